@@ -40,6 +40,7 @@
 #include <libgen.h>
 #include <ctype.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <wayland-client.h>
 #include "window.h"
@@ -68,6 +69,23 @@ struct desktop {
 	enum cursor_type grab_cursor;
 
 	int painted;
+
+	/* Launcher icons, shared by the panels of all outputs. They are
+	 * decoded in batches on 'icon_loader', which hands each one back
+	 * through 'icon_pipe' as it is done, followed by a NULL. */
+	struct wl_list icons;
+	pthread_t icon_loader;
+	int icon_loader_busy;
+	struct wl_array icon_batch; /* owned by icon_loader while busy */
+	int icon_pipe[2];
+	struct task icon_task;
+};
+
+struct launcher_icon {
+	char *path;
+	cairo_surface_t *surface;
+	int loading;
+	struct wl_list link;
 };
 
 struct surface {
@@ -96,6 +114,16 @@ struct background {
 	char *image;
 	int type;
 	uint32_t color;
+
+	/* The decoded image, and the size it was decoded for */
+	cairo_surface_t *cached;
+	int cached_width, cached_height;
+
+	/* Decoding runs on 'loader' between configure and draw */
+	pthread_t loader;
+	int loading;
+	int load_width, load_height;
+	cairo_surface_t *loaded;
 };
 
 struct output {
@@ -110,7 +138,8 @@ struct output {
 struct panel_launcher {
 	struct widget *widget;
 	struct panel *panel;
-	cairo_surface_t *icon;
+	struct launcher_icon *icon_entry;
+	cairo_surface_t *icon; /* NULL until its entry is decoded */
 	int focused, pressed;
 	char *path;
 	struct wl_list link;
@@ -208,6 +237,9 @@ panel_launcher_redraw_handler(struct widget *widget, void *data)
 	struct rectangle allocation;
 	cairo_t *cr;
 
+	if (!launcher->icon)
+		return;
+
 	cr = widget_cairo_create(launcher->panel->widget);
 
 	widget_get_allocation(widget, &allocation);
@@ -446,6 +478,12 @@ panel_resize_handler(struct widget *widget,
 	x = 10;
 	y = 16;
 	wl_list_for_each(launcher, &panel->launcher_list, link) {
+		/* launchers get their slot once the icon is there */
+		if (!launcher->icon) {
+			widget_set_allocation(launcher->widget, x, y, 0, 0);
+			continue;
+		}
+
 		w = cairo_image_surface_get_width(launcher->icon);
 		h = cairo_image_surface_get_height(launcher->icon);
 		widget_set_allocation(launcher->widget,
@@ -480,7 +518,8 @@ panel_destroy_launcher(struct panel_launcher *launcher)
 
 	free(launcher->path);
 
-	cairo_surface_destroy(launcher->icon);
+	if (launcher->icon)
+		cairo_surface_destroy(launcher->icon);
 
 	widget_destroy(launcher->widget);
 	wl_list_remove(&launcher->link);
@@ -572,15 +611,205 @@ load_icon_or_fallback(const char *icon)
 	return surface;
 }
 
+static struct launcher_icon *
+desktop_get_icon(struct desktop *desktop, const char *path)
+{
+	struct launcher_icon *icon;
+
+	wl_list_for_each(icon, &desktop->icons, link)
+		if (strcmp(icon->path, path) == 0)
+			return icon;
+
+	icon = xzalloc(sizeof *icon);
+	icon->path = xstrdup(path);
+	wl_list_insert(desktop->icons.prev, &icon->link);
+
+	return icon;
+}
+
+static void
+icon_loader_send(struct desktop *desktop, struct launcher_icon *icon)
+{
+	if (write(desktop->icon_pipe[1], &icon, sizeof icon) < 0)
+		fprintf(stderr, "icon loader: write failed: %m\n");
+}
+
+static void *
+icon_load_thread(void *data)
+{
+	struct desktop *desktop = data;
+	struct launcher_icon **icon;
+
+	wl_array_for_each(icon, &desktop->icon_batch) {
+		(*icon)->surface = load_icon_or_fallback((*icon)->path);
+		icon_loader_send(desktop, *icon);
+	}
+	icon_loader_send(desktop, NULL);
+
+	return NULL;
+}
+
+static void
+panel_relayout(struct panel *panel)
+{
+	struct rectangle allocation;
+
+	widget_get_allocation(panel->widget, &allocation);
+	if (allocation.width == 0)
+		return;
+
+	panel_resize_handler(panel->widget,
+			     allocation.width, allocation.height, panel);
+	widget_schedule_redraw(panel->widget);
+}
+
+static void
+desktop_install_icon(struct desktop *desktop, struct launcher_icon *icon)
+{
+	struct output *output;
+	struct panel_launcher *launcher;
+	int changed;
+
+	icon->loading = 0;
+
+	wl_list_for_each(output, &desktop->outputs, link) {
+		if (!output->panel)
+			continue;
+
+		changed = 0;
+		wl_list_for_each(launcher, &output->panel->launcher_list, link) {
+			if (launcher->icon || launcher->icon_entry != icon)
+				continue;
+
+			launcher->icon = cairo_surface_reference(icon->surface);
+			changed = 1;
+		}
+
+		if (changed)
+			panel_relayout(output->panel);
+	}
+}
+
+/* Hand the icons nobody has asked the loader for yet to a new loader
+ * thread. If one is still running, this is called again when it has
+ * finished its batch. */
+static void
+desktop_load_icons(struct desktop *desktop)
+{
+	struct launcher_icon *icon, **p;
+
+	if (desktop->icon_loader_busy)
+		return;
+
+	desktop->icon_batch.size = 0;
+	wl_list_for_each(icon, &desktop->icons, link) {
+		if (icon->surface || icon->loading)
+			continue;
+
+		p = wl_array_add(&desktop->icon_batch, sizeof *p);
+		if (!p)
+			break;
+		*p = icon;
+		icon->loading = 1;
+	}
+
+	if (desktop->icon_batch.size == 0)
+		return;
+
+	if (desktop->icon_pipe[0] >= 0 &&
+	    pthread_create(&desktop->icon_loader, NULL,
+			   icon_load_thread, desktop) == 0) {
+		desktop->icon_loader_busy = 1;
+		return;
+	}
+
+	wl_array_for_each(p, &desktop->icon_batch) {
+		(*p)->surface = load_icon_or_fallback((*p)->path);
+		desktop_install_icon(desktop, *p);
+	}
+}
+
+static void
+icon_loader_func(struct task *task, uint32_t events)
+{
+	struct desktop *desktop =
+		container_of(task, struct desktop, icon_task);
+	struct launcher_icon *icons[16];
+	ssize_t len;
+	size_t i;
+
+	len = read(desktop->icon_pipe[0], icons, sizeof icons);
+	if (len <= 0)
+		return;
+
+	for (i = 0; i < len / sizeof icons[0]; i++) {
+		if (icons[i]) {
+			desktop_install_icon(desktop, icons[i]);
+			continue;
+		}
+
+		pthread_join(desktop->icon_loader, NULL);
+		desktop->icon_loader_busy = 0;
+		desktop_load_icons(desktop);
+	}
+}
+
+static void
+desktop_init_icons(struct desktop *desktop)
+{
+	wl_list_init(&desktop->icons);
+	wl_array_init(&desktop->icon_batch);
+
+	if (pipe2(desktop->icon_pipe, O_CLOEXEC) < 0) {
+		fprintf(stderr, "could not create icon pipe: %m\n");
+		desktop->icon_pipe[0] = -1;
+		desktop->icon_pipe[1] = -1;
+		return;
+	}
+
+	desktop->icon_task.run = icon_loader_func;
+	display_watch_fd(desktop->display, desktop->icon_pipe[0],
+			 EPOLLIN, &desktop->icon_task);
+}
+
+static void
+desktop_destroy_icons(struct desktop *desktop)
+{
+	struct launcher_icon *icon, *tmp;
+
+	if (desktop->icon_loader_busy)
+		pthread_join(desktop->icon_loader, NULL);
+
+	if (desktop->icon_pipe[0] >= 0) {
+		display_unwatch_fd(desktop->display, desktop->icon_pipe[0]);
+		close(desktop->icon_pipe[0]);
+		close(desktop->icon_pipe[1]);
+	}
+
+	wl_list_for_each_safe(icon, tmp, &desktop->icons, link) {
+		if (icon->surface)
+			cairo_surface_destroy(icon->surface);
+		free(icon->path);
+		free(icon);
+	}
+
+	wl_array_release(&desktop->icon_batch);
+}
+
 static void
 panel_add_launcher(struct panel *panel, const char *icon, const char *path)
 {
+	struct desktop *desktop =
+		display_get_user_data(window_get_display(panel->window));
 	struct panel_launcher *launcher;
 	char *start, *p, *eq, **ps;
 	int i, j, k;
 
 	launcher = xzalloc(sizeof *launcher);
-	launcher->icon = load_icon_or_fallback(icon);
+	launcher->icon_entry = desktop_get_icon(desktop, icon);
+	if (launcher->icon_entry->surface)
+		launcher->icon =
+			cairo_surface_reference(launcher->icon_entry->surface);
 	launcher->path = xstrdup(path);
 
 	wl_array_init(&launcher->envp);
@@ -652,6 +881,106 @@ enum {
 	BACKGROUND_TILE
 };
 
+static const char *
+background_get_image_path(struct background *background)
+{
+	if (background->type == -1)
+		return NULL;
+	if (background->image)
+		return background->image;
+	if (background->color == 0)
+		return DATADIR "/weston/pattern.png";
+
+	return NULL;
+}
+
+/* Scaled backgrounds never need more pixels than the buffer has, so
+ * the decoder is allowed to shrink them; tiles are used as is. */
+static void
+background_get_decode_size(struct background *background,
+			   int32_t width, int32_t height,
+			   int *decode_width, int *decode_height)
+{
+	int32_t scale = window_get_buffer_scale(background->window);
+
+	if (background->type == BACKGROUND_TILE) {
+		*decode_width = 0;
+		*decode_height = 0;
+	} else {
+		*decode_width = width * scale;
+		*decode_height = height * scale;
+	}
+}
+
+static void *
+background_load_thread(void *data)
+{
+	struct background *background = data;
+
+	background->loaded =
+		load_cairo_surface_scaled(background_get_image_path(background),
+					  background->load_width,
+					  background->load_height);
+
+	return NULL;
+}
+
+static void
+background_take_loaded(struct background *background)
+{
+	if (background->cached)
+		cairo_surface_destroy(background->cached);
+	background->cached = background->loaded;
+	background->cached_width = background->load_width;
+	background->cached_height = background->load_height;
+	background->loaded = NULL;
+}
+
+static void
+background_finish_load(struct background *background)
+{
+	if (!background->loading)
+		return;
+
+	pthread_join(background->loader, NULL);
+	background->loading = 0;
+	background_take_loaded(background);
+}
+
+/* Start decoding the image for a width x height buffer on a separate
+ * thread, unless the image we already have is good enough. */
+static void
+background_start_load(struct background *background,
+		      int32_t width, int32_t height)
+{
+	int decode_width, decode_height;
+
+	if (!background_get_image_path(background))
+		return;
+
+	background_get_decode_size(background, width, height,
+				   &decode_width, &decode_height);
+
+	background_finish_load(background);
+	if (background->cached &&
+	    (background->cached_width == 0 ||
+	     (background->cached_width >= decode_width &&
+	      background->cached_height >= decode_height)))
+		return;
+
+	background->load_width = decode_width;
+	background->load_height = decode_height;
+	background->loaded = NULL;
+	if (pthread_create(&background->loader, NULL,
+			   background_load_thread, background) == 0) {
+		background->loading = 1;
+		return;
+	}
+
+	background_load_thread(background);
+	background_take_loaded(background);
+}
+
 static void
 background_draw(struct widget *widget, void *data)
 {
@@ -673,13 +1002,11 @@ background_draw(struct widget *widget, void *data)
 	cairo_paint(cr);
 
 	widget_get_allocation(widget, &allocation);
-	image = NULL;
-	if (background->image)
-		image = load_cairo_surface(background->image);
-	else if (background->color == 0)
-		image = load_cairo_surface(DATADIR "/weston/pattern.png");
+	background_start_load(background, allocation.width, allocation.height);
+	background_finish_load(background);
+	image = background->cached;
 
-	if (image && background->type != -1) {
+	if (image) {
 		im_w = cairo_image_surface_get_width(image);
 		im_h = cairo_image_surface_get_height(image);
 		sx = im_w / allocation.width;
@@ -710,7 +1037,6 @@ background_draw(struct widget *widget, void *data)
 
 		cairo_set_source(cr, pattern);
 		cairo_pattern_destroy (pattern);
-		cairo_surface_destroy(image);
 	} else {
 		set_hex_color(cr, background->color);
 	}
@@ -732,6 +1058,7 @@ background_configure(void *data,
 	struct background *background =
 		(struct background *) window_get_user_data(window);
 
+	background_start_load(background, width, height);
 	widget_schedule_resize(background->widget, width, height);
 }
 
@@ -996,6 +1323,10 @@ static const struct desktop_shell_listener listener = {
 static void
 background_destroy(struct background *background)
 {
+	background_finish_load(background);
+	if (background->cached)
+		cairo_surface_destroy(background->cached);
+
 	widget_destroy(background->widget);
 	window_destroy(background->window);
 
@@ -1186,17 +1517,21 @@ output_init(struct output *output, struct desktop *desktop)
 {
 	struct wl_surface *surface;
 
+	/* The background goes first, it is what the fade-in reveals.
+	 * The panel comes up without launcher icons, those are decoded
+	 * on a separate thread and appear as they are ready. */
+	output->background = background_create(desktop);
+	surface = window_get_wl_surface(output->background->window);
+	desktop_shell_set_background(desktop->shell,
+				     output->output, surface);
+
 	if (want_panel(desktop)) {
 		output->panel = panel_create(desktop);
 		surface = window_get_wl_surface(output->panel->window);
 		desktop_shell_set_panel(desktop->shell,
 					output->output, surface);
+		desktop_load_icons(desktop);
 	}
-
-	output->background = background_create(desktop);
-	surface = window_get_wl_surface(output->background->window);
-	desktop_shell_set_background(desktop->shell,
-				     output->output, surface);
 }
 
 static void
@@ -1314,6 +1649,7 @@ int main(int argc, char *argv[])
 	}
 
 	display_set_user_data(desktop.display, &desktop);
+	desktop_init_icons(&desktop);
 	display_set_global_handler(desktop.display, global_handler);
 	display_set_global_handler_remove(desktop.display, global_handler_remove);
 
@@ -1332,6 +1668,7 @@ int main(int argc, char *argv[])
 	/* Cleanup */
 	grab_surface_destroy(&desktop);
 	desktop_destroy_outputs(&desktop);
+	desktop_destroy_icons(&desktop);
 	if (desktop.unlock_dialog)
 		unlock_dialog_destroy(desktop.unlock_dialog);
 	desktop_shell_destroy(desktop.shell);
@@ -25,6 +25,7 @@
 #include "config.h"
 
 #include <assert.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -40,6 +41,18 @@
 #include "window.h"
 #include "text-client-protocol.h"
 
+/* The text is laid out one paragraph at a time, so an edit only lays
+ * out the paragraphs it touched again.  Offsets are in bytes into the
+ * displayed text, preedit included, and y and height in Pango units. */
+struct text_paragraph {
+	PangoLayout *layout;
+	uint32_t start;
+	uint32_t length;
+	int y;
+	int height;
+	bool decorated;
+};
+
 struct text_entry {
 	struct widget *widget;
 	struct window *window;
@@ -65,7 +78,15 @@ struct text_entry {
 		bool invalid_delete;
 	} pending_commit;
 	struct wl_text_input *text_input;
-	PangoLayout *layout;
+	PangoContext *pango;
+	guint pango_serial;
+	struct text_paragraph *paragraphs;
+	int paragraph_count;
+	int text_height;
+	struct {
+		int32_t y;
+		int32_t height;
+	} drawn_cursor;
 	struct {
 		xkb_mod_mask_t shift_mask;
 	} keysym;
@@ -179,6 +200,9 @@ static void text_entry_reset_preedit(struct text_entry *entry);
 static void text_entry_commit_and_reset(struct text_entry *entry);
 static void text_entry_get_cursor_rectangle(struct text_entry *entry, struct rectangle *rectangle);
 static void text_entry_update(struct text_entry *entry);
+static void text_entry_update_layout(struct text_entry *entry);
+static void text_entry_schedule_redraw(struct text_entry *entry);
+static void text_entry_context_changed(struct text_entry *entry);
 
 static void
 text_input_commit_string(void *data,
@@ -216,7 +240,7 @@ text_input_commit_string(void *data,
 
 	memset(&entry->pending_commit, 0, sizeof entry->pending_commit);
 
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 }
 
 static void
@@ -270,7 +294,7 @@ text_input_preedit_string(void *data,
 
 	text_entry_update(entry);
 
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 }
 
 static void
@@ -409,7 +433,7 @@ text_input_keysym(void *data,
 
 		if (!(modifiers & entry->keysym.shift_mask))
 			entry->anchor = entry->cursor;
-		widget_schedule_redraw(entry->widget);
+		text_entry_schedule_redraw(entry);
 
 		return;
 	}
@@ -426,7 +450,7 @@ text_input_keysym(void *data,
 
 		if (!(modifiers & entry->keysym.shift_mask))
 			entry->anchor = entry->cursor;
-		widget_schedule_redraw(entry->widget);
+		text_entry_schedule_redraw(entry);
 
 		return;
 	}
@@ -524,7 +548,6 @@ text_input_text_direction(void *data,
 			  uint32_t direction)
 {
 	struct text_entry *entry = data;
-	PangoContext *context = pango_layout_get_context(entry->layout);
 	PangoDirection pango_direction;
 
 
@@ -540,7 +563,9 @@ text_input_text_direction(void *data,
 			pango_direction = PANGO_DIRECTION_NEUTRAL;
 	}
 
-	pango_context_set_base_dir(context, pango_direction);
+	pango_context_set_base_dir(entry->pango, pango_direction);
+	text_entry_context_changed(entry);
+	widget_schedule_redraw(entry->widget);
 }
 
 static const struct wl_text_input_listener text_input_listener = {
@@ -698,6 +723,11 @@ text_entry_create(struct editor *editor, const char *text)
 	entry->text_input = wl_text_input_manager_create_text_input(editor->text_input_manager);
 	wl_text_input_add_listener(entry->text_input, &text_input_listener, entry);
 
+	/* font options are picked up from the surface when drawing */
+	entry->pango = pango_font_map_create_context(pango_cairo_font_map_get_default());
+	entry->pango_serial = pango_context_get_serial(entry->pango);
+	text_entry_update_layout(entry);
+
 	widget_set_redraw_handler(entry->widget, text_entry_redraw_handler);
 	widget_set_button_handler(entry->widget, text_entry_button_handler);
 	widget_set_motion_handler(entry->widget, text_entry_motion_handler);
@@ -709,9 +739,14 @@ text_entry_create(struct editor *editor, const char *text)
 static void
 text_entry_destroy(struct text_entry *entry)
 {
+	int i;
+
 	widget_destroy(entry->widget);
 	wl_text_input_destroy(entry->text_input);
-	g_clear_object(&entry->layout);
+	for (i = 0; i < entry->paragraph_count; i++)
+		g_object_unref(entry->paragraphs[i].layout);
+	free(entry->paragraphs);
+	g_object_unref(entry->pango);
 	free(entry->text);
 	free(entry);
 }
@@ -720,14 +755,14 @@ static void
 redraw_handler(struct widget *widget, void *data)
 {
 	struct editor *editor = data;
-	cairo_surface_t *surface;
 	struct rectangle allocation;
 	cairo_t *cr;
 
-	surface = window_get_surface(editor->window);
 	widget_get_allocation(editor->widget, &allocation);
 
-	cr = cairo_create(surface);
+	/* clipped to the redrawn area, so entries which are not
+	 * redrawn are not painted over */
+	cr = widget_cairo_create(editor->widget);
 	cairo_rectangle(cr, allocation.x, allocation.y, allocation.width, allocation.height);
 	cairo_clip(cr);
 
@@ -744,7 +779,6 @@ redraw_handler(struct widget *widget, void *data)
 	cairo_paint(cr);
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
 }
 
 static void
@@ -799,11 +833,22 @@ text_entry_deactivate(struct text_entry *entry,
 				 seat);
 }
 
-static void
-text_entry_update_layout(struct text_entry *entry)
+static int
+text_offset_left(struct rectangle *allocation)
+{
+	return 10;
+}
+
+static int
+text_offset_top(struct rectangle *allocation)
+{
+	return allocation->height / 2;
+}
+
+static char *
+text_entry_get_display_text(struct text_entry *entry)
 {
 	char *text;
-	PangoAttrList *attr_list;
 
 	assert(entry->cursor <= (strlen(entry->text) +
 	       (entry->preedit.text ? strlen(entry->preedit.text) : 0)));
@@ -818,6 +863,14 @@ text_entry_update_layout(struct text_entry *entry)
 		text = strdup(entry->text);
 	}
 
+	return text;
+}
+
+static PangoAttrList *
+text_entry_get_attributes(struct text_entry *entry)
+{
+	PangoAttrList *attr_list;
+
 	if (entry->cursor != entry->anchor) {
 		int start_index = MIN(entry->cursor, entry->anchor);
 		int end_index = MAX(entry->cursor, entry->anchor);
@@ -853,15 +906,310 @@ text_entry_update_layout(struct text_entry *entry)
 		pango_attr_list_insert(attr_list, attr);
 	}
 
-	if (entry->layout) {
-		pango_layout_set_text(entry->layout, text, -1);
-		pango_layout_set_attributes(entry->layout, attr_list);
+	return attr_list;
+}
+
+struct paragraph_attrs {
+	PangoAttrList *attr_list;
+	uint32_t start;
+	uint32_t end;
+};
+
+static gboolean
+paragraph_attrs_filter(PangoAttribute *attr, gpointer data)
+{
+	struct paragraph_attrs *attrs = data;
+	PangoAttribute *copy;
+
+	if (attr->end_index <= attrs->start || attr->start_index >= attrs->end)
+		return FALSE;
+
+	copy = pango_attribute_copy(attr);
+	copy->start_index = MAX(attr->start_index, attrs->start) - attrs->start;
+	copy->end_index = MIN(attr->end_index, attrs->end) - attrs->start;
+
+	if (!attrs->attr_list)
+		attrs->attr_list = pango_attr_list_new();
+	pango_attr_list_insert(attrs->attr_list, copy);
+
+	/* the attribute stays in the list of the whole text */
+	return FALSE;
+}
+
+/* Returns the attributes of attr_list that apply to a paragraph,
+ * relative to its start, or NULL if there are none */
+static PangoAttrList *
+paragraph_get_attributes(PangoAttrList *attr_list,
+			 const struct text_paragraph *paragraph)
+{
+	struct paragraph_attrs attrs;
+
+	if (!attr_list)
+		return NULL;
+
+	attrs.attr_list = NULL;
+	attrs.start = paragraph->start;
+	attrs.end = paragraph->start + paragraph->length;
+	pango_attr_list_filter(attr_list, paragraph_attrs_filter, &attrs);
+
+	return attrs.attr_list;
+}
+
+static bool
+paragraph_has_text(const struct text_paragraph *paragraph,
+		   const char *text, uint32_t length)
+{
+	return paragraph->length == length &&
+	       memcmp(pango_layout_get_text(paragraph->layout),
+		      text, length) == 0;
+}
+
+/* Redraws the band of the text between y and y + height, in Pango
+ * units from the top of the text */
+static void
+text_entry_damage(struct text_entry *entry, int y, int height)
+{
+	struct rectangle allocation, area;
+
+	widget_get_allocation(entry->widget, &allocation);
+
+	area.x = allocation.x;
+	area.y = allocation.y + text_offset_top(&allocation) +
+		 PANGO_PIXELS_FLOOR(y);
+	area.width = allocation.width;
+	area.height = PANGO_PIXELS_CEIL(y + height) - PANGO_PIXELS_FLOOR(y);
+	widget_schedule_redraw_area(entry->widget, &area);
+}
+
+/** Lay out the paragraphs that changed since the last update
+ *
+ * \param entry The text entry.
+ *
+ * Paragraphs before and after the edited ones, and without
+ * attributes, keep their layout.  The lines whose layout or position
+ * changed are damaged.
+ */
+static void
+text_entry_update_layout(struct text_entry *entry)
+{
+	struct text_paragraph *old = entry->paragraphs;
+	struct text_paragraph *paragraphs, *p, *src;
+	int old_count = entry->paragraph_count;
+	int old_height = entry->text_height;
+	int count, prefix, suffix, i, y, first, last;
+	PangoAttrList *attr_list, *attrs;
+	PangoRectangle logical;
+	char *text, *line, *end;
+	bool kept, relayout;
+
+	text = text_entry_get_display_text(entry);
+	attr_list = text_entry_get_attributes(entry);
+
+	count = 1;
+	for (line = strchr(text, '\n'); line; line = strchr(line + 1, '\n'))
+		count++;
+
+	paragraphs = xzalloc(count * sizeof *paragraphs);
+	line = text;
+	for (i = 0; i < count; i++) {
+		end = strchr(line, '\n');
+		if (!end)
+			end = line + strlen(line);
+		paragraphs[i].start = line - text;
+		paragraphs[i].length = end - line;
+		line = end + 1;
+	}
+
+	/* an edit leaves the paragraphs around it untouched */
+	prefix = 0;
+	while (prefix < count && prefix < old_count &&
+	       paragraph_has_text(&old[prefix],
+				  text + paragraphs[prefix].start,
+				  paragraphs[prefix].length))
+		prefix++;
+
+	suffix = 0;
+	while (suffix < count - prefix && suffix < old_count - prefix &&
+	       paragraph_has_text(&old[old_count - 1 - suffix],
+				  text + paragraphs[count - 1 - suffix].start,
+				  paragraphs[count - 1 - suffix].length))
+		suffix++;
+
+	first = INT_MAX;
+	last = INT_MIN;
+	y = 0;
+	for (i = 0; i < count; i++) {
+		p = &paragraphs[i];
+		kept = i < prefix || i >= count - suffix;
+
+		if (i >= count - suffix)
+			src = &old[i - count + old_count];
+		else if (i < old_count - suffix)
+			src = &old[i];
+		else
+			src = NULL;
+
+		if (src) {
+			p->layout = src->layout;
+			src->layout = NULL;
+		} else {
+			p->layout = pango_layout_new(entry->pango);
+		}
+
+		if (!kept)
+			pango_layout_set_text(p->layout, text + p->start,
+					      p->length);
+
+		attrs = paragraph_get_attributes(attr_list, p);
+		p->decorated = attrs != NULL;
+		relayout = !kept || p->decorated || src->decorated;
+		if (relayout)
+			pango_layout_set_attributes(p->layout, attrs);
+		if (attrs)
+			pango_attr_list_unref(attrs);
+
+		pango_layout_get_extents(p->layout, NULL, &logical);
+		p->y = y;
+		p->height = logical.height;
+		y += p->height;
+
+		if (relayout || src->y != p->y || src->height != p->height) {
+			first = MIN(first, p->y);
+			last = MAX(last, p->y + p->height);
+		}
 	}
 
+	/* lines removed from the end */
+	if (y < old_height) {
+		first = MIN(first, y);
+		last = MAX(last, old_height);
+	}
+
+	for (i = 0; i < old_count; i++)
+		if (old[i].layout)
+			g_object_unref(old[i].layout);
+	free(old);
+
+	entry->paragraphs = paragraphs;
+	entry->paragraph_count = count;
+	entry->text_height = y;
+
+	if (first < last)
+		text_entry_damage(entry, first, last - first);
+
 	free(text);
 	pango_attr_list_unref(attr_list);
 }
 
+/* The font options or the base direction changed, which affects all
+ * of the paragraphs */
+static void
+text_entry_context_changed(struct text_entry *entry)
+{
+	struct text_paragraph *p;
+	PangoRectangle logical;
+	int i, y = 0;
+
+	entry->pango_serial = pango_context_get_serial(entry->pango);
+
+	for (i = 0; i < entry->paragraph_count; i++) {
+		p = &entry->paragraphs[i];
+		pango_layout_context_changed(p->layout);
+		pango_layout_get_extents(p->layout, NULL, &logical);
+		p->y = y;
+		p->height = logical.height;
+		y += p->height;
+	}
+
+	entry->text_height = y;
+}
+
+static struct text_paragraph *
+text_entry_paragraph_at_index(struct text_entry *entry, uint32_t index)
+{
+	int lo = 0, hi = entry->paragraph_count - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (entry->paragraphs[mid].start <= index)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return &entry->paragraphs[lo];
+}
+
+static struct text_paragraph *
+text_entry_paragraph_at_y(struct text_entry *entry, int y)
+{
+	int lo = 0, hi = entry->paragraph_count - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (entry->paragraphs[mid].y <= y)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return &entry->paragraphs[lo];
+}
+
+/* Returns the byte index in the displayed text under a point, in
+ * pixels from the top left of the text */
+static uint32_t
+text_entry_xy_to_index(struct text_entry *entry, int32_t x, int32_t y)
+{
+	struct text_paragraph *p;
+	int index, trailing;
+	const char *text;
+
+	p = text_entry_paragraph_at_y(entry, y * PANGO_SCALE);
+	pango_layout_xy_to_index(p->layout,
+				 x * PANGO_SCALE, y * PANGO_SCALE - p->y,
+				 &index, &trailing);
+
+	text = pango_layout_get_text(p->layout);
+
+	return p->start + (g_utf8_offset_to_pointer(text + index, trailing) - text);
+}
+
+/* Returns false if the preedit hides the cursor */
+static bool
+text_entry_get_cursor_pos(struct text_entry *entry, PangoRectangle *pos)
+{
+	struct text_paragraph *p;
+	uint32_t index;
+
+	if (entry->preedit.text && entry->preedit.cursor < 0)
+		return false;
+
+	index = entry->cursor + entry->preedit.cursor;
+	p = text_entry_paragraph_at_index(entry, index);
+	pango_layout_get_cursor_pos(p->layout, index - p->start, pos, NULL);
+	pos->y += p->y;
+
+	return true;
+}
+
+/* Redraws the lines that changed, and where the cursor was and is */
+static void
+text_entry_schedule_redraw(struct text_entry *entry)
+{
+	PangoRectangle cursor_pos;
+
+	text_entry_update_layout(entry);
+
+	if (entry->drawn_cursor.height > 0)
+		text_entry_damage(entry,
+				  entry->drawn_cursor.y * PANGO_SCALE,
+				  entry->drawn_cursor.height * PANGO_SCALE);
+
+	if (text_entry_get_cursor_pos(entry, &cursor_pos))
+		text_entry_damage(entry, cursor_pos.y, cursor_pos.height);
+}
+
 static void
 text_entry_update(struct text_entry *entry)
 {
@@ -910,9 +1258,7 @@ text_entry_insert_at_cursor(struct text_entry *entry, const char *text,
 	else
 		entry->cursor += 1 + cursor;
 
-	text_entry_update_layout(entry);
-
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 
 	text_entry_update(entry);
 }
@@ -964,9 +1310,7 @@ text_entry_set_preedit(struct text_entry *entry,
 	entry->preedit.text = strdup(preedit_text);
 	entry->preedit.cursor = preedit_cursor;
 
-	text_entry_update_layout(entry);
-
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 }
 
 static uint32_t
@@ -975,19 +1319,12 @@ text_entry_try_invoke_preedit_action(struct text_entry *entry,
 				     uint32_t button,
 				     enum wl_pointer_button_state state)
 {
-	int index, trailing;
 	uint32_t cursor;
-	const char *text;
 
 	if (!entry->preedit.text)
 		return 0;
 
-	pango_layout_xy_to_index(entry->layout,
-				 x * PANGO_SCALE, y * PANGO_SCALE,
-				 &index, &trailing);
-
-	text = pango_layout_get_text(entry->layout);
-	cursor = g_utf8_offset_to_pointer(text + index, trailing) - text;
+	cursor = text_entry_xy_to_index(entry, x, y);
 
 	if (cursor < entry->cursor ||
 	    cursor > entry->cursor + strlen(entry->preedit.text)) {
@@ -1013,17 +1350,9 @@ text_entry_set_cursor_position(struct text_entry *entry,
 			       int32_t x, int32_t y,
 			       bool move_anchor)
 {
-	int index, trailing;
-	const char *text;
 	uint32_t cursor;
 
-	pango_layout_xy_to_index(entry->layout,
-				 x * PANGO_SCALE, y * PANGO_SCALE,
-				 &index, &trailing);
-
-	text = pango_layout_get_text(entry->layout);
-
-	cursor = g_utf8_offset_to_pointer(text + index, trailing) - text;
+	cursor = text_entry_xy_to_index(entry, x, y);
 
 	if (move_anchor)
 		entry->anchor = cursor;
@@ -1039,9 +1368,7 @@ text_entry_set_cursor_position(struct text_entry *entry,
 
 	entry->cursor = cursor;
 
-	text_entry_update_layout(entry);
-
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 
 	text_entry_update(entry);
 }
@@ -1068,9 +1395,7 @@ text_entry_delete_text(struct text_entry *entry,
 
 	entry->anchor = entry->cursor;
 
-	text_entry_update_layout(entry);
-
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 
 	text_entry_update(entry);
 }
@@ -1093,12 +1418,11 @@ static void
 text_entry_get_cursor_rectangle(struct text_entry *entry, struct rectangle *rectangle)
 {
 	struct rectangle allocation;
-	PangoRectangle extents;
 	PangoRectangle cursor_pos;
 
 	widget_get_allocation(entry->widget, &allocation);
 
-	if (entry->preedit.text && entry->preedit.cursor < 0) {
+	if (!text_entry_get_cursor_pos(entry, &cursor_pos)) {
 		rectangle->x = 0;
 		rectangle->y = 0;
 		rectangle->width = 0;
@@ -1106,12 +1430,6 @@ text_entry_get_cursor_rectangle(struct text_entry *entry, struct rectangle *rect
 		return;
 	}
 
-
-	pango_layout_get_extents(entry->layout, &extents, NULL);
-	pango_layout_get_cursor_pos(entry->layout,
-				    entry->cursor + entry->preedit.cursor,
-				    &cursor_pos, NULL);
-
 	rectangle->x = allocation.x + (allocation.height / 2) + PANGO_PIXELS(cursor_pos.x);
 	rectangle->y = allocation.y + 10 + PANGO_PIXELS(cursor_pos.y);
 	rectangle->width = PANGO_PIXELS(cursor_pos.width);
@@ -1121,47 +1439,35 @@ text_entry_get_cursor_rectangle(struct text_entry *entry, struct rectangle *rect
 static void
 text_entry_draw_cursor(struct text_entry *entry, cairo_t *cr)
 {
-	PangoRectangle extents;
 	PangoRectangle cursor_pos;
 
-	if (entry->preedit.text && entry->preedit.cursor < 0)
+	if (!text_entry_get_cursor_pos(entry, &cursor_pos)) {
+		entry->drawn_cursor.height = 0;
 		return;
-
-	pango_layout_get_extents(entry->layout, &extents, NULL);
-	pango_layout_get_cursor_pos(entry->layout,
-				    entry->cursor + entry->preedit.cursor,
-				    &cursor_pos, NULL);
+	}
 
 	cairo_set_line_width(cr, 1.0);
 	cairo_move_to(cr, PANGO_PIXELS(cursor_pos.x), PANGO_PIXELS(cursor_pos.y));
 	cairo_line_to(cr, PANGO_PIXELS(cursor_pos.x), PANGO_PIXELS(cursor_pos.y) + PANGO_PIXELS(cursor_pos.height));
 	cairo_stroke(cr);
-}
 
-static int
-text_offset_left(struct rectangle *allocation)
-{
-	return 10;
-}
-
-static int
-text_offset_top(struct rectangle *allocation)
-{
-	return allocation->height / 2;
+	entry->drawn_cursor.y = PANGO_PIXELS(cursor_pos.y);
+	entry->drawn_cursor.height = PANGO_PIXELS(cursor_pos.height);
 }
 
 static void
 text_entry_redraw_handler(struct widget *widget, void *data)
 {
 	struct text_entry *entry = data;
-	cairo_surface_t *surface;
+	struct text_paragraph *p;
 	struct rectangle allocation;
+	double x1, y1, x2, y2;
 	cairo_t *cr;
+	int i;
 
-	surface = window_get_surface(entry->window);
 	widget_get_allocation(entry->widget, &allocation);
 
-	cr = cairo_create(surface);
+	cr = widget_cairo_create(entry->widget);
 	cairo_rectangle(cr, allocation.x, allocation.y, allocation.width, allocation.height);
 	cairo_clip(cr);
 
@@ -1189,14 +1495,26 @@ text_entry_redraw_handler(struct widget *widget, void *data)
 			text_offset_left(&allocation),
 			text_offset_top(&allocation));
 
-	if (!entry->layout)
-		entry->layout = pango_cairo_create_layout(cr);
-	else
-		pango_cairo_update_layout(cr, entry->layout);
+	pango_cairo_update_context(cr, entry->pango);
+	if (pango_context_get_serial(entry->pango) != entry->pango_serial) {
+		text_entry_context_changed(entry);
+		widget_schedule_redraw(entry->widget);
+	}
 
 	text_entry_update_layout(entry);
 
-	pango_cairo_show_layout(cr, entry->layout);
+	/* only the paragraphs in the redrawn area are drawn */
+	cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+	for (i = 0; i < entry->paragraph_count; i++) {
+		p = &entry->paragraphs[i];
+		if (PANGO_PIXELS_CEIL(p->y + p->height) < y1)
+			continue;
+		if (PANGO_PIXELS_FLOOR(p->y) > y2)
+			break;
+
+		cairo_move_to(cr, 0, (double) p->y / PANGO_SCALE);
+		pango_cairo_show_layout(cr, p->layout);
+	}
 
 	text_entry_draw_cursor(entry, cr);
 
@@ -1204,7 +1522,6 @@ text_entry_redraw_handler(struct widget *widget, void *data)
 	cairo_paint(cr);
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
 }
 
 static int
@@ -1421,7 +1738,7 @@ key_handler(struct window *window,
 				entry->cursor = new_char - entry->text;
 				if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 					entry->anchor = entry->cursor;
-				widget_schedule_redraw(entry->widget);
+				text_entry_schedule_redraw(entry);
 			}
 			break;
 		case XKB_KEY_Right:
@@ -1432,7 +1749,7 @@ key_handler(struct window *window,
 				entry->cursor = new_char - entry->text;
 				if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 					entry->anchor = entry->cursor;
-				widget_schedule_redraw(entry->widget);
+				text_entry_schedule_redraw(entry);
 			}
 			break;
 		case XKB_KEY_Up:
@@ -1441,7 +1758,7 @@ key_handler(struct window *window,
 			move_up(entry->text, &entry->cursor);
 			if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 				entry->anchor = entry->cursor;
-			widget_schedule_redraw(entry->widget);
+			text_entry_schedule_redraw(entry);
 			break;
 		case XKB_KEY_Down:
 			text_entry_commit_and_reset(entry);
@@ -1449,7 +1766,7 @@ key_handler(struct window *window,
 			move_down(entry->text, &entry->cursor);
 			if (!(input_get_modifiers(input) & MOD_SHIFT_MASK))
 				entry->anchor = entry->cursor;
-			widget_schedule_redraw(entry->widget);
+			text_entry_schedule_redraw(entry);
 			break;
 		case XKB_KEY_Escape:
 			break;
@@ -1463,7 +1780,7 @@ key_handler(struct window *window,
 			break;
 	}
 
-	widget_schedule_redraw(entry->widget);
+	text_entry_schedule_redraw(entry);
 }
 
 static void
@@ -24,6 +24,7 @@
 
 #include "config.h"
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -257,12 +258,24 @@ enum keyboard_state {
 	KEYBOARD_STATE_SYMBOLS
 };
 
+#define KEYBOARD_STATE_COUNT 3
+
 struct keyboard {
 	struct virtual_keyboard *keyboard;
 	struct window *window;
 	struct widget *widget;
 
 	enum keyboard_state state;
+	const struct key *pressed_key;
+
+	/* Every key of a layout rendered once per state, released and
+	 * pressed.  Keys are blitted from there. */
+	struct {
+		const struct layout *layout;
+		uint32_t preedit_style;
+		int32_t scale;
+		cairo_surface_t *keys[KEYBOARD_STATE_COUNT][2];
+	} cache;
 };
 
 static void __attribute__ ((format (printf, 1, 2)))
@@ -352,39 +365,67 @@ get_current_layout(struct virtual_keyboard *keyboard)
 }
 
 static void
-redraw_handler(struct widget *widget, void *data)
+keyboard_get_key_rectangle(const struct layout *layout,
+			   const struct key *key,
+			   struct rectangle *rectangle)
 {
-	struct keyboard *keyboard = data;
-	cairo_surface_t *surface;
-	struct rectangle allocation;
-	cairo_t *cr;
 	unsigned int i;
 	unsigned int row = 0, col = 0;
-	const struct layout *layout;
 
-	layout = get_current_layout(keyboard->keyboard);
+	memset(rectangle, 0, sizeof *rectangle);
 
-	surface = window_get_surface(keyboard->window);
-	widget_get_allocation(keyboard->widget, &allocation);
+	for (i = 0; i < layout->count; ++i) {
+		if (&layout->keys[i] == key)
+			break;
+		col += layout->keys[i].width;
+		if (col >= layout->columns) {
+			row += 1;
+			col = 0;
+		}
+	}
 
+	/* a key of another layout */
+	if (i == layout->count)
+		return;
+
+	rectangle->x = col * key_width;
+	rectangle->y = row * key_height;
+	rectangle->width = key->width * key_width;
+	rectangle->height = key_height;
+}
+
+static cairo_surface_t *
+keyboard_render_keys(struct keyboard *keyboard, const struct layout *layout,
+		     bool pressed, int32_t scale)
+{
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	unsigned int i;
+	unsigned int row = 0, col = 0;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+					     layout->columns * key_width * scale,
+					     layout->rows * key_height * scale);
 	cr = cairo_create(surface);
-	cairo_rectangle(cr, allocation.x, allocation.y, allocation.width, allocation.height);
-	cairo_clip(cr);
+	cairo_scale(cr, scale, scale);
 
 	cairo_select_font_face(cr, "sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
 	cairo_set_font_size(cr, 16);
 
-	cairo_translate(cr, allocation.x, allocation.y);
-
 	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
-	cairo_set_source_rgba(cr, 1, 1, 1, 0.75);
-	cairo_rectangle(cr, 0, 0, layout->columns * key_width, layout->rows * key_height);
+	if (pressed)
+		cairo_set_source_rgba(cr, 0, 0, 0, 0.75);
+	else
+		cairo_set_source_rgba(cr, 1, 1, 1, 0.75);
 	cairo_paint(cr);
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 
 	for (i = 0; i < layout->count; ++i) {
-		cairo_set_source_rgb(cr, 0, 0, 0);
+		if (pressed)
+			cairo_set_source_rgb(cr, 1, 1, 1);
+		else
+			cairo_set_source_rgb(cr, 0, 0, 0);
 		draw_key(keyboard, &layout->keys[i], cr, row, col);
 		col += layout->keys[i].width;
 		if (col >= layout->columns) {
@@ -394,7 +435,101 @@ redraw_handler(struct widget *widget, void *data)
 	}
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
+
+	return surface;
+}
+
+static void
+keyboard_clear_cache(struct keyboard *keyboard)
+{
+	int i, j;
+
+	for (i = 0; i < KEYBOARD_STATE_COUNT; i++) {
+		for (j = 0; j < 2; j++) {
+			if (keyboard->cache.keys[i][j])
+				cairo_surface_destroy(keyboard->cache.keys[i][j]);
+			keyboard->cache.keys[i][j] = NULL;
+		}
+	}
+}
+
+/* The style key shows the preedit style, so it is part of the cache
+ * key along with the layout */
+static cairo_surface_t *
+keyboard_get_keys(struct keyboard *keyboard, const struct layout *layout,
+		  bool pressed, int32_t scale)
+{
+	cairo_surface_t **keys;
+
+	if (keyboard->cache.layout != layout ||
+	    keyboard->cache.preedit_style != keyboard->keyboard->preedit_style ||
+	    keyboard->cache.scale != scale) {
+		keyboard_clear_cache(keyboard);
+		keyboard->cache.layout = layout;
+		keyboard->cache.preedit_style = keyboard->keyboard->preedit_style;
+		keyboard->cache.scale = scale;
+	}
+
+	keys = &keyboard->cache.keys[keyboard->state][pressed];
+	if (!*keys)
+		*keys = keyboard_render_keys(keyboard, layout, pressed, scale);
+
+	return *keys;
+}
+
+static void
+blit_keys(cairo_t *cr, cairo_surface_t *keys, int32_t scale,
+	  const struct rectangle *rectangle)
+{
+	cairo_save(cr);
+	cairo_rectangle(cr, rectangle->x, rectangle->y,
+			rectangle->width, rectangle->height);
+	cairo_clip(cr);
+	cairo_scale(cr, 1.0 / scale, 1.0 / scale);
+	cairo_set_source_surface(cr, keys, 0, 0);
+	cairo_paint(cr);
+	cairo_restore(cr);
+}
+
+static void
+redraw_handler(struct widget *widget, void *data)
+{
+	struct keyboard *keyboard = data;
+	struct rectangle allocation, rectangle;
+	cairo_surface_t *keys;
+	cairo_t *cr;
+	int32_t scale;
+	const struct layout *layout;
+
+	layout = get_current_layout(keyboard->keyboard);
+	scale = window_get_buffer_scale(keyboard->window);
+
+	widget_get_allocation(keyboard->widget, &allocation);
+
+	/* clipped to the area being redrawn, usually a single key */
+	cr = widget_cairo_create(keyboard->widget);
+	cairo_rectangle(cr, allocation.x, allocation.y, allocation.width, allocation.height);
+	cairo_clip(cr);
+
+	cairo_translate(cr, allocation.x, allocation.y);
+
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+
+	rectangle.x = 0;
+	rectangle.y = 0;
+	rectangle.width = layout->columns * key_width;
+	rectangle.height = layout->rows * key_height;
+	keys = keyboard_get_keys(keyboard, layout, false, scale);
+	blit_keys(cr, keys, scale, &rectangle);
+
+	if (keyboard->pressed_key) {
+		keyboard_get_key_rectangle(layout, keyboard->pressed_key,
+					   &rectangle);
+		keys = keyboard_get_keys(keyboard, layout, true, scale);
+		blit_keys(cr, keys, scale, &rectangle);
+	}
+
+	cairo_destroy(cr);
 }
 
 static void
@@ -657,6 +792,53 @@ keyboard_handle_key(struct keyboard *keyboard, uint32_t time, const struct key *
 	}
 }
 
+static void
+keyboard_damage_key(struct keyboard *keyboard, const struct layout *layout,
+		    const struct key *key)
+{
+	struct rectangle allocation, rectangle;
+
+	widget_get_allocation(keyboard->widget, &allocation);
+	keyboard_get_key_rectangle(layout, key, &rectangle);
+	rectangle.x += allocation.x;
+	rectangle.y += allocation.y;
+	widget_schedule_redraw_area(keyboard->widget, &rectangle);
+}
+
+/** Handle a key, and redraw what it changed
+ *
+ * Only the pressed and released keys are redrawn, unless the key
+ * changed the labels of the keyboard.  key is NULL if no key was hit.
+ */
+static void
+keyboard_press_key(struct keyboard *keyboard, uint32_t time,
+		   const struct layout *layout, const struct key *key,
+		   struct input *input, enum wl_pointer_button_state state)
+{
+	enum keyboard_state keyboard_state = keyboard->state;
+	uint32_t preedit_style = keyboard->keyboard->preedit_style;
+	const struct key *released = keyboard->pressed_key;
+
+	if (key)
+		keyboard_handle_key(keyboard, time, key, input, state);
+
+	if (state == WL_POINTER_BUTTON_STATE_PRESSED)
+		keyboard->pressed_key = key;
+	else
+		keyboard->pressed_key = NULL;
+
+	if (keyboard->state != keyboard_state ||
+	    keyboard->keyboard->preedit_style != preedit_style) {
+		widget_schedule_redraw(keyboard->widget);
+		return;
+	}
+
+	if (released && released != keyboard->pressed_key)
+		keyboard_damage_key(keyboard, layout, released);
+	if (keyboard->pressed_key)
+		keyboard_damage_key(keyboard, layout, keyboard->pressed_key);
+}
+
 static void
 button_handler(struct widget *widget,
 	       struct input *input, uint32_t time,
@@ -687,12 +869,13 @@ button_handler(struct widget *widget,
 	for (i = 0; i < layout->count; ++i) {
 		col -= layout->keys[i].width;
 		if (col < 0) {
-			keyboard_handle_key(keyboard, time, &layout->keys[i], input, state);
-			break;
+			keyboard_press_key(keyboard, time, layout,
+					   &layout->keys[i], input, state);
+			return;
 		}
 	}
 
-	widget_schedule_redraw(widget);
+	keyboard_press_key(keyboard, time, layout, NULL, input, state);
 }
 
 static void
@@ -717,13 +900,13 @@ touch_handler(struct input *input, uint32_t time,
 	for (i = 0; i < layout->count; ++i) {
 		col -= layout->keys[i].width;
 		if (col < 0) {
-			keyboard_handle_key(keyboard, time,
-					    &layout->keys[i], input, state);
-			break;
+			keyboard_press_key(keyboard, time, layout,
+					   &layout->keys[i], input, state);
+			return;
 		}
 	}
 
-	widget_schedule_redraw(keyboard->widget);
+	keyboard_press_key(keyboard, time, layout, NULL, input, state);
 }
 
 static void
@@ -863,6 +1046,7 @@ input_method_activate(void *data,
 	const struct layout *layout;
 
 	keyboard->keyboard->state = KEYBOARD_STATE_DEFAULT;
+	keyboard->keyboard->pressed_key = NULL;
 
 	if (keyboard->context)
 		wl_input_method_context_destroy(keyboard->context);
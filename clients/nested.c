@@ -30,8 +30,10 @@
 #include <cairo.h>
 #include <math.h>
 #include <assert.h>
+#include <time.h>
 #include <pixman.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -47,7 +49,10 @@
 #include <wayland-server.h>
 
 #include "shared/helpers.h"
+#include "shared/os-compatibility.h"
 #include "window.h"
+#include "linux-dmabuf-client-protocol.h"
+#include "linux-dmabuf-server-protocol.h"
 
 #ifndef EGL_WL_create_wayland_buffer_from_image
 #define EGL_WL_create_wayland_buffer_from_image 1
@@ -60,6 +65,13 @@ typedef struct wl_buffer * (EGLAPIENTRYP PFNEGLCREATEWAYLANDBUFFERFROMIMAGEWL) (
 #endif
 
 static int option_blit;
+static int option_stats;
+
+/* How often the frame statistics are printed, in milliseconds */
+#define NESTED_STATS_PERIOD 5000
+
+/* Number of parent buffers the contents of SHM buffers are copied to */
+#define NESTED_SHM_SLOTS 3
 
 struct nested {
 	struct display *display;
@@ -74,6 +86,12 @@ struct nested {
 	struct wl_list surface_list;
 
 	const struct nested_renderer *renderer;
+
+	/* Globals of the parent compositor that client buffers are
+	 * passed on to by the subsurface renderer */
+	struct wl_shm *parent_shm;
+	struct zlinux_dmabuf *parent_dmabuf;
+	struct wl_array dmabuf_formats;
 };
 
 struct nested_region {
@@ -86,15 +104,22 @@ struct nested_buffer_reference {
 	struct wl_listener destroy_listener;
 };
 
+enum nested_buffer_type {
+	NESTED_BUFFER_EGL,
+	NESTED_BUFFER_SHM,
+	NESTED_BUFFER_DMABUF
+};
+
 struct nested_buffer {
 	struct wl_resource *resource;
+	enum nested_buffer_type type;
 	struct wl_signal destroy_signal;
 	struct wl_listener destroy_listener;
 	uint32_t busy_count;
 
 	/* A buffer in the parent compositor representing the same
 	 * data. This is created on-demand when the subsurface
-	 * renderer is used */
+	 * renderer is used, or together with the buffer for dmabuf */
 	struct wl_buffer *parent_buffer;
 	/* This reference is used to mark when the parent buffer has
 	 * been attached to the subsurface. It will be unrefenced when
@@ -104,6 +129,18 @@ struct nested_buffer {
 	struct nested_buffer_reference parent_ref;
 };
 
+/* Time from a commit of a client to the frame callback telling it
+ * that the parent compositor showed the contents */
+struct nested_frame_stats {
+	struct timespec commit;
+	int pending;
+
+	struct timespec period_start;
+	uint32_t frames;
+	double latency_sum;
+	double latency_max;
+};
+
 struct nested_surface {
 	struct wl_resource *resource;
 	struct nested *nested;
@@ -125,6 +162,8 @@ struct nested_surface {
 		pixman_region32_t damage;
 	} pending;
 
+	struct nested_frame_stats stats;
+
 	void *renderer_data;
 };
 
@@ -135,12 +174,36 @@ struct nested_blit_surface {
 	cairo_surface_t *cairo_surface;
 };
 
+/* A buffer in the parent compositor that the contents of the SHM
+ * buffers of a client are copied to. The damage is what the client
+ * redrew since this copy was last brought up to date */
+struct nested_shm_slot {
+	struct wl_buffer *buffer;
+	void *data;
+	size_t size;
+	int32_t width, height, stride;
+	uint32_t format;
+	int busy;
+	pixman_region32_t damage;
+};
+
 /* Data used for the subsurface renderer */
 struct nested_ss_surface {
 	struct widget *widget;
 	struct wl_surface *surface;
 	struct wl_subsurface *subsurface;
 	struct wl_callback *frame_callback;
+	struct nested_shm_slot shm[NESTED_SHM_SLOTS];
+};
+
+/* A zlinux_buffer_params of a client, forwarded to the parent */
+struct nested_dmabuf_params {
+	struct nested *nested;
+	struct wl_resource *resource;
+	struct zlinux_buffer_params *parent;
+	uint32_t planes;
+	int used;
+	int pending;
 };
 
 struct nested_frame_callback {
@@ -154,14 +217,17 @@ struct nested_renderer {
 	void (* render_clients)(struct nested *nested, cairo_t *cr);
 	void (* surface_attach)(struct nested_surface *surface,
 				struct nested_buffer *buffer);
+	void (* surface_commit)(struct nested_surface *surface);
 };
 
 static const struct weston_option nested_options[] = {
 	{ WESTON_OPTION_BOOLEAN, "blit", 'b', &option_blit },
+	{ WESTON_OPTION_BOOLEAN, "stats", 's', &option_stats },
 };
 
 static const struct nested_renderer nested_blit_renderer;
 static const struct nested_renderer nested_ss_renderer;
+static struct wl_buffer_listener ss_buffer_listener;
 
 static PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 static PFNEGLCREATEIMAGEKHRPROC create_image;
@@ -252,12 +318,86 @@ nested_buffer_reference(struct nested_buffer_reference *ref,
 	ref->buffer = buffer;
 }
 
+static void
+dmabuf_buffer_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_buffer_interface dmabuf_buffer_implementation = {
+	dmabuf_buffer_destroy
+};
+
+static int
+nested_buffer_is_dmabuf(struct wl_resource *resource)
+{
+	return wl_resource_instance_of(resource, &wl_buffer_interface,
+				       &dmabuf_buffer_implementation);
+}
+
+static double
+timespec_sub_to_msec(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000.0 +
+		(a->tv_nsec - b->tv_nsec) / 1000000.0;
+}
+
+static void
+nested_stats_commit(struct nested_surface *surface)
+{
+	struct nested_frame_stats *stats = &surface->stats;
+
+	/* Measure from the oldest commit not shown yet */
+	if (!option_stats || stats->pending)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &stats->commit);
+	stats->pending = 1;
+}
+
+static void
+nested_stats_present(struct nested_surface *surface)
+{
+	struct nested_frame_stats *stats = &surface->stats;
+	struct timespec now;
+	double latency, period;
+
+	if (!stats->pending)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	stats->pending = 0;
+
+	latency = timespec_sub_to_msec(&now, &stats->commit);
+	stats->frames++;
+	stats->latency_sum += latency;
+	if (latency > stats->latency_max)
+		stats->latency_max = latency;
+
+	period = timespec_sub_to_msec(&now, &stats->period_start);
+	if (period < NESTED_STATS_PERIOD)
+		return;
+
+	printf("surface %u: %u frames in %.0f ms (%.1f fps), "
+	       "commit to frame latency %.2f ms avg, %.2f ms max\n",
+	       wl_resource_get_id(surface->resource),
+	       stats->frames, period, stats->frames * 1000.0 / period,
+	       stats->latency_sum / stats->frames, stats->latency_max);
+
+	stats->period_start = now;
+	stats->frames = 0;
+	stats->latency_sum = 0;
+	stats->latency_max = 0;
+}
+
 static void
 flush_surface_frame_callback_list(struct nested_surface *surface,
 				  uint32_t time)
 {
 	struct nested_frame_callback *nc, *next;
 
+	nested_stats_present(surface);
+
 	wl_list_for_each_safe(nc, next, &surface->frame_callback_list, link) {
 		wl_callback_send_done(nc->resource, time);
 		wl_resource_destroy(nc->resource);
@@ -432,32 +572,56 @@ surface_attach(struct wl_client *client,
 	struct nested_buffer *buffer = NULL;
 
 	if (buffer_resource) {
+		enum nested_buffer_type type;
 		int format;
 
-		if (!query_buffer(nested->egl_display, (void *) buffer_resource,
-				  EGL_TEXTURE_FORMAT, &format)) {
+		if (nested_buffer_is_dmabuf(buffer_resource))
+			type = NESTED_BUFFER_DMABUF;
+		else if (wl_shm_buffer_get(buffer_resource))
+			type = NESTED_BUFFER_SHM;
+		else
+			type = NESTED_BUFFER_EGL;
+
+		/* Only the subsurface renderer can pass SHM buffers
+		 * on to the parent compositor */
+		if (type == NESTED_BUFFER_SHM &&
+		    (nested->renderer != &nested_ss_renderer ||
+		     nested->parent_shm == NULL)) {
 			wl_resource_post_error(buffer_resource,
 					       WL_DISPLAY_ERROR_INVALID_OBJECT,
-					       "attaching non-egl wl_buffer");
+					       "attaching wl_shm buffer "
+					       "without subsurfaces");
 			return;
 		}
 
-		switch (format) {
-		case EGL_TEXTURE_RGB:
-		case EGL_TEXTURE_RGBA:
-			break;
-		default:
+		if (type == NESTED_BUFFER_EGL &&
+		    !query_buffer(nested->egl_display, (void *) buffer_resource,
+				  EGL_TEXTURE_FORMAT, &format)) {
 			wl_resource_post_error(buffer_resource,
 					       WL_DISPLAY_ERROR_INVALID_OBJECT,
-					       "invalid format");
+					       "attaching non-egl wl_buffer");
 			return;
 		}
 
+		if (type == NESTED_BUFFER_EGL) {
+			switch (format) {
+			case EGL_TEXTURE_RGB:
+			case EGL_TEXTURE_RGBA:
+				break;
+			default:
+				wl_resource_post_error(buffer_resource,
+						       WL_DISPLAY_ERROR_INVALID_OBJECT,
+						       "invalid format");
+				return;
+			}
+		}
+
 		buffer = nested_buffer_from_resource(buffer_resource);
 		if (buffer == NULL) {
 			wl_client_post_no_memory(client);
 			return;
 		}
+		buffer->type = type;
 	}
 
 	if (surface->pending.buffer)
@@ -477,15 +641,21 @@ nested_surface_attach(struct nested_surface *surface,
 {
 	struct nested *nested = surface->nested;
 
-	if (surface->image != EGL_NO_IMAGE_KHR)
+	if (surface->image != EGL_NO_IMAGE_KHR) {
 		destroy_image(nested->egl_display, surface->image);
+		surface->image = EGL_NO_IMAGE_KHR;
+	}
 
-	surface->image = create_image(nested->egl_display, NULL,
-				      EGL_WAYLAND_BUFFER_WL, buffer->resource,
-				      NULL);
-	if (surface->image == EGL_NO_IMAGE_KHR) {
-		fprintf(stderr, "failed to create img\n");
-		return;
+	/* SHM and dmabuf buffers are passed on to the parent
+	 * compositor as they are and don't need an image */
+	if (buffer && buffer->type == NESTED_BUFFER_EGL) {
+		surface->image = create_image(nested->egl_display, NULL,
+					      EGL_WAYLAND_BUFFER_WL,
+					      buffer->resource, NULL);
+		if (surface->image == EGL_NO_IMAGE_KHR) {
+			fprintf(stderr, "failed to create img\n");
+			return;
+		}
 	}
 
 	nested->renderer->surface_attach(surface, buffer);
@@ -574,11 +744,9 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 			    &surface->pending.frame_callback_list);
 	wl_list_init(&surface->pending.frame_callback_list);
 
-	/* FIXME: For the subsurface renderer we don't need to
-	 * actually redraw the window. However we do want to cause a
-	 * commit because the subsurface is synchronized. Ideally we
-	 * would just queue the commit */
-	window_schedule_redraw(nested->window);
+	nested_stats_commit(surface);
+
+	nested->renderer->surface_commit(surface);
 }
 
 static void
@@ -631,6 +799,8 @@ compositor_create_surface(struct wl_client *client,
 		surface_handle_pending_buffer_destroy;
 	pixman_region32_init(&surface->pending.damage);
 
+	clock_gettime(CLOCK_MONOTONIC, &surface->stats.period_start);
+
 	display_acquire_window_surface(nested->display,
 				       nested->window, NULL);
 
@@ -729,6 +899,298 @@ compositor_bind(struct wl_client *client,
 				       nested, NULL);
 }
 
+static void
+nested_dmabuf_params_free(struct nested_dmabuf_params *params)
+{
+	zlinux_buffer_params_destroy(params->parent);
+	free(params);
+}
+
+static void
+destroy_params(struct wl_resource *resource)
+{
+	struct nested_dmabuf_params *params =
+		wl_resource_get_user_data(resource);
+
+	params->resource = NULL;
+
+	/* Wait for the answer of the parent compositor so that the
+	 * buffer it may create doesn't leak */
+	if (params->pending)
+		return;
+
+	nested_dmabuf_params_free(params);
+}
+
+static void
+params_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+params_add(struct wl_client *client,
+	   struct wl_resource *resource,
+	   int32_t fd,
+	   uint32_t plane_idx,
+	   uint32_t offset,
+	   uint32_t stride,
+	   uint32_t modifier_hi,
+	   uint32_t modifier_lo)
+{
+	struct nested_dmabuf_params *params =
+		wl_resource_get_user_data(resource);
+
+	if (params->used) {
+		wl_resource_post_error(resource,
+			ZLINUX_BUFFER_PARAMS_ERROR_ALREADY_USED,
+			"params was already used to create a wl_buffer");
+		close(fd);
+		return;
+	}
+
+	if (plane_idx >= 4) {
+		wl_resource_post_error(resource,
+			ZLINUX_BUFFER_PARAMS_ERROR_PLANE_IDX,
+			"plane index %u is too high", plane_idx);
+		close(fd);
+		return;
+	}
+
+	if (params->planes & (1 << plane_idx)) {
+		wl_resource_post_error(resource,
+			ZLINUX_BUFFER_PARAMS_ERROR_PLANE_SET,
+			"a dmabuf has already been added for plane %u",
+			plane_idx);
+		close(fd);
+		return;
+	}
+
+	params->planes |= 1 << plane_idx;
+
+	/* The fd is duplicated when the request is marshalled */
+	zlinux_buffer_params_add(params->parent, fd, plane_idx,
+				 offset, stride, modifier_hi, modifier_lo);
+	close(fd);
+}
+
+static void
+params_create(struct wl_client *client,
+	      struct wl_resource *resource,
+	      int32_t width,
+	      int32_t height,
+	      uint32_t format,
+	      uint32_t flags)
+{
+	struct nested_dmabuf_params *params =
+		wl_resource_get_user_data(resource);
+
+	if (params->used) {
+		wl_resource_post_error(resource,
+			ZLINUX_BUFFER_PARAMS_ERROR_ALREADY_USED,
+			"params was already used to create a wl_buffer");
+		return;
+	}
+
+	params->used = 1;
+
+	/* Check for holes in the planes (e.g. [0, 1, 3]) */
+	if (params->planes == 0 ||
+	    (params->planes & (params->planes + 1)) != 0) {
+		wl_resource_post_error(resource,
+			ZLINUX_BUFFER_PARAMS_ERROR_INCOMPLETE,
+			"the planes added don't start at 0 or have holes");
+		return;
+	}
+
+	if (width < 1 || height < 1) {
+		wl_resource_post_error(resource,
+			ZLINUX_BUFFER_PARAMS_ERROR_INVALID_DIMENSIONS,
+			"invalid width %d or height %d", width, height);
+		return;
+	}
+
+	/* The parent compositor imports the dmabufs and answers
+	 * with created or failed */
+	zlinux_buffer_params_create(params->parent,
+				    width, height, format, flags);
+	params->pending = 1;
+}
+
+static const struct zlinux_buffer_params_interface params_implementation = {
+	params_destroy,
+	params_add,
+	params_create
+};
+
+static void
+parent_params_created(void *data,
+		      struct zlinux_buffer_params *parent_params,
+		      struct wl_buffer *parent_buffer)
+{
+	struct nested_dmabuf_params *params = data;
+	struct nested_buffer *buffer;
+	struct wl_resource *resource;
+
+	params->pending = 0;
+
+	if (params->resource == NULL) {
+		wl_buffer_destroy(parent_buffer);
+		nested_dmabuf_params_free(params);
+		return;
+	}
+
+	resource = wl_resource_create(wl_resource_get_client(params->resource),
+				      &wl_buffer_interface, 1, 0);
+	if (resource == NULL) {
+		wl_buffer_destroy(parent_buffer);
+		wl_resource_post_no_memory(params->resource);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &dmabuf_buffer_implementation,
+				       NULL, NULL);
+
+	buffer = nested_buffer_from_resource(resource);
+	if (buffer == NULL) {
+		wl_resource_destroy(resource);
+		wl_buffer_destroy(parent_buffer);
+		wl_resource_post_no_memory(params->resource);
+		return;
+	}
+
+	/* The parent compositor samples the dmabuf directly, so the
+	 * buffer is released to the client when the parent releases
+	 * it */
+	buffer->type = NESTED_BUFFER_DMABUF;
+	buffer->parent_buffer = parent_buffer;
+	wl_buffer_add_listener(parent_buffer, &ss_buffer_listener, buffer);
+
+	zlinux_buffer_params_send_created(params->resource, resource);
+	wl_display_flush_clients(params->nested->child_display);
+}
+
+static void
+parent_params_failed(void *data, struct zlinux_buffer_params *parent_params)
+{
+	struct nested_dmabuf_params *params = data;
+
+	params->pending = 0;
+
+	if (params->resource == NULL) {
+		nested_dmabuf_params_free(params);
+		return;
+	}
+
+	zlinux_buffer_params_send_failed(params->resource);
+	wl_display_flush_clients(params->nested->child_display);
+}
+
+static const struct zlinux_buffer_params_listener parent_params_listener = {
+	parent_params_created,
+	parent_params_failed
+};
+
+static void
+dmabuf_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+dmabuf_create_params(struct wl_client *client,
+		     struct wl_resource *dmabuf_resource,
+		     uint32_t params_id)
+{
+	struct nested *nested = wl_resource_get_user_data(dmabuf_resource);
+	struct nested_dmabuf_params *params;
+
+	params = zalloc(sizeof *params);
+	if (params == NULL) {
+		wl_resource_post_no_memory(dmabuf_resource);
+		return;
+	}
+
+	params->nested = nested;
+	params->resource =
+		wl_resource_create(client, &zlinux_buffer_params_interface,
+				   wl_resource_get_version(dmabuf_resource),
+				   params_id);
+	if (params->resource == NULL) {
+		free(params);
+		wl_resource_post_no_memory(dmabuf_resource);
+		return;
+	}
+
+	params->parent = zlinux_dmabuf_create_params(nested->parent_dmabuf);
+	zlinux_buffer_params_add_listener(params->parent,
+					  &parent_params_listener, params);
+
+	wl_resource_set_implementation(params->resource,
+				       &params_implementation,
+				       params, destroy_params);
+}
+
+static const struct zlinux_dmabuf_interface dmabuf_implementation = {
+	dmabuf_destroy,
+	dmabuf_create_params
+};
+
+static void
+dmabuf_bind(struct wl_client *client,
+	    void *data, uint32_t version, uint32_t id)
+{
+	struct nested *nested = data;
+	struct wl_resource *resource;
+	uint32_t *format;
+
+	resource = wl_resource_create(client, &zlinux_dmabuf_interface, 1, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &dmabuf_implementation,
+				       nested, NULL);
+
+	wl_array_for_each(format, &nested->dmabuf_formats)
+		zlinux_dmabuf_send_format(resource, *format);
+}
+
+static void
+parent_dmabuf_format(void *data, struct zlinux_dmabuf *dmabuf,
+		     uint32_t format)
+{
+	struct nested *nested = data;
+	uint32_t *fmt;
+
+	fmt = wl_array_add(&nested->dmabuf_formats, sizeof *fmt);
+	if (fmt)
+		*fmt = format;
+}
+
+static const struct zlinux_dmabuf_listener parent_dmabuf_listener = {
+	parent_dmabuf_format
+};
+
+static void
+global_handler(struct display *display, uint32_t name,
+	       const char *interface, uint32_t version, void *data)
+{
+	struct nested *nested = data;
+
+	if (strcmp(interface, "wl_shm") == 0) {
+		nested->parent_shm =
+			display_bind(display, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, "zlinux_dmabuf") == 0) {
+		nested->parent_dmabuf =
+			display_bind(display, name,
+				     &zlinux_dmabuf_interface, 1);
+		zlinux_dmabuf_add_listener(nested->parent_dmabuf,
+					   &parent_dmabuf_listener, nested);
+	}
+}
+
 static int
 nested_init_compositor(struct nested *nested)
 {
@@ -790,6 +1252,16 @@ nested_init_compositor(struct nested *nested)
 	if (use_ss_renderer) {
 		printf("Using subsurfaces to render client surfaces\n");
 		nested->renderer = &nested_ss_renderer;
+
+		if (nested->parent_dmabuf) {
+			/* Get the formats the parent compositor takes */
+			wl_display_roundtrip(display_get_display(nested->display));
+
+			if (!wl_global_create(nested->child_display,
+					      &zlinux_dmabuf_interface, 1,
+					      nested, dmabuf_bind))
+				return -1;
+		}
 	} else {
 		printf("Using local compositing with blits to "
 		       "render client surfaces\n");
@@ -813,6 +1285,10 @@ nested_create(struct display *display)
 	window_set_title(nested->window, "Wayland Nested");
 	nested->display = display;
 
+	wl_array_init(&nested->dmabuf_formats);
+	display_set_user_data(display, nested);
+	display_set_global_handler(display, global_handler);
+
 	window_set_user_data(nested->window, nested);
 	widget_set_redraw_handler(nested->widget, redraw_handler);
 	window_set_keyboard_focus_handler(nested->window,
@@ -830,6 +1306,11 @@ nested_destroy(struct nested *nested)
 {
 	widget_destroy(nested->widget);
 	window_destroy(nested->window);
+	if (nested->parent_dmabuf)
+		zlinux_dmabuf_destroy(nested->parent_dmabuf);
+	if (nested->parent_shm)
+		wl_shm_destroy(nested->parent_shm);
+	wl_array_release(&nested->dmabuf_formats);
 	free(nested);
 }
 
@@ -893,6 +1374,9 @@ blit_render_clients(struct nested *nested,
 	wl_list_for_each(s, &nested->surface_list, link) {
 		struct nested_blit_surface *blit_surface = s->renderer_data;
 
+		if (blit_surface->cairo_surface == NULL)
+			continue;
+
 		display_acquire_window_surface(nested->display,
 					       nested->window, NULL);
 
@@ -929,8 +1413,13 @@ blit_surface_attach(struct nested_surface *surface,
 
 	nested_buffer_reference(&blit_surface->buffer_ref, buffer);
 
-	if (blit_surface->cairo_surface)
+	if (blit_surface->cairo_surface) {
 		cairo_surface_destroy(blit_surface->cairo_surface);
+		blit_surface->cairo_surface = NULL;
+	}
+
+	if (buffer == NULL)
+		return;
 
 	query_buffer(nested->egl_display, (void *) buffer->resource,
 		     EGL_WIDTH, &width);
@@ -945,12 +1434,21 @@ blit_surface_attach(struct nested_surface *surface,
 						    width, height);
 }
 
+static void
+blit_surface_commit(struct nested_surface *surface)
+{
+	/* The clients are drawn into the window, so it has to be
+	 * redrawn for their new contents to show up */
+	window_schedule_redraw(surface->nested->window);
+}
+
 static const struct nested_renderer
 nested_blit_renderer = {
 	.surface_init = blit_surface_init,
 	.surface_fini = blit_surface_fini,
 	.render_clients = blit_render_clients,
-	.surface_attach = blit_surface_attach
+	.surface_attach = blit_surface_attach,
+	.surface_commit = blit_surface_commit
 };
 
 /*** subsurface renderer ***/
@@ -965,11 +1463,15 @@ ss_surface_init(struct nested_surface *surface)
 		xzalloc(sizeof *ss_surface);
 	struct rectangle allocation;
 	struct wl_region *region;
+	int i;
 
+	/* The subsurface is desynchronized so that the commits of the
+	 * clients reach the parent compositor without the window
+	 * being redrawn and committed as well */
 	ss_surface->widget =
 		window_add_subsurface(nested->window,
 				      nested,
-				      SUBSURFACE_SYNCHRONIZED);
+				      SUBSURFACE_DESYNCHRONIZED);
 
 	widget_set_use_cairo(ss_surface->widget, 0);
 
@@ -988,13 +1490,96 @@ ss_surface_init(struct nested_surface *surface)
 				   allocation.x + 10,
 				   allocation.y + 10);
 
+	/* The position is applied on the next commit of the window */
+	window_schedule_redraw(nested->window);
+
+	for (i = 0; i < NESTED_SHM_SLOTS; i++)
+		pixman_region32_init(&ss_surface->shm[i].damage);
+
 	surface->renderer_data = ss_surface;
 }
 
+static void
+ss_shm_slot_fini(struct nested_shm_slot *slot)
+{
+	if (slot->buffer)
+		wl_buffer_destroy(slot->buffer);
+	if (slot->data)
+		munmap(slot->data, slot->size);
+
+	slot->buffer = NULL;
+	slot->data = NULL;
+	slot->width = 0;
+	slot->height = 0;
+	slot->busy = 0;
+}
+
+static void
+ss_shm_slot_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct nested_shm_slot *slot = data;
+
+	slot->busy = 0;
+}
+
+static const struct wl_buffer_listener ss_shm_slot_listener = {
+	ss_shm_slot_release
+};
+
+static int
+ss_shm_slot_init(struct nested *nested, struct nested_shm_slot *slot,
+		 int32_t width, int32_t height, uint32_t format)
+{
+	struct wl_shm_pool *pool;
+	int fd;
+
+	slot->stride = width * 4;
+	slot->size = slot->stride * height;
+
+	fd = os_create_anonymous_file(slot->size);
+	if (fd < 0) {
+		fprintf(stderr, "creating a buffer file for %zu B failed: %m\n",
+			slot->size);
+		return -1;
+	}
+
+	slot->data = mmap(NULL, slot->size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, fd, 0);
+	if (slot->data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %m\n");
+		slot->data = NULL;
+		close(fd);
+		return -1;
+	}
+
+	pool = wl_shm_create_pool(nested->parent_shm, fd, slot->size);
+	slot->buffer = wl_shm_pool_create_buffer(pool, 0, width, height,
+						 slot->stride, format);
+	wl_buffer_add_listener(slot->buffer, &ss_shm_slot_listener, slot);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	slot->width = width;
+	slot->height = height;
+	slot->format = format;
+
+	/* Nothing has been copied yet */
+	pixman_region32_fini(&slot->damage);
+	pixman_region32_init_rect(&slot->damage, 0, 0, width, height);
+
+	return 0;
+}
+
 static void
 ss_surface_fini(struct nested_surface *surface)
 {
 	struct nested_ss_surface *ss_surface = surface->renderer_data;
+	int i;
+
+	for (i = 0; i < NESTED_SHM_SLOTS; i++) {
+		ss_shm_slot_fini(&ss_surface->shm[i]);
+		pixman_region32_fini(&ss_surface->shm[i].damage);
+	}
 
 	widget_destroy(ss_surface->widget);
 
@@ -1024,6 +1609,84 @@ static struct wl_buffer_listener ss_buffer_listener = {
    ss_buffer_release
 };
 
+/* The pool fd of a SHM buffer isn't available to the compositor, so
+ * the contents are copied to a buffer shared with the parent
+ * compositor instead. Only what the client damaged since the copy
+ * was last used is copied. Returns NULL if all the copies are still
+ * in use by the parent. */
+static struct wl_buffer *
+ss_surface_copy_shm(struct nested_surface *surface,
+		    struct nested_buffer *buffer)
+{
+	struct nested_ss_surface *ss_surface = surface->renderer_data;
+	struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(buffer->resource);
+	struct nested_shm_slot *slot = NULL;
+	const pixman_box32_t *rects;
+	int32_t width, height, stride;
+	uint32_t format;
+	uint8_t *src, *dst;
+	int n_rects, i, y;
+
+	width = wl_shm_buffer_get_width(shm_buffer);
+	height = wl_shm_buffer_get_height(shm_buffer);
+	stride = wl_shm_buffer_get_stride(shm_buffer);
+	format = wl_shm_buffer_get_format(shm_buffer);
+
+	/* Both formats every compositor supports are 32 bpp */
+	if (stride < width * 4) {
+		fprintf(stderr, "invalid stride %d for a %d pixel wide "
+			"shm buffer\n", stride, width);
+		return NULL;
+	}
+
+	for (i = 0; i < NESTED_SHM_SLOTS; i++)
+		pixman_region32_union(&ss_surface->shm[i].damage,
+				      &ss_surface->shm[i].damage,
+				      &surface->pending.damage);
+
+	for (i = 0; i < NESTED_SHM_SLOTS; i++) {
+		if (!ss_surface->shm[i].busy) {
+			slot = &ss_surface->shm[i];
+			break;
+		}
+	}
+
+	if (slot == NULL)
+		return NULL;
+
+	if (slot->width != width || slot->height != height ||
+	    slot->format != format || slot->buffer == NULL) {
+		ss_shm_slot_fini(slot);
+		if (ss_shm_slot_init(surface->nested, slot,
+				     width, height, format) < 0)
+			return NULL;
+	}
+
+	pixman_region32_intersect_rect(&slot->damage, &slot->damage,
+				       0, 0, width, height);
+	rects = pixman_region32_rectangles(&slot->damage, &n_rects);
+
+	wl_shm_buffer_begin_access(shm_buffer);
+
+	src = wl_shm_buffer_get_data(shm_buffer);
+	dst = slot->data;
+	for (i = 0; i < n_rects; i++) {
+		const pixman_box32_t *rect = rects + i;
+		size_t len = (rect->x2 - rect->x1) * 4;
+
+		for (y = rect->y1; y < rect->y2; y++)
+			memcpy(dst + y * slot->stride + rect->x1 * 4,
+			       src + y * stride + rect->x1 * 4, len);
+	}
+
+	wl_shm_buffer_end_access(shm_buffer);
+
+	pixman_region32_clear(&slot->damage);
+	slot->busy = 1;
+
+	return slot->buffer;
+}
+
 static void
 ss_frame_callback(void *data, struct wl_callback *callback, uint32_t time)
 {
@@ -1052,9 +1715,16 @@ ss_surface_attach(struct nested_surface *surface,
 	const pixman_box32_t *rects;
 	int n_rects, i;
 
-	if (buffer) {
+	if (buffer && buffer->type == NESTED_BUFFER_SHM) {
+		parent_buffer = ss_surface_copy_shm(surface, buffer);
+
+		/* The client can reuse the buffer as soon as it has
+		 * been copied */
+		wl_resource_queue_event(buffer->resource, WL_BUFFER_RELEASE);
+	} else if (buffer) {
 		/* Create a representation of the buffer in the parent
-		 * compositor if we haven't already */
+		 * compositor if we haven't already. dmabuf buffers
+		 * always have one */
 		if (buffer->parent_buffer == NULL) {
 			EGLDisplay *edpy = nested->egl_display;
 			EGLImageKHR image = surface->image;
@@ -1077,7 +1747,10 @@ ss_surface_attach(struct nested_surface *surface,
 		parent_buffer = NULL;
 	}
 
-	wl_surface_attach(ss_surface->surface, parent_buffer, 0, 0);
+	/* If the contents of a SHM buffer couldn't be copied, the
+	 * parent keeps showing the previous ones */
+	if (buffer == NULL || parent_buffer != NULL)
+		wl_surface_attach(ss_surface->surface, parent_buffer, 0, 0);
 
 	rects = pixman_region32_rectangles(&surface->pending.damage, &n_rects);
 
@@ -1101,12 +1774,20 @@ ss_surface_attach(struct nested_surface *surface,
 	wl_surface_commit(ss_surface->surface);
 }
 
+static void
+ss_surface_commit(struct nested_surface *surface)
+{
+	/* The subsurface was committed in ss_surface_attach already
+	 * and is desynchronized, so the window needn't be redrawn */
+}
+
 static const struct nested_renderer
 nested_ss_renderer = {
 	.surface_init = ss_surface_init,
 	.surface_fini = ss_surface_fini,
 	.render_clients = ss_render_clients,
-	.surface_attach = ss_surface_attach
+	.surface_attach = ss_surface_attach,
+	.surface_commit = ss_surface_commit
 };
 
 int
@@ -1117,7 +1798,9 @@ main(int argc, char *argv[])
 
 	if (parse_options(nested_options,
 			  ARRAY_LENGTH(nested_options), &argc, argv) > 1) {
-		printf("Usage: %s [OPTIONS]\n  --blit or -b\n", argv[0]);
+		printf("Usage: %s [OPTIONS]\n"
+		       "  --blit or -b\n"
+		       "  --stats or -s\n", argv[0]);
 		exit(1);
 	}
 
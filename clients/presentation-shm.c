@@ -34,6 +34,7 @@
 #include <sys/mman.h>
 #include <signal.h>
 #include <time.h>
+#include <math.h>
 
 #include <wayland-client.h>
 #include "shared/helpers.h"
@@ -52,6 +53,12 @@ static const char * const run_mode_name[] = {
 	[RUN_MODE_PRESENT] = "low-lat present",
 };
 
+enum output_format {
+	OUTPUT_TEXT,
+	OUTPUT_CSV,
+	OUTPUT_JSON,
+};
+
 struct output {
 	struct wl_output *output;
 	uint32_t name;
@@ -90,6 +97,23 @@ struct buffer {
 	int busy;
 };
 
+struct bench_stats {
+	unsigned presented;
+	unsigned discarded;
+	unsigned missed;	/* vblanks skipped between presentations */
+
+	int *c2p_usec;		/* commit to present, one per presented frame */
+	unsigned c2p_count;
+	unsigned c2p_alloc;
+
+	double p2p_sum;		/* presentation intervals, in usec */
+	double p2p_sum_sq;
+	unsigned p2p_count;
+	int p2p_max_dev;	/* largest |p2p - refresh|, in usec */
+
+	uint32_t refresh_nsec;
+};
+
 struct window {
 	struct display *display;
 	int width, height;
@@ -107,8 +131,14 @@ struct window {
 	struct wl_list feedback_list;
 
 	struct feedback *received_feedback;
+
+	unsigned max_frames;
+	enum output_format format;
+	struct bench_stats stats;
 };
 
+static int running = 1;
+
 #define NSEC_PER_SEC 1000000000
 
 static void
@@ -266,7 +296,8 @@ destroy_window(struct window *window)
 		struct feedback *f;
 
 		f = wl_container_of(window->feedback_list.next, f, link);
-		printf("clean up feedback %u\n", f->frame_no);
+		if (window->format == OUTPUT_TEXT)
+			printf("clean up feedback %u\n", f->frame_no);
 		destroy_feedback(f);
 	}
 
@@ -280,6 +311,7 @@ destroy_window(struct window *window)
 		wl_buffer_destroy(window->buffers[i].buffer);
 	/* munmap(window->buffers[0].shm_data, size); */
 	free(window->buffers);
+	free(window->stats.c2p_usec);
 
 	free(window);
 }
@@ -398,6 +430,143 @@ timespec_diff_to_usec(const struct timespec *a, const struct timespec *b)
 	return secs * 1000000 + nsec / 1000;
 }
 
+static void
+bench_check_done(struct window *window)
+{
+	struct bench_stats *stats = &window->stats;
+
+	if (window->max_frames &&
+	    stats->presented + stats->discarded >= window->max_frames)
+		running = 0;
+}
+
+static void
+bench_add_presented(struct window *window, int c2p, int p2p,
+		    bool have_p2p, uint32_t refresh_nsec)
+{
+	struct bench_stats *stats = &window->stats;
+	int refresh_usec, dev, *c2ps;
+	unsigned alloc, vblanks;
+
+	stats->presented++;
+	if (refresh_nsec)
+		stats->refresh_nsec = refresh_nsec;
+
+	if (stats->c2p_count == stats->c2p_alloc) {
+		alloc = stats->c2p_alloc ? stats->c2p_alloc * 2 : 256;
+		c2ps = realloc(stats->c2p_usec, alloc * sizeof *c2ps);
+		if (c2ps) {
+			stats->c2p_usec = c2ps;
+			stats->c2p_alloc = alloc;
+		}
+	}
+	if (stats->c2p_count < stats->c2p_alloc)
+		stats->c2p_usec[stats->c2p_count++] = c2p;
+
+	/* The idle mode sleeps between frames on purpose, so intervals
+	 * say nothing about pacing there. */
+	if (!have_p2p || window->mode == RUN_MODE_FEEDBACK_IDLE)
+		return;
+
+	stats->p2p_sum += p2p;
+	stats->p2p_sum_sq += (double)p2p * p2p;
+	stats->p2p_count++;
+
+	if (!refresh_nsec)
+		return;
+
+	refresh_usec = refresh_nsec / 1000;
+	dev = abs(p2p - refresh_usec);
+	if (dev > stats->p2p_max_dev)
+		stats->p2p_max_dev = dev;
+
+	vblanks = ((int64_t)p2p * 1000 + refresh_nsec / 2) / refresh_nsec;
+	if (vblanks > 1)
+		stats->missed += vblanks - 1;
+}
+
+static int
+compare_int(const void *a, const void *b)
+{
+	const int *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+static int
+percentile(const int *sorted, unsigned count, unsigned percent)
+{
+	unsigned i;
+
+	if (count == 0)
+		return 0;
+
+	i = (count * percent + 99) / 100;
+	if (i > 0)
+		i--;
+
+	return sorted[i];
+}
+
+static void
+bench_report(struct window *window)
+{
+	struct bench_stats *stats = &window->stats;
+	double avg = 0.0, p2p_avg = 0.0, jitter = 0.0;
+	int min = 0, max = 0, p50, p90, p99;
+	unsigned i;
+	FILE *fp;
+
+	qsort(stats->c2p_usec, stats->c2p_count, sizeof stats->c2p_usec[0],
+	      compare_int);
+
+	if (stats->c2p_count) {
+		for (i = 0; i < stats->c2p_count; i++)
+			avg += stats->c2p_usec[i];
+		avg /= stats->c2p_count;
+		min = stats->c2p_usec[0];
+		max = stats->c2p_usec[stats->c2p_count - 1];
+	}
+	p50 = percentile(stats->c2p_usec, stats->c2p_count, 50);
+	p90 = percentile(stats->c2p_usec, stats->c2p_count, 90);
+	p99 = percentile(stats->c2p_usec, stats->c2p_count, 99);
+
+	if (stats->p2p_count) {
+		p2p_avg = stats->p2p_sum / stats->p2p_count;
+		jitter = stats->p2p_sum_sq / stats->p2p_count -
+			 p2p_avg * p2p_avg;
+		jitter = jitter > 0.0 ? sqrt(jitter) : 0.0;
+	}
+
+	if (window->format == OUTPUT_JSON) {
+		printf("{ \"mode\": \"%s\", \"delay_ms\": %d, "
+		       "\"presented\": %u, \"discarded\": %u, "
+		       "\"missed_vblanks\": %u, \"refresh_us\": %u,\n"
+		       "  \"c2p_us\": { \"min\": %d, \"avg\": %.1f, "
+		       "\"p50\": %d, \"p90\": %d, \"p99\": %d, "
+		       "\"max\": %d },\n"
+		       "  \"p2p_us\": { \"avg\": %.1f, \"stddev\": %.1f, "
+		       "\"max_dev\": %d } }\n",
+		       run_mode_name[window->mode], window->commit_delay_msecs,
+		       stats->presented, stats->discarded, stats->missed,
+		       stats->refresh_nsec / 1000,
+		       min, avg, p50, p90, p99, max,
+		       p2p_avg, jitter, stats->p2p_max_dev);
+		return;
+	}
+
+	/* Keep stdout parseable when it carries CSV rows. */
+	fp = window->format == OUTPUT_CSV ? stderr : stdout;
+	fprintf(fp, "%s: %u presented, %u discarded, %u missed vblanks, "
+		"refresh %u us\n", run_mode_name[window->mode],
+		stats->presented, stats->discarded, stats->missed,
+		stats->refresh_nsec / 1000);
+	fprintf(fp, "c2p us: min %d, avg %.1f, p50 %d, p90 %d, p99 %d, "
+		"max %d\n", min, avg, p50, p90, p99, max);
+	fprintf(fp, "p2p us: avg %.1f, stddev %.1f, max deviation %d\n",
+		p2p_avg, jitter, stats->p2p_max_dev);
+}
+
 static void
 feedback_presented(void *data,
 		   struct presentation_feedback *presentation_feedback,
@@ -416,7 +585,7 @@ feedback_presented(void *data,
 	const struct timespec *prevpresent;
 	uint32_t commit, present;
 	uint32_t f2c, c2p, f2p;
-	int p2p, t2p;
+	int p2p, t2p, c2p_usec;
 	char flagstr[10];
 
 	timespec_from_proto(&feedback->present, tv_sec_hi, tv_sec_lo, tv_nsec);
@@ -433,25 +602,41 @@ feedback_presented(void *data,
 	f2p = present - feedback->frame_stamp;
 	p2p = timespec_diff_to_usec(&feedback->present, prevpresent);
 	t2p = timespec_diff_to_usec(&feedback->present, &feedback->target);
+	c2p_usec = timespec_diff_to_usec(&feedback->present, &feedback->commit);
 
-	switch (window->mode) {
-	case RUN_MODE_PRESENT:
-		printf("%6u: c2p %4u ms, p2p %5d us, t2p %6d us, [%s] "
-			"seq %" PRIu64 "\n", feedback->frame_no, c2p,
-			p2p, t2p,
-			pflags_to_str(flags, flagstr, sizeof(flagstr)), seq);
+	bench_add_presented(window, c2p_usec, p2p, prev_feedback != NULL,
+			    refresh_nsec);
+
+	switch (window->format) {
+	case OUTPUT_CSV:
+		printf("%u,%u,%d,%d,%u,%s,%" PRIu64 "\n", feedback->frame_no,
+		       f2c, c2p_usec, p2p, refresh_nsec / 1000,
+		       pflags_to_str(flags, flagstr, sizeof(flagstr)), seq);
+		break;
+	case OUTPUT_JSON:
+		/* summary only */
+		break;
+	case OUTPUT_TEXT:
+		if (window->mode == RUN_MODE_PRESENT)
+			printf("%6u: c2p %4u ms, p2p %5d us, t2p %6d us, [%s] "
+				"seq %" PRIu64 "\n", feedback->frame_no, c2p,
+				p2p, t2p,
+				pflags_to_str(flags, flagstr, sizeof(flagstr)),
+				seq);
+		else
+			printf("%6u: f2c %2u ms, c2p %2u ms, f2p %2u ms, "
+				"p2p %5d us, t2p %6d, [%s], seq %" PRIu64 "\n",
+				feedback->frame_no, f2c, c2p, f2p, p2p, t2p,
+				pflags_to_str(flags, flagstr, sizeof(flagstr)),
+				seq);
 		break;
-	case RUN_MODE_FEEDBACK:
-	case RUN_MODE_FEEDBACK_IDLE:
-		printf("%6u: f2c %2u ms, c2p %2u ms, f2p %2u ms, p2p %5d us, "
-			"t2p %6d, [%s], seq %" PRIu64 "\n", feedback->frame_no,
-			f2c, c2p, f2p, p2p, t2p,
-			pflags_to_str(flags, flagstr, sizeof(flagstr)), seq);
 	}
 
 	if (window->received_feedback)
 		destroy_feedback(window->received_feedback);
 	window->received_feedback = feedback;
+
+	bench_check_done(window);
 }
 
 static void
@@ -459,10 +644,16 @@ feedback_discarded(void *data,
 		   struct presentation_feedback *presentation_feedback)
 {
 	struct feedback *feedback = data;
+	struct window *window = feedback->window;
 
-	printf("discarded %u\n", feedback->frame_no);
+	if (window->format == OUTPUT_TEXT)
+		printf("discarded %u\n", feedback->frame_no);
+	else if (window->format == OUTPUT_CSV)
+		printf("%u,,,,,discarded,\n", feedback->frame_no);
 
+	window->stats.discarded++;
 	destroy_feedback(feedback);
+	bench_check_done(window);
 }
 
 static const struct presentation_feedback_listener feedback_listener = {
@@ -821,8 +1012,6 @@ destroy_display(struct display *display)
 	free(display);
 }
 
-static int running = 1;
-
 static void
 signal_int(int signum)
 {
@@ -839,7 +1028,11 @@ usage(const char *prog, int exit_code)
 		"  -p\t\trun in low-latency presentation mode\n"
 		"and 'options' may include\n"
 		"  -d msecs\temulate the time used for rendering by a delay \n"
-		"\t\tof the given milliseconds before commit\n\n",
+		"\t\tof the given milliseconds before commit\n"
+		"  -n frames\tstop after this many frames were presented or\n"
+		"\t\tdiscarded and print the statistics summary\n"
+		"  -o format\toutput 'text' (default), 'csv' (per-frame rows,\n"
+		"\t\tsummary on stderr) or 'json' (summary only)\n\n",
 		prog);
 
 	fprintf(stderr, "Printed timing statistics, depending on mode:\n"
@@ -849,7 +1042,10 @@ usage(const char *prog, int exit_code)
 		"  f2p: time from frame callback timestamp to presentation\n"
 		"  p2p: time from previous presentation to this one\n"
 		"  t2p: time from target timestamp to presentation\n"
-		"  seq: MSC\n");
+		"  seq: MSC\n"
+		"The summary adds the commit to presentation latency\n"
+		"distribution, vblanks missed between presentations and the\n"
+		"standard deviation of the presentation interval (jitter).\n");
 
 
 	exit(exit_code);
@@ -865,6 +1061,8 @@ main(int argc, char **argv)
 	enum run_mode mode = RUN_MODE_FEEDBACK;
 	int i;
 	int commit_delay_msecs = 0;
+	unsigned max_frames = 0;
+	enum output_format format = OUTPUT_TEXT;
 
 	for (i = 1; i < argc; i++) {
 		if (strcmp("-f", argv[i]) == 0)
@@ -877,6 +1075,21 @@ main(int argc, char **argv)
 			i++;
 			commit_delay_msecs = atoi(argv[i]);
 		}
+		else if ((strcmp("-n", argv[i]) == 0) && (i + 1 < argc)) {
+			i++;
+			max_frames = strtoul(argv[i], NULL, 10);
+		}
+		else if ((strcmp("-o", argv[i]) == 0) && (i + 1 < argc)) {
+			i++;
+			if (strcmp(argv[i], "text") == 0)
+				format = OUTPUT_TEXT;
+			else if (strcmp(argv[i], "csv") == 0)
+				format = OUTPUT_CSV;
+			else if (strcmp(argv[i], "json") == 0)
+				format = OUTPUT_JSON;
+			else
+				usage(argv[0], EXIT_FAILURE);
+		}
 		else
 			usage(argv[0], EXIT_FAILURE);
 	}
@@ -886,6 +1099,11 @@ main(int argc, char **argv)
 	if (!window)
 		return 1;
 
+	window->max_frames = max_frames;
+	window->format = format;
+	if (format == OUTPUT_CSV)
+		printf("frame,f2c_ms,c2p_us,p2p_us,refresh_us,flags,seq\n");
+
 	sigint.sa_handler = signal_int;
 	sigemptyset(&sigint.sa_mask);
 	sigint.sa_flags = SA_RESETHAND;
@@ -907,6 +1125,7 @@ main(int argc, char **argv)
 		ret = wl_display_dispatch(display->display);
 
 	fprintf(stderr, "presentation-shm exiting\n");
+	bench_report(window);
 	destroy_window(window);
 	destroy_display(display);
 
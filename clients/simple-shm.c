@@ -102,6 +102,9 @@ create_shm_buffer(struct display *display, struct buffer *buffer,
 		return -1;
 	}
 
+	/* Lets the compositor skip copying the buffers, if it can */
+	os_seal_shrink(fd);
+
 	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
 	if (data == MAP_FAILED) {
 		fprintf(stderr, "mmap failed: %m\n");
@@ -0,0 +1,1048 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Load generator for the compositor: creates a number of toplevel
+ * windows, each with a number of desynchronized sub-surfaces, and
+ * commits all of them with a chosen damage pattern, either at a fixed
+ * rate or driven by frame callbacks. Every commit asks for presentation
+ * feedback and the commit-to-present latency is reported periodically.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <signal.h>
+#include <time.h>
+
+#include <wayland-client.h>
+#include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+#include "presentation_timing-client-protocol.h"
+
+#define NUM_BUFFERS 3
+#define SCATTER_RECTS 8
+#define MAX_DAMAGE_RECTS SCATTER_RECTS
+#define LATENCY_BUCKETS 200	/* 1 ms each, the last one is overflow */
+
+enum damage_mode {
+	DAMAGE_FULL,
+	DAMAGE_RECT,
+	DAMAGE_SCATTER,
+};
+
+static const char * const damage_mode_name[] = {
+	[DAMAGE_FULL] = "full",
+	[DAMAGE_RECT] = "rect",
+	[DAMAGE_SCATTER] = "scatter",
+};
+
+struct options {
+	int windows;
+	int subsurfaces;
+	int width, height;
+	int sub_width, sub_height;
+	enum damage_mode damage;
+	int rate;
+	int duration;
+	int report;
+};
+
+struct stats {
+	uint64_t commits;
+	uint64_t skipped;
+	uint64_t presented;
+	uint64_t discarded;
+	uint64_t c2p_sum_usec;
+	uint32_t c2p_max_usec;
+	uint32_t hist[LATENCY_BUCKETS];
+};
+
+struct display {
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	struct wl_subcompositor *subcompositor;
+	struct wl_shell *shell;
+
+	struct wl_shm *shm;
+	uint32_t formats;
+
+	struct presentation *presentation;
+	clockid_t clk_id;
+
+	const struct options *opts;
+	struct wl_list window_list;	/* struct window::link */
+	struct wl_list feedback_list;	/* struct feedback::link */
+
+	struct stats interval;
+	struct stats total;
+	struct timespec start;
+	struct timespec last_report;
+};
+
+struct buffer {
+	struct wl_buffer *buffer;
+	void *shm_data;
+	int busy;
+};
+
+struct surface {
+	struct window *window;
+	struct wl_surface *surface;
+	struct wl_subsurface *subsurface;
+	int width, height;
+	struct buffer buffers[NUM_BUFFERS];
+	void *shm_data;
+	size_t shm_size;
+	uint32_t frame;
+};
+
+struct window {
+	struct display *display;
+	struct surface main;
+	struct wl_shell_surface *shell_surface;
+	struct surface *subs;
+	int num_subs;
+	struct wl_callback *callback;
+	struct wl_list link;
+};
+
+struct feedback {
+	struct display *display;
+	struct presentation_feedback *feedback;
+	struct timespec commit;
+	struct wl_list link;
+};
+
+static int running = 1;
+
+static void
+buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct buffer *mybuf = data;
+
+	mybuf->busy = 0;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	buffer_release
+};
+
+static int
+surface_create_buffers(struct display *display, struct surface *surface)
+{
+	struct wl_shm_pool *pool;
+	int fd, size, stride, offset;
+	void *data;
+	int i;
+
+	stride = surface->width * 4;
+	size = stride * surface->height * NUM_BUFFERS;
+
+	fd = os_create_anonymous_file(size);
+	if (fd < 0) {
+		fprintf(stderr, "creating a buffer file for %d B failed: %m\n",
+			size);
+		return -1;
+	}
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %m\n");
+		close(fd);
+		return -1;
+	}
+
+	pool = wl_shm_create_pool(display->shm, fd, size);
+	offset = 0;
+
+	for (i = 0; i < NUM_BUFFERS; i++) {
+		surface->buffers[i].buffer =
+			wl_shm_pool_create_buffer(pool, offset,
+						  surface->width,
+						  surface->height, stride,
+						  WL_SHM_FORMAT_XRGB8888);
+		assert(surface->buffers[i].buffer);
+		wl_buffer_add_listener(surface->buffers[i].buffer,
+				       &buffer_listener, &surface->buffers[i]);
+
+		surface->buffers[i].shm_data = (char *)data + offset;
+		memset(surface->buffers[i].shm_data, 0x40, stride *
+		       surface->height);
+		offset += stride * surface->height;
+	}
+
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	surface->shm_data = data;
+	surface->shm_size = size;
+
+	return 0;
+}
+
+static int
+surface_init(struct surface *surface, struct window *window,
+	     int width, int height)
+{
+	surface->window = window;
+	surface->width = width;
+	surface->height = height;
+	surface->surface =
+		wl_compositor_create_surface(window->display->compositor);
+
+	return surface_create_buffers(window->display, surface);
+}
+
+static void
+surface_fini(struct surface *surface)
+{
+	int i;
+
+	if (surface->subsurface)
+		wl_subsurface_destroy(surface->subsurface);
+	wl_surface_destroy(surface->surface);
+
+	for (i = 0; i < NUM_BUFFERS; i++)
+		if (surface->buffers[i].buffer)
+			wl_buffer_destroy(surface->buffers[i].buffer);
+
+	if (surface->shm_data)
+		munmap(surface->shm_data, surface->shm_size);
+}
+
+static struct buffer *
+surface_next_buffer(struct surface *surface)
+{
+	int i;
+
+	for (i = 0; i < NUM_BUFFERS; i++)
+		if (!surface->buffers[i].busy)
+			return &surface->buffers[i];
+
+	return NULL;
+}
+
+static void
+fill_rect(struct surface *surface, struct buffer *buffer,
+	  int x, int y, int width, int height, uint32_t color)
+{
+	uint32_t *row;
+	int i, j;
+
+	row = (uint32_t *)buffer->shm_data + y * surface->width + x;
+	for (j = 0; j < height; j++) {
+		for (i = 0; i < width; i++)
+			row[i] = color;
+		row += surface->width;
+	}
+}
+
+/* Fill rects with the damage for the next frame of surface according
+ * to the damage mode, returning the number of rectangles. Each rect
+ * is { x, y, width, height }. */
+static int
+surface_get_damage(struct surface *surface, enum damage_mode mode,
+		   int32_t rects[][4])
+{
+	int w = surface->width;
+	int h = surface->height;
+	int rw, rh, i;
+
+	switch (mode) {
+	case DAMAGE_FULL:
+		break;
+	case DAMAGE_RECT:
+		rw = MAX(w / 4, 1);
+		rh = MAX(h / 4, 1);
+		rects[0][0] = (surface->frame * 3) % (w - rw + 1);
+		rects[0][1] = (surface->frame * 2) % (h - rh + 1);
+		rects[0][2] = rw;
+		rects[0][3] = rh;
+		return 1;
+	case DAMAGE_SCATTER:
+		rw = MAX(w / 16, 1);
+		rh = MAX(h / 16, 1);
+		for (i = 0; i < SCATTER_RECTS; i++) {
+			rects[i][0] = rand() % (w - rw + 1);
+			rects[i][1] = rand() % (h - rh + 1);
+			rects[i][2] = rw;
+			rects[i][3] = rh;
+		}
+		return SCATTER_RECTS;
+	}
+
+	rects[0][0] = 0;
+	rects[0][1] = 0;
+	rects[0][2] = w;
+	rects[0][3] = h;
+
+	return 1;
+}
+
+static void
+feedback_destroy(struct feedback *feedback)
+{
+	presentation_feedback_destroy(feedback->feedback);
+	wl_list_remove(&feedback->link);
+	free(feedback);
+}
+
+static void
+timespec_from_proto(struct timespec *tm, uint32_t tv_sec_hi,
+		    uint32_t tv_sec_lo, uint32_t tv_nsec)
+{
+	tm->tv_sec = ((uint64_t)tv_sec_hi << 32) + tv_sec_lo;
+	tm->tv_nsec = tv_nsec;
+}
+
+static int64_t
+timespec_diff_to_usec(const struct timespec *a, const struct timespec *b)
+{
+	time_t secs = a->tv_sec - b->tv_sec;
+	long nsec = a->tv_nsec - b->tv_nsec;
+
+	return (int64_t)secs * 1000000 + nsec / 1000;
+}
+
+static void
+stats_add_latency(struct stats *stats, uint32_t usec)
+{
+	uint32_t bucket = usec / 1000;
+
+	if (bucket >= LATENCY_BUCKETS)
+		bucket = LATENCY_BUCKETS - 1;
+
+	stats->presented++;
+	stats->c2p_sum_usec += usec;
+	if (usec > stats->c2p_max_usec)
+		stats->c2p_max_usec = usec;
+	stats->hist[bucket]++;
+}
+
+static void
+feedback_sync_output(void *data,
+		     struct presentation_feedback *presentation_feedback,
+		     struct wl_output *output)
+{
+	/* not interested */
+}
+
+static void
+feedback_presented(void *data,
+		   struct presentation_feedback *presentation_feedback,
+		   uint32_t tv_sec_hi,
+		   uint32_t tv_sec_lo,
+		   uint32_t tv_nsec,
+		   uint32_t refresh_nsec,
+		   uint32_t seq_hi,
+		   uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct feedback *feedback = data;
+	struct display *display = feedback->display;
+	struct timespec present;
+	int64_t c2p;
+
+	timespec_from_proto(&present, tv_sec_hi, tv_sec_lo, tv_nsec);
+	c2p = timespec_diff_to_usec(&present, &feedback->commit);
+	if (c2p < 0)
+		c2p = 0;
+
+	stats_add_latency(&display->interval, c2p);
+	stats_add_latency(&display->total, c2p);
+
+	feedback_destroy(feedback);
+}
+
+static void
+feedback_discarded(void *data,
+		   struct presentation_feedback *presentation_feedback)
+{
+	struct feedback *feedback = data;
+	struct display *display = feedback->display;
+
+	display->interval.discarded++;
+	display->total.discarded++;
+
+	feedback_destroy(feedback);
+}
+
+static const struct presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+static void
+surface_commit_next(struct surface *surface)
+{
+	struct display *display = surface->window->display;
+	int32_t rects[MAX_DAMAGE_RECTS][4];
+	struct feedback *feedback;
+	struct buffer *buffer;
+	uint32_t color;
+	int n, i;
+
+	buffer = surface_next_buffer(surface);
+	if (!buffer) {
+		/* The compositor still holds every buffer; committing
+		 * anyway would only measure our own starvation. */
+		display->interval.skipped++;
+		display->total.skipped++;
+		return;
+	}
+
+	surface->frame++;
+	color = 0xff000000 | (surface->frame * 0x010305 & 0xffffff);
+
+	n = surface_get_damage(surface, display->opts->damage, rects);
+	for (i = 0; i < n; i++) {
+		fill_rect(surface, buffer, rects[i][0], rects[i][1],
+			  rects[i][2], rects[i][3], color);
+		wl_surface_damage(surface->surface, rects[i][0], rects[i][1],
+				  rects[i][2], rects[i][3]);
+	}
+
+	wl_surface_attach(surface->surface, buffer->buffer, 0, 0);
+	buffer->busy = 1;
+
+	feedback = calloc(1, sizeof *feedback);
+	assert(feedback);
+	feedback->display = display;
+	feedback->feedback = presentation_feedback(display->presentation,
+						   surface->surface);
+	presentation_feedback_add_listener(feedback->feedback,
+					   &feedback_listener, feedback);
+	wl_list_insert(&display->feedback_list, &feedback->link);
+
+	clock_gettime(display->clk_id, &feedback->commit);
+	wl_surface_commit(surface->surface);
+
+	display->interval.commits++;
+	display->total.commits++;
+}
+
+static void
+window_commit(struct window *window)
+{
+	int i;
+
+	/* Sub-surfaces are desynchronized, so every one of these is an
+	 * independent commit the compositor has to process. */
+	for (i = 0; i < window->num_subs; i++)
+		surface_commit_next(&window->subs[i]);
+
+	surface_commit_next(&window->main);
+}
+
+static const struct wl_callback_listener frame_listener;
+
+static void
+redraw(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct window *window = data;
+
+	if (callback)
+		wl_callback_destroy(callback);
+
+	window->callback = wl_surface_frame(window->main.surface);
+	wl_callback_add_listener(window->callback, &frame_listener, window);
+
+	window_commit(window);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	redraw
+};
+
+static void
+handle_ping(void *data, struct wl_shell_surface *shell_surface,
+	    uint32_t serial)
+{
+	wl_shell_surface_pong(shell_surface, serial);
+}
+
+static void
+handle_configure(void *data, struct wl_shell_surface *shell_surface,
+		 uint32_t edges, int32_t width, int32_t height)
+{
+}
+
+static void
+handle_popup_done(void *data, struct wl_shell_surface *shell_surface)
+{
+}
+
+static const struct wl_shell_surface_listener shell_surface_listener = {
+	handle_ping,
+	handle_configure,
+	handle_popup_done
+};
+
+static struct window *
+create_window(struct display *display, int index)
+{
+	const struct options *opts = display->opts;
+	struct window *window;
+	struct surface *sub;
+	char title[128];
+	int cols, i;
+
+	window = calloc(1, sizeof *window);
+	if (!window)
+		return NULL;
+
+	window->display = display;
+	if (surface_init(&window->main, window,
+			 opts->width, opts->height) < 0)
+		goto err;
+
+	window->shell_surface = wl_shell_get_shell_surface(display->shell,
+							   window->main.surface);
+	wl_shell_surface_add_listener(window->shell_surface,
+				      &shell_surface_listener, window);
+	snprintf(title, sizeof title, "surface-stress %d", index);
+	wl_shell_surface_set_title(window->shell_surface, title);
+	wl_shell_surface_set_toplevel(window->shell_surface);
+
+	window->subs = calloc(opts->subsurfaces, sizeof *window->subs);
+	if (opts->subsurfaces && !window->subs)
+		goto err;
+
+	/* Lay the sub-surfaces out on a grid over the parent; when they
+	 * do not all fit they overlap, which is fine for a stress load. */
+	cols = MAX(opts->width / opts->sub_width, 1);
+	for (i = 0; i < opts->subsurfaces; i++) {
+		sub = &window->subs[i];
+		window->num_subs++;
+		if (surface_init(sub, window,
+				 opts->sub_width, opts->sub_height) < 0)
+			goto err;
+
+		sub->subsurface =
+			wl_subcompositor_get_subsurface(display->subcompositor,
+							sub->surface,
+							window->main.surface);
+		wl_subsurface_set_position(sub->subsurface,
+					   (i % cols) * opts->sub_width,
+					   (i / cols) * opts->sub_height %
+					   MAX(opts->height, 1));
+		wl_subsurface_set_desync(sub->subsurface);
+	}
+
+	wl_list_insert(display->window_list.prev, &window->link);
+
+	return window;
+
+err:
+	for (i = 0; i < window->num_subs; i++)
+		surface_fini(&window->subs[i]);
+	free(window->subs);
+	if (window->shell_surface)
+		wl_shell_surface_destroy(window->shell_surface);
+	if (window->main.surface)
+		surface_fini(&window->main);
+	free(window);
+
+	return NULL;
+}
+
+static void
+destroy_window(struct window *window)
+{
+	int i;
+
+	if (window->callback)
+		wl_callback_destroy(window->callback);
+
+	for (i = 0; i < window->num_subs; i++)
+		surface_fini(&window->subs[i]);
+	free(window->subs);
+
+	wl_shell_surface_destroy(window->shell_surface);
+	surface_fini(&window->main);
+
+	wl_list_remove(&window->link);
+	free(window);
+}
+
+static void
+presentation_clock_id(void *data, struct presentation *presentation,
+		      uint32_t clk_id)
+{
+	struct display *d = data;
+
+	d->clk_id = clk_id;
+}
+
+static const struct presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
+static void
+shm_format(void *data, struct wl_shm *wl_shm, uint32_t format)
+{
+	struct display *d = data;
+
+	d->formats |= (1 << format);
+}
+
+static const struct wl_shm_listener shm_listener = {
+	shm_format
+};
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t name, const char *interface, uint32_t version)
+{
+	struct display *d = data;
+
+	if (strcmp(interface, "wl_compositor") == 0) {
+		d->compositor =
+			wl_registry_bind(registry,
+					 name, &wl_compositor_interface, 1);
+	} else if (strcmp(interface, "wl_subcompositor") == 0) {
+		d->subcompositor =
+			wl_registry_bind(registry,
+					 name, &wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, "wl_shell") == 0) {
+		d->shell = wl_registry_bind(registry,
+					    name, &wl_shell_interface, 1);
+	} else if (strcmp(interface, "wl_shm") == 0) {
+		d->shm = wl_registry_bind(registry,
+					  name, &wl_shm_interface, 1);
+		wl_shm_add_listener(d->shm, &shm_listener, d);
+	} else if (strcmp(interface, "presentation") == 0) {
+		d->presentation =
+			wl_registry_bind(registry,
+					 name, &presentation_interface, 1);
+		presentation_add_listener(d->presentation,
+					  &presentation_listener, d);
+	}
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static struct display *
+create_display(const struct options *opts)
+{
+	struct display *display;
+
+	display = calloc(1, sizeof *display);
+	if (display == NULL) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	display->display = wl_display_connect(NULL);
+	if (!display->display) {
+		fprintf(stderr, "failed to connect to the display: %m\n");
+		exit(1);
+	}
+
+	display->opts = opts;
+	display->clk_id = -1;
+	wl_list_init(&display->window_list);
+	wl_list_init(&display->feedback_list);
+	display->registry = wl_display_get_registry(display->display);
+	wl_registry_add_listener(display->registry,
+				 &registry_listener, display);
+	wl_display_roundtrip(display->display);
+
+	if (!display->compositor || !display->shell || !display->shm) {
+		fprintf(stderr, "wl_compositor, wl_shell or wl_shm missing\n");
+		exit(1);
+	}
+	if (opts->subsurfaces && !display->subcompositor) {
+		fprintf(stderr, "No wl_subcompositor global\n");
+		exit(1);
+	}
+	if (!display->presentation) {
+		fprintf(stderr, "No presentation global\n");
+		exit(1);
+	}
+
+	wl_display_roundtrip(display->display);
+
+	if (!(display->formats & (1 << WL_SHM_FORMAT_XRGB8888))) {
+		fprintf(stderr, "WL_SHM_FORMAT_XRGB32 not available\n");
+		exit(1);
+	}
+	if (display->clk_id == (clockid_t)-1) {
+		fprintf(stderr, "presentation clock id not received\n");
+		exit(1);
+	}
+
+	return display;
+}
+
+static void
+destroy_display(struct display *display)
+{
+	while (!wl_list_empty(&display->feedback_list)) {
+		struct feedback *f;
+
+		f = wl_container_of(display->feedback_list.next, f, link);
+		feedback_destroy(f);
+	}
+
+	while (!wl_list_empty(&display->window_list)) {
+		struct window *w;
+
+		w = wl_container_of(display->window_list.next, w, link);
+		destroy_window(w);
+	}
+
+	if (display->presentation)
+		presentation_destroy(display->presentation);
+
+	if (display->shm)
+		wl_shm_destroy(display->shm);
+
+	if (display->shell)
+		wl_shell_destroy(display->shell);
+
+	if (display->subcompositor)
+		wl_subcompositor_destroy(display->subcompositor);
+
+	if (display->compositor)
+		wl_compositor_destroy(display->compositor);
+
+	wl_registry_destroy(display->registry);
+	wl_display_flush(display->display);
+	wl_display_disconnect(display->display);
+	free(display);
+}
+
+static uint32_t
+stats_percentile(const struct stats *stats, unsigned percent)
+{
+	uint64_t target, seen = 0;
+	unsigned i;
+
+	if (stats->presented == 0)
+		return 0;
+
+	target = (stats->presented * percent + 99) / 100;
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += stats->hist[i];
+		if (seen >= target)
+			break;
+	}
+
+	return i;
+}
+
+static void
+print_stats(const char *what, const struct stats *stats, int64_t usec)
+{
+	double secs = usec / 1000000.0;
+	uint64_t avg = 0;
+
+	if (stats->presented)
+		avg = stats->c2p_sum_usec / stats->presented;
+
+	printf("%s %7.2f s: %8.1f commits/s, %" PRIu64 " skipped, "
+	       "%" PRIu64 " presented, %" PRIu64 " discarded, "
+	       "c2p avg %" PRIu64 " us, p50 %u ms, p99 %u ms, max %u us\n",
+	       what, secs, secs > 0 ? stats->commits / secs : 0.0,
+	       stats->skipped, stats->presented, stats->discarded,
+	       avg, stats_percentile(stats, 50), stats_percentile(stats, 99),
+	       stats->c2p_max_usec);
+	fflush(stdout);
+}
+
+static void
+display_report(struct display *display)
+{
+	struct timespec now;
+
+	clock_gettime(display->clk_id, &now);
+	print_stats("interval", &display->interval,
+		    timespec_diff_to_usec(&now, &display->last_report));
+
+	memset(&display->interval, 0, sizeof display->interval);
+	display->last_report = now;
+}
+
+static int
+create_timer(uint64_t period_nsec)
+{
+	struct itimerspec its;
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "timerfd_create failed: %m\n");
+		exit(1);
+	}
+
+	its.it_interval.tv_sec = period_nsec / 1000000000;
+	its.it_interval.tv_nsec = period_nsec % 1000000000;
+	its.it_value = its.it_interval;
+	timerfd_settime(fd, 0, &its, NULL);
+
+	return fd;
+}
+
+static int
+read_timer(int fd)
+{
+	uint64_t expires;
+
+	if (read(fd, &expires, sizeof expires) != sizeof expires)
+		return 0;
+
+	return expires > 0;
+}
+
+static void
+signal_int(int signum)
+{
+	running = 0;
+}
+
+static void
+usage(const char *prog, int exit_code)
+{
+	fprintf(stderr, "Usage: %s [options]\n"
+		"  --windows=N\t\tnumber of toplevel windows (default 1)\n"
+		"  --subsurfaces=N\tsub-surfaces per window (default 0)\n"
+		"  --size=WxH\t\ttoplevel size (default 256x256)\n"
+		"  --sub-size=WxH\tsub-surface size (default 64x64)\n"
+		"  --damage=MODE\t\tfull, rect or scatter (default full)\n"
+		"  --rate=HZ\t\tcommits per second per surface; 0 follows\n"
+		"\t\t\tframe callbacks (default 0)\n"
+		"  --duration=SECS\tstop after this long; 0 runs until\n"
+		"\t\t\tinterrupted (default 0)\n"
+		"  --report=SECS\t\tstatistics interval (default 1)\n"
+		"  -h, --help\t\tthis help\n\n",
+		prog);
+
+	fprintf(stderr, "Printed statistics:\n"
+		"  commits/s: surface commits sent by this client\n"
+		"  skipped: commits dropped because no buffer was released\n"
+		"  presented/discarded: presentation feedback received\n"
+		"  c2p: time from commit to presentation\n");
+
+	exit(exit_code);
+}
+
+static int
+parse_damage_mode(const char *s, enum damage_mode *mode)
+{
+	unsigned i;
+
+	for (i = 0; i < ARRAY_LENGTH(damage_mode_name); i++) {
+		if (strcmp(s, damage_mode_name[i]) == 0) {
+			*mode = i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sigaction sigint;
+	struct display *display;
+	struct window *window;
+	struct options opts = {
+		.windows = 1,
+		.subsurfaces = 0,
+		.width = 256,
+		.height = 256,
+		.sub_width = 64,
+		.sub_height = 64,
+		.damage = DAMAGE_FULL,
+		.rate = 0,
+		.duration = 0,
+		.report = 1,
+	};
+	struct pollfd pfd[3];
+	struct timespec now;
+	int commit_fd = -1, report_fd;
+	int nfds, ret = 0;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--help") == 0 ||
+		    strcmp(argv[i], "-h") == 0) {
+			usage(argv[0], EXIT_SUCCESS);
+		} else if (sscanf(argv[i], "--windows=%d", &opts.windows) > 0) {
+			;
+		} else if (sscanf(argv[i], "--subsurfaces=%d",
+				  &opts.subsurfaces) > 0) {
+			;
+		} else if (sscanf(argv[i], "--size=%dx%d",
+				  &opts.width, &opts.height) == 2) {
+			;
+		} else if (sscanf(argv[i], "--sub-size=%dx%d",
+				  &opts.sub_width, &opts.sub_height) == 2) {
+			;
+		} else if (strncmp(argv[i], "--damage=", 9) == 0 &&
+			   parse_damage_mode(argv[i] + 9, &opts.damage)) {
+			;
+		} else if (sscanf(argv[i], "--rate=%d", &opts.rate) > 0) {
+			;
+		} else if (sscanf(argv[i], "--duration=%d",
+				  &opts.duration) > 0) {
+			;
+		} else if (sscanf(argv[i], "--report=%d", &opts.report) > 0) {
+			;
+		} else {
+			printf("Invalid option: %s\n", argv[i]);
+			usage(argv[0], EXIT_FAILURE);
+		}
+	}
+
+	if (opts.windows < 1 || opts.subsurfaces < 0 ||
+	    opts.width < 1 || opts.height < 1 ||
+	    opts.sub_width < 1 || opts.sub_height < 1 ||
+	    opts.rate < 0 || opts.duration < 0 || opts.report < 1)
+		usage(argv[0], EXIT_FAILURE);
+
+	display = create_display(&opts);
+
+	for (i = 0; i < opts.windows; i++) {
+		window = create_window(display, i);
+		if (!window) {
+			fprintf(stderr, "failed to create window %d\n", i);
+			destroy_display(display);
+			return 1;
+		}
+	}
+
+	sigint.sa_handler = signal_int;
+	sigemptyset(&sigint.sa_mask);
+	sigint.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &sigint, NULL);
+
+	printf("surface-stress: %d windows x (1 + %d sub-surfaces), "
+	       "damage %s, %s\n", opts.windows, opts.subsurfaces,
+	       damage_mode_name[opts.damage],
+	       opts.rate ? "fixed rate" : "frame callback driven");
+
+	clock_gettime(display->clk_id, &display->start);
+	display->last_report = display->start;
+
+	/* The first commit maps the windows; in frame callback mode it
+	 * also starts each window's redraw loop. */
+	wl_list_for_each(window, &display->window_list, link) {
+		if (opts.rate)
+			window_commit(window);
+		else
+			redraw(window, NULL, 0);
+	}
+
+	report_fd = create_timer((uint64_t)opts.report * 1000000000);
+	if (opts.rate)
+		commit_fd = create_timer(1000000000 / opts.rate);
+
+	pfd[0].fd = wl_display_get_fd(display->display);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = report_fd;
+	pfd[1].events = POLLIN;
+	pfd[2].fd = commit_fd;
+	pfd[2].events = POLLIN;
+	nfds = opts.rate ? 3 : 2;
+
+	while (running && ret != -1) {
+		wl_display_dispatch_pending(display->display);
+		ret = wl_display_flush(display->display);
+		if (ret < 0 && errno == EAGAIN) {
+			pfd[0].events = POLLIN | POLLOUT;
+		} else if (ret < 0) {
+			break;
+		}
+
+		if (poll(pfd, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			ret = wl_display_dispatch(display->display);
+			if (ret < 0)
+				break;
+		}
+		if (pfd[0].revents & POLLOUT)
+			pfd[0].events = POLLIN;
+		if (pfd[0].revents & (POLLERR | POLLHUP))
+			break;
+
+		if (nfds > 2 && (pfd[2].revents & POLLIN) &&
+		    read_timer(commit_fd)) {
+			/* Missed ticks are not made up for; the rate is a
+			 * ceiling, and falling behind shows up as a lower
+			 * commits/s figure. */
+			wl_list_for_each(window, &display->window_list, link)
+				window_commit(window);
+		}
+
+		if ((pfd[1].revents & POLLIN) && read_timer(report_fd)) {
+			display_report(display);
+
+			clock_gettime(display->clk_id, &now);
+			if (opts.duration &&
+			    timespec_diff_to_usec(&now, &display->start) >=
+			    (int64_t)opts.duration * 1000000)
+				running = 0;
+		}
+	}
+
+	clock_gettime(display->clk_id, &now);
+	print_stats("total", &display->total,
+		    timespec_diff_to_usec(&now, &display->start));
+
+	close(report_fd);
+	if (commit_fd >= 0)
+		close(commit_fd);
+	destroy_display(display);
+
+	return 0;
+}
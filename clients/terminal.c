@@ -52,6 +52,7 @@ static char *option_font;
 static int option_font_size;
 static char *option_term;
 static char *option_shell;
+static int option_scrollback_lines;
 
 static struct wl_list terminal_list;
 
@@ -378,6 +379,17 @@ apply_key_map(keyboard_mode mode, int sym, uint32_t modifiers, char *response)
 }
 
 struct terminal_color { double r, g, b, a; };
+#define GLYPH_CACHE_SIZE 512
+
+/* The glyphs a character cell was shaped to, relative to the cell
+ * origin, so unchanged characters skip cairo_scaled_font_text_to_glyphs. */
+struct glyph_cache_entry {
+	union utf8_char c;
+	int bold;
+	int num_glyphs;
+	cairo_glyph_t glyphs[4];
+};
+
 struct attr {
 	unsigned char fg, bg;
 	char a;        /* attributes format:
@@ -435,6 +447,8 @@ struct terminal {
 	struct task io_task;
 	char *tab_ruler;
 	struct attr *data_attr;
+	uint32_t attr_rows;	/* rows of data_attr filled so far */
+	struct attr fill_attr;
 	struct attr curr_attr;
 	uint32_t mode;
 	char origin_mode;
@@ -467,7 +481,15 @@ struct terminal {
 	cairo_font_extents_t extents;
 	double average_width;
 	cairo_scaled_font_t *font_normal, *font_bold;
+	struct glyph_cache_entry *glyph_cache;
 	uint32_t hide_cursor_serial;
+
+	/* Rendered cells, kept across redraws so only the rows that
+	 * changed since the last frame are drawn again. */
+	cairo_surface_t *text_surface;
+	struct rendered_cell *rendered;
+	int rendered_width, rendered_height, rendered_scale;
+	uint32_t rendered_start;
 	int size_in_title;
 
 	struct wl_data_source *selection;
@@ -567,6 +589,16 @@ terminal_get_attr_row(struct terminal *terminal, int row)
 
 	index = (row + terminal->start) & (terminal->buffer_height - 1);
 
+	/* The scrollback can be large, so rows that were never used are
+	 * filled on first access rather than all at allocation time. */
+	while (terminal->attr_rows <= (uint32_t) index) {
+		attr_init((void *) terminal->data_attr +
+			  terminal->attr_rows * terminal->attr_pitch,
+			  terminal->fill_attr,
+			  terminal->attr_pitch / sizeof(struct attr));
+		terminal->attr_rows++;
+	}
+
 	return (void *) terminal->data_attr + index * terminal->attr_pitch;
 }
 
@@ -575,6 +607,11 @@ union decoded_attr {
 	uint32_t key;
 };
 
+struct rendered_cell {
+	union utf8_char c;
+	union decoded_attr attr;
+};
+
 static void
 terminal_decode_attr(struct terminal *terminal, int row, int col,
 		     union decoded_attr *decoded)
@@ -779,8 +816,7 @@ terminal_resize_cells(struct terminal *terminal,
 		attr_pitch = width * sizeof(struct attr);
 		data_attr = xmalloc(attr_pitch * terminal->buffer_height);
 		tab_ruler = xzalloc(width);
-		attr_init(data_attr, terminal->curr_attr,
-			  width * terminal->buffer_height);
+		attr_init(data_attr, terminal->curr_attr, width * height);
 
 		if (terminal->data && terminal->data_attr) {
 			if (width > terminal->width)
@@ -817,6 +853,8 @@ terminal_resize_cells(struct terminal *terminal,
 		terminal->attr_pitch = attr_pitch;
 		terminal->data = data;
 		terminal->data_attr = data_attr;
+		terminal->attr_rows = height;
+		terminal->fill_attr = terminal->curr_attr;
 		terminal->tab_ruler = tab_ruler;
 		terminal->start = 0;
 	}
@@ -1004,19 +1042,80 @@ glyph_run_flush(struct glyph_run *run, union decoded_attr attr)
 	run->attr = attr;
 }
 
+static struct glyph_cache_entry *
+glyph_cache_lookup(struct terminal *terminal, union utf8_char *c, int bold,
+		   cairo_scaled_font_t *font)
+{
+	struct glyph_cache_entry *entry;
+	cairo_glyph_t *glyphs;
+	int num_glyphs;
+	uint32_t h;
+
+	if (!terminal->glyph_cache) {
+		terminal->glyph_cache = calloc(GLYPH_CACHE_SIZE,
+					       sizeof *terminal->glyph_cache);
+		if (!terminal->glyph_cache)
+			return NULL;
+	}
+
+	h = (c->ch * 2654435761u) >> 23;
+	entry = &terminal->glyph_cache[(h ^ bold) % GLYPH_CACHE_SIZE];
+	if (entry->num_glyphs > 0 && entry->c.ch == c->ch &&
+	    entry->bold == bold)
+		return entry;
+
+	glyphs = entry->glyphs;
+	num_glyphs = ARRAY_LENGTH(entry->glyphs);
+	if (cairo_scaled_font_text_to_glyphs(font, 0, 0,
+					     (char *) c->byte, 4,
+					     &glyphs, &num_glyphs,
+					     NULL, NULL, NULL) !=
+	    CAIRO_STATUS_SUCCESS) {
+		entry->num_glyphs = 0;
+		return NULL;
+	}
+
+	if (glyphs != entry->glyphs) {
+		/* More glyphs than we keep; cairo allocated them. */
+		cairo_glyph_free(glyphs);
+		entry->num_glyphs = 0;
+		return NULL;
+	}
+
+	entry->c = *c;
+	entry->bold = bold;
+	entry->num_glyphs = num_glyphs;
+
+	return entry;
+}
+
 static void
 glyph_run_add(struct glyph_run *run, int x, int y, union utf8_char *c)
 {
-	int num_glyphs;
+	int i, bold, num_glyphs;
 	cairo_scaled_font_t *font;
+	struct glyph_cache_entry *entry;
 
 	num_glyphs = ARRAY_LENGTH(run->glyphs) - run->count;
 
-	if (run->attr.attr.a & (ATTRMASK_BOLD | ATTRMASK_BLINK))
+	bold = !!(run->attr.attr.a & (ATTRMASK_BOLD | ATTRMASK_BLINK));
+	if (bold)
 		font = run->terminal->font_bold;
 	else
 		font = run->terminal->font_normal;
 
+	entry = glyph_cache_lookup(run->terminal, c, bold, font);
+	if (entry && entry->num_glyphs <= num_glyphs) {
+		for (i = 0; i < entry->num_glyphs; i++) {
+			run->g[i].index = entry->glyphs[i].index;
+			run->g[i].x = entry->glyphs[i].x + x;
+			run->g[i].y = entry->glyphs[i].y + y;
+		}
+		run->g += entry->num_glyphs;
+		run->count += entry->num_glyphs;
+		return;
+	}
+
 	cairo_move_to(run->cr, x, y);
 	cairo_scaled_font_text_to_glyphs (font, x, y,
 					  (char *) c->byte, 4,
@@ -1026,6 +1125,220 @@ glyph_run_add(struct glyph_run *run, int x, int y, union utf8_char *c)
 	run->count += num_glyphs;
 }
 
+/* Draw one row of cells, clipped to the row so rows can be redrawn
+ * independently on top of what was there before. */
+static void
+terminal_draw_row(struct terminal *terminal, cairo_t *cr, int row)
+{
+	union utf8_char *p_row;
+	union decoded_attr attr;
+	struct glyph_run run;
+	cairo_font_extents_t extents;
+	double average_width;
+	double unichar_width;
+	int col, text_x, text_y, y0, y1;
+
+	extents = terminal->extents;
+	average_width = terminal->average_width;
+
+	y0 = row * extents.height;
+	if (row == terminal->height - 1)
+		y1 = ceil(terminal->height * extents.height);
+	else
+		y1 = (row + 1) * extents.height;
+
+	cairo_save(cr);
+	cairo_rectangle(cr, 0, y0, terminal->width * average_width, y1 - y0);
+	cairo_clip(cr);
+
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	terminal_set_color(terminal, cr, terminal->color_scheme->border);
+	cairo_paint(cr);
+
+	/* paint the background */
+	p_row = terminal_get_row(terminal, row);
+	for (col = 0; col < terminal->width; col++) {
+		/* get the attributes for this character cell */
+		terminal_decode_attr(terminal, row, col, &attr);
+
+		if (attr.attr.bg == terminal->color_scheme->border)
+			continue;
+
+		if (is_wide(p_row[col]))
+			unichar_width = 2 * average_width;
+		else
+			unichar_width = average_width;
+
+		terminal_set_color(terminal, cr, attr.attr.bg);
+		cairo_move_to(cr, col * average_width,
+			      row * extents.height);
+		cairo_rel_line_to(cr, unichar_width, 0);
+		cairo_rel_line_to(cr, 0, extents.height);
+		cairo_rel_line_to(cr, -unichar_width, 0);
+		cairo_close_path(cr);
+		cairo_fill(cr);
+	}
+
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+
+	/* paint the foreground */
+	glyph_run_init(&run, terminal, cr);
+	for (col = 0; col < terminal->width; col++) {
+		/* get the attributes for this character cell */
+		terminal_decode_attr(terminal, row, col, &attr);
+
+		glyph_run_flush(&run, attr);
+
+		text_x = col * average_width;
+		text_y = extents.ascent + row * extents.height;
+		if (attr.attr.a & ATTRMASK_UNDERLINE) {
+			terminal_set_color(terminal, cr, attr.attr.fg);
+			cairo_move_to(cr, text_x, (double)text_y + 1.5);
+			cairo_line_to(cr, text_x + average_width, (double) text_y + 1.5);
+			cairo_stroke(cr);
+		}
+
+                /* skip space glyph (RLE) we use as a placeholder of
+                   the right half of a double-width character,
+                   because RLE is not available in every font. */
+		if (p_row[col].ch == 0x200B)
+			continue;
+
+		glyph_run_add(&run, text_x, text_y, &p_row[col]);
+	}
+
+	attr.key = ~0;
+	glyph_run_flush(&run, attr);
+
+	cairo_restore(cr);
+}
+
+/* Compare a row with what was drawn for it last time and remember the
+ * new contents.  Returns whether the row needs to be drawn again. */
+static int
+terminal_row_changed(struct terminal *terminal, int row)
+{
+	struct rendered_cell *cell;
+	union utf8_char *p_row;
+	union decoded_attr attr;
+	int col, changed = 0;
+
+	p_row = terminal_get_row(terminal, row);
+	cell = &terminal->rendered[row * terminal->width];
+	for (col = 0; col < terminal->width; col++, cell++) {
+		terminal_decode_attr(terminal, row, col, &attr);
+		if (cell->c.ch != p_row[col].ch ||
+		    cell->attr.key != attr.key) {
+			cell->c = p_row[col];
+			cell->attr = attr;
+			changed = 1;
+		}
+	}
+
+	return changed;
+}
+
+static void
+terminal_invalidate_text(struct terminal *terminal)
+{
+	if (terminal->text_surface)
+		cairo_surface_destroy(terminal->text_surface);
+	terminal->text_surface = NULL;
+	free(terminal->rendered);
+	terminal->rendered = NULL;
+}
+
+/* When the view scrolled since the last redraw, move the pixels and
+ * the remembered cells along with it so only the rows that scrolled
+ * in compare as changed.  Rows are only a whole number of pixels high
+ * with integral font metrics; otherwise everything is compared. */
+static void
+terminal_scroll_text(struct terminal *terminal)
+{
+	int d, rows, shift, stride, height;
+	uint8_t *data;
+
+	d = terminal->start - terminal->rendered_start;
+	terminal->rendered_start = terminal->start;
+	if (d == 0 || abs(d) >= terminal->height ||
+	    terminal->extents.height != floor(terminal->extents.height))
+		return;
+
+	cairo_surface_flush(terminal->text_surface);
+	data = cairo_image_surface_get_data(terminal->text_surface);
+	stride = cairo_image_surface_get_stride(terminal->text_surface);
+	height = cairo_image_surface_get_height(terminal->text_surface);
+	shift = abs(d) * terminal->extents.height * terminal->rendered_scale;
+	rows = terminal->height - abs(d);
+
+	if (d > 0) {
+		memmove(data, data + shift * stride, (height - shift) * stride);
+		memmove(terminal->rendered,
+			terminal->rendered + abs(d) * terminal->width,
+			rows * terminal->width * sizeof *terminal->rendered);
+	} else {
+		memmove(data + shift * stride, data, (height - shift) * stride);
+		memmove(terminal->rendered + abs(d) * terminal->width,
+			terminal->rendered,
+			rows * terminal->width * sizeof *terminal->rendered);
+	}
+	cairo_surface_mark_dirty(terminal->text_surface);
+}
+
+/* Bring the offscreen copy of the cells up to date, drawing only the
+ * rows that changed.  Returns NULL if it could not be allocated. */
+static cairo_surface_t *
+terminal_update_text(struct terminal *terminal, int scale)
+{
+	cairo_t *cr;
+	int row, width, height, all;
+
+	width = ceil(terminal->width * terminal->average_width);
+	height = ceil(terminal->height * terminal->extents.height);
+
+	all = 0;
+	if (!terminal->text_surface ||
+	    terminal->rendered_width != terminal->width ||
+	    terminal->rendered_height != terminal->height ||
+	    terminal->rendered_scale != scale) {
+		terminal_invalidate_text(terminal);
+
+		terminal->text_surface =
+			cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						   width * scale,
+						   height * scale);
+		if (cairo_surface_status(terminal->text_surface) !=
+		    CAIRO_STATUS_SUCCESS) {
+			terminal_invalidate_text(terminal);
+			return NULL;
+		}
+
+		terminal->rendered = calloc(terminal->width * terminal->height,
+					    sizeof *terminal->rendered);
+		if (!terminal->rendered) {
+			terminal_invalidate_text(terminal);
+			return NULL;
+		}
+
+		terminal->rendered_width = terminal->width;
+		terminal->rendered_height = terminal->height;
+		terminal->rendered_scale = scale;
+		terminal->rendered_start = terminal->start;
+		all = 1;
+	} else {
+		terminal_scroll_text(terminal);
+	}
+
+	cr = cairo_create(terminal->text_surface);
+	cairo_scale(cr, scale, scale);
+	cairo_set_line_width(cr, 1.0);
+	for (row = 0; row < terminal->height; row++)
+		if (terminal_row_changed(terminal, row) || all)
+			terminal_draw_row(terminal, cr, row);
+	cairo_destroy(cr);
+
+	return terminal->text_surface;
+}
 
 static void
 redraw_handler(struct widget *widget, void *data)
@@ -1034,16 +1347,12 @@ redraw_handler(struct widget *widget, void *data)
 	struct rectangle allocation;
 	cairo_t *cr;
 	int top_margin, side_margin;
-	int row, col, cursor_x, cursor_y;
-	union utf8_char *p_row;
-	union decoded_attr attr;
-	int text_x, text_y;
-	cairo_surface_t *surface;
+	int row, cursor_x, cursor_y, scale;
+	cairo_surface_t *surface, *text;
+	cairo_matrix_t matrix;
 	double d;
-	struct glyph_run run;
 	cairo_font_extents_t extents;
 	double average_width;
-	double unichar_width;
 
 	surface = window_get_surface(terminal->window);
 	widget_get_allocation(terminal->widget, &allocation);
@@ -1067,65 +1376,24 @@ redraw_handler(struct widget *widget, void *data)
 	cairo_set_line_width(cr, 1.0);
 	cairo_translate(cr, allocation.x + side_margin,
 			allocation.y + top_margin);
-	/* paint the background */
-	for (row = 0; row < terminal->height; row++) {
-		p_row = terminal_get_row(terminal, row);
-		for (col = 0; col < terminal->width; col++) {
-			/* get the attributes for this character cell */
-			terminal_decode_attr(terminal, row, col, &attr);
-
-			if (attr.attr.bg == terminal->color_scheme->border)
-				continue;
-
-			if (is_wide(p_row[col]))
-				unichar_width = 2 * average_width;
-			else
-				unichar_width = average_width;
 
-			terminal_set_color(terminal, cr, attr.attr.bg);
-			cairo_move_to(cr, col * average_width,
-				      row * extents.height);
-			cairo_rel_line_to(cr, unichar_width, 0);
-			cairo_rel_line_to(cr, 0, extents.height);
-			cairo_rel_line_to(cr, -unichar_width, 0);
-			cairo_close_path(cr);
-			cairo_fill(cr);
-		}
+	scale = window_get_buffer_scale(terminal->window);
+	text = terminal_update_text(terminal, scale);
+	if (text) {
+		cairo_set_source_surface(cr, text, 0, 0);
+		cairo_matrix_init_scale(&matrix, scale, scale);
+		cairo_pattern_set_matrix(cairo_get_source(cr), &matrix);
+		cairo_rectangle(cr, 0, 0,
+				terminal->width * average_width,
+				ceil(terminal->height * extents.height));
+		cairo_fill(cr);
+	} else {
+		for (row = 0; row < terminal->height; row++)
+			terminal_draw_row(terminal, cr, row);
 	}
 
 	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-
-	/* paint the foreground */
-	glyph_run_init(&run, terminal, cr);
-	for (row = 0; row < terminal->height; row++) {
-		p_row = terminal_get_row(terminal, row);
-		for (col = 0; col < terminal->width; col++) {
-			/* get the attributes for this character cell */
-			terminal_decode_attr(terminal, row, col, &attr);
-
-			glyph_run_flush(&run, attr);
-
-			text_x = col * average_width;
-			text_y = extents.ascent + row * extents.height;
-			if (attr.attr.a & ATTRMASK_UNDERLINE) {
-				terminal_set_color(terminal, cr, attr.attr.fg);
-				cairo_move_to(cr, text_x, (double)text_y + 1.5);
-				cairo_line_to(cr, text_x + average_width, (double) text_y + 1.5);
-				cairo_stroke(cr);
-			}
-
-                        /* skip space glyph (RLE) we use as a placeholder of
-                           the right half of a double-width character,
-                           because RLE is not available in every font. */
-			if (p_row[col].ch == 0x200B)
-				continue;
-
-			glyph_run_add(&run, text_x, text_y, &p_row[col]);
-		}
-	}
-
-	attr.key = ~0;
-	glyph_run_flush(&run, attr);
+	terminal_set_color(terminal, cr, terminal->color_scheme->default_attr.fg);
 
 	if ((terminal->mode & MODE_SHOW_CURSOR) &&
 	    !window_has_focus(terminal->window)) {
@@ -2921,7 +3189,12 @@ terminal_create(struct display *display)
 
 	terminal->display = display;
 	terminal->margin = 5;
-	terminal->buffer_height = 1024;
+	/* The scrollback is a ring indexed with a mask, so its size is
+	 * rounded up to a power of two. */
+	terminal->buffer_height = 256;
+	while (terminal->buffer_height < (uint32_t) option_scrollback_lines &&
+	       terminal->buffer_height < (1u << 20))
+		terminal->buffer_height <<= 1;
 	terminal->end = 1;
 
 	window_set_user_data(terminal->window, terminal);
@@ -2993,6 +3266,8 @@ terminal_destroy(struct terminal *terminal)
 	if (wl_list_empty(&terminal_list))
 		display_exit(terminal->display);
 
+	terminal_invalidate_text(terminal);
+	free(terminal->glyph_cache);
 	free(terminal->title);
 	free(terminal);
 }
@@ -3079,6 +3354,8 @@ int main(int argc, char *argv[])
 	weston_config_section_get_string(s, "font", &option_font, "mono");
 	weston_config_section_get_int(s, "font-size", &option_font_size, 14);
 	weston_config_section_get_string(s, "term", &option_term, "xterm");
+	weston_config_section_get_int(s, "scrollback-lines",
+				      &option_scrollback_lines, 1024);
 	weston_config_destroy(config);
 
 	if (parse_options(terminal_options,
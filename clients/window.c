@@ -71,6 +71,7 @@ typedef void *EGLContext;
 #include "xdg-shell-client-protocol.h"
 #include "text-cursor-position-client-protocol.h"
 #include "workspaces-client-protocol.h"
+#include "scaler-client-protocol.h"
 #include "shared/os-compatibility.h"
 
 #include "window.h"
@@ -93,6 +94,7 @@ struct display {
 	struct wl_registry *registry;
 	struct wl_compositor *compositor;
 	struct wl_subcompositor *subcompositor;
+	struct wl_scaler *scaler;
 	struct wl_shm *shm;
 	struct wl_data_device_manager *data_device_manager;
 	struct text_cursor_position *text_cursor_position;
@@ -139,6 +141,10 @@ struct display {
 	cairo_surface_t *dummy_surface;
 	void *dummy_surface_data;
 
+	/* The last dismissed popup menu, kept mapped-ready with its
+	 * surface and buffers for the next window_show_menu() */
+	struct menu *menu_cache;
+
 	int has_rgb565;
 	int seat_version;
 	int data_device_manager_version;
@@ -149,6 +155,10 @@ struct window_output {
 	struct wl_list link;
 };
 
+/* Private to window.c: the toolkit may crop the surface with a
+ * wl_viewport of its own, as the client never asks for one */
+#define SURFACE_HINT_CROP 0x1000
+
 struct toysurface {
 	/*
 	 * Prepare the surface for drawing. Makes sure there is a surface
@@ -167,11 +177,20 @@ struct toysurface {
 	 * Post the surface to the server, returning the server allocation
 	 * rectangle. The Cairo surface from prepare() must be destroyed
 	 * after calling this.
+	 * damage is the area that was redrawn, in surface coordinates,
+	 * or NULL if the whole surface was.
 	 */
 	void (*swap)(struct toysurface *base,
 		     enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		     const struct rectangle *damage,
 		     struct rectangle *server_allocation);
 
+	/*
+	 * Returns how many frames ago the buffer returned by the last
+	 * prepare() was drawn, or 0 if its contents are undefined.
+	 */
+	int (*buffer_age)(struct toysurface *base);
+
 	/*
 	 * Make the toysurface current with the given EGL context.
 	 * Returns 0 on success, and negative of failure.
@@ -191,6 +210,8 @@ struct toysurface {
 	void (*destroy)(struct toysurface *base);
 };
 
+#define SURFACE_DAMAGE_HISTORY 4
+
 struct surface {
 	struct window *window;
 
@@ -216,6 +237,17 @@ struct surface {
 
 	cairo_surface_t *cairo_surface;
 
+	/* The area to redraw in the next frame, what changed in the
+	 * current one and the area being redrawn for it when that is
+	 * only part of the surface, and what changed in the frames
+	 * before, to bring an older buffer up to date. All in surface
+	 * coordinates. */
+	struct rectangle damage;
+	struct rectangle frame_damage;
+	struct rectangle redraw_area;
+	int partial_redraw;
+	struct rectangle damage_history[SURFACE_DAMAGE_HISTORY];
+
 	struct wl_list link;
 };
 
@@ -331,6 +363,13 @@ struct input {
 	float sx, sy;
 	struct wl_list link;
 
+	/* The latest motion, delivered to widgets at most once per
+	 * frame of the focused window */
+	int motion_pending;
+	uint32_t motion_time;
+	struct task motion_task;
+	int motion_task_scheduled;
+
 	struct widget *focus_widget;
 	struct widget *grab;
 	uint32_t grab_button;
@@ -401,6 +440,7 @@ struct menu {
 	int count;
 	int release_count;
 	menu_func_t func;
+	int reusable;
 };
 
 struct tooltip {
@@ -515,6 +555,18 @@ buffer_to_surface_size (enum wl_output_transform buffer_transform, int32_t buffe
 
 #ifdef HAVE_CAIRO_EGL
 
+/* Buffers grown during an interactive resize get a quarter more than
+ * needed, rounded up to this */
+#define EGL_RESIZE_ALIGN 64
+
+static int32_t
+egl_resize_grow(int32_t size)
+{
+	size += size / 4;
+
+	return (size + EGL_RESIZE_ALIGN - 1) & ~(EGL_RESIZE_ALIGN - 1);
+}
+
 struct egl_window_surface {
 	struct toysurface base;
 	cairo_surface_t *cairo_surface;
@@ -522,6 +574,12 @@ struct egl_window_surface {
 	struct wl_surface *surface;
 	struct wl_egl_window *egl_window;
 	EGLSurface egl_surface;
+
+	/* While resizing, the buffers can be larger than what is drawn,
+	 * with the viewport cropping them to width x height. */
+	struct wl_viewport *viewport;
+	int32_t width, height;
+	int32_t alloc_width, alloc_height;
 };
 
 static struct egl_window_surface *
@@ -536,32 +594,90 @@ egl_window_surface_prepare(struct toysurface *base, int dx, int dy,
 			   enum wl_output_transform buffer_transform, int32_t buffer_scale)
 {
 	struct egl_window_surface *surface = to_egl_window_surface(base);
+	struct wl_scaler *scaler = surface->display->scaler;
+	int32_t alloc_width, alloc_height;
 
 	surface_to_buffer_size (buffer_transform, buffer_scale, &width, &height);
 
-	wl_egl_window_resize(surface->egl_window, width, height, dx, dy);
+	/* During an interactive resize, only reallocate the buffers when
+	 * the window outgrows them, and once more when the resize
+	 * ends. */
+	alloc_width = width;
+	alloc_height = height;
+	if ((flags & SURFACE_HINT_RESIZE) && (flags & SURFACE_HINT_CROP) &&
+	    scaler && buffer_scale == 1 &&
+	    buffer_transform == WL_OUTPUT_TRANSFORM_NORMAL) {
+		if (surface->alloc_width >= width)
+			alloc_width = surface->alloc_width;
+		else
+			alloc_width = egl_resize_grow(width);
+		if (surface->alloc_height >= height)
+			alloc_height = surface->alloc_height;
+		else
+			alloc_height = egl_resize_grow(height);
+	}
+
+	if (alloc_width != width || alloc_height != height) {
+		if (!surface->viewport)
+			surface->viewport =
+				wl_scaler_get_viewport(scaler,
+						       surface->surface);
+
+		/* cairo-gl draws window surfaces bottom-up, so the
+		 * picture ends up in the bottom left of the buffer. */
+		wl_viewport_set_source(surface->viewport,
+				       wl_fixed_from_int(0),
+				       wl_fixed_from_int(alloc_height - height),
+				       wl_fixed_from_int(width),
+				       wl_fixed_from_int(height));
+		wl_viewport_set_destination(surface->viewport, width, height);
+	} else if (surface->viewport) {
+		wl_viewport_destroy(surface->viewport);
+		surface->viewport = NULL;
+	}
+
+	wl_egl_window_resize(surface->egl_window,
+			     alloc_width, alloc_height, dx, dy);
 	cairo_gl_surface_set_size(surface->cairo_surface, width, height);
 
+	surface->width = width;
+	surface->height = height;
+	surface->alloc_width = alloc_width;
+	surface->alloc_height = alloc_height;
+
 	return cairo_surface_reference(surface->cairo_surface);
 }
 
 static void
 egl_window_surface_swap(struct toysurface *base,
 			enum wl_output_transform buffer_transform, int32_t buffer_scale,
+			const struct rectangle *damage,
 			struct rectangle *server_allocation)
 {
 	struct egl_window_surface *surface = to_egl_window_surface(base);
 
 	cairo_gl_surface_swapbuffers(surface->cairo_surface);
-	wl_egl_window_get_attached_size(surface->egl_window,
-					&server_allocation->width,
-					&server_allocation->height);
+	if (surface->viewport) {
+		server_allocation->width = surface->width;
+		server_allocation->height = surface->height;
+	} else {
+		wl_egl_window_get_attached_size(surface->egl_window,
+						&server_allocation->width,
+						&server_allocation->height);
+	}
 
 	buffer_to_surface_size (buffer_transform, buffer_scale,
 				&server_allocation->width,
 				&server_allocation->height);
 }
 
+static int
+egl_window_surface_buffer_age(struct toysurface *base)
+{
+	/* cairo-gl gives no access to EGL_EXT_buffer_age */
+	return 0;
+}
+
 static int
 egl_window_surface_acquire(struct toysurface *base, EGLContext ctx)
 {
@@ -613,6 +729,8 @@ egl_window_surface_destroy(struct toysurface *base)
 
 	cairo_surface_destroy(surface->cairo_surface);
 	eglDestroySurface(d->dpy, surface->egl_surface);
+	if (surface->viewport)
+		wl_viewport_destroy(surface->viewport);
 	wl_egl_window_destroy(surface->egl_window);
 	surface->surface = NULL;
 
@@ -636,6 +754,7 @@ egl_window_surface_create(struct display *display,
 
 	surface->base.prepare = egl_window_surface_prepare;
 	surface->base.swap = egl_window_surface_swap;
+	surface->base.buffer_age = egl_window_surface_buffer_age;
 	surface->base.acquire = egl_window_surface_acquire;
 	surface->base.release = egl_window_surface_release;
 	surface->base.destroy = egl_window_surface_destroy;
@@ -718,7 +837,12 @@ make_shm_pool(struct display *display, int size, void **data)
 		return NULL;
 	}
 
-	*data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	/* Lets the compositor skip copying the buffers, if it can */
+	os_seal_shrink(fd);
+
+	/* Fault the pool in at once, on huge pages when it is large
+	 * enough, rather than page by page while drawing the first frame */
+	*data = os_map_pool(fd, size, OS_POOL_HUGE_PAGES | OS_POOL_POPULATE);
 	if (*data == MAP_FAILED) {
 		fprintf(stderr, "mmap failed: %m\n");
 		close(fd);
@@ -790,6 +914,26 @@ data_length_for_shm_surface(struct rectangle *rect)
 	return stride * rect->height;
 }
 
+#ifdef USE_RESIZE_POOL
+#define SHM_POOL_MIN_SIZE (64 * 1024)
+
+/* Pick the size of a resize pool that can hold 'length' bytes.  Pools
+ * come in power of two size classes, and a pool replacing one that
+ * grew too small is at least twice as big, so a window being resized
+ * larger only needs a logarithmic number of new pools.
+ */
+static size_t
+shm_pool_size_class(size_t length, size_t previous)
+{
+	size_t size = SHM_POOL_MIN_SIZE;
+
+	while (size < length || size <= previous)
+		size *= 2;
+
+	return size;
+}
+#endif
+
 static cairo_surface_t *
 display_create_shm_surface_from_pool(struct display *display,
 				     struct rectangle *rectangle,
@@ -927,6 +1071,7 @@ struct shm_surface_leaf {
 
 	struct shm_pool *resize_pool;
 	int busy;
+	int age;
 };
 
 static void
@@ -953,6 +1098,7 @@ struct shm_surface {
 
 	struct shm_surface_leaf leaf[MAX_LEAVES];
 	struct shm_surface_leaf *current;
+	int resizing;
 };
 
 static struct shm_surface *
@@ -1012,6 +1158,12 @@ shm_surface_buffer_release(void *data, struct wl_buffer *buffer)
 		if (!leaf->cairo_surface || leaf->busy)
 			continue;
 
+		/* While resizing, keep the storage of every leaf so
+		 * the next frames can reuse it instead of mapping new
+		 * pools. */
+		if (surface->resizing)
+			continue;
+
 		if (!free_found)
 			free_found = 1;
 		else
@@ -1034,10 +1186,14 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 	struct shm_surface *surface = to_shm_surface(base);
 	struct rectangle rect = { 0};
 	struct shm_surface_leaf *leaf = NULL;
+#ifdef USE_RESIZE_POOL
+	size_t previous_size = 0;
+#endif
 	int i;
 
 	surface->dx = dx;
 	surface->dy = dy;
+	surface->resizing = resize_hint;
 
 	/* pick a free buffer, preferably one that already has storage */
 	for (i = 0; i < MAX_LEAVES; i++) {
@@ -1073,23 +1229,34 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 
 	if (leaf->cairo_surface)
 		cairo_surface_destroy(leaf->cairo_surface);
+	leaf->age = 0;
+
+	rect.width = width;
+	rect.height = height;
 
 #ifdef USE_RESIZE_POOL
+	if (resize_hint && leaf->resize_pool &&
+	    leaf->resize_pool->size <
+	    (size_t) data_length_for_shm_surface(&rect)) {
+		previous_size = leaf->resize_pool->size;
+		shm_pool_destroy(leaf->resize_pool);
+		leaf->resize_pool = NULL;
+	}
+
 	if (resize_hint && !leaf->resize_pool) {
-		/* Create a big pool to allocate from, while continuously
+		/* Create a pool to allocate from, while continuously
 		 * resizing. Mmapping a new pool in the server
 		 * is relatively expensive, so reusing a pool performs
 		 * better, but may temporarily reserve unneeded memory.
+		 * The pool is sized to the next size class, so it is
+		 * replaced only when the window outgrows it.
 		 */
-		/* We should probably base this number on the output size. */
 		leaf->resize_pool = shm_pool_create(surface->display,
-						    6 * 1024 * 1024);
+			shm_pool_size_class(data_length_for_shm_surface(&rect),
+					    previous_size));
 	}
 #endif
 
-	rect.width = width;
-	rect.height = height;
-
 	leaf->cairo_surface =
 		display_create_shm_surface(surface->display, &rect,
 					   surface->flags,
@@ -1110,10 +1277,12 @@ out:
 static void
 shm_surface_swap(struct toysurface *base,
 		 enum wl_output_transform buffer_transform, int32_t buffer_scale,
+		 const struct rectangle *damage,
 		 struct rectangle *server_allocation)
 {
 	struct shm_surface *surface = to_shm_surface(base);
 	struct shm_surface_leaf *leaf = surface->current;
+	int i;
 
 	server_allocation->width =
 		cairo_image_surface_get_width(leaf->cairo_surface);
@@ -1126,17 +1295,38 @@ shm_surface_swap(struct toysurface *base,
 
 	wl_surface_attach(surface->surface, leaf->data->buffer,
 			  surface->dx, surface->dy);
-	wl_surface_damage(surface->surface, 0, 0,
-			  server_allocation->width, server_allocation->height);
+	if (damage && !surface->dx && !surface->dy)
+		wl_surface_damage(surface->surface, damage->x, damage->y,
+				  damage->width, damage->height);
+	else
+		wl_surface_damage(surface->surface, 0, 0,
+				  server_allocation->width,
+				  server_allocation->height);
 	wl_surface_commit(surface->surface);
 
 	DBG_OBJ(surface->surface, "leaf %d busy\n",
 		(int)(leaf - &surface->leaf[0]));
 
+	for (i = 0; i < MAX_LEAVES; i++)
+		if (surface->leaf[i].age > 0)
+			surface->leaf[i].age++;
+	leaf->age = 1;
+	if (surface->dx || surface->dy)
+		for (i = 0; i < MAX_LEAVES; i++)
+			surface->leaf[i].age = 0;
+
 	leaf->busy = 1;
 	surface->current = NULL;
 }
 
+static int
+shm_surface_buffer_age(struct toysurface *base)
+{
+	struct shm_surface *surface = to_shm_surface(base);
+
+	return surface->current ? surface->current->age : 0;
+}
+
 static int
 shm_surface_acquire(struct toysurface *base, EGLContext ctx)
 {
@@ -1170,6 +1360,7 @@ shm_surface_create(struct display *display, struct wl_surface *wl_surface,
 	surface = xzalloc(sizeof *surface);
 	surface->base.prepare = shm_surface_prepare;
 	surface->base.swap = shm_surface_swap;
+	surface->base.buffer_age = shm_surface_buffer_age;
 	surface->base.acquire = shm_surface_acquire;
 	surface->base.release = shm_surface_release;
 	surface->base.destroy = shm_surface_destroy;
@@ -1346,6 +1537,8 @@ display_get_pointer_image(struct display *display, int pointer)
 static void
 surface_flush(struct surface *surface)
 {
+	int i;
+
 	if (!surface->cairo_surface)
 		return;
 
@@ -1365,8 +1558,22 @@ surface_flush(struct surface *surface)
 
 	surface->toysurface->swap(surface->toysurface,
 				  surface->buffer_transform, surface->buffer_scale,
+				  surface->partial_redraw ?
+				  &surface->redraw_area : NULL,
 				  &surface->server_allocation);
 
+	for (i = SURFACE_DAMAGE_HISTORY - 1; i > 0; i--)
+		surface->damage_history[i] = surface->damage_history[i - 1];
+	if (surface->partial_redraw) {
+		surface->damage_history[0] = surface->frame_damage;
+	} else {
+		surface->damage_history[0].x = 0;
+		surface->damage_history[0].y = 0;
+		surface->damage_history[0].width = surface->allocation.width;
+		surface->damage_history[0].height = surface->allocation.height;
+	}
+	surface->partial_redraw = 0;
+
 	cairo_surface_destroy(surface->cairo_surface);
 	surface->cairo_surface = NULL;
 }
@@ -1440,6 +1647,11 @@ window_create_main_surface(struct window *window)
 	if (window->resizing)
 		flags |= SURFACE_HINT_RESIZE;
 
+	/* Only windows with toolkit decorations; others may have a
+	 * viewport of their own on the main surface. */
+	if (window->frame)
+		flags |= SURFACE_HINT_CROP;
+
 	if (window->preferred_format == WINDOW_PREFERRED_FORMAT_RGB565)
 		flags |= SURFACE_HINT_RGB565;
 
@@ -1815,6 +2027,14 @@ widget_cairo_create(struct widget *widget)
 
 	widget_cairo_update_transform(widget, cr);
 
+	if (surface->partial_redraw) {
+		cairo_rectangle(cr, surface->redraw_area.x,
+				surface->redraw_area.y,
+				surface->redraw_area.width,
+				surface->redraw_area.height);
+		cairo_clip(cr);
+	}
+
 	cairo_translate(cr, -surface->allocation.x, -surface->allocation.y);
 
 	return cr;
@@ -1938,11 +2158,81 @@ widget_set_axis_handler(struct widget *widget,
 static void
 window_schedule_redraw_task(struct window *window);
 
+static int
+rectangle_is_empty(const struct rectangle *r)
+{
+	return r->width <= 0 || r->height <= 0;
+}
+
+/* Grow r to the bounding box of r and other. */
+static void
+rectangle_union(struct rectangle *r, const struct rectangle *other)
+{
+	int32_t x1, y1;
+
+	if (rectangle_is_empty(other))
+		return;
+
+	if (rectangle_is_empty(r)) {
+		*r = *other;
+		return;
+	}
+
+	x1 = MAX(r->x + r->width, other->x + other->width);
+	y1 = MAX(r->y + r->height, other->y + other->height);
+	r->x = MIN(r->x, other->x);
+	r->y = MIN(r->y, other->y);
+	r->width = x1 - r->x;
+	r->height = y1 - r->y;
+}
+
+static int
+rectangle_intersects(const struct rectangle *a, const struct rectangle *b)
+{
+	return a->x < b->x + b->width && b->x < a->x + a->width &&
+	       a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+static void
+surface_damage_all(struct surface *surface)
+{
+	surface->damage.x = 0;
+	surface->damage.y = 0;
+	surface->damage.width = surface->allocation.width;
+	surface->damage.height = surface->allocation.height;
+}
+
 void
 widget_schedule_redraw(struct widget *widget)
 {
+	widget_schedule_redraw_area(widget, &widget->allocation);
+}
+
+/* Redraw only part of a widget.  The area is in the same coordinates
+ * as the widget allocation, and is clipped to it. */
+void
+widget_schedule_redraw_area(struct widget *widget,
+			    const struct rectangle *area)
+{
+	struct surface *surface = widget->surface;
+	struct rectangle *allocation = &widget->allocation;
+	struct rectangle rect;
+	int32_t x1, y1;
+
 	DBG_OBJ(widget->surface->surface, "widget %p\n", widget);
-	widget->surface->redraw_needed = 1;
+
+	rect.x = MAX(area->x, allocation->x);
+	rect.y = MAX(area->y, allocation->y);
+	x1 = MIN(area->x + area->width, allocation->x + allocation->width);
+	y1 = MIN(area->y + area->height, allocation->y + allocation->height);
+	rect.width = MAX(x1 - rect.x, 0);
+	rect.height = MAX(y1 - rect.y, 0);
+
+	rect.x -= surface->allocation.x;
+	rect.y -= surface->allocation.y;
+	rectangle_union(&surface->damage, &rect);
+
+	surface->redraw_needed = 1;
 	window_schedule_redraw_task(widget->window);
 }
 
@@ -2674,6 +2964,8 @@ input_remove_pointer_focus(struct input *input)
 {
 	struct window *window = input->pointer_focus;
 
+	input->motion_pending = 0;
+
 	if (!window)
 		return;
 
@@ -2728,21 +3020,20 @@ pointer_handle_leave(void *data, struct wl_pointer *pointer,
 }
 
 static void
-pointer_handle_motion(void *data, struct wl_pointer *pointer,
-		      uint32_t time, wl_fixed_t sx_w, wl_fixed_t sy_w)
+input_flush_motion(struct input *input)
 {
-	struct input *input = data;
 	struct window *window = input->pointer_focus;
 	struct widget *widget;
 	int cursor;
-	float sx = wl_fixed_to_double(sx_w);
-	float sy = wl_fixed_to_double(sy_w);
+	float sx = input->sx;
+	float sy = input->sy;
 
-	if (!window)
+	if (!input->motion_pending)
 		return;
 
-	input->sx = sx;
-	input->sy = sy;
+	input->motion_pending = 0;
+	if (!window)
+		return;
 
 	/* when making the window smaller - e.g. after a unmaximise we might
 	 * still have a pending motion event that the compositor has picked
@@ -2764,7 +3055,9 @@ pointer_handle_motion(void *data, struct wl_pointer *pointer,
 	if (widget) {
 		if (widget->motion_handler)
 			cursor = widget->motion_handler(input->focus_widget,
-							input, time, sx, sy,
+							input,
+							input->motion_time,
+							sx, sy,
 							widget->user_data);
 		else
 			cursor = widget->default_cursor;
@@ -2774,6 +3067,46 @@ pointer_handle_motion(void *data, struct wl_pointer *pointer,
 	input_set_pointer_image(input, cursor);
 }
 
+static void
+motion_task_run(struct task *task, uint32_t events)
+{
+	struct input *input = container_of(task, struct input, motion_task);
+
+	wl_list_init(&input->motion_task.link);
+	input->motion_task_scheduled = 0;
+
+	/* A frame went out since the motion came in; wait for it */
+	if (input->pointer_focus &&
+	    input->pointer_focus->main_surface->frame_cb)
+		return;
+
+	input_flush_motion(input);
+}
+
+static void
+pointer_handle_motion(void *data, struct wl_pointer *pointer,
+		      uint32_t time, wl_fixed_t sx_w, wl_fixed_t sy_w)
+{
+	struct input *input = data;
+	struct window *window = input->pointer_focus;
+
+	if (!window)
+		return;
+
+	input->sx = wl_fixed_to_double(sx_w);
+	input->sy = wl_fixed_to_double(sy_w);
+	input->motion_time = time;
+	input->motion_pending = 1;
+
+	/* While a frame is on its way, frame_callback() delivers the
+	 * motion; otherwise it goes out once the events read so far
+	 * are dispatched, so a burst still becomes one call. */
+	if (!window->main_surface->frame_cb && !input->motion_task_scheduled) {
+		input->motion_task_scheduled = 1;
+		display_defer(input->display, &input->motion_task);
+	}
+}
+
 static void
 pointer_handle_button(void *data, struct wl_pointer *pointer, uint32_t serial,
 		      uint32_t time, uint32_t button, uint32_t state_w)
@@ -2782,6 +3115,8 @@ pointer_handle_button(void *data, struct wl_pointer *pointer, uint32_t serial,
 	struct widget *widget;
 	enum wl_pointer_button_state state = state_w;
 
+	input_flush_motion(input);
+
 	input->display->serial = serial;
 	if (input->focus_widget && input->grab == NULL &&
 	    state == WL_POINTER_BUTTON_STATE_PRESSED)
@@ -2806,6 +3141,8 @@ pointer_handle_axis(void *data, struct wl_pointer *pointer,
 	struct input *input = data;
 	struct widget *widget;
 
+	input_flush_motion(input);
+
 	widget = input->focus_widget;
 	if (input->grab)
 		widget = input->grab;
@@ -4184,7 +4521,7 @@ window_flush(struct window *window)
 }
 
 static void
-menu_destroy(struct menu *menu)
+menu_free(struct menu *menu)
 {
 	widget_destroy(menu->widget);
 	window_destroy(menu->window);
@@ -4192,6 +4529,59 @@ menu_destroy(struct menu *menu)
 	free(menu);
 }
 
+/* Take the menu off screen but keep its wl_surface, frame and
+ * buffers, so showing the next menu needs neither a new surface nor
+ * new buffers. */
+static void
+menu_unmap(struct menu *menu)
+{
+	struct window *window = menu->window;
+	struct surface *surface = window->main_surface;
+	struct input *input;
+
+	wl_list_for_each(input, &window->display->input_list, link) {
+		if (input->pointer_focus == window)
+			input->pointer_focus = NULL;
+		if (input->focus_widget == menu->widget)
+			input->focus_widget = NULL;
+		if (input->grab == menu->widget)
+			input->grab = NULL;
+	}
+
+	wl_list_remove(&window->redraw_task.link);
+	wl_list_init(&window->redraw_task.link);
+	window->redraw_task_scheduled = 0;
+	window->resize_needed = 0;
+
+	/* An unmapped surface gets no more frame callbacks */
+	if (surface->frame_cb) {
+		wl_callback_destroy(surface->frame_cb);
+		surface->frame_cb = NULL;
+	}
+
+	if (window->xdg_popup) {
+		xdg_popup_destroy(window->xdg_popup);
+		window->xdg_popup = NULL;
+	}
+
+	wl_surface_attach(surface->surface, NULL, 0, 0);
+	wl_surface_commit(surface->surface);
+}
+
+static void
+menu_destroy(struct menu *menu)
+{
+	struct display *display = menu->window->display;
+
+	if (menu->reusable && !display->menu_cache) {
+		menu_unmap(menu);
+		display->menu_cache = menu;
+		return;
+	}
+
+	menu_free(menu);
+}
+
 void
 window_get_allocation(struct window *window,
 		      struct rectangle *allocation)
@@ -4202,9 +4592,16 @@ window_get_allocation(struct window *window,
 static void
 widget_redraw(struct widget *widget)
 {
+	struct surface *surface = widget->surface;
 	struct widget *child;
+	struct rectangle rect = widget->allocation;
+
+	rect.x -= surface->allocation.x;
+	rect.y -= surface->allocation.y;
 
-	if (widget->redraw_handler)
+	if (widget->redraw_handler &&
+	    (!surface->partial_redraw ||
+	     rectangle_intersects(&rect, &surface->redraw_area)))
 		widget->redraw_handler(widget, widget->user_data);
 	wl_list_for_each(child, &widget->child_list, link)
 		widget_redraw(child);
@@ -4214,6 +4611,8 @@ static void
 frame_callback(void *data, struct wl_callback *callback, uint32_t time)
 {
 	struct surface *surface = data;
+	struct window *window = surface->window;
+	struct input *input;
 
 	assert(callback == surface->frame_cb);
 	DBG_OBJ(callback, "done\n");
@@ -4222,6 +4621,13 @@ frame_callback(void *data, struct wl_callback *callback, uint32_t time)
 
 	surface->last_time = time;
 
+	/* Motion held back for this frame; whatever it redraws goes
+	 * into the next one. */
+	if (surface == window->main_surface)
+		wl_list_for_each(input, &window->display->input_list, link)
+			if (input->pointer_focus == window)
+				input_flush_motion(input);
+
 	if (surface->redraw_needed || surface->window->redraw_needed) {
 		DBG_OBJ(surface->surface, "window_schedule_redraw_task\n");
 		window_schedule_redraw_task(surface->window);
@@ -4232,6 +4638,40 @@ static const struct wl_callback_listener listener = {
 	frame_callback
 };
 
+/* Work out what has to be redrawn: what was damaged since the last
+ * frame, plus whatever changed since the buffer we got back was last
+ * drawn.  Only cairo drawing with widget_cairo_create() is clipped. */
+static void
+surface_update_redraw_area(struct surface *surface)
+{
+	struct rectangle all = {
+		0, 0, surface->allocation.width, surface->allocation.height
+	};
+	int i, age = 0;
+
+	if (surface->window->redraw_needed)
+		surface->damage = all;
+
+	if (surface->widget->use_cairo && surface->cairo_surface)
+		age = surface->toysurface->buffer_age(surface->toysurface);
+
+	surface->redraw_area = surface->damage;
+	if (age == 0 || age > SURFACE_DAMAGE_HISTORY + 1)
+		surface->redraw_area = all;
+	else
+		for (i = 0; i < age - 1; i++)
+			rectangle_union(&surface->redraw_area,
+					&surface->damage_history[i]);
+
+	surface->partial_redraw =
+		surface->redraw_area.x > 0 || surface->redraw_area.y > 0 ||
+		surface->redraw_area.x + surface->redraw_area.width < all.width ||
+		surface->redraw_area.y + surface->redraw_area.height < all.height;
+
+	surface->frame_damage = surface->damage;
+	memset(&surface->damage, 0, sizeof surface->damage);
+}
+
 static int
 surface_redraw(struct surface *surface)
 {
@@ -4261,6 +4701,8 @@ surface_redraw(struct surface *surface)
 	wl_callback_add_listener(surface->frame_cb, &listener, surface);
 	DBG_OBJ(surface->frame_cb, "new\n");
 
+	surface_update_redraw_area(surface);
+
 	surface->redraw_needed = 0;
 	DBG_OBJ(surface->surface, "-> widget_redraw\n");
 	widget_redraw(surface->widget);
@@ -4337,8 +4779,10 @@ window_schedule_redraw(struct window *window)
 
 	DBG_OBJ(window->main_surface->surface, "window %p\n", window);
 
-	wl_list_for_each(surface, &window->subsurface_list, link)
+	wl_list_for_each(surface, &window->subsurface_list, link) {
+		surface_damage_all(surface);
 		surface->redraw_needed = 1;
+	}
 
 	window_schedule_redraw_task(window);
 }
@@ -4817,27 +5261,40 @@ static struct menu *
 create_menu(struct display *display,
 	    struct input *input, uint32_t time,
 	    menu_func_t func, const char **entries, int count,
-	    void *user_data)
+	    void *user_data, int reusable)
 {
 	struct window *window;
 	struct menu *menu;
 
-	menu = malloc(sizeof *menu);
-	if (!menu)
-		return NULL;
+	if (reusable && display->menu_cache) {
+		menu = display->menu_cache;
+		display->menu_cache = NULL;
 
-	window = window_create_internal(display, 0);
-	if (!window) {
-		free(menu);
-		return NULL;
+		/* Size it from scratch and draw all of it */
+		window = menu->window;
+		memset(&window->min_allocation, 0,
+		       sizeof window->min_allocation);
+		window->redraw_needed = 1;
+	} else {
+		menu = malloc(sizeof *menu);
+		if (!menu)
+			return NULL;
+
+		window = window_create_internal(display, 0);
+		if (!window) {
+			free(menu);
+			return NULL;
+		}
+
+		menu->window = window;
+		menu->widget = window_add_widget(menu->window, menu);
+		menu->frame = frame_create(window->display->theme, 0, 0,
+					   FRAME_BUTTON_NONE, NULL);
+		fail_on_null(menu->frame);
 	}
 
-	menu->window = window;
+	menu->reusable = reusable;
 	menu->user_data = user_data;
-	menu->widget = window_add_widget(menu->window, menu);
-	menu->frame = frame_create(window->display->theme, 0, 0,
-				   FRAME_BUTTON_NONE, NULL);
-	fail_on_null(menu->frame);
 	menu->entries = entries;
 	menu->count = count;
 	menu->release_count = 0;
@@ -4871,7 +5328,8 @@ window_create_menu(struct display *display,
 		   void *user_data)
 {
 	struct menu *menu;
-	menu = create_menu(display, input, time, func, entries, count, user_data);
+	menu = create_menu(display, input, time, func, entries, count,
+			   user_data, 0);
 
 	if (menu == NULL)
 		return NULL;
@@ -4889,7 +5347,8 @@ window_show_menu(struct display *display,
 	struct window *window;
 	int32_t ix, iy;
 
-	menu = create_menu(display, input, time, func, entries, count, parent);
+	menu = create_menu(display, input, time, func, entries, count,
+			   parent, 1);
 
 	if (menu == NULL)
 		return;
@@ -5237,6 +5696,8 @@ display_add_input(struct display *d, uint32_t id)
 
 	input->pointer_surface = wl_compositor_create_surface(d->compositor);
 	input->cursor_task.run = cursor_timer_func;
+	input->motion_task.run = motion_task_run;
+	wl_list_init(&input->motion_task.link);
 
 	input->cursor_delay_fd = timerfd_create(CLOCK_MONOTONIC,
 						TFD_CLOEXEC | TFD_NONBLOCK);
@@ -5256,6 +5717,7 @@ input_destroy(struct input *input)
 {
 	input_remove_keyboard_focus(input);
 	input_remove_pointer_focus(input);
+	wl_list_remove(&input->motion_task.link);
 
 	if (input->drag_offer)
 		data_offer_destroy(input->drag_offer);
@@ -5378,6 +5840,9 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 		d->ivi_application =
 			wl_registry_bind(registry, id,
 					 &ivi_application_interface, 1);
+	} else if (strcmp(interface, "wl_scaler") == 0 && version >= 2) {
+		d->scaler = wl_registry_bind(registry, id,
+					     &wl_scaler_interface, 2);
 	}
 
 	if (d->global_handler)
@@ -5651,6 +6116,9 @@ display_destroy_inputs(struct display *display)
 void
 display_destroy(struct display *display)
 {
+	if (display->menu_cache)
+		menu_free(display->menu_cache);
+
 	if (!wl_list_empty(&display->window_list))
 		fprintf(stderr, "toytoolkit warning: %d windows exist.\n",
 			wl_list_length(&display->window_list));
@@ -5677,6 +6145,9 @@ display_destroy(struct display *display)
 	if (display->subcompositor)
 		wl_subcompositor_destroy(display->subcompositor);
 
+	if (display->scaler)
+		wl_scaler_destroy(display->scaler);
+
 	if (display->xdg_shell)
 		xdg_shell_destroy(display->xdg_shell);
 
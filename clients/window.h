@@ -522,6 +522,9 @@ widget_set_axis_handler(struct widget *widget,
 void
 widget_schedule_redraw(struct widget *widget);
 void
+widget_schedule_redraw_area(struct widget *widget,
+			    const struct rectangle *area);
+void
 widget_set_use_cairo(struct widget *widget, int use_cairo);
 
 struct widget *
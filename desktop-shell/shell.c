@@ -45,6 +45,10 @@
 #define DEFAULT_NUM_WORKSPACES 1
 #define DEFAULT_WORKSPACE_CHANGE_ANIMATION_LENGTH 200
 
+/* How long an interactive resize waits for the client to commit a
+ * configured size before sending the next one anyway, in ms. */
+#define RESIZE_CONFIGURE_TIMEOUT 100
+
 #ifndef static_assert
 #define static_assert(cond, msg)
 #endif
@@ -179,6 +183,17 @@ struct shell_surface {
 	bool has_set_geometry, has_next_geometry;
 
 	int focus_count;
+	uint32_t configure_serial;
+
+	/* Interactive resizes keep at most one configure in flight;
+	 * sizes computed meanwhile are coalesced into the queued one. */
+	struct {
+		bool in_flight, acked, queued;
+		int32_t width, height;
+		int32_t sent_width, sent_height;
+		uint32_t serial;
+		struct wl_event_source *timer;
+	} resize_configure;
 
 	bool destroying;
 };
@@ -660,6 +675,8 @@ shell_configuration(struct desktop_shell *shell)
 	weston_config_section_get_string(section, "focus-animation", &s, "none");
 	shell->focus_animation_type = get_animation_type(s);
 	free(s);
+	weston_config_section_get_bool(section, "workspace-snapshot",
+				       &shell->workspace_snapshot, 0);
 	weston_config_section_get_uint(section, "num-workspaces",
 				       &shell->workspaces.num,
 				       DEFAULT_NUM_WORKSPACES);
@@ -1023,6 +1040,17 @@ animate_focus_change(struct desktop_shell *shell, struct workspace *ws,
 	}
 }
 
+static void
+workspace_snapshot_destroy(struct workspace *ws)
+{
+	if (!ws->snapshot)
+		return;
+
+	weston_surface_destroy(ws->snapshot);
+	ws->snapshot = NULL;
+	ws->snapshot_view = NULL;
+}
+
 static void
 workspace_destroy(struct workspace *ws)
 {
@@ -1035,6 +1063,7 @@ workspace_destroy(struct workspace *ws)
 		focus_surface_destroy(ws->fsurf_front);
 	if (ws->fsurf_back)
 		focus_surface_destroy(ws->fsurf_back);
+	workspace_snapshot_destroy(ws);
 
 	free(ws);
 }
@@ -1069,6 +1098,10 @@ workspace_create(void)
 	ws->fsurf_back = NULL;
 	ws->focus_animation = NULL;
 
+	weston_layer_init(&ws->snapshot_layer, NULL);
+	ws->snapshot = NULL;
+	ws->snapshot_view = NULL;
+
 	return ws;
 }
 
@@ -1133,6 +1166,186 @@ view_translate(struct workspace *ws, struct weston_view *view, double d)
 	weston_view_geometry_dirty(view);
 }
 
+static int
+workspace_snapshot_get_label(struct weston_surface *surface,
+			     char *buf, size_t len)
+{
+	return snprintf(buf, len, "workspace snapshot");
+}
+
+/* Composite one view into the snapshot image. Only views the image can
+ * represent exactly are accepted: untransformed apart from translation,
+ * without subsurfaces and with a buffer matching the surface size. */
+static int
+workspace_snapshot_add_view(pixman_image_t *image, struct weston_view *view,
+			    struct weston_output *output)
+{
+	struct weston_surface *surface = view->surface;
+	pixman_image_t *src, *mask = NULL;
+	pixman_color_t alpha = { 0, 0, 0, 0 };
+	float x, y;
+	int width, height;
+	void *pixels;
+	size_t size;
+	int ret;
+
+	weston_view_update_transform(view);
+	if (view->transform.enabled &&
+	    view->transform.matrix.type & ~WESTON_MATRIX_TRANSFORM_TRANSLATE)
+		return -1;
+
+	if (!wl_list_empty(&surface->subsurface_list))
+		return -1;
+
+	weston_surface_get_content_size(surface, &width, &height);
+	if (width != surface->width || height != surface->height)
+		return -1;
+
+	if (width == 0 || height == 0)
+		return 0;
+
+	size = (size_t) width * height * 4;
+	pixels = malloc(size);
+	if (!pixels)
+		return -1;
+
+	ret = weston_surface_copy_content(surface, pixels, size,
+					  0, 0, width, height);
+	if (ret < 0) {
+		free(pixels);
+		return -1;
+	}
+
+	weston_view_to_global_float(view, 0, 0, &x, &y);
+	src = pixman_image_create_bits(PIXMAN_a8b8g8r8, width, height,
+				       pixels, width * 4);
+	if (view->alpha < 1.0) {
+		alpha.alpha = 0xffff * view->alpha;
+		mask = pixman_image_create_solid_fill(&alpha);
+	}
+
+	pixman_image_composite32(PIXMAN_OP_OVER, src, mask, image,
+				 0, 0, 0, 0,
+				 (int) x - output->x, (int) y - output->y,
+				 width, height);
+
+	if (mask)
+		pixman_image_unref(mask);
+	pixman_image_unref(src);
+	free(pixels);
+
+	return 0;
+}
+
+/* Render the workspace as it looks on the output into a single surface
+ * in ws->snapshot_layer. The snapshot layer is not added to the
+ * compositor here. */
+static int
+workspace_snapshot_create(struct workspace *ws, struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_surface *surface;
+	struct weston_view *view;
+	pixman_image_t *image;
+
+	image = pixman_image_create_bits(PIXMAN_a8b8g8r8,
+					 output->width, output->height,
+					 NULL, 0);
+	if (!image)
+		return -1;
+
+	wl_list_for_each_reverse(view, &ws->layer.view_list.link,
+				 layer_link.link) {
+		if (workspace_snapshot_add_view(image, view, output) < 0)
+			goto err_image;
+	}
+
+	surface = weston_surface_create(ec);
+	if (!surface)
+		goto err_image;
+
+	view = weston_view_create(surface);
+	if (!view)
+		goto err_surface;
+
+	if (weston_surface_set_image(surface, image) < 0)
+		goto err_surface;
+
+	weston_surface_set_label_func(surface, workspace_snapshot_get_label);
+	weston_surface_set_size(surface, output->width, output->height);
+	pixman_region32_fini(&surface->input);
+	pixman_region32_init(&surface->input);
+
+	weston_view_set_position(view, output->x, output->y);
+	weston_layer_entry_insert(&ws->snapshot_layer.view_list,
+				  &view->layer_link);
+
+	ws->snapshot = surface;
+	ws->snapshot_view = view;
+	pixman_image_unref(image);
+
+	return 0;
+
+err_surface:
+	weston_surface_destroy(surface);
+err_image:
+	pixman_image_unref(image);
+
+	return -1;
+}
+
+/* Swap the layers of both workspaces for their snapshots, so each
+ * animation frame moves two views rather than every window. */
+static int
+workspace_snapshot_start(struct desktop_shell *shell,
+			 struct workspace *from, struct workspace *to)
+{
+	struct weston_compositor *ec = shell->compositor;
+	struct weston_output *output;
+
+	/* Sticky views stay in place while their workspace moves */
+	if (!shell->workspace_snapshot ||
+	    !wl_list_empty(&shell->workspaces.anim_sticky_list))
+		return -1;
+
+	if (wl_list_empty(&ec->output_list) ||
+	    ec->output_list.next->next != &ec->output_list)
+		return -1;
+
+	output = get_default_output(ec);
+	if (workspace_snapshot_create(from, output) < 0)
+		return -1;
+
+	if (workspace_snapshot_create(to, output) < 0) {
+		workspace_snapshot_destroy(from);
+		return -1;
+	}
+
+	wl_list_insert(from->layer.link.prev, &to->snapshot_layer.link);
+	wl_list_insert(&to->snapshot_layer.link, &from->snapshot_layer.link);
+	wl_list_remove(&from->layer.link);
+
+	return 0;
+}
+
+static void
+workspace_snapshot_translate(struct workspace *ws, double fraction, int in)
+{
+	struct weston_output *output =
+		get_default_output(ws->snapshot->compositor);
+	unsigned int height = get_output_height(output);
+	double d;
+
+	if (!in)
+		d = height * fraction;
+	else if (fraction > 0)
+		d = -(height - height * fraction);
+	else
+		d = height + height * fraction;
+
+	weston_view_set_position(ws->snapshot_view, output->x, output->y + d);
+}
+
 static void
 workspace_translate_out(struct workspace *ws, double fraction)
 {
@@ -1140,6 +1353,11 @@ workspace_translate_out(struct workspace *ws, double fraction)
 	unsigned int height;
 	double d;
 
+	if (ws->snapshot) {
+		workspace_snapshot_translate(ws, fraction, 0);
+		return;
+	}
+
 	wl_list_for_each(view, &ws->layer.view_list.link, layer_link.link) {
 		height = get_output_height(view->surface->output);
 		d = height * fraction;
@@ -1155,6 +1373,11 @@ workspace_translate_in(struct workspace *ws, double fraction)
 	unsigned int height;
 	double d;
 
+	if (ws->snapshot) {
+		workspace_snapshot_translate(ws, fraction, 1);
+		return;
+	}
+
 	wl_list_for_each(view, &ws->layer.view_list.link, layer_link.link) {
 		height = get_output_height(view->surface->output);
 
@@ -1226,6 +1449,23 @@ finish_workspace_change_animation(struct desktop_shell *shell,
 
 	weston_compositor_schedule_repaint(shell->compositor);
 
+	wl_list_remove(&shell->workspaces.animation.link);
+	workspace_deactivate_transforms(from);
+	workspace_deactivate_transforms(to);
+	shell->workspaces.anim_to = NULL;
+
+	if (to->snapshot) {
+		/* Neither live layer is in the layer list; put back the
+		 * one being switched to where the snapshots were. */
+		weston_view_damage_below(from->snapshot_view);
+		wl_list_insert(to->snapshot_layer.link.prev, &to->layer.link);
+		wl_list_remove(&to->snapshot_layer.link);
+		wl_list_remove(&from->snapshot_layer.link);
+		workspace_snapshot_destroy(from);
+		workspace_snapshot_destroy(to);
+		return;
+	}
+
 	/* Views that extend past the bottom of the output are still
 	 * visible after the workspace animation ends but before its layer
 	 * is hidden. In that case, we need to damage below those views so
@@ -1233,11 +1473,6 @@ finish_workspace_change_animation(struct desktop_shell *shell,
 	wl_list_for_each(view, &from->layer.view_list.link, layer_link.link)
 		weston_view_damage_below(view);
 
-	wl_list_remove(&shell->workspaces.animation.link);
-	workspace_deactivate_transforms(from);
-	workspace_deactivate_transforms(to);
-	shell->workspaces.anim_to = NULL;
-
 	wl_list_remove(&shell->workspaces.anim_from->layer.link);
 }
 
@@ -1320,7 +1555,8 @@ animate_workspace_change(struct desktop_shell *shell,
 	wl_list_insert(&output->animation_list,
 		       &shell->workspaces.animation.link);
 
-	wl_list_insert(from->layer.link.prev, &to->layer.link);
+	if (workspace_snapshot_start(shell, from, to) < 0)
+		wl_list_insert(from->layer.link.prev, &to->layer.link);
 
 	workspace_translate_in(to, 0);
 
@@ -1487,8 +1723,9 @@ take_surface_to_workspace_by_seat(struct desktop_shell *shell,
 	replace_focus_state(shell, to, seat);
 	drop_focus_state(shell, from, surface);
 
+	/* A snapshot no longer shows the moved view, so don't reuse it */
 	if (shell->workspaces.anim_from == to &&
-	    shell->workspaces.anim_to == from) {
+	    shell->workspaces.anim_to == from && !to->snapshot) {
 		wl_list_remove(&to->layer.link);
 		wl_list_insert(from->layer.link.prev, &to->layer.link);
 
@@ -1595,6 +1832,8 @@ touch_move_grab_up(struct weston_touch_grab *grab, uint32_t time, int touch_id)
 		move->active = 0;
 
 	if (grab->touch->num_tp == 0) {
+		if (move->base.shsurf)
+			move->base.shsurf->view->moving = false;
 		shell_touch_grab_end(&move->base);
 		free(move);
 	}
@@ -1632,6 +1871,8 @@ touch_move_grab_cancel(struct weston_touch_grab *grab)
 		(struct weston_touch_move_grab *) container_of(
 			grab, struct shell_touch_grab, grab);
 
+	if (move->base.shsurf)
+		move->base.shsurf->view->moving = false;
 	shell_touch_grab_end(&move->base);
 	free(move);
 }
@@ -1667,6 +1908,7 @@ surface_touch_move(struct shell_surface *shsurf, struct weston_touch *touch)
 
 	shell_touch_grab_start(&move->base, &touch_move_grab_interface, shsurf,
 			       touch);
+	shsurf->view->moving = true;
 
 	return 0;
 }
@@ -1728,6 +1970,15 @@ move_grab_motion(struct weston_pointer_grab *grab, uint32_t time,
 	weston_compositor_schedule_repaint(shsurf->surface->compositor);
 }
 
+static void
+move_grab_end(struct shell_grab *shell_grab)
+{
+	if (shell_grab->shsurf)
+		shell_grab->shsurf->view->moving = false;
+
+	shell_grab_end(shell_grab);
+}
+
 static void
 move_grab_button(struct weston_pointer_grab *grab,
 		 uint32_t time, uint32_t button, uint32_t state_w)
@@ -1739,7 +1990,7 @@ move_grab_button(struct weston_pointer_grab *grab,
 
 	if (pointer->button_count == 0 &&
 	    state == WL_POINTER_BUTTON_STATE_RELEASED) {
-		shell_grab_end(shell_grab);
+		move_grab_end(shell_grab);
 		free(grab);
 	}
 }
@@ -1750,7 +2001,7 @@ move_grab_cancel(struct weston_pointer_grab *grab)
 	struct shell_grab *shell_grab =
 		container_of(grab, struct shell_grab, grab);
 
-	shell_grab_end(shell_grab);
+	move_grab_end(shell_grab);
 	free(grab);
 }
 
@@ -1786,6 +2037,7 @@ surface_move(struct shell_surface *shsurf, struct weston_pointer *pointer,
 
 	shell_grab_start(&move->base, &move_grab_interface, shsurf,
 			 pointer, DESKTOP_SHELL_CURSOR_MOVE);
+	shsurf->view->moving = true;
 
 	return 0;
 }
@@ -1831,6 +2083,106 @@ struct weston_resize_grab {
 	int32_t width, height;
 };
 
+static void
+resize_configure_flush(struct shell_surface *shsurf);
+
+static int
+resize_configure_timeout(void *data)
+{
+	struct shell_surface *shsurf = data;
+
+	shsurf->resize_configure.in_flight = false;
+	resize_configure_flush(shsurf);
+
+	return 1;
+}
+
+static void
+resize_configure_send(struct shell_surface *shsurf,
+		      int32_t width, int32_t height)
+{
+	struct weston_compositor *compositor = shsurf->shell->compositor;
+	struct wl_event_loop *loop;
+
+	shsurf->client->send_configure(shsurf->surface, width, height);
+	shsurf->resize_configure.sent_width = width;
+	shsurf->resize_configure.sent_height = height;
+	shsurf->resize_configure.in_flight = true;
+	shsurf->resize_configure.serial = shsurf->configure_serial;
+
+	/* wl_shell has no ack request, the next commit answers */
+	shsurf->resize_configure.acked =
+		!shell_surface_is_xdg_surface(shsurf);
+
+	if (!shsurf->resize_configure.timer) {
+		loop = wl_display_get_event_loop(compositor->wl_display);
+		shsurf->resize_configure.timer =
+			wl_event_loop_add_timer(loop, resize_configure_timeout,
+						shsurf);
+	}
+	if (shsurf->resize_configure.timer)
+		wl_event_source_timer_update(shsurf->resize_configure.timer,
+					     RESIZE_CONFIGURE_TIMEOUT);
+}
+
+/* Send the queued size, unless the client is still busy with the last */
+static void
+resize_configure_flush(struct shell_surface *shsurf)
+{
+	if (shsurf->resize_configure.in_flight ||
+	    !shsurf->resize_configure.queued)
+		return;
+
+	shsurf->resize_configure.queued = false;
+	resize_configure_send(shsurf, shsurf->resize_configure.width,
+			      shsurf->resize_configure.height);
+}
+
+static void
+resize_configure_queue(struct shell_surface *shsurf,
+		       int32_t width, int32_t height)
+{
+	if (!shsurf->resize_configure.queued &&
+	    shsurf->resize_configure.sent_width == width &&
+	    shsurf->resize_configure.sent_height == height)
+		return;
+
+	shsurf->resize_configure.width = width;
+	shsurf->resize_configure.height = height;
+	shsurf->resize_configure.queued = true;
+	resize_configure_flush(shsurf);
+}
+
+/* Called on each commit of a new buffer */
+static void
+resize_configure_committed(struct shell_surface *shsurf)
+{
+	if (!shsurf->resize_configure.in_flight ||
+	    !shsurf->resize_configure.acked)
+		return;
+
+	shsurf->resize_configure.in_flight = false;
+	if (shsurf->resize_configure.timer)
+		wl_event_source_timer_update(shsurf->resize_configure.timer, 0);
+	resize_configure_flush(shsurf);
+}
+
+/* The grab is over: the final size must not stay queued */
+static void
+resize_configure_finish(struct shell_surface *shsurf)
+{
+	if (shsurf->resize_configure.queued) {
+		shsurf->resize_configure.queued = false;
+		shsurf->client->send_configure(shsurf->surface,
+					       shsurf->resize_configure.width,
+					       shsurf->resize_configure.height);
+	}
+
+	shsurf->resize_configure.in_flight = false;
+	if (shsurf->resize_configure.timer)
+		wl_event_source_timer_update(shsurf->resize_configure.timer, 0);
+}
+
 static void
 resize_grab_motion(struct weston_pointer_grab *grab, uint32_t time,
 		   wl_fixed_t x, wl_fixed_t y)
@@ -1871,7 +2223,7 @@ resize_grab_motion(struct weston_pointer_grab *grab, uint32_t time,
 		width = 1;
 	if (height < 1)
 		height = 1;
-	shsurf->client->send_configure(shsurf->surface, width, height);
+	resize_configure_queue(shsurf, width, height);
 }
 
 static void
@@ -1901,6 +2253,8 @@ resize_grab_button(struct weston_pointer_grab *grab,
 
 	if (pointer->button_count == 0 &&
 	    state == WL_POINTER_BUTTON_STATE_RELEASED) {
+		if (resize->base.shsurf)
+			resize_configure_finish(resize->base.shsurf);
 		shell_grab_end(&resize->base);
 		free(grab);
 	}
@@ -1911,6 +2265,8 @@ resize_grab_cancel(struct weston_pointer_grab *grab)
 {
 	struct weston_resize_grab *resize = (struct weston_resize_grab *) grab;
 
+	if (resize->base.shsurf)
+		resize_configure_finish(resize->base.shsurf);
 	shell_grab_end(&resize->base);
 	free(grab);
 }
@@ -1928,33 +2284,18 @@ static const struct weston_pointer_grab_interface resize_grab_interface = {
 static void
 surface_subsurfaces_boundingbox(struct weston_surface *surface, int32_t *x,
 				int32_t *y, int32_t *w, int32_t *h) {
-	pixman_region32_t region;
-	pixman_box32_t *box;
-	struct weston_subsurface *subsurface;
-
-	pixman_region32_init_rect(&region, 0, 0,
-	                          surface->width,
-	                          surface->height);
+	pixman_box32_t box;
 
-	wl_list_for_each(subsurface, &surface->subsurface_list, parent_link) {
-		pixman_region32_union_rect(&region, &region,
-		                           subsurface->position.x,
-		                           subsurface->position.y,
-		                           subsurface->surface->width,
-		                           subsurface->surface->height);
-	}
+	weston_surface_get_subsurfaces_extents(surface, &box);
 
-	box = pixman_region32_extents(&region);
 	if (x)
-		*x = box->x1;
+		*x = box.x1;
 	if (y)
-		*y = box->y1;
+		*y = box.y1;
 	if (w)
-		*w = box->x2 - box->x1;
+		*w = box.x2 - box.x1;
 	if (h)
-		*h = box->y2 - box->y1;
-
-	pixman_region32_fini(&region);
+		*h = box.y2 - box.y1;
 }
 
 static int
@@ -1987,6 +2328,11 @@ surface_resize(struct shell_surface *shsurf,
 	resize->width = shsurf->geometry.width;
 	resize->height = shsurf->geometry.height;
 
+	shsurf->resize_configure.queued = false;
+	shsurf->resize_configure.in_flight = false;
+	shsurf->resize_configure.sent_width = resize->width;
+	shsurf->resize_configure.sent_height = resize->height;
+
 	shsurf->resize_edges = edges;
 	shell_surface_state_changed(shsurf);
 	shell_grab_start(&resize->base, &resize_grab_interface, shsurf,
@@ -3593,6 +3939,9 @@ destroy_shell_surface(struct shell_surface *shsurf)
 	if (shsurf->fullscreen.black_view)
 		weston_surface_destroy(shsurf->fullscreen.black_view->surface);
 
+	if (shsurf->resize_configure.timer)
+		wl_event_source_remove(shsurf->resize_configure.timer);
+
 	/* As destroy_resource() use wl_list_for_each_safe(),
 	 * we can always remove the listener.
 	 */
@@ -3672,6 +4021,7 @@ handle_resource_destroy(struct wl_listener *listener, void *data)
 
 	pixman_region32_fini(&shsurf->surface->pending.input);
 	pixman_region32_init(&shsurf->surface->pending.input);
+	shsurf->surface->pending.dirty |= WESTON_SURFACE_STATE_INPUT;
 	pixman_region32_fini(&shsurf->surface->input);
 	pixman_region32_init(&shsurf->surface->input);
 	if (shsurf->shell->win_close_animation_type == ANIMATION_FADE) {
@@ -3904,6 +4254,10 @@ xdg_surface_ack_configure(struct wl_client *client,
 {
 	struct shell_surface *shsurf = wl_resource_get_user_data(resource);
 
+	if (shsurf->resize_configure.in_flight &&
+	    (int32_t) (serial - shsurf->resize_configure.serial) >= 0)
+		shsurf->resize_configure.acked = true;
+
 	if (shsurf->state_requested) {
 		shsurf->next_state = shsurf->requested_state;
 		shsurf->state_changed = true;
@@ -4057,6 +4411,7 @@ xdg_send_configure(struct weston_surface *surface,
 
 	serial = wl_display_next_serial(shsurf->surface->compositor->wl_display);
 	xdg_surface_send_configure(shsurf->resource, width, height, &states, serial);
+	shsurf->configure_serial = serial;
 
 	wl_array_release(&states);
 }
@@ -5690,6 +6045,8 @@ shell_surface_configure(struct weston_surface *es, int32_t sx, int32_t sy)
 
 	shell = shsurf->shell;
 
+	resize_configure_committed(shsurf);
+
 	if (!weston_surface_is_mapped(es) &&
 	    !wl_list_empty(&shsurf->popup.grab_link)) {
 		remove_popup_grab(shsurf);
@@ -106,6 +106,11 @@ struct workspace {
 	struct focus_surface *fsurf_front;
 	struct focus_surface *fsurf_back;
 	struct weston_view_animation *focus_animation;
+
+	/* Stands in for the layer while workspaces slide, if enabled */
+	struct weston_layer snapshot_layer;
+	struct weston_surface *snapshot;
+	struct weston_view *snapshot_view;
 };
 
 struct shell_output {
@@ -194,6 +199,7 @@ struct desktop_shell {
 	enum animation_type win_close_animation_type;
 	enum animation_type startup_animation_type;
 	enum animation_type focus_animation_type;
+	int workspace_snapshot;
 
 	struct weston_layer minimized_layer;
 
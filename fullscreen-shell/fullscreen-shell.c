@@ -360,6 +360,11 @@ fs_output_scale_view(struct fs_output *fsout, float width, float height)
 					 fsout->output->x - surf_x,
 					 fsout->output->y - surf_y);
 	} else {
+		/* Land on whole output pixels, so the backend can show
+		 * the buffer scaled on a plane instead of compositing it */
+		width = (int32_t) (width + 0.5f);
+		height = (int32_t) (height + 0.5f);
+
 		matrix = &fsout->transform.matrix;
 		weston_matrix_init(matrix);
 
@@ -369,8 +374,8 @@ fs_output_scale_view(struct fs_output *fsout, float width, float height)
 		wl_list_insert(&fsout->view->geometry.transformation_list,
 			       &fsout->transform.link);
 
-		x = output->x + (output->width - width) / 2 - surf_x;
-		y = output->y + (output->height - height) / 2 - surf_y;
+		x = output->x + (int32_t) (output->width - width) / 2 - surf_x;
+		y = output->y + (int32_t) (output->height - height) / 2 - surf_y;
 
 		weston_view_set_position(view, x, y);
 	}
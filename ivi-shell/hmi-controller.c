@@ -198,6 +198,36 @@ compare_launcher_info(const void *lhs, const void *rhs)
 	return 0;
 }
 
+/*
+ * The layouts below fill in an update for each application ivi_surface
+ * and hand them all to ivi-layout in one surface_apply_updates() call.
+ */
+static void
+set_surface_update(struct ivi_layout_surface_update *update,
+		   struct ivi_layout_surface *ivisurf,
+		   enum ivi_layout_transition_type transition_type,
+		   uint32_t duration, bool visibility)
+{
+	update->ivisurf = ivisurf;
+	update->mask = IVI_LAYOUT_SURFACE_UPDATE_TRANSITION |
+		       IVI_LAYOUT_SURFACE_UPDATE_VISIBILITY;
+	update->transition_type = transition_type;
+	update->transition_duration = duration;
+	update->visibility = visibility;
+}
+
+static void
+set_surface_update_rectangle(struct ivi_layout_surface_update *update,
+			     int32_t x, int32_t y,
+			     int32_t width, int32_t height)
+{
+	update->mask |= IVI_LAYOUT_SURFACE_UPDATE_DEST_RECT;
+	update->dest_x = x;
+	update->dest_y = y;
+	update->dest_width = width;
+	update->dest_height = height;
+}
+
 /**
  * Internal methods called by mainly ivi_hmi_controller_switch_mode
  * This reference shows 4 examples how to use ivi_layout APIs.
@@ -213,16 +243,15 @@ mode_divided_into_tiling(struct hmi_controller *hmi_ctrl,
 	int32_t surface_x = 0;
 	int32_t surface_y = 0;
 	struct ivi_layout_surface *ivisurf  = NULL;
-	struct ivi_layout_surface **surfaces;
-	struct ivi_layout_surface **new_order;
+	struct ivi_layout_surface_update *updates;
+	struct ivi_layout_surface_update *update;
 	const uint32_t duration = hmi_ctrl->hmi_setting->transition_duration;
 
 	int32_t i = 0;
 	int32_t surf_num = 0;
 	uint32_t num = 1;
 
-	surfaces = MEM_ALLOC(sizeof(*surfaces) * surface_length);
-	new_order = MEM_ALLOC(sizeof(*surfaces) * surface_length);
+	updates = MEM_ALLOC(sizeof(*updates) * surface_length);
 
 	for (i = 0; i < surface_length; i++) {
 		ivisurf = pp_surface[i];
@@ -231,12 +260,7 @@ mode_divided_into_tiling(struct hmi_controller *hmi_ctrl,
 		if (is_surf_in_ui_widget(hmi_ctrl, ivisurf))
 			continue;
 
-		surfaces[surf_num++] = ivisurf;
-	}
-
-	for (i = 0; i < surf_num; i++) {
-		ivisurf = surfaces[i];
-		new_order[i] = ivisurf;
+		update = &updates[surf_num++];
 
 		if (num <= 8) {
 			if (num < 5) {
@@ -247,11 +271,10 @@ mode_divided_into_tiling(struct hmi_controller *hmi_ctrl,
 				surface_y = (int32_t)surface_height;
 			}
 
-			ivi_controller_interface->surface_set_transition(ivisurf,
-					IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
-					duration);
-			ivi_controller_interface->surface_set_visibility(ivisurf, true);
-			ivi_controller_interface->surface_set_destination_rectangle(ivisurf,
+			set_surface_update(update, ivisurf,
+					   IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
+					   duration, true);
+			set_surface_update_rectangle(update,
 					surface_x, surface_y,
 					(int32_t)surface_width,
 					(int32_t)surface_height);
@@ -259,17 +282,20 @@ mode_divided_into_tiling(struct hmi_controller *hmi_ctrl,
 			num++;
 			continue;
 		}
-		ivi_controller_interface->surface_set_visibility(ivisurf, false);
+		update->ivisurf = ivisurf;
+		update->mask = IVI_LAYOUT_SURFACE_UPDATE_VISIBILITY;
+		update->visibility = false;
 	}
 
+	ivi_controller_interface->surface_apply_updates(updates, surf_num);
+
 	if (surf_num > 0) {
 		ivi_controller_interface->layer_set_transition(layer->ivilayer,
 				IVI_LAYOUT_TRANSITION_LAYER_VIEW_ORDER,
 				duration);
 	}
 
-	free(surfaces);
-	free(new_order);
+	free(updates);
 }
 
 static void
@@ -281,11 +307,16 @@ mode_divided_into_sidebyside(struct hmi_controller *hmi_ctrl,
 	int32_t surface_width  = layer->width / 2;
 	int32_t surface_height = layer->height;
 	struct ivi_layout_surface *ivisurf  = NULL;
+	struct ivi_layout_surface_update *updates;
+	struct ivi_layout_surface_update *update;
 
 	const uint32_t duration = hmi_ctrl->hmi_setting->transition_duration;
 	int32_t i = 0;
+	int32_t surf_num = 0;
 	int32_t num = 1;
 
+	updates = MEM_ALLOC(sizeof(*updates) * surface_length);
+
 	for (i = 0; i < surface_length; i++) {
 		ivisurf = pp_surface[i];
 
@@ -293,36 +324,39 @@ mode_divided_into_sidebyside(struct hmi_controller *hmi_ctrl,
 		if (is_surf_in_ui_widget(hmi_ctrl, ivisurf))
 			continue;
 
+		update = &updates[surf_num++];
+
 		if (num == 1) {
-			ivi_controller_interface->surface_set_transition(ivisurf,
-					IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
-					duration);
-			ivi_controller_interface->surface_set_visibility(ivisurf, true);
-			ivi_controller_interface->surface_set_destination_rectangle(ivisurf,
-							0, 0,
-							surface_width,
-							surface_height);
+			set_surface_update(update, ivisurf,
+					   IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
+					   duration, true);
+			set_surface_update_rectangle(update,
+						     0, 0,
+						     surface_width,
+						     surface_height);
 
 			num++;
 			continue;
 		} else if (num == 2) {
-			ivi_controller_interface->surface_set_transition(ivisurf,
-					IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
-					duration);
-			ivi_controller_interface->surface_set_visibility(ivisurf, true);
-			ivi_controller_interface->surface_set_destination_rectangle(ivisurf,
-							surface_width, 0,
-							surface_width,
-							surface_height);
+			set_surface_update(update, ivisurf,
+					   IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
+					   duration, true);
+			set_surface_update_rectangle(update,
+						     surface_width, 0,
+						     surface_width,
+						     surface_height);
 
 			num++;
 			continue;
 		}
-		ivi_controller_interface->surface_set_transition(ivisurf,
-					IVI_LAYOUT_TRANSITION_VIEW_FADE_ONLY,
-					duration);
-		ivi_controller_interface->surface_set_visibility(ivisurf, false);
+		set_surface_update(update, ivisurf,
+				   IVI_LAYOUT_TRANSITION_VIEW_FADE_ONLY,
+				   duration, false);
 	}
+
+	ivi_controller_interface->surface_apply_updates(updates, surf_num);
+
+	free(updates);
 }
 
 static void
@@ -334,9 +368,14 @@ mode_fullscreen_someone(struct hmi_controller *hmi_ctrl,
 	const int32_t  surface_width  = layer->width;
 	const int32_t  surface_height = layer->height;
 	struct ivi_layout_surface *ivisurf  = NULL;
+	struct ivi_layout_surface_update *updates;
+	struct ivi_layout_surface_update *update;
 	int32_t i = 0;
+	int32_t surf_num = 0;
 	const uint32_t duration = hmi_ctrl->hmi_setting->transition_duration;
 
+	updates = MEM_ALLOC(sizeof(*updates) * surface_length);
+
 	for (i = 0; i < surface_length; i++) {
 		ivisurf = pp_surface[i];
 
@@ -344,14 +383,18 @@ mode_fullscreen_someone(struct hmi_controller *hmi_ctrl,
 		if (is_surf_in_ui_widget(hmi_ctrl, ivisurf))
 			continue;
 
-		ivi_controller_interface->surface_set_transition(ivisurf,
-					IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
-					duration);
-		ivi_controller_interface->surface_set_visibility(ivisurf, true);
-		ivi_controller_interface->surface_set_destination_rectangle(ivisurf, 0, 0,
-							     surface_width,
-							     surface_height);
+		update = &updates[surf_num++];
+		set_surface_update(update, ivisurf,
+				   IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
+				   duration, true);
+		set_surface_update_rectangle(update, 0, 0,
+					     surface_width,
+					     surface_height);
 	}
+
+	ivi_controller_interface->surface_apply_updates(updates, surf_num);
+
+	free(updates);
 }
 
 static void
@@ -365,8 +408,13 @@ mode_random_replace(struct hmi_controller *hmi_ctrl,
 	int32_t surface_x = 0;
 	int32_t surface_y = 0;
 	struct ivi_layout_surface *ivisurf  = NULL;
+	struct ivi_layout_surface_update *updates;
+	struct ivi_layout_surface_update *update;
 	const uint32_t duration = hmi_ctrl->hmi_setting->transition_duration;
 	int32_t i = 0;
+	int32_t surf_num = 0;
+
+	updates = MEM_ALLOC(sizeof(*updates) * surface_length);
 
 	for (i = 0; i < surface_length; i++) {
 		ivisurf = pp_surface[i];
@@ -375,19 +423,23 @@ mode_random_replace(struct hmi_controller *hmi_ctrl,
 		if (is_surf_in_ui_widget(hmi_ctrl, ivisurf))
 			continue;
 
-		ivi_controller_interface->surface_set_transition(ivisurf,
-					IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
-					duration);
-		ivi_controller_interface->surface_set_visibility(ivisurf, true);
+		update = &updates[surf_num++];
+		set_surface_update(update, ivisurf,
+				   IVI_LAYOUT_TRANSITION_VIEW_DEFAULT,
+				   duration, true);
 		surface_x = rand() % (layer->width - surface_width);
 		surface_y = rand() % (layer->height - surface_height);
 
-		ivi_controller_interface->surface_set_destination_rectangle(ivisurf,
-							     surface_x,
-							     surface_y,
-							     surface_width,
-							     surface_height);
+		set_surface_update_rectangle(update,
+					     surface_x,
+					     surface_y,
+					     surface_width,
+					     surface_height);
 	}
+
+	ivi_controller_interface->surface_apply_updates(updates, surf_num);
+
+	free(updates);
 }
 
 static int32_t
@@ -696,6 +748,8 @@ hmi_controller_create(struct weston_compositor *ec)
 	hmi_ctrl->base_layer.id_layer = hmi_ctrl->hmi_setting->base_layer_id;
 
 	create_layer(iviscrn, &hmi_ctrl->base_layer);
+	ivi_controller_interface->layer_set_cacheable(
+		hmi_ctrl->base_layer.ivilayer, true);
 
 	panel_height = hmi_ctrl->hmi_setting->panel_height;
 
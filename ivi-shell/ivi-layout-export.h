@@ -104,6 +104,7 @@ struct ivi_layout_layer_properties
 	double start_alpha;
 	double end_alpha;
 	uint32_t is_fade_in;
+	uint32_t cacheable;
 };
 
 enum ivi_layout_notification_mask {
@@ -173,6 +174,53 @@ typedef void (*ivi_controller_surface_content_callback)(
 			int32_t content,
 			void *userdata);
 
+struct ivi_layout_surface_change {
+	struct ivi_layout_surface *ivisurf;
+	enum ivi_layout_notification_mask mask;
+};
+
+struct ivi_layout_layer_change {
+	struct ivi_layout_layer *ivilayer;
+	enum ivi_layout_notification_mask mask;
+};
+
+enum ivi_layout_surface_update_mask {
+	IVI_LAYOUT_SURFACE_UPDATE_VISIBILITY	= (1 << 0),
+	IVI_LAYOUT_SURFACE_UPDATE_OPACITY	= (1 << 1),
+	IVI_LAYOUT_SURFACE_UPDATE_DEST_RECT	= (1 << 2),
+	IVI_LAYOUT_SURFACE_UPDATE_TRANSITION	= (1 << 3),
+};
+
+/**
+ * Property changes of one ivi_surface for surface_apply_updates(), only
+ * the members named in mask are used.
+ */
+struct ivi_layout_surface_update {
+	struct ivi_layout_surface *ivisurf;
+	uint32_t mask;	/* enum ivi_layout_surface_update_mask */
+	bool visibility;
+	wl_fixed_t opacity;
+	int32_t dest_x;
+	int32_t dest_y;
+	int32_t dest_width;
+	int32_t dest_height;
+	enum ivi_layout_transition_type transition_type;
+	uint32_t transition_duration;
+};
+
+typedef void (*surface_dump_done_func)(
+			void *target,
+			int32_t width, int32_t height,
+			int32_t result,
+			void *userdata);
+
+typedef void (*commit_notification_func)(
+			const struct ivi_layout_surface_change *surfaces,
+			int32_t surface_count,
+			const struct ivi_layout_layer_change *layers,
+			int32_t layer_count,
+			void *userdata);
+
 struct ivi_controller_interface {
 
 	/**
@@ -804,6 +852,75 @@ struct ivi_controller_interface {
 	 * \return id of ivi_screen
 	 */
 	uint32_t (*get_id_of_screen)(struct ivi_layout_screen *iviscrn);
+
+	/**
+	 * \brief register/unregister for one notification per commit
+	 *
+	 * After the per-object property notifications of a commit, the
+	 * callback gets every ivi_surface and ivi_layer that changed in it
+	 * once, each with the mask of everything that changed. It is not
+	 * called for commits that change nothing. The arrays are only
+	 * valid during the callback.
+	 */
+	int32_t (*add_notification_commit)(
+				commit_notification_func callback,
+				void *userdata);
+
+	void (*remove_notification_commit)(
+				commit_notification_func callback,
+				void *userdata);
+
+	/**
+	 * \brief dump the content of an ivi_surface scaled to width and
+	 * height without waiting for the GPU
+	 *
+	 * The whole content is scaled down by the renderer and stored in
+	 * target like surface_dump() does, which needs width * 4 * height
+	 * bytes of size. The callback gets the result once the copy is
+	 * done, from the event loop or before this returns; target must
+	 * stay valid until then. It is called even if the ivi_surface is
+	 * destroyed in the meantime.
+	 *
+	 * \return IVI_SUCCEEDED if the callback is going to be called
+	 * \return IVI_FAILED if the method call was failed
+	 */
+	int32_t (*surface_dump_async)(struct ivi_layout_surface *ivisurf,
+				      void *target, size_t size,
+				      int32_t width, int32_t height,
+				      surface_dump_done_func callback,
+				      void *userdata);
+
+	/**
+	 * \brief set properties of many ivi_surfaces at once
+	 *
+	 * Has the same effect as the surface_set_transition,
+	 * surface_set_visibility, surface_set_opacity and
+	 * surface_set_destination_rectangle calls for each update, but
+	 * checks all of the updates first and then writes each one in a
+	 * single pass: either all of them are applied or none is. The
+	 * changes take effect with the next commit_changes().
+	 *
+	 * \return IVI_SUCCEEDED if the method call was successful
+	 * \return IVI_FAILED if the method call was failed
+	 */
+	int32_t (*surface_apply_updates)(
+				const struct ivi_layout_surface_update *updates,
+				int32_t count);
+
+	/**
+	 * \brief mark the contents of an ivi_layer as mostly static
+	 *
+	 * The renderer may then draw the ivi_surfaces of the ivi_layer once
+	 * into an offscreen buffer, apart from the other ivi_layers, and
+	 * reuse it until one of them is damaged or moves. Meant for
+	 * backgrounds and home screens; an ivi_layer that changes often
+	 * costs an extra copy each time it does.
+	 *
+	 * \return IVI_SUCCEEDED if the method call was successful
+	 * \return IVI_FAILED if the method call was failed
+	 */
+	int32_t (*layer_set_cacheable)(struct ivi_layout_layer *ivilayer,
+				       bool cacheable);
 };
 
 #ifdef __cplusplus
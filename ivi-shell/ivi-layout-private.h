@@ -31,6 +31,7 @@
 
 struct ivi_layout_surface {
 	struct wl_list link;
+	struct wl_list id_link; /* ivi_layout::surface_ids */
 	struct wl_signal property_changed;
 	struct wl_list layer_list;
 	int32_t update_count;
@@ -47,6 +48,7 @@ struct ivi_layout_surface {
 	struct {
 		struct ivi_layout_surface_properties prop;
 		struct wl_list link;
+		int dirty; /* prop set since the last commit */
 	} pending;
 
 	struct {
@@ -64,6 +66,7 @@ struct ivi_layout_surface {
 
 struct ivi_layout_layer {
 	struct wl_list link;
+	struct wl_list id_link; /* ivi_layout::layer_ids */
 	struct wl_signal property_changed;
 	struct wl_list screen_list;
 	struct wl_list link_to_surface;
@@ -78,6 +81,7 @@ struct ivi_layout_layer {
 		struct ivi_layout_layer_properties prop;
 		struct wl_list surface_list;
 		struct wl_list link;
+		int dirty; /* prop set since the last commit */
 	} pending;
 
 	struct {
@@ -89,6 +93,8 @@ struct ivi_layout_layer {
 	int32_t ref_count;
 };
 
+#define IVI_LAYOUT_ID_BUCKETS 256
+
 struct ivi_layout {
 	struct weston_compositor *compositor;
 
@@ -96,6 +102,11 @@ struct ivi_layout {
 	struct wl_list layer_list;
 	struct wl_list screen_list;
 
+	/* The same objects hashed by their IDs */
+	struct wl_list surface_ids[IVI_LAYOUT_ID_BUCKETS];
+	struct wl_list layer_ids[IVI_LAYOUT_ID_BUCKETS];
+	struct wl_list screen_ids[IVI_LAYOUT_ID_BUCKETS];
+
 	struct {
 		struct wl_signal created;
 		struct wl_signal removed;
@@ -107,7 +118,17 @@ struct ivi_layout {
 		struct wl_signal configure_changed;
 	} surface_notification;
 
+	/* Changes of the commit being sent, for add_notification_commit */
+	struct {
+		struct wl_signal committed;
+		struct wl_array surface_changes;
+		struct wl_array layer_changes;
+	} commit_notification;
+
 	struct weston_layer layout_layer;
+	/* layout_layer must be rebuilt: render orders or visibility
+	 * changed, or a surface or layer went away */
+	int view_list_dirty;
 	struct wl_signal warning_signal;
 
 	struct ivi_layout_transition_set *transitions;
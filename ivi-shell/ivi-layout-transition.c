@@ -47,7 +47,9 @@ struct ivi_layout_transition {
 	uint32_t time_start;
 	uint32_t time_duration;
 	uint32_t time_elapsed;
+	float nowpos; /* eased progress at time_elapsed, set by the tick */
 	uint32_t  is_done;
+	struct transition_node *node;
 	ivi_layout_is_transition_func is_transition_func;
 	ivi_layout_transition_frame_func frame_func;
 	ivi_layout_transition_destroy_func destroy_func;
@@ -60,6 +62,39 @@ struct transition_node {
 
 static void layout_transition_destroy(struct ivi_layout_transition *transition);
 
+/* The easing curve, sin(x * pi / 2) over [0, 1], sampled once so that
+ * a frame of many transitions does not evaluate it for each of them. */
+#define EASING_CURVE_STEPS 256
+static float easing_curve[EASING_CURVE_STEPS + 1];
+
+static void
+easing_curve_init(void)
+{
+	int i;
+
+	if (easing_curve[EASING_CURVE_STEPS] != 0.0f)
+		return;
+
+	for (i = 0; i <= EASING_CURVE_STEPS; i++)
+		easing_curve[i] = sin((double)i / EASING_CURVE_STEPS * M_PI_2);
+}
+
+static float
+easing_curve_at(uint32_t elapsed, uint32_t duration)
+{
+	float pos, frac;
+	int i;
+
+	if (duration == 0 || elapsed >= duration)
+		return 1.0f;
+
+	pos = (float)elapsed / (float)duration * EASING_CURVE_STEPS;
+	i = (int)pos;
+	frac = pos - i;
+
+	return easing_curve[i] + (easing_curve[i + 1] - easing_curve[i]) * frac;
+}
+
 static struct ivi_layout_transition *
 get_transition_from_type_and_id(enum ivi_layout_transition_type type,
 				void *id_data)
@@ -109,12 +144,14 @@ tick_transition(struct ivi_layout_transition *transition, uint32_t timestamp)
 	} else {
 		transition->time_elapsed = t;
 	}
+
+	transition->nowpos = easing_curve_at(transition->time_elapsed,
+					     transition->time_duration);
 }
 
 static float time_to_nowpos(struct ivi_layout_transition *transition)
 {
-	return sin((float)transition->time_elapsed /
-		   (float)transition->time_duration * M_PI_2);
+	return transition->nowpos;
 }
 
 static void
@@ -172,6 +209,7 @@ ivi_layout_transition_set_create(struct weston_compositor *ec)
 	}
 
 	wl_list_init(&transitions->transition_list);
+	easing_curve_init();
 
 	loop = wl_display_get_event_loop(ec->wl_display);
 	transitions->event_source =
@@ -194,33 +232,24 @@ layout_transition_register(struct ivi_layout_transition *trans)
 	}
 
 	node->transition = trans;
+	trans->node = node;
 	wl_list_insert(&layout->pending_transition_list, &node->link);
 }
 
+/* The node is on either the active or the pending list, unlinking it
+ * does not need to know which. */
 static void
 remove_transition(struct ivi_layout *layout,
 		  struct ivi_layout_transition *trans)
 {
-	struct transition_node *node;
-	struct transition_node *next;
-
-	wl_list_for_each_safe(node, next,
-			      &layout->transitions->transition_list, link) {
-		if (node->transition == trans) {
-			wl_list_remove(&node->link);
-			free(node);
-			return;
-		}
-	}
+	struct transition_node *node = trans->node;
 
-	wl_list_for_each_safe(node, next,
-			      &layout->pending_transition_list, link) {
-		if (node->transition == trans) {
-			wl_list_remove(&node->link);
-			free(node);
-			return;
-		}
-	}
+	if (node == NULL)
+		return;
+
+	wl_list_remove(&node->link);
+	free(node);
+	trans->node = NULL;
 }
 
 static void
@@ -248,8 +277,10 @@ create_layout_transition(void)
 	transition->time_start = 0;
 	transition->time_duration = 300; /* 300ms */
 	transition->time_elapsed = 0;
+	transition->nowpos = 0.0f;
 
 	transition->is_done = 0;
+	transition->node = NULL;
 
 	transition->private_data = NULL;
 	transition->user_data = NULL;
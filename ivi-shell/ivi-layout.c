@@ -90,6 +90,7 @@ struct ivi_layout;
 
 struct ivi_layout_screen {
 	struct wl_list link;
+	struct wl_list id_link; /* ivi_layout::screen_ids */
 	struct wl_list link_to_layer;
 	uint32_t id_screen;
 
@@ -243,14 +244,28 @@ remove_orderlayer_from_screen(struct ivi_layout_layer *ivilayer)
 }
 
 /**
- * Internal API to add/remove a ivi_layer to/from ivi_screen.
+ * Internal API to look up ivi_surface/ivi_layer/ivi_screen by ID.
+ *
+ * IDs are picked by clients and controllers, often as small sequential
+ * numbers or with a fixed prefix in the high bits, so fold all of them
+ * into the bucket index.
  */
+static struct wl_list *
+id_bucket(struct wl_list *buckets, uint32_t id)
+{
+	id ^= id >> 16;
+	id ^= id >> 8;
+
+	return &buckets[id % IVI_LAYOUT_ID_BUCKETS];
+}
+
 static struct ivi_layout_surface *
-get_surface(struct wl_list *surf_list, uint32_t id_surface)
+get_surface(struct ivi_layout *layout, uint32_t id_surface)
 {
 	struct ivi_layout_surface *ivisurf;
 
-	wl_list_for_each(ivisurf, surf_list, link) {
+	wl_list_for_each(ivisurf, id_bucket(layout->surface_ids, id_surface),
+			 id_link) {
 		if (ivisurf->id_surface == id_surface) {
 			return ivisurf;
 		}
@@ -260,11 +275,12 @@ get_surface(struct wl_list *surf_list, uint32_t id_surface)
 }
 
 static struct ivi_layout_layer *
-get_layer(struct wl_list *layer_list, uint32_t id_layer)
+get_layer(struct ivi_layout *layout, uint32_t id_layer)
 {
 	struct ivi_layout_layer *ivilayer;
 
-	wl_list_for_each(ivilayer, layer_list, link) {
+	wl_list_for_each(ivilayer, id_bucket(layout->layer_ids, id_layer),
+			 id_link) {
 		if (ivilayer->id_layer == id_layer) {
 			return ivilayer;
 		}
@@ -273,6 +289,21 @@ get_layer(struct wl_list *layer_list, uint32_t id_layer)
 	return NULL;
 }
 
+static struct ivi_layout_screen *
+get_screen(struct ivi_layout *layout, uint32_t id_screen)
+{
+	struct ivi_layout_screen *iviscrn;
+
+	wl_list_for_each(iviscrn, id_bucket(layout->screen_ids, id_screen),
+			 id_link) {
+		if (iviscrn->id_screen == id_screen) {
+			return iviscrn;
+		}
+	}
+
+	return NULL;
+}
+
 static void
 remove_configured_listener(struct ivi_layout_surface *ivisurf)
 {
@@ -345,7 +376,9 @@ ivi_layout_surface_destroy(struct ivi_layout_surface *ivisurf)
 	wl_list_remove(&ivisurf->pending.link);
 	wl_list_remove(&ivisurf->order.link);
 	wl_list_remove(&ivisurf->link);
+	wl_list_remove(&ivisurf->id_link);
 	remove_ordersurface_from_layer(ivisurf);
+	layout->view_list_dirty = 1;
 
 	wl_signal_emit(&layout->surface_notification.removed, ivisurf);
 
@@ -425,6 +458,8 @@ create_screen(struct weston_compositor *ec)
 		wl_list_init(&iviscrn->link_to_layer);
 
 		wl_list_insert(&layout->screen_list, &iviscrn->link);
+		wl_list_insert(id_bucket(layout->screen_ids, iviscrn->id_screen),
+			       &iviscrn->id_link);
 	}
 }
 
@@ -820,6 +855,13 @@ commit_surface_list(struct ivi_layout *layout)
 	int32_t configured = 0;
 
 	wl_list_for_each(ivisurf, &layout->surface_list, link) {
+		if (!ivisurf->pending.dirty)
+			continue;
+
+		ivisurf->pending.dirty = 0;
+		if (ivisurf->prop.visibility != ivisurf->pending.prop.visibility)
+			layout->view_list_dirty = 1;
+
 		if (ivisurf->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_VIEW_DEFAULT) {
 			dest_x = ivisurf->prop.dest_x;
 			dest_y = ivisurf->prop.dest_y;
@@ -913,22 +955,31 @@ commit_layer_list(struct ivi_layout *layout)
 	struct ivi_layout_surface *next     = NULL;
 
 	wl_list_for_each(ivilayer, &layout->layer_list, link) {
-		if (ivilayer->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_LAYER_MOVE) {
-			ivi_layout_transition_move_layer(ivilayer, ivilayer->pending.prop.dest_x, ivilayer->pending.prop.dest_y, ivilayer->pending.prop.transition_duration);
-		} else if (ivilayer->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_LAYER_FADE) {
-			ivi_layout_transition_fade_layer(ivilayer,ivilayer->pending.prop.is_fade_in,
-							 ivilayer->pending.prop.start_alpha,ivilayer->pending.prop.end_alpha,
-							 NULL, NULL,
-							 ivilayer->pending.prop.transition_duration);
-		}
-		ivilayer->pending.prop.transition_type = IVI_LAYOUT_TRANSITION_NONE;
+		if (ivilayer->pending.dirty) {
+			if (ivilayer->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_LAYER_MOVE) {
+				ivi_layout_transition_move_layer(ivilayer, ivilayer->pending.prop.dest_x, ivilayer->pending.prop.dest_y, ivilayer->pending.prop.transition_duration);
+			} else if (ivilayer->pending.prop.transition_type == IVI_LAYOUT_TRANSITION_LAYER_FADE) {
+				ivi_layout_transition_fade_layer(ivilayer,ivilayer->pending.prop.is_fade_in,
+								 ivilayer->pending.prop.start_alpha,ivilayer->pending.prop.end_alpha,
+								 NULL, NULL,
+								 ivilayer->pending.prop.transition_duration);
+			}
+			ivilayer->pending.prop.transition_type = IVI_LAYOUT_TRANSITION_NONE;
+
+			if (ivilayer->prop.visibility != ivilayer->pending.prop.visibility ||
+			    ivilayer->prop.cacheable != ivilayer->pending.prop.cacheable)
+				layout->view_list_dirty = 1;
 
-		ivilayer->prop = ivilayer->pending.prop;
+			ivilayer->prop = ivilayer->pending.prop;
+			ivilayer->pending.dirty = 0;
+		}
 
 		if (!ivilayer->order.dirty) {
 			continue;
 		}
 
+		layout->view_list_dirty = 1;
+
 		wl_list_for_each_safe(ivisurf, next, &ivilayer->order.surface_list,
 					 order.link) {
 			remove_ordersurface_from_layer(ivisurf);
@@ -962,6 +1013,8 @@ commit_screen_list(struct ivi_layout *layout)
 
 	wl_list_for_each(iviscrn, &layout->screen_list, link) {
 		if (iviscrn->order.dirty) {
+			layout->view_list_dirty = 1;
+
 			wl_list_for_each_safe(ivilayer, next,
 					      &iviscrn->order.layer_list, order.link) {
 				remove_orderlayer_from_screen(ivilayer);
@@ -983,8 +1036,15 @@ commit_screen_list(struct ivi_layout *layout)
 			iviscrn->order.dirty = 0;
 		}
 
+		/* Nothing that decides which views are shown has changed */
+		if (!layout->view_list_dirty)
+			break;
+
+		layout->view_list_dirty = 0;
+
 		/* Clear view list of layout ivi_layer */
 		wl_list_init(&layout->layout_layer.view_list.link);
+		layout->layout_layer.dirty = 1;
 
 		wl_list_for_each(ivilayer, &iviscrn->order.layer_list, order.link) {
 			if (ivilayer->prop.visibility == false)
@@ -1005,6 +1065,8 @@ commit_screen_list(struct ivi_layout *layout)
 
 				weston_layer_entry_insert(&layout->layout_layer.view_list,
 							  &tmpview->layer_link);
+				tmpview->cache_group =
+					ivilayer->prop.cacheable ? ivilayer : NULL;
 
 				ivisurf->surface->output = iviscrn->output;
 			}
@@ -1043,21 +1105,75 @@ send_layer_prop(struct ivi_layout_layer *ivilayer)
 	ivilayer->event_mask = 0;
 }
 
+static void
+queue_layer_change(struct ivi_layout *layout,
+		   struct ivi_layout_layer *ivilayer)
+{
+	struct ivi_layout_layer_change *change;
+
+	change = wl_array_add(&layout->commit_notification.layer_changes,
+			      sizeof *change);
+	if (change == NULL) {
+		weston_log("fails to allocate memory\n");
+		return;
+	}
+
+	change->ivilayer = ivilayer;
+	change->mask = ivilayer->event_mask;
+}
+
+static void
+queue_surface_change(struct ivi_layout *layout,
+		     struct ivi_layout_surface *ivisurf)
+{
+	struct ivi_layout_surface_change *change;
+
+	change = wl_array_add(&layout->commit_notification.surface_changes,
+			      sizeof *change);
+	if (change == NULL) {
+		weston_log("fails to allocate memory\n");
+		return;
+	}
+
+	change->ivisurf = ivisurf;
+	change->mask = ivisurf->event_mask;
+}
+
 static void
 send_prop(struct ivi_layout *layout)
 {
 	struct ivi_layout_layer   *ivilayer = NULL;
 	struct ivi_layout_surface *ivisurf  = NULL;
+	struct wl_array *surface_changes =
+		&layout->commit_notification.surface_changes;
+	struct wl_array *layer_changes =
+		&layout->commit_notification.layer_changes;
+	int batch;
+
+	batch = !wl_list_empty(&layout->commit_notification.committed.listener_list);
+	surface_changes->size = 0;
+	layer_changes->size = 0;
 
 	wl_list_for_each_reverse(ivilayer, &layout->layer_list, link) {
-		if (ivilayer->event_mask)
-			send_layer_prop(ivilayer);
+		if (!ivilayer->event_mask)
+			continue;
+
+		if (batch)
+			queue_layer_change(layout, ivilayer);
+		send_layer_prop(ivilayer);
 	}
 
 	wl_list_for_each_reverse(ivisurf, &layout->surface_list, link) {
-		if (ivisurf->event_mask)
-			send_surface_prop(ivisurf);
+		if (!ivisurf->event_mask)
+			continue;
+
+		if (batch)
+			queue_surface_change(layout, ivisurf);
+		send_surface_prop(ivisurf);
 	}
+
+	if (surface_changes->size > 0 || layer_changes->size > 0)
+		wl_signal_emit(&layout->commit_notification.committed, layout);
 }
 
 static void
@@ -1208,6 +1324,31 @@ surface_configure_changed(struct wl_listener *listener,
 		(ivisurface, configure_changed_callback->data);
 }
 
+static void
+commit_notified(struct wl_listener *listener, void *data)
+{
+	struct ivi_layout *layout = data;
+	struct wl_array *surface_changes =
+		&layout->commit_notification.surface_changes;
+	struct wl_array *layer_changes =
+		&layout->commit_notification.layer_changes;
+
+	struct listener_layout_notification *notification =
+		container_of(listener,
+			     struct listener_layout_notification,
+			     listener);
+
+	struct ivi_layout_notification_callback *commit_callback =
+		notification->userdata;
+
+	((commit_notification_func)commit_callback->callback)
+		(surface_changes->data,
+		 surface_changes->size / sizeof(struct ivi_layout_surface_change),
+		 layer_changes->data,
+		 layer_changes->size / sizeof(struct ivi_layout_layer_change),
+		 commit_callback->data);
+}
+
 static int32_t
 add_notification(struct wl_signal *signal,
 		 wl_notify_func_t callback,
@@ -1429,6 +1570,41 @@ ivi_layout_remove_notification_configure_surface(surface_configure_notification_
 	remove_notification(&layout->surface_notification.configure_changed.listener_list, callback, userdata);
 }
 
+static int32_t
+ivi_layout_add_notification_commit(commit_notification_func callback,
+				   void *userdata)
+{
+	struct ivi_layout *layout = get_instance();
+	struct ivi_layout_notification_callback *commit_callback = NULL;
+
+	if (callback == NULL) {
+		weston_log("ivi_layout_add_notification_commit: invalid argument\n");
+		return IVI_FAILED;
+	}
+
+	commit_callback = malloc(sizeof *commit_callback);
+	if (commit_callback == NULL) {
+		weston_log("fails to allocate memory\n");
+		return IVI_FAILED;
+	}
+
+	commit_callback->callback = callback;
+	commit_callback->data = userdata;
+
+	return add_notification(&layout->commit_notification.committed,
+				commit_notified,
+				commit_callback);
+}
+
+static void
+ivi_layout_remove_notification_commit(commit_notification_func callback,
+				      void *userdata)
+{
+	struct ivi_layout *layout = get_instance();
+	remove_notification(&layout->commit_notification.committed.listener_list,
+			    callback, userdata);
+}
+
 uint32_t
 ivi_layout_get_id_of_surface(struct ivi_layout_surface *ivisurf)
 {
@@ -1450,46 +1626,19 @@ ivi_layout_get_id_of_screen(struct ivi_layout_screen *iviscrn)
 static struct ivi_layout_layer *
 ivi_layout_get_layer_from_id(uint32_t id_layer)
 {
-	struct ivi_layout *layout = get_instance();
-	struct ivi_layout_layer *ivilayer = NULL;
-
-	wl_list_for_each(ivilayer, &layout->layer_list, link) {
-		if (ivilayer->id_layer == id_layer) {
-			return ivilayer;
-		}
-	}
-
-	return NULL;
+	return get_layer(get_instance(), id_layer);
 }
 
 struct ivi_layout_surface *
 ivi_layout_get_surface_from_id(uint32_t id_surface)
 {
-	struct ivi_layout *layout = get_instance();
-	struct ivi_layout_surface *ivisurf = NULL;
-
-	wl_list_for_each(ivisurf, &layout->surface_list, link) {
-		if (ivisurf->id_surface == id_surface) {
-			return ivisurf;
-		}
-	}
-
-	return NULL;
+	return get_surface(get_instance(), id_surface);
 }
 
 static struct ivi_layout_screen *
 ivi_layout_get_screen_from_id(uint32_t id_screen)
 {
-	struct ivi_layout *layout = get_instance();
-	struct ivi_layout_screen *iviscrn = NULL;
-
-	wl_list_for_each(iviscrn, &layout->screen_list, link) {
-/* FIXME : select iviscrn from screen_list by id_screen */
-		return iviscrn;
-		break;
-	}
-
-	return NULL;
+	return get_screen(get_instance(), id_screen);
 }
 
 static int32_t
@@ -1800,7 +1949,7 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 	struct ivi_layout *layout = get_instance();
 	struct ivi_layout_layer *ivilayer = NULL;
 
-	ivilayer = get_layer(&layout->layer_list, id_layer);
+	ivilayer = get_layer(layout, id_layer);
 	if (ivilayer != NULL) {
 		weston_log("id_layer is already created\n");
 		++ivilayer->ref_count;
@@ -1831,6 +1980,8 @@ ivi_layout_layer_create_with_dimension(uint32_t id_layer,
 	wl_list_init(&ivilayer->order.link);
 
 	wl_list_insert(&layout->layer_list, &ivilayer->link);
+	wl_list_insert(id_bucket(layout->layer_ids, id_layer),
+		       &ivilayer->id_link);
 
 	wl_signal_emit(&layout->layer_notification.created, ivilayer);
 
@@ -1882,10 +2033,12 @@ ivi_layout_layer_destroy(struct ivi_layout_layer *ivilayer)
 	wl_list_remove(&ivilayer->pending.link);
 	wl_list_remove(&ivilayer->order.link);
 	wl_list_remove(&ivilayer->link);
+	wl_list_remove(&ivilayer->id_link);
 
 	remove_orderlayer_from_screen(ivilayer);
 	remove_link_to_surface(ivilayer);
 	ivi_layout_layer_remove_notification(ivilayer);
+	layout->view_list_dirty = 1;
 
 	free(ivilayer);
 }
@@ -1902,6 +2055,7 @@ ivi_layout_layer_set_visibility(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	ivilayer->pending.dirty = 1;
 	prop->visibility = newVisibility;
 
 	if (ivilayer->prop.visibility != newVisibility)
@@ -1912,6 +2066,21 @@ ivi_layout_layer_set_visibility(struct ivi_layout_layer *ivilayer,
 	return IVI_SUCCEEDED;
 }
 
+static int32_t
+ivi_layout_layer_set_cacheable(struct ivi_layout_layer *ivilayer,
+			       bool cacheable)
+{
+	if (ivilayer == NULL) {
+		weston_log("ivi_layout_layer_set_cacheable: invalid argument\n");
+		return IVI_FAILED;
+	}
+
+	ivilayer->pending.prop.cacheable = cacheable;
+	ivilayer->pending.dirty = 1;
+
+	return IVI_SUCCEEDED;
+}
+
 static bool
 ivi_layout_layer_get_visibility(struct ivi_layout_layer *ivilayer)
 {
@@ -1937,6 +2106,7 @@ ivi_layout_layer_set_opacity(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	ivilayer->pending.dirty = 1;
 	prop->opacity = opacity;
 
 	if (ivilayer->prop.opacity != opacity)
@@ -1971,6 +2141,7 @@ ivi_layout_layer_set_source_rectangle(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	ivilayer->pending.dirty = 1;
 	prop->source_x = x;
 	prop->source_y = y;
 	prop->source_width = width;
@@ -1999,6 +2170,7 @@ ivi_layout_layer_set_destination_rectangle(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	ivilayer->pending.dirty = 1;
 	prop->dest_x = x;
 	prop->dest_y = y;
 	prop->dest_width = width;
@@ -2041,6 +2213,7 @@ ivi_layout_layer_set_dimension(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	ivilayer->pending.dirty = 1;
 
 	prop->dest_width  = dest_width;
 	prop->dest_height = dest_height;
@@ -2081,6 +2254,7 @@ ivi_layout_layer_set_position(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	ivilayer->pending.dirty = 1;
 	prop->dest_x = dest_x;
 	prop->dest_y = dest_y;
 
@@ -2104,6 +2278,7 @@ ivi_layout_layer_set_orientation(struct ivi_layout_layer *ivilayer,
 	}
 
 	prop = &ivilayer->pending.prop;
+	ivilayer->pending.dirty = 1;
 	prop->orientation = orientation;
 
 	if (ivilayer->prop.orientation != orientation)
@@ -2175,6 +2350,7 @@ ivi_layout_surface_set_visibility(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = 1;
 	prop->visibility = newVisibility;
 
 	if (ivisurf->prop.visibility != newVisibility)
@@ -2210,6 +2386,7 @@ ivi_layout_surface_set_opacity(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = 1;
 	prop->opacity = opacity;
 
 	if (ivisurf->prop.opacity != opacity)
@@ -2244,6 +2421,7 @@ ivi_layout_surface_set_destination_rectangle(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = 1;
 	prop->start_x = prop->dest_x;
 	prop->start_y = prop->dest_y;
 	prop->dest_x = x;
@@ -2275,6 +2453,7 @@ ivi_layout_surface_set_dimension(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = 1;
 	prop->dest_width  = dest_width;
 	prop->dest_height = dest_height;
 
@@ -2314,6 +2493,7 @@ ivi_layout_surface_set_position(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = 1;
 	prop->dest_x = dest_x;
 	prop->dest_y = dest_y;
 
@@ -2352,6 +2532,7 @@ ivi_layout_surface_set_orientation(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = 1;
 	prop->orientation = orientation;
 
 	if (ivisurf->prop.orientation != orientation)
@@ -2603,6 +2784,7 @@ ivi_layout_surface_set_source_rectangle(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = 1;
 	prop->source_x = x;
 	prop->source_y = y;
 	prop->source_width = width;
@@ -2648,6 +2830,7 @@ ivi_layout_layer_set_transition(struct ivi_layout_layer *ivilayer,
 
 	ivilayer->pending.prop.transition_type = type;
 	ivilayer->pending.prop.transition_duration = duration;
+	ivilayer->pending.dirty = 1;
 
 	return 0;
 }
@@ -2665,6 +2848,7 @@ ivi_layout_layer_set_fade_info(struct ivi_layout_layer* ivilayer,
 	ivilayer->pending.prop.is_fade_in = is_fade_in;
 	ivilayer->pending.prop.start_alpha = start_alpha;
 	ivilayer->pending.prop.end_alpha = end_alpha;
+	ivilayer->pending.dirty = 1;
 
 	return 0;
 }
@@ -2681,6 +2865,7 @@ ivi_layout_surface_set_transition_duration(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = 1;
 	prop->transition_duration = duration*10;
 	return 0;
 }
@@ -2698,6 +2883,7 @@ ivi_layout_surface_set_transition(struct ivi_layout_surface *ivisurf,
 	}
 
 	prop = &ivisurf->pending.prop;
+	ivisurf->pending.dirty = 1;
 	prop->transition_type = type;
 	prop->transition_duration = duration;
 	return 0;
@@ -2722,6 +2908,146 @@ ivi_layout_surface_dump(struct weston_surface *surface,
 	return result == 0 ? IVI_SUCCEEDED : IVI_FAILED;
 }
 
+/* Write one checked update into the pending properties, with the
+ * notification bits worked out once for all of its members */
+static void
+ivi_layout_surface_apply_update(const struct ivi_layout_surface_update *update)
+{
+	struct ivi_layout_surface *ivisurf = update->ivisurf;
+	struct ivi_layout_surface_properties *prop = &ivisurf->pending.prop;
+	uint32_t touched = 0, changed = 0;
+
+	if (update->mask & IVI_LAYOUT_SURFACE_UPDATE_TRANSITION) {
+		prop->transition_type = update->transition_type;
+		prop->transition_duration = update->transition_duration;
+	}
+
+	if (update->mask & IVI_LAYOUT_SURFACE_UPDATE_VISIBILITY) {
+		prop->visibility = update->visibility;
+		touched |= IVI_NOTIFICATION_VISIBILITY;
+		if (ivisurf->prop.visibility != update->visibility)
+			changed |= IVI_NOTIFICATION_VISIBILITY;
+	}
+
+	if (update->mask & IVI_LAYOUT_SURFACE_UPDATE_OPACITY) {
+		prop->opacity = update->opacity;
+		touched |= IVI_NOTIFICATION_OPACITY;
+		if (ivisurf->prop.opacity != update->opacity)
+			changed |= IVI_NOTIFICATION_OPACITY;
+	}
+
+	if (update->mask & IVI_LAYOUT_SURFACE_UPDATE_DEST_RECT) {
+		prop->start_x = prop->dest_x;
+		prop->start_y = prop->dest_y;
+		prop->start_width = prop->dest_width;
+		prop->start_height = prop->dest_height;
+		prop->dest_x = update->dest_x;
+		prop->dest_y = update->dest_y;
+		prop->dest_width = update->dest_width;
+		prop->dest_height = update->dest_height;
+		touched |= IVI_NOTIFICATION_DEST_RECT;
+		if (ivisurf->prop.dest_x != update->dest_x ||
+		    ivisurf->prop.dest_y != update->dest_y ||
+		    ivisurf->prop.dest_width != update->dest_width ||
+		    ivisurf->prop.dest_height != update->dest_height)
+			changed |= IVI_NOTIFICATION_DEST_RECT;
+	}
+
+	if (update->mask)
+		ivisurf->pending.dirty = 1;
+	ivisurf->event_mask = (ivisurf->event_mask & ~touched) | changed;
+}
+
+static int32_t
+ivi_layout_surface_apply_updates(const struct ivi_layout_surface_update *updates,
+				 int32_t count)
+{
+	const struct ivi_layout_surface_update *update;
+	int32_t i;
+
+	if (count < 0 || (count > 0 && updates == NULL)) {
+		weston_log("%s: invalid argument\n", __func__);
+		return IVI_FAILED;
+	}
+
+	for (i = 0; i < count; i++) {
+		update = &updates[i];
+
+		if (update->ivisurf == NULL ||
+		    ((update->mask & IVI_LAYOUT_SURFACE_UPDATE_OPACITY) &&
+		     (update->opacity < wl_fixed_from_double(0.0) ||
+		      wl_fixed_from_double(1.0) < update->opacity))) {
+			weston_log("%s: invalid update %d\n", __func__, i);
+			return IVI_FAILED;
+		}
+	}
+
+	for (i = 0; i < count; i++)
+		ivi_layout_surface_apply_update(&updates[i]);
+
+	return IVI_SUCCEEDED;
+}
+
+struct surface_dump {
+	void *target;
+	int32_t width, height;
+	surface_dump_done_func callback;
+	void *userdata;
+};
+
+static void
+surface_dump_done(void *data, int status)
+{
+	struct surface_dump *dump = data;
+
+	dump->callback(dump->target, dump->width, dump->height,
+		       status == 0 ? IVI_SUCCEEDED : IVI_FAILED,
+		       dump->userdata);
+	free(dump);
+}
+
+static int32_t
+ivi_layout_surface_dump_async(struct ivi_layout_surface *ivisurf,
+			      void *target, size_t size,
+			      int32_t width, int32_t height,
+			      surface_dump_done_func callback,
+			      void *userdata)
+{
+	struct surface_dump *dump;
+	int32_t w, h;
+
+	if (ivisurf == NULL || ivisurf->surface == NULL ||
+	    target == NULL || callback == NULL) {
+		weston_log("%s: invalid argument\n", __func__);
+		return IVI_FAILED;
+	}
+
+	weston_surface_get_content_size(ivisurf->surface, &w, &h);
+	if (w <= 0 || h <= 0)
+		return IVI_FAILED;
+
+	dump = malloc(sizeof *dump);
+	if (dump == NULL) {
+		weston_log("fails to allocate memory\n");
+		return IVI_FAILED;
+	}
+
+	dump->target = target;
+	dump->width = width;
+	dump->height = height;
+	dump->callback = callback;
+	dump->userdata = userdata;
+
+	if (weston_surface_copy_content_async(ivisurf->surface, target, size,
+					      0, 0, w, h, width, height,
+					      surface_dump_done, dump) < 0) {
+		free(dump);
+		return IVI_FAILED;
+	}
+
+	return IVI_SUCCEEDED;
+}
+
 /**
  * methods of interaction between ivi-shell with ivi-layout
  */
@@ -2781,7 +3107,7 @@ ivi_layout_surface_create(struct weston_surface *wl_surface,
 		return NULL;
 	}
 
-	ivisurf = get_surface(&layout->surface_list, id_surface);
+	ivisurf = get_surface(layout, id_surface);
 	if (ivisurf != NULL) {
 		if (ivisurf->surface != NULL) {
 			weston_log("id_surface(%d) is already created\n", id_surface);
@@ -2824,6 +3150,8 @@ ivi_layout_surface_create(struct weston_surface *wl_surface,
 	wl_list_init(&ivisurf->order.layer_list);
 
 	wl_list_insert(&layout->surface_list, &ivisurf->link);
+	wl_list_insert(id_bucket(layout->surface_ids, id_surface),
+		       &ivisurf->id_link);
 
 	wl_signal_emit(&layout->surface_notification.created, ivisurf);
 
@@ -2834,6 +3162,7 @@ void
 ivi_layout_init_with_compositor(struct weston_compositor *ec)
 {
 	struct ivi_layout *layout = get_instance();
+	int i;
 
 	layout->compositor = ec;
 
@@ -2841,6 +3170,12 @@ ivi_layout_init_with_compositor(struct weston_compositor *ec)
 	wl_list_init(&layout->layer_list);
 	wl_list_init(&layout->screen_list);
 
+	for (i = 0; i < IVI_LAYOUT_ID_BUCKETS; i++) {
+		wl_list_init(&layout->surface_ids[i]);
+		wl_list_init(&layout->layer_ids[i]);
+		wl_list_init(&layout->screen_ids[i]);
+	}
+
 	wl_signal_init(&layout->layer_notification.created);
 	wl_signal_init(&layout->layer_notification.removed);
 
@@ -2848,8 +3183,13 @@ ivi_layout_init_with_compositor(struct weston_compositor *ec)
 	wl_signal_init(&layout->surface_notification.removed);
 	wl_signal_init(&layout->surface_notification.configure_changed);
 
+	wl_signal_init(&layout->commit_notification.committed);
+	wl_array_init(&layout->commit_notification.surface_changes);
+	wl_array_init(&layout->commit_notification.layer_changes);
+
 	/* Add layout_layer at the last of weston_compositor.layer_list */
 	weston_layer_init(&layout->layout_layer, ec->layer_list.prev);
+	layout->view_list_dirty = 1;
 
 	create_screen(ec);
 
@@ -2970,7 +3310,28 @@ static struct ivi_controller_interface ivi_controller_interface = {
 	/**
 	 * screen controller interfaces part2
 	 */
-	.get_id_of_screen	= ivi_layout_get_id_of_screen
+	.get_id_of_screen	= ivi_layout_get_id_of_screen,
+
+	/**
+	 * notification once per commit
+	 */
+	.add_notification_commit	= ivi_layout_add_notification_commit,
+	.remove_notification_commit	= ivi_layout_remove_notification_commit,
+
+	/**
+	 * surface content dumping without waiting for the GPU
+	 */
+	.surface_dump_async		= ivi_layout_surface_dump_async,
+
+	/**
+	 * setting properties of many surfaces at once
+	 */
+	.surface_apply_updates		= ivi_layout_surface_apply_updates,
+
+	/**
+	 * offscreen caching of static layers
+	 */
+	.layer_set_cacheable		= ivi_layout_layer_set_cacheable
 };
 
 int
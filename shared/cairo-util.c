@@ -49,13 +49,37 @@ surface_flush_device(cairo_surface_t *surface)
 		cairo_device_flush(device);
 }
 
+/* The blur keeps two 64 bit words per pixel, each holding two of the
+ * colour channels 32 bits apart.  A channel times the whole kernel
+ * stays below 2^32, so a single multiply-accumulate updates two
+ * channels at once.  The loops run over contiguous arrays without
+ * per-tap bounds checks, so the compiler can vectorize them. */
+static inline uint64_t
+blur_unpack(uint32_t p)
+{
+	return (p & 0xff) | (uint64_t) (p & 0xff0000) << 16;
+}
+
+static inline uint64_t
+blur_divide(uint64_t v, uint32_t a)
+{
+	return (v & 0xffffffff) / a | (v >> 32) / a << 32;
+}
+
+static inline uint32_t
+blur_pack(uint64_t v)
+{
+	return (v & 0xff) | (v >> 16 & 0xff0000);
+}
+
 static int
 blur_surface(cairo_surface_t *surface, int margin)
 {
-	int32_t width, height, stride, x, y, z, w;
-	uint8_t *src, *dst;
-	uint32_t *s, *d, a, p;
-	int i, j, k, size, half;
+	int32_t width, height, stride;
+	uint8_t *src;
+	uint32_t *s, a;
+	uint64_t *buf, *plane, *row, *acc;
+	int i, j, k, c, lo, hi, size, half;
 	uint32_t kernel[71];
 	double f;
 
@@ -65,9 +89,10 @@ blur_surface(cairo_surface_t *surface, int margin)
 	stride = cairo_image_surface_get_stride(surface);
 	src = cairo_image_surface_get_data(surface);
 
-	dst = malloc(height * stride);
-	if (dst == NULL)
+	buf = malloc((2 * height + 1) * width * sizeof *buf);
+	if (buf == NULL)
 		return -1;
+	acc = buf + 2 * height * width;
 
 	half = size / 2;
 	a = 0;
@@ -79,60 +104,65 @@ blur_surface(cairo_surface_t *surface, int margin)
 
 	for (i = 0; i < height; i++) {
 		s = (uint32_t *) (src + i * stride);
-		d = (uint32_t *) (dst + i * stride);
 		for (j = 0; j < width; j++) {
-			if (margin < j && j < width - margin) {
-				d[j] = s[j];
-				continue;
-			}
+			buf[i * width + j] = blur_unpack(s[j]);
+			buf[(height + i) * width + j] = blur_unpack(s[j] >> 8);
+		}
+	}
+
+	for (c = 0; c < 2; c++) {
+		plane = buf + c * height * width;
 
-			x = 0;
-			y = 0;
-			z = 0;
-			w = 0;
+		for (i = 0; i < height; i++) {
+			row = plane + i * width;
+			memset(acc, 0, width * sizeof *acc);
 			for (k = 0; k < size; k++) {
-				if (j - half + k < 0 || j - half + k >= width)
-					continue;
-				p = s[j - half + k];
-
-				x += (p >> 24) * kernel[k];
-				y += ((p >> 16) & 0xff) * kernel[k];
-				z += ((p >> 8) & 0xff) * kernel[k];
-				w += (p & 0xff) * kernel[k];
+				lo = k < half ? half - k : 0;
+				hi = k > half ? width + half - k : width;
+				/* Only the columns outside the margins are
+				 * blurred, the others are kept as is. */
+				for (j = lo; j < hi && j <= margin; j++)
+					acc[j] += row[j - half + k] * kernel[k];
+				if (lo < width - margin)
+					lo = width - margin;
+				if (lo <= margin)
+					lo = margin + 1;
+				for (j = lo; j < hi; j++)
+					acc[j] += row[j - half + k] * kernel[k];
 			}
-			d[j] = (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
+			for (j = 0; j < width; j++)
+				if (j <= margin || j >= width - margin)
+					row[j] = blur_divide(acc[j], a);
 		}
 	}
 
 	for (i = 0; i < height; i++) {
-		s = (uint32_t *) (dst + i * stride);
-		d = (uint32_t *) (src + i * stride);
-		for (j = 0; j < width; j++) {
+		s = (uint32_t *) (src + i * stride);
+		memset(s, 0, width * sizeof *s);
+		lo = i < half ? half - i : 0;
+		hi = i + half < height ? size : height + half - i;
+
+		for (c = 0; c < 2; c++) {
+			plane = buf + c * height * width;
 			if (margin <= i && i < height - margin) {
-				d[j] = s[j];
+				row = plane + i * width;
+				for (j = 0; j < width; j++)
+					s[j] |= blur_pack(row[j]) << (c * 8);
 				continue;
 			}
 
-			x = 0;
-			y = 0;
-			z = 0;
-			w = 0;
-			for (k = 0; k < size; k++) {
-				if (i - half + k < 0 || i - half + k >= height)
-					continue;
-				s = (uint32_t *) (dst + (i - half + k) * stride);
-				p = s[j];
-
-				x += (p >> 24) * kernel[k];
-				y += ((p >> 16) & 0xff) * kernel[k];
-				z += ((p >> 8) & 0xff) * kernel[k];
-				w += (p & 0xff) * kernel[k];
+			memset(acc, 0, width * sizeof *acc);
+			for (k = lo; k < hi; k++) {
+				row = plane + (i - half + k) * width;
+				for (j = 0; j < width; j++)
+					acc[j] += row[j] * kernel[k];
 			}
-			d[j] = (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
+			for (j = 0; j < width; j++)
+				s[j] |= blur_pack(blur_divide(acc[j], a)) << (c * 8);
 		}
 	}
 
-	free(dst);
+	free(buf);
 	cairo_surface_mark_dirty(surface);
 
 	return 0;
@@ -340,14 +370,24 @@ rounded_rect(cairo_t *cr, int x0, int y0, int x1, int y1, int radius)
 	cairo_close_path(cr);
 }
 
+static const cairo_user_data_key_t pixman_image_key;
+
+static void
+pixman_image_user_data_destroy(void *data)
+{
+	pixman_image_unref(data);
+}
+
 cairo_surface_t *
-load_cairo_surface(const char *filename)
+load_cairo_surface_scaled(const char *filename, int target_width,
+			  int target_height)
 {
 	pixman_image_t *image;
+	cairo_surface_t *surface;
 	int width, height, stride;
 	void *data;
 
-	image = load_image(filename);
+	image = load_image_scaled(filename, target_width, target_height);
 	if (image == NULL) {
 		return NULL;
 	}
@@ -357,8 +397,23 @@ load_cairo_surface(const char *filename)
 	height = pixman_image_get_height(image);
 	stride = pixman_image_get_stride(image);
 
-	return cairo_image_surface_create_for_data(data, CAIRO_FORMAT_ARGB32,
-						   width, height, stride);
+	surface = cairo_image_surface_create_for_data(data,
+						      CAIRO_FORMAT_ARGB32,
+						      width, height, stride);
+
+	/* keep the pixels alive for as long as the surface uses them */
+	if (cairo_surface_set_user_data(surface, &pixman_image_key, image,
+					pixman_image_user_data_destroy) !=
+	    CAIRO_STATUS_SUCCESS)
+		pixman_image_unref(image);
+
+	return surface;
+}
+
+cairo_surface_t *
+load_cairo_surface(const char *filename)
+{
+	return load_cairo_surface_scaled(filename, 0, 0);
 }
 
 void
@@ -377,6 +432,62 @@ theme_set_background_source(struct theme *t, cairo_t *cr, uint32_t flags)
 	}
 }
 
+/* The blurred shadow tile only depends on the frame radius, so it is
+ * shared by every theme in the process instead of being blurred again
+ * for each one.  The cache holds no reference; the user data destroy
+ * hook forgets the tile once the last theme using it is gone. */
+static struct {
+	cairo_surface_t *surface;
+	int radius;
+} shadow_cache;
+
+static const cairo_user_data_key_t shadow_cache_key;
+
+static void
+shadow_cache_forget(void *data)
+{
+	shadow_cache.surface = NULL;
+}
+
+static cairo_surface_t *
+theme_get_shadow(int radius)
+{
+	cairo_surface_t *shadow;
+	cairo_t *cr;
+
+	if (shadow_cache.surface && shadow_cache.radius == radius)
+		return cairo_surface_reference(shadow_cache.surface);
+
+	shadow = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 128, 128);
+	cr = cairo_create(shadow);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	cairo_set_source_rgba(cr, 0, 0, 0, 1);
+	rounded_rect(cr, 32, 32, 96, 96, radius);
+	cairo_fill(cr);
+	if (cairo_status(cr) != CAIRO_STATUS_SUCCESS)
+		goto err;
+	cairo_destroy(cr);
+	cr = NULL;
+
+	if (blur_surface(shadow, 64) == -1)
+		goto err;
+
+	if (cairo_surface_set_user_data(shadow, &shadow_cache_key, NULL,
+					shadow_cache_forget) ==
+	    CAIRO_STATUS_SUCCESS) {
+		shadow_cache.surface = shadow;
+		shadow_cache.radius = radius;
+	}
+
+	return shadow;
+
+ err:
+	if (cr)
+		cairo_destroy(cr);
+	cairo_surface_destroy(shadow);
+	return NULL;
+}
+
 struct theme *
 theme_create(void)
 {
@@ -391,17 +502,11 @@ theme_create(void)
 	t->width = 6;
 	t->titlebar_height = 27;
 	t->frame_radius = 3;
-	t->shadow = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 128, 128);
-	cr = cairo_create(t->shadow);
-	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
-	cairo_set_source_rgba(cr, 0, 0, 0, 1);
-	rounded_rect(cr, 32, 32, 96, 96, t->frame_radius);
-	cairo_fill(cr);
-	if (cairo_status (cr) != CAIRO_STATUS_SUCCESS)
-		goto err_shadow;
-	cairo_destroy(cr);
-	if (blur_surface(t->shadow, 64) == -1)
-		goto err_shadow;
+	t->shadow = theme_get_shadow(t->frame_radius);
+	if (t->shadow == NULL) {
+		free(t);
+		return NULL;
+	}
 
 	t->active_frame =
 		cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 128, 128);
@@ -436,7 +541,6 @@ theme_create(void)
 	cairo_surface_destroy(t->inactive_frame);
  err_active_frame:
 	cairo_surface_destroy(t->active_frame);
- err_shadow:
 	cairo_surface_destroy(t->shadow);
 	free(t);
 	return NULL;
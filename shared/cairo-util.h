@@ -48,6 +48,10 @@ rounded_rect(cairo_t *cr, int x0, int y0, int x1, int y1, int radius);
 cairo_surface_t *
 load_cairo_surface(const char *filename);
 
+cairo_surface_t *
+load_cairo_surface_scaled(const char *filename, int target_width,
+			  int target_height);
+
 struct theme {
 	cairo_surface_t *active_frame;
 	cairo_surface_t *inactive_frame;
@@ -230,4 +234,10 @@ frame_double_touch_up(struct frame *frame, void *data, int32_t id);
 void
 frame_repaint(struct frame *frame, cairo_t *cr);
 
+/* Like frame_repaint(), for targets that keep their previous contents:
+ * when only the title or the buttons changed, only the titlebar is
+ * redrawn. */
+void
+frame_repaint_damage(struct frame *frame, cairo_t *cr);
+
 #endif
@@ -32,6 +32,7 @@
 #include <ctype.h>
 #include <limits.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -40,24 +41,81 @@
 #include <wayland-util.h>
 #include "config-parser.h"
 #include "helpers.h"
+#include "zalloc.h"
+
+/* Values already converted by the weston_config_section_get_*()
+ * calls, so repeated lookups, e.g. on every output hotplug, do not
+ * parse them again. */
+enum config_value_type {
+	CONFIG_VALUE_INT = 1 << 0,
+	CONFIG_VALUE_UINT = 1 << 1,
+	CONFIG_VALUE_DOUBLE = 1 << 2,
+	CONFIG_VALUE_BOOL = 1 << 3,
+};
 
 struct weston_config_entry {
 	char *key;
 	char *value;
 	struct wl_list link;
+	uint32_t hash;
+	struct weston_config_entry *hash_next;
+
+	uint32_t parsed; /* enum config_value_type */
+	uint32_t invalid; /* enum config_value_type */
+	int32_t int_value;
+	uint32_t uint_value;
+	double double_value;
+	int bool_value;
 };
 
 struct weston_config_section {
 	char *name;
 	struct wl_list entry_list;
 	struct wl_list link;
+	uint32_t hash;
+	struct weston_config_section *hash_next;
+
+	/* Entries by key, duplicates in file order */
+	struct weston_config_entry **entry_index;
+	uint32_t entry_index_size; /* power of two */
+	uint32_t entry_count;
 };
 
 struct weston_config {
 	struct wl_list section_list;
 	char path[PATH_MAX];
+
+	/* Sections by name, in file order within a chain */
+	struct weston_config_section **section_index;
+	uint32_t section_index_size; /* power of two */
+	uint32_t section_count;
 };
 
+/* FNV-1a */
+static uint32_t
+config_hash(const char *s)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*s) {
+		hash ^= (unsigned char) *s++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static uint32_t
+config_index_size(uint32_t count)
+{
+	uint32_t size = 8;
+
+	while (size < count * 2)
+		size *= 2;
+
+	return size;
+}
+
 static int
 open_config_file(struct weston_config *c, const char *name)
 {
@@ -120,11 +178,22 @@ config_section_get_entry(struct weston_config_section *section,
 			 const char *key)
 {
 	struct weston_config_entry *e;
+	uint32_t hash;
 
 	if (section == NULL)
 		return NULL;
-	wl_list_for_each(e, &section->entry_list, link)
-		if (strcmp(e->key, key) == 0)
+
+	if (section->entry_index == NULL) {
+		wl_list_for_each(e, &section->entry_list, link)
+			if (strcmp(e->key, key) == 0)
+				return e;
+		return NULL;
+	}
+
+	hash = config_hash(key);
+	for (e = section->entry_index[hash & (section->entry_index_size - 1)];
+	     e; e = e->hash_next)
+		if (e->hash == hash && strcmp(e->key, key) == 0)
 			return e;
 
 	return NULL;
@@ -137,11 +206,16 @@ weston_config_get_section(struct weston_config *config, const char *section,
 {
 	struct weston_config_section *s;
 	struct weston_config_entry *e;
+	uint32_t hash;
 
 	if (config == NULL)
 		return NULL;
-	wl_list_for_each(s, &config->section_list, link) {
-		if (strcmp(s->name, section) != 0)
+
+	hash = config_hash(section);
+	for (s = config->section_index[hash &
+				       (config->section_index_size - 1)];
+	     s; s = s->hash_next) {
+		if (s->hash != hash || strcmp(s->name, section) != 0)
 			continue;
 		if (key == NULL)
 			return s;
@@ -169,13 +243,21 @@ weston_config_section_get_int(struct weston_config_section *section,
 		return -1;
 	}
 
-	*value = strtol(entry->value, &end, 0);
-	if (*end != '\0') {
+	if (!(entry->parsed & CONFIG_VALUE_INT)) {
+		entry->int_value = strtol(entry->value, &end, 0);
+		if (*end != '\0')
+			entry->invalid |= CONFIG_VALUE_INT;
+		entry->parsed |= CONFIG_VALUE_INT;
+	}
+
+	if (entry->invalid & CONFIG_VALUE_INT) {
 		*value = default_value;
 		errno = EINVAL;
 		return -1;
 	}
 
+	*value = entry->int_value;
+
 	return 0;
 }
 
@@ -195,13 +277,21 @@ weston_config_section_get_uint(struct weston_config_section *section,
 		return -1;
 	}
 
-	*value = strtoul(entry->value, &end, 0);
-	if (*end != '\0') {
+	if (!(entry->parsed & CONFIG_VALUE_UINT)) {
+		entry->uint_value = strtoul(entry->value, &end, 0);
+		if (*end != '\0')
+			entry->invalid |= CONFIG_VALUE_UINT;
+		entry->parsed |= CONFIG_VALUE_UINT;
+	}
+
+	if (entry->invalid & CONFIG_VALUE_UINT) {
 		*value = default_value;
 		errno = EINVAL;
 		return -1;
 	}
 
+	*value = entry->uint_value;
+
 	return 0;
 }
 
@@ -221,13 +311,21 @@ weston_config_section_get_double(struct weston_config_section *section,
 		return -1;
 	}
 
-	*value = strtod(entry->value, &end);
-	if (*end != '\0') {
+	if (!(entry->parsed & CONFIG_VALUE_DOUBLE)) {
+		entry->double_value = strtod(entry->value, &end);
+		if (*end != '\0')
+			entry->invalid |= CONFIG_VALUE_DOUBLE;
+		entry->parsed |= CONFIG_VALUE_DOUBLE;
+	}
+
+	if (entry->invalid & CONFIG_VALUE_DOUBLE) {
 		*value = default_value;
 		errno = EINVAL;
 		return -1;
 	}
 
+	*value = entry->double_value;
+
 	return 0;
 }
 
@@ -269,16 +367,24 @@ weston_config_section_get_bool(struct weston_config_section *section,
 		return -1;
 	}
 
-	if (strcmp(entry->value, "false") == 0)
-		*value = 0;
-	else if (strcmp(entry->value, "true") == 0)
-		*value = 1;
-	else {
+	if (!(entry->parsed & CONFIG_VALUE_BOOL)) {
+		if (strcmp(entry->value, "false") == 0)
+			entry->bool_value = 0;
+		else if (strcmp(entry->value, "true") == 0)
+			entry->bool_value = 1;
+		else
+			entry->invalid |= CONFIG_VALUE_BOOL;
+		entry->parsed |= CONFIG_VALUE_BOOL;
+	}
+
+	if (entry->invalid & CONFIG_VALUE_BOOL) {
 		*value = default_value;
 		errno = EINVAL;
 		return -1;
 	}
 
+	*value = entry->bool_value;
+
 	return 0;
 }
 
@@ -311,10 +417,12 @@ config_add_section(struct weston_config *config, const char *name)
 {
 	struct weston_config_section *section;
 
-	section = malloc(sizeof *section);
+	section = zalloc(sizeof *section);
 	section->name = strdup(name);
+	section->hash = config_hash(name);
 	wl_list_init(&section->entry_list);
 	wl_list_insert(config->section_list.prev, &section->link);
+	config->section_count++;
 
 	return section;
 }
@@ -325,25 +433,90 @@ section_add_entry(struct weston_config_section *section,
 {
 	struct weston_config_entry *entry;
 
-	entry = malloc(sizeof *entry);
+	entry = zalloc(sizeof *entry);
 	entry->key = strdup(key);
 	entry->value = strdup(value);
+	entry->hash = config_hash(key);
 	wl_list_insert(section->entry_list.prev, &entry->link);
+	section->entry_count++;
 
 	return entry;
 }
 
+/* Hash the sections and their entries once everything is parsed, the
+ * sizes are known then. Chains keep file order, so lookups still find
+ * the first matching section or key. Without memory for an index, a
+ * section falls back to walking its entries. */
+static int
+config_build_index(struct weston_config *config)
+{
+	struct weston_config_section *section, **s_tail;
+	struct weston_config_entry *entry, **e_tail;
+	uint32_t size;
+
+	size = config_index_size(config->section_count);
+	config->section_index = calloc(size, sizeof *config->section_index);
+	if (!config->section_index)
+		return -1;
+	config->section_index_size = size;
+
+	wl_list_for_each(section, &config->section_list, link) {
+		s_tail = &config->section_index[section->hash & (size - 1)];
+		while (*s_tail)
+			s_tail = &(*s_tail)->hash_next;
+		*s_tail = section;
+
+		section->entry_index_size =
+			config_index_size(section->entry_count);
+		section->entry_index = calloc(section->entry_index_size,
+					      sizeof *section->entry_index);
+		if (!section->entry_index)
+			continue;
+
+		wl_list_for_each(entry, &section->entry_list, link) {
+			e_tail = &section->entry_index[entry->hash &
+					(section->entry_index_size - 1)];
+			while (*e_tail)
+				e_tail = &(*e_tail)->hash_next;
+			*e_tail = entry;
+		}
+	}
+
+	return 0;
+}
+
+/* Like fgets(), for the mapped file */
+static int
+config_next_line(const char **pos, const char *end, char *line, size_t size)
+{
+	const char *p = *pos;
+	size_t n = 0;
+
+	if (p >= end)
+		return 0;
+
+	while (p < end && n < size - 1) {
+		line[n++] = *p;
+		if (*p++ == '\n')
+			break;
+	}
+	line[n] = '\0';
+	*pos = p;
+
+	return 1;
+}
+
 struct weston_config *
 weston_config_parse(const char *name)
 {
-	FILE *fp;
 	char line[512], *p;
+	const char *data = NULL, *pos, *end;
 	struct stat filestat;
 	struct weston_config *config;
 	struct weston_config_section *section = NULL;
 	int i, fd;
 
-	config = malloc(sizeof *config);
+	config = zalloc(sizeof *config);
 	if (config == NULL)
 		return NULL;
 
@@ -362,13 +535,20 @@ weston_config_parse(const char *name)
 		return NULL;
 	}
 
-	fp = fdopen(fd, "r");
-	if (fp == NULL) {
-		free(config);
-		return NULL;
+	if (filestat.st_size > 0) {
+		data = mmap(NULL, filestat.st_size, PROT_READ, MAP_PRIVATE,
+			    fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			free(config);
+			return NULL;
+		}
 	}
+	close(fd);
 
-	while (fgets(line, sizeof line, fp)) {
+	pos = data;
+	end = data + filestat.st_size;
+	while (config_next_line(&pos, end, line, sizeof line)) {
 		switch (line[0]) {
 		case '#':
 		case '\n':
@@ -378,9 +558,7 @@ weston_config_parse(const char *name)
 			if (!p || p[1] != '\n') {
 				fprintf(stderr, "malformed "
 					"section header: %s\n", line);
-				fclose(fp);
-				weston_config_destroy(config);
-				return NULL;
+				goto err;
 			}
 			p[0] = '\0';
 			section = config_add_section(config, &line[1]);
@@ -390,9 +568,7 @@ weston_config_parse(const char *name)
 			if (!p || p == line || !section) {
 				fprintf(stderr, "malformed "
 					"config line: %s\n", line);
-				fclose(fp);
-				weston_config_destroy(config);
-				return NULL;
+				goto err;
 			}
 
 			p[0] = '\0';
@@ -409,9 +585,21 @@ weston_config_parse(const char *name)
 		}
 	}
 
-	fclose(fp);
+	if (data)
+		munmap((void *) data, filestat.st_size);
+
+	if (config_build_index(config) < 0) {
+		weston_config_destroy(config);
+		return NULL;
+	}
 
 	return config;
+
+err:
+	if (data)
+		munmap((void *) data, filestat.st_size);
+	weston_config_destroy(config);
+	return NULL;
 }
 
 const char *
@@ -458,9 +646,11 @@ weston_config_destroy(struct weston_config *config)
 			free(e->value);
 			free(e);
 		}
+		free(s->entry_index);
 		free(s->name);
 		free(s);
 	}
 
+	free(config->section_index);
 	free(config);
 }
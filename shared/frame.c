@@ -98,12 +98,27 @@ struct frame {
 	int geometry_dirty;
 
 	uint32_t status;
+	int titlebar_damage;
 
 	struct wl_list buttons;
 	struct wl_list pointers;
 	struct wl_list touches;
 };
 
+/* Mark the frame for repainting.  titlebar_only says the change is
+ * confined to the titlebar strip, which lets frame_repaint_damage()
+ * skip redrawing the rest of the decoration. */
+static void
+frame_damage(struct frame *frame, int titlebar_only)
+{
+	if (frame->status & FRAME_STATUS_REPAINT)
+		frame->titlebar_damage &= titlebar_only;
+	else
+		frame->titlebar_damage = titlebar_only;
+
+	frame->status |= FRAME_STATUS_REPAINT;
+}
+
 static struct frame_button *
 frame_button_create(struct frame *frame, const char *icon,
 		    enum frame_status status_effect,
@@ -141,7 +156,7 @@ static void
 frame_button_enter(struct frame_button *button)
 {
 	if (!button->hover_count)
-		button->frame->status |= FRAME_STATUS_REPAINT;
+		frame_damage(button->frame, 1);
 	button->hover_count++;
 }
 
@@ -150,14 +165,14 @@ frame_button_leave(struct frame_button *button, struct frame_pointer *pointer)
 {
 	button->hover_count--;
 	if (!button->hover_count)
-		button->frame->status |= FRAME_STATUS_REPAINT;
+		frame_damage(button->frame, 1);
 }
 
 static void
 frame_button_press(struct frame_button *button)
 {
 	if (!button->press_count)
-		button->frame->status |= FRAME_STATUS_REPAINT;
+		frame_damage(button->frame, 1);
 	button->press_count++;
 
 	if (button->flags & FRAME_BUTTON_CLICK_DOWN)
@@ -171,7 +186,7 @@ frame_button_release(struct frame_button *button)
 	if (button->press_count)
 		return;
 
-	button->frame->status |= FRAME_STATUS_REPAINT;
+	frame_damage(button->frame, 1);
 
 	if (!(button->flags & FRAME_BUTTON_CLICK_DOWN))
 		button->frame->status |= button->status_effect;
@@ -182,7 +197,7 @@ frame_button_cancel(struct frame_button *button)
 {
 	button->press_count--;
 	if (!button->press_count)
-		button->frame->status |= FRAME_STATUS_REPAINT;
+		frame_damage(button->frame, 1);
 }
 
 static void
@@ -379,39 +394,54 @@ frame_set_title(struct frame *frame, const char *title)
 {
 	char *dup = NULL;
 
+	if (title && frame->title && strcmp(title, frame->title) == 0)
+		return 0;
+
 	if (title) {
 		dup = strdup(title);
 		if (!dup)
 			return -1;
 	}
 
+	/* Adding or removing the title changes the titlebar height;
+	 * changing the text only needs the titlebar redrawn. */
+	if (!title != !frame->title) {
+		frame->geometry_dirty = 1;
+		frame_damage(frame, 0);
+	} else {
+		frame_damage(frame, 1);
+	}
+
 	free(frame->title);
 	frame->title = dup;
 
-	frame->geometry_dirty = 1;
-	frame->status |= FRAME_STATUS_REPAINT;
-
 	return 0;
 }
 
 void
 frame_set_flag(struct frame *frame, enum frame_flag flag)
 {
+	if ((frame->flags & flag) == flag)
+		return;
+
 	if (flag & FRAME_FLAG_MAXIMIZED && !(frame->flags & FRAME_FLAG_MAXIMIZED))
 		frame->geometry_dirty = 1;
 
 	frame->flags |= flag;
-	frame->status |= FRAME_STATUS_REPAINT;
+	frame_damage(frame, 0);
 }
 
 void
 frame_unset_flag(struct frame *frame, enum frame_flag flag)
 {
+	if (!(frame->flags & flag))
+		return;
+
 	if (flag & FRAME_FLAG_MAXIMIZED && frame->flags & FRAME_FLAG_MAXIMIZED)
 		frame->geometry_dirty = 1;
 
 	frame->flags &= ~flag;
-	frame->status |= FRAME_STATUS_REPAINT;
+	frame_damage(frame, 0);
 }
 
 void
@@ -421,7 +451,7 @@ frame_resize(struct frame *frame, int32_t width, int32_t height)
 	frame->height = height;
 
 	frame->geometry_dirty = 1;
-	frame->status |= FRAME_STATUS_REPAINT;
+	frame_damage(frame, 0);
 }
 
 void
@@ -944,3 +974,33 @@ frame_repaint(struct frame *frame, cairo_t *cr)
 
 	frame_status_clear(frame, FRAME_STATUS_REPAINT);
 }
+
+void
+frame_repaint_damage(struct frame *frame, cairo_t *cr)
+{
+	struct theme *t = frame->theme;
+	int margin, titlebar_height;
+
+	if (!(frame->status & FRAME_STATUS_REPAINT) ||
+	    !frame->titlebar_damage || frame->geometry_dirty) {
+		frame_repaint(frame, cr);
+		return;
+	}
+
+	if (frame->flags & FRAME_FLAG_MAXIMIZED)
+		margin = 0;
+	else
+		margin = t->margin;
+
+	if (frame->title || !wl_list_empty(&frame->buttons))
+		titlebar_height = t->titlebar_height;
+	else
+		titlebar_height = t->width;
+
+	cairo_save(cr);
+	cairo_rectangle(cr, margin, margin,
+			frame->width - margin * 2, titlebar_height);
+	cairo_clip(cr);
+	frame_repaint(frame, cr);
+	cairo_restore(cr);
+}
@@ -47,6 +47,7 @@ stride_for_width(int width)
 	return width * 4;
 }
 
+#ifndef JCS_EXTENSIONS
 static void
 swizzle_row(JSAMPLE *row, JDIMENSION width)
 {
@@ -61,6 +62,7 @@ swizzle_row(JSAMPLE *row, JDIMENSION width)
 		d--;
 	}
 }
+#endif
 
 static void
 error_exit(j_common_ptr cinfo)
@@ -74,8 +76,29 @@ pixman_image_destroy_func(pixman_image_t *image, void *data)
 	free(data);
 }
 
+/* Let the decoder scale the image down by 1/2, 1/4 or 1/8 in the DCT
+ * domain, picking the smallest output that still covers width x height.
+ * This is much cheaper than decoding at full size and scaling later. */
+static void
+jpeg_choose_scale(struct jpeg_decompress_struct *cinfo, int width, int height)
+{
+	unsigned int denom;
+
+	if (width <= 0 || height <= 0)
+		return;
+
+	for (denom = 8; denom > 1; denom /= 2) {
+		if ((cinfo->image_width + denom - 1) / denom >= (unsigned) width &&
+		    (cinfo->image_height + denom - 1) / denom >= (unsigned) height)
+			break;
+	}
+
+	cinfo->scale_num = 1;
+	cinfo->scale_denom = denom;
+}
+
 static pixman_image_t *
-load_jpeg(FILE *fp)
+load_jpeg(FILE *fp, int width, int height)
 {
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
@@ -97,7 +120,18 @@ load_jpeg(FILE *fp)
 
 	jpeg_read_header(&cinfo, TRUE);
 
+	jpeg_choose_scale(&cinfo, width, height);
+
+#ifdef JCS_EXTENSIONS
+	/* libjpeg-turbo can write a8r8g8b8 pixels directly */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	cinfo.out_color_space = JCS_EXT_ARGB;
+#else
+	cinfo.out_color_space = JCS_EXT_BGRA;
+#endif
+#else
 	cinfo.out_color_space = JCS_RGB;
+#endif
 	jpeg_start_decompress(&cinfo);
 
 	stride = cinfo.output_width * 4;
@@ -113,8 +147,10 @@ load_jpeg(FILE *fp)
 			rows[i] = data + (first + i) * stride;
 
 		jpeg_read_scanlines(&cinfo, rows, ARRAY_LENGTH(rows));
+#ifndef JCS_EXTENSIONS
 		for (i = 0; first + i < cinfo.output_scanline; i++)
 			swizzle_row(rows[i], cinfo.output_width);
+#endif
 	}
 
 	jpeg_finish_decompress(&cinfo);
@@ -140,6 +176,16 @@ multiply_alpha(int alpha, int color)
     return ((temp + (temp >> 8)) >> 8);
 }
 
+/* Same as multiply_alpha(), for the two channels held in bits 0-7 and
+ * 16-23 of 'pair' at once. */
+static inline uint32_t
+multiply_alpha_pair(uint32_t alpha, uint32_t pair)
+{
+	uint32_t temp = (alpha * pair) + 0x00800080;
+
+	return ((temp + ((temp >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+}
+
 static void
 premultiply_data(png_structp   png,
 		 png_row_infop row_info,
@@ -149,25 +195,21 @@ premultiply_data(png_structp   png,
     png_bytep p;
 
     for (i = 0, p = data; i < row_info->rowbytes; i += 4, p += 4) {
-	png_byte  alpha = p[3];
-	uint32_t w;
+	uint32_t alpha = p[3];
+	uint32_t rb = (p[0] << 16) | p[2];
+	uint32_t g = p[1];
 
 	if (alpha == 0) {
-		w = 0;
-	} else {
-		png_byte red   = p[0];
-		png_byte green = p[1];
-		png_byte blue  = p[2];
-
-		if (alpha != 0xff) {
-			red   = multiply_alpha(alpha, red);
-			green = multiply_alpha(alpha, green);
-			blue  = multiply_alpha(alpha, blue);
-		}
-		w = (alpha << 24) | (red << 16) | (green << 8) | (blue << 0);
+		* (uint32_t *) p = 0;
+		continue;
+	}
+
+	if (alpha != 0xff) {
+		rb = multiply_alpha_pair(alpha, rb);
+		g = multiply_alpha(alpha, g);
 	}
 
-	* (uint32_t *) p = w;
+	* (uint32_t *) p = (alpha << 24) | rb | (g << 8);
     }
 }
 
@@ -187,7 +229,7 @@ png_error_callback(png_structp png, png_const_charp error_msg)
 }
 
 static pixman_image_t *
-load_png(FILE *fp)
+load_png(FILE *fp, int target_width, int target_height)
 {
 	png_struct *png;
 	png_info *info;
@@ -289,7 +331,7 @@ load_png(FILE *fp)
 #ifdef HAVE_WEBP
 
 static pixman_image_t *
-load_webp(FILE *fp)
+load_webp(FILE *fp, int target_width, int target_height)
 {
 	WebPDecoderConfig config;
 	uint8_t buffer[16 * 1024];
@@ -358,7 +400,7 @@ load_webp(FILE *fp)
 struct image_loader {
 	unsigned char header[4];
 	int header_size;
-	pixman_image_t *(*load)(FILE *fp);
+	pixman_image_t *(*load)(FILE *fp, int width, int height);
 };
 
 static const struct image_loader loaders[] = {
@@ -370,7 +412,7 @@ static const struct image_loader loaders[] = {
 };
 
 pixman_image_t *
-load_image(const char *filename)
+load_image_scaled(const char *filename, int width, int height)
 {
 	pixman_image_t *image;
 	unsigned char header[4];
@@ -396,7 +438,7 @@ load_image(const char *filename)
 	for (i = 0; i < ARRAY_LENGTH(loaders); i++) {
 		if (memcmp(header, loaders[i].header,
 			   loaders[i].header_size) == 0) {
-			image = loaders[i].load(fp);
+			image = loaders[i].load(fp, width, height);
 			break;
 		}
 	}
@@ -415,3 +457,9 @@ load_image(const char *filename)
 
 	return image;
 }
+
+pixman_image_t *
+load_image(const char *filename)
+{
+	return load_image_scaled(filename, 0, 0);
+}
@@ -31,4 +31,10 @@
 pixman_image_t *
 load_image(const char *filename);
 
+/* Like load_image(), but the decoder may produce a smaller image, as
+ * long as it is at least width x height, when this is cheaper than
+ * decoding at full size.  Pass 0 to always decode at full size. */
+pixman_image_t *
+load_image_scaled(const char *filename, int width, int height);
+
 #endif
@@ -31,6 +31,10 @@
 #include <stdlib.h>
 #include <math.h>
 
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#endif
+
 #ifdef IN_WESTON
 #include <wayland-server.h>
 #else
@@ -48,6 +52,17 @@
  *  3  7 11 15
  */
 
+/* Types of the matrices that only scale and translate:
+ *  sx  0  0 tx
+ *   0 sy  0 ty
+ *   0  0 sz tz
+ *   0  0  0  1
+ * The fast paths below rely on the type being kept accurate, so a
+ * matrix filled in by hand has to be marked WESTON_MATRIX_TRANSFORM_OTHER.
+ */
+#define SCALE_TRANSLATE_TYPES (WESTON_MATRIX_TRANSFORM_TRANSLATE | \
+			       WESTON_MATRIX_TRANSFORM_SCALE)
+
 WL_EXPORT void
 weston_matrix_init(struct weston_matrix *matrix)
 {
@@ -64,10 +79,51 @@ WL_EXPORT void
 weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
 {
 	struct weston_matrix tmp;
-	const float *row, *column;
+	const float *column;
+	int i;
+#ifdef __SSE2__
+	__m128 n0, n1, n2, n3, r;
+#else
+	const float *row;
 	div_t d;
-	int i, j;
+	int j;
+#endif
+
+	/* Only the diagonal and the last column of n contribute; the
+	 * zeros would not change the sums, so the results are the same
+	 * as the full product. */
+	if (!(n->type & ~SCALE_TRANSLATE_TYPES)) {
+		for (i = 0; i < 4; i++) {
+			column = m->d + i * 4;
+			tmp.d[i * 4 + 0] = n->d[0] * column[0] +
+					   n->d[12] * column[3];
+			tmp.d[i * 4 + 1] = n->d[5] * column[1] +
+					   n->d[13] * column[3];
+			tmp.d[i * 4 + 2] = n->d[10] * column[2] +
+					   n->d[14] * column[3];
+			tmp.d[i * 4 + 3] = column[3];
+		}
+		tmp.type = m->type | n->type;
+		memcpy(m, &tmp, sizeof tmp);
+		return;
+	}
 
+#ifdef __SSE2__
+	/* Column i of the product is the columns of n weighted by
+	 * column i of m, summed in the same order as below. */
+	n0 = _mm_loadu_ps(n->d + 0);
+	n1 = _mm_loadu_ps(n->d + 4);
+	n2 = _mm_loadu_ps(n->d + 8);
+	n3 = _mm_loadu_ps(n->d + 12);
+	for (i = 0; i < 4; i++) {
+		column = m->d + i * 4;
+		r = _mm_mul_ps(n0, _mm_set1_ps(column[0]));
+		r = _mm_add_ps(r, _mm_mul_ps(n1, _mm_set1_ps(column[1])));
+		r = _mm_add_ps(r, _mm_mul_ps(n2, _mm_set1_ps(column[2])));
+		r = _mm_add_ps(r, _mm_mul_ps(n3, _mm_set1_ps(column[3])));
+		_mm_storeu_ps(tmp.d + i * 4, r);
+	}
+#else
 	for (i = 0; i < 16; i++) {
 		tmp.d[i] = 0;
 		d = div(i, 4);
@@ -76,6 +132,7 @@ weston_matrix_multiply(struct weston_matrix *m, const struct weston_matrix *n)
 		for (j = 0; j < 4; j++)
 			tmp.d[i] += row[j] * column[j * 4];
 	}
+#endif
 	tmp.type = m->type | n->type;
 	memcpy(m, &tmp, sizeof tmp);
 }
@@ -117,6 +174,18 @@ weston_matrix_rotate_xy(struct weston_matrix *matrix, float cos, float sin)
 WL_EXPORT void
 weston_matrix_transform(struct weston_matrix *matrix, struct weston_vector *v)
 {
+#ifdef __SSE2__
+	__m128 t;
+
+	t = _mm_mul_ps(_mm_loadu_ps(matrix->d + 0), _mm_set1_ps(v->f[0]));
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(matrix->d + 4),
+				     _mm_set1_ps(v->f[1])));
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(matrix->d + 8),
+				     _mm_set1_ps(v->f[2])));
+	t = _mm_add_ps(t, _mm_mul_ps(_mm_loadu_ps(matrix->d + 12),
+				     _mm_set1_ps(v->f[3])));
+	_mm_storeu_ps(v->f, t);
+#else
 	int i, j;
 	struct weston_vector t;
 
@@ -127,6 +196,7 @@ weston_matrix_transform(struct weston_matrix *matrix, struct weston_vector *v)
 	}
 
 	*v = t;
+#endif
 }
 
 static inline void
@@ -264,6 +334,31 @@ weston_matrix_invert(struct weston_matrix *inverse,
 	unsigned perm[4];	/* permutation */
 	unsigned c;
 
+	/* Invert the scales and undo the translation directly; the
+	 * singularity test is the one the LU pivots would get. */
+	if (!(matrix->type & ~SCALE_TRANSLATE_TYPES)) {
+		double sx = matrix->d[0], sy = matrix->d[5], sz = matrix->d[10];
+		double tx = matrix->d[12], ty = matrix->d[13], tz = matrix->d[14];
+
+		if (fabs(sx) < 1e-9 || fabs(sy) < 1e-9 || fabs(sz) < 1e-9)
+			return -1;
+
+		sx = 1.0 / sx;
+		sy = 1.0 / sy;
+		sz = 1.0 / sz;
+
+		weston_matrix_init(inverse);
+		inverse->d[0] = sx;
+		inverse->d[5] = sy;
+		inverse->d[10] = sz;
+		inverse->d[12] = -tx * sx;
+		inverse->d[13] = -ty * sy;
+		inverse->d[14] = -tz * sz;
+		inverse->type = matrix->type;
+
+		return 0;
+	}
+
 	if (matrix_invert(LU, perm, matrix) < 0)
 		return -1;
 
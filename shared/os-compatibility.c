@@ -31,6 +31,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <stdlib.h>
 
@@ -147,6 +148,9 @@ create_tmpfile_cloexec(char *tmpname)
  * given size. If disk space is insufficent, errno is set to ENOSPC.
  * If posix_fallocate() is not supported, program may receive
  * SIGBUS on accessing mmap()'ed file contents instead.
+ *
+ * Where memfd_create() is available, the file is a memfd that allows
+ * sealing, see os_seal_shrink().
  */
 int
 os_create_anonymous_file(off_t size)
@@ -157,6 +161,12 @@ os_create_anonymous_file(off_t size)
 	int fd;
 	int ret;
 
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+	fd = memfd_create("weston-shared", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd >= 0)
+		goto allocate;
+#endif
+
 	path = getenv("XDG_RUNTIME_DIR");
 	if (!path) {
 		errno = ENOENT;
@@ -177,6 +187,10 @@ os_create_anonymous_file(off_t size)
 	if (fd < 0)
 		return -1;
 
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+allocate:
+#endif
+
 #ifdef HAVE_POSIX_FALLOCATE
 	ret = posix_fallocate(fd, 0, size);
 	if (ret != 0) {
@@ -195,6 +209,166 @@ os_create_anonymous_file(off_t size)
 	return fd;
 }
 
+/* Written at offset 0 without moving the file offset, which clients
+ * given the same file description share and may read() from */
+static int
+write_all(int fd, const char *data, size_t size)
+{
+	off_t offset = 0;
+	ssize_t len;
+
+	while (size > 0) {
+		len = pwrite(fd, data, size, offset);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += len;
+		size -= len;
+		offset += len;
+	}
+
+	return 0;
+}
+
+/*
+ * Create an anonymous file holding a copy of the given data, meant to
+ * be handed out read-only to clients.
+ *
+ * Where memfd sealing is available, the file is sealed against writes
+ * and resizing, so the same file descriptor can safely be sent to every
+ * client.  Otherwise this falls back to os_create_anonymous_file(), with
+ * the same caveats.
+ */
+int
+os_create_sealed_file(const void *data, size_t size)
+{
+	int fd;
+
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+	fd = memfd_create("weston-shared", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd >= 0) {
+		if (write_all(fd, data, size) < 0 ||
+		    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+					   F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		return fd;
+	}
+#endif
+
+	fd = os_create_anonymous_file(size);
+	if (fd < 0)
+		return -1;
+
+	if (write_all(fd, data, size) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * Create an empty anonymous file that is filled in incrementally and
+ * may grow without bound, e.g. with splice().  Once complete, it can be
+ * sealed with os_seal_file().
+ */
+int
+os_create_sealable_file(void)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+	int fd;
+
+	fd = memfd_create("weston-shared", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd >= 0)
+		return fd;
+#endif
+
+	return os_create_anonymous_file(0);
+}
+
+/*
+ * Seal a file from os_create_sealable_file() against further writes and
+ * resizing.  Fails with EINVAL where sealing is not supported.
+ */
+int
+os_seal_file(int fd)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+	return fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+				      F_SEAL_WRITE | F_SEAL_SEAL);
+#else
+	errno = EINVAL;
+	return -1;
+#endif
+}
+
+/*
+ * Seal a file from os_create_anonymous_file() against shrinking, for
+ * buffer pools that never shrink.  The compositor can then map the
+ * pool into the GPU instead of copying every buffer out of it.  Fails
+ * with EINVAL where sealing is not supported.
+ */
+int
+os_seal_shrink(int fd)
+{
+#if defined(HAVE_MEMFD_CREATE) && defined(F_ADD_SEALS)
+	return fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK);
+#else
+	errno = EINVAL;
+	return -1;
+#endif
+}
+
+/* Below the size of a huge page, asking for them is pointless */
+#define OS_POOL_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/*
+ * Map a buffer pool file shared and read-write.  Returns MAP_FAILED on
+ * failure, like mmap().
+ *
+ * With OS_POOL_HUGE_PAGES, pools of at least a huge page are backed by
+ * transparent huge pages where the kernel allows it for shared memory
+ * (transparent_hugepage/shmem_enabled set to advise or always), which
+ * takes the TLB pressure off drawing into and uploading from them.
+ *
+ * With OS_POOL_POPULATE, the pool is faulted in here at once instead of
+ * page by page on the first frame drawn into it.
+ */
+void *
+os_map_pool(int fd, size_t size, uint32_t flags)
+{
+	int map_flags = MAP_SHARED;
+	void *data;
+
+	/* Without MADV_POPULATE_WRITE, populate at map time, before the
+	 * huge page advice can be given */
+#if defined(MAP_POPULATE) && !defined(MADV_POPULATE_WRITE)
+	if (flags & OS_POOL_POPULATE)
+		map_flags |= MAP_POPULATE;
+#endif
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, map_flags, fd, 0);
+	if (data == MAP_FAILED)
+		return MAP_FAILED;
+
+#ifdef MADV_HUGEPAGE
+	if ((flags & OS_POOL_HUGE_PAGES) && size >= OS_POOL_HUGE_PAGE_SIZE)
+		madvise(data, size, MADV_HUGEPAGE);
+#endif
+
+#ifdef MADV_POPULATE_WRITE
+	if (flags & OS_POOL_POPULATE)
+		madvise(data, size, MADV_POPULATE_WRITE);
+#endif
+
+	return data;
+}
+
 #ifndef HAVE_STRCHRNUL
 char *
 strchrnul(const char *s, int c)
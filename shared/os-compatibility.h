@@ -28,6 +28,7 @@
 
 #include "config.h"
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #ifdef HAVE_EXECINFO_H
@@ -52,6 +53,26 @@ os_epoll_create_cloexec(void);
 int
 os_create_anonymous_file(off_t size);
 
+int
+os_create_sealed_file(const void *data, size_t size);
+
+int
+os_create_sealable_file(void);
+
+int
+os_seal_file(int fd);
+
+int
+os_seal_shrink(int fd);
+
+enum os_pool_flags {
+	OS_POOL_HUGE_PAGES = 1 << 0,
+	OS_POOL_POPULATE = 1 << 1,
+};
+
+void *
+os_map_pool(int fd, size_t size, uint32_t flags);
+
 #ifndef HAVE_STRCHRNUL
 char *
 strchrnul(const char *s, int c);
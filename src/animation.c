@@ -25,6 +25,7 @@
 
 #include "config.h"
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -122,7 +123,8 @@ typedef	void (*weston_view_animation_frame_func_t)(struct weston_view_animation
 
 struct weston_view_animation {
 	struct weston_view *view;
-	struct weston_animation animation;
+	struct wl_list link;	/* weston_compositor::view_animation_list */
+	int frame_counter;
 	struct weston_spring spring;
 	struct weston_transform transform;
 	struct wl_listener listener;
@@ -137,7 +139,7 @@ struct weston_view_animation {
 WL_EXPORT void
 weston_view_animation_destroy(struct weston_view_animation *animation)
 {
-	wl_list_remove(&animation->animation.link);
+	wl_list_remove(&animation->link);
 	wl_list_remove(&animation->listener.link);
 	wl_list_remove(&animation->transform.link);
 	if (animation->reset)
@@ -158,32 +160,39 @@ handle_animation_view_destroy(struct wl_listener *listener, void *data)
 	weston_view_animation_destroy(animation);
 }
 
-static void
-weston_view_animation_frame(struct weston_animation *base,
-			    struct weston_output *output, uint32_t msecs)
+/* Steps the spring of an animation up to msecs and applies the new
+ * value to the view. Returns true once the spring has settled. */
+static bool
+weston_view_animation_advance(struct weston_view_animation *animation,
+			      uint32_t msecs)
 {
-	struct weston_view_animation *animation =
-		container_of(base,
-			     struct weston_view_animation, animation);
-	struct weston_compositor *compositor =
-		animation->view->surface->compositor;
-
-	if (base->frame_counter <= 1)
+	if (animation->frame_counter <= 1)
 		animation->spring.timestamp = msecs;
+	else if ((int32_t) (msecs - animation->spring.timestamp) < 0)
+		/* Already stepped further by a repaint of another output
+		 * whose frame time is ahead of this one. */
+		return false;
 
 	weston_spring_update(&animation->spring, msecs);
 
-	if (weston_spring_done(&animation->spring)) {
-		weston_view_schedule_repaint(animation->view);
-		weston_view_animation_destroy(animation);
-		return;
-	}
+	if (weston_spring_done(&animation->spring))
+		return true;
 
 	if (animation->frame)
 		animation->frame(animation);
 
-	weston_view_geometry_dirty(animation->view);
-	weston_view_schedule_repaint(animation->view);
+	return false;
+}
+
+static void
+weston_view_animation_touch(struct weston_view *view, uint32_t pass)
+{
+	if (pass && view->animation_pass == pass)
+		return;
+
+	view->animation_pass = pass;
+	weston_view_geometry_dirty(view);
+	weston_view_schedule_repaint(view);
 
 	/* The view's output_mask will be zero if its position is
 	 * offscreen. Animations should always run but as they are also
@@ -191,8 +200,57 @@ weston_view_animation_frame(struct weston_animation *base,
 	 * the animation stops running. Therefore if we catch this situation
 	 * and schedule a repaint on all outputs it will be avoided.
 	 */
-	if (animation->view->output_mask == 0)
-		weston_compositor_schedule_repaint(compositor);
+	if (view->output_mask == 0)
+		weston_compositor_schedule_repaint(view->surface->compositor);
+}
+
+/** Advance all view animations for a repaint of output
+ *
+ * Every running animation of a view on this output, or of a view not
+ * on any output, has its spring stepped to msecs and its effect
+ * applied in a single pass. Each affected view is then invalidated
+ * once, however many animations it runs, and animations that settled
+ * are finished after the pass so that their done callbacks, which
+ * often start further animations, see a consistent list.
+ */
+WL_EXPORT void
+weston_compositor_run_view_animations(struct weston_output *output,
+				      uint32_t msecs)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_view_animation *animation, *next;
+	struct weston_view *view;
+	struct wl_list done_list;
+	uint32_t pass;
+
+	if (wl_list_empty(&compositor->view_animation_list))
+		return;
+
+	pass = ++compositor->view_animation_pass;
+	if (pass == 0)
+		pass = ++compositor->view_animation_pass;
+
+	wl_list_init(&done_list);
+	wl_list_for_each_safe(animation, next,
+			      &compositor->view_animation_list, link) {
+		view = animation->view;
+		if (view->output && view->output != output)
+			continue;
+
+		animation->frame_counter++;
+		if (weston_view_animation_advance(animation, msecs)) {
+			wl_list_remove(&animation->link);
+			wl_list_insert(done_list.prev, &animation->link);
+		}
+
+		weston_view_animation_touch(view, pass);
+	}
+
+	while (!wl_list_empty(&done_list)) {
+		animation = container_of(done_list.next,
+					 struct weston_view_animation, link);
+		weston_view_animation_destroy(animation);
+	}
 }
 
 static struct weston_view_animation *
@@ -204,6 +262,7 @@ weston_view_animation_create(struct weston_view *view,
 			     void *data,
 			     void *private)
 {
+	struct weston_compositor *compositor = view->surface->compositor;
 	struct weston_view_animation *animation;
 
 	animation = malloc(sizeof *animation);
@@ -223,13 +282,11 @@ weston_view_animation_create(struct weston_view *view,
 	wl_list_insert(&view->geometry.transformation_list,
 		       &animation->transform.link);
 
-	animation->animation.frame = weston_view_animation_frame;
-
 	animation->listener.notify = handle_animation_view_destroy;
 	wl_signal_add(&view->destroy_signal, &animation->listener);
 
-	wl_list_insert(&view->output->animation_list,
-		       &animation->animation.link);
+	wl_list_insert(compositor->view_animation_list.prev,
+		       &animation->link);
 
 	return animation;
 }
@@ -237,8 +294,16 @@ weston_view_animation_create(struct weston_view *view,
 static void
 weston_view_animation_run(struct weston_view_animation *animation)
 {
-	animation->animation.frame_counter = 0;
-	weston_view_animation_frame(&animation->animation, NULL, 0);
+	struct weston_view *view = animation->view;
+
+	animation->frame_counter = 0;
+	if (weston_view_animation_advance(animation, 0)) {
+		weston_view_schedule_repaint(view);
+		weston_view_animation_destroy(animation);
+		return;
+	}
+
+	weston_view_animation_touch(view, 0);
 }
 
 static void
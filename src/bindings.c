@@ -26,6 +26,7 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <linux/input.h>
 
 #include "compositor.h"
@@ -39,8 +40,76 @@ struct weston_binding {
 	void *handler;
 	void *data;
 	struct wl_list link;
+
+	/* Key and button bindings only */
+	struct weston_binding_table *table;
+	struct wl_list table_link;
 };
 
+void
+weston_binding_table_init(struct weston_binding_table *table)
+{
+	int i;
+
+	for (i = 0; i < WESTON_BINDING_BUCKETS; i++)
+		wl_list_init(&table->buckets[i]);
+	memset(table->codes, 0, sizeof table->codes);
+}
+
+static struct wl_list *
+binding_table_bucket(struct weston_binding_table *table,
+		     uint32_t code, uint32_t modifier)
+{
+	uint32_t hash = code * 31 + modifier;
+
+	return &table->buckets[hash % WESTON_BINDING_BUCKETS];
+}
+
+static void
+binding_table_mark(struct weston_binding_table *table, uint32_t code)
+{
+	code %= ARRAY_LENGTH(table->codes) * 32;
+	table->codes[code / 32] |= 1u << (code % 32);
+}
+
+/* Whether any binding may be on code; false positives are fine */
+static int
+binding_table_has_code(struct weston_binding_table *table, uint32_t code)
+{
+	code %= ARRAY_LENGTH(table->codes) * 32;
+	return table->codes[code / 32] & (1u << (code % 32));
+}
+
+static void
+binding_table_insert(struct weston_binding_table *table,
+		     struct weston_binding *binding, uint32_t code)
+{
+	struct wl_list *bucket;
+
+	/* Appending keeps bindings on the same code and modifier running
+	 * in the order they were added, as with the plain lists. */
+	bucket = binding_table_bucket(table, code, binding->modifier);
+	wl_list_insert(bucket->prev, &binding->table_link);
+	binding_table_mark(table, code);
+	binding->table = table;
+}
+
+static void
+binding_table_remove(struct weston_binding *binding)
+{
+	struct weston_binding_table *table = binding->table;
+	struct weston_binding *b;
+	int i;
+
+	wl_list_remove(&binding->table_link);
+
+	/* Bindings are rarely removed, so just rebuild the bitmap */
+	memset(table->codes, 0, sizeof table->codes);
+	for (i = 0; i < WESTON_BINDING_BUCKETS; i++)
+		wl_list_for_each(b, &table->buckets[i], table_link)
+			binding_table_mark(table, b->key | b->button);
+}
+
 static struct weston_binding *
 weston_compositor_add_binding(struct weston_compositor *compositor,
 			      uint32_t key, uint32_t button, uint32_t axis,
@@ -58,6 +127,8 @@ weston_compositor_add_binding(struct weston_compositor *compositor,
 	binding->modifier = modifier;
 	binding->handler = handler;
 	binding->data = data;
+	binding->table = NULL;
+	wl_list_init(&binding->table_link);
 
 	return binding;
 }
@@ -76,6 +147,7 @@ weston_compositor_add_key_binding(struct weston_compositor *compositor,
 		return NULL;
 
 	wl_list_insert(compositor->key_binding_list.prev, &binding->link);
+	binding_table_insert(&compositor->key_binding_table, binding, key);
 
 	return binding;
 }
@@ -112,6 +184,8 @@ weston_compositor_add_button_binding(struct weston_compositor *compositor,
 		return NULL;
 
 	wl_list_insert(compositor->button_binding_list.prev, &binding->link);
+	binding_table_insert(&compositor->button_binding_table,
+			     binding, button);
 
 	return binding;
 }
@@ -171,6 +245,8 @@ weston_compositor_add_debug_binding(struct weston_compositor *compositor,
 WL_EXPORT void
 weston_binding_destroy(struct weston_binding *binding)
 {
+	if (binding->table)
+		binding_table_remove(binding);
 	wl_list_remove(&binding->link);
 	free(binding);
 }
@@ -284,9 +360,11 @@ weston_compositor_run_key_binding(struct weston_compositor *compositor,
 				  uint32_t time, uint32_t key,
 				  enum wl_keyboard_key_state state)
 {
+	struct weston_binding_table *table = &compositor->key_binding_table;
 	struct weston_binding *b, *tmp;
 	struct weston_surface *focus;
 	struct weston_seat *seat = keyboard->seat;
+	struct wl_list *bucket;
 
 	if (state == WL_KEYBOARD_KEY_STATE_RELEASED)
 		return;
@@ -295,7 +373,11 @@ weston_compositor_run_key_binding(struct weston_compositor *compositor,
 	wl_list_for_each(b, &compositor->modifier_binding_list, link)
 		b->key = key;
 
-	wl_list_for_each_safe(b, tmp, &compositor->key_binding_list, link) {
+	if (!binding_table_has_code(table, key))
+		return;
+
+	bucket = binding_table_bucket(table, key, seat->modifier_state);
+	wl_list_for_each_safe(b, tmp, bucket, table_link) {
 		if (b->key == key && b->modifier == seat->modifier_state) {
 			weston_key_binding_handler_t handler = b->handler;
 			focus = keyboard->focus;
@@ -351,7 +433,10 @@ weston_compositor_run_button_binding(struct weston_compositor *compositor,
 				     uint32_t time, uint32_t button,
 				     enum wl_pointer_button_state state)
 {
+	struct weston_binding_table *table = &compositor->button_binding_table;
+	uint32_t modifier = pointer->seat->modifier_state;
 	struct weston_binding *b, *tmp;
+	struct wl_list *bucket;
 
 	if (state == WL_POINTER_BUTTON_STATE_RELEASED)
 		return;
@@ -360,9 +445,12 @@ weston_compositor_run_button_binding(struct weston_compositor *compositor,
 	wl_list_for_each(b, &compositor->modifier_binding_list, link)
 		b->key = button;
 
-	wl_list_for_each_safe(b, tmp, &compositor->button_binding_list, link) {
-		if (b->button == button &&
-		    b->modifier == pointer->seat->modifier_state) {
+	if (!binding_table_has_code(table, button))
+		return;
+
+	bucket = binding_table_bucket(table, button, modifier);
+	wl_list_for_each_safe(b, tmp, bucket, table_link) {
+		if (b->button == button && b->modifier == modifier) {
 			weston_button_binding_handler_t handler = b->handler;
 			handler(pointer, time, button, b->data);
 		}
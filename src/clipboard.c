@@ -30,14 +30,27 @@
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 
 #include "compositor.h"
 #include "shared/helpers.h"
+#include "shared/os-compatibility.h"
 
+/* Upper bound on what is moved per wakeup, in either direction */
+#define CLIPBOARD_CHUNK_SIZE (1024 * 1024)
+
+/*
+ * The selection contents live in an anonymous file (a memfd where
+ * available) rather than in compositor memory.  They are spliced in
+ * from the source pipe and sent back out to clients with sendfile(),
+ * so a large selection never gets copied through userspace.
+ */
 struct clipboard_source {
 	struct weston_data_source base;
-	struct wl_array contents;
+	int contents_fd;
+	size_t size;
 	struct clipboard *clipboard;
 	struct wl_event_source *event_source;
 	uint32_t serial;
@@ -50,6 +63,9 @@ struct clipboard {
 	struct wl_listener selection_listener;
 	struct wl_listener destroy_listener;
 	struct clipboard_source *source;
+	size_t max_size;
+	char **mime_types;
+	int n_mime_types;
 };
 
 static void clipboard_client_create(struct clipboard_source *source, int fd);
@@ -72,35 +88,57 @@ clipboard_source_unref(struct clipboard_source *source)
 	s = source->base.mime_types.data;
 	free(*s);
 	wl_array_release(&source->base.mime_types);
-	wl_array_release(&source->contents);
+	close(source->contents_fd);
 	free(source);
 }
 
+static ssize_t
+clipboard_source_read(struct clipboard_source *source, int fd)
+{
+	char buffer[16384];
+	loff_t offset = source->size;
+	ssize_t len;
+
+	len = splice(fd, NULL, source->contents_fd, &offset,
+		     CLIPBOARD_CHUNK_SIZE, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (len >= 0 || errno != EINVAL)
+		return len;
+
+	/* the file system backing the file cannot splice */
+	len = read(fd, buffer, sizeof buffer);
+	if (len > 0)
+		len = pwrite(source->contents_fd, buffer, len, source->size);
+
+	return len;
+}
+
 static int
 clipboard_source_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_source *source = data;
 	struct clipboard *clipboard = source->clipboard;
-	char *p;
-	int len, size;
-
-	if (source->contents.alloc - source->contents.size < 1024) {
-		wl_array_add(&source->contents, 1024);
-		source->contents.size -= 1024;
-	}
+	ssize_t len;
 
-	p = source->contents.data + source->contents.size;
-	size = source->contents.alloc - source->contents.size;
-	len = read(fd, p, size);
+	len = clipboard_source_read(source, fd);
 	if (len == 0) {
 		wl_event_source_remove(source->event_source);
 		close(fd);
 		source->event_source = NULL;
+		os_seal_file(source->contents_fd);
 	} else if (len < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 1;
 		clipboard_source_unref(source);
 		clipboard->source = NULL;
 	} else {
-		source->contents.size += len;
+		source->size += len;
+		if (clipboard->max_size && source->size > clipboard->max_size) {
+			weston_log("clipboard: selection larger than %zu "
+				   "bytes, not keeping it\n",
+				   clipboard->max_size);
+			clipboard_source_unref(source);
+			clipboard->source = NULL;
+		}
 	}
 
 	return 1;
@@ -145,7 +183,13 @@ clipboard_source_create(struct clipboard *clipboard,
 	if (source == NULL)
 		return NULL;
 
-	wl_array_init(&source->contents);
+	source->contents_fd = os_create_sealable_file();
+	if (source->contents_fd < 0) {
+		free(source);
+		return NULL;
+	}
+
+	source->size = 0;
 	wl_array_init(&source->base.mime_types);
 	source->base.resource = NULL;
 	source->base.accept = clipboard_source_accept;
@@ -176,6 +220,7 @@ clipboard_source_create(struct clipboard *clipboard,
  err_strdup:
 	wl_array_release(&source->base.mime_types);
  err_add:
+	close(source->contents_fd);
 	free(source);
 
 	return NULL;
@@ -191,13 +236,15 @@ static int
 clipboard_client_data(int fd, uint32_t mask, void *data)
 {
 	struct clipboard_client *client = data;
-	char *p;
+	off_t offset = client->offset;
 	size_t size;
-	int len;
+	ssize_t len;
 
-	size = client->source->contents.size;
-	p = client->source->contents.data;
-	len = write(fd, p + client->offset, size - client->offset);
+	size = client->source->size;
+	len = sendfile(fd, client->source->contents_fd, &offset,
+		       MIN(size - client->offset, CLIPBOARD_CHUNK_SIZE));
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return 1;
 	if (len > 0)
 		client->offset += len;
 
@@ -230,6 +277,25 @@ clipboard_client_create(struct clipboard_source *source, int fd)
 				     clipboard_client_data, client);
 }
 
+/* The first type in the configured preference list the source offers,
+ * or else the first one it offers */
+static const char *
+clipboard_pick_mime_type(struct clipboard *clipboard,
+			 struct weston_data_source *source)
+{
+	const char **mime_types = source->mime_types.data;
+	int n = source->mime_types.size / sizeof *mime_types;
+	int i, j;
+
+	for (i = 0; i < clipboard->n_mime_types; i++)
+		for (j = 0; j < n; j++)
+			if (strcmp(clipboard->mime_types[i],
+				   mime_types[j]) == 0)
+				return mime_types[j];
+
+	return mime_types[0];
+}
+
 static void
 clipboard_set_selection(struct wl_listener *listener, void *data)
 {
@@ -237,7 +303,7 @@ clipboard_set_selection(struct wl_listener *listener, void *data)
 		container_of(listener, struct clipboard, selection_listener);
 	struct weston_seat *seat = data;
 	struct weston_data_source *source = seat->selection_data_source;
-	const char **mime_types;
+	const char *mime_type;
 	int p[2];
 
 	if (source == NULL) {
@@ -256,15 +322,14 @@ clipboard_set_selection(struct wl_listener *listener, void *data)
 
 	clipboard->source = NULL;
 
-	mime_types = source->mime_types.data;
-
-	if (!mime_types || pipe2(p, O_CLOEXEC) == -1)
+	if (!source->mime_types.data || pipe2(p, O_CLOEXEC) == -1)
 		return;
 
-	source->send(source, mime_types[0], p[1]);
+	mime_type = clipboard_pick_mime_type(clipboard, source);
+	source->send(source, mime_type, p[1]);
 
 	clipboard->source =
-		clipboard_source_create(clipboard, mime_types[0],
+		clipboard_source_create(clipboard, mime_type,
 					seat->selection_serial, p[0]);
 	if (clipboard->source == NULL) {
 		close(p[0]);
@@ -277,22 +342,67 @@ clipboard_destroy(struct wl_listener *listener, void *data)
 {
 	struct clipboard *clipboard =
 		container_of(listener, struct clipboard, destroy_listener);
+	int i;
 
 	wl_list_remove(&clipboard->selection_listener.link);
 	wl_list_remove(&clipboard->destroy_listener.link);
 
+	for (i = 0; i < clipboard->n_mime_types; i++)
+		free(clipboard->mime_types[i]);
+	free(clipboard->mime_types);
 	free(clipboard);
 }
 
+static void
+clipboard_parse_mime_types(struct clipboard *clipboard, const char *list)
+{
+	const char *p, *end;
+	char **types;
+	int n = 0;
+
+	for (p = list; p; p = strchr(p, ','), p = p ? p + 1 : NULL)
+		n++;
+
+	types = zalloc(n * sizeof *types);
+	if (types == NULL)
+		return;
+
+	clipboard->mime_types = types;
+	for (p = list; *p; p = end) {
+		p += strspn(p, " ");
+		end = strchrnul(p, ',');
+		if (end > p)
+			types[clipboard->n_mime_types++] = strndup(p, end - p);
+		if (*end == ',')
+			end++;
+	}
+}
+
 struct clipboard *
 clipboard_create(struct weston_seat *seat)
 {
+	struct weston_config_section *section;
 	struct clipboard *clipboard;
+	int32_t max_size;
+	char *mime_types;
 
 	clipboard = zalloc(sizeof *clipboard);
 	if (clipboard == NULL)
 		return NULL;
 
+	section = weston_config_get_section(seat->compositor->config,
+					    "core", NULL, NULL);
+	weston_config_section_get_int(section, "clipboard-max-size",
+				      &max_size, 256);
+	if (max_size > 0)
+		clipboard->max_size = (size_t) max_size * 1024 * 1024;
+	weston_config_section_get_string(section, "clipboard-mime-types",
+					 &mime_types, NULL);
+	if (mime_types) {
+		clipboard_parse_mime_types(clipboard, mime_types);
+		free(mime_types);
+	}
+
 	clipboard->seat = seat;
 	clipboard->selection_listener.notify = clipboard_set_selection;
 	clipboard->destroy_listener.notify = clipboard_destroy;
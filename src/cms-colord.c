@@ -42,6 +42,7 @@ struct cms_colord {
 	struct weston_compositor	*ec;
 	CdClient			*client;
 	GHashTable			*devices; /* key = device-id, value = cms_output */
+	GHashTable			*profiles; /* key = device-id, value = cms_profile_entry */
 	GHashTable			*pnp_ids; /* key = pnp-id, value = vendor */
 	gchar				*pnp_ids_data;
 	GMainLoop			*loop;
@@ -55,37 +56,35 @@ struct cms_colord {
 	struct wl_listener		 output_created_listener;
 };
 
+/*
+ * Everything below ->o is set up on the compositor thread before the
+ * output is handed to the GLib thread, and is not written afterwards.
+ * ->o itself is cleared under pending_mutex when the output goes away,
+ * so the GLib thread never looks at the weston_output.
+ */
 struct cms_output {
 	CdDevice			*device;
 	guint32				 backlight_value;
 	struct cms_colord		*cms;
-	struct weston_color_profile	*p;
+	struct weston_color_profile	*p; /* owned by cms->profiles */
 	struct weston_output		*o;
+	gchar				*device_id;
+	GHashTable			*device_props;
 	struct wl_listener		 destroy_listener;
 };
 
-static gint
-colord_idle_find_output_cb(gconstpointer a, gconstpointer b)
-{
-	struct cms_output *ocms = (struct cms_output *) a;
-	struct weston_output *o = (struct weston_output *) b;
-	return ocms->o == o ? 0 : -1;
-}
-
-static void
-colord_idle_cancel_for_output(struct cms_colord *cms, struct weston_output *o)
-{
-	GList *l;
-
-	/* cancel and remove any helpers that match the output */
-	g_mutex_lock(&cms->pending_mutex);
-	l = g_list_find_custom (cms->pending, o, colord_idle_find_output_cb);
-	if (l) {
-		struct cms_output *ocms = l->data;
-		cms->pending = g_list_remove (cms->pending, ocms);
-	}
-	g_mutex_unlock(&cms->pending_mutex);
-}
+/*
+ * The last profile loaded for a device-id, which is derived from the
+ * EDID.  Replugging the same monitor applies it straight away instead
+ * of waiting on colord, and the profile file is only parsed again if
+ * colord hands out a different one.  Only the GLib thread modifies the
+ * table, always under pending_mutex.
+ */
+struct cms_profile_entry {
+	gchar				*filename;
+	struct weston_color_profile	*p;
+	guint32				 backlight_value;
+};
 
 static bool
 edid_value_valid(const char *str)
@@ -126,6 +125,74 @@ get_output_id(struct cms_colord *cms, struct weston_output *o)
 	return g_string_free(device_id, FALSE);
 }
 
+static GHashTable *
+get_output_device_props(struct cms_colord *cms, struct weston_output *o)
+{
+	const gchar *tmp;
+	GHashTable *device_props;
+
+	device_props = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     g_free, g_free);
+	g_hash_table_insert (device_props,
+			     g_strdup(CD_DEVICE_PROPERTY_KIND),
+			     g_strdup(cd_device_kind_to_string (CD_DEVICE_KIND_DISPLAY)));
+	g_hash_table_insert (device_props,
+			     g_strdup(CD_DEVICE_PROPERTY_FORMAT),
+			     g_strdup("ColorModel.OutputMode.OutputResolution"));
+	g_hash_table_insert (device_props,
+			     g_strdup(CD_DEVICE_PROPERTY_COLORSPACE),
+			     g_strdup(cd_colorspace_to_string(CD_COLORSPACE_RGB)));
+	if (edid_value_valid(o->make)) {
+		tmp = g_hash_table_lookup(cms->pnp_ids, o->make);
+		if (tmp == NULL)
+			tmp = o->make;
+		g_hash_table_insert (device_props,
+				     g_strdup(CD_DEVICE_PROPERTY_VENDOR),
+				     g_strdup(tmp));
+	}
+	if (edid_value_valid(o->model)) {
+		g_hash_table_insert (device_props,
+				     g_strdup(CD_DEVICE_PROPERTY_MODEL),
+				     g_strdup(o->model));
+	}
+	if (edid_value_valid(o->serial_number)) {
+		g_hash_table_insert (device_props,
+				     g_strdup(CD_DEVICE_PROPERTY_SERIAL),
+				     g_strdup(o->serial_number));
+	}
+	if (o->connection_internal) {
+		g_hash_table_insert (device_props,
+				     g_strdup (CD_DEVICE_PROPERTY_EMBEDDED),
+				     NULL);
+	}
+
+	return device_props;
+}
+
+static void
+colord_profile_entry_free(gpointer data)
+{
+	struct cms_profile_entry *entry = data;
+
+	weston_cms_destroy_profile(entry->p);
+	g_free(entry->filename);
+	g_slice_free(struct cms_profile_entry, entry);
+}
+
+/* Called with pending_mutex held, on the compositor thread */
+static void
+colord_output_apply(struct cms_output *ocms)
+{
+	/* optionally set backlight to calibration value */
+	if (ocms->o->set_backlight && ocms->backlight_value != 0) {
+		weston_log("colord: profile calibration backlight to %i/255\n",
+			   ocms->backlight_value);
+		ocms->o->set_backlight(ocms->o, ocms->backlight_value);
+	}
+
+	weston_cms_set_color_profile(ocms->o, ocms->p);
+}
+
 static void
 update_device_with_profile_in_idle(struct cms_output *ocms)
 {
@@ -133,8 +200,13 @@ update_device_with_profile_in_idle(struct cms_output *ocms)
 	ssize_t rc;
 	struct cms_colord *cms = ocms->cms;
 
-	colord_idle_cancel_for_output(cms, ocms->o);
 	g_mutex_lock(&cms->pending_mutex);
+	if (ocms->o == NULL) {
+		/* output already gone, removal is queued behind us */
+		g_mutex_unlock(&cms->pending_mutex);
+		return;
+	}
+	cms->pending = g_list_remove(cms->pending, ocms);
 	if (cms->pending == NULL)
 		signal_write = TRUE;
 	cms->pending = g_list_prepend(cms->pending, ocms);
@@ -152,15 +224,17 @@ update_device_with_profile_in_idle(struct cms_output *ocms)
 static void
 colord_update_output_from_device (struct cms_output *ocms)
 {
+	struct cms_colord *cms = ocms->cms;
+	struct cms_profile_entry *entry, *new_entry = NULL;
 	CdProfile *profile;
+	const gchar *filename;
 	const gchar *tmp;
 	gboolean ret;
+	gboolean found = FALSE;
+	gboolean changed = TRUE;
 	GError *error = NULL;
 	gint percentage;
-
-	/* old profile is no longer valid */
-	weston_cms_destroy_profile(ocms->p);
-	ocms->p = NULL;
+	guint32 backlight_value = 0;
 
 	ret = cd_device_connect_sync(ocms->device, NULL, &error);
 	if (!ret) {
@@ -190,19 +264,56 @@ colord_update_output_from_device (struct cms_output *ocms)
 	if (tmp != NULL) {
 		percentage = atoi(tmp);
 		if (percentage > 0 && percentage <= 100)
-			ocms->backlight_value = percentage * 255 / 100;
+			backlight_value = percentage * 255 / 100;
 	}
 
-	ocms->p = weston_cms_load_profile(cd_profile_get_filename(profile));
-	if (ocms->p == NULL) {
-		weston_log("colord: warning failed to load profile %s: %s\n",
-			   cd_profile_get_object_path (profile),
-			   error->message);
-		g_error_free(error);
+	/* only parse the file if it is not the one we already have */
+	filename = cd_profile_get_filename(profile);
+	g_mutex_lock(&cms->pending_mutex);
+	entry = g_hash_table_lookup(cms->profiles, ocms->device_id);
+	found = entry && g_strcmp0(entry->filename, filename) == 0;
+	g_mutex_unlock(&cms->pending_mutex);
+	if (found)
+		goto out;
+
+	new_entry = g_slice_new0(struct cms_profile_entry);
+	new_entry->p = weston_cms_load_profile(filename);
+	if (new_entry->p == NULL) {
+		weston_log("colord: warning failed to load profile %s\n",
+			   cd_profile_get_object_path (profile));
+		g_slice_free(struct cms_profile_entry, new_entry);
+		new_entry = NULL;
 		goto out;
 	}
+	new_entry->filename = g_strdup(filename);
+	found = TRUE;
 out:
-	update_device_with_profile_in_idle(ocms);
+	g_mutex_lock(&cms->pending_mutex);
+	if (new_entry) {
+		/* ocms->p may still point at the entry being replaced;
+		 * it is reassigned below before the lock is dropped */
+		g_hash_table_replace(cms->profiles,
+				     g_strdup(ocms->device_id), new_entry);
+	} else if (!found) {
+		g_hash_table_remove(cms->profiles, ocms->device_id);
+	}
+	entry = found ? g_hash_table_lookup(cms->profiles,
+					    ocms->device_id) : NULL;
+	if (entry) {
+		entry->backlight_value = backlight_value;
+		changed = new_entry != NULL ||
+			  ocms->p != entry->p ||
+			  ocms->backlight_value != backlight_value;
+		ocms->p = entry->p;
+	} else {
+		changed = ocms->p != NULL;
+		ocms->p = NULL;
+	}
+	ocms->backlight_value = backlight_value;
+	g_mutex_unlock(&cms->pending_mutex);
+
+	if (changed)
+		update_device_with_profile_in_idle(ocms);
 }
 
 static void
@@ -213,71 +324,20 @@ colord_device_changed_cb(CdDevice *device, struct cms_output *ocms)
 	colord_update_output_from_device(ocms);
 }
 
-static void
-colord_notifier_output_destroy(struct wl_listener *listener, void *data)
+/* Runs on the GLib thread */
+static gboolean
+colord_output_added_cb(gpointer data)
 {
-	struct cms_output *ocms =
-		container_of(listener, struct cms_output, destroy_listener);
-	struct weston_output *o = (struct weston_output *) data;
+	struct cms_output *ocms = data;
 	struct cms_colord *cms = ocms->cms;
-	gchar *device_id;
-
-	device_id = get_output_id(cms, o);
-	g_hash_table_remove (cms->devices, device_id);
-	g_free (device_id);
-}
-
-static void
-colord_output_created(struct cms_colord *cms, struct weston_output *o)
-{
 	CdDevice *device;
-	const gchar *tmp;
-	gchar *device_id;
 	GError *error = NULL;
-	GHashTable *device_props;
-	struct cms_output *ocms;
 
 	/* create device */
-	device_id = get_output_id(cms, o);
-	weston_log("colord: output added %s\n", device_id);
-	device_props = g_hash_table_new_full(g_str_hash, g_str_equal,
-					     g_free, g_free);
-	g_hash_table_insert (device_props,
-			     g_strdup(CD_DEVICE_PROPERTY_KIND),
-			     g_strdup(cd_device_kind_to_string (CD_DEVICE_KIND_DISPLAY)));
-	g_hash_table_insert (device_props,
-			     g_strdup(CD_DEVICE_PROPERTY_FORMAT),
-			     g_strdup("ColorModel.OutputMode.OutputResolution"));
-	g_hash_table_insert (device_props,
-			     g_strdup(CD_DEVICE_PROPERTY_COLORSPACE),
-			     g_strdup(cd_colorspace_to_string(CD_COLORSPACE_RGB)));
-	if (edid_value_valid(o->make)) {
-		tmp = g_hash_table_lookup(cms->pnp_ids, o->make);
-		if (tmp == NULL)
-			tmp = o->make;
-		g_hash_table_insert (device_props,
-				     g_strdup(CD_DEVICE_PROPERTY_VENDOR),
-				     g_strdup(tmp));
-	}
-	if (edid_value_valid(o->model)) {
-		g_hash_table_insert (device_props,
-				     g_strdup(CD_DEVICE_PROPERTY_MODEL),
-				     g_strdup(o->model));
-	}
-	if (edid_value_valid(o->serial_number)) {
-		g_hash_table_insert (device_props,
-				     g_strdup(CD_DEVICE_PROPERTY_SERIAL),
-				     g_strdup(o->serial_number));
-	}
-	if (o->connection_internal) {
-		g_hash_table_insert (device_props,
-				     g_strdup (CD_DEVICE_PROPERTY_EMBEDDED),
-				     NULL);
-	}
 	device = cd_client_create_device_sync(cms->client,
-					      device_id,
+					      ocms->device_id,
 					      CD_OBJECT_SCOPE_TEMP,
-					      device_props,
+					      ocms->device_props,
 					      NULL,
 					      &error);
 	if (g_error_matches (error,
@@ -285,7 +345,7 @@ colord_output_created(struct cms_colord *cms, struct weston_output *o)
 			     CD_CLIENT_ERROR_ALREADY_EXISTS)) {
 		g_clear_error(&error);
 		device = cd_client_find_device_sync (cms->client,
-						     device_id,
+						     ocms->device_id,
 						     NULL,
 						     &error);
 	}
@@ -294,29 +354,125 @@ colord_output_created(struct cms_colord *cms, struct weston_output *o)
 			   "find existing device: %s\n",
 			   error->message);
 		g_error_free(error);
-		goto out;
+		return FALSE;
+	}
+
+	ocms->device = device;
+	g_signal_connect (ocms->device, "changed",
+			  G_CALLBACK (colord_device_changed_cb), ocms);
+
+	/* get profiles */
+	colord_update_output_from_device (ocms);
+	return FALSE;
+}
+
+static void
+colord_cms_output_destroy(gpointer data)
+{
+	struct cms_output *ocms = (struct cms_output *) data;
+	struct cms_colord *cms = ocms->cms;
+	gboolean ret;
+	GError *error = NULL;
+
+	/* only still set when the module goes away with the output */
+	if (ocms->o)
+		wl_list_remove(&ocms->destroy_listener.link);
+
+	if (ocms->device) {
+		g_signal_handlers_disconnect_by_data(ocms->device, ocms);
+
+		ret = cd_client_delete_device_sync (cms->client,
+						    ocms->device,
+						    NULL,
+						    &error);
+
+		if (!ret) {
+			weston_log("colord: failed to delete device: %s\n",
+				   error->message);
+			g_error_free(error);
+		}
+
+		g_object_unref(ocms->device);
+	}
+
+	g_hash_table_unref(ocms->device_props);
+	g_free(ocms->device_id);
+	g_slice_free(struct cms_output, ocms);
+}
+
+/* Runs on the GLib thread */
+static gboolean
+colord_output_removed_cb(gpointer data)
+{
+	colord_cms_output_destroy(data);
+	return FALSE;
+}
+
+static void
+colord_notifier_output_destroy(struct wl_listener *listener, void *data)
+{
+	struct cms_output *ocms =
+		container_of(listener, struct cms_output, destroy_listener);
+	struct cms_colord *cms = ocms->cms;
+	gpointer key;
+
+	weston_log("colord: output unplugged %s\n", ocms->device_id);
+	wl_list_remove(&ocms->destroy_listener.link);
+
+	g_mutex_lock(&cms->pending_mutex);
+	ocms->o = NULL;
+	cms->pending = g_list_remove(cms->pending, ocms);
+	g_mutex_unlock(&cms->pending_mutex);
+
+	/* the D-Bus teardown happens on the GLib thread, so only the
+	 * key is freed with the entry here */
+	if (g_hash_table_lookup_extended(cms->devices, ocms->device_id,
+					 &key, NULL)) {
+		g_hash_table_steal(cms->devices, key);
+		g_free(key);
+	}
+	g_idle_add(colord_output_removed_cb, ocms);
+}
+
+static void
+colord_output_created(struct cms_colord *cms, struct weston_output *o)
+{
+	struct cms_profile_entry *entry;
+	struct cms_output *ocms;
+	gchar *device_id;
+
+	device_id = get_output_id(cms, o);
+	weston_log("colord: output added %s\n", device_id);
+	if (g_hash_table_lookup(cms->devices, device_id)) {
+		weston_log("colord: device %s already in use\n", device_id);
+		g_free(device_id);
+		return;
 	}
 
 	/* create object and watch for the output to be destroyed */
 	ocms = g_slice_new0(struct cms_output);
 	ocms->cms = cms;
 	ocms->o = o;
-	ocms->device = g_object_ref(device);
+	ocms->device_id = device_id;
+	ocms->device_props = get_output_device_props(cms, o);
 	ocms->destroy_listener.notify = colord_notifier_output_destroy;
 	wl_signal_add(&o->destroy_signal, &ocms->destroy_listener);
 
 	/* add to local cache */
 	g_hash_table_insert (cms->devices, g_strdup(device_id), ocms);
-	g_signal_connect (ocms->device, "changed",
-			  G_CALLBACK (colord_device_changed_cb), ocms);
 
-	/* get profiles */
-	colord_update_output_from_device (ocms);
-out:
-	g_hash_table_unref (device_props);
-	if (device)
-		g_object_unref (device);
-	g_free (device_id);
+	/* a monitor we have seen before gets its old profile right away,
+	 * colord is asked again on the GLib thread */
+	g_mutex_lock(&cms->pending_mutex);
+	entry = g_hash_table_lookup(cms->profiles, device_id);
+	if (entry) {
+		ocms->p = entry->p;
+		ocms->backlight_value = entry->backlight_value;
+		colord_output_apply(ocms);
+	}
+	g_mutex_unlock(&cms->pending_mutex);
+
+	g_idle_add(colord_output_added_cb, ocms);
 }
 
 static void
@@ -324,7 +480,8 @@ colord_notifier_output_created(struct wl_listener *listener, void *data)
 {
 	struct weston_output *o = (struct weston_output *) data;
 	struct cms_colord *cms =
-		container_of(listener, struct cms_colord, destroy_listener);
+		container_of(listener, struct cms_colord,
+			     output_created_listener);
 	weston_log("colord: output %s created\n", o->name);
 	colord_output_created(cms, o);
 }
@@ -333,13 +490,6 @@ static gpointer
 colord_run_loop_thread(gpointer data)
 {
 	struct cms_colord *cms = (struct cms_colord *) data;
-	struct weston_output *o;
-
-	/* coldplug outputs */
-	wl_list_for_each(o, &cms->ec->output_list, link) {
-		weston_log("colord: output %s coldplugged\n", o->name);
-		colord_output_created(cms, o);
-	}
 
 	g_main_loop_run(cms->loop);
 	return NULL;
@@ -352,22 +502,11 @@ colord_dispatch_all_pending(int fd, uint32_t mask, void *data)
 	GList *l;
 	ssize_t rc;
 	struct cms_colord *cms = data;
-	struct cms_output *ocms;
 
 	weston_log("colord: dispatching events\n");
 	g_mutex_lock(&cms->pending_mutex);
-	for (l = cms->pending; l != NULL; l = l->next) {
-		ocms = l->data;
-
-		/* optionally set backlight to calibration value */
-		if (ocms->o->set_backlight && ocms->backlight_value != 0) {
-			weston_log("colord: profile calibration backlight to %i/255\n",
-				   ocms->backlight_value);
-			ocms->o->set_backlight(ocms->o, ocms->backlight_value);
-		}
-
-		weston_cms_set_color_profile(ocms->o, ocms->p);
-	}
+	for (l = cms->pending; l != NULL; l = l->next)
+		colord_output_apply(l->data);
 	g_list_free (cms->pending);
 	cms->pending = NULL;
 	g_mutex_unlock(&cms->pending_mutex);
@@ -439,8 +578,11 @@ colord_module_destroy(struct cms_colord *cms)
 	 * the other resources are needed during output cleanup in
 	 * cms->devices unref.
 	 */
+	g_list_free(cms->pending);
 	if (cms->devices)
 		g_hash_table_unref(cms->devices);
+	if (cms->profiles)
+		g_hash_table_unref(cms->profiles);
 	if (cms->client)
 		g_object_unref(cms->client);
 	if (cms->readfd)
@@ -462,39 +604,6 @@ colord_notifier_destroy(struct wl_listener *listener, void *data)
 	colord_module_destroy(cms);
 }
 
-static void
-colord_cms_output_destroy(gpointer data)
-{
-	struct cms_output *ocms = (struct cms_output *) data;
-	struct cms_colord *cms = ocms->cms;
-	struct weston_output *o = ocms->o;
-	gboolean ret;
-	gchar *device_id;
-	GError *error = NULL;
-
-	colord_idle_cancel_for_output(cms, o);
-	device_id = get_output_id(cms, o);
-	weston_log("colord: output unplugged %s\n", device_id);
-
-	wl_list_remove(&ocms->destroy_listener.link);
-	g_signal_handlers_disconnect_by_data(ocms->device, ocms);
-
-	ret = cd_client_delete_device_sync (cms->client,
-					    ocms->device,
-					    NULL,
-					    &error);
-
-	if (!ret) {
-		weston_log("colord: failed to delete device: %s\n",
-			   error->message);
-		g_error_free(error);
-	}
-
-	g_object_unref(ocms->device);
-	g_slice_free(struct cms_output, ocms);
-	g_free (device_id);
-}
-
 WL_EXPORT int
 module_init(struct weston_compositor *ec,
 	    int *argc, char *argv[])
@@ -503,6 +612,7 @@ module_init(struct weston_compositor *ec,
 	GError *error = NULL;
 	int fd[2];
 	struct cms_colord *cms;
+	struct weston_output *o;
 	struct wl_event_loop *loop;
 
 	weston_log("colord: initialized\n");
@@ -526,6 +636,8 @@ module_init(struct weston_compositor *ec,
 	g_mutex_init(&cms->pending_mutex);
 	cms->devices = g_hash_table_new_full(g_str_hash, g_str_equal,
 					     g_free, colord_cms_output_destroy);
+	cms->profiles = g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, colord_profile_entry_free);
 
 	/* destroy */
 	cms->destroy_listener.notify = colord_notifier_destroy;
@@ -542,11 +654,6 @@ module_init(struct weston_compositor *ec,
 					     NULL);
 	colord_load_pnp_ids(cms);
 
-	/* setup a thread for the GLib callbacks */
-	cms->loop = g_main_loop_new(NULL, FALSE);
-	cms->thread = g_thread_new("colord CMS main loop",
-				   colord_run_loop_thread, cms);
-
 	/* batch device<->profile updates */
 	if (pipe2(fd, O_CLOEXEC) == -1) {
 		colord_module_destroy(cms);
@@ -564,5 +671,16 @@ module_init(struct weston_compositor *ec,
 		colord_module_destroy(cms);
 		return -1;
 	}
+
+	/* setup a thread for the GLib callbacks */
+	cms->loop = g_main_loop_new(NULL, FALSE);
+	cms->thread = g_thread_new("colord CMS main loop",
+				   colord_run_loop_thread, cms);
+
+	/* coldplug outputs */
+	wl_list_for_each(o, &ec->output_list, link) {
+		weston_log("colord: output %s coldplugged\n", o->name);
+		colord_output_created(cms, o);
+	}
 	return 0;
 }
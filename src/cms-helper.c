@@ -26,8 +26,13 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #ifdef HAVE_LCMS
 #include <lcms2.h>
@@ -35,6 +40,7 @@
 
 #include "compositor.h"
 #include "cms-helper.h"
+#include "shared/helpers.h"
 
 #ifdef HAVE_LCMS
 static void
@@ -54,6 +60,215 @@ weston_cms_gamma_clear(struct weston_output *o)
 }
 #endif
 
+#ifdef HAVE_LCMS
+/* Renderers that can apply a 3D LUT get the whole profile applied, not
+ * just the VCGT ramps.  Filling the LUT takes size^3 transforms, so it
+ * is done on a thread and handed to the renderer when ready.  The
+ * thread does not log, the main loop reports how it went. */
+#define CMS_LUT_MAX_SIZE 64
+
+struct cms_lut_job {
+	struct weston_output *output;
+	struct wl_listener output_destroy_listener;
+	struct wl_list link;
+
+	cmsHTRANSFORM transform;
+	int size;
+	uint8_t *lut;
+
+	pthread_t thread;
+	int fd[2];
+	struct wl_event_source *source;
+};
+
+static struct wl_list cms_lut_jobs = { &cms_lut_jobs, &cms_lut_jobs };
+
+static void
+cms_lut_job_detach(struct cms_lut_job *job)
+{
+	if (!job->output)
+		return;
+
+	wl_list_remove(&job->output_destroy_listener.link);
+	wl_list_remove(&job->link);
+	job->output = NULL;
+}
+
+static void
+cms_lut_job_cancel_output(struct weston_output *o)
+{
+	struct cms_lut_job *job, *next;
+
+	wl_list_for_each_safe(job, next, &cms_lut_jobs, link)
+		if (job->output == o)
+			cms_lut_job_detach(job);
+}
+
+static void
+cms_lut_job_handle_output_destroy(struct wl_listener *listener, void *data)
+{
+	struct cms_lut_job *job =
+		container_of(listener, struct cms_lut_job,
+			     output_destroy_listener);
+
+	cms_lut_job_detach(job);
+}
+
+static void *
+cms_lut_job_thread(void *data)
+{
+	struct cms_lut_job *job = data;
+	int n = job->size;
+	uint8_t *in;
+	int r, g, b, i = 0;
+	char c = 0;
+	ssize_t len;
+
+	in = malloc(n * n * n * 3);
+	if (in) {
+		for (b = 0; b < n; b++)
+			for (g = 0; g < n; g++)
+				for (r = 0; r < n; r++) {
+					in[i++] = r * 255 / (n - 1);
+					in[i++] = g * 255 / (n - 1);
+					in[i++] = b * 255 / (n - 1);
+				}
+
+		cmsDoTransform(job->transform, in, job->lut, n * n * n);
+		free(in);
+	} else {
+		free(job->lut);
+		job->lut = NULL;
+	}
+
+	do {
+		len = write(job->fd[1], &c, 1);
+	} while (len < 0 && errno == EINTR);
+
+	return NULL;
+}
+
+static void
+cms_lut_job_destroy(struct cms_lut_job *job)
+{
+	cms_lut_job_detach(job);
+	if (job->source)
+		wl_event_source_remove(job->source);
+	close(job->fd[0]);
+	close(job->fd[1]);
+	cmsDeleteTransform(job->transform);
+	free(job->lut);
+	free(job);
+}
+
+static int
+cms_lut_job_done(int fd, uint32_t mask, void *data)
+{
+	struct cms_lut_job *job = data;
+	struct weston_renderer *renderer;
+	char c;
+
+	if (read(fd, &c, 1) < 0)
+		return 0;
+
+	pthread_join(job->thread, NULL);
+
+	if (job->output && !job->lut)
+		weston_log("cms: out of memory computing the color LUT\n");
+
+	if (job->output && job->lut) {
+		renderer = job->output->compositor->renderer;
+		if (renderer->output_set_color_lut(job->output, job->size,
+						   job->lut) < 0)
+			weston_log("cms: renderer refused the %d^3 color "
+				   "LUT\n", job->size);
+	}
+
+	cms_lut_job_destroy(job);
+
+	return 0;
+}
+
+/* Start computing the LUT taking sRGB content to the output profile */
+static void
+weston_cms_set_color_lut(struct weston_output *o,
+			 struct weston_color_profile *p)
+{
+	struct weston_renderer *renderer = o->compositor->renderer;
+	struct weston_config_section *section;
+	struct wl_event_loop *loop;
+	struct cms_lut_job *job;
+	cmsHPROFILE srgb;
+	int32_t size;
+
+	if (!renderer->output_set_color_lut)
+		return;
+
+	cms_lut_job_cancel_output(o);
+
+	section = weston_config_get_section(o->compositor->config,
+					    "core", NULL, NULL);
+	weston_config_section_get_int(section, "color-lut-size", &size, 0);
+	if (size != 0 && (size < 2 || size > CMS_LUT_MAX_SIZE)) {
+		weston_log("cms: color-lut-size %d is not within 2 and %d, "
+			   "not using a color LUT\n", size, CMS_LUT_MAX_SIZE);
+		size = 0;
+	}
+	if (!p || size < 2) {
+		renderer->output_set_color_lut(o, 0, NULL);
+		return;
+	}
+
+	job = zalloc(sizeof *job);
+	if (!job)
+		return;
+
+	job->size = size;
+	job->lut = malloc(size * size * size * 3);
+	if (!job->lut || pipe2(job->fd, O_CLOEXEC) < 0) {
+		free(job->lut);
+		free(job);
+		return;
+	}
+
+	srgb = cmsCreate_sRGBProfile();
+	job->transform = cmsCreateTransform(srgb, TYPE_RGB_8,
+					    p->lcms_handle, TYPE_RGB_8,
+					    INTENT_RELATIVE_COLORIMETRIC,
+					    cmsFLAGS_NOOPTIMIZE);
+	cmsCloseProfile(srgb);
+	if (!job->transform)
+		goto err;
+
+	loop = wl_display_get_event_loop(o->compositor->wl_display);
+	job->source = wl_event_loop_add_fd(loop, job->fd[0], WL_EVENT_READABLE,
+					   cms_lut_job_done, job);
+	if (!job->source)
+		goto err_transform;
+
+	job->output = o;
+	job->output_destroy_listener.notify =
+		cms_lut_job_handle_output_destroy;
+	wl_signal_add(&o->destroy_signal, &job->output_destroy_listener);
+	wl_list_insert(&cms_lut_jobs, &job->link);
+
+	if (pthread_create(&job->thread, NULL, cms_lut_job_thread, job) != 0) {
+		cms_lut_job_destroy(job);
+		return;
+	}
+
+	return;
+
+err_transform:
+	cmsDeleteTransform(job->transform);
+err:
+	close(job->fd[0]);
+	close(job->fd[1]);
+	free(job->lut);
+	free(job);
+}
+#endif
+
 void
 weston_cms_set_color_profile(struct weston_output *o,
 			     struct weston_color_profile *p)
@@ -67,6 +282,8 @@ weston_cms_set_color_profile(struct weston_output *o,
 	uint16_t *green = NULL;
 	uint16_t *blue = NULL;
 
+	weston_cms_set_color_lut(o, p);
+
 	if (!o->set_gamma)
 		return;
 	if (!p) {
@@ -35,6 +35,9 @@
 #include <linux/input.h>
 #include <linux/vt.h>
 #include <assert.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <dlfcn.h>
 #include <time.h>
@@ -57,11 +60,21 @@
 #include "vaapi-recorder.h"
 #include "presentation_timing-server-protocol.h"
 #include "linux-dmabuf.h"
+#include "linux-dmabuf-server-protocol.h"
+#include "timeline.h"
 
 #ifndef DRM_CAP_TIMESTAMP_MONOTONIC
 #define DRM_CAP_TIMESTAMP_MONOTONIC 0x6
 #endif
 
+#ifndef DRM_CAP_ASYNC_PAGE_FLIP
+#define DRM_CAP_ASYNC_PAGE_FLIP 0x7
+#endif
+
+#ifndef DRM_MODE_PAGE_FLIP_ASYNC
+#define DRM_MODE_PAGE_FLIP_ASYNC 0x02
+#endif
+
 #ifndef DRM_CAP_CURSOR_WIDTH
 #define DRM_CAP_CURSOR_WIDTH 0x8
 #endif
@@ -74,6 +87,21 @@
 #define GBM_BO_USE_CURSOR GBM_BO_USE_CURSOR_64X64
 #endif
 
+#ifndef DRM_CLIENT_CAP_UNIVERSAL_PLANES
+#define DRM_CLIENT_CAP_UNIVERSAL_PLANES 2
+#endif
+
+#ifndef DRM_CLIENT_CAP_ATOMIC
+#define DRM_CLIENT_CAP_ATOMIC 3
+#endif
+
+/* Values of the immutable "type" property of universal planes */
+enum wdrm_plane_type {
+	WDRM_PLANE_TYPE_OVERLAY = 0,
+	WDRM_PLANE_TYPE_PRIMARY = 1,
+	WDRM_PLANE_TYPE_CURSOR = 2,
+};
+
 static int option_current_mode = 0;
 
 enum output_config {
@@ -85,6 +113,18 @@ enum output_config {
 	OUTPUT_CONFIG_MODELINE
 };
 
+/* Hotplug uevents of a DRM device since its outputs were last updated.
+ * A burst of them is handled once, DRM_HOTPLUG_DEBOUNCE_MS after the
+ * last one. */
+struct drm_hotplug {
+	int pending;
+	/* The connector ids the uevents named, or all of them if one did
+	 * not name its connector */
+	uint32_t connectors;
+	int all;
+	struct udev_device *device; /* of the last uevent */
+};
+
 struct drm_backend {
 	struct weston_backend base;
 	struct weston_compositor *compositor;
@@ -94,6 +134,16 @@ struct drm_backend {
 
 	struct udev_monitor *udev_monitor;
 	struct wl_event_source *udev_drm_source;
+	struct drm_hotplug hotplug;
+	struct wl_event_source *hotplug_timer;
+
+	/* Parsed EDIDs, most recently used first, see
+	 * drm_edid_cache_get() */
+	struct wl_list edid_cache;
+	int edid_cache_length;
+
+	/* GEM handles of imported dmabufs, see drm_gem_handle_import() */
+	struct wl_list gem_handles;
 
 	struct {
 		int id;
@@ -122,6 +172,34 @@ struct drm_backend {
 
 	int cursors_are_broken;
 
+	/* Most overlay scanout, in MB/s, to put on one output, from
+	 * [core] overlay-bandwidth; 0 for no limit */
+	uint32_t overlay_bandwidth;
+
+	/* Further GPUs driving outputs, see struct drm_gpu; only
+	 * looked for with [core] secondary-gpus */
+	int use_secondary_gpus;
+	struct wl_list gpu_list;
+
+	/* Composite each output on its own thread, from [core]
+	 * render-threads; pixman renderer only */
+	int render_threads;
+
+	/* Trust the framebuffers to have survived a session switch,
+	 * from [core] session-fast-resume */
+	int fast_resume;
+
+	/* How long a backlight change takes, in ms, from [core]
+	 * backlight-ramp-time */
+	int backlight_ramp_ms;
+
+	/* Set when the kernel accepted DRM_CLIENT_CAP_ATOMIC; all
+	 * CRTC and plane state is then committed with one ioctl. */
+	int atomic_modeset;
+
+	/* DRM_MODE_PAGE_FLIP_ASYNC works, legacy page flips only */
+	int async_page_flip;
+
 	int use_pixman;
 
 	uint32_t prev_state;
@@ -130,6 +208,64 @@ struct drm_backend {
 
 	int32_t cursor_width;
 	int32_t cursor_height;
+
+	/* Flip and vblank events are read off the DRM fd by a separate
+	 * thread, so that busy clients cannot hold them back, and then
+	 * handled on the main loop in order. */
+	struct {
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		struct wl_list events; /* drm_flip_event::link */
+		uint32_t errors; /* enum drm_flip_error, for the main loop */
+		int poll_errno;
+		int wake_pipe[2]; /* thread -> main loop */
+		int quit_pipe[2]; /* main loop -> thread */
+		int running;
+	} flip;
+};
+
+/* weston_log() is main loop only, so the flip thread leaves these
+ * for on_drm_flip_events() to report */
+enum drm_flip_error {
+	DRM_FLIP_ERROR_NO_MEMORY = (1 << 0),
+	DRM_FLIP_ERROR_POLL = (1 << 1),
+};
+
+enum drm_flip_event_type {
+	DRM_FLIP_EVENT_PAGE_FLIP,
+	DRM_FLIP_EVENT_VBLANK,
+};
+
+struct drm_flip_event {
+	struct wl_list link;
+	enum drm_flip_event_type type;
+	unsigned int frame, sec, usec;
+	void *data;
+};
+
+/*
+ * A DRM device besides the one we render with, whose connectors are
+ * driven as outputs too.  Their frames are rendered on the primary GPU
+ * and imported as dmabufs, or copied into dumb buffers when the import
+ * cannot work.  Overlays and the cursor plane are not used on them.
+ */
+struct drm_gpu {
+	struct drm_backend *backend;
+	struct wl_list link;		/* drm_backend::gpu_list */
+
+	struct udev_device *device;
+	int id;
+	int fd;
+	char *filename;
+	struct wl_event_source *source;
+
+	/* Whether PRIME buffers from the primary GPU can be imported */
+	int prime_import;
+
+	uint32_t crtc_allocator;
+	uint32_t connector_allocator;
+
+	struct drm_hotplug hotplug;
 };
 
 struct drm_mode {
@@ -139,18 +275,157 @@ struct drm_mode {
 
 struct drm_output;
 
+/* Cursor image cache entry, keyed by the buffer it was copied from */
+struct drm_cursor_bo {
+	struct gbm_bo *bo;
+	struct weston_buffer *buffer;
+	struct wl_listener buffer_destroy_listener;
+	uint32_t *pixels; /* what was last written into bo */
+	uint32_t last_used;
+};
+
+/* Client dmabuf imported for the cursor plane */
+struct drm_cursor_import {
+	struct gbm_bo *bo;
+	struct weston_buffer_reference buffer_ref;
+};
+
+#define DRM_CURSOR_CACHE_SIZE 4
+
+/* Where a view lands on a plane: the part of its buffer shown, in the
+ * 16.16 fixed point KMS takes, and the part of the CRTC it covers */
+struct drm_plane_rect {
+	uint32_t src_x, src_y, src_w, src_h;
+	int32_t dest_x, dest_y, dest_w, dest_h;
+};
+
 struct drm_fb {
 	struct drm_output *output;
 	uint32_t fb_id, stride, handle, size;
 	int fd;
 	int is_client_buffer;
+	/* A client buffer scaled or cropped onto the primary plane */
+	int scanout_scaled;
+	struct drm_plane_rect scanout_rect;
 	struct weston_buffer_reference buffer_ref;
+	/* Client buffers: the release sent once the fb is off screen,
+	 * and the acquire fence, -1 if it was none */
+	struct weston_buffer_release_reference buffer_release_ref;
+	int acquire_fence_fd;
+
+	/* Emitted before the fb goes away, for anything caching it */
+	struct wl_signal destroy_signal;
 
 	/* Used by gbm fbs */
 	struct gbm_bo *bo;
 
 	/* Used by dumb fbs */
 	void *map;
+
+	/* Used by dmabuf fbs, imported GEM handles */
+	int is_dmabuf;
+	struct drm_backend *backend;
+	uint32_t gem_handles[MAX_DMABUF_PLANES];
+};
+
+/* The kernel hands out one GEM handle per buffer and fd, so fbs of the
+ * same dmabuf share it; it is closed with the last of them. Handles
+ * gbm may be using too are left to gbm, see drm_fb_get_from_dmabuf(). */
+struct drm_gem_handle {
+	int fd;
+	uint32_t handle;
+	int refcount;
+	struct wl_list link;
+};
+
+/* KMS property IDs used to build atomic requests, zero if missing */
+struct drm_plane_props {
+	uint32_t fb_id, crtc_id;
+	uint32_t src_x, src_y, src_w, src_h;
+	uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+	uint32_t in_fence_fd;	/* optional */
+	uint32_t rotation;	/* optional */
+	uint32_t rotation_supported; /* DRM_ROTATE_* bits it takes */
+};
+
+/* Bits of the plane "rotation" property, rotations are
+ * counter-clockwise */
+#define DRM_ROTATE_0	(1 << 0)
+#define DRM_ROTATE_90	(1 << 1)
+#define DRM_ROTATE_180	(1 << 2)
+#define DRM_ROTATE_270	(1 << 3)
+
+/* The planes drm_assign_planes() tries a view on, in that order */
+enum drm_plane_try {
+	DRM_PLANE_TRY_CURSOR,
+	DRM_PLANE_TRY_SCANOUT,
+	DRM_PLANE_TRY_OVERLAY,
+	DRM_PLANE_TRY_COUNT
+};
+
+/* Why a view could not go on a plane */
+enum drm_plane_reject {
+	DRM_REJECT_NONE = 0,
+	DRM_REJECT_DISABLED,	/* no GBM, or turned off by debug binding */
+	DRM_REJECT_OCCLUDED,	/* below something on the primary plane */
+	DRM_REJECT_OUTPUTS,	/* shown on more than one output */
+	DRM_REJECT_BUFFER,	/* no buffer, or a kind the plane cannot use */
+	DRM_REJECT_SHM,
+	DRM_REJECT_ALPHA,
+	DRM_REJECT_TRANSFORM,	/* rotation or buffer transform */
+	DRM_REJECT_GEOMETRY,	/* position, size, scaling or clipping */
+	DRM_REJECT_FORMAT,	/* pixel format or dmabuf flags */
+	DRM_REJECT_IMPORT,	/* importing the buffer or its fb failed */
+	DRM_REJECT_NO_PLANE,	/* every suitable plane already taken */
+	DRM_REJECT_KMS_TEST,	/* the atomic test commit failed */
+	DRM_REJECT_COST,	/* saves less than the views given the planes */
+	DRM_REJECT_BANDWIDTH,	/* would exceed overlay-bandwidth */
+	DRM_REJECT_FENCE,	/* unsignalled fence the plane cannot wait for */
+	DRM_REJECT_COUNT
+};
+
+static const char * const drm_plane_try_names[DRM_PLANE_TRY_COUNT] = {
+	"cursor", "scanout", "overlay"
+};
+
+static const char * const drm_plane_reject_names[DRM_REJECT_COUNT] = {
+	[DRM_REJECT_NONE] = "none",
+	[DRM_REJECT_DISABLED] = "disabled",
+	[DRM_REJECT_OCCLUDED] = "occluded",
+	[DRM_REJECT_OUTPUTS] = "outputs",
+	[DRM_REJECT_BUFFER] = "buffer",
+	[DRM_REJECT_SHM] = "shm",
+	[DRM_REJECT_ALPHA] = "alpha",
+	[DRM_REJECT_TRANSFORM] = "transform",
+	[DRM_REJECT_GEOMETRY] = "geometry",
+	[DRM_REJECT_FORMAT] = "format",
+	[DRM_REJECT_IMPORT] = "import",
+	[DRM_REJECT_NO_PLANE] = "no_plane",
+	[DRM_REJECT_KMS_TEST] = "kms_test",
+	[DRM_REJECT_COST] = "cost",
+	[DRM_REJECT_BANDWIDTH] = "bandwidth",
+	[DRM_REJECT_FENCE] = "fence",
+};
+
+/* Timeline point names, one per reason, as the ring buffer wants
+ * string literals */
+static const char * const drm_plane_reject_points[DRM_REJECT_COUNT] = {
+	[DRM_REJECT_NONE] = "drm_reject_none",
+	[DRM_REJECT_DISABLED] = "drm_reject_disabled",
+	[DRM_REJECT_OCCLUDED] = "drm_reject_occluded",
+	[DRM_REJECT_OUTPUTS] = "drm_reject_outputs",
+	[DRM_REJECT_BUFFER] = "drm_reject_buffer",
+	[DRM_REJECT_SHM] = "drm_reject_shm",
+	[DRM_REJECT_ALPHA] = "drm_reject_alpha",
+	[DRM_REJECT_TRANSFORM] = "drm_reject_transform",
+	[DRM_REJECT_GEOMETRY] = "drm_reject_geometry",
+	[DRM_REJECT_FORMAT] = "drm_reject_format",
+	[DRM_REJECT_IMPORT] = "drm_reject_import",
+	[DRM_REJECT_NO_PLANE] = "drm_reject_no_plane",
+	[DRM_REJECT_KMS_TEST] = "drm_reject_kms_test",
+	[DRM_REJECT_COST] = "drm_reject_cost",
+	[DRM_REJECT_BANDWIDTH] = "drm_reject_bandwidth",
+	[DRM_REJECT_FENCE] = "drm_reject_fence",
 };
 
 struct drm_edid {
@@ -160,6 +435,18 @@ struct drm_edid {
 	char serial_number[13];
 };
 
+struct drm_edid_cache_entry {
+	struct wl_list link; /* drm_backend::edid_cache */
+	uint32_t hash;
+	uint8_t *data;
+	size_t length;
+	int valid; /* whether edid_parse() took it */
+	struct drm_edid edid;
+};
+
+#define DRM_EDID_CACHE_SIZE 16
+#define DRM_HOTPLUG_DEBOUNCE_MS 100
+
 struct drm_output {
 	struct weston_output   base;
 
@@ -171,18 +458,63 @@ struct drm_output {
 	drmModePropertyPtr dpms_prop;
 	uint32_t format;
 
+	/* atomic modesetting property IDs */
+	uint32_t connector_prop_crtc_id;
+	uint32_t crtc_prop_mode_id;
+	uint32_t crtc_prop_active;
+	/* [output] adaptive-sync on a vrr_capable connector, zero if
+	 * not wanted or possible */
+	uint32_t crtc_prop_vrr_enabled;
+	int adaptive_sync_requested;
+
+	/* The planes' rotation doing weston_output::scanout_transform,
+	 * 0 if the renderer does the [output] transform */
+	uint32_t hw_rotation;
+
+	/* [output] render-size, the size drawn at before the primary
+	 * plane scales up to the mode; zero if not configured */
+	int32_t render_size_width, render_size_height;
+	/* universal planes driving this CRTC, atomic mode only */
+	struct drm_sprite *primary_sprite;
+	struct drm_sprite *cursor_sprite;
+
 	enum dpms_enum dpms;
 
 	int vblank_pending;
 	int page_flip_pending;
 	int destroy_pending;
+	/* next is a client buffer to show without waiting for vblank,
+	 * and the pending flip was queued that way */
+	int next_async;
+	int page_flip_async;
+
+	/* The pixman renderer composites this output on a thread and
+	 * calls drm_output_render_done() to flip, and with GL the flip
+	 * waits for render_fence_fd to signal; render_pending is set
+	 * from repaint until then. */
+	int render_thread;
+	int render_pending;
+	int render_fence_fd;
+	struct wl_event_source *render_fence_source;
 
 	struct gbm_surface *surface;
-	struct gbm_bo *cursor_bo[2];
+	struct drm_cursor_bo cursor_bo[DRM_CURSOR_CACHE_SIZE];
+	struct drm_cursor_bo *cursor_current;
+	uint32_t cursor_serial;
+	uint32_t *cursor_scratch;
+	/* The import on screen, and the one before it which the
+	 * hardware may still be scanning out until the next update */
+	struct drm_cursor_import cursor_import[2];
+	int cursor_import_current;
 	struct weston_plane cursor_plane;
 	struct weston_plane fb_plane;
 	struct weston_view *cursor_view;
-	int current_cursor;
+	/* A cursor layer view right below cursor_view, such as a drag
+	 * icon, composed into the same cursor image. cursor_under_dx/dy
+	 * is its offset from cursor_view when the image was last made. */
+	struct weston_view *cursor_under;
+	int cursor_composed;
+	int32_t cursor_under_dx, cursor_under_dy;
 	struct drm_fb *current, *next;
 	struct backlight *backlight;
 
@@ -191,8 +523,26 @@ struct drm_output {
 	int current_image;
 	pixman_region32_t previous_damage;
 
+	/* Set for outputs on a secondary GPU. With gpu_copy, GL frames
+	 * are read back into the dumb buffers above from the frame
+	 * signal, gpu_copy_damage saying which part of them is stale. */
+	struct drm_gpu *gpu;
+	int gpu_copy;
+	uint8_t *gpu_copy_pixels;
+	pixman_region32_t gpu_copy_damage;
+	struct wl_listener gpu_copy_listener;
+
 	struct vaapi_recorder *recorder;
 	struct wl_listener recorder_frame_listener;
+	/* drm_recorder_fb: the fbs the recorder holds an import of */
+	struct wl_list recorder_fb_list;
+
+	/* Plane assignment statistics since the last dump, only views
+	 * ending up on the primary plane count as rejected */
+	uint32_t plane_stats_repaints;
+	uint32_t plane_assigned[DRM_PLANE_TRY_COUNT];
+	uint32_t plane_rejects[DRM_PLANE_TRY_COUNT][DRM_REJECT_COUNT];
+	int plane_stats_dump_views;
 };
 
 /*
@@ -211,6 +561,8 @@ struct drm_sprite {
 	uint32_t possible_crtcs;
 	uint32_t plane_id;
 	uint32_t count_formats;
+	enum wdrm_plane_type type;
+	struct drm_plane_props props;
 
 	int32_t src_x, src_y;
 	uint32_t src_w, src_h;
@@ -237,6 +589,41 @@ drm_output_set_cursor(struct drm_output *output);
 static void
 drm_output_update_msc(struct drm_output *output, unsigned int seq);
 
+static struct weston_plane *
+drm_plane_reject(enum drm_plane_reject *reject, enum drm_plane_reject reason)
+{
+	*reject = reason;
+
+	return NULL;
+}
+
+/**
+ * Check whether a view's acquire fence allows putting it on a plane
+ *
+ * @param b DRM backend
+ * @param ev The view to check
+ * @param s The plane, NULL for the cursor which is written by the CPU
+ * @returns true if KMS can wait for the fence or it has signalled
+ */
+static bool
+drm_view_fence_ready(struct drm_backend *b, struct weston_view *ev,
+		     struct drm_sprite *s)
+{
+	struct pollfd pfd;
+
+	if (ev->surface->acquire_fence_fd < 0)
+		return true;
+
+	if (b->atomic_modeset && s && s->props.in_fence_fd)
+		return true;
+
+	/* A sync_file polls readable once signalled */
+	pfd.fd = ev->surface->acquire_fence_fd;
+	pfd.events = POLLIN;
+
+	return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+
 static int
 drm_sprite_crtc_supported(struct drm_output *output, uint32_t supported)
 {
@@ -244,6 +631,10 @@ drm_sprite_crtc_supported(struct drm_output *output, uint32_t supported)
 	struct drm_backend *b =(struct drm_backend *)ec->backend;
 	int crtc;
 
+	/* Planes of the primary GPU cannot show on another one */
+	if (output->gpu)
+		return 0;
+
 	for (crtc = 0; crtc < b->num_crtcs; crtc++) {
 		if (b->crtcs[crtc] != output->crtc_id)
 			continue;
@@ -255,22 +646,62 @@ drm_sprite_crtc_supported(struct drm_output *output, uint32_t supported)
 	return 0;
 }
 
+/* Views can only go on a plane that rotates along with the output */
+static int
+drm_sprite_rotation_supported(struct drm_output *output, struct drm_sprite *s)
+{
+	return !output->hw_rotation ||
+		(s->props.rotation_supported & output->hw_rotation);
+}
+
+/* The DRM fd an output's CRTC and connector belong to */
+static int
+drm_output_fd(struct drm_output *output)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+
+	return output->gpu ? output->gpu->fd : b->drm.fd;
+}
+
+/* Dropping the release after the flip away from the fb means the
+ * client gets it once scanout is done with the buffer */
+static void
+drm_fb_clear_buffer(struct drm_fb *fb)
+{
+	weston_buffer_reference(&fb->buffer_ref, NULL);
+	weston_buffer_release_reference(&fb->buffer_release_ref, NULL);
+	if (fb->acquire_fence_fd >= 0)
+		close(fb->acquire_fence_fd);
+	fb->acquire_fence_fd = -1;
+}
+
 static void
 drm_fb_destroy_callback(struct gbm_bo *bo, void *data)
 {
 	struct drm_fb *fb = data;
-	struct gbm_device *gbm = gbm_bo_get_device(bo);
+	struct drm_gem_close gem_close;
 
+	wl_signal_emit(&fb->destroy_signal, fb);
+
+	/* fb->fd is a secondary GPU for frames imported there, which
+	 * then own the GEM handle they were imported as */
 	if (fb->fb_id)
-		drmModeRmFB(gbm_device_get_fd(gbm), fb->fb_id);
+		drmModeRmFB(fb->fd, fb->fb_id);
 
-	weston_buffer_reference(&fb->buffer_ref, NULL);
+	if (fb->gem_handles[0]) {
+		memset(&gem_close, 0, sizeof gem_close);
+		gem_close.handle = fb->gem_handles[0];
+		drmIoctl(fb->fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+	}
+
+	drm_fb_clear_buffer(fb);
 
 	free(data);
 }
 
 static struct drm_fb *
-drm_fb_create_dumb(struct drm_backend *b, unsigned width, unsigned height)
+drm_fb_create_dumb(int drm_fd, unsigned width, unsigned height)
 {
 	struct drm_fb *fb;
 	int ret;
@@ -282,22 +713,24 @@ drm_fb_create_dumb(struct drm_backend *b, unsigned width, unsigned height)
 	fb = zalloc(sizeof *fb);
 	if (!fb)
 		return NULL;
+	fb->acquire_fence_fd = -1;
+	wl_signal_init(&fb->destroy_signal);
 
 	memset(&create_arg, 0, sizeof create_arg);
 	create_arg.bpp = 32;
 	create_arg.width = width;
 	create_arg.height = height;
 
-	ret = drmIoctl(b->drm.fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_arg);
+	ret = drmIoctl(drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &create_arg);
 	if (ret)
 		goto err_fb;
 
 	fb->handle = create_arg.handle;
 	fb->stride = create_arg.pitch;
 	fb->size = create_arg.size;
-	fb->fd = b->drm.fd;
+	fb->fd = drm_fd;
 
-	ret = drmModeAddFB(b->drm.fd, width, height, 24, 32,
+	ret = drmModeAddFB(drm_fd, width, height, 24, 32,
 			   fb->stride, fb->handle, &fb->fb_id);
 	if (ret)
 		goto err_bo;
@@ -309,18 +742,18 @@ drm_fb_create_dumb(struct drm_backend *b, unsigned width, unsigned height)
 		goto err_add_fb;
 
 	fb->map = mmap(0, fb->size, PROT_WRITE,
-		       MAP_SHARED, b->drm.fd, map_arg.offset);
+		       MAP_SHARED, drm_fd, map_arg.offset);
 	if (fb->map == MAP_FAILED)
 		goto err_add_fb;
 
 	return fb;
 
 err_add_fb:
-	drmModeRmFB(b->drm.fd, fb->fb_id);
+	drmModeRmFB(drm_fd, fb->fb_id);
 err_bo:
 	memset(&destroy_arg, 0, sizeof(destroy_arg));
 	destroy_arg.handle = create_arg.handle;
-	drmIoctl(b->drm.fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_arg);
+	drmIoctl(drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy_arg);
 err_fb:
 	free(fb);
 	return NULL;
@@ -334,10 +767,12 @@ drm_fb_destroy_dumb(struct drm_fb *fb)
 	if (!fb->map)
 		return;
 
+	wl_signal_emit(&fb->destroy_signal, fb);
+
 	if (fb->fb_id)
 		drmModeRmFB(fb->fd, fb->fb_id);
 
-	weston_buffer_reference(&fb->buffer_ref, NULL);
+	drm_fb_clear_buffer(fb);
 
 	munmap(fb->map, fb->size);
 
@@ -363,6 +798,8 @@ drm_fb_get_from_bo(struct gbm_bo *bo,
 	fb = zalloc(sizeof *fb);
 	if (fb == NULL)
 		return NULL;
+	fb->acquire_fence_fd = -1;
+	wl_signal_init(&fb->destroy_signal);
 
 	fb->bo = bo;
 
@@ -415,775 +852,2604 @@ err_free:
 	return NULL;
 }
 
-static void
-drm_fb_set_buffer(struct drm_fb *fb, struct weston_buffer *buffer)
-{
-	assert(fb->buffer_ref.buffer == NULL);
-
-	fb->is_client_buffer = 1;
-
-	weston_buffer_reference(&fb->buffer_ref, buffer);
-}
-
-static void
-drm_output_release_fb(struct drm_output *output, struct drm_fb *fb)
+/**
+ * Get a framebuffer on a secondary GPU for a bo rendered on the primary
+ *
+ * The bo is shared as a dmabuf and imported with PRIME.  Like with
+ * drm_fb_get_from_bo(), the fb stays attached to the bo so that it is
+ * only imported once.
+ */
+static struct drm_fb *
+drm_fb_get_from_bo_for_gpu(struct gbm_bo *bo, struct drm_gpu *gpu,
+			   uint32_t format)
 {
-	if (!fb)
-		return;
+#ifdef HAVE_GBM_FD_IMPORT
+	struct drm_fb *fb = gbm_bo_get_user_data(bo);
+	struct drm_gem_close gem_close;
+	uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	uint32_t width, height;
+	int fd, ret;
 
-	if (fb->map &&
-            (fb != output->dumb[0] && fb != output->dumb[1])) {
-		drm_fb_destroy_dumb(fb);
-	} else if (fb->bo) {
-		if (fb->is_client_buffer)
-			gbm_bo_destroy(fb->bo);
-		else
-			gbm_surface_release_buffer(output->surface,
-						   fb->bo);
-	}
-}
+	if (fb)
+		return fb;
 
-static uint32_t
-drm_output_check_scanout_format(struct drm_output *output,
-				struct weston_surface *es, struct gbm_bo *bo)
-{
-	uint32_t format;
-	pixman_region32_t r;
+	fb = zalloc(sizeof *fb);
+	if (fb == NULL)
+		return NULL;
+	fb->acquire_fence_fd = -1;
+	wl_signal_init(&fb->destroy_signal);
 
-	format = gbm_bo_get_format(bo);
+	fb->bo = bo;
+	fb->fd = gpu->fd;
+	fb->stride = gbm_bo_get_stride(bo);
+	width = gbm_bo_get_width(bo);
+	height = gbm_bo_get_height(bo);
+	fb->size = fb->stride * height;
 
-	if (format == GBM_FORMAT_ARGB8888) {
-		/* We can scanout an ARGB buffer if the surface's
-		 * opaque region covers the whole output, but we have
-		 * to use XRGB as the KMS format code. */
-		pixman_region32_init_rect(&r, 0, 0,
-					  output->base.width,
-					  output->base.height);
-		pixman_region32_subtract(&r, &r, &es->opaque);
+	fd = gbm_bo_get_fd(bo);
+	if (fd < 0)
+		goto err_free;
 
-		if (!pixman_region32_not_empty(&r))
-			format = GBM_FORMAT_XRGB8888;
+	ret = drmPrimeFDToHandle(gpu->fd, fd, &fb->handle);
+	close(fd);
+	if (ret)
+		goto err_free;
+	fb->gem_handles[0] = fb->handle;
 
-		pixman_region32_fini(&r);
+	handles[0] = fb->handle;
+	pitches[0] = fb->stride;
+	ret = drmModeAddFB2(gpu->fd, width, height, format,
+			    handles, pitches, offsets, &fb->fb_id, 0);
+	if (ret)
+		ret = drmModeAddFB(gpu->fd, width, height, 24, 32,
+				   fb->stride, fb->handle, &fb->fb_id);
+	if (ret) {
+		memset(&gem_close, 0, sizeof gem_close);
+		gem_close.handle = fb->handle;
+		drmIoctl(gpu->fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+		goto err_free;
 	}
 
-	if (output->format == format)
-		return format;
+	gbm_bo_set_user_data(bo, fb, drm_fb_destroy_callback);
 
-	return 0;
+	return fb;
+
+err_free:
+	free(fb);
+#endif
+	return NULL;
 }
 
-static struct weston_plane *
-drm_output_prepare_scanout_view(struct drm_output *output,
-				struct weston_view *ev)
+static int
+drm_gem_handle_import(struct drm_backend *b, int fd, int prime_fd,
+		      uint32_t *handle)
 {
-	struct drm_backend *b =
-		(struct drm_backend *)output->base.compositor->backend;
-	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
-	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
-	struct gbm_bo *bo;
-	uint32_t format;
-
-	if (ev->geometry.x != output->base.x ||
-	    ev->geometry.y != output->base.y ||
-	    buffer == NULL || b->gbm == NULL ||
-	    buffer->width != output->base.current_mode->width ||
-	    buffer->height != output->base.current_mode->height ||
-	    output->base.transform != viewport->buffer.transform ||
-	    ev->transform.enabled)
-		return NULL;
-
-	if (ev->geometry.scissor_enabled)
-		return NULL;
-
-	bo = gbm_bo_import(b->gbm, GBM_BO_IMPORT_WL_BUFFER,
-			   buffer->resource, GBM_BO_USE_SCANOUT);
+	struct drm_gem_handle *h;
 
-	/* Unable to use the buffer for scanout */
-	if (!bo)
-		return NULL;
+	if (drmPrimeFDToHandle(fd, prime_fd, handle) < 0)
+		return -1;
 
-	format = drm_output_check_scanout_format(output, ev->surface, bo);
-	if (format == 0) {
-		gbm_bo_destroy(bo);
-		return NULL;
+	wl_list_for_each(h, &b->gem_handles, link) {
+		if (h->fd == fd && h->handle == *handle) {
+			h->refcount++;
+			return 0;
+		}
 	}
 
-	output->next = drm_fb_get_from_bo(bo, b, format);
-	if (!output->next) {
-		gbm_bo_destroy(bo);
-		return NULL;
-	}
+	/* Leaks the handle on failure rather than closing one that
+	 * something else may have imported as well */
+	h = zalloc(sizeof *h);
+	if (!h)
+		return -1;
 
-	drm_fb_set_buffer(output->next, buffer);
+	h->fd = fd;
+	h->handle = *handle;
+	h->refcount = 1;
+	wl_list_insert(&b->gem_handles, &h->link);
 
-	return &output->fb_plane;
+	return 0;
 }
 
 static void
-drm_output_render_gl(struct drm_output *output, pixman_region32_t *damage)
+drm_gem_handle_unref(struct drm_backend *b, int fd, uint32_t handle)
 {
-	struct drm_backend *b =
-		(struct drm_backend *)output->base.compositor->backend;
-	struct gbm_bo *bo;
+	struct drm_gem_handle *h;
+	struct drm_gem_close gem_close;
 
-	output->base.compositor->renderer->repaint_output(&output->base,
-							  damage);
+	wl_list_for_each(h, &b->gem_handles, link) {
+		if (h->fd != fd || h->handle != handle)
+			continue;
 
-	bo = gbm_surface_lock_front_buffer(output->surface);
-	if (!bo) {
-		weston_log("failed to lock front buffer: %m\n");
-		return;
-	}
+		if (--h->refcount > 0)
+			return;
 
-	output->next = drm_fb_get_from_bo(bo, b, output->format);
-	if (!output->next) {
-		weston_log("failed to get drm_fb for bo\n");
-		gbm_surface_release_buffer(output->surface, bo);
+		wl_list_remove(&h->link);
+		free(h);
+
+		memset(&gem_close, 0, sizeof gem_close);
+		gem_close.handle = handle;
+		drmIoctl(fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
 		return;
 	}
 }
 
 static void
-drm_output_render_pixman(struct drm_output *output, pixman_region32_t *damage)
+drm_fb_destroy_dmabuf(struct drm_fb *fb)
 {
-	struct weston_compositor *ec = output->base.compositor;
-	pixman_region32_t total_damage, previous_damage;
+	int i;
 
-	pixman_region32_init(&total_damage);
-	pixman_region32_init(&previous_damage);
+	wl_signal_emit(&fb->destroy_signal, fb);
 
-	pixman_region32_copy(&previous_damage, damage);
+	if (fb->fb_id)
+		drmModeRmFB(fb->fd, fb->fb_id);
 
-	pixman_region32_union(&total_damage, damage, &output->previous_damage);
-	pixman_region32_copy(&output->previous_damage, &previous_damage);
+	drm_fb_clear_buffer(fb);
 
-	output->current_image ^= 1;
+	if (fb->bo) {
+		gbm_bo_destroy(fb->bo);
+		free(fb);
+		return;
+	}
 
-	output->next = output->dumb[output->current_image];
-	pixman_renderer_output_set_buffer(&output->base,
-					  output->image[output->current_image]);
+	/* Every plane holds a reference, also where planes of one
+	 * dmabuf got the same handle */
+	for (i = 0; i < MAX_DMABUF_PLANES; i++)
+		if (fb->gem_handles[i])
+			drm_gem_handle_unref(fb->backend, fb->fd,
+					     fb->gem_handles[i]);
 
-	ec->renderer->repaint_output(&output->base, &total_damage);
+	free(fb);
+}
+
+/**
+ * Add a framebuffer with explicit format modifiers
+ *
+ * A zero modifier on every plane leaves the layout to the driver, as
+ * drmModeAddFB2() does. Otherwise the modifiers are passed on, which
+ * requires DRM_MODE_FB_MODIFIERS support from the kernel headers and
+ * the driver.
+ */
+static int
+drm_fb_add_dmabuf(struct drm_fb *fb, struct linux_dmabuf_buffer *dmabuf,
+		  uint32_t format, uint32_t handles[4],
+		  uint32_t pitches[4], uint32_t offsets[4])
+{
+#ifdef DRM_MODE_FB_MODIFIERS
+	struct drm_mode_fb_cmd2 cmd;
+#endif
+	int i, has_modifiers = 0;
+
+	for (i = 0; i < dmabuf->n_planes; i++)
+		if (dmabuf->modifier[i] != 0)
+			has_modifiers = 1;
+
+	if (!has_modifiers)
+		return drmModeAddFB2(fb->fd, dmabuf->width, dmabuf->height,
+				     format, handles, pitches, offsets,
+				     &fb->fb_id, 0);
+
+#ifdef DRM_MODE_FB_MODIFIERS
+	memset(&cmd, 0, sizeof cmd);
+	cmd.width = dmabuf->width;
+	cmd.height = dmabuf->height;
+	cmd.pixel_format = format;
+	cmd.flags = DRM_MODE_FB_MODIFIERS;
+	for (i = 0; i < 4; i++) {
+		cmd.handles[i] = handles[i];
+		cmd.pitches[i] = pitches[i];
+		cmd.offsets[i] = offsets[i];
+		if (i < dmabuf->n_planes)
+			cmd.modifier[i] = dmabuf->modifier[i];
+	}
+
+	if (drmIoctl(fb->fd, DRM_IOCTL_MODE_ADDFB2, &cmd))
+		return -1;
+
+	fb->fb_id = cmd.fb_id;
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/**
+ * Create a KMS framebuffer for a linux_dmabuf buffer
+ *
+ * All planes of the buffer are imported, so that multi-planar YUV
+ * formats can be scanned out as they are.
+ *
+ * @param dmabuf The buffer to import
+ * @param backend DRM backend structure
+ * @param format KMS format code to use, may differ from the buffer's
+ * @returns the framebuffer, or NULL on failure
+ */
+static struct drm_fb *
+drm_fb_get_from_dmabuf(struct linux_dmabuf_buffer *dmabuf,
+		       struct drm_backend *backend, uint32_t format)
+{
+	struct drm_fb *fb;
+	uint32_t handles[4] = { 0 }, pitches[4] = { 0 }, offsets[4] = { 0 };
+	int i;
+
+	if (backend->no_addfb2)
+		return NULL;
+
+	if (backend->min_width > (uint32_t)dmabuf->width ||
+	    (uint32_t)dmabuf->width > backend->max_width ||
+	    backend->min_height > (uint32_t)dmabuf->height ||
+	    (uint32_t)dmabuf->height > backend->max_height)
+		return NULL;
+
+	fb = zalloc(sizeof *fb);
+	if (fb == NULL)
+		return NULL;
+	fb->acquire_fence_fd = -1;
+	wl_signal_init(&fb->destroy_signal);
+
+	fb->is_dmabuf = 1;
+	fb->backend = backend;
+	fb->fd = backend->drm.fd;
+
+#ifdef HAVE_GBM_FD_IMPORT
+	/* The renderer imports client dmabufs through the same gbm
+	 * device, and gets the same GEM handle; importing through gbm
+	 * leaves closing it to gbm. Only single plane buffers without
+	 * modifiers can go that way. */
+	if (dmabuf->n_planes == 1 && dmabuf->modifier[0] == 0) {
+		struct gbm_import_fd_data gbm_dmabuf = {
+			.fd     = dmabuf->dmabuf_fd[0],
+			.width  = dmabuf->width,
+			.height = dmabuf->height,
+			.stride = dmabuf->stride[0],
+			.format = dmabuf->format
+		};
+
+		fb->bo = gbm_bo_import(backend->gbm, GBM_BO_IMPORT_FD,
+				       &gbm_dmabuf, GBM_BO_USE_SCANOUT);
+		if (!fb->bo)
+			goto err;
+
+		handles[0] = gbm_bo_get_handle(fb->bo).u32;
+		pitches[0] = dmabuf->stride[0];
+		offsets[0] = dmabuf->offset[0];
+	}
+#endif
+
+	for (i = 0; !fb->bo && i < dmabuf->n_planes; i++) {
+		if (drm_gem_handle_import(backend, fb->fd,
+					  dmabuf->dmabuf_fd[i],
+					  &fb->gem_handles[i]) < 0) {
+			fb->gem_handles[i] = 0;
+			goto err;
+		}
+
+		handles[i] = fb->gem_handles[i];
+		pitches[i] = dmabuf->stride[i];
+		offsets[i] = dmabuf->offset[i];
+	}
+
+	fb->handle = handles[0];
+	fb->stride = pitches[0];
+
+	if (drm_fb_add_dmabuf(fb, dmabuf, format,
+			      handles, pitches, offsets) != 0) {
+		fb->fb_id = 0;
+		goto err;
+	}
+
+	return fb;
+
+err:
+	drm_fb_destroy_dmabuf(fb);
+	return NULL;
+}
+
+static void
+drm_fb_set_buffer(struct drm_fb *fb, struct weston_surface *surface)
+{
+	assert(fb->buffer_ref.buffer == NULL);
+
+	fb->is_client_buffer = 1;
+
+	weston_buffer_reference(&fb->buffer_ref, surface->buffer_ref.buffer);
+	weston_buffer_release_reference(&fb->buffer_release_ref,
+					surface->buffer_release_ref.buffer_release);
+	if (surface->acquire_fence_fd >= 0)
+		fb->acquire_fence_fd = dup(surface->acquire_fence_fd);
+}
+
+static void
+drm_output_release_fb(struct drm_output *output, struct drm_fb *fb)
+{
+	if (!fb)
+		return;
+
+	if (fb->map &&
+            (fb != output->dumb[0] && fb != output->dumb[1])) {
+		drm_fb_destroy_dumb(fb);
+	} else if (fb->is_dmabuf) {
+		drm_fb_destroy_dmabuf(fb);
+	} else if (fb->bo) {
+		if (fb->is_client_buffer)
+			gbm_bo_destroy(fb->bo);
+		else
+			gbm_surface_release_buffer(output->surface,
+						   fb->bo);
+	}
+}
+
+static uint32_t
+drm_output_check_scanout_format(struct drm_output *output,
+				struct weston_surface *es, uint32_t format)
+{
+	pixman_region32_t r;
+	uint32_t i;
+
+	if (format == GBM_FORMAT_ARGB8888) {
+		/* We can scanout an ARGB buffer if the surface's
+		 * opaque region covers the whole output, but we have
+		 * to use XRGB as the KMS format code. */
+		pixman_region32_init_rect(&r, 0, 0,
+					  output->base.width,
+					  output->base.height);
+		pixman_region32_subtract(&r, &r, &es->opaque);
+
+		if (!pixman_region32_not_empty(&r))
+			format = GBM_FORMAT_XRGB8888;
+
+		pixman_region32_fini(&r);
+	}
+
+	if (output->format != format)
+		return 0;
+
+	/* With atomic modesetting we know what the primary plane takes;
+	 * YUV and the like are left to the overlay planes */
+	if (output->primary_sprite) {
+		for (i = 0; i < output->primary_sprite->count_formats; i++)
+			if (output->primary_sprite->formats[i] == format)
+				return format;
+
+		return 0;
+	}
+
+	return format;
+}
+
+static int
+drm_output_test_atomic(struct drm_output *output);
+
+/* Work out the plane rectangles for a view that is only scaled and
+ * moved on the output. Returns DRM_REJECT_NONE if it can be shown
+ * that way. */
+static enum drm_plane_reject
+drm_view_get_plane_rect(struct drm_output *output, struct weston_view *ev,
+			struct drm_plane_rect *rect)
+{
+	struct weston_matrix matrix;
+	enum wl_output_transform transform;
+	float scalex, scaley, transx, transy;
+	pixman_region32_t dest_rect, src_rect;
+	pixman_box32_t *box, tbox;
+	int32_t sx1, sy1, sx2, sy2;
+
+	weston_view_to_output_matrix(ev, &output->base, false, &matrix);
+
+	if (!weston_matrix_to_transform(&matrix, &transform,
+					&scalex, &scaley,
+					&transx, &transy))
+		return DRM_REJECT_TRANSFORM;
+
+	if (transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		return DRM_REJECT_TRANSFORM;
+
+	/*
+	 * Calculate the source & dest rects properly based on actual
+	 * position (note the caller has called weston_view_update_transform()
+	 * for us already).
+	 */
+	pixman_region32_init(&dest_rect);
+	pixman_region32_intersect(&dest_rect, &ev->transform.boundingbox,
+				  &output->base.region);
+	weston_matrix_transform_region(&dest_rect, &output->base.matrix, &dest_rect);
+	box = pixman_region32_extents(&dest_rect);
+
+	rect->dest_x = box->x1;
+	rect->dest_y = box->y1;
+	rect->dest_w = box->x2 - box->x1;
+	rect->dest_h = box->y2 - box->y1;
+	pixman_region32_fini(&dest_rect);
+
+	pixman_region32_init(&src_rect);
+	pixman_region32_intersect(&src_rect, &ev->transform.boundingbox,
+				  &output->base.region);
+	box = pixman_region32_extents(&src_rect);
+
+	weston_view_from_global(ev, box->x1, box->y1, &sx1, &sy1);
+	weston_view_from_global(ev, box->x2, box->y2, &sx2, &sy2);
+	pixman_region32_fini(&src_rect);
+
+	/* Previously we clamped to the surface edge here, but that will
+	 * result in incorrect scaling, so we just bail.
+	 */
+	if (sx1 < 0 || sy1 < 0 ||
+	    sx2 > ev->surface->width || sy2 > ev->surface->height)
+		return DRM_REJECT_GEOMETRY;
+
+	tbox.x1 = sx1;
+	tbox.y1 = sy1;
+	tbox.x2 = sx2;
+	tbox.y2 = sy2;
+
+	tbox = weston_surface_to_buffer_rect(ev->surface, tbox);
+
+	/* KMS source coordinates are 16.16 fixed point */
+	rect->src_x = wl_fixed_from_int(tbox.x1) << 8;
+	rect->src_y = wl_fixed_from_int(tbox.y1) << 8;
+	rect->src_w = wl_fixed_from_int(tbox.x2 - tbox.x1) << 8;
+	rect->src_h = wl_fixed_from_int(tbox.y2 - tbox.y1) << 8;
+
+	return DRM_REJECT_NONE;
+}
+
+/* A client buffer on the primary plane either matches the mode
+ * exactly, or, with atomic modesetting, is scaled or cropped to cover
+ * the whole output, like the fullscreen shell's zoom and stretch. It
+ * must cover everything, since views below it would not be seen. */
+static enum drm_plane_reject
+drm_output_check_scanout_geometry(struct drm_output *output,
+				  struct weston_view *ev,
+				  struct drm_plane_rect *rect, int *scaled)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
+	enum drm_plane_reject reason;
+	int32_t width, height;
+
+	if (ev->geometry.scissor_enabled)
+		return DRM_REJECT_GEOMETRY;
+
+	weston_output_get_buffer_size(&output->base, &width, &height);
+	if (ev->geometry.x == output->base.x &&
+	    ev->geometry.y == output->base.y &&
+	    buffer->width == width &&
+	    buffer->height == height &&
+	    !ev->transform.enabled) {
+		if (weston_output_get_buffer_transform(&output->base) !=
+		    viewport->buffer.transform)
+			return DRM_REJECT_TRANSFORM;
+
+		*scaled = 0;
+		return DRM_REJECT_NONE;
+	}
+
+	if (!b->atomic_modeset || output->gpu || output->hw_rotation)
+		return DRM_REJECT_GEOMETRY;
+
+	if (viewport->buffer.transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		return DRM_REJECT_TRANSFORM;
+
+	reason = drm_view_get_plane_rect(output, ev, rect);
+	if (reason != DRM_REJECT_NONE)
+		return reason;
+
+	if (rect->dest_x != 0 || rect->dest_y != 0 ||
+	    rect->dest_w != mode->width || rect->dest_h != mode->height)
+		return DRM_REJECT_GEOMETRY;
+
+	*scaled = 1;
+
+	return DRM_REJECT_NONE;
+}
+
+static struct weston_plane *
+drm_output_prepare_scanout_view(struct drm_output *output,
+				struct weston_view *ev,
+				enum drm_plane_reject *reject)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct linux_dmabuf_buffer *dmabuf;
+	struct drm_plane_rect rect;
+	enum drm_plane_reject reason;
+	struct gbm_bo *bo;
+	uint32_t format;
+	int scaled;
+
+	if (b->gbm == NULL)
+		return drm_plane_reject(reject, DRM_REJECT_DISABLED);
+
+	if (buffer == NULL)
+		return drm_plane_reject(reject, DRM_REJECT_BUFFER);
+
+	reason = drm_output_check_scanout_geometry(output, ev, &rect, &scaled);
+	if (reason != DRM_REJECT_NONE)
+		return drm_plane_reject(reject, reason);
+
+	if (wl_shm_buffer_get(buffer->resource))
+		return drm_plane_reject(reject, DRM_REJECT_SHM);
+
+	if (!drm_view_fence_ready(b, ev, output->primary_sprite))
+		return drm_plane_reject(reject, DRM_REJECT_FENCE);
+
+	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+	if (dmabuf) {
+		/* Added with their format modifiers, so tiled and
+		 * compressed buffers are flipped to as well */
+		if (dmabuf->flags)
+			return drm_plane_reject(reject, DRM_REJECT_FORMAT);
+
+		format = drm_output_check_scanout_format(output, ev->surface,
+							 dmabuf->format);
+		if (format == 0)
+			return drm_plane_reject(reject, DRM_REJECT_FORMAT);
+
+		output->next = drm_fb_get_from_dmabuf(dmabuf, b, format);
+		if (!output->next)
+			return drm_plane_reject(reject, DRM_REJECT_IMPORT);
+	} else {
+		bo = gbm_bo_import(b->gbm, GBM_BO_IMPORT_WL_BUFFER,
+				   buffer->resource, GBM_BO_USE_SCANOUT);
+
+		/* Unable to use the buffer for scanout */
+		if (!bo)
+			return drm_plane_reject(reject, DRM_REJECT_IMPORT);
+
+		format = drm_output_check_scanout_format(output, ev->surface,
+							 gbm_bo_get_format(bo));
+		if (format == 0) {
+			gbm_bo_destroy(bo);
+			return drm_plane_reject(reject, DRM_REJECT_FORMAT);
+		}
+
+		output->next = drm_fb_get_from_bo(bo, b, format);
+		if (!output->next) {
+			gbm_bo_destroy(bo);
+			return drm_plane_reject(reject, DRM_REJECT_IMPORT);
+		}
+	}
+
+	drm_fb_set_buffer(output->next, ev->surface);
+	output->next->scanout_scaled = scaled;
+	if (scaled)
+		output->next->scanout_rect = rect;
+
+	if (b->atomic_modeset && drm_output_test_atomic(output) < 0) {
+		drm_output_release_fb(output, output->next);
+		output->next = NULL;
+		return drm_plane_reject(reject, DRM_REJECT_KMS_TEST);
+	}
+
+	/* ztearing_control: the client takes tearing over latency */
+	output->next_async = b->async_page_flip && ev->surface->async_flip;
+
+	return &output->fb_plane;
+}
+
+static int
+drm_output_init_gpu_copy(struct drm_output *output);
+
+/*
+ * Read back what GL rendered into the dumb buffer about to be shown,
+ * for an output on a secondary GPU that cannot import our buffers.
+ * Runs from the frame signal, which the GL renderer emits before
+ * swapping, and copies only the stale part of the dumb buffer.
+ */
+static void
+drm_output_gpu_copy_notify(struct wl_listener *listener, void *data)
+{
+	struct drm_output *output =
+		container_of(listener, struct drm_output, gpu_copy_listener);
+	struct weston_compositor *ec = output->base.compositor;
+	struct drm_fb *fb = output->dumb[output->current_image];
+	pixman_region32_t damage;
+	pixman_box32_t *rects;
+	int32_t buffer_width, height;
+	int i, n, row, width;
+
+	if (!output->gpu_copy || !fb)
+		return;
+
+	weston_output_get_buffer_size(&output->base, &buffer_width, &height);
+
+	pixman_region32_init(&damage);
+	weston_matrix_transform_region(&damage, &output->base.matrix,
+				       &output->gpu_copy_damage);
+	pixman_region32_intersect_rect(&damage, &damage, 0, 0,
+				       buffer_width, height);
+
+	rects = pixman_region32_rectangles(&damage, &n);
+	for (i = 0; i < n; i++) {
+		width = rects[i].x2 - rects[i].x1;
+
+		/* GL rows go bottom to top */
+		if (ec->renderer->read_pixels(&output->base, PIXMAN_a8r8g8b8,
+					      output->gpu_copy_pixels,
+					      rects[i].x1, height - rects[i].y2,
+					      width,
+					      rects[i].y2 - rects[i].y1) < 0)
+			break;
+
+		for (row = rects[i].y1; row < rects[i].y2; row++)
+			memcpy((uint8_t *) fb->map + row * fb->stride +
+			       rects[i].x1 * 4,
+			       output->gpu_copy_pixels +
+			       (rects[i].y2 - 1 - row) * width * 4,
+			       width * 4);
+	}
+
+	pixman_region32_fini(&damage);
+}
+
+static void
+drm_output_render_done(struct weston_output *output_base);
+
+static void
+drm_output_clear_render_fence(struct drm_output *output)
+{
+	wl_event_source_remove(output->render_fence_source);
+	output->render_fence_source = NULL;
+	close(output->render_fence_fd);
+	output->render_fence_fd = -1;
+}
+
+static int
+drm_output_render_fence_signalled(int fd, uint32_t mask, void *data)
+{
+	struct drm_output *output = data;
+
+	drm_output_clear_render_fence(output);
+	drm_output_render_done(&output->base);
+
+	return 0;
+}
+
+/* Instead of having the flip, and maybe the event loop, wait on the
+ * GPU, submit it from the event loop once rendering is complete */
+static void
+drm_output_wait_render_fence(struct drm_output *output)
+{
+	struct wl_event_loop *loop;
+	int fd;
+
+	fd = gl_renderer->output_create_fence_fd(&output->base);
+	if (fd < 0)
+		return;
+
+	loop = wl_display_get_event_loop(output->base.compositor->wl_display);
+	output->render_fence_source =
+		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+				     drm_output_render_fence_signalled,
+				     output);
+	if (!output->render_fence_source) {
+		close(fd);
+		return;
+	}
+
+	output->render_fence_fd = fd;
+	output->render_pending = 1;
+}
+
+/* Flip a frame still being rendered right away, its buffers are
+ * about to go */
+static void
+drm_output_finish_render(struct drm_output *output)
+{
+	struct pollfd pfd;
+
+	if (!output->render_pending)
+		return;
+
+	if (output->render_thread) {
+		pixman_renderer_output_finish_frame(&output->base);
+		return;
+	}
+
+	pfd.fd = output->render_fence_fd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, -1) < 0 && errno == EINTR)
+		;
+
+	drm_output_clear_render_fence(output);
+	drm_output_render_done(&output->base);
+}
+
+static void
+drm_output_render_gl(struct drm_output *output, pixman_region32_t *damage)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct gbm_bo *bo;
+
+	if (output->gpu_copy) {
+		if (!output->gpu_copy_pixels)
+			return;
+
+		/* Each dumb buffer misses this frame's and the previous
+		 * frame's damage, as with the pixman renderer */
+		pixman_region32_union(&output->gpu_copy_damage, damage,
+				      &output->previous_damage);
+		pixman_region32_copy(&output->previous_damage, damage);
+		output->current_image ^= 1;
+	}
+
+	output->base.compositor->renderer->repaint_output(&output->base,
+							  damage);
+
+	bo = gbm_surface_lock_front_buffer(output->surface);
+	if (!bo) {
+		weston_log("failed to lock front buffer: %m\n");
+		return;
+	}
+
+	if (output->gpu_copy) {
+		gbm_surface_release_buffer(output->surface, bo);
+		output->next = output->dumb[output->current_image];
+		return;
+	}
+
+	if (output->gpu) {
+		output->next = drm_fb_get_from_bo_for_gpu(bo, output->gpu,
+							  output->format);
+		if (output->next)
+			return;
+
+		/* Carry on with copies from the next frame */
+		gbm_surface_release_buffer(output->surface, bo);
+		weston_log("%s: importing frames on %s failed, "
+			   "copying them instead\n",
+			   output->base.name, output->gpu->filename);
+		output->gpu_copy = 1;
+		if (drm_output_init_gpu_copy(output) < 0)
+			weston_log("%s: no buffers to copy frames to\n",
+				   output->base.name);
+		weston_output_damage(&output->base);
+		return;
+	}
+
+	output->next = drm_fb_get_from_bo(bo, b, output->format);
+	if (!output->next) {
+		weston_log("failed to get drm_fb for bo\n");
+		gbm_surface_release_buffer(output->surface, bo);
+		return;
+	}
+
+	drm_output_wait_render_fence(output);
+}
+
+static void
+drm_output_render_pixman(struct drm_output *output, pixman_region32_t *damage)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	pixman_region32_t total_damage, previous_damage;
+
+	pixman_region32_init(&total_damage);
+	pixman_region32_init(&previous_damage);
+
+	pixman_region32_copy(&previous_damage, damage);
+
+	pixman_region32_union(&total_damage, damage, &output->previous_damage);
+	pixman_region32_copy(&output->previous_damage, &previous_damage);
+
+	output->current_image ^= 1;
+
+	output->next = output->dumb[output->current_image];
+	pixman_renderer_output_set_buffer(&output->base,
+					  output->image[output->current_image]);
+
+	ec->renderer->repaint_output(&output->base, &total_damage);
 
 	pixman_region32_fini(&total_damage);
 	pixman_region32_fini(&previous_damage);
 }
 
 static void
-drm_output_render(struct drm_output *output, pixman_region32_t *damage)
+drm_output_render(struct drm_output *output, pixman_region32_t *damage)
+{
+	struct weston_compositor *c = output->base.compositor;
+	struct drm_backend *b = (struct drm_backend *)c->backend;
+
+	if (b->use_pixman)
+		drm_output_render_pixman(output, damage);
+	else
+		drm_output_render_gl(output, damage);
+
+	pixman_region32_subtract(&c->primary_plane.damage,
+				 &c->primary_plane.damage, damage);
+}
+
+static void
+drm_output_set_gamma(struct weston_output *output_base,
+		     uint16_t size, uint16_t *r, uint16_t *g, uint16_t *b)
+{
+	int rc;
+	struct drm_output *output = (struct drm_output *) output_base;
+
+	/* check */
+	if (output_base->gamma_size != size)
+		return;
+	if (!output->original_crtc)
+		return;
+
+	rc = drmModeCrtcSetGamma(drm_output_fd(output),
+				 output->crtc_id,
+				 size, r, g, b);
+	if (rc)
+		weston_log("set gamma failed: %m\n");
+}
+
+/* Determine the type of vblank synchronization to use for the output.
+ * 
+ * The pipe parameter indicates which CRTC is in use.  Knowing this, we
+ * can determine which vblank sequence type to use for it.  Traditional
+ * cards had only two CRTCs, with CRTC 0 using no special flags, and
+ * CRTC 1 using DRM_VBLANK_SECONDARY.  The first bit of the pipe
+ * parameter indicates this.
+ * 
+ * Bits 1-5 of the pipe parameter are 5 bit wide pipe number between
+ * 0-31.  If this is non-zero it indicates we're dealing with a
+ * multi-gpu situation and we need to calculate the vblank sync
+ * using DRM_BLANK_HIGH_CRTC_MASK.
+ */
+static unsigned int
+drm_waitvblank_pipe(struct drm_output *output)
+{
+	if (output->pipe > 1)
+		return (output->pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) &
+				DRM_VBLANK_HIGH_CRTC_MASK;
+	else if (output->pipe > 0)
+		return DRM_VBLANK_SECONDARY;
+	else
+		return 0;
+}
+
+#ifdef HAVE_DRM_ATOMIC
+/* Map a rectangle of the framebuffer, in the orientation everything is
+ * rendered in, to where the plane rotation puts it on the CRTC */
+static void
+drm_output_rect_to_crtc(struct drm_output *output, struct drm_sprite *s,
+			int32_t *x, int32_t *y, uint32_t *w, uint32_t *h)
+{
+	int32_t width, height;
+
+	weston_output_get_buffer_size(&output->base, &width, &height);
+
+	*x = (int32_t) s->dest_x;
+	*y = (int32_t) s->dest_y;
+	*w = s->dest_w;
+	*h = s->dest_h;
+
+	switch (output->base.scanout_transform) {
+	case WL_OUTPUT_TRANSFORM_90:
+		*x = s->dest_y;
+		*y = width - (int32_t) s->dest_x - (int32_t) s->dest_w;
+		*w = s->dest_h;
+		*h = s->dest_w;
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		*x = width - (int32_t) s->dest_x - (int32_t) s->dest_w;
+		*y = height - (int32_t) s->dest_y - (int32_t) s->dest_h;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		*x = height - (int32_t) s->dest_y - (int32_t) s->dest_h;
+		*y = s->dest_x;
+		*w = s->dest_h;
+		*h = s->dest_w;
+		break;
+	default:
+		break;
+	}
+}
+
+static int
+drm_sprite_add_atomic(drmModeAtomicReq *req, struct drm_output *output,
+		      struct drm_sprite *s, struct drm_fb *fb)
+{
+	struct drm_plane_props *p = &s->props;
+	uint32_t crtc_id = output->crtc_id;
+	int32_t crtc_x, crtc_y;
+	uint32_t crtc_w, crtc_h;
+	int ret = 0;
+
+	if (!fb) {
+		ret |= drmModeAtomicAddProperty(req, s->plane_id,
+						p->fb_id, 0) < 0;
+		ret |= drmModeAtomicAddProperty(req, s->plane_id,
+						p->crtc_id, 0) < 0;
+		return ret ? -1 : 0;
+	}
+
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->fb_id, fb->fb_id) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->crtc_id, crtc_id) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->src_x, s->src_x) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->src_y, s->src_y) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->src_w, s->src_w) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->src_h, s->src_h) < 0;
+	/* CRTC_X/Y are signed, the cursor can hang off the top left */
+	drm_output_rect_to_crtc(output, s, &crtc_x, &crtc_y,
+				&crtc_w, &crtc_h);
+	ret |= drmModeAtomicAddProperty(req, s->plane_id, p->crtc_x,
+					crtc_x) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id, p->crtc_y,
+					crtc_y) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->crtc_w, crtc_w) < 0;
+	ret |= drmModeAtomicAddProperty(req, s->plane_id,
+					p->crtc_h, crtc_h) < 0;
+
+	/* Also resets what another output left on the plane */
+	if (p->rotation)
+		ret |= drmModeAtomicAddProperty(req, s->plane_id, p->rotation,
+						output->hw_rotation ?
+						output->hw_rotation :
+						DRM_ROTATE_0) < 0;
+
+	/* KMS waits for the client's rendering before scanning out */
+	if (p->in_fence_fd && fb->acquire_fence_fd >= 0)
+		ret |= drmModeAtomicAddProperty(req, s->plane_id,
+						p->in_fence_fd,
+						fb->acquire_fence_fd) < 0;
+
+	return ret ? -1 : 0;
+}
+
+/**
+ * Add the complete plane state of an output to an atomic request
+ *
+ * @param output DRM output
+ * @param req Atomic request to fill
+ * @param scanout Framebuffer for the primary plane
+ * @param with_cursor Whether to include the cursor plane
+ * @returns 0 on success, -1 if a property could not be added
+ */
+static int
+drm_output_populate_atomic(struct drm_output *output, drmModeAtomicReq *req,
+			   struct drm_fb *scanout, bool with_cursor)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_sprite *primary = output->primary_sprite;
+	struct drm_sprite *s;
+	struct drm_fb *fb;
+	int32_t width, height;
+	int ret = 0;
+
+	/* In the framebuffer's orientation, drm_sprite_add_atomic()
+	 * turns the destination for the plane rotation */
+	weston_output_get_buffer_size(&output->base, &width, &height);
+	primary->src_x = 0;
+	primary->src_y = 0;
+	primary->src_w = width << 16;
+	primary->src_h = height << 16;
+	/* Our own frames are drawn small, client buffers are full size */
+	if (output->base.render_width && scanout &&
+	    !scanout->is_client_buffer) {
+		primary->src_w = output->base.render_width << 16;
+		primary->src_h = output->base.render_height << 16;
+	}
+	primary->dest_x = 0;
+	primary->dest_y = 0;
+	primary->dest_w = width;
+	primary->dest_h = height;
+	/* A client buffer shown scaled or cropped to the mode */
+	if (scanout && scanout->is_client_buffer && scanout->scanout_scaled) {
+		primary->src_x = scanout->scanout_rect.src_x;
+		primary->src_y = scanout->scanout_rect.src_y;
+		primary->src_w = scanout->scanout_rect.src_w;
+		primary->src_h = scanout->scanout_rect.src_h;
+	}
+	ret |= drm_sprite_add_atomic(req, output, primary, scanout);
+
+	if (with_cursor && output->cursor_sprite)
+		ret |= drm_sprite_add_atomic(req, output, output->cursor_sprite,
+					     output->cursor_sprite->next);
+
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != WDRM_PLANE_TYPE_OVERLAY || s->output != output)
+			continue;
+
+		fb = NULL;
+		if (s->next && !b->sprites_hidden)
+			fb = s->next;
+
+		ret |= drm_sprite_add_atomic(req, output, s, fb);
+	}
+
+	return ret ? -1 : 0;
+}
+
+/**
+ * Ask the kernel whether the planes assigned so far would work
+ *
+ * This is called from drm_assign_planes() every time a view is put on
+ * a plane, so a configuration the hardware cannot do falls back to the
+ * renderer before anything is committed.
+ *
+ * @param output DRM output
+ * @returns 0 if the configuration is valid, -1 otherwise
+ */
+static int
+drm_output_test_atomic(struct drm_output *output)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_fb *scanout = output->next ? output->next : output->current;
+	drmModeAtomicReq *req;
+	int ret;
+
+	/* Nothing to validate against before the first modeset */
+	if (!scanout)
+		return -1;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -1;
+
+	ret = drm_output_populate_atomic(output, req, scanout, false);
+	if (ret == 0)
+		ret = drmModeAtomicCommit(b->drm.fd, req,
+					  DRM_MODE_ATOMIC_TEST_ONLY, output);
+
+	drmModeAtomicFree(req);
+
+	return ret == 0 ? 0 : -1;
+}
+
+static int
+drm_output_commit_atomic(struct drm_output *output)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_mode *mode;
+	drmModeAtomicReq *req;
+	uint32_t flags = DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK;
+	uint32_t blob_id = 0;
+	int ret = 0;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -1;
+
+	/* Unlike a legacy page flip, an atomic commit can change the
+	 * stride, so we only need a modeset after a mode switch. */
+	if (!output->current) {
+		mode = container_of(output->base.current_mode,
+				    struct drm_mode, base);
+		ret = drmModeCreatePropertyBlob(b->drm.fd, &mode->mode_info,
+						sizeof mode->mode_info,
+						&blob_id);
+		if (ret == 0) {
+			ret |= drmModeAtomicAddProperty(req,
+					output->connector_id,
+					output->connector_prop_crtc_id,
+					output->crtc_id) < 0;
+			ret |= drmModeAtomicAddProperty(req, output->crtc_id,
+					output->crtc_prop_mode_id,
+					blob_id) < 0;
+			ret |= drmModeAtomicAddProperty(req, output->crtc_id,
+					output->crtc_prop_active, 1) < 0;
+			if (output->crtc_prop_vrr_enabled)
+				ret |= drmModeAtomicAddProperty(req,
+					output->crtc_id,
+					output->crtc_prop_vrr_enabled, 1) < 0;
+		}
+		flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+	}
+
+	if (ret == 0)
+		ret = drm_output_populate_atomic(output, req, output->next,
+						 true);
+	if (ret == 0)
+		ret = drmModeAtomicCommit(b->drm.fd, req, flags, output);
+	if (ret)
+		weston_log("atomic commit failed: %m\n");
+
+	if (blob_id)
+		drmModeDestroyPropertyBlob(b->drm.fd, blob_id);
+	drmModeAtomicFree(req);
+
+	return ret ? -1 : 0;
+}
+#else
+static int
+drm_output_test_atomic(struct drm_output *output)
+{
+	return -1;
+}
+
+static int
+drm_output_commit_atomic(struct drm_output *output)
+{
+	return -1;
+}
+#endif
+
+/* Drop overlay state prepared for a frame that never reached the screen */
+static void
+drm_output_release_sprites(struct drm_output *output)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_sprite *s;
+
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != WDRM_PLANE_TYPE_OVERLAY || s->output != output)
+			continue;
+
+		drm_output_release_fb(output, s->next);
+		s->next = NULL;
+		if (!s->current)
+			s->output = NULL;
+	}
+}
+
+/* In atomic mode the overlays flip together with the primary plane */
+static void
+drm_output_finish_sprites(struct drm_output *output)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_sprite *s;
+
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != WDRM_PLANE_TYPE_OVERLAY || s->output != output)
+			continue;
+
+		drm_output_release_fb(output, s->current);
+		s->current = s->next;
+		s->next = NULL;
+		if (!s->current)
+			s->output = NULL;
+	}
+}
+
+static int
+drm_output_repaint_atomic(struct drm_output *output)
+{
+	drm_output_set_cursor(output);
+
+	if (drm_output_commit_atomic(output) < 0) {
+		drm_output_release_sprites(output);
+		return -1;
+	}
+
+	/* ACTIVE=1 in the modeset has already turned the display on */
+	output->dpms = WESTON_DPMS_ON;
+	output->page_flip_pending = 1;
+
+	return 0;
+}
+
+static int
+drm_output_post(struct drm_output *output);
+
+static void
+drm_output_destroy(struct weston_output *output_base);
+
+#ifdef BUILD_VAAPI_RECORDER
+static void
+recorder_destroy(struct drm_output *output);
+#endif
+
+static int
+drm_output_repaint(struct weston_output *output_base,
+		   pixman_region32_t *damage)
+{
+	struct drm_output *output = (struct drm_output *) output_base;
+
+	if (output->destroy_pending)
+		return -1;
+
+	if (!output->next) {
+		drm_output_render(output, damage);
+
+		/* Posted by drm_output_render_done() */
+		if (output->next && output->render_thread)
+			output->render_pending = 1;
+		if (output->render_pending)
+			return 0;
+	}
+	if (!output->next)
+		return -1;
+
+	return drm_output_post(output);
+}
+
+/** Called once the pixman render thread has painted output->next, or
+ * the GPU has finished rendering it */
+static void
+drm_output_render_done(struct weston_output *output_base)
+{
+	struct drm_output *output = (struct drm_output *) output_base;
+	struct timespec ts;
+
+	output->render_pending = 0;
+
+	if (output->destroy_pending) {
+		drm_output_release_fb(output, output->next);
+		output->next = NULL;
+		drm_output_destroy(output_base);
+		return;
+	}
+
+	if (drm_output_post(output) < 0) {
+		/* Nothing will flip, keep the repaint loop going */
+		weston_compositor_read_presentation_clock(output_base->compositor,
+							  &ts);
+		weston_output_finish_frame(output_base, &ts,
+					   PRESENTATION_FEEDBACK_INVALID);
+	}
+}
+
+/** Queue output->next, and the sprites, to be shown at the next vblank */
+static int
+drm_output_post(struct drm_output *output)
+{
+	struct weston_output *output_base = &output->base;
+	struct drm_backend *backend =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_sprite *s;
+	struct drm_mode *mode;
+	uint32_t flip_flags = DRM_MODE_PAGE_FLIP_EVENT;
+	int ret = 0;
+
+	output->page_flip_async = output->next_async;
+	output->next_async = 0;
+
+	if (backend->atomic_modeset && !output->gpu) {
+		if (drm_output_repaint_atomic(output) < 0)
+			goto err_pageflip;
+		return 0;
+	}
+
+	mode = container_of(output->base.current_mode, struct drm_mode, base);
+	if (!output->current ||
+	    output->current->stride != output->next->stride) {
+		ret = drmModeSetCrtc(drm_output_fd(output), output->crtc_id,
+				     output->next->fb_id, 0, 0,
+				     &output->connector_id, 1,
+				     &mode->mode_info);
+		if (ret) {
+			weston_log("set mode failed: %m\n");
+			goto err_pageflip;
+		}
+		output_base->set_dpms(output_base, WESTON_DPMS_ON);
+		output->page_flip_async = 0;
+	}
+
+	if (output->page_flip_async)
+		flip_flags |= DRM_MODE_PAGE_FLIP_ASYNC;
+
+	if (drmModePageFlip(drm_output_fd(output), output->crtc_id,
+			    output->next->fb_id, flip_flags, output) < 0) {
+		weston_log("queueing pageflip failed: %m\n");
+		goto err_pageflip;
+	}
+
+	output->page_flip_pending = 1;
+
+	drm_output_set_cursor(output);
+
+	/*
+	 * Now, update all the sprite surfaces
+	 */
+	wl_list_for_each(s, &backend->sprite_list, link) {
+		uint32_t flags = 0, fb_id = 0;
+		drmVBlank vbl = {
+			.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT,
+			.request.sequence = 1,
+		};
+
+		if ((!s->current && !s->next) ||
+		    !drm_sprite_crtc_supported(output, s->possible_crtcs))
+			continue;
+
+		if (s->next && !backend->sprites_hidden)
+			fb_id = s->next->fb_id;
+
+		ret = drmModeSetPlane(backend->drm.fd, s->plane_id,
+				      output->crtc_id, fb_id, flags,
+				      s->dest_x, s->dest_y,
+				      s->dest_w, s->dest_h,
+				      s->src_x, s->src_y,
+				      s->src_w, s->src_h);
+		if (ret)
+			weston_log("setplane failed: %d: %s\n",
+				ret, strerror(errno));
+
+		vbl.request.type |= drm_waitvblank_pipe(output);
+
+		/*
+		 * Queue a vblank signal so we know when the surface
+		 * becomes active on the display or has been replaced.
+		 */
+		vbl.request.signal = (unsigned long)s;
+		ret = drmWaitVBlank(backend->drm.fd, &vbl);
+		if (ret) {
+			weston_log("vblank event request failed: %d: %s\n",
+				ret, strerror(errno));
+		}
+
+		s->output = output;
+		output->vblank_pending = 1;
+	}
+
+	return 0;
+
+err_pageflip:
+	output->cursor_view = NULL;
+	output->cursor_under = NULL;
+	if (output->next) {
+		drm_output_release_fb(output, output->next);
+		output->next = NULL;
+	}
+
+	return -1;
+}
+
+static void
+drm_output_start_repaint_loop(struct weston_output *output_base)
+{
+	struct drm_output *output = (struct drm_output *) output_base;
+	struct drm_backend *backend = (struct drm_backend *)
+		output_base->compositor->backend;
+	uint32_t fb_id;
+	struct timespec ts, tnow;
+	struct timespec vbl2now;
+	int64_t refresh_nsec;
+	int ret;
+	drmVBlank vbl = {
+		.request.type = DRM_VBLANK_RELATIVE,
+		.request.sequence = 0,
+		.request.signal = 0,
+	};
+
+	if (output->destroy_pending)
+		return;
+
+	if (!output->current) {
+		/* We can't page flip if there's no mode set */
+		goto finish_frame;
+	}
+
+	/* Try to get current msc and timestamp via instant query */
+	vbl.request.type |= drm_waitvblank_pipe(output);
+	ret = drmWaitVBlank(drm_output_fd(output), &vbl);
+
+	/* Error ret or zero timestamp means failure to get valid timestamp */
+	if ((ret == 0) && (vbl.reply.tval_sec > 0 || vbl.reply.tval_usec > 0)) {
+		ts.tv_sec = vbl.reply.tval_sec;
+		ts.tv_nsec = vbl.reply.tval_usec * 1000;
+
+		/* Valid timestamp for most recent vblank - not stale?
+		 * Stale ts could happen on Linux 3.17+, so make sure it
+		 * is not older than 1 refresh duration since now.
+		 */
+		weston_compositor_read_presentation_clock(backend->compositor,
+							  &tnow);
+		timespec_sub(&vbl2now, &tnow, &ts);
+		refresh_nsec =
+			millihz_to_nsec(output->base.current_mode->refresh);
+		if (timespec_to_nsec(&vbl2now) < refresh_nsec) {
+			drm_output_update_msc(output, vbl.reply.sequence);
+			weston_output_finish_frame(output_base, &ts,
+						PRESENTATION_FEEDBACK_INVALID);
+			return;
+		}
+	}
+
+	/* Immediate query didn't provide valid timestamp.
+	 * Use pageflip fallback.
+	 */
+	fb_id = output->current->fb_id;
+
+	if (drmModePageFlip(drm_output_fd(output), output->crtc_id, fb_id,
+			    DRM_MODE_PAGE_FLIP_EVENT, output) < 0) {
+		weston_log("queueing pageflip failed: %m\n");
+		goto finish_frame;
+	}
+
+	return;
+
+finish_frame:
+	/* if we cannot page-flip, immediately finish frame */
+	weston_compositor_read_presentation_clock(output_base->compositor, &ts);
+	weston_output_finish_frame(output_base, &ts,
+				   PRESENTATION_FEEDBACK_INVALID);
+}
+
+static void
+drm_output_update_msc(struct drm_output *output, unsigned int seq)
 {
-	struct weston_compositor *c = output->base.compositor;
-	struct drm_backend *b = (struct drm_backend *)c->backend;
+	uint64_t msc_hi = output->base.msc >> 32;
 
-	if (b->use_pixman)
-		drm_output_render_pixman(output, damage);
-	else
-		drm_output_render_gl(output, damage);
+	if (seq < (output->base.msc & 0xffffffff))
+		msc_hi++;
 
-	pixman_region32_subtract(&c->primary_plane.damage,
-				 &c->primary_plane.damage, damage);
+	output->base.msc = (msc_hi << 32) + seq;
+}
+
+static void
+vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
+	       void *data)
+{
+	struct drm_sprite *s = (struct drm_sprite *)data;
+	struct drm_output *output = s->output;
+	struct timespec ts;
+	uint32_t flags = PRESENTATION_FEEDBACK_KIND_HW_COMPLETION |
+			 PRESENTATION_FEEDBACK_KIND_HW_CLOCK;
+
+	drm_output_update_msc(output, frame);
+	output->vblank_pending = 0;
+
+	drm_output_release_fb(output, s->current);
+	s->current = s->next;
+	s->next = NULL;
+
+	if (!output->page_flip_pending) {
+		ts.tv_sec = sec;
+		ts.tv_nsec = usec * 1000;
+		weston_output_finish_frame(&output->base, &ts, flags);
+	}
+}
+
+static void
+page_flip_handler(int fd, unsigned int frame,
+		  unsigned int sec, unsigned int usec, void *data)
+{
+	struct drm_output *output = (struct drm_output *) data;
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct timespec ts;
+	uint32_t flags = PRESENTATION_FEEDBACK_KIND_VSYNC |
+			 PRESENTATION_FEEDBACK_KIND_HW_COMPLETION |
+			 PRESENTATION_FEEDBACK_KIND_HW_CLOCK;
+
+	drm_output_update_msc(output, frame);
+
+	/* We don't set page_flip_pending on start_repaint_loop, in that case
+	 * we just want to page flip to the current buffer to get an accurate
+	 * timestamp */
+	if (output->page_flip_pending) {
+		drm_output_release_fb(output, output->current);
+		output->current = output->next;
+		output->next = NULL;
+
+		if (b->atomic_modeset)
+			drm_output_finish_sprites(output);
+
+		/* Only a client scanned out directly sets the pace, the
+		 * desktop keeps a steady refresh */
+		output->base.adaptive_sync = output->crtc_prop_vrr_enabled &&
+			output->current && output->current->is_client_buffer;
+	}
+
+	output->page_flip_pending = 0;
+
+	if (output->destroy_pending)
+		drm_output_destroy(&output->base);
+	else if (!output->vblank_pending) {
+		ts.tv_sec = sec;
+		ts.tv_nsec = usec * 1000;
+
+		/* The timestamp is that of the last vblank, but an async
+		 * flip takes effect when it completes, mid-scanout */
+		if (output->page_flip_async) {
+			weston_compositor_read_presentation_clock(
+				output->base.compositor, &ts);
+			flags = PRESENTATION_FEEDBACK_KIND_HW_COMPLETION;
+		}
+		weston_output_finish_frame(&output->base, &ts, flags);
+
+		/* We can't call this from frame_notify, because the output's
+		 * repaint needed flag is cleared just after that */
+		if (output->recorder)
+			weston_output_schedule_repaint(&output->base);
+	}
+}
+
+static uint32_t
+drm_output_check_sprite_format(struct drm_sprite *s,
+			       struct weston_view *ev, uint32_t format)
+{
+	uint32_t i;
+
+	if (format == GBM_FORMAT_ARGB8888) {
+		pixman_region32_t r;
+
+		pixman_region32_init_rect(&r, 0, 0,
+					  ev->surface->width,
+					  ev->surface->height);
+		pixman_region32_subtract(&r, &r, &ev->surface->opaque);
+
+		if (!pixman_region32_not_empty(&r))
+			format = GBM_FORMAT_XRGB8888;
+
+		pixman_region32_fini(&r);
+	}
+
+	for (i = 0; i < s->count_formats; i++)
+		if (s->formats[i] == format)
+			return format;
+
+	return 0;
+}
+
+static struct weston_plane *
+drm_output_prepare_overlay_view(struct drm_output *output,
+				struct weston_view *ev,
+				enum drm_plane_reject *reject)
+{
+	struct weston_compositor *ec = output->base.compositor;
+	struct drm_backend *b = (struct drm_backend *)ec->backend;
+	struct wl_resource *buffer_resource;
+	struct drm_sprite *s;
+	struct linux_dmabuf_buffer *dmabuf;
+	int found = 0;
+	struct gbm_bo *bo = NULL;
+	struct drm_plane_rect rect;
+	enum drm_plane_reject reason;
+	pixman_box32_t *box;
+	uint32_t format;
+
+	if (b->gbm == NULL || b->sprites_are_broken)
+		return drm_plane_reject(reject, DRM_REJECT_DISABLED);
+
+	if (ev->output_mask != (1u << output->base.id))
+		return drm_plane_reject(reject, DRM_REJECT_OUTPUTS);
+
+	if (ev->surface->buffer_ref.buffer == NULL)
+		return drm_plane_reject(reject, DRM_REJECT_BUFFER);
+	buffer_resource = ev->surface->buffer_ref.buffer->resource;
+
+	if (ev->alpha != 1.0f)
+		return drm_plane_reject(reject, DRM_REJECT_ALPHA);
+
+	if (wl_shm_buffer_get(buffer_resource))
+		return drm_plane_reject(reject, DRM_REJECT_SHM);
+
+	reason = drm_view_get_plane_rect(output, ev, &rect);
+	if (reason != DRM_REJECT_NONE)
+		return drm_plane_reject(reject, reason);
+
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != WDRM_PLANE_TYPE_OVERLAY)
+			continue;
+
+		if (!drm_sprite_crtc_supported(output, s->possible_crtcs) ||
+		    !drm_sprite_rotation_supported(output, s))
+			continue;
+
+		/* Atomic commits are per CRTC, so a plane still showing
+		 * content on another output cannot be taken over. */
+		if (b->atomic_modeset && s->output && s->output != output)
+			continue;
+
+		if (!s->next) {
+			found = 1;
+			break;
+		}
+	}
+
+	/* No sprites available */
+	if (!found)
+		return drm_plane_reject(reject, DRM_REJECT_NO_PLANE);
+
+	if (!drm_view_fence_ready(b, ev, s))
+		return drm_plane_reject(reject, DRM_REJECT_FENCE);
+
+	if ((dmabuf = linux_dmabuf_buffer_get(buffer_resource))) {
+		/* dmabufs, including multi-planar YUV ones, are added as
+		 * framebuffers directly, without going through GBM. The
+		 * plane cannot flip or interlace them. */
+		if (dmabuf->flags)
+			return drm_plane_reject(reject, DRM_REJECT_FORMAT);
+
+		format = drm_output_check_sprite_format(s, ev, dmabuf->format);
+		if (format == 0)
+			return drm_plane_reject(reject, DRM_REJECT_FORMAT);
+
+		s->next = drm_fb_get_from_dmabuf(dmabuf, b, format);
+		if (!s->next)
+			return drm_plane_reject(reject, DRM_REJECT_IMPORT);
+	} else {
+		bo = gbm_bo_import(b->gbm, GBM_BO_IMPORT_WL_BUFFER,
+				   buffer_resource, GBM_BO_USE_SCANOUT);
+		if (!bo)
+			return drm_plane_reject(reject, DRM_REJECT_IMPORT);
+
+		format = drm_output_check_sprite_format(s, ev,
+							gbm_bo_get_format(bo));
+		if (format == 0) {
+			gbm_bo_destroy(bo);
+			return drm_plane_reject(reject, DRM_REJECT_FORMAT);
+		}
+
+		s->next = drm_fb_get_from_bo(bo, b, format);
+		if (!s->next) {
+			gbm_bo_destroy(bo);
+			return drm_plane_reject(reject, DRM_REJECT_IMPORT);
+		}
+	}
+
+	drm_fb_set_buffer(s->next, ev->surface);
+
+	box = pixman_region32_extents(&ev->transform.boundingbox);
+	s->plane.x = box->x1;
+	s->plane.y = box->y1;
+
+	s->dest_x = rect.dest_x;
+	s->dest_y = rect.dest_y;
+	s->dest_w = rect.dest_w;
+	s->dest_h = rect.dest_h;
+	s->src_x = rect.src_x;
+	s->src_y = rect.src_y;
+	s->src_w = rect.src_w;
+	s->src_h = rect.src_h;
+
+	if (b->atomic_modeset) {
+		s->output = output;
+		if (drm_output_test_atomic(output) < 0) {
+			drm_output_release_fb(output, s->next);
+			s->next = NULL;
+			if (!s->current)
+				s->output = NULL;
+			return drm_plane_reject(reject, DRM_REJECT_KMS_TEST);
+		}
+	}
+
+	return &s->plane;
+}
+
+/**
+ * Check whether a client dmabuf can be scanned out as the cursor as is
+ *
+ * The cursor plane only takes buffers of the size the driver reports
+ * through DRM_CAP_CURSOR_WIDTH/HEIGHT.
+ *
+ * @param b DRM backend structure
+ * @param dmabuf Buffer attached to the cursor surface
+ * @returns true if the buffer can be imported for the cursor plane
+ */
+static bool
+drm_cursor_dmabuf_usable(struct drm_backend *b,
+			 struct linux_dmabuf_buffer *dmabuf)
+{
+#ifdef HAVE_GBM_FD_IMPORT
+	return dmabuf->n_planes == 1 && dmabuf->offset[0] == 0 &&
+	       dmabuf->format == GBM_FORMAT_ARGB8888 &&
+	       dmabuf->width == b->cursor_width &&
+	       dmabuf->height == b->cursor_height;
+#else
+	return false;
+#endif
+}
+
+/* Whether a view can be shown on the cursor plane, on its own or
+ * together with another */
+static enum drm_plane_reject
+drm_output_check_cursor_view(struct drm_output *output,
+			     struct weston_view *ev)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct linux_dmabuf_buffer *dmabuf;
+	struct wl_shm_buffer *shm_buffer;
+	int32_t scale = output->base.current_scale;
+
+	if (ev->output_mask != (1u << output->base.id))
+		return DRM_REJECT_OUTPUTS;
+	if (buffer == NULL)
+		return DRM_REJECT_BUFFER;
+	if (!drm_view_fence_ready(b, ev, NULL))
+		return DRM_REJECT_FENCE;
+	if (viewport->buffer.transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		return DRM_REJECT_TRANSFORM;
+	if (ev->geometry.scissor_enabled ||
+	    viewport->buffer.src_width != wl_fixed_from_int(-1) ||
+	    viewport->surface.width != -1 ||
+	    ev->surface->width * scale > b->cursor_width ||
+	    ev->surface->height * scale > b->cursor_height)
+		return DRM_REJECT_GEOMETRY;
+
+	/* shm buffers are copied, and scaled if needed, dmabufs are
+	 * scanned out directly */
+	shm_buffer = wl_shm_buffer_get(buffer->resource);
+	if (shm_buffer) {
+		switch (wl_shm_buffer_get_format(shm_buffer)) {
+		case WL_SHM_FORMAT_ARGB8888:
+		case WL_SHM_FORMAT_XRGB8888:
+			break;
+		default:
+			return DRM_REJECT_FORMAT;
+		}
+	} else {
+		dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+		if (!dmabuf)
+			return DRM_REJECT_BUFFER;
+		if (viewport->buffer.scale != scale)
+			return DRM_REJECT_GEOMETRY;
+		if (!drm_cursor_dmabuf_usable(b, dmabuf))
+			return DRM_REJECT_FORMAT;
+	}
+
+	return DRM_REJECT_NONE;
+}
+
+/* Whether a view is the sprite of the pointer whose cursor is sent
+ * apart from the output contents, which keeps the cursor plane while
+ * the other planes are disabled. Only shm cursors at the output scale
+ * qualify, those can be forwarded as they are. */
+static bool
+drm_view_is_side_channel_cursor(struct drm_output *output,
+				struct weston_view *ev)
+{
+	struct weston_pointer *pointer = output->base.side_channel_pointer;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+
+	return pointer && pointer->sprite == ev && buffer &&
+	       wl_shm_buffer_get(buffer->resource) &&
+	       ev->surface->buffer_viewport.buffer.scale ==
+			output->base.current_scale;
+}
+
+/* Top left corner of the cursor image in global coordinates, which is
+ * that of the cursor view unless a view is composed under it */
+static void
+drm_output_cursor_origin(struct drm_output *output, struct weston_view *ev,
+			 int32_t *x, int32_t *y)
+{
+	struct weston_view *under = output->cursor_under;
+
+	*x = ev->geometry.x;
+	*y = ev->geometry.y;
+	if (under) {
+		*x = MIN(*x, (int32_t) under->geometry.x);
+		*y = MIN(*y, (int32_t) under->geometry.y);
+	}
+}
+
+/**
+ * Compose a view into the cursor image, under the cursor view
+ *
+ * A drag icon sits in the cursor layer right below the pointer sprite
+ * and moves along with it; rather than compositing it every frame, it
+ * is copied into the cursor image as long as both are shm buffers and
+ * fit into the cursor size together.
+ */
+static struct weston_plane *
+drm_output_prepare_cursor_under_view(struct drm_output *output,
+				     struct weston_view *ev,
+				     enum drm_plane_reject *reject)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct weston_view *top = output->cursor_view;
+	int32_t scale = output->base.current_scale;
+	int32_t x1, y1, x2, y2;
+	enum drm_plane_reject r;
+
+	if (output->cursor_under ||
+	    weston_view_get_layer(ev) !=
+	    &output->base.compositor->cursor_layer)
+		return drm_plane_reject(reject, DRM_REJECT_NO_PLANE);
+
+	r = drm_output_check_cursor_view(output, ev);
+	if (r != DRM_REJECT_NONE)
+		return drm_plane_reject(reject, r);
+
+	if (!wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource) ||
+	    !wl_shm_buffer_get(top->surface->buffer_ref.buffer->resource))
+		return drm_plane_reject(reject, DRM_REJECT_BUFFER);
+
+	x1 = MIN((int32_t) ev->geometry.x, (int32_t) top->geometry.x);
+	y1 = MIN((int32_t) ev->geometry.y, (int32_t) top->geometry.y);
+	x2 = MAX((int32_t) ev->geometry.x + ev->surface->width,
+		 (int32_t) top->geometry.x + top->surface->width);
+	y2 = MAX((int32_t) ev->geometry.y + ev->surface->height,
+		 (int32_t) top->geometry.y + top->surface->height);
+	if ((x2 - x1) * scale > b->cursor_width ||
+	    (y2 - y1) * scale > b->cursor_height)
+		return drm_plane_reject(reject, DRM_REJECT_GEOMETRY);
+
+	output->cursor_under = ev;
+
+	return &output->cursor_plane;
 }
 
-static void
-drm_output_set_gamma(struct weston_output *output_base,
-		     uint16_t size, uint16_t *r, uint16_t *g, uint16_t *b)
+static struct weston_plane *
+drm_output_prepare_cursor_view(struct drm_output *output,
+			       struct weston_view *ev,
+			       struct weston_view *prev,
+			       enum drm_plane_reject *reject)
 {
-	int rc;
-	struct drm_output *output = (struct drm_output *) output_base;
-	struct drm_backend *backend =
-		(struct drm_backend *) output->base.compositor->backend;
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	enum drm_plane_reject r;
+
+	if (b->gbm == NULL || b->cursors_are_broken)
+		return drm_plane_reject(reject, DRM_REJECT_DISABLED);
+	if (weston_output_get_buffer_transform(&output->base) !=
+	    WL_OUTPUT_TRANSFORM_NORMAL)
+		return drm_plane_reject(reject, DRM_REJECT_TRANSFORM);
+	/* The legacy cursor ioctls cannot rotate */
+	if (output->hw_rotation &&
+	    (!output->cursor_sprite ||
+	     !drm_sprite_rotation_supported(output, output->cursor_sprite)))
+		return drm_plane_reject(reject, DRM_REJECT_TRANSFORM);
+	if (output->cursor_view) {
+		if (prev != output->cursor_view)
+			return drm_plane_reject(reject, DRM_REJECT_NO_PLANE);
+		return drm_output_prepare_cursor_under_view(output, ev,
+							    reject);
+	}
 
-	/* check */
-	if (output_base->gamma_size != size)
-		return;
-	if (!output->original_crtc)
-		return;
+	r = drm_output_check_cursor_view(output, ev);
+	if (r != DRM_REJECT_NONE)
+		return drm_plane_reject(reject, r);
 
-	rc = drmModeCrtcSetGamma(backend->drm.fd,
-				 output->crtc_id,
-				 size, r, g, b);
-	if (rc)
-		weston_log("set gamma failed: %m\n");
-}
+	output->cursor_view = ev;
 
-/* Determine the type of vblank synchronization to use for the output.
- * 
- * The pipe parameter indicates which CRTC is in use.  Knowing this, we
- * can determine which vblank sequence type to use for it.  Traditional
- * cards had only two CRTCs, with CRTC 0 using no special flags, and
- * CRTC 1 using DRM_VBLANK_SECONDARY.  The first bit of the pipe
- * parameter indicates this.
- * 
- * Bits 1-5 of the pipe parameter are 5 bit wide pipe number between
- * 0-31.  If this is non-zero it indicates we're dealing with a
- * multi-gpu situation and we need to calculate the vblank sync
- * using DRM_BLANK_HIGH_CRTC_MASK.
- */
-static unsigned int
-drm_waitvblank_pipe(struct drm_output *output)
-{
-	if (output->pipe > 1)
-		return (output->pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) &
-				DRM_VBLANK_HIGH_CRTC_MASK;
-	else if (output->pipe > 0)
-		return DRM_VBLANK_SECONDARY;
-	else
-		return 0;
+	return &output->cursor_plane;
 }
 
-static int
-drm_output_repaint(struct weston_output *output_base,
-		   pixman_region32_t *damage)
+/**
+ * Copy the cursor surface into a cursor sized image
+ *
+ * The image is scaled from the buffer scale to the output scale.
+ *
+ * @param output DRM output showing the cursor
+ * @param ev View to use for cursor image
+ * @param dst Image of cursor_width x cursor_height pixels
+ * @param x Column of dst to put the surface at, in output pixels
+ * @param y Row of dst to put the surface at, in output pixels
+ * @param op PIXMAN_OP_SRC, or PIXMAN_OP_OVER to blend onto dst
+ */
+static void
+cursor_image_copy(struct drm_output *output, struct weston_view *ev,
+		  uint32_t *dst, int32_t x, int32_t y, pixman_op_t op)
 {
-	struct drm_output *output = (struct drm_output *) output_base;
-	struct drm_backend *backend =
+	struct drm_backend *b =
 		(struct drm_backend *)output->base.compositor->backend;
-	struct drm_sprite *s;
-	struct drm_mode *mode;
-	int ret = 0;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	int32_t buffer_scale = ev->surface->buffer_viewport.buffer.scale;
+	int32_t scale = output->base.current_scale;
+	pixman_image_t *src_image, *dst_image;
+	pixman_transform_t transform;
+	int32_t stride;
+	uint8_t *s;
+	int i;
 
-	if (output->destroy_pending)
-		return -1;
+	assert(buffer && buffer->shm_buffer);
+	assert(buffer->shm_buffer == wl_shm_buffer_get(buffer->resource));
+	assert(x + ev->surface->width * scale <= b->cursor_width);
+	assert(y + ev->surface->height * scale <= b->cursor_height);
 
-	if (!output->next)
-		drm_output_render(output, damage);
-	if (!output->next)
-		return -1;
+	stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
+	s = wl_shm_buffer_get_data(buffer->shm_buffer);
 
-	mode = container_of(output->base.current_mode, struct drm_mode, base);
-	if (!output->current ||
-	    output->current->stride != output->next->stride) {
-		ret = drmModeSetCrtc(backend->drm.fd, output->crtc_id,
-				     output->next->fb_id, 0, 0,
-				     &output->connector_id, 1,
-				     &mode->mode_info);
-		if (ret) {
-			weston_log("set mode failed: %m\n");
-			goto err_pageflip;
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	if (buffer_scale == scale && op == PIXMAN_OP_SRC) {
+		for (i = 0; i < ev->surface->height * scale; i++)
+			memcpy(dst + (y + i) * b->cursor_width + x,
+			       s + i * stride,
+			       ev->surface->width * scale * 4);
+	} else {
+		src_image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+						     buffer->width,
+						     buffer->height,
+						     (uint32_t *)s, stride);
+		dst_image = pixman_image_create_bits(PIXMAN_a8r8g8b8,
+						     b->cursor_width,
+						     b->cursor_height,
+						     dst, b->cursor_width * 4);
+		if (src_image && dst_image) {
+			pixman_transform_init_scale(&transform,
+				pixman_double_to_fixed((double)buffer_scale / scale),
+				pixman_double_to_fixed((double)buffer_scale / scale));
+			pixman_image_set_transform(src_image, &transform);
+			pixman_image_set_filter(src_image,
+						PIXMAN_FILTER_NEAREST, NULL, 0);
+			pixman_image_composite32(op,
+						 src_image, NULL, dst_image,
+						 0, 0, 0, 0, x, y,
+						 ev->surface->width * scale,
+						 ev->surface->height * scale);
 		}
-		output_base->set_dpms(output_base, WESTON_DPMS_ON);
+		if (src_image)
+			pixman_image_unref(src_image);
+		if (dst_image)
+			pixman_image_unref(dst_image);
 	}
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+}
 
-	if (drmModePageFlip(backend->drm.fd, output->crtc_id,
-			    output->next->fb_id,
-			    DRM_MODE_PAGE_FLIP_EVENT, output) < 0) {
-		weston_log("queueing pageflip failed: %m\n");
-		goto err_pageflip;
-	}
-
-	output->page_flip_pending = 1;
-
-	drm_output_set_cursor(output);
+static void
+cursor_bo_handle_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct drm_cursor_bo *cursor =
+		container_of(listener, struct drm_cursor_bo,
+			     buffer_destroy_listener);
 
-	/*
-	 * Now, update all the sprite surfaces
-	 */
-	wl_list_for_each(s, &backend->sprite_list, link) {
-		uint32_t flags = 0, fb_id = 0;
-		drmVBlank vbl = {
-			.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT,
-			.request.sequence = 1,
-		};
+	cursor->buffer = NULL;
+	wl_list_remove(&cursor->buffer_destroy_listener.link);
+}
 
-		if ((!s->current && !s->next) ||
-		    !drm_sprite_crtc_supported(output, s->possible_crtcs))
-			continue;
+static void
+cursor_bo_set_buffer(struct drm_cursor_bo *cursor, struct weston_buffer *buffer)
+{
+	if (cursor->buffer == buffer)
+		return;
 
-		if (s->next && !backend->sprites_hidden)
-			fb_id = s->next->fb_id;
+	if (cursor->buffer)
+		wl_list_remove(&cursor->buffer_destroy_listener.link);
 
-		ret = drmModeSetPlane(backend->drm.fd, s->plane_id,
-				      output->crtc_id, fb_id, flags,
-				      s->dest_x, s->dest_y,
-				      s->dest_w, s->dest_h,
-				      s->src_x, s->src_y,
-				      s->src_w, s->src_h);
-		if (ret)
-			weston_log("setplane failed: %d: %s\n",
-				ret, strerror(errno));
+	cursor->buffer = buffer;
+	cursor->buffer_destroy_listener.notify =
+		cursor_bo_handle_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal,
+		      &cursor->buffer_destroy_listener);
+}
 
-		vbl.request.type |= drm_waitvblank_pipe(output);
+/**
+ * Get a cursor bo holding the image of the cursor surface
+ *
+ * Cursor bos are cached by buffer, so that animated cursors cycling
+ * through a few buffers are only written once. A cached bo is only
+ * reused if its contents still match the buffer, as clients may redraw
+ * a released buffer. The bo on screen is never written to.
+ *
+ * @param output DRM output showing the cursor
+ * @param ev View to use for cursor image
+ * @returns the cursor bo to show, or NULL on failure
+ */
+static struct drm_cursor_bo *
+drm_output_get_cursor_bo(struct drm_output *output, struct weston_view *ev)
+{
+	struct drm_backend *b =
+		(struct drm_backend *) output->base.compositor->backend;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	size_t size = b->cursor_width * b->cursor_height * 4;
+	struct weston_view *under = output->cursor_under;
+	int32_t scale = output->base.current_scale;
+	struct drm_cursor_bo *cursor, *victim = NULL;
+	int32_t x, y;
+	int i;
 
-		/*
-		 * Queue a vblank signal so we know when the surface
-		 * becomes active on the display or has been replaced.
-		 */
-		vbl.request.signal = (unsigned long)s;
-		ret = drmWaitVBlank(backend->drm.fd, &vbl);
-		if (ret) {
-			weston_log("vblank event request failed: %d: %s\n",
-				ret, strerror(errno));
+	memset(output->cursor_scratch, 0, size);
+	drm_output_cursor_origin(output, ev, &x, &y);
+	if (under)
+		cursor_image_copy(output, under, output->cursor_scratch,
+				  ((int32_t) under->geometry.x - x) * scale,
+				  ((int32_t) under->geometry.y - y) * scale,
+				  PIXMAN_OP_SRC);
+	cursor_image_copy(output, ev, output->cursor_scratch,
+			  ((int32_t) ev->geometry.x - x) * scale,
+			  ((int32_t) ev->geometry.y - y) * scale,
+			  under ? PIXMAN_OP_OVER : PIXMAN_OP_SRC);
+
+	for (i = 0; i < DRM_CURSOR_CACHE_SIZE; i++) {
+		cursor = &output->cursor_bo[i];
+		if (cursor->buffer == buffer &&
+		    memcmp(cursor->pixels, output->cursor_scratch, size) == 0) {
+			cursor->last_used = ++output->cursor_serial;
+			return cursor;
 		}
 
-		s->output = output;
-		output->vblank_pending = 1;
+		if (cursor == output->cursor_current)
+			continue;
+		if (!victim || cursor->last_used < victim->last_used)
+			victim = cursor;
 	}
 
-	return 0;
-
-err_pageflip:
-	output->cursor_view = NULL;
-	if (output->next) {
-		drm_output_release_fb(output, output->next);
-		output->next = NULL;
+	if (gbm_bo_write(victim->bo, output->cursor_scratch, size) < 0) {
+		weston_log("failed update cursor: %m\n");
+		return NULL;
 	}
 
-	return -1;
+	memcpy(victim->pixels, output->cursor_scratch, size);
+	cursor_bo_set_buffer(victim, buffer);
+	victim->last_used = ++output->cursor_serial;
+
+	return victim;
 }
 
 static void
-drm_output_start_repaint_loop(struct weston_output *output_base)
+drm_cursor_import_release(struct drm_cursor_import *import)
 {
-	struct drm_output *output = (struct drm_output *) output_base;
-	struct drm_backend *backend = (struct drm_backend *)
-		output_base->compositor->backend;
-	uint32_t fb_id;
-	struct timespec ts, tnow;
-	struct timespec vbl2now;
-	int64_t refresh_nsec;
-	int ret;
-	drmVBlank vbl = {
-		.request.type = DRM_VBLANK_RELATIVE,
-		.request.sequence = 0,
-		.request.signal = 0,
-	};
+	if (import->bo)
+		gbm_bo_destroy(import->bo);
+	import->bo = NULL;
+	weston_buffer_reference(&import->buffer_ref, NULL);
+}
 
-	if (output->destroy_pending)
-		return;
+/**
+ * Retire the import on screen, and release the one retired before
+ *
+ * @param output DRM output showing the cursor
+ * @returns the now empty import slot to use next
+ */
+static struct drm_cursor_import *
+drm_output_next_cursor_import(struct drm_output *output)
+{
+	struct drm_cursor_import *import;
 
-	if (!output->current) {
-		/* We can't page flip if there's no mode set */
-		goto finish_frame;
-	}
+	output->cursor_import_current ^= 1;
+	import = &output->cursor_import[output->cursor_import_current];
+	drm_cursor_import_release(import);
 
-	/* Try to get current msc and timestamp via instant query */
-	vbl.request.type |= drm_waitvblank_pipe(output);
-	ret = drmWaitVBlank(backend->drm.fd, &vbl);
+	return import;
+}
 
-	/* Error ret or zero timestamp means failure to get valid timestamp */
-	if ((ret == 0) && (vbl.reply.tval_sec > 0 || vbl.reply.tval_usec > 0)) {
-		ts.tv_sec = vbl.reply.tval_sec;
-		ts.tv_nsec = vbl.reply.tval_usec * 1000;
+/**
+ * Get the gbm bo to show for the cursor surface
+ *
+ * dmabufs are imported, shm buffers are copied into a cursor bo.
+ *
+ * @param output DRM output showing the cursor
+ * @param ev View to use for cursor image
+ * @returns the bo to show, or NULL on failure
+ */
+static struct gbm_bo *
+drm_output_update_cursor(struct drm_output *output, struct weston_view *ev)
+{
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
+	struct drm_cursor_import *import;
+	struct drm_cursor_bo *cursor;
+#ifdef HAVE_GBM_FD_IMPORT
+	struct drm_backend *b =
+		(struct drm_backend *) output->base.compositor->backend;
+	struct linux_dmabuf_buffer *dmabuf;
 
-		/* Valid timestamp for most recent vblank - not stale?
-		 * Stale ts could happen on Linux 3.17+, so make sure it
-		 * is not older than 1 refresh duration since now.
-		 */
-		weston_compositor_read_presentation_clock(backend->compositor,
-							  &tnow);
-		timespec_sub(&vbl2now, &tnow, &ts);
-		refresh_nsec =
-			millihz_to_nsec(output->base.current_mode->refresh);
-		if (timespec_to_nsec(&vbl2now) < refresh_nsec) {
-			drm_output_update_msc(output, vbl.reply.sequence);
-			weston_output_finish_frame(output_base, &ts,
-						PRESENTATION_FEEDBACK_INVALID);
-			return;
-		}
+	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+	if (dmabuf) {
+		struct gbm_import_fd_data gbm_dmabuf = {
+			.fd     = dmabuf->dmabuf_fd[0],
+			.width  = dmabuf->width,
+			.height = dmabuf->height,
+			.stride = dmabuf->stride[0],
+			.format = dmabuf->format
+		};
+
+		import = &output->cursor_import[output->cursor_import_current];
+		if (import->bo && import->buffer_ref.buffer == buffer)
+			return import->bo;
+
+		import = drm_output_next_cursor_import(output);
+		import->bo = gbm_bo_import(b->gbm, GBM_BO_IMPORT_FD,
+					   &gbm_dmabuf, GBM_BO_USE_CURSOR);
+		if (!import->bo)
+			return NULL;
+		weston_buffer_reference(&import->buffer_ref, buffer);
+		output->cursor_current = NULL;
+
+		return import->bo;
 	}
+#endif
 
-	/* Immediate query didn't provide valid timestamp.
-	 * Use pageflip fallback.
-	 */
-	fb_id = output->current->fb_id;
+	cursor = drm_output_get_cursor_bo(output, ev);
+	if (!cursor)
+		return NULL;
 
-	if (drmModePageFlip(backend->drm.fd, output->crtc_id, fb_id,
-			    DRM_MODE_PAGE_FLIP_EVENT, output) < 0) {
-		weston_log("queueing pageflip failed: %m\n");
-		goto finish_frame;
+	import = &output->cursor_import[output->cursor_import_current];
+	if (import->bo)
+		drm_output_next_cursor_import(output);
+	output->cursor_current = cursor;
+
+	return cursor->bo;
+}
+
+/**
+ * Prepare the cursor plane state for the next atomic commit
+ *
+ * @param output DRM output owning the cursor plane
+ * @param ev View to show on the cursor plane, or NULL to hide it
+ */
+/* Whether the views composed into the cursor image moved relative to
+ * each other since it was made, and remember how they are now */
+static int
+drm_output_cursor_layout_changed(struct drm_output *output,
+				 struct weston_view *ev)
+{
+	struct weston_view *under = output->cursor_under;
+	int32_t dx = 0, dy = 0;
+	int changed;
+
+	if (under) {
+		dx = (int32_t) under->geometry.x - (int32_t) ev->geometry.x;
+		dy = (int32_t) under->geometry.y - (int32_t) ev->geometry.y;
 	}
 
-	return;
+	changed = output->cursor_composed != (under != NULL) ||
+		  output->cursor_under_dx != dx ||
+		  output->cursor_under_dy != dy;
 
-finish_frame:
-	/* if we cannot page-flip, immediately finish frame */
-	weston_compositor_read_presentation_clock(output_base->compositor, &ts);
-	weston_output_finish_frame(output_base, &ts,
-				   PRESENTATION_FEEDBACK_INVALID);
+	output->cursor_composed = under != NULL;
+	output->cursor_under_dx = dx;
+	output->cursor_under_dy = dy;
+
+	return changed;
 }
 
 static void
-drm_output_update_msc(struct drm_output *output, unsigned int seq)
+drm_output_set_cursor_plane(struct drm_output *output, struct weston_view *ev)
 {
-	uint64_t msc_hi = output->base.msc >> 32;
+	struct drm_backend *b =
+		(struct drm_backend *) output->base.compositor->backend;
+	struct drm_sprite *s = output->cursor_sprite;
+	struct gbm_bo *bo;
+	int32_t x, y;
+	int changed;
 
-	if (seq < (output->base.msc & 0xffffffff))
-		msc_hi++;
+	if (ev == NULL) {
+		s->next = NULL;
+		return;
+	}
 
-	output->base.msc = (msc_hi << 32) + seq;
+	changed = drm_output_cursor_layout_changed(output, ev);
+	if (!s->next || changed ||
+	    pixman_region32_not_empty(&output->cursor_plane.damage)) {
+		pixman_region32_fini(&output->cursor_plane.damage);
+		pixman_region32_init(&output->cursor_plane.damage);
+
+		bo = drm_output_update_cursor(output, ev);
+		s->next = bo ? drm_fb_get_from_bo(bo, b, GBM_FORMAT_ARGB8888) :
+			       NULL;
+		if (!s->next) {
+			weston_log("failed to create cursor fb\n");
+			b->cursors_are_broken = 1;
+			return;
+		}
+	}
+
+	drm_output_cursor_origin(output, ev, &x, &y);
+	s->src_x = 0;
+	s->src_y = 0;
+	s->src_w = b->cursor_width << 16;
+	s->src_h = b->cursor_height << 16;
+	s->dest_x = (x - output->base.x) * output->base.current_scale;
+	s->dest_y = (y - output->base.y) * output->base.current_scale;
+	s->dest_w = b->cursor_width;
+	s->dest_h = b->cursor_height;
+
+	output->cursor_plane.x = s->dest_x;
+	output->cursor_plane.y = s->dest_y;
 }
 
 static void
-vblank_handler(int fd, unsigned int frame, unsigned int sec, unsigned int usec,
-	       void *data)
+drm_output_set_cursor(struct drm_output *output)
 {
-	struct drm_sprite *s = (struct drm_sprite *)data;
-	struct drm_output *output = s->output;
-	struct timespec ts;
-	uint32_t flags = PRESENTATION_FEEDBACK_KIND_HW_COMPLETION |
-			 PRESENTATION_FEEDBACK_KIND_HW_CLOCK;
+	struct weston_view *ev = output->cursor_view;
+	struct weston_buffer *buffer;
+	struct drm_backend *b =
+		(struct drm_backend *) output->base.compositor->backend;
+	EGLint handle;
+	struct gbm_bo *bo;
+	int32_t x, y;
+	int changed;
 
-	drm_output_update_msc(output, frame);
-	output->vblank_pending = 0;
+	output->cursor_view = NULL;
 
-	drm_output_release_fb(output, s->current);
-	s->current = s->next;
-	s->next = NULL;
+	if (output->cursor_sprite) {
+		drm_output_set_cursor_plane(output, ev);
+		return;
+	}
 
-	if (!output->page_flip_pending) {
-		ts.tv_sec = sec;
-		ts.tv_nsec = usec * 1000;
-		weston_output_finish_frame(&output->base, &ts, flags);
+	if (ev == NULL) {
+		drmModeSetCursor(drm_output_fd(output), output->crtc_id,
+				 0, 0, 0);
+		return;
 	}
-}
 
-static void
-drm_output_destroy(struct weston_output *output_base);
+	buffer = ev->surface->buffer_ref.buffer;
 
-static void
-page_flip_handler(int fd, unsigned int frame,
-		  unsigned int sec, unsigned int usec, void *data)
-{
-	struct drm_output *output = (struct drm_output *) data;
-	struct timespec ts;
-	uint32_t flags = PRESENTATION_FEEDBACK_KIND_VSYNC |
-			 PRESENTATION_FEEDBACK_KIND_HW_COMPLETION |
-			 PRESENTATION_FEEDBACK_KIND_HW_CLOCK;
+	changed = drm_output_cursor_layout_changed(output, ev);
+	if (buffer &&
+	    (changed ||
+	     pixman_region32_not_empty(&output->cursor_plane.damage))) {
+		pixman_region32_fini(&output->cursor_plane.damage);
+		pixman_region32_init(&output->cursor_plane.damage);
 
-	drm_output_update_msc(output, frame);
+		bo = drm_output_update_cursor(output, ev);
+		if (!bo) {
+			b->cursors_are_broken = 1;
+			return;
+		}
 
-	/* We don't set page_flip_pending on start_repaint_loop, in that case
-	 * we just want to page flip to the current buffer to get an accurate
-	 * timestamp */
-	if (output->page_flip_pending) {
-		drm_output_release_fb(output, output->current);
-		output->current = output->next;
-		output->next = NULL;
+		handle = gbm_bo_get_handle(bo).s32;
+		if (drmModeSetCursor(b->drm.fd, output->crtc_id, handle,
+				b->cursor_width, b->cursor_height)) {
+			weston_log("failed to set cursor: %m\n");
+			b->cursors_are_broken = 1;
+		}
 	}
 
-	output->page_flip_pending = 0;
-
-	if (output->destroy_pending)
-		drm_output_destroy(&output->base);
-	else if (!output->vblank_pending) {
-		ts.tv_sec = sec;
-		ts.tv_nsec = usec * 1000;
-		weston_output_finish_frame(&output->base, &ts, flags);
+	drm_output_cursor_origin(output, ev, &x, &y);
+	x = (x - output->base.x) * output->base.current_scale;
+	y = (y - output->base.y) * output->base.current_scale;
+	if (output->cursor_plane.x != x || output->cursor_plane.y != y) {
+		if (drmModeMoveCursor(b->drm.fd, output->crtc_id, x, y)) {
+			weston_log("failed to move cursor: %m\n");
+			b->cursors_are_broken = 1;
+		}
 
-		/* We can't call this from frame_notify, because the output's
-		 * repaint needed flag is cleared just after that */
-		if (output->recorder)
-			weston_output_schedule_repaint(&output->base);
+		output->cursor_plane.x = x;
+		output->cursor_plane.y = y;
 	}
 }
 
-static uint32_t
-drm_output_check_sprite_format(struct drm_sprite *s,
-			       struct weston_view *ev, struct gbm_bo *bo)
+/**
+ * Allocate the cursor bo cache of an output
+ *
+ * @param output DRM output
+ * @param b DRM backend structure
+ * @returns 0 on success, -1 if hardware cursors cannot be used
+ */
+static int
+drm_output_init_cursor_bos(struct drm_output *output, struct drm_backend *b)
 {
-	uint32_t i, format;
-
-	format = gbm_bo_get_format(bo);
-
-	if (format == GBM_FORMAT_ARGB8888) {
-		pixman_region32_t r;
-
-		pixman_region32_init_rect(&r, 0, 0,
-					  ev->surface->width,
-					  ev->surface->height);
-		pixman_region32_subtract(&r, &r, &ev->surface->opaque);
+	size_t size = b->cursor_width * b->cursor_height * 4;
+	struct drm_cursor_bo *cursor;
+	int i;
 
-		if (!pixman_region32_not_empty(&r))
-			format = GBM_FORMAT_XRGB8888;
+	output->cursor_scratch = zalloc(size);
+	if (!output->cursor_scratch)
+		return -1;
 
-		pixman_region32_fini(&r);
+	for (i = 0; i < DRM_CURSOR_CACHE_SIZE; i++) {
+		cursor = &output->cursor_bo[i];
+		cursor->bo = gbm_bo_create(b->gbm, b->cursor_width,
+					   b->cursor_height,
+					   GBM_FORMAT_ARGB8888,
+					   GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE);
+		cursor->pixels = zalloc(size);
+		if (!cursor->bo || !cursor->pixels)
+			return -1;
 	}
 
-	for (i = 0; i < s->count_formats; i++)
-		if (s->formats[i] == format)
-			return format;
-
 	return 0;
 }
 
-static struct weston_plane *
-drm_output_prepare_overlay_view(struct drm_output *output,
-				struct weston_view *ev)
+static void
+drm_output_fini_cursor_bos(struct drm_output *output)
 {
-	struct weston_compositor *ec = output->base.compositor;
-	struct drm_backend *b = (struct drm_backend *)ec->backend;
-	struct wl_resource *buffer_resource;
-	struct weston_matrix matrix;
-	struct drm_sprite *s;
-	struct linux_dmabuf_buffer *dmabuf;
-	int found = 0;
-	struct gbm_bo *bo;
-	pixman_region32_t dest_rect, src_rect;
-	pixman_box32_t *box, tbox;
-	enum wl_output_transform transform;
-	uint32_t format;
-	float scalex, scaley, transx, transy;
-	int32_t sx1, sy1, sx2, sy2;
+	struct drm_cursor_bo *cursor;
+	int i;
 
-	if (b->gbm == NULL)
-		return NULL;
+	for (i = 0; i < DRM_CURSOR_CACHE_SIZE; i++) {
+		cursor = &output->cursor_bo[i];
+		if (cursor->buffer)
+			wl_list_remove(&cursor->buffer_destroy_listener.link);
+		if (cursor->bo)
+			gbm_bo_destroy(cursor->bo);
+		free(cursor->pixels);
+		memset(cursor, 0, sizeof *cursor);
+	}
 
-	if (b->sprites_are_broken)
-		return NULL;
+	drm_cursor_import_release(&output->cursor_import[0]);
+	drm_cursor_import_release(&output->cursor_import[1]);
+	free(output->cursor_scratch);
+	output->cursor_scratch = NULL;
+	output->cursor_current = NULL;
+}
 
-	if (ev->output_mask != (1u << output->base.id))
-		return NULL;
+static void
+scanout_formats_add(struct wl_array *formats, uint32_t format, uint32_t plane)
+{
+	struct weston_scanout_format *f;
 
-	if (ev->surface->buffer_ref.buffer == NULL)
-		return NULL;
-	buffer_resource = ev->surface->buffer_ref.buffer->resource;
+	wl_array_for_each(f, formats)
+		if (f->format == format && f->plane == plane)
+			return;
 
-	if (ev->alpha != 1.0f)
-		return NULL;
+	f = wl_array_add(formats, sizeof *f);
+	if (!f)
+		return;
 
-	if (wl_shm_buffer_get(buffer_resource))
-		return NULL;
+	f->format = format;
+	f->modifier = 0;
+	f->plane = plane;
+}
 
-	weston_view_to_output_matrix(ev, &output->base, false, &matrix);
+/**
+ * List the dmabuf formats the output can scan out
+ *
+ * These are the formats drm_output_prepare_scanout_view() and
+ * drm_output_prepare_overlay_view() accept. The planes do not report
+ * supported modifiers, so only the driver chosen layout is advertised.
+ *
+ * @param output_base The output to describe
+ * @param formats Array of struct weston_scanout_format to append to
+ */
+static void
+drm_output_get_scanout_formats(struct weston_output *output_base,
+			       struct wl_array *formats)
+{
+	struct drm_output *output = (struct drm_output *)output_base;
+	struct drm_backend *b =
+		(struct drm_backend *)output_base->compositor->backend;
+	struct drm_sprite *s;
+	uint32_t i;
 
-	if (!weston_matrix_to_transform(&matrix, &transform,
-					&scalex, &scaley,
-					&transx, &transy))
-		return NULL;
+	/* Nothing is scanned out directly on a secondary GPU */
+	if (b->gbm == NULL || output->gpu)
+		return;
 
-	if (transform != WL_OUTPUT_TRANSFORM_NORMAL)
-		return NULL;
+	scanout_formats_add(formats, output->format,
+			    ZLINUX_DMABUF_SCANOUT_FEEDBACK_PLANE_PRIMARY);
+	/* ARGB is scanned out as XRGB when the surface is opaque */
+	if (output->format == GBM_FORMAT_XRGB8888)
+		scanout_formats_add(formats, GBM_FORMAT_ARGB8888,
+				    ZLINUX_DMABUF_SCANOUT_FEEDBACK_PLANE_PRIMARY);
+
+	if (b->sprites_are_broken)
+		return;
 
 	wl_list_for_each(s, &b->sprite_list, link) {
-		if (!drm_sprite_crtc_supported(output, s->possible_crtcs))
+		if (s->type != WDRM_PLANE_TYPE_OVERLAY ||
+		    !drm_sprite_crtc_supported(output, s->possible_crtcs))
 			continue;
 
-		if (!s->next) {
-			found = 1;
-			break;
-		}
-	}
-
-	/* No sprites available */
-	if (!found)
-		return NULL;
-
-	if ((dmabuf = linux_dmabuf_buffer_get(buffer_resource))) {
-#ifdef HAVE_GBM_FD_IMPORT
-		/* XXX: TODO:
-		 *
-		 * Use AddFB2 directly, do not go via GBM.
-		 * Add support for multiplanar formats.
-		 * Both require refactoring in the DRM-backend to
-		 * support a mix of gbm_bos and drmfbs.
-		 */
-		struct gbm_import_fd_data gbm_dmabuf = {
-			.fd     = dmabuf->dmabuf_fd[0],
-			.width  = dmabuf->width,
-			.height = dmabuf->height,
-			.stride = dmabuf->stride[0],
-			.format = dmabuf->format
-		};
-
-		if (dmabuf->n_planes != 1 || dmabuf->offset[0] != 0)
-			return NULL;
-
-		bo = gbm_bo_import(b->gbm, GBM_BO_IMPORT_FD, &gbm_dmabuf,
-				   GBM_BO_USE_SCANOUT);
-#else
-		return NULL;
-#endif
-	} else {
-		bo = gbm_bo_import(b->gbm, GBM_BO_IMPORT_WL_BUFFER,
-				   buffer_resource, GBM_BO_USE_SCANOUT);
-	}
-	if (!bo)
-		return NULL;
-
-	format = drm_output_check_sprite_format(s, ev, bo);
-	if (format == 0) {
-		gbm_bo_destroy(bo);
-		return NULL;
-	}
-
-	s->next = drm_fb_get_from_bo(bo, b, format);
-	if (!s->next) {
-		gbm_bo_destroy(bo);
-		return NULL;
+		for (i = 0; i < s->count_formats; i++)
+			scanout_formats_add(formats, s->formats[i],
+					    ZLINUX_DMABUF_SCANOUT_FEEDBACK_PLANE_OVERLAY);
 	}
+}
 
-	drm_fb_set_buffer(s->next, ev->surface->buffer_ref.buffer);
-
-	box = pixman_region32_extents(&ev->transform.boundingbox);
-	s->plane.x = box->x1;
-	s->plane.y = box->y1;
+/* No more than this many views compete for an output's overlays */
+#define DRM_OVERLAY_CANDIDATES_MAX 16
+
+/* Overlay planning state for one drm_assign_planes() run */
+struct drm_overlay_plan {
+	/* Score a view needs to be worth one of the free overlays */
+	uint64_t threshold;
+	/* Overlay scanout handed out so far, in bytes per second */
+	uint64_t bandwidth;
+	/* Views put on overlays so far, in global coordinates */
+	pixman_region32_t occupied;
+};
 
-	/*
-	 * Calculate the source & dest rects properly based on actual
-	 * position (note the caller has called weston_view_update_transform()
-	 * for us already).
-	 */
-	pixman_region32_init(&dest_rect);
-	pixman_region32_intersect(&dest_rect, &ev->transform.boundingbox,
-				  &output->base.region);
-	weston_matrix_transform_region(&dest_rect, &output->base.matrix, &dest_rect);
-	box = pixman_region32_extents(&dest_rect);
+static int
+drm_view_on_overlay(struct drm_output *output, struct weston_view *ev)
+{
+	struct drm_backend *b =
+		(struct drm_backend *)output->base.compositor->backend;
+	struct drm_sprite *s;
 
-	s->dest_x = box->x1;
-	s->dest_y = box->y1;
-	s->dest_w = box->x2 - box->x1;
-	s->dest_h = box->y2 - box->y1;
-	pixman_region32_fini(&dest_rect);
+	wl_list_for_each(s, &b->sprite_list, link)
+		if (ev->plane == &s->plane)
+			return s->type == WDRM_PLANE_TYPE_OVERLAY &&
+			       drm_sprite_crtc_supported(output,
+							 s->possible_crtcs);
 
-	pixman_region32_init(&src_rect);
-	pixman_region32_intersect(&src_rect, &ev->transform.boundingbox,
-				  &output->base.region);
-	box = pixman_region32_extents(&src_rect);
+	return 0;
+}
 
-	weston_view_from_global(ev, box->x1, box->y1, &sx1, &sy1);
-	weston_view_from_global(ev, box->x2, box->y2, &sx2, &sy2);
+/**
+ * Estimate the composition work an overlay would save for a view
+ *
+ * This is the area of the view on the output, doubled when the
+ * renderer would have to blend it and quartered when it was not damaged
+ * this frame.  A view that was on an overlay last frame gets half as
+ * much again, so that planes are not handed back and forth between
+ * views of about the same worth.
+ */
+static uint64_t
+drm_view_overlay_score(struct drm_output *output, struct weston_view *ev)
+{
+	pixman_region32_t visible;
+	pixman_box32_t box;
+	uint64_t score;
 
+	pixman_region32_init(&visible);
+	pixman_region32_intersect(&visible, &ev->transform.boundingbox,
+				  &output->base.region);
+	box = *pixman_region32_extents(&visible);
+	pixman_region32_fini(&visible);
 
-	/* Previously we clamped to the surface edge here, but that will
-	 * result in incorrect scaling, so we just bail.
-	 */
-	if (sx1 < 0 || sy1 < 0 ||
-	    sx2 > ev->surface->width || sy2 > ev->surface->height)
-		return NULL;
+	score = (uint64_t) (box.x2 - box.x1) * (box.y2 - box.y1);
 
-	tbox.x1 = sx1;
-	tbox.y1 = sy1;
-	tbox.x2 = sx2;
-	tbox.y2 = sy2;
+	if (pixman_region32_contains_rectangle(&ev->transform.opaque,
+					       &box) != PIXMAN_REGION_IN)
+		score *= 2;
+	else if (ev->moving)
+		/* Composited, a dragged view repaints everything it
+		 * passes over, on an overlay only what it uncovers */
+		return UINT64_MAX;
 
-	tbox = weston_surface_to_buffer_rect(ev->surface, tbox);
+	if (!pixman_region32_not_empty(&ev->surface->damage))
+		score /= 4;
 
-	s->src_x = wl_fixed_from_int(tbox.x1);
-	s->src_y = wl_fixed_from_int(tbox.y1);
-	s->src_w = wl_fixed_from_int(tbox.x2 - tbox.x1);
-	s->src_h = wl_fixed_from_int(tbox.y2 - tbox.y1);
-	pixman_region32_fini(&src_rect);
+	if (drm_view_on_overlay(output, ev))
+		score += score / 2;
 
-	return &s->plane;
+	return score;
 }
 
-static struct weston_plane *
-drm_output_prepare_cursor_view(struct drm_output *output,
-			       struct weston_view *ev)
+/* Bytes per second scanning out a view's buffer from an overlay takes */
+static uint64_t
+drm_view_overlay_bandwidth(struct drm_output *output, struct weston_view *ev)
 {
-	struct drm_backend *b =
-		(struct drm_backend *)output->base.compositor->backend;
-	struct weston_buffer_viewport *viewport = &ev->surface->buffer_viewport;
-
-	if (b->gbm == NULL)
-		return NULL;
-	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL)
-		return NULL;
-	if (viewport->buffer.scale != output->base.current_scale)
-		return NULL;
-	if (output->cursor_view)
-		return NULL;
-	if (ev->output_mask != (1u << output->base.id))
-		return NULL;
-	if (b->cursors_are_broken)
-		return NULL;
-	if (ev->geometry.scissor_enabled)
-		return NULL;
-	if (ev->surface->buffer_ref.buffer == NULL ||
-	    !wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource) ||
-	    ev->surface->width > b->cursor_width ||
-	    ev->surface->height > b->cursor_height)
-		return NULL;
-
-	output->cursor_view = ev;
+	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
 
-	return &output->cursor_plane;
+	return (uint64_t) buffer->width * buffer->height * 4 *
+	       output->base.current_mode->refresh / 1000;
 }
 
 /**
- * Update the image for the current cursor surface
+ * Work out which views are worth this output's free overlays
  *
- * @param b DRM backend structure
- * @param bo GBM buffer object to write into
- * @param ev View to use for cursor image
+ * When there are more views that could go on an overlay than overlays,
+ * only the best scoring ones get to try.  A view covering the whole
+ * output is left out, as it goes on the primary plane if anything.
  */
 static void
-cursor_bo_update(struct drm_backend *b, struct gbm_bo *bo,
-		 struct weston_view *ev)
+drm_overlay_plan_init(struct drm_overlay_plan *plan, struct drm_output *output)
 {
-	struct weston_buffer *buffer = ev->surface->buffer_ref.buffer;
-	uint32_t buf[b->cursor_width * b->cursor_height];
-	int32_t stride;
-	uint8_t *s;
-	int i;
+	struct weston_compositor *ec = output->base.compositor;
+	struct drm_backend *b = (struct drm_backend *)ec->backend;
+	uint64_t best[DRM_OVERLAY_CANDIDATES_MAX], score;
+	pixman_box32_t *extents;
+	struct weston_view *ev;
+	struct drm_sprite *s;
+	int free_planes = 0, n = 0, i;
 
-	assert(buffer && buffer->shm_buffer);
-	assert(buffer->shm_buffer == wl_shm_buffer_get(buffer->resource));
-	assert(ev->surface->width <= b->cursor_width);
-	assert(ev->surface->height <= b->cursor_height);
+	plan->threshold = 0;
+	plan->bandwidth = 0;
+	pixman_region32_init(&plan->occupied);
 
-	memset(buf, 0, sizeof buf);
-	stride = wl_shm_buffer_get_stride(buffer->shm_buffer);
-	s = wl_shm_buffer_get_data(buffer->shm_buffer);
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != WDRM_PLANE_TYPE_OVERLAY ||
+		    !drm_sprite_crtc_supported(output, s->possible_crtcs) ||
+		    !drm_sprite_rotation_supported(output, s))
+			continue;
+		if (b->atomic_modeset && s->output && s->output != output)
+			continue;
+		free_planes++;
+	}
 
-	wl_shm_buffer_begin_access(buffer->shm_buffer);
-	for (i = 0; i < ev->surface->height; i++)
-		memcpy(buf + i * b->cursor_width,
-		       s + i * stride,
-		       ev->surface->width * 4);
-	wl_shm_buffer_end_access(buffer->shm_buffer);
+	if (free_planes == 0 || free_planes >= DRM_OVERLAY_CANDIDATES_MAX)
+		return;
 
-	if (gbm_bo_write(bo, buf, sizeof buf) < 0)
-		weston_log("failed update cursor: %m\n");
+	extents = pixman_region32_extents(&output->base.region);
+	wl_list_for_each(ev, &ec->view_list, link) {
+		if (ev->output_mask != (1u << output->base.id) ||
+		    !ev->surface->buffer_ref.buffer ||
+		    wl_shm_buffer_get(ev->surface->buffer_ref.buffer->resource) ||
+		    ev->alpha != 1.0f)
+			continue;
+
+		if (pixman_region32_contains_rectangle(&ev->transform.boundingbox,
+						       extents) == PIXMAN_REGION_IN)
+			continue;
+
+		/* Keep the free_planes + 1 best scores, in order */
+		score = drm_view_overlay_score(output, ev);
+		for (i = n; i > 0 && best[i - 1] < score; i--)
+			if (i <= free_planes)
+				best[i] = best[i - 1];
+		if (i <= free_planes)
+			best[i] = score;
+		if (n <= free_planes)
+			n++;
+	}
+
+	if (n > free_planes)
+		plan->threshold = best[free_planes - 1];
 }
 
-static void
-drm_output_set_cursor(struct drm_output *output)
+/**
+ * Try a view on an overlay, if the plan allows for it
+ *
+ * Without a zpos property the stacking of overlays against each other
+ * is up to the hardware, so a view below one already on an overlay must
+ * be composited instead.  The view must also score well enough and fit
+ * in what is left of the bandwidth budget.
+ */
+static struct weston_plane *
+drm_output_plan_overlay_view(struct drm_output *output,
+			     struct weston_view *ev,
+			     struct drm_overlay_plan *plan,
+			     enum drm_plane_reject *reject)
 {
-	struct weston_view *ev = output->cursor_view;
-	struct weston_buffer *buffer;
 	struct drm_backend *b =
-		(struct drm_backend *) output->base.compositor->backend;
-	EGLint handle;
-	struct gbm_bo *bo;
-	int x, y;
-
-	output->cursor_view = NULL;
-	if (ev == NULL) {
-		drmModeSetCursor(b->drm.fd, output->crtc_id, 0, 0, 0);
-		return;
+		(struct drm_backend *)output->base.compositor->backend;
+	struct weston_plane *plane;
+	pixman_region32_t below;
+	uint64_t bandwidth = 0;
+	int occluded;
+
+	pixman_region32_init(&below);
+	pixman_region32_intersect(&below, &plan->occupied,
+				  &ev->transform.boundingbox);
+	occluded = pixman_region32_not_empty(&below);
+	pixman_region32_fini(&below);
+	if (occluded)
+		return drm_plane_reject(reject, DRM_REJECT_OCCLUDED);
+
+	if (ev->surface->buffer_ref.buffer &&
+	    drm_view_overlay_score(output, ev) < plan->threshold)
+		return drm_plane_reject(reject, DRM_REJECT_COST);
+
+	if (b->overlay_bandwidth && ev->surface->buffer_ref.buffer) {
+		bandwidth = drm_view_overlay_bandwidth(output, ev);
+		if (plan->bandwidth + bandwidth >
+		    (uint64_t) b->overlay_bandwidth * 1000000)
+			return drm_plane_reject(reject, DRM_REJECT_BANDWIDTH);
 	}
 
-	buffer = ev->surface->buffer_ref.buffer;
+	plane = drm_output_prepare_overlay_view(output, ev, reject);
+	if (plane) {
+		plan->bandwidth += bandwidth;
+		pixman_region32_union(&plan->occupied, &plan->occupied,
+				      &ev->transform.boundingbox);
+	}
 
-	if (buffer &&
-	    pixman_region32_not_empty(&output->cursor_plane.damage)) {
-		pixman_region32_fini(&output->cursor_plane.damage);
-		pixman_region32_init(&output->cursor_plane.damage);
-		output->current_cursor ^= 1;
-		bo = output->cursor_bo[output->current_cursor];
+	return plane;
+}
 
-		cursor_bo_update(b, bo, ev);
-		handle = gbm_bo_get_handle(bo).s32;
-		if (drmModeSetCursor(b->drm.fd, output->crtc_id, handle,
-				b->cursor_width, b->cursor_height)) {
-			weston_log("failed to set cursor: %m\n");
-			b->cursors_are_broken = 1;
-		}
+/** Account for where drm_assign_planes() put a view on this output
+ *
+ * A view on the primary plane counts against every plane it was
+ * tried on, with the reason it was turned down.  The timeline gets a
+ * drm_reject_* point for it: the scanout reason when the view was
+ * positioned and sized to be scanned out, the overlay one otherwise.
+ */
+static void
+drm_output_plane_stats_add(struct drm_output *output, struct weston_view *ev,
+			   struct weston_plane *plane,
+			   const enum drm_plane_reject *reject)
+{
+	enum drm_plane_reject shown;
+	char label[64];
+	int try;
+
+	if (plane == &output->cursor_plane)
+		output->plane_assigned[DRM_PLANE_TRY_CURSOR]++;
+	else if (plane == &output->fb_plane)
+		output->plane_assigned[DRM_PLANE_TRY_SCANOUT]++;
+	else if (plane != &output->base.compositor->primary_plane)
+		output->plane_assigned[DRM_PLANE_TRY_OVERLAY]++;
+	else
+		for (try = 0; try < DRM_PLANE_TRY_COUNT; try++)
+			output->plane_rejects[try][reject[try]]++;
+
+	if (plane == &output->base.compositor->primary_plane) {
+		shown = reject[DRM_PLANE_TRY_SCANOUT];
+		if (shown == DRM_REJECT_GEOMETRY)
+			shown = reject[DRM_PLANE_TRY_OVERLAY];
+		TL_POINT(drm_plane_reject_points[shown], TLP_OUTPUT(&output->base),
+			 TLP_SURFACE(ev->surface), TLP_END);
 	}
 
-	x = (ev->geometry.x - output->base.x) * output->base.current_scale;
-	y = (ev->geometry.y - output->base.y) * output->base.current_scale;
-	if (output->cursor_plane.x != x || output->cursor_plane.y != y) {
-		if (drmModeMoveCursor(b->drm.fd, output->crtc_id, x, y)) {
-			weston_log("failed to move cursor: %m\n");
-			b->cursors_are_broken = 1;
-		}
+	if (!output->plane_stats_dump_views)
+		return;
 
-		output->cursor_plane.x = x;
-		output->cursor_plane.y = y;
+	if (!ev->surface->get_label ||
+	    ev->surface->get_label(ev->surface, label, sizeof label) < 0)
+		snprintf(label, sizeof label, "unlabelled");
+
+	if (plane != &output->base.compositor->primary_plane) {
+		weston_log_continue(STAMP_SPACE "%s: on a plane\n", label);
+		return;
 	}
+
+	weston_log_continue(STAMP_SPACE "%s: primary, cursor %s, "
+			    "scanout %s, overlay %s\n", label,
+			    drm_plane_reject_names[reject[DRM_PLANE_TRY_CURSOR]],
+			    drm_plane_reject_names[reject[DRM_PLANE_TRY_SCANOUT]],
+			    drm_plane_reject_names[reject[DRM_PLANE_TRY_OVERLAY]]);
 }
 
 static void
@@ -1192,9 +3458,12 @@ drm_assign_planes(struct weston_output *output_base)
 	struct drm_backend *b =
 		(struct drm_backend *)output_base->compositor->backend;
 	struct drm_output *output = (struct drm_output *)output_base;
-	struct weston_view *ev, *next;
+	struct weston_view *ev, *next, *prev = NULL;
 	pixman_region32_t overlap, surface_overlap;
-	struct weston_plane *primary, *next_plane;
+	struct weston_plane *primary, *software_cursor, *next_plane;
+	enum drm_plane_reject reject[DRM_PLANE_TRY_COUNT];
+	struct drm_overlay_plan plan;
+	int try;
 
 	/*
 	 * Find a surface for each sprite in the output using some heuristics:
@@ -1208,9 +3477,18 @@ drm_assign_planes(struct weston_output *output_base)
 	 * the main display surface may not need to update at all, and
 	 * the client buffer can be used directly for the sprite surface
 	 * as we do for flipping full screen surfaces.
+	 *
+	 * Views are still placed front to back, but overlays are kept
+	 * for the views drm_view_overlay_score() rates highest.
 	 */
 	pixman_region32_init(&overlap);
+	drm_overlay_plan_init(&plan, output);
+	output->cursor_under = NULL;
 	primary = &output_base->compositor->primary_plane;
+	software_cursor = &output_base->compositor->cursor_plane;
+	output->plane_stats_repaints++;
+	if (output->plane_stats_dump_views)
+		weston_log("DRM plane assignment on %s:\n", output_base->name);
 
 	wl_list_for_each_safe(ev, next, &output_base->compositor->view_list, link) {
 		struct weston_surface *es = ev->surface;
@@ -1235,25 +3513,57 @@ drm_assign_planes(struct weston_output *output_base)
 		pixman_region32_intersect(&surface_overlap, &overlap,
 					  &ev->transform.boundingbox);
 
+		for (try = 0; try < DRM_PLANE_TRY_COUNT; try++)
+			reject[try] = DRM_REJECT_NONE;
+
 		next_plane = NULL;
-		if (pixman_region32_not_empty(&surface_overlap))
+		if (output->gpu) {
+			next_plane = primary;
+			for (try = 0; try < DRM_PLANE_TRY_COUNT; try++)
+				reject[try] = DRM_REJECT_DISABLED;
+		} else if (pixman_region32_not_empty(&surface_overlap)) {
 			next_plane = primary;
+			for (try = 0; try < DRM_PLANE_TRY_COUNT; try++)
+				reject[try] = DRM_REJECT_OCCLUDED;
+		} else if (output_base->disable_planes &&
+			   !drm_view_is_side_channel_cursor(output, ev)) {
+			next_plane = primary;
+			for (try = 0; try < DRM_PLANE_TRY_COUNT; try++)
+				reject[try] = DRM_REJECT_DISABLED;
+		}
 		if (next_plane == NULL)
-			next_plane = drm_output_prepare_cursor_view(output, ev);
+			next_plane = drm_output_prepare_cursor_view(output, ev,
+					prev, &reject[DRM_PLANE_TRY_CURSOR]);
+		if (next_plane == NULL && output_base->disable_planes) {
+			next_plane = primary;
+			reject[DRM_PLANE_TRY_SCANOUT] = DRM_REJECT_DISABLED;
+			reject[DRM_PLANE_TRY_OVERLAY] = DRM_REJECT_DISABLED;
+		}
 		if (next_plane == NULL)
-			next_plane = drm_output_prepare_scanout_view(output, ev);
+			next_plane = drm_output_prepare_scanout_view(output, ev,
+					&reject[DRM_PLANE_TRY_SCANOUT]);
 		if (next_plane == NULL)
-			next_plane = drm_output_prepare_overlay_view(output, ev);
+			next_plane = drm_output_plan_overlay_view(output, ev,
+					&plan, &reject[DRM_PLANE_TRY_OVERLAY]);
 		if (next_plane == NULL)
-			next_plane = primary;
+			next_plane = weston_view_get_fallback_plane(ev);
+
+		/* The software cursor is composited like the primary */
+		if (ev->output_mask & (1u << output_base->id))
+			drm_output_plane_stats_add(output, ev,
+						   next_plane == software_cursor ?
+						   primary : next_plane,
+						   reject);
 
 		weston_view_move_to_plane(ev, next_plane);
 
-		if (next_plane == primary)
+		/* The software cursor is in the primary framebuffer too */
+		if (next_plane == primary || next_plane == software_cursor)
 			pixman_region32_union(&overlap, &overlap,
 					      &ev->transform.boundingbox);
 
 		if (next_plane == primary ||
+		    next_plane == software_cursor ||
 		    next_plane == &output->cursor_plane) {
 			/* cursor plane involves a copy */
 			ev->psf_flags = 0;
@@ -1265,13 +3575,20 @@ drm_assign_planes(struct weston_output *output_base)
 		}
 
 		pixman_region32_fini(&surface_overlap);
+		prev = ev;
 	}
 	pixman_region32_fini(&overlap);
+	pixman_region32_fini(&plan.occupied);
+
+	output->plane_stats_dump_views = 0;
 }
 
 static void
 drm_output_fini_pixman(struct drm_output *output);
 
+static void
+drm_output_fini_gpu_copy(struct drm_output *output);
+
 static void
 drm_output_destroy(struct weston_output *output_base)
 {
@@ -1279,6 +3596,7 @@ drm_output_destroy(struct weston_output *output_base)
 	struct drm_backend *b =
 		(struct drm_backend *)output->base.compositor->backend;
 	drmModeCrtcPtr origcrtc = output->original_crtc;
+	struct drm_sprite *s;
 
 	if (output->page_flip_pending) {
 		output->destroy_pending = 1;
@@ -1286,26 +3604,65 @@ drm_output_destroy(struct weston_output *output_base)
 		return;
 	}
 
+	/* Nothing to wait for once the buffers are gone */
+	if (output->render_fence_source) {
+		drm_output_clear_render_fence(output);
+		output->render_pending = 0;
+		drm_output_release_fb(output, output->next);
+		output->next = NULL;
+	}
+
+	if (output->render_pending) {
+		output->destroy_pending = 1;
+		return;
+	}
+
+#ifdef BUILD_VAAPI_RECORDER
+	if (output->recorder)
+		recorder_destroy(output);
+#endif
+
 	if (output->backlight)
 		backlight_destroy(output->backlight);
 
 	drmModeFreeProperty(output->dpms_prop);
 
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->output != output)
+			continue;
+
+		if (s->type == WDRM_PLANE_TYPE_OVERLAY) {
+			drm_output_release_fb(output, s->current);
+			drm_output_release_fb(output, s->next);
+		}
+		s->current = s->next = NULL;
+		s->output = NULL;
+	}
+
 	/* Turn off hardware cursor */
-	drmModeSetCursor(b->drm.fd, output->crtc_id, 0, 0, 0);
+	drmModeSetCursor(drm_output_fd(output), output->crtc_id, 0, 0, 0);
 
 	/* Restore original CRTC state */
-	drmModeSetCrtc(b->drm.fd, origcrtc->crtc_id, origcrtc->buffer_id,
-		       origcrtc->x, origcrtc->y,
+	drmModeSetCrtc(drm_output_fd(output), origcrtc->crtc_id,
+		       origcrtc->buffer_id, origcrtc->x, origcrtc->y,
 		       &output->connector_id, 1, &origcrtc->mode);
 	drmModeFreeCrtc(origcrtc);
 
-	b->crtc_allocator &= ~(1 << output->crtc_id);
-	b->connector_allocator &= ~(1 << output->connector_id);
+	if (output->gpu) {
+		output->gpu->crtc_allocator &= ~(1 << output->crtc_id);
+		output->gpu->connector_allocator &=
+			~(1 << output->connector_id);
+		wl_list_remove(&output->gpu_copy_listener.link);
+	} else {
+		b->crtc_allocator &= ~(1 << output->crtc_id);
+		b->connector_allocator &= ~(1 << output->connector_id);
+	}
 
 	if (b->use_pixman) {
 		drm_output_fini_pixman(output);
 	} else {
+		drm_output_fini_gpu_copy(output);
+		drm_output_fini_cursor_bos(output);
 		gl_renderer->output_destroy(output_base);
 		gbm_surface_destroy(output->surface);
 	}
@@ -1341,8 +3698,8 @@ choose_mode (struct drm_output *output, struct weston_mode *target_mode)
 		return (struct drm_mode *)output->base.current_mode;
 
 	wl_list_for_each(mode, &output->base.mode_list, base.link) {
-		if (mode->mode_info.hdisplay == target_mode->width &&
-		    mode->mode_info.vdisplay == target_mode->height) {
+		if (mode->base.width == target_mode->width &&
+		    mode->base.height == target_mode->height) {
 			if (mode->base.refresh == target_mode->refresh ||
 			    target_mode->refresh == 0) {
 				return mode;
@@ -1356,6 +3713,8 @@ choose_mode (struct drm_output *output, struct weston_mode *target_mode)
 
 static int
 drm_output_init_egl(struct drm_output *output, struct drm_backend *b);
+static void
+drm_output_fini_gpu_copy(struct drm_output *output);
 static int
 drm_output_init_pixman(struct drm_output *output, struct drm_backend *b);
 
@@ -1394,44 +3753,289 @@ drm_output_switch_mode(struct weston_output *output_base, struct weston_mode *mo
 	output->base.current_mode->flags =
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
 
-	/* reset rendering stuff. */
-	drm_output_release_fb(output, output->current);
-	drm_output_release_fb(output, output->next);
-	output->current = output->next = NULL;
+	/* Let a frame being composited flip before its buffers go */
+	drm_output_finish_render(output);
+
+	/* reset rendering stuff. */
+	drm_output_release_fb(output, output->current);
+	drm_output_release_fb(output, output->next);
+	output->current = output->next = NULL;
+
+	if (b->use_pixman) {
+		drm_output_fini_pixman(output);
+		if (drm_output_init_pixman(output, b) < 0) {
+			weston_log("failed to init output pixman state with "
+				   "new mode\n");
+			return -1;
+		}
+	} else {
+		drm_output_fini_gpu_copy(output);
+		gl_renderer->output_destroy(&output->base);
+		gbm_surface_destroy(output->surface);
+
+		if (drm_output_init_egl(output, b) < 0) {
+			weston_log("failed to init output egl state with "
+				   "new mode");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+on_drm_input(int fd, uint32_t mask, void *data)
+{
+	drmEventContext evctx;
+
+	memset(&evctx, 0, sizeof evctx);
+	evctx.version = DRM_EVENT_CONTEXT_VERSION;
+	evctx.page_flip_handler = page_flip_handler;
+	evctx.vblank_handler = vblank_handler;
+	drmHandleEvent(fd, &evctx);
+
+	return 1;
+}
+
+static void
+drm_flip_event_queue(struct drm_backend *b, enum drm_flip_event_type type,
+		     unsigned int frame, unsigned int sec, unsigned int usec,
+		     void *data)
+{
+	struct drm_flip_event *event;
+
+	event = zalloc(sizeof *event);
+	if (event == NULL) {
+		pthread_mutex_lock(&b->flip.mutex);
+		b->flip.errors |= DRM_FLIP_ERROR_NO_MEMORY;
+		pthread_mutex_unlock(&b->flip.mutex);
+		return;
+	}
+
+	event->type = type;
+	event->frame = frame;
+	event->sec = sec;
+	event->usec = usec;
+	event->data = data;
+
+	pthread_mutex_lock(&b->flip.mutex);
+	wl_list_insert(b->flip.events.prev, &event->link);
+	pthread_mutex_unlock(&b->flip.mutex);
+}
+
+/* The DRM fd is the only thing the flip thread can reach the backend
+ * through, so both handlers get it via this thread-local pointer. */
+static __thread struct drm_backend *flip_thread_backend;
+
+static void
+flip_thread_page_flip(int fd, unsigned int frame,
+		      unsigned int sec, unsigned int usec, void *data)
+{
+	drm_flip_event_queue(flip_thread_backend, DRM_FLIP_EVENT_PAGE_FLIP,
+			     frame, sec, usec, data);
+}
+
+static void
+flip_thread_vblank(int fd, unsigned int frame,
+		   unsigned int sec, unsigned int usec, void *data)
+{
+	drm_flip_event_queue(flip_thread_backend, DRM_FLIP_EVENT_VBLANK,
+			     frame, sec, usec, data);
+}
+
+/* A full pipe means the main loop is woken up already, and other
+ * failures have nobody to be reported to from the flip thread */
+static void
+drm_flip_thread_wake(struct drm_backend *b)
+{
+	char c = 0;
+
+	if (write(b->flip.wake_pipe[1], &c, 1) < 0)
+		return;
+}
+
+static void *
+drm_flip_thread(void *data)
+{
+	struct drm_backend *b = data;
+	drmEventContext evctx;
+	struct pollfd fds[2];
+
+	flip_thread_backend = b;
+
+	memset(&evctx, 0, sizeof evctx);
+	evctx.version = DRM_EVENT_CONTEXT_VERSION;
+	evctx.page_flip_handler = flip_thread_page_flip;
+	evctx.vblank_handler = flip_thread_vblank;
+
+	fds[0].fd = b->drm.fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = b->flip.quit_pipe[0];
+	fds[1].events = POLLIN;
+
+	while (1) {
+		if (poll(fds, ARRAY_LENGTH(fds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			pthread_mutex_lock(&b->flip.mutex);
+			b->flip.errors |= DRM_FLIP_ERROR_POLL;
+			b->flip.poll_errno = errno;
+			pthread_mutex_unlock(&b->flip.mutex);
+			drm_flip_thread_wake(b);
+			break;
+		}
+
+		if (fds[1].revents)
+			break;
+
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		drmHandleEvent(b->drm.fd, &evctx);
+		drm_flip_thread_wake(b);
+	}
+
+	return NULL;
+}
+
+static int
+on_drm_flip_events(int fd, uint32_t mask, void *data)
+{
+	struct drm_backend *b = data;
+	struct drm_flip_event *event, *next;
+	struct wl_list events;
+	uint32_t errors;
+	int poll_errno;
+	char buf[16];
+
+	while (read(fd, buf, sizeof buf) > 0)
+		;
+
+	wl_list_init(&events);
+	pthread_mutex_lock(&b->flip.mutex);
+	wl_list_insert_list(&events, &b->flip.events);
+	wl_list_init(&b->flip.events);
+	errors = b->flip.errors;
+	poll_errno = b->flip.poll_errno;
+	b->flip.errors = 0;
+	pthread_mutex_unlock(&b->flip.mutex);
+
+	if (errors & DRM_FLIP_ERROR_NO_MEMORY)
+		weston_log("drm: out of memory queueing a flip event\n");
+	if (errors & DRM_FLIP_ERROR_POLL)
+		weston_log("drm: flip thread poll failed: %s\n",
+			   strerror(poll_errno));
+
+	wl_list_for_each_safe(event, next, &events, link) {
+		switch (event->type) {
+		case DRM_FLIP_EVENT_PAGE_FLIP:
+			page_flip_handler(b->drm.fd, event->frame,
+					  event->sec, event->usec,
+					  event->data);
+			break;
+		case DRM_FLIP_EVENT_VBLANK:
+			vblank_handler(b->drm.fd, event->frame,
+				       event->sec, event->usec,
+				       event->data);
+			break;
+		}
+		wl_list_remove(&event->link);
+		free(event);
+	}
+
+	return 1;
+}
+
+static void
+drm_flip_thread_raise_priority(struct drm_backend *b)
+{
+	struct sched_param param;
+
+	memset(&param, 0, sizeof param);
+	param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+	if (pthread_setschedparam(b->flip.thread, SCHED_FIFO, &param) != 0)
+		weston_log("drm: flip thread runs without real-time "
+			   "priority\n");
+}
+
+/** Start servicing DRM events
+ *
+ * Sets up the thread that reads flip and vblank events. If that is
+ * not possible, the DRM fd is dispatched from the main loop instead.
+ */
+static int
+drm_backend_start_flip_thread(struct drm_backend *b,
+			      struct wl_event_loop *loop)
+{
+	b->flip.running = 0;
+	b->flip.errors = 0;
+	wl_list_init(&b->flip.events);
+
+	if (pipe2(b->flip.wake_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+		goto fallback;
 
-	if (b->use_pixman) {
-		drm_output_fini_pixman(output);
-		if (drm_output_init_pixman(output, b) < 0) {
-			weston_log("failed to init output pixman state with "
-				   "new mode\n");
-			return -1;
-		}
-	} else {
-		gl_renderer->output_destroy(&output->base);
-		gbm_surface_destroy(output->surface);
+	if (pipe2(b->flip.quit_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+		goto err_wake_pipe;
 
-		if (drm_output_init_egl(output, b) < 0) {
-			weston_log("failed to init output egl state with "
-				   "new mode");
-			return -1;
-		}
+	b->drm_source =
+		wl_event_loop_add_fd(loop, b->flip.wake_pipe[0],
+				     WL_EVENT_READABLE, on_drm_flip_events, b);
+	if (b->drm_source == NULL)
+		goto err_quit_pipe;
+
+	pthread_mutex_init(&b->flip.mutex, NULL);
+	if (pthread_create(&b->flip.thread, NULL, drm_flip_thread, b) != 0) {
+		pthread_mutex_destroy(&b->flip.mutex);
+		wl_event_source_remove(b->drm_source);
+		goto err_quit_pipe;
 	}
 
+	drm_flip_thread_raise_priority(b);
+	b->flip.running = 1;
+
 	return 0;
+
+err_quit_pipe:
+	close(b->flip.quit_pipe[0]);
+	close(b->flip.quit_pipe[1]);
+err_wake_pipe:
+	close(b->flip.wake_pipe[0]);
+	close(b->flip.wake_pipe[1]);
+fallback:
+	weston_log("drm: no flip thread, handling DRM events on the "
+		   "main loop\n");
+	b->drm_source =
+		wl_event_loop_add_fd(loop, b->drm.fd,
+				     WL_EVENT_READABLE, on_drm_input, b);
+
+	return b->drm_source ? 0 : -1;
 }
 
-static int
-on_drm_input(int fd, uint32_t mask, void *data)
+static void
+drm_backend_stop_flip_thread(struct drm_backend *b)
 {
-	drmEventContext evctx;
+	struct drm_flip_event *event, *next;
+	char c = 0;
 
-	memset(&evctx, 0, sizeof evctx);
-	evctx.version = DRM_EVENT_CONTEXT_VERSION;
-	evctx.page_flip_handler = page_flip_handler;
-	evctx.vblank_handler = vblank_handler;
-	drmHandleEvent(fd, &evctx);
+	wl_event_source_remove(b->drm_source);
 
-	return 1;
+	if (!b->flip.running)
+		return;
+
+	if (write(b->flip.quit_pipe[1], &c, 1) < 0)
+		pthread_cancel(b->flip.thread);
+	pthread_join(b->flip.thread, NULL);
+	b->flip.running = 0;
+
+	wl_list_for_each_safe(event, next, &b->flip.events, link)
+		free(event);
+	wl_list_init(&b->flip.events);
+
+	pthread_mutex_destroy(&b->flip.mutex);
+	close(b->flip.quit_pipe[0]);
+	close(b->flip.quit_pipe[1]);
+	close(b->flip.wake_pipe[0]);
+	close(b->flip.wake_pipe[1]);
 }
 
 static int
@@ -1488,6 +4092,28 @@ init_drm(struct drm_backend *b, struct udev_device *device)
 	else
 		b->cursor_height = 64;
 
+#ifdef HAVE_DRM_ATOMIC
+	if (!getenv("WESTON_DISABLE_ATOMIC")) {
+		ret = drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
+		if (ret == 0) {
+			ret = drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1);
+			/* Without atomic, keep the primary and cursor
+			 * planes out of the sprite list. */
+			if (ret != 0)
+				drmSetClientCap(fd,
+						DRM_CLIENT_CAP_UNIVERSAL_PLANES,
+						0);
+		}
+		b->atomic_modeset = (ret == 0);
+	}
+#endif
+	weston_log("DRM: %s atomic modesetting\n",
+		   b->atomic_modeset ? "using" : "not using");
+
+	/* Atomic commits cannot be asynchronous with these kernels */
+	ret = drmGetCap(fd, DRM_CAP_ASYNC_PAGE_FLIP, &cap);
+	b->async_page_flip = ret == 0 && cap == 1 && !b->atomic_modeset;
+
 	return 0;
 }
 
@@ -1662,11 +4288,14 @@ drm_get_backlight(struct drm_output *output)
 	return (uint32_t) norm;
 }
 
-/* values accepted are between 0-255 range */
+/* values accepted are between 0-255 range; the sysfs write is done on
+ * a thread of the backlight, it can take milliseconds */
 static void
 drm_set_backlight(struct weston_output *output_base, uint32_t value)
 {
 	struct drm_output *output = (struct drm_output *) output_base;
+	struct drm_backend *b =
+		(struct drm_backend *) output_base->compositor->backend;
 	long max_brightness, new_brightness;
 
 	if (!output->backlight)
@@ -1675,13 +4304,252 @@ drm_set_backlight(struct weston_output *output_base, uint32_t value)
 	if (value > 255)
 		return;
 
-	max_brightness = backlight_get_max_brightness(output->backlight);
+	/* read once by backlight_init(), no sysfs access here */
+	max_brightness = output->backlight->max_brightness;
 
 	/* get denormalized value */
 	new_brightness = (value * max_brightness) / 255;
 
-	backlight_set_brightness(output->backlight, new_brightness);
+	if (backlight_set_brightness_async(output->backlight, new_brightness,
+					   b->backlight_ramp_ms) < 0)
+		backlight_set_brightness(output->backlight, new_brightness);
+}
+
+#ifdef HAVE_DRM_ATOMIC
+/**
+ * Look up a KMS property by name
+ *
+ * @param fd DRM device
+ * @param props Properties of a KMS object
+ * @param name Property name
+ * @param value If not NULL, receives the current value of the property
+ * @returns The property ID, or 0 if the object has no such property
+ */
+static uint32_t
+drm_property_get(int fd, drmModeObjectPropertiesPtr props,
+		 const char *name, uint64_t *value)
+{
+	drmModePropertyPtr prop;
+	uint32_t i, id = 0;
+
+	for (i = 0; i < props->count_props && id == 0; i++) {
+		prop = drmModeGetProperty(fd, props->props[i]);
+		if (!prop)
+			continue;
+
+		if (!strcmp(prop->name, name)) {
+			id = prop->prop_id;
+			if (value)
+				*value = props->prop_values[i];
+		}
+
+		drmModeFreeProperty(prop);
+	}
+
+	return id;
+}
+
+/* The bits a bitmask property such as "rotation" accepts */
+static uint32_t
+drm_property_get_bitmask(int fd, uint32_t prop_id)
+{
+	drmModePropertyPtr prop;
+	uint32_t mask = 0;
+	int i;
+
+	if (!prop_id)
+		return 0;
+
+	prop = drmModeGetProperty(fd, prop_id);
+	if (!prop)
+		return 0;
+
+	if (prop->flags & DRM_MODE_PROP_BITMASK) {
+		for (i = 0; i < prop->count_enums; i++)
+			if (prop->enums[i].value < 32)
+				mask |= 1u << prop->enums[i].value;
+	}
+
+	drmModeFreeProperty(prop);
+
+	return mask;
+}
+
+static int
+drm_sprite_init_props(struct drm_backend *b, struct drm_sprite *sprite)
+{
+	struct drm_plane_props *p = &sprite->props;
+	drmModeObjectPropertiesPtr props;
+	uint64_t type = WDRM_PLANE_TYPE_OVERLAY;
+	int fd = b->drm.fd;
+
+	props = drmModeObjectGetProperties(fd, sprite->plane_id,
+					   DRM_MODE_OBJECT_PLANE);
+	if (!props)
+		return -1;
+
+	drm_property_get(fd, props, "type", &type);
+	p->fb_id = drm_property_get(fd, props, "FB_ID", NULL);
+	p->crtc_id = drm_property_get(fd, props, "CRTC_ID", NULL);
+	p->src_x = drm_property_get(fd, props, "SRC_X", NULL);
+	p->src_y = drm_property_get(fd, props, "SRC_Y", NULL);
+	p->src_w = drm_property_get(fd, props, "SRC_W", NULL);
+	p->src_h = drm_property_get(fd, props, "SRC_H", NULL);
+	p->crtc_x = drm_property_get(fd, props, "CRTC_X", NULL);
+	p->crtc_y = drm_property_get(fd, props, "CRTC_Y", NULL);
+	p->crtc_w = drm_property_get(fd, props, "CRTC_W", NULL);
+	p->crtc_h = drm_property_get(fd, props, "CRTC_H", NULL);
+	p->in_fence_fd = drm_property_get(fd, props, "IN_FENCE_FD", NULL);
+	p->rotation = drm_property_get(fd, props, "rotation", NULL);
+	drmModeFreeObjectProperties(props);
+
+	p->rotation_supported = drm_property_get_bitmask(fd, p->rotation);
+
+	sprite->type = type;
+
+	if (!p->fb_id || !p->crtc_id ||
+	    !p->src_x || !p->src_y || !p->src_w || !p->src_h ||
+	    !p->crtc_x || !p->crtc_y || !p->crtc_w || !p->crtc_h)
+		return -1;
+
+	return 0;
+}
+
+static struct drm_sprite *
+drm_output_claim_sprite(struct drm_backend *b, struct drm_output *output,
+			enum wdrm_plane_type type)
+{
+	struct drm_sprite *s;
+
+	wl_list_for_each(s, &b->sprite_list, link) {
+		if (s->type != type || s->output)
+			continue;
+
+		if (!drm_sprite_crtc_supported(output, s->possible_crtcs))
+			continue;
+
+		s->output = output;
+		return s;
+	}
+
+	return NULL;
+}
+
+/**
+ * Look up the CRTC and connector properties and claim the primary and
+ * cursor planes for an output
+ *
+ * @param b DRM backend
+ * @param output Output whose crtc_id and connector_id are already set
+ * @returns 0 on success, -1 if the output cannot be driven atomically
+ */
+static int
+drm_output_init_atomic(struct drm_backend *b, struct drm_output *output)
+{
+	drmModeObjectPropertiesPtr props;
+	uint64_t vrr_capable = 0;
+	uint32_t vrr_enabled;
+
+	props = drmModeObjectGetProperties(b->drm.fd, output->crtc_id,
+					   DRM_MODE_OBJECT_CRTC);
+	if (!props)
+		return -1;
+	output->crtc_prop_mode_id =
+		drm_property_get(b->drm.fd, props, "MODE_ID", NULL);
+	output->crtc_prop_active =
+		drm_property_get(b->drm.fd, props, "ACTIVE", NULL);
+	vrr_enabled = drm_property_get(b->drm.fd, props, "VRR_ENABLED", NULL);
+	drmModeFreeObjectProperties(props);
+
+	props = drmModeObjectGetProperties(b->drm.fd, output->connector_id,
+					   DRM_MODE_OBJECT_CONNECTOR);
+	if (!props)
+		return -1;
+	output->connector_prop_crtc_id =
+		drm_property_get(b->drm.fd, props, "CRTC_ID", NULL);
+	drm_property_get(b->drm.fd, props, "vrr_capable", &vrr_capable);
+	drmModeFreeObjectProperties(props);
+
+	if (output->adaptive_sync_requested) {
+		if (vrr_enabled && vrr_capable)
+			output->crtc_prop_vrr_enabled = vrr_enabled;
+		else
+			weston_log("Output %s does not support adaptive "
+				   "sync\n", output->base.name);
+	}
+
+	if (!output->crtc_prop_mode_id || !output->crtc_prop_active ||
+	    !output->connector_prop_crtc_id)
+		return -1;
+
+	output->primary_sprite =
+		drm_output_claim_sprite(b, output, WDRM_PLANE_TYPE_PRIMARY);
+	if (!output->primary_sprite)
+		return -1;
+
+	/* Without a cursor plane the legacy cursor ioctls are used */
+	output->cursor_sprite =
+		drm_output_claim_sprite(b, output, WDRM_PLANE_TYPE_CURSOR);
+
+	return 0;
+}
+
+/**
+ * Let the planes' rotation property do a configured output transform
+ *
+ * Only plain rotations are handled, and only when the primary plane
+ * takes them; otherwise the renderer keeps doing the transform. The
+ * weston_output keeps the transform either way, so that clients and
+ * input devices see the output as configured.
+ *
+ * @param output Output with its primary plane claimed
+ * @param transform The [output] transform from weston.ini
+ */
+static void
+drm_output_init_hw_rotation(struct drm_output *output, uint32_t transform)
+{
+	struct drm_sprite *primary = output->primary_sprite;
+	uint32_t rotation;
+
+	switch (transform) {
+	case WL_OUTPUT_TRANSFORM_90:
+		rotation = DRM_ROTATE_90;
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		rotation = DRM_ROTATE_180;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		rotation = DRM_ROTATE_270;
+		break;
+	default:
+		return;
+	}
+
+	if (!primary || !(primary->props.rotation_supported & rotation))
+		return;
+
+	output->base.scanout_transform = transform;
+	output->hw_rotation = rotation;
+	weston_log("Output %s rotated at scanout\n", output->base.name);
+}
+#else
+static int
+drm_sprite_init_props(struct drm_backend *b, struct drm_sprite *sprite)
+{
+	return -1;
+}
+
+static int
+drm_output_init_atomic(struct drm_backend *b, struct drm_output *output)
+{
+	return -1;
+}
+
+static void
+drm_output_init_hw_rotation(struct drm_output *output, uint32_t transform)
+{
 }
+#endif
 
 static drmModePropertyPtr
 drm_get_prop(int fd, drmModeConnectorPtr connector, const char *name)
@@ -1707,14 +4575,13 @@ static void
 drm_set_dpms(struct weston_output *output_base, enum dpms_enum level)
 {
 	struct drm_output *output = (struct drm_output *) output_base;
-	struct weston_compositor *ec = output_base->compositor;
-	struct drm_backend *b = (struct drm_backend *)ec->backend;
 	int ret;
 
 	if (!output->dpms_prop)
 		return;
 
-	ret = drmModeConnectorSetProperty(b->drm.fd, output->connector_id,
+	ret = drmModeConnectorSetProperty(drm_output_fd(output),
+					  output->connector_id,
 				 	  output->dpms_prop->prop_id, level);
 	if (ret) {
 		weston_log("DRM: DPMS: failed property set for %s\n",
@@ -1765,7 +4632,7 @@ make_connector_name(const drmModeConnector *con)
 }
 
 static int
-find_crtc_for_connector(struct drm_backend *b,
+find_crtc_for_connector(int drm_fd, uint32_t crtc_allocator,
 			drmModeRes *resources, drmModeConnector *connector)
 {
 	drmModeEncoder *encoder;
@@ -1773,7 +4640,7 @@ find_crtc_for_connector(struct drm_backend *b,
 	int i, j;
 
 	for (j = 0; j < connector->count_encoders; j++) {
-		encoder = drmModeGetEncoder(b->drm.fd, connector->encoders[j]);
+		encoder = drmModeGetEncoder(drm_fd, connector->encoders[j]);
 		if (encoder == NULL) {
 			weston_log("Failed to get encoder.\n");
 			return -1;
@@ -1783,7 +4650,7 @@ find_crtc_for_connector(struct drm_backend *b,
 
 		for (i = 0; i < resources->count_crtcs; i++) {
 			if (possible_crtcs & (1 << i) &&
-			    !(b->crtc_allocator & (1 << resources->crtcs[i])))
+			    !(crtc_allocator & (1 << resources->crtcs[i])))
 				return i;
 		}
 	}
@@ -1791,6 +4658,38 @@ find_crtc_for_connector(struct drm_backend *b,
 	return -1;
 }
 
+/* Draw at the configured render size while it is below the current
+ * mode, the primary plane scaling it up. That takes atomic modesetting
+ * and the planes of the primary GPU. */
+static void
+drm_output_update_render_size(struct drm_output *output,
+			      struct drm_backend *b)
+{
+	int32_t width = output->render_size_width;
+	int32_t height = output->render_size_height;
+	int32_t mode_width, mode_height;
+
+	output->base.render_width = 0;
+	output->base.render_height = 0;
+
+	weston_output_get_buffer_size(&output->base, &mode_width, &mode_height);
+	if (width <= 0 || height <= 0 ||
+	    width > mode_width || height > mode_height ||
+	    (width == mode_width && height == mode_height))
+		return;
+
+	if (!b->atomic_modeset || output->gpu) {
+		weston_log("Output %s cannot scale at scanout, ignoring "
+			   "render-size\n", output->base.name);
+		return;
+	}
+
+	output->base.render_width = width;
+	output->base.render_height = height;
+	weston_log("Output %s renders at %dx%d\n",
+		   output->base.name, width, height);
+}
+
 /* Init output state that depends on gl or gbm */
 static int
 drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
@@ -1799,14 +4698,26 @@ drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
 		output->format,
 		fallback_format_for(output->format),
 	};
-	int i, flags, n_formats = 1;
-
-	output->surface = gbm_surface_create(b->gbm,
-					     output->base.current_mode->width,
-					     output->base.current_mode->height,
-					     format[0],
-					     GBM_BO_USE_SCANOUT |
-					     GBM_BO_USE_RENDERING);
+	uint32_t flags = GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING;
+	int32_t width, height;
+	int n_formats = 1;
+
+#ifdef HAVE_GBM_BO_USE_LINEAR
+	/* Another GPU can only make sense of untiled buffers */
+	if (output->gpu)
+		flags |= GBM_BO_USE_LINEAR;
+#endif
+
+	drm_output_update_render_size(output, b);
+	if (output->base.render_width) {
+		width = output->base.render_width;
+		height = output->base.render_height;
+	} else {
+		weston_output_get_buffer_size(&output->base, &width, &height);
+	}
+
+	output->surface = gbm_surface_create(b->gbm, width, height,
+					     format[0], flags);
 	if (!output->surface) {
 		weston_log("failed to create gbm surface\n");
 		return -1;
@@ -1825,36 +4736,98 @@ drm_output_init_egl(struct drm_output *output, struct drm_backend *b)
 		return -1;
 	}
 
-	flags = GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE;
-
-	for (i = 0; i < 2; i++) {
-		if (output->cursor_bo[i])
-			continue;
-
-		output->cursor_bo[i] =
-			gbm_bo_create(b->gbm, b->cursor_width, b->cursor_height,
-				GBM_FORMAT_ARGB8888, flags);
+	if (output->gpu) {
+		if (output->gpu_copy && drm_output_init_gpu_copy(output) < 0) {
+			weston_log("failed to create buffers to copy frames "
+				   "to %s\n", output->gpu->filename);
+			gl_renderer->output_destroy(&output->base);
+			gbm_surface_destroy(output->surface);
+			return -1;
+		}
+		return 0;
 	}
 
-	if (output->cursor_bo[0] == NULL || output->cursor_bo[1] == NULL) {
+	if (!output->cursor_scratch &&
+	    drm_output_init_cursor_bos(output, b) < 0) {
 		weston_log("cursor buffers unavailable, using gl cursors\n");
+		drm_output_fini_cursor_bos(output);
 		b->cursors_are_broken = 1;
 	}
 
 	return 0;
 }
 
+/* Dumb buffers on the secondary GPU for frames read back from GL */
+static int
+drm_output_init_gpu_copy(struct drm_output *output)
+{
+	int32_t w, h;
+	unsigned int i;
+
+	if (output->gpu_copy_pixels)
+		return 0;
+
+	weston_output_get_buffer_size(&output->base, &w, &h);
+
+	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
+		output->dumb[i] = drm_fb_create_dumb(output->gpu->fd, w, h);
+		if (!output->dumb[i])
+			goto err;
+	}
+
+	output->gpu_copy_pixels = malloc(w * h * 4);
+	if (!output->gpu_copy_pixels)
+		goto err;
+
+	pixman_region32_init(&output->gpu_copy_damage);
+	pixman_region32_init_rect(&output->previous_damage,
+				  output->base.x, output->base.y,
+				  output->base.width, output->base.height);
+
+	return 0;
+
+err:
+	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
+		if (output->dumb[i])
+			drm_fb_destroy_dumb(output->dumb[i]);
+		output->dumb[i] = NULL;
+	}
+
+	return -1;
+}
+
+static void
+drm_output_fini_gpu_copy(struct drm_output *output)
+{
+	unsigned int i;
+
+	if (!output->gpu_copy_pixels)
+		return;
+
+	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
+		drm_fb_destroy_dumb(output->dumb[i]);
+		output->dumb[i] = NULL;
+	}
+
+	free(output->gpu_copy_pixels);
+	output->gpu_copy_pixels = NULL;
+	pixman_region32_fini(&output->gpu_copy_damage);
+	pixman_region32_fini(&output->previous_damage);
+}
+
 static int
 drm_output_init_pixman(struct drm_output *output, struct drm_backend *b)
 {
-	int w = output->base.current_mode->width;
-	int h = output->base.current_mode->height;
+	int32_t w, h;
+	int fd = output->gpu ? output->gpu->fd : b->drm.fd;
 	unsigned int i;
 
+	weston_output_get_buffer_size(&output->base, &w, &h);
+
 	/* FIXME error checking */
 
 	for (i = 0; i < ARRAY_LENGTH(output->dumb); i++) {
-		output->dumb[i] = drm_fb_create_dumb(b, w, h);
+		output->dumb[i] = drm_fb_create_dumb(fd, w, h);
 		if (!output->dumb[i])
 			goto err;
 
@@ -1869,6 +4842,17 @@ drm_output_init_pixman(struct drm_output *output, struct drm_backend *b)
 	if (pixman_renderer_output_create(&output->base) < 0)
 		goto err;
 
+	output->render_thread = 0;
+	if (b->render_threads) {
+		if (pixman_renderer_output_start_thread(&output->base,
+							drm_output_render_done) == 0)
+			output->render_thread = 1;
+		else
+			weston_log("Failed to start render thread for %s, "
+				   "compositing on the main thread\n",
+				   output->base.name);
+	}
+
 	pixman_region32_init_rect(&output->previous_damage,
 				  output->base.x, output->base.y, output->base.width, output->base.height);
 
@@ -1999,23 +4983,100 @@ edid_parse(struct drm_edid *edid, const uint8_t *data, size_t length)
 	return 0;
 }
 
+static uint32_t
+edid_hash(const uint8_t *data, size_t length)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void
+drm_edid_cache_entry_destroy(struct drm_edid_cache_entry *entry)
+{
+	wl_list_remove(&entry->link);
+	free(entry->data);
+	free(entry);
+}
+
+static void
+drm_edid_cache_release(struct drm_backend *b)
+{
+	struct drm_edid_cache_entry *entry, *next;
+
+	wl_list_for_each_safe(entry, next, &b->edid_cache, link)
+		drm_edid_cache_entry_destroy(entry);
+	b->edid_cache_length = 0;
+}
+
+/* The parsed EDID of a display, which a KVM switch or a flaky cable
+ * brings back again and again. NULL when out of memory. */
+static struct drm_edid_cache_entry *
+drm_edid_cache_get(struct drm_backend *b, const uint8_t *data, size_t length)
+{
+	struct drm_edid_cache_entry *entry;
+	uint32_t hash = edid_hash(data, length);
+
+	wl_list_for_each(entry, &b->edid_cache, link) {
+		if (entry->hash == hash && entry->length == length &&
+		    memcmp(entry->data, data, length) == 0) {
+			wl_list_remove(&entry->link);
+			wl_list_insert(&b->edid_cache, &entry->link);
+			return entry;
+		}
+	}
+
+	entry = zalloc(sizeof *entry);
+	if (!entry)
+		return NULL;
+	entry->data = malloc(length);
+	if (!entry->data) {
+		free(entry);
+		return NULL;
+	}
+	memcpy(entry->data, data, length);
+	entry->hash = hash;
+	entry->length = length;
+	entry->valid = edid_parse(&entry->edid, data, length) == 0;
+
+	if (b->edid_cache_length == DRM_EDID_CACHE_SIZE)
+		drm_edid_cache_entry_destroy(
+			container_of(b->edid_cache.prev,
+				     struct drm_edid_cache_entry, link));
+	else
+		b->edid_cache_length++;
+	wl_list_insert(&b->edid_cache, &entry->link);
+
+	return entry;
+}
+
 static void
-find_and_parse_output_edid(struct drm_backend *b,
+find_and_parse_output_edid(int drm_fd,
 			   struct drm_output *output,
 			   drmModeConnector *connector)
 {
+	struct drm_backend *b =
+		(struct drm_backend *) output->base.compositor->backend;
+	struct drm_edid_cache_entry *entry;
 	drmModePropertyBlobPtr edid_blob = NULL;
 	drmModePropertyPtr property;
 	int i;
 	int rc;
 
 	for (i = 0; i < connector->count_props && !edid_blob; i++) {
-		property = drmModeGetProperty(b->drm.fd, connector->props[i]);
+		property = drmModeGetProperty(drm_fd, connector->props[i]);
 		if (!property)
 			continue;
 		if ((property->flags & DRM_MODE_PROP_BLOB) &&
 		    !strcmp(property->name, "EDID")) {
-			edid_blob = drmModeGetPropertyBlob(b->drm.fd,
+			edid_blob = drmModeGetPropertyBlob(drm_fd,
 							   connector->prop_values[i]);
 		}
 		drmModeFreeProperty(property);
@@ -2023,9 +5084,15 @@ find_and_parse_output_edid(struct drm_backend *b,
 	if (!edid_blob)
 		return;
 
-	rc = edid_parse(&output->edid,
-			edid_blob->data,
-			edid_blob->length);
+	entry = drm_edid_cache_get(b, edid_blob->data, edid_blob->length);
+	if (entry) {
+		rc = entry->valid ? 0 : -1;
+		output->edid = entry->edid;
+	} else {
+		rc = edid_parse(&output->edid,
+				edid_blob->data,
+				edid_blob->length);
+	}
 	if (!rc) {
 		weston_log("EDID data '%s', '%s', '%s'\n",
 			   output->edid.pnp_id,
@@ -2246,6 +5313,7 @@ connector_get_current_mode(drmModeConnector *connector, int drm_fd,
  * to Weston's output list.
  *
  * @param b Weston backend structure structure
+ * @param gpu Secondary GPU the connector is on, or NULL for the primary one
  * @param resources DRM resources for this device
  * @param connector DRM connector to use for this new output
  * @param x Horizontal offset to use into global co-ordinate space
@@ -2254,11 +5322,16 @@ connector_get_current_mode(drmModeConnector *connector, int drm_fd,
  * @returns 0 on success, or -1 on failure
  */
 static int
-create_output_for_connector(struct drm_backend *b,
+create_output_for_connector(struct drm_backend *b, struct drm_gpu *gpu,
 			    drmModeRes *resources,
 			    drmModeConnector *connector,
 			    int x, int y, struct udev_device *drm_device)
 {
+	int fd = gpu ? gpu->fd : b->drm.fd;
+	uint32_t *crtc_allocator =
+		gpu ? &gpu->crtc_allocator : &b->crtc_allocator;
+	uint32_t *connector_allocator =
+		gpu ? &gpu->connector_allocator : &b->connector_allocator;
 	struct drm_output *output;
 	struct drm_mode *drm_mode, *next, *current;
 	struct weston_mode *m;
@@ -2269,7 +5342,7 @@ create_output_for_connector(struct drm_backend *b,
 	enum output_config config;
 	uint32_t transform;
 
-	i = find_crtc_for_connector(b, resources, connector);
+	i = find_crtc_for_connector(fd, *crtc_allocator, resources, connector);
 	if (i < 0) {
 		weston_log("No usable crtc/encoder pair for connector.\n");
 		return -1;
@@ -2279,6 +5352,7 @@ create_output_for_connector(struct drm_backend *b,
 	if (output == NULL)
 		return -1;
 
+	output->render_fence_fd = -1;
 	output->base.subpixel = drm_subpixel_to_wayland(connector->subpixel);
 	output->base.name = make_connector_name(connector);
 	output->base.make = "unknown";
@@ -2323,16 +5397,48 @@ create_output_for_connector(struct drm_backend *b,
 	setup_output_seat_constraint(b, &output->base, s);
 	free(s);
 
+	weston_config_section_get_bool(section, "adaptive-sync",
+				       &output->adaptive_sync_requested, 0);
+
+	weston_config_section_get_string(section, "render-size", &s, NULL);
+	if (s && sscanf(s, "%dx%d", &output->render_size_width,
+			&output->render_size_height) != 2) {
+		weston_log("Invalid render-size \"%s\" for output %s\n",
+			   s, output->base.name);
+		output->render_size_width = 0;
+		output->render_size_height = 0;
+	}
+	free(s);
+
 	output->crtc_id = resources->crtcs[i];
 	output->pipe = i;
-	b->crtc_allocator |= (1 << output->crtc_id);
+	*crtc_allocator |= (1 << output->crtc_id);
 	output->connector_id = connector->connector_id;
-	b->connector_allocator |= (1 << output->connector_id);
+	*connector_allocator |= (1 << output->connector_id);
+
+	output->original_crtc = drmModeGetCrtc(fd, output->crtc_id);
+	output->dpms_prop = drm_get_prop(fd, connector, "DPMS");
+
+	output->gpu = gpu;
+	if (gpu && !b->use_pixman) {
+		/* Without linear buffers the other GPU would misread
+		 * ours, so those have to be copied */
+#ifdef HAVE_GBM_BO_USE_LINEAR
+		output->gpu_copy = !gpu->prime_import;
+#else
+		output->gpu_copy = 1;
+#endif
+	}
 
-	output->original_crtc = drmModeGetCrtc(b->drm.fd, output->crtc_id);
-	output->dpms_prop = drm_get_prop(b->drm.fd, connector, "DPMS");
+	/* Atomic modesetting is only enabled on the primary GPU */
+	if (b->atomic_modeset && !gpu &&
+	    drm_output_init_atomic(b, output) < 0) {
+		weston_log("Output %s cannot be driven with atomic "
+			   "modesetting\n", output->base.name);
+		goto err_free;
+	}
 
-	if (connector_get_current_mode(connector, b->drm.fd, &crtc_mode) < 0)
+	if (connector_get_current_mode(connector, fd, &crtc_mode) < 0)
 		goto err_free;
 
 	for (i = 0; i < connector->count_modes; i++) {
@@ -2343,7 +5449,7 @@ create_output_for_connector(struct drm_backend *b,
 
 	if (config == OUTPUT_CONFIG_OFF) {
 		weston_log("Disabling output %s\n", output->base.name);
-		drmModeSetCrtc(b->drm.fd, output->crtc_id,
+		drmModeSetCrtc(fd, output->crtc_id,
 			       0, 0, 0, 0, 0, NULL);
 		goto err_free;
 	}
@@ -2356,6 +5462,10 @@ create_output_for_connector(struct drm_backend *b,
 	output->base.current_mode = &current->base;
 	output->base.current_mode->flags |= WL_OUTPUT_MODE_CURRENT;
 
+	/* With the planes rotating, everything is rendered for an
+	 * output already in portrait or landscape as configured */
+	drm_output_init_hw_rotation(output, transform);
+
 	weston_output_init(&output->base, b->compositor, x, y,
 			   connector->mmWidth, connector->mmHeight,
 			   transform, scale);
@@ -2383,7 +5493,7 @@ create_output_for_connector(struct drm_backend *b,
 
 	weston_compositor_add_output(b->compositor, &output->base);
 
-	find_and_parse_output_edid(b, output, connector);
+	find_and_parse_output_edid(fd, output, connector);
 	if (connector->connector_type == DRM_MODE_CONNECTOR_LVDS)
 		output->base.connection_internal = 1;
 
@@ -2393,6 +5503,7 @@ create_output_for_connector(struct drm_backend *b,
 	output->base.assign_planes = drm_assign_planes;
 	output->base.set_dpms = drm_set_dpms;
 	output->base.switch_mode = drm_output_switch_mode;
+	output->base.get_scanout_formats = drm_output_get_scanout_formats;
 
 	output->base.gamma_size = output->original_crtc->gamma_size;
 	output->base.set_gamma = drm_output_set_gamma;
@@ -2404,8 +5515,15 @@ create_output_for_connector(struct drm_backend *b,
 	weston_compositor_stack_plane(b->compositor, &output->fb_plane,
 				      &b->compositor->primary_plane);
 
-	weston_log("Output %s, (connector %d, crtc %d)\n",
-		   output->base.name, output->connector_id, output->crtc_id);
+	if (gpu) {
+		output->gpu_copy_listener.notify = drm_output_gpu_copy_notify;
+		wl_signal_add(&output->base.frame_signal,
+			      &output->gpu_copy_listener);
+	}
+
+	weston_log("Output %s, (connector %d, crtc %d%s%s)\n",
+		   output->base.name, output->connector_id, output->crtc_id,
+		   gpu ? ", on " : "", gpu ? gpu->filename : "");
 	wl_list_for_each(m, &output->base.mode_list, link)
 		weston_log_continue(STAMP_SPACE "mode %dx%d@%.1f%s%s%s\n",
 				    m->width, m->height, m->refresh / 1000.0,
@@ -2432,8 +5550,12 @@ err_free:
 	}
 
 	drmModeFreeCrtc(output->original_crtc);
-	b->crtc_allocator &= ~(1 << output->crtc_id);
-	b->connector_allocator &= ~(1 << output->connector_id);
+	*crtc_allocator &= ~(1 << output->crtc_id);
+	*connector_allocator &= ~(1 << output->connector_id);
+	if (output->primary_sprite)
+		output->primary_sprite->output = NULL;
+	if (output->cursor_sprite)
+		output->cursor_sprite->output = NULL;
 	free(output);
 
 	return -1;
@@ -2473,13 +5595,27 @@ create_sprites(struct drm_backend *b)
 		sprite->current = NULL;
 		sprite->next = NULL;
 		sprite->backend = b;
+		sprite->type = WDRM_PLANE_TYPE_OVERLAY;
 		sprite->count_formats = plane->count_formats;
 		memcpy(sprite->formats, plane->formats,
 		       plane->count_formats * sizeof(plane->formats[0]));
 		drmModeFreePlane(plane);
+
+		if (b->atomic_modeset &&
+		    drm_sprite_init_props(b, sprite) < 0) {
+			weston_log("plane %d lacks atomic properties, "
+				   "ignoring it\n", sprite->plane_id);
+			free(sprite);
+			continue;
+		}
+
+		/* Primary and cursor planes are driven through the
+		 * output, only overlays are exposed as weston planes. */
 		weston_plane_init(&sprite->plane, b->compositor, 0, 0);
-		weston_compositor_stack_plane(b->compositor, &sprite->plane,
-					      &b->compositor->primary_plane);
+		if (sprite->type == WDRM_PLANE_TYPE_OVERLAY)
+			weston_compositor_stack_plane(b->compositor,
+						      &sprite->plane,
+						      &b->compositor->primary_plane);
 
 		wl_list_insert(&b->sprite_list, &sprite->link);
 	}
@@ -2497,23 +5633,129 @@ destroy_sprites(struct drm_backend *backend)
 			      struct drm_output, base.link);
 
 	wl_list_for_each_safe(sprite, next, &backend->sprite_list, link) {
-		drmModeSetPlane(backend->drm.fd,
-				sprite->plane_id,
-				output->crtc_id, 0, 0,
-				0, 0, 0, 0, 0, 0, 0, 0);
-		drm_output_release_fb(output, sprite->current);
-		drm_output_release_fb(output, sprite->next);
+		if (sprite->type == WDRM_PLANE_TYPE_OVERLAY) {
+			drmModeSetPlane(backend->drm.fd,
+					sprite->plane_id,
+					output->crtc_id, 0, 0,
+					0, 0, 0, 0, 0, 0, 0, 0);
+			drm_output_release_fb(output, sprite->current);
+			drm_output_release_fb(output, sprite->next);
+		}
 		weston_plane_release(&sprite->plane);
 		free(sprite);
 	}
 }
 
+/* Probing a connector makes the kernel read its EDID and modes, which
+ * can take tens of milliseconds each. Startup probes them one after the
+ * other on a thread, while the main thread brings up the outputs of the
+ * connectors probed so far. */
+struct drm_connector_probe {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	int fd;
+	int count;
+	uint32_t *ids;
+	drmModeConnector **connectors;
+	int probed;
+};
+
+static void *
+drm_connector_probe_thread(void *data)
+{
+	struct drm_connector_probe *probe = data;
+	drmModeConnector *connector;
+	int i;
+
+	for (i = 0; i < probe->count; i++) {
+		connector = drmModeGetConnector(probe->fd, probe->ids[i]);
+
+		pthread_mutex_lock(&probe->mutex);
+		probe->connectors[i] = connector;
+		probe->probed = i + 1;
+		pthread_cond_signal(&probe->cond);
+		pthread_mutex_unlock(&probe->mutex);
+	}
+
+	return NULL;
+}
+
+static int
+drm_connector_probe_start(struct drm_connector_probe *probe, int fd,
+			  drmModeRes *resources)
+{
+	probe->fd = fd;
+	probe->count = resources->count_connectors;
+	probe->ids = resources->connectors;
+	probe->probed = 0;
+	probe->connectors = calloc(probe->count, sizeof *probe->connectors);
+	if (probe->count > 0 && !probe->connectors)
+		return -1;
+
+	pthread_mutex_init(&probe->mutex, NULL);
+	pthread_cond_init(&probe->cond, NULL);
+	if (pthread_create(&probe->thread, NULL,
+			   drm_connector_probe_thread, probe) != 0) {
+		/* Not worth failing startup for, just probe here */
+		weston_log("drm: probing connectors without a thread\n");
+		drm_connector_probe_thread(probe);
+		probe->thread = pthread_self();
+	}
+
+	return 0;
+}
+
+/** Wait for the given connector to be probed
+ *
+ * Returns the connector, owned by the caller, or NULL if probing
+ * failed.
+ */
+static drmModeConnector *
+drm_connector_probe_get(struct drm_connector_probe *probe, int i)
+{
+	drmModeConnector *connector;
+
+	pthread_mutex_lock(&probe->mutex);
+	while (probe->probed <= i)
+		pthread_cond_wait(&probe->cond, &probe->mutex);
+	connector = probe->connectors[i];
+	probe->connectors[i] = NULL;
+	pthread_mutex_unlock(&probe->mutex);
+
+	return connector;
+}
+
+static void
+drm_connector_probe_finish(struct drm_connector_probe *probe)
+{
+	int i;
+
+	if (!pthread_equal(probe->thread, pthread_self()))
+		pthread_join(probe->thread, NULL);
+
+	for (i = 0; i < probe->count; i++)
+		if (probe->connectors[i])
+			drmModeFreeConnector(probe->connectors[i]);
+
+	pthread_cond_destroy(&probe->cond);
+	pthread_mutex_destroy(&probe->mutex);
+	free(probe->connectors);
+}
+
+static void
+update_outputs(struct drm_backend *b, struct drm_gpu *gpu,
+	       struct udev_device *drm_device, uint32_t only);
+
 static int
 create_outputs(struct drm_backend *b, uint32_t option_connector,
 	       struct udev_device *drm_device)
 {
+	struct drm_connector_probe probe;
 	drmModeConnector *connector;
 	drmModeRes *resources;
+	struct drm_gpu *gpu;
 	int i;
 	int x = 0, y = 0;
 
@@ -2537,16 +5779,20 @@ create_outputs(struct drm_backend *b, uint32_t option_connector,
 	b->num_crtcs = resources->count_crtcs;
 	memcpy(b->crtcs, resources->crtcs, sizeof(uint32_t) * b->num_crtcs);
 
+	if (drm_connector_probe_start(&probe, b->drm.fd, resources) < 0) {
+		drmModeFreeResources(resources);
+		return -1;
+	}
+
 	for (i = 0; i < resources->count_connectors; i++) {
-		connector = drmModeGetConnector(b->drm.fd,
-						resources->connectors[i]);
+		connector = drm_connector_probe_get(&probe, i);
 		if (connector == NULL)
 			continue;
 
 		if (connector->connection == DRM_MODE_CONNECTED &&
 		    (option_connector == 0 ||
 		     connector->connector_id == option_connector)) {
-			if (create_output_for_connector(b, resources,
+			if (create_output_for_connector(b, NULL, resources,
 							connector, x, y,
 							drm_device) < 0) {
 				drmModeFreeConnector(connector);
@@ -2561,20 +5807,64 @@ create_outputs(struct drm_backend *b, uint32_t option_connector,
 		drmModeFreeConnector(connector);
 	}
 
+	drm_connector_probe_finish(&probe);
+	drmModeFreeResources(resources);
+
+	wl_list_for_each(gpu, &b->gpu_list, link)
+		update_outputs(b, gpu, gpu->device, 0);
+
 	if (wl_list_empty(&b->compositor->output_list)) {
 		weston_log("No currently active connector found.\n");
-		drmModeFreeResources(resources);
 		return -1;
 	}
 
-	drmModeFreeResources(resources);
+	return 0;
+}
+
+static int
+drm_backend_has_connectors(struct drm_backend *b)
+{
+	struct drm_gpu *gpu;
+
+	if (b->connector_allocator)
+		return 1;
+
+	wl_list_for_each(gpu, &b->gpu_list, link)
+		if (gpu->connector_allocator)
+			return 1;
 
 	return 0;
 }
 
+/* The state of a connector as the kernel last probed it. A hotplug
+ * uevent naming a connector comes after the kernel probed it, asking
+ * for another probe takes as long as reading the EDID again. Anywhere
+ * else the cached state may be stale, or missing if the connector was
+ * never probed, so use drmModeGetConnector() there. */
+static drmModeConnector *
+drm_get_connector_current(int fd, uint32_t connector_id)
+{
+#ifdef HAVE_DRM_MODE_GET_CONNECTOR_CURRENT
+	return drmModeGetConnectorCurrent(fd, connector_id);
+#else
+	return drmModeGetConnector(fd, connector_id);
+#endif
+}
+
+/* Add and remove outputs for the connectors of the primary GPU, or of
+ * the secondary GPU gpu, that have been plugged in or out. Only the
+ * connectors in the mask only are looked at, unless it is 0. Those are
+ * the connectors a hotplug uevent named, which the kernel has probed
+ * already, so only the newly connected ones are probed again, for their
+ * modes and EDID. With only 0, at startup or for a uevent that named no
+ * connector, every connector gets a full probe. */
 static void
-update_outputs(struct drm_backend *b, struct udev_device *drm_device)
+update_outputs(struct drm_backend *b, struct drm_gpu *gpu,
+	       struct udev_device *drm_device, uint32_t only)
 {
+	int fd = gpu ? gpu->fd : b->drm.fd;
+	uint32_t *connector_allocator =
+		gpu ? &gpu->connector_allocator : &b->connector_allocator;
 	drmModeConnector *connector;
 	drmModeRes *resources;
 	struct drm_output *output, *next;
@@ -2582,7 +5872,7 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 	uint32_t connected = 0, disconnects = 0;
 	int i;
 
-	resources = drmModeGetResources(b->drm.fd);
+	resources = drmModeGetResources(fd);
 	if (!resources) {
 		weston_log("drmModeGetResources failed\n");
 		return;
@@ -2592,7 +5882,17 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 	for (i = 0; i < resources->count_connectors; i++) {
 		int connector_id = resources->connectors[i];
 
-		connector = drmModeGetConnector(b->drm.fd, connector_id);
+		/* No uevent named it, so it is as it was */
+		if (only && !(only & (1u << connector_id))) {
+			connected |= *connector_allocator & (1u << connector_id);
+			continue;
+		}
+
+		if (only)
+			connector = drm_get_connector_current(fd,
+							      connector_id);
+		else
+			connector = drmModeGetConnector(fd, connector_id);
 		if (connector == NULL)
 			continue;
 
@@ -2603,7 +5903,7 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 
 		connected |= (1 << connector_id);
 
-		if (!(b->connector_allocator & (1 << connector_id))) {
+		if (!(*connector_allocator & (1 << connector_id))) {
 			struct weston_output *last =
 				container_of(b->compositor->output_list.prev,
 					     struct weston_output, link);
@@ -2614,7 +5914,17 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 			else
 				x = 0;
 			y = 0;
-			create_output_for_connector(b, resources,
+
+			/* Newly connected: its modes and EDID */
+			if (only) {
+				drmModeFreeConnector(connector);
+				connector = drmModeGetConnector(fd,
+								connector_id);
+				if (connector == NULL)
+					continue;
+			}
+
+			create_output_for_connector(b, gpu, resources,
 						    connector, x, y,
 						    drm_device);
 			weston_log("connector %d connected\n", connector_id);
@@ -2624,11 +5934,12 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 	}
 	drmModeFreeResources(resources);
 
-	disconnects = b->connector_allocator & ~connected;
+	disconnects = *connector_allocator & ~connected;
 	if (disconnects) {
 		wl_list_for_each_safe(output, next, &b->compositor->output_list,
 				      base.link) {
-			if (disconnects & (1 << output->connector_id)) {
+			if (output->gpu == gpu &&
+			    disconnects & (1 << output->connector_id)) {
 				disconnects &= ~(1 << output->connector_id);
 				weston_log("connector %d disconnected\n",
 				       output->connector_id);
@@ -2638,18 +5949,18 @@ update_outputs(struct drm_backend *b, struct udev_device *drm_device)
 	}
 
 	/* FIXME: handle zero outputs, without terminating */
-	if (b->connector_allocator == 0)
+	if (!drm_backend_has_connectors(b))
 		weston_compositor_exit(b->compositor);
 }
 
 static int
-udev_event_is_hotplug(struct drm_backend *b, struct udev_device *device)
+udev_event_is_hotplug(struct udev_device *device, int id)
 {
 	const char *sysnum;
 	const char *val;
 
 	sysnum = udev_device_get_sysnum(device);
-	if (!sysnum || atoi(sysnum) != b->drm.id)
+	if (!sysnum || atoi(sysnum) != id)
 		return 0;
 
 	val = udev_device_get_property_value(device, "HOTPLUG");
@@ -2659,22 +5970,208 @@ udev_event_is_hotplug(struct drm_backend *b, struct udev_device *device)
 	return strcmp(val, "1") == 0;
 }
 
+static void
+drm_hotplug_queue(struct drm_backend *b, struct drm_hotplug *hotplug,
+		  struct udev_device *event)
+{
+	const char *val;
+	int id = 0;
+
+	/* Newer kernels name the connector that changed */
+	val = udev_device_get_property_value(event, "CONNECTOR");
+	if (val)
+		id = atoi(val);
+	if (id > 0 && id < 32)
+		hotplug->connectors |= 1u << id;
+	else
+		hotplug->all = 1;
+
+	if (hotplug->device)
+		udev_device_unref(hotplug->device);
+	hotplug->device = udev_device_ref(event);
+	hotplug->pending = 1;
+
+	wl_event_source_timer_update(b->hotplug_timer,
+				     DRM_HOTPLUG_DEBOUNCE_MS);
+}
+
+static void
+drm_hotplug_clear(struct drm_hotplug *hotplug)
+{
+	if (hotplug->device)
+		udev_device_unref(hotplug->device);
+	memset(hotplug, 0, sizeof *hotplug);
+}
+
+static void
+drm_hotplug_run(struct drm_backend *b, struct drm_gpu *gpu,
+		struct drm_hotplug *hotplug)
+{
+	struct drm_hotplug h = *hotplug;
+
+	if (!h.pending)
+		return;
+
+	memset(hotplug, 0, sizeof *hotplug);
+	update_outputs(b, gpu, h.device, h.all ? 0 : h.connectors);
+	drm_hotplug_clear(&h);
+}
+
+static int
+drm_hotplug_timer_handler(void *data)
+{
+	struct drm_backend *b = data;
+	struct drm_gpu *gpu;
+
+	drm_hotplug_run(b, NULL, &b->hotplug);
+	wl_list_for_each(gpu, &b->gpu_list, link)
+		drm_hotplug_run(b, gpu, &gpu->hotplug);
+
+	return 0;
+}
+
 static int
 udev_drm_event(int fd, uint32_t mask, void *data)
 {
 	struct drm_backend *b = data;
 	struct udev_device *event;
+	struct drm_gpu *gpu;
 
 	event = udev_monitor_receive_device(b->udev_monitor);
 
-	if (udev_event_is_hotplug(b, event))
-		update_outputs(b, event);
+	if (udev_event_is_hotplug(event, b->drm.id))
+		drm_hotplug_queue(b, &b->hotplug, event);
+
+	wl_list_for_each(gpu, &b->gpu_list, link)
+		if (udev_event_is_hotplug(event, gpu->id))
+			drm_hotplug_queue(b, &gpu->hotplug, event);
 
 	udev_device_unref(event);
 
 	return 1;
 }
 
+static void
+drm_gpu_destroy(struct drm_gpu *gpu)
+{
+	struct weston_compositor *ec = gpu->backend->compositor;
+
+	wl_list_remove(&gpu->link);
+	drm_hotplug_clear(&gpu->hotplug);
+	if (gpu->source)
+		wl_event_source_remove(gpu->source);
+	weston_launcher_close(ec->launcher, gpu->fd);
+	udev_device_unref(gpu->device);
+	free(gpu->filename);
+	free(gpu);
+}
+
+static struct drm_gpu *
+drm_gpu_create(struct drm_backend *b, struct udev_device *device)
+{
+	struct weston_compositor *ec = b->compositor;
+	struct wl_event_loop *loop;
+	const char *filename, *sysnum;
+	struct drm_gpu *gpu;
+	drmModeRes *resources;
+	uint64_t cap;
+	int fd, connectors;
+
+	sysnum = udev_device_get_sysnum(device);
+	filename = udev_device_get_devnode(device);
+	if (!sysnum || !filename)
+		return NULL;
+
+	fd = weston_launcher_open(ec->launcher, filename, O_RDWR);
+	if (fd < 0) {
+		weston_log("couldn't open %s, skipping\n", filename);
+		return NULL;
+	}
+
+	/* Render-only devices have nothing to drive */
+	resources = drmModeGetResources(fd);
+	connectors = resources ? resources->count_connectors : 0;
+	drmModeFreeResources(resources);
+	if (connectors == 0) {
+		weston_launcher_close(ec->launcher, fd);
+		return NULL;
+	}
+
+	gpu = zalloc(sizeof *gpu);
+	if (!gpu) {
+		weston_launcher_close(ec->launcher, fd);
+		return NULL;
+	}
+
+	gpu->backend = b;
+	gpu->device = udev_device_ref(device);
+	gpu->id = atoi(sysnum);
+	gpu->fd = fd;
+	gpu->filename = strdup(filename);
+
+	if (drmGetCap(fd, DRM_CAP_PRIME, &cap) == 0 &&
+	    (cap & DRM_PRIME_CAP_IMPORT) &&
+	    drmGetCap(b->drm.fd, DRM_CAP_PRIME, &cap) == 0 &&
+	    (cap & DRM_PRIME_CAP_EXPORT))
+		gpu->prime_import = 1;
+
+	/* Flips there are rare enough to be handled on the main loop */
+	loop = wl_display_get_event_loop(ec->wl_display);
+	gpu->source = wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+					   on_drm_input, b);
+	if (!gpu->source) {
+		wl_list_init(&gpu->link);
+		drm_gpu_destroy(gpu);
+		return NULL;
+	}
+
+	wl_list_insert(b->gpu_list.prev, &gpu->link);
+
+	weston_log("using %s for outputs too, %s\n", filename,
+		   gpu->prime_import ? "importing frames" : "copying frames");
+
+	return gpu;
+}
+
+/*
+ * Find the DRM devices on the seat besides the primary GPU which have
+ * connectors, for [core] secondary-gpus.
+ */
+static void
+find_secondary_gpus(struct drm_backend *b, const char *seat,
+		    struct udev_device *primary)
+{
+	struct udev_enumerate *e;
+	struct udev_list_entry *entry;
+	const char *path, *device_seat;
+	struct udev_device *device;
+
+	e = udev_enumerate_new(b->udev);
+	udev_enumerate_add_match_subsystem(e, "drm");
+	udev_enumerate_add_match_sysname(e, "card[0-9]*");
+
+	udev_enumerate_scan_devices(e);
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(e)) {
+		path = udev_list_entry_get_name(entry);
+		if (strcmp(path, udev_device_get_syspath(primary)) == 0)
+			continue;
+
+		device = udev_device_new_from_syspath(b->udev, path);
+		if (!device)
+			continue;
+
+		device_seat = udev_device_get_property_value(device, "ID_SEAT");
+		if (!device_seat)
+			device_seat = default_seat;
+		if (strcmp(device_seat, seat) == 0)
+			drm_gpu_create(b, device);
+
+		udev_device_unref(device);
+	}
+
+	udev_enumerate_unref(e);
+}
+
 static void
 drm_restore(struct weston_compositor *ec)
 {
@@ -2685,16 +6182,22 @@ static void
 drm_destroy(struct weston_compositor *ec)
 {
 	struct drm_backend *b = (struct drm_backend *) ec->backend;
+	struct drm_gpu *gpu, *next;
 
 	udev_input_destroy(&b->input);
 
 	wl_event_source_remove(b->udev_drm_source);
-	wl_event_source_remove(b->drm_source);
+	wl_event_source_remove(b->hotplug_timer);
+	drm_hotplug_clear(&b->hotplug);
+	drm_backend_stop_flip_thread(b);
 
 	destroy_sprites(b);
 
 	weston_compositor_shutdown(ec);
 
+	wl_list_for_each_safe(gpu, next, &b->gpu_list, link)
+		drm_gpu_destroy(gpu);
+
 	if (b->gbm)
 		gbm_device_destroy(b->gbm);
 
@@ -2702,6 +6205,7 @@ drm_destroy(struct weston_compositor *ec)
 
 	close(b->drm.fd);
 
+	drm_edid_cache_release(b);
 	free(b);
 }
 
@@ -2724,7 +6228,7 @@ drm_backend_set_modes(struct drm_backend *backend)
 		}
 
 		drm_mode = (struct drm_mode *) output->base.current_mode;
-		ret = drmModeSetCrtc(backend->drm.fd, output->crtc_id,
+		ret = drmModeSetCrtc(drm_output_fd(output), output->crtc_id,
 				     output->current->fb_id, 0, 0,
 				     &output->connector_id, 1,
 				     &drm_mode->mode_info);
@@ -2737,6 +6241,53 @@ drm_backend_set_modes(struct drm_backend *backend)
 	}
 }
 
+/* Put back what was on screen when the session was deactivated. The
+ * framebuffers are still ours and the renderer's damage tracking still
+ * holds, so only what changed in the meantime needs a repaint. */
+static void
+drm_backend_fast_resume(struct drm_backend *b)
+{
+	struct drm_output *output;
+	struct drm_sprite *s;
+	int ret;
+
+	drm_backend_set_modes(b);
+
+	/* Atomic outputs commit all their planes with the next frame */
+	if (!b->atomic_modeset) {
+		wl_list_for_each(s, &b->sprite_list, link) {
+			if (s->type != WDRM_PLANE_TYPE_OVERLAY ||
+			    !s->current || !s->output || s->output->gpu)
+				continue;
+
+			ret = drmModeSetPlane(b->drm.fd, s->plane_id,
+					      s->output->crtc_id,
+					      s->current->fb_id, 0,
+					      s->dest_x, s->dest_y,
+					      s->dest_w, s->dest_h,
+					      s->src_x, s->src_y,
+					      s->src_w, s->src_h);
+			if (ret)
+				weston_log("restoring plane %u failed: %m\n",
+					   s->plane_id);
+		}
+	}
+
+	wl_list_for_each(output, &b->compositor->output_list, base.link) {
+		/* The cursor was turned off on deactivation, make the
+		 * next repaint upload and place it again */
+		pixman_region32_union_rect(&output->cursor_plane.damage,
+					   &output->cursor_plane.damage,
+					   output->base.x, output->base.y,
+					   1, 1);
+		output->cursor_plane.x = INT32_MIN;
+		output->cursor_plane.y = INT32_MIN;
+
+		/* For the frame callbacks held back while inactive */
+		weston_output_schedule_repaint(&output->base);
+	}
+}
+
 static void
 session_notify(struct wl_listener *listener, void *data)
 {
@@ -2748,8 +6299,12 @@ session_notify(struct wl_listener *listener, void *data)
 	if (compositor->session_active) {
 		weston_log("activating session\n");
 		compositor->state = b->prev_state;
-		drm_backend_set_modes(b);
-		weston_compositor_damage_all(compositor);
+		if (b->fast_resume) {
+			drm_backend_fast_resume(b);
+		} else {
+			drm_backend_set_modes(b);
+			weston_compositor_damage_all(compositor);
+		}
 		udev_input_enable(&b->input);
 	} else {
 		weston_log("deactivating session\n");
@@ -2768,17 +6323,22 @@ session_notify(struct wl_listener *listener, void *data)
 
 		wl_list_for_each(output, &compositor->output_list, base.link) {
 			output->base.repaint_needed = 0;
-			drmModeSetCursor(b->drm.fd, output->crtc_id, 0, 0, 0);
+			drmModeSetCursor(drm_output_fd(output), output->crtc_id,
+					 0, 0, 0);
 		}
 
 		output = container_of(compositor->output_list.next,
 				      struct drm_output, base.link);
 
-		wl_list_for_each(sprite, &b->sprite_list, link)
+		wl_list_for_each(sprite, &b->sprite_list, link) {
+			if (sprite->type != WDRM_PLANE_TYPE_OVERLAY)
+				continue;
+
 			drmModeSetPlane(b->drm.fd,
 					sprite->plane_id,
 					output->crtc_id, 0, 0,
 					0, 0, 0, 0, 0, 0, 0, 0);
+		}
 	};
 }
 
@@ -2868,10 +6428,111 @@ planes_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 	}
 }
 
+/*
+ * Log how often views went on each kind of plane, and why those left on
+ * the primary plane could not, since the last time; then list each view
+ * with its reasons on the next repaint of every output.
+ */
+static void
+plane_stats_binding(struct weston_keyboard *keyboard, uint32_t time,
+		    uint32_t key, void *data)
+{
+	struct drm_backend *b = data;
+	struct drm_output *output;
+	char reasons[512];
+	int try, r, len;
+
+	wl_list_for_each(output, &b->compositor->output_list, base.link) {
+		weston_log("DRM plane statistics for %s over %u repaints:\n",
+			   output->base.name, output->plane_stats_repaints);
+
+		for (try = 0; try < DRM_PLANE_TRY_COUNT; try++) {
+			len = 0;
+			reasons[0] = '\0';
+			for (r = DRM_REJECT_NONE + 1; r < DRM_REJECT_COUNT; r++) {
+				if (!output->plane_rejects[try][r] ||
+				    len >= (int) sizeof reasons)
+					continue;
+				len += snprintf(reasons + len,
+						sizeof reasons - len, " %s %u",
+						drm_plane_reject_names[r],
+						output->plane_rejects[try][r]);
+			}
+
+			weston_log_continue(STAMP_SPACE "%s: %u assigned, "
+					    "rejected:%s\n",
+					    drm_plane_try_names[try],
+					    output->plane_assigned[try],
+					    reasons[0] ? reasons : " none");
+		}
+
+		output->plane_stats_repaints = 0;
+		memset(output->plane_assigned, 0,
+		       sizeof output->plane_assigned);
+		memset(output->plane_rejects, 0, sizeof output->plane_rejects);
+		output->plane_stats_dump_views = 1;
+		weston_output_schedule_repaint(&output->base);
+	}
+}
+
 #ifdef BUILD_VAAPI_RECORDER
+/* The recorder keeps the fbs it records imported, and has to forget
+ * them before their memory can be reused by another fb */
+struct drm_recorder_fb {
+	struct drm_output *output;
+	struct drm_fb *fb;
+	struct wl_listener fb_destroy_listener;
+	struct wl_list link;
+};
+
+static void
+recorder_fb_free(struct drm_recorder_fb *rfb)
+{
+	wl_list_remove(&rfb->fb_destroy_listener.link);
+	wl_list_remove(&rfb->link);
+	free(rfb);
+}
+
+static void
+recorder_fb_destroy_notify(struct wl_listener *listener, void *data)
+{
+	struct drm_recorder_fb *rfb =
+		container_of(listener, struct drm_recorder_fb,
+			     fb_destroy_listener);
+
+	if (rfb->output->recorder)
+		vaapi_recorder_forget_buffer(rfb->output->recorder, rfb->fb);
+	recorder_fb_free(rfb);
+}
+
+static void
+recorder_fb_track(struct drm_output *output, struct drm_fb *fb)
+{
+	struct drm_recorder_fb *rfb;
+
+	wl_list_for_each(rfb, &output->recorder_fb_list, link)
+		if (rfb->fb == fb)
+			return;
+
+	rfb = zalloc(sizeof *rfb);
+	if (!rfb)
+		return;
+
+	rfb->output = output;
+	rfb->fb = fb;
+	rfb->fb_destroy_listener.notify = recorder_fb_destroy_notify;
+	wl_signal_add(&fb->destroy_signal, &rfb->fb_destroy_listener);
+	wl_list_insert(&output->recorder_fb_list, &rfb->link);
+}
+
 static void
 recorder_destroy(struct drm_output *output)
 {
+	struct drm_recorder_fb *rfb, *next;
+
+	wl_list_for_each_safe(rfb, next, &output->recorder_fb_list, link)
+		recorder_fb_free(rfb);
+
 	vaapi_recorder_destroy(output->recorder);
 	output->recorder = NULL;
 
@@ -2903,7 +6564,9 @@ recorder_frame_notify(struct wl_listener *listener, void *data)
 		return;
 	}
 
-	ret = vaapi_recorder_frame(output->recorder, fd,
+	recorder_fb_track(output, output->current);
+
+	ret = vaapi_recorder_frame(output->recorder, output->current, fd,
 				   output->current->stride);
 	if (ret < 0) {
 		weston_log("[libva recorder] aborted: %m\n");
@@ -2934,7 +6597,7 @@ recorder_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 {
 	struct drm_backend *b = data;
 	struct drm_output *output;
-	int width, height;
+	int32_t width, height;
 
 	output = container_of(b->compositor->output_list.next,
 			      struct drm_output, base.link);
@@ -2946,8 +6609,7 @@ recorder_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 			return;
 		}
 
-		width = output->base.current_mode->width;
-		height = output->base.current_mode->height;
+		weston_output_get_buffer_size(&output->base, &width, &height);
 
 		output->recorder =
 			create_recorder(b, width, height, "capture.h264");
@@ -2958,6 +6620,7 @@ recorder_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 
 		output->base.disable_planes++;
 
+		wl_list_init(&output->recorder_fb_list);
 		output->recorder_frame_listener.notify = recorder_frame_notify;
 		wl_signal_add(&output->base.frame_signal,
 			      &output->recorder_frame_listener);
@@ -2998,8 +6661,11 @@ switch_to_gl_renderer(struct drm_backend *b)
 		return;
 	}
 
-	wl_list_for_each(output, &b->compositor->output_list, base.link)
+	wl_list_for_each(output, &b->compositor->output_list, base.link) {
+		drm_output_finish_render(output);
 		pixman_renderer_output_destroy(&output->base);
+		output->render_thread = 0;
+	}
 
 	b->compositor->renderer->destroy(b->compositor);
 
@@ -3042,6 +6708,7 @@ drm_backend_create(struct weston_compositor *compositor,
 	struct weston_config_section *section;
 	struct udev_device *drm_device;
 	struct wl_event_loop *loop;
+	struct drm_gpu *gpu, *next_gpu;
 	const char *path;
 	uint32_t key;
 
@@ -3063,12 +6730,25 @@ drm_backend_create(struct weston_compositor *compositor,
 	b->sprites_are_broken = 1;
 	b->cursors_are_broken = 1;
 	b->compositor = compositor;
+	wl_list_init(&b->gpu_list);
+	wl_list_init(&b->edid_cache);
+	wl_list_init(&b->gem_handles);
 
 	section = weston_config_get_section(config, "core", NULL, NULL);
 	if (get_gbm_format_from_section(section,
 					GBM_FORMAT_XRGB8888,
 					&b->format) == -1)
 		goto err_base;
+	weston_config_section_get_uint(section, "overlay-bandwidth",
+				       &b->overlay_bandwidth, 0);
+	weston_config_section_get_bool(section, "secondary-gpus",
+				       &b->use_secondary_gpus, 0);
+	weston_config_section_get_bool(section, "render-threads",
+				       &b->render_threads, 0);
+	weston_config_section_get_bool(section, "session-fast-resume",
+				       &b->fast_resume, 0);
+	weston_config_section_get_int(section, "backlight-ramp-time",
+				      &b->backlight_ramp_ms, 0);
 
 	b->use_pixman = param->use_pixman;
 
@@ -3102,6 +6782,12 @@ drm_backend_create(struct weston_compositor *compositor,
 		goto err_udev_dev;
 	}
 
+	/* Atomic commits update all planes of a CRTC in one go. */
+	if (b->atomic_modeset) {
+		b->sprites_are_broken = 0;
+		b->cursors_are_broken = 0;
+	}
+
 	if (b->use_pixman) {
 		if (init_pixman(b) < 0) {
 			weston_log("failed to initialize pixman renderer\n");
@@ -3127,6 +6813,9 @@ drm_backend_create(struct weston_compositor *compositor,
 	wl_list_init(&b->sprite_list);
 	create_sprites(b);
 
+	if (b->use_secondary_gpus)
+		find_secondary_gpus(b, param->seat_id, drm_device);
+
 	if (udev_input_init(&b->input,
 			    compositor, b->udev, param->seat_id) < 0) {
 		weston_log("failed to create input devices\n");
@@ -3146,9 +6835,10 @@ drm_backend_create(struct weston_compositor *compositor,
 	path = NULL;
 
 	loop = wl_display_get_event_loop(compositor->wl_display);
-	b->drm_source =
-		wl_event_loop_add_fd(loop, b->drm.fd,
-				     WL_EVENT_READABLE, on_drm_input, b);
+	if (drm_backend_start_flip_thread(b, loop) < 0) {
+		weston_log("failed to add the DRM event source\n");
+		goto err_udev_input;
+	}
 
 	b->udev_monitor = udev_monitor_new_from_netlink(b->udev, "udev");
 	if (b->udev_monitor == NULL) {
@@ -3161,6 +6851,8 @@ drm_backend_create(struct weston_compositor *compositor,
 		wl_event_loop_add_fd(loop,
 				     udev_monitor_get_fd(b->udev_monitor),
 				     WL_EVENT_READABLE, udev_drm_event, b);
+	b->hotplug_timer =
+		wl_event_loop_add_timer(loop, drm_hotplug_timer_handler, b);
 
 	if (udev_monitor_enable_receiving(b->udev_monitor) < 0) {
 		weston_log("failed to enable udev-monitor receiving\n");
@@ -3175,6 +6867,8 @@ drm_backend_create(struct weston_compositor *compositor,
 					    planes_binding, b);
 	weston_compositor_add_debug_binding(compositor, KEY_V,
 					    planes_binding, b);
+	weston_compositor_add_debug_binding(compositor, KEY_A,
+					    plane_stats_binding, b);
 	weston_compositor_add_debug_binding(compositor, KEY_Q,
 					    recorder_binding, b);
 	weston_compositor_add_debug_binding(compositor, KEY_W,
@@ -3192,12 +6886,15 @@ drm_backend_create(struct weston_compositor *compositor,
 
 err_udev_monitor:
 	wl_event_source_remove(b->udev_drm_source);
+	wl_event_source_remove(b->hotplug_timer);
 	udev_monitor_unref(b->udev_monitor);
 err_drm_source:
-	wl_event_source_remove(b->drm_source);
+	drm_backend_stop_flip_thread(b);
 err_udev_input:
 	udev_input_destroy(&b->input);
 err_sprite:
+	wl_list_for_each_safe(gpu, next_gpu, &b->gpu_list, link)
+		drm_gpu_destroy(gpu);
 	gbm_device_destroy(b->gbm);
 	destroy_sprites(b);
 err_udev_dev:
@@ -3209,6 +6906,7 @@ err_udev:
 err_compositor:
 	weston_compositor_shutdown(compositor);
 err_base:
+	drm_edid_cache_release(b);
 	free(b);
 	return NULL;
 }
@@ -37,6 +37,7 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <linux/fb.h>
 #include <linux/input.h>
 
@@ -46,6 +47,7 @@
 #include "compositor.h"
 #include "launcher-util.h"
 #include "pixman-renderer.h"
+#include "linux-dmabuf.h"
 #include "libinput-seat.h"
 #include "gl-renderer.h"
 #include "presentation_timing-server-protocol.h"
@@ -89,10 +91,34 @@ struct fbdev_output {
 	void *fb; /* length is fb_info.buffer_length */
 
 	/* pixman details. */
-	pixman_image_t *hw_surface;
+	pixman_image_t *hw_surface[2];
 	pixman_image_t *shadow_surface;
 	void *shadow_buf;
 	uint8_t depth;
+
+	/* With a virtual frame buffer twice the screen height we render
+	 * straight into the half not on screen and pan to it.  Otherwise
+	 * there is one buffer, updated from the shadow surface. */
+	int num_buffers;
+	int back;
+	int fb_fd; /* kept open for panning, -1 otherwise */
+	struct fb_var_screeninfo varinfo;
+	pixman_region32_t previous_damage;
+
+	/* Waits for vblank and pans, off the main loop */
+	struct {
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		int running;
+		int quit;
+		int pending; /* a pan to yoffset is requested */
+		int in_flight; /* main loop waits for the wake_pipe */
+		uint32_t yoffset;
+		struct timespec stamp;
+		int wake_pipe[2];
+		struct wl_event_source *source;
+	} vsync;
 };
 
 struct fbdev_parameters {
@@ -126,6 +152,61 @@ fbdev_output_start_repaint_loop(struct weston_output *output)
 	weston_output_finish_frame(output, &ts, PRESENTATION_FEEDBACK_INVALID);
 }
 
+/* Show the back buffer.  Returns 1 if finish_frame will follow the
+ * vblank it lands on, 0 if the caller should time the frame. */
+static int
+fbdev_output_flip(struct fbdev_output *output)
+{
+	struct fb_var_screeninfo varinfo;
+
+	if (output->vsync.running) {
+		pthread_mutex_lock(&output->vsync.mutex);
+		output->vsync.yoffset = output->back * output->mode.height;
+		output->vsync.pending = 1;
+		output->vsync.in_flight = 1;
+		pthread_cond_signal(&output->vsync.cond);
+		pthread_mutex_unlock(&output->vsync.mutex);
+
+		return 1;
+	}
+
+	varinfo = output->varinfo;
+	varinfo.yoffset = output->back * output->mode.height;
+	varinfo.activate = FB_ACTIVATE_VBL;
+	if (ioctl(output->fb_fd, FBIOPAN_DISPLAY, &varinfo) < 0)
+		weston_log("fbdev: failed to pan display: %m\n");
+	else
+		output->back ^= 1;
+
+	return 0;
+}
+
+static void
+fbdev_output_repaint_flip(struct weston_output *base, pixman_region32_t *damage)
+{
+	struct fbdev_output *output = to_fbdev_output(base);
+	struct weston_compositor *ec = output->base.compositor;
+	pixman_region32_t total_damage;
+
+	/* The back buffer last got the frame before the previous one */
+	pixman_region32_init(&total_damage);
+	pixman_region32_union(&total_damage, damage, &output->previous_damage);
+	pixman_region32_copy(&output->previous_damage, damage);
+
+	pixman_renderer_output_set_buffer(base,
+					  output->hw_surface[output->back]);
+	ec->renderer->repaint_output(base, &total_damage);
+
+	pixman_region32_fini(&total_damage);
+
+	pixman_region32_subtract(&ec->primary_plane.damage,
+	                         &ec->primary_plane.damage, damage);
+
+	if (!fbdev_output_flip(output))
+		wl_event_source_timer_update(output->finish_frame_timer,
+		                             1000000 / output->mode.refresh);
+}
+
 static void
 fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damage)
 {
@@ -152,7 +233,7 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 		pixman_image_composite32(PIXMAN_OP_SRC,
 			output->shadow_surface, /* src */
 			NULL /* mask */,
-			output->hw_surface, /* dest */
+			output->hw_surface[0], /* dest */
 			rects[i].x1, /* src_x */
 			rects[i].y1, /* src_y */
 			0, 0, /* mask_x, mask_y */
@@ -168,10 +249,8 @@ fbdev_output_repaint_pixman(struct weston_output *base, pixman_region32_t *damag
 	pixman_region32_subtract(&ec->primary_plane.damage,
 	                         &ec->primary_plane.damage, damage);
 
-	/* Schedule the end of the frame. We do not sync this to the frame
-	 * buffer clock because users who want that should be using the DRM
-	 * compositor. FBIO_WAITFORVSYNC blocks and FB_ACTIVATE_VBL requires
-	 * panning, which is broken in most kernel drivers.
+	/* Without a second buffer to pan to there is nothing to sync to
+	 * the frame buffer clock, see fbdev_frame_buffer_enable_flip().
 	 *
 	 * Finish the frame synchronised to the specified refresh rate. The
 	 * refresh rate is given in mHz and the interval in ms. */
@@ -186,7 +265,9 @@ fbdev_output_repaint(struct weston_output *base, pixman_region32_t *damage)
 	struct fbdev_backend *fbb = output->backend;
 	struct weston_compositor *ec = fbb->compositor;
 
-	if (fbb->use_pixman) {
+	if (fbb->use_pixman && output->num_buffers == 2) {
+		fbdev_output_repaint_flip(base, damage);
+	} else if (fbb->use_pixman) {
 		fbdev_output_repaint_pixman(base,damage);
 	} else {
 		ec->renderer->repaint_output(base, damage);
@@ -213,6 +294,147 @@ finish_frame_handler(void *data)
 	return 1;
 }
 
+static int
+fbdev_output_vsync_handler(int fd, uint32_t mask, void *data)
+{
+	struct fbdev_output *output = data;
+	struct timespec ts;
+	char buf[16];
+
+	while (read(fd, buf, sizeof buf) > 0)
+		;
+
+	pthread_mutex_lock(&output->vsync.mutex);
+	ts = output->vsync.stamp;
+	pthread_mutex_unlock(&output->vsync.mutex);
+
+	if (!output->vsync.in_flight)
+		return 1;
+	output->vsync.in_flight = 0;
+
+	output->back ^= 1;
+	weston_output_finish_frame(&output->base, &ts,
+				   PRESENTATION_FEEDBACK_KIND_VSYNC |
+				   PRESENTATION_FEEDBACK_KIND_HW_COMPLETION);
+
+	return 1;
+}
+
+static void *
+fbdev_vsync_thread(void *data)
+{
+	struct fbdev_output *output = data;
+	struct fb_var_screeninfo varinfo = output->varinfo;
+	clockid_t clock = output->base.compositor->presentation_clock;
+	uint32_t crtc = 0;
+	struct timespec ts;
+	char c = 0;
+
+	pthread_mutex_lock(&output->vsync.mutex);
+	while (1) {
+		while (!output->vsync.pending && !output->vsync.quit)
+			pthread_cond_wait(&output->vsync.cond,
+					  &output->vsync.mutex);
+		if (output->vsync.quit)
+			break;
+
+		varinfo.yoffset = output->vsync.yoffset;
+		output->vsync.pending = 0;
+		pthread_mutex_unlock(&output->vsync.mutex);
+
+		/* Pan right at the start of vblank, so the new buffer is
+		 * scanned out from the top. */
+		ioctl(output->fb_fd, FBIO_WAITFORVSYNC, &crtc);
+		clock_gettime(clock, &ts);
+		varinfo.activate = FB_ACTIVATE_NOW;
+		if (ioctl(output->fb_fd, FBIOPAN_DISPLAY, &varinfo) < 0)
+			weston_log("fbdev: failed to pan display: %m\n");
+
+		pthread_mutex_lock(&output->vsync.mutex);
+		output->vsync.stamp = ts;
+		if (write(output->vsync.wake_pipe[1], &c, 1) < 0 &&
+		    errno != EAGAIN)
+			weston_log("fbdev: failed to signal vblank\n");
+	}
+	pthread_mutex_unlock(&output->vsync.mutex);
+
+	return NULL;
+}
+
+static void
+fbdev_output_start_vsync(struct fbdev_output *output)
+{
+	struct wl_event_loop *loop;
+	uint32_t crtc = 0;
+
+	/* Drivers without FBIO_WAITFORVSYNC get panned from the main
+	 * loop and timed by the refresh rate. */
+	if (ioctl(output->fb_fd, FBIO_WAITFORVSYNC, &crtc) < 0)
+		return;
+
+	if (pipe2(output->vsync.wake_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+		return;
+
+	loop = wl_display_get_event_loop(output->base.compositor->wl_display);
+	output->vsync.source =
+		wl_event_loop_add_fd(loop, output->vsync.wake_pipe[0],
+				     WL_EVENT_READABLE,
+				     fbdev_output_vsync_handler, output);
+	if (!output->vsync.source)
+		goto err_pipe;
+
+	pthread_mutex_init(&output->vsync.mutex, NULL);
+	pthread_cond_init(&output->vsync.cond, NULL);
+	output->vsync.quit = 0;
+	output->vsync.pending = 0;
+	output->vsync.in_flight = 0;
+
+	if (pthread_create(&output->vsync.thread, NULL,
+			   fbdev_vsync_thread, output) != 0) {
+		pthread_mutex_destroy(&output->vsync.mutex);
+		pthread_cond_destroy(&output->vsync.cond);
+		wl_event_source_remove(output->vsync.source);
+		goto err_pipe;
+	}
+
+	output->vsync.running = 1;
+	weston_log("fbdev: page flips synchronised to vblank\n");
+
+	return;
+
+err_pipe:
+	close(output->vsync.wake_pipe[0]);
+	close(output->vsync.wake_pipe[1]);
+}
+
+static void
+fbdev_output_stop_vsync(struct fbdev_output *output)
+{
+	if (!output->vsync.running)
+		return;
+
+	pthread_mutex_lock(&output->vsync.mutex);
+	output->vsync.quit = 1;
+	pthread_cond_signal(&output->vsync.cond);
+	pthread_mutex_unlock(&output->vsync.mutex);
+
+	pthread_join(output->vsync.thread, NULL);
+
+	pthread_mutex_destroy(&output->vsync.mutex);
+	pthread_cond_destroy(&output->vsync.cond);
+	wl_event_source_remove(output->vsync.source);
+	close(output->vsync.wake_pipe[0]);
+	close(output->vsync.wake_pipe[1]);
+	output->vsync.running = 0;
+
+	/* Do not leave the repaint loop waiting for a flip that no
+	 * longer reports back. */
+	if (output->vsync.in_flight) {
+		output->vsync.in_flight = 0;
+		wl_event_source_timer_update(output->finish_frame_timer, 1);
+	}
+}
+
 static pixman_format_code_t
 calculate_pixman_format(struct fb_var_screeninfo *vinfo,
                         struct fb_fix_screeninfo *finfo)
@@ -393,6 +615,49 @@ fbdev_set_screen_info(struct fbdev_output *output, int fd,
 
 static void fbdev_frame_buffer_destroy(struct fbdev_output *output);
 
+/* Make the virtual frame buffer twice the screen height so there is
+ * a second buffer to pan to.  Many drivers do not support panning,
+ * or do not have the memory, in which case we keep single
+ * buffering. */
+static int
+fbdev_frame_buffer_enable_flip(struct fbdev_output *output, int fd)
+{
+	struct fb_var_screeninfo varinfo;
+	struct fb_fix_screeninfo fixinfo;
+	unsigned int yres;
+
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &varinfo) < 0)
+		return -1;
+
+	yres = varinfo.yres;
+	if (varinfo.yres_virtual < yres * 2) {
+		varinfo.yres_virtual = yres * 2;
+		varinfo.yoffset = 0;
+		varinfo.activate = FB_ACTIVATE_NOW;
+		if (ioctl(fd, FBIOPUT_VSCREENINFO, &varinfo) < 0)
+			return -1;
+	}
+
+	if (ioctl(fd, FBIOGET_VSCREENINFO, &varinfo) < 0 ||
+	    ioctl(fd, FBIOGET_FSCREENINFO, &fixinfo) < 0)
+		return -1;
+
+	if (varinfo.yres != yres || varinfo.yres_virtual < yres * 2 ||
+	    fixinfo.ypanstep == 0 || yres % fixinfo.ypanstep != 0 ||
+	    fixinfo.smem_len < (size_t) fixinfo.line_length * yres * 2)
+		return -1;
+
+	varinfo.yoffset = 0;
+	if (ioctl(fd, FBIOPAN_DISPLAY, &varinfo) < 0)
+		return -1;
+
+	output->fb_info.line_length = fixinfo.line_length;
+	output->fb_info.buffer_length = fixinfo.smem_len;
+	output->varinfo = varinfo;
+
+	return 0;
+}
+
 /* Returns an FD for the frame buffer device. */
 static int
 fbdev_frame_buffer_open(struct fbdev_output *output, const char *fb_dev,
@@ -422,14 +687,22 @@ fbdev_frame_buffer_open(struct fbdev_output *output, const char *fb_dev,
 	return fd;
 }
 
-/* Closes the FD on success or failure. */
+/* Closes the FD on failure, and on success unless it is needed for
+ * panning. */
 static int
 fbdev_frame_buffer_map(struct fbdev_output *output, int fd)
 {
+	size_t offset;
 	int retval = -1;
+	int i;
 
 	weston_log("Mapping fbdev frame buffer.\n");
 
+	if (fbdev_frame_buffer_enable_flip(output, fd) == 0)
+		output->num_buffers = 2;
+	else
+		output->num_buffers = 1;
+
 	/* Map the frame buffer. Write-only mode, since we don't want to read
 	 * anything back (because it's slow). */
 	output->fb = mmap(NULL, output->fb_info.buffer_length,
@@ -437,24 +710,43 @@ fbdev_frame_buffer_map(struct fbdev_output *output, int fd)
 	if (output->fb == MAP_FAILED) {
 		weston_log("Failed to mmap frame buffer: %s\n",
 		           strerror(errno));
+		output->fb = NULL;
 		goto out_close;
 	}
 
-	/* Create a pixman image to wrap the memory mapped frame buffer. */
-	output->hw_surface =
-		pixman_image_create_bits(output->fb_info.pixel_format,
-		                         output->fb_info.x_resolution,
-		                         output->fb_info.y_resolution,
-		                         output->fb,
-		                         output->fb_info.line_length);
-	if (output->hw_surface == NULL) {
-		weston_log("Failed to create surface for frame buffer.\n");
-		goto out_unmap;
+	/* Create a pixman image to wrap each buffer in the memory mapped
+	 * frame buffer. */
+	for (i = 0; i < output->num_buffers; i++) {
+		offset = (size_t) i * output->fb_info.y_resolution *
+			 output->fb_info.line_length;
+		output->hw_surface[i] =
+			pixman_image_create_bits(output->fb_info.pixel_format,
+			                         output->fb_info.x_resolution,
+			                         output->fb_info.y_resolution,
+			                         (uint32_t *) ((char *) output->fb +
+			                                       offset),
+			                         output->fb_info.line_length);
+		if (output->hw_surface[i] == NULL) {
+			weston_log("Failed to create surface for frame buffer.\n");
+			goto out_unmap;
+		}
 	}
 
 	/* Success! */
 	retval = 0;
 
+	/* Buffer 0 is on screen, so render to buffer 1 first, in full */
+	pixman_region32_fini(&output->previous_damage);
+	pixman_region32_init(&output->previous_damage);
+	output->back = 1;
+
+	if (output->num_buffers == 2) {
+		weston_log("fbdev: double buffering by panning\n");
+		output->fb_fd = fd;
+		fbdev_output_start_vsync(output);
+		return 0;
+	}
+
 out_unmap:
 	if (retval != 0 && output->fb != NULL)
 		fbdev_frame_buffer_destroy(output);
@@ -469,8 +761,24 @@ out_close:
 static void
 fbdev_frame_buffer_destroy(struct fbdev_output *output)
 {
+	int i;
+
 	weston_log("Destroying fbdev frame buffer.\n");
 
+	fbdev_output_stop_vsync(output);
+
+	for (i = 0; i < 2; i++) {
+		if (output->hw_surface[i] != NULL) {
+			pixman_image_unref(output->hw_surface[i]);
+			output->hw_surface[i] = NULL;
+		}
+	}
+
+	if (output->fb_fd >= 0) {
+		close(output->fb_fd);
+		output->fb_fd = -1;
+	}
+
 	if (munmap(output->fb, output->fb_info.buffer_length) < 0)
 		weston_log("Failed to munmap frame buffer: %s\n",
 		           strerror(errno));
@@ -502,6 +810,8 @@ fbdev_output_create(struct fbdev_backend *backend,
 
 	output->backend = backend;
 	output->device = device;
+	output->fb_fd = -1;
+	pixman_region32_init(&output->previous_damage);
 
 	/* Create the frame buffer. */
 	fb_fd = fbdev_frame_buffer_open(output, device, &output->fb_info);
@@ -509,14 +819,6 @@ fbdev_output_create(struct fbdev_backend *backend,
 		weston_log("Creating frame buffer failed.\n");
 		goto out_free;
 	}
-	if (backend->use_pixman) {
-		if (fbdev_frame_buffer_map(output, fb_fd) < 0) {
-			weston_log("Mapping frame buffer failed.\n");
-			goto out_free;
-		}
-	} else {
-		close(fb_fd);
-	}
 
 	output->base.start_repaint_loop = fbdev_output_start_repaint_loop;
 	output->base.repaint = fbdev_output_repaint;
@@ -552,6 +854,20 @@ fbdev_output_create(struct fbdev_backend *backend,
 	                   config_transform,
 			   1);
 
+	loop = wl_display_get_event_loop(backend->compositor->wl_display);
+	output->finish_frame_timer =
+		wl_event_loop_add_timer(loop, finish_frame_handler, output);
+
+	/* Mapped once the output exists, for the vsync thread */
+	if (backend->use_pixman) {
+		if (fbdev_frame_buffer_map(output, fb_fd) < 0) {
+			weston_log("Mapping frame buffer failed.\n");
+			goto out_output;
+		}
+	} else {
+		close(fb_fd);
+	}
+
 	width = output->mode.width;
 	height = output->mode.height;
 	bytes_per_pixel = output->fb_info.bits_per_pixel / 8;
@@ -581,11 +897,6 @@ fbdev_output_create(struct fbdev_backend *backend,
 		}
 	}
 
-
-	loop = wl_display_get_event_loop(backend->compositor->wl_display);
-	output->finish_frame_timer =
-		wl_event_loop_add_timer(loop, finish_frame_handler, output);
-
 	weston_compositor_add_output(backend->compositor, &output->base);
 
 	weston_log("fbdev output %d×%d px\n",
@@ -600,11 +911,13 @@ out_shadow_surface:
 	output->shadow_surface = NULL;
 out_hw_surface:
 	free(output->shadow_buf);
-	pixman_image_unref(output->hw_surface);
-	output->hw_surface = NULL;
+	if (output->fb != NULL)
+		fbdev_frame_buffer_destroy(output);
+out_output:
+	wl_event_source_remove(output->finish_frame_timer);
 	weston_output_destroy(&output->base);
-	fbdev_frame_buffer_destroy(output);
 out_free:
+	pixman_region32_fini(&output->previous_damage);
 	free(output);
 
 	return -1;
@@ -639,8 +952,10 @@ fbdev_output_destroy(struct weston_output *base)
 	}
 
 	/* Remove the output. */
+	wl_event_source_remove(output->finish_frame_timer);
 	weston_output_destroy(&output->base);
 
+	pixman_region32_fini(&output->previous_damage);
 	free(output);
 }
 
@@ -729,12 +1044,8 @@ fbdev_output_disable(struct weston_output *base)
 
 	if ( ! backend->use_pixman) return;
 
-	if (output->hw_surface != NULL) {
-		pixman_image_unref(output->hw_surface);
-		output->hw_surface = NULL;
-	}
-
-	fbdev_frame_buffer_destroy(output);
+	if (output->fb != NULL)
+		fbdev_frame_buffer_destroy(output);
 }
 
 static void
@@ -885,6 +1196,12 @@ fbdev_backend_create(struct weston_compositor *compositor, int *argc, char *argv
 
 	udev_input_init(&backend->input, compositor, backend->udev, seat_id);
 
+	if (compositor->renderer->import_dmabuf) {
+		if (linux_dmabuf_setup(compositor) < 0)
+			weston_log("Error: initializing dmabuf "
+				   "support failed.\n");
+	}
+
 	compositor->backend = &backend->base;
 	return backend;
 
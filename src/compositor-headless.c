@@ -28,12 +28,17 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <stdbool.h>
 
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
 #include "compositor.h"
+#include "frame-stats.h"
 #include "pixman-renderer.h"
+#include "linux-dmabuf.h"
 #include "presentation_timing-server-protocol.h"
 
 struct headless_backend {
@@ -41,20 +46,32 @@ struct headless_backend {
 	struct weston_compositor *compositor;
 	struct weston_seat fake_seat;
 	bool use_pixman;
+	int benchmark_frames;
 };
 
 struct headless_output {
 	struct weston_output base;
 	struct weston_mode mode;
 	struct wl_event_source *finish_frame_timer;
+	int frame_interval; /* msec */
 	uint32_t *image_buf;
 	pixman_image_t *image;
+
+	/* Collected with --benchmark */
+	struct {
+		uint32_t frames;
+		struct timespec first, last;
+		uint64_t render_nsec, render_max_nsec;
+		int reported;
+	} bench;
 };
 
 struct headless_parameters {
 	int width;
 	int height;
 	int use_pixman;
+	int refresh;
+	int benchmark_frames;
 	uint32_t transform;
 };
 
@@ -79,19 +96,85 @@ finish_frame_handler(void *data)
 	return 1;
 }
 
+static void
+headless_output_report(struct headless_output *output)
+{
+	struct timespec elapsed;
+	struct rusage usage;
+	double secs;
+
+	if (output->bench.frames == 0 || output->bench.reported)
+		return;
+	output->bench.reported = 1;
+
+	timespec_sub(&elapsed, &output->bench.last, &output->bench.first);
+	secs = timespec_to_nsec(&elapsed) / 1e9;
+	getrusage(RUSAGE_SELF, &usage);
+
+	/* The first frame only starts the clock */
+	weston_log("headless benchmark: output %s: %u frames in %.2f s, "
+		   "%.1f frames/s\n", output->base.name,
+		   output->bench.frames, secs,
+		   secs > 0 ? (output->bench.frames - 1) / secs : 0.0);
+	weston_log_continue(STAMP_SPACE "render %.3f ms average, "
+			    "%.3f ms worst; peak RSS %ld KiB\n",
+			    output->bench.render_nsec /
+			    (1e6 * output->bench.frames),
+			    output->bench.render_max_nsec / 1e6,
+			    usage.ru_maxrss);
+}
+
+static void
+headless_output_bench_frame(struct headless_output *output,
+			    const struct timespec *begin,
+			    const struct timespec *end)
+{
+	struct headless_backend *b =
+		(struct headless_backend *) output->base.compositor->backend;
+	struct timespec render;
+	uint64_t nsec;
+
+	timespec_sub(&render, end, begin);
+	nsec = timespec_to_nsec(&render);
+
+	if (output->bench.frames == 0)
+		output->bench.first = *begin;
+	output->bench.last = *end;
+	output->bench.frames++;
+	output->bench.render_nsec += nsec;
+	if (nsec > output->bench.render_max_nsec)
+		output->bench.render_max_nsec = nsec;
+
+	if (output->bench.frames == (uint32_t) b->benchmark_frames) {
+		headless_output_report(output);
+		wl_display_terminate(output->base.compositor->wl_display);
+	}
+}
+
 static int
 headless_output_repaint(struct weston_output *output_base,
 		       pixman_region32_t *damage)
 {
 	struct headless_output *output = (struct headless_output *) output_base;
 	struct weston_compositor *ec = output->base.compositor;
+	struct headless_backend *b = (struct headless_backend *) ec->backend;
+	struct timespec begin, end;
+
+	if (b->benchmark_frames)
+		clock_gettime(CLOCK_MONOTONIC, &begin);
 
 	ec->renderer->repaint_output(&output->base, damage);
 
+	if (b->benchmark_frames) {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		headless_output_bench_frame(output, &begin, &end);
+	}
+
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 16);
+	wl_event_source_timer_update(output->finish_frame_timer,
+				     output->frame_interval);
 
 	return 0;
 }
@@ -105,6 +188,9 @@ headless_output_destroy(struct weston_output *output_base)
 
 	wl_event_source_remove(output->finish_frame_timer);
 
+	if (b->benchmark_frames)
+		headless_output_report(output);
+
 	if (b->use_pixman) {
 		pixman_renderer_output_destroy(&output->base);
 		pixman_image_unref(output->image);
@@ -134,7 +220,17 @@ headless_backend_create_output(struct headless_backend *b,
 		WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
 	output->mode.width = param->width;
 	output->mode.height = param->height;
-	output->mode.refresh = 60000;
+
+	/* A refresh of 0 runs as fast as the millisecond timer allows */
+	if (param->refresh > 0 && param->refresh <= 1000000) {
+		output->mode.refresh = param->refresh;
+		output->frame_interval = 1000000 / param->refresh;
+		if (output->frame_interval < 1)
+			output->frame_interval = 1;
+	} else {
+		output->mode.refresh = 1000000;
+		output->frame_interval = 1;
+	}
 	wl_list_init(&output->base.mode_list);
 	wl_list_insert(&output->base.mode_list, &output->mode.link);
 
@@ -237,6 +333,7 @@ headless_backend_create(struct weston_compositor *compositor,
 	b->base.restore = headless_restore;
 
 	b->use_pixman = param->use_pixman;
+	b->benchmark_frames = param->benchmark_frames;
 	if (b->use_pixman) {
 		pixman_renderer_init(compositor);
 	}
@@ -246,7 +343,18 @@ headless_backend_create(struct weston_compositor *compositor,
 	if (!b->use_pixman && noop_renderer_init(compositor) < 0)
 		goto err_input;
 
+	if (compositor->renderer->import_dmabuf) {
+		if (linux_dmabuf_setup(compositor) < 0)
+			weston_log("Error: initializing dmabuf "
+				   "support failed.\n");
+	}
+
 	compositor->backend = &b->base;
+
+	/* Also follow each client commit to its presentation */
+	if (b->benchmark_frames)
+		weston_frame_stats_start(compositor);
+
 	return b;
 
 err_input:
@@ -262,7 +370,7 @@ backend_init(struct weston_compositor *compositor,
 	     int *argc, char *argv[],
 	     struct weston_config *config)
 {
-	int width = 1024, height = 640;
+	int width = 1024, height = 640, refresh = 60000;
 	char *display_name = NULL;
 	struct headless_parameters param = { 0, };
 	const char *transform = "normal";
@@ -273,6 +381,9 @@ backend_init(struct weston_compositor *compositor,
 		{ WESTON_OPTION_INTEGER, "height", 0, &height },
 		{ WESTON_OPTION_BOOLEAN, "use-pixman", 0, &param.use_pixman },
 		{ WESTON_OPTION_STRING, "transform", 0, &transform },
+		{ WESTON_OPTION_INTEGER, "refresh", 0, &refresh },
+		{ WESTON_OPTION_INTEGER, "benchmark", 0,
+		  &param.benchmark_frames },
 	};
 
 	parse_options(headless_options,
@@ -280,6 +391,7 @@ backend_init(struct weston_compositor *compositor,
 
 	param.width = width;
 	param.height = height;
+	param.refresh = refresh;
 
 	if (weston_parse_transform(transform, &param.transform) < 0)
 		weston_log("Invalid transform \"%s\"\n", transform);
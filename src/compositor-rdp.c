@@ -28,6 +28,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <linux/input.h>
 
 #if HAVE_FREERDP_VERSION_H
@@ -44,6 +47,7 @@
 
 #if FREERDP_VERSION_NUMBER >= 0x10201
 #define HAVE_SKIP_COMPRESSION
+#define HAVE_FRAME_ACKNOWLEDGE
 #endif
 
 #if FREERDP_VERSION_NUMBER < 0x10202
@@ -65,13 +69,32 @@
 #include <freerdp/locale/keyboard.h>
 #include <winpr/input.h>
 
+#ifdef HAVE_FREERDP_GFX
+#include <freerdp/channels/wtsvc.h>
+#include <freerdp/server/rdpgfx.h>
+#include <freerdp/codec/h264.h>
+#include <freerdp/codec/planar.h>
+#include <winpr/synch.h>
+#endif
+
 #include "shared/helpers.h"
 #include "compositor.h"
 #include "pixman-renderer.h"
+#include "linux-dmabuf.h"
 
 #define MAX_FREERDP_FDS 32
 #define DEFAULT_AXIS_STEP_DISTANCE wl_fixed_from_int(10)
 #define RDP_MODE_FREQ 60 * 1000
+#define RDP_MAX_MONITORS 16
+#define RDP_TILE_SIZE 64
+
+#define RDP_FLOW_HISTORY 16
+#define RDP_FLOW_MAX_IN_FLIGHT 4
+#define RDP_FLOW_MIN_RTT_WINDOW 10000
+
+#define RDP_GFX_SUSPEND_FRAME_ACKS 0xffffffff
+#define RDP_GFX_AVC420_BITRATE (10 * 1000 * 1000)
+#define RDP_GFX_AVC420_MIN_BITRATE (500 * 1000)
 
 struct rdp_backend_config {
 	int width;
@@ -93,7 +116,10 @@ struct rdp_backend {
 
 	freerdp_listener *listener;
 	struct wl_event_source *listener_events[MAX_FREERDP_FDS];
-	struct rdp_output *output;
+	struct wl_list outputs; /* rdp_output::link, in monitor order */
+	struct wl_list peers;   /* rdp_peers_item::link */
+	int next_output_id;
+	int applying_layout;
 
 	char *server_cert;
 	char *server_key;
@@ -115,12 +141,124 @@ struct rdp_peers_item {
 	struct wl_list link;
 };
 
+/* One output per monitor of the client, at the monitor's position in
+ * the client desktop. Each repaints and encodes on its own. */
 struct rdp_output {
 	struct weston_output base;
+	struct rdp_backend *backend;
+	struct wl_list link; /* rdp_backend::outputs */
+	int id;
 	struct wl_event_source *finish_frame_timer;
 	pixman_image_t *shadow_surface;
 
-	struct wl_list peers;
+	struct wl_list encoders;
+};
+
+enum rdp_codec {
+	RDP_CODEC_NSC,
+	RDP_CODEC_RFX,
+#ifdef HAVE_FREERDP_GFX
+	RDP_CODEC_GFX_PLANAR,
+	RDP_CODEC_GFX_AVC420,
+#endif
+};
+
+/* Shared RemoteFX/NSCodec encoder thread
+ *
+ * Each output has its own encoders. Peers negotiating the same codec
+ * and output size are sent the very same bitstream, so they share one
+ * encoder: each frame is encoded once and the result sent to all of
+ * them ('peers', the rdp_peer_output views of the output).
+ *
+ * Peers using the graphics pipeline (RDPGFX) get an encoder of their
+ * own instead, whose H.264 bitrate follows the peer's throughput. An
+ * AVC420 encoder always encodes whole frames, so its 'pending' image is
+ * kept complete rather than only holding the damaged pixels.
+ *
+ * Frames are not handed to the thread while a peer acknowledging frames
+ * has as many in flight as its link can carry, see rdp_peer_flow.
+ *
+ * The compositor copies damaged pixels into 'pending' and accumulates
+ * the damage. When the thread is idle, 'pending' and 'frame' are
+ * swapped and the thread encodes 'frame' into encode_stream. The
+ * encoded frame is sent from the compositor thread, so FreeRDP is only
+ * ever called from there. Peers that cannot keep up thus have their
+ * damage coalesced into the next frame, and never delay the repaint.
+ *
+ * If the thread cannot be started, frames are encoded synchronously.
+ */
+struct rdp_encoder {
+	struct wl_list link; /* rdp_output::encoders */
+	struct wl_list peers; /* rdp_peer_output::encoder_link */
+	enum rdp_codec codec;
+	UINT32 width, height;
+	int x, y; /* of the output, surface bits are in desktop coordinates */
+
+	RFX_CONTEXT *rfx_context;
+	NSC_CONTEXT *nsc_context;
+	wStream *encode_stream;
+	RFX_RECT *rfx_rects;
+
+	/* Hash of each tile as last queued, 0 if unknown */
+	uint64_t *tile_hashes;
+	int tiles_x, tiles_y;
+
+#ifdef HAVE_FREERDP_GFX
+	H264_CONTEXT *h264;
+	UINT32 bitrate; /* applied when handing a frame to the thread */
+	BITMAP_PLANAR_CONTEXT *planar;
+	RDPGFX_AVC420_BITMAP_STREAM avc420;
+	RECTANGLE_16 *region_rects;
+	RDPGFX_H264_QUANT_QUALITY *quant_vals;
+	struct wl_array gfx_cmds; /* RDPGFX_SURFACE_COMMAND */
+#endif
+
+	int threaded;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t idle_cond;
+	int quit;
+	int busy;  /* frame, encode_stream and codecs belong to the thread */
+	int ready; /* cmd refers to an encoded frame not sent yet */
+
+	pixman_image_t *pending;
+	pixman_region32_t pending_damage;
+	pixman_image_t *frame;
+	pixman_region32_t frame_damage;
+	SURFACE_BITS_COMMAND cmd;
+
+	int pipe[2];
+	struct wl_event_source *source;
+};
+
+struct rdp_flow_frame {
+	uint32_t sent; /* ms */
+	size_t bytes;
+};
+
+/* Frame acknowledgement state of a peer
+ *
+ * Frames are numbered from 'next_id', those from 'acked' on are not
+ * acknowledged yet. The delivery rate and the shortest round trip give
+ * how many frames the link holds; allowing one more than that keeps it
+ * busy without queueing frames, and latency, in the transport.
+ */
+struct rdp_peer_flow {
+	int enabled;
+	UINT32 next_id;
+	UINT32 acked;
+	UINT32 limit;         /* what the client accepts */
+	UINT32 max_in_flight; /* what its link holds */
+	int saturated;        /* frames were held back since the last ack */
+	struct rdp_flow_frame frames[RDP_FLOW_HISTORY];
+
+	uint32_t last_ack;    /* ms */
+	uint32_t min_rtt;     /* ms, over RDP_FLOW_MIN_RTT_WINDOW */
+	uint32_t min_rtt_stamp;
+	uint32_t srtt;        /* ms */
+	uint64_t rate;        /* bytes per second */
+	size_t frame_bytes;   /* average frame size */
 };
 
 struct rdp_peer_context {
@@ -128,15 +266,44 @@ struct rdp_peer_context {
 
 	struct rdp_backend *rdpBackend;
 	struct wl_event_source *events[MAX_FREERDP_FDS];
-	RFX_CONTEXT *rfx_context;
-	wStream *encode_stream;
-	RFX_RECT *rfx_rects;
-	NSC_CONTEXT *nsc_context;
+	struct wl_list outputs; /* rdp_peer_output::link */
+	struct rdp_peer_flow flow;
+
+#ifdef HAVE_FREERDP_GFX
+	HANDLE vcm;
+	struct wl_event_source *vcm_event;
+	RdpgfxServerContext *gfx;
+	int gfx_opened;
+	int gfx_ready; /* the surface is created and mapped */
+
+	/* Written by the callbacks of the channel thread, which wakes the
+	 * compositor up through gfx_pipe */
+	pthread_mutex_t gfx_mutex;
+	int gfx_pipe[2];
+	struct wl_event_source *gfx_event;
+	int gfx_caps_confirmed;
+	int gfx_avc420;
+	int gfx_acks_suspended;
+	int gfx_ack_pending;
+	UINT32 gfx_last_ack;
+#endif
 
 	struct rdp_peers_item item;
 };
 typedef struct rdp_peer_context RdpPeerContext;
 
+/* What a peer sees of an output */
+struct rdp_peer_output {
+	RdpPeerContext *peerCtx;
+	struct rdp_output *output;
+	struct wl_list link; /* rdp_peer_context::outputs */
+	struct rdp_encoder *encoder;
+	struct wl_list encoder_link; /* rdp_encoder::peers */
+#ifdef HAVE_FREERDP_GFX
+	int gfx_mapped;
+#endif
+};
+
 static void
 rdp_backend_config_init(struct rdp_backend_config *config)
 {
@@ -151,16 +318,93 @@ rdp_backend_config_init(struct rdp_backend_config *config)
 	config->no_clients_resize = 0;
 }
 
+/* A limit of 0 means the peer doesn't acknowledge frames */
+static void
+rdp_peer_flow_init(struct rdp_peer_flow *flow, UINT32 limit)
+{
+	memset(flow, 0, sizeof *flow);
+	flow->enabled = limit > 0;
+	flow->limit = MIN(limit, RDP_FLOW_HISTORY);
+	flow->max_in_flight = MIN(flow->limit, 2);
+	if (flow->max_in_flight == 0)
+		flow->max_in_flight = 1;
+}
+
+static int
+rdp_peer_flow_blocked(struct rdp_peer_flow *flow)
+{
+	return flow->enabled &&
+	       flow->next_id - flow->acked >= flow->max_in_flight;
+}
+
+/* Returns the ID of the frame to send */
+static UINT32
+rdp_peer_flow_sent(struct rdp_peer_flow *flow, size_t bytes)
+{
+	struct rdp_flow_frame *frame;
+	UINT32 id = flow->next_id++;
+
+	/* frames sent regardless of the limit push out the oldest ones */
+	if (flow->next_id - flow->acked > RDP_FLOW_HISTORY)
+		flow->acked = flow->next_id - RDP_FLOW_HISTORY;
+
+	frame = &flow->frames[id % RDP_FLOW_HISTORY];
+	frame->sent = weston_compositor_get_time();
+	frame->bytes = bytes;
+
+	return id;
+}
+
+/* Acknowledgements are cumulative */
+static void
+rdp_peer_flow_ack(struct rdp_peer_flow *flow, UINT32 id)
+{
+	uint32_t now = weston_compositor_get_time();
+	struct rdp_flow_frame *frame;
+	uint32_t rtt, elapsed;
+	uint64_t bytes = 0, rate, bdp;
+
+	if (id - flow->acked >= flow->next_id - flow->acked)
+		return;
+
+	for (; flow->acked != id + 1; flow->acked++) {
+		frame = &flow->frames[flow->acked % RDP_FLOW_HISTORY];
+		bytes += frame->bytes;
+		flow->frame_bytes = (flow->frame_bytes * 7 + frame->bytes) / 8;
+
+		rtt = now - frame->sent;
+		flow->srtt = flow->srtt ? (flow->srtt * 7 + rtt) / 8 : rtt;
+		if (!flow->min_rtt || rtt <= flow->min_rtt ||
+		    now - flow->min_rtt_stamp > RDP_FLOW_MIN_RTT_WINDOW) {
+			flow->min_rtt = rtt ? rtt : 1;
+			flow->min_rtt_stamp = now;
+		}
+	}
+
+	elapsed = now - flow->last_ack;
+	if (flow->last_ack && elapsed > 0) {
+		rate = bytes * 1000 / elapsed;
+		flow->rate = flow->rate ? (flow->rate * 7 + rate) / 8 : rate;
+	}
+	flow->last_ack = now;
+
+	if (!flow->rate || !flow->frame_bytes)
+		return;
+
+	bdp = flow->rate * flow->min_rtt / 1000;
+	flow->max_in_flight = MIN(bdp / flow->frame_bytes + 1, flow->limit);
+	if (flow->max_in_flight == 0)
+		flow->max_in_flight = 1;
+}
+
 static void
-rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_encoder_encode_rfx(struct rdp_encoder *context, pixman_region32_t *damage,
+		       pixman_image_t *image, SURFACE_BITS_COMMAND *cmd)
 {
 	int width, height, nrects, i;
 	pixman_box32_t *region, *rects;
 	uint32_t *ptr;
 	RFX_RECT *rfxRect;
-	rdpUpdate *update = peer->update;
-	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 
 	Stream_Clear(context->encode_stream);
 	Stream_SetPosition(context->encode_stream, 0);
@@ -173,12 +417,11 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 #else
 	memset(cmd, 0, sizeof(*cmd));
 #endif
-	cmd->destLeft = damage->extents.x1;
-	cmd->destTop = damage->extents.y1;
-	cmd->destRight = damage->extents.x2;
-	cmd->destBottom = damage->extents.y2;
+	cmd->destLeft = context->x + damage->extents.x1;
+	cmd->destTop = context->y + damage->extents.y1;
+	cmd->destRight = context->x + damage->extents.x2;
+	cmd->destBottom = context->y + damage->extents.y2;
 	cmd->bpp = 32;
-	cmd->codecID = peer->settings->RemoteFxCodecId;
 	cmd->width = width;
 	cmd->height = height;
 
@@ -205,19 +448,15 @@ rdp_peer_refresh_rfx(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 
 	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
 	cmd->bitmapData = Stream_Buffer(context->encode_stream);
-
-	update->SurfaceBits(update->context, cmd);
 }
 
 
 static void
-rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_peer *peer)
+rdp_encoder_encode_nsc(struct rdp_encoder *context, pixman_region32_t *damage,
+		       pixman_image_t *image, SURFACE_BITS_COMMAND *cmd)
 {
 	int width, height;
 	uint32_t *ptr;
-	rdpUpdate *update = peer->update;
-	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
 
 	Stream_Clear(context->encode_stream);
 	Stream_SetPosition(context->encode_stream, 0);
@@ -225,29 +464,1068 @@ rdp_peer_refresh_nsc(pixman_region32_t *damage, pixman_image_t *image, freerdp_p
 	width = (damage->extents.x2 - damage->extents.x1);
 	height = (damage->extents.y2 - damage->extents.y1);
 
-#ifdef HAVE_SKIP_COMPRESSION
-	cmd->skipCompression = TRUE;
-#else
-	memset(cmd, 0, sizeof(*cmd));
+#ifdef HAVE_SKIP_COMPRESSION
+	cmd->skipCompression = TRUE;
+#else
+	memset(cmd, 0, sizeof(*cmd));
+#endif
+	cmd->destLeft = context->x + damage->extents.x1;
+	cmd->destTop = context->y + damage->extents.y1;
+	cmd->destRight = context->x + damage->extents.x2;
+	cmd->destBottom = context->y + damage->extents.y2;
+	cmd->bpp = 32;
+	cmd->width = width;
+	cmd->height = height;
+
+	ptr = pixman_image_get_data(image) + damage->extents.x1 +
+				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
+
+	nsc_compose_message(context->nsc_context, context->encode_stream, (BYTE *)ptr,
+			cmd->width,	cmd->height,
+			pixman_image_get_stride(image));
+	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
+	cmd->bitmapData = Stream_Buffer(context->encode_stream);
+}
+
+static int
+rdp_codec_is_shared(enum rdp_codec codec)
+{
+	return codec == RDP_CODEC_RFX || codec == RDP_CODEC_NSC;
+}
+
+#ifdef HAVE_FREERDP_GFX
+static int
+rdp_encoder_is_gfx(struct rdp_encoder *encoder)
+{
+	return !rdp_codec_is_shared(encoder->codec);
+}
+
+static RDPGFX_SURFACE_COMMAND *
+rdp_encoder_add_gfx_cmd(struct rdp_encoder *encoder, UINT32 codec_id,
+			pixman_box32_t *box)
+{
+	RDPGFX_SURFACE_COMMAND *cmd;
+
+	cmd = wl_array_add(&encoder->gfx_cmds, sizeof *cmd);
+	if (!cmd)
+		return NULL;
+
+	memset(cmd, 0, sizeof *cmd);
+	cmd->codecId = codec_id;
+	cmd->format = PIXEL_FORMAT_BGRX32;
+	cmd->left = box->x1;
+	cmd->top = box->y1;
+	cmd->right = box->x2;
+	cmd->bottom = box->y2;
+	cmd->width = box->x2 - box->x1;
+	cmd->height = box->y2 - box->y1;
+
+	return cmd;
+}
+
+/* Planar bitmaps are allocated by the codec, the H.264 bitstream is
+ * owned by the H.264 context */
+static void
+rdp_encoder_clear_gfx_cmds(struct rdp_encoder *encoder)
+{
+	RDPGFX_SURFACE_COMMAND *cmd;
+
+	if (encoder->codec == RDP_CODEC_GFX_PLANAR) {
+		wl_array_for_each(cmd, &encoder->gfx_cmds)
+			free(cmd->data);
+	}
+	encoder->gfx_cmds.size = 0;
+}
+
+static void
+rdp_encoder_encode_planar(struct rdp_encoder *encoder,
+			  pixman_region32_t *damage, pixman_image_t *image)
+{
+	int stride = pixman_image_get_stride(image);
+	pixman_box32_t *rects;
+	RDPGFX_SURFACE_COMMAND *cmd;
+	uint32_t *ptr;
+	UINT32 length;
+	BYTE *data;
+	int nrects, i;
+
+	rects = pixman_region32_rectangles(damage, &nrects);
+	for (i = 0; i < nrects; i++) {
+		ptr = pixman_image_get_data(image) + rects[i].x1 +
+			rects[i].y1 * (stride / sizeof(uint32_t));
+
+		length = 0;
+		data = freerdp_bitmap_compress_planar(encoder->planar,
+						      (BYTE *)ptr,
+						      PIXEL_FORMAT_BGRX32,
+						      rects[i].x2 - rects[i].x1,
+						      rects[i].y2 - rects[i].y1,
+						      stride, NULL, &length);
+		if (!data)
+			continue;
+
+		cmd = rdp_encoder_add_gfx_cmd(encoder, RDPGFX_CODECID_PLANAR,
+					      &rects[i]);
+		if (!cmd) {
+			free(data);
+			return;
+		}
+		cmd->data = data;
+		cmd->length = length;
+	}
+}
+
+/* The whole frame is encoded, the damage only goes into the metablock
+ * so the client knows which regions to update */
+static void
+rdp_encoder_encode_avc420(struct rdp_encoder *encoder,
+			  pixman_region32_t *damage, pixman_image_t *image)
+{
+	RDPGFX_H264_METABLOCK *meta = &encoder->avc420.meta;
+	RDPGFX_SURFACE_COMMAND *cmd;
+	pixman_box32_t *rects, box;
+	UINT32 length;
+	BYTE *data;
+	int nrects, i;
+
+	if (avc420_compress(encoder->h264,
+			    (BYTE *)pixman_image_get_data(image),
+			    PIXEL_FORMAT_BGRX32,
+			    pixman_image_get_stride(image),
+			    encoder->width, encoder->height,
+			    &data, &length) < 0)
+		return;
+
+	rects = pixman_region32_rectangles(damage, &nrects);
+	encoder->region_rects = realloc(encoder->region_rects,
+					nrects * sizeof *encoder->region_rects);
+	encoder->quant_vals = realloc(encoder->quant_vals,
+				      nrects * sizeof *encoder->quant_vals);
+	if (!encoder->region_rects || !encoder->quant_vals)
+		return;
+
+	for (i = 0; i < nrects; i++) {
+		encoder->region_rects[i].left = rects[i].x1;
+		encoder->region_rects[i].top = rects[i].y1;
+		encoder->region_rects[i].right = rects[i].x2;
+		encoder->region_rects[i].bottom = rects[i].y2;
+
+		encoder->quant_vals[i].qp = encoder->h264->QP;
+		encoder->quant_vals[i].r = 0;
+		encoder->quant_vals[i].p = 0;
+		encoder->quant_vals[i].qpVal = encoder->h264->QP;
+		encoder->quant_vals[i].qualityVal = 100 - encoder->h264->QP;
+	}
+
+	meta->numRegionRects = nrects;
+	meta->regionRects = encoder->region_rects;
+	meta->quantQualityVals = encoder->quant_vals;
+	encoder->avc420.data = data;
+	encoder->avc420.length = length;
+
+	box.x1 = 0;
+	box.y1 = 0;
+	box.x2 = encoder->width;
+	box.y2 = encoder->height;
+	cmd = rdp_encoder_add_gfx_cmd(encoder, RDPGFX_CODECID_AVC420, &box);
+	if (!cmd)
+		return;
+	cmd->data = data;
+	cmd->length = length;
+	cmd->extra = &encoder->avc420;
+}
+
+/* A GFX encoder has a single peer, see rdp_peer_output_attach(). Each
+ * output has a surface of its own, identified by the output ID. */
+static void
+rdp_encoder_send_gfx(struct rdp_encoder *encoder)
+{
+	struct rdp_peer_output *view;
+	RdpPeerContext *peerCtx;
+	RdpgfxServerContext *gfx;
+	RDPGFX_START_FRAME_PDU start;
+	RDPGFX_END_FRAME_PDU end;
+	RDPGFX_SURFACE_COMMAND *cmd;
+	size_t bytes;
+
+	if (encoder->gfx_cmds.size == 0)
+		return;
+
+	wl_list_for_each(view, &encoder->peers, encoder_link) {
+		peerCtx = view->peerCtx;
+		if (!(peerCtx->item.flags & RDP_PEER_ACTIVATED) ||
+		    !(peerCtx->item.flags & RDP_PEER_OUTPUT_ENABLED) ||
+		    !peerCtx->gfx_ready)
+			continue;
+
+		bytes = 0;
+		wl_array_for_each(cmd, &encoder->gfx_cmds)
+			bytes += cmd->length;
+
+		gfx = peerCtx->gfx;
+		memset(&start, 0, sizeof start);
+		memset(&end, 0, sizeof end);
+		start.frameId = end.frameId =
+			rdp_peer_flow_sent(&peerCtx->flow, bytes);
+
+		gfx->StartFrame(gfx, &start);
+		wl_array_for_each(cmd, &encoder->gfx_cmds) {
+			cmd->surfaceId = view->output->id;
+			gfx->SurfaceCommand(gfx, cmd);
+		}
+		gfx->EndFrame(gfx, &end);
+	}
+}
+#endif
+
+/* The codec ID is negotiated per peer, and filled in when sending */
+static void
+rdp_encoder_encode(struct rdp_encoder *encoder, pixman_region32_t *damage,
+		   pixman_image_t *image, SURFACE_BITS_COMMAND *cmd)
+{
+	switch (encoder->codec) {
+	case RDP_CODEC_RFX:
+		rdp_encoder_encode_rfx(encoder, damage, image, cmd);
+		break;
+	case RDP_CODEC_NSC:
+		rdp_encoder_encode_nsc(encoder, damage, image, cmd);
+		break;
+#ifdef HAVE_FREERDP_GFX
+	case RDP_CODEC_GFX_PLANAR:
+		rdp_encoder_clear_gfx_cmds(encoder);
+		rdp_encoder_encode_planar(encoder, damage, image);
+		break;
+	case RDP_CODEC_GFX_AVC420:
+		rdp_encoder_clear_gfx_cmds(encoder);
+		rdp_encoder_encode_avc420(encoder, damage, image);
+		break;
+#endif
+	}
+}
+
+/* Send an encoded frame to every peer of the encoder */
+static void
+rdp_encoder_send(struct rdp_encoder *encoder, SURFACE_BITS_COMMAND *cmd)
+{
+	struct rdp_peer_output *view;
+	RdpPeerContext *peerCtx;
+	SURFACE_FRAME_MARKER *marker;
+	freerdp_peer *peer;
+
+#ifdef HAVE_FREERDP_GFX
+	if (rdp_encoder_is_gfx(encoder)) {
+		rdp_encoder_send_gfx(encoder);
+		return;
+	}
+#endif
+
+	wl_list_for_each(view, &encoder->peers, encoder_link) {
+		peerCtx = view->peerCtx;
+		if (!(peerCtx->item.flags & RDP_PEER_ACTIVATED) ||
+		    !(peerCtx->item.flags & RDP_PEER_OUTPUT_ENABLED))
+			continue;
+
+		peer = peerCtx->item.peer;
+		marker = &peer->update->surface_frame_marker;
+		marker->frameId = rdp_peer_flow_sent(&peerCtx->flow,
+						     cmd->bitmapDataLength);
+		marker->frameAction = SURFACECMD_FRAMEACTION_BEGIN;
+		peer->update->SurfaceFrameMarker(peer->context, marker);
+
+		cmd->codecID = encoder->codec == RDP_CODEC_RFX ?
+			       peer->settings->RemoteFxCodecId :
+			       peer->settings->NSCodecId;
+		peer->update->SurfaceBits(peer->context, cmd);
+
+		marker->frameAction = SURFACECMD_FRAMEACTION_END;
+		peer->update->SurfaceFrameMarker(peer->context, marker);
+	}
+}
+
+/* Don't run ahead of a slow peer: a shared encoder goes at the pace of
+ * its slowest peer, the others get their damage coalesced as well */
+static int
+rdp_encoder_throttled(struct rdp_encoder *encoder)
+{
+	struct rdp_peer_output *view;
+	int throttled = 0;
+
+	wl_list_for_each(view, &encoder->peers, encoder_link) {
+		if (rdp_peer_flow_blocked(&view->peerCtx->flow)) {
+			view->peerCtx->flow.saturated = 1;
+			throttled = 1;
+		}
+	}
+
+	return throttled;
+}
+
+/* Back off to the measured rate when the link is full, probe upwards
+ * otherwise */
+static void
+rdp_encoder_adapt(struct rdp_encoder *encoder)
+{
+#ifdef HAVE_FREERDP_GFX
+	struct rdp_peer_output *view;
+	RdpPeerContext *peerCtx;
+	uint64_t bitrate;
+
+	if (encoder->codec != RDP_CODEC_GFX_AVC420)
+		return;
+
+	wl_list_for_each(view, &encoder->peers, encoder_link) {
+		peerCtx = view->peerCtx;
+		if (!peerCtx->flow.saturated || !peerCtx->flow.rate)
+			bitrate = (uint64_t)encoder->bitrate * 11 / 10;
+		else
+			bitrate = peerCtx->flow.rate * 8 * 9 / 10;
+
+		encoder->bitrate = MAX(MIN(bitrate, RDP_GFX_AVC420_BITRATE),
+				       RDP_GFX_AVC420_MIN_BITRATE);
+	}
+#endif
+}
+
+static void *
+rdp_encoder_thread(void *data)
+{
+	struct rdp_encoder *encoder = data;
+	char c = 0;
+
+	pthread_mutex_lock(&encoder->mutex);
+	while (1) {
+		while (!encoder->quit && !encoder->busy)
+			pthread_cond_wait(&encoder->work_cond, &encoder->mutex);
+		if (encoder->quit)
+			break;
+		pthread_mutex_unlock(&encoder->mutex);
+
+		rdp_encoder_encode(encoder, &encoder->frame_damage,
+				   encoder->frame, &encoder->cmd);
+
+		pthread_mutex_lock(&encoder->mutex);
+		encoder->busy = 0;
+		encoder->ready = 1;
+		pthread_cond_broadcast(&encoder->idle_cond);
+
+		/* Wake up the compositor to send the frame. A full pipe
+		 * means it is woken up already, and weston_log() may not
+		 * be used from this thread. */
+		if (write(encoder->pipe[1], &c, 1) < 0)
+			continue;
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+
+	return NULL;
+}
+
+/* Hand the pending damage to the thread, unless it still has a frame */
+static void
+rdp_encoder_kick(struct rdp_encoder *encoder)
+{
+	pixman_image_t *image;
+
+	if (rdp_encoder_throttled(encoder))
+		return;
+
+	pthread_mutex_lock(&encoder->mutex);
+	if (!encoder->busy && !encoder->ready &&
+	    pixman_region32_not_empty(&encoder->pending_damage)) {
+		image = encoder->frame;
+		encoder->frame = encoder->pending;
+		encoder->pending = image;
+
+		pixman_region32_copy(&encoder->frame_damage,
+				     &encoder->pending_damage);
+		pixman_region32_clear(&encoder->pending_damage);
+
+#ifdef HAVE_FREERDP_GFX
+		if (encoder->h264)
+			encoder->h264->BitRate = encoder->bitrate;
+
+		/* Bring the older image up to date, the thread only reads
+		 * 'frame' */
+		if (encoder->codec == RDP_CODEC_GFX_AVC420 && encoder->pending) {
+			pixman_image_set_clip_region32(encoder->pending,
+						       &encoder->frame_damage);
+			pixman_image_composite32(PIXMAN_OP_SRC, encoder->frame,
+						 NULL, encoder->pending,
+						 0, 0, 0, 0, 0, 0,
+						 encoder->width,
+						 encoder->height);
+			pixman_image_set_clip_region32(encoder->pending, NULL);
+		}
+#endif
+
+		encoder->busy = 1;
+		pthread_cond_signal(&encoder->work_cond);
+	}
+	pthread_mutex_unlock(&encoder->mutex);
+}
+
+static int
+rdp_encoder_handle_ready(int fd, uint32_t mask, void *data)
+{
+	struct rdp_encoder *encoder = data;
+	char buf[16];
+	int ready;
+
+	while (read(fd, buf, sizeof buf) > 0)
+		;
+
+	pthread_mutex_lock(&encoder->mutex);
+	ready = encoder->ready;
+	pthread_mutex_unlock(&encoder->mutex);
+
+	if (ready) {
+		rdp_encoder_send(encoder, &encoder->cmd);
+
+		pthread_mutex_lock(&encoder->mutex);
+		encoder->ready = 0;
+		pthread_mutex_unlock(&encoder->mutex);
+	}
+
+	rdp_encoder_kick(encoder);
+
+	return 1;
+}
+
+/* FNV-1a over four interleaved lanes, so consecutive pixels don't
+ * depend on each other and the loop can be vectorised */
+static uint64_t
+rdp_tile_hash(pixman_image_t *image, const pixman_box32_t *tile)
+{
+	const uint64_t prime = 0x100000001b3ull;
+	int stride = pixman_image_get_stride(image) / sizeof(uint32_t);
+	const uint32_t *row = pixman_image_get_data(image) +
+			      tile->y1 * stride + tile->x1;
+	int width = tile->x2 - tile->x1;
+	uint64_t h0 = 0xcbf29ce484222325ull, h1 = h0 ^ 1, h2 = h0 ^ 2,
+		 h3 = h0 ^ 3;
+	int x, y;
+
+	for (y = tile->y1; y < tile->y2; y++, row += stride) {
+		for (x = 0; x + 4 <= width; x += 4) {
+			h0 = (h0 ^ row[x]) * prime;
+			h1 = (h1 ^ row[x + 1]) * prime;
+			h2 = (h2 ^ row[x + 2]) * prime;
+			h3 = (h3 ^ row[x + 3]) * prime;
+		}
+		for (; x < width; x++)
+			h0 = (h0 ^ row[x]) * prime;
+	}
+
+	h0 = (h0 ^ (h1 >> 17) ^ (h1 << 47)) * prime;
+	h0 = (h0 ^ (h2 >> 31) ^ (h2 << 33)) * prime;
+	h0 = (h0 ^ (h3 >> 43) ^ (h3 << 21)) * prime;
+
+	/* 0 marks tiles of unknown content */
+	return h0 | 1;
+}
+
+/* Forget the tile contents, so that the next frame is sent in full */
+static void
+rdp_encoder_invalidate_tiles(struct rdp_encoder *encoder)
+{
+	memset(encoder->tile_hashes, 0,
+	       encoder->tiles_x * encoder->tiles_y *
+	       sizeof *encoder->tile_hashes);
+}
+
+/** Drop the damage of tiles whose pixels did not change
+ *
+ * \param encoder The encoder, holding the hash of each tile as last
+ * queued.
+ * \param damage The damage to filter, in output coordinates.
+ * \param image The output's shadow surface.
+ *
+ * Clients often report more damage than what they actually change, a
+ * blinking cursor damaging a whole window for instance. The damage of
+ * a tile is trusted to cover all of its changes.
+ */
+static void
+rdp_encoder_filter_damage(struct rdp_encoder *encoder,
+			  pixman_region32_t *damage, pixman_image_t *image)
+{
+	int width = MIN(pixman_image_get_width(image), (int)encoder->width);
+	int height = MIN(pixman_image_get_height(image), (int)encoder->height);
+	pixman_box32_t *extents = pixman_region32_extents(damage);
+	pixman_region32_t unchanged;
+	pixman_box32_t tile;
+	uint64_t hash, *cached;
+	int tx, ty;
+
+	pixman_region32_init(&unchanged);
+
+	for (ty = extents->y1 / RDP_TILE_SIZE;
+	     ty < encoder->tiles_y && ty * RDP_TILE_SIZE < extents->y2; ty++) {
+		for (tx = extents->x1 / RDP_TILE_SIZE;
+		     tx < encoder->tiles_x && tx * RDP_TILE_SIZE < extents->x2;
+		     tx++) {
+			tile.x1 = tx * RDP_TILE_SIZE;
+			tile.y1 = ty * RDP_TILE_SIZE;
+			tile.x2 = MIN(tile.x1 + RDP_TILE_SIZE, width);
+			tile.y2 = MIN(tile.y1 + RDP_TILE_SIZE, height);
+			if (tile.x1 >= tile.x2 || tile.y1 >= tile.y2)
+				continue;
+
+			if (pixman_region32_contains_rectangle(damage, &tile) ==
+			    PIXMAN_REGION_OUT)
+				continue;
+
+			hash = rdp_tile_hash(image, &tile);
+			cached = &encoder->tile_hashes[ty * encoder->tiles_x + tx];
+			if (*cached == hash)
+				pixman_region32_union_rect(&unchanged, &unchanged,
+							   tile.x1, tile.y1,
+							   tile.x2 - tile.x1,
+							   tile.y2 - tile.y1);
+			else
+				*cached = hash;
+		}
+	}
+
+	pixman_region32_subtract(damage, damage, &unchanged);
+	pixman_region32_fini(&unchanged);
+}
+
+static void
+rdp_encoder_queue_changed(struct rdp_encoder *encoder,
+			  pixman_region32_t *damage, pixman_image_t *image)
+{
+	int width = pixman_image_get_width(image);
+	int height = pixman_image_get_height(image);
+
+	if (!encoder->threaded) {
+#ifdef HAVE_FREERDP_GFX
+		if (encoder->h264)
+			encoder->h264->BitRate = encoder->bitrate;
+#endif
+		rdp_encoder_encode(encoder, damage, image, &encoder->cmd);
+		rdp_encoder_send(encoder, &encoder->cmd);
+		return;
+	}
+
+	/* The output size changed, older pixels are of no use */
+	if (!encoder->pending ||
+	    pixman_image_get_width(encoder->pending) != width ||
+	    pixman_image_get_height(encoder->pending) != height) {
+		if (encoder->pending)
+			pixman_image_unref(encoder->pending);
+		encoder->pending = pixman_image_create_bits(PIXMAN_x8r8g8b8,
+							    width, height,
+							    NULL, width * 4);
+		if (!encoder->pending) {
+			weston_log("rdp: failed to allocate encoder buffer\n");
+			return;
+		}
+		pixman_region32_clear(&encoder->pending_damage);
+
+#ifdef HAVE_FREERDP_GFX
+		if (encoder->codec == RDP_CODEC_GFX_AVC420)
+			pixman_image_composite32(PIXMAN_OP_SRC, image, NULL,
+						 encoder->pending,
+						 0, 0, 0, 0, 0, 0,
+						 width, height);
+#endif
+	}
+
+	pixman_image_set_clip_region32(encoder->pending, damage);
+	pixman_image_composite32(PIXMAN_OP_SRC, image, NULL, encoder->pending,
+				 0, 0, 0, 0, 0, 0, width, height);
+	pixman_image_set_clip_region32(encoder->pending, NULL);
+
+	pixman_region32_union(&encoder->pending_damage,
+			      &encoder->pending_damage, damage);
+
+	rdp_encoder_kick(encoder);
+}
+
+/** Queue damage of the shadow surface for encoding
+ *
+ * \param encoder The encoder shared by the peers to refresh.
+ * \param damage The damaged region, in output coordinates.
+ * \param image The output's shadow surface.
+ *
+ * The damaged pixels are copied right away, so the caller may repaint
+ * the shadow surface as soon as this returns. Tiles left unchanged
+ * are not sent again.
+ */
+static void
+rdp_encoder_queue(struct rdp_encoder *encoder, pixman_region32_t *damage,
+		  pixman_image_t *image)
+{
+	pixman_region32_t changed;
+
+	pixman_region32_init(&changed);
+	pixman_region32_copy(&changed, damage);
+	rdp_encoder_filter_damage(encoder, &changed, image);
+
+	if (pixman_region32_not_empty(&changed))
+		rdp_encoder_queue_changed(encoder, &changed, image);
+
+	pixman_region32_fini(&changed);
+}
+
+/* Wait for the thread to finish, drop any frame not sent yet and
+ * restart the codecs, so that the next frame carries the stream headers
+ */
+static void
+rdp_encoder_reset(struct rdp_encoder *encoder)
+{
+	if (encoder->threaded) {
+		pthread_mutex_lock(&encoder->mutex);
+		while (encoder->busy)
+			pthread_cond_wait(&encoder->idle_cond, &encoder->mutex);
+		encoder->ready = 0;
+		pixman_region32_clear(&encoder->pending_damage);
+		pthread_mutex_unlock(&encoder->mutex);
+	}
+
+	rdp_encoder_invalidate_tiles(encoder);
+
+#ifdef HAVE_FREERDP_GFX
+	if (rdp_encoder_is_gfx(encoder)) {
+		/* restarts the stream with an IDR frame */
+		if (encoder->h264)
+			h264_context_reset(encoder->h264, encoder->width,
+					   encoder->height);
+		return;
+	}
+#endif
+
+	rfx_context_reset(encoder->rfx_context);
+#ifdef HAVE_NSC_RESET
+	nsc_context_reset(encoder->nsc_context);
+#endif
+}
+
+#ifdef HAVE_FREERDP_GFX
+static int
+rdp_encoder_init_gfx(struct rdp_encoder *encoder)
+{
+	if (encoder->codec == RDP_CODEC_GFX_AVC420) {
+		encoder->h264 = h264_context_new(TRUE);
+		if (encoder->h264) {
+			encoder->bitrate = RDP_GFX_AVC420_BITRATE;
+			encoder->h264->RateControlMode = H264_RATECONTROL_VBR;
+			encoder->h264->BitRate = encoder->bitrate;
+			encoder->h264->FrameRate = RDP_MODE_FREQ / 1000;
+			if (h264_context_reset(encoder->h264, encoder->width,
+					       encoder->height))
+				return 0;
+
+			h264_context_free(encoder->h264);
+			encoder->h264 = NULL;
+		}
+
+		weston_log("rdp: no H.264 encoder available, "
+			   "falling back to planar\n");
+		encoder->codec = RDP_CODEC_GFX_PLANAR;
+	}
+
+	encoder->planar = freerdp_bitmap_planar_context_new(
+		PLANAR_FORMAT_HEADER_NA | PLANAR_FORMAT_HEADER_RLE,
+		encoder->width, encoder->height);
+	if (!encoder->planar)
+		return -1;
+
+	return 0;
+}
+#endif
+
+static int
+rdp_encoder_init_codecs(struct rdp_encoder *encoder)
+{
+#ifdef HAVE_FREERDP_GFX
+	if (rdp_encoder_is_gfx(encoder))
+		return rdp_encoder_init_gfx(encoder);
+#endif
+
+#if FREERDP_VERSION_MAJOR == 1 && FREERDP_VERSION_MINOR == 1
+	encoder->rfx_context = rfx_context_new();
+#else
+	encoder->rfx_context = rfx_context_new(TRUE);
+#endif
+	encoder->nsc_context = nsc_context_new();
+	encoder->encode_stream = Stream_New(NULL, 65536);
+	if (!encoder->rfx_context || !encoder->nsc_context ||
+	    !encoder->encode_stream)
+		return -1;
+
+	encoder->rfx_context->mode = RLGR3;
+	encoder->rfx_context->width = encoder->width;
+	encoder->rfx_context->height = encoder->height;
+	rfx_context_set_pixel_format(encoder->rfx_context, RDP_PIXEL_FORMAT_B8G8R8A8);
+	nsc_context_set_pixel_format(encoder->nsc_context, RDP_PIXEL_FORMAT_B8G8R8A8);
+
+	return 0;
+}
+
+static void
+rdp_encoder_fini_codecs(struct rdp_encoder *encoder)
+{
+#ifdef HAVE_FREERDP_GFX
+	rdp_encoder_clear_gfx_cmds(encoder);
+	wl_array_release(&encoder->gfx_cmds);
+	free(encoder->region_rects);
+	free(encoder->quant_vals);
+	if (encoder->h264)
+		h264_context_free(encoder->h264);
+	if (encoder->planar)
+		freerdp_bitmap_planar_context_free(encoder->planar);
+#endif
+
+	if (encoder->encode_stream)
+		Stream_Free(encoder->encode_stream, TRUE);
+	if (encoder->nsc_context)
+		nsc_context_free(encoder->nsc_context);
+	if (encoder->rfx_context)
+		rfx_context_free(encoder->rfx_context);
+	free(encoder->rfx_rects);
+}
+
+static struct rdp_encoder *
+rdp_encoder_create(enum rdp_codec codec, UINT32 width, UINT32 height,
+		   struct wl_event_loop *loop)
+{
+	struct rdp_encoder *encoder;
+
+	encoder = zalloc(sizeof *encoder);
+	if (!encoder)
+		return NULL;
+
+	wl_list_init(&encoder->peers);
+	encoder->codec = codec;
+	encoder->width = width;
+	encoder->height = height;
+	pixman_region32_init(&encoder->pending_damage);
+	pixman_region32_init(&encoder->frame_damage);
+#ifdef HAVE_FREERDP_GFX
+	wl_array_init(&encoder->gfx_cmds);
+#endif
+
+	encoder->tiles_x = (width + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE;
+	encoder->tiles_y = (height + RDP_TILE_SIZE - 1) / RDP_TILE_SIZE;
+	encoder->tile_hashes = calloc(encoder->tiles_x * encoder->tiles_y,
+				      sizeof *encoder->tile_hashes);
+	if (!encoder->tile_hashes)
+		goto err_codecs;
+
+	if (rdp_encoder_init_codecs(encoder) < 0)
+		goto err_codecs;
+
+	if (pipe2(encoder->pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+		goto err_sync;
+
+	encoder->source = wl_event_loop_add_fd(loop, encoder->pipe[0],
+					       WL_EVENT_READABLE,
+					       rdp_encoder_handle_ready,
+					       encoder);
+	if (!encoder->source)
+		goto err_pipe;
+
+	pthread_mutex_init(&encoder->mutex, NULL);
+	pthread_cond_init(&encoder->work_cond, NULL);
+	pthread_cond_init(&encoder->idle_cond, NULL);
+
+	if (pthread_create(&encoder->thread, NULL,
+			   rdp_encoder_thread, encoder) != 0)
+		goto err_thread;
+
+	encoder->threaded = 1;
+	return encoder;
+
+err_thread:
+	pthread_cond_destroy(&encoder->idle_cond);
+	pthread_cond_destroy(&encoder->work_cond);
+	pthread_mutex_destroy(&encoder->mutex);
+	wl_event_source_remove(encoder->source);
+err_pipe:
+	close(encoder->pipe[0]);
+	close(encoder->pipe[1]);
+err_sync:
+	weston_log("rdp: failed to start encoder thread, "
+		   "encoding synchronously\n");
+	return encoder;
+
+err_codecs:
+	rdp_encoder_fini_codecs(encoder);
+	free(encoder->tile_hashes);
+	pixman_region32_fini(&encoder->frame_damage);
+	pixman_region32_fini(&encoder->pending_damage);
+	free(encoder);
+	return NULL;
+}
+
+static void
+rdp_encoder_destroy(struct rdp_encoder *encoder)
+{
+	if (encoder->threaded) {
+		pthread_mutex_lock(&encoder->mutex);
+		encoder->quit = 1;
+		pthread_cond_signal(&encoder->work_cond);
+		pthread_mutex_unlock(&encoder->mutex);
+		pthread_join(encoder->thread, NULL);
+
+		pthread_cond_destroy(&encoder->idle_cond);
+		pthread_cond_destroy(&encoder->work_cond);
+		pthread_mutex_destroy(&encoder->mutex);
+
+		wl_event_source_remove(encoder->source);
+		close(encoder->pipe[0]);
+		close(encoder->pipe[1]);
+	}
+
+	rdp_encoder_fini_codecs(encoder);
+	free(encoder->tile_hashes);
+
+	if (encoder->pending)
+		pixman_image_unref(encoder->pending);
+	if (encoder->frame)
+		pixman_image_unref(encoder->frame);
+	pixman_region32_fini(&encoder->frame_damage);
+	pixman_region32_fini(&encoder->pending_damage);
+	wl_list_remove(&encoder->link);
+	free(encoder);
+}
+
+/* Graphics pipeline codecs take over once the peer confirmed its
+ * capabilities, until then RemoteFX and NSCodec surface bits are used */
+static int
+rdp_peer_select_codec(RdpPeerContext *peerCtx, enum rdp_codec *codec)
+{
+	rdpSettings *settings = peerCtx->item.peer->settings;
+
+#ifdef HAVE_FREERDP_GFX
+	if (peerCtx->gfx_ready) {
+		pthread_mutex_lock(&peerCtx->gfx_mutex);
+		*codec = peerCtx->gfx_avc420 ? RDP_CODEC_GFX_AVC420 :
+					       RDP_CODEC_GFX_PLANAR;
+		pthread_mutex_unlock(&peerCtx->gfx_mutex);
+		return 0;
+	}
+#endif
+
+	if (settings->RemoteFxCodec)
+		*codec = RDP_CODEC_RFX;
+	else if (settings->NSCodec)
+		*codec = RDP_CODEC_NSC;
+	else
+		return -1;
+
+	return 0;
+}
+
+#ifdef HAVE_FREERDP_GFX
+/* Surfaces are numbered after their output */
+static void
+rdp_peer_gfx_map_output(struct rdp_peer_output *view)
+{
+	RdpgfxServerContext *gfx = view->peerCtx->gfx;
+	struct rdp_output *output = view->output;
+	RDPGFX_CREATE_SURFACE_PDU create;
+	RDPGFX_MAP_SURFACE_TO_OUTPUT_PDU map;
+
+	memset(&create, 0, sizeof create);
+	create.surfaceId = output->id;
+	create.width = output->base.width;
+	create.height = output->base.height;
+	create.pixelFormat = GFX_PIXEL_FORMAT_XRGB_8888;
+	gfx->CreateSurface(gfx, &create);
+
+	memset(&map, 0, sizeof map);
+	map.surfaceId = output->id;
+	map.outputOriginX = output->base.x;
+	map.outputOriginY = output->base.y;
+	gfx->MapSurfaceToOutput(gfx, &map);
+
+	view->gfx_mapped = 1;
+}
+
+static void
+rdp_peer_gfx_unmap_output(struct rdp_peer_output *view)
+{
+	RdpgfxServerContext *gfx = view->peerCtx->gfx;
+	RDPGFX_DELETE_SURFACE_PDU delete;
+
+	memset(&delete, 0, sizeof delete);
+	delete.surfaceId = view->output->id;
+	gfx->DeleteSurface(gfx, &delete);
+
+	view->gfx_mapped = 0;
+}
+
+/* Announce the monitor layout, before the surfaces are created */
+static void
+rdp_peer_gfx_reset_graphics(RdpPeerContext *peerCtx)
+{
+	struct rdp_backend *b = peerCtx->rdpBackend;
+	rdpSettings *settings = peerCtx->item.peer->settings;
+	RdpgfxServerContext *gfx = peerCtx->gfx;
+	RDPGFX_RESET_GRAPHICS_PDU reset;
+	MONITOR_DEF monitors[RDP_MAX_MONITORS];
+	struct rdp_output *output;
+	UINT32 count = 0;
+
+	memset(monitors, 0, sizeof monitors);
+	wl_list_for_each(output, &b->outputs, link) {
+		if (count == RDP_MAX_MONITORS)
+			break;
+		monitors[count].left = output->base.x;
+		monitors[count].top = output->base.y;
+		monitors[count].right = output->base.x + output->base.width - 1;
+		monitors[count].bottom = output->base.y + output->base.height - 1;
+		monitors[count].flags = count == 0 ? MONITOR_PRIMARY : 0;
+		count++;
+	}
+
+	memset(&reset, 0, sizeof reset);
+	reset.width = settings->DesktopWidth;
+	reset.height = settings->DesktopHeight;
+	reset.monitorCount = count;
+	reset.monitorDefArray = monitors;
+	gfx->ResetGraphics(gfx, &reset);
+}
+#endif
+
+static void
+rdp_peer_output_detach(struct rdp_peer_output *view)
+{
+	struct rdp_encoder *encoder = view->encoder;
+
+#ifdef HAVE_FREERDP_GFX
+	if (view->gfx_mapped && view->peerCtx->gfx_ready)
+		rdp_peer_gfx_unmap_output(view);
+#endif
+
+	if (encoder) {
+		wl_list_remove(&view->encoder_link);
+		if (wl_list_empty(&encoder->peers))
+			rdp_encoder_destroy(encoder);
+	}
+
+	wl_list_remove(&view->link);
+	free(view);
+}
+
+static void
+rdp_peer_detach_encoders(RdpPeerContext *peerCtx)
+{
+	struct rdp_peer_output *view, *next;
+
+	wl_list_for_each_safe(view, next, &peerCtx->outputs, link)
+		rdp_peer_output_detach(view);
+}
+
+/** Attach a peer to the encoder of an output matching its codec
+ *
+ * \param peerCtx The activated peer.
+ * \param output The output to attach to.
+ * \param codec The codec the peer uses.
+ * \return 0 on success, -1 if no encoder could be created.
+ *
+ * Joining an existing encoder restarts its codecs, and sends a full
+ * frame to all of its peers, since the frame dropped by the reset, and
+ * the stream headers, are needed by everyone. Graphics pipeline
+ * encoders are never shared.
+ */
+static int
+rdp_peer_output_attach(RdpPeerContext *peerCtx, struct rdp_output *output,
+		       enum rdp_codec codec)
+{
+	struct rdp_peer_output *view;
+	struct wl_event_loop *loop;
+	struct rdp_encoder *encoder, *found = NULL;
+	pixman_region32_t damage;
+
+	view = zalloc(sizeof *view);
+	if (!view)
+		return -1;
+
+	view->peerCtx = peerCtx;
+	view->output = output;
+	wl_list_insert(peerCtx->outputs.prev, &view->link);
+
+#ifdef HAVE_FREERDP_GFX
+	if (peerCtx->gfx_ready)
+		rdp_peer_gfx_map_output(view);
+#endif
+
+	wl_list_for_each(encoder, &output->encoders, link) {
+		if (encoder->codec == codec && rdp_codec_is_shared(codec) &&
+		    encoder->width == (UINT32)output->base.width &&
+		    encoder->height == (UINT32)output->base.height &&
+		    encoder->x == output->base.x &&
+		    encoder->y == output->base.y) {
+			found = encoder;
+			break;
+		}
+	}
+
+	if (found) {
+		rdp_encoder_reset(found);
+		pixman_region32_init_rect(&damage, 0, 0,
+					  output->base.width,
+					  output->base.height);
+		rdp_encoder_queue(found, &damage, output->shadow_surface);
+		pixman_region32_fini(&damage);
+	} else {
+		loop = wl_display_get_event_loop(output->base.compositor->wl_display);
+		found = rdp_encoder_create(codec, output->base.width,
+					   output->base.height, loop);
+		if (!found)
+			return -1;
+		found->x = output->base.x;
+		found->y = output->base.y;
+		wl_list_insert(&output->encoders, &found->link);
+	}
+
+	wl_list_insert(&found->peers, &view->encoder_link);
+	view->encoder = found;
+
+	return 0;
+}
+
+/* Peers without any codec are refreshed with raw surface bits, and
+ * have no view of the outputs */
+static int
+rdp_peer_attach_encoders(RdpPeerContext *peerCtx)
+{
+	struct rdp_output *output;
+	enum rdp_codec codec;
+
+	rdp_peer_detach_encoders(peerCtx);
+
+	if (rdp_peer_select_codec(peerCtx, &codec) < 0)
+		return 0;
+
+#ifdef HAVE_FREERDP_GFX
+	if (peerCtx->gfx_ready)
+		rdp_peer_gfx_reset_graphics(peerCtx);
 #endif
-	cmd->destLeft = damage->extents.x1;
-	cmd->destTop = damage->extents.y1;
-	cmd->destRight = damage->extents.x2;
-	cmd->destBottom = damage->extents.y2;
-	cmd->bpp = 32;
-	cmd->codecID = peer->settings->NSCodecId;
-	cmd->width = width;
-	cmd->height = height;
 
-	ptr = pixman_image_get_data(image) + damage->extents.x1 +
-				damage->extents.y1 * (pixman_image_get_stride(image) / sizeof(uint32_t));
+	wl_list_for_each(output, &peerCtx->rdpBackend->outputs, link) {
+		if (rdp_peer_output_attach(peerCtx, output, codec) < 0)
+			return -1;
+	}
 
-	nsc_compose_message(context->nsc_context, context->encode_stream, (BYTE *)ptr,
-			cmd->width,	cmd->height,
-			pixman_image_get_stride(image));
-	cmd->bitmapDataLength = Stream_GetPosition(context->encode_stream);
-	cmd->bitmapData = Stream_Buffer(context->encode_stream);
-	update->SurfaceBits(update->context, cmd);
+	return 0;
+}
+
+/* An acknowledgement may unblock the encoders of the peer */
+static void
+rdp_peer_flow_acked(RdpPeerContext *peerCtx)
+{
+	struct rdp_peer_output *view;
+
+	wl_list_for_each(view, &peerCtx->outputs, link) {
+		if (!view->encoder)
+			continue;
+		rdp_encoder_adapt(view->encoder);
+		rdp_encoder_kick(view->encoder);
+	}
+	peerCtx->flow.saturated = 0;
 }
 
 static void
@@ -264,9 +1542,12 @@ pixman_image_flipped_subrect(const pixman_box32_t *rect, pixman_image_t *img, BY
 		   memcpy(dest, src, toCopy);
 }
 
+/* The region is in output coordinates */
 static void
-rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_peer *peer)
+rdp_peer_refresh_raw(pixman_region32_t *region, struct rdp_output *output,
+		     freerdp_peer *peer)
 {
+	pixman_image_t *image = output->shadow_surface;
 	rdpUpdate *update = peer->update;
 	SURFACE_BITS_COMMAND *cmd = &update->surface_bits_command;
 	SURFACE_FRAME_MARKER *marker = &update->surface_frame_marker;
@@ -288,8 +1569,8 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 
 	for (i = 0; i < nrects; i++, rect++) {
 		/*weston_log("rect(%d,%d, %d,%d)\n", rect->x1, rect->y1, rect->x2, rect->y2);*/
-		cmd->destLeft = rect->x1;
-		cmd->destRight = rect->x2;
+		cmd->destLeft = output->base.x + rect->x1;
+		cmd->destRight = output->base.x + rect->x2;
 		cmd->width = rect->x2 - rect->x1;
 
 		heightIncrement = peer->settings->MultifragMaxRequestSize / (16 + cmd->width * 4);
@@ -301,8 +1582,8 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 
 		while (remainingHeight) {
 			   cmd->height = (remainingHeight > heightIncrement) ? heightIncrement : remainingHeight;
-			   cmd->destTop = top;
-			   cmd->destBottom = top + cmd->height;
+			   cmd->destTop = output->base.y + top;
+			   cmd->destBottom = output->base.y + top + cmd->height;
 			   cmd->bitmapDataLength = cmd->width * cmd->height * 4;
 			   cmd->bitmapData = (BYTE *)realloc(cmd->bitmapData, cmd->bitmapDataLength);
 
@@ -322,19 +1603,41 @@ rdp_peer_refresh_raw(pixman_region32_t *region, pixman_image_t *image, freerdp_p
 	update->SurfaceFrameMarker(peer->context, marker);
 }
 
+/* With a codec, this refreshes every peer sharing the peer's encoders */
 static void
-rdp_peer_refresh_region(pixman_region32_t *region, freerdp_peer *peer)
+rdp_peer_refresh_full(RdpPeerContext *peerCtx)
 {
-	RdpPeerContext *context = (RdpPeerContext *)peer->context;
-	struct rdp_output *output = context->rdpBackend->output;
-	rdpSettings *settings = peer->settings;
+	struct rdp_output *output;
+	struct rdp_peer_output *view;
+	pixman_region32_t damage;
 
-	if (settings->RemoteFxCodec)
-		rdp_peer_refresh_rfx(region, output->shadow_surface, peer);
-	else if (settings->NSCodec)
-		rdp_peer_refresh_nsc(region, output->shadow_surface, peer);
-	else
-		rdp_peer_refresh_raw(region, output->shadow_surface, peer);
+	if (wl_list_empty(&peerCtx->outputs)) {
+		wl_list_for_each(output, &peerCtx->rdpBackend->outputs, link) {
+			pixman_region32_init_rect(&damage, 0, 0,
+						  output->base.width,
+						  output->base.height);
+			rdp_peer_refresh_raw(&damage, output,
+					     peerCtx->item.peer);
+			pixman_region32_fini(&damage);
+		}
+		return;
+	}
+
+	wl_list_for_each(view, &peerCtx->outputs, link) {
+		if (!view->encoder)
+			continue;
+
+		output = view->output;
+		pixman_region32_init_rect(&damage, 0, 0,
+					  output->base.width,
+					  output->base.height);
+
+		/* the client lost its copy, what we last sent doesn't matter */
+		rdp_encoder_invalidate_tiles(view->encoder);
+		rdp_encoder_queue(view->encoder, &damage,
+				  output->shadow_surface);
+		pixman_region32_fini(&damage);
+	}
 }
 
 static void
@@ -352,18 +1655,34 @@ rdp_output_repaint(struct weston_output *output_base, pixman_region32_t *damage)
 	struct rdp_output *output = container_of(output_base, struct rdp_output, base);
 	struct weston_compositor *ec = output->base.compositor;
 	struct rdp_peers_item *outputPeer;
+	struct rdp_encoder *encoder;
+	pixman_region32_t local;
 
 	pixman_renderer_output_set_buffer(output_base, output->shadow_surface);
 	ec->renderer->repaint_output(&output->base, damage);
 
 	if (pixman_region32_not_empty(damage)) {
-		wl_list_for_each(outputPeer, &output->peers, link) {
+		pixman_region32_init(&local);
+		pixman_region32_copy(&local, damage);
+		pixman_region32_translate(&local, -output->base.x,
+					  -output->base.y);
+
+		/* Encoded frames are sent to all the peers of an encoder */
+		wl_list_for_each(encoder, &output->encoders, link)
+			rdp_encoder_queue(encoder, &local,
+					  output->shadow_surface);
+
+		wl_list_for_each(outputPeer, &output->backend->peers, link) {
 			if ((outputPeer->flags & RDP_PEER_ACTIVATED) &&
-					(outputPeer->flags & RDP_PEER_OUTPUT_ENABLED))
+					(outputPeer->flags & RDP_PEER_OUTPUT_ENABLED) &&
+					wl_list_empty(&((RdpPeerContext *)outputPeer->peer->context)->outputs))
 			{
-				rdp_peer_refresh_region(damage, outputPeer->peer);
+				rdp_peer_refresh_raw(&local, output,
+						     outputPeer->peer);
 			}
 		}
+
+		pixman_region32_fini(&local);
 	}
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
@@ -379,6 +1698,10 @@ rdp_output_destroy(struct weston_output *output_base)
 	struct rdp_output *output = (struct rdp_output *)output_base;
 
 	wl_event_source_remove(output->finish_frame_timer);
+	pixman_renderer_output_destroy(output_base);
+	pixman_image_unref(output->shadow_surface);
+	weston_output_destroy(output_base);
+	wl_list_remove(&output->link);
 	free(output);
 }
 
@@ -421,12 +1744,93 @@ ensure_matching_mode(struct weston_output *output, struct weston_mode *target)
 	return rdp_insert_new_mode(output, target->width, target->height, RDP_MODE_FREQ);
 }
 
+/* The desktop spans from the origin to the farthest output corner */
+static void
+rdp_backend_desktop_size(struct rdp_backend *b, int *width, int *height)
+{
+	struct rdp_output *output;
+
+	*width = 0;
+	*height = 0;
+	wl_list_for_each(output, &b->outputs, link) {
+		*width = MAX(*width, output->base.x + output->base.width);
+		*height = MAX(*height, output->base.y + output->base.height);
+	}
+}
+
+static int
+rdp_backend_contains_point(struct rdp_backend *b, int x, int y)
+{
+	struct rdp_output *output;
+
+	wl_list_for_each(output, &b->outputs, link) {
+		if (pixman_region32_contains_point(&output->base.region,
+						   x, y, NULL))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Encoders depend on the size and position of their output, so the
+ * peers drop them before the outputs change */
+static void
+rdp_backend_detach_peers(struct rdp_backend *b)
+{
+	struct rdp_peers_item *item;
+
+	wl_list_for_each(item, &b->peers, link)
+		rdp_peer_detach_encoders((RdpPeerContext *)item->peer->context);
+}
+
+/** Reattach the peers once the outputs changed
+ *
+ * \param b The backend.
+ * \param except A peer being activated, which attaches itself, or NULL.
+ *
+ * Peers seeing a desktop of another size are resized instead, and
+ * reattach once reactivated.
+ */
+static void
+rdp_backend_reattach_peers(struct rdp_backend *b, RdpPeerContext *except)
+{
+	struct rdp_peers_item *item, *next;
+	RdpPeerContext *peerCtx;
+	rdpSettings *settings;
+	freerdp_peer *peer;
+	int width, height;
+
+	rdp_backend_desktop_size(b, &width, &height);
+
+	wl_list_for_each_safe(item, next, &b->peers, link) {
+		peer = item->peer;
+		peerCtx = (RdpPeerContext *)peer->context;
+		settings = peer->settings;
+		if (peerCtx == except || !(item->flags & RDP_PEER_ACTIVATED))
+			continue;
+
+		if (settings->DesktopWidth == (UINT32)width &&
+		    settings->DesktopHeight == (UINT32)height) {
+			if (rdp_peer_attach_encoders(peerCtx) < 0)
+				weston_log("failed to create encoder for %p\n",
+					   peer);
+			rdp_peer_refresh_full(peerCtx);
+		} else if (!settings->DesktopResize) {
+			/* too bad this peer does not support desktop resize */
+			peer->Close(peer);
+		} else {
+			settings->DesktopWidth = width;
+			settings->DesktopHeight = height;
+			peer->update->DesktopResize(peer->context);
+		}
+	}
+}
+
 static int
 rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode)
 {
 	struct rdp_output *rdpOutput = container_of(output, struct rdp_output, base);
-	struct rdp_peers_item *rdpPeer;
-	rdpSettings *settings;
+	struct rdp_backend *b = rdpOutput->backend;
 	pixman_image_t *new_shadow_buffer;
 	struct weston_mode *local_mode;
 
@@ -439,6 +1843,9 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode)
 	if (local_mode == output->current_mode)
 		return 0;
 
+	if (!b->applying_layout)
+		rdp_backend_detach_peers(b);
+
 	output->current_mode->flags &= ~WL_OUTPUT_MODE_CURRENT;
 
 	output->current_mode = local_mode;
@@ -454,26 +1861,15 @@ rdp_switch_mode(struct weston_output *output, struct weston_mode *target_mode)
 	pixman_image_unref(rdpOutput->shadow_surface);
 	rdpOutput->shadow_surface = new_shadow_buffer;
 
-	wl_list_for_each(rdpPeer, &rdpOutput->peers, link) {
-		settings = rdpPeer->peer->settings;
-		if (settings->DesktopWidth == (UINT32)target_mode->width &&
-				settings->DesktopHeight == (UINT32)target_mode->height)
-			continue;
+	if (!b->applying_layout)
+		rdp_backend_reattach_peers(b, NULL);
 
-		if (!settings->DesktopResize) {
-			/* too bad this peer does not support desktop resize */
-			rdpPeer->peer->Close(rdpPeer->peer);
-		} else {
-			settings->DesktopWidth = target_mode->width;
-			settings->DesktopHeight = target_mode->height;
-			rdpPeer->peer->update->DesktopResize(rdpPeer->peer->context);
-		}
-	}
 	return 0;
 }
 
 static int
-rdp_backend_create_output(struct rdp_backend *b, int width, int height)
+rdp_backend_create_output(struct rdp_backend *b, int x, int y,
+			  int width, int height)
 {
 	struct rdp_output *output;
 	struct wl_event_loop *loop;
@@ -484,7 +1880,8 @@ rdp_backend_create_output(struct rdp_backend *b, int width, int height)
 	if (output == NULL)
 		return -1;
 
-	wl_list_init(&output->peers);
+	output->backend = b;
+	wl_list_init(&output->encoders);
 	wl_list_init(&output->base.mode_list);
 
 	initMode.flags = WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
@@ -497,7 +1894,7 @@ rdp_backend_create_output(struct rdp_backend *b, int width, int height)
 		goto out_free_output;
 
 	output->base.current_mode = output->base.native_mode = currentMode;
-	weston_output_init(&output->base, b->compositor, 0, 0, width, height,
+	weston_output_init(&output->base, b->compositor, x, y, width, height,
 			   WL_OUTPUT_TRANSFORM_NORMAL, 1);
 
 	output->base.make = "weston";
@@ -524,7 +1921,8 @@ rdp_backend_create_output(struct rdp_backend *b, int width, int height)
 	output->base.set_backlight = NULL;
 	output->base.set_dpms = NULL;
 	output->base.switch_mode = rdp_switch_mode;
-	b->output = output;
+	output->id = b->next_output_id++;
+	wl_list_insert(b->outputs.prev, &output->link);
 
 	weston_compositor_add_output(b->compositor, &output->base);
 	return 0;
@@ -538,6 +1936,100 @@ out_free_output:
 	return -1;
 }
 
+static int
+rdp_output_set_size(struct rdp_output *output, int width, int height)
+{
+	struct weston_mode new_mode;
+	struct weston_mode *target_mode;
+
+	new_mode.width = width;
+	new_mode.height = height;
+	target_mode = ensure_matching_mode(&output->base, &new_mode);
+	if (!target_mode) {
+		weston_log("client mode not found\n");
+		return -1;
+	}
+
+	weston_output_mode_set_native(&output->base, target_mode, 1);
+	output->base.width = width;
+	output->base.height = height;
+	return 0;
+}
+
+/** Lay the outputs out like the monitors of a client
+ *
+ * \param b The backend.
+ * \param peerCtx The peer being activated.
+ *
+ * Clients without a monitor layout get a single output of their desktop
+ * size. Monitors to the left or above the primary one have negative
+ * coordinates, the layout is moved so the desktop starts at 0,0.
+ */
+static void
+rdp_backend_apply_layout(struct rdp_backend *b, RdpPeerContext *peerCtx)
+{
+	rdpSettings *settings = peerCtx->item.peer->settings;
+	struct rdp_output *output;
+	rdpMonitor single, *monitors;
+	struct wl_list *link;
+	int count, i, min_x, min_y, x, y;
+
+	if (settings->MonitorCount > 0 && settings->MonitorDefArray) {
+		monitors = settings->MonitorDefArray;
+		count = MIN((int)settings->MonitorCount, RDP_MAX_MONITORS);
+	} else {
+		memset(&single, 0, sizeof single);
+		single.width = settings->DesktopWidth;
+		single.height = settings->DesktopHeight;
+		monitors = &single;
+		count = 1;
+	}
+
+	min_x = monitors[0].x;
+	min_y = monitors[0].y;
+	for (i = 1; i < count; i++) {
+		min_x = MIN(min_x, monitors[i].x);
+		min_y = MIN(min_y, monitors[i].y);
+	}
+
+	b->applying_layout = 1;
+	rdp_backend_detach_peers(b);
+
+	link = b->outputs.next;
+	for (i = 0; i < count; i++) {
+		x = monitors[i].x - min_x;
+		y = monitors[i].y - min_y;
+
+		if (link == &b->outputs) {
+			if (rdp_backend_create_output(b, x, y,
+						      monitors[i].width,
+						      monitors[i].height) < 0) {
+				weston_log("failed to create output for "
+					   "monitor %d\n", i);
+				break;
+			}
+			continue;
+		}
+
+		output = container_of(link, struct rdp_output, link);
+		link = link->next;
+		rdp_output_set_size(output, monitors[i].width,
+				    monitors[i].height);
+		if (output->base.x != x || output->base.y != y)
+			weston_output_move(&output->base, x, y);
+	}
+
+	/* the first output is kept, there is always somewhere to draw */
+	while (link != &b->outputs && link != b->outputs.next) {
+		output = container_of(link, struct rdp_output, link);
+		link = link->next;
+		output->base.destroy(&output->base);
+	}
+
+	b->applying_layout = 0;
+	rdp_backend_reattach_peers(b, peerCtx);
+}
+
 static void
 rdp_restore(struct weston_compositor *ec)
 {
@@ -601,27 +2093,265 @@ int rdp_implant_listener(struct rdp_backend *b, freerdp_listener* instance)
 	return 0;
 }
 
+#ifdef HAVE_FREERDP_GFX
+/* Called from the channel thread */
+static void
+rdp_peer_gfx_notify(RdpPeerContext *peerCtx)
+{
+	char c = 0;
+
+	if (write(peerCtx->gfx_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+		weston_log("rdp: failed to signal graphics pipeline event\n");
+}
+
+static int
+rdp_gfx_caps_avc420(const RDPGFX_CAPSET *caps)
+{
+	if (caps->version == RDPGFX_CAPVERSION_8)
+		return 0;
+	if (caps->version == RDPGFX_CAPVERSION_81)
+		return caps->flags & RDPGFX_CAPS_FLAG_AVC420_ENABLED;
+
+	return !(caps->flags & RDPGFX_CAPS_FLAG_AVC_DISABLED);
+}
+
+/* Confirms the most recent capability set, whose versions are ordered */
+static UINT
+rdp_gfx_caps_advertise(RdpgfxServerContext *gfx,
+		       const RDPGFX_CAPS_ADVERTISE_PDU *advertise)
+{
+	RdpPeerContext *peerCtx = gfx->custom;
+	RDPGFX_CAPS_CONFIRM_PDU confirm;
+	RDPGFX_CAPSET *caps = NULL;
+	UINT16 i;
+	UINT ret;
+
+	for (i = 0; i < advertise->capsSetCount; i++) {
+		if (!caps || advertise->capsSets[i].version > caps->version)
+			caps = &advertise->capsSets[i];
+	}
+	if (!caps)
+		return CHANNEL_RC_UNSUPPORTED_VERSION;
+
+	confirm.capsSet = caps;
+	ret = gfx->CapsConfirm(gfx, &confirm);
+	if (ret != CHANNEL_RC_OK)
+		return ret;
+
+	pthread_mutex_lock(&peerCtx->gfx_mutex);
+	peerCtx->gfx_caps_confirmed = 1;
+	peerCtx->gfx_avc420 = rdp_gfx_caps_avc420(caps);
+	pthread_mutex_unlock(&peerCtx->gfx_mutex);
+	rdp_peer_gfx_notify(peerCtx);
+
+	return CHANNEL_RC_OK;
+}
+
+static UINT
+rdp_gfx_frame_acknowledge(RdpgfxServerContext *gfx,
+			  const RDPGFX_FRAME_ACKNOWLEDGE_PDU *ack)
+{
+	RdpPeerContext *peerCtx = gfx->custom;
+
+	pthread_mutex_lock(&peerCtx->gfx_mutex);
+	peerCtx->gfx_acks_suspended =
+		ack->queueDepth == RDP_GFX_SUSPEND_FRAME_ACKS;
+	peerCtx->gfx_last_ack = ack->frameId;
+	peerCtx->gfx_ack_pending = 1;
+	pthread_mutex_unlock(&peerCtx->gfx_mutex);
+	rdp_peer_gfx_notify(peerCtx);
+
+	return CHANNEL_RC_OK;
+}
+
+/* Surfaces are created by rdp_peer_attach_encoders() */
+static void
+rdp_peer_gfx_start(RdpPeerContext *peerCtx)
+{
+	peerCtx->gfx_ready = 1;
+	rdp_peer_flow_init(&peerCtx->flow, RDP_FLOW_MAX_IN_FLIGHT);
+}
+
+static int
+rdp_peer_gfx_confirmed(RdpPeerContext *peerCtx)
+{
+	int confirmed;
+
+	if (!peerCtx->gfx)
+		return 0;
+
+	pthread_mutex_lock(&peerCtx->gfx_mutex);
+	confirmed = peerCtx->gfx_caps_confirmed;
+	pthread_mutex_unlock(&peerCtx->gfx_mutex);
+
+	return confirmed;
+}
+
+/* Switch an activated peer over to the graphics pipeline, or resume
+ * encoding after an acknowledgement */
+static int
+rdp_peer_gfx_handle_event(int fd, uint32_t mask, void *data)
+{
+	RdpPeerContext *peerCtx = data;
+	int ack_pending, suspended;
+	UINT32 ack;
+	char buf[16];
+
+	while (read(fd, buf, sizeof buf) > 0)
+		;
+
+	pthread_mutex_lock(&peerCtx->gfx_mutex);
+	ack_pending = peerCtx->gfx_ack_pending;
+	suspended = peerCtx->gfx_acks_suspended;
+	ack = peerCtx->gfx_last_ack;
+	peerCtx->gfx_ack_pending = 0;
+	pthread_mutex_unlock(&peerCtx->gfx_mutex);
+
+	if (!peerCtx->gfx_ready && rdp_peer_gfx_confirmed(peerCtx) &&
+	    (peerCtx->item.flags & RDP_PEER_ACTIVATED)) {
+		rdp_peer_gfx_start(peerCtx);
+		if (rdp_peer_attach_encoders(peerCtx) < 0) {
+			weston_log("rdp: failed to create graphics pipeline "
+				   "encoder for %p\n", peerCtx->item.peer);
+			return 1;
+		}
+
+		rdp_peer_refresh_full(peerCtx);
+		return 1;
+	}
+
+	if (ack_pending && peerCtx->gfx_ready) {
+		peerCtx->flow.enabled = !suspended;
+		rdp_peer_flow_ack(&peerCtx->flow, ack);
+		rdp_peer_flow_acked(peerCtx);
+	}
+
+	return 1;
+}
+
+/* The graphics pipeline is a dynamic channel, it can be opened once
+ * the client joined the drdynvc static channel */
+static int
+rdp_peer_check_vcm(RdpPeerContext *peerCtx)
+{
+	rdpSettings *settings = peerCtx->item.peer->settings;
+
+	if (!peerCtx->gfx)
+		return 0;
+
+	if (!WTSVirtualChannelManagerCheckFileDescriptor(peerCtx->vcm))
+		return -1;
+
+	if (peerCtx->gfx_opened || !settings->SupportGraphicsPipeline ||
+	    !WTSVirtualChannelManagerIsChannelJoined(peerCtx->vcm, "drdynvc") ||
+	    WTSVirtualChannelManagerGetDrdynvcState(peerCtx->vcm) !=
+							DRDYNVC_STATE_READY)
+		return 0;
+
+	peerCtx->gfx_opened = 1;
+	if (!peerCtx->gfx->Open(peerCtx->gfx))
+		weston_log("rdp: failed to open the graphics pipeline\n");
+
+	return 0;
+}
+
+static int
+rdp_peer_vcm_activity(int fd, uint32_t mask, void *data)
+{
+	freerdp_peer *client = data;
+
+	if (rdp_peer_check_vcm((RdpPeerContext *)client->context) < 0) {
+		weston_log("unable to check channels of %p\n", client);
+		freerdp_peer_context_free(client);
+		freerdp_peer_free(client);
+	}
+
+	return 0;
+}
 
 static void
-rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
+rdp_peer_fini_gfx(RdpPeerContext *peerCtx)
 {
-	context->item.peer = client;
-	context->item.flags = RDP_PEER_OUTPUT_ENABLED;
+	if (!peerCtx->gfx)
+		return;
 
-#if FREERDP_VERSION_MAJOR == 1 && FREERDP_VERSION_MINOR == 1
-	context->rfx_context = rfx_context_new();
-#else
-	context->rfx_context = rfx_context_new(TRUE);
-#endif
-	context->rfx_context->mode = RLGR3;
-	context->rfx_context->width = client->settings->DesktopWidth;
-	context->rfx_context->height = client->settings->DesktopHeight;
-	rfx_context_set_pixel_format(context->rfx_context, RDP_PIXEL_FORMAT_B8G8R8A8);
+	if (peerCtx->gfx_opened)
+		peerCtx->gfx->Close(peerCtx->gfx);
+	rdpgfx_server_context_free(peerCtx->gfx);
+	peerCtx->gfx = NULL;
+
+	wl_event_source_remove(peerCtx->vcm_event);
+	WTSCloseServer(peerCtx->vcm);
+
+	wl_event_source_remove(peerCtx->gfx_event);
+	close(peerCtx->gfx_pipe[0]);
+	close(peerCtx->gfx_pipe[1]);
+	pthread_mutex_destroy(&peerCtx->gfx_mutex);
+}
+
+/* Without the graphics pipeline, the peer keeps using surface bits */
+static void
+rdp_peer_init_gfx(freerdp_peer *client, struct wl_event_loop *loop)
+{
+	RdpPeerContext *peerCtx = (RdpPeerContext *)client->context;
+	int fd;
 
-	context->nsc_context = nsc_context_new();
-	nsc_context_set_pixel_format(context->nsc_context, RDP_PIXEL_FORMAT_B8G8R8A8);
+	client->settings->SupportGraphicsPipeline = TRUE;
+
+	peerCtx->vcm = WTSOpenServerA((LPSTR)client->context);
+	if (!peerCtx->vcm)
+		goto err;
+
+	fd = GetEventFileDescriptor(
+		WTSVirtualChannelManagerGetEventHandle(peerCtx->vcm));
+	peerCtx->vcm_event = wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+						  rdp_peer_vcm_activity,
+						  client);
+	if (!peerCtx->vcm_event)
+		goto err_vcm;
+
+	if (pipe2(peerCtx->gfx_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+		goto err_vcm_event;
+
+	peerCtx->gfx_event = wl_event_loop_add_fd(loop, peerCtx->gfx_pipe[0],
+						  WL_EVENT_READABLE,
+						  rdp_peer_gfx_handle_event,
+						  peerCtx);
+	if (!peerCtx->gfx_event)
+		goto err_pipe;
+
+	peerCtx->gfx = rdpgfx_server_context_new(peerCtx->vcm);
+	if (!peerCtx->gfx)
+		goto err_gfx_event;
+
+	pthread_mutex_init(&peerCtx->gfx_mutex, NULL);
+	peerCtx->gfx->rdpcontext = client->context;
+	peerCtx->gfx->custom = peerCtx;
+	peerCtx->gfx->CapsAdvertise = rdp_gfx_caps_advertise;
+	peerCtx->gfx->FrameAcknowledge = rdp_gfx_frame_acknowledge;
+	return;
+
+err_gfx_event:
+	wl_event_source_remove(peerCtx->gfx_event);
+err_pipe:
+	close(peerCtx->gfx_pipe[0]);
+	close(peerCtx->gfx_pipe[1]);
+err_vcm_event:
+	wl_event_source_remove(peerCtx->vcm_event);
+err_vcm:
+	WTSCloseServer(peerCtx->vcm);
+err:
+	client->settings->SupportGraphicsPipeline = FALSE;
+	weston_log("rdp: graphics pipeline unavailable for %p\n", client);
+}
+#endif
 
-	context->encode_stream = Stream_New(NULL, 65536);
+static void
+rdp_peer_context_new(freerdp_peer* client, RdpPeerContext* context)
+{
+	context->item.peer = client;
+	context->item.flags = RDP_PEER_OUTPUT_ENABLED;
+	wl_list_init(&context->outputs);
 }
 
 static void
@@ -643,10 +2373,14 @@ rdp_peer_context_free(freerdp_peer* client, RdpPeerContext* context)
 		weston_seat_release(&context->item.seat);
 	}
 
-	Stream_Free(context->encode_stream, TRUE);
-	nsc_context_free(context->nsc_context);
-	rfx_context_free(context->rfx_context);
-	free(context->rfx_rects);
+#ifdef HAVE_FREERDP_GFX
+	/* no need to delete the surfaces of a leaving peer */
+	context->gfx_ready = 0;
+#endif
+	rdp_peer_detach_encoders(context);
+#ifdef HAVE_FREERDP_GFX
+	rdp_peer_fini_gfx(context);
+#endif
 }
 
 
@@ -659,6 +2393,13 @@ rdp_client_activity(int fd, uint32_t mask, void *data)
 		weston_log("unable to checkDescriptor for %p\n", client);
 		goto out_clean;
 	}
+
+#ifdef HAVE_FREERDP_GFX
+	if (rdp_peer_check_vcm((RdpPeerContext *)client->context) < 0) {
+		weston_log("unable to check channels of %p\n", client);
+		goto out_clean;
+	}
+#endif
 	return 0;
 
 out_clean:
@@ -813,23 +2554,18 @@ xf_peer_activate(freerdp_peer* client)
 {
 	RdpPeerContext *peerCtx;
 	struct rdp_backend *b;
-	struct rdp_output *output;
 	rdpSettings *settings;
 	rdpPointerUpdate *pointer;
 	struct rdp_peers_item *peersItem;
-	struct xkb_context *xkbContext;
 	struct xkb_rule_names xkbRuleNames;
 	struct xkb_keymap *keymap;
-	int i;
-	pixman_box32_t box;
-	pixman_region32_t damage;
+	int i, width, height;
 	char seat_name[50];
 
 
 	peerCtx = (RdpPeerContext *)client->context;
 	b = peerCtx->rdpBackend;
 	peersItem = &peerCtx->item;
-	output = b->output;
 	settings = client->settings;
 
 	if (!settings->SurfaceCommandsEnabled) {
@@ -837,42 +2573,40 @@ xf_peer_activate(freerdp_peer* client)
 		return FALSE;
 	}
 
-	if (output->base.width != (int)settings->DesktopWidth ||
-			output->base.height != (int)settings->DesktopHeight)
+	/* RDP peers may not dictate their monitor layout to weston */
+	if (!b->no_clients_resize)
+		rdp_backend_apply_layout(b, peerCtx);
+
+	rdp_backend_desktop_size(b, &width, &height);
+	if (width != (int)settings->DesktopWidth ||
+			height != (int)settings->DesktopHeight)
 	{
-		if (b->no_clients_resize) {
-			/* RDP peers don't dictate their resolution to weston */
-			if (!settings->DesktopResize) {
-				/* peer does not support desktop resize */
-				weston_log("%s: client doesn't support resizing, closing connection\n", __FUNCTION__);
-				return FALSE;
-			} else {
-				settings->DesktopWidth = output->base.width;
-				settings->DesktopHeight = output->base.height;
-				client->update->DesktopResize(client->context);
-			}
+		if (!settings->DesktopResize) {
+			/* peer does not support desktop resize */
+			weston_log("%s: client doesn't support resizing, closing connection\n", __FUNCTION__);
+			return FALSE;
 		} else {
-			/* ask weston to adjust size */
-			struct weston_mode new_mode;
-			struct weston_mode *target_mode;
-			new_mode.width = (int)settings->DesktopWidth;
-			new_mode.height = (int)settings->DesktopHeight;
-			target_mode = ensure_matching_mode(&output->base, &new_mode);
-			if (!target_mode) {
-				weston_log("client mode not found\n");
-				return FALSE;
-			}
-			weston_output_mode_set_native(&output->base, target_mode, 1);
-			output->base.width = new_mode.width;
-			output->base.height = new_mode.height;
+			settings->DesktopWidth = width;
+			settings->DesktopHeight = height;
+			client->update->DesktopResize(client->context);
 		}
 	}
 
-	rfx_context_reset(peerCtx->rfx_context);
-#ifdef HAVE_NSC_RESET
-	nsc_context_reset(peerCtx->nsc_context);
+#ifdef HAVE_FRAME_ACKNOWLEDGE
+	rdp_peer_flow_init(&peerCtx->flow, settings->FrameAcknowledge);
+#else
+	rdp_peer_flow_init(&peerCtx->flow, 0);
+#endif
+#ifdef HAVE_FREERDP_GFX
+	if (!peerCtx->gfx_ready && rdp_peer_gfx_confirmed(peerCtx))
+		rdp_peer_gfx_start(peerCtx);
 #endif
 
+	if (rdp_peer_attach_encoders(peerCtx) < 0) {
+		weston_log("failed to create encoder for %p\n", client);
+		return FALSE;
+	}
+
 	if (peersItem->flags & RDP_PEER_ACTIVATED)
 		return TRUE;
 
@@ -895,15 +2629,9 @@ xf_peer_activate(freerdp_peer* client)
 	}
 
 	keymap = NULL;
-	if (xkbRuleNames.layout) {
-		xkbContext = xkb_context_new(0);
-		if (!xkbContext) {
-			weston_log("unable to create a xkb_context\n");
-			return FALSE;
-		}
-
-		keymap = xkb_keymap_new_from_names(xkbContext, &xkbRuleNames, 0);
-	}
+	if (xkbRuleNames.layout)
+		keymap = weston_compositor_compile_keymap(b->compositor,
+							  &xkbRuleNames);
 
 	if (settings->ClientHostname)
 		snprintf(seat_name, sizeof(seat_name), "RDP %s", settings->ClientHostname);
@@ -912,6 +2640,7 @@ xf_peer_activate(freerdp_peer* client)
 
 	weston_seat_init(&peersItem->seat, b->compositor, seat_name);
 	weston_seat_init_keyboard(&peersItem->seat, keymap);
+	xkb_keymap_unref(keymap);
 	weston_seat_init_pointer(&peersItem->seat);
 
 	peersItem->flags |= RDP_PEER_ACTIVATED;
@@ -922,15 +2651,7 @@ xf_peer_activate(freerdp_peer* client)
 	pointer->PointerSystem(client->context, &pointer->pointer_system);
 
 	/* sends a full refresh */
-	box.x1 = 0;
-	box.y1 = 0;
-	box.x2 = output->base.width;
-	box.y2 = output->base.height;
-	pixman_region32_init_with_extents(&damage, &box);
-
-	rdp_peer_refresh_region(&damage, client);
-
-	pixman_region32_fini(&damage);
+	rdp_peer_refresh_full(peerCtx);
 
 	return TRUE;
 }
@@ -945,12 +2666,10 @@ xf_mouseEvent(rdpInput *input, UINT16 flags, UINT16 x, UINT16 y)
 {
 	wl_fixed_t wl_x, wl_y, axis;
 	RdpPeerContext *peerContext = (RdpPeerContext *)input->context;
-	struct rdp_output *output;
 	uint32_t button = 0;
 
 	if (flags & PTR_FLAGS_MOVE) {
-		output = peerContext->rdpBackend->output;
-		if (x < output->base.width && y < output->base.height) {
+		if (rdp_backend_contains_point(peerContext->rdpBackend, x, y)) {
 			wl_x = wl_fixed_from_int((int)x);
 			wl_y = wl_fixed_from_int((int)y);
 			notify_motion_absolute(&peerContext->item.seat, weston_compositor_get_time(),
@@ -995,10 +2714,8 @@ xf_extendedMouseEvent(rdpInput *input, UINT16 flags, UINT16 x, UINT16 y)
 {
 	wl_fixed_t wl_x, wl_y;
 	RdpPeerContext *peerContext = (RdpPeerContext *)input->context;
-	struct rdp_output *output;
 
-	output = peerContext->rdpBackend->output;
-	if (x < output->base.width && y < output->base.height) {
+	if (rdp_backend_contains_point(peerContext->rdpBackend, x, y)) {
 		wl_x = wl_fixed_from_int((int)x);
 		wl_y = wl_fixed_from_int((int)y);
 		notify_motion_absolute(&peerContext->item.seat, weston_compositor_get_time(),
@@ -1012,22 +2729,11 @@ xf_extendedMouseEvent(rdpInput *input, UINT16 flags, UINT16 x, UINT16 y)
 static FREERDP_CB_RET_TYPE
 xf_input_synchronize_event(rdpInput *input, UINT32 flags)
 {
-	freerdp_peer *client = input->context->peer;
 	RdpPeerContext *peerCtx = (RdpPeerContext *)input->context;
-	struct rdp_output *output = peerCtx->rdpBackend->output;
-	pixman_box32_t box;
-	pixman_region32_t damage;
 
 	/* sends a full refresh */
-	box.x1 = 0;
-	box.y1 = 0;
-	box.x2 = output->base.width;
-	box.y2 = output->base.height;
-	pixman_region32_init_with_extents(&damage, &box);
+	rdp_peer_refresh_full(peerCtx);
 
-	rdp_peer_refresh_region(&damage, client);
-
-	pixman_region32_fini(&damage);
 	FREERDP_CB_RETURN(TRUE);
 }
 
@@ -1092,6 +2798,19 @@ xf_suppress_output(rdpContext *context, BYTE allow, RECTANGLE_16 *area)
 	FREERDP_CB_RETURN(TRUE);
 }
 
+#ifdef HAVE_FRAME_ACKNOWLEDGE
+static FREERDP_CB_RET_TYPE
+xf_surface_frame_acknowledge(rdpContext *context, UINT32 frameId)
+{
+	RdpPeerContext *peerCtx = (RdpPeerContext *)context;
+
+	rdp_peer_flow_ack(&peerCtx->flow, frameId);
+	rdp_peer_flow_acked(peerCtx);
+
+	FREERDP_CB_RETURN(TRUE);
+}
+#endif
+
 static int
 rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 {
@@ -1136,12 +2855,19 @@ rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 	settings->NSCodec = TRUE;
 	settings->FrameMarkerCommandEnabled = TRUE;
 	settings->SurfaceFrameMarkerEnabled = TRUE;
+#ifdef HAVE_FRAME_ACKNOWLEDGE
+	/* replaced by the client's own limit, 0 if it doesn't ack frames */
+	settings->FrameAcknowledge = RDP_FLOW_MAX_IN_FLIGHT;
+#endif
 
 	client->Capabilities = xf_peer_capabilities;
 	client->PostConnect = xf_peer_post_connect;
 	client->Activate = xf_peer_activate;
 
 	client->update->SuppressOutput = xf_suppress_output;
+#ifdef HAVE_FRAME_ACKNOWLEDGE
+	client->update->SurfaceFrameAcknowledge = xf_surface_frame_acknowledge;
+#endif
 
 	input = client->input;
 	input->SynchronizeEvent = xf_input_synchronize_event;
@@ -1165,7 +2891,11 @@ rdp_peer_init(freerdp_peer *client, struct rdp_backend *b)
 	for ( ; i < MAX_FREERDP_FDS; i++)
 		peerCtx->events[i] = 0;
 
-	wl_list_insert(&b->output->peers, &peerCtx->item.link);
+#ifdef HAVE_FREERDP_GFX
+	rdp_peer_init_gfx(client, loop);
+#endif
+
+	wl_list_insert(&b->peers, &peerCtx->item.link);
 	return 0;
 
 error_initialize:
@@ -1200,6 +2930,8 @@ rdp_backend_create(struct weston_compositor *compositor,
 		return NULL;
 
 	b->compositor = compositor;
+	wl_list_init(&b->outputs);
+	wl_list_init(&b->peers);
 	b->base.destroy = rdp_destroy;
 	b->base.restore = rdp_restore;
 	b->rdp_key = config->rdp_key ? strdup(config->rdp_key) : NULL;
@@ -1221,7 +2953,7 @@ rdp_backend_create(struct weston_compositor *compositor,
 	if (pixman_renderer_init(compositor) < 0)
 		goto err_compositor;
 
-	if (rdp_backend_create_output(b, config->width, config->height) < 0)
+	if (rdp_backend_create_output(b, 0, 0, config->width, config->height) < 0)
 		goto err_compositor;
 
 	compositor->capabilities |= WESTON_CAP_ARBITRARY_MODES;
@@ -1242,21 +2974,22 @@ rdp_backend_create(struct weston_compositor *compositor,
 		fd_str = getenv("RDP_FD");
 		if (!fd_str) {
 			weston_log("RDP_FD env variable not set");
-			goto err_output;
+			goto err_compositor;
 		}
 
 		fd = strtoul(fd_str, NULL, 10);
 		if (rdp_peer_init(freerdp_peer_new(fd), b))
-			goto err_output;
+			goto err_compositor;
 	}
 
+	if (linux_dmabuf_setup(compositor) < 0)
+		weston_log("Error: initializing dmabuf support failed.\n");
+
 	compositor->backend = &b->base;
 	return b;
 
 err_listener:
 	freerdp_listener_free(b->listener);
-err_output:
-	weston_output_destroy(&b->output->base);
 err_compositor:
 	weston_compositor_shutdown(compositor);
 err_free_strings:
@@ -47,7 +47,10 @@
 #include "shared/os-compatibility.h"
 #include "shared/cairo-util.h"
 #include "fullscreen-shell-client-protocol.h"
+#include "linux-dmabuf-client-protocol.h"
+#include "presentation_timing-client-protocol.h"
 #include "presentation_timing-server-protocol.h"
+#include "linux-dmabuf.h"
 
 #define WINDOW_TITLE "Weston Compositor"
 
@@ -62,8 +65,15 @@ struct wayland_backend {
 		struct wl_shell *shell;
 		struct _wl_fullscreen_shell *fshell;
 		struct wl_shm *shm;
+		struct wl_subcompositor *subcompositor;
+		struct zlinux_dmabuf *dmabuf;
+		/* Only kept when the parent's clock is usable as ours */
+		struct presentation *presentation;
+		clockid_t presentation_clock;
 
 		struct wl_list output_list;
+		/* Client dmabufs recreated as parent wl_buffers */
+		struct wl_list dmabuf_list;
 
 		struct wl_event_source *wl_source;
 		uint32_t event_mask;
@@ -94,6 +104,15 @@ struct wayland_output {
 		int configure_width, configure_height;
 	} parent;
 
+	/* A parent subsurface showing a client dmabuf without
+	 * compositing it, and the plane standing for it */
+	struct {
+		struct wl_surface *surface;
+		struct wl_subsurface *subsurface;
+		struct weston_plane plane;
+		int attached;
+	} overlay;
+
 	int keyboard_count;
 
 	char *name;
@@ -149,13 +168,34 @@ struct wayland_shm_buffer {
 	struct wl_buffer *buffer;
 	void *data;
 	size_t size;
+	/* To repaint before the buffer is drawn again: the damage of
+	 * every frame since it was last drawn into */
 	pixman_region32_t damage;
 	int frame_damaged;
+	int attached;
 
 	pixman_image_t *pm_image;
 	cairo_surface_t *c_surface;
 };
 
+/* A client dmabuf buffer and the same dmabuf imported into the parent
+ * compositor.  The import is asynchronous, so the buffer only goes to
+ * the overlay once the parent has created its wl_buffer. */
+struct wayland_dmabuf_buffer {
+	struct wayland_backend *backend;
+	struct wl_list link;
+
+	struct linux_dmabuf_buffer *dmabuf;
+	struct wl_listener destroy_listener;
+
+	struct zlinux_buffer_params *params;
+	struct wl_buffer *buffer;
+	int failed;
+
+	/* Held while the parent uses the buffer */
+	struct weston_buffer_reference buffer_ref;
+};
+
 struct wayland_input {
 	struct weston_seat base;
 	struct wayland_backend *backend;
@@ -316,8 +356,6 @@ frame_done(void *data, struct wl_callback *callback, uint32_t time)
 
 	wl_callback_destroy(callback);
 
-	/* XXX: use the presentation extension for proper timings */
-
 	/*
 	 * This is the fallback case, where Presentation extension is not
 	 * available from the parent compositor. We do not know the base for
@@ -333,6 +371,86 @@ static const struct wl_callback_listener frame_listener = {
 	frame_done
 };
 
+static void
+feedback_sync_output(void *data, struct presentation_feedback *feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data, struct presentation_feedback *feedback,
+		   uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+		   uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct weston_output *output = data;
+	struct timespec ts;
+	uint64_t seq;
+
+	presentation_feedback_destroy(feedback);
+
+	ts.tv_sec = ((uint64_t) tv_sec_hi << 32) + tv_sec_lo;
+	ts.tv_nsec = tv_nsec;
+
+	/* Repaint at the rate the parent really presents at */
+	if (refresh > 0)
+		output->current_mode->refresh =
+			(1000000000000ULL + refresh / 2) / refresh;
+
+	seq = ((uint64_t) seq_hi << 32) + seq_lo;
+	if (seq)
+		output->msc = seq;
+	else
+		output->msc++;
+
+	/* Zero-copy is decided per view by assign_planes, the rest
+	 * describes our frame as much as the parent's. */
+	weston_output_finish_frame(output, &ts,
+				   flags & ~PRESENTATION_FEEDBACK_KIND_ZERO_COPY);
+}
+
+static void
+feedback_discarded(void *data, struct presentation_feedback *feedback)
+{
+	struct weston_output *output = data;
+	struct timespec ts;
+
+	presentation_feedback_destroy(feedback);
+
+	/* Keep the repaint loop going, there is no better timestamp */
+	weston_compositor_read_presentation_clock(output->compositor, &ts);
+	weston_output_finish_frame(output, &ts, 0);
+}
+
+static const struct presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+/* Ask to hear about the next commit of the output surface, through
+ * presentation feedback when the parent supports it. */
+static void
+wayland_output_request_frame(struct wayland_output *output)
+{
+	struct wayland_backend *b =
+		(struct wayland_backend *) output->base.compositor->backend;
+	struct presentation_feedback *feedback;
+	struct wl_callback *callback;
+
+	if (b->parent.presentation) {
+		feedback = presentation_feedback(b->parent.presentation,
+						 output->parent.surface);
+		presentation_feedback_add_listener(feedback,
+						   &feedback_listener,
+						   &output->base);
+	} else {
+		callback = wl_surface_frame(output->parent.surface);
+		wl_callback_add_listener(callback, &frame_listener,
+					 &output->base);
+	}
+}
+
 static void
 draw_initial_frame(struct wayland_output *output)
 {
@@ -427,7 +545,6 @@ wayland_output_start_repaint_loop(struct weston_output *output_base)
 	struct wayland_output *output = (struct wayland_output *) output_base;
 	struct wayland_backend *wb =
 		(struct wayland_backend *)output->base.compositor->backend;
-	struct wl_callback *callback;
 
 	/* If this is the initial frame, we need to attach a buffer so that
 	 * the compositor can map the surface and include it in its render
@@ -440,8 +557,7 @@ wayland_output_start_repaint_loop(struct weston_output *output_base)
 		draw_initial_frame(output);
 	}
 
-	callback = wl_surface_frame(output->parent.surface);
-	wl_callback_add_listener(callback, &frame_listener, output);
+	wayland_output_request_frame(output);
 	wl_surface_commit(output->parent.surface);
 	wl_display_flush(wb->parent.wl_display);
 }
@@ -452,10 +568,8 @@ wayland_output_repaint_gl(struct weston_output *output_base,
 {
 	struct wayland_output *output = (struct wayland_output *) output_base;
 	struct weston_compositor *ec = output->base.compositor;
-	struct wl_callback *callback;
 
-	callback = wl_surface_frame(output->parent.surface);
-	wl_callback_add_listener(callback, &frame_listener, output);
+	wayland_output_request_frame(output);
 
 	wayland_output_update_gl_border(output);
 
@@ -506,16 +620,30 @@ wayland_output_update_shm_border(struct wayland_shm_buffer *buffer)
 	cairo_destroy(cr);
 }
 
+/* Attach the buffer, damaging the parent surface only where it differs
+ * from the buffer attached before: the damage of this frame, or the
+ * whole buffer the first time it is used.
+ *
+ * \param frame_damage The damage of this frame.
+ * \param border_damaged Whether the decorations changed in this frame.
+ */
 static void
-wayland_shm_buffer_attach(struct wayland_shm_buffer *sb)
+wayland_shm_buffer_attach(struct wayland_shm_buffer *sb,
+			  pixman_region32_t *frame_damage, int border_damaged)
 {
 	pixman_region32_t damage;
 	pixman_box32_t *rects;
 	int32_t ix, iy, iwidth, iheight, fwidth, fheight;
 	int i, n;
 
+	if (!sb->attached) {
+		frame_damage = &sb->damage;
+		border_damaged = 1;
+		sb->attached = 1;
+	}
+
 	pixman_region32_init(&damage);
-	pixman_region32_copy(&damage, &sb->damage);
+	pixman_region32_copy(&damage, frame_damage);
 	pixman_region32_translate(&damage, sb->output->base.x, sb->output->base.y);
 	weston_matrix_transform_region(&damage, &sb->output->base.matrix, &damage);
 
@@ -526,7 +654,7 @@ wayland_shm_buffer_attach(struct wayland_shm_buffer *sb)
 
 		pixman_region32_translate(&damage, ix, iy);
 
-		if (sb->frame_damaged) {
+		if (border_damaged) {
 			pixman_region32_union_rect(&damage, &damage,
 						   0, 0, fwidth, iy);
 			pixman_region32_union_rect(&damage, &damage,
@@ -547,8 +675,7 @@ wayland_shm_buffer_attach(struct wayland_shm_buffer *sb)
 				  rects[i].y1, rects[i].x2 - rects[i].x1,
 				  rects[i].y2 - rects[i].y1);
 
-	if (sb->output->frame)
-		pixman_region32_fini(&damage);
+	pixman_region32_fini(&damage);
 }
 
 static int
@@ -558,13 +685,15 @@ wayland_output_repaint_pixman(struct weston_output *output_base,
 	struct wayland_output *output = (struct wayland_output *) output_base;
 	struct wayland_backend *b =
 		(struct wayland_backend *)output->base.compositor->backend;
-	struct wl_callback *callback;
 	struct wayland_shm_buffer *sb;
+	int border_damaged = 0;
 
 	if (output->frame) {
-		if (frame_status(output->frame) & FRAME_STATUS_REPAINT)
+		if (frame_status(output->frame) & FRAME_STATUS_REPAINT) {
 			wl_list_for_each(sb, &output->shm.buffers, link)
 				sb->frame_damaged = 1;
+			border_damaged = 1;
+		}
 	}
 
 	wl_list_for_each(sb, &output->shm.buffers, link)
@@ -576,10 +705,9 @@ wayland_output_repaint_pixman(struct weston_output *output_base,
 	pixman_renderer_output_set_buffer(output_base, sb->pm_image);
 	b->compositor->renderer->repaint_output(output_base, &sb->damage);
 
-	wayland_shm_buffer_attach(sb);
+	wayland_shm_buffer_attach(sb, damage, border_damaged);
 
-	callback = wl_surface_frame(output->parent.surface);
-	wl_callback_add_listener(callback, &frame_listener, output);
+	wayland_output_request_frame(output);
 	wl_surface_commit(output->parent.surface);
 	wl_display_flush(b->parent.wl_display);
 
@@ -606,6 +734,11 @@ wayland_output_destroy(struct weston_output *output_base)
 	}
 
 	wl_egl_window_destroy(output->gl.egl_window);
+	if (output->overlay.subsurface) {
+		wl_subsurface_destroy(output->overlay.subsurface);
+		wl_surface_destroy(output->overlay.surface);
+		weston_plane_release(&output->overlay.plane);
+	}
 	wl_surface_destroy(output->parent.surface);
 	if (output->parent.shell_surface)
 		wl_shell_surface_destroy(output->parent.shell_surface);
@@ -978,6 +1111,264 @@ err_output:
 	return -1;
 }
 
+static void
+wayland_dmabuf_buffer_free(struct wayland_dmabuf_buffer *dbuf)
+{
+	weston_buffer_reference(&dbuf->buffer_ref, NULL);
+	if (dbuf->buffer)
+		wl_buffer_destroy(dbuf->buffer);
+	free(dbuf);
+}
+
+static void
+wayland_dmabuf_buffer_destroy_handler(struct wl_listener *listener,
+				      void *data)
+{
+	struct wayland_dmabuf_buffer *dbuf =
+		container_of(listener, struct wayland_dmabuf_buffer,
+			     destroy_listener);
+
+	wl_list_remove(&dbuf->link);
+	wl_list_remove(&dbuf->destroy_listener.link);
+	dbuf->dmabuf = NULL;
+
+	/* The parent still owes us a created or failed event, which
+	 * frees the buffer then. */
+	if (dbuf->params)
+		return;
+
+	wayland_dmabuf_buffer_free(dbuf);
+}
+
+static void
+wayland_dmabuf_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct wayland_dmabuf_buffer *dbuf = data;
+
+	weston_buffer_reference(&dbuf->buffer_ref, NULL);
+}
+
+static const struct wl_buffer_listener wayland_dmabuf_buffer_listener = {
+	wayland_dmabuf_buffer_release
+};
+
+static void
+wayland_dmabuf_params_created(void *data,
+			      struct zlinux_buffer_params *params,
+			      struct wl_buffer *buffer)
+{
+	struct wayland_dmabuf_buffer *dbuf = data;
+
+	zlinux_buffer_params_destroy(dbuf->params);
+	dbuf->params = NULL;
+	dbuf->buffer = buffer;
+	wl_buffer_add_listener(buffer, &wayland_dmabuf_buffer_listener, dbuf);
+
+	if (!dbuf->dmabuf) {
+		wayland_dmabuf_buffer_free(dbuf);
+		return;
+	}
+
+	/* Let the next repaint put it on the overlay */
+	weston_compositor_schedule_repaint(dbuf->backend->compositor);
+}
+
+static void
+wayland_dmabuf_params_failed(void *data, struct zlinux_buffer_params *params)
+{
+	struct wayland_dmabuf_buffer *dbuf = data;
+
+	zlinux_buffer_params_destroy(dbuf->params);
+	dbuf->params = NULL;
+	dbuf->failed = 1;
+
+	if (!dbuf->dmabuf)
+		wayland_dmabuf_buffer_free(dbuf);
+}
+
+static const struct zlinux_buffer_params_listener wayland_dmabuf_params_listener = {
+	wayland_dmabuf_params_created,
+	wayland_dmabuf_params_failed
+};
+
+/* Find the parent import of a client dmabuf, starting one if there is
+ * none yet. */
+static struct wayland_dmabuf_buffer *
+wayland_backend_get_dmabuf_buffer(struct wayland_backend *b,
+				  struct linux_dmabuf_buffer *dmabuf)
+{
+	struct wayland_dmabuf_buffer *dbuf;
+	int i;
+
+	wl_list_for_each(dbuf, &b->parent.dmabuf_list, link)
+		if (dbuf->dmabuf == dmabuf)
+			return dbuf;
+
+	dbuf = zalloc(sizeof *dbuf);
+	if (!dbuf)
+		return NULL;
+
+	dbuf->backend = b;
+	dbuf->dmabuf = dmabuf;
+	dbuf->destroy_listener.notify = wayland_dmabuf_buffer_destroy_handler;
+	wl_resource_add_destroy_listener(dmabuf->buffer_resource,
+					 &dbuf->destroy_listener);
+	wl_list_insert(&b->parent.dmabuf_list, &dbuf->link);
+
+	dbuf->params = zlinux_dmabuf_create_params(b->parent.dmabuf);
+	for (i = 0; i < dmabuf->n_planes; i++)
+		zlinux_buffer_params_add(dbuf->params, dmabuf->dmabuf_fd[i], i,
+					 dmabuf->offset[i], dmabuf->stride[i],
+					 dmabuf->modifier[i] >> 32,
+					 dmabuf->modifier[i] & 0xffffffff);
+	zlinux_buffer_params_add_listener(dbuf->params,
+					  &wayland_dmabuf_params_listener,
+					  dbuf);
+	zlinux_buffer_params_create(dbuf->params, dmabuf->width,
+				    dmabuf->height, dmabuf->format,
+				    dmabuf->flags);
+
+	return dbuf;
+}
+
+/* Whether the view can be shown by the parent compositor as is: an
+ * opaque, untransformed dmabuf covering exactly the whole output. */
+static struct linux_dmabuf_buffer *
+wayland_output_overlay_dmabuf(struct wayland_output *output,
+			      struct weston_view *ev)
+{
+	struct weston_surface *es = ev->surface;
+	struct weston_buffer_viewport *vp = &es->buffer_viewport;
+	struct linux_dmabuf_buffer *dmabuf;
+	pixman_box32_t *box;
+
+	if (!es->buffer_ref.buffer)
+		return NULL;
+
+	dmabuf = linux_dmabuf_buffer_get(es->buffer_ref.buffer->resource);
+	if (!dmabuf)
+		return NULL;
+
+	if (ev->alpha != 1.0f)
+		return NULL;
+
+	if (ev->transform.enabled &&
+	    ev->transform.matrix.type & ~WESTON_MATRIX_TRANSFORM_TRANSLATE)
+		return NULL;
+
+	if (output->base.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    output->base.current_scale != 1)
+		return NULL;
+
+	if (vp->buffer.transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+	    vp->buffer.scale != 1 ||
+	    vp->buffer.src_width != wl_fixed_from_int(-1) ||
+	    vp->surface.width != -1)
+		return NULL;
+
+	box = pixman_region32_extents(&ev->transform.boundingbox);
+	if (box->x1 != output->base.x || box->y1 != output->base.y ||
+	    box->x2 != output->base.x + output->base.width ||
+	    box->y2 != output->base.y + output->base.height)
+		return NULL;
+
+	return dmabuf;
+}
+
+static void
+wayland_output_assign_planes(struct weston_output *output_base)
+{
+	struct wayland_output *output = (struct wayland_output *) output_base;
+	struct wayland_backend *b =
+		(struct wayland_backend *) output->base.compositor->backend;
+	struct weston_plane *primary = &b->compositor->primary_plane;
+	struct weston_view *ev, **views, *overlay_view = NULL;
+	struct linux_dmabuf_buffer *dmabuf = NULL;
+	struct wayland_dmabuf_buffer *dbuf = NULL;
+	size_t i, n;
+	int32_t ix = 0, iy = 0;
+
+	views = output->base.view_list.data;
+	n = output->base.view_list.size / sizeof *views;
+
+	/* Only the topmost view can go to the overlay, anything above
+	 * it would have to be composited on top of the parent's. */
+	if (n > 0 && !output->base.disable_planes)
+		dmabuf = wayland_output_overlay_dmabuf(output, views[0]);
+	if (dmabuf)
+		dbuf = wayland_backend_get_dmabuf_buffer(b, dmabuf);
+	if (dbuf && dbuf->buffer)
+		overlay_view = views[0];
+
+	for (i = 0; i < n; i++) {
+		ev = views[i];
+		ev->surface->keep_buffer = ev == views[0] && dmabuf;
+
+		if (ev == overlay_view) {
+			weston_view_move_to_plane(ev, &output->overlay.plane);
+			ev->psf_flags = PRESENTATION_FEEDBACK_KIND_ZERO_COPY;
+		} else {
+			weston_view_move_to_plane(ev, primary);
+			ev->psf_flags = 0;
+		}
+	}
+
+	/* The subsurface is synchronized, so this only shows with the
+	 * commit of the parent surface in repaint. */
+	if (overlay_view) {
+		if (output->frame)
+			frame_interior(output->frame, &ix, &iy, NULL, NULL);
+		wl_subsurface_set_position(output->overlay.subsurface, ix, iy);
+		wl_surface_attach(output->overlay.surface, dbuf->buffer, 0, 0);
+		wl_surface_damage(output->overlay.surface, 0, 0,
+				  dmabuf->width, dmabuf->height);
+		wl_surface_commit(output->overlay.surface);
+		weston_buffer_reference(&dbuf->buffer_ref,
+					overlay_view->surface->buffer_ref.buffer);
+		output->overlay.attached = 1;
+	} else if (output->overlay.attached) {
+		wl_surface_attach(output->overlay.surface, NULL, 0, 0);
+		wl_surface_commit(output->overlay.surface);
+		output->overlay.attached = 0;
+	}
+}
+
+static int
+wayland_output_create_overlay(struct wayland_output *output)
+{
+	struct wayland_backend *b =
+		(struct wayland_backend *) output->base.compositor->backend;
+	struct wl_region *region;
+
+	output->overlay.surface =
+		wl_compositor_create_surface(b->parent.compositor);
+	if (!output->overlay.surface)
+		return -1;
+
+	output->overlay.subsurface =
+		wl_subcompositor_get_subsurface(b->parent.subcompositor,
+						output->overlay.surface,
+						output->parent.surface);
+	if (!output->overlay.subsurface) {
+		wl_surface_destroy(output->overlay.surface);
+		output->overlay.surface = NULL;
+		return -1;
+	}
+	wl_subsurface_set_sync(output->overlay.subsurface);
+
+	/* Input goes to the output surface beneath, which is the one
+	 * the input handlers know. */
+	region = wl_compositor_create_region(b->parent.compositor);
+	wl_surface_set_input_region(output->overlay.surface, region);
+	wl_region_destroy(region);
+
+	weston_plane_init(&output->overlay.plane, b->compositor, 0, 0);
+	weston_compositor_stack_plane(b->compositor,
+				      &output->overlay.plane, NULL);
+
+	return 0;
+}
+
 static struct wayland_output *
 wayland_output_create(struct wayland_backend *b, int x, int y,
 		      int width, int height, const char *name, int fullscreen,
@@ -1054,9 +1445,17 @@ wayland_output_create(struct wayland_backend *b, int x, int y,
 		output->base.repaint = wayland_output_repaint_gl;
 	}
 
+	/* Without the overlay, or when wayland_output_create_overlay
+	 * fails, every view simply stays composited. */
+	if (b->parent.subcompositor && b->parent.dmabuf)
+		wayland_output_create_overlay(output);
+
 	output->base.start_repaint_loop = wayland_output_start_repaint_loop;
 	output->base.destroy = wayland_output_destroy;
-	output->base.assign_planes = NULL;
+	if (output->overlay.subsurface)
+		output->base.assign_planes = wayland_output_assign_planes;
+	else
+		output->base.assign_planes = NULL;
 	output->base.set_backlight = NULL;
 	output->base.set_dpms = NULL;
 	output->base.switch_mode = wayland_output_switch_mode;
@@ -1800,6 +2199,19 @@ wayland_parent_output_destroy(struct wayland_parent_output *output)
 	}
 }
 
+static void
+presentation_handle_clock_id(void *data, struct presentation *presentation,
+			     uint32_t clk_id)
+{
+	struct wayland_backend *b = data;
+
+	b->parent.presentation_clock = clk_id;
+}
+
+static const struct presentation_listener presentation_listener = {
+	presentation_handle_clock_id
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 		       const char *interface, uint32_t version)
@@ -1825,6 +2237,20 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t name,
 	} else if (strcmp(interface, "wl_shm") == 0) {
 		b->parent.shm =
 			wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, "wl_subcompositor") == 0) {
+		b->parent.subcompositor =
+			wl_registry_bind(registry, name,
+					 &wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, "presentation") == 0) {
+		b->parent.presentation =
+			wl_registry_bind(registry, name,
+					 &presentation_interface, 1);
+		presentation_add_listener(b->parent.presentation,
+					  &presentation_listener, b);
+	} else if (strcmp(interface, "zlinux_dmabuf") == 0) {
+		b->parent.dmabuf =
+			wl_registry_bind(registry, name,
+					 &zlinux_dmabuf_interface, 1);
 	}
 }
 
@@ -1878,11 +2304,25 @@ static void
 wayland_destroy(struct weston_compositor *ec)
 {
 	struct wayland_backend *b = (struct wayland_backend *) ec->backend;
+	struct wayland_dmabuf_buffer *dbuf, *next;
 
 	weston_compositor_shutdown(ec);
 
+	wl_list_for_each_safe(dbuf, next, &b->parent.dmabuf_list, link) {
+		wl_list_remove(&dbuf->destroy_listener.link);
+		if (dbuf->params)
+			zlinux_buffer_params_destroy(dbuf->params);
+		wayland_dmabuf_buffer_free(dbuf);
+	}
+
 	if (b->parent.shm)
 		wl_shm_destroy(b->parent.shm);
+	if (b->parent.subcompositor)
+		wl_subcompositor_destroy(b->parent.subcompositor);
+	if (b->parent.dmabuf)
+		zlinux_dmabuf_destroy(b->parent.dmabuf);
+	if (b->parent.presentation)
+		presentation_destroy(b->parent.presentation);
 
 	free(b);
 }
@@ -1970,11 +2410,28 @@ wayland_backend_create(struct weston_compositor *compositor, int use_pixman,
 	}
 
 	wl_list_init(&b->parent.output_list);
+	wl_list_init(&b->parent.dmabuf_list);
 	wl_list_init(&b->input_list);
+	b->parent.presentation_clock = -1;
 	b->parent.registry = wl_display_get_registry(b->parent.wl_display);
 	wl_registry_add_listener(b->parent.registry, &registry_listener, b);
 	wl_display_roundtrip(b->parent.wl_display);
 
+	/* Parent timestamps are only of use in our own clock domain,
+	 * so switch to the parent's clock or don't use them. */
+	if (b->parent.presentation) {
+		if (b->parent.presentation_clock == (clockid_t) -1)
+			wl_display_roundtrip(b->parent.wl_display);
+		if (b->parent.presentation_clock == (clockid_t) -1 ||
+		    weston_compositor_set_presentation_clock(compositor,
+				b->parent.presentation_clock) < 0) {
+			weston_log("parent presentation clock unusable, "
+				   "falling back to frame callbacks\n");
+			presentation_destroy(b->parent.presentation);
+			b->parent.presentation = NULL;
+		}
+	}
+
 	create_cursor(b, config);
 
 	b->use_pixman = use_pixman;
@@ -40,6 +40,9 @@
 
 #include <xcb/xcb.h>
 #include <xcb/shm.h>
+#ifdef HAVE_XCB_PRESENT
+#include <xcb/present.h>
+#endif
 #ifdef HAVE_XCB_XKB
 #include <xcb/xkb.h>
 #endif
@@ -78,6 +81,9 @@ struct x11_backend {
 	struct xkb_keymap	*xkb_keymap;
 	unsigned int		 has_xkb;
 	uint8_t			 xkb_event_base;
+	uint8_t			 shm_event_base;
+	int			 has_present;
+	uint8_t			 present_opcode;
 	int			 use_pixman;
 
 	int			 has_net_wm_state_fullscreen;
@@ -121,6 +127,12 @@ struct x11_output {
 	void		       *buf;
 	uint8_t			depth;
 	int32_t                 scale;
+
+	/* A frame is finished once it is due, by the timer or a Present
+	 * CompleteNotify, and the server has read the SHM segment. */
+	int			frame_due;
+	int			shm_busy;
+	uint32_t		present_serial;
 };
 
 struct window_delete_data {
@@ -166,7 +178,7 @@ x11_backend_get_keymap(struct x11_backend *b)
 	copy_prop_value(options);
 #undef copy_prop_value
 
-	ret = xkb_keymap_new_from_names(b->compositor->xkb_context, &names, 0);
+	ret = weston_compositor_compile_keymap(b->compositor, &names);
 
 	free(reply);
 	return ret;
@@ -345,6 +357,38 @@ x11_input_create(struct x11_backend *b, int no_input)
 	return 0;
 }
 
+/* Present paces the SHM path at the refresh rate of the X server */
+static void
+x11_backend_setup_present(struct x11_backend *b)
+{
+#ifdef HAVE_XCB_PRESENT
+	const xcb_query_extension_reply_t *ext;
+	xcb_present_query_version_cookie_t cookie;
+	xcb_present_query_version_reply_t *reply;
+
+	b->has_present = 0;
+
+	ext = xcb_get_extension_data(b->conn, &xcb_present_id);
+	if (!ext || !ext->present) {
+		weston_log("Present extension not available on host X11 server\n");
+		return;
+	}
+
+	cookie = xcb_present_query_version(b->conn,
+					   XCB_PRESENT_MAJOR_VERSION,
+					   XCB_PRESENT_MINOR_VERSION);
+	reply = xcb_present_query_version_reply(b->conn, cookie, NULL);
+	if (!reply)
+		return;
+	free(reply);
+
+	b->present_opcode = ext->major_opcode;
+	b->has_present = 1;
+#else
+	b->has_present = 0;
+#endif
+}
+
 static void
 x11_input_destroy(struct x11_backend *b)
 {
@@ -377,48 +421,74 @@ x11_output_repaint_gl(struct weston_output *output_base,
 }
 
 static void
-set_clip_for_output(struct weston_output *output_base, pixman_region32_t *region)
+x11_output_finish_frame(struct x11_output *output)
 {
-	struct x11_output *output = (struct x11_output *)output_base;
-	struct weston_compositor *ec = output->base.compositor;
-	struct x11_backend *b = (struct x11_backend *)ec->backend;
+	struct timespec ts;
+
+	if (!output->frame_due || output->shm_busy)
+		return;
+
+	output->frame_due = 0;
+	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
+	weston_output_finish_frame(&output->base, &ts, 0);
+}
+
+/* Ask for the frame to be finished at the next vblank of the X server,
+ * or after a fixed delay without the Present extension. */
+static void
+x11_output_schedule_frame(struct x11_output *output)
+{
+#ifdef HAVE_XCB_PRESENT
+	struct x11_backend *b =
+		(struct x11_backend *)output->base.compositor->backend;
+
+	if (b->has_present) {
+		xcb_present_notify_msc(b->conn, output->window,
+				       ++output->present_serial, 0, 1, 0);
+		xcb_flush(b->conn);
+		return;
+	}
+#endif
+
+	wl_event_source_timer_update(output->finish_frame_timer, 10);
+}
+
+/* Copy only the damaged rectangles of the SHM segment to the window,
+ * without waiting for the server. The last request asks for a
+ * ShmCompletion event, after which the segment may be drawn again. */
+static void
+x11_output_put_damage(struct x11_output *output, pixman_region32_t *region)
+{
+	struct x11_backend *b =
+		(struct x11_backend *)output->base.compositor->backend;
+	int width = pixman_image_get_width(output->hw_surface);
+	int height = pixman_image_get_height(output->hw_surface);
 	pixman_region32_t transformed_region;
 	pixman_box32_t *rects;
-	xcb_rectangle_t *output_rects;
-	xcb_void_cookie_t cookie;
 	int nrects, i;
-	xcb_generic_error_t *err;
 
 	pixman_region32_init(&transformed_region);
-	weston_matrix_transform_region(&transformed_region, &output_base->matrix, region);
+	weston_matrix_transform_region(&transformed_region,
+				       &output->base.matrix, region);
+	pixman_region32_intersect_rect(&transformed_region,
+				       &transformed_region,
+				       0, 0, width, height);
 
 	rects = pixman_region32_rectangles(&transformed_region, &nrects);
-	output_rects = calloc(nrects, sizeof(xcb_rectangle_t));
-
-	if (output_rects == NULL) {
-		pixman_region32_fini(&transformed_region);
-		return;
-	}
-
-	for (i = 0; i < nrects; i++) {
-		output_rects[i].x = rects[i].x1;
-		output_rects[i].y = rects[i].y1;
-		output_rects[i].width = rects[i].x2 - rects[i].x1;
-		output_rects[i].height = rects[i].y2 - rects[i].y1;
-	}
+	for (i = 0; i < nrects; i++)
+		xcb_shm_put_image(b->conn, output->window, output->gc,
+				  width, height,
+				  rects[i].x1, rects[i].y1,
+				  rects[i].x2 - rects[i].x1,
+				  rects[i].y2 - rects[i].y1,
+				  rects[i].x1, rects[i].y1,
+				  output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				  i == nrects - 1, output->segment, 0);
+
+	if (nrects > 0)
+		output->shm_busy = 1;
 
 	pixman_region32_fini(&transformed_region);
-
-	cookie = xcb_set_clip_rectangles_checked(b->conn, XCB_CLIP_ORDERING_UNSORTED,
-					output->gc,
-					0, 0, nrects,
-					output_rects);
-	err = xcb_request_check(b->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to set clip rects, err: %d\n", err->error_code);
-		free(err);
-	}
-	free(output_rects);
 }
 
 
@@ -428,31 +498,16 @@ x11_output_repaint_shm(struct weston_output *output_base,
 {
 	struct x11_output *output = (struct x11_output *)output_base;
 	struct weston_compositor *ec = output->base.compositor;
-	struct x11_backend *b = (struct x11_backend *)ec->backend;
-	xcb_void_cookie_t cookie;
-	xcb_generic_error_t *err;
 
 	pixman_renderer_output_set_buffer(output_base, output->hw_surface);
 	ec->renderer->repaint_output(output_base, damage);
 
 	pixman_region32_subtract(&ec->primary_plane.damage,
 				 &ec->primary_plane.damage, damage);
-	set_clip_for_output(output_base, damage);
-	cookie = xcb_shm_put_image_checked(b->conn, output->window, output->gc,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0,
-					pixman_image_get_width(output->hw_surface),
-					pixman_image_get_height(output->hw_surface),
-					0, 0, output->depth, XCB_IMAGE_FORMAT_Z_PIXMAP,
-					0, output->segment, 0);
-	err = xcb_request_check(b->conn, cookie);
-	if (err != NULL) {
-		weston_log("Failed to put shm image, err: %d\n", err->error_code);
-		free(err);
-	}
+	x11_output_put_damage(output, damage);
 
-	wl_event_source_timer_update(output->finish_frame_timer, 10);
+	output->frame_due = 0;
+	x11_output_schedule_frame(output);
 	return 0;
 }
 
@@ -460,10 +515,9 @@ static int
 finish_frame_handler(void *data)
 {
 	struct x11_output *output = data;
-	struct timespec ts;
 
-	weston_compositor_read_presentation_clock(output->base.compositor, &ts);
-	weston_output_finish_frame(&output->base, &ts, 0);
+	output->frame_due = 1;
+	x11_output_finish_frame(output);
 
 	return 1;
 }
@@ -679,6 +733,7 @@ x11_output_init_shm(struct x11_backend *b, struct x11_output *output,
 		errno = ENOENT;
 		return -1;
 	}
+	b->shm_event_base = ext->first_event;
 
 	iter = xcb_setup_roots_iterator(xcb_get_setup(b->conn));
 	visual_type = find_visual_by_id(iter.data, iter.data->root_visual);
@@ -907,6 +962,13 @@ x11_backend_create_output(struct x11_backend *b, int x, int y,
 			x11_output_deinit_shm(b, output);
 			return NULL;
 		}
+#ifdef HAVE_XCB_PRESENT
+		if (b->has_present)
+			xcb_present_select_input(b->conn,
+						 xcb_generate_id(b->conn),
+						 output->window,
+						 XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+#endif
 	} else {
 		/* eglCreatePlatformWindowSurfaceEXT takes a Window*
 		 * but eglCreateWindowSurface takes a Window. */
@@ -1356,6 +1418,41 @@ x11_backend_handle_event(int fd, uint32_t mask, void *data)
 			break;
 		}
 
+		if (b->shm_event_base &&
+		    response_type == b->shm_event_base + XCB_SHM_COMPLETION) {
+			xcb_shm_completion_event_t *completion =
+				(xcb_shm_completion_event_t *) event;
+
+			output = x11_backend_find_output(b,
+							 completion->drawable);
+			if (output) {
+				output->shm_busy = 0;
+				x11_output_finish_frame(output);
+			}
+		}
+
+#ifdef HAVE_XCB_PRESENT
+		if (b->has_present && response_type == XCB_GE_GENERIC) {
+			xcb_present_complete_notify_event_t *complete =
+				(xcb_present_complete_notify_event_t *) event;
+
+			if (complete->extension == b->present_opcode &&
+			    complete->event_type ==
+			    XCB_PRESENT_EVENT_COMPLETE_NOTIFY)
+				output = x11_backend_find_output(b,
+								 complete->window);
+			else
+				output = NULL;
+
+			/* Stale notifies are for frames already finished */
+			if (output &&
+			    complete->serial == output->present_serial) {
+				output->frame_due = 1;
+				x11_output_finish_frame(output);
+			}
+		}
+#endif
+
 #ifdef HAVE_XCB_XKB
 		if (b->has_xkb) {
 			if (response_type == b->xkb_event_base) {
@@ -1564,6 +1661,8 @@ x11_backend_create(struct weston_compositor *compositor,
 	}
 
 	b->use_pixman = use_pixman;
+	if (b->use_pixman)
+		x11_backend_setup_present(b);
 	if (b->use_pixman) {
 		if (pixman_renderer_init(compositor) < 0) {
 			weston_log("Failed to initialize pixman renderer for X11 backend\n");
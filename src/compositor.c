@@ -32,6 +32,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <assert.h>
@@ -52,10 +53,14 @@
 #include <errno.h>
 
 #include "timeline.h"
+#include "frame-stats.h"
 
 #include "compositor.h"
 #include "scaler-server-protocol.h"
 #include "presentation_timing-server-protocol.h"
+#include "linux-explicit-synchronization.h"
+#include "tearing-control-server-protocol.h"
+#include "resource-usage-server-protocol.h"
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
 #include "shared/timespec-util.h"
@@ -63,6 +68,7 @@
 #include "version.h"
 
 #define DEFAULT_REPAINT_WINDOW 7 /* milliseconds */
+#define REPAINT_WINDOW_MARGIN 1000000 /* nanoseconds */
 
 static void
 weston_output_transform_scale_init(struct weston_output *output,
@@ -71,6 +77,9 @@ weston_output_transform_scale_init(struct weston_output *output,
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor);
 
+static void
+weston_compositor_dirty_view_outputs(struct weston_compositor *compositor);
+
 static void weston_mode_switch_finish(struct weston_output *output,
 				      int mode_changed,
 				      int scale_changed)
@@ -91,6 +100,7 @@ static void weston_mode_switch_finish(struct weston_output *output,
 				  output->width, output->height);
 
 	weston_output_update_matrix(output);
+	weston_compositor_dirty_view_outputs(output->compositor);
 
 	/* If a pointer falls outside the outputs new geometry, move it to its
 	 * lower-right corner */
@@ -386,9 +396,27 @@ region_init_infinite(pixman_region32_t *region)
 				  UINT32_MAX, UINT32_MAX);
 }
 
+/* Regions own their boxes through a plain pointer, so two of them can
+ * trade storage without copying any */
+static void
+region_swap(pixman_region32_t *a, pixman_region32_t *b)
+{
+	pixman_region32_t tmp;
+
+	tmp = *a;
+	*a = *b;
+	*b = tmp;
+}
+
 static struct weston_subsurface *
 weston_surface_to_subsurface(struct weston_surface *surface);
 
+static void
+weston_surface_subsurfaces_extents_dirty(struct weston_surface *surface)
+{
+	surface->subsurfaces_extents_dirty = true;
+}
+
 WL_EXPORT struct weston_view *
 weston_view_create(struct weston_surface *surface)
 {
@@ -437,6 +465,10 @@ struct weston_presentation_feedback {
 
 	/* The per-surface feedback flags */
 	uint32_t psf_flags;
+
+	/* Set while queued in output->feedback_array, at index slot */
+	struct weston_output *output;
+	uint32_t slot;
 };
 
 static void
@@ -486,23 +518,56 @@ weston_presentation_feedback_present(
 	wl_resource_destroy(feedback->resource);
 }
 
+/* Sends everything queued on the output by
+ * weston_output_take_feedback() in one pass. Entries destroyed by
+ * their client meanwhile were cleared to NULL. The array keeps its
+ * allocation for the next frame. */
 static void
-weston_presentation_feedback_present_list(struct wl_list *list,
-					  struct weston_output *output,
-					  uint32_t refresh_nsec,
-					  const struct timespec *ts,
-					  uint64_t seq,
-					  uint32_t flags)
+weston_output_present_feedback(struct weston_output *output,
+			       uint32_t refresh_nsec,
+			       const struct timespec *ts,
+			       uint64_t seq,
+			       uint32_t flags)
 {
-	struct weston_presentation_feedback *feedback, *tmp;
+	struct weston_presentation_feedback **feedbacks;
+	size_t i, n;
 
-	assert(!(flags & PRESENTATION_FEEDBACK_INVALID) ||
-	       wl_list_empty(list));
+	feedbacks = output->feedback_array.data;
+	n = output->feedback_array.size / sizeof *feedbacks;
 
-	wl_list_for_each_safe(feedback, tmp, list, link)
-		weston_presentation_feedback_present(feedback, output,
+	assert(!(flags & PRESENTATION_FEEDBACK_INVALID) || n == 0);
+
+	for (i = 0; i < n; i++) {
+		if (!feedbacks[i])
+			continue;
+
+		feedbacks[i]->output = NULL;
+		weston_presentation_feedback_present(feedbacks[i], output,
 						     refresh_nsec, ts, seq,
 						     flags);
+	}
+
+	output->feedback_array.size = 0;
+}
+
+static void
+weston_output_discard_feedback(struct weston_output *output)
+{
+	struct weston_presentation_feedback **feedbacks;
+	size_t i, n;
+
+	feedbacks = output->feedback_array.data;
+	n = output->feedback_array.size / sizeof *feedbacks;
+
+	for (i = 0; i < n; i++) {
+		if (!feedbacks[i])
+			continue;
+
+		feedbacks[i]->output = NULL;
+		weston_presentation_feedback_discard(feedbacks[i]);
+	}
+
+	output->feedback_array.size = 0;
 }
 
 static void
@@ -515,9 +580,20 @@ surface_state_handle_buffer_destroy(struct wl_listener *listener, void *data)
 	state->buffer = NULL;
 }
 
+/* Replace the fd in *dest, closing what was there */
+static void
+fd_move(int *dest, int fd)
+{
+	if (*dest >= 0 && *dest != fd)
+		close(*dest);
+	*dest = fd;
+}
+
 static void
 weston_surface_state_init(struct weston_surface_state *state)
 {
+	/* The default regions still have to be clipped on first commit */
+	state->dirty = WESTON_SURFACE_STATE_OPAQUE | WESTON_SURFACE_STATE_INPUT;
 	state->newly_attached = 0;
 	state->buffer = NULL;
 	state->buffer_destroy_listener.notify =
@@ -526,6 +602,7 @@ weston_surface_state_init(struct weston_surface_state *state)
 	state->sy = 0;
 
 	pixman_region32_init(&state->damage);
+	pixman_region32_init(&state->damage_buffer);
 	pixman_region32_init(&state->opaque);
 	region_init_infinite(&state->input);
 
@@ -537,6 +614,11 @@ weston_surface_state_init(struct weston_surface_state *state)
 	state->buffer_viewport.buffer.src_width = wl_fixed_from_int(-1);
 	state->buffer_viewport.surface.width = -1;
 	state->buffer_viewport.changed = 0;
+
+	state->acquire_fence_fd = -1;
+	state->buffer_release_ref.buffer_release = NULL;
+
+	state->async_flip = false;
 }
 
 static void
@@ -552,11 +634,15 @@ weston_surface_state_fini(struct weston_surface_state *state)
 
 	pixman_region32_fini(&state->input);
 	pixman_region32_fini(&state->opaque);
+	pixman_region32_fini(&state->damage_buffer);
 	pixman_region32_fini(&state->damage);
 
 	if (state->buffer)
 		wl_list_remove(&state->buffer_destroy_listener.link);
 	state->buffer = NULL;
+
+	fd_move(&state->acquire_fence_fd, -1);
+	weston_buffer_release_reference(&state->buffer_release_ref, NULL);
 }
 
 static void
@@ -592,10 +678,12 @@ weston_surface_create(struct weston_compositor *compositor)
 	surface->buffer_viewport.buffer.scale = 1;
 	surface->buffer_viewport.buffer.src_width = wl_fixed_from_int(-1);
 	surface->buffer_viewport.surface.width = -1;
+	surface->acquire_fence_fd = -1;
 
 	weston_surface_state_init(&surface->pending);
 
 	pixman_region32_init(&surface->damage);
+	pixman_region32_init(&surface->buffer_damage);
 	pixman_region32_init(&surface->opaque);
 	region_init_infinite(&surface->input);
 
@@ -605,6 +693,7 @@ weston_surface_create(struct weston_compositor *compositor)
 	wl_list_init(&surface->feedback_list);
 
 	wl_list_init(&surface->subsurface_list);
+	surface->subsurfaces_extents_dirty = true;
 	wl_list_init(&surface->subsurface_list_pending);
 
 	weston_matrix_init(&surface->buffer_to_surface_matrix);
@@ -620,11 +709,49 @@ weston_surface_set_color(struct weston_surface *surface,
 	surface->compositor->renderer->surface_set_color(surface, red, green, blue, alpha);
 }
 
+/** Give a compositor-internal surface the content of an image
+ *
+ * \param surface A surface without a client buffer.
+ * \param image A PIXMAN_a8b8g8r8 image, with a stride of 4 * width.
+ * \return 0 on success, -1 if the renderer cannot show images.
+ *
+ * Like weston_surface_set_color(), this only sets what the renderer
+ * draws; the caller still sets the surface size. The renderer may keep
+ * a reference to the image, so its pixels must not change afterwards.
+ */
+WL_EXPORT int
+weston_surface_set_image(struct weston_surface *surface,
+			 pixman_image_t *image)
+{
+	struct weston_renderer *renderer = surface->compositor->renderer;
+
+	if (!renderer->surface_set_image)
+		return -1;
+
+	return renderer->surface_set_image(surface, image);
+}
+
+/* Translations and scales leave w at 1, so mapping a point through
+ * them is one multiply and add per coordinate, with the same result
+ * as the full matrix product.
+ */
+static inline bool
+matrix_is_scale_translate(const struct weston_matrix *matrix)
+{
+	return !(matrix->type & ~(WESTON_MATRIX_TRANSFORM_TRANSLATE |
+				  WESTON_MATRIX_TRANSFORM_SCALE));
+}
+
 WL_EXPORT void
 weston_view_to_global_float(struct weston_view *view,
 			    float sx, float sy, float *x, float *y)
 {
-	if (view->transform.enabled) {
+	const struct weston_matrix *m = &view->transform.matrix;
+
+	if (view->transform.enabled && matrix_is_scale_translate(m)) {
+		*x = sx * m->d[0] + m->d[12];
+		*y = sy * m->d[5] + m->d[13];
+	} else if (view->transform.enabled) {
 		struct weston_vector v = { { sx, sy, 0.0f, 1.0f } };
 
 		weston_matrix_transform(&view->transform.matrix, &v);
@@ -690,25 +817,240 @@ weston_matrix_transform_rect(struct weston_matrix *matrix,
 	return out;
 }
 
+/* A matrix mapping whole pixels to whole pixels, as output transforms
+ * do: x' = xx * x + xy * y + tx, y' = yx * x + yy * y + ty, with either
+ * the diagonal or the anti-diagonal zero (flips and multiples of 90
+ * degrees) and integer coefficients.
+ */
+struct integer_transform {
+	int32_t xx, xy, yx, yy;
+	int32_t tx, ty;
+};
+
+static bool
+float_to_int(float f, int32_t limit, int32_t *i)
+{
+	if (!(fabsf(f) <= limit) || nearbyintf(f) != f)
+		return false;
+
+	*i = f;
+	return true;
+}
+
+static bool
+matrix_get_integer_transform(const struct weston_matrix *matrix,
+			     struct integer_transform *t)
+{
+	/* Scales beyond this are not output transforms, and keeping
+	 * them small keeps the products far from overflowing. */
+	const int32_t max_scale = 64, max_translate = 1 << 24;
+
+	if (matrix->type & WESTON_MATRIX_TRANSFORM_OTHER)
+		return false;
+
+	if (matrix->d[3] != 0.0f || matrix->d[7] != 0.0f ||
+	    matrix->d[15] != 1.0f)
+		return false;
+
+	if (!float_to_int(matrix->d[0], max_scale, &t->xx) ||
+	    !float_to_int(matrix->d[4], max_scale, &t->xy) ||
+	    !float_to_int(matrix->d[1], max_scale, &t->yx) ||
+	    !float_to_int(matrix->d[5], max_scale, &t->yy) ||
+	    !float_to_int(matrix->d[12], max_translate, &t->tx) ||
+	    !float_to_int(matrix->d[13], max_translate, &t->ty))
+		return false;
+
+	if (t->xy == 0 && t->yx == 0)
+		return t->xx != 0 && t->yy != 0;
+
+	return t->xx == 0 && t->yy == 0;
+}
+
+static int32_t
+clamp_int32(int64_t v)
+{
+	return v < INT32_MIN ? INT32_MIN : v > INT32_MAX ? INT32_MAX : v;
+}
+
+static pixman_box32_t
+integer_transform_box(const struct integer_transform *t,
+		      const pixman_box32_t *box)
+{
+	int64_t x1, y1, x2, y2, tmp;
+	pixman_box32_t out;
+
+	if (t->xy == 0) {
+		x1 = (int64_t) t->xx * box->x1 + t->tx;
+		x2 = (int64_t) t->xx * box->x2 + t->tx;
+		y1 = (int64_t) t->yy * box->y1 + t->ty;
+		y2 = (int64_t) t->yy * box->y2 + t->ty;
+	} else {
+		x1 = (int64_t) t->xy * box->y1 + t->tx;
+		x2 = (int64_t) t->xy * box->y2 + t->tx;
+		y1 = (int64_t) t->yx * box->x1 + t->ty;
+		y2 = (int64_t) t->yx * box->x2 + t->ty;
+	}
+
+	if (x1 > x2) {
+		tmp = x1;
+		x1 = x2;
+		x2 = tmp;
+	}
+	if (y1 > y2) {
+		tmp = y1;
+		y1 = y2;
+		y2 = tmp;
+	}
+
+	out.x1 = clamp_int32(x1);
+	out.y1 = clamp_int32(y1);
+	out.x2 = clamp_int32(x2);
+	out.y2 = clamp_int32(y2);
+
+	return out;
+}
+
+/* Regions with up to this many boxes are transformed without
+ * allocating */
+#define TRANSFORM_REGION_STACK_BOXES 64
+
 WL_EXPORT void
 weston_matrix_transform_region(pixman_region32_t *dest,
 			       struct weston_matrix *matrix,
 			       pixman_region32_t *src)
 {
+	pixman_box32_t stack_rects[TRANSFORM_REGION_STACK_BOXES];
 	pixman_box32_t *src_rects, *dest_rects;
+	struct integer_transform t;
+	bool integer;
 	int nrects, i;
 
-	src_rects = pixman_region32_rectangles(src, &nrects);
-	dest_rects = malloc(nrects * sizeof(*dest_rects));
-	if (!dest_rects)
+	integer = matrix_get_integer_transform(matrix, &t);
+
+	/* A whole-pixel translation keeps the bands, so the region can
+	 * be moved in place. */
+	if (integer && t.xx == 1 && t.yy == 1 && t.xy == 0) {
+		if (dest != src)
+			pixman_region32_copy(dest, src);
+		pixman_region32_translate(dest, t.tx, t.ty);
 		return;
+	}
+
+	src_rects = pixman_region32_rectangles(src, &nrects);
+	if (nrects <= TRANSFORM_REGION_STACK_BOXES) {
+		dest_rects = stack_rects;
+	} else {
+		dest_rects = malloc(nrects * sizeof(*dest_rects));
+		if (!dest_rects)
+			return;
+	}
 
-	for (i = 0; i < nrects; i++)
-		dest_rects[i] = weston_matrix_transform_rect(matrix, src_rects[i]);
+	if (integer) {
+		for (i = 0; i < nrects; i++)
+			dest_rects[i] = integer_transform_box(&t,
+							      &src_rects[i]);
+	} else {
+		for (i = 0; i < nrects; i++)
+			dest_rects[i] = weston_matrix_transform_rect(matrix,
+								     src_rects[i]);
+	}
 
 	pixman_region32_clear(dest);
 	pixman_region32_init_rects(dest, dest_rects, nrects);
-	free(dest_rects);
+	if (dest_rects != stack_rects)
+		free(dest_rects);
+}
+
+/* Extra pixels worth repainting to save a rectangle, which otherwise
+ * costs its own upload, clipping and quad further down */
+#define COARSEN_RECT_COST 1024
+
+/** Merge the rectangles of a region into fewer, larger ones
+ *
+ * \param region The region, only ever grown.
+ * \param max_rects The most rectangles the region may keep, or 0 to
+ * leave it alone.
+ *
+ * Each band becomes its bounding box where that repaints fewer extra
+ * pixels than COARSEN_RECT_COST per rectangle saved. If there are
+ * still more than max_rects rectangles left, runs of adjacent bands
+ * are merged into their bounding boxes until there are not.
+ */
+WL_EXPORT void
+weston_region_coarsen(pixman_region32_t *region, int max_rects)
+{
+	pixman_box32_t stack_boxes[TRANSFORM_REGION_STACK_BOXES];
+	pixman_box32_t *rects, *boxes, box;
+	int nrects, nboxes, nbands, per_group, band, i, j;
+	int64_t area, extra;
+
+	rects = pixman_region32_rectangles(region, &nrects);
+	if (max_rects <= 0 || nrects <= 1)
+		return;
+
+	if (nrects <= TRANSFORM_REGION_STACK_BOXES) {
+		boxes = stack_boxes;
+	} else {
+		boxes = malloc(nrects * sizeof(*boxes));
+		if (!boxes)
+			return;
+	}
+
+	/* The rectangles of a band share y1 and y2, sorted by x */
+	nboxes = 0;
+	nbands = 0;
+	for (i = 0; i < nrects; i = j) {
+		box = rects[i];
+		area = (int64_t) (box.x2 - box.x1) * (box.y2 - box.y1);
+		for (j = i + 1; j < nrects && rects[j].y1 == box.y1; j++) {
+			box.x2 = rects[j].x2;
+			area += (int64_t) (rects[j].x2 - rects[j].x1) *
+				(rects[j].y2 - rects[j].y1);
+		}
+		nbands++;
+
+		extra = (int64_t) (box.x2 - box.x1) * (box.y2 - box.y1) -
+			area;
+		if (extra <= (int64_t) (j - i - 1) * COARSEN_RECT_COST) {
+			boxes[nboxes++] = box;
+		} else {
+			memcpy(&boxes[nboxes], &rects[i],
+			       (j - i) * sizeof(*boxes));
+			nboxes += j - i;
+		}
+	}
+
+	/* Bands do not overlap, neither do boxes of whole bands */
+	if (nboxes > max_rects) {
+		per_group = (nbands + max_rects - 1) / max_rects;
+		nboxes = 0;
+		band = 0;
+		for (i = 0; i < nrects; i = j) {
+			if (band++ % per_group == 0) {
+				boxes[nboxes++] = rects[i];
+			} else {
+				box = boxes[nboxes - 1];
+				box.y2 = rects[i].y2;
+				boxes[nboxes - 1] = box;
+			}
+
+			for (j = i; j < nrects && rects[j].y1 == rects[i].y1;
+			     j++) {
+				box = boxes[nboxes - 1];
+				box.x1 = MIN(box.x1, rects[j].x1);
+				box.x2 = MAX(box.x2, rects[j].x2);
+				boxes[nboxes - 1] = box;
+			}
+		}
+	}
+
+	if (nboxes < nrects) {
+		pixman_region32_fini(region);
+		pixman_region32_init_rects(region, boxes, nboxes);
+	}
+
+	if (boxes != stack_boxes)
+		free(boxes);
 }
 
 static bool near_zero(float a)
@@ -922,6 +1264,7 @@ weston_view_move_to_plane(struct weston_view *view,
 WL_EXPORT void
 weston_view_damage_below(struct weston_view *view)
 {
+	struct weston_plane *primary = &view->surface->compositor->primary_plane;
 	pixman_region32_t damage;
 
 	pixman_region32_init(&damage);
@@ -930,10 +1273,44 @@ weston_view_damage_below(struct weston_view *view)
 	if (view->plane)
 		pixman_region32_union(&view->plane->damage,
 				      &view->plane->damage, &damage);
+
+	/* The primary plane skips what opaque views on other planes
+	 * cover, see weston_plane::clip, so that part needs repainting
+	 * once the view goes. What the view still covers after a move
+	 * gets clipped again. */
+	if (view->plane && view->plane != primary &&
+	    view->plane != &view->surface->compositor->cursor_plane) {
+		pixman_region32_subtract(&damage, &view->transform.opaque,
+					 &view->clip);
+		pixman_region32_union(&primary->damage,
+				      &primary->damage, &damage);
+	}
+
 	pixman_region32_fini(&damage);
 	weston_view_schedule_repaint(view);
 }
 
+static void
+weston_surface_send_output(struct weston_surface *es,
+			   struct weston_output *output, int enter)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_find_for_client(&output->resource_list,
+					       wl_resource_get_client(es->resource));
+	if (resource == NULL)
+		return;
+
+	if (enter)
+		wl_surface_send_enter(es->resource, resource);
+	else
+		wl_surface_send_leave(es->resource, resource);
+}
+
+/* Send leave before enter, and the enter of es->output, the output
+ * the surface mostly covers, before the others. A client picking its
+ * buffer scale from the first output it entered then draws for that
+ * output rather than one it only overlaps at the edge. */
 static void
 weston_surface_update_output_mask(struct weston_surface *es, uint32_t mask)
 {
@@ -941,8 +1318,6 @@ weston_surface_update_output_mask(struct weston_surface *es, uint32_t mask)
 	uint32_t entered = mask & different;
 	uint32_t left = es->output_mask & different;
 	struct weston_output *output;
-	struct wl_resource *resource = NULL;
-	struct wl_client *client;
 
 	es->output_mask = mask;
 	if (es->resource == NULL)
@@ -950,20 +1325,18 @@ weston_surface_update_output_mask(struct weston_surface *es, uint32_t mask)
 	if (different == 0)
 		return;
 
-	client = wl_resource_get_client(es->resource);
-
-	wl_list_for_each(output, &es->compositor->output_list, link) {
-		if (1 << output->id & different)
-			resource =
-				wl_resource_find_for_client(&output->resource_list,
-							 client);
-		if (resource == NULL)
-			continue;
-		if (1 << output->id & entered)
-			wl_surface_send_enter(es->resource, resource);
+	wl_list_for_each(output, &es->compositor->output_list, link)
 		if (1 << output->id & left)
-			wl_surface_send_leave(es->resource, resource);
+			weston_surface_send_output(es, output, 0);
+
+	if (es->output && 1 << es->output->id & entered) {
+		weston_surface_send_output(es, es->output, 1);
+		entered &= ~(1 << es->output->id);
 	}
+
+	wl_list_for_each(output, &es->compositor->output_list, link)
+		if (1 << output->id & entered)
+			weston_surface_send_output(es, output, 1);
 }
 
 
@@ -1036,6 +1409,9 @@ weston_view_assign_output(struct weston_view *ev)
 	}
 	pixman_region32_fini(&region);
 
+	if (ev->output_mask != mask)
+		ec->output_view_lists_dirty = 1;
+
 	ev->output = new_output;
 	ev->output_mask = mask;
 
@@ -1145,12 +1521,69 @@ weston_view_update_transform_disable(struct weston_view *view)
 	if (view->alpha == 1.0) {
 		pixman_region32_copy(&view->transform.opaque,
 				     &view->surface->opaque);
+		if (view->geometry.scissor_enabled)
+			pixman_region32_intersect(&view->transform.opaque,
+						  &view->transform.opaque,
+						  &view->geometry.scissor);
 		pixman_region32_translate(&view->transform.opaque,
 					  view->geometry.x,
 					  view->geometry.y);
 	}
 }
 
+/* Opaque region of a transformed view, in global coordinates.
+ *
+ * Only axis-aligned transformations (translation and scaling) keep
+ * the opaque rectangles rectangular, for anything else the view is
+ * treated as fully translucent. Opaque boxes are rounded inwards so
+ * that the views below are never culled where this one does not
+ * fully cover the pixel.
+ */
+static void
+view_compute_opaque(struct weston_view *view)
+{
+	pixman_region32_t surfopaque;
+	pixman_box32_t *rects;
+	int i, nrects;
+
+	if (view->alpha != 1.0)
+		return;
+
+	if (view->transform.matrix.type & (WESTON_MATRIX_TRANSFORM_ROTATE |
+					   WESTON_MATRIX_TRANSFORM_OTHER))
+		return;
+
+	pixman_region32_init(&surfopaque);
+	pixman_region32_copy(&surfopaque, &view->surface->opaque);
+	if (view->geometry.scissor_enabled)
+		pixman_region32_intersect(&surfopaque, &surfopaque,
+					  &view->geometry.scissor);
+
+	rects = pixman_region32_rectangles(&surfopaque, &nrects);
+	for (i = 0; i < nrects; i++) {
+		float x1, y1, x2, y2;
+		int32_t ix1, iy1, ix2, iy2;
+
+		weston_view_to_global_float(view, rects[i].x1, rects[i].y1,
+					    &x1, &y1);
+		weston_view_to_global_float(view, rects[i].x2, rects[i].y2,
+					    &x2, &y2);
+
+		ix1 = ceilf(MIN(x1, x2));
+		iy1 = ceilf(MIN(y1, y2));
+		ix2 = floorf(MAX(x1, x2));
+		iy2 = floorf(MAX(y1, y2));
+		if (ix1 >= ix2 || iy1 >= iy2)
+			continue;
+
+		pixman_region32_union_rect(&view->transform.opaque,
+					   &view->transform.opaque,
+					   ix1, iy1, ix2 - ix1, iy2 - iy1);
+	}
+
+	pixman_region32_fini(&surfopaque);
+}
+
 static int
 weston_view_update_transform_enable(struct weston_view *view)
 {
@@ -1192,93 +1625,359 @@ weston_view_update_transform_enable(struct weston_view *view)
 	view_compute_bbox(view, surfbox, &view->transform.boundingbox);
 	pixman_region32_fini(&surfregion);
 
+	view_compute_opaque(view);
+
 	return 0;
 }
 
-static struct weston_layer *
-get_view_layer(struct weston_view *view)
+/* Keep a whole-pixel translation inverse in fixed point, the common
+ * case of untransformed views and their sub-surfaces, so that
+ * weston_view_from_global_fixed() is two additions for every pointer
+ * and touch motion. */
+static void
+weston_view_update_integer_translate(struct weston_view *view)
+{
+	const struct weston_matrix *m = &view->transform.inverse;
+
+	view->transform.integer_translate =
+		!(m->type & ~WESTON_MATRIX_TRANSFORM_TRANSLATE) &&
+		m->d[12] == floorf(m->d[12]) &&
+		m->d[13] == floorf(m->d[13]) &&
+		fabsf(m->d[12]) < 0x7fffff && fabsf(m->d[13]) < 0x7fffff;
+
+	if (view->transform.integer_translate) {
+		view->transform.inverse_x = wl_fixed_from_int(m->d[12]);
+		view->transform.inverse_y = wl_fixed_from_int(m->d[13]);
+	}
+}
+
+/** The layer of a view, or of the view it is a sub-surface of
+ *
+ * \param view The view.
+ * \return The layer, or NULL if the view is in none.
+ */
+WL_EXPORT struct weston_layer *
+weston_view_get_layer(struct weston_view *view)
 {
 	if (view->parent_view)
-		return get_view_layer(view->parent_view);
+		return weston_view_get_layer(view->parent_view);
 	return view->layer_link.layer;
 }
 
-WL_EXPORT void
-weston_view_update_transform(struct weston_view *view)
+/** The plane for a view that no hardware plane takes
+ *
+ * \param view The view.
+ * \return The software cursor plane for the views of the cursor layer
+ * when the renderer draws them itself, see WESTON_CAP_SOFTWARE_CURSOR,
+ * or else the primary plane.
+ *
+ * Moving such a view then only damages the cursor plane, and the views
+ * below it are not composited again.
+ */
+WL_EXPORT struct weston_plane *
+weston_view_get_fallback_plane(struct weston_view *view)
 {
-	struct weston_view *parent = view->geometry.parent;
-	struct weston_layer *layer;
-	pixman_region32_t mask;
+	struct weston_compositor *ec = view->surface->compositor;
 
-	if (!view->transform.dirty)
-		return;
+	if ((ec->capabilities & WESTON_CAP_SOFTWARE_CURSOR) &&
+	    weston_view_get_layer(view) == &ec->cursor_layer)
+		return &ec->cursor_plane;
 
-	if (parent)
-		weston_view_update_transform(parent);
+	return &ec->primary_plane;
+}
 
-	view->transform.dirty = 0;
+/* The pick index is a sparse uniform grid over the global coordinate
+ * space.  Each occupied cell holds the views whose bounding box
+ * overlaps it, and cells are kept in a small hash table.  Views that
+ * would span too many cells (backgrounds, fullscreen surfaces on large
+ * outputs) are kept in a separate list that is always searched.
+ */
+#define PICK_CELL_SHIFT 8
+#define PICK_MAX_CELLS 256
+#define PICK_HASH_SIZE 256
 
-	weston_view_damage_below(view);
+struct weston_pick_cell {
+	struct wl_list link;
+	int32_t cx, cy;
+	struct wl_array views; /* struct weston_view * */
+};
 
-	pixman_region32_fini(&view->transform.boundingbox);
-	pixman_region32_fini(&view->transform.opaque);
-	pixman_region32_init(&view->transform.opaque);
+struct weston_pick_index {
+	struct wl_list buckets[PICK_HASH_SIZE];
+	struct wl_array oversized; /* struct weston_view * */
+};
 
-	/* transform.position is always in transformation_list */
-	if (view->geometry.transformation_list.next ==
-	    &view->transform.position.link &&
-	    view->geometry.transformation_list.prev ==
-	    &view->transform.position.link &&
-	    !parent) {
-		weston_view_update_transform_disable(view);
-	} else {
-		if (weston_view_update_transform_enable(view) < 0)
-			weston_view_update_transform_disable(view);
-	}
+static struct weston_pick_index *
+pick_index_create(void)
+{
+	struct weston_pick_index *index;
+	int i;
 
-	layer = get_view_layer(view);
-	if (layer) {
-		pixman_region32_init_with_extents(&mask, &layer->mask);
-		pixman_region32_intersect(&view->transform.boundingbox,
-					  &view->transform.boundingbox, &mask);
-		pixman_region32_intersect(&view->transform.opaque,
-					  &view->transform.opaque, &mask);
-		pixman_region32_fini(&mask);
-	}
+	index = zalloc(sizeof *index);
+	if (index == NULL)
+		return NULL;
 
-	if (parent) {
-		if (parent->geometry.scissor_enabled) {
-			view->geometry.scissor_enabled = true;
-			weston_view_transfer_scissor(parent, view);
-		} else {
-			view->geometry.scissor_enabled = false;
-		}
-	}
+	for (i = 0; i < PICK_HASH_SIZE; i++)
+		wl_list_init(&index->buckets[i]);
+	wl_array_init(&index->oversized);
 
-	weston_view_damage_below(view);
+	return index;
+}
 
-	weston_view_assign_output(view);
+static void
+pick_index_destroy(struct weston_pick_index *index)
+{
+	struct weston_pick_cell *cell, *next;
+	int i;
 
-	wl_signal_emit(&view->surface->compositor->transform_signal,
-		       view->surface);
+	for (i = 0; i < PICK_HASH_SIZE; i++) {
+		wl_list_for_each_safe(cell, next, &index->buckets[i], link) {
+			wl_array_release(&cell->views);
+			free(cell);
+		}
+	}
+	wl_array_release(&index->oversized);
+	free(index);
 }
 
-WL_EXPORT void
-weston_view_geometry_dirty(struct weston_view *view)
+static struct wl_list *
+pick_index_bucket(struct weston_pick_index *index, int32_t cx, int32_t cy)
 {
-	struct weston_view *child;
+	uint32_t hash = (uint32_t) cx * 73856093u ^ (uint32_t) cy * 19349663u;
 
-	/*
-	 * The invariant: if view->geometry.dirty, then all views
-	 * in view->geometry.child_list have geometry.dirty too.
-	 * Corollary: if not parent->geometry.dirty, then all ancestors
-	 * are not dirty.
-	 */
+	return &index->buckets[hash % PICK_HASH_SIZE];
+}
 
-	if (view->transform.dirty)
-		return;
+static struct weston_pick_cell *
+pick_index_find_cell(struct weston_pick_index *index, int32_t cx, int32_t cy)
+{
+	struct wl_list *bucket = pick_index_bucket(index, cx, cy);
+	struct weston_pick_cell *cell;
 
-	view->transform.dirty = 1;
+	wl_list_for_each(cell, bucket, link)
+		if (cell->cx == cx && cell->cy == cy)
+			return cell;
+
+	return NULL;
+}
+
+static int
+pick_array_add(struct wl_array *array, struct weston_view *view)
+{
+	struct weston_view **p;
+
+	p = wl_array_add(array, sizeof *p);
+	if (p == NULL)
+		return -1;
+
+	*p = view;
+	return 0;
+}
+
+static void
+pick_array_remove(struct wl_array *array, struct weston_view *view)
+{
+	struct weston_view **p, **last;
+
+	last = (struct weston_view **) ((char *) array->data + array->size) - 1;
+	wl_array_for_each(p, array) {
+		if (*p == view) {
+			*p = *last;
+			array->size -= sizeof *p;
+			return;
+		}
+	}
+}
+
+static void
+weston_view_pick_index_remove(struct weston_view *view)
+{
+	struct weston_pick_index *index = view->surface->compositor->pick_index;
+	struct weston_pick_cell *cell;
+	int32_t cx, cy;
+
+	if (!view->pick.indexed)
+		return;
+
+	view->pick.indexed = 0;
+
+	if (view->pick.oversized) {
+		pick_array_remove(&index->oversized, view);
+		return;
+	}
+
+	for (cy = view->pick.y1; cy < view->pick.y2; cy++) {
+		for (cx = view->pick.x1; cx < view->pick.x2; cx++) {
+			cell = pick_index_find_cell(index, cx, cy);
+			if (!cell)
+				continue;
+
+			pick_array_remove(&cell->views, view);
+			if (cell->views.size == 0) {
+				wl_list_remove(&cell->link);
+				wl_array_release(&cell->views);
+				free(cell);
+			}
+		}
+	}
+}
+
+static int
+weston_view_pick_index_add_cells(struct weston_view *view)
+{
+	struct weston_pick_index *index = view->surface->compositor->pick_index;
+	struct weston_pick_cell *cell;
+	int32_t cx, cy;
+
+	for (cy = view->pick.y1; cy < view->pick.y2; cy++) {
+		for (cx = view->pick.x1; cx < view->pick.x2; cx++) {
+			cell = pick_index_find_cell(index, cx, cy);
+			if (!cell) {
+				cell = zalloc(sizeof *cell);
+				if (cell == NULL)
+					return -1;
+				cell->cx = cx;
+				cell->cy = cy;
+				wl_array_init(&cell->views);
+				wl_list_insert(pick_index_bucket(index, cx, cy),
+					       &cell->link);
+			}
+
+			if (pick_array_add(&cell->views, view) < 0)
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Re-insert a view into the pick index after its bounding box changed
+ *
+ * \param view The view whose transform.boundingbox is up to date.
+ *
+ * On allocation failure the view is moved to the oversized list, which
+ * is always searched, so picking stays correct.
+ */
+static void
+weston_view_pick_index_update(struct weston_view *view)
+{
+	struct weston_pick_index *index = view->surface->compositor->pick_index;
+	const pixman_box32_t *box;
+	int64_t cells;
+
+	weston_view_pick_index_remove(view);
+
+	if (!pixman_region32_not_empty(&view->transform.boundingbox))
+		return;
+
+	box = pixman_region32_extents(&view->transform.boundingbox);
+	view->pick.x1 = box->x1 >> PICK_CELL_SHIFT;
+	view->pick.y1 = box->y1 >> PICK_CELL_SHIFT;
+	view->pick.x2 = ((box->x2 - 1) >> PICK_CELL_SHIFT) + 1;
+	view->pick.y2 = ((box->y2 - 1) >> PICK_CELL_SHIFT) + 1;
+
+	cells = (int64_t) (view->pick.x2 - view->pick.x1) *
+		(view->pick.y2 - view->pick.y1);
+
+	view->pick.indexed = 1;
+	view->pick.oversized = cells > PICK_MAX_CELLS;
+	if (!view->pick.oversized) {
+		if (weston_view_pick_index_add_cells(view) == 0)
+			return;
+
+		/* Undo the partial insertion */
+		weston_view_pick_index_remove(view);
+		view->pick.indexed = 1;
+		view->pick.oversized = 1;
+	}
+
+	if (pick_array_add(&index->oversized, view) < 0) {
+		weston_log("error: out of memory indexing view %p\n", view);
+		view->pick.indexed = 0;
+	}
+}
+
+WL_EXPORT void
+weston_view_update_transform(struct weston_view *view)
+{
+	struct weston_view *parent = view->geometry.parent;
+	struct weston_layer *layer;
+	pixman_region32_t mask;
+
+	if (!view->transform.dirty)
+		return;
+
+	if (parent)
+		weston_view_update_transform(parent);
+
+	view->transform.dirty = 0;
+
+	weston_view_damage_below(view);
+
+	pixman_region32_fini(&view->transform.boundingbox);
+	pixman_region32_fini(&view->transform.opaque);
+	pixman_region32_init(&view->transform.opaque);
+
+	/* transform.position is always in transformation_list */
+	if (view->geometry.transformation_list.next ==
+	    &view->transform.position.link &&
+	    view->geometry.transformation_list.prev ==
+	    &view->transform.position.link &&
+	    !parent) {
+		weston_view_update_transform_disable(view);
+	} else {
+		if (weston_view_update_transform_enable(view) < 0)
+			weston_view_update_transform_disable(view);
+	}
+	weston_view_update_integer_translate(view);
+
+	layer = weston_view_get_layer(view);
+	if (layer) {
+		pixman_region32_init_with_extents(&mask, &layer->mask);
+		pixman_region32_intersect(&view->transform.boundingbox,
+					  &view->transform.boundingbox, &mask);
+		pixman_region32_intersect(&view->transform.opaque,
+					  &view->transform.opaque, &mask);
+		pixman_region32_fini(&mask);
+	}
+
+	if (parent) {
+		if (parent->geometry.scissor_enabled) {
+			view->geometry.scissor_enabled = true;
+			weston_view_transfer_scissor(parent, view);
+		} else {
+			view->geometry.scissor_enabled = false;
+		}
+	}
+
+	weston_view_damage_below(view);
+
+	weston_view_pick_index_update(view);
+
+	weston_view_assign_output(view);
+
+	wl_signal_emit(&view->surface->compositor->transform_signal,
+		       view->surface);
+}
+
+WL_EXPORT void
+weston_view_geometry_dirty(struct weston_view *view)
+{
+	struct weston_view *child;
+
+	/*
+	 * The invariant: if view->geometry.dirty, then all views
+	 * in view->geometry.child_list have geometry.dirty too.
+	 * Corollary: if not parent->geometry.dirty, then all ancestors
+	 * are not dirty.
+	 */
+
+	if (view->transform.dirty)
+		return;
+
+	view->transform.dirty = 1;
+	view->surface->compositor->view_transforms_dirty = 1;
+	view->surface->compositor->scene_serial++;
 
 	wl_list_for_each(child, &view->geometry.child_list,
 			 geometry.parent_link)
@@ -1304,7 +2003,12 @@ WL_EXPORT void
 weston_view_from_global_float(struct weston_view *view,
 			      float x, float y, float *vx, float *vy)
 {
-	if (view->transform.enabled) {
+	const struct weston_matrix *m = &view->transform.inverse;
+
+	if (view->transform.enabled && matrix_is_scale_translate(m)) {
+		*vx = x * m->d[0] + m->d[12];
+		*vy = y * m->d[5] + m->d[13];
+	} else if (view->transform.enabled) {
 		struct weston_vector v = { { x, y, 0.0f, 1.0f } };
 
 		weston_matrix_transform(&view->transform.inverse, &v);
@@ -1333,6 +2037,12 @@ weston_view_from_global_fixed(struct weston_view *view,
 {
 	float vxf, vyf;
 
+	if (view->transform.integer_translate && !view->transform.dirty) {
+		*vx = x + view->transform.inverse_x;
+		*vy = y + view->transform.inverse_y;
+		return;
+	}
+
 	weston_view_from_global_float(view,
 				      wl_fixed_to_double(x),
 				      wl_fixed_to_double(y),
@@ -1385,9 +2095,16 @@ weston_view_schedule_repaint(struct weston_view *view)
 WL_EXPORT void
 weston_surface_damage(struct weston_surface *surface)
 {
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+
 	pixman_region32_union_rect(&surface->damage, &surface->damage,
 				   0, 0, surface->width,
 				   surface->height);
+	if (buffer)
+		pixman_region32_union_rect(&surface->buffer_damage,
+					   &surface->buffer_damage,
+					   0, 0, buffer->width,
+					   buffer->height);
 
 	weston_surface_schedule_repaint(surface);
 }
@@ -1548,6 +2265,7 @@ static void
 surface_set_size(struct weston_surface *surface, int32_t width, int32_t height)
 {
 	struct weston_view *view;
+	struct weston_subsurface *sub;
 
 	if (surface->width == width && surface->height == height)
 		return;
@@ -1557,6 +2275,11 @@ surface_set_size(struct weston_surface *surface, int32_t width, int32_t height)
 
 	wl_list_for_each(view, &surface->views, surface_link)
 		weston_view_geometry_dirty(view);
+
+	weston_surface_subsurfaces_extents_dirty(surface);
+	sub = weston_surface_to_subsurface(surface);
+	if (sub && sub->parent)
+		weston_surface_subsurfaces_extents_dirty(sub->parent);
 }
 
 WL_EXPORT void
@@ -1639,35 +2362,93 @@ weston_compositor_get_time(void)
        return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
-WL_EXPORT struct weston_view *
-weston_compositor_pick_view(struct weston_compositor *compositor,
-			    wl_fixed_t x, wl_fixed_t y,
-			    wl_fixed_t *vx, wl_fixed_t *vy)
+static int
+view_accepts_input_at(struct weston_view *view, wl_fixed_t x, wl_fixed_t y,
+		      wl_fixed_t *vx, wl_fixed_t *vy)
 {
-	struct weston_view *view;
 	wl_fixed_t view_x, view_y;
 	int view_ix, view_iy;
 	int ix = wl_fixed_to_int(x);
 	int iy = wl_fixed_to_int(y);
 
-	wl_list_for_each(view, &compositor->view_list, link) {
-		if (!pixman_region32_contains_point(
-				&view->transform.boundingbox, ix, iy, NULL))
-			continue;
+	if (!pixman_region32_contains_point(&view->transform.boundingbox,
+					    ix, iy, NULL))
+		return 0;
+
+	weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
+	view_ix = wl_fixed_to_int(view_x);
+	view_iy = wl_fixed_to_int(view_y);
 
-		weston_view_from_global_fixed(view, x, y, &view_x, &view_y);
-		view_ix = wl_fixed_to_int(view_x);
-		view_iy = wl_fixed_to_int(view_y);
+	if (!pixman_region32_contains_point(&view->surface->input,
+					    view_ix, view_iy, NULL))
+		return 0;
 
-		if (!pixman_region32_contains_point(&view->surface->input,
-						    view_ix, view_iy, NULL))
+	if (view->geometry.scissor_enabled &&
+	    !pixman_region32_contains_point(&view->geometry.scissor,
+					    view_ix, view_iy, NULL))
+		return 0;
+
+	*vx = view_x;
+	*vy = view_y;
+	return 1;
+}
+
+static struct weston_view *
+pick_array_search(struct weston_compositor *compositor,
+		  struct wl_array *array, struct weston_view *best,
+		  wl_fixed_t x, wl_fixed_t y, wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	struct weston_view **p;
+
+	wl_array_for_each(p, array) {
+		struct weston_view *view = *p;
+
+		/* Only views in the current view_list can be picked */
+		if (view->pick.serial != compositor->view_list_serial)
 			continue;
 
-		if (view->geometry.scissor_enabled &&
-		    !pixman_region32_contains_point(&view->geometry.scissor,
-						    view_ix, view_iy, NULL))
+		if (best && view->pick.order >= best->pick.order)
 			continue;
 
+		if (view_accepts_input_at(view, x, y, vx, vy))
+			best = view;
+	}
+
+	return best;
+}
+
+/** Find the topmost view accepting input at a global position
+ *
+ * \param compositor The compositor.
+ * \param x The global x coordinate.
+ * \param y The global y coordinate.
+ * \param vx Returns the x coordinate in the picked view's space.
+ * \param vy Returns the y coordinate in the picked view's space.
+ * \return The picked view, or NULL if there is none.
+ *
+ * Only the views sharing a pick index cell with the point are tested,
+ * and of those the one earliest in weston_compositor::view_list wins.
+ */
+WL_EXPORT struct weston_view *
+weston_compositor_pick_view(struct weston_compositor *compositor,
+			    wl_fixed_t x, wl_fixed_t y,
+			    wl_fixed_t *vx, wl_fixed_t *vy)
+{
+	struct weston_pick_index *index = compositor->pick_index;
+	struct weston_pick_cell *cell;
+	struct weston_view *view = NULL;
+	int32_t cx = wl_fixed_to_int(x) >> PICK_CELL_SHIFT;
+	int32_t cy = wl_fixed_to_int(y) >> PICK_CELL_SHIFT;
+	wl_fixed_t view_x = 0, view_y = 0;
+
+	cell = pick_index_find_cell(index, cx, cy);
+	if (cell)
+		view = pick_array_search(compositor, &cell->views, view,
+					 x, y, &view_x, &view_y);
+	view = pick_array_search(compositor, &index->oversized, view,
+				 x, y, &view_x, &view_y);
+
+	if (view) {
 		*vx = view_x;
 		*vy = view_y;
 		return view;
@@ -1678,16 +2459,37 @@ weston_compositor_pick_view(struct weston_compositor *compositor,
 	return NULL;
 }
 
+/* Repicks the pointer focus of every seat after a repaint, unless
+ * neither the scene nor the pointer changed since the last time */
 static void
 weston_compositor_repick(struct weston_compositor *compositor)
 {
 	struct weston_seat *seat;
+	struct weston_pointer *pointer;
 
 	if (!compositor->session_active)
 		return;
 
-	wl_list_for_each(seat, &compositor->seat_list, link)
+	wl_list_for_each(seat, &compositor->seat_list, link) {
+		pointer = weston_seat_get_pointer(seat);
+		if (!pointer)
+			continue;
+
+		if (pointer->repick_scene_serial == compositor->scene_serial &&
+		    pointer->repick_x == pointer->x &&
+		    pointer->repick_y == pointer->y &&
+		    pointer->repick_grab == pointer->grab &&
+		    pointer->repick_focus == pointer->focus)
+			continue;
+
 		weston_seat_repick(seat);
+
+		pointer->repick_scene_serial = compositor->scene_serial;
+		pointer->repick_x = pointer->x;
+		pointer->repick_y = pointer->y;
+		pointer->repick_grab = pointer->grab;
+		pointer->repick_focus = pointer->focus;
+	}
 }
 
 WL_EXPORT void
@@ -1704,9 +2506,16 @@ weston_view_unmap(struct weston_view *view)
 	weston_layer_entry_remove(&view->layer_link);
 	wl_list_remove(&view->link);
 	wl_list_init(&view->link);
+	view->surface->compositor->view_list_dirty = 1;
 	view->output_mask = 0;
 	weston_surface_assign_output(view->surface);
 
+	/* Not pickable until the view list is rebuilt with it again, and
+	 * dirty so that mapping it again puts it back in the pick index */
+	weston_view_pick_index_remove(view);
+	view->pick.serial = 0;
+	weston_view_geometry_dirty(view);
+
 	if (weston_surface_is_mapped(view->surface))
 		return;
 
@@ -1760,6 +2569,8 @@ weston_view_destroy(struct weston_view *view)
 	wl_list_remove(&view->link);
 	weston_layer_entry_remove(&view->layer_link);
 
+	weston_view_pick_index_remove(view);
+
 	pixman_region32_fini(&view->clip);
 	pixman_region32_fini(&view->geometry.scissor);
 	pixman_region32_fini(&view->transform.boundingbox);
@@ -1791,11 +2602,18 @@ weston_surface_destroy(struct weston_surface *surface)
 	wl_list_for_each_safe(ev, nv, &surface->views, surface_link)
 		weston_view_destroy(ev);
 
+	if (surface->tearing_control_resource)
+		wl_resource_set_user_data(surface->tearing_control_resource,
+					  NULL);
+
 	weston_surface_state_fini(&surface->pending);
 
 	weston_buffer_reference(&surface->buffer_ref, NULL);
+	fd_move(&surface->acquire_fence_fd, -1);
+	weston_buffer_release_reference(&surface->buffer_release_ref, NULL);
 
 	pixman_region32_fini(&surface->damage);
+	pixman_region32_fini(&surface->buffer_damage);
 	pixman_region32_fini(&surface->opaque);
 	pixman_region32_fini(&surface->input);
 
@@ -1811,9 +2629,16 @@ static void
 destroy_surface(struct wl_resource *resource)
 {
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
+	struct weston_client_usage *usage;
 
 	assert(surface);
 
+	usage = weston_client_usage_find(wl_resource_get_client(resource));
+	if (usage) {
+		usage->surfaces--;
+		usage->texture_bytes -= surface->texture_bytes;
+	}
+
 	/* Set the resource to NULL, since we don't want to leave a
 	 * dangling pointer if the surface was refcounted and survives
 	 * the weston_surface_destroy() call. */
@@ -1821,11 +2646,265 @@ destroy_surface(struct wl_resource *resource)
 	weston_surface_destroy(surface);
 }
 
+static void
+client_usage_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct weston_client_usage *usage =
+		container_of(listener, struct weston_client_usage,
+			     destroy_listener);
+	struct weston_buffer *buffer, *next;
+
+	wl_list_for_each_safe(buffer, next, &usage->held_buffer_list,
+			      held_link)
+		wl_list_init(&buffer->held_link);
+
+	wl_list_remove(&usage->link);
+	free(usage);
+}
+
+/** Look up what a client holds, without creating the record
+ *
+ * \param client The client
+ * \return Its usage, or NULL if it never had any or is disconnecting.
+ *
+ * The client's resources are destroyed after its destroy signal, so
+ * the decrements done from resource destructors find nothing then.
+ */
+WL_EXPORT struct weston_client_usage *
+weston_client_usage_find(struct wl_client *client)
+{
+	struct wl_listener *listener;
+
+	listener = wl_client_get_destroy_listener(client,
+						  client_usage_handle_destroy);
+	if (!listener)
+		return NULL;
+
+	return container_of(listener, struct weston_client_usage,
+			    destroy_listener);
+}
+
+/** Look up what a client holds, creating the record on first use
+ *
+ * \param compositor The compositor
+ * \param client The client
+ * \return Its usage, or NULL when out of memory.
+ */
+WL_EXPORT struct weston_client_usage *
+weston_client_usage_get(struct weston_compositor *compositor,
+			struct wl_client *client)
+{
+	struct weston_client_usage *usage;
+
+	usage = weston_client_usage_find(client);
+	if (usage)
+		return usage;
+
+	usage = zalloc(sizeof *usage);
+	if (!usage)
+		return NULL;
+
+	usage->compositor = compositor;
+	usage->client = client;
+	wl_client_get_credentials(client, &usage->pid, NULL, NULL);
+	usage->destroy_listener.notify = client_usage_handle_destroy;
+	wl_client_add_destroy_listener(client, &usage->destroy_listener);
+	wl_list_insert(compositor->client_usage_list.prev, &usage->link);
+	wl_list_init(&usage->held_buffer_list);
+
+	return usage;
+}
+
+/* Count a commit, and decide whether the client went over its commit
+ * budget for this frame. A client that is over has its buffers given
+ * back only once per frame, so committing faster than the outputs
+ * refresh makes it wait for buffers instead of taking the compositor's
+ * time away from everyone else. */
+static void
+client_usage_count_commit(struct weston_surface *surface,
+			  struct wl_client *client)
+{
+	struct weston_compositor *compositor = surface->compositor;
+	struct weston_client_usage *usage;
+	uint32_t now, elapsed;
+
+	usage = weston_client_usage_get(compositor, client);
+	if (!usage)
+		return;
+
+	usage->commits++;
+	usage->damage_rects +=
+		pixman_region32_n_rects(&surface->pending.damage) +
+		pixman_region32_n_rects(&surface->pending.damage_buffer);
+
+	now = weston_compositor_get_time();
+	elapsed = now - usage->rate_start_ms;
+	usage->rate_commits++;
+	if (elapsed >= 1000) {
+		usage->commit_rate =
+			(uint64_t) usage->rate_commits * 1000 / elapsed;
+		usage->rate_start_ms = now;
+		usage->rate_commits = 0;
+	}
+
+	if (!compositor->client_commit_budget)
+		return;
+
+	if (usage->frame_seq != compositor->frame_seq) {
+		usage->frame_seq = compositor->frame_seq;
+		usage->frame_commits = 0;
+	}
+
+	if (++usage->frame_commits <= compositor->client_commit_budget)
+		return;
+
+	usage->throttled = true;
+	if (!usage->throttle_logged) {
+		weston_log("client pid %d committed more than %u times in "
+			   "a frame, its buffers are released once per "
+			   "frame from now on\n", (int) usage->pid,
+			   compositor->client_commit_budget);
+		usage->throttle_logged = true;
+	}
+}
+
+/* Keep the release of a throttled client's buffer for the next frame */
+static bool
+client_usage_hold_release(struct weston_buffer *buffer)
+{
+	struct weston_client_usage *usage;
+
+	usage = weston_client_usage_find(
+			wl_resource_get_client(buffer->resource));
+	if (!usage || !usage->throttled)
+		return false;
+
+	if (wl_list_empty(&buffer->held_link))
+		wl_list_insert(usage->held_buffer_list.prev,
+			       &buffer->held_link);
+
+	return true;
+}
+
+/* A frame went out: send the held releases, the budgets start over */
+static void
+client_usage_release_held(struct weston_compositor *compositor)
+{
+	struct weston_client_usage *usage;
+	struct weston_buffer *buffer, *next;
+
+	compositor->frame_seq++;
+
+	wl_list_for_each(usage, &compositor->client_usage_list, link) {
+		usage->throttled = false;
+		wl_list_for_each_safe(buffer, next, &usage->held_buffer_list,
+				      held_link) {
+			wl_list_remove(&buffer->held_link);
+			wl_list_init(&buffer->held_link);
+			if (buffer->busy_count == 0)
+				wl_resource_queue_event(buffer->resource,
+							WL_BUFFER_RELEASE);
+		}
+	}
+}
+
+/** Count buffer memory against a client's limit
+ *
+ * \param usage The client's usage
+ * \param counter Its shm_bytes or dmabuf_bytes
+ * \param bytes The size of the new buffer
+ * \return 0 if counted, -1 if it would take the client over
+ * weston_compositor::client_memory_limit.
+ */
+WL_EXPORT int
+weston_client_usage_add_memory(struct weston_client_usage *usage,
+			       uint64_t *counter, uint64_t bytes)
+{
+	uint64_t limit = usage->compositor->client_memory_limit;
+
+	if (limit && usage->shm_bytes + usage->dmabuf_bytes + bytes > limit) {
+		weston_log("client pid %d went over its memory limit of "
+			   "%" PRIu64 " KiB\n", (int) usage->pid,
+			   limit / 1024);
+		return -1;
+	}
+
+	*counter += bytes;
+
+	return 0;
+}
+
+/** Account the memory a renderer holds for a surface's contents
+ *
+ * \param surface The surface
+ * \param bytes What the renderer holds for it now
+ *
+ * Once the wl_surface is destroyed, the memory is no longer counted
+ * against the client.
+ */
+WL_EXPORT void
+weston_surface_set_texture_bytes(struct weston_surface *surface,
+				 uint64_t bytes)
+{
+	struct weston_client_usage *usage = NULL;
+
+	if (surface->resource)
+		usage = weston_client_usage_find(
+				wl_resource_get_client(surface->resource));
+
+	if (usage) {
+		usage->texture_bytes -= surface->texture_bytes;
+		usage->texture_bytes += bytes;
+	}
+
+	surface->texture_bytes = bytes;
+}
+
+static int
+client_usage_account_buffer(struct weston_compositor *compositor,
+			    struct wl_client *client,
+			    struct weston_buffer *buffer)
+{
+	struct weston_client_usage *usage;
+	struct wl_shm_buffer *shm_buffer;
+
+	usage = weston_client_usage_get(compositor, client);
+	if (!usage)
+		return -1;
+
+	/* dmabufs are counted when created, see linux-dmabuf.c */
+	shm_buffer = wl_shm_buffer_get(buffer->resource);
+	if (shm_buffer) {
+		buffer->shm_bytes =
+			(uint64_t) wl_shm_buffer_get_stride(shm_buffer) *
+			wl_shm_buffer_get_height(shm_buffer);
+		if (weston_client_usage_add_memory(usage, &usage->shm_bytes,
+						   buffer->shm_bytes) < 0)
+			return -1;
+	}
+
+	usage->buffers++;
+	buffer->accounted = true;
+
+	return 0;
+}
+
 static void
 weston_buffer_destroy_handler(struct wl_listener *listener, void *data)
 {
 	struct weston_buffer *buffer =
 		container_of(listener, struct weston_buffer, destroy_listener);
+	struct weston_client_usage *usage;
+
+	if (buffer->accounted) {
+		usage = weston_client_usage_find(
+				wl_resource_get_client(buffer->resource));
+		if (usage) {
+			usage->buffers--;
+			usage->shm_bytes -= buffer->shm_bytes;
+		}
+	}
+	wl_list_remove(&buffer->held_link);
 
 	wl_signal_emit(&buffer->destroy_signal, buffer);
 	free(buffer);
@@ -1852,6 +2931,7 @@ weston_buffer_from_resource(struct wl_resource *resource)
 	wl_signal_init(&buffer->destroy_signal);
 	buffer->destroy_listener.notify = weston_buffer_destroy_handler;
 	buffer->y_inverted = 1;
+	wl_list_init(&buffer->held_link);
 	wl_resource_add_destroy_listener(resource, &buffer->destroy_listener);
 
 	return buffer;
@@ -1875,7 +2955,8 @@ weston_buffer_reference(struct weston_buffer_reference *ref,
 {
 	if (ref->buffer && buffer != ref->buffer) {
 		ref->buffer->busy_count--;
-		if (ref->buffer->busy_count == 0) {
+		if (ref->buffer->busy_count == 0 &&
+		    !client_usage_hold_release(ref->buffer)) {
 			assert(wl_resource_get_client(ref->buffer->resource));
 			wl_resource_queue_event(ref->buffer->resource,
 						WL_BUFFER_RELEASE);
@@ -1943,6 +3024,7 @@ surface_flush_damage(struct weston_surface *surface)
 			 TLP_OUTPUT(surface->output), TLP_END);
 
 	pixman_region32_clear(&surface->damage);
+	pixman_region32_clear(&surface->buffer_damage);
 }
 
 static void
@@ -1978,31 +3060,36 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 {
 	struct weston_plane *plane;
 	struct weston_view *ev;
-	pixman_region32_t opaque, clip;
+	pixman_region32_t clip;
+
+	wl_list_for_each(plane, &ec->plane_list, link)
+		pixman_region32_clear(&plane->opaque);
+
+	/* The planes only occlude their own views here, so one walk down
+	 * the views does all planes at once. Planes that are not stacked
+	 * are not drawn. */
+	wl_list_for_each(ev, &ec->view_list, link) {
+		ev->surface->touched = 0;
+
+		if (ev->plane && !wl_list_empty(&ev->plane->link))
+			view_accumulate_damage(ev, &ev->plane->opaque);
+	}
 
 	pixman_region32_init(&clip);
 
 	wl_list_for_each(plane, &ec->plane_list, link) {
 		pixman_region32_copy(&plane->clip, &clip);
 
-		pixman_region32_init(&opaque);
-
-		wl_list_for_each(ev, &ec->view_list, link) {
-			if (ev->plane != plane)
-				continue;
-
-			view_accumulate_damage(ev, &opaque);
-		}
+		/* The software cursor is drawn over the frame, which
+		 * has to be complete under it */
+		if (plane != &ec->cursor_plane)
+			pixman_region32_union(&clip, &clip, &plane->opaque);
 
-		pixman_region32_union(&clip, &clip, &opaque);
-		pixman_region32_fini(&opaque);
+		weston_region_coarsen(&plane->damage, ec->damage_max_rects);
 	}
 
 	pixman_region32_fini(&clip);
 
-	wl_list_for_each(ev, &ec->view_list, link)
-		ev->surface->touched = 0;
-
 	wl_list_for_each(ev, &ec->view_list, link) {
 		if (ev->surface->touched)
 			continue;
@@ -2018,8 +3105,11 @@ compositor_accumulate_damage(struct weston_compositor *ec)
 		 * reference now, and allow early buffer release. This enables
 		 * clients to use single-buffering.
 		 */
-		if (!ev->surface->keep_buffer)
+		if (!ev->surface->keep_buffer) {
 			weston_buffer_reference(&ev->surface->buffer_ref, NULL);
+			weston_buffer_release_reference(
+				&ev->surface->buffer_release_ref, NULL);
+		}
 	}
 }
 
@@ -2058,6 +3148,16 @@ surface_free_unused_subsurface_views(struct weston_surface *surface)
 	}
 }
 
+/* Records the stacking order for the pick index on the way */
+static void
+view_list_append(struct weston_compositor *compositor,
+		 struct weston_view *view)
+{
+	wl_list_insert(compositor->view_list.prev, &view->link);
+	view->pick.serial = compositor->view_list_serial;
+	view->pick.order = compositor->view_list_length++;
+}
+
 static void
 view_list_add_subsurface_view(struct weston_compositor *compositor,
 			      struct weston_subsurface *sub,
@@ -2092,13 +3192,13 @@ view_list_add_subsurface_view(struct weston_compositor *compositor,
 	weston_view_update_transform(view);
 
 	if (wl_list_empty(&sub->surface->subsurface_list)) {
-		wl_list_insert(compositor->view_list.prev, &view->link);
+		view_list_append(compositor, view);
 		return;
 	}
 
 	wl_list_for_each(child, &sub->surface->subsurface_list, parent_link) {
 		if (child->surface == sub->surface)
-			wl_list_insert(compositor->view_list.prev, &view->link);
+			view_list_append(compositor, view);
 		else
 			view_list_add_subsurface_view(compositor, child, view);
 	}
@@ -2113,28 +3213,59 @@ view_list_add(struct weston_compositor *compositor,
 	weston_view_update_transform(view);
 
 	if (wl_list_empty(&view->surface->subsurface_list)) {
-		wl_list_insert(compositor->view_list.prev, &view->link);
+		view_list_append(compositor, view);
 		return;
 	}
 
 	wl_list_for_each(sub, &view->surface->subsurface_list, parent_link) {
 		if (sub->surface == view->surface)
-			wl_list_insert(compositor->view_list.prev, &view->link);
+			view_list_append(compositor, view);
 		else
 			view_list_add_subsurface_view(compositor, sub, view);
 	}
 }
 
+/* Split the view list per output, so that repainting one output of
+ * many does not walk the views of all of them. */
+static int
+weston_compositor_build_output_view_lists(struct weston_compositor *compositor)
+{
+	struct weston_output *output;
+	struct weston_view *view, **views;
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		output->view_list.size = 0;
+		wl_list_for_each(view, &compositor->view_list, link) {
+			if (!(view->output_mask & (1u << output->id)))
+				continue;
+
+			views = wl_array_add(&output->view_list, sizeof *views);
+			if (!views)
+				return -1;
+			*views = view;
+		}
+	}
+
+	return 0;
+}
+
 static void
 weston_compositor_build_view_list(struct weston_compositor *compositor)
 {
 	struct weston_view *view;
-	struct weston_layer *layer;
+	struct weston_layer *layer, **layers;
 
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
 			surface_stash_subsurface_views(view->surface);
 
+	/* Serial 0 is reserved for views that have never been in the
+	 * list, see view_list_append() */
+	if (++compositor->view_list_serial == 0)
+		compositor->view_list_serial = 1;
+	compositor->view_list_length = 0;
+	compositor->scene_serial++;
+
 	wl_list_init(&compositor->view_list);
 	wl_list_for_each(layer, &compositor->layer_list, link) {
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link) {
@@ -2145,14 +3276,73 @@ weston_compositor_build_view_list(struct weston_compositor *compositor)
 	wl_list_for_each(layer, &compositor->layer_list, link)
 		wl_list_for_each(view, &layer->view_list.link, layer_link.link)
 			surface_free_unused_subsurface_views(view->surface);
+
+	/* Remember what the list was built from */
+	compositor->view_list_layers.size = 0;
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		layers = wl_array_add(&compositor->view_list_layers,
+				      sizeof *layers);
+		if (!layers)
+			return;
+		*layers = layer;
+		layer->dirty = 0;
+	}
+
+	if (weston_compositor_build_output_view_lists(compositor) < 0)
+		return;
+
+	compositor->view_list_dirty = 0;
+	compositor->view_transforms_dirty = 0;
+	compositor->output_view_lists_dirty = 0;
 }
 
+/* Views only moved, the list itself stands */
 static void
-weston_output_take_feedback_list(struct weston_output *output,
-				 struct weston_surface *surface)
+weston_compositor_update_view_transforms(struct weston_compositor *compositor)
 {
 	struct weston_view *view;
-	struct weston_presentation_feedback *feedback;
+
+	wl_list_for_each(view, &compositor->view_list, link)
+		weston_view_update_transform(view);
+
+	if (compositor->output_view_lists_dirty &&
+	    weston_compositor_build_output_view_lists(compositor) < 0)
+		return;
+
+	compositor->view_transforms_dirty = 0;
+	compositor->output_view_lists_dirty = 0;
+}
+
+/* Whether anything the view list is built from changed since the last
+ * build: the layer order, the views in the layers, the subsurfaces and
+ * the view geometry, which also determines the output_mask.
+ */
+static int
+weston_compositor_view_list_is_stale(struct weston_compositor *compositor)
+{
+	struct weston_layer *layer, **layers;
+	size_t n = compositor->view_list_layers.size / sizeof *layers;
+	size_t i = 0;
+
+	if (compositor->view_list_dirty)
+		return 1;
+
+	layers = compositor->view_list_layers.data;
+	wl_list_for_each(layer, &compositor->layer_list, link) {
+		if (i == n || layers[i] != layer || layer->dirty)
+			return 1;
+		i++;
+	}
+
+	return i != n;
+}
+
+static void
+weston_output_take_feedback(struct weston_output *output,
+			    struct weston_surface *surface)
+{
+	struct weston_view *view;
+	struct weston_presentation_feedback *feedback, *tmp, **p;
 	uint32_t flags = 0xffffffff;
 
 	if (wl_list_empty(&surface->feedback_list))
@@ -2165,22 +3355,229 @@ weston_output_take_feedback_list(struct weston_output *output,
 			flags &= view->psf_flags;
 	}
 
-	wl_list_for_each(feedback, &surface->feedback_list, link)
+	wl_list_for_each_safe(feedback, tmp, &surface->feedback_list, link) {
+		p = wl_array_add(&output->feedback_array, sizeof *p);
+		if (!p) {
+			weston_presentation_feedback_discard(feedback);
+			continue;
+		}
+
+		*p = feedback;
 		feedback->psf_flags = flags;
+		feedback->output = output;
+		feedback->slot = p - (struct weston_presentation_feedback **)
+			output->feedback_array.data;
+		wl_list_remove(&feedback->link);
+		wl_list_init(&feedback->link);
+	}
+}
 
-	wl_list_insert_list(&output->feedback_list, &surface->feedback_list);
-	wl_list_init(&surface->feedback_list);
+/* Account the time spent since 'begin' in the repaint cost estimate
+ *
+ * The estimate is a smoothed mean and mean deviation of the time it
+ * takes weston_output_repaint() to post a frame, as is done for round
+ * trip times in TCP (RFC 6298).
+ */
+static void
+weston_output_update_repaint_cost(struct weston_output *output,
+				  const struct timespec *begin)
+{
+	struct timespec now, cost;
+	int64_t sample, err;
+
+	weston_compositor_read_presentation_clock(output->compositor, &now);
+	timespec_sub(&cost, &now, begin);
+	sample = timespec_to_nsec(&cost);
+
+	if (output->repaint_cost_avg == 0) {
+		output->repaint_cost_avg = sample;
+		output->repaint_cost_dev = sample / 2;
+		return;
+	}
+
+	err = sample - output->repaint_cost_avg;
+	output->repaint_cost_avg += err / 8;
+	output->repaint_cost_dev += (llabs(err) - output->repaint_cost_dev) / 4;
+}
+
+/* Length of the repaint window, in nanoseconds
+ *
+ * With the adaptive repaint window, this is the predicted repaint cost
+ * plus a margin, at most one refresh period. Until the first repaint is
+ * measured, and otherwise, this is repaint_msec.
+ */
+static int64_t
+weston_output_repaint_window(struct weston_output *output,
+			     int64_t refresh_nsec)
+{
+	struct weston_compositor *compositor = output->compositor;
+	int64_t window;
+
+	if (!compositor->repaint_adaptive || output->repaint_cost_avg == 0)
+		return (int64_t)compositor->repaint_msec * 1000000;
+
+	window = output->repaint_cost_avg + 4 * output->repaint_cost_dev +
+		 REPAINT_WINDOW_MARGIN;
+
+	return MIN(window, refresh_nsec);
+}
+
+/* Take down what the renderer paints for this frame, see
+ * struct weston_render_item */
+static void
+weston_output_build_render_list(struct weston_output *output)
+{
+	struct weston_compositor *ec = output->compositor;
+	struct weston_view *ev, **views = output->view_list.data;
+	struct weston_render_item *item;
+	size_t i = output->view_list.size / sizeof *views;
+
+	output->render_list.size = 0;
+
+	/* Bottom to top */
+	while (i-- > 0) {
+		ev = views[i];
+		if (ev->plane != &ec->primary_plane)
+			continue;
+
+		item = wl_array_add(&output->render_list, sizeof *item);
+		if (!item) {
+			weston_log("out of memory for the render list\n");
+			return;
+		}
+
+		item->view = ev;
+		item->surface = ev->surface;
+		item->alpha = ev->alpha;
+		pixman_region32_init(&item->region);
+		pixman_region32_subtract(&item->region,
+					 &ev->transform.boundingbox, &ev->clip);
+		weston_view_to_output_matrix(ev, output, false, &item->matrix);
+
+		if (!pixman_region32_not_empty(&item->region)) {
+			pixman_region32_fini(&item->region);
+			output->render_list.size -= sizeof *item;
+		}
+	}
+}
+
+static void
+weston_output_clear_render_list(struct weston_output *output)
+{
+	struct weston_render_item *item;
+
+	wl_array_for_each(item, &output->render_list)
+		pixman_region32_fini(&item->region);
+	output->render_list.size = 0;
+}
+
+/* Whether no view of the surface shows on the output, as of the last
+ * damage accumulation */
+static bool
+weston_surface_is_occluded(struct weston_surface *surface,
+			   struct weston_output *output)
+{
+	struct weston_compositor *ec = surface->compositor;
+	struct weston_view *view;
+	pixman_region32_t visible;
+	bool occluded = true;
+
+	pixman_region32_init(&visible);
+	wl_list_for_each(view, &surface->views, surface_link) {
+		if (view->pick.serial != ec->view_list_serial || !view->plane)
+			continue;
+
+		pixman_region32_intersect(&visible,
+					  &view->transform.boundingbox,
+					  &output->region);
+		pixman_region32_subtract(&visible, &visible, &view->clip);
+		pixman_region32_subtract(&visible, &visible,
+					 &view->plane->clip);
+		if (pixman_region32_not_empty(&visible)) {
+			occluded = false;
+			break;
+		}
+	}
+	pixman_region32_fini(&visible);
+
+	return occluded;
+}
+
+/** Whether to hold back the frame callbacks of a surface this repaint
+ *
+ * A client drawing under other windows only gets a callback every
+ * occluded_frame_interval, enough to keep it alive without running its
+ * animations at the refresh rate.
+ */
+static bool
+weston_surface_frame_throttled(struct weston_surface *surface,
+			       struct weston_output *output)
+{
+	struct weston_compositor *ec = surface->compositor;
+	struct timespec now;
+	uint32_t msec, elapsed;
+
+	if (ec->occluded_frame_interval <= 0 ||
+	    surface->frame_throttle_disabled ||
+	    !weston_surface_is_occluded(surface, output)) {
+		surface->frame_throttle_time = 0;
+		return false;
+	}
+
+	if (wl_list_empty(&surface->frame_callback_list))
+		return false;
+
+	weston_compositor_read_presentation_clock(ec, &now);
+	msec = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+	if (msec == 0)
+		msec = 1;
+
+	elapsed = msec - surface->frame_throttle_time;
+	if (surface->frame_throttle_time == 0 ||
+	    elapsed >= (uint32_t) ec->occluded_frame_interval) {
+		surface->frame_throttle_time = msec;
+		return false;
+	}
+
+	/* Nothing else may repaint before then */
+	wl_event_source_timer_update(ec->frame_throttle_timer,
+				     ec->occluded_frame_interval - elapsed);
+
+	return true;
+}
+
+static int
+frame_throttle_timer_handler(void *data)
+{
+	struct weston_compositor *ec = data;
+
+	weston_compositor_schedule_repaint(ec);
+
+	return 0;
+}
+
+static void
+weston_frame_callback_send_list(struct wl_list *list, uint32_t time)
+{
+	struct weston_frame_callback *cb, *cnext;
+
+	wl_list_for_each_safe(cb, cnext, list, link) {
+		wl_callback_send_done(cb->resource, time);
+		wl_resource_destroy(cb->resource);
+	}
+	wl_list_init(list);
 }
 
 static int
 weston_output_repaint(struct weston_output *output)
 {
 	struct weston_compositor *ec = output->compositor;
-	struct weston_view *ev;
+	struct weston_view *ev, **views;
 	struct weston_animation *animation, *next;
-	struct weston_frame_callback *cb, *cnext;
 	struct wl_list frame_callback_list;
 	pixman_region32_t output_damage;
+	struct timespec begin;
+	size_t i, n;
 	int r;
 
 	if (output->destroying)
@@ -2188,34 +3585,67 @@ weston_output_repaint(struct weston_output *output)
 
 	TL_POINT("core_repaint_begin", TLP_OUTPUT(output), TLP_END);
 
-	/* Rebuild the surface list and update surface transforms up front. */
-	weston_compositor_build_view_list(ec);
+	weston_compositor_read_presentation_clock(ec, &begin);
+	output->last_repaint = begin;
 
-	if (output->assign_planes && !output->disable_planes) {
+	/* A surface committing frame after frame is animating */
+	if (output->idle_refresh_committed)
+		output->idle_refresh_commit_frames++;
+	else
+		output->idle_refresh_commit_frames = 0;
+	output->idle_refresh_committed = false;
+
+	/* Rebuild the surface list and update surface transforms up front,
+	 * unless another output already did and nothing changed since. */
+	if (weston_compositor_view_list_is_stale(ec))
+		weston_compositor_build_view_list(ec);
+	else if (ec->view_transforms_dirty)
+		weston_compositor_update_view_transforms(ec);
+
+	/* With a side channel for the cursor the backend still gets to
+	 * put that one on a plane, see weston_output::disable_planes */
+	if (output->assign_planes &&
+	    (!output->disable_planes || output->side_channel_pointer)) {
 		output->assign_planes(output);
-	} else {
+	} else if (output->disable_planes) {
 		wl_list_for_each(ev, &ec->view_list, link) {
 			weston_view_move_to_plane(ev, &ec->primary_plane);
 			ev->psf_flags = 0;
 		}
+	} else {
+		wl_list_for_each(ev, &ec->view_list, link) {
+			weston_view_move_to_plane(ev,
+					weston_view_get_fallback_plane(ev));
+			ev->psf_flags = 0;
+		}
 	}
 
+	FRAME_STATS(output_repaint, output);
+
+	compositor_accumulate_damage(ec);
+
+	/* After the damage, which tells what is occluded */
 	wl_list_init(&frame_callback_list);
-	wl_list_for_each(ev, &ec->view_list, link) {
+	views = output->view_list.data;
+	n = output->view_list.size / sizeof *views;
+	for (i = 0; i < n; i++) {
+		ev = views[i];
+
 		/* Note: This operation is safe to do multiple times on the
 		 * same surface.
 		 */
 		if (ev->surface->output == output) {
-			wl_list_insert_list(&frame_callback_list,
-					    &ev->surface->frame_callback_list);
-			wl_list_init(&ev->surface->frame_callback_list);
-
-			weston_output_take_feedback_list(output, ev->surface);
+			if (!weston_surface_frame_throttled(ev->surface,
+							    output)) {
+				wl_list_insert_list(&frame_callback_list,
+						    &ev->surface->frame_callback_list);
+				wl_list_init(&ev->surface->frame_callback_list);
+			}
+
+			weston_output_take_feedback(output, ev->surface);
 		}
 	}
 
-	compositor_accumulate_damage(ec);
-
 	pixman_region32_init(&output_damage);
 	pixman_region32_intersect(&output_damage,
 				  &ec->primary_plane.damage, &output->region);
@@ -2225,27 +3655,41 @@ weston_output_repaint(struct weston_output *output)
 	if (output->dirty)
 		weston_output_update_matrix(output);
 
+	weston_output_build_render_list(output);
 	r = output->repaint(output, &output_damage);
+	weston_output_clear_render_list(output);
+
+	/* The renderer drew the software cursor along */
+	pixman_region32_subtract(&ec->cursor_plane.damage,
+				 &ec->cursor_plane.damage, &output->region);
 
 	pixman_region32_fini(&output_damage);
+	weston_frame_arena_reset(&output->frame_arena);
 
 	output->repaint_needed = 0;
 
 	weston_compositor_repick(ec);
 	wl_event_loop_dispatch(ec->input_loop, 0);
 
-	wl_list_for_each_safe(cb, cnext, &frame_callback_list, link) {
-		wl_callback_send_done(cb->resource, output->frame_time);
-		wl_resource_destroy(cb->resource);
-	}
+	/* A frame that failed to post will not be presented */
+	if (ec->present_frame_callbacks && r == 0)
+		wl_list_insert_list(output->frame_callback_list.prev,
+				    &frame_callback_list);
+	else
+		weston_frame_callback_send_list(&frame_callback_list,
+						output->frame_time);
 
 	wl_list_for_each_safe(animation, next, &output->animation_list, link) {
 		animation->frame_counter++;
 		animation->frame(animation, output, output->frame_time);
 	}
+	weston_compositor_run_view_animations(output, output->frame_time);
 
 	TL_POINT("core_repaint_posted", TLP_OUTPUT(output), TLP_END);
 
+	if (ec->repaint_adaptive && r == 0)
+		weston_output_update_repaint_cost(output, &begin);
+
 	return r;
 }
 
@@ -2285,6 +3729,23 @@ output_repaint_timer_handler(void *data)
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
 
+	/* Whichever of the timer and the preempting idle comes first */
+	if (output->repaint_preempt_source) {
+		wl_event_source_remove(output->repaint_preempt_source);
+		output->repaint_preempt_source = NULL;
+	}
+
+	output->idle_refresh_delayed = false;
+
+	/* How late this runs against the deadline is the scheduling
+	 * slip, e.g. from client requests served before the timer */
+	if (output->repaint_deadline.tv_sec || output->repaint_deadline.tv_nsec) {
+		TL_POINT("core_repaint_timer", TLP_OUTPUT(output),
+			 TLP_DEADLINE(&output->repaint_deadline), TLP_END);
+		output->repaint_deadline.tv_sec = 0;
+		output->repaint_deadline.tv_nsec = 0;
+	}
+
 	if (output->repaint_needed &&
 	    compositor->state != WESTON_COMPOSITOR_SLEEPING &&
 	    compositor->state != WESTON_COMPOSITOR_OFFSCREEN &&
@@ -2296,6 +3757,72 @@ output_repaint_timer_handler(void *data)
 	return 0;
 }
 
+/* Whether the damage waiting for the next repaint of the output,
+ * also of surfaces committed since the last, is at most
+ * idle_refresh_damage percent of it */
+static bool
+weston_output_idle_refresh_damage_small(struct weston_output *output)
+{
+	struct weston_compositor *compositor = output->compositor;
+	struct weston_view *view;
+	pixman_region32_t damage, view_damage;
+	pixman_box32_t *extents, *rects;
+	int64_t area, limit;
+	int i, n;
+
+	pixman_region32_init(&damage);
+	pixman_region32_init(&view_damage);
+	pixman_region32_copy(&damage, &compositor->primary_plane.damage);
+
+	wl_list_for_each(view, &compositor->view_list, link) {
+		if (!(view->output_mask & (1u << output->id)) ||
+		    !pixman_region32_not_empty(&view->surface->damage))
+			continue;
+
+		if (view->transform.enabled) {
+			extents = pixman_region32_extents(&view->surface->damage);
+			view_compute_bbox(view, extents, &view_damage);
+		} else {
+			pixman_region32_copy(&view_damage,
+					     &view->surface->damage);
+			pixman_region32_translate(&view_damage,
+						  view->geometry.x,
+						  view->geometry.y);
+		}
+		pixman_region32_union(&damage, &damage, &view_damage);
+	}
+
+	pixman_region32_intersect(&damage, &damage, &output->region);
+
+	area = 0;
+	rects = pixman_region32_rectangles(&damage, &n);
+	for (i = 0; i < n; i++)
+		area += (int64_t) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1);
+
+	pixman_region32_fini(&view_damage);
+	pixman_region32_fini(&damage);
+
+	limit = (int64_t) output->width * output->height *
+		compositor->idle_refresh_damage / 100;
+
+	return area <= limit;
+}
+
+/* Whether the next repaint of the output may be pushed back while
+ * idle: only small updates that are not part of an animation are */
+static bool
+weston_output_idle_refresh_may_delay(struct weston_output *output)
+{
+	if (!output->compositor->idle_refresh)
+		return false;
+
+	if (output->idle_refresh_commit_frames >= 2)
+		return false;
+
+	return weston_output_idle_refresh_damage_small(output);
+}
+
 WL_EXPORT void
 weston_output_finish_frame(struct weston_output *output,
 			   const struct timespec *stamp,
@@ -2303,25 +3830,61 @@ weston_output_finish_frame(struct weston_output *output,
 {
 	struct weston_compositor *compositor = output->compositor;
 	int32_t refresh_nsec;
+	int64_t present_nsec;
 	struct timespec now;
 	struct timespec gone;
-	int msec;
+	struct timespec deadline;
+	int64_t window;
+	int msec, idle_msec;
 
 	TL_POINT("core_repaint_finished", TLP_OUTPUT(output),
 		 TLP_VBLANK(stamp), TLP_END);
 
+	client_usage_release_held(compositor);
+
+	FRAME_STATS(output_present, output, stamp, presented_flags);
+
 	refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
-	weston_presentation_feedback_present_list(&output->feedback_list,
-						  output, refresh_nsec, stamp,
-						  output->msc,
-						  presented_flags);
+
+	/* With adaptive sync the mode refresh is only the shortest
+	 * possible, report how long the frame actually lasted */
+	present_nsec = refresh_nsec;
+	if (presented_flags & PRESENTATION_FEEDBACK_KIND_VSYNC) {
+		if (output->adaptive_sync && output->last_present.tv_sec) {
+			timespec_sub(&gone, stamp, &output->last_present);
+			present_nsec = MAX(timespec_to_nsec(&gone),
+					   present_nsec);
+			if (present_nsec > NSEC_PER_SEC)
+				present_nsec = refresh_nsec;
+		}
+		output->last_present = *stamp;
+	}
+
+	weston_output_present_feedback(output, present_nsec, stamp,
+				       output->msc, presented_flags);
 
 	output->frame_time = stamp->tv_sec * 1000 + stamp->tv_nsec / 1000000;
 
+	/* Clients drawing from here have a whole refresh until the
+	 * next deadline, and the time of the flip to animate with. */
+	weston_frame_callback_send_list(&output->frame_callback_list,
+					output->frame_time);
+
 	weston_compositor_read_presentation_clock(compositor, &now);
 	timespec_sub(&gone, &now, stamp);
+	window = weston_output_repaint_window(output, refresh_nsec);
+
+	timespec_add_nsec(&deadline, stamp, refresh_nsec - window);
+	TL_POINT("core_repaint_deadline", TLP_OUTPUT(output),
+		 TLP_DEADLINE(&deadline), TLP_END);
+
 	msec = (refresh_nsec - timespec_to_nsec(&gone)) / 1000000; /* floor */
-	msec -= compositor->repaint_msec;
+
+	/* The timer has millisecond granularity, round the window up */
+	if (window > 0)
+		msec -= (window + 999999) / 1000000;
+	else
+		msec -= window / 1000000;
 
 	if (msec < -1000 || msec > 1000) {
 		static bool warned;
@@ -2338,13 +3901,88 @@ weston_output_finish_frame(struct weston_output *output,
 	 * the deadline given by repaint_msec? In that case we delay until
 	 * the deadline of the next frame, to give clients a more predictable
 	 * timing of the repaint cycle to lock on. */
-	if (presented_flags == PRESENTATION_FEEDBACK_INVALID && msec < 0)
+	if (presented_flags == PRESENTATION_FEEDBACK_INVALID && msec < 0 &&
+	    !output->adaptive_sync)
 		msec += refresh_nsec / 1000000;
 
-	if (msec < 1)
+	/* The display is holding its vblank until our flip, so a commit
+	 * arriving late in the frame is shown now instead of judder
+	 * waiting for the next fixed deadline */
+	if (presented_flags == PRESENTATION_FEEDBACK_INVALID &&
+	    output->adaptive_sync && msec < 0)
+		msec = 0;
+
+	/* Idle, the damage of several refreshes goes into one frame. An
+	 * adaptive sync display then also refreshes less often. */
+	if (weston_output_idle_refresh_may_delay(output)) {
+		timespec_sub(&gone, &now, &output->last_repaint);
+		idle_msec = compositor->idle_refresh_interval -
+			    timespec_to_nsec(&gone) / 1000000;
+		if (idle_msec > msec) {
+			msec = idle_msec;
+			output->idle_refresh_delayed = true;
+		}
+	}
+
+	if (msec < 1) {
 		output_repaint_timer_handler(output);
-	else
+	} else {
+		/* Not to be preempted while delayed */
+		if (!output->idle_refresh_delayed)
+			output->repaint_deadline = deadline;
 		wl_event_source_timer_update(output->repaint_timer, msec);
+	}
+}
+
+static void
+output_repaint_preempt_idle(void *data)
+{
+	struct weston_output *output = data;
+
+	output->repaint_preempt_source = NULL;
+	output_repaint_timer_handler(output);
+}
+
+/* Client requests are dispatched in the order their sockets became
+ * readable, the repaint timer may come after a long burst of them.
+ * Checked between requests that are expensive enough to matter, moves
+ * the repaint of every output that should have started by now from
+ * its timer to an idle callback. That runs before the event loop
+ * polls again, not from within the commit. */
+static void
+weston_compositor_preempt_repaint(struct weston_compositor *compositor)
+{
+	struct weston_output *output;
+	struct wl_event_loop *loop;
+	struct timespec now, late;
+
+	if (!compositor->repaint_preempt)
+		return;
+
+	weston_compositor_read_presentation_clock(compositor, &now);
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (output->repaint_preempt_source)
+			continue;
+
+		if (!output->repaint_deadline.tv_sec &&
+		    !output->repaint_deadline.tv_nsec)
+			continue;
+
+		timespec_sub(&late, &now, &output->repaint_deadline);
+		if (timespec_to_nsec(&late) < 0)
+			continue;
+
+		TL_POINT("core_repaint_preempt", TLP_OUTPUT(output),
+			 TLP_DEADLINE(&output->repaint_deadline), TLP_END);
+		output->repaint_preempt_source =
+			wl_event_loop_add_idle(loop,
+					       output_repaint_preempt_idle,
+					       output);
+		if (output->repaint_preempt_source)
+			wl_event_source_timer_update(output->repaint_timer, 0);
+	}
 }
 
 static void
@@ -2361,6 +3999,8 @@ weston_layer_entry_insert(struct weston_layer_entry *list,
 {
 	wl_list_insert(&list->link, &entry->link);
 	entry->layer = list->layer;
+	if (entry->layer)
+		entry->layer->dirty = 1;
 }
 
 WL_EXPORT void
@@ -2368,6 +4008,8 @@ weston_layer_entry_remove(struct weston_layer_entry *entry)
 {
 	wl_list_remove(&entry->link);
 	wl_list_init(&entry->link);
+	if (entry->layer)
+		entry->layer->dirty = 1;
 	entry->layer = NULL;
 }
 
@@ -2376,6 +4018,7 @@ weston_layer_init(struct weston_layer *layer, struct wl_list *below)
 {
 	wl_list_init(&layer->view_list.link);
 	layer->view_list.layer = layer;
+	layer->dirty = 1;
 	weston_layer_set_mask_infinite(layer);
 	if (below != NULL)
 		wl_list_insert(below, &layer->link);
@@ -2462,6 +4105,13 @@ surface_attach(struct wl_client *client,
 			wl_client_post_no_memory(client);
 			return;
 		}
+
+		if (!buffer->accounted &&
+		    client_usage_account_buffer(surface->compositor, client,
+						buffer) < 0) {
+			wl_client_post_no_memory(client);
+			return;
+		}
 	}
 
 	/* Attach, attach, without commit in between does not send
@@ -2485,6 +4135,18 @@ surface_damage(struct wl_client *client,
 				   x, y, width, height);
 }
 
+static void
+surface_damage_buffer(struct wl_client *client,
+		      struct wl_resource *resource,
+		      int32_t x, int32_t y, int32_t width, int32_t height)
+{
+	struct weston_surface *surface = wl_resource_get_user_data(resource);
+
+	pixman_region32_union_rect(&surface->pending.damage_buffer,
+				   &surface->pending.damage_buffer,
+				   x, y, width, height);
+}
+
 static void
 destroy_frame_callback(struct wl_resource *resource)
 {
@@ -2536,6 +4198,7 @@ surface_set_opaque_region(struct wl_client *client,
 	} else {
 		pixman_region32_clear(&surface->pending.opaque);
 	}
+	surface->pending.dirty |= WESTON_SURFACE_STATE_OPAQUE;
 }
 
 static void
@@ -2554,6 +4217,23 @@ surface_set_input_region(struct wl_client *client,
 		pixman_region32_fini(&surface->pending.input);
 		region_init_infinite(&surface->pending.input);
 	}
+	surface->pending.dirty |= WESTON_SURFACE_STATE_INPUT;
+}
+
+static bool
+subsurface_order_changed(struct weston_surface *surface)
+{
+	struct wl_list *pending = surface->subsurface_list_pending.next;
+	struct weston_subsurface *sub;
+
+	wl_list_for_each(sub, &surface->subsurface_list, parent_link) {
+		if (pending == &surface->subsurface_list_pending ||
+		    pending != &sub->parent_link_pending)
+			return true;
+		pending = pending->next;
+	}
+
+	return pending != &surface->subsurface_list_pending;
 }
 
 static void
@@ -2561,11 +4241,17 @@ weston_surface_commit_subsurface_order(struct weston_surface *surface)
 {
 	struct weston_subsurface *sub;
 
+	/* Most commits leave the order alone, and the view list with it */
+	if (!subsurface_order_changed(surface))
+		return;
+
 	wl_list_for_each_reverse(sub, &surface->subsurface_list_pending,
 				 parent_link_pending) {
 		wl_list_remove(&sub->parent_link);
 		wl_list_insert(&surface->subsurface_list, &sub->parent_link);
 	}
+
+	surface->compositor->view_list_dirty = 1;
 }
 
 static void
@@ -2644,29 +4330,124 @@ weston_surface_build_buffer_matrix(struct weston_surface *surface,
 	weston_matrix_scale(matrix, vp->buffer.scale, vp->buffer.scale, 1);
 }
 
+/* Many damage rectangles make every later step slower, from the upload
+ * to the repaint, while a few larger ones cost little extra. */
+static void
+surface_coarsen_damage(struct weston_surface *surface)
+{
+	int max_rects = surface->compositor->damage_max_rects;
+	uint32_t nrects;
+
+	if (max_rects <= 0)
+		return;
+
+	nrects = pixman_region32_n_rects(&surface->damage);
+	if (nrects <= 1)
+		return;
+
+	TL_POINT("core_damage_coarsen_begin", TLP_SURFACE(surface),
+		 TLP_RECTS(&nrects), TLP_END);
+	weston_region_coarsen(&surface->damage, max_rects);
+	weston_region_coarsen(&surface->buffer_damage, max_rects);
+	nrects = pixman_region32_n_rects(&surface->damage);
+	TL_POINT("core_damage_coarsen_end", TLP_SURFACE(surface),
+		 TLP_RECTS(&nrects), TLP_END);
+}
+
+static void
+region_union_into(pixman_region32_t *dest, pixman_region32_t *src)
+{
+	if (pixman_region32_not_empty(dest))
+		pixman_region32_union(dest, dest, src);
+	else
+		region_swap(dest, src);
+	pixman_region32_clear(src);
+}
+
+/* Surface damage is kept in both coordinate spaces: the surface one
+ * damages the views, the buffer one is what the renderer uploads.
+ * Damage the client gave in buffer coordinates goes to the renderer
+ * exactly, without the rounding of a round trip through the surface
+ * space. */
+static void
+surface_commit_damage(struct weston_surface *surface,
+		      struct weston_surface_state *state)
+{
+	struct weston_buffer *buffer = surface->buffer_ref.buffer;
+	pixman_region32_t converted;
+
+	if (pixman_region32_not_empty(&state->damage)) {
+		pixman_region32_init(&converted);
+		weston_surface_to_buffer_region(surface, &state->damage,
+						&converted);
+		region_union_into(&surface->buffer_damage, &converted);
+		pixman_region32_fini(&converted);
+
+		region_union_into(&surface->damage, &state->damage);
+	}
+
+	if (pixman_region32_not_empty(&state->damage_buffer)) {
+		pixman_region32_init(&converted);
+		weston_matrix_transform_region(&converted,
+					       &surface->buffer_to_surface_matrix,
+					       &state->damage_buffer);
+		region_union_into(&surface->damage, &converted);
+		pixman_region32_fini(&converted);
+
+		region_union_into(&surface->buffer_damage,
+				  &state->damage_buffer);
+	}
+
+	pixman_region32_intersect_rect(&surface->damage, &surface->damage,
+				       0, 0, surface->width, surface->height);
+	if (buffer)
+		pixman_region32_intersect_rect(&surface->buffer_damage,
+					       &surface->buffer_damage,
+					       0, 0, buffer->width,
+					       buffer->height);
+	else
+		pixman_region32_clear(&surface->buffer_damage);
+}
+
 static void
 weston_surface_commit_state(struct weston_surface *surface,
 			    struct weston_surface_state *state)
 {
 	struct weston_view *view;
 	pixman_region32_t opaque;
+	int32_t old_width = surface->width;
+	int32_t old_height = surface->height;
+	uint32_t dirty;
 
 	/* wl_surface.set_buffer_transform */
 	/* wl_surface.set_buffer_scale */
 	/* wl_viewport.set */
 	surface->buffer_viewport = state->buffer_viewport;
 
+	/* ztearing_control.set_presentation_hint */
+	surface->async_flip = state->async_flip;
+
 	/* wl_surface.attach */
-	if (state->newly_attached)
+	if (state->newly_attached) {
+		/* zlinux_surface_synchronization, renderers and backends
+		 * pick these up in attach and when placing the view */
+		fd_move(&surface->acquire_fence_fd, state->acquire_fence_fd);
+		state->acquire_fence_fd = -1;
+		weston_buffer_release_move(&surface->buffer_release_ref,
+					   &state->buffer_release_ref);
 		weston_surface_attach(surface, state->buffer);
+		if (state->buffer)
+			FRAME_STATS(surface_commit, surface);
+	}
 	weston_surface_state_set_buffer(state, NULL);
 
-	weston_surface_build_buffer_matrix(surface,
-					   &surface->surface_to_buffer_matrix);
-	weston_matrix_invert(&surface->buffer_to_surface_matrix,
-			     &surface->surface_to_buffer_matrix);
-
+	/* The buffer matrix only depends on the viewport and the buffer
+	 * size, so damage-only commits can skip it. */
 	if (state->newly_attached || state->buffer_viewport.changed) {
+		weston_surface_build_buffer_matrix(surface,
+					&surface->surface_to_buffer_matrix);
+		weston_matrix_invert(&surface->buffer_to_surface_matrix,
+				     &surface->surface_to_buffer_matrix);
 		weston_surface_update_size(surface);
 		if (surface->configure)
 			surface->configure(surface, state->sx, state->sy);
@@ -2677,32 +4458,47 @@ weston_surface_commit_state(struct weston_surface *surface,
 	state->newly_attached = 0;
 	state->buffer_viewport.changed = 0;
 
-	/* wl_surface.damage */
+	/* Only now, configure() may have set the regions, as for the
+	 * empty input region of cursors and drag icons */
+	dirty = state->dirty;
+
+	/* wl_surface.damage and wl_surface.damage_buffer */
 	if (weston_timeline_enabled_ &&
-	    pixman_region32_not_empty(&state->damage))
+	    (pixman_region32_not_empty(&state->damage) ||
+	     pixman_region32_not_empty(&state->damage_buffer)))
 		TL_POINT("core_commit_damage", TLP_SURFACE(surface), TLP_END);
-	pixman_region32_union(&surface->damage, &surface->damage,
-			      &state->damage);
-	pixman_region32_intersect_rect(&surface->damage, &surface->damage,
-				       0, 0, surface->width, surface->height);
-	pixman_region32_clear(&state->damage);
+	surface_commit_damage(surface, state);
+	surface_coarsen_damage(surface);
+
+	/* The regions are sticky and clipped to the surface size, so
+	 * they only need redoing if they or the size changed. */
+	if (surface->width != old_width || surface->height != old_height)
+		dirty |= WESTON_SURFACE_STATE_OPAQUE |
+			 WESTON_SURFACE_STATE_INPUT;
+	state->dirty = 0;
 
 	/* wl_surface.set_opaque_region */
-	pixman_region32_init(&opaque);
-	pixman_region32_intersect_rect(&opaque, &state->opaque,
-				       0, 0, surface->width, surface->height);
+	if (dirty & WESTON_SURFACE_STATE_OPAQUE) {
+		pixman_region32_init(&opaque);
+		pixman_region32_intersect_rect(&opaque, &state->opaque, 0, 0,
+					       surface->width, surface->height);
 
-	if (!pixman_region32_equal(&opaque, &surface->opaque)) {
-		pixman_region32_copy(&surface->opaque, &opaque);
-		wl_list_for_each(view, &surface->views, surface_link)
-			weston_view_geometry_dirty(view);
-	}
+		if (!pixman_region32_equal(&opaque, &surface->opaque)) {
+			pixman_region32_copy(&surface->opaque, &opaque);
+			wl_list_for_each(view, &surface->views, surface_link)
+				weston_view_geometry_dirty(view);
+		}
 
-	pixman_region32_fini(&opaque);
+		pixman_region32_fini(&opaque);
+	}
 
 	/* wl_surface.set_input_region */
-	pixman_region32_intersect_rect(&surface->input, &state->input,
-				       0, 0, surface->width, surface->height);
+	if (dirty & WESTON_SURFACE_STATE_INPUT) {
+		pixman_region32_intersect_rect(&surface->input, &state->input,
+					       0, 0, surface->width,
+					       surface->height);
+		surface->compositor->scene_serial++;
+	}
 
 	/* wl_surface.frame */
 	wl_list_insert_list(&surface->frame_callback_list,
@@ -2720,6 +4516,27 @@ weston_surface_commit_state(struct weston_surface *surface,
 	wl_list_init(&state->feedback_list);
 }
 
+/* Notes the commit for the idle refresh of the outputs the surface is
+ * on, and ends the delay of those it now damages too much */
+static void
+weston_surface_idle_refresh_commit(struct weston_surface *surface)
+{
+	struct weston_output *output;
+
+	wl_list_for_each(output, &surface->compositor->output_list, link) {
+		if (!(surface->output_mask & (1u << output->id)))
+			continue;
+
+		output->idle_refresh_committed = true;
+
+		if (output->idle_refresh_delayed &&
+		    !weston_output_idle_refresh_damage_small(output)) {
+			output->idle_refresh_delayed = false;
+			wl_event_source_timer_update(output->repaint_timer, 1);
+		}
+	}
+}
+
 static void
 weston_surface_commit(struct weston_surface *surface)
 {
@@ -2727,6 +4544,8 @@ weston_surface_commit(struct weston_surface *surface)
 
 	weston_surface_commit_subsurface_order(surface);
 
+	weston_surface_idle_refresh_commit(surface);
+
 	weston_surface_schedule_repaint(surface);
 }
 
@@ -2743,6 +4562,13 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 	struct weston_surface *surface = wl_resource_get_user_data(resource);
 	struct weston_subsurface *sub = weston_surface_to_subsurface(surface);
 
+	if (linux_explicit_synchronization_check_commit(surface) < 0)
+		return;
+
+	TL_POINT("core_commit", TLP_SURFACE(surface), TLP_END);
+	client_usage_count_commit(surface, client);
+	wl_signal_emit(&surface->compositor->commit_signal, surface);
+
 	if (sub) {
 		weston_subsurface_commit(sub);
 		return;
@@ -2754,6 +4580,8 @@ surface_commit(struct wl_client *client, struct wl_resource *resource)
 		if (sub->surface != surface)
 			weston_subsurface_parent_commit(sub, 0);
 	}
+
+	weston_compositor_preempt_repaint(surface->compositor);
 }
 
 static void
@@ -2804,7 +4632,8 @@ static const struct wl_surface_interface surface_interface = {
 	surface_set_input_region,
 	surface_commit,
 	surface_set_buffer_transform,
-	surface_set_buffer_scale
+	surface_set_buffer_scale,
+	surface_damage_buffer
 };
 
 static void
@@ -2813,6 +4642,13 @@ compositor_create_surface(struct wl_client *client,
 {
 	struct weston_compositor *ec = wl_resource_get_user_data(resource);
 	struct weston_surface *surface;
+	struct weston_client_usage *usage;
+
+	usage = weston_client_usage_get(ec, client);
+	if (usage == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
 
 	surface = weston_surface_create(ec);
 	if (surface == NULL) {
@@ -2830,6 +4666,7 @@ compositor_create_surface(struct wl_client *client,
 	}
 	wl_resource_set_implementation(surface->resource, &surface_interface,
 				       surface, destroy_surface);
+	usage->surfaces++;
 
 	wl_signal_emit(&ec->create_surface_signal, surface);
 }
@@ -2926,18 +4763,39 @@ static void
 weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
 {
 	struct weston_surface *surface = sub->surface;
+	uint32_t dirty;
 
 	/*
 	 * If this commit would cause the surface to move by the
 	 * attach(dx, dy) parameters, the old damage region must be
 	 * translated to correspond to the new surface coordinate system
 	 * original_mode.
+	 *
+	 * With nothing cached yet, the pending damage is simply handed
+	 * over, leaving the empty cached region in pending.
 	 */
-	pixman_region32_translate(&sub->cached.damage,
-				  -surface->pending.sx, -surface->pending.sy);
-	pixman_region32_union(&sub->cached.damage, &sub->cached.damage,
-			      &surface->pending.damage);
-	pixman_region32_clear(&surface->pending.damage);
+	if (!pixman_region32_not_empty(&sub->cached.damage)) {
+		region_swap(&sub->cached.damage, &surface->pending.damage);
+	} else {
+		if (surface->pending.sx != 0 || surface->pending.sy != 0)
+			pixman_region32_translate(&sub->cached.damage,
+						  -surface->pending.sx,
+						  -surface->pending.sy);
+		if (pixman_region32_not_empty(&surface->pending.damage)) {
+			pixman_region32_union(&sub->cached.damage,
+					      &sub->cached.damage,
+					      &surface->pending.damage);
+			pixman_region32_clear(&surface->pending.damage);
+		}
+	}
+
+	/* Buffer coordinates do not move with attach(dx, dy) */
+	if (pixman_region32_not_empty(&surface->pending.damage_buffer)) {
+		pixman_region32_union(&sub->cached.damage_buffer,
+				      &sub->cached.damage_buffer,
+				      &surface->pending.damage_buffer);
+		pixman_region32_clear(&surface->pending.damage_buffer);
+	}
 
 	if (surface->pending.newly_attached) {
 		sub->cached.newly_attached = 1;
@@ -2945,6 +4803,11 @@ weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
 						surface->pending.buffer);
 		weston_buffer_reference(&sub->cached_buffer_ref,
 					surface->pending.buffer);
+		fd_move(&sub->cached.acquire_fence_fd,
+			surface->pending.acquire_fence_fd);
+		surface->pending.acquire_fence_fd = -1;
+		weston_buffer_release_move(&sub->cached.buffer_release_ref,
+					   &surface->pending.buffer_release_ref);
 		weston_presentation_feedback_discard_list(
 					&sub->cached.feedback_list);
 	}
@@ -2958,11 +4821,24 @@ weston_subsurface_commit_to_cache(struct weston_subsurface *sub)
 	sub->cached.buffer_viewport.surface =
 		surface->pending.buffer_viewport.surface;
 
+	sub->cached.async_flip = surface->pending.async_flip;
+
 	weston_surface_reset_pending_buffer(surface);
 
-	pixman_region32_copy(&sub->cached.opaque, &surface->pending.opaque);
+	/* The regions are sticky: unless they changed, the cache already
+	 * holds the same ones. */
+	dirty = surface->pending.dirty | sub->cache_stale;
+	if (dirty & WESTON_SURFACE_STATE_OPAQUE)
+		pixman_region32_copy(&sub->cached.opaque,
+				     &surface->pending.opaque);
+
+	if (dirty & WESTON_SURFACE_STATE_INPUT)
+		pixman_region32_copy(&sub->cached.input,
+				     &surface->pending.input);
 
-	pixman_region32_copy(&sub->cached.input, &surface->pending.input);
+	sub->cached.dirty |= dirty;
+	sub->cache_stale = 0;
+	surface->pending.dirty = 0;
 
 	wl_list_insert_list(&sub->cached.frame_callback_list,
 			    &surface->pending.frame_callback_list);
@@ -3006,6 +4882,7 @@ weston_subsurface_commit(struct weston_subsurface *sub)
 			weston_subsurface_commit_to_cache(sub);
 			weston_subsurface_commit_from_cache(sub);
 		} else {
+			sub->cache_stale |= surface->pending.dirty;
 			weston_surface_commit(surface);
 		}
 
@@ -3096,6 +4973,9 @@ subsurface_configure(struct weston_surface *surface, int32_t dx, int32_t dy)
 
 		surface->output = output;
 		weston_surface_update_output_mask(surface, 1 << output->id);
+
+		/* Mapped sub-surfaces get their views at the next build */
+		compositor->view_list_dirty = 1;
 	}
 }
 
@@ -3119,6 +4999,65 @@ weston_surface_get_main_surface(struct weston_surface *surface)
 	return surface;
 }
 
+/** Get the extents of a surface and its direct sub-surfaces
+ *
+ * \param surface The parent surface.
+ * \param box Returns the bounding box in surface-local coordinates.
+ *
+ * Sub-surfaces are counted at their latest requested position. The
+ * result is cached on the surface and only recomputed after a size
+ * change of the surface or one of its sub-surfaces, or a sub-surface
+ * being added, removed or moved, so shells can call this on every
+ * step of an interactive move or resize.
+ */
+WL_EXPORT void
+weston_surface_get_subsurfaces_extents(struct weston_surface *surface,
+				       pixman_box32_t *box)
+{
+	struct weston_subsurface *sub;
+	pixman_box32_t *e = &surface->subsurfaces_extents;
+	bool empty = true;
+	int32_t w, h;
+
+	if (!surface->subsurfaces_extents_dirty) {
+		*box = *e;
+		return;
+	}
+
+	/* Same result as the extents of the union of all the rects,
+	 * without building the region: empty rects do not count. */
+	e->x1 = e->y1 = e->x2 = e->y2 = 0;
+	if (surface->width > 0 && surface->height > 0) {
+		e->x2 = surface->width;
+		e->y2 = surface->height;
+		empty = false;
+	}
+
+	wl_list_for_each(sub, &surface->subsurface_list, parent_link) {
+		w = sub->surface->width;
+		h = sub->surface->height;
+		if (sub->surface == surface || w <= 0 || h <= 0)
+			continue;
+
+		if (empty) {
+			e->x1 = sub->position.x;
+			e->y1 = sub->position.y;
+			e->x2 = sub->position.x + w;
+			e->y2 = sub->position.y + h;
+			empty = false;
+			continue;
+		}
+
+		e->x1 = MIN(e->x1, sub->position.x);
+		e->y1 = MIN(e->y1, sub->position.y);
+		e->x2 = MAX(e->x2, sub->position.x + w);
+		e->y2 = MAX(e->y2, sub->position.y + h);
+	}
+
+	surface->subsurfaces_extents_dirty = false;
+	*box = *e;
+}
+
 WL_EXPORT int
 weston_surface_set_role(struct weston_surface *surface,
 			const char *role_name,
@@ -3218,40 +5157,113 @@ weston_surface_get_content_size(struct weston_surface *surface,
  * Use surface_get_data_size to determine the content size; the
  * needed target buffer size and rectangle limits.
  *
- * CURRENT IMPLEMENTATION RESTRICTIONS:
- * - the machine must be little-endian due to Pixman formats.
+ * CURRENT IMPLEMENTATION RESTRICTIONS:
+ * - the machine must be little-endian due to Pixman formats.
+ *
+ * NOTE: Pixman formats are premultiplied.
+ */
+WL_EXPORT int
+weston_surface_copy_content(struct weston_surface *surface,
+			    void *target, size_t size,
+			    int src_x, int src_y,
+			    int width, int height)
+{
+	struct weston_renderer *rer = surface->compositor->renderer;
+	int cw, ch;
+	const size_t bytespp = 4; /* PIXMAN_a8b8g8r8 */
+
+	if (!rer->surface_copy_content)
+		return -1;
+
+	weston_surface_get_content_size(surface, &cw, &ch);
+
+	if (src_x < 0 || src_y < 0)
+		return -1;
+
+	if (width <= 0 || height <= 0)
+		return -1;
+
+	if (src_x + width > cw || src_y + height > ch)
+		return -1;
+
+	if (width * bytespp * height > size)
+		return -1;
+
+	return rer->surface_copy_content(surface, target, size,
+					 src_x, src_y, width, height);
+}
+
+/** Copy surface contents to system memory without waiting for the GPU
+ *
+ * \param surface The surface to copy from.
+ * \param target Pointer to the target memory buffer.
+ * \param size Size of the target buffer in bytes.
+ * \param src_x X location on contents to copy from.
+ * \param src_y Y location on contents to copy from.
+ * \param width Width in pixels of the area to copy.
+ * \param height Height in pixels of the area to copy.
+ * \param dst_width Width in pixels of the image stored in target.
+ * \param dst_height Height in pixels of the image stored in target.
+ * \param done Called with the data and 0 once target holds the image,
+ * or -1 if the copy failed.
+ * \param data Passed to done.
+ * \return 0 if done is going to be called, -1 for failure.
+ *
+ * Like weston_surface_copy_content(), except that the area is scaled
+ * to dst_width by dst_height, which the target must have room for,
+ * and that the renderer may return before the copy is done, so that
+ * many surfaces can be copied in one go without a stall for each.
+ * done is called exactly once, from the event loop or before this
+ * returns, and target must stay valid until then.  It is called even
+ * if the surface is destroyed in the meantime.
  *
- * NOTE: Pixman formats are premultiplied.
+ * Renderers without support for it copy synchronously, and fail if
+ * the area is to be scaled.
  */
 WL_EXPORT int
-weston_surface_copy_content(struct weston_surface *surface,
-			    void *target, size_t size,
-			    int src_x, int src_y,
-			    int width, int height)
+weston_surface_copy_content_async(struct weston_surface *surface,
+				  void *target, size_t size,
+				  int src_x, int src_y,
+				  int width, int height,
+				  int dst_width, int dst_height,
+				  weston_surface_copy_done_func done,
+				  void *data)
 {
 	struct weston_renderer *rer = surface->compositor->renderer;
 	int cw, ch;
 	const size_t bytespp = 4; /* PIXMAN_a8b8g8r8 */
 
-	if (!rer->surface_copy_content)
-		return -1;
+	if (!rer->surface_copy_content_async) {
+		if (dst_width != width || dst_height != height)
+			return -1;
+
+		if (weston_surface_copy_content(surface, target, size,
+						src_x, src_y,
+						width, height) < 0)
+			return -1;
+
+		done(data, 0);
+		return 0;
+	}
 
 	weston_surface_get_content_size(surface, &cw, &ch);
 
 	if (src_x < 0 || src_y < 0)
 		return -1;
 
-	if (width <= 0 || height <= 0)
+	if (width <= 0 || height <= 0 || dst_width <= 0 || dst_height <= 0)
 		return -1;
 
 	if (src_x + width > cw || src_y + height > ch)
 		return -1;
 
-	if (width * bytespp * height > size)
+	if (dst_width * bytespp * dst_height > size)
 		return -1;
 
-	return rer->surface_copy_content(surface, target, size,
-					 src_x, src_y, width, height);
+	return rer->surface_copy_content_async(surface, target, size,
+					       src_x, src_y, width, height,
+					       dst_width, dst_height,
+					       done, data);
 }
 
 static void
@@ -3266,6 +5278,9 @@ subsurface_set_position(struct wl_client *client,
 	sub->position.x = x;
 	sub->position.y = y;
 	sub->position.set = 1;
+
+	if (sub->parent)
+		weston_surface_subsurfaces_extents_dirty(sub->parent);
 }
 
 static struct weston_subsurface *
@@ -3382,6 +5397,7 @@ subsurface_set_desync(struct wl_client *client, struct wl_resource *resource)
 static void
 weston_subsurface_unlink_parent(struct weston_subsurface *sub)
 {
+	weston_surface_subsurfaces_extents_dirty(sub->parent);
 	wl_list_remove(&sub->parent_link);
 	wl_list_remove(&sub->parent_link_pending);
 	wl_list_remove(&sub->parent_destroy_listener.link);
@@ -3448,6 +5464,7 @@ weston_subsurface_link_parent(struct weston_subsurface *sub,
 	wl_list_insert(&parent->subsurface_list, &sub->parent_link);
 	wl_list_insert(&parent->subsurface_list_pending,
 		       &sub->parent_link_pending);
+	weston_surface_subsurfaces_extents_dirty(parent);
 }
 
 static void
@@ -3533,6 +5550,10 @@ weston_subsurface_create(uint32_t id, struct weston_surface *surface,
 	weston_subsurface_link_surface(sub, surface);
 	weston_subsurface_link_parent(sub, parent);
 	weston_surface_state_init(&sub->cached);
+	/* The fresh cache has the default regions, whatever the
+	 * surface had pending before */
+	sub->cache_stale = WESTON_SURFACE_STATE_OPAQUE |
+			   WESTON_SURFACE_STATE_INPUT;
 	sub->cached_buffer_ref.buffer = NULL;
 	sub->synchronized = 1;
 
@@ -3660,6 +5681,30 @@ weston_compositor_dpms(struct weston_compositor *compositor,
 			output->set_dpms(output, state);
 }
 
+/* Back to the full refresh rate on input, without waiting for the
+ * repaints pushed back while idle */
+static void
+weston_compositor_idle_refresh_end(struct weston_compositor *compositor)
+{
+	struct weston_output *output;
+
+	if (compositor->idle_refresh_timeout > 0)
+		wl_event_source_timer_update(compositor->idle_refresh_source,
+					     compositor->idle_refresh_timeout *
+					     1000);
+
+	if (!compositor->idle_refresh)
+		return;
+
+	compositor->idle_refresh = false;
+	TL_POINT("core_idle_refresh_end", TLP_END);
+
+	wl_list_for_each(output, &compositor->output_list, link) {
+		if (output->idle_refresh_delayed)
+			wl_event_source_timer_update(output->repaint_timer, 1);
+	}
+}
+
 WL_EXPORT void
 weston_compositor_wake(struct weston_compositor *compositor)
 {
@@ -3682,6 +5727,8 @@ weston_compositor_wake(struct weston_compositor *compositor)
 		wl_event_source_timer_update(compositor->idle_source,
 					     compositor->idle_time * 1000);
 	}
+
+	weston_compositor_idle_refresh_end(compositor);
 }
 
 WL_EXPORT void
@@ -3710,6 +5757,21 @@ weston_compositor_sleep(struct weston_compositor *compositor)
 	weston_compositor_dpms(compositor, WESTON_DPMS_OFF);
 }
 
+static int
+idle_refresh_handler(void *data)
+{
+	struct weston_compositor *compositor = data;
+
+	/* Keys or buttons held down */
+	if (compositor->idle_inhibit)
+		return 1;
+
+	compositor->idle_refresh = true;
+	TL_POINT("core_idle_refresh_begin", TLP_END);
+
+	return 1;
+}
+
 static int
 idle_handler(void *data)
 {
@@ -3731,6 +5793,7 @@ weston_plane_init(struct weston_plane *plane,
 {
 	pixman_region32_init(&plane->damage);
 	pixman_region32_init(&plane->clip);
+	pixman_region32_init(&plane->opaque);
 	plane->x = x;
 	plane->y = y;
 	plane->compositor = ec;
@@ -3747,6 +5810,7 @@ weston_plane_release(struct weston_plane *plane)
 
 	pixman_region32_fini(&plane->damage);
 	pixman_region32_fini(&plane->clip);
+	pixman_region32_fini(&plane->opaque);
 
 	wl_list_for_each(view, &plane->compositor->view_list, link) {
 		if (view->plane == plane)
@@ -3848,10 +5912,15 @@ weston_output_destroy(struct weston_output *output)
 		if (view->output_mask & (1 << output->id))
 			weston_view_assign_output(view);
 	}
+	output->compositor->view_list_dirty = 1;
 
 	wl_event_source_remove(output->repaint_timer);
+	if (output->repaint_preempt_source)
+		wl_event_source_remove(output->repaint_preempt_source);
 
-	weston_presentation_feedback_discard_list(&output->feedback_list);
+	weston_output_discard_feedback(output);
+	weston_frame_callback_send_list(&output->frame_callback_list,
+					output->frame_time);
 
 	weston_compositor_remove_output(output->compositor, output);
 	wl_list_remove(&output->link);
@@ -3862,6 +5931,10 @@ weston_output_destroy(struct weston_output *output)
 	free(output->name);
 	pixman_region32_fini(&output->region);
 	pixman_region32_fini(&output->previous_damage);
+	weston_frame_arena_release(&output->frame_arena);
+	wl_array_release(&output->view_list);
+	wl_array_release(&output->render_list);
+	wl_array_release(&output->feedback_array);
 	output->compositor->output_id_pool &= ~(1 << output->id);
 
 	wl_resource_for_each(resource, &output->resource_list) {
@@ -3871,60 +5944,130 @@ weston_output_destroy(struct weston_output *output)
 	wl_global_destroy(output->global);
 }
 
-WL_EXPORT void
-weston_output_update_matrix(struct weston_output *output)
+/* Turns a width x height area into the given output transform */
+static void
+weston_matrix_output_transform(struct weston_matrix *matrix,
+			       uint32_t transform,
+			       int32_t width, int32_t height)
 {
-	float magnification;
-
-	weston_matrix_init(&output->matrix);
-	weston_matrix_translate(&output->matrix, -output->x, -output->y, 0);
-
-	if (output->zoom.active) {
-		magnification = 1 / (1 - output->zoom.spring_z.current);
-		weston_output_update_zoom(output);
-		weston_matrix_translate(&output->matrix, -output->zoom.trans_x,
-					-output->zoom.trans_y, 0);
-		weston_matrix_scale(&output->matrix, magnification,
-				    magnification, 1.0);
-	}
-
-	switch (output->transform) {
+	switch (transform) {
 	case WL_OUTPUT_TRANSFORM_FLIPPED:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		weston_matrix_translate(&output->matrix, -output->width, 0, 0);
-		weston_matrix_scale(&output->matrix, -1, 1, 1);
+		weston_matrix_translate(matrix, -width, 0, 0);
+		weston_matrix_scale(matrix, -1, 1, 1);
 		break;
 	}
 
-	switch (output->transform) {
+	switch (transform) {
 	default:
 	case WL_OUTPUT_TRANSFORM_NORMAL:
 	case WL_OUTPUT_TRANSFORM_FLIPPED:
 		break;
 	case WL_OUTPUT_TRANSFORM_90:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-		weston_matrix_translate(&output->matrix, 0, -output->height, 0);
-		weston_matrix_rotate_xy(&output->matrix, 0, 1);
+		weston_matrix_translate(matrix, 0, -height, 0);
+		weston_matrix_rotate_xy(matrix, 0, 1);
 		break;
 	case WL_OUTPUT_TRANSFORM_180:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-		weston_matrix_translate(&output->matrix,
-					-output->width, -output->height, 0);
-		weston_matrix_rotate_xy(&output->matrix, -1, 0);
+		weston_matrix_translate(matrix, -width, -height, 0);
+		weston_matrix_rotate_xy(matrix, -1, 0);
 		break;
 	case WL_OUTPUT_TRANSFORM_270:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		weston_matrix_translate(&output->matrix, -output->width, 0, 0);
-		weston_matrix_rotate_xy(&output->matrix, 0, -1);
+		weston_matrix_translate(matrix, -width, 0, 0);
+		weston_matrix_rotate_xy(matrix, 0, -1);
 		break;
 	}
+}
+
+/* Applies the output transform and scale, the last steps from global
+ * to output buffer coordinates. A transform the display does at
+ * scanout is left out, the renderer draws in its final orientation. */
+static void
+weston_output_transform_matrix(struct weston_output *output,
+			       struct weston_matrix *matrix)
+{
+	weston_matrix_output_transform(matrix,
+				       weston_output_get_buffer_transform(output),
+				       output->width, output->height);
 
 	if (output->current_scale != 1)
-		weston_matrix_scale(&output->matrix,
+		weston_matrix_scale(matrix,
 				    output->current_scale,
 				    output->current_scale, 1);
+}
+
+/** The transform the renderer draws an output with
+ *
+ * \param output The output.
+ * \return weston_output::transform, or WL_OUTPUT_TRANSFORM_NORMAL when
+ * the display does it at scanout.
+ */
+WL_EXPORT uint32_t
+weston_output_get_buffer_transform(struct weston_output *output)
+{
+	if (output->scanout_transform != WL_OUTPUT_TRANSFORM_NORMAL)
+		return WL_OUTPUT_TRANSFORM_NORMAL;
+
+	return output->transform;
+}
+
+/** The size of the buffers the renderer draws an output into
+ *
+ * \param output The output.
+ * \param width Returns the width in pixels.
+ * \param height Returns the height in pixels.
+ *
+ * That is the size of the current mode, turned as the output is when
+ * the display rotates it at scanout, see
+ * weston_output::scanout_transform. weston_output::matrix maps global
+ * coordinates into this area, also when weston_output::render_width
+ * has the renderer draw fewer pixels.
+ */
+WL_EXPORT void
+weston_output_get_buffer_size(struct weston_output *output,
+			      int32_t *width, int32_t *height)
+{
+	switch (output->scanout_transform) {
+	case WL_OUTPUT_TRANSFORM_90:
+	case WL_OUTPUT_TRANSFORM_270:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		*width = output->current_mode->height;
+		*height = output->current_mode->width;
+		break;
+	default:
+		*width = output->current_mode->width;
+		*height = output->current_mode->height;
+		break;
+	}
+}
+
+WL_EXPORT void
+weston_output_update_matrix(struct weston_output *output)
+{
+	float magnification;
+
+	weston_matrix_init(&output->matrix);
+	weston_matrix_translate(&output->matrix, -output->x, -output->y, 0);
+
+	if (output->zoom.active) {
+		output->zoom.unzoomed_matrix = output->matrix;
+		weston_output_transform_matrix(output,
+					       &output->zoom.unzoomed_matrix);
+
+		magnification = 1 / (1 - output->zoom.spring_z.current);
+		weston_output_update_zoom(output);
+		weston_matrix_translate(&output->matrix, -output->zoom.trans_x,
+					-output->zoom.trans_y, 0);
+		weston_matrix_scale(&output->matrix, magnification,
+				    magnification, 1.0);
+	}
+
+	weston_output_transform_matrix(output, &output->matrix);
 
 	output->dirty = 0;
 
@@ -3961,12 +6104,25 @@ weston_output_transform_scale_init(struct weston_output *output, uint32_t transf
 	output->height /= scale;
 }
 
+/* The output layout changed, so may have the output_mask of any view */
+static void
+weston_compositor_dirty_view_outputs(struct weston_compositor *compositor)
+{
+	struct weston_view *view;
+
+	wl_list_for_each(view, &compositor->view_list, link)
+		weston_view_geometry_dirty(view);
+	compositor->view_list_dirty = 1;
+}
+
 static void
 weston_output_init_geometry(struct weston_output *output, int x, int y)
 {
 	output->x = x;
 	output->y = y;
 
+	weston_compositor_dirty_view_outputs(output->compositor);
+
 	pixman_region32_init(&output->previous_damage);
 	pixman_region32_init_rect(&output->region, x, y,
 				  output->width,
@@ -4022,6 +6178,7 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	output->mm_height = mm_height;
 	output->dirty = 1;
 	output->original_scale = scale;
+	memset(&output->frame_arena, 0, sizeof output->frame_arena);
 
 	weston_output_transform_scale_init(output, transform, scale);
 	weston_output_init_zoom(output);
@@ -4033,7 +6190,10 @@ weston_output_init(struct weston_output *output, struct weston_compositor *c,
 	wl_signal_init(&output->destroy_signal);
 	wl_list_init(&output->animation_list);
 	wl_list_init(&output->resource_list);
-	wl_list_init(&output->feedback_list);
+	wl_array_init(&output->feedback_array);
+	wl_list_init(&output->frame_callback_list);
+	wl_array_init(&output->view_list);
+	wl_array_init(&output->render_list);
 	wl_list_init(&output->link);
 
 	loop = wl_display_get_event_loop(c->wl_display);
@@ -4059,6 +6219,8 @@ weston_compositor_add_output(struct weston_compositor *compositor,
                              struct weston_output *output)
 {
 	wl_list_insert(compositor->output_list.prev, &output->link);
+	/* The new output needs its own view list */
+	compositor->view_list_dirty = 1;
 	wl_signal_emit(&compositor->output_created_signal, output);
 }
 
@@ -4072,6 +6234,20 @@ weston_output_transform_coordinate(struct weston_output *output,
 		wl_fixed_to_double(device_y),
 		0.0,
 		1.0 } };
+	struct weston_matrix matrix, inverse;
+	int32_t width, height;
+
+	/* Devices report in the display's orientation, which the
+	 * buffers are not in when the display rotates them */
+	if (output->scanout_transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+		weston_output_get_buffer_size(output, &width, &height);
+		weston_matrix_init(&matrix);
+		weston_matrix_output_transform(&matrix,
+					       output->scanout_transform,
+					       width, height);
+		if (weston_matrix_invert(&inverse, &matrix) == 0)
+			weston_matrix_transform(&inverse, &p);
+	}
 
 	weston_matrix_transform(&output->inverse_matrix, &p);
 
@@ -4277,6 +6453,159 @@ bind_scaler(struct wl_client *client,
 				       NULL, NULL);
 }
 
+static void
+destroy_tearing_control(struct wl_resource *resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(resource);
+
+	if (!surface)
+		return;
+
+	surface->tearing_control_resource = NULL;
+	surface->pending.async_flip = false;
+}
+
+static void
+tearing_control_destroy(struct wl_client *client,
+			struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+tearing_control_set_presentation_hint(struct wl_client *client,
+				      struct wl_resource *resource,
+				      uint32_t hint)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(resource);
+
+	/* Inert once the surface is gone */
+	if (!surface)
+		return;
+
+	surface->pending.async_flip =
+		hint == ZTEARING_CONTROL_PRESENTATION_HINT_ASYNC;
+}
+
+static const struct ztearing_control_interface tearing_control_interface = {
+	tearing_control_set_presentation_hint,
+	tearing_control_destroy
+};
+
+static void
+tearing_control_manager_destroy(struct wl_client *client,
+				struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+tearing_control_manager_get_tearing_control(struct wl_client *client,
+					    struct wl_resource *manager,
+					    uint32_t id,
+					    struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct wl_resource *resource;
+
+	if (surface->tearing_control_resource) {
+		wl_resource_post_error(manager,
+			ZTEARING_CONTROL_MANAGER_ERROR_TEARING_CONTROL_EXISTS,
+			"a tearing control for that surface already exists");
+		return;
+	}
+
+	resource = wl_resource_create(client, &ztearing_control_interface,
+				      1, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &tearing_control_interface,
+				       surface, destroy_tearing_control);
+
+	surface->tearing_control_resource = resource;
+}
+
+static const struct ztearing_control_manager_interface
+tearing_control_manager_interface = {
+	tearing_control_manager_destroy,
+	tearing_control_manager_get_tearing_control
+};
+
+static void
+bind_tearing_control_manager(struct wl_client *client,
+			     void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &ztearing_control_manager_interface,
+				      1, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &tearing_control_manager_interface,
+				       NULL, NULL);
+}
+
+static void
+resource_usage_destroy(struct wl_client *client,
+		       struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+resource_usage_update(struct wl_client *client,
+		      struct wl_resource *resource)
+{
+	struct weston_compositor *compositor =
+		wl_resource_get_user_data(resource);
+	struct weston_client_usage *usage;
+
+	wl_list_for_each(usage, &compositor->client_usage_list, link)
+		weston_resource_usage_send_client(resource, usage->pid,
+						  usage->surfaces,
+						  usage->buffers,
+						  usage->shm_bytes / 1024,
+						  usage->dmabuf_bytes / 1024,
+						  usage->texture_bytes / 1024);
+
+	weston_resource_usage_send_done(resource);
+}
+
+static const struct weston_resource_usage_interface
+resource_usage_interface = {
+	resource_usage_destroy,
+	resource_usage_update
+};
+
+static void
+bind_resource_usage(struct wl_client *client,
+		    void *data, uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &weston_resource_usage_interface,
+				      1, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &resource_usage_interface,
+				       compositor, NULL);
+}
+
 static void
 destroy_presentation_feedback(struct wl_resource *feedback_resource)
 {
@@ -4284,6 +6613,13 @@ destroy_presentation_feedback(struct wl_resource *feedback_resource)
 
 	feedback = wl_resource_get_user_data(feedback_resource);
 
+	if (feedback->output) {
+		struct weston_presentation_feedback **feedbacks;
+
+		feedbacks = feedback->output->feedback_array.data;
+		feedbacks[feedback->slot] = NULL;
+	}
+
 	wl_list_remove(&feedback->link);
 	free(feedback);
 }
@@ -4361,7 +6697,7 @@ compositor_bind(struct wl_client *client,
 	struct wl_resource *resource;
 
 	resource = wl_resource_create(client, &wl_compositor_interface,
-				      MIN(version, 3), id);
+				      MIN(version, 4), id);
 	if (resource == NULL) {
 		wl_client_post_no_memory(client);
 		return;
@@ -4394,13 +6730,79 @@ weston_environment_get_fd(const char *env)
 	return fd;
 }
 
+static void
+frame_stats_key_binding_handler(struct weston_keyboard *keyboard,
+				uint32_t time, uint32_t key, void *data)
+{
+	struct weston_compositor *compositor = data;
+
+	if (weston_frame_stats_enabled_)
+		weston_frame_stats_stop(compositor);
+	else
+		weston_frame_stats_start(compositor);
+}
+
+/* Log what every client holds, largest memory users first */
+static void
+client_usage_key_binding_handler(struct weston_keyboard *keyboard,
+				 uint32_t time, uint32_t key, void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_client_usage *usage, **sorted, *tmp;
+	int i, j, n;
+
+	n = wl_list_length(&compositor->client_usage_list);
+	sorted = calloc(n ? n : 1, sizeof *sorted);
+	if (!sorted)
+		return;
+
+	i = 0;
+	wl_list_for_each(usage, &compositor->client_usage_list, link)
+		sorted[i++] = usage;
+
+	/* A handful of clients, insertion sort will do */
+	for (i = 1; i < n; i++) {
+		tmp = sorted[i];
+		for (j = i; j > 0 &&
+		     sorted[j - 1]->shm_bytes + sorted[j - 1]->dmabuf_bytes +
+		     sorted[j - 1]->texture_bytes <
+		     tmp->shm_bytes + tmp->dmabuf_bytes + tmp->texture_bytes;
+		     j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = tmp;
+	}
+
+	weston_log("Client resource usage, %d clients:\n", n);
+	for (i = 0; i < n; i++) {
+		usage = sorted[i];
+		weston_log_continue(STAMP_SPACE "pid %d: %u surfaces, "
+				    "%u buffers, shm %" PRIu64 " KiB, "
+				    "dmabuf %" PRIu64 " KiB, "
+				    "textures %" PRIu64 " KiB\n",
+				    (int) usage->pid, usage->surfaces,
+				    usage->buffers, usage->shm_bytes / 1024,
+				    usage->dmabuf_bytes / 1024,
+				    usage->texture_bytes / 1024);
+		weston_log_continue(STAMP_SPACE "  %" PRIu64 " commits, "
+				    "%u/s, %" PRIu64 " damage rects, "
+				    "%d releases held\n",
+				    usage->commits, usage->commit_rate,
+				    usage->damage_rects,
+				    wl_list_length(&usage->held_buffer_list));
+	}
+
+	free(sorted);
+}
+
 static void
 timeline_key_binding_handler(struct weston_keyboard *keyboard, uint32_t time,
 			     uint32_t key, void *data)
 {
 	struct weston_compositor *compositor = data;
 
-	if (weston_timeline_enabled_)
+	if (weston_timeline_ring_enabled())
+		weston_timeline_ring_snapshot();
+	else if (weston_timeline_enabled_)
 		weston_timeline_close();
 	else
 		weston_timeline_open(compositor);
@@ -4429,6 +6831,7 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 	ec->user_data = user_data;
 	wl_signal_init(&ec->destroy_signal);
 	wl_signal_init(&ec->create_surface_signal);
+	wl_signal_init(&ec->commit_signal);
 	wl_signal_init(&ec->activate_signal);
 	wl_signal_init(&ec->transform_signal);
 	wl_signal_init(&ec->kill_signal);
@@ -4447,7 +6850,7 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 	ec->output_id_pool = 0;
 	ec->repaint_msec = DEFAULT_REPAINT_WINDOW;
 
-	if (!wl_global_create(ec->wl_display, &wl_compositor_interface, 3,
+	if (!wl_global_create(ec->wl_display, &wl_compositor_interface, 4,
 			      ec, compositor_bind))
 		goto fail;
 
@@ -4463,20 +6866,44 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 			      ec, bind_presentation))
 		goto fail;
 
+	if (!wl_global_create(ec->wl_display,
+			      &ztearing_control_manager_interface, 1,
+			      ec, bind_tearing_control_manager))
+		goto fail;
+
+	if (!wl_global_create(ec->wl_display,
+			      &weston_resource_usage_interface, 1,
+			      ec, bind_resource_usage))
+		goto fail;
+
+	ec->pick_index = pick_index_create();
+	if (!ec->pick_index)
+		goto fail;
+	ec->view_list_serial = 1;
+	ec->view_list_dirty = 1;
+	wl_array_init(&ec->view_list_layers);
+
 	wl_list_init(&ec->view_list);
 	wl_list_init(&ec->plane_list);
+	wl_list_init(&ec->view_animation_list);
 	wl_list_init(&ec->layer_list);
 	wl_list_init(&ec->seat_list);
 	wl_list_init(&ec->output_list);
+	wl_list_init(&ec->client_usage_list);
 	wl_list_init(&ec->key_binding_list);
+	weston_binding_table_init(&ec->key_binding_table);
 	wl_list_init(&ec->modifier_binding_list);
 	wl_list_init(&ec->button_binding_list);
+	weston_binding_table_init(&ec->button_binding_table);
 	wl_list_init(&ec->touch_binding_list);
 	wl_list_init(&ec->axis_binding_list);
 	wl_list_init(&ec->debug_binding_list);
 
 	weston_plane_init(&ec->primary_plane, ec, 0, 0);
 	weston_compositor_stack_plane(ec, &ec->primary_plane, NULL);
+	weston_plane_init(&ec->cursor_plane, ec, 0, 0);
+	weston_compositor_stack_plane(ec, &ec->cursor_plane,
+				      &ec->primary_plane);
 
 	wl_data_device_manager_init(ec->wl_display);
 
@@ -4485,6 +6912,10 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 	loop = wl_display_get_event_loop(ec->wl_display);
 	ec->idle_source = wl_event_loop_add_timer(loop, idle_handler, ec);
 	wl_event_source_timer_update(ec->idle_source, ec->idle_time * 1000);
+	ec->frame_throttle_timer =
+		wl_event_loop_add_timer(loop, frame_throttle_timer_handler, ec);
+	ec->idle_refresh_source =
+		wl_event_loop_add_timer(loop, idle_refresh_handler, ec);
 
 	ec->input_loop = wl_event_loop_create();
 
@@ -4493,6 +6924,11 @@ weston_compositor_create(struct wl_display *display, void *user_data)
 
 	weston_compositor_add_debug_binding(ec, KEY_T,
 					    timeline_key_binding_handler, ec);
+	weston_compositor_add_debug_binding(ec, KEY_P,
+					    frame_stats_key_binding_handler, ec);
+	weston_compositor_add_debug_binding(ec, KEY_U,
+					    client_usage_key_binding_handler,
+					    ec);
 
 	return ec;
 
@@ -4505,8 +6941,12 @@ WL_EXPORT void
 weston_compositor_shutdown(struct weston_compositor *ec)
 {
 	struct weston_output *output, *next;
+	struct weston_client_usage *usage, *next_usage;
+	struct weston_buffer *buffer, *next_buffer;
 
 	wl_event_source_remove(ec->idle_source);
+	wl_event_source_remove(ec->frame_throttle_timer);
+	wl_event_source_remove(ec->idle_refresh_source);
 	if (ec->input_loop_source)
 		wl_event_source_remove(ec->input_loop_source);
 
@@ -4524,8 +6964,19 @@ weston_compositor_shutdown(struct weston_compositor *ec)
 	weston_binding_list_destroy_all(&ec->axis_binding_list);
 	weston_binding_list_destroy_all(&ec->debug_binding_list);
 
+	weston_plane_release(&ec->cursor_plane);
 	weston_plane_release(&ec->primary_plane);
 
+	/* Clients outlive the compositor, forget them first */
+	wl_list_for_each_safe(usage, next_usage, &ec->client_usage_list, link) {
+		wl_list_for_each_safe(buffer, next_buffer,
+				      &usage->held_buffer_list, held_link)
+			wl_list_init(&buffer->held_link);
+		wl_list_remove(&usage->destroy_listener.link);
+		wl_list_remove(&usage->link);
+		free(usage);
+	}
+
 	wl_event_loop_destroy(ec->input_loop);
 }
 
@@ -4657,6 +7108,32 @@ weston_compositor_import_dmabuf(struct weston_compositor *compositor,
 	return renderer->import_dmabuf(compositor, buffer);
 }
 
+/** Import a dmabuf without waiting for the driver
+ *
+ * \param compositor
+ * \param buffer the dmabuf buffer to import
+ * \param done called with the result of weston_compositor_import_dmabuf()
+ *
+ * Importing may take the driver milliseconds, which are spent away from
+ * the event loop when the renderer can.  done is called exactly once,
+ * from the event loop or before this returns, and the buffer must stay
+ * alive until then.
+ */
+WL_EXPORT void
+weston_compositor_import_dmabuf_async(struct weston_compositor *compositor,
+				      struct linux_dmabuf_buffer *buffer,
+				      weston_dmabuf_import_done_func done)
+{
+	struct weston_renderer *renderer = compositor->renderer;
+
+	if (renderer->import_dmabuf_async) {
+		renderer->import_dmabuf_async(compositor, buffer, done);
+		return;
+	}
+
+	done(buffer, weston_compositor_import_dmabuf(compositor, buffer));
+}
+
 WL_EXPORT void
 weston_version(int *major, int *minor, int *micro)
 {
@@ -4726,6 +7203,8 @@ weston_compositor_destroy(struct weston_compositor *compositor)
 	weston_compositor_xkb_destroy(compositor);
 
 	compositor->backend->destroy(compositor);
+	pick_index_destroy(compositor->pick_index);
+	wl_array_release(&compositor->view_list_layers);
 	free(compositor);
 }
 
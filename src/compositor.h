@@ -59,6 +59,10 @@ struct input_method;
 struct weston_pointer;
 struct linux_dmabuf_buffer;
 
+typedef void (*weston_dmabuf_import_done_func)(
+			struct linux_dmabuf_buffer *buffer, bool success);
+typedef void (*weston_surface_copy_done_func)(void *data, int status);
+
 enum weston_keyboard_modifier {
 	MODIFIER_CTRL = (1 << 0),
 	MODIFIER_ALT = (1 << 1),
@@ -159,6 +163,9 @@ struct weston_output_zoom {
 	struct weston_spring spring_z;
 	struct weston_fixed_point current;
 	struct wl_listener motion_listener;
+	/* weston_output::matrix as it would be without the zoom, valid
+	 * while the zoom is active, see WESTON_CAP_ZOOM_OFFSCREEN */
+	struct weston_matrix unzoomed_matrix;
 };
 
 /* bit compatible with drm definitions. */
@@ -169,6 +176,43 @@ enum dpms_enum {
 	WESTON_DPMS_OFF
 };
 
+struct weston_scanout_format {
+	uint32_t format;      /* DRM_FORMAT code */
+	uint64_t modifier;
+	uint32_t plane;       /* enum zlinux_dmabuf_scanout_feedback_plane */
+};
+
+/* Memory for temporaries that only live for one repaint of an output.
+ * Allocations are carved from one block that is reset after every
+ * repaint; what does not fit comes from malloc for that frame, and the
+ * block grows to the peak use on the next reset. */
+struct weston_frame_arena {
+	char *data;
+	size_t size;
+	size_t used;
+	size_t overflow;
+	void *chunks;
+};
+
+/** One view to paint on the primary plane, as it was when the repaint
+ * of an output started.
+ *
+ * weston_output_repaint() builds these bottom to top in
+ * weston_output::render_list, so renderers take the geometry of a
+ * frame from there rather than from the scene graph. The view and
+ * surface are still needed for their buffer and renderer state.
+ */
+struct weston_render_item {
+	struct weston_view *view;
+	struct weston_surface *surface;
+	/* the part of the view not occluded by opaque views above it,
+	 * in global coordinates */
+	pixman_region32_t region;
+	/* buffer to output coordinates */
+	struct weston_matrix matrix;
+	float alpha;
+};
+
 struct weston_output {
 	uint32_t id;
 	char *name;
@@ -196,6 +240,22 @@ struct weston_output {
 	int repaint_needed;
 	int repaint_scheduled;
 	struct wl_event_source *repaint_timer;
+	/* idle repaint replacing repaint_timer, see repaint-preempt */
+	struct wl_event_source *repaint_preempt_source;
+	/* when repaint_timer is due, zero while it is not armed */
+	struct timespec repaint_deadline;
+	/* when the last repaint started, and whether repaint_timer was
+	 * pushed back for weston_compositor::idle_refresh */
+	struct timespec last_repaint;
+	bool idle_refresh_delayed;
+	/* whether a surface on the output committed since the last
+	 * repaint, and how many repaints in a row that was so */
+	bool idle_refresh_committed;
+	uint32_t idle_refresh_commit_frames;
+	/* Repaint cost estimate for the adaptive repaint window, in
+	 * nanoseconds: smoothed mean and mean deviation */
+	int64_t repaint_cost_avg;
+	int64_t repaint_cost_dev;
 	struct weston_output_zoom zoom;
 	int dirty;
 	struct wl_signal frame_signal;
@@ -203,9 +263,25 @@ struct weston_output {
 	int move_x, move_y;
 	uint32_t frame_time; /* presentation timestamp in milliseconds */
 	uint64_t msc;        /* media stream counter */
+	/* Set by the backend while the display waits for each flip,
+	 * up to its lowest refresh rate: repaints then go out as soon as
+	 * they are needed rather than at fixed intervals. */
+	bool adaptive_sync;
+	struct timespec last_present; /* of the last vsynced frame */
 	int disable_planes;
+	/* While planes are disabled, the sprite of this pointer may still
+	 * go to a cursor plane, leaving it out of read_pixels(). Set by
+	 * screen sharing, which sends that cursor separately. Backends
+	 * with assign_planes must keep everything else on the primary
+	 * plane while disable_planes is set. */
+	struct weston_pointer *side_channel_pointer;
 	int destroying;
-	struct wl_list feedback_list;
+	/* struct weston_presentation_feedback * queued for the next
+	 * flip, NULL where destroyed meanwhile; reused across frames */
+	struct wl_array feedback_array;
+	/* frame callbacks of the frame waiting for its flip, see
+	 * weston_compositor::present_frame_callbacks */
+	struct wl_list frame_callback_list;
 
 	char *make, *model, *serial_number;
 	uint32_t subpixel;
@@ -219,6 +295,20 @@ struct weston_output {
 	struct weston_mode *original_mode;
 	struct wl_list mode_list;
 
+	/* Size of the buffers the renderer draws into, when the backend
+	 * has them scaled up to current_mode at scanout; zero to draw at
+	 * the mode's size. The region and matrix stay in mode pixels. */
+	int32_t render_width, render_height;
+
+	/* The part of transform the display applies at scanout, by
+	 * rotating its planes: either WL_OUTPUT_TRANSFORM_NORMAL or
+	 * transform itself, set by the backend before
+	 * weston_output_init(). The renderer then draws in the final
+	 * orientation, see weston_output_get_buffer_size(). Clients and
+	 * input devices still get transform, and the modes as the
+	 * display has them. */
+	uint32_t scanout_transform;
+
 	void (*start_repaint_loop)(struct weston_output *output);
 	int (*repaint)(struct weston_output *output,
 			pixman_region32_t *damage);
@@ -226,6 +316,11 @@ struct weston_output {
 	void (*assign_planes)(struct weston_output *output);
 	int (*switch_mode)(struct weston_output *output, struct weston_mode *mode);
 
+	/* Append the dmabuf formats the output can scan out directly to
+	 * formats, as struct weston_scanout_format */
+	void (*get_scanout_formats)(struct weston_output *output,
+				    struct wl_array *formats);
+
 	/* backlight values are on 0-255 range, where higher is brighter */
 	int32_t backlight_current;
 	void (*set_backlight)(struct weston_output *output, uint32_t value);
@@ -240,6 +335,17 @@ struct weston_output {
 			  uint16_t *b);
 
 	struct weston_timeline_object timeline;
+
+	struct weston_frame_arena frame_arena;
+
+	/** The views of compositor->view_list on this output, in the same
+	 * top to bottom order, as struct weston_view pointers. Rebuilt
+	 * with the view list, so only valid during a repaint. */
+	struct wl_array view_list;
+
+	/** struct weston_render_item for the views on the primary
+	 * plane, bottom to top; only valid inside repaint(). */
+	struct wl_array render_list;
 };
 
 struct weston_pointer_grab;
@@ -317,7 +423,7 @@ struct weston_data_source {
 struct weston_pointer {
 	struct weston_seat *seat;
 
-	struct wl_list resource_list;
+	struct wl_list resource_groups; /* unfocused resources by client */
 	struct wl_list focus_resource_list;
 	struct weston_view *focus;
 	uint32_t focus_serial;
@@ -342,13 +448,30 @@ struct weston_pointer {
 	uint32_t button_count;
 
 	struct wl_listener output_destroy_listener;
+
+	/* What the last repick after a repaint saw, to skip the next
+	 * one when nothing changed */
+	uint32_t repick_scene_serial;
+	wl_fixed_t repick_x, repick_y;
+	struct weston_pointer_grab *repick_grab;
+	struct weston_view *repick_focus;
+
+	/* Motion held back until the next refresh, only when the seat
+	 * coalesces motion.  motion_x/y is the last absolute position
+	 * if motion_absolute, and the deltas accumulate on top of it. */
+	struct wl_event_source *motion_timer;
+	int motion_pending;
+	int motion_absolute;
+	wl_fixed_t motion_x, motion_y;
+	wl_fixed_t motion_dx, motion_dy;
+	uint32_t motion_time;
 };
 
 
 struct weston_touch {
 	struct weston_seat *seat;
 
-	struct wl_list resource_list;
+	struct wl_list resource_groups; /* unfocused resources by client */
 	struct wl_list focus_resource_list;
 	struct weston_view *focus;
 	struct wl_listener focus_view_listener;
@@ -364,6 +487,14 @@ struct weston_touch {
 	wl_fixed_t grab_x, grab_y;
 	uint32_t grab_serial;
 	uint32_t grab_time;
+
+	/* Motion held back until the next refresh, only when the seat
+	 * coalesces touch: the latest position of each moved point, and
+	 * whether a touch frame is owed once they are sent. */
+	struct wl_event_source *frame_timer;
+	struct wl_array pending_motions;
+	int frame_deferred;
+	int frame_has_events; /* down or up since the last frame */
 };
 
 struct weston_pointer *
@@ -448,11 +579,15 @@ weston_touch_start_drag(struct weston_touch *touch,
 			struct weston_surface *icon,
 			struct wl_client *client);
 
+/* Keymaps are shared by every keyboard whose keymap serializes to the
+ * same string, through weston_compositor::xkb_info_list. */
 struct weston_xkb_info {
 	struct xkb_keymap *keymap;
 	int keymap_fd;
 	size_t keymap_size;
-	char *keymap_area;
+	char *keymap_area; /* read-only */
+	uint32_t keymap_hash;
+	struct wl_list link;
 	int32_t ref_count;
 	xkb_mod_index_t shift_mod;
 	xkb_mod_index_t caps_mod;
@@ -470,7 +605,7 @@ struct weston_xkb_info {
 struct weston_keyboard {
 	struct weston_seat *seat;
 
-	struct wl_list resource_list;
+	struct wl_list resource_groups; /* unfocused resources by client */
 	struct wl_list focus_resource_list;
 	struct weston_surface *focus;
 	struct wl_listener focus_resource_listener;
@@ -536,6 +671,11 @@ struct weston_seat {
 	uint32_t slot_map;
 	struct input_method *input_method;
 	char *seat_name;
+
+	/* Deliver at most one pointer motion per output refresh */
+	int coalesce_motion;
+	/* Deliver touch motion in one batch per output refresh */
+	int coalesce_touch;
 };
 
 enum {
@@ -555,6 +695,7 @@ struct weston_layer {
 	struct weston_layer_entry view_list;
 	struct wl_list link;
 	pixman_box32_t mask;
+	int dirty; /* view_list changed since the last view list build */
 };
 
 struct weston_plane {
@@ -563,6 +704,9 @@ struct weston_plane {
 	pixman_region32_t clip;
 	int32_t x, y;
 	struct wl_list link;
+	/* views above accumulated so far, see
+	 * compositor_accumulate_damage() */
+	pixman_region32_t opaque;
 };
 
 struct weston_renderer {
@@ -570,6 +714,19 @@ struct weston_renderer {
 			       pixman_format_code_t format, void *pixels,
 			       uint32_t x, uint32_t y,
 			       uint32_t width, uint32_t height);
+
+	/** Start reading back the rectangles, given in the coordinates
+	 * read_pixels() takes, without waiting for rendering to finish.
+	 * Returns a handle for finish_read_pixels(), or -1 if the caller
+	 * should use read_pixels() instead.  May be NULL. */
+	int (*queue_read_pixels)(struct weston_output *output,
+				 pixman_format_code_t format,
+				 const pixman_box32_t *rects, int nrects);
+	/** Wait for a read started with queue_read_pixels() and store
+	 * the rectangles one after the other in pixels, each laid out
+	 * like read_pixels() would. */
+	int (*finish_read_pixels)(struct weston_output *output, int handle,
+				  void *pixels);
 	void (*repaint_output)(struct weston_output *output,
 			       pixman_region32_t *output_damage);
 	void (*flush_damage)(struct weston_surface *surface);
@@ -577,6 +734,15 @@ struct weston_renderer {
 	void (*surface_set_color)(struct weston_surface *surface,
 			       float red, float green,
 			       float blue, float alpha);
+	/** See weston_surface_set_image(). May be NULL. */
+	int (*surface_set_image)(struct weston_surface *surface,
+				 pixman_image_t *image);
+	/** Pass everything drawn on the output through a 3D colour
+	 * lookup table of size^3 RGB triplets, red varying fastest and
+	 * blue slowest. NULL lut removes it. Returns -1 if the table
+	 * cannot be used. May be NULL. */
+	int (*output_set_color_lut)(struct weston_output *output, int size,
+				    const uint8_t *lut);
 	void (*destroy)(struct weston_compositor *ec);
 
 
@@ -590,9 +756,31 @@ struct weston_renderer {
 				    int src_x, int src_y,
 				    int width, int height);
 
+	/** See weston_surface_copy_content_async(). May be NULL. */
+	int (*surface_copy_content_async)(struct weston_surface *surface,
+					  void *target, size_t size,
+					  int src_x, int src_y,
+					  int width, int height,
+					  int dst_width, int dst_height,
+					  weston_surface_copy_done_func done,
+					  void *data);
+
 	/** See weston_compositor_import_dmabuf() */
 	bool (*import_dmabuf)(struct weston_compositor *ec,
 			      struct linux_dmabuf_buffer *buffer);
+
+	/** See weston_compositor_import_dmabuf_async(). May be NULL. */
+	void (*import_dmabuf_async)(struct weston_compositor *ec,
+				    struct linux_dmabuf_buffer *buffer,
+				    weston_dmabuf_import_done_func done);
+
+	/** Copy the rectangle, in the coordinates read_pixels() takes,
+	 * to the top left of the dmabuf without reading it back.
+	 * Returns -1 if the dmabuf can't be written. May be NULL. */
+	int (*copy_to_dmabuf)(struct weston_output *output,
+			      struct linux_dmabuf_buffer *buffer,
+			      uint32_t x, uint32_t y,
+			      uint32_t width, uint32_t height);
 };
 
 enum weston_capability {
@@ -610,6 +798,19 @@ enum weston_capability {
 
 	/* renderer supports weston_view_set_mask() clipping */
 	WESTON_CAP_VIEW_CLIP_MASK		= 0x0010,
+
+	/* renderer waits for acquire fences and hands out release
+	 * fences, see linux-explicit-synchronization.c */
+	WESTON_CAP_EXPLICIT_SYNC		= 0x0020,
+
+	/* renderer keeps the unzoomed output offscreen and only scales
+	 * it while zoomed, so moving the zoom needs no damage */
+	WESTON_CAP_ZOOM_OFFSCREEN		= 0x0040,
+
+	/* renderer draws the views of weston_compositor::cursor_plane
+	 * over the finished frame itself, see
+	 * weston_view_get_fallback_plane() */
+	WESTON_CAP_SOFTWARE_CURSOR		= 0x0080,
 };
 
 struct weston_backend {
@@ -617,6 +818,16 @@ struct weston_backend {
 	void (*restore)(struct weston_compositor *ec);
 };
 
+#define WESTON_BINDING_BUCKETS 64
+
+/* Key or button bindings hashed by (code, modifier), with a bitmap of
+ * the codes bound under any modifier to reject most presses without
+ * touching a bucket. */
+struct weston_binding_table {
+	struct wl_list buckets[WESTON_BINDING_BUCKETS];
+	uint32_t codes[1024 / 32];
+};
+
 struct weston_compositor {
 	struct wl_signal destroy_signal;
 
@@ -626,6 +837,8 @@ struct weston_compositor {
 
 	/* surface signals */
 	struct wl_signal create_surface_signal;
+	/* emitted with the weston_surface on every wl_surface.commit */
+	struct wl_signal commit_signal;
 	struct wl_signal activate_signal;
 	struct wl_signal transform_signal;
 
@@ -655,10 +868,32 @@ struct weston_compositor {
 	struct wl_list seat_list;
 	struct wl_list layer_list;
 	struct wl_list view_list;
+	uint32_t view_list_serial;
+	uint32_t view_list_length;
+	/* Set when the view list must be rebuilt before the next repaint,
+	 * along with weston_layer::dirty and the order of the layers at
+	 * the last build, in view_list_layers. */
+	int view_list_dirty;
+	struct wl_array view_list_layers;
+	/* Set when only view geometry changed since: the transforms of
+	 * the views in the list are brought up to date without a rebuild,
+	 * and the per-output lists only if an output_mask changed. */
+	int view_transforms_dirty;
+	int output_view_lists_dirty;
+	/* Bumped whenever what weston_compositor_pick_view() sees may
+	 * have changed: view geometry, the view list, input regions. */
+	uint32_t scene_serial;
+	struct weston_pick_index *pick_index;
 	struct wl_list plane_list;
+	/* Running weston_view_animations, in creation order; all are
+	 * advanced in one pass per output repaint. */
+	struct wl_list view_animation_list;
+	uint32_t view_animation_pass;
 	struct wl_list key_binding_list;
+	struct weston_binding_table key_binding_table;
 	struct wl_list modifier_binding_list;
 	struct wl_list button_binding_list;
+	struct weston_binding_table button_binding_table;
 	struct wl_list touch_binding_list;
 	struct wl_list axis_binding_list;
 	struct wl_list debug_binding_list;
@@ -672,6 +907,10 @@ struct weston_compositor {
 
 	/* Repaint state. */
 	struct weston_plane primary_plane;
+	/* Views of the cursor layer no hardware plane took, when the
+	 * renderer has WESTON_CAP_SOFTWARE_CURSOR. It occludes nothing on
+	 * the planes below. */
+	struct weston_plane cursor_plane;
 	uint32_t capabilities; /* combination of enum weston_capability */
 
 	struct weston_renderer *renderer;
@@ -687,6 +926,8 @@ struct weston_compositor {
 	struct xkb_rule_names xkb_names;
 	struct xkb_context *xkb_context;
 	struct weston_xkb_info *xkb_info;
+	struct wl_list xkb_info_list; /* weston_xkb_info::link */
+	char *xkb_cache_dir; /* of compiled keymaps, or NULL */
 
 	/* Raw keyboard processing (no libxkbcommon initialization or handling) */
 	int use_xkbcommon;
@@ -696,6 +937,40 @@ struct weston_compositor {
 
 	clockid_t presentation_clock;
 	int32_t repaint_msec;
+	int repaint_adaptive;
+	/* Repaint an output whose deadline passed while serving client
+	 * requests, instead of after the rest of them */
+	int repaint_preempt;
+	/* Send frame callbacks when the frame is presented rather than
+	 * when it is submitted */
+	int present_frame_callbacks;
+	/* in ms, 0 to send frame callbacks of occluded surfaces with
+	 * every repaint */
+	int32_t occluded_frame_interval;
+	struct wl_event_source *frame_throttle_timer;
+
+	/* Without input for idle_refresh_timeout seconds, idle_refresh is
+	 * set and outputs repaint at most every idle_refresh_interval ms,
+	 * until the next input; 0 to always repaint at the refresh rate */
+	int32_t idle_refresh_timeout;
+	int32_t idle_refresh_interval;
+	/* only repaints damaging at most this percentage of the output,
+	 * and not animated, are pushed back */
+	int32_t idle_refresh_damage;
+	struct wl_event_source *idle_refresh_source;
+	bool idle_refresh;
+
+	/* weston_client_usage::link */
+	struct wl_list client_usage_list;
+	/* in bytes of wl_shm and dmabuf buffers per client, 0 for none */
+	uint64_t client_memory_limit;
+	/* commits per client and output frame before the client's buffer
+	 * releases are held until the next frame, 0 for no limit */
+	uint32_t client_commit_budget;
+	uint32_t frame_seq; /* bumped on every finished output frame */
+	/* Damage regions are merged down to this many rectangles, 0 to
+	 * keep them as they are */
+	int32_t damage_max_rects;
 
 	int exit_code;
 
@@ -703,10 +978,43 @@ struct weston_compositor {
 	void (*exit)(struct weston_compositor *c);
 };
 
+/* What a client holds in the compositor, created with its first
+ * surface or dmabuf and freed when it disconnects */
+struct weston_client_usage {
+	struct weston_compositor *compositor;
+	struct wl_client *client;
+	struct wl_listener destroy_listener;
+	struct wl_list link; /* weston_compositor::client_usage_list */
+	pid_t pid;
+
+	uint32_t surfaces;
+	uint32_t buffers; /* wl_buffers attached at least once */
+	uint64_t shm_bytes;
+	uint64_t dmabuf_bytes;
+	uint64_t texture_bytes; /* renderer copies of the contents */
+
+	uint64_t commits;
+	uint64_t damage_rects;
+	uint32_t commit_rate; /* per second, over the last second */
+	uint32_t rate_start_ms;
+	uint32_t rate_commits;
+
+	/* Over weston_compositor::client_commit_budget in the current
+	 * frame: wl_buffer.release is held in held_buffer_list */
+	uint32_t frame_seq;
+	uint32_t frame_commits;
+	bool throttled;
+	bool throttle_logged;
+	struct wl_list held_buffer_list; /* weston_buffer::held_link */
+};
+
 struct weston_buffer {
 	struct wl_resource *resource;
 	struct wl_signal destroy_signal;
 	struct wl_listener destroy_listener;
+	/* counted in the client's weston_client_usage */
+	bool accounted;
+	uint64_t shm_bytes;
 
 	union {
 		struct wl_shm_buffer *shm_buffer;
@@ -715,6 +1023,8 @@ struct weston_buffer {
 	int32_t width, height;
 	uint32_t busy_count;
 	int y_inverted;
+	/* in weston_client_usage::held_buffer_list, release not sent yet */
+	struct wl_list held_link;
 };
 
 struct weston_buffer_reference {
@@ -722,6 +1032,19 @@ struct weston_buffer_reference {
 	struct wl_listener destroy_listener;
 };
 
+/* A zlinux_buffer_release, sent once the last reference is dropped:
+ * with fence_fd if some user of the buffer left one, immediately
+ * otherwise. */
+struct weston_buffer_release {
+	struct wl_resource *resource; /* NULL once the client is gone */
+	uint32_t ref_count;
+	int fence_fd;
+};
+
+struct weston_buffer_release_reference {
+	struct weston_buffer_release *buffer_release;
+};
+
 struct weston_buffer_viewport {
 	struct {
 		/* wl_surface.set_buffer_transform */
@@ -784,19 +1107,48 @@ struct weston_region {
  */
 
 struct weston_view {
+	/* What the walks over weston_compositor::view_list read of every
+	 * view on each repaint and pick comes first, to keep them to the
+	 * first cache line of the views they skip. */
+	struct wl_list link;
+	struct weston_plane *plane;
 	struct weston_surface *surface;
+
+	/*
+	 * A more complete representation of all outputs this surface is
+	 * displayed on.
+	 */
+	uint32_t output_mask;
+	float alpha;                     /* part of geometry, see below */
+
+	/* Spatial index state used by weston_compositor_pick_view().
+	 * x1, y1, x2, y2 is the range of grid cells the bounding box
+	 * covers, order is the position in weston_compositor::view_list
+	 * that was valid when serial matched view_list_serial.
+	 */
+	struct {
+		uint32_t serial;
+		uint32_t order;
+		int indexed;
+		int oversized;
+		int32_t x1, y1, x2, y2;
+	} pick;
+
 	struct wl_list surface_link;
 	struct wl_signal destroy_signal;
 
-	struct wl_list link;
 	struct weston_layer_entry layer_link; /* part of geometry */
-	struct weston_plane *plane;
 
 	/* For weston_layer inheritance from another view */
 	struct weston_view *parent_view;
 
 	pixman_region32_t clip;          /* See weston_view_damage_below() */
-	float alpha;                     /* part of geometry, see below */
+
+	/* Views of a layer with the same non-NULL cache_group are expected
+	 * to stay unchanged for long and may be cached by the renderer as
+	 * soon as they are drawn, apart from the rest of their layer. The
+	 * shell owns the value, which is only compared. */
+	void *cache_group;
 
 	void *renderer_state;
 
@@ -843,6 +1195,11 @@ struct weston_view {
 		struct weston_matrix matrix;
 		struct weston_matrix inverse;
 
+		/* Set when inverse only translates by whole pixels, by
+		 * inverse_x, inverse_y; input then skips the matrix. */
+		int integer_translate;
+		wl_fixed_t inverse_x, inverse_y;
+
 		struct weston_transform position; /* matrix from x, y */
 	} transform;
 
@@ -853,17 +1210,36 @@ struct weston_view {
 	 */
 	struct weston_output *output;
 
-	/*
-	 * A more complete representation of all outputs this surface is
-	 * displayed on.
-	 */
-	uint32_t output_mask;
-
 	/* Per-surface Presentation feedback flags, controlled by backend. */
 	uint32_t psf_flags;
+
+	/* Set by the shell while the user drags the view around. Backends
+	 * should then favour it for a plane of its own, where moving it
+	 * only repaints what it uncovers on the primary plane. */
+	bool moving;
+
+	/* Pass of weston_compositor_run_view_animations() that last
+	 * dirtied this view, so that a view running several animations
+	 * is only invalidated once per frame. */
+	uint32_t animation_pass;
+};
+
+/* Sticky regions of a weston_surface_state that have changed since
+ * the state was last committed or copied to the sub-surface cache.
+ * weston_surface_commit_state() only recomputes the surface's regions
+ * for the bits set here, or when the surface size changes, so code
+ * that modifies them in surface->pending directly has to set the bit
+ * as well.
+ */
+enum weston_surface_state_dirty {
+	WESTON_SURFACE_STATE_OPAQUE = (1 << 0),
+	WESTON_SURFACE_STATE_INPUT = (1 << 1),
 };
 
 struct weston_surface_state {
+	/* enum weston_surface_state_dirty */
+	uint32_t dirty;
+
 	/* wl_surface.attach */
 	int newly_attached;
 	struct weston_buffer *buffer;
@@ -874,6 +1250,9 @@ struct weston_surface_state {
 	/* wl_surface.damage */
 	pixman_region32_t damage;
 
+	/* wl_surface.damage_buffer */
+	pixman_region32_t damage_buffer;
+
 	/* wl_surface.set_opaque_region */
 	pixman_region32_t opaque;
 
@@ -890,6 +1269,15 @@ struct weston_surface_state {
 	/* wl_surface.set_scaling_factor */
 	/* wl_viewport.set */
 	struct weston_buffer_viewport buffer_viewport;
+
+	/* zlinux_surface_synchronization.set_acquire_fence */
+	int acquire_fence_fd;
+
+	/* zlinux_surface_synchronization.get_release */
+	struct weston_buffer_release_reference buffer_release_ref;
+
+	/* ztearing_control.set_presentation_hint */
+	bool async_flip;
 };
 
 struct weston_surface {
@@ -897,9 +1285,12 @@ struct weston_surface {
 	struct wl_signal destroy_signal; /* callback argument: this surface */
 	struct weston_compositor *compositor;
 
-	/** Damage in local coordinates from the client, for tex upload. */
+	/** Damage in local coordinates from the client. */
 	pixman_region32_t damage;
 
+	/** The same damage in buffer coordinates, for tex upload. */
+	pixman_region32_t buffer_damage;
+
 	pixman_region32_t opaque;        /* part of geometry, see below */
 	pixman_region32_t input;
 	int32_t width, height;
@@ -930,6 +1321,13 @@ struct weston_surface {
 	struct wl_list frame_callback_list;
 	struct wl_list feedback_list;
 
+	/* Frame callbacks of a surface hidden under other views are only
+	 * sent every weston_compositor::occluded_frame_interval, unless
+	 * frame_throttle_disabled is set; frame_throttle_time is when
+	 * they last went out while hidden, 0 when visible. */
+	bool frame_throttle_disabled;
+	uint32_t frame_throttle_time;
+
 	struct weston_buffer_reference buffer_ref;
 	struct weston_buffer_viewport buffer_viewport;
 	int32_t width_from_buffer; /* before applying viewport */
@@ -939,6 +1337,24 @@ struct weston_surface {
 	/* wl_viewport resource for this surface */
 	struct wl_resource *viewport_resource;
 
+	/* zlinux_surface_synchronization resource for this surface */
+	struct wl_resource *synchronization_resource;
+	/* Fence the client gave for buffer_ref, -1 once waited on or if
+	 * none; the release is signalled when renderers and backends
+	 * are done with buffer_ref. */
+	int acquire_fence_fd;
+	struct weston_buffer_release_reference buffer_release_ref;
+
+	/* GPU memory the renderer holds for the contents, see
+	 * weston_surface_set_texture_bytes() */
+	uint64_t texture_bytes;
+
+	/* ztearing_control resource for this surface */
+	struct wl_resource *tearing_control_resource;
+	/* Backends may flip to this surface's buffers without waiting
+	 * for vblank when it is scanned out directly */
+	bool async_flip;
+
 	/* All the pending state, that wl_surface.commit will apply. */
 	struct weston_surface_state pending;
 
@@ -964,6 +1380,9 @@ struct weston_surface {
 	 */
 	struct wl_list subsurface_list; /* weston_subsurface::parent_link */
 	struct wl_list subsurface_list_pending; /* ...::parent_link_pending */
+	/* cache of weston_surface_get_subsurfaces_extents() */
+	pixman_box32_t subsurfaces_extents;
+	bool subsurfaces_extents_dirty;
 
 	/*
 	 * For tracking protocol role assignments. Different roles may
@@ -999,6 +1418,9 @@ struct weston_subsurface {
 	int has_cached_data;
 	struct weston_surface_state cached;
 	struct weston_buffer_reference cached_buffer_ref;
+	/* enum weston_surface_state_dirty: regions committed directly
+	 * since the last commit to cache, so cached ones are out of date */
+	uint32_t cache_stale;
 
 	int synchronized;
 
@@ -1056,6 +1478,10 @@ weston_surface_to_buffer(struct weston_surface *surface,
 pixman_box32_t
 weston_surface_to_buffer_rect(struct weston_surface *surface,
 			      pixman_box32_t rect);
+struct weston_layer *
+weston_view_get_layer(struct weston_view *view);
+struct weston_plane *
+weston_view_get_fallback_plane(struct weston_view *view);
 void
 weston_view_to_output_matrix(struct weston_view *view,
 			     struct weston_output *op,
@@ -1077,6 +1503,9 @@ weston_spring_done(struct weston_spring *spring);
 void
 weston_surface_activate(struct weston_surface *surface,
 			struct weston_seat *seat);
+int
+weston_compositor_refresh_interval_at(struct weston_compositor *ec,
+				      wl_fixed_t fx, wl_fixed_t fy);
 void
 notify_motion(struct weston_seat *seat, uint32_t time,
 	      wl_fixed_t dx, wl_fixed_t dy);
@@ -1232,6 +1661,9 @@ weston_install_debug_key_binding(struct weston_compositor *compositor,
 void
 weston_binding_list_destroy_all(struct wl_list *list);
 
+void
+weston_binding_table_init(struct weston_binding_table *table);
+
 void
 weston_compositor_run_key_binding(struct weston_compositor *compositor,
 				  struct weston_keyboard *keyboard,
@@ -1346,19 +1778,59 @@ void
 weston_surface_get_content_size(struct weston_surface *surface,
 				int *width, int *height);
 
+void
+weston_surface_get_subsurfaces_extents(struct weston_surface *surface,
+				       pixman_box32_t *box);
+
 int
 weston_surface_copy_content(struct weston_surface *surface,
 			    void *target, size_t size,
 			    int src_x, int src_y,
 			    int width, int height);
 
+int
+weston_surface_copy_content_async(struct weston_surface *surface,
+				  void *target, size_t size,
+				  int src_x, int src_y,
+				  int width, int height,
+				  int dst_width, int dst_height,
+				  weston_surface_copy_done_func done,
+				  void *data);
+
 struct weston_buffer *
 weston_buffer_from_resource(struct wl_resource *resource);
 
+struct weston_client_usage *
+weston_client_usage_get(struct weston_compositor *compositor,
+			struct wl_client *client);
+
+struct weston_client_usage *
+weston_client_usage_find(struct wl_client *client);
+
+int
+weston_client_usage_add_memory(struct weston_client_usage *usage,
+			       uint64_t *counter, uint64_t bytes);
+
+void
+weston_surface_set_texture_bytes(struct weston_surface *surface,
+				 uint64_t bytes);
+
 void
 weston_buffer_reference(struct weston_buffer_reference *ref,
 			struct weston_buffer *buffer);
 
+void
+weston_buffer_release_reference(struct weston_buffer_release_reference *ref,
+				struct weston_buffer_release *buffer_release);
+
+void
+weston_buffer_release_move(struct weston_buffer_release_reference *dest,
+			   struct weston_buffer_release_reference *src);
+
+void
+weston_buffer_release_set_fence(struct weston_buffer_release *buffer_release,
+				int fence_fd);
+
 uint32_t
 weston_compositor_get_time(void);
 
@@ -1384,6 +1856,10 @@ weston_compositor_read_presentation_clock(
 bool
 weston_compositor_import_dmabuf(struct weston_compositor *compositor,
 				struct linux_dmabuf_buffer *buffer);
+void
+weston_compositor_import_dmabuf_async(struct weston_compositor *compositor,
+				      struct linux_dmabuf_buffer *buffer,
+				      weston_dmabuf_import_done_func done);
 
 void
 weston_compositor_shutdown(struct weston_compositor *ec);
@@ -1409,6 +1885,17 @@ weston_compositor_add_output(struct weston_compositor *compositor,
                              struct weston_output *output);
 void
 weston_output_destroy(struct weston_output *output);
+void *
+weston_output_frame_alloc(struct weston_output *output, size_t size);
+void
+weston_frame_arena_reset(struct weston_frame_arena *arena);
+void
+weston_frame_arena_release(struct weston_frame_arena *arena);
+uint32_t
+weston_output_get_buffer_transform(struct weston_output *output);
+void
+weston_output_get_buffer_size(struct weston_output *output,
+			      int32_t *width, int32_t *height);
 void
 weston_output_transform_coordinate(struct weston_output *output,
 				   wl_fixed_t device_x, wl_fixed_t device_y,
@@ -1439,6 +1926,9 @@ weston_seat_release(struct weston_seat *seat);
 int
 weston_compositor_xkb_init(struct weston_compositor *ec,
 			   struct xkb_rule_names *names);
+struct xkb_keymap *
+weston_compositor_compile_keymap(struct weston_compositor *ec,
+				 const struct xkb_rule_names *names);
 void
 weston_compositor_xkb_destroy(struct weston_compositor *ec);
 
@@ -1449,6 +1939,8 @@ void
 weston_log_file_open(const char *filename);
 void
 weston_log_file_close(void);
+void
+weston_log_sync(void);
 int
 weston_vlog(const char *fmt, va_list ap);
 int
@@ -1483,7 +1975,8 @@ screenshooter_create(struct weston_compositor *ec);
 enum weston_screenshooter_outcome {
 	WESTON_SCREENSHOOTER_SUCCESS,
 	WESTON_SCREENSHOOTER_NO_MEMORY,
-	WESTON_SCREENSHOOTER_BAD_BUFFER
+	WESTON_SCREENSHOOTER_BAD_BUFFER,
+	WESTON_SCREENSHOOTER_BAD_REGION
 };
 
 typedef void (*weston_screenshooter_done_func_t)(void *data,
@@ -1491,6 +1984,13 @@ typedef void (*weston_screenshooter_done_func_t)(void *data,
 int
 weston_screenshooter_shoot(struct weston_output *output, struct weston_buffer *buffer,
 			   weston_screenshooter_done_func_t done, void *data);
+int
+weston_screenshooter_shoot_region(struct weston_output *output,
+				  struct weston_buffer *buffer,
+				  int32_t x, int32_t y,
+				  int32_t width, int32_t height,
+				  weston_screenshooter_done_func_t done,
+				  void *data);
 
 struct clipboard *
 clipboard_create(struct weston_seat *seat);
@@ -1548,6 +2048,10 @@ weston_move_scale_run(struct weston_view *view, int dx, int dy,
 void
 weston_fade_update(struct weston_view_animation *fade, float target);
 
+void
+weston_compositor_run_view_animations(struct weston_output *output,
+				      uint32_t msecs);
+
 struct weston_view_animation *
 weston_stable_fade_run(struct weston_view *front_view, float start,
 		       struct weston_view *back_view, float end,
@@ -1561,6 +2065,10 @@ void
 weston_surface_set_color(struct weston_surface *surface,
 			 float red, float green, float blue, float alpha);
 
+int
+weston_surface_set_image(struct weston_surface *surface,
+			 pixman_image_t *image);
+
 void
 weston_surface_destroy(struct weston_surface *surface);
 
@@ -1594,6 +2102,8 @@ void
 weston_matrix_transform_region(pixman_region32_t *dest,
                                struct weston_matrix *matrix,
                                pixman_region32_t *src);
+void
+weston_region_coarsen(pixman_region32_t *region, int max_rects);
 void *
 weston_load_module(const char *name, const char *entrypoint);
 
@@ -49,6 +49,12 @@ struct weston_drag {
 struct weston_pointer_drag {
 	struct weston_drag  base;
 	struct weston_pointer_grab grab;
+
+	/* wl_data_device.motion is sent once per refresh at most, the
+	 * latest position when the timer fires */
+	struct wl_event_source *motion_timer;
+	int motion_pending;
+	uint32_t motion_time;
 };
 
 struct weston_touch_drag {
@@ -201,6 +207,7 @@ drag_surface_configure(struct weston_drag *drag,
 		weston_layer_entry_insert(list, &drag->icon->layer_link);
 		weston_view_update_transform(drag->icon);
 		pixman_region32_clear(&es->pending.input);
+		es->pending.dirty |= WESTON_SURFACE_STATE_INPUT;
 	}
 
 	drag->dx += sx;
@@ -316,6 +323,37 @@ weston_drag_set_focus(struct weston_drag *drag,
 	drag->focus_resource = resource;
 }
 
+/* Send the motion held back for the drop target, if any, so that it
+ * sees the latest position before anything else */
+static void
+drag_flush_motion(struct weston_pointer_drag *drag)
+{
+	struct weston_pointer *pointer = drag->grab.pointer;
+	wl_fixed_t sx, sy;
+
+	if (!drag->motion_pending)
+		return;
+
+	drag->motion_pending = 0;
+	if (!drag->base.focus_resource)
+		return;
+
+	weston_view_from_global_fixed(drag->base.focus,
+				      pointer->x, pointer->y, &sx, &sy);
+	wl_data_device_send_motion(drag->base.focus_resource,
+				   drag->motion_time, sx, sy);
+}
+
+static int
+drag_motion_timer_handler(void *data)
+{
+	struct weston_pointer_drag *drag = data;
+
+	drag_flush_motion(drag);
+
+	return 0;
+}
+
 static void
 drag_grab_focus(struct weston_pointer_grab *grab)
 {
@@ -328,8 +366,10 @@ drag_grab_focus(struct weston_pointer_grab *grab)
 	view = weston_compositor_pick_view(pointer->seat->compositor,
 					   pointer->x, pointer->y,
 					   &sx, &sy);
-	if (drag->base.focus != view)
+	if (drag->base.focus != view) {
+		drag_flush_motion(drag);
 		weston_drag_set_focus(&drag->base, pointer->seat, view, sx, sy);
+	}
 }
 
 static void
@@ -351,12 +391,25 @@ drag_grab_motion(struct weston_pointer_grab *grab, uint32_t time,
 		weston_view_schedule_repaint(drag->base.icon);
 	}
 
-	if (drag->base.focus_resource) {
+	if (!drag->base.focus_resource)
+		return;
+
+	if (!drag->motion_timer) {
 		weston_view_from_global_fixed(drag->base.focus,
 					      pointer->x, pointer->y,
 					      &sx, &sy);
 
 		wl_data_device_send_motion(drag->base.focus_resource, time, sx, sy);
+		return;
+	}
+
+	drag->motion_time = time;
+	if (!drag->motion_pending) {
+		drag->motion_pending = 1;
+		wl_event_source_timer_update(drag->motion_timer,
+			weston_compositor_refresh_interval_at(
+				pointer->seat->compositor,
+				pointer->x, pointer->y));
 	}
 }
 
@@ -371,6 +424,8 @@ data_device_end_drag_grab(struct weston_drag *drag,
 		drag->icon->surface->configure = NULL;
 		weston_surface_set_label_func(drag->icon->surface, NULL);
 		pixman_region32_clear(&drag->icon->surface->pending.input);
+		drag->icon->surface->pending.dirty |=
+			WESTON_SURFACE_STATE_INPUT;
 		wl_list_remove(&drag->icon_destroy_listener.link);
 		weston_view_destroy(drag->icon);
 	}
@@ -383,6 +438,8 @@ data_device_end_pointer_drag_grab(struct weston_pointer_drag *drag)
 {
 	struct weston_pointer *pointer = drag->grab.pointer;
 
+	if (drag->motion_timer)
+		wl_event_source_remove(drag->motion_timer);
 	data_device_end_drag_grab(&drag->base, pointer->seat);
 	weston_pointer_end_grab(pointer);
 	free(drag);
@@ -397,6 +454,8 @@ drag_grab_button(struct weston_pointer_grab *grab,
 	struct weston_pointer *pointer = drag->grab.pointer;
 	enum wl_pointer_button_state state = state_w;
 
+	drag_flush_motion(drag);
+
 	if (drag->base.focus_resource &&
 	    pointer->grab_button == button &&
 	    state == WL_POINTER_BUTTON_STATE_RELEASED)
@@ -557,11 +616,18 @@ weston_pointer_start_drag(struct weston_pointer *pointer,
 		       struct wl_client *client)
 {
 	struct weston_pointer_drag *drag;
+	struct wl_event_loop *loop;
 
 	drag = zalloc(sizeof *drag);
 	if (drag == NULL)
 		return -1;
 
+	/* Without a timer, every motion is sent right away */
+	loop = wl_display_get_event_loop(pointer->seat->compositor->wl_display);
+	drag->motion_timer = wl_event_loop_add_timer(loop,
+						     drag_motion_timer_handler,
+						     drag);
+
 	drag->grab.interface = &pointer_drag_grab_interface;
 	drag->base.client = client;
 	drag->base.data_source = source;
@@ -569,6 +635,8 @@ weston_pointer_start_drag(struct weston_pointer *pointer,
 	if (icon) {
 		drag->base.icon = weston_view_create(icon);
 		if (drag->base.icon == NULL) {
+			if (drag->motion_timer)
+				wl_event_source_remove(drag->motion_timer);
 			free(drag);
 			return -1;
 		}
@@ -0,0 +1,132 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compositor.h"
+
+/* Enough for any type the renderers put in the arena */
+#define FRAME_ARENA_ALIGN 16
+#define FRAME_ARENA_MIN_SIZE 4096
+
+struct frame_arena_chunk {
+	struct frame_arena_chunk *next;
+};
+
+static size_t
+frame_arena_align(size_t size)
+{
+	return (size + FRAME_ARENA_ALIGN - 1) & ~(size_t) (FRAME_ARENA_ALIGN - 1);
+}
+
+static void
+frame_arena_free_chunks(struct weston_frame_arena *arena)
+{
+	struct frame_arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->chunks = NULL;
+}
+
+/** Allocate temporary memory for the current repaint of an output
+ *
+ * \param output The output being repainted.
+ * \param size Number of bytes.
+ * \return Memory aligned for any basic type, or NULL.
+ *
+ * The memory stays valid until the output's repaint finishes and
+ * must not be freed.  Used for arrays the renderers need while
+ * painting an output, so that a steady frame does not call malloc.
+ */
+WL_EXPORT void *
+weston_output_frame_alloc(struct weston_output *output, size_t size)
+{
+	struct weston_frame_arena *arena = &output->frame_arena;
+	struct frame_arena_chunk *chunk;
+	size_t header = frame_arena_align(sizeof *chunk);
+	void *p;
+
+	size = frame_arena_align(size);
+	if (size <= arena->size - arena->used) {
+		p = arena->data + arena->used;
+		arena->used += size;
+		return p;
+	}
+
+	chunk = malloc(header + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	arena->overflow += size;
+
+	return (char *) chunk + header;
+}
+
+/** Release everything allocated this frame
+ *
+ * If the frame did not fit, the block is replaced by one large enough
+ * for the whole frame, so the next one with the same load does not
+ * need malloc at all.  The block never shrinks.
+ */
+void
+weston_frame_arena_reset(struct weston_frame_arena *arena)
+{
+	size_t size;
+	char *data;
+
+	frame_arena_free_chunks(arena);
+
+	if (arena->overflow) {
+		size = arena->size ? arena->size : FRAME_ARENA_MIN_SIZE;
+		while (size < arena->used + arena->overflow)
+			size *= 2;
+
+		data = malloc(size);
+		if (data) {
+			free(arena->data);
+			arena->data = data;
+			arena->size = size;
+		}
+	}
+
+	arena->used = 0;
+	arena->overflow = 0;
+}
+
+void
+weston_frame_arena_release(struct weston_frame_arena *arena)
+{
+	frame_arena_free_chunks(arena);
+	free(arena->data);
+	memset(arena, 0, sizeof *arena);
+}
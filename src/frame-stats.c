@@ -0,0 +1,497 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "frame-stats.h"
+#include "compositor.h"
+#include "presentation_timing-server-protocol.h"
+#include "shared/helpers.h"
+#include "shared/timespec-util.h"
+
+/* Commit to present latencies kept per surface for the percentiles */
+#define FRAME_STATS_SAMPLES 256
+
+struct frame_stats_samples {
+	uint32_t usec[FRAME_STATS_SAMPLES];
+	uint32_t n;
+	uint32_t next;
+};
+
+struct frame_stats_surface {
+	struct weston_surface *surface;
+	struct wl_listener destroy_listener;
+	struct wl_list link; /* frame_stats_::surface_list */
+
+	/* Earliest touch event sent to the surface since its last commit */
+	int touched;
+	struct timespec touch;
+
+	/* Newest committed buffer not yet taken by a repaint, and the
+	 * touch it answers if any */
+	int pending;
+	struct timespec pending_commit;
+	int pending_touched;
+	struct timespec pending_touch;
+
+	/* Buffer repainted on inflight_output, waiting for the flip */
+	struct weston_output *inflight_output;
+	struct timespec inflight_commit;
+	int inflight_zero_copy;
+	int inflight_touched;
+	struct timespec inflight_touch;
+
+	uint32_t frames;
+	uint32_t zero_copy;
+	uint32_t late;     /* presented more than a refresh after commit */
+	uint32_t replaced; /* committed over before they were repainted */
+
+	struct frame_stats_samples latency;
+	struct frame_stats_samples touch_latency;
+};
+
+struct frame_stats_output {
+	struct weston_output *output;
+	struct wl_listener destroy_listener;
+	struct wl_list link; /* frame_stats_::output_list */
+
+	/* Set by a repaint until its frame is presented */
+	int repainted;
+	/* The MSC that frame should land on, 0 if unknown */
+	uint64_t target_msc;
+
+	uint32_t frames;
+	uint32_t missed_vblanks;
+};
+
+struct frame_stats {
+	struct weston_compositor *compositor;
+	struct wl_listener compositor_destroy_listener;
+	struct wl_list surface_list;
+	struct wl_list output_list;
+	struct timespec started;
+};
+
+WL_EXPORT int weston_frame_stats_enabled_;
+static struct frame_stats frame_stats_;
+
+static int
+compare_uint32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+frame_stats_samples_add(struct frame_stats_samples *samples,
+			const struct timespec *from, const struct timespec *to)
+{
+	struct timespec latency;
+
+	timespec_sub(&latency, to, from);
+
+	samples->usec[samples->next] =
+		MAX(timespec_to_nsec(&latency), 0) / 1000;
+	samples->next = (samples->next + 1) % FRAME_STATS_SAMPLES;
+	if (samples->n < FRAME_STATS_SAMPLES)
+		samples->n++;
+}
+
+static void
+frame_stats_samples_percentiles(const struct frame_stats_samples *samples,
+				uint32_t *p50, uint32_t *p90, uint32_t *p99)
+{
+	uint32_t sorted[FRAME_STATS_SAMPLES];
+	uint32_t n = samples->n;
+
+	*p50 = *p90 = *p99 = 0;
+	if (n == 0)
+		return;
+
+	memcpy(sorted, samples->usec, n * sizeof sorted[0]);
+	qsort(sorted, n, sizeof sorted[0], compare_uint32);
+	*p50 = sorted[(n - 1) * 50 / 100];
+	*p90 = sorted[(n - 1) * 90 / 100];
+	*p99 = sorted[(n - 1) * 99 / 100];
+}
+
+static void
+frame_stats_surface_report(struct frame_stats_surface *fss,
+			   const char *state)
+{
+	struct weston_surface *surface = fss->surface;
+	char label[100] = "unknown";
+	pid_t pid = 0;
+	uint32_t p50, p90, p99;
+
+	if (fss->frames == 0 && fss->replaced == 0)
+		return;
+
+	if (surface->get_label)
+		surface->get_label(surface, label, sizeof label);
+	if (surface->resource)
+		wl_client_get_credentials(wl_resource_get_client(surface->resource),
+					  &pid, NULL, NULL);
+
+	frame_stats_samples_percentiles(&fss->latency, &p50, &p90, &p99);
+
+	weston_log_continue(STAMP_SPACE "surface %s (pid %d)%s: "
+			    "%u frames, %u%% zero-copy, "
+			    "latency p50 %.2f p90 %.2f p99 %.2f ms, "
+			    "%u late, %u replaced\n",
+			    label, (int)pid, state, fss->frames,
+			    fss->frames ? fss->zero_copy * 100 / fss->frames : 0,
+			    p50 / 1000.0, p90 / 1000.0, p99 / 1000.0,
+			    fss->late, fss->replaced);
+
+	if (fss->touch_latency.n == 0)
+		return;
+
+	frame_stats_samples_percentiles(&fss->touch_latency,
+					&p50, &p90, &p99);
+
+	weston_log_continue(STAMP_SPACE "  touch to present over %u frames: "
+			    "p50 %.2f p90 %.2f p99 %.2f ms\n",
+			    fss->touch_latency.n,
+			    p50 / 1000.0, p90 / 1000.0, p99 / 1000.0);
+}
+
+static void
+frame_stats_surface_destroy(struct frame_stats_surface *fss)
+{
+	wl_list_remove(&fss->destroy_listener.link);
+	wl_list_remove(&fss->link);
+	free(fss);
+}
+
+static void
+frame_stats_surface_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct frame_stats_surface *fss =
+		container_of(listener, struct frame_stats_surface,
+			     destroy_listener);
+
+	/* Report now, the numbers are most interesting for apps that
+	 * stutter and then get closed. */
+	if (fss->frames > 0) {
+		weston_log("frame stats:\n");
+		frame_stats_surface_report(fss, " destroyed");
+	}
+
+	frame_stats_surface_destroy(fss);
+}
+
+static struct frame_stats_surface *
+frame_stats_surface_get(struct weston_surface *surface)
+{
+	struct frame_stats_surface *fss;
+	struct wl_listener *listener;
+
+	listener = wl_signal_get(&surface->destroy_signal,
+				 frame_stats_surface_handle_destroy);
+	if (listener)
+		return container_of(listener, struct frame_stats_surface,
+				    destroy_listener);
+
+	fss = zalloc(sizeof *fss);
+	if (fss == NULL)
+		return NULL;
+
+	fss->surface = surface;
+	fss->destroy_listener.notify = frame_stats_surface_handle_destroy;
+	wl_signal_add(&surface->destroy_signal, &fss->destroy_listener);
+	wl_list_insert(&frame_stats_.surface_list, &fss->link);
+
+	return fss;
+}
+
+static void
+frame_stats_output_destroy(struct frame_stats_output *fso)
+{
+	struct frame_stats_surface *fss;
+
+	wl_list_for_each(fss, &frame_stats_.surface_list, link)
+		if (fss->inflight_output == fso->output)
+			fss->inflight_output = NULL;
+
+	wl_list_remove(&fso->destroy_listener.link);
+	wl_list_remove(&fso->link);
+	free(fso);
+}
+
+static void
+frame_stats_output_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct frame_stats_output *fso =
+		container_of(listener, struct frame_stats_output,
+			     destroy_listener);
+
+	frame_stats_output_destroy(fso);
+}
+
+static struct frame_stats_output *
+frame_stats_output_get(struct weston_output *output, int create)
+{
+	struct frame_stats_output *fso;
+	struct wl_listener *listener;
+
+	listener = wl_signal_get(&output->destroy_signal,
+				 frame_stats_output_handle_destroy);
+	if (listener)
+		return container_of(listener, struct frame_stats_output,
+				    destroy_listener);
+
+	if (!create)
+		return NULL;
+
+	fso = zalloc(sizeof *fso);
+	if (fso == NULL)
+		return NULL;
+
+	fso->output = output;
+	fso->destroy_listener.notify = frame_stats_output_handle_destroy;
+	wl_signal_add(&output->destroy_signal, &fso->destroy_listener);
+	wl_list_insert(frame_stats_.output_list.prev, &fso->link);
+
+	return fso;
+}
+
+static void
+frame_stats_report(void)
+{
+	struct frame_stats_output *fso;
+	struct frame_stats_surface *fss;
+	struct timespec now, elapsed;
+
+	weston_compositor_read_presentation_clock(frame_stats_.compositor,
+						  &now);
+	timespec_sub(&elapsed, &now, &frame_stats_.started);
+
+	weston_log("frame stats over %.1f s:\n",
+		   timespec_to_nsec(&elapsed) / 1e9);
+
+	wl_list_for_each(fso, &frame_stats_.output_list, link)
+		weston_log_continue(STAMP_SPACE "output %s: %u frames, "
+				    "%u missed vblanks\n",
+				    fso->output->name, fso->frames,
+				    fso->missed_vblanks);
+
+	wl_list_for_each(fss, &frame_stats_.surface_list, link)
+		frame_stats_surface_report(fss, "");
+}
+
+static void
+frame_stats_handle_compositor_destroy(struct wl_listener *listener,
+				      void *data)
+{
+	weston_frame_stats_stop(frame_stats_.compositor);
+}
+
+/** Start collecting presentation statistics
+ *
+ * Until weston_frame_stats_stop(), every committed buffer is followed
+ * to its presentation, for how long that took and whether it was
+ * scanned out directly, and every output counts the vblanks its
+ * repaints missed.
+ */
+WL_EXPORT void
+weston_frame_stats_start(struct weston_compositor *compositor)
+{
+	if (weston_frame_stats_enabled_)
+		return;
+
+	frame_stats_.compositor = compositor;
+	wl_list_init(&frame_stats_.surface_list);
+	wl_list_init(&frame_stats_.output_list);
+	weston_compositor_read_presentation_clock(compositor,
+						  &frame_stats_.started);
+
+	frame_stats_.compositor_destroy_listener.notify =
+		frame_stats_handle_compositor_destroy;
+	wl_signal_add(&compositor->destroy_signal,
+		      &frame_stats_.compositor_destroy_listener);
+
+	weston_frame_stats_enabled_ = 1;
+	weston_log("Frame stats collection started.\n");
+}
+
+/** Log the collected statistics and stop collecting */
+void
+weston_frame_stats_stop(struct weston_compositor *compositor)
+{
+	struct frame_stats_surface *fss, *fss_next;
+	struct frame_stats_output *fso, *fso_next;
+
+	if (!weston_frame_stats_enabled_)
+		return;
+
+	frame_stats_report();
+
+	wl_list_for_each_safe(fss, fss_next, &frame_stats_.surface_list, link)
+		frame_stats_surface_destroy(fss);
+	wl_list_for_each_safe(fso, fso_next, &frame_stats_.output_list, link)
+		frame_stats_output_destroy(fso);
+
+	wl_list_remove(&frame_stats_.compositor_destroy_listener.link);
+	weston_frame_stats_enabled_ = 0;
+}
+
+void
+weston_frame_stats_surface_commit(struct weston_surface *surface)
+{
+	struct frame_stats_surface *fss;
+
+	fss = frame_stats_surface_get(surface);
+	if (fss == NULL)
+		return;
+
+	if (fss->pending)
+		fss->replaced++;
+
+	fss->pending = 1;
+	weston_compositor_read_presentation_clock(surface->compositor,
+						  &fss->pending_commit);
+
+	/* A commit replacing one that answered an earlier touch still
+	 * answers that touch. */
+	if (fss->touched && !fss->pending_touched) {
+		fss->pending_touched = 1;
+		fss->pending_touch = fss->touch;
+	}
+	fss->touched = 0;
+}
+
+/** Note that a touch event is on its way to the surface
+ *
+ * The next buffer the surface commits is taken to be its response, and
+ * the time from the event to that buffer's presentation is sampled as
+ * the surface's touch latency.
+ */
+void
+weston_frame_stats_touch(struct weston_surface *surface)
+{
+	struct frame_stats_surface *fss;
+
+	fss = frame_stats_surface_get(surface);
+	if (fss == NULL || fss->touched)
+		return;
+
+	fss->touched = 1;
+	weston_compositor_read_presentation_clock(surface->compositor,
+						  &fss->touch);
+}
+
+/* Called after planes are assigned: the committed buffers of the
+ * surfaces this output repaints are now on their way to the screen. */
+void
+weston_frame_stats_output_repaint(struct weston_output *output)
+{
+	struct frame_stats_output *fso;
+	struct frame_stats_surface *fss;
+	struct weston_view *view;
+
+	fso = frame_stats_output_get(output, 1);
+	if (fso) {
+		fso->repainted = 1;
+		fso->target_msc = output->msc ? output->msc + 1 : 0;
+	}
+
+	wl_list_for_each(fss, &frame_stats_.surface_list, link) {
+		if (!fss->pending || fss->surface->output != output)
+			continue;
+
+		fss->pending = 0;
+		fss->inflight_output = output;
+		fss->inflight_commit = fss->pending_commit;
+		fss->inflight_touched = fss->pending_touched;
+		fss->inflight_touch = fss->pending_touch;
+		fss->pending_touched = 0;
+
+		/* Like for the feedback flags, all views must be scanned
+		 * out for the frame to count as zero-copy. */
+		fss->inflight_zero_copy = 1;
+		wl_list_for_each(view, &fss->surface->views, surface_link)
+			if ((view->output_mask & (1u << output->id)) &&
+			    !(view->psf_flags &
+			      PRESENTATION_FEEDBACK_KIND_ZERO_COPY))
+				fss->inflight_zero_copy = 0;
+	}
+}
+
+void
+weston_frame_stats_output_present(struct weston_output *output,
+				  const struct timespec *stamp,
+				  uint32_t presented_flags)
+{
+	struct frame_stats_output *fso;
+	struct frame_stats_surface *fss;
+	struct timespec latency;
+	int64_t refresh_nsec;
+
+	if (presented_flags & PRESENTATION_FEEDBACK_INVALID)
+		return;
+
+	fso = frame_stats_output_get(output, 0);
+	if (fso == NULL || !fso->repainted)
+		return;
+
+	fso->frames++;
+	if (fso->target_msc && output->msc > fso->target_msc)
+		fso->missed_vblanks += output->msc - fso->target_msc;
+	fso->repainted = 0;
+	fso->target_msc = 0;
+
+	refresh_nsec = 0;
+	if (output->current_mode->refresh > 0)
+		refresh_nsec = millihz_to_nsec(output->current_mode->refresh);
+
+	wl_list_for_each(fss, &frame_stats_.surface_list, link) {
+		if (fss->inflight_output != output)
+			continue;
+
+		fss->inflight_output = NULL;
+
+		frame_stats_samples_add(&fss->latency,
+					&fss->inflight_commit, stamp);
+		if (fss->inflight_touched)
+			frame_stats_samples_add(&fss->touch_latency,
+						&fss->inflight_touch, stamp);
+		fss->inflight_touched = 0;
+
+		timespec_sub(&latency, stamp, &fss->inflight_commit);
+
+		fss->frames++;
+		if (fss->inflight_zero_copy)
+			fss->zero_copy++;
+		if (refresh_nsec && timespec_to_nsec(&latency) > refresh_nsec)
+			fss->late++;
+	}
+}
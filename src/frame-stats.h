@@ -0,0 +1,63 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_FRAME_STATS_H
+#define WESTON_FRAME_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+extern int weston_frame_stats_enabled_;
+
+struct weston_compositor;
+struct weston_output;
+struct weston_surface;
+
+void
+weston_frame_stats_start(struct weston_compositor *compositor);
+
+void
+weston_frame_stats_stop(struct weston_compositor *compositor);
+
+void
+weston_frame_stats_surface_commit(struct weston_surface *surface);
+
+void
+weston_frame_stats_touch(struct weston_surface *surface);
+
+void
+weston_frame_stats_output_repaint(struct weston_output *output);
+
+void
+weston_frame_stats_output_present(struct weston_output *output,
+				  const struct timespec *stamp,
+				  uint32_t presented_flags);
+
+#define FRAME_STATS(func, ...) do { \
+	if (weston_frame_stats_enabled_) \
+		weston_frame_stats_##func(__VA_ARGS__); \
+} while (0)
+
+#endif /* WESTON_FRAME_STATS_H */
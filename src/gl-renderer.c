@@ -30,12 +30,25 @@
 #include <GLES2/gl2ext.h>
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <float.h>
 #include <assert.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <linux/input.h>
+#ifdef HAVE_LINUX_UDMABUF_H
+#include <linux/udmabuf.h>
+#endif
 #include <drm_fourcc.h>
 
 #include "gl-renderer.h"
@@ -44,7 +57,9 @@
 #include "linux-dmabuf-server-protocol.h"
 
 #include "shared/helpers.h"
+#include "shared/timespec-util.h"
 #include "weston-egl-ext.h"
+#include "timeline.h"
 
 struct gl_shader {
 	GLuint program;
@@ -53,10 +68,13 @@ struct gl_shader {
 	GLint tex_uniforms[3];
 	GLint alpha_uniform;
 	GLint color_uniform;
+	GLint lut_size_uniform;
 	const char *vertex_source, *fragment_source;
 };
 
-#define BUFFER_DAMAGE_COUNT 2
+/* Drivers on tiled GPUs commonly rotate through three or four buffers,
+ * keep enough history so that none of them forces a full repaint. */
+#define BUFFER_DAMAGE_COUNT 4
 
 enum gl_border_status {
 	BORDER_STATUS_CLEAN = 0,
@@ -75,6 +93,42 @@ struct gl_border_image {
 	void *data;
 };
 
+/* A read-back in flight, see gl_renderer_queue_read_pixels() */
+struct gl_readback {
+	GLuint pbo;
+	GLsizeiptr size, used;
+#ifdef EGL_KHR_fence_sync
+	EGLSyncKHR sync;
+#endif
+	int pending;
+};
+
+/* A weston_surface_copy_content_async() read-back in flight, in
+ * gl_renderer::copy_jobs */
+struct gl_copy_job {
+	struct wl_list link;
+	GLuint pbo;
+	size_t size;
+	void *target;
+#ifdef EGL_KHR_fence_sync
+	EGLSyncKHR sync;
+#endif
+	weston_surface_copy_done_func done;
+	void *data;
+};
+
+/* A view of the bottom layers as it was drawn into the layer cache */
+struct gl_layer_cache_view {
+	struct weston_view *view;
+	struct weston_surface *surface;
+	struct weston_layer *layer;
+	void *cache_group;
+	uint32_t content_serial;
+	float alpha;
+	struct weston_matrix matrix;
+	pixman_box32_t extents;
+};
+
 struct gl_output_state {
 	EGLSurface egl_surface;
 	pixman_region32_t buffer_damage[BUFFER_DAMAGE_COUNT];
@@ -84,6 +138,57 @@ struct gl_output_state {
 	enum gl_border_status border_status;
 
 	struct weston_matrix output_matrix;
+
+	struct gl_readback readback[2];
+	int readback_index;
+
+	/* With a colour LUT or while zoomed, the views are drawn
+	 * unzoomed into tex, which keeps its contents from frame to
+	 * frame, and tex is then drawn through the LUT or scaled into
+	 * the output buffer. */
+	struct {
+		GLuint fbo;
+		GLuint tex;
+		int32_t width, height;
+		int valid;
+	} offscreen;
+
+	struct {
+		GLuint lut_tex;
+		int lut_size;
+	} color;
+
+	/* The bottom layers of the output, drawn once into tex after they
+	 * stayed the same for GL_LAYER_CACHE_FRAMES frames, and from there
+	 * until one of their views changes. views holds the primary plane
+	 * views of the last frame, bottom up, the first n_cached of them
+	 * are in tex and the first n_static stayed the same for
+	 * static_frames frames. */
+	struct {
+		GLuint fbo;
+		GLuint tex;
+		int32_t width, height;
+		struct weston_matrix matrix;
+		struct wl_array views; /* struct gl_layer_cache_view */
+		struct wl_array next_views;
+		size_t n_cached;
+		size_t n_static;
+		int static_frames;
+	} layer_cache;
+
+	/* Timer queries of the views drawn in the last frame, read back
+	 * at the next repaint of the output */
+	struct wl_array timer_queries;
+	uint64_t gpu_time;
+	uint64_t gpu_frame_max;
+	uint32_t gpu_frames;
+};
+
+struct gl_timer_query {
+	GLuint query;
+	uint64_t elapsed;
+	/* NULL once the surface is gone */
+	struct gl_surface_state *gs;
 };
 
 enum buffer_type {
@@ -105,6 +210,100 @@ struct egl_image {
 	struct wl_list link;
 };
 
+/* EGLImages created for a wl_drm style EGL buffer. They live as long as
+ * the weston_buffer, so attaching the same buffer again only has to
+ * rebind the textures. */
+struct egl_buffer_state {
+	struct gl_renderer *renderer;
+	struct weston_buffer *buffer;
+	struct wl_listener destroy_listener;
+	struct wl_list link; /* gl_renderer::egl_buffers */
+
+	struct egl_image *images[3];
+	int num_images;
+	GLenum target;
+	struct gl_shader *shader;
+};
+
+/* A wl_shm buffer whose pool is a memfd sealed against shrinking,
+ * turned into a dmabuf with udmabuf so that the GPU samples the
+ * client's memory without an upload. It lives as long as the
+ * weston_buffer; a failed import is kept too, with no image, so that
+ * it is only tried once. */
+struct shm_import_state {
+	struct gl_renderer *renderer;
+	struct wl_listener destroy_listener;
+	struct wl_list link; /* gl_renderer::shm_imports */
+
+	struct egl_image *image;
+
+	/* Bytes of the pool mapping from the start of the buffer, 0 until
+	 * looked up and -1 if it cannot be. Pools only grow. */
+	int64_t pool_bytes;
+};
+
+/* wl_shm YUV formats are uploaded a texture per plane and converted by
+ * the shaders of EGL YUV buffers. A plane has bpp bytes per texel and
+ * hsub, vsub times fewer texels across and down than the first, whose
+ * rows are the buffer stride. The planes follow each other, or are
+ * views of the same data if packed. */
+struct yuv_shm_format {
+	uint32_t format;
+	int packed;
+	int num_planes;
+	struct {
+		GLenum format;
+		int bpp;
+		int hsub, vsub;
+	} plane[3];
+};
+
+static const struct yuv_shm_format yuv_shm_formats[] = {
+	/* The UV texels read as luminance and alpha, which is where
+	 * the XUXV shader looks for U and V */
+	{ WL_SHM_FORMAT_NV12, 0, 2, {
+		{ GL_LUMINANCE, 1, 1, 1 },
+		{ GL_LUMINANCE_ALPHA, 2, 2, 2 } } },
+	{ WL_SHM_FORMAT_YUV420, 0, 3, {
+		{ GL_LUMINANCE, 1, 1, 1 },
+		{ GL_LUMINANCE, 1, 2, 2 },
+		{ GL_LUMINANCE, 1, 2, 2 } } },
+	/* Y0 U Y1 V, read as Y and U or V per pixel, and as YUYV
+	 * quadruplets per pair of them */
+	{ WL_SHM_FORMAT_YUYV, 1, 2, {
+		{ GL_LUMINANCE_ALPHA, 2, 1, 1 },
+		{ GL_BGRA_EXT, 4, 2, 1 } } },
+};
+
+/* Where one plane of a wl_shm buffer is, see struct yuv_shm_format */
+struct shm_plane_layout {
+	int32_t pitch; /* in texels */
+	int32_t height;
+	int32_t bpp;
+	int32_t stride; /* in bytes */
+	int hsub, vsub;
+	size_t offset;
+};
+
+/* Small wl_shm surfaces, such as cursors, icons and tooltips, share
+ * atlas textures instead of getting one each. An atlas is split into
+ * cells, every surface takes a rectangle of them, with a transparent
+ * texel of padding around its contents so that filtering does not
+ * pick up its neighbours. */
+#define GL_ATLAS_SIZE 1024
+#define GL_ATLAS_CELL 16
+#define GL_ATLAS_CELLS (GL_ATLAS_SIZE / GL_ATLAS_CELL)
+#define GL_ATLAS_MAX_CELLS 8
+#define GL_ATLAS_MAX_PAGES 4
+
+struct gl_atlas {
+	GLuint texture;
+	struct wl_list link; /* gl_renderer::atlases */
+	/* A row of cells per entry, a bit set for each cell in use */
+	uint64_t used[GL_ATLAS_CELLS];
+	int n_slots;
+};
+
 struct gl_surface_state {
 	GLfloat color[4];
 	struct gl_shader *shader;
@@ -112,24 +311,66 @@ struct gl_surface_state {
 	GLuint textures[3];
 	int num_textures;
 	int needs_full_upload;
-	pixman_region32_t texture_damage;
+	pixman_region32_t texture_damage; /* in buffer coordinates */
 
 	/* These are only used by SHM surfaces to detect when we need
 	 * to do a full upload to specify a new internal texture
 	 * format */
 	GLenum gl_format;
 	GLenum gl_pixel_type;
+	/* The planes of a YUV SHM buffer, or NULL */
+	const struct yuv_shm_format *yuv;
 
 	struct egl_image* images[3];
 	GLenum target;
 	int num_images;
 
 	struct weston_buffer_reference buffer_ref;
+	/* Gets the fence of the last frame this buffer was drawn in */
+	struct weston_buffer_release_reference buffer_release_ref;
 	enum buffer_type buffer_type;
 	int pitch; /* in pixels */
 	int height; /* in pixels */
 	int y_inverted;
 
+	/* Set when the SHM contents live in an atlas, textures[0] is then
+	 * the atlas texture and the contents start at atlas_x, atlas_y
+	 * within the atlas_box cells */
+	struct gl_atlas *atlas;
+	pixman_box32_t atlas_box;
+	int atlas_x, atlas_y;
+
+	/* SHM textures get mipmaps once drawn heavily minified; they are
+	 * regenerated before the next such draw after an upload. */
+	int has_mipmaps;
+	int mipmaps_stale;
+
+	/* EGL buffers can't get mipmaps; one drawn minified for a few
+	 * draws in a row gets a half size copy instead, which is dropped
+	 * on the next attach. */
+	GLuint downscaled_tex;
+	int minified_draws;
+
+	/* GPU memory of the SHM texture and the downscaled copy,
+	 * counted in gl_renderer::texture_bytes */
+	size_t texture_bytes;
+	/* gl_renderer::texture_lru, most recently in a render list first */
+	struct wl_list lru_link;
+	/* The texture was dropped to stay within the budget, it is
+	 * uploaded again from buffer_ref when next drawn */
+	int evicted;
+
+	/* GPU time of the draws of this surface since timing started */
+	uint64_t gpu_time;
+	uint32_t gpu_draws;
+
+	/* Changes along with what the surface shows, see
+	 * gl_layer_cache_view */
+	uint32_t content_serial;
+
+	/* gl_geometry::link, most recently drawn first */
+	struct wl_list geometry;
+
 	struct weston_surface *surface;
 
 	struct wl_listener surface_destroy_listener;
@@ -149,6 +390,9 @@ struct gl_renderer {
 
 	struct wl_array vertices;
 	struct wl_array vtxcnt;
+	struct wl_array indices;
+	/* Scratch space for the gl_geometry key of a draw */
+	struct wl_array geometry_key;
 
 	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture_2d;
 	PFNEGLCREATEIMAGEKHRPROC create_image;
@@ -158,10 +402,65 @@ struct gl_renderer {
 	PFNEGLSWAPBUFFERSWITHDAMAGEEXTPROC swap_buffers_with_damage;
 #endif
 
+#ifdef EGL_KHR_partial_update
+	PFNEGLSETDAMAGEREGIONKHRPROC set_damage_region;
+#endif
+
 	PFNEGLCREATEPLATFORMWINDOWSURFACEEXTPROC create_platform_window;
 
+#ifdef EGL_KHR_fence_sync
+	PFNEGLCREATESYNCKHRPROC create_sync;
+	PFNEGLDESTROYSYNCKHRPROC destroy_sync;
+	PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync;
+#endif
+	int has_fence_sync;
+
+#if defined(EGL_ANDROID_native_fence_sync) && defined(EGL_KHR_wait_sync)
+	PFNEGLDUPNATIVEFENCEFDANDROIDPROC dup_native_fence_fd;
+	PFNEGLWAITSYNCKHRPROC wait_sync;
+#endif
+	/* Acquire fences are waited for on the GPU, release fences
+	 * come from the frames the buffers are drawn in */
+	int has_native_fence_sync;
+
 	int has_unpack_subimage;
 
+	/* glGenerateMipmap works on textures of any size */
+	int has_npot_mipmap;
+
+	/* Ring of pixel buffer objects used to stage wl_shm uploads */
+	int has_pbo;
+	void *(GL_APIENTRYP map_buffer_range)(GLenum target, GLintptr offset,
+					      GLsizeiptr length,
+					      GLbitfield access);
+	GLboolean (GL_APIENTRYP unmap_buffer)(GLenum target);
+	GLuint upload_pbo[3];
+	int upload_pbo_index;
+
+#ifdef GL_OES_get_program_binary
+	PFNGLGETPROGRAMBINARYOESPROC get_program_binary;
+	PFNGLPROGRAMBINARYOESPROC program_binary;
+#endif
+#ifdef GL_EXT_disjoint_timer_query
+	PFNGLGENQUERIESEXTPROC gen_queries;
+	PFNGLDELETEQUERIESEXTPROC delete_queries;
+	PFNGLBEGINQUERYEXTPROC begin_query;
+	PFNGLENDQUERYEXTPROC end_query;
+	PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_object_ui64v;
+#endif
+	int has_timer_query;
+	/* Every view draw is wrapped in a timer query */
+	int gpu_timing;
+	struct timespec gpu_timing_start;
+	/* Query objects to reuse */
+	struct wl_array free_queries;
+	struct weston_binding *gpu_timing_binding;
+
+	/* Where linked programs are kept across runs, NULL if nowhere */
+	char *shader_cache_dir;
+	/* Hash of the GL vendor, renderer and version strings */
+	uint64_t shader_cache_key;
+
 	PFNEGLBINDWAYLANDDISPLAYWL bind_display;
 	PFNEGLUNBINDWAYLANDDISPLAYWL unbind_display;
 	PFNEGLQUERYWAYLANDBUFFERWL query_buffer;
@@ -175,6 +474,45 @@ struct gl_renderer {
 
 	int has_dmabuf_import;
 	struct wl_list dmabuf_images;
+	struct wl_list egl_buffers;
+
+	/* Client dmabufs are imported on a thread of their own, started
+	 * with the first import: some drivers take milliseconds over
+	 * eglCreateImageKHR(), which needs no context. */
+	struct {
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		struct wl_list queue; /* dmabuf_import_job::link */
+		struct wl_list done; /* dmabuf_import_job::link */
+		int pipe[2];
+		struct wl_event_source *source;
+		int started;
+		int quit;
+	} import;
+
+	/* Surface copies waiting for the GPU, oldest first, polled from
+	 * copy_timer */
+	struct wl_list copy_jobs;
+	struct wl_event_source *copy_timer;
+
+	/* /dev/udmabuf, or -1 when wl_shm buffers are always copied */
+	int udmabuf_fd;
+	struct wl_list shm_imports;
+
+	/* SHM textures of surfaces in no render list are evicted, least
+	 * recently shown first, while texture_bytes exceeds the budget;
+	 * a budget of 0 keeps every texture */
+	size_t texture_budget;
+	size_t texture_bytes;
+	struct wl_list texture_lru;
+	struct weston_binding *texture_binding;
+
+	/* Last gl_surface_state::content_serial handed out */
+	uint32_t content_serial;
+
+	int has_atlas;
+	struct wl_list atlases;
 
 	struct gl_shader texture_shader_rgba;
 	struct gl_shader texture_shader_rgbx;
@@ -182,6 +520,11 @@ struct gl_renderer {
 	struct gl_shader texture_shader_y_uv;
 	struct gl_shader texture_shader_y_u_v;
 	struct gl_shader texture_shader_y_xuxv;
+	/* Variants for views at full opacity, without the alpha multiply */
+	struct gl_shader texture_shader_rgba_noalpha;
+	struct gl_shader texture_shader_opaque;
+	struct gl_shader texture_shader_egl_external_noalpha;
+	struct gl_shader color_lut_shader;
 	struct gl_shader invert_color_shader;
 	struct gl_shader solid_shader;
 	struct gl_shader *current_shader;
@@ -215,25 +558,37 @@ get_renderer(struct weston_compositor *ec)
 	return (struct gl_renderer *)ec->renderer;
 }
 
+/* Takes ownership of image */
 static struct egl_image*
-egl_image_create(struct gl_renderer *gr, EGLenum target,
-		 EGLClientBuffer buffer, const EGLint *attribs)
+egl_image_wrap(struct gl_renderer *gr, EGLImageKHR image)
 {
 	struct egl_image *img;
 
 	img = zalloc(sizeof *img);
+	if (!img) {
+		gr->destroy_image(gr->egl_display, image);
+		return NULL;
+	}
 	wl_list_init(&img->link);
 	img->renderer = gr;
 	img->refcount = 1;
-	img->image = gr->create_image(gr->egl_display, EGL_NO_CONTEXT,
-				      target, buffer, attribs);
+	img->image = image;
+
+	return img;
+}
 
-	if (img->image == EGL_NO_IMAGE_KHR) {
-		free(img);
+static struct egl_image*
+egl_image_create(struct gl_renderer *gr, EGLenum target,
+		 EGLClientBuffer buffer, const EGLint *attribs)
+{
+	EGLImageKHR image;
+
+	image = gr->create_image(gr->egl_display, EGL_NO_CONTEXT,
+				 target, buffer, attribs);
+	if (image == EGL_NO_IMAGE_KHR)
 		return NULL;
-	}
 
-	return img;
+	return egl_image_wrap(gr, image);
 }
 
 static struct egl_image*
@@ -301,80 +656,8 @@ gl_renderer_print_egl_error_state(void)
 		egl_error_string(code), (long)code);
 }
 
-#define max(a, b) (((a) > (b)) ? (a) : (b))
-#define min(a, b) (((a) > (b)) ? (b) : (a))
-
-/*
- * Compute the boundary vertices of the intersection of the global coordinate
- * aligned rectangle 'rect', and an arbitrary quadrilateral produced from
- * 'surf_rect' when transformed from surface coordinates into global coordinates.
- * The vertices are written to 'ex' and 'ey', and the return value is the
- * number of vertices. Vertices are produced in clockwise winding order.
- * Guarantees to produce either zero vertices, or 3-8 vertices with non-zero
- * polygon area.
- */
-static int
-calculate_edges(struct weston_view *ev, pixman_box32_t *rect,
-		pixman_box32_t *surf_rect, GLfloat *ex, GLfloat *ey)
-{
-
-	struct clip_context ctx;
-	int i, n;
-	GLfloat min_x, max_x, min_y, max_y;
-	struct polygon8 surf = {
-		{ surf_rect->x1, surf_rect->x2, surf_rect->x2, surf_rect->x1 },
-		{ surf_rect->y1, surf_rect->y1, surf_rect->y2, surf_rect->y2 },
-		4
-	};
-
-	ctx.clip.x1 = rect->x1;
-	ctx.clip.y1 = rect->y1;
-	ctx.clip.x2 = rect->x2;
-	ctx.clip.y2 = rect->y2;
-
-	/* transform surface to screen space: */
-	for (i = 0; i < surf.n; i++)
-		weston_view_to_global_float(ev, surf.x[i], surf.y[i],
-					    &surf.x[i], &surf.y[i]);
-
-	/* find bounding box: */
-	min_x = max_x = surf.x[0];
-	min_y = max_y = surf.y[0];
-
-	for (i = 1; i < surf.n; i++) {
-		min_x = min(min_x, surf.x[i]);
-		max_x = max(max_x, surf.x[i]);
-		min_y = min(min_y, surf.y[i]);
-		max_y = max(max_y, surf.y[i]);
-	}
-
-	/* First, simple bounding box check to discard early transformed
-	 * surface rects that do not intersect with the clip region:
-	 */
-	if ((min_x >= ctx.clip.x2) || (max_x <= ctx.clip.x1) ||
-	    (min_y >= ctx.clip.y2) || (max_y <= ctx.clip.y1))
-		return 0;
-
-	/* Simple case, bounding box edges are parallel to surface edges,
-	 * there will be only four edges.  We just need to clip the surface
-	 * vertices to the clip rect bounds:
-	 */
-	if (!ev->transform.enabled)
-		return clip_simple(&ctx, &surf, ex, ey);
-
-	/* Transformed case: use a general polygon clipping algorithm to
-	 * clip the surface rectangle with each side of 'rect'.
-	 * The algorithm is Sutherland-Hodgman, as explained in
-	 * http://www.codeguru.com/cpp/misc/misc/graphics/article.php/c8965/Polygon-Clipping.htm
-	 * but without looking at any of that code.
-	 */
-	n = clip_transformed(&ctx, &surf, ex, ey);
-
-	if (n < 3)
-		return 0;
-
-	return n;
-}
+/* Clip rectangles handed to clip_quad_batch() at a time */
+#define CLIP_BATCH 16
 
 static bool
 merge_down(pixman_box32_t *a, pixman_box32_t *b, pixman_box32_t *merge)
@@ -390,8 +673,9 @@ merge_down(pixman_box32_t *a, pixman_box32_t *b, pixman_box32_t *merge)
 }
 
 static int
-compress_bands(pixman_box32_t *inrects, int nrects,
-		   pixman_box32_t **outrects)
+compress_bands(struct weston_output *output,
+	       pixman_box32_t *inrects, int nrects,
+	       pixman_box32_t **outrects)
 {
 	bool merged;
 	pixman_box32_t *out, merge_rect;
@@ -405,7 +689,12 @@ compress_bands(pixman_box32_t *inrects, int nrects,
 	/* nrects is an upper bound - we're not too worried about
 	 * allocating a little extra
 	 */
-	out = malloc(sizeof(pixman_box32_t) * nrects);
+	out = weston_output_frame_alloc(output, sizeof(pixman_box32_t) * nrects);
+	if (!out) {
+		*outrects = inrects;
+		return nrects;
+	}
+
 	out[0] = inrects[0];
 	nout = 1;
 	for (i = 1; i < nrects; i++) {
@@ -425,29 +714,139 @@ compress_bands(pixman_box32_t *inrects, int nrects,
 	return nout;
 }
 
+/* Maps buffer coordinates to texture coordinates */
+struct texcoord_map {
+	GLfloat inv_width, inv_height;
+	GLfloat off_x, off_y;
+	GLfloat height;
+	int y_inverted;
+};
+
+static void
+texcoord_map_init(struct texcoord_map *map, struct gl_surface_state *gs)
+{
+	if (gs->atlas) {
+		map->inv_width = 1.0 / GL_ATLAS_SIZE;
+		map->inv_height = 1.0 / GL_ATLAS_SIZE;
+		map->off_x = gs->atlas_x;
+		map->off_y = gs->atlas_y;
+	} else {
+		map->inv_width = 1.0 / gs->pitch;
+		map->inv_height = 1.0 / gs->height;
+		map->off_x = 0;
+		map->off_y = 0;
+	}
+	map->height = gs->height;
+	map->y_inverted = gs->y_inverted;
+}
+
+/* Write the position and texcoord of a vertex at global x, y, which is
+ * sx, sy on the surface */
+static inline GLfloat *
+emit_vertex(GLfloat *v, struct weston_surface *surface,
+	    const struct texcoord_map *map,
+	    GLfloat x, GLfloat y, GLfloat sx, GLfloat sy)
+{
+	GLfloat bx, by;
+
+	/* position: */
+	*(v++) = x;
+	*(v++) = y;
+
+	/* texcoord: */
+	weston_surface_to_buffer_float(surface, sx, sy, &bx, &by);
+	*(v++) = (map->off_x + bx) * map->inv_width;
+	if (map->y_inverted)
+		*(v++) = (map->off_y + by) * map->inv_height;
+	else
+		*(v++) = (map->off_y + map->height - by) * map->inv_height;
+
+	return v;
+}
+
+/* An untransformed view is a translated copy of its surface, so the
+ * region to draw is the intersection of the two regions, which pixman
+ * computes in one sweep over their bands. Each of its rectangles is
+ * emitted as a quad, with no clipping of each surface rectangle
+ * against each damage rectangle. */
+static int
+texture_region_untransformed(struct weston_view *ev,
+			     pixman_region32_t *region,
+			     pixman_region32_t *surf_region)
+{
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct gl_renderer *gr = get_renderer(ev->surface->compositor);
+	struct texcoord_map map;
+	pixman_region32_t quads;
+	pixman_box32_t *rects;
+	GLfloat *v;
+	unsigned int *vtxcnt;
+	int i, nrects, dx, dy;
+
+	/* Whole numbers while untransformed */
+	dx = ev->geometry.x;
+	dy = ev->geometry.y;
+
+	pixman_region32_init(&quads);
+	pixman_region32_copy(&quads, surf_region);
+	pixman_region32_translate(&quads, dx, dy);
+	pixman_region32_intersect(&quads, &quads, region);
+	rects = pixman_region32_rectangles(&quads, &nrects);
+
+	v = wl_array_add(&gr->vertices, nrects * 4 * 4 * sizeof *v);
+	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * sizeof *vtxcnt);
+	if (!v || !vtxcnt) {
+		pixman_region32_fini(&quads);
+		return 0;
+	}
+
+	texcoord_map_init(&map, gs);
+
+	for (i = 0; i < nrects; i++) {
+		GLfloat x1 = rects[i].x1, y1 = rects[i].y1;
+		GLfloat x2 = rects[i].x2, y2 = rects[i].y2;
+
+		v = emit_vertex(v, ev->surface, &map, x1, y1,
+				x1 - dx, y1 - dy);
+		v = emit_vertex(v, ev->surface, &map, x2, y1,
+				x2 - dx, y1 - dy);
+		v = emit_vertex(v, ev->surface, &map, x2, y2,
+				x2 - dx, y2 - dy);
+		v = emit_vertex(v, ev->surface, &map, x1, y2,
+				x1 - dx, y2 - dy);
+		vtxcnt[i] = 4;
+	}
+
+	pixman_region32_fini(&quads);
+
+	return nrects;
+}
+
 static int
-texture_region(struct weston_view *ev, pixman_region32_t *region,
-		pixman_region32_t *surf_region)
+texture_region(struct weston_view *ev, struct weston_output *output,
+	       pixman_region32_t *region, pixman_region32_t *surf_region)
 {
 	struct gl_surface_state *gs = get_surface_state(ev->surface);
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v, inv_width, inv_height;
+	struct texcoord_map map;
+	GLfloat *v;
 	unsigned int *vtxcnt, nvtx = 0;
 	pixman_box32_t *rects, *surf_rects;
 	pixman_box32_t *raw_rects;
-	int i, j, k, nrects, nsurf, raw_nrects;
-	bool used_band_compression;
+	int i, j, k, b, nbox, nrects, nsurf, raw_nrects;
+
+	if (!ev->transform.enabled)
+		return texture_region_untransformed(ev, region, surf_region);
+
 	raw_rects = pixman_region32_rectangles(region, &raw_nrects);
 	surf_rects = pixman_region32_rectangles(surf_region, &nsurf);
 
 	if (raw_nrects < 4) {
-		used_band_compression = false;
 		nrects = raw_nrects;
 		rects = raw_rects;
 	} else {
-		nrects = compress_bands(raw_rects, raw_nrects, &rects);
-		used_band_compression = true;
+		nrects = compress_bands(output, raw_rects, raw_nrects, &rects);
 	}
 	/* worst case we can have 8 vertices per rect (ie. clipped into
 	 * an octagon):
@@ -455,60 +854,76 @@ texture_region(struct weston_view *ev, pixman_region32_t *region,
 	v = wl_array_add(&gr->vertices, nrects * nsurf * 8 * 4 * sizeof *v);
 	vtxcnt = wl_array_add(&gr->vtxcnt, nrects * nsurf * sizeof *vtxcnt);
 
-	inv_width = 1.0 / gs->pitch;
-        inv_height = 1.0 / gs->height;
+	texcoord_map_init(&map, gs);
+
+	for (j = 0; j < nsurf; j++) {
+		pixman_box32_t *surf_rect = &surf_rects[j];
+		struct polygon8 quad = {
+			{ surf_rect->x1, surf_rect->x2,
+			  surf_rect->x2, surf_rect->x1 },
+			{ surf_rect->y1, surf_rect->y1,
+			  surf_rect->y2, surf_rect->y2 },
+			4
+		};
+
+		/* transform surface to screen space, once for all rects: */
+		for (k = 0; k < quad.n; k++)
+			weston_view_to_global_float(ev, quad.x[k], quad.y[k],
+						    &quad.x[k], &quad.y[k]);
+
+		for (i = 0; i < nrects; i += nbox) {
+			struct clip_box boxes[CLIP_BATCH];
+			GLfloat ex[CLIP_BATCH * CLIP_QUAD_MAX_VERTICES];
+			GLfloat ey[CLIP_BATCH * CLIP_QUAD_MAX_VERTICES];
+			int counts[CLIP_BATCH];
+
+			nbox = MIN(nrects - i, CLIP_BATCH);
+			for (b = 0; b < nbox; b++) {
+				boxes[b].x1 = rects[i + b].x1;
+				boxes[b].y1 = rects[i + b].y1;
+				boxes[b].x2 = rects[i + b].x2;
+				boxes[b].y2 = rects[i + b].y2;
+			}
 
-	for (i = 0; i < nrects; i++) {
-		pixman_box32_t *rect = &rects[i];
-		for (j = 0; j < nsurf; j++) {
-			pixman_box32_t *surf_rect = &surf_rects[j];
-			GLfloat sx, sy, bx, by;
-			GLfloat ex[8], ey[8];          /* edge points in screen space */
-			int n;
-
-			/* The transformed surface, after clipping to the clip region,
-			 * can have as many as eight sides, emitted as a triangle-fan.
-			 * The first vertex in the triangle fan can be chosen arbitrarily,
-			 * since the area is guaranteed to be convex.
-			 *
-			 * If a corner of the transformed surface falls outside of the
-			 * clip region, instead of emitting one vertex for the corner
-			 * of the surface, up to two are emitted for two corresponding
-			 * intersection point(s) between the surface and the clip region.
+			/* The transformed surface, after clipping to each clip
+			 * rect, can have as many as eight sides, emitted as a
+			 * triangle-fan. The first vertex in the triangle fan
+			 * can be chosen arbitrarily, since the area is
+			 * guaranteed to be convex.
 			 *
-			 * To do this, we first calculate the (up to eight) points that
-			 * form the intersection of the clip rect and the transformed
-			 * surface.
+			 * If a corner of the transformed surface falls outside
+			 * of the clip region, instead of emitting one vertex
+			 * for the corner of the surface, up to two are emitted
+			 * for two corresponding intersection point(s) between
+			 * the surface and the clip region.
 			 */
-			n = calculate_edges(ev, rect, surf_rect, ex, ey);
-			if (n < 3)
-				continue;
-
-			/* emit edge points: */
-			for (k = 0; k < n; k++) {
-				weston_view_from_global_float(ev, ex[k], ey[k],
-							      &sx, &sy);
-				/* position: */
-				*(v++) = ex[k];
-				*(v++) = ey[k];
-				/* texcoord: */
-				weston_surface_to_buffer_float(ev->surface,
-							       sx, sy,
-							       &bx, &by);
-				*(v++) = bx * inv_width;
-				if (gs->y_inverted) {
-					*(v++) = by * inv_height;
-				} else {
-					*(v++) = (gs->height - by) * inv_height;
+			clip_quad_batch(&quad, 0, boxes, nbox, ex, ey, counts);
+
+			for (b = 0; b < nbox; b++) {
+				GLfloat *bex = ex + b * CLIP_QUAD_MAX_VERTICES;
+				GLfloat *bey = ey + b * CLIP_QUAD_MAX_VERTICES;
+				GLfloat sx, sy;
+				int n = counts[b];
+
+				if (n < 3)
+					continue;
+
+				/* emit edge points: */
+				for (k = 0; k < n; k++) {
+					weston_view_from_global_float(ev,
+								      bex[k],
+								      bey[k],
+								      &sx, &sy);
+					v = emit_vertex(v, ev->surface, &map,
+							bex[k], bey[k],
+							sx, sy);
 				}
-			}
 
-			vtxcnt[nvtx++] = n;
+				vtxcnt[nvtx++] = n;
+			}
 		}
 	}
 
-	if (used_band_compression)
-		free(rects);
 	return nvtx;
 }
 
@@ -552,15 +967,255 @@ triangle_fan_debug(struct weston_view *view, int first, int count)
 	free(buffer);
 }
 
+/** Convert the triangle fans produced by texture_region() into one
+ * indexed triangle list
+ *
+ * @param gr The renderer, whose vtxcnt array holds the fan sizes.
+ * @param nfans Number of fans in vtxcnt.
+ * @returns Number of indices written to gr->indices, or 0 if the fans
+ * cannot be expressed with 16-bit indices.
+ */
+static int
+build_fan_indices(struct gl_renderer *gr, int nfans)
+{
+	unsigned int *vtxcnt = gr->vtxcnt.data;
+	unsigned int nvtx = 0, ntri = 0;
+	GLushort *index;
+	int i, k, first;
+
+	for (i = 0; i < nfans; i++) {
+		nvtx += vtxcnt[i];
+		ntri += vtxcnt[i] - 2;
+	}
+
+	if (nvtx > 0x10000)
+		return 0;
+
+	index = wl_array_add(&gr->indices, ntri * 3 * sizeof *index);
+	if (!index)
+		return 0;
+
+	for (i = 0, first = 0; i < nfans; i++) {
+		for (k = 1; k < (int) vtxcnt[i] - 1; k++) {
+			*index++ = first;
+			*index++ = first + k;
+			*index++ = first + k + 1;
+		}
+		first += vtxcnt[i];
+	}
+
+	return ntri * 3;
+}
+
+/* The vertices of a view drawn again with the same transform, surface
+ * mapping and regions are the same as last time. A draw seen twice in
+ * a row keeps its vertices and indices in buffer objects, so views that
+ * do not move cost no geometry work at all. */
+#define GL_GEOMETRY_CACHE_SIZE 4
+
+struct gl_geometry_key {
+	GLfloat to_buffer[16];
+	GLfloat to_global[16];
+	GLfloat from_global[16];
+	struct texcoord_map map;
+	int32_t x, y;
+	int transformed;
+	int nrects, nsurf;
+	/* followed by the rects of the region, then of surf_region */
+};
+
+struct gl_geometry {
+	struct wl_list link; /* gl_surface_state::geometry */
+	uint32_t hash;
+	struct wl_array key;
+	/* 0 until the same draw is seen a second time */
+	GLuint vbo, ibo;
+	int nindices;
+};
+
+static void
+gl_geometry_destroy(struct gl_geometry *geom)
+{
+	if (geom->vbo) {
+		glDeleteBuffers(1, &geom->vbo);
+		glDeleteBuffers(1, &geom->ibo);
+	}
+	wl_list_remove(&geom->link);
+	wl_array_release(&geom->key);
+	free(geom);
+}
+
+/* FNV-1a over the key bytes */
+static uint32_t
+gl_geometry_hash(const void *data, size_t size)
+{
+	const unsigned char *p = data;
+	uint32_t hash = 0x811c9dc5;
+
+	while (size--) {
+		hash ^= *p++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+/** Find the cached geometry of a draw
+ *
+ * @returns The entry of a draw seen before, most recently used from
+ * now on, or NULL when the draw is new. A new draw is recorded without
+ * buffers and evicts the least recently used entry when the cache of
+ * the surface is full.
+ */
+static struct gl_geometry *
+gl_geometry_get(struct gl_renderer *gr, struct weston_view *ev,
+		pixman_region32_t *region, pixman_region32_t *surf_region)
+{
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct gl_geometry_key *key;
+	struct gl_geometry *geom, *last;
+	pixman_box32_t *rects, *surf_rects, *r;
+	int nrects, nsurf, n = 0;
+	uint32_t hash;
+
+	rects = pixman_region32_rectangles(region, &nrects);
+	surf_rects = pixman_region32_rectangles(surf_region, &nsurf);
+
+	gr->geometry_key.size = 0;
+	key = wl_array_add(&gr->geometry_key, sizeof *key +
+			   (nrects + nsurf) * sizeof *rects);
+	if (!key)
+		return NULL;
+
+	/* Zeroed for the padding, the key is compared byte for byte */
+	memset(key, 0, sizeof *key);
+	memcpy(key->to_buffer, ev->surface->surface_to_buffer_matrix.d,
+	       sizeof key->to_buffer);
+	texcoord_map_init(&key->map, gs);
+	key->transformed = ev->transform.enabled;
+	if (ev->transform.enabled) {
+		memcpy(key->to_global, ev->transform.matrix.d,
+		       sizeof key->to_global);
+		memcpy(key->from_global, ev->transform.inverse.d,
+		       sizeof key->from_global);
+	} else {
+		key->x = ev->geometry.x;
+		key->y = ev->geometry.y;
+	}
+	key->nrects = nrects;
+	key->nsurf = nsurf;
+
+	r = (pixman_box32_t *) (key + 1);
+	memcpy(r, rects, nrects * sizeof *rects);
+	memcpy(r + nrects, surf_rects, nsurf * sizeof *rects);
+
+	hash = gl_geometry_hash(gr->geometry_key.data,
+				gr->geometry_key.size);
+
+	wl_list_for_each(geom, &gs->geometry, link) {
+		if (geom->hash != hash ||
+		    geom->key.size != gr->geometry_key.size ||
+		    memcmp(geom->key.data, gr->geometry_key.data,
+			   geom->key.size) != 0) {
+			n++;
+			continue;
+		}
+
+		wl_list_remove(&geom->link);
+		wl_list_insert(&gs->geometry, &geom->link);
+		return geom;
+	}
+
+	if (n >= GL_GEOMETRY_CACHE_SIZE) {
+		last = container_of(gs->geometry.prev,
+				    struct gl_geometry, link);
+		gl_geometry_destroy(last);
+	}
+
+	geom = zalloc(sizeof *geom);
+	if (!geom)
+		return NULL;
+
+	wl_array_init(&geom->key);
+	if (wl_array_copy(&geom->key, &gr->geometry_key) < 0) {
+		free(geom);
+		return NULL;
+	}
+	geom->hash = hash;
+	wl_list_insert(&gs->geometry, &geom->link);
+
+	return NULL;
+}
+
+/* Keep the vertices and indices of the draw in buffer objects */
+static int
+gl_geometry_upload(struct gl_renderer *gr, struct gl_geometry *geom,
+		   int nindices)
+{
+	glGenBuffers(1, &geom->vbo);
+	glGenBuffers(1, &geom->ibo);
+
+	glBindBuffer(GL_ARRAY_BUFFER, geom->vbo);
+	glBufferData(GL_ARRAY_BUFFER, gr->vertices.size,
+		     gr->vertices.data, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geom->ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, nindices * sizeof(GLushort),
+		     gr->indices.data, GL_STATIC_DRAW);
+	geom->nindices = nindices;
+
+	if (glGetError() != GL_NO_ERROR) {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		glDeleteBuffers(1, &geom->vbo);
+		glDeleteBuffers(1, &geom->ibo);
+		geom->vbo = 0;
+		geom->ibo = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Point the position and texcoord attributes at interleaved vertices,
+ * at v or, when v is NULL, in the bound GL_ARRAY_BUFFER */
+static void
+vertex_attribs(const GLfloat *v)
+{
+	const char *base = (const char *) v;
+
+	/* position: */
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      base);
+	glEnableVertexAttribArray(0);
+
+	/* texcoord: */
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat),
+			      base + 2 * sizeof(GLfloat));
+	glEnableVertexAttribArray(1);
+}
+
 static void
-repaint_region(struct weston_view *ev, pixman_region32_t *region,
-		pixman_region32_t *surf_region)
+repaint_region(struct weston_view *ev, struct weston_output *output,
+	       pixman_region32_t *region, pixman_region32_t *surf_region)
 {
 	struct weston_compositor *ec = ev->surface->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
-	GLfloat *v;
+	struct gl_geometry *geom = NULL;
 	unsigned int *vtxcnt;
-	int i, first, nfans;
+	int i, first, nfans, nindices;
+
+	/* The fan debug draws need the fans, which are not kept */
+	if (!gr->fan_debug)
+		geom = gl_geometry_get(gr, ev, region, surf_region);
+
+	if (geom && geom->vbo) {
+		glBindBuffer(GL_ARRAY_BUFFER, geom->vbo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geom->ibo);
+		vertex_attribs(NULL);
+		glDrawElements(GL_TRIANGLES, geom->nindices,
+			       GL_UNSIGNED_SHORT, NULL);
+		goto out;
+	}
 
 	/* The final region to be painted is the intersection of
 	 * 'region' and 'surf_region'. However, 'region' is in the global
@@ -570,31 +1225,45 @@ repaint_region(struct weston_view *ev, pixman_region32_t *region,
 	 * polygon for each pair, and store it as a triangle fan if
 	 * it has a non-zero area (at least 3 vertices1, actually).
 	 */
-	nfans = texture_region(ev, region, surf_region);
+	nfans = texture_region(ev, output, region, surf_region);
 
-	v = gr->vertices.data;
 	vtxcnt = gr->vtxcnt.data;
 
-	/* position: */
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[0]);
-	glEnableVertexAttribArray(0);
+	/* Submit all fans of the region with a single draw call when
+	 * possible, instead of one glDrawArrays() per fan. */
+	nindices = build_fan_indices(gr, nfans);
 
-	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof *v, &v[2]);
-	glEnableVertexAttribArray(1);
+	if (geom && nindices > 0 &&
+	    gl_geometry_upload(gr, geom, nindices) == 0) {
+		vertex_attribs(NULL);
+		glDrawElements(GL_TRIANGLES, nindices, GL_UNSIGNED_SHORT,
+			       NULL);
+		goto out;
+	}
+
+	vertex_attribs(gr->vertices.data);
+
+	if (nindices > 0)
+		glDrawElements(GL_TRIANGLES, nindices, GL_UNSIGNED_SHORT,
+			       gr->indices.data);
 
 	for (i = 0, first = 0; i < nfans; i++) {
-		glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
+		if (nindices == 0)
+			glDrawArrays(GL_TRIANGLE_FAN, first, vtxcnt[i]);
 		if (gr->fan_debug)
 			triangle_fan_debug(ev, first, vtxcnt[i]);
 		first += vtxcnt[i];
 	}
 
+out:
 	glDisableVertexAttribArray(1);
 	glDisableVertexAttribArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	gr->vertices.size = 0;
 	gr->vtxcnt.size = 0;
+	gr->indices.size = 0;
 }
 
 static int
@@ -662,50 +1331,464 @@ shader_uniforms(struct gl_shader *shader,
 		glUniform1i(shader->tex_uniforms[i], i);
 }
 
-static void
-draw_view(struct weston_view *ev, struct weston_output *output,
-	  pixman_region32_t *damage) /* in global coordinates */
-{
-	struct weston_matrix transform;
-	struct weston_compositor *ec = ev->surface->compositor;
-	struct gl_renderer *gr = get_renderer(ec);
-	struct gl_surface_state *gs = get_surface_state(ev->surface);
-	/* repaint bounding region in global coordinates: */
-	pixman_region32_t repaint;
-	/* opaque region in surface coordinates: */
-	pixman_region32_t surface_opaque;
-	/* non-opaque region in surface coordinates: */
-	pixman_region32_t surface_blend;
-	GLint filter;
-	int i;
+/* Texels per output pixel beyond which plain GL_LINEAR sampling skips
+ * texels, and a thumbnail shimmers and costs memory bandwidth. */
+#define MIPMAP_MIN_FACTOR 2.0f
 
-	/* In case of a runtime switch of renderers, we may not have received
-	 * an attach for this surface since the switch. In that case we don't
-	 * have a valid buffer or a proper shader set up so skip rendering. */
-	if (!gs->shader)
-		return;
+/* Draws in a row an EGL buffer has to be minified in before it gets
+ * a half size copy; a client redrawing every frame never does. */
+#define GL_DOWNSCALE_DRAWS 3
 
-	pixman_region32_init(&repaint);
-	pixman_region32_intersect(&repaint,
-				  &ev->transform.boundingbox, damage);
-	pixman_region32_subtract(&repaint, &repaint, &ev->clip);
+/* Whether the view is drawn with more than MIPMAP_MIN_FACTOR texels
+ * per output pixel, like a buffer_scale 2 surface on a scale 1 output */
+static int
+view_is_minified(struct gl_surface_state *gs, struct weston_view *ev,
+		 const struct weston_matrix *transform)
+{
+	struct weston_surface *surface = ev->surface;
+	float scale_x, scale_y, density;
 
-	if (!pixman_region32_not_empty(&repaint))
-		goto out;
+	if (surface->width <= 0 || surface->height <= 0)
+		return 0;
 
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	/* Output pixels per surface unit along each axis */
+	scale_x = hypotf(transform->d[0], transform->d[1]);
+	scale_y = hypotf(transform->d[4], transform->d[5]);
 
-	if (gr->fan_debug) {
-		use_shader(gr, &gr->solid_shader);
-		shader_uniforms(&gr->solid_shader, ev, output);
-	}
+	/* Texels per surface unit */
+	density = sqrtf((float)gs->pitch * gs->height /
+			((float)surface->width * surface->height));
+
+	return density >= MIPMAP_MIN_FACTOR * MAX(scale_x, scale_y);
+}
+
+/* Whether the view is drawn minified enough to sample a mipmap instead,
+ * for the SHM textures we upload ourselves. Client EGL buffers get
+ * a downscaled copy instead, see use_downscaled(). */
+static int
+use_mipmaps(struct gl_renderer *gr, struct gl_surface_state *gs,
+	    struct weston_view *ev, const struct weston_matrix *transform)
+{
+	if (!gr->has_npot_mipmap || gs->buffer_type != BUFFER_TYPE_SHM ||
+	    gs->target != GL_TEXTURE_2D || gs->num_textures != 1 ||
+	    gs->atlas)
+		return 0;
+
+	return view_is_minified(gs, ev, transform);
+}
+
+/* Whether to sample the half size copy of an EGL buffer. Until there
+ * is one, counts the draws in a row that would; the copy is made by
+ * output_update_downscaled() before a later repaint. */
+static int
+use_downscaled(struct gl_surface_state *gs, struct weston_view *ev,
+	       const struct weston_matrix *transform)
+{
+	if (gs->buffer_type != BUFFER_TYPE_EGL ||
+	    gs->target != GL_TEXTURE_2D || gs->num_textures != 1 ||
+	    !gs->y_inverted)
+		return 0;
+
+	if (!view_is_minified(gs, ev, transform)) {
+		gs->minified_draws = 0;
+		return 0;
+	}
+
+	if (gs->downscaled_tex)
+		return 1;
+
+	gs->minified_draws++;
+
+	return 0;
+}
+
+/* Pick the cheapest shader that draws the view right
+ *
+ * \param opaque Whether the region drawn is in the opaque region, where
+ * texture alpha is ignored.
+ */
+static struct gl_shader *
+shader_for_view(struct gl_renderer *gr, struct gl_shader *shader,
+		struct weston_view *ev, int opaque)
+{
+	if (ev->alpha < 1.0) {
+		/* Special case for RGBA textures with possibly
+		 * bad data in alpha channel: use the shader
+		 * that forces texture alpha = 1.0.
+		 * Xwayland surfaces need this.
+		 */
+		if (opaque && shader == &gr->texture_shader_rgba)
+			return &gr->texture_shader_rgbx;
+		return shader;
+	}
+
+	if (shader == &gr->texture_shader_rgba)
+		return opaque ? &gr->texture_shader_opaque :
+				&gr->texture_shader_rgba_noalpha;
+	if (shader == &gr->texture_shader_rgbx)
+		return &gr->texture_shader_opaque;
+	if (shader == &gr->texture_shader_egl_external)
+		return &gr->texture_shader_egl_external_noalpha;
+
+	return shader;
+}
+
+/* Make the GPU wait for the client's rendering into the buffer,
+ * without blocking the compositor. The fence stays with the surface,
+ * waiting again for a signalled one costs next to nothing. */
+static void
+wait_acquire_fence(struct gl_renderer *gr, struct weston_surface *surface)
+{
+#if defined(EGL_ANDROID_native_fence_sync) && defined(EGL_KHR_wait_sync)
+	EGLint attribs[] = {
+		EGL_SYNC_NATIVE_FENCE_FD_ANDROID, -1,
+		EGL_NONE
+	};
+	EGLSyncKHR sync;
+
+	if (!gr->has_native_fence_sync)
+		return;
+
+	/* On success EGL owns the fd */
+	attribs[1] = dup(surface->acquire_fence_fd);
+	if (attribs[1] < 0)
+		return;
+
+	sync = gr->create_sync(gr->egl_display,
+			       EGL_SYNC_NATIVE_FENCE_ANDROID, attribs);
+	if (sync == EGL_NO_SYNC_KHR) {
+		close(attribs[1]);
+		weston_log("failed to import acquire fence\n");
+		return;
+	}
+
+	gr->wait_sync(gr->egl_display, sync, 0);
+	gr->destroy_sync(gr->egl_display, sync);
+#endif
+}
+
+/* Hand a fence for this frame to every buffer drawn in it. A single
+ * context executes in order, so a buffer shown on several outputs
+ * only needs the fence of the last one. */
+static void
+set_release_fences(struct gl_renderer *gr, struct weston_output *output,
+		   EGLSyncKHR sync)
+{
+#if defined(EGL_ANDROID_native_fence_sync) && defined(EGL_KHR_wait_sync)
+	struct weston_render_item *item;
+	struct gl_surface_state *gs;
+	int fence_fd;
+
+	fence_fd = gr->dup_native_fence_fd(gr->egl_display, sync);
+	gr->destroy_sync(gr->egl_display, sync);
+	if (fence_fd == EGL_NO_NATIVE_FENCE_FD_ANDROID)
+		return;
+
+	wl_array_for_each(item, &output->render_list) {
+		gs = get_surface_state(item->surface);
+		if (!gs->buffer_release_ref.buffer_release)
+			continue;
+
+		weston_buffer_release_set_fence(
+			gs->buffer_release_ref.buffer_release,
+			dup(fence_fd));
+	}
+
+	close(fence_fd);
+#endif
+}
+
+static int
+shm_num_planes(struct gl_surface_state *gs)
+{
+	return gs->yuv ? gs->yuv->num_planes : 1;
+}
+
+/* A buffer of pitch texels in the first plane, and height rows */
+static void
+yuv_plane_layout(const struct yuv_shm_format *yuv, int32_t pitch,
+		 int32_t height, int plane, struct shm_plane_layout *l)
+{
+	int i;
+
+	memset(l, 0, sizeof *l);
+	for (i = 0; i <= plane; i++) {
+		if (i > 0 && !yuv->packed)
+			l->offset += (size_t) l->stride * l->height;
+		l->hsub = yuv->plane[i].hsub;
+		l->vsub = yuv->plane[i].vsub;
+		l->bpp = yuv->plane[i].bpp;
+		l->pitch = pitch / l->hsub;
+		l->height = (height + l->vsub - 1) / l->vsub;
+		l->stride = l->pitch * l->bpp;
+	}
+}
+
+/* The bytes of a YUV buffer that its planes take */
+static size_t
+yuv_buffer_bytes(const struct yuv_shm_format *yuv, int32_t pitch,
+		 int32_t height)
+{
+	struct shm_plane_layout l;
+	size_t bytes = 0;
+	int i;
+
+	for (i = 0; i < yuv->num_planes; i++) {
+		yuv_plane_layout(yuv, pitch, height, i, &l);
+		bytes = MAX(bytes, l.offset + (size_t) l.stride * l.height);
+	}
+
+	return bytes;
+}
+
+static void
+shm_plane_layout(struct gl_surface_state *gs, int plane,
+		 struct shm_plane_layout *l)
+{
+	if (gs->yuv) {
+		yuv_plane_layout(gs->yuv, gs->pitch, gs->height, plane, l);
+		return;
+	}
+
+	memset(l, 0, sizeof *l);
+	l->pitch = gs->pitch;
+	l->height = gs->height;
+	l->bpp = gs->gl_pixel_type == GL_UNSIGNED_SHORT_5_6_5 ? 2 : 4;
+	l->stride = l->pitch * l->bpp;
+	l->hsub = 1;
+	l->vsub = 1;
+}
+
+/* Update the texture memory of a surface after its SHM texture was
+ * allocated, freed or got mipmaps, or its downscaled copy changed */
+static void
+surface_state_account(struct gl_renderer *gr, struct gl_surface_state *gs)
+{
+	struct shm_plane_layout l;
+	size_t bytes = 0;
+	int i;
+
+	if (gs->buffer_type == BUFFER_TYPE_SHM && gs->num_textures) {
+		for (i = 0; i < shm_num_planes(gs); i++) {
+			shm_plane_layout(gs, i, &l);
+			bytes += (size_t) l.stride * l.height;
+		}
+		/* The mipmap chain adds up to a third */
+		if (gs->has_mipmaps)
+			bytes += bytes / 3;
+	}
+
+	/* RGBA at half size, see output_update_downscaled() */
+	if (gs->downscaled_tex)
+		bytes += (size_t) ((gs->pitch + 1) / 2) *
+			 ((gs->height + 1) / 2) * 4;
+
+	gr->texture_bytes -= gs->texture_bytes;
+	gr->texture_bytes += bytes;
+	gs->texture_bytes = bytes;
+
+	weston_surface_set_texture_bytes(gs->surface, bytes);
+}
+
+static int
+surface_in_render_list(struct weston_surface *surface)
+{
+	struct weston_output *output;
+	struct weston_render_item *item;
+
+	wl_list_for_each(output, &surface->compositor->output_list, link) {
+		wl_array_for_each(item, &output->render_list)
+			if (item->view->surface == surface)
+				return 1;
+	}
+
+	return 0;
+}
+
+/* Drop the textures of surfaces no output shows until the budget is
+ * met. Only textures that can be rebuilt are dropped: those of surfaces
+ * whose current SHM buffer the renderer still holds because it was not
+ * uploaded yet. The next flush uploads that buffer, or the next attached
+ * one, in full. */
+static void
+evict_textures(struct gl_renderer *gr)
+{
+	struct gl_surface_state *gs;
+
+	wl_list_for_each_reverse(gs, &gr->texture_lru, lru_link) {
+		if (gr->texture_bytes <= gr->texture_budget)
+			break;
+
+		if (!gs->texture_bytes || !gs->buffer_ref.buffer ||
+		    gs->atlas || surface_in_render_list(gs->surface))
+			continue;
+
+		glDeleteTextures(gs->num_textures, gs->textures);
+		gs->num_textures = 0;
+		gs->has_mipmaps = 0;
+		gs->evicted = 1;
+		surface_state_account(gr, gs);
+	}
+}
+
+static void
+gl_renderer_flush_damage(struct weston_surface *surface);
+static void
+ensure_textures(struct gl_surface_state *gs, int num_textures);
+
+static void
+timer_query_begin(struct gl_renderer *gr, struct weston_output *output,
+		  struct gl_surface_state *gs)
+{
+#ifdef GL_EXT_disjoint_timer_query
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_timer_query *q;
+
+	if (!gr->gpu_timing)
+		return;
+
+	q = wl_array_add(&go->timer_queries, sizeof *q);
+	if (!q)
+		return;
+
+	if (gr->free_queries.size >= sizeof q->query) {
+		gr->free_queries.size -= sizeof q->query;
+		memcpy(&q->query,
+		       (char *) gr->free_queries.data + gr->free_queries.size,
+		       sizeof q->query);
+	} else {
+		gr->gen_queries(1, &q->query);
+	}
+	q->elapsed = 0;
+	q->gs = gs;
+
+	gr->begin_query(GL_TIME_ELAPSED_EXT, q->query);
+#endif
+}
+
+static void
+timer_query_end(struct gl_renderer *gr)
+{
+#ifdef GL_EXT_disjoint_timer_query
+	if (gr->gpu_timing)
+		gr->end_query(GL_TIME_ELAPSED_EXT);
+#endif
+}
+
+/* Add up the GPU time of the views drawn in the last frame of the
+ * output. The previous swap is usually done with by now, so waiting
+ * for the results costs little. */
+static void
+output_collect_gpu_times(struct weston_output *output)
+{
+#ifdef GL_EXT_disjoint_timer_query
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_timer_query *q;
+	GLuint *free_query;
+	GLuint64 elapsed;
+	GLint disjoint = 0;
+	uint64_t total = 0;
+
+	if (!go->timer_queries.size)
+		return;
+
+	wl_array_for_each(q, &go->timer_queries) {
+		gr->get_query_object_ui64v(q->query, GL_QUERY_RESULT_EXT,
+					   &elapsed);
+		q->elapsed = elapsed;
+	}
+
+	/* A disjoint operation, such as a GPU clock change, makes the
+	 * results meaningless */
+	glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+	wl_array_for_each(q, &go->timer_queries) {
+		if (!disjoint) {
+			total += q->elapsed;
+			if (q->gs) {
+				q->gs->gpu_time += q->elapsed;
+				q->gs->gpu_draws++;
+				TL_POINT("renderer_gpu_draw", TLP_OUTPUT(output),
+					 TLP_SURFACE(q->gs->surface),
+					 TLP_GPU_TIME(&q->elapsed), TLP_END);
+			}
+		}
+
+		free_query = wl_array_add(&gr->free_queries,
+					  sizeof *free_query);
+		if (free_query)
+			*free_query = q->query;
+		else
+			gr->delete_queries(1, &q->query);
+	}
+	go->timer_queries.size = 0;
+
+	if (disjoint)
+		return;
+
+	go->gpu_time += total;
+	go->gpu_frames++;
+	if (total > go->gpu_frame_max)
+		go->gpu_frame_max = total;
+	TL_POINT("renderer_gpu_frame", TLP_OUTPUT(output),
+		 TLP_GPU_TIME(&total), TLP_END);
+#endif
+}
+
+static void
+draw_view(struct weston_render_item *item, struct weston_output *output,
+	  pixman_region32_t *damage) /* in global coordinates */
+{
+	struct weston_view *ev = item->view;
+	struct weston_matrix *transform = &item->matrix;
+	struct weston_compositor *ec = ev->surface->compositor;
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_surface_state *gs = get_surface_state(ev->surface);
+	struct gl_shader *shader;
+	/* repaint bounding region in global coordinates: */
+	pixman_region32_t repaint;
+	/* opaque region in surface coordinates: */
+	pixman_region32_t surface_opaque;
+	/* non-opaque region in surface coordinates: */
+	pixman_region32_t surface_blend;
+	GLint filter;
+	int i;
+
+	/* In case of a runtime switch of renderers, we may not have received
+	 * an attach for this surface since the switch. In that case we don't
+	 * have a valid buffer or a proper shader set up so skip rendering. */
+	if (!gs->shader)
+		return;
+
+	wl_list_remove(&gs->lru_link);
+	wl_list_insert(&gr->texture_lru, &gs->lru_link);
+
+	pixman_region32_init(&repaint);
+	pixman_region32_intersect(&repaint, &item->region, damage);
+
+	if (!pixman_region32_not_empty(&repaint))
+		goto out;
+
+	if (gs->evicted)
+		gl_renderer_flush_damage(ev->surface);
+
+	if (ev->surface->acquire_fence_fd >= 0)
+		wait_acquire_fence(gr, ev->surface);
+
+	timer_query_begin(gr, output, gs);
+
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	if (gr->fan_debug) {
+		use_shader(gr, &gr->solid_shader);
+		shader_uniforms(&gr->solid_shader, ev, output);
+	}
 
 	use_shader(gr, gs->shader);
 	shader_uniforms(gs->shader, ev, output);
 
-	weston_view_to_output_matrix(ev, output, false, &transform);
-
-	if (weston_matrix_needs_filtering(&transform))
+	if (weston_matrix_needs_filtering(transform))
 		filter = GL_LINEAR;
 	else
 		filter = GL_NEAREST;
@@ -717,6 +1800,20 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
 	}
 
+	if (use_mipmaps(gr, gs, ev, transform)) {
+		if (!gs->has_mipmaps || gs->mipmaps_stale) {
+			glGenerateMipmap(GL_TEXTURE_2D);
+			gs->has_mipmaps = 1;
+			gs->mipmaps_stale = 0;
+			surface_state_account(gr, gs);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+				GL_LINEAR_MIPMAP_LINEAR);
+	} else if (use_downscaled(gs, ev, transform)) {
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, gs->downscaled_tex);
+	}
+
 	/* blended region is whole surface minus opaque region: */
 	pixman_region32_init_rect(&surface_blend, 0, 0,
 				  ev->surface->width, ev->surface->height);
@@ -736,30 +1833,31 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		pixman_region32_copy(&surface_opaque, &ev->surface->opaque);
 
 	if (pixman_region32_not_empty(&surface_opaque)) {
-		if (gs->shader == &gr->texture_shader_rgba) {
-			/* Special case for RGBA textures with possibly
-			 * bad data in alpha channel: use the shader
-			 * that forces texture alpha = 1.0.
-			 * Xwayland surfaces need this.
-			 */
-			use_shader(gr, &gr->texture_shader_rgbx);
-			shader_uniforms(&gr->texture_shader_rgbx, ev, output);
+		shader = shader_for_view(gr, gs->shader, ev, 1);
+		if (shader != gs->shader) {
+			use_shader(gr, shader);
+			shader_uniforms(shader, ev, output);
 		}
 
-		if (ev->alpha < 1.0)
+		if (item->alpha < 1.0)
 			glEnable(GL_BLEND);
 		else
 			glDisable(GL_BLEND);
 
-		repaint_region(ev, &repaint, &surface_opaque);
+		repaint_region(ev, output, &repaint, &surface_opaque);
 	}
 
 	if (pixman_region32_not_empty(&surface_blend)) {
-		use_shader(gr, gs->shader);
+		shader = shader_for_view(gr, gs->shader, ev, 0);
+		use_shader(gr, shader);
+		if (shader != gs->shader)
+			shader_uniforms(shader, ev, output);
 		glEnable(GL_BLEND);
-		repaint_region(ev, &repaint, &surface_blend);
+		repaint_region(ev, output, &repaint, &surface_blend);
 	}
 
+	timer_query_end(gr);
+
 	pixman_region32_fini(&surface_blend);
 	pixman_region32_fini(&surface_opaque);
 
@@ -767,53 +1865,379 @@ out:
 	pixman_region32_fini(&repaint);
 }
 
+/* Frames the bottom layers have to stay the same before they are
+ * cached, and the fewest views worth caching */
+#define GL_LAYER_CACHE_FRAMES 8
+#define GL_LAYER_CACHE_MIN_VIEWS 2
+
 static void
-repaint_views(struct weston_output *output, pixman_region32_t *damage)
+output_layer_cache_release(struct gl_output_state *go)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	if (go->layer_cache.fbo) {
+		glDeleteFramebuffers(1, &go->layer_cache.fbo);
+		glDeleteTextures(1, &go->layer_cache.tex);
+		go->layer_cache.fbo = 0;
+	}
+	go->layer_cache.n_cached = 0;
+}
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+static int
+layer_cache_view_equal(const struct gl_layer_cache_view *a,
+		       const struct gl_layer_cache_view *b)
+{
+	return a->view == b->view && a->surface == b->surface &&
+	       a->layer == b->layer && a->cache_group == b->cache_group &&
+	       a->content_serial == b->content_serial &&
+	       a->alpha == b->alpha &&
+	       memcmp(a->matrix.d, b->matrix.d, sizeof a->matrix.d) == 0 &&
+	       memcmp(&a->extents, &b->extents, sizeof a->extents) == 0;
 }
 
-static void
-draw_output_border_texture(struct gl_output_state *go,
-			   enum gl_renderer_border_side side,
-			   int32_t x, int32_t y,
-			   int32_t width, int32_t height)
+/* Takes down the primary plane views of the output, bottom up */
+static int
+output_layer_cache_snapshot(struct weston_output *output,
+			    struct wl_array *views)
 {
-	struct gl_border_image *img = &go->borders[side];
-	static GLushort indices [] = { 0, 1, 3, 3, 1, 2 };
+	struct weston_compositor *ec = output->compositor;
+	struct weston_view *ev, **list = output->view_list.data;
+	size_t i = output->view_list.size / sizeof *list;
+	struct gl_layer_cache_view *v;
+
+	views->size = 0;
+	while (i-- > 0) {
+		ev = list[i];
+		if (ev->plane != &ec->primary_plane)
+			continue;
 
-	if (!img->data) {
-		if (img->tex) {
-			glDeleteTextures(1, &img->tex);
-			img->tex = 0;
+		v = wl_array_add(views, sizeof *v);
+		if (!v)
+			return -1;
+
+		v->view = ev;
+		v->surface = ev->surface;
+		v->layer = weston_view_get_layer(ev);
+		v->cache_group = ev->cache_group;
+		v->content_serial = get_surface_state(ev->surface)->content_serial;
+		v->alpha = ev->alpha;
+		weston_view_to_output_matrix(ev, output, false, &v->matrix);
+		v->extents = *pixman_region32_extents(&ev->transform.boundingbox);
+	}
+
+	return 0;
+}
+
+/* Draws the first n views into the cache texture, each clipped only by
+ * the opaque views above it among them */
+static int
+output_layer_cache_draw(struct weston_output *output, size_t n)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_layer_cache_view *views = go->layer_cache.views.data;
+	struct weston_render_item item;
+	pixman_region32_t opaque, *regions;
+	int32_t width, height;
+	size_t i;
+
+	regions = weston_output_frame_alloc(output, n * sizeof *regions);
+	if (!regions)
+		return -1;
+
+	output_get_render_size(output, &width, &height);
+
+	if (go->layer_cache.fbo &&
+	    (go->layer_cache.width != width ||
+	     go->layer_cache.height != height))
+		output_layer_cache_release(go);
+
+	if (!go->layer_cache.fbo) {
+		glGenTextures(1, &go->layer_cache.tex);
+		glBindTexture(GL_TEXTURE_2D, go->layer_cache.tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+		glGenFramebuffers(1, &go->layer_cache.fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, go->layer_cache.fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				       GL_TEXTURE_2D, go->layer_cache.tex, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+		    GL_FRAMEBUFFER_COMPLETE) {
+			weston_log("layer cache framebuffer incomplete\n");
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			output_layer_cache_release(go);
+			return -1;
 		}
 
-		return;
+		go->layer_cache.width = width;
+		go->layer_cache.height = height;
 	}
 
-	if (!img->tex) {
-		glGenTextures(1, &img->tex);
-		glBindTexture(GL_TEXTURE_2D, img->tex);
+	glBindFramebuffer(GL_FRAMEBUFFER, go->layer_cache.fbo);
+	glViewport(0, 0, width, height);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	/* Top down for the occlusion, drawn bottom up */
+	pixman_region32_init(&opaque);
+	for (i = n; i-- > 0; ) {
+		pixman_region32_init(&regions[i]);
+		pixman_region32_subtract(&regions[i],
+					 &views[i].view->transform.boundingbox,
+					 &opaque);
+		pixman_region32_union(&opaque, &opaque,
+				      &views[i].view->transform.opaque);
+	}
+	pixman_region32_fini(&opaque);
 
-		glTexParameteri(GL_TEXTURE_2D,
-				GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D,
-				GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D,
-				GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D,
-				GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	} else {
-		glBindTexture(GL_TEXTURE_2D, img->tex);
+	for (i = 0; i < n; i++) {
+		item.view = views[i].view;
+		item.surface = views[i].surface;
+		item.alpha = views[i].alpha;
+		item.matrix = views[i].matrix;
+		item.region = regions[i];
+		draw_view(&item, output, &output->region);
+		pixman_region32_fini(&regions[i]);
 	}
 
-	if (go->border_status & (1 << side)) {
-#ifdef GL_EXT_unpack_subimage
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	go->layer_cache.matrix = go->output_matrix;
+	go->layer_cache.n_cached = n;
+
+	return 0;
+}
+
+/* Whether views a and b, next to each other, are in different layers
+ * or cache groups of layers */
+static int
+layer_cache_boundary(const struct gl_layer_cache_view *a,
+		     const struct gl_layer_cache_view *b)
+{
+	return a->layer != b->layer || a->cache_group != b->cache_group;
+}
+
+/**
+ * Work out how much of the bottom of the output the layer cache covers
+ *
+ * The views of the bottom layers are compared with the last frame, a
+ * layer counting as unchanged only if all its views are. Once the same
+ * bottom layers stayed unchanged for GL_LAYER_CACHE_FRAMES frames they
+ * are drawn into the cache, which is dropped as soon as one of their
+ * views changes, and the views are then drawn directly again.
+ *
+ * The views of a weston_view::cache_group count as a layer of their
+ * own, and are cached from their second unchanged frame on when no
+ * view outside a group is among the unchanged ones.
+ */
+static void
+output_layer_cache_update(struct weston_output *output, int disabled)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_layer_cache_view *old, *cur;
+	struct wl_array tmp;
+	size_t n_old, n_cur, same, n, i;
+	int frames, grouped;
+
+	if (disabled ||
+	    output_layer_cache_snapshot(output,
+					&go->layer_cache.next_views) < 0) {
+		go->layer_cache.views.size = 0;
+		go->layer_cache.n_static = 0;
+		go->layer_cache.static_frames = 0;
+		output_layer_cache_release(go);
+		return;
+	}
+
+	old = go->layer_cache.views.data;
+	n_old = go->layer_cache.views.size / sizeof *old;
+	cur = go->layer_cache.next_views.data;
+	n_cur = go->layer_cache.next_views.size / sizeof *cur;
+
+	for (same = 0; same < n_old && same < n_cur; same++)
+		if (!layer_cache_view_equal(&old[same], &cur[same]))
+			break;
+
+	/* Only whole layers, in both frames */
+	for (n = same; n > 0; n--) {
+		if ((n == n_cur || layer_cache_boundary(&cur[n], &cur[n - 1])) &&
+		    (n == n_old || layer_cache_boundary(&old[n], &old[n - 1])))
+			break;
+	}
+
+	grouped = n > 0;
+	for (i = 0; i < n; i++)
+		if (!cur[i].cache_group)
+			grouped = 0;
+
+	if (n > 0 && n == go->layer_cache.n_static)
+		go->layer_cache.static_frames++;
+	else
+		go->layer_cache.static_frames = 0;
+	go->layer_cache.n_static = n;
+
+	tmp = go->layer_cache.views;
+	go->layer_cache.views = go->layer_cache.next_views;
+	go->layer_cache.next_views = tmp;
+
+	if (go->layer_cache.n_cached > n ||
+	    memcmp(go->layer_cache.matrix.d, go->output_matrix.d,
+		   sizeof go->output_matrix.d) != 0)
+		go->layer_cache.n_cached = 0;
+
+	frames = grouped ? 1 : GL_LAYER_CACHE_FRAMES;
+	if (n > go->layer_cache.n_cached &&
+	    (grouped || n >= GL_LAYER_CACHE_MIN_VIEWS) &&
+	    go->layer_cache.static_frames >= frames)
+		output_layer_cache_draw(output, n);
+}
+
+/* Draws the layer cache where its views show through the damage, and
+ * returns the first render item not in it */
+static struct weston_render_item *
+draw_layer_cache(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_shader *shader = &gr->texture_shader_rgba;
+	struct gl_layer_cache_view *views = go->layer_cache.views.data;
+	struct weston_render_item *item, *end;
+	struct weston_vector v;
+	pixman_region32_t region;
+	pixman_box32_t *rects;
+	GLfloat *d, *vertices;
+	size_t i = 0;
+	int j, k, nrects;
+
+	item = output->render_list.data;
+	end = (void *) ((char *) output->render_list.data +
+			output->render_list.size);
+
+	/* The render list holds the visible views of the snapshot, in
+	 * the same order */
+	pixman_region32_init(&region);
+	for (; item < end; item++) {
+		while (i < go->layer_cache.n_cached && views[i].view != item->view)
+			i++;
+		if (i == go->layer_cache.n_cached)
+			break;
+		pixman_region32_union(&region, &region, &item->region);
+		i++;
+	}
+	pixman_region32_intersect(&region, &region, damage);
+
+	rects = pixman_region32_rectangles(&region, &nrects);
+	vertices = weston_output_frame_alloc(output,
+					     nrects * 6 * 4 * sizeof *vertices);
+	if (nrects == 0 || !vertices) {
+		pixman_region32_fini(&region);
+		return item;
+	}
+
+	/* x, y in global coordinates, then s, t where the projection
+	 * puts them in the texture, for two triangles a rectangle */
+	d = vertices;
+	for (j = 0; j < nrects; j++) {
+		static const int corners[6][2] = {
+			{ 0, 0 }, { 1, 0 }, { 1, 1 },
+			{ 0, 0 }, { 1, 1 }, { 0, 1 }
+		};
+
+		for (k = 0; k < 6; k++) {
+			v.f[0] = corners[k][0] ? rects[j].x2 : rects[j].x1;
+			v.f[1] = corners[k][1] ? rects[j].y2 : rects[j].y1;
+			v.f[2] = 0.0f;
+			v.f[3] = 1.0f;
+			*d++ = v.f[0];
+			*d++ = v.f[1];
+			weston_matrix_transform(&go->output_matrix, &v);
+			*d++ = (v.f[0] / v.f[3] + 1.0f) / 2.0f;
+			*d++ = (v.f[1] / v.f[3] + 1.0f) / 2.0f;
+		}
+	}
+
+	glDisable(GL_BLEND);
+	use_shader(gr, shader);
+	glUniformMatrix4fv(shader->proj_uniform, 1, GL_FALSE,
+			   go->output_matrix.d);
+	glUniform1i(shader->tex_uniforms[0], 0);
+	glUniform1f(shader->alpha_uniform, 1.0f);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, go->layer_cache.tex);
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE,
+			      4 * sizeof *vertices, &vertices[0]);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE,
+			      4 * sizeof *vertices, &vertices[2]);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	glDrawArrays(GL_TRIANGLES, 0, nrects * 6);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+
+	pixman_region32_fini(&region);
+
+	return item;
+}
+
+static void
+repaint_views(struct weston_output *output, pixman_region32_t *damage)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct weston_render_item *item, *end;
+
+	item = output->render_list.data;
+	end = (void *) ((char *) output->render_list.data +
+			output->render_list.size);
+
+	if (go->layer_cache.n_cached)
+		item = draw_layer_cache(output, damage);
+
+	/* Bottom to top */
+	for (; item < end; item++)
+		draw_view(item, output, damage);
+}
+
+static void
+draw_output_border_texture(struct gl_output_state *go,
+			   enum gl_renderer_border_side side,
+			   int32_t x, int32_t y,
+			   int32_t width, int32_t height)
+{
+	struct gl_border_image *img = &go->borders[side];
+	static GLushort indices [] = { 0, 1, 3, 3, 1, 2 };
+
+	if (!img->data) {
+		if (img->tex) {
+			glDeleteTextures(1, &img->tex);
+			img->tex = 0;
+		}
+
+		return;
+	}
+
+	if (!img->tex) {
+		glGenTextures(1, &img->tex);
+		glBindTexture(GL_TEXTURE_2D, img->tex);
+
+		glTexParameteri(GL_TEXTURE_2D,
+				GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,
+				GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D,
+				GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D,
+				GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	} else {
+		glBindTexture(GL_TEXTURE_2D, img->tex);
+	}
+
+	if (go->border_status & (1 << side)) {
+#ifdef GL_EXT_unpack_subimage
 		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
 		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
 		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
@@ -950,6 +2374,19 @@ output_get_border_damage(struct weston_output *output,
 					   full_width, bottom->height);
 }
 
+/* The size of the buffers drawn into, see weston_output::render_width */
+static void
+output_get_render_size(struct weston_output *output,
+		       int32_t *width, int32_t *height)
+{
+	if (output->render_width) {
+		*width = output->render_width;
+		*height = output->render_height;
+	} else {
+		weston_output_get_buffer_size(output, width, height);
+	}
+}
+
 static void
 output_get_damage(struct weston_output *output,
 		  pixman_region32_t *buffer_damage, uint32_t *border_damage)
@@ -1008,190 +2445,1074 @@ output_rotate_damage(struct weston_output *output,
 	go->border_damage[go->buffer_damage_index] = border_status;
 }
 
-/* NOTE: We now allow falling back to ARGB gl visuals when XRGB is
- * unavailable, so we're assuming the background has no transparency
- * and that everything with a blend, like drop shadows, will have something
- * opaque (like the background) drawn underneath it.
- *
- * Depending on the underlying hardware, violating that assumption could
- * result in seeing through to another display plane.
- */
-static void
-gl_renderer_repaint_output(struct weston_output *output,
-			      pixman_region32_t *output_damage)
+#if defined(EGL_EXT_swap_buffers_with_damage) || defined(EGL_KHR_partial_update)
+/* Converts a damage region in global coordinates to the array of
+ * x, y, width, height rectangles with a bottom-left origin that the
+ * EGL damage extensions take. The array lives in the output's frame
+ * arena. */
+static EGLint *
+output_damage_to_egl_rects(struct weston_output *output,
+			   pixman_region32_t *damage,
+			   enum gl_border_status border_status,
+			   EGLint *n_rects)
 {
 	struct gl_output_state *go = get_output_state(output);
-	struct weston_compositor *compositor = output->compositor;
-	struct gl_renderer *gr = get_renderer(compositor);
-	EGLBoolean ret;
-	static int errored;
-#ifdef EGL_EXT_swap_buffers_with_damage
-	int i, nrects, buffer_height;
-	EGLint *egl_damage, *d;
+	pixman_region32_t buffer_damage;
 	pixman_box32_t *rects;
-#endif
-	pixman_region32_t buffer_damage, total_damage;
-	enum gl_border_status border_damage = BORDER_STATUS_CLEAN;
-
-	if (use_output(output) < 0)
-		return;
-
-	/* Calculate the viewport */
-	glViewport(go->borders[GL_RENDERER_BORDER_LEFT].width,
-		   go->borders[GL_RENDERER_BORDER_BOTTOM].height,
-		   output->current_mode->width,
-		   output->current_mode->height);
-
-	/* Calculate the global GL matrix */
-	go->output_matrix = output->matrix;
-	weston_matrix_translate(&go->output_matrix,
-				-(output->current_mode->width / 2.0),
-				-(output->current_mode->height / 2.0), 0);
-	weston_matrix_scale(&go->output_matrix,
-			    2.0 / output->current_mode->width,
-			    -2.0 / output->current_mode->height, 1);
+	EGLint *egl_damage, *d;
+	struct weston_matrix scale;
+	int32_t width, height, mode_width, mode_height;
+	int i, nrects, buffer_height;
 
-	/* if debugging, redraw everything outside the damage to clean up
-	 * debug lines from the previous draw on this buffer:
-	 */
-	if (gr->fan_debug) {
-		pixman_region32_t undamaged;
-		pixman_region32_init(&undamaged);
-		pixman_region32_subtract(&undamaged, &output->region,
-					 output_damage);
-		gr->fan_debug = 0;
-		repaint_views(output, &undamaged);
-		gr->fan_debug = 1;
-		pixman_region32_fini(&undamaged);
-	}
+	output_get_render_size(output, &width, &height);
+	weston_output_get_buffer_size(output, &mode_width, &mode_height);
 
-	pixman_region32_init(&total_damage);
 	pixman_region32_init(&buffer_damage);
+	pixman_region32_copy(&buffer_damage, damage);
+	pixman_region32_translate(&buffer_damage,
+				  output->x,
+				  output->y);
+	weston_matrix_transform_region(&buffer_damage,
+				       &output->matrix,
+				       &buffer_damage);
+
+	if (output->render_width) {
+		weston_matrix_init(&scale);
+		weston_matrix_scale(&scale,
+				    (float) width / mode_width,
+				    (float) height / mode_height,
+				    1);
+		weston_matrix_transform_region(&buffer_damage, &scale,
+					       &buffer_damage);
+	}
 
-	output_get_damage(output, &buffer_damage, &border_damage);
-	output_rotate_damage(output, output_damage, go->border_status);
+	if (output_has_borders(output)) {
+		pixman_region32_translate(&buffer_damage,
+					  go->borders[GL_RENDERER_BORDER_LEFT].width,
+					  go->borders[GL_RENDERER_BORDER_TOP].height);
+		output_get_border_damage(output, border_status,
+					 &buffer_damage);
+	}
 
-	pixman_region32_union(&total_damage, &buffer_damage, output_damage);
-	border_damage |= go->border_status;
+	rects = pixman_region32_rectangles(&buffer_damage, &nrects);
+	egl_damage = weston_output_frame_alloc(output,
+					       nrects * 4 * sizeof(EGLint));
+	if (egl_damage == NULL) {
+		pixman_region32_fini(&buffer_damage);
+		return NULL;
+	}
 
-	repaint_views(output, &total_damage);
+	buffer_height = go->borders[GL_RENDERER_BORDER_TOP].height +
+			height +
+			go->borders[GL_RENDERER_BORDER_BOTTOM].height;
 
-	pixman_region32_fini(&total_damage);
+	d = egl_damage;
+	for (i = 0; i < nrects; ++i) {
+		*d++ = rects[i].x1;
+		*d++ = buffer_height - rects[i].y2;
+		*d++ = rects[i].x2 - rects[i].x1;
+		*d++ = rects[i].y2 - rects[i].y1;
+	}
 	pixman_region32_fini(&buffer_damage);
 
-	draw_output_borders(output, border_damage);
-
-	pixman_region32_copy(&output->previous_damage, output_damage);
-	wl_signal_emit(&output->frame_signal, output);
-
-#ifdef EGL_EXT_swap_buffers_with_damage
-	if (gr->swap_buffers_with_damage) {
-		pixman_region32_init(&buffer_damage);
-		pixman_region32_copy(&buffer_damage, output_damage);
-		pixman_region32_translate(&buffer_damage,
-					  output->x,
-					  output->y);
-		weston_matrix_transform_region(&buffer_damage,
-					       &output->matrix,
-					       &buffer_damage);
+	*n_rects = nrects;
+	return egl_damage;
+}
+#endif
 
-		if (output_has_borders(output)) {
-			pixman_region32_translate(&buffer_damage,
-						  go->borders[GL_RENDERER_BORDER_LEFT].width,
-						  go->borders[GL_RENDERER_BORDER_TOP].height);
-			output_get_border_damage(output, go->border_status,
-						 &buffer_damage);
-		}
+#ifdef EGL_KHR_partial_update
+/* Tells the driver which part of the back buffer this frame will
+ * touch, so tiled GPUs only load and resolve those tiles. This has to
+ * happen after the buffer age query and before any drawing. */
+static void
+output_set_damage_region(struct weston_output *output,
+			 pixman_region32_t *damage,
+			 enum gl_border_status border_status)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	EGLint *egl_damage;
+	EGLint nrects;
+	EGLBoolean ret;
 
-		rects = pixman_region32_rectangles(&buffer_damage, &nrects);
-		egl_damage = malloc(nrects * 4 * sizeof(EGLint));
+	egl_damage = output_damage_to_egl_rects(output, damage,
+						border_status, &nrects);
+	if (egl_damage == NULL)
+		return;
 
-		buffer_height = go->borders[GL_RENDERER_BORDER_TOP].height +
-				output->current_mode->height +
-				go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+	ret = gr->set_damage_region(gr->egl_display, go->egl_surface,
+				    egl_damage, nrects);
 
-		d = egl_damage;
-		for (i = 0; i < nrects; ++i) {
-			*d++ = rects[i].x1;
-			*d++ = buffer_height - rects[i].y2;
-			*d++ = rects[i].x2 - rects[i].x1;
-			*d++ = rects[i].y2 - rects[i].y1;
-		}
-		ret = gr->swap_buffers_with_damage(gr->egl_display,
-						   go->egl_surface,
-						   egl_damage, nrects);
-		free(egl_damage);
-		pixman_region32_fini(&buffer_damage);
-	} else {
-		ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
+	if (ret == EGL_FALSE) {
+		weston_log("setting the damage region failed.\n");
+		gl_renderer_print_egl_error_state();
 	}
-#else /* ! defined EGL_EXT_swap_buffers_with_damage */
-	ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
+}
 #endif
 
-	if (ret == EGL_FALSE && !errored) {
-		errored = 1;
-		weston_log("Failed in eglSwapBuffers.\n");
-		gl_renderer_print_egl_error_state();
-	}
+/* NOTE: We now allow falling back to ARGB gl visuals when XRGB is
+ * unavailable, so we're assuming the background has no transparency
+ * and that everything with a blend, like drop shadows, will have something
+ * opaque (like the background) drawn underneath it.
+ *
+ * Depending on the underlying hardware, violating that assumption could
+ * result in seeing through to another display plane.
+ */
+/* Calculates the GL projection of an output, matrix going from global
+ * to output buffer coordinates; the viewport maps the mode's pixels
+ * onto the render size whatever it is. */
+static void
+output_get_projection(struct weston_output *output,
+		      const struct weston_matrix *matrix,
+		      struct weston_matrix *projection)
+{
+	int32_t width, height;
 
-	go->border_status = BORDER_STATUS_CLEAN;
+	weston_output_get_buffer_size(output, &width, &height);
+
+	*projection = *matrix;
+	weston_matrix_translate(projection,
+				-(width / 2.0), -(height / 2.0), 0);
+	weston_matrix_scale(projection,
+			    2.0 / width, -2.0 / height, 1);
+}
+
+static void
+output_offscreen_release(struct gl_output_state *go)
+{
+	if (go->offscreen.fbo) {
+		glDeleteFramebuffers(1, &go->offscreen.fbo);
+		glDeleteTextures(1, &go->offscreen.tex);
+		go->offscreen.fbo = 0;
+	}
 }
 
+/* Redirect drawing into the offscreen texture, sized like the output */
 static int
-gl_renderer_read_pixels(struct weston_output *output,
-			       pixman_format_code_t format, void *pixels,
-			       uint32_t x, uint32_t y,
-			       uint32_t width, uint32_t height)
+output_offscreen_begin(struct weston_output *output)
 {
-	GLenum gl_format;
 	struct gl_output_state *go = get_output_state(output);
+	int32_t width, height;
 
-	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
-	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+	output_get_render_size(output, &width, &height);
+
+	if (go->offscreen.fbo &&
+	    (go->offscreen.width != width || go->offscreen.height != height))
+		output_offscreen_release(go);
+
+	if (!go->offscreen.fbo) {
+		glGenTextures(1, &go->offscreen.tex);
+		glBindTexture(GL_TEXTURE_2D, go->offscreen.tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+		glGenFramebuffers(1, &go->offscreen.fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, go->offscreen.fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+				       GL_TEXTURE_2D, go->offscreen.tex, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+		    GL_FRAMEBUFFER_COMPLETE) {
+			weston_log("offscreen framebuffer incomplete, "
+				   "drawing to the output directly\n");
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			output_offscreen_release(go);
+			return 0;
+		}
 
-	switch (format) {
-	case PIXMAN_a8r8g8b8:
-		gl_format = GL_BGRA_EXT;
-		break;
-	case PIXMAN_a8b8g8r8:
-		gl_format = GL_RGBA;
-		break;
-	default:
-		return -1;
+		go->offscreen.width = width;
+		go->offscreen.height = height;
+		go->offscreen.valid = 0;
 	}
 
-	if (use_output(output) < 0)
-		return -1;
-
-	glPixelStorei(GL_PACK_ALIGNMENT, 1);
-	glReadPixels(x, y, width, height, gl_format,
-		     GL_UNSIGNED_BYTE, pixels);
+	glBindFramebuffer(GL_FRAMEBUFFER, go->offscreen.fbo);
 
-	return 0;
+	return 1;
 }
 
+/* Draw the offscreen texture over the whole output, through the LUT if
+ * there is one. While zoomed only the part of the texture the zoom
+ * shows is drawn, scaled up to the output. */
 static void
-gl_renderer_flush_damage(struct weston_surface *surface)
+output_offscreen_end(struct weston_output *output, int zoomed)
 {
-	struct gl_renderer *gr = get_renderer(surface->compositor);
-	struct gl_surface_state *gs = get_surface_state(surface);
-	struct weston_buffer *buffer = gs->buffer_ref.buffer;
-	struct weston_view *view;
-	int texture_used;
-
-#ifdef GL_EXT_unpack_subimage
-	pixman_box32_t *rectangles;
-	void *data;
-	int i, n;
-#endif
-
-	pixman_region32_union(&gs->texture_damage,
-			      &gs->texture_damage, &surface->damage);
-
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_shader *shader;
+	struct weston_matrix matrix, zoom;
+	struct weston_vector v;
+	static const GLfloat verts[] = {
+		-1.0f, -1.0f,
+		 1.0f, -1.0f,
+		 1.0f,  1.0f,
+		-1.0f,  1.0f
+	};
+	GLfloat texcoord[] = {
+		0.0f, 0.0f,
+		1.0f, 0.0f,
+		1.0f, 1.0f,
+		0.0f, 1.0f
+	};
+	GLint filter = GL_NEAREST;
+	int i;
+
+	/* Take the corners of the output back to global coordinates
+	 * through the zoomed projection and forward through the unzoomed
+	 * one the texture was drawn with. */
+	if (zoomed) {
+		output_get_projection(output, &output->matrix, &zoom);
+		if (weston_matrix_invert(&matrix, &zoom) == 0) {
+			weston_matrix_multiply(&matrix, &go->output_matrix);
+			for (i = 0; i < 4; i++) {
+				v.f[0] = verts[i * 2];
+				v.f[1] = verts[i * 2 + 1];
+				v.f[2] = 0.0f;
+				v.f[3] = 1.0f;
+				weston_matrix_transform(&matrix, &v);
+				texcoord[i * 2] = (v.f[0] / v.f[3] + 1.0f) / 2.0f;
+				texcoord[i * 2 + 1] = (v.f[1] / v.f[3] + 1.0f) / 2.0f;
+			}
+			filter = GL_LINEAR;
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(go->borders[GL_RENDERER_BORDER_LEFT].width,
+		   go->borders[GL_RENDERER_BORDER_BOTTOM].height,
+		   go->offscreen.width, go->offscreen.height);
+
+	glDisable(GL_BLEND);
+
+	if (go->color.lut_tex) {
+		shader = &gr->color_lut_shader;
+		use_shader(gr, shader);
+		glUniform1i(shader->tex_uniforms[1], 1);
+		glUniform1f(shader->lut_size_uniform, go->color.lut_size);
+
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, go->color.lut_tex);
+	} else {
+		shader = &gr->texture_shader_rgbx;
+		use_shader(gr, shader);
+	}
+
+	weston_matrix_init(&matrix);
+	glUniformMatrix4fv(shader->proj_uniform, 1, GL_FALSE, matrix.d);
+	glUniform1i(shader->tex_uniforms[0], 0);
+	glUniform1f(shader->alpha_uniform, 1.0f);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, go->offscreen.tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, texcoord);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+}
+
+static void
+output_color_lut_release(struct gl_output_state *go)
+{
+	if (go->color.lut_tex) {
+		glDeleteTextures(1, &go->color.lut_tex);
+		go->color.lut_tex = 0;
+	}
+}
+
+static int
+gl_renderer_output_set_color_lut(struct weston_output *output, int size,
+				 const uint8_t *lut)
+{
+	struct gl_output_state *go = get_output_state(output);
+	uint8_t *packed;
+	GLint max_size;
+	int r, g, b;
+
+	if (use_output(output) < 0)
+		return -1;
+
+	if (!lut) {
+		output_color_lut_release(go);
+		weston_output_damage(output);
+		return 0;
+	}
+
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if (size < 2 || size * size > max_size)
+		return -1;
+
+	/* Slices of constant blue side by side, see the shader */
+	packed = malloc(size * size * size * 3);
+	if (!packed)
+		return -1;
+
+	for (g = 0; g < size; g++)
+		for (b = 0; b < size; b++)
+			for (r = 0; r < size; r++)
+				memcpy(packed + ((g * size + b) * size + r) * 3,
+				       lut + ((b * size + g) * size + r) * 3, 3);
+
+	if (!go->color.lut_tex)
+		glGenTextures(1, &go->color.lut_tex);
+	glBindTexture(GL_TEXTURE_2D, go->color.lut_tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, size * size, size, 0,
+		     GL_RGB, GL_UNSIGNED_BYTE, packed);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	free(packed);
+
+	go->color.lut_size = size;
+	weston_output_damage(output);
+
+	return 0;
+}
+
+static int
+surface_copy_draw(struct gl_renderer *gr, struct gl_surface_state *gs,
+		  int src_x, int src_y, int width, int height,
+		  int dst_width, int dst_height, GLuint *fbo, GLuint *tex);
+
+/* Make the half size copies of the EGL buffers use_downscaled() has
+ * seen minified long enough, before the output is bound. Linear
+ * sampling at half size averages each 2x2 block, so the draws of the
+ * views that follow read a quarter of the texels. */
+static void
+output_update_downscaled(struct weston_output *output)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct weston_render_item *item;
+	struct gl_surface_state *gs;
+	GLuint fbo, tex;
+	int drawn = 0;
+
+	wl_array_for_each(item, &output->render_list) {
+		gs = get_surface_state(item->view->surface);
+		if (!gs || !gs->shader || gs->downscaled_tex ||
+		    gs->minified_draws < GL_DOWNSCALE_DRAWS)
+			continue;
+
+		drawn = 1;
+		if (surface_copy_draw(gr, gs, 0, 0, gs->pitch, gs->height,
+				      (gs->pitch + 1) / 2,
+				      (gs->height + 1) / 2,
+				      &fbo, &tex) < 0) {
+			gs->minified_draws = 0;
+			continue;
+		}
+
+		glDeleteFramebuffers(1, &fbo);
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+				GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,
+				GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S,
+				GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T,
+				GL_CLAMP_TO_EDGE);
+		gs->downscaled_tex = tex;
+		surface_state_account(gr, gs);
+	}
+
+	if (drawn)
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+static void
+gl_renderer_repaint_output(struct weston_output *output,
+			      pixman_region32_t *output_damage)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct weston_compositor *compositor = output->compositor;
+	struct gl_renderer *gr = get_renderer(compositor);
+	EGLBoolean ret;
+	static int errored;
+#ifdef EGL_EXT_swap_buffers_with_damage
+	EGLint *egl_damage;
+	EGLint nrects;
+#endif
+	EGLSyncKHR release_sync = EGL_NO_SYNC_KHR;
+	pixman_region32_t buffer_damage, total_damage;
+	enum gl_border_status border_damage = BORDER_STATUS_CLEAN;
+	int32_t width, height;
+	int zoomed, use_offscreen;
+
+	if (use_output(output) < 0)
+		return;
+
+	output_collect_gpu_times(output);
+
+	/* The core only damages what changed in the unzoomed scene,
+	 * see WESTON_CAP_ZOOM_OFFSCREEN */
+	zoomed = output->zoom.active;
+
+	/* Before the offscreen texture is bound, the cache may need
+	 * drawing; its views are in the unzoomed projection */
+	output_get_projection(output, &output->matrix, &go->output_matrix);
+	output_layer_cache_update(output, zoomed || gr->fan_debug);
+	output_update_downscaled(output);
+
+	if (go->color.lut_tex || zoomed) {
+		use_offscreen = output_offscreen_begin(output);
+	} else {
+		output_offscreen_release(go);
+		use_offscreen = 0;
+	}
+
+	/* Calculate the viewport, the matrix below maps the mode's
+	 * pixels onto it whatever its size */
+	output_get_render_size(output, &width, &height);
+	if (use_offscreen)
+		glViewport(0, 0, width, height);
+	else
+		glViewport(go->borders[GL_RENDERER_BORDER_LEFT].width,
+			   go->borders[GL_RENDERER_BORDER_BOTTOM].height,
+			   width, height);
+
+	/* Calculate the global GL matrix */
+	if (zoomed && use_offscreen)
+		output_get_projection(output, &output->zoom.unzoomed_matrix,
+				      &go->output_matrix);
+	else
+		output_get_projection(output, &output->matrix,
+				      &go->output_matrix);
+
+	pixman_region32_init(&total_damage);
+	pixman_region32_init(&buffer_damage);
+
+	/* A zoomed frame changes the whole buffer, which the buffer
+	 * age of the frames after the zoom has to account for. */
+	output_get_damage(output, &buffer_damage, &border_damage);
+	output_rotate_damage(output, zoomed ? &output->region : output_damage,
+			     go->border_status);
+
+	pixman_region32_union(&total_damage, &buffer_damage, output_damage);
+	border_damage |= go->border_status;
+
+	/* The offscreen texture keeps its contents, only this frame's
+	 * damage needs drawing there, while the pass below covers the
+	 * whole buffer. Without it a zoomed output is redrawn whole. */
+	if (use_offscreen) {
+		if (go->offscreen.valid)
+			pixman_region32_copy(&total_damage, output_damage);
+		else
+			pixman_region32_copy(&total_damage, &output->region);
+		go->offscreen.valid = 1;
+	} else if (zoomed) {
+		pixman_region32_copy(&total_damage, &output->region);
+	}
+
+#ifdef EGL_KHR_partial_update
+	/* Zoomed, the damage is not in the buffer's coordinates, and
+	 * leaving the region unset covers the whole buffer. */
+	if (gr->set_damage_region && !zoomed)
+		output_set_damage_region(output,
+					 gr->fan_debug || use_offscreen ?
+						&output->region : &total_damage,
+					 border_damage);
+#endif
+
+	/* if debugging, redraw everything outside the damage to clean up
+	 * debug lines from the previous draw on this buffer:
+	 */
+	if (gr->fan_debug) {
+		pixman_region32_t undamaged;
+		pixman_region32_init(&undamaged);
+		pixman_region32_subtract(&undamaged, &output->region,
+					 output_damage);
+		gr->fan_debug = 0;
+		repaint_views(output, &undamaged);
+		gr->fan_debug = 1;
+		pixman_region32_fini(&undamaged);
+	}
+
+	repaint_views(output, &total_damage);
+
+	pixman_region32_fini(&total_damage);
+	pixman_region32_fini(&buffer_damage);
+
+	if (use_offscreen)
+		output_offscreen_end(output, zoomed);
+
+	draw_output_borders(output, border_damage);
+
+	pixman_region32_copy(&output->previous_damage, output_damage);
+	wl_signal_emit(&output->frame_signal, output);
+
+#if defined(EGL_ANDROID_native_fence_sync) && defined(EGL_KHR_wait_sync)
+	/* The fd only exists once the swap has flushed the commands */
+	if (gr->has_native_fence_sync)
+		release_sync = gr->create_sync(gr->egl_display,
+					       EGL_SYNC_NATIVE_FENCE_ANDROID,
+					       NULL);
+#endif
+
+#ifdef EGL_EXT_swap_buffers_with_damage
+	egl_damage = NULL;
+	if (gr->swap_buffers_with_damage && !zoomed)
+		egl_damage = output_damage_to_egl_rects(output, output_damage,
+							go->border_status,
+							&nrects);
+	if (egl_damage) {
+		ret = gr->swap_buffers_with_damage(gr->egl_display,
+						   go->egl_surface,
+						   egl_damage, nrects);
+	} else {
+		ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
+	}
+#else /* ! defined EGL_EXT_swap_buffers_with_damage */
+	ret = eglSwapBuffers(gr->egl_display, go->egl_surface);
+#endif
+
+	if (ret == EGL_FALSE && !errored) {
+		errored = 1;
+		weston_log("Failed in eglSwapBuffers.\n");
+		gl_renderer_print_egl_error_state();
+	}
+
+	if (release_sync != EGL_NO_SYNC_KHR)
+		set_release_fences(gr, output, release_sync);
+
+	go->border_status = BORDER_STATUS_CLEAN;
+
+	if (gr->texture_budget && gr->texture_bytes > gr->texture_budget)
+		evict_textures(gr);
+}
+
+static int
+gl_renderer_output_create_fence_fd(struct weston_output *output)
+{
+#if defined(EGL_ANDROID_native_fence_sync) && defined(EGL_KHR_wait_sync)
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	EGLSyncKHR sync;
+	int fd;
+
+	if (!gr->has_native_fence_sync)
+		return -1;
+
+	if (use_output(output) < 0)
+		return -1;
+
+	sync = gr->create_sync(gr->egl_display,
+			       EGL_SYNC_NATIVE_FENCE_ANDROID, NULL);
+	if (sync == EGL_NO_SYNC_KHR)
+		return -1;
+
+	/* The fd only exists once the fence command is flushed */
+	glFlush();
+	fd = gr->dup_native_fence_fd(gr->egl_display, sync);
+	gr->destroy_sync(gr->egl_display, sync);
+
+	return fd == EGL_NO_NATIVE_FENCE_FD_ANDROID ? -1 : fd;
+#else
+	return -1;
+#endif
+}
+
+/* The part of the buffers drawn at the render size that covers a
+ * rectangle in the coordinates read_pixels() takes */
+static void
+output_rect_to_render(struct weston_output *output,
+		      uint32_t *x, uint32_t *y,
+		      uint32_t *width, uint32_t *height)
+{
+	int32_t buffer_width, buffer_height, render_width, render_height;
+	uint32_t x1, y1, x2, y2;
+
+	weston_output_get_buffer_size(output, &buffer_width, &buffer_height);
+	output_get_render_size(output, &render_width, &render_height);
+
+	x1 = (uint64_t) *x * render_width / buffer_width;
+	y1 = (uint64_t) *y * render_height / buffer_height;
+	x2 = ((uint64_t) (*x + *width) * render_width + buffer_width - 1) /
+	     buffer_width;
+	y2 = ((uint64_t) (*y + *height) * render_height + buffer_height - 1) /
+	     buffer_height;
+
+	*x = x1;
+	*y = y1;
+	*width = MAX(x2 - x1, 1u);
+	*height = MAX(y2 - y1, 1u);
+}
+
+/* Read back at the render size and scale up to the rectangle asked
+ * for, each pixel taken from the one its centre falls in */
+static int
+read_pixels_scaled(struct weston_output *output, GLenum gl_format,
+		   void *pixels, uint32_t x, uint32_t y,
+		   uint32_t width, uint32_t height)
+{
+	struct gl_output_state *go = get_output_state(output);
+	int32_t buffer_width, buffer_height, render_width, render_height;
+	uint32_t rx = x, ry = y, rwidth = width, rheight = height;
+	uint32_t *src, *dst = pixels;
+	uint32_t u, v, su, sv;
+
+	weston_output_get_buffer_size(output, &buffer_width, &buffer_height);
+	output_get_render_size(output, &render_width, &render_height);
+	output_rect_to_render(output, &rx, &ry, &rwidth, &rheight);
+
+	src = malloc((size_t) rwidth * rheight * 4);
+	if (!src)
+		return -1;
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(rx + go->borders[GL_RENDERER_BORDER_LEFT].width,
+		     ry + go->borders[GL_RENDERER_BORDER_BOTTOM].height,
+		     rwidth, rheight, gl_format, GL_UNSIGNED_BYTE, src);
+
+	for (v = 0; v < height; v++) {
+		sv = (uint64_t) (2 * (y + v) + 1) * render_height /
+		     (2 * buffer_height) - ry;
+		sv = MIN(sv, rheight - 1);
+		for (u = 0; u < width; u++) {
+			su = (uint64_t) (2 * (x + u) + 1) * render_width /
+			     (2 * buffer_width) - rx;
+			su = MIN(su, rwidth - 1);
+			dst[v * width + u] = src[sv * rwidth + su];
+		}
+	}
+
+	free(src);
+
+	return 0;
+}
+
+static int
+gl_renderer_read_pixels(struct weston_output *output,
+			       pixman_format_code_t format, void *pixels,
+			       uint32_t x, uint32_t y,
+			       uint32_t width, uint32_t height)
+{
+	GLenum gl_format;
+	struct gl_output_state *go = get_output_state(output);
+
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+		gl_format = GL_BGRA_EXT;
+		break;
+	case PIXMAN_a8b8g8r8:
+		gl_format = GL_RGBA;
+		break;
+	default:
+		return -1;
+	}
+
+	if (use_output(output) < 0)
+		return -1;
+
+	/* The buffers hold fewer pixels than the mode */
+	if (output->render_width)
+		return read_pixels_scaled(output, gl_format, pixels,
+					  x, y, width, height);
+
+	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
+	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(x, y, width, height, gl_format,
+		     GL_UNSIGNED_BYTE, pixels);
+
+	return 0;
+}
+
+/** Start reading back output pixels into a pixel buffer object
+ *
+ * The reads are queued behind the rendering of the current frame, and
+ * a fence is inserted after them, so this returns without waiting for
+ * the GPU. gl_renderer_finish_read_pixels() later copies the result
+ * out, by which time the GPU has normally long finished.
+ */
+static int
+gl_renderer_queue_read_pixels(struct weston_output *output,
+			      pixman_format_code_t format,
+			      const pixman_box32_t *rects, int nrects)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback *rb;
+	GLsizeiptr size = 0, offset = 0;
+	GLenum gl_format;
+	GLint x, y;
+	GLsizei width, height;
+	int i, handle;
+
+	if (!gr->has_pbo || output->render_width)
+		return -1;
+
+	switch (format) {
+	case PIXMAN_a8r8g8b8:
+		gl_format = GL_BGRA_EXT;
+		break;
+	case PIXMAN_a8b8g8r8:
+		gl_format = GL_RGBA;
+		break;
+	default:
+		return -1;
+	}
+
+	handle = go->readback_index;
+	rb = &go->readback[handle];
+	if (rb->pending)
+		return -1;
+
+	for (i = 0; i < nrects; i++)
+		size += (GLsizeiptr) (rects[i].x2 - rects[i].x1) *
+			(rects[i].y2 - rects[i].y1) * 4;
+	if (size == 0)
+		return -1;
+
+	if (use_output(output) < 0)
+		return -1;
+
+	if (!rb->pbo)
+		glGenBuffers(1, &rb->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+	if (rb->size < size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		rb->size = size;
+	}
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (i = 0; i < nrects; i++) {
+		x = rects[i].x1 + go->borders[GL_RENDERER_BORDER_LEFT].width;
+		y = rects[i].y1 + go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+		width = rects[i].x2 - rects[i].x1;
+		height = rects[i].y2 - rects[i].y1;
+		glReadPixels(x, y, width, height, gl_format,
+			     GL_UNSIGNED_BYTE, (void *) (intptr_t) offset);
+		offset += (GLsizeiptr) width * height * 4;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+#ifdef EGL_KHR_fence_sync
+	if (gr->has_fence_sync)
+		rb->sync = gr->create_sync(gr->egl_display,
+					   EGL_SYNC_FENCE_KHR, NULL);
+#endif
+
+	rb->used = size;
+	rb->pending = 1;
+	go->readback_index = (handle + 1) % ARRAY_LENGTH(go->readback);
+
+	return handle;
+}
+
+static int
+gl_renderer_finish_read_pixels(struct weston_output *output, int handle,
+			       void *pixels)
+{
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback *rb;
+	void *map;
+	int ret = -1;
+
+	if (handle < 0 || handle >= (int) ARRAY_LENGTH(go->readback))
+		return -1;
+
+	rb = &go->readback[handle];
+	if (!rb->pending)
+		return -1;
+	rb->pending = 0;
+
+	if (use_output(output) < 0)
+		return -1;
+
+#ifdef EGL_KHR_fence_sync
+	if (rb->sync != EGL_NO_SYNC_KHR) {
+		gr->client_wait_sync(gr->egl_display, rb->sync,
+				     EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+				     EGL_FOREVER_KHR);
+		gr->destroy_sync(gr->egl_display, rb->sync);
+		rb->sync = EGL_NO_SYNC_KHR;
+	}
+#endif
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, rb->pbo);
+	map = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER, 0, rb->used,
+				   GL_MAP_READ_BIT);
+	if (map) {
+		memcpy(pixels, map, rb->used);
+		if (gr->unmap_buffer(GL_PIXEL_PACK_BUFFER))
+			ret = 0;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	return ret;
+}
+
+/** Upload wl_shm damage through a pixel buffer object
+ *
+ * The damaged rectangles are packed into the next buffer of the upload
+ * ring, which is orphaned first so that the copy never waits for the
+ * GPU to finish reading the previous contents. The texture updates
+ * then source from the buffer and are pipelined by the driver instead
+ * of being copied synchronously from the client's pool.
+ *
+ * @param surface The surface whose texture to update.
+ * @param full Upload the whole buffer instead of texture_damage.
+ * @returns 0 on success, -1 if the caller should upload directly.
+ */
+/* Upload a rectangle of a plane of the surface contents to the bound
+ * texture, a full upload also specifies the texture unless it is in
+ * an atlas */
+static void
+texture_upload(struct gl_surface_state *gs, int plane, int full,
+	       int32_t x, int32_t y, int32_t width, int32_t height,
+	       const void *data)
+{
+	GLenum format = gs->yuv ? gs->yuv->plane[plane].format : gs->gl_format;
+	GLenum type = gs->yuv ? GL_UNSIGNED_BYTE : gs->gl_pixel_type;
+
+	if (gs->atlas)
+		glTexSubImage2D(GL_TEXTURE_2D, 0,
+				gs->atlas_x + x, gs->atlas_y + y,
+				width, height, format, type, data);
+	else if (full)
+		glTexImage2D(GL_TEXTURE_2D, 0, format,
+			     width, height, 0, format, type, data);
+	else
+		glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height,
+				format, type, data);
+}
+
+/* The damage of the buffer, in texels of the plane */
+static void
+shm_plane_box(const struct shm_plane_layout *l, const pixman_box32_t *r,
+	      pixman_box32_t *box)
+{
+	box->x1 = MAX(r->x1 / l->hsub, 0);
+	box->y1 = MAX(r->y1 / l->vsub, 0);
+	box->x2 = MIN((r->x2 + l->hsub - 1) / l->hsub, l->pitch);
+	box->y2 = MIN((r->y2 + l->vsub - 1) / l->vsub, l->height);
+}
+
+static int
+gl_renderer_upload_shm_pbo(struct weston_surface *surface, int plane,
+			   int full)
+{
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct weston_buffer *buffer = gs->buffer_ref.buffer;
+	struct wl_shm_buffer *shm_buffer = buffer->shm_buffer;
+	pixman_box32_t *rectangles, whole, *boxes;
+	struct shm_plane_layout l;
+	int32_t stride, bpp;
+	GLsizeiptr size = 0, offset;
+	uint8_t *src, *dst, *map;
+	int i, n, y;
+
+	shm_plane_layout(gs, plane, &l);
+	stride = gs->yuv ? l.stride : wl_shm_buffer_get_stride(shm_buffer);
+	bpp = l.bpp;
+
+	if (full) {
+		whole.x1 = 0;
+		whole.y1 = 0;
+		whole.x2 = gs->pitch;
+		whole.y2 = buffer->height;
+		rectangles = &whole;
+		n = 1;
+	} else {
+		rectangles = pixman_region32_rectangles(&gs->texture_damage,
+							&n);
+	}
+
+	if (n == 0)
+		return 0;
+
+	boxes = malloc(n * sizeof *boxes);
+	if (!boxes)
+		return -1;
+
+	/* Rows are padded to the default GL_UNPACK_ALIGNMENT of 4 */
+	for (i = 0; i < n; i++) {
+		shm_plane_box(&l, &rectangles[i], &boxes[i]);
+		if (boxes[i].x2 <= boxes[i].x1 || boxes[i].y2 <= boxes[i].y1)
+			continue;
+
+		size += (GLsizeiptr) (((boxes[i].x2 - boxes[i].x1) * bpp + 3) &
+				      ~3) * (boxes[i].y2 - boxes[i].y1);
+	}
+
+	if (size == 0) {
+		free(boxes);
+		return 0;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gr->upload_pbo[gr->upload_pbo_index]);
+	gr->upload_pbo_index =
+		(gr->upload_pbo_index + 1) % ARRAY_LENGTH(gr->upload_pbo);
+
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+	map = gr->map_buffer_range(GL_PIXEL_UNPACK_BUFFER, 0, size,
+				   GL_MAP_WRITE_BIT |
+				   GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!map) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		free(boxes);
+		return -1;
+	}
+
+	wl_shm_buffer_begin_access(shm_buffer);
+	src = (uint8_t *) wl_shm_buffer_get_data(shm_buffer) + l.offset;
+	dst = map;
+	for (i = 0; i < n; i++) {
+		int32_t row = (boxes[i].x2 - boxes[i].x1) * bpp;
+
+		if (row <= 0 || boxes[i].y2 <= boxes[i].y1)
+			continue;
+
+		for (y = boxes[i].y1; y < boxes[i].y2; y++) {
+			memcpy(dst, src + y * stride + boxes[i].x1 * bpp, row);
+			dst += (row + 3) & ~3;
+		}
+	}
+	wl_shm_buffer_end_access(shm_buffer);
+
+	if (!gr->unmap_buffer(GL_PIXEL_UNPACK_BUFFER)) {
+		/* The buffer contents were lost, e.g. on a mode switch */
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		free(boxes);
+		return -1;
+	}
+
+#ifdef GL_EXT_unpack_subimage
+	if (gr->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	}
+#endif
+
+	offset = 0;
+	for (i = 0; i < n; i++) {
+		int32_t w = boxes[i].x2 - boxes[i].x1;
+		int32_t h = boxes[i].y2 - boxes[i].y1;
+
+		if (w <= 0 || h <= 0)
+			continue;
+
+		texture_upload(gs, plane, full, boxes[i].x1, boxes[i].y1, w, h,
+			       (void *) (uintptr_t) offset);
+
+		offset += (GLsizeiptr) ((w * bpp + 3) & ~3) * h;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	free(boxes);
+
+	return 0;
+}
+
+/* Upload texture_damage, or all of it on a full upload, of a plane of
+ * the SHM buffer to the bound texture */
+static void
+shm_upload_plane(struct weston_surface *surface, int plane)
+{
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct weston_buffer *buffer = gs->buffer_ref.buffer;
+	struct shm_plane_layout l;
+	uint8_t *data;
+
+#ifdef GL_EXT_unpack_subimage
+	pixman_box32_t *rectangles, r;
+	int i, n;
+#endif
+
+	if (gr->has_pbo &&
+	    gl_renderer_upload_shm_pbo(surface, plane,
+				       gs->needs_full_upload) == 0)
+		return;
+
+	shm_plane_layout(gs, plane, &l);
+	data = (uint8_t *) wl_shm_buffer_get_data(buffer->shm_buffer) +
+	       l.offset;
+
+	/* Chroma rows need not be a multiple of 4 bytes */
+	if (gs->yuv)
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	if (!gr->has_unpack_subimage) {
+		wl_shm_buffer_begin_access(buffer->shm_buffer);
+		texture_upload(gs, plane, 1, 0, 0, l.pitch, l.height, data);
+		wl_shm_buffer_end_access(buffer->shm_buffer);
+
+		goto out;
+	}
+
+#ifdef GL_EXT_unpack_subimage
+	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, l.pitch);
+
+	if (gs->needs_full_upload) {
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+		wl_shm_buffer_begin_access(buffer->shm_buffer);
+		texture_upload(gs, plane, 1, 0, 0, l.pitch, l.height, data);
+		wl_shm_buffer_end_access(buffer->shm_buffer);
+		goto out;
+	}
+
+	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
+	wl_shm_buffer_begin_access(buffer->shm_buffer);
+	for (i = 0; i < n; i++) {
+		shm_plane_box(&l, &rectangles[i], &r);
+		if (r.x2 <= r.x1 || r.y2 <= r.y1)
+			continue;
+
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, r.x1);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, r.y1);
+		texture_upload(gs, plane, 0, r.x1, r.y1,
+			       r.x2 - r.x1, r.y2 - r.y1, data);
+	}
+	wl_shm_buffer_end_access(buffer->shm_buffer);
+#endif
+
+out:
+	if (gs->yuv)
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+static void
+gl_renderer_flush_damage(struct weston_surface *surface)
+{
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct weston_buffer *buffer = gs->buffer_ref.buffer;
+	struct weston_view *view;
+	int texture_used;
+	int uploaded = 0;
+	int i;
+
+	if (pixman_region32_not_empty(&surface->buffer_damage))
+		gs->content_serial = ++gr->content_serial;
+
+	pixman_region32_union(&gs->texture_damage,
+			      &gs->texture_damage, &surface->buffer_damage);
+
 	if (!buffer)
 		return;
 
+	/* An imported buffer is sampled in place */
+	if (gs->buffer_type == BUFFER_TYPE_EGL) {
+		pixman_region32_clear(&gs->texture_damage);
+		return;
+	}
+
 	/* Avoid upload, if the texture won't be used this time.
 	 * We still accumulate the damage in texture_damage, and
 	 * hold the reference to the buffer, in case the surface
@@ -1207,80 +3528,513 @@ gl_renderer_flush_damage(struct weston_surface *surface)
 	if (!texture_used)
 		return;
 
+	if (gs->evicted) {
+		gs->evicted = 0;
+		ensure_textures(gs, shm_num_planes(gs));
+		gs->needs_full_upload = 1;
+	}
+
 	if (!pixman_region32_not_empty(&gs->texture_damage) &&
 	    !gs->needs_full_upload)
 		goto done;
 
-	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
+	TL_POINT("renderer_upload_begin", TLP_SURFACE(surface), TLP_END);
+	uploaded = 1;
 
-	if (!gr->has_unpack_subimage) {
-		wl_shm_buffer_begin_access(buffer->shm_buffer);
-		glTexImage2D(GL_TEXTURE_2D, 0, gs->gl_format,
-			     gs->pitch, buffer->height, 0,
-			     gs->gl_format, gs->gl_pixel_type,
-			     wl_shm_buffer_get_data(buffer->shm_buffer));
-		wl_shm_buffer_end_access(buffer->shm_buffer);
+	for (i = 0; i < shm_num_planes(gs); i++) {
+		glBindTexture(GL_TEXTURE_2D, gs->textures[i]);
+		shm_upload_plane(surface, i);
+	}
+
+done:
+	if (uploaded) {
+		TL_POINT("renderer_upload_end", TLP_SURFACE(surface), TLP_END);
+		gs->mipmaps_stale = 1;
+		surface_state_account(gr, gs);
+	}
+
+	pixman_region32_fini(&gs->texture_damage);
+	pixman_region32_init(&gs->texture_damage);
+	gs->needs_full_upload = 0;
+
+	weston_buffer_reference(&gs->buffer_ref, NULL);
+}
+
+static void
+ensure_textures(struct gl_surface_state *gs, int num_textures)
+{
+	int i;
+
+	if (num_textures <= gs->num_textures)
+		return;
+
+	for (i = gs->num_textures; i < num_textures; i++) {
+		glGenTextures(1, &gs->textures[i]);
+		glBindTexture(gs->target, gs->textures[i]);
+		glTexParameteri(gs->target,
+				GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(gs->target,
+				GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	gs->num_textures = num_textures;
+	glBindTexture(gs->target, 0);
+}
+
+/* Find a free rectangle of cells, first fit from the top left */
+static int
+atlas_alloc_cells(struct gl_atlas *atlas, int cw, int ch,
+		  pixman_box32_t *box)
+{
+	uint64_t mask;
+	int x, y, i;
+
+	for (y = 0; y + ch <= GL_ATLAS_CELLS; y++) {
+		for (x = 0; x + cw <= GL_ATLAS_CELLS; x++) {
+			mask = (((uint64_t) 1 << cw) - 1) << x;
+			for (i = 0; i < ch; i++)
+				if (atlas->used[y + i] & mask)
+					break;
+			if (i < ch)
+				continue;
+
+			for (i = 0; i < ch; i++)
+				atlas->used[y + i] |= mask;
+			atlas->n_slots++;
+
+			box->x1 = x * GL_ATLAS_CELL;
+			box->y1 = y * GL_ATLAS_CELL;
+			box->x2 = (x + cw) * GL_ATLAS_CELL;
+			box->y2 = (y + ch) * GL_ATLAS_CELL;
+
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static struct gl_atlas *
+atlas_create(struct gl_renderer *gr)
+{
+	struct gl_atlas *atlas;
+
+	atlas = zalloc(sizeof *atlas);
+	if (!atlas)
+		return NULL;
+
+	glGenTextures(1, &atlas->texture);
+	glBindTexture(GL_TEXTURE_2D, atlas->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT,
+		     GL_ATLAS_SIZE, GL_ATLAS_SIZE, 0,
+		     GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	wl_list_insert(gr->atlases.prev, &atlas->link);
+
+	return atlas;
+}
+
+static void
+atlas_free(struct gl_atlas *atlas, const pixman_box32_t *box)
+{
+	uint64_t mask;
+	int cw, y;
+
+	cw = (box->x2 - box->x1) / GL_ATLAS_CELL;
+	mask = (((uint64_t) 1 << cw) - 1) << (box->x1 / GL_ATLAS_CELL);
+	for (y = box->y1 / GL_ATLAS_CELL; y < box->y2 / GL_ATLAS_CELL; y++)
+		atlas->used[y] &= ~mask;
+
+	if (--atlas->n_slots > 0)
+		return;
+
+	glDeleteTextures(1, &atlas->texture);
+	wl_list_remove(&atlas->link);
+	free(atlas);
+}
+
+static void
+surface_state_release_atlas(struct gl_surface_state *gs)
+{
+	if (!gs->atlas)
+		return;
+
+	atlas_free(gs->atlas, &gs->atlas_box);
+	gs->atlas = NULL;
+	gs->num_textures = 0;
+}
+
+/* Drop the half size copy of an EGL buffer, to be made again once the
+ * surface is drawn minified for long enough */
+static void
+surface_state_release_downscaled(struct gl_surface_state *gs)
+{
+	gs->minified_draws = 0;
+
+	if (!gs->downscaled_tex)
+		return;
+
+	glDeleteTextures(1, &gs->downscaled_tex);
+	gs->downscaled_tex = 0;
+	surface_state_account(get_renderer(gs->surface->compositor), gs);
+}
+
+/* Drop the textures of the surface, or its place in an atlas */
+static void
+surface_state_release_textures(struct gl_surface_state *gs)
+{
+	surface_state_release_atlas(gs);
+	surface_state_release_downscaled(gs);
+	glDeleteTextures(gs->num_textures, gs->textures);
+	gs->num_textures = 0;
+}
+
+/* Put the SHM contents of a small surface into an atlas, returns
+ * whether it got a place there. The padding around the contents is
+ * cleared, the contents need a full upload. */
+static int
+surface_state_use_atlas(struct gl_renderer *gr, struct gl_surface_state *gs)
+{
+	struct gl_atlas *atlas;
+	pixman_box32_t box;
+	int cw, ch, n_atlases = 0;
+	void *zero;
+
+	if (!gr->has_atlas ||
+	    gs->gl_format != GL_BGRA_EXT ||
+	    gs->gl_pixel_type != GL_UNSIGNED_BYTE)
+		return 0;
+
+	cw = (gs->pitch + 2 + GL_ATLAS_CELL - 1) / GL_ATLAS_CELL;
+	ch = (gs->height + 2 + GL_ATLAS_CELL - 1) / GL_ATLAS_CELL;
+	if (cw > GL_ATLAS_MAX_CELLS || ch > GL_ATLAS_MAX_CELLS)
+		return 0;
+
+	wl_list_for_each(atlas, &gr->atlases, link) {
+		if (atlas_alloc_cells(atlas, cw, ch, &box) == 0)
+			goto found;
+		n_atlases++;
+	}
+
+	if (n_atlases == GL_ATLAS_MAX_PAGES)
+		return 0;
+
+	atlas = atlas_create(gr);
+	if (!atlas)
+		return 0;
+	atlas_alloc_cells(atlas, cw, ch, &box);
+
+found:
+	zero = zalloc((box.x2 - box.x1) * (box.y2 - box.y1) * 4);
+	if (!zero) {
+		atlas_free(atlas, &box);
+		return 0;
+	}
+
+	glDeleteTextures(gs->num_textures, gs->textures);
+	gs->textures[0] = atlas->texture;
+	gs->num_textures = 1;
+	gs->atlas = atlas;
+	gs->atlas_box = box;
+	gs->atlas_x = box.x1 + 1;
+	gs->atlas_y = box.y1 + 1;
+
+	glBindTexture(GL_TEXTURE_2D, atlas->texture);
+#ifdef GL_EXT_unpack_subimage
+	if (gr->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	}
+#endif
+	glTexSubImage2D(GL_TEXTURE_2D, 0, box.x1, box.y1,
+			box.x2 - box.x1, box.y2 - box.y1,
+			GL_BGRA_EXT, GL_UNSIGNED_BYTE, zero);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	free(zero);
+
+	return 1;
+}
+
+static void
+shm_import_state_destroy(struct shm_import_state *sis)
+{
+	if (sis->image)
+		egl_image_unref(sis->image);
+
+	wl_list_remove(&sis->destroy_listener.link);
+	wl_list_remove(&sis->link);
+	free(sis);
+}
+
+static void
+shm_import_state_handle_buffer_destroy(struct wl_listener *listener,
+				       void *data)
+{
+	struct shm_import_state *sis =
+		container_of(listener, struct shm_import_state,
+			     destroy_listener);
+
+	shm_import_state_destroy(sis);
+}
+
+/* Find the mapping of a wl_shm pool, which libwayland does not tell */
+static int
+shm_pool_mapping(const void *data, unsigned long *start, unsigned long *end,
+		 unsigned long long *pgoff)
+{
+	uintptr_t addr = (uintptr_t) data;
+	char *line = NULL;
+	size_t len = 0;
+	FILE *fp;
+	int ret = -1;
+
+	fp = fopen("/proc/self/maps", "re");
+	if (!fp)
+		return -1;
+
+	while (getline(&line, &len, fp) > 0) {
+		if (sscanf(line, "%lx-%lx %*s %llx", start, end, pgoff) != 3)
+			continue;
+		if (addr >= *start && addr < *end) {
+			ret = 0;
+			break;
+		}
+	}
+
+	free(line);
+	fclose(fp);
+
+	return ret;
+}
+
+#ifdef HAVE_LINUX_UDMABUF_H
+/* libwayland keeps the pool fd to itself, but its mapping of the pool
+ * leads back to the file. Opening that through map_files needs
+ * CAP_CHECKPOINT_RESTORE, or CAP_SYS_ADMIN before Linux 5.9; without
+ * it buffers are simply copied. */
+static int
+shm_pool_open(const void *data, off_t *offset)
+{
+	unsigned long start, end;
+	unsigned long long pgoff;
+	char path[64];
+
+	if (shm_pool_mapping(data, &start, &end, &pgoff) < 0)
+		return -1;
+
+	snprintf(path, sizeof path, "/proc/self/map_files/%lx-%lx",
+		 start, end);
+	*offset = pgoff + ((uintptr_t) data - start);
+
+	return open(path, O_RDWR | O_CLOEXEC);
+}
+
+/* Whether map_files may be opened at all, tried once at init on a
+ * mapping of the renderer's own code rather than on every buffer */
+static bool
+shm_pool_open_allowed(void)
+{
+	unsigned long start, end;
+	unsigned long long pgoff;
+	char path[64];
+	int fd;
+
+	if (shm_pool_mapping((const void *) (uintptr_t) shm_pool_open_allowed,
+			     &start, &end, &pgoff) < 0)
+		return false;
+
+	snprintf(path, sizeof path, "/proc/self/map_files/%lx-%lx",
+		 start, end);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	close(fd);
+	return true;
+}
+
+static struct egl_image *
+shm_import(struct gl_renderer *gr, struct wl_shm_buffer *shm_buffer)
+{
+	struct udmabuf_create create;
+	struct egl_image *image;
+	long page_size = sysconf(_SC_PAGESIZE);
+	int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+	int32_t height = wl_shm_buffer_get_height(shm_buffer);
+	EGLint attribs[13];
+	uint32_t format;
+	struct stat st;
+	off_t offset, size;
+	int memfd, dmabuf_fd, seals;
+
+	switch (wl_shm_buffer_get_format(shm_buffer)) {
+	case WL_SHM_FORMAT_XRGB8888:
+		format = DRM_FORMAT_XRGB8888;
+		break;
+	case WL_SHM_FORMAT_ARGB8888:
+		format = DRM_FORMAT_ARGB8888;
+		break;
+	default:
+		return NULL;
+	}
+
+	memfd = shm_pool_open(wl_shm_buffer_get_data(shm_buffer), &offset);
+	if (memfd < 0) {
+		/* Lost the capability, no later buffer will do better */
+		if (errno == EPERM || errno == EACCES) {
+			weston_log("wl_shm import: map_files not permitted, "
+				   "copying buffers from now on\n");
+			close(gr->udmabuf_fd);
+			gr->udmabuf_fd = -1;
+		}
+		return NULL;
+	}
+
+	/* udmabuf needs the memfd sealed against shrinking and takes
+	 * whole pages, of which the buffer may start anywhere in the
+	 * first one */
+	memset(&create, 0, sizeof create);
+	create.memfd = memfd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = offset - offset % page_size;
+	size = offset % page_size + (off_t) stride * height;
+	create.size = (size + page_size - 1) / page_size * page_size;
+
+	seals = fcntl(memfd, F_GET_SEALS);
+	if (seals < 0 || !(seals & F_SEAL_SHRINK) ||
+	    fstat(memfd, &st) < 0 ||
+	    create.offset + create.size > (uint64_t) st.st_size) {
+		close(memfd);
+		return NULL;
+	}
+
+	dmabuf_fd = ioctl(gr->udmabuf_fd, UDMABUF_CREATE, &create);
+	close(memfd);
+	if (dmabuf_fd < 0)
+		return NULL;
+
+	attribs[0] = EGL_WIDTH;
+	attribs[1] = wl_shm_buffer_get_width(shm_buffer);
+	attribs[2] = EGL_HEIGHT;
+	attribs[3] = height;
+	attribs[4] = EGL_LINUX_DRM_FOURCC_EXT;
+	attribs[5] = format;
+	attribs[6] = EGL_DMA_BUF_PLANE0_FD_EXT;
+	attribs[7] = dmabuf_fd;
+	attribs[8] = EGL_DMA_BUF_PLANE0_OFFSET_EXT;
+	attribs[9] = offset % page_size;
+	attribs[10] = EGL_DMA_BUF_PLANE0_PITCH_EXT;
+	attribs[11] = stride;
+	attribs[12] = EGL_NONE;
+
+	/* The image keeps its own reference to the dmabuf */
+	image = egl_image_create(gr, EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+	close(dmabuf_fd);
+
+	return image;
+}
+#else
+static struct egl_image *
+shm_import(struct gl_renderer *gr, struct wl_shm_buffer *shm_buffer)
+{
+	return NULL;
+}
+#endif
+
+static struct shm_import_state *
+shm_import_state_get(struct gl_renderer *gr, struct weston_buffer *buffer)
+{
+	struct shm_import_state *sis;
+	struct wl_listener *listener;
 
-		goto done;
-	}
+	listener = wl_signal_get(&buffer->destroy_signal,
+				 shm_import_state_handle_buffer_destroy);
+	if (listener)
+		return container_of(listener, struct shm_import_state,
+				    destroy_listener);
 
-#ifdef GL_EXT_unpack_subimage
-	glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, gs->pitch);
-	data = wl_shm_buffer_get_data(buffer->shm_buffer);
+	sis = zalloc(sizeof *sis);
+	if (sis == NULL)
+		return NULL;
 
-	if (gs->needs_full_upload) {
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
-		wl_shm_buffer_begin_access(buffer->shm_buffer);
-		glTexImage2D(GL_TEXTURE_2D, 0, gs->gl_format,
-			     gs->pitch, buffer->height, 0,
-			     gs->gl_format, gs->gl_pixel_type, data);
-		wl_shm_buffer_end_access(buffer->shm_buffer);
-		goto done;
-	}
+	sis->image = shm_import(gr, buffer->shm_buffer);
+	sis->renderer = gr;
+	sis->destroy_listener.notify = shm_import_state_handle_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal, &sis->destroy_listener);
+	wl_list_insert(&gr->shm_imports, &sis->link);
 
-	rectangles = pixman_region32_rectangles(&gs->texture_damage, &n);
-	wl_shm_buffer_begin_access(buffer->shm_buffer);
-	for (i = 0; i < n; i++) {
-		pixman_box32_t r;
+	return sis;
+}
 
-		r = weston_surface_to_buffer_rect(surface, rectangles[i]);
+/* libwayland only checks that the first plane of a buffer fits in its
+ * pool, the others are checked here before they are read */
+static bool
+shm_buffer_fits_pool(struct gl_renderer *gr, struct weston_buffer *buffer,
+		     size_t bytes)
+{
+	struct shm_import_state *sis;
+	unsigned long start, end;
+	unsigned long long pgoff;
+	void *data = wl_shm_buffer_get_data(buffer->shm_buffer);
 
-		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, r.x1);
-		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, r.y1);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, r.x1, r.y1,
-				r.x2 - r.x1, r.y2 - r.y1,
-				gs->gl_format, gs->gl_pixel_type, data);
-	}
-	wl_shm_buffer_end_access(buffer->shm_buffer);
-#endif
+	sis = shm_import_state_get(gr, buffer);
+	if (!sis)
+		return false;
 
-done:
-	pixman_region32_fini(&gs->texture_damage);
-	pixman_region32_init(&gs->texture_damage);
-	gs->needs_full_upload = 0;
+	if (sis->pool_bytes == 0) {
+		if (shm_pool_mapping(data, &start, &end, &pgoff) < 0)
+			sis->pool_bytes = -1;
+		else
+			sis->pool_bytes = end - (uintptr_t) data;
+	}
 
-	weston_buffer_reference(&gs->buffer_ref, NULL);
+	return sis->pool_bytes >= 0 && (uint64_t) sis->pool_bytes >= bytes;
 }
 
-static void
-ensure_textures(struct gl_surface_state *gs, int num_textures)
+/* Samples a wl_shm buffer in place if its pool could be imported.
+ * The buffer then stays referenced until the next attach, like any
+ * EGL buffer. */
+static bool
+gl_renderer_attach_shm_import(struct weston_surface *es,
+			      struct weston_buffer *buffer)
 {
+	struct gl_renderer *gr = get_renderer(es->compositor);
+	struct gl_surface_state *gs = get_surface_state(es);
+	struct shm_import_state *sis;
 	int i;
 
-	if (num_textures <= gs->num_textures)
-		return;
+	if (gr->udmabuf_fd < 0)
+		return false;
 
-	for (i = gs->num_textures; i < num_textures; i++) {
-		glGenTextures(1, &gs->textures[i]);
-		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target,
-				GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(gs->target,
-				GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	sis = shm_import_state_get(gr, buffer);
+	if (!sis || !sis->image)
+		return false;
+
+	surface_state_release_atlas(gs);
+
+	for (i = 0; i < gs->num_images; i++) {
+		egl_image_unref(gs->images[i]);
+		gs->images[i] = NULL;
 	}
-	gs->num_textures = num_textures;
-	glBindTexture(gs->target, 0);
+
+	gs->images[0] = egl_image_ref(sis->image);
+	gs->num_images = 1;
+	gs->target = GL_TEXTURE_2D;
+
+	ensure_textures(gs, 1);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(gs->target, gs->textures[0]);
+	gr->image_target_texture_2d(gs->target, gs->images[0]->image);
+
+	gs->pitch = buffer->width;
+	gs->height = buffer->height;
+	gs->buffer_type = BUFFER_TYPE_EGL;
+	gs->y_inverted = 1;
+
+	return true;
 }
 
 static void
@@ -1290,8 +4044,9 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 	struct weston_compositor *ec = es->compositor;
 	struct gl_renderer *gr = get_renderer(ec);
 	struct gl_surface_state *gs = get_surface_state(es);
+	const struct yuv_shm_format *yuv = NULL;
 	GLenum gl_format, gl_pixel_type;
-	int pitch;
+	int pitch, i;
 
 	buffer->shm_buffer = shm_buffer;
 	buffer->width = wl_shm_buffer_get_width(shm_buffer);
@@ -1317,11 +4072,36 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 		gl_pixel_type = GL_UNSIGNED_SHORT_5_6_5;
 		break;
 	default:
+		for (i = 0; i < (int) ARRAY_LENGTH(yuv_shm_formats); i++)
+			if (yuv_shm_formats[i].format ==
+			    wl_shm_buffer_get_format(shm_buffer))
+				yuv = &yuv_shm_formats[i];
+		if (yuv)
+			break;
 		weston_log("warning: unknown shm buffer format: %08x\n",
 			   wl_shm_buffer_get_format(shm_buffer));
 		return;
 	}
 
+	if (yuv) {
+		gs->shader = yuv->num_planes == 3 ?
+			&gr->texture_shader_y_u_v :
+			&gr->texture_shader_y_xuxv;
+		pitch = wl_shm_buffer_get_stride(shm_buffer) /
+			yuv->plane[0].bpp;
+		gl_format = yuv->plane[0].format;
+		gl_pixel_type = GL_UNSIGNED_BYTE;
+		if (!shm_buffer_fits_pool(gr, buffer,
+					  yuv_buffer_bytes(yuv, pitch,
+							   buffer->height))) {
+			weston_log("warning: shm buffer planes do not fit "
+				   "in its pool\n");
+			return;
+		}
+	} else if (gl_renderer_attach_shm_import(es, buffer)) {
+		return;
+	}
+
 	/* Only allocate a texture if it doesn't match existing one.
 	 * If a switch from DRM allocated buffer to a SHM buffer is
 	 * happening, we need to allocate a new texture buffer. */
@@ -1329,32 +4109,70 @@ gl_renderer_attach_shm(struct weston_surface *es, struct weston_buffer *buffer,
 	    buffer->height != gs->height ||
 	    gl_format != gs->gl_format ||
 	    gl_pixel_type != gs->gl_pixel_type ||
+	    yuv != gs->yuv ||
 	    gs->buffer_type != BUFFER_TYPE_SHM) {
 		gs->pitch = pitch;
 		gs->height = buffer->height;
 		gs->target = GL_TEXTURE_2D;
 		gs->gl_format = gl_format;
 		gs->gl_pixel_type = gl_pixel_type;
+		gs->yuv = yuv;
 		gs->buffer_type = BUFFER_TYPE_SHM;
 		gs->needs_full_upload = 1;
 		gs->y_inverted = 1;
 
 		gs->surface = es;
 
-		ensure_textures(gs, 1);
+		for (i = 0; i < gs->num_images; i++) {
+			egl_image_unref(gs->images[i]);
+			gs->images[i] = NULL;
+		}
+		gs->num_images = 0;
+
+		surface_state_release_atlas(gs);
+		if (gs->num_textures > shm_num_planes(gs))
+			surface_state_release_textures(gs);
+		if (yuv || !surface_state_use_atlas(gr, gs))
+			ensure_textures(gs, shm_num_planes(gs));
 	}
 }
 
 static void
-gl_renderer_attach_egl(struct weston_surface *es, struct weston_buffer *buffer,
-		       uint32_t format)
+egl_buffer_state_destroy(struct egl_buffer_state *ebs)
 {
-	struct weston_compositor *ec = es->compositor;
-	struct gl_renderer *gr = get_renderer(ec);
-	struct gl_surface_state *gs = get_surface_state(es);
+	int i;
+
+	for (i = 0; i < ebs->num_images; i++)
+		egl_image_unref(ebs->images[i]);
+
+	wl_list_remove(&ebs->destroy_listener.link);
+	wl_list_remove(&ebs->link);
+	free(ebs);
+}
+
+static void
+egl_buffer_state_handle_buffer_destroy(struct wl_listener *listener,
+				       void *data)
+{
+	struct egl_buffer_state *ebs =
+		container_of(listener, struct egl_buffer_state,
+			     destroy_listener);
+
+	egl_buffer_state_destroy(ebs);
+}
+
+static struct egl_buffer_state *
+egl_buffer_state_create(struct gl_renderer *gr, struct weston_buffer *buffer,
+			EGLint format)
+{
+	struct egl_buffer_state *ebs;
 	EGLint attribs[3];
 	int i, num_planes;
 
+	ebs = zalloc(sizeof *ebs);
+	if (ebs == NULL)
+		return NULL;
+
 	buffer->legacy_buffer = (struct wl_buffer *)buffer->resource;
 	gr->query_buffer(gr->egl_display, buffer->legacy_buffer,
 			 EGL_WIDTH, &buffer->width);
@@ -1363,52 +4181,101 @@ gl_renderer_attach_egl(struct weston_surface *es, struct weston_buffer *buffer,
 	gr->query_buffer(gr->egl_display, buffer->legacy_buffer,
 			 EGL_WAYLAND_Y_INVERTED_WL, &buffer->y_inverted);
 
-	for (i = 0; i < gs->num_images; i++) {
-		egl_image_unref(gs->images[i]);
-		gs->images[i] = NULL;
-	}
-	gs->num_images = 0;
-	gs->target = GL_TEXTURE_2D;
+	ebs->target = GL_TEXTURE_2D;
 	switch (format) {
 	case EGL_TEXTURE_RGB:
 	case EGL_TEXTURE_RGBA:
 	default:
 		num_planes = 1;
-		gs->shader = &gr->texture_shader_rgba;
+		ebs->shader = &gr->texture_shader_rgba;
 		break;
 	case EGL_TEXTURE_EXTERNAL_WL:
 		num_planes = 1;
-		gs->target = GL_TEXTURE_EXTERNAL_OES;
-		gs->shader = &gr->texture_shader_egl_external;
+		ebs->target = GL_TEXTURE_EXTERNAL_OES;
+		ebs->shader = &gr->texture_shader_egl_external;
 		break;
 	case EGL_TEXTURE_Y_UV_WL:
 		num_planes = 2;
-		gs->shader = &gr->texture_shader_y_uv;
+		ebs->shader = &gr->texture_shader_y_uv;
 		break;
 	case EGL_TEXTURE_Y_U_V_WL:
 		num_planes = 3;
-		gs->shader = &gr->texture_shader_y_u_v;
+		ebs->shader = &gr->texture_shader_y_u_v;
 		break;
 	case EGL_TEXTURE_Y_XUXV_WL:
 		num_planes = 2;
-		gs->shader = &gr->texture_shader_y_xuxv;
+		ebs->shader = &gr->texture_shader_y_xuxv;
 		break;
 	}
 
-	ensure_textures(gs, num_planes);
 	for (i = 0; i < num_planes; i++) {
 		attribs[0] = EGL_WAYLAND_PLANE_WL;
 		attribs[1] = i;
 		attribs[2] = EGL_NONE;
-		gs->images[i] = egl_image_create(gr,
-						 EGL_WAYLAND_BUFFER_WL,
-						 buffer->legacy_buffer,
-						 attribs);
-		if (!gs->images[i]) {
+		ebs->images[ebs->num_images] =
+			egl_image_create(gr, EGL_WAYLAND_BUFFER_WL,
+					 buffer->legacy_buffer, attribs);
+		if (!ebs->images[ebs->num_images]) {
 			weston_log("failed to create img for plane %d\n", i);
 			continue;
 		}
-		gs->num_images++;
+		ebs->num_images++;
+	}
+
+	ebs->renderer = gr;
+	ebs->buffer = buffer;
+	ebs->destroy_listener.notify = egl_buffer_state_handle_buffer_destroy;
+	wl_signal_add(&buffer->destroy_signal, &ebs->destroy_listener);
+	wl_list_insert(&gr->egl_buffers, &ebs->link);
+
+	return ebs;
+}
+
+/* Returns the cached EGL state of an EGL buffer, creating it on first
+ * attach. NULL means the buffer is not an EGL buffer at all. */
+static struct egl_buffer_state *
+egl_buffer_state_get(struct gl_renderer *gr, struct weston_buffer *buffer)
+{
+	struct wl_listener *listener;
+	EGLint format;
+
+	listener = wl_signal_get(&buffer->destroy_signal,
+				 egl_buffer_state_handle_buffer_destroy);
+	if (listener)
+		return container_of(listener, struct egl_buffer_state,
+				    destroy_listener);
+
+	if (!gr->query_buffer(gr->egl_display, (void *) buffer->resource,
+			      EGL_TEXTURE_FORMAT, &format))
+		return NULL;
+
+	return egl_buffer_state_create(gr, buffer, format);
+}
+
+static void
+gl_renderer_attach_egl(struct weston_surface *es, struct weston_buffer *buffer,
+		       struct egl_buffer_state *ebs)
+{
+	struct gl_renderer *gr = ebs->renderer;
+	struct gl_surface_state *gs = get_surface_state(es);
+	int i;
+
+	surface_state_release_atlas(gs);
+
+	for (i = 0; i < gs->num_images; i++) {
+		egl_image_unref(gs->images[i]);
+		gs->images[i] = NULL;
+	}
+
+	gs->target = ebs->target;
+	gs->shader = ebs->shader;
+	gs->num_images = ebs->num_images;
+
+	/* Binding the image again on every attach is still needed: it is
+	 * what tells the driver the contents may have changed. */
+	ensure_textures(gs, gs->num_images);
+	for (i = 0; i < gs->num_images; i++) {
+		gs->images[i] = egl_image_ref(ebs->images[i]);
 
 		glActiveTexture(GL_TEXTURE0 + i);
 		glBindTexture(gs->target, gs->textures[i]);
@@ -1430,18 +4297,13 @@ gl_renderer_destroy_dmabuf(struct linux_dmabuf_buffer *dmabuf)
 	egl_image_unref(image);
 }
 
-static struct egl_image *
-import_dmabuf(struct gl_renderer *gr,
-	      struct linux_dmabuf_buffer *dmabuf)
+#define DMABUF_ATTRIBS_MAX 30
+
+static void
+dmabuf_attribs(struct linux_dmabuf_buffer *dmabuf, EGLint *attribs)
 {
-	struct egl_image *image;
-	EGLint attribs[30];
 	int atti = 0;
 
-	image = linux_dmabuf_buffer_get_user_data(dmabuf);
-	if (image)
-		return egl_image_ref(image);
-
 	/* This requires the Mesa commit in
 	 * Mesa 10.3 (08264e5dad4df448e7718e782ad9077902089a07) or
 	 * Mesa 10.2.7 (55d28925e6109a4afd61f109e845a8a51bd17652).
@@ -1486,50 +4348,388 @@ import_dmabuf(struct gl_renderer *gr,
 	}
 
 	attribs[atti++] = EGL_NONE;
+	assert(atti <= DMABUF_ATTRIBS_MAX);
+}
+
+/* The cache owns one ref. The caller gets another. */
+static struct egl_image *
+dmabuf_image_cache(struct gl_renderer *gr, struct linux_dmabuf_buffer *dmabuf,
+		   struct egl_image *image)
+{
+	image->dmabuf = dmabuf;
+	wl_list_insert(&gr->dmabuf_images, &image->link);
+	linux_dmabuf_buffer_set_user_data(dmabuf, egl_image_ref(image),
+		gl_renderer_destroy_dmabuf);
+
+	return image;
+}
+
+static struct egl_image *
+import_dmabuf(struct gl_renderer *gr,
+	      struct linux_dmabuf_buffer *dmabuf)
+{
+	struct egl_image *image;
+	EGLint attribs[DMABUF_ATTRIBS_MAX];
+
+	image = linux_dmabuf_buffer_get_user_data(dmabuf);
+	if (image)
+		return egl_image_ref(image);
 
+	dmabuf_attribs(dmabuf, attribs);
 	image = egl_image_create(gr, EGL_LINUX_DMA_BUF_EXT, NULL,
 				 attribs);
-
 	if (!image)
 		return NULL;
 
-	/* The cache owns one ref. The caller gets another. */
-	image->dmabuf = dmabuf;
-	wl_list_insert(&gr->dmabuf_images, &image->link);
-	linux_dmabuf_buffer_set_user_data(dmabuf, egl_image_ref(image),
-		gl_renderer_destroy_dmabuf);
+	return dmabuf_image_cache(gr, dmabuf, image);
+}
+
+static bool
+dmabuf_is_importable(struct linux_dmabuf_buffer *dmabuf)
+{
+	int i;
+
+	for (i = 0; i < dmabuf->n_planes; i++) {
+		/* EGL import does not have modifiers */
+		if (dmabuf->modifier[i] != 0)
+			return false;
+	}
+
+	/* reject all flags we do not recognize or handle */
+	if (dmabuf->flags & ~ZLINUX_BUFFER_PARAMS_FLAGS_Y_INVERT)
+		return false;
+
+	return true;
+}
+
+static bool
+gl_renderer_import_dmabuf(struct weston_compositor *ec,
+			  struct linux_dmabuf_buffer *dmabuf)
+{
+	struct gl_renderer *gr = get_renderer(ec);
+	struct egl_image *image;
+
+	assert(gr->has_dmabuf_import);
+
+	if (!dmabuf_is_importable(dmabuf))
+		return false;
+
+	image = import_dmabuf(gr, dmabuf);
+	if (!image)
+		return false;
+
+	/* Cache retains a ref. */
+	egl_image_unref(image);
+
+	return true;
+}
+
+struct dmabuf_import_job {
+	struct wl_list link;
+	struct linux_dmabuf_buffer *dmabuf;
+	weston_dmabuf_import_done_func done;
+	EGLint attribs[DMABUF_ATTRIBS_MAX];
+	EGLImageKHR image; /* set by the import thread */
+};
+
+static void *
+dmabuf_import_thread(void *data)
+{
+	struct gl_renderer *gr = data;
+	struct dmabuf_import_job *job;
+	char c = 0;
+
+	pthread_mutex_lock(&gr->import.mutex);
+	for (;;) {
+		while (!gr->import.quit && wl_list_empty(&gr->import.queue))
+			pthread_cond_wait(&gr->import.cond,
+					  &gr->import.mutex);
+		if (gr->import.quit)
+			break;
+
+		job = container_of(gr->import.queue.next,
+				   struct dmabuf_import_job, link);
+		wl_list_remove(&job->link);
+		pthread_mutex_unlock(&gr->import.mutex);
+
+		job->image = gr->create_image(gr->egl_display, EGL_NO_CONTEXT,
+					      EGL_LINUX_DMA_BUF_EXT, NULL,
+					      job->attribs);
+
+		pthread_mutex_lock(&gr->import.mutex);
+		wl_list_insert(gr->import.done.prev, &job->link);
+		/* A full pipe has a wakeup pending already, and
+		 * weston_log() may not be used from this thread */
+		if (write(gr->import.pipe[1], &c, 1) < 0)
+			continue;
+	}
+	pthread_mutex_unlock(&gr->import.mutex);
+
+	eglReleaseThread();
+
+	return NULL;
+}
+
+static void
+dmabuf_import_job_finish(struct gl_renderer *gr, struct dmabuf_import_job *job)
+{
+	struct egl_image *image = NULL;
+
+	if (job->image != EGL_NO_IMAGE_KHR)
+		image = egl_image_wrap(gr, job->image);
+	if (image) {
+		dmabuf_image_cache(gr, job->dmabuf, image);
+		egl_image_unref(image);
+	}
+
+	job->done(job->dmabuf, image != NULL);
+	free(job);
+}
+
+static int
+dmabuf_import_done(int fd, uint32_t mask, void *data)
+{
+	struct gl_renderer *gr = data;
+	struct dmabuf_import_job *job, *next;
+	struct wl_list done;
+	char buf[64];
+
+	while (read(fd, buf, sizeof buf) > 0)
+		;
+
+	wl_list_init(&done);
+	pthread_mutex_lock(&gr->import.mutex);
+	wl_list_insert_list(&done, &gr->import.done);
+	wl_list_init(&gr->import.done);
+	pthread_mutex_unlock(&gr->import.mutex);
+
+	wl_list_for_each_safe(job, next, &done, link)
+		dmabuf_import_job_finish(gr, job);
+
+	return 0;
+}
+
+static int
+dmabuf_import_start(struct gl_renderer *gr, struct weston_compositor *ec)
+{
+	struct wl_event_loop *loop = wl_display_get_event_loop(ec->wl_display);
+
+	if (gr->import.started)
+		return 0;
+
+	if (pipe2(gr->import.pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+		return -1;
+
+	gr->import.source = wl_event_loop_add_fd(loop, gr->import.pipe[0],
+						 WL_EVENT_READABLE,
+						 dmabuf_import_done, gr);
+	if (!gr->import.source)
+		goto err_pipe;
+
+	pthread_mutex_init(&gr->import.mutex, NULL);
+	pthread_cond_init(&gr->import.cond, NULL);
+	wl_list_init(&gr->import.queue);
+	wl_list_init(&gr->import.done);
+	gr->import.quit = 0;
+
+	if (pthread_create(&gr->import.thread, NULL,
+			   dmabuf_import_thread, gr) != 0) {
+		pthread_cond_destroy(&gr->import.cond);
+		pthread_mutex_destroy(&gr->import.mutex);
+		wl_event_source_remove(gr->import.source);
+		goto err_pipe;
+	}
+
+	gr->import.started = 1;
+
+	return 0;
+
+err_pipe:
+	close(gr->import.pipe[0]);
+	close(gr->import.pipe[1]);
+	return -1;
+}
+
+/* Imports still queued fail; those done complete */
+static void
+dmabuf_import_stop(struct gl_renderer *gr)
+{
+	struct dmabuf_import_job *job, *next;
+
+	if (!gr->import.started)
+		return;
+
+	pthread_mutex_lock(&gr->import.mutex);
+	gr->import.quit = 1;
+	pthread_cond_signal(&gr->import.cond);
+	pthread_mutex_unlock(&gr->import.mutex);
+	pthread_join(gr->import.thread, NULL);
 
-	return image;
+	wl_list_for_each_safe(job, next, &gr->import.queue, link) {
+		job->done(job->dmabuf, false);
+		free(job);
+	}
+	wl_list_for_each_safe(job, next, &gr->import.done, link)
+		dmabuf_import_job_finish(gr, job);
+
+	wl_event_source_remove(gr->import.source);
+	close(gr->import.pipe[0]);
+	close(gr->import.pipe[1]);
+	pthread_cond_destroy(&gr->import.cond);
+	pthread_mutex_destroy(&gr->import.mutex);
+	gr->import.started = 0;
 }
 
-static bool
-gl_renderer_import_dmabuf(struct weston_compositor *ec,
-			  struct linux_dmabuf_buffer *dmabuf)
+static void
+gl_renderer_import_dmabuf_async(struct weston_compositor *ec,
+				struct linux_dmabuf_buffer *dmabuf,
+				weston_dmabuf_import_done_func done)
 {
 	struct gl_renderer *gr = get_renderer(ec);
-	struct egl_image *image;
-	int i;
+	struct dmabuf_import_job *job;
 
-	assert(gr->has_dmabuf_import);
+	if (!dmabuf_is_importable(dmabuf) ||
+	    linux_dmabuf_buffer_get_user_data(dmabuf)) {
+		done(dmabuf, gl_renderer_import_dmabuf(ec, dmabuf));
+		return;
+	}
 
-	for (i = 0; i < dmabuf->n_planes; i++) {
-		/* EGL import does not have modifiers */
-		if (dmabuf->modifier[i] != 0)
-			return false;
+	job = zalloc(sizeof *job);
+	if (!job || dmabuf_import_start(gr, ec) < 0) {
+		free(job);
+		done(dmabuf, gl_renderer_import_dmabuf(ec, dmabuf));
+		return;
 	}
 
-	/* reject all flags we do not recognize or handle */
+	job->dmabuf = dmabuf;
+	job->done = done;
+	dmabuf_attribs(dmabuf, job->attribs);
+
+	pthread_mutex_lock(&gr->import.mutex);
+	wl_list_insert(gr->import.queue.prev, &job->link);
+	pthread_cond_signal(&gr->import.cond);
+	pthread_mutex_unlock(&gr->import.mutex);
+}
+
+/** Copy a rectangle of the output into a dmabuf on the GPU
+ *
+ * The rectangle is in the coordinates read_pixels() takes. It is
+ * stored at the top left of the dmabuf, top row first unless the
+ * buffer is y-inverted. The window surface can't be sampled, so the
+ * rectangle is first copied to a scratch texture, which is then drawn
+ * flipped into the dmabuf.
+ */
+static int
+gl_renderer_copy_to_dmabuf(struct weston_output *output,
+			   struct linux_dmabuf_buffer *dmabuf,
+			   uint32_t x, uint32_t y,
+			   uint32_t width, uint32_t height)
+{
+	struct gl_output_state *go = get_output_state(output);
+	struct gl_renderer *gr = get_renderer(output->compositor);
+	struct gl_shader *shader = &gr->texture_shader_rgbx;
+	struct egl_image *image;
+	struct weston_matrix matrix;
+	GLuint textures[2], fbo;
+	GLfloat s = (GLfloat) width / dmabuf->width;
+	GLfloat t = (GLfloat) height / dmabuf->height;
+	GLfloat verts[8], texcoord[8];
+	int ret = -1;
+
 	if (dmabuf->flags & ~ZLINUX_BUFFER_PARAMS_FLAGS_Y_INVERT)
-		return false;
+		return -1;
+
+	if (use_output(output) < 0)
+		return -1;
 
 	image = import_dmabuf(gr, dmabuf);
 	if (!image)
-		return false;
+		return -1;
 
-	/* Cache retains a ref. */
+	/* The buffers hold fewer pixels than the mode, the part copied
+	 * is scaled up by drawing it into the dmabuf */
+	if (output->render_width)
+		output_rect_to_render(output, &x, &y, &width, &height);
+
+	x += go->borders[GL_RENDERER_BORDER_LEFT].width;
+	y += go->borders[GL_RENDERER_BORDER_BOTTOM].height;
+
+	glGenTextures(2, textures);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, textures[0]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	/* The window surface may have no alpha, which GL_RGBA needs */
+	glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, x, y, width, height, 0);
+
+	glBindTexture(GL_TEXTURE_2D, textures[1]);
+	gr->image_target_texture_2d(GL_TEXTURE_2D, image->image);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			       GL_TEXTURE_2D, textures[1], 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+	    GL_FRAMEBUFFER_COMPLETE) {
+		weston_log("dmabuf of format 0x%08x can't be rendered to\n",
+			   dmabuf->format);
+		goto out;
+	}
+
+	/* The first row of the framebuffer is the first row in memory,
+	 * while the first row of the scratch texture is the bottom one */
+	verts[0] = -1.0f;		verts[1] = -1.0f;
+	verts[2] = 2.0f * s - 1.0f;	verts[3] = -1.0f;
+	verts[4] = 2.0f * s - 1.0f;	verts[5] = 2.0f * t - 1.0f;
+	verts[6] = -1.0f;		verts[7] = 2.0f * t - 1.0f;
+
+	if (dmabuf->flags & ZLINUX_BUFFER_PARAMS_FLAGS_Y_INVERT) {
+		texcoord[0] = 0.0f;	texcoord[1] = 0.0f;
+		texcoord[2] = 1.0f;	texcoord[3] = 0.0f;
+		texcoord[4] = 1.0f;	texcoord[5] = 1.0f;
+		texcoord[6] = 0.0f;	texcoord[7] = 1.0f;
+	} else {
+		texcoord[0] = 0.0f;	texcoord[1] = 1.0f;
+		texcoord[2] = 1.0f;	texcoord[3] = 1.0f;
+		texcoord[4] = 1.0f;	texcoord[5] = 0.0f;
+		texcoord[6] = 0.0f;	texcoord[7] = 0.0f;
+	}
+
+	glViewport(0, 0, dmabuf->width, dmabuf->height);
+	glDisable(GL_BLEND);
+	use_shader(gr, shader);
+
+	weston_matrix_init(&matrix);
+	glUniformMatrix4fv(shader->proj_uniform, 1, GL_FALSE, matrix.d);
+	glUniform1i(shader->tex_uniforms[0], 0);
+	glUniform1f(shader->alpha_uniform, 1.0f);
+
+	glBindTexture(GL_TEXTURE_2D, textures[0]);
+
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, texcoord);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+
+	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+	glDisableVertexAttribArray(1);
+	glDisableVertexAttribArray(0);
+
+	/* Implicit fencing on the dmabuf makes the client wait for the
+	 * draw, so there is no need to block here */
+	glFlush();
+	ret = 0;
+
+out:
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(2, textures);
 	egl_image_unref(image);
 
-	return true;
+	return ret;
 }
 
 static GLenum
@@ -1570,6 +4770,8 @@ gl_renderer_attach_dmabuf(struct weston_surface *surface,
 	buffer->y_inverted =
 		!!(dmabuf->flags & ZLINUX_BUFFER_PARAMS_FLAGS_Y_INVERT);
 
+	surface_state_release_atlas(gs);
+
 	for (i = 0; i < gs->num_images; i++)
 		egl_image_unref(gs->images[i]);
 	gs->num_images = 0;
@@ -1584,21 +4786,11 @@ gl_renderer_attach_dmabuf(struct weston_surface *surface,
 	}
 
 	/*
-	 * We try to always hold an imported EGLImage from the dmabuf
-	 * to prevent the client from preventing re-imports. But, we also
-	 * need to re-import every time the contents may change because
-	 * GL driver's caching may need flushing.
-	 *
-	 * Here we release the cache reference which has to be final.
+	 * The EGLImage imported at create time stays cached on the dmabuf
+	 * for its whole lifetime, so this is normally just a lookup.
+	 * Rebinding the image to the texture below is what lets the GL
+	 * driver pick up new contents; no re-import is needed for that.
 	 */
-	gs->images[0] = linux_dmabuf_buffer_get_user_data(dmabuf);
-	if (gs->images[0]) {
-		int ret;
-
-		ret = egl_image_unref(gs->images[0]);
-		assert(ret == 0);
-	}
-
 	gs->images[0] = import_dmabuf(gr, dmabuf);
 	if (!gs->images[0]) {
 		linux_dmabuf_buffer_send_server_error(dmabuf,
@@ -1627,10 +4819,15 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	struct gl_surface_state *gs = get_surface_state(es);
 	struct wl_shm_buffer *shm_buffer;
 	struct linux_dmabuf_buffer *dmabuf;
-	EGLint format;
+	struct egl_buffer_state *ebs;
 	int i;
 
+	gs->content_serial = ++gr->content_serial;
+	surface_state_release_downscaled(gs);
+
 	weston_buffer_reference(&gs->buffer_ref, buffer);
+	weston_buffer_release_reference(&gs->buffer_release_ref,
+					es->buffer_release_ref.buffer_release);
 
 	if (!buffer) {
 		for (i = 0; i < gs->num_images; i++) {
@@ -1638,28 +4835,38 @@ gl_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 			gs->images[i] = NULL;
 		}
 		gs->num_images = 0;
-		glDeleteTextures(gs->num_textures, gs->textures);
-		gs->num_textures = 0;
+		surface_state_release_textures(gs);
 		gs->buffer_type = BUFFER_TYPE_NULL;
 		gs->y_inverted = 1;
+		gs->evicted = 0;
+		surface_state_account(gr, gs);
 		return;
 	}
 
+	/* A new buffer is uploaded in full anyway */
+	if (gs->evicted) {
+		gs->evicted = 0;
+		ensure_textures(gs, shm_num_planes(gs));
+		gs->needs_full_upload = 1;
+	}
+
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
 
 	if (shm_buffer)
 		gl_renderer_attach_shm(es, buffer, shm_buffer);
-	else if (gr->query_buffer(gr->egl_display, (void *) buffer->resource,
-				  EGL_TEXTURE_FORMAT, &format))
-		gl_renderer_attach_egl(es, buffer, format);
+	else if ((ebs = egl_buffer_state_get(gr, buffer)))
+		gl_renderer_attach_egl(es, buffer, ebs);
 	else if ((dmabuf = linux_dmabuf_buffer_get(buffer->resource)))
 		gl_renderer_attach_dmabuf(es, buffer, dmabuf);
 	else {
 		weston_log("unhandled buffer type!\n");
 		weston_buffer_reference(&gs->buffer_ref, NULL);
+		weston_buffer_release_reference(&gs->buffer_release_ref, NULL);
 		gs->buffer_type = BUFFER_TYPE_NULL;
 		gs->y_inverted = 1;
 	}
+
+	surface_state_account(gr, gs);
 }
 
 static void
@@ -1673,6 +4880,7 @@ gl_renderer_surface_set_color(struct weston_surface *surface,
 	gs->color[1] = green;
 	gs->color[2] = blue;
 	gs->color[3] = alpha;
+	gs->content_serial = ++gr->content_serial;
 	gs->buffer_type = BUFFER_TYPE_SOLID;
 	gs->pitch = 1;
 	gs->height = 1;
@@ -1680,6 +4888,49 @@ gl_renderer_surface_set_color(struct weston_surface *surface,
 	gs->shader = &gr->solid_shader;
 }
 
+static int
+gl_renderer_surface_set_image(struct weston_surface *surface,
+			      pixman_image_t *image)
+{
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	int width = pixman_image_get_width(image);
+	int height = pixman_image_get_height(image);
+
+	if (pixman_image_get_format(image) != PIXMAN_a8b8g8r8 ||
+	    pixman_image_get_stride(image) != width * 4)
+		return -1;
+
+	gl_renderer_attach(surface, NULL);
+
+	/* Uploaded like a wl_shm buffer that is never attached again */
+	gs->target = GL_TEXTURE_2D;
+	ensure_textures(gs, 1);
+	glBindTexture(GL_TEXTURE_2D, gs->textures[0]);
+#ifdef GL_EXT_unpack_subimage
+	if (gr->has_unpack_subimage) {
+		glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, width);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+	}
+#endif
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+		     GL_RGBA, GL_UNSIGNED_BYTE, pixman_image_get_data(image));
+
+	gs->buffer_type = BUFFER_TYPE_SHM;
+	gs->gl_format = GL_RGBA;
+	gs->gl_pixel_type = GL_UNSIGNED_BYTE;
+	gs->yuv = NULL;
+	gs->pitch = width;
+	gs->height = height;
+	gs->y_inverted = 1;
+	gs->mipmaps_stale = 1;
+	gs->shader = &gr->texture_shader_rgba;
+	surface_state_account(gr, gs);
+
+	return 0;
+}
+
 static void
 gl_renderer_surface_get_content_size(struct weston_surface *surface,
 				     int *width, int *height)
@@ -1712,11 +4963,14 @@ pack_color(pixman_format_code_t format, float *c)
 	}
 }
 
+/* Draw the src rectangle of the surface contents, scaled to dst_width
+ * by dst_height, into a new texture attached to a new framebuffer,
+ * which is left bound. The top row of the rectangle ends up in row 0,
+ * where glReadPixels() starts. */
 static int
-gl_renderer_surface_copy_content(struct weston_surface *surface,
-				 void *target, size_t size,
-				 int src_x, int src_y,
-				 int width, int height)
+surface_copy_draw(struct gl_renderer *gr, struct gl_surface_state *gs,
+		  int src_x, int src_y, int width, int height,
+		  int dst_width, int dst_height, GLuint *fbo, GLuint *tex)
 {
 	static const GLfloat verts[4 * 2] = {
 		0.0f, 0.0f,
@@ -1736,53 +4990,33 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 		 0.0f,  0.0f, 1.0f, 0.0f,
 		-1.0f,  1.0f, 0.0f, 1.0f
 	};
-	const pixman_format_code_t format = PIXMAN_a8b8g8r8;
-	const size_t bytespp = 4; /* PIXMAN_a8b8g8r8 */
-	const GLenum gl_format = GL_RGBA; /* PIXMAN_a8b8g8r8 little-endian */
-	struct gl_renderer *gr = get_renderer(surface->compositor);
-	struct gl_surface_state *gs = get_surface_state(surface);
-	int cw, ch;
-	GLuint fbo;
-	GLuint tex;
+	GLfloat texcoords[4 * 2];
+	GLfloat u, v;
 	GLenum status;
+	GLint filter;
 	const GLfloat *proj;
 	int i;
 
-	gl_renderer_surface_get_content_size(surface, &cw, &ch);
-
-	switch (gs->buffer_type) {
-	case BUFFER_TYPE_NULL:
-		return -1;
-	case BUFFER_TYPE_SOLID:
-		*(uint32_t *)target = pack_color(format, gs->color);
-		return 0;
-	case BUFFER_TYPE_SHM:
-		gl_renderer_flush_damage(surface);
-		/* fall through */
-	case BUFFER_TYPE_EGL:
-		break;
-	}
-
-	glGenTextures(1, &tex);
-	glBindTexture(GL_TEXTURE_2D, tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, cw, ch,
+	glGenTextures(1, tex);
+	glBindTexture(GL_TEXTURE_2D, *tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, dst_width, dst_height,
 		     0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	glBindTexture(GL_TEXTURE_2D, 0);
 
-	glGenFramebuffers(1, &fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glGenFramebuffers(1, fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-			       GL_TEXTURE_2D, tex, 0);
+			       GL_TEXTURE_2D, *tex, 0);
 
 	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 	if (status != GL_FRAMEBUFFER_COMPLETE) {
 		weston_log("%s: fbo error: %#x\n", __func__, status);
-		glDeleteFramebuffers(1, &fbo);
-		glDeleteTextures(1, &tex);
+		glDeleteFramebuffers(1, fbo);
+		glDeleteTextures(1, tex);
 		return -1;
 	}
 
-	glViewport(0, 0, cw, ch);
+	glViewport(0, 0, dst_width, dst_height);
 	glDisable(GL_BLEND);
 	use_shader(gr, gs->shader);
 	if (gs->y_inverted)
@@ -1793,21 +5027,43 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	glUniformMatrix4fv(gs->shader->proj_uniform, 1, GL_FALSE, proj);
 	glUniform1f(gs->shader->alpha_uniform, 1.0f);
 
+	if (dst_width == width && dst_height == height)
+		filter = GL_NEAREST;
+	else
+		filter = GL_LINEAR;
+
 	for (i = 0; i < gs->num_textures; i++) {
 		glUniform1i(gs->shader->tex_uniforms[i], i);
 
 		glActiveTexture(GL_TEXTURE0 + i);
 		glBindTexture(gs->target, gs->textures[i]);
-		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(gs->target, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(gs->target, GL_TEXTURE_MAG_FILTER, filter);
 	}
 
 	/* position: */
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, verts);
 	glEnableVertexAttribArray(0);
 
-	/* texcoord: */
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, verts);
+	/* texcoord, in buffer pixels first: */
+	for (i = 0; i < 4; i++) {
+		u = src_x + verts[i * 2] * width;
+		if (gs->y_inverted)
+			v = src_y + verts[i * 2 + 1] * height;
+		else
+			v = gs->height - src_y - height +
+			    verts[i * 2 + 1] * height;
+
+		if (gs->atlas) {
+			texcoords[i * 2] = (gs->atlas_x + u) / GL_ATLAS_SIZE;
+			texcoords[i * 2 + 1] = (gs->atlas_y + v) /
+					       GL_ATLAS_SIZE;
+		} else {
+			texcoords[i * 2] = u / gs->pitch;
+			texcoords[i * 2 + 1] = v / gs->height;
+		}
+	}
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, texcoords);
 	glEnableVertexAttribArray(1);
 
 	glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
@@ -1815,8 +5071,42 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	glDisableVertexAttribArray(1);
 	glDisableVertexAttribArray(0);
 
+	return 0;
+}
+
+static int
+gl_renderer_surface_copy_content(struct weston_surface *surface,
+				 void *target, size_t size,
+				 int src_x, int src_y,
+				 int width, int height)
+{
+	const pixman_format_code_t format = PIXMAN_a8b8g8r8;
+	const size_t bytespp = 4; /* PIXMAN_a8b8g8r8 */
+	const GLenum gl_format = GL_RGBA; /* PIXMAN_a8b8g8r8 little-endian */
+	struct gl_renderer *gr = get_renderer(surface->compositor);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	GLuint fbo;
+	GLuint tex;
+
+	switch (gs->buffer_type) {
+	case BUFFER_TYPE_NULL:
+		return -1;
+	case BUFFER_TYPE_SOLID:
+		*(uint32_t *)target = pack_color(format, gs->color);
+		return 0;
+	case BUFFER_TYPE_SHM:
+		gl_renderer_flush_damage(surface);
+		/* fall through */
+	case BUFFER_TYPE_EGL:
+		break;
+	}
+
+	if (surface_copy_draw(gr, gs, src_x, src_y, width, height,
+			      width, height, &fbo, &tex) < 0)
+		return -1;
+
 	glPixelStorei(GL_PACK_ALIGNMENT, bytespp);
-	glReadPixels(src_x, src_y, width, height, gl_format,
+	glReadPixels(0, 0, width, height, gl_format,
 		     GL_UNSIGNED_BYTE, target);
 
 	glDeleteFramebuffers(1, &fbo);
@@ -1825,9 +5115,185 @@ gl_renderer_surface_copy_content(struct weston_surface *surface,
 	return 0;
 }
 
+/* How often finished surface copies are looked for */
+#define GL_COPY_POLL_MS 2
+
+/* Copy the pixels of a job out, unless read is 0, and report the
+ * result */
+static void
+gl_copy_job_finish(struct gl_renderer *gr, struct gl_copy_job *job,
+		   int read)
+{
+	void *map;
+	int status = -1;
+
+#ifdef EGL_KHR_fence_sync
+	if (job->sync != EGL_NO_SYNC_KHR)
+		gr->destroy_sync(gr->egl_display, job->sync);
+#endif
+
+	if (read) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, job->pbo);
+		map = gr->map_buffer_range(GL_PIXEL_PACK_BUFFER, 0, job->size,
+					   GL_MAP_READ_BIT);
+		if (map) {
+			memcpy(job->target, map, job->size);
+			if (gr->unmap_buffer(GL_PIXEL_PACK_BUFFER))
+				status = 0;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	glDeleteBuffers(1, &job->pbo);
+
+	wl_list_remove(&job->link);
+	job->done(job->data, status);
+	free(job);
+}
+
+static int
+gl_copy_jobs_poll(void *data)
+{
+	struct gl_renderer *gr = data;
+	struct gl_copy_job *job, *next;
+
+	/* Fences signal in submission order, stop at the first pending one */
+	wl_list_for_each_safe(job, next, &gr->copy_jobs, link) {
+#ifdef EGL_KHR_fence_sync
+		if (job->sync != EGL_NO_SYNC_KHR &&
+		    gr->client_wait_sync(gr->egl_display, job->sync,
+					 EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+					 0) == EGL_TIMEOUT_EXPIRED_KHR)
+			break;
+#endif
+		gl_copy_job_finish(gr, job, 1);
+	}
+
+	if (!wl_list_empty(&gr->copy_jobs))
+		wl_event_source_timer_update(gr->copy_timer, GL_COPY_POLL_MS);
+
+	return 0;
+}
+
+/** Copy surface contents without waiting for the GPU
+ *
+ * The rectangle is drawn scaled into a framebuffer of its own and read
+ * back into a pixel buffer object behind a fence, which is polled from
+ * the event loop; the pixels are copied out once the GPU is done. The
+ * scaling filters linearly, minifying by more than two is better done
+ * in steps by the caller. Without pixel buffer objects the read is
+ * synchronous and done is called before this returns.
+ */
+static int
+gl_renderer_surface_copy_content_async(struct weston_surface *surface,
+				       void *target, size_t size,
+				       int src_x, int src_y,
+				       int width, int height,
+				       int dst_width, int dst_height,
+				       weston_surface_copy_done_func done,
+				       void *data)
+{
+	const pixman_format_code_t format = PIXMAN_a8b8g8r8;
+	const GLenum gl_format = GL_RGBA; /* PIXMAN_a8b8g8r8 little-endian */
+	struct weston_compositor *ec = surface->compositor;
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_surface_state *gs = get_surface_state(surface);
+	struct wl_event_loop *loop;
+	struct gl_copy_job *job;
+	uint32_t color, *pixel;
+	size_t bytes = (size_t) dst_width * dst_height * 4;
+	GLuint fbo;
+	GLuint tex;
+	size_t i;
+
+	switch (gs->buffer_type) {
+	case BUFFER_TYPE_NULL:
+		return -1;
+	case BUFFER_TYPE_SOLID:
+		color = pack_color(format, gs->color);
+		pixel = target;
+		for (i = 0; i < bytes / 4; i++)
+			pixel[i] = color;
+		done(data, 0);
+		return 0;
+	case BUFFER_TYPE_SHM:
+		gl_renderer_flush_damage(surface);
+		/* fall through */
+	case BUFFER_TYPE_EGL:
+		break;
+	}
+
+	if (!gr->has_pbo) {
+		if (surface_copy_draw(gr, gs, src_x, src_y, width, height,
+				      dst_width, dst_height, &fbo, &tex) < 0)
+			return -1;
+
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, dst_width, dst_height, gl_format,
+			     GL_UNSIGNED_BYTE, target);
+
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteTextures(1, &tex);
+
+		done(data, 0);
+		return 0;
+	}
+
+	if (!gr->copy_timer) {
+		loop = wl_display_get_event_loop(ec->wl_display);
+		gr->copy_timer = wl_event_loop_add_timer(loop,
+							 gl_copy_jobs_poll,
+							 gr);
+		if (!gr->copy_timer)
+			return -1;
+	}
+
+	job = zalloc(sizeof *job);
+	if (!job)
+		return -1;
+
+	if (surface_copy_draw(gr, gs, src_x, src_y, width, height,
+			      dst_width, dst_height, &fbo, &tex) < 0) {
+		free(job);
+		return -1;
+	}
+
+	glGenBuffers(1, &job->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, job->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glReadPixels(0, 0, dst_width, dst_height, gl_format,
+		     GL_UNSIGNED_BYTE, NULL);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	/* The texture lives on until the read is done */
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &tex);
+
+#ifdef EGL_KHR_fence_sync
+	job->sync = EGL_NO_SYNC_KHR;
+	if (gr->has_fence_sync)
+		job->sync = gr->create_sync(gr->egl_display,
+					    EGL_SYNC_FENCE_KHR, NULL);
+#endif
+
+	job->size = bytes;
+	job->target = target;
+	job->done = done;
+	job->data = data;
+	wl_list_insert(gr->copy_jobs.prev, &job->link);
+
+	wl_event_source_timer_update(gr->copy_timer, GL_COPY_POLL_MS);
+
+	return 0;
+}
+
 static void
 surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 {
+	struct weston_output *output;
+	struct gl_output_state *go;
+	struct gl_timer_query *q;
+	struct gl_geometry *geom, *next;
 	int i;
 
 	wl_list_remove(&gs->surface_destroy_listener.link);
@@ -1835,12 +5301,28 @@ surface_state_destroy(struct gl_surface_state *gs, struct gl_renderer *gr)
 
 	gs->surface->renderer_state = NULL;
 
-	glDeleteTextures(gs->num_textures, gs->textures);
+	surface_state_release_textures(gs);
+	gr->texture_bytes -= gs->texture_bytes;
+	wl_list_remove(&gs->lru_link);
+
+	wl_list_for_each_safe(geom, next, &gs->geometry, link)
+		gl_geometry_destroy(geom);
+
+	wl_list_for_each(output, &gs->surface->compositor->output_list, link) {
+		go = get_output_state(output);
+		if (!go)
+			continue;
+
+		wl_array_for_each(q, &go->timer_queries)
+			if (q->gs == gs)
+				q->gs = NULL;
+	}
 
 	for (i = 0; i < gs->num_images; i++)
 		egl_image_unref(gs->images[i]);
 
 	weston_buffer_reference(&gs->buffer_ref, NULL);
+	weston_buffer_release_reference(&gs->buffer_release_ref, NULL);
 	pixman_region32_fini(&gs->texture_damage);
 	free(gs);
 }
@@ -1889,10 +5371,13 @@ gl_renderer_create_surface(struct weston_surface *surface)
 	 */
 	gs->pitch = 1;
 	gs->y_inverted = 1;
+	gs->content_serial = ++gr->content_serial;
 
 	gs->surface = surface;
 
 	pixman_region32_init(&gs->texture_damage);
+	wl_list_insert(&gr->texture_lru, &gs->lru_link);
+	wl_list_init(&gs->geometry);
 	surface->renderer_state = gs;
 
 	gs->surface_destroy_listener.notify =
@@ -1961,6 +5446,35 @@ static const char texture_fragment_shader_rgbx[] =
 	"   gl_FragColor.a = alpha;\n"
 	;
 
+static const char texture_fragment_shader_rgba_noalpha[] =
+	"precision mediump float;\n"
+	"varying vec2 v_texcoord;\n"
+	"uniform sampler2D tex;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_FragColor = texture2D(tex, v_texcoord);\n"
+	;
+
+static const char texture_fragment_shader_opaque[] =
+	"precision mediump float;\n"
+	"varying vec2 v_texcoord;\n"
+	"uniform sampler2D tex;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_FragColor.rgb = texture2D(tex, v_texcoord).rgb;\n"
+	"   gl_FragColor.a = 1.0;\n"
+	;
+
+static const char texture_fragment_shader_egl_external_noalpha[] =
+	"#extension GL_OES_EGL_image_external : require\n"
+	"precision mediump float;\n"
+	"varying vec2 v_texcoord;\n"
+	"uniform samplerExternalOES tex;\n"
+	"void main()\n"
+	"{\n"
+	"   gl_FragColor = texture2D(tex, v_texcoord);\n"
+	;
+
 static const char texture_fragment_shader_egl_external[] =
 	"#extension GL_OES_EGL_image_external : require\n"
 	"precision mediump float;\n"
@@ -2012,6 +5526,34 @@ static const char texture_fragment_shader_y_xuxv[] =
 	FRAGMENT_CONVERT_YUV
 	;
 
+/* The LUT is packed into a 2D texture as lut_size slices of constant
+ * blue side by side, red across and green down each slice. Red and
+ * green are interpolated by the sampler, blue between two slices.
+ * mediump may only have 10 bits of mantissa, too few to address the
+ * lut_size^2 texels across, so highp is used where there is one. */
+static const char color_lut_fragment_shader[] =
+	"#ifdef GL_FRAGMENT_PRECISION_HIGH\n"
+	"precision highp float;\n"
+	"#else\n"
+	"precision mediump float;\n"
+	"#endif\n"
+	"varying vec2 v_texcoord;\n"
+	"uniform sampler2D tex;\n"
+	"uniform sampler2D tex1;\n"
+	"uniform float lut_size;\n"
+	"uniform float alpha;\n"
+	"void main()\n"
+	"{\n"
+	"   vec3 c = texture2D(tex, v_texcoord).rgb * (lut_size - 1.0);\n"
+	"   float b0 = floor(c.b);\n"
+	"   float b1 = min(b0 + 1.0, lut_size - 1.0);\n"
+	"   vec2 uv = vec2((c.r + 0.5) / (lut_size * lut_size),\n"
+	"                  (c.g + 0.5) / lut_size);\n"
+	"   vec3 c0 = texture2D(tex1, uv + vec2(b0 / lut_size, 0.0)).rgb;\n"
+	"   vec3 c1 = texture2D(tex1, uv + vec2(b1 / lut_size, 0.0)).rgb;\n"
+	"   gl_FragColor = vec4(mix(c0, c1, c.b - b0), 1.0);\n"
+	;
+
 static const char solid_fragment_shader[] =
 	"precision mediump float;\n"
 	"uniform vec4 color;\n"
@@ -2041,6 +5583,145 @@ compile_shader(GLenum type, int count, const char **sources)
 	return s;
 }
 
+/* FNV-1a, which is plenty to tell shader sources and drivers apart */
+static uint64_t
+shader_cache_hash(uint64_t hash, const char *str)
+{
+	while (*str) {
+		hash ^= (unsigned char) *str++;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+#define SHADER_CACHE_MAGIC 0x57534331	/* "WSC1" */
+
+struct shader_cache_header {
+	uint32_t magic;
+	uint32_t format;
+	uint32_t length;
+};
+
+static int
+shader_cache_path(struct gl_renderer *gr, char *path, size_t size,
+		  const char *vertex_source, const char **sources, int count)
+{
+	uint64_t hash;
+	int i;
+
+	hash = shader_cache_hash(gr->shader_cache_key, vertex_source);
+	for (i = 0; i < count; i++)
+		hash = shader_cache_hash(hash, sources[i]);
+
+	return snprintf(path, size, "%s/%016" PRIx64 ".bin",
+			gr->shader_cache_dir, hash) < (int) size ? 0 : -1;
+}
+
+/* Load a program linked by an earlier run, sparing the compile */
+static int
+shader_cache_load(struct gl_shader *shader, struct gl_renderer *gr,
+		  const char *vertex_source, const char **sources, int count)
+{
+#ifdef GL_OES_get_program_binary
+	struct shader_cache_header header;
+	char path[PATH_MAX];
+	void *binary = NULL;
+	GLuint program;
+	GLint status;
+	FILE *fp;
+
+	if (!gr->shader_cache_dir ||
+	    shader_cache_path(gr, path, sizeof path,
+			      vertex_source, sources, count) < 0)
+		return -1;
+
+	fp = fopen(path, "re");
+	if (!fp)
+		return -1;
+
+	if (fread(&header, sizeof header, 1, fp) != 1 ||
+	    header.magic != SHADER_CACHE_MAGIC ||
+	    !(binary = malloc(header.length)) ||
+	    fread(binary, header.length, 1, fp) != 1) {
+		free(binary);
+		fclose(fp);
+		return -1;
+	}
+	fclose(fp);
+
+	/* A driver update may still refuse the binary; then recompile */
+	program = glCreateProgram();
+	gr->program_binary(program, header.format, binary, header.length);
+	free(binary);
+
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		glDeleteProgram(program);
+		return -1;
+	}
+
+	shader->program = program;
+
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+static void
+shader_cache_store(struct gl_shader *shader, struct gl_renderer *gr,
+		   const char *vertex_source, const char **sources, int count)
+{
+#ifdef GL_OES_get_program_binary
+	struct shader_cache_header header;
+	char path[PATH_MAX], tmp[PATH_MAX + 4];
+	GLint length = 0;
+	GLsizei written;
+	GLenum format;
+	void *binary;
+	FILE *fp;
+	int ok;
+
+	if (!gr->shader_cache_dir ||
+	    shader_cache_path(gr, path, sizeof path,
+			      vertex_source, sources, count) < 0)
+		return;
+
+	glGetProgramiv(shader->program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+	if (length <= 0)
+		return;
+
+	binary = malloc(length);
+	if (!binary)
+		return;
+
+	gr->get_program_binary(shader->program, length, &written,
+			       &format, binary);
+
+	header.magic = SHADER_CACHE_MAGIC;
+	header.format = format;
+	header.length = written;
+
+	/* Write a temporary file and rename it, so that a crash or a
+	 * second compositor never leaves a torn binary behind. */
+	snprintf(tmp, sizeof tmp, "%s.tmp", path);
+	fp = fopen(tmp, "we");
+	if (!fp) {
+		free(binary);
+		return;
+	}
+
+	ok = fwrite(&header, sizeof header, 1, fp) == 1 &&
+	     fwrite(binary, written, 1, fp) == 1;
+	ok = fclose(fp) == 0 && ok;
+	free(binary);
+
+	if (!ok || rename(tmp, path) < 0)
+		unlink(tmp);
+#endif
+}
+
 static int
 shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		   const char *vertex_source, const char *fragment_source)
@@ -2050,9 +5731,6 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 	int count;
 	const char *sources[3];
 
-	shader->vertex_shader =
-		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
-
 	if (renderer->fragment_shader_debug) {
 		sources[0] = fragment_source;
 		sources[1] = fragment_debug;
@@ -2064,6 +5742,13 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		count = 2;
 	}
 
+	if (shader_cache_load(shader, renderer,
+			      vertex_source, sources, count) == 0)
+		goto uniforms;
+
+	shader->vertex_shader =
+		compile_shader(GL_VERTEX_SHADER, 1, &vertex_source);
+
 	shader->fragment_shader =
 		compile_shader(GL_FRAGMENT_SHADER, count, sources);
 
@@ -2081,12 +5766,17 @@ shader_init(struct gl_shader *shader, struct gl_renderer *renderer,
 		return -1;
 	}
 
+	shader_cache_store(shader, renderer, vertex_source, sources, count);
+
+uniforms:
 	shader->proj_uniform = glGetUniformLocation(shader->program, "proj");
 	shader->tex_uniforms[0] = glGetUniformLocation(shader->program, "tex");
 	shader->tex_uniforms[1] = glGetUniformLocation(shader->program, "tex1");
 	shader->tex_uniforms[2] = glGetUniformLocation(shader->program, "tex2");
 	shader->alpha_uniform = glGetUniformLocation(shader->program, "alpha");
 	shader->color_uniform = glGetUniformLocation(shader->program, "color");
+	shader->lut_size_uniform =
+		glGetUniformLocation(shader->program, "lut_size");
 
 	return 0;
 }
@@ -2350,16 +6040,50 @@ gl_renderer_output_create(struct weston_output *output,
 	return 0;
 }
 
+static void
+output_timer_queries_release(struct gl_renderer *gr,
+			     struct gl_output_state *go)
+{
+#ifdef GL_EXT_disjoint_timer_query
+	struct gl_timer_query *q;
+
+	wl_array_for_each(q, &go->timer_queries)
+		gr->delete_queries(1, &q->query);
+#endif
+	go->timer_queries.size = 0;
+}
+
 static void
 gl_renderer_output_destroy(struct weston_output *output)
 {
 	struct gl_renderer *gr = get_renderer(output->compositor);
 	struct gl_output_state *go = get_output_state(output);
+	struct gl_readback *rb;
 	int i;
 
-	for (i = 0; i < 2; i++)
+	for (i = 0; i < BUFFER_DAMAGE_COUNT; i++)
 		pixman_region32_fini(&go->buffer_damage[i]);
 
+	for (i = 0; i < (int) ARRAY_LENGTH(go->readback); i++) {
+		rb = &go->readback[i];
+#ifdef EGL_KHR_fence_sync
+		if (rb->sync != EGL_NO_SYNC_KHR)
+			gr->destroy_sync(gr->egl_display, rb->sync);
+#endif
+		if (rb->pbo)
+			glDeleteBuffers(1, &rb->pbo);
+	}
+
+	if (use_output(output) == 0) {
+		output_offscreen_release(go);
+		output_color_lut_release(go);
+		output_layer_cache_release(go);
+		output_timer_queries_release(gr, go);
+	}
+	wl_array_release(&go->timer_queries);
+	wl_array_release(&go->layer_cache.views);
+	wl_array_release(&go->layer_cache.next_views);
+
 	eglDestroySurface(gr->egl_display, go->egl_surface);
 
 	free(go);
@@ -2376,9 +6100,19 @@ gl_renderer_destroy(struct weston_compositor *ec)
 {
 	struct gl_renderer *gr = get_renderer(ec);
 	struct egl_image *image, *next;
+	struct egl_buffer_state *ebs, *ebs_next;
+	struct shm_import_state *sis, *sis_next;
+	struct gl_copy_job *job, *job_next;
 
 	wl_signal_emit(&gr->destroy_signal, gr);
 
+	dmabuf_import_stop(gr);
+
+	wl_list_for_each_safe(job, job_next, &gr->copy_jobs, link)
+		gl_copy_job_finish(gr, job, 0);
+	if (gr->copy_timer)
+		wl_event_source_remove(gr->copy_timer);
+
 	if (gr->has_bind_display)
 		gr->unbind_display(gr->egl_display, ec->wl_display);
 
@@ -2388,6 +6122,14 @@ gl_renderer_destroy(struct weston_compositor *ec)
 		       EGL_NO_CONTEXT);
 
 
+	wl_list_for_each_safe(ebs, ebs_next, &gr->egl_buffers, link)
+		egl_buffer_state_destroy(ebs);
+
+	wl_list_for_each_safe(sis, sis_next, &gr->shm_imports, link)
+		shm_import_state_destroy(sis);
+	if (gr->udmabuf_fd >= 0)
+		close(gr->udmabuf_fd);
+
 	wl_list_for_each_safe(image, next, &gr->dmabuf_images, link) {
 		int ret;
 
@@ -2399,13 +6141,21 @@ gl_renderer_destroy(struct weston_compositor *ec)
 	eglReleaseThread();
 
 	wl_array_release(&gr->vertices);
+	wl_array_release(&gr->geometry_key);
 	wl_array_release(&gr->vtxcnt);
+	wl_array_release(&gr->indices);
+	wl_array_release(&gr->free_queries);
 
 	if (gr->fragment_binding)
 		weston_binding_destroy(gr->fragment_binding);
 	if (gr->fan_binding)
 		weston_binding_destroy(gr->fan_binding);
+	if (gr->texture_binding)
+		weston_binding_destroy(gr->texture_binding);
+	if (gr->gpu_timing_binding)
+		weston_binding_destroy(gr->gpu_timing_binding);
 
+	free(gr->shader_cache_dir);
 	free(gr);
 }
 
@@ -2458,14 +6208,20 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 			gr->has_bind_display = 0;
 	}
 
-	if (strstr(extensions, "EGL_EXT_buffer_age"))
+	/* EGL_KHR_partial_update brings its own buffer age query with
+	 * the same token. */
+	if (strstr(extensions, "EGL_EXT_buffer_age") ||
+	    strstr(extensions, "EGL_KHR_partial_update"))
 		gr->has_egl_buffer_age = 1;
 	else
 		weston_log("warning: EGL_EXT_buffer_age not supported. "
 			   "Performance could be affected.\n");
 
 #ifdef EGL_EXT_swap_buffers_with_damage
-	if (strstr(extensions, "EGL_EXT_swap_buffers_with_damage"))
+	if (strstr(extensions, "EGL_KHR_swap_buffers_with_damage"))
+		gr->swap_buffers_with_damage =
+			(void *) eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+	else if (strstr(extensions, "EGL_EXT_swap_buffers_with_damage"))
 		gr->swap_buffers_with_damage =
 			(void *) eglGetProcAddress("eglSwapBuffersWithDamageEXT");
 	else
@@ -2473,11 +6229,43 @@ gl_renderer_setup_egl_extensions(struct weston_compositor *ec)
 			   "supported. Performance could be affected.\n");
 #endif
 
+#ifdef EGL_KHR_partial_update
+	if (strstr(extensions, "EGL_KHR_partial_update"))
+		gr->set_damage_region =
+			(void *) eglGetProcAddress("eglSetDamageRegionKHR");
+#endif
+
 #ifdef EGL_MESA_configless_context
 	if (strstr(extensions, "EGL_MESA_configless_context"))
 		gr->has_configless_context = 1;
 #endif
 
+#ifdef EGL_KHR_fence_sync
+	if (strstr(extensions, "EGL_KHR_fence_sync")) {
+		gr->create_sync =
+			(void *) eglGetProcAddress("eglCreateSyncKHR");
+		gr->destroy_sync =
+			(void *) eglGetProcAddress("eglDestroySyncKHR");
+		gr->client_wait_sync =
+			(void *) eglGetProcAddress("eglClientWaitSyncKHR");
+		gr->has_fence_sync = gr->create_sync && gr->destroy_sync &&
+			gr->client_wait_sync;
+	}
+#endif
+
+#if defined(EGL_ANDROID_native_fence_sync) && defined(EGL_KHR_wait_sync)
+	if (gr->has_fence_sync &&
+	    strstr(extensions, "EGL_ANDROID_native_fence_sync") &&
+	    strstr(extensions, "EGL_KHR_wait_sync")) {
+		gr->dup_native_fence_fd = (void *)
+			eglGetProcAddress("eglDupNativeFenceFDANDROID");
+		gr->wait_sync =
+			(void *) eglGetProcAddress("eglWaitSyncKHR");
+		gr->has_native_fence_sync = gr->dup_native_fence_fd &&
+			gr->wait_sync;
+	}
+#endif
+
 #ifdef EGL_EXT_image_dma_buf_import
 	if (strstr(extensions, "EGL_EXT_image_dma_buf_import"))
 		gr->has_dmabuf_import = 1;
@@ -2593,6 +6381,7 @@ gl_renderer_create(struct weston_compositor *ec, EGLenum platform,
 	struct gl_renderer *gr;
 	EGLint major, minor;
 	int supports = 0;
+	unsigned int i;
 
 	if (platform) {
 		supports = gl_renderer_supports(
@@ -2606,14 +6395,20 @@ gl_renderer_create(struct weston_compositor *ec, EGLenum platform,
 		return -1;
 
 	gr->base.read_pixels = gl_renderer_read_pixels;
+	gr->base.queue_read_pixels = gl_renderer_queue_read_pixels;
+	gr->base.finish_read_pixels = gl_renderer_finish_read_pixels;
 	gr->base.repaint_output = gl_renderer_repaint_output;
 	gr->base.flush_damage = gl_renderer_flush_damage;
 	gr->base.attach = gl_renderer_attach;
 	gr->base.surface_set_color = gl_renderer_surface_set_color;
+	gr->base.surface_set_image = gl_renderer_surface_set_image;
+	gr->base.output_set_color_lut = gl_renderer_output_set_color_lut;
 	gr->base.destroy = gl_renderer_destroy;
 	gr->base.surface_get_content_size =
 		gl_renderer_surface_get_content_size;
 	gr->base.surface_copy_content = gl_renderer_surface_copy_content;
+	gr->base.surface_copy_content_async =
+		gl_renderer_surface_copy_content_async;
 	gr->egl_display = NULL;
 
 	/* extension_suffix is supported */
@@ -2661,15 +6456,31 @@ gl_renderer_create(struct weston_compositor *ec, EGLenum platform,
 	ec->capabilities |= WESTON_CAP_ROTATION_ANY;
 	ec->capabilities |= WESTON_CAP_CAPTURE_YFLIP;
 	ec->capabilities |= WESTON_CAP_VIEW_CLIP_MASK;
+	ec->capabilities |= WESTON_CAP_ZOOM_OFFSCREEN;
 
 	if (gl_renderer_setup_egl_extensions(ec) < 0)
 		goto fail_with_error;
 
+	if (gr->has_native_fence_sync)
+		ec->capabilities |= WESTON_CAP_EXPLICIT_SYNC;
+
 	wl_list_init(&gr->dmabuf_images);
-	if (gr->has_dmabuf_import)
+	wl_list_init(&gr->egl_buffers);
+	wl_list_init(&gr->shm_imports);
+	wl_list_init(&gr->copy_jobs);
+	gr->udmabuf_fd = -1;
+	wl_list_init(&gr->atlases);
+	wl_list_init(&gr->texture_lru);
+	if (gr->has_dmabuf_import) {
 		gr->base.import_dmabuf = gl_renderer_import_dmabuf;
+		gr->base.import_dmabuf_async = gl_renderer_import_dmabuf_async;
+		gr->base.copy_to_dmabuf = gl_renderer_copy_to_dmabuf;
+	}
 
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
+	for (i = 0; i < ARRAY_LENGTH(yuv_shm_formats); i++)
+		wl_display_add_shm_format(ec->wl_display,
+					  yuv_shm_formats[i].format);
 
 	wl_signal_init(&gr->destroy_signal);
 
@@ -2690,6 +6501,53 @@ gl_renderer_display(struct weston_compositor *ec)
 	return get_renderer(ec)->egl_display;
 }
 
+/* Programs are cached in $XDG_CACHE_HOME/weston, or ~/.cache/weston */
+static void
+shader_cache_init(struct gl_renderer *gr)
+{
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	const char *strings[3];
+	char *parent = NULL;
+	uint64_t key = 0xcbf29ce484222325ULL;
+	GLint formats = 0;
+	unsigned i;
+
+#ifdef GL_OES_get_program_binary
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+#endif
+	if (formats == 0)
+		return;
+
+	strings[0] = (const char *) glGetString(GL_VENDOR);
+	strings[1] = (const char *) glGetString(GL_RENDERER);
+	strings[2] = (const char *) glGetString(GL_VERSION);
+	for (i = 0; i < ARRAY_LENGTH(strings); i++) {
+		if (!strings[i])
+			return;
+		key = shader_cache_hash(key, strings[i]);
+	}
+	gr->shader_cache_key = key;
+
+	if (cache_home && cache_home[0] == '/')
+		parent = strdup(cache_home);
+	else if (home && asprintf(&parent, "%s/.cache", home) < 0)
+		parent = NULL;
+	if (!parent)
+		return;
+
+	if (asprintf(&gr->shader_cache_dir, "%s/weston", parent) < 0) {
+		gr->shader_cache_dir = NULL;
+	} else if ((mkdir(parent, 0700) < 0 && errno != EEXIST) ||
+		   (mkdir(gr->shader_cache_dir, 0700) < 0 && errno != EEXIST)) {
+		weston_log("shader cache disabled, cannot create %s: %m\n",
+			   gr->shader_cache_dir);
+		free(gr->shader_cache_dir);
+		gr->shader_cache_dir = NULL;
+	}
+	free(parent);
+}
+
 static int
 compile_shaders(struct weston_compositor *ec)
 {
@@ -2716,6 +6574,21 @@ compile_shaders(struct weston_compositor *ec)
 	gr->texture_shader_y_xuxv.fragment_source =
 		texture_fragment_shader_y_xuxv;
 
+	gr->texture_shader_rgba_noalpha.vertex_source = vertex_shader;
+	gr->texture_shader_rgba_noalpha.fragment_source =
+		texture_fragment_shader_rgba_noalpha;
+
+	gr->texture_shader_opaque.vertex_source = vertex_shader;
+	gr->texture_shader_opaque.fragment_source =
+		texture_fragment_shader_opaque;
+
+	gr->texture_shader_egl_external_noalpha.vertex_source = vertex_shader;
+	gr->texture_shader_egl_external_noalpha.fragment_source =
+		texture_fragment_shader_egl_external_noalpha;
+
+	gr->color_lut_shader.vertex_source = vertex_shader;
+	gr->color_lut_shader.fragment_source = color_lut_fragment_shader;
+
 	gr->solid_shader.vertex_source = vertex_shader;
 	gr->solid_shader.fragment_source = solid_fragment_shader;
 
@@ -2738,6 +6611,10 @@ fragment_debug_binding(struct weston_keyboard *keyboard, uint32_t time,
 	shader_release(&gr->texture_shader_y_uv);
 	shader_release(&gr->texture_shader_y_u_v);
 	shader_release(&gr->texture_shader_y_xuxv);
+	shader_release(&gr->texture_shader_rgba_noalpha);
+	shader_release(&gr->texture_shader_opaque);
+	shader_release(&gr->texture_shader_egl_external_noalpha);
+	shader_release(&gr->color_lut_shader);
 	shader_release(&gr->solid_shader);
 
 	/* Force use_shader() to call glUseProgram(), since we need to use
@@ -2759,13 +6636,234 @@ fan_debug_repaint_binding(struct weston_keyboard *keyboard, uint32_t time,
 	weston_compositor_damage_all(compositor);
 }
 
+/* Log the texture memory of every surface, least recently shown last */
+static void
+texture_memory_binding(struct weston_keyboard *keyboard, uint32_t time,
+		       uint32_t key, void *data)
+{
+	struct weston_compositor *ec = data;
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_surface_state *gs;
+	char label[64];
+
+	weston_log("GL renderer: %zu KiB of SHM textures, budget %zu KiB\n",
+		   gr->texture_bytes / 1024, gr->texture_budget / 1024);
+
+	wl_list_for_each(gs, &gr->texture_lru, lru_link) {
+		if (!gs->texture_bytes && !gs->evicted)
+			continue;
+
+		if (!gs->surface->get_label ||
+		    gs->surface->get_label(gs->surface, label,
+					   sizeof label) < 0)
+			snprintf(label, sizeof label, "unlabelled");
+
+		weston_log_continue(STAMP_SPACE "%s: %dx%d, %zu KiB%s%s%s\n",
+				    label, gs->pitch, gs->height,
+				    gs->texture_bytes / 1024,
+				    gs->atlas ? ", in an atlas" : "",
+				    gs->has_mipmaps ? ", mipmapped" : "",
+				    gs->evicted ? ", evicted" :
+				    surface_in_render_list(gs->surface) ?
+				    ", shown" : "");
+	}
+}
+
+static void
+gpu_timing_start(struct weston_compositor *ec)
+{
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_surface_state *gs;
+	struct weston_output *output;
+	struct gl_output_state *go;
+
+	wl_list_for_each(gs, &gr->texture_lru, lru_link) {
+		gs->gpu_time = 0;
+		gs->gpu_draws = 0;
+	}
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		go = get_output_state(output);
+		if (!go)
+			continue;
+
+		go->gpu_time = 0;
+		go->gpu_frame_max = 0;
+		go->gpu_frames = 0;
+	}
+
+	weston_compositor_read_presentation_clock(ec, &gr->gpu_timing_start);
+	gr->gpu_timing = 1;
+}
+
+struct gpu_client_time {
+	struct wl_client *client;
+	uint64_t gpu_time;
+	uint32_t gpu_draws;
+};
+
+static struct wl_client *
+surface_state_client(struct gl_surface_state *gs)
+{
+	if (!gs->surface->resource)
+		return NULL;
+
+	return wl_resource_get_client(gs->surface->resource);
+}
+
+static struct gpu_client_time *
+gpu_client_time_get(struct wl_array *clients, struct wl_client *client)
+{
+	struct gpu_client_time *ct;
+
+	wl_array_for_each(ct, clients)
+		if (ct->client == client)
+			return ct;
+
+	ct = wl_array_add(clients, sizeof *ct);
+	if (!ct)
+		return NULL;
+
+	ct->client = client;
+	ct->gpu_time = 0;
+	ct->gpu_draws = 0;
+
+	return ct;
+}
+
+static int
+gpu_client_time_compare(const void *a, const void *b)
+{
+	const struct gpu_client_time *ca = a, *cb = b;
+
+	if (ca->gpu_time == cb->gpu_time)
+		return 0;
+
+	return ca->gpu_time < cb->gpu_time ? 1 : -1;
+}
+
+/* Log the GPU time spent on each output, client and surface since
+ * timing started, the busiest clients first */
+static void
+gpu_timing_dump(struct weston_compositor *ec)
+{
+	struct gl_renderer *gr = get_renderer(ec);
+	struct gl_surface_state *gs;
+	struct weston_output *output;
+	struct gl_output_state *go;
+	struct gpu_client_time *ct;
+	struct wl_array clients;
+	struct timespec now, elapsed;
+	uint64_t wall;
+	char label[64];
+	pid_t pid;
+
+	weston_compositor_read_presentation_clock(ec, &now);
+	timespec_sub(&elapsed, &now, &gr->gpu_timing_start);
+	wall = timespec_to_nsec(&elapsed);
+	if (wall == 0)
+		wall = 1;
+
+	weston_log("GL renderer: GPU time over %" PRIu64 " ms\n",
+		   wall / 1000000);
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		go = get_output_state(output);
+		if (!go)
+			continue;
+
+		weston_log_continue(STAMP_SPACE "output %s: %u frames, "
+				    "%" PRIu64 " us average, "
+				    "%" PRIu64 " us max\n",
+				    output->name, go->gpu_frames,
+				    go->gpu_frames ?
+				    go->gpu_time / go->gpu_frames / 1000 : 0,
+				    go->gpu_frame_max / 1000);
+	}
+
+	wl_array_init(&clients);
+	wl_list_for_each(gs, &gr->texture_lru, lru_link) {
+		if (!gs->gpu_draws)
+			continue;
+
+		ct = gpu_client_time_get(&clients, surface_state_client(gs));
+		if (!ct)
+			continue;
+
+		ct->gpu_time += gs->gpu_time;
+		ct->gpu_draws += gs->gpu_draws;
+	}
+
+	qsort(clients.data, clients.size / sizeof *ct, sizeof *ct,
+	      gpu_client_time_compare);
+
+	wl_array_for_each(ct, &clients) {
+		pid = 0;
+		if (ct->client)
+			wl_client_get_credentials(ct->client, &pid,
+						  NULL, NULL);
+
+		weston_log_continue(STAMP_SPACE "%s %d: %" PRIu64 " us in "
+				    "%u draws, %.1f%% of the time\n",
+				    ct->client ? "client" : "compositor",
+				    pid, ct->gpu_time / 1000, ct->gpu_draws,
+				    100.0 * ct->gpu_time / wall);
+
+		wl_list_for_each(gs, &gr->texture_lru, lru_link) {
+			if (!gs->gpu_draws ||
+			    surface_state_client(gs) != ct->client)
+				continue;
+
+			if (!gs->surface->get_label ||
+			    gs->surface->get_label(gs->surface, label,
+						   sizeof label) < 0)
+				snprintf(label, sizeof label, "unlabelled");
+
+			weston_log_continue(STAMP_SPACE "  %s: %" PRIu64
+					    " us in %u draws\n", label,
+					    gs->gpu_time / 1000,
+					    gs->gpu_draws);
+		}
+	}
+
+	wl_array_release(&clients);
+}
+
+/* The first press starts timing the draws on the GPU, the second one
+ * logs the results and stops */
+static void
+gpu_timing_binding(struct weston_keyboard *keyboard, uint32_t time,
+		   uint32_t key, void *data)
+{
+	struct weston_compositor *ec = data;
+	struct gl_renderer *gr = get_renderer(ec);
+
+	if (!gr->has_timer_query) {
+		weston_log("GL renderer: GPU timing needs "
+			   "GL_EXT_disjoint_timer_query\n");
+		return;
+	}
+
+	if (gr->gpu_timing) {
+		gr->gpu_timing = 0;
+		gpu_timing_dump(ec);
+	} else {
+		gpu_timing_start(ec);
+		weston_log("GL renderer: GPU timing started\n");
+	}
+}
+
 static int
 gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 {
 	struct gl_renderer *gr = get_renderer(ec);
+	struct weston_config_section *section;
 	const char *extensions;
+	const char *version;
 	EGLConfig context_config;
 	EGLBoolean ret;
+	uint32_t budget;
+	int gpu_timing;
 
 	static const EGLint context_attribs[] = {
 		EGL_CONTEXT_CLIENT_VERSION, 2,
@@ -2830,6 +6928,72 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 	if (strstr(extensions, "GL_OES_EGL_image_external"))
 		gr->has_egl_image_external = 1;
 
+	version = (const char *) glGetString(GL_VERSION);
+
+	if (strstr(extensions, "GL_OES_texture_npot") ||
+	    (version && !strncmp(version, "OpenGL ES 3", 11)))
+		gr->has_npot_mipmap = 1;
+	if (version && !strncmp(version, "OpenGL ES 3", 11)) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRange");
+		gr->unmap_buffer = (void *) eglGetProcAddress("glUnmapBuffer");
+	} else if (strstr(extensions, "GL_NV_pixel_buffer_object") &&
+		   strstr(extensions, "GL_EXT_map_buffer_range") &&
+		   strstr(extensions, "GL_OES_mapbuffer")) {
+		gr->map_buffer_range =
+			(void *) eglGetProcAddress("glMapBufferRangeEXT");
+		gr->unmap_buffer =
+			(void *) eglGetProcAddress("glUnmapBufferOES");
+	}
+
+	if (gr->map_buffer_range && gr->unmap_buffer &&
+	    !getenv("WESTON_GL_DISABLE_PBO")) {
+		glGenBuffers(ARRAY_LENGTH(gr->upload_pbo), gr->upload_pbo);
+		gr->has_pbo = 1;
+	}
+
+	gr->has_atlas = !getenv("WESTON_GL_DISABLE_ATLAS");
+
+#ifdef HAVE_LINUX_UDMABUF_H
+	if (gr->has_dmabuf_import && !getenv("WESTON_GL_DISABLE_UDMABUF")) {
+		if (shm_pool_open_allowed())
+			gr->udmabuf_fd = open("/dev/udmabuf",
+					      O_RDWR | O_CLOEXEC);
+		else
+			weston_log("wl_shm import: map_files not permitted, "
+				   "buffers are copied\n");
+	}
+#endif
+
+#ifdef GL_OES_get_program_binary
+	if (strstr(extensions, "GL_OES_get_program_binary") &&
+	    !getenv("WESTON_GL_DISABLE_SHADER_CACHE")) {
+		gr->get_program_binary =
+			(void *) eglGetProcAddress("glGetProgramBinaryOES");
+		gr->program_binary =
+			(void *) eglGetProcAddress("glProgramBinaryOES");
+		if (gr->get_program_binary && gr->program_binary)
+			shader_cache_init(gr);
+	}
+#endif
+
+#ifdef GL_EXT_disjoint_timer_query
+	if (strstr(extensions, "GL_EXT_disjoint_timer_query")) {
+		gr->gen_queries =
+			(void *) eglGetProcAddress("glGenQueriesEXT");
+		gr->delete_queries =
+			(void *) eglGetProcAddress("glDeleteQueriesEXT");
+		gr->begin_query =
+			(void *) eglGetProcAddress("glBeginQueryEXT");
+		gr->end_query = (void *) eglGetProcAddress("glEndQueryEXT");
+		gr->get_query_object_ui64v =
+			(void *) eglGetProcAddress("glGetQueryObjectui64vEXT");
+		gr->has_timer_query = gr->gen_queries && gr->delete_queries &&
+				      gr->begin_query && gr->end_query &&
+				      gr->get_query_object_ui64v;
+	}
+#endif
+
 	glActiveTexture(GL_TEXTURE0);
 
 	if (compile_shaders(ec))
@@ -2843,14 +7007,43 @@ gl_renderer_setup(struct weston_compositor *ec, EGLSurface egl_surface)
 		weston_compositor_add_debug_binding(ec, KEY_F,
 						    fan_debug_repaint_binding,
 						    ec);
+	gr->texture_binding =
+		weston_compositor_add_debug_binding(ec, KEY_M,
+						    texture_memory_binding,
+						    ec);
+	gr->gpu_timing_binding =
+		weston_compositor_add_debug_binding(ec, KEY_G,
+						    gpu_timing_binding,
+						    ec);
+
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_uint(section, "gl-texture-budget",
+				       &budget, 0);
+	gr->texture_budget = (size_t) budget * 1024 * 1024;
+	weston_config_section_get_bool(section, "gl-gpu-timing",
+				       &gpu_timing, 0);
+	if (gpu_timing && gr->has_timer_query)
+		gpu_timing_start(ec);
 
 	weston_log("GL ES 2 renderer features:\n");
 	weston_log_continue(STAMP_SPACE "read-back format: %s\n",
 		ec->read_format == PIXMAN_a8r8g8b8 ? "BGRA" : "RGBA");
 	weston_log_continue(STAMP_SPACE "wl_shm sub-image to texture: %s\n",
 			    gr->has_unpack_subimage ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "wl_shm pixel buffer uploads: %s\n",
+			    gr->has_pbo ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "small wl_shm surfaces in atlases: %s\n",
+			    gr->has_atlas ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "asynchronous read-back: %s\n",
+			    gr->has_pbo ? (gr->has_fence_sync ?
+					   "yes" : "yes, without fences") :
+			    "no");
 	weston_log_continue(STAMP_SPACE "EGL Wayland extension: %s\n",
 			    gr->has_bind_display ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "explicit synchronization: %s\n",
+			    gr->has_native_fence_sync ? "yes" : "no");
+	weston_log_continue(STAMP_SPACE "GPU timer queries: %s\n",
+			    gr->has_timer_query ? "yes" : "no");
 
 
 	return 0;
@@ -2866,5 +7059,6 @@ WL_EXPORT struct gl_renderer_interface gl_renderer_interface = {
 	.output_destroy = gl_renderer_output_destroy,
 	.output_surface = gl_renderer_output_surface,
 	.output_set_border = gl_renderer_output_set_border,
-	.print_egl_error_state = gl_renderer_print_egl_error_state
+	.print_egl_error_state = gl_renderer_print_egl_error_state,
+	.output_create_fence_fd = gl_renderer_output_create_fence_fd
 };
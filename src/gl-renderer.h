@@ -128,5 +128,10 @@ struct gl_renderer_interface {
 				  int32_t tex_width, unsigned char *data);
 
 	void (*print_egl_error_state)(void);
+
+	/* Returns a sync_file fd that signals once the GPU has finished
+	 * everything submitted for the output so far, the last repaint
+	 * included, or -1 without EGL_ANDROID_native_fence_sync. */
+	int (*output_create_fence_fd)(struct weston_output *output);
 };
 
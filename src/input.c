@@ -27,8 +27,11 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <assert.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -37,6 +40,8 @@
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
 #include "compositor.h"
+#include "timeline.h"
+#include "frame-stats.h"
 
 static void
 empty_region(pixman_region32_t *region)
@@ -50,6 +55,115 @@ static void unbind_resource(struct wl_resource *resource)
 	wl_list_remove(wl_resource_get_link(resource));
 }
 
+/*
+ * The pointer, keyboard and touch resources of clients that do not
+ * have focus are kept in one group per client and device, so a focus
+ * change only touches the resources of the clients involved.  A
+ * client's groups hang off a destroy listener on the wl_client, which
+ * wl_client_get_destroy_listener() finds without looking at any other
+ * client.  Groups are identified by the address of the device's
+ * resource_groups list.
+ */
+struct input_client {
+	struct wl_listener destroy_listener;
+	struct wl_list groups; /* input_resource_group::client_link */
+};
+
+struct input_resource_group {
+	struct wl_list *device;
+	struct wl_list resource_list;
+	struct wl_list client_link;
+	struct wl_list device_link;
+};
+
+static void
+input_resource_group_destroy(struct input_resource_group *group)
+{
+	struct wl_resource *resource, *tmp;
+
+	/* The resources go away on their own later, unlink them so
+	 * unbind_resource() does not touch the freed list head. */
+	wl_resource_for_each_safe(resource, tmp, &group->resource_list)
+		wl_list_init(wl_resource_get_link(resource));
+
+	wl_list_remove(&group->client_link);
+	wl_list_remove(&group->device_link);
+	free(group);
+}
+
+static void
+input_client_destroyed(struct wl_listener *listener, void *data)
+{
+	struct input_client *input_client =
+		container_of(listener, struct input_client, destroy_listener);
+	struct input_resource_group *group, *next;
+
+	wl_list_for_each_safe(group, next, &input_client->groups, client_link)
+		input_resource_group_destroy(group);
+
+	wl_list_remove(&input_client->destroy_listener.link);
+	free(input_client);
+}
+
+static void
+destroy_resource_groups(struct wl_list *device)
+{
+	struct input_resource_group *group, *next;
+
+	wl_list_for_each_safe(group, next, device, device_link)
+		input_resource_group_destroy(group);
+}
+
+/** Find the list a client's unfocused resources for a device live in
+ *
+ * \param device The resource_groups list of the pointer, keyboard or touch
+ * \param client The client
+ * \param create Whether to create the list if the client has none yet
+ * \return The resource list, or NULL
+ */
+static struct wl_list *
+client_resources(struct wl_list *device, struct wl_client *client,
+		 bool create)
+{
+	struct wl_listener *listener;
+	struct input_client *input_client;
+	struct input_resource_group *group;
+
+	listener = wl_client_get_destroy_listener(client,
+						  input_client_destroyed);
+	if (listener) {
+		input_client = container_of(listener, struct input_client,
+					    destroy_listener);
+		wl_list_for_each(group, &input_client->groups, client_link)
+			if (group->device == device)
+				return &group->resource_list;
+	} else {
+		if (!create)
+			return NULL;
+
+		input_client = zalloc(sizeof *input_client);
+		if (!input_client)
+			return NULL;
+		wl_list_init(&input_client->groups);
+		input_client->destroy_listener.notify = input_client_destroyed;
+		wl_client_add_destroy_listener(client,
+					       &input_client->destroy_listener);
+	}
+
+	if (!create)
+		return NULL;
+
+	group = zalloc(sizeof *group);
+	if (!group)
+		return NULL;
+	group->device = device;
+	wl_list_init(&group->resource_list);
+	wl_list_insert(&input_client->groups, &group->client_link);
+	wl_list_insert(device, &group->device_link);
+
+	return &group->resource_list;
+}
+
 WL_EXPORT void
 weston_seat_repick(struct weston_seat *seat)
 {
@@ -125,26 +239,41 @@ touch_focus_resource_destroyed(struct wl_listener *listener, void *data)
 	weston_touch_set_focus(touch, NULL);
 }
 
+/* Give the focus resources, which all belong to one client, back to
+ * that client's group */
 static void
-move_resources(struct wl_list *destination, struct wl_list *source)
+move_resources(struct wl_list *device, struct wl_list *source)
 {
-	wl_list_insert_list(destination, source);
+	struct wl_resource *resource, *tmp;
+	struct wl_list *destination;
+
+	if (wl_list_empty(source))
+		return;
+
+	resource = wl_resource_from_link(source->next);
+	destination = client_resources(device,
+				       wl_resource_get_client(resource), true);
+	if (destination) {
+		wl_list_insert_list(destination, source);
+	} else {
+		wl_resource_for_each_safe(resource, tmp, source)
+			wl_list_init(wl_resource_get_link(resource));
+	}
 	wl_list_init(source);
 }
 
 static void
 move_resources_for_client(struct wl_list *destination,
-			  struct wl_list *source,
+			  struct wl_list *device,
 			  struct wl_client *client)
 {
-	struct wl_resource *resource, *tmp;
-	wl_resource_for_each_safe(resource, tmp, source) {
-		if (wl_resource_get_client(resource) == client) {
-			wl_list_remove(wl_resource_get_link(resource));
-			wl_list_insert(destination,
-				       wl_resource_get_link(resource));
-		}
-	}
+	struct wl_list *source = client_resources(device, client, false);
+
+	if (!source)
+		return;
+
+	wl_list_insert_list(destination, source);
+	wl_list_init(source);
 }
 
 static void
@@ -184,6 +313,11 @@ default_grab_pointer_motion(struct weston_pointer_grab *grab, uint32_t time,
 		wl_pointer_send_motion(resource, time,
 				       pointer->sx, pointer->sy);
 	}
+
+	if (!wl_list_empty(resource_list))
+		TL_POINT("core_input_motion_sent",
+			 TLP_SURFACE(pointer->focus->surface),
+			 TLP_INPUT_TIME(&time), TLP_END);
 }
 
 static void
@@ -209,6 +343,9 @@ default_grab_pointer_button(struct weston_pointer_grab *grab,
 					       time,
 					       button,
 					       state_w);
+		TL_POINT("core_input_button_sent",
+			 TLP_SURFACE(pointer->focus->surface),
+			 TLP_INPUT_TIME(&time), TLP_END);
 	}
 
 	if (pointer->button_count == 0 &&
@@ -255,6 +392,9 @@ default_grab_touch_down(struct weston_touch_grab *grab, uint32_t time,
 				wl_touch_send_down(resource, serial, time,
 						   touch->focus->surface->resource,
 						   touch_id, sx, sy);
+		TL_POINT("core_input_touch_sent",
+			 TLP_SURFACE(touch->focus->surface),
+			 TLP_INPUT_TIME(&time), TLP_END);
 	}
 }
 
@@ -294,6 +434,11 @@ default_grab_touch_motion(struct weston_touch_grab *grab, uint32_t time,
 		wl_touch_send_motion(resource, time,
 				     touch_id, sx, sy);
 	}
+
+	if (!wl_list_empty(resource_list))
+		TL_POINT("core_input_touch_sent",
+			 TLP_SURFACE(touch->focus->surface),
+			 TLP_INPUT_TIME(&time), TLP_END);
 }
 
 static void
@@ -337,6 +482,9 @@ default_grab_keyboard_key(struct weston_keyboard_grab *grab,
 					     time,
 					     key,
 					     state);
+		TL_POINT("core_input_key_sent",
+			 TLP_SURFACE(keyboard->focus),
+			 TLP_INPUT_TIME(&time), TLP_END);
 	}
 }
 
@@ -355,39 +503,47 @@ send_modifiers_to_resource(struct weston_keyboard *keyboard,
 
 static void
 send_modifiers_to_client_in_list(struct wl_client *client,
-				 struct wl_list *list,
+				 struct wl_list *device,
 				 uint32_t serial,
 				 struct weston_keyboard *keyboard)
 {
 	struct wl_resource *resource;
+	struct wl_list *list = client_resources(device, client, false);
 
-	wl_resource_for_each(resource, list) {
-		if (wl_resource_get_client(resource) == client)
-			send_modifiers_to_resource(keyboard,
-						   resource,
-						   serial);
-	}
+	if (!list)
+		return;
+
+	wl_resource_for_each(resource, list)
+		send_modifiers_to_resource(keyboard,
+					   resource,
+					   serial);
 }
 
-static struct wl_resource *
-find_resource_for_surface(struct wl_list *list, struct weston_surface *surface)
+static bool
+has_resource_for_surface(struct wl_list *device, struct weston_surface *surface)
 {
+	struct wl_list *list;
+
 	if (!surface)
-		return NULL;
+		return false;
 
 	if (!surface->resource)
-		return NULL;
+		return false;
 
-	return wl_resource_find_for_client(list, wl_resource_get_client(surface->resource));
+	list = client_resources(device,
+				wl_resource_get_client(surface->resource),
+				false);
+
+	return list && !wl_list_empty(list);
 }
 
-static struct wl_resource *
-find_resource_for_view(struct wl_list *list, struct weston_view *view)
+static bool
+has_resource_for_view(struct wl_list *device, struct weston_view *view)
 {
 	if (!view)
-		return NULL;
+		return false;
 
-	return find_resource_for_surface(list, view->surface);
+	return has_resource_for_surface(device, view->surface);
 }
 
 static void
@@ -413,7 +569,7 @@ default_grab_keyboard_modifiers(struct weston_keyboard_grab *grab,
 		struct wl_client *pointer_client =
 			wl_resource_get_client(pointer->focus->surface->resource);
 		send_modifiers_to_client_in_list(pointer_client,
-						 &keyboard->resource_list,
+						 &keyboard->resource_groups,
 						 serial,
 						 keyboard);
 	}
@@ -461,11 +617,15 @@ static void
 weston_pointer_reset_state(struct weston_pointer *pointer)
 {
 	pointer->button_count = 0;
+	pointer->motion_pending = 0;
 }
 
 static void
 weston_pointer_handle_output_destroy(struct wl_listener *listener, void *data);
 
+static int
+pointer_motion_timer_handler(void *data);
+
 WL_EXPORT struct weston_pointer *
 weston_pointer_create(struct weston_seat *seat)
 {
@@ -475,7 +635,7 @@ weston_pointer_create(struct weston_seat *seat)
 	if (pointer == NULL)
 		return NULL;
 
-	wl_list_init(&pointer->resource_list);
+	wl_list_init(&pointer->resource_groups);
 	wl_list_init(&pointer->focus_resource_list);
 	weston_pointer_set_default_grab(pointer,
 					seat->compositor->default_pointer_grab);
@@ -501,6 +661,16 @@ weston_pointer_create(struct weston_seat *seat)
 	pointer->sx = wl_fixed_from_int(-1000000);
 	pointer->sy = wl_fixed_from_int(-1000000);
 
+	if (seat->coalesce_motion) {
+		struct wl_event_loop *loop =
+			wl_display_get_event_loop(seat->compositor->wl_display);
+
+		pointer->motion_timer =
+			wl_event_loop_add_timer(loop,
+						pointer_motion_timer_handler,
+						pointer);
+	}
+
 	return pointer;
 }
 
@@ -510,11 +680,13 @@ weston_pointer_destroy(struct weston_pointer *pointer)
 	if (pointer->sprite)
 		pointer_unmap_sprite(pointer);
 
-	/* XXX: What about pointer->resource_list? */
+	destroy_resource_groups(&pointer->resource_groups);
 
 	wl_list_remove(&pointer->focus_resource_listener.link);
 	wl_list_remove(&pointer->focus_view_listener.link);
 	wl_list_remove(&pointer->output_destroy_listener.link);
+	if (pointer->motion_timer)
+		wl_event_source_remove(pointer->motion_timer);
 	free(pointer);
 }
 
@@ -538,7 +710,7 @@ weston_keyboard_create(void)
 	if (keyboard == NULL)
 	    return NULL;
 
-	wl_list_init(&keyboard->resource_list);
+	wl_list_init(&keyboard->resource_groups);
 	wl_list_init(&keyboard->focus_resource_list);
 	wl_list_init(&keyboard->focus_resource_listener.link);
 	keyboard->focus_resource_listener.notify = keyboard_focus_resource_destroyed;
@@ -557,7 +729,7 @@ weston_xkb_info_destroy(struct weston_xkb_info *xkb_info);
 WL_EXPORT void
 weston_keyboard_destroy(struct weston_keyboard *keyboard)
 {
-	/* XXX: What about keyboard->resource_list? */
+	destroy_resource_groups(&keyboard->resource_groups);
 
 #ifdef ENABLE_XKBCOMMON
 	if (keyboard->seat->compositor->use_xkbcommon) {
@@ -577,6 +749,9 @@ static void
 weston_touch_reset_state(struct weston_touch *touch)
 {
 	touch->num_tp = 0;
+	touch->pending_motions.size = 0;
+	touch->frame_deferred = 0;
+	touch->frame_has_events = 0;
 }
 
 WL_EXPORT struct weston_touch *
@@ -588,7 +763,7 @@ weston_touch_create(void)
 	if (touch == NULL)
 		return NULL;
 
-	wl_list_init(&touch->resource_list);
+	wl_list_init(&touch->resource_groups);
 	wl_list_init(&touch->focus_resource_list);
 	wl_list_init(&touch->focus_view_listener.link);
 	touch->focus_view_listener.notify = touch_focus_view_destroyed;
@@ -598,6 +773,7 @@ weston_touch_create(void)
 	touch->default_grab.touch = touch;
 	touch->grab = &touch->default_grab;
 	wl_signal_init(&touch->focus_signal);
+	wl_array_init(&touch->pending_motions);
 
 	return touch;
 }
@@ -605,7 +781,11 @@ weston_touch_create(void)
 WL_EXPORT void
 weston_touch_destroy(struct weston_touch *touch)
 {
-	/* XXX: What about touch->resource_list? */
+	destroy_resource_groups(&touch->resource_groups);
+
+	if (touch->frame_timer)
+		wl_event_source_remove(touch->frame_timer);
+	wl_array_release(&touch->pending_motions);
 
 	wl_list_remove(&touch->focus_view_listener.link);
 	wl_list_remove(&touch->focus_resource_listener.link);
@@ -678,10 +858,10 @@ weston_pointer_set_focus(struct weston_pointer *pointer,
 					      pointer->focus->surface->resource);
 		}
 
-		move_resources(&pointer->resource_list, focus_resource_list);
+		move_resources(&pointer->resource_groups, focus_resource_list);
 	}
 
-	if (find_resource_for_view(&pointer->resource_list, view) && refocus) {
+	if (has_resource_for_view(&pointer->resource_groups, view) && refocus) {
 		struct wl_client *surface_client =
 			wl_resource_get_client(view->surface->resource);
 
@@ -689,12 +869,12 @@ weston_pointer_set_focus(struct weston_pointer *pointer,
 
 		if (kbd && kbd->focus != view->surface)
 			send_modifiers_to_client_in_list(surface_client,
-							 &kbd->resource_list,
+							 &kbd->resource_groups,
 							 serial,
 							 kbd);
 
 		move_resources_for_client(focus_resource_list,
-					  &pointer->resource_list,
+					  &pointer->resource_groups,
 					  surface_client);
 
 		wl_resource_for_each(resource, focus_resource_list) {
@@ -761,10 +941,10 @@ weston_keyboard_set_focus(struct weston_keyboard *keyboard,
 			wl_keyboard_send_leave(resource, serial,
 					keyboard->focus->resource);
 		}
-		move_resources(&keyboard->resource_list, focus_resource_list);
+		move_resources(&keyboard->resource_groups, focus_resource_list);
 	}
 
-	if (find_resource_for_surface(&keyboard->resource_list, surface) &&
+	if (has_resource_for_surface(&keyboard->resource_groups, surface) &&
 	    keyboard->focus != surface) {
 		struct wl_client *surface_client =
 			wl_resource_get_client(surface->resource);
@@ -772,7 +952,7 @@ weston_keyboard_set_focus(struct weston_keyboard *keyboard,
 		serial = wl_display_next_serial(display);
 
 		move_resources_for_client(focus_resource_list,
-					  &keyboard->resource_list,
+					  &keyboard->resource_groups,
 					  surface_client);
 		send_enter_to_resource_list(focus_resource_list,
 					    keyboard,
@@ -974,6 +1154,107 @@ weston_pointer_handle_output_destroy(struct wl_listener *listener, void *data)
 	weston_pointer_move(pointer, fx, fy);
 }
 
+/** Deliver the motion a coalescing seat has held back, if any
+ *
+ * Called before any other pointer event so clients and grabs still see
+ * everything in order.
+ */
+static void
+weston_pointer_flush_motion(struct weston_pointer *pointer)
+{
+	wl_fixed_t x, y;
+
+	if (!pointer->motion_pending)
+		return;
+
+	pointer->motion_pending = 0;
+
+	if (pointer->motion_absolute) {
+		x = pointer->motion_x;
+		y = pointer->motion_y;
+	} else {
+		x = pointer->x;
+		y = pointer->y;
+	}
+
+	pointer->grab->interface->motion(pointer->grab, pointer->motion_time,
+					 x + pointer->motion_dx,
+					 y + pointer->motion_dy);
+}
+
+static int
+pointer_motion_timer_handler(void *data)
+{
+	struct weston_pointer *pointer = data;
+
+	weston_pointer_flush_motion(pointer);
+
+	return 0;
+}
+
+/** One refresh of the output at a position
+ *
+ * \param ec The compositor.
+ * \param fx X of the position in global coordinates.
+ * \param fy Y of the position in global coordinates.
+ * \return The refresh interval in milliseconds, 16 if no output with
+ * a known refresh rate is there.
+ */
+WL_EXPORT int
+weston_compositor_refresh_interval_at(struct weston_compositor *ec,
+				      wl_fixed_t fx, wl_fixed_t fy)
+{
+	struct weston_output *output, *found = NULL;
+	int x = wl_fixed_to_int(fx);
+	int y = wl_fixed_to_int(fy);
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (pixman_region32_contains_point(&output->region,
+						   x, y, NULL)) {
+			found = output;
+			break;
+		}
+	}
+
+	if (!found || !found->current_mode ||
+	    found->current_mode->refresh <= 0)
+		return 16;
+
+	return MAX(1000000 / found->current_mode->refresh, 1);
+}
+
+static void
+weston_pointer_queue_motion(struct weston_pointer *pointer, uint32_t time,
+			    wl_fixed_t x, wl_fixed_t y, int absolute)
+{
+	if (!pointer->motion_pending) {
+		pointer->motion_absolute = 0;
+		pointer->motion_dx = 0;
+		pointer->motion_dy = 0;
+	}
+
+	if (absolute) {
+		/* An absolute position supersedes earlier motion */
+		pointer->motion_absolute = 1;
+		pointer->motion_x = x;
+		pointer->motion_y = y;
+		pointer->motion_dx = 0;
+		pointer->motion_dy = 0;
+	} else {
+		pointer->motion_dx += x;
+		pointer->motion_dy += y;
+	}
+	pointer->motion_time = time;
+
+	if (!pointer->motion_pending) {
+		pointer->motion_pending = 1;
+		wl_event_source_timer_update(pointer->motion_timer,
+			weston_compositor_refresh_interval_at(
+				pointer->seat->compositor,
+				pointer->x, pointer->y));
+	}
+}
+
 WL_EXPORT void
 notify_motion(struct weston_seat *seat,
 	      uint32_t time, wl_fixed_t dx, wl_fixed_t dy)
@@ -981,7 +1262,15 @@ notify_motion(struct weston_seat *seat,
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	TL_POINT("core_input_motion", TLP_INPUT_TIME(&time), TLP_END);
+
 	weston_compositor_wake(ec);
+
+	if (pointer->motion_timer) {
+		weston_pointer_queue_motion(pointer, time, dx, dy, 0);
+		return;
+	}
+
 	pointer->grab->interface->motion(pointer->grab, time, pointer->x + dx, pointer->y + dy);
 }
 
@@ -1028,7 +1317,15 @@ notify_motion_absolute(struct weston_seat *seat,
 	struct weston_compositor *ec = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	TL_POINT("core_input_motion", TLP_INPUT_TIME(&time), TLP_END);
+
 	weston_compositor_wake(ec);
+
+	if (pointer->motion_timer) {
+		weston_pointer_queue_motion(pointer, time, x, y, 1);
+		return;
+	}
+
 	pointer->grab->interface->motion(pointer->grab, time, x, y);
 }
 
@@ -1054,6 +1351,10 @@ notify_button(struct weston_seat *seat, uint32_t time, int32_t button,
 	struct weston_compositor *compositor = seat->compositor;
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	TL_POINT("core_input_button", TLP_INPUT_TIME(&time), TLP_END);
+
+	weston_pointer_flush_motion(pointer);
+
 	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 		if (pointer->button_count == 0) {
@@ -1088,6 +1389,7 @@ notify_axis(struct weston_seat *seat, uint32_t time, uint32_t axis,
 	struct wl_list *resource_list;
 
 	weston_compositor_wake(compositor);
+	weston_pointer_flush_motion(pointer);
 
 	if (!value)
 		return;
@@ -1269,19 +1571,21 @@ send_modifiers(struct wl_resource *resource, uint32_t serial, struct weston_keyb
 }
 
 static struct weston_xkb_info *
-weston_xkb_info_create(struct xkb_keymap *keymap);
+weston_xkb_info_create(struct weston_compositor *ec, struct xkb_keymap *keymap);
 
 static void
 update_keymap(struct weston_seat *seat)
 {
 	struct weston_keyboard *keyboard = weston_seat_get_keyboard(seat);
 	struct wl_resource *resource;
+	struct input_resource_group *group;
 	struct weston_xkb_info *xkb_info;
 	struct xkb_state *state;
 	xkb_mod_mask_t latched_mods;
 	xkb_mod_mask_t locked_mods;
 
-	xkb_info = weston_xkb_info_create(keyboard->pending_keymap);
+	xkb_info = weston_xkb_info_create(seat->compositor,
+					  keyboard->pending_keymap);
 
 	xkb_keymap_unref(keyboard->pending_keymap);
 	keyboard->pending_keymap = NULL;
@@ -1291,6 +1595,12 @@ update_keymap(struct weston_seat *seat)
 		return;
 	}
 
+	/* Nothing to tell clients if the keymap did not really change */
+	if (xkb_info == keyboard->xkb_info) {
+		weston_xkb_info_destroy(xkb_info);
+		return;
+	}
+
 	state = xkb_state_new(xkb_info->keymap);
 	if (!state) {
 		weston_log("failed to initialise XKB state\n");
@@ -1314,8 +1624,9 @@ update_keymap(struct weston_seat *seat)
 	xkb_state_unref(keyboard->xkb_state.state);
 	keyboard->xkb_state.state = state;
 
-	wl_resource_for_each(resource, &keyboard->resource_list)
-		send_keymap(resource, xkb_info);
+	wl_list_for_each(group, &keyboard->resource_groups, device_link)
+		wl_resource_for_each(resource, &group->resource_list)
+			send_keymap(resource, xkb_info);
 	wl_resource_for_each(resource, &keyboard->focus_resource_list)
 		send_keymap(resource, xkb_info);
 
@@ -1324,8 +1635,9 @@ update_keymap(struct weston_seat *seat)
 	if (!latched_mods && !locked_mods)
 		return;
 
-	wl_resource_for_each(resource, &keyboard->resource_list)
-		send_modifiers(resource, wl_display_get_serial(seat->compositor->wl_display), keyboard);
+	wl_list_for_each(group, &keyboard->resource_groups, device_link)
+		wl_resource_for_each(resource, &group->resource_list)
+			send_modifiers(resource, wl_display_get_serial(seat->compositor->wl_display), keyboard);
 	wl_resource_for_each(resource, &keyboard->focus_resource_list)
 		send_modifiers(resource, wl_display_get_serial(seat->compositor->wl_display), keyboard);
 }
@@ -1357,6 +1669,8 @@ notify_key(struct weston_seat *seat, uint32_t time, uint32_t key,
 	struct weston_keyboard_grab *grab = keyboard->grab;
 	uint32_t *k, *end;
 
+	TL_POINT("core_input_key", TLP_INPUT_TIME(&time), TLP_END);
+
 	if (state == WL_KEYBOARD_KEY_STATE_PRESSED) {
 		weston_compositor_idle_inhibit(compositor);
 	} else {
@@ -1412,6 +1726,8 @@ notify_pointer_focus(struct weston_seat *seat, struct weston_output *output,
 {
 	struct weston_pointer *pointer = weston_seat_get_pointer(seat);
 
+	pointer->motion_pending = 0;
+
 	if (output) {
 		weston_pointer_move(pointer, x, y);
 	} else {
@@ -1508,7 +1824,7 @@ weston_touch_set_focus(struct weston_touch *touch, struct weston_view *view)
 	wl_list_init(&touch->focus_view_listener.link);
 
 	if (!wl_list_empty(focus_resource_list)) {
-		move_resources(&touch->resource_list,
+		move_resources(&touch->resource_groups,
 			       focus_resource_list);
 	}
 
@@ -1522,7 +1838,7 @@ weston_touch_set_focus(struct weston_touch *touch, struct weston_view *view)
 
 		surface_client = wl_resource_get_client(view->surface->resource);
 		move_resources_for_client(focus_resource_list,
-					  &touch->resource_list,
+					  &touch->resource_groups,
 					  surface_client);
 		wl_resource_add_destroy_listener(view->surface->resource,
 						 &touch->focus_resource_listener);
@@ -1539,6 +1855,68 @@ weston_touch_set_focus(struct weston_touch *touch, struct weston_view *view)
  * for sending along such order.
  *
  */
+struct touch_motion {
+	int touch_id;
+	uint32_t time;
+	wl_fixed_t x, y;
+};
+
+/* Send the motions a coalescing seat has held back, and the touch
+ * frame they were waiting for if frame is set */
+static void
+weston_touch_flush_motion(struct weston_touch *touch, int frame)
+{
+	struct weston_touch_grab *grab = touch->grab;
+	struct touch_motion *motion;
+
+	if (touch->focus) {
+		wl_array_for_each(motion, &touch->pending_motions)
+			grab->interface->motion(grab, motion->time,
+						motion->touch_id,
+						motion->x, motion->y);
+	}
+	touch->pending_motions.size = 0;
+
+	if (frame && touch->frame_deferred)
+		grab->interface->frame(grab);
+	touch->frame_deferred = 0;
+}
+
+static int
+touch_frame_timer_handler(void *data)
+{
+	struct weston_touch *touch = data;
+
+	weston_touch_flush_motion(touch, 1);
+
+	return 0;
+}
+
+static void
+weston_touch_queue_motion(struct weston_touch *touch, uint32_t time,
+			  int touch_id, wl_fixed_t x, wl_fixed_t y)
+{
+	struct touch_motion *motion;
+
+	wl_array_for_each(motion, &touch->pending_motions) {
+		if (motion->touch_id == touch_id)
+			goto found;
+	}
+
+	motion = wl_array_add(&touch->pending_motions, sizeof *motion);
+	if (!motion) {
+		touch->grab->interface->motion(touch->grab, time,
+					       touch_id, x, y);
+		return;
+	}
+	motion->touch_id = touch_id;
+
+found:
+	motion->time = time;
+	motion->x = x;
+	motion->y = y;
+}
+
 WL_EXPORT void
 notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
              wl_fixed_t x, wl_fixed_t y, int touch_type)
@@ -1549,6 +1927,29 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 	struct weston_view *ev;
 	wl_fixed_t sx, sy;
 
+	TL_POINT("core_input_touch", TLP_INPUT_TIME(&time), TLP_END);
+
+	/* A down may move the focus; it is sampled once that's done */
+	if (touch->focus && touch_type != WL_TOUCH_DOWN)
+		FRAME_STATS(touch, touch->focus->surface);
+
+	if (touch->frame_timer) {
+		if (touch_type == WL_TOUCH_MOTION) {
+			if (touch_id == touch->grab_touch_id) {
+				touch->grab_x = x;
+				touch->grab_y = y;
+			}
+			if (touch->focus)
+				weston_touch_queue_motion(touch, time,
+							  touch_id, x, y);
+			return;
+		}
+
+		/* Keep everything in order around downs and ups */
+		weston_touch_flush_motion(touch, 1);
+		touch->frame_has_events = 1;
+	}
+
 	/* Update grab's global coordinates. */
 	if (touch_id == touch->grab_touch_id && touch_type != WL_TOUCH_UP) {
 		touch->grab_x = x;
@@ -1576,6 +1977,9 @@ notify_touch(struct weston_seat *seat, uint32_t time, int touch_id,
 			return;
 		}
 
+		if (touch->focus)
+			FRAME_STATS(touch, touch->focus->surface);
+
 		weston_compositor_run_touch_binding(ec, touch,
 						    time, touch_type);
 
@@ -1622,6 +2026,25 @@ notify_touch_frame(struct weston_seat *seat)
 	struct weston_touch *touch = weston_seat_get_touch(seat);
 	struct weston_touch_grab *grab = touch->grab;
 
+	/* A frame of nothing but motion waits for the next refresh,
+	 * collecting the motion of later frames meanwhile. */
+	if (touch->frame_timer && !touch->frame_has_events &&
+	    touch->pending_motions.size > 0) {
+		if (!touch->frame_deferred) {
+			touch->frame_deferred = 1;
+			wl_event_source_timer_update(touch->frame_timer,
+				weston_compositor_refresh_interval_at(
+					seat->compositor,
+					touch->grab_x, touch->grab_y));
+		}
+		return;
+	}
+
+	if (touch->frame_timer) {
+		weston_touch_flush_motion(touch, 0);
+		touch->frame_has_events = 0;
+	}
+
 	grab->interface->frame(grab);
 }
 
@@ -1653,6 +2076,7 @@ pointer_cursor_surface_configure(struct weston_surface *es,
 	weston_view_set_position(pointer->sprite, x, y);
 
 	empty_region(&es->pending.input);
+	es->pending.dirty |= WESTON_SURFACE_STATE_INPUT;
 	empty_region(&es->input);
 
 	if (!weston_surface_is_mapped(es)) {
@@ -1749,10 +2173,17 @@ seat_get_pointer(struct wl_client *client, struct wl_resource *resource,
 	 */
 	struct weston_pointer *pointer = seat->pointer_state;
 	struct wl_resource *cr;
+	struct wl_list *list;
 
 	if (!pointer)
 		return;
 
+	list = client_resources(&pointer->resource_groups, client, true);
+	if (list == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
         cr = wl_resource_create(client, &wl_pointer_interface,
 				wl_resource_get_version(resource), id);
 	if (cr == NULL) {
@@ -1763,7 +2194,7 @@ seat_get_pointer(struct wl_client *client, struct wl_resource *resource,
 	/* May be moved to focused list later by either
 	 * weston_pointer_set_focus or directly if this client is already
 	 * focused */
-	wl_list_insert(&pointer->resource_list, wl_resource_get_link(cr));
+	wl_list_insert(list, wl_resource_get_link(cr));
 	wl_resource_set_implementation(cr, &pointer_interface, pointer,
 				       unbind_resource);
 
@@ -1833,10 +2264,17 @@ seat_get_keyboard(struct wl_client *client, struct wl_resource *resource,
 	 */
 	struct weston_keyboard *keyboard = seat->keyboard_state;
 	struct wl_resource *cr;
+	struct wl_list *list;
 
 	if (!keyboard)
 		return;
 
+	list = client_resources(&keyboard->resource_groups, client, true);
+	if (list == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
         cr = wl_resource_create(client, &wl_keyboard_interface,
 				wl_resource_get_version(resource), id);
 	if (cr == NULL) {
@@ -1847,7 +2285,7 @@ seat_get_keyboard(struct wl_client *client, struct wl_resource *resource,
 	/* May be moved to focused list later by either
 	 * weston_keyboard_set_focus or directly if this client is already
 	 * focused */
-	wl_list_insert(&keyboard->resource_list, wl_resource_get_link(cr));
+	wl_list_insert(list, wl_resource_get_link(cr));
 	wl_resource_set_implementation(cr, &keyboard_interface,
 				       seat, unbind_resource);
 
@@ -1921,10 +2359,17 @@ seat_get_touch(struct wl_client *client, struct wl_resource *resource,
 	 */
 	struct weston_touch *touch = seat->touch_state;
 	struct wl_resource *cr;
+	struct wl_list *list;
 
 	if (!touch)
 		return;
 
+	list = client_resources(&touch->resource_groups, client, true);
+	if (list == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
         cr = wl_resource_create(client, &wl_touch_interface,
 				wl_resource_get_version(resource), id);
 	if (cr == NULL) {
@@ -1934,11 +2379,10 @@ seat_get_touch(struct wl_client *client, struct wl_resource *resource,
 
 	if (touch->focus &&
 	    wl_resource_get_client(touch->focus->surface->resource) == client) {
-		wl_list_insert(&touch->resource_list,
-			       wl_resource_get_link(cr));
-	} else {
 		wl_list_insert(&touch->focus_resource_list,
 			       wl_resource_get_link(cr));
+	} else {
+		wl_list_insert(list, wl_resource_get_link(cr));
 	}
 	wl_resource_set_implementation(cr, &touch_interface,
 				       seat, unbind_resource);
@@ -1976,6 +2420,41 @@ bind_seat(struct wl_client *client, void *data, uint32_t version, uint32_t id)
 }
 
 #ifdef ENABLE_XKBCOMMON
+/* Compiled keymaps are cached in $XDG_CACHE_HOME/weston, or
+ * ~/.cache/weston */
+static char *
+keymap_cache_dir_create(void)
+{
+	const char *cache_home = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char *parent = NULL, *dir;
+
+#ifndef XKBCOMMON_VERSION
+	/* A cached keymap could outlive the xkbcommon that compiled it */
+	return NULL;
+#endif
+
+	if (cache_home && cache_home[0] == '/')
+		parent = strdup(cache_home);
+	else if (home && asprintf(&parent, "%s/.cache", home) < 0)
+		parent = NULL;
+	if (!parent)
+		return NULL;
+
+	if (asprintf(&dir, "%s/weston", parent) < 0) {
+		dir = NULL;
+	} else if ((mkdir(parent, 0700) < 0 && errno != EEXIST) ||
+		   (mkdir(dir, 0700) < 0 && errno != EEXIST)) {
+		weston_log("keymap cache disabled, cannot create %s: %m\n",
+			   dir);
+		free(dir);
+		dir = NULL;
+	}
+	free(parent);
+
+	return dir;
+}
+
 int
 weston_compositor_xkb_init(struct weston_compositor *ec,
 			   struct xkb_rule_names *names)
@@ -1988,6 +2467,8 @@ weston_compositor_xkb_init(struct weston_compositor *ec,
 			weston_log("failed to create XKB context\n");
 			return -1;
 		}
+		wl_list_init(&ec->xkb_info_list);
+		ec->xkb_cache_dir = keymap_cache_dir_create();
 	}
 
 	if (names)
@@ -2008,6 +2489,7 @@ weston_xkb_info_destroy(struct weston_xkb_info *xkb_info)
 	if (--xkb_info->ref_count > 0)
 		return;
 
+	wl_list_remove(&xkb_info->link);
 	xkb_keymap_unref(xkb_info->keymap);
 
 	if (xkb_info->keymap_area)
@@ -2036,20 +2518,58 @@ weston_compositor_xkb_destroy(struct weston_compositor *ec)
 	if (ec->xkb_info)
 		weston_xkb_info_destroy(ec->xkb_info);
 	xkb_context_unref(ec->xkb_context);
+	free(ec->xkb_cache_dir);
 }
 
+/* FNV-1a */
+static uint32_t
+keymap_hash(const char *str, size_t size)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= (unsigned char) str[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+/** Find or create the xkb_info for a keymap
+ *
+ * Keymaps that serialize to the same string share one xkb_info, and so
+ * one sealed file that is sent to every client of every keyboard using
+ * it.  keymap_str is that string, of size bytes with the terminating
+ * NUL; it is copied.  The returned reference is dropped with
+ * weston_xkb_info_destroy().
+ */
 static struct weston_xkb_info *
-weston_xkb_info_create(struct xkb_keymap *keymap)
+weston_xkb_info_create_from_string(struct weston_compositor *ec,
+				   struct xkb_keymap *keymap,
+				   const char *keymap_str, size_t size)
 {
-	struct weston_xkb_info *xkb_info = zalloc(sizeof *xkb_info);
+	struct weston_xkb_info *xkb_info;
+	uint32_t hash;
+
+	hash = keymap_hash(keymap_str, size);
+
+	wl_list_for_each(xkb_info, &ec->xkb_info_list, link) {
+		if (xkb_info->keymap_hash == hash &&
+		    xkb_info->keymap_size == size &&
+		    memcmp(xkb_info->keymap_area, keymap_str, size) == 0) {
+			xkb_info->ref_count++;
+			return xkb_info;
+		}
+	}
+
+	xkb_info = zalloc(sizeof *xkb_info);
 	if (xkb_info == NULL)
 		return NULL;
 
 	xkb_info->keymap = xkb_keymap_ref(keymap);
 	xkb_info->ref_count = 1;
 
-	char *keymap_str;
-
 	xkb_info->shift_mod = xkb_keymap_mod_get_index(xkb_info->keymap,
 						       XKB_MOD_NAME_SHIFT);
 	xkb_info->caps_mod = xkb_keymap_mod_get_index(xkb_info->keymap,
@@ -2074,55 +2594,275 @@ weston_xkb_info_create(struct xkb_keymap *keymap)
 	xkb_info->scroll_led = xkb_keymap_led_get_index(xkb_info->keymap,
 							XKB_LED_NAME_SCROLL);
 
-	keymap_str = xkb_keymap_get_as_string(xkb_info->keymap,
-					      XKB_KEYMAP_FORMAT_TEXT_V1);
-	if (keymap_str == NULL) {
-		weston_log("failed to get string version of keymap\n");
-		goto err_keymap;
-	}
-	xkb_info->keymap_size = strlen(keymap_str) + 1;
+	xkb_info->keymap_size = size;
+	xkb_info->keymap_hash = hash;
 
-	xkb_info->keymap_fd = os_create_anonymous_file(xkb_info->keymap_size);
+	xkb_info->keymap_fd = os_create_sealed_file(keymap_str, size);
 	if (xkb_info->keymap_fd < 0) {
 		weston_log("creating a keymap file for %lu bytes failed: %m\n",
 			(unsigned long) xkb_info->keymap_size);
-		goto err_keymap_str;
+		goto err_keymap;
 	}
 
+	/* Only kept for comparing against new keymaps */
 	xkb_info->keymap_area = mmap(NULL, xkb_info->keymap_size,
-				     PROT_READ | PROT_WRITE,
-				     MAP_SHARED, xkb_info->keymap_fd, 0);
+				     PROT_READ, MAP_SHARED,
+				     xkb_info->keymap_fd, 0);
 	if (xkb_info->keymap_area == MAP_FAILED) {
 		weston_log("failed to mmap() %lu bytes\n",
 			(unsigned long) xkb_info->keymap_size);
-		goto err_dev_zero;
+		goto err_fd;
 	}
-	strcpy(xkb_info->keymap_area, keymap_str);
-	free(keymap_str);
+
+	wl_list_insert(&ec->xkb_info_list, &xkb_info->link);
 
 	return xkb_info;
 
-err_dev_zero:
+err_fd:
 	close(xkb_info->keymap_fd);
-err_keymap_str:
-	free(keymap_str);
 err_keymap:
 	xkb_keymap_unref(xkb_info->keymap);
 	free(xkb_info);
 	return NULL;
 }
 
+static struct weston_xkb_info *
+weston_xkb_info_create(struct weston_compositor *ec, struct xkb_keymap *keymap)
+{
+	struct weston_xkb_info *xkb_info;
+	char *keymap_str;
+
+	keymap_str = xkb_keymap_get_as_string(keymap,
+					      XKB_KEYMAP_FORMAT_TEXT_V1);
+	if (keymap_str == NULL) {
+		weston_log("failed to get string version of keymap\n");
+		return NULL;
+	}
+
+	xkb_info = weston_xkb_info_create_from_string(ec, keymap, keymap_str,
+						      strlen(keymap_str) + 1);
+	free(keymap_str);
+
+	return xkb_info;
+}
+
+#define KEYMAP_CACHE_MAGIC 0x574b4331	/* "WKC1" */
+
+struct keymap_cache_header {
+	uint32_t magic;
+	uint32_t key_length;
+	uint32_t length; /* of the keymap, with its NUL */
+};
+
+static int
+keymap_cache_key_add(struct wl_array *key, const char *str)
+{
+	size_t length = str ? strlen(str) + 1 : 1;
+	char *p;
+
+	p = wl_array_add(key, length);
+	if (!p)
+		return -1;
+	memcpy(p, str ? str : "", length);
+
+	return 0;
+}
+
+/* What the keymap compiled from names depends on: the names, the
+ * defaults xkbcommon takes for the ones missing, the xkbcommon version
+ * and the rules files.  A changed layout file in xkeyboard-config is
+ * not noticed, but packages update the rules with it. */
+static int
+keymap_cache_key(struct weston_compositor *ec,
+		 const struct xkb_rule_names *names, struct wl_array *key)
+{
+	static const char *const defaults[] = {
+		"XKB_DEFAULT_RULES", "XKB_DEFAULT_MODEL", "XKB_DEFAULT_LAYOUT",
+		"XKB_DEFAULT_VARIANT", "XKB_DEFAULT_OPTIONS"
+	};
+	const char *rules = names->rules ? names->rules : "evdev";
+	char path[PATH_MAX], mtime[64];
+	struct stat st;
+	unsigned int i;
+	int ret = 0;
+
+#ifdef XKBCOMMON_VERSION
+	ret |= keymap_cache_key_add(key, XKBCOMMON_VERSION);
+#endif
+	ret |= keymap_cache_key_add(key, names->rules);
+	ret |= keymap_cache_key_add(key, names->model);
+	ret |= keymap_cache_key_add(key, names->layout);
+	ret |= keymap_cache_key_add(key, names->variant);
+	ret |= keymap_cache_key_add(key, names->options);
+	for (i = 0; i < ARRAY_LENGTH(defaults); i++)
+		ret |= keymap_cache_key_add(key, getenv(defaults[i]));
+
+	for (i = 0; i < xkb_context_num_include_paths(ec->xkb_context); i++) {
+		const char *dir = xkb_context_include_path_get(ec->xkb_context,
+							       i);
+
+		snprintf(path, sizeof path, "%s/rules/%s", dir, rules);
+		if (stat(path, &st) < 0)
+			continue;
+		snprintf(mtime, sizeof mtime, "%lld.%09ld",
+			 (long long) st.st_mtim.tv_sec,
+			 (long) st.st_mtim.tv_nsec);
+		ret |= keymap_cache_key_add(key, path);
+		ret |= keymap_cache_key_add(key, mtime);
+	}
+
+	return ret;
+}
+
+static int
+keymap_cache_path(struct weston_compositor *ec, struct wl_array *key,
+		  char *path, size_t size)
+{
+	return snprintf(path, size, "%s/keymap-%08x.xkb", ec->xkb_cache_dir,
+			keymap_hash(key->data, key->size)) < (int) size ? 0 : -1;
+}
+
+/* The keymap text an earlier run compiled from the same names */
+static char *
+keymap_cache_load(const char *path, struct wl_array *key, size_t *size)
+{
+	struct keymap_cache_header header;
+	char *stored_key = NULL, *text = NULL;
+	FILE *fp;
+	int ok;
+
+	fp = fopen(path, "re");
+	if (!fp)
+		return NULL;
+
+	ok = fread(&header, sizeof header, 1, fp) == 1 &&
+	     header.magic == KEYMAP_CACHE_MAGIC &&
+	     header.key_length == key->size && header.length > 0 &&
+	     (stored_key = malloc(header.key_length)) &&
+	     fread(stored_key, header.key_length, 1, fp) == 1 &&
+	     memcmp(stored_key, key->data, key->size) == 0 &&
+	     (text = malloc(header.length)) &&
+	     fread(text, header.length, 1, fp) == 1 &&
+	     text[header.length - 1] == '\0';
+	fclose(fp);
+	free(stored_key);
+
+	if (!ok) {
+		free(text);
+		return NULL;
+	}
+
+	*size = header.length;
+
+	return text;
+}
+
+static void
+keymap_cache_store(const char *path, struct wl_array *key,
+		   const char *text, size_t size)
+{
+	struct keymap_cache_header header;
+	char tmp[PATH_MAX + 4];
+	FILE *fp;
+	int ok;
+
+	header.magic = KEYMAP_CACHE_MAGIC;
+	header.key_length = key->size;
+	header.length = size;
+
+	/* Write a temporary file and rename it, so that a crash or a
+	 * second compositor never leaves a torn keymap behind. */
+	snprintf(tmp, sizeof tmp, "%s.tmp", path);
+	fp = fopen(tmp, "we");
+	if (!fp)
+		return;
+
+	ok = fwrite(&header, sizeof header, 1, fp) == 1 &&
+	     fwrite(key->data, key->size, 1, fp) == 1 &&
+	     fwrite(text, size, 1, fp) == 1;
+	ok = fclose(fp) == 0 && ok;
+
+	if (!ok || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
+/* Compile a keymap from names, or parse the text an earlier run
+ * compiled them to, which is several times faster.  The text is
+ * returned too, in *text and *size, to be freed by the caller. */
+static struct xkb_keymap *
+compile_keymap(struct weston_compositor *ec,
+	       const struct xkb_rule_names *names, char **text, size_t *size)
+{
+	struct xkb_keymap *keymap = NULL;
+	char path[PATH_MAX];
+	struct wl_array key;
+	int cached;
+
+	wl_array_init(&key);
+	cached = ec->xkb_cache_dir &&
+		 keymap_cache_key(ec, names, &key) == 0 &&
+		 keymap_cache_path(ec, &key, path, sizeof path) == 0;
+
+	*text = cached ? keymap_cache_load(path, &key, size) : NULL;
+	if (*text) {
+		keymap = xkb_keymap_new_from_string(ec->xkb_context, *text,
+						    XKB_KEYMAP_FORMAT_TEXT_V1,
+						    0);
+		if (keymap) {
+			wl_array_release(&key);
+			return keymap;
+		}
+		free(*text);
+	}
+
+	keymap = xkb_keymap_new_from_names(ec->xkb_context, names, 0);
+	*text = keymap ? xkb_keymap_get_as_string(keymap,
+						  XKB_KEYMAP_FORMAT_TEXT_V1) :
+			 NULL;
+	if (!*text) {
+		xkb_keymap_unref(keymap);
+		wl_array_release(&key);
+		return NULL;
+	}
+	*size = strlen(*text) + 1;
+
+	if (cached)
+		keymap_cache_store(path, &key, *text, *size);
+	wl_array_release(&key);
+
+	return keymap;
+}
+
+/** Compile a keymap from RMLVO names, through the keymap cache
+ *
+ * For backends that learn the layout of a keyboard by name.  Returns
+ * NULL if the names do not compile.
+ */
+WL_EXPORT struct xkb_keymap *
+weston_compositor_compile_keymap(struct weston_compositor *ec,
+				 const struct xkb_rule_names *names)
+{
+	struct xkb_keymap *keymap;
+	char *text;
+	size_t size;
+
+	keymap = compile_keymap(ec, names, &text, &size);
+	free(text);
+
+	return keymap;
+}
+
 static int
 weston_compositor_build_global_keymap(struct weston_compositor *ec)
 {
 	struct xkb_keymap *keymap;
+	char *text;
+	size_t size;
 
 	if (ec->xkb_info != NULL)
 		return 0;
 
-	keymap = xkb_keymap_new_from_names(ec->xkb_context,
-					   &ec->xkb_names,
-					   0);
+	keymap = compile_keymap(ec, &ec->xkb_names, &text, &size);
 	if (keymap == NULL) {
 		weston_log("failed to compile global XKB keymap\n");
 		weston_log("  tried rules %s, model %s, layout %s, variant %s, "
@@ -2133,8 +2873,11 @@ weston_compositor_build_global_keymap(struct weston_compositor *ec)
 		return -1;
 	}
 
-	ec->xkb_info = weston_xkb_info_create(keymap);
+	/* The sealed file sent to clients is made from the same text */
+	ec->xkb_info = weston_xkb_info_create_from_string(ec, keymap,
+							  text, size);
 	xkb_keymap_unref(keymap);
+	free(text);
 	if (ec->xkb_info == NULL)
 		return -1;
 
@@ -2152,6 +2895,13 @@ void
 weston_compositor_xkb_destroy(struct weston_compositor *ec)
 {
 }
+
+WL_EXPORT struct xkb_keymap *
+weston_compositor_compile_keymap(struct weston_compositor *ec,
+				 const struct xkb_rule_names *names)
+{
+	return NULL;
+}
 #endif
 
 WL_EXPORT void
@@ -2195,7 +2945,9 @@ weston_seat_init_keyboard(struct weston_seat *seat, struct xkb_keymap *keymap)
 #ifdef ENABLE_XKBCOMMON
 	if (seat->compositor->use_xkbcommon) {
 		if (keymap != NULL) {
-			keyboard->xkb_info = weston_xkb_info_create(keymap);
+			keyboard->xkb_info =
+				weston_xkb_info_create(seat->compositor,
+						       keymap);
 			if (keyboard->xkb_info == NULL)
 				goto err;
 		} else {
@@ -2329,6 +3081,16 @@ weston_seat_init_touch(struct weston_seat *seat)
 	if (touch == NULL)
 		return;
 
+	if (seat->coalesce_touch) {
+		struct wl_event_loop *loop =
+			wl_display_get_event_loop(seat->compositor->wl_display);
+
+		touch->frame_timer =
+			wl_event_loop_add_timer(loop,
+						touch_frame_timer_handler,
+						touch);
+	}
+
 	seat->touch_state = touch;
 	seat->touch_device_count = 1;
 	touch->seat = seat;
@@ -2352,6 +3114,8 @@ WL_EXPORT void
 weston_seat_init(struct weston_seat *seat, struct weston_compositor *ec,
 		 const char *seat_name)
 {
+	struct weston_config_section *section;
+
 	memset(seat, 0, sizeof *seat);
 
 	seat->selection_data_source = NULL;
@@ -2368,6 +3132,13 @@ weston_seat_init(struct weston_seat *seat, struct weston_compositor *ec,
 	seat->modifier_state = 0;
 	seat->seat_name = strdup(seat_name);
 
+	section = weston_config_get_section(ec->config, "seat",
+					    "name", seat_name);
+	weston_config_section_get_bool(section, "coalesce-motion",
+				       &seat->coalesce_motion, 0);
+	weston_config_section_get_bool(section, "coalesce-touch",
+				       &seat->coalesce_touch, 0);
+
 	wl_list_insert(ec->seat_list.prev, &seat->link);
 
 	clipboard_create(seat);
@@ -50,6 +50,9 @@
 
 #define DRM_MAJOR 226
 
+/* The primary GPU plus the [core] secondary-gpus ones */
+#define MAX_DRM_FDS 8
+
 #ifndef KDSKBMUTE
 #define KDSKBMUTE	0x4B51
 #endif
@@ -99,10 +102,29 @@ struct weston_launcher {
 	int fd;
 	struct wl_event_source *source;
 
-	int kb_mode, tty, drm_fd;
+	int kb_mode, tty;
+	int drm_fd[MAX_DRM_FDS], drm_fd_count;
 	struct wl_event_source *vt_source;
 };
 
+static void
+launcher_drop_master(struct weston_launcher *launcher)
+{
+	int i;
+
+	for (i = 0; i < launcher->drm_fd_count; i++)
+		drmDropMaster(launcher->drm_fd[i]);
+}
+
+static void
+launcher_set_master(struct weston_launcher *launcher)
+{
+	int i;
+
+	for (i = 0; i < launcher->drm_fd_count; i++)
+		drmSetMaster(launcher->drm_fd[i]);
+}
+
 int
 weston_launcher_open(struct weston_launcher *launcher,
 		     const char *path, int flags)
@@ -137,12 +159,17 @@ weston_launcher_open(struct weston_launcher *launcher,
 		}
 
 		if (major(s.st_rdev) == DRM_MAJOR) {
-			launcher->drm_fd = fd;
 			if (!is_drm_master(fd)) {
 				weston_log("drm fd not master\n");
 				close(fd);
 				return -1;
 			}
+			if (launcher->drm_fd_count == MAX_DRM_FDS) {
+				weston_log("too many drm devices\n");
+				close(fd);
+				return -1;
+			}
+			launcher->drm_fd[launcher->drm_fd_count++] = fd;
 		}
 
 		return fd;
@@ -198,12 +225,41 @@ weston_launcher_open(struct weston_launcher *launcher,
 void
 weston_launcher_close(struct weston_launcher *launcher, int fd)
 {
+	int i;
+
 	if (launcher->logind)
 		weston_logind_close(launcher->logind, fd);
 
+	for (i = 0; i < launcher->drm_fd_count; i++) {
+		if (launcher->drm_fd[i] == fd) {
+			launcher->drm_fd[i] =
+				launcher->drm_fd[--launcher->drm_fd_count];
+			break;
+		}
+	}
+
 	close(fd);
 }
 
+/** Hint that a device will be opened soon
+ *
+ * Only logind does anything with it, see weston_logind_prefetch(). Call
+ * weston_launcher_prefetch_finish() once the opens are done.
+ */
+void
+weston_launcher_prefetch(struct weston_launcher *launcher, const char *path)
+{
+	if (launcher->logind)
+		weston_logind_prefetch(launcher->logind, path);
+}
+
+void
+weston_launcher_prefetch_finish(struct weston_launcher *launcher)
+{
+	if (launcher->logind)
+		weston_logind_prefetch_finish(launcher->logind);
+}
+
 void
 weston_launcher_restore(struct weston_launcher *launcher)
 {
@@ -222,7 +278,7 @@ weston_launcher_restore(struct weston_launcher *launcher)
 	/* We have to drop master before we switch the VT back in
 	 * VT_AUTO, so we don't risk switching to a VT with another
 	 * display server, that will then fail to set drm master. */
-	drmDropMaster(launcher->drm_fd);
+	launcher_drop_master(launcher);
 
 	mode.mode = VT_AUTO;
 	if (ioctl(launcher->tty, VT_SETMODE, &mode) < 0)
@@ -276,11 +332,11 @@ vt_handler(int signal_number, void *data)
 	if (compositor->session_active) {
 		compositor->session_active = 0;
 		wl_signal_emit(&compositor->session_signal, compositor);
-		drmDropMaster(launcher->drm_fd);
+		launcher_drop_master(launcher);
 		ioctl(launcher->tty, VT_RELDISP, 1);
 	} else {
 		ioctl(launcher->tty, VT_RELDISP, VT_ACKACQ);
-		drmSetMaster(launcher->drm_fd);
+		launcher_set_master(launcher);
 		compositor->session_active = 1;
 		wl_signal_emit(&compositor->session_signal, compositor);
 	}
@@ -407,7 +463,7 @@ weston_launcher_connect(struct weston_compositor *compositor, int tty,
 
 	launcher->logind = NULL;
 	launcher->compositor = compositor;
-	launcher->drm_fd = -1;
+	launcher->drm_fd_count = 0;
 	launcher->fd = weston_environment_get_fd("WESTON_LAUNCHER_SOCK");
 	if (launcher->fd != -1) {
 		launcher->tty = weston_environment_get_fd("WESTON_TTY_FD");
@@ -42,6 +42,26 @@
 #include <malloc.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Writes to sysfs can block for milliseconds on some laptops, and a
+ * brightness key repeats; the worker takes them off the caller. */
+struct backlight_worker {
+	struct backlight *backlight;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int quit;
+
+	/* The latest value asked for, not yet written if pending */
+	int pending;
+	long target;
+	int ramp_ms;
+};
+
+/* Time between two steps of a ramp */
+#define BACKLIGHT_RAMP_STEP_MS 16
 
 static long backlight_get(struct backlight *backlight, char *node)
 {
@@ -88,6 +108,127 @@ long backlight_get_actual_brightness(struct backlight *backlight)
 	return backlight_get(backlight, "actual_brightness");
 }
 
+static int backlight_write(struct backlight *backlight, long brightness)
+{
+	char buffer[32];
+	char *path;
+	int fd, len, ret = 0;
+
+	if (asprintf(&path, "%s/%s", backlight->path, "brightness") < 0)
+		return -1;
+
+	fd = open(path, O_WRONLY);
+	free(path);
+	if (fd < 0)
+		return -1;
+
+	len = snprintf(buffer, sizeof buffer, "%ld", brightness);
+	if (write(fd, buffer, len) < 0)
+		ret = -1;
+
+	close(fd);
+	return ret;
+}
+
+static void *backlight_worker_run(void *data)
+{
+	struct backlight_worker *worker = data;
+	struct timespec deadline;
+	long current, target = 0, value = 0;
+	int steps = 0, step = 0;
+
+	current = worker->backlight->brightness;
+
+	pthread_mutex_lock(&worker->mutex);
+	while (1) {
+		while (!worker->quit && !worker->pending && step == steps)
+			pthread_cond_wait(&worker->cond, &worker->mutex);
+		if (worker->quit)
+			break;
+
+		/* A new value restarts the ramp from where it got */
+		if (worker->pending) {
+			worker->pending = 0;
+			target = worker->target;
+			steps = worker->ramp_ms / BACKLIGHT_RAMP_STEP_MS;
+			if (steps < 1)
+				steps = 1;
+			step = 0;
+			value = current;
+		}
+		pthread_mutex_unlock(&worker->mutex);
+
+		step++;
+		current = value + (target - value) * step / steps;
+		backlight_write(worker->backlight, current);
+
+		pthread_mutex_lock(&worker->mutex);
+		if (step == steps)
+			continue;
+
+		/* Until the next step, unless a new value comes first */
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_nsec += BACKLIGHT_RAMP_STEP_MS * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while (!worker->quit && !worker->pending &&
+		       pthread_cond_timedwait(&worker->cond, &worker->mutex,
+					      &deadline) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&worker->mutex);
+
+	return NULL;
+}
+
+static void backlight_worker_destroy(struct backlight_worker *worker)
+{
+	pthread_mutex_lock(&worker->mutex);
+	worker->quit = 1;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->mutex);
+
+	pthread_join(worker->thread, NULL);
+	pthread_cond_destroy(&worker->cond);
+	pthread_mutex_destroy(&worker->mutex);
+	free(worker);
+}
+
+int backlight_set_brightness_async(struct backlight *backlight,
+				   long brightness, int ramp_ms)
+{
+	struct backlight_worker *worker = backlight->worker;
+
+	if (!worker) {
+		worker = calloc(1, sizeof *worker);
+		if (!worker)
+			return -1;
+
+		worker->backlight = backlight;
+		pthread_mutex_init(&worker->mutex, NULL);
+		pthread_cond_init(&worker->cond, NULL);
+		if (pthread_create(&worker->thread, NULL,
+				   backlight_worker_run, worker) != 0) {
+			pthread_cond_destroy(&worker->cond);
+			pthread_mutex_destroy(&worker->mutex);
+			free(worker);
+			return -1;
+		}
+		backlight->worker = worker;
+	}
+
+	pthread_mutex_lock(&worker->mutex);
+	worker->target = brightness;
+	worker->ramp_ms = ramp_ms;
+	worker->pending = 1;
+	pthread_cond_signal(&worker->cond);
+	pthread_mutex_unlock(&worker->mutex);
+
+	return 0;
+}
+
 long backlight_set_brightness(struct backlight *backlight, long brightness)
 {
 	char *path;
@@ -136,6 +277,9 @@ void backlight_destroy(struct backlight *backlight)
 	if (!backlight)
 		return;
 
+	if (backlight->worker)
+		backlight_worker_destroy(backlight->worker);
+
 	if (backlight->path)
 		free(backlight->path);
 
@@ -291,6 +435,7 @@ struct backlight *backlight_init(struct udev_device *drm_device,
 
 	backlight->path = chosen_path;
 	backlight->type = type;
+	backlight->worker = NULL;
 
 	backlight->max_brightness = backlight_get_max_brightness(backlight);
 	if (backlight->max_brightness < 0)
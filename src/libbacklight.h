@@ -43,11 +43,16 @@ enum backlight_type {
 	BACKLIGHT_FIRMWARE
 };
 
+struct backlight_worker;
+
 struct backlight {
 	char *path;
 	int max_brightness;
 	int brightness;
 	enum backlight_type type;
+
+	/* NULL until backlight_set_brightness_async() is first called */
+	struct backlight_worker *worker;
 };
 
 /*
@@ -72,6 +77,15 @@ long backlight_get_actual_brightness(struct backlight *backlight);
 /* Set the backlight to a value between 0 and max */
 long backlight_set_brightness(struct backlight *backlight, long brightness);
 
+/*
+ * Set the backlight from a thread of its own, going there in steps over
+ * ramp_ms milliseconds if ramp_ms > 0. Values set while one is being
+ * written replace it, only the latest is written. Returns 0, or -1 if
+ * the thread cannot be started.
+ */
+int backlight_set_brightness_async(struct backlight *backlight,
+				   long brightness, int ramp_ms);
+
 #ifdef __cplusplus
 }
 #endif
@@ -38,13 +38,22 @@
 
 #include "compositor.h"
 #include "libinput-device.h"
+#include "libinput-seat.h"
 #include "shared/helpers.h"
 
 #define DEFAULT_AXIS_STEP_DISTANCE wl_fixed_from_int(10)
 
+static struct udev_input *
+evdev_device_get_input(struct evdev_device *device)
+{
+	return libinput_get_user_data(
+			libinput_device_get_context(device->device));
+}
+
 void
 evdev_led_update(struct evdev_device *device, enum weston_led weston_leds)
 {
+	struct udev_input *input = evdev_device_get_input(device);
 	enum libinput_led leds = 0;
 
 	if (weston_leds & LED_NUM_LOCK)
@@ -54,7 +63,9 @@ evdev_led_update(struct evdev_device *device, enum weston_led weston_leds)
 	if (weston_leds & LED_SCROLL_LOCK)
 		leds |= LIBINPUT_LED_SCROLL_LOCK;
 
+	udev_input_lock(input);
 	libinput_device_led_update(device->device, leds);
+	udev_input_unlock(input);
 }
 
 static void
@@ -432,8 +443,10 @@ evdev_device_set_calibration(struct evdev_device *device)
 	calibration[2] /= width;
 	calibration[5] /= height;
 
+	udev_input_lock(evdev_device_get_input(device));
 	status = libinput_device_config_calibration_set_matrix(device->device,
 							       calibration);
+	udev_input_unlock(evdev_device_get_input(device));
 	if (status != LIBINPUT_CONFIG_STATUS_SUCCESS)
 		weston_log("Failed to apply calibration.\n");
 
@@ -26,10 +26,14 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <libinput.h>
 #include <libudev.h>
 
@@ -48,6 +52,8 @@ static struct udev_seat *
 udev_seat_create(struct udev_input *input, const char *seat_name);
 static void
 udev_seat_destroy(struct udev_seat *seat);
+static void
+udev_input_remove_source(struct udev_input *input);
 
 static void
 device_added(struct udev_input *input, struct libinput_device *libinput_device)
@@ -125,6 +131,7 @@ udev_input_disable(struct udev_input *input)
 	if (input->suspended)
 		return;
 
+	udev_input_remove_source(input);
 	libinput_suspend(input->libinput);
 	process_events(input);
 	input->suspended = 1;
@@ -141,10 +148,14 @@ udev_input_process_event(struct libinput_event *event)
 
 	switch (libinput_event_get_type(event)) {
 	case LIBINPUT_EVENT_DEVICE_ADDED:
+		udev_input_lock(input);
 		device_added(input, libinput_device);
+		udev_input_unlock(input);
 		break;
 	case LIBINPUT_EVENT_DEVICE_REMOVED:
+		udev_input_lock(input);
 		device_removed(input, libinput_device);
+		udev_input_unlock(input);
 		break;
 	default:
 		handled = 0;
@@ -192,12 +203,132 @@ libinput_source_dispatch(int fd, uint32_t mask, void *data)
 	return udev_input_dispatch(input) != 0;
 }
 
+/* Set on the input thread, so the launcher calls libinput makes from
+ * there can be handed to the main loop. */
+static __thread int on_input_thread;
+
+/* Queue a message from the input thread for the main loop to log */
+static void
+udev_input_thread_vlog(struct udev_input *input,
+		       const char *format, va_list ap)
+{
+	char *msg, c = 0;
+
+	if (vasprintf(&msg, format, ap) < 0)
+		msg = NULL;
+
+	pthread_mutex_lock(&input->thread.log.mutex);
+	if (msg && input->thread.log.head - input->thread.log.tail <
+	    UDEV_INPUT_LOG_SIZE) {
+		input->thread.log.msg[input->thread.log.head++ &
+				      (UDEV_INPUT_LOG_SIZE - 1)] = msg;
+	} else {
+		free(msg);
+		input->thread.log.dropped++;
+	}
+	pthread_mutex_unlock(&input->thread.log.mutex);
+
+	/* Nothing to report a failure to from here */
+	if (write(input->thread.wake_pipe[1], &c, 1) < 0)
+		return;
+}
+
+static void
+udev_input_thread_log(struct udev_input *input, const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	udev_input_thread_vlog(input, format, ap);
+	va_end(ap);
+}
+
+/* Print what the input thread queued */
+static void
+udev_input_flush_log(struct udev_input *input)
+{
+	unsigned int dropped;
+	char *msg;
+
+	pthread_mutex_lock(&input->thread.log.mutex);
+	while (input->thread.log.tail != input->thread.log.head) {
+		msg = input->thread.log.msg[input->thread.log.tail++ &
+					    (UDEV_INPUT_LOG_SIZE - 1)];
+		pthread_mutex_unlock(&input->thread.log.mutex);
+		weston_log("%s", msg);
+		free(msg);
+		pthread_mutex_lock(&input->thread.log.mutex);
+	}
+	dropped = input->thread.log.dropped;
+	input->thread.log.dropped = 0;
+	pthread_mutex_unlock(&input->thread.log.mutex);
+
+	if (dropped > 0)
+		weston_log("libinput: %u input thread messages dropped\n",
+			   dropped);
+}
+
+/* Runs a launcher open (path != NULL) or close for the input thread
+ * on the main loop and waits for the result. */
+static int
+udev_input_call_main(struct udev_input *input,
+		     const char *path, int flags, int fd)
+{
+	char c = 0;
+	int result;
+
+	pthread_mutex_lock(&input->thread.call.mutex);
+	input->thread.call.path = path;
+	input->thread.call.flags = flags;
+	input->thread.call.fd = fd;
+	input->thread.call.done = 0;
+	input->thread.call.pending = 1;
+
+	if (write(input->thread.wake_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+		udev_input_thread_log(input, "libinput: failed to signal "
+				      "the main loop\n");
+
+	while (!input->thread.call.done)
+		pthread_cond_wait(&input->thread.call.cond,
+				  &input->thread.call.mutex);
+	result = input->thread.call.result;
+	pthread_mutex_unlock(&input->thread.call.mutex);
+
+	return result;
+}
+
+static void
+udev_input_service_call(struct udev_input *input)
+{
+	struct weston_launcher *launcher = input->compositor->launcher;
+
+	pthread_mutex_lock(&input->thread.call.mutex);
+	if (input->thread.call.pending) {
+		if (input->thread.call.path) {
+			input->thread.call.result =
+				weston_launcher_open(launcher,
+						     input->thread.call.path,
+						     input->thread.call.flags);
+		} else {
+			weston_launcher_close(launcher, input->thread.call.fd);
+			input->thread.call.result = 0;
+		}
+		input->thread.call.pending = 0;
+		input->thread.call.done = 1;
+		pthread_cond_signal(&input->thread.call.cond);
+	}
+	pthread_mutex_unlock(&input->thread.call.mutex);
+}
+
 static int
 open_restricted(const char *path, int flags, void *user_data)
 {
 	struct udev_input *input = user_data;
 	struct weston_launcher *launcher = input->compositor->launcher;
 
+	if (on_input_thread)
+		return udev_input_call_main(input, path, flags, -1);
+
 	return weston_launcher_open(launcher, path, flags);
 }
 
@@ -207,6 +338,11 @@ close_restricted(int fd, void *user_data)
 	struct udev_input *input = user_data;
 	struct weston_launcher *launcher = input->compositor->launcher;
 
+	if (on_input_thread) {
+		udev_input_call_main(input, NULL, 0, fd);
+		return;
+	}
+
 	weston_launcher_close(launcher, fd);
 }
 
@@ -215,34 +351,360 @@ const struct libinput_interface libinput_interface = {
 	close_restricted,
 };
 
-int
-udev_input_enable(struct udev_input *input)
+/** Take the libinput context away from the input thread
+ *
+ * Needed for any libinput call other than reading an event the thread
+ * handed over.  Does nothing without the thread, and can be nested.
+ */
+void
+udev_input_lock(struct udev_input *input)
+{
+	struct pollfd pfd;
+
+	if (!input->thread.running)
+		return;
+
+	/* The thread may hold the lock while waiting for us to open a
+	 * device for it, so keep serving it until it lets go. */
+	while (pthread_mutex_trylock(&input->thread.lock) != 0) {
+		pfd.fd = input->thread.wake_pipe[0];
+		pfd.events = POLLIN;
+		poll(&pfd, 1, 1);
+		udev_input_service_call(input);
+	}
+}
+
+void
+udev_input_unlock(struct udev_input *input)
+{
+	if (input->thread.running)
+		pthread_mutex_unlock(&input->thread.lock);
+}
+
+/* Destroy the events the main loop is done with */
+static void
+udev_input_thread_reclaim(struct udev_input *input)
+{
+	unsigned int tail = __atomic_load_n(&input->thread.tail,
+					    __ATOMIC_ACQUIRE);
+
+	while (input->thread.reclaim != tail) {
+		libinput_event_destroy(input->thread.ring[input->thread.reclaim &
+						(UDEV_INPUT_RING_SIZE - 1)]);
+		input->thread.reclaim++;
+	}
+}
+
+/* Move pending events from libinput into the ring, as far as they fit.
+ * The rest stays queued in libinput until the main loop catches up. */
+static int
+udev_input_thread_fill(struct udev_input *input)
+{
+	struct libinput_event *event;
+	unsigned int head = input->thread.head;
+	int queued = 0;
+
+	while (head - input->thread.reclaim < UDEV_INPUT_RING_SIZE &&
+	       (event = libinput_get_event(input->libinput))) {
+		input->thread.ring[head & (UDEV_INPUT_RING_SIZE - 1)] = event;
+		head++;
+		queued++;
+	}
+
+	__atomic_store_n(&input->thread.head, head, __ATOMIC_RELEASE);
+
+	return queued;
+}
+
+static void *
+udev_input_thread(void *data)
+{
+	struct udev_input *input = data;
+	struct pollfd fds[2];
+	char buf[16], c = 0;
+	int quit = 0, queued;
+
+	on_input_thread = 1;
+
+	fds[0].fd = libinput_get_fd(input->libinput);
+	fds[0].events = POLLIN;
+	fds[1].fd = input->thread.kick_pipe[0];
+	fds[1].events = POLLIN;
+
+	while (!quit) {
+		if (poll(fds, ARRAY_LENGTH(fds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			udev_input_thread_log(input, "libinput: input thread "
+					      "poll failed: %m\n");
+			break;
+		}
+
+		while (read(input->thread.kick_pipe[0], buf, sizeof buf) > 0)
+			;
+
+		queued = 0;
+		pthread_mutex_lock(&input->thread.lock);
+		quit = input->thread.quit;
+		if (!quit) {
+			udev_input_thread_reclaim(input);
+			if ((fds[0].revents & POLLIN) &&
+			    libinput_dispatch(input->libinput) != 0)
+				udev_input_thread_log(input, "libinput: Failed "
+						      "to dispatch libinput\n");
+			queued = udev_input_thread_fill(input);
+		}
+		pthread_mutex_unlock(&input->thread.lock);
+
+		/* A full pipe already wakes the main loop */
+		if (queued > 0 &&
+		    write(input->thread.wake_pipe[1], &c, 1) < 0)
+			continue;
+	}
+
+	return NULL;
+}
+
+/* Process everything the thread has queued, in one batch */
+static void
+udev_input_consume(struct udev_input *input)
+{
+	unsigned int head = __atomic_load_n(&input->thread.head,
+					    __ATOMIC_ACQUIRE);
+	unsigned int tail = input->thread.tail;
+	char c = 0;
+
+	if (tail == head)
+		return;
+
+	for (; tail != head; tail++)
+		process_event(input->thread.ring[tail &
+						 (UDEV_INPUT_RING_SIZE - 1)]);
+
+	__atomic_store_n(&input->thread.tail, tail, __ATOMIC_RELEASE);
+
+	/* Let the thread destroy them and refill the ring */
+	if (write(input->thread.kick_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+		weston_log("libinput: failed to signal the input thread\n");
+}
+
+static int
+udev_input_thread_dispatch(int fd, uint32_t mask, void *data)
+{
+	struct udev_input *input = data;
+	char buf[16];
+
+	while (read(fd, buf, sizeof buf) > 0)
+		;
+
+	udev_input_flush_log(input);
+	udev_input_service_call(input);
+	udev_input_consume(input);
+
+	return 0;
+}
+
+static int
+udev_input_start_thread(struct udev_input *input)
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(input->compositor->wl_display);
+	pthread_mutexattr_t attr;
+
+	input->thread.head = 0;
+	input->thread.tail = 0;
+	input->thread.reclaim = 0;
+	input->thread.quit = 0;
+	input->thread.call.pending = 0;
+	input->thread.log.head = 0;
+	input->thread.log.tail = 0;
+	input->thread.log.dropped = 0;
+
+	if (pipe2(input->thread.wake_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+		return -1;
+
+	if (pipe2(input->thread.kick_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+		goto err_wake_pipe;
+
+	input->libinput_source =
+		wl_event_loop_add_fd(loop, input->thread.wake_pipe[0],
+				     WL_EVENT_READABLE,
+				     udev_input_thread_dispatch, input);
+	if (!input->libinput_source)
+		goto err_kick_pipe;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&input->thread.lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_mutex_init(&input->thread.call.mutex, NULL);
+	pthread_cond_init(&input->thread.call.cond, NULL);
+	pthread_mutex_init(&input->thread.log.mutex, NULL);
+
+	input->thread.running = 1;
+	if (pthread_create(&input->thread.thread, NULL,
+			   udev_input_thread, input) != 0) {
+		input->thread.running = 0;
+		goto err_mutex;
+	}
+
+	return 0;
+
+err_mutex:
+	pthread_mutex_destroy(&input->thread.log.mutex);
+	pthread_cond_destroy(&input->thread.call.cond);
+	pthread_mutex_destroy(&input->thread.call.mutex);
+	pthread_mutex_destroy(&input->thread.lock);
+	wl_event_source_remove(input->libinput_source);
+	input->libinput_source = NULL;
+err_kick_pipe:
+	close(input->thread.kick_pipe[0]);
+	close(input->thread.kick_pipe[1]);
+err_wake_pipe:
+	close(input->thread.wake_pipe[0]);
+	close(input->thread.wake_pipe[1]);
+
+	return -1;
+}
+
+static void
+udev_input_stop_thread(struct udev_input *input)
+{
+	char c = 0;
+
+	/* Holding the lock means the thread is outside libinput, and
+	 * it checks for quit before going back in. */
+	udev_input_lock(input);
+	input->thread.quit = 1;
+	udev_input_unlock(input);
+
+	if (write(input->thread.kick_pipe[1], &c, 1) < 0)
+		pthread_cancel(input->thread.thread);
+	pthread_join(input->thread.thread, NULL);
+	input->thread.running = 0;
+
+	wl_event_source_remove(input->libinput_source);
+	input->libinput_source = NULL;
+
+	/* Whatever the thread queued before stopping still counts */
+	udev_input_consume(input);
+	udev_input_thread_reclaim(input);
+	udev_input_flush_log(input);
+
+	pthread_mutex_destroy(&input->thread.log.mutex);
+	pthread_cond_destroy(&input->thread.call.cond);
+	pthread_mutex_destroy(&input->thread.call.mutex);
+	pthread_mutex_destroy(&input->thread.lock);
+	close(input->thread.kick_pipe[0]);
+	close(input->thread.kick_pipe[1]);
+	close(input->thread.wake_pipe[0]);
+	close(input->thread.wake_pipe[1]);
+}
+
+static int
+udev_input_add_source(struct udev_input *input)
 {
 	struct wl_event_loop *loop;
-	struct weston_compositor *c = input->compositor;
 	int fd;
-	struct udev_seat *seat;
-	int devices_found = 0;
 
-	loop = wl_display_get_event_loop(c->wl_display);
+	if (input->libinput_source)
+		return 0;
+
+	if (input->thread.enabled) {
+		if (udev_input_start_thread(input) == 0)
+			return 0;
+		weston_log("libinput: no input thread, reading input on "
+			   "the main loop\n");
+	}
+
+	loop = wl_display_get_event_loop(input->compositor->wl_display);
 	fd = libinput_get_fd(input->libinput);
 	input->libinput_source =
 		wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
 				     libinput_source_dispatch, input);
-	if (!input->libinput_source) {
-		return -1;
+
+	return input->libinput_source ? 0 : -1;
+}
+
+static void
+udev_input_remove_source(struct udev_input *input)
+{
+	if (input->thread.running) {
+		udev_input_stop_thread(input);
+	} else if (input->libinput_source) {
+		wl_event_source_remove(input->libinput_source);
+		input->libinput_source = NULL;
+	}
+}
+
+/* Tell the launcher which event devices of the seat libinput is going
+ * to open, so that with logind they are all requested at once rather
+ * than one round trip after the other. */
+static void
+udev_input_prefetch_devices(struct udev_input *input)
+{
+	struct weston_launcher *launcher = input->compositor->launcher;
+	struct udev_enumerate *e;
+	struct udev_list_entry *entry;
+	struct udev_device *device;
+	const char *path, *seat;
+
+	if (!launcher)
+		return;
+
+	e = udev_enumerate_new(input->udev);
+	if (!e)
+		return;
+
+	udev_enumerate_add_match_subsystem(e, "input");
+	udev_enumerate_add_match_sysname(e, "event[0-9]*");
+	udev_enumerate_scan_devices(e);
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(e)) {
+		device = udev_device_new_from_syspath(input->udev,
+				udev_list_entry_get_name(entry));
+		if (!device)
+			continue;
+
+		seat = udev_device_get_property_value(device, "ID_SEAT");
+		path = udev_device_get_devnode(device);
+		if (path && strcmp(seat ? seat : default_seat,
+				   input->seat_id) == 0)
+			weston_launcher_prefetch(launcher, path);
+
+		udev_device_unref(device);
 	}
+	udev_enumerate_unref(e);
+}
 
+static void
+udev_input_prefetch_finish(struct udev_input *input)
+{
+	if (input->compositor->launcher)
+		weston_launcher_prefetch_finish(input->compositor->launcher);
+}
+
+int
+udev_input_enable(struct udev_input *input)
+{
+	struct udev_seat *seat;
+	int devices_found = 0;
+
+	/* Resume before the input thread, if any, starts using the
+	 * libinput context. */
 	if (input->suspended) {
+		udev_input_prefetch_devices(input);
 		if (libinput_resume(input->libinput) != 0) {
-			wl_event_source_remove(input->libinput_source);
-			input->libinput_source = NULL;
+			udev_input_prefetch_finish(input);
 			return -1;
 		}
+		udev_input_prefetch_finish(input);
 		input->suspended = 0;
 		process_events(input);
 	}
 
+	if (udev_input_add_source(input) < 0)
+		return -1;
+
 	wl_list_for_each(seat, &input->compositor->seat_list, base.link) {
 		evdev_notify_keyboard_focus(&seat->base, &seat->devices_list);
 
@@ -269,6 +731,13 @@ libinput_log_func(struct libinput *libinput,
 		  enum libinput_log_priority priority,
 		  const char *format, va_list args)
 {
+	struct udev_input *input = libinput_get_user_data(libinput);
+
+	if (on_input_thread) {
+		udev_input_thread_vlog(input, format, args);
+		return;
+	}
+
 	weston_vlog(format, args);
 }
 
@@ -278,16 +747,26 @@ udev_input_init(struct udev_input *input, struct weston_compositor *c,
 {
 	enum libinput_log_priority priority = LIBINPUT_LOG_PRIORITY_INFO;
 	const char *log_priority = NULL;
+	struct weston_config_section *s;
 
 	memset(input, 0, sizeof *input);
 
 	input->compositor = c;
+	input->udev = udev;
+	input->seat_id = strdup(seat_id);
+	if (!input->seat_id)
+		return -1;
+
+	s = weston_config_get_section(c->config, "libinput", NULL, NULL);
+	weston_config_section_get_bool(s, "input_thread",
+				       &input->thread.enabled, 0);
 
 	log_priority = getenv("WESTON_LIBINPUT_LOG_PRIORITY");
 
 	input->libinput = libinput_udev_create_context(&libinput_interface,
 						       input, udev);
 	if (!input->libinput) {
+		free(input->seat_id);
 		return -1;
 	}
 
@@ -305,10 +784,14 @@ udev_input_init(struct udev_input *input, struct weston_compositor *c,
 
 	libinput_log_set_priority(input->libinput, priority);
 
+	udev_input_prefetch_devices(input);
 	if (libinput_udev_assign_seat(input->libinput, seat_id) != 0) {
+		udev_input_prefetch_finish(input);
 		libinput_unref(input->libinput);
+		free(input->seat_id);
 		return -1;
 	}
+	udev_input_prefetch_finish(input);
 
 	process_events(input);
 
@@ -320,10 +803,11 @@ udev_input_destroy(struct udev_input *input)
 {
 	struct udev_seat *seat, *next;
 
-	wl_event_source_remove(input->libinput_source);
+	udev_input_remove_source(input);
 	wl_list_for_each_safe(seat, next, &input->compositor->seat_list, base.link)
 		udev_seat_destroy(seat);
 	libinput_unref(input->libinput);
+	free(input->seat_id);
 }
 
 static void
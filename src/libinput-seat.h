@@ -29,10 +29,17 @@
 
 #include "config.h"
 
+#include <pthread.h>
 #include <libudev.h>
 
 #include "compositor.h"
 
+/* Must be a power of two */
+#define UDEV_INPUT_RING_SIZE 256
+#define UDEV_INPUT_LOG_SIZE 32
+
+struct libinput_event;
+
 struct udev_seat {
 	struct weston_seat base;
 	struct wl_list devices_list;
@@ -44,6 +51,54 @@ struct udev_input {
 	struct wl_event_source *libinput_source;
 	struct weston_compositor *compositor;
 	int suspended;
+
+	/* to look up the devices libinput is about to open */
+	struct udev *udev;
+	char *seat_id;
+
+	/* With [libinput] input_thread=true, a thread keeps draining
+	 * libinput while the main loop is busy and hands the events
+	 * over through a ring.  The thread owns libinput_dispatch() and
+	 * libinput_event_destroy(); anything else touching the libinput
+	 * context from the main loop goes through udev_input_lock(). */
+	struct {
+		int enabled;
+		int running;
+		int quit;
+		pthread_t thread;
+		pthread_mutex_t lock; /* recursive */
+		int wake_pipe[2]; /* thread -> main loop */
+		int kick_pipe[2]; /* main loop -> thread */
+
+		/* head is written by the thread and tail by the main
+		 * loop; events between reclaim and tail have been
+		 * processed and wait for the thread to destroy them. */
+		struct libinput_event *ring[UDEV_INPUT_RING_SIZE];
+		unsigned int head, tail, reclaim;
+
+		/* libinput opens and closes devices from inside
+		 * libinput_dispatch(), but the launcher may only be
+		 * used from the main loop. */
+		struct {
+			pthread_mutex_t mutex;
+			pthread_cond_t cond;
+			int pending;
+			int done;
+			const char *path;
+			int flags;
+			int fd;
+			int result;
+		} call;
+
+		/* weston_log() is main loop only, so the thread's messages,
+		 * libinput's included, are queued and printed from there. */
+		struct {
+			pthread_mutex_t mutex;
+			char *msg[UDEV_INPUT_LOG_SIZE];
+			unsigned int head, tail;
+			unsigned int dropped;
+		} log;
+	} thread;
 };
 
 int
@@ -58,6 +113,11 @@ udev_input_init(struct udev_input *input,
 void
 udev_input_destroy(struct udev_input *input);
 
+void
+udev_input_lock(struct udev_input *input);
+void
+udev_input_unlock(struct udev_input *input);
+
 struct udev_seat *
 udev_seat_get_named(struct udev_input *u,
 		    const char *seat_name);
@@ -29,6 +29,7 @@
 #include "compositor.h"
 #include "linux-dmabuf.h"
 #include "linux-dmabuf-server-protocol.h"
+#include "linux-explicit-synchronization.h"
 
 static void
 linux_dmabuf_buffer_destroy(struct linux_dmabuf_buffer *buffer)
@@ -128,13 +129,109 @@ destroy_linux_dmabuf_wl_buffer(struct wl_resource *resource)
 {
 	struct linux_dmabuf_buffer *buffer;
 
+	struct weston_client_usage *usage;
+
 	buffer = wl_resource_get_user_data(resource);
 	assert(buffer->buffer_resource == resource);
 	assert(!buffer->params_resource);
 
+	usage = weston_client_usage_find(wl_resource_get_client(resource));
+	if (usage)
+		usage->dmabuf_bytes -= buffer->accounted_bytes;
+
+	if (buffer->user_data_destroy_func)
+		buffer->user_data_destroy_func(buffer);
+
+	linux_dmabuf_buffer_destroy(buffer);
+}
+
+/* The whole allocation when the kernel tells, the planes otherwise */
+static uint64_t
+linux_dmabuf_buffer_size(struct linux_dmabuf_buffer *buffer)
+{
+	uint64_t bytes = 0;
+	off_t size;
+	int i;
+
+	size = lseek(buffer->dmabuf_fd[0], 0, SEEK_END);
+	if (size > 0)
+		return size;
+
+	for (i = 0; i < buffer->n_planes; i++)
+		bytes += (uint64_t) buffer->stride[i] * buffer->height;
+
+	return bytes;
+}
+
+static void
+params_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct linux_dmabuf_buffer *buffer =
+		wl_container_of(listener, buffer, params_destroy_listener);
+
+	wl_list_remove(&buffer->params_destroy_listener.link);
+	buffer->params_resource = NULL;
+}
+
+/* Turn the imported dmabuf into a wl_buffer */
+static void
+params_create_done(struct linux_dmabuf_buffer *buffer, bool success)
+{
+	struct wl_resource *params_resource = buffer->params_resource;
+	struct weston_client_usage *usage;
+	struct wl_client *client;
+	uint64_t bytes;
+
+	if (!params_resource) {
+		/* Nobody is left to hear of it */
+		if (success && buffer->user_data_destroy_func)
+			buffer->user_data_destroy_func(buffer);
+		linux_dmabuf_buffer_destroy(buffer);
+		return;
+	}
+
+	wl_list_remove(&buffer->params_destroy_listener.link);
+	buffer->params_resource = NULL;
+
+	if (!success)
+		goto err_failed;
+
+	client = wl_resource_get_client(params_resource);
+	buffer->buffer_resource = wl_resource_create(client,
+						     &wl_buffer_interface,
+						     1, 0);
+	if (!buffer->buffer_resource) {
+		wl_resource_post_no_memory(params_resource);
+		goto err_buffer;
+	}
+
+	wl_resource_set_implementation(buffer->buffer_resource,
+				       &linux_dmabuf_buffer_implementation,
+				       buffer, destroy_linux_dmabuf_wl_buffer);
+
+	/* Over the limit, the client is disconnected, which destroys
+	 * the new wl_buffer too */
+	usage = weston_client_usage_get(buffer->compositor, client);
+	bytes = linux_dmabuf_buffer_size(buffer);
+	if (!usage ||
+	    weston_client_usage_add_memory(usage, &usage->dmabuf_bytes,
+					   bytes) < 0) {
+		wl_resource_post_no_memory(params_resource);
+		return;
+	}
+	buffer->accounted_bytes = bytes;
+
+	zlinux_buffer_params_send_created(params_resource,
+					  buffer->buffer_resource);
+
+	return;
+
+err_buffer:
 	if (buffer->user_data_destroy_func)
 		buffer->user_data_destroy_func(buffer);
 
+err_failed:
+	zlinux_buffer_params_send_failed(params_resource);
 	linux_dmabuf_buffer_destroy(buffer);
 }
 
@@ -254,33 +351,18 @@ params_create(struct wl_client *client,
 	 * checks (e.g. drm_format_num_planes).
 	 */
 
-	if (!weston_compositor_import_dmabuf(buffer->compositor, buffer))
-		goto err_failed;
+	/* The params stay around for the created or failed event, unless
+	 * the client destroys them first */
+	buffer->params_resource = params_resource;
+	buffer->params_destroy_listener.notify = params_handle_destroy;
+	wl_resource_add_destroy_listener(params_resource,
+					 &buffer->params_destroy_listener);
 
-	buffer->buffer_resource = wl_resource_create(client,
-						     &wl_buffer_interface,
-						     1, 0);
-	if (!buffer->buffer_resource) {
-		wl_resource_post_no_memory(params_resource);
-		goto err_buffer;
-	}
-
-	wl_resource_set_implementation(buffer->buffer_resource,
-				       &linux_dmabuf_buffer_implementation,
-				       buffer, destroy_linux_dmabuf_wl_buffer);
-
-	zlinux_buffer_params_send_created(params_resource,
-					  buffer->buffer_resource);
+	weston_compositor_import_dmabuf_async(buffer->compositor, buffer,
+					      params_create_done);
 
 	return;
 
-err_buffer:
-	if (buffer->user_data_destroy_func)
-		buffer->user_data_destroy_func(buffer);
-
-err_failed:
-	zlinux_buffer_params_send_failed(params_resource);
-
 err_out:
 	linux_dmabuf_buffer_destroy(buffer);
 }
@@ -411,9 +493,60 @@ linux_dmabuf_buffer_get_user_data(struct linux_dmabuf_buffer *buffer)
 	return buffer->user_data;
 }
 
+static void
+scanout_feedback_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct zlinux_dmabuf_scanout_feedback_interface
+scanout_feedback_implementation = {
+	scanout_feedback_destroy
+};
+
+static void
+linux_dmabuf_get_scanout_feedback(struct wl_client *client,
+				  struct wl_resource *linux_dmabuf_resource,
+				  uint32_t id,
+				  struct wl_resource *output_resource)
+{
+	struct weston_output *output = wl_resource_get_user_data(output_resource);
+	struct weston_scanout_format *format;
+	struct wl_resource *resource;
+	struct wl_array formats;
+
+	resource = wl_resource_create(client,
+				      &zlinux_dmabuf_scanout_feedback_interface,
+				      1, id);
+	if (resource == NULL) {
+		wl_resource_post_no_memory(linux_dmabuf_resource);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &scanout_feedback_implementation,
+				       NULL, NULL);
+
+	/* Outputs of backends without planes scan out nothing directly */
+	wl_array_init(&formats);
+	if (output && output->get_scanout_formats)
+		output->get_scanout_formats(output, &formats);
+
+	wl_array_for_each(format, &formats)
+		zlinux_dmabuf_scanout_feedback_send_scanout_format(resource,
+				format->format,
+				format->modifier >> 32,
+				format->modifier & 0xffffffff,
+				format->plane);
+	wl_array_release(&formats);
+
+	zlinux_dmabuf_scanout_feedback_send_done(resource);
+}
+
 static const struct zlinux_dmabuf_interface linux_dmabuf_implementation = {
 	linux_dmabuf_destroy,
-	linux_dmabuf_create_params
+	linux_dmabuf_create_params,
+	linux_dmabuf_get_scanout_feedback
 };
 
 static void
@@ -453,10 +586,15 @@ WL_EXPORT int
 linux_dmabuf_setup(struct weston_compositor *compositor)
 {
 	if (!wl_global_create(compositor->wl_display,
-			      &zlinux_dmabuf_interface, 1,
+			      &zlinux_dmabuf_interface, 2,
 			      compositor, bind_linux_dmabuf))
 		return -1;
 
+	/* Fences are only accepted for dmabuf buffers */
+	if (compositor->capabilities & WESTON_CAP_EXPLICIT_SYNC &&
+	    linux_explicit_synchronization_setup(compositor) < 0)
+		return -1;
+
 	return 0;
 }
 
@@ -45,6 +45,12 @@ struct linux_dmabuf_buffer {
 	uint32_t stride[MAX_DMABUF_PLANES];
 	uint64_t modifier[MAX_DMABUF_PLANES];
 
+	/* counted in the client's weston_client_usage::dmabuf_bytes */
+	uint64_t accounted_bytes;
+
+	/* clears params_resource if it goes away while importing */
+	struct wl_listener params_destroy_listener;
+
 	void *user_data;
 	dmabuf_user_data_destroy_func user_data_destroy_func;
 
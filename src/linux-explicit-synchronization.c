@@ -0,0 +1,437 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and
+ * its documentation for any purpose is hereby granted without fee, provided
+ * that the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of the copyright holders not be used in
+ * advertising or publicity pertaining to distribution of the software
+ * without specific, written prior permission.  The copyright holders make
+ * no representations about the suitability of this software for any
+ * purpose.  It is provided "as is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS
+ * SOFTWARE, INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS, IN NO EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER
+ * RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF
+ * CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/types.h>
+
+#include "compositor.h"
+#include "shared/helpers.h"
+#include "linux-dmabuf.h"
+#include "linux-explicit-synchronization.h"
+#include "linux-explicit-synchronization-server-protocol.h"
+
+/* From linux/sync_file.h, which older kernel headers lack */
+#ifndef SYNC_IOC_FILE_INFO
+struct sync_file_info {
+	char name[32];
+	__s32 status;
+	__u32 flags;
+	__u32 num_fences;
+	__u32 pad;
+	__u64 sync_fence_info;
+};
+
+#define SYNC_IOC_MAGIC		'>'
+#define SYNC_IOC_FILE_INFO	_IOWR(SYNC_IOC_MAGIC, 4, struct sync_file_info)
+#endif
+
+struct linux_surface_synchronization {
+	struct wl_resource *resource;
+	struct weston_surface *surface; /* NULL once destroyed */
+	struct wl_listener surface_destroy_listener;
+};
+
+static int
+sync_file_is_valid(int fd)
+{
+	struct sync_file_info info = { { 0 } };
+
+	return ioctl(fd, SYNC_IOC_FILE_INFO, &info) == 0 &&
+	       info.num_fences > 0;
+}
+
+static void
+fd_clear(int *fd)
+{
+	if (*fd >= 0)
+		close(*fd);
+	*fd = -1;
+}
+
+static void
+buffer_release_free(struct weston_buffer_release *buffer_release)
+{
+	fd_clear(&buffer_release->fence_fd);
+	free(buffer_release);
+}
+
+static void
+destroy_linux_buffer_release(struct wl_resource *resource)
+{
+	struct weston_buffer_release *buffer_release =
+		wl_resource_get_user_data(resource);
+
+	/* The client went away with the buffer still in use */
+	buffer_release->resource = NULL;
+	if (buffer_release->ref_count == 0)
+		buffer_release_free(buffer_release);
+}
+
+static void
+buffer_release_send(struct weston_buffer_release *buffer_release)
+{
+	struct wl_resource *resource = buffer_release->resource;
+
+	if (!resource) {
+		buffer_release_free(buffer_release);
+		return;
+	}
+
+	if (buffer_release->fence_fd >= 0)
+		zlinux_buffer_release_send_fenced_release(resource,
+						buffer_release->fence_fd);
+	else
+		zlinux_buffer_release_send_immediate_release(resource);
+
+	/* Frees buffer_release through destroy_linux_buffer_release */
+	wl_resource_destroy(resource);
+}
+
+/** Point a reference at a buffer release
+ *
+ * \param ref The reference to update.
+ * \param buffer_release The new release, or NULL.
+ *
+ * Dropping the last reference sends the release to the client, with
+ * the fence set through weston_buffer_release_set_fence() if any.
+ */
+WL_EXPORT void
+weston_buffer_release_reference(struct weston_buffer_release_reference *ref,
+				struct weston_buffer_release *buffer_release)
+{
+	if (ref->buffer_release == buffer_release)
+		return;
+
+	if (buffer_release)
+		buffer_release->ref_count++;
+
+	if (ref->buffer_release &&
+	    --ref->buffer_release->ref_count == 0)
+		buffer_release_send(ref->buffer_release);
+
+	ref->buffer_release = buffer_release;
+}
+
+/** Move a buffer release reference, dropping whatever dest held */
+WL_EXPORT void
+weston_buffer_release_move(struct weston_buffer_release_reference *dest,
+			   struct weston_buffer_release_reference *src)
+{
+	weston_buffer_release_reference(dest, src->buffer_release);
+	weston_buffer_release_reference(src, NULL);
+}
+
+/** Hand the fence of the latest operation on the buffer to its release
+ *
+ * \param buffer_release The release, may be NULL.
+ * \param fence_fd A sync_file fd, ownership is taken.
+ *
+ * The fence replaces any earlier one, so whoever sets it last has to
+ * know that the earlier operations are done by the time it signals.
+ */
+WL_EXPORT void
+weston_buffer_release_set_fence(struct weston_buffer_release *buffer_release,
+				int fence_fd)
+{
+	if (!buffer_release) {
+		close(fence_fd);
+		return;
+	}
+
+	fd_clear(&buffer_release->fence_fd);
+	buffer_release->fence_fd = fence_fd;
+}
+
+static void
+surface_synchronization_handle_surface_destroy(struct wl_listener *listener,
+					       void *data)
+{
+	struct linux_surface_synchronization *sync =
+		container_of(listener, struct linux_surface_synchronization,
+			     surface_destroy_listener);
+
+	sync->surface = NULL;
+	wl_list_remove(&sync->surface_destroy_listener.link);
+}
+
+static void
+destroy_linux_surface_synchronization(struct wl_resource *resource)
+{
+	struct linux_surface_synchronization *sync =
+		wl_resource_get_user_data(resource);
+	struct weston_surface *surface = sync->surface;
+
+	if (surface) {
+		fd_clear(&surface->pending.acquire_fence_fd);
+		weston_buffer_release_reference(
+			&surface->pending.buffer_release_ref, NULL);
+		surface->synchronization_resource = NULL;
+		wl_list_remove(&sync->surface_destroy_listener.link);
+	}
+
+	free(sync);
+}
+
+static void
+surface_synchronization_destroy(struct wl_client *client,
+				struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+surface_synchronization_set_acquire_fence(struct wl_client *client,
+					  struct wl_resource *resource,
+					  int32_t fd)
+{
+	struct linux_surface_synchronization *sync =
+		wl_resource_get_user_data(resource);
+	struct weston_surface *surface = sync->surface;
+
+	if (!surface) {
+		wl_resource_post_error(resource,
+			ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_NO_SURFACE,
+			"the surface has been destroyed");
+		goto err;
+	}
+
+	if (surface->pending.acquire_fence_fd >= 0) {
+		wl_resource_post_error(resource,
+			ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_DUPLICATE_FENCE,
+			"an acquire fence was already set for this commit");
+		goto err;
+	}
+
+	if (!sync_file_is_valid(fd)) {
+		wl_resource_post_error(resource,
+			ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_INVALID_FENCE,
+			"the acquire fence is not a valid sync_file");
+		goto err;
+	}
+
+	surface->pending.acquire_fence_fd = fd;
+	return;
+
+err:
+	close(fd);
+}
+
+static void
+surface_synchronization_get_release(struct wl_client *client,
+				    struct wl_resource *resource,
+				    uint32_t id)
+{
+	struct linux_surface_synchronization *sync =
+		wl_resource_get_user_data(resource);
+	struct weston_surface *surface = sync->surface;
+	struct weston_buffer_release *buffer_release;
+
+	if (!surface) {
+		wl_resource_post_error(resource,
+			ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_NO_SURFACE,
+			"the surface has been destroyed");
+		return;
+	}
+
+	if (surface->pending.buffer_release_ref.buffer_release) {
+		wl_resource_post_error(resource,
+			ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_DUPLICATE_RELEASE,
+			"a release was already requested for this commit");
+		return;
+	}
+
+	buffer_release = zalloc(sizeof *buffer_release);
+	if (!buffer_release)
+		goto err_alloc;
+
+	buffer_release->fence_fd = -1;
+	buffer_release->resource =
+		wl_resource_create(client, &zlinux_buffer_release_interface,
+				   wl_resource_get_version(resource), id);
+	if (!buffer_release->resource)
+		goto err_create;
+
+	wl_resource_set_implementation(buffer_release->resource, NULL,
+				       buffer_release,
+				       destroy_linux_buffer_release);
+
+	weston_buffer_release_reference(&surface->pending.buffer_release_ref,
+					buffer_release);
+	return;
+
+err_create:
+	free(buffer_release);
+err_alloc:
+	wl_client_post_no_memory(client);
+}
+
+static const struct zlinux_surface_synchronization_interface
+surface_synchronization_interface = {
+	surface_synchronization_destroy,
+	surface_synchronization_set_acquire_fence,
+	surface_synchronization_get_release
+};
+
+static void
+linux_explicit_synchronization_destroy(struct wl_client *client,
+				       struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+linux_explicit_synchronization_get_synchronization(
+				struct wl_client *client,
+				struct wl_resource *resource,
+				uint32_t id,
+				struct wl_resource *surface_resource)
+{
+	struct weston_surface *surface =
+		wl_resource_get_user_data(surface_resource);
+	struct linux_surface_synchronization *sync;
+
+	if (surface->synchronization_resource) {
+		wl_resource_post_error(resource,
+			ZLINUX_EXPLICIT_SYNCHRONIZATION_ERROR_SYNCHRONIZATION_EXISTS,
+			"the surface already has a synchronization object");
+		return;
+	}
+
+	sync = zalloc(sizeof *sync);
+	if (!sync)
+		goto err_alloc;
+
+	sync->surface = surface;
+	sync->resource =
+		wl_resource_create(client,
+				   &zlinux_surface_synchronization_interface,
+				   wl_resource_get_version(resource), id);
+	if (!sync->resource)
+		goto err_create;
+
+	wl_resource_set_implementation(sync->resource,
+				       &surface_synchronization_interface,
+				       sync,
+				       destroy_linux_surface_synchronization);
+
+	sync->surface_destroy_listener.notify =
+		surface_synchronization_handle_surface_destroy;
+	wl_signal_add(&surface->destroy_signal,
+		      &sync->surface_destroy_listener);
+
+	surface->synchronization_resource = sync->resource;
+	return;
+
+err_create:
+	free(sync);
+err_alloc:
+	wl_client_post_no_memory(client);
+}
+
+static const struct zlinux_explicit_synchronization_interface
+linux_explicit_synchronization_interface = {
+	linux_explicit_synchronization_destroy,
+	linux_explicit_synchronization_get_synchronization
+};
+
+static void
+bind_linux_explicit_synchronization(struct wl_client *client,
+				    void *data, uint32_t version, uint32_t id)
+{
+	struct weston_compositor *compositor = data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client,
+				      &zlinux_explicit_synchronization_interface,
+				      version, id);
+	if (resource == NULL) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource,
+				       &linux_explicit_synchronization_interface,
+				       compositor, NULL);
+}
+
+/** Check the pending synchronization state on wl_surface.commit
+ *
+ * \param surface The surface being committed.
+ * \return Zero if the commit may go ahead, -1 if a protocol error
+ * was posted.
+ *
+ * A fence or release is only meaningful with a newly attached
+ * zlinux_dmabuf buffer: other buffer types are implicitly synchronized
+ * only, or read by the CPU.
+ */
+WL_EXPORT int
+linux_explicit_synchronization_check_commit(struct weston_surface *surface)
+{
+	struct weston_surface_state *pending = &surface->pending;
+
+	if (!surface->synchronization_resource)
+		return 0;
+
+	if (pending->acquire_fence_fd < 0 &&
+	    !pending->buffer_release_ref.buffer_release)
+		return 0;
+
+	if (!pending->newly_attached || !pending->buffer) {
+		wl_resource_post_error(surface->synchronization_resource,
+			ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_NO_BUFFER,
+			"fence or release without an attached buffer");
+		return -1;
+	}
+
+	if (!linux_dmabuf_buffer_get(pending->buffer->resource)) {
+		wl_resource_post_error(surface->synchronization_resource,
+			ZLINUX_SURFACE_SYNCHRONIZATION_ERROR_UNSUPPORTED_BUFFER,
+			"fences are only supported with dmabuf buffers");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Advertise the zlinux_explicit_synchronization global
+ *
+ * \param compositor The compositor to advertise it on.
+ * \return Zero on success, -1 on failure.
+ *
+ * Only called when the renderer set WESTON_CAP_EXPLICIT_SYNC, as the
+ * whole point is that somebody waits for the acquire fences.
+ */
+WL_EXPORT int
+linux_explicit_synchronization_setup(struct weston_compositor *compositor)
+{
+	if (!wl_global_create(compositor->wl_display,
+			      &zlinux_explicit_synchronization_interface, 1,
+			      compositor, bind_linux_explicit_synchronization))
+		return -1;
+
+	return 0;
+}
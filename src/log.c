@@ -29,49 +29,320 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <sys/time.h>
 #include <time.h>
 
 #include <wayland-util.h>
 
 #include "compositor.h"
+#include "shared/helpers.h"
 
 #include "os-compatibility.h"
 
 static FILE *weston_logfile = NULL;
 
+/* Shared by all logging threads, only ever swapped atomically */
 static int cached_tm_mday = -1;
 
-static int weston_log_timestamp(void)
+/* Messages are formatted by the logging thread into a bounded ring of
+ * fixed size slots, and a writer thread does the file I/O, so a slow
+ * log file cannot stall the compositor. Any thread may log: slots are
+ * claimed with a compare-and-swap on head and published through their
+ * sequence number. A slot holds the longest message log_vwrite()
+ * formats, so a message is never split between slots and cannot
+ * interleave with another. A full ring drops the message and counts
+ * it. Without the ring, log_vwrite() writes a message with the log
+ * file locked, which keeps it in one piece as well. */
+#define LOG_RING_SIZE 512 /* power of two */
+#define LOG_SLOT_SIZE 1024
+
+struct log_slot {
+	unsigned int seq;
+	unsigned int len;
+	char text[LOG_SLOT_SIZE];
+};
+
+static struct {
+	struct log_slot *slots;
+	unsigned int head; /* next slot to claim */
+	unsigned int tail; /* next slot to write, writer thread only */
+	unsigned int dropped;
+	int idle; /* writer is waiting for the wake pipe */
+	int quit;
+	int running;
+	int sync; /* bypass the ring, see weston_log_sync() */
+	int draining; /* the ring is being written out */
+	int atfork; /* the fork handler is installed */
+	int wake_pipe[2];
+	pthread_t thread;
+} log_ring;
+
+static void
+log_ring_wake(void)
+{
+	char c = 0;
+
+	if (!__atomic_exchange_n(&log_ring.idle, 0, __ATOMIC_SEQ_CST))
+		return;
+
+	/* A full pipe means the writer has wake-ups pending anyway */
+	if (write(log_ring.wake_pipe[1], &c, 1) < 0)
+		return;
+}
+
+static void
+log_ring_push(const char *text, size_t len)
+{
+	struct log_slot *slot;
+	unsigned int pos;
+	int diff;
+
+	pos = __atomic_load_n(&log_ring.head, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &log_ring.slots[pos & (LOG_RING_SIZE - 1)];
+		diff = (int) (__atomic_load_n(&slot->seq,
+					      __ATOMIC_ACQUIRE) - pos);
+		if (diff < 0) {
+			/* Not written out yet: the ring is full */
+			__atomic_fetch_add(&log_ring.dropped, 1,
+					   __ATOMIC_RELAXED);
+			return;
+		} else if (diff > 0) {
+			/* Another thread claimed it first */
+			pos = __atomic_load_n(&log_ring.head,
+					      __ATOMIC_RELAXED);
+		} else if (__atomic_compare_exchange_n(&log_ring.head,
+						       &pos, pos + 1, 1,
+						       __ATOMIC_RELAXED,
+						       __ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+
+	len = MIN(len, sizeof slot->text);
+	memcpy(slot->text, text, len);
+	slot->len = len;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+	log_ring_wake();
+}
+
+/* Write out everything published so far, returns the number of slots.
+ * Returns 0 without writing if another thread is draining, which only
+ * happens when the crash handler took over from the writer thread. */
+static int
+log_ring_drain(void)
+{
+	struct log_slot *slot;
+	unsigned int dropped;
+	int count = 0;
+	int expected = 0;
+
+	if (!__atomic_compare_exchange_n(&log_ring.draining, &expected, 1, 0,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return 0;
+
+	for (;;) {
+		slot = &log_ring.slots[log_ring.tail & (LOG_RING_SIZE - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) !=
+		    log_ring.tail + 1)
+			break;
+
+		fwrite(slot->text, 1, slot->len, weston_logfile);
+		__atomic_store_n(&slot->seq, log_ring.tail + LOG_RING_SIZE,
+				 __ATOMIC_RELEASE);
+		log_ring.tail++;
+		count++;
+	}
+
+	dropped = __atomic_exchange_n(&log_ring.dropped, 0, __ATOMIC_RELAXED);
+	if (dropped)
+		fprintf(weston_logfile, "[log: %u messages dropped]\n",
+			dropped);
+
+	if (count || dropped)
+		fflush(weston_logfile);
+
+	__atomic_store_n(&log_ring.draining, 0, __ATOMIC_RELEASE);
+
+	return count;
+}
+
+static void *
+log_ring_thread(void *data)
+{
+	char buf[64];
+
+	for (;;) {
+		log_ring_drain();
+
+		__atomic_store_n(&log_ring.idle, 1, __ATOMIC_SEQ_CST);
+		/* Anything published before we went idle is ours,
+		 * anything after will wake us. */
+		if (log_ring_drain() > 0) {
+			log_ring.idle = 0;
+			continue;
+		}
+
+		if (__atomic_load_n(&log_ring.quit, __ATOMIC_SEQ_CST))
+			break;
+
+		if (read(log_ring.wake_pipe[0], buf, sizeof buf) < 0 &&
+		    errno != EINTR)
+			break;
+	}
+
+	return NULL;
+}
+
+/* The writer thread does not survive fork(), so the child writes its
+ * messages itself, until it execs */
+static void
+log_ring_atfork_child(void)
+{
+	log_ring.running = 0;
+}
+
+static void
+log_ring_start(void)
+{
+	unsigned int i;
+
+	log_ring.slots = calloc(LOG_RING_SIZE, sizeof *log_ring.slots);
+	if (!log_ring.slots)
+		return;
+
+	for (i = 0; i < LOG_RING_SIZE; i++)
+		log_ring.slots[i].seq = i;
+	log_ring.head = 0;
+	log_ring.tail = 0;
+	log_ring.quit = 0;
+
+	if (pipe2(log_ring.wake_pipe, O_CLOEXEC) < 0)
+		goto err_slots;
+	fcntl(log_ring.wake_pipe[1], F_SETFL, O_NONBLOCK);
+
+	if (!log_ring.atfork) {
+		if (pthread_atfork(NULL, NULL, log_ring_atfork_child) != 0)
+			goto err_pipe;
+		log_ring.atfork = 1;
+	}
+
+	if (pthread_create(&log_ring.thread, NULL, log_ring_thread, NULL))
+		goto err_pipe;
+
+	log_ring.running = 1;
+	return;
+
+err_pipe:
+	close(log_ring.wake_pipe[0]);
+	close(log_ring.wake_pipe[1]);
+err_slots:
+	free(log_ring.slots);
+	log_ring.slots = NULL;
+}
+
+static void
+log_ring_stop(void)
+{
+	char c = 0;
+
+	if (!log_ring.running)
+		return;
+
+	__atomic_store_n(&log_ring.quit, 1, __ATOMIC_SEQ_CST);
+	if (write(log_ring.wake_pipe[1], &c, 1) < 0 && errno != EAGAIN)
+		return; /* leave the thread be rather than hang */
+	pthread_join(log_ring.thread, NULL);
+	log_ring.running = 0;
+
+	close(log_ring.wake_pipe[0]);
+	close(log_ring.wake_pipe[1]);
+	free(log_ring.slots);
+	log_ring.slots = NULL;
+}
+
+/* The timestamp prefix of a message, with a date line first when the
+ * day changed */
+static int
+log_timestamp(char *buf, size_t size)
 {
 	struct timeval tv;
-	struct tm *brokendown_time;
+	struct tm *brokendown_time, tm;
 	char string[128];
+	int l = 0, mday;
 
 	gettimeofday(&tv, NULL);
 
-	brokendown_time = localtime(&tv.tv_sec);
+	brokendown_time = localtime_r(&tv.tv_sec, &tm);
 	if (brokendown_time == NULL)
-		return fprintf(weston_logfile, "[(NULL)localtime] ");
+		return snprintf(buf, size, "[(NULL)localtime] ");
 
-	if (brokendown_time->tm_mday != cached_tm_mday) {
+	/* Only the thread that sees the day change prints the date */
+	mday = brokendown_time->tm_mday;
+	if (__atomic_exchange_n(&cached_tm_mday, mday,
+				__ATOMIC_RELAXED) != mday) {
 		strftime(string, sizeof string, "%Y-%m-%d %Z", brokendown_time);
-		fprintf(weston_logfile, "Date: %s\n", string);
-
-		cached_tm_mday = brokendown_time->tm_mday;
+		l = snprintf(buf, size, "Date: %s\n", string);
 	}
 
 	strftime(string, sizeof string, "%H:%M:%S", brokendown_time);
 
-	return fprintf(weston_logfile, "[%s.%03li] ", string, tv.tv_usec/1000);
+	return l + snprintf(buf + l, size - l, "[%s.%03li] ",
+			    string, tv.tv_usec/1000);
+}
+
+/* Format a message, with prefix in front of it, and queue it in one
+ * piece so messages from different threads do not mix. */
+static int
+log_vwrite(const char *prefix, const char *fmt, va_list ap)
+{
+	char buf[LOG_SLOT_SIZE];
+	int l = 0, m;
+
+	if (prefix)
+		l = snprintf(buf, sizeof buf, "%s", prefix);
+
+	if (!log_ring.running || log_ring.sync) {
+		flockfile(weston_logfile);
+		if (l > 0)
+			fputs(buf, weston_logfile);
+		m = vfprintf(weston_logfile, fmt, ap);
+		funlockfile(weston_logfile);
+
+		return l + m;
+	}
+
+	m = vsnprintf(buf + l, sizeof buf - l, fmt, ap);
+	if (m < 0)
+		return m;
+
+	log_ring_push(buf, MIN((size_t) (l + m), sizeof buf - 1));
+
+	return l + m;
+}
+
+static int
+log_vwrite_stamped(const char *tag, const char *fmt, va_list ap)
+{
+	char prefix[256];
+	int l;
+
+	l = log_timestamp(prefix, sizeof prefix);
+	if (tag)
+		snprintf(prefix + l, sizeof prefix - l, "%s", tag);
+
+	return log_vwrite(prefix, fmt, ap);
 }
 
 static void
 custom_handler(const char *fmt, va_list arg)
 {
-	weston_log_timestamp();
-	fprintf(weston_logfile, "libwayland: ");
-	vfprintf(weston_logfile, fmt, arg);
+	log_vwrite_stamped("libwayland: ", fmt, arg);
 }
 
 void
@@ -89,25 +360,41 @@ weston_log_file_open(const char *filename)
 		weston_logfile = stderr;
 	else
 		setvbuf(weston_logfile, NULL, _IOLBF, 256);
+
+	if (!getenv("WESTON_LOG_SYNC"))
+		log_ring_start();
 }
 
 void
 weston_log_file_close()
 {
+	log_ring_stop();
+
 	if ((weston_logfile != stderr) && (weston_logfile != NULL))
 		fclose(weston_logfile);
 	weston_logfile = stderr;
 }
 
-WL_EXPORT int
-weston_vlog(const char *fmt, va_list ap)
+/** Write log messages directly from now on
+ *
+ * For the crash handler: the writer thread may never get to run
+ * again, so the messages still in the ring are written out here and
+ * what follows is written by the caller. If the writer thread is in
+ * the middle of writing, or crashed doing so, the ring is left to it.
+ */
+void
+weston_log_sync(void)
 {
-	int l;
+	__atomic_store_n(&log_ring.sync, 1, __ATOMIC_SEQ_CST);
 
-	l = weston_log_timestamp();
-	l += vfprintf(weston_logfile, fmt, ap);
+	if (log_ring.running)
+		log_ring_drain();
+}
 
-	return l;
+WL_EXPORT int
+weston_vlog(const char *fmt, va_list ap)
+{
+	return log_vwrite_stamped(NULL, fmt, ap);
 }
 
 WL_EXPORT int
@@ -126,7 +413,7 @@ weston_log(const char *fmt, ...)
 WL_EXPORT int
 weston_vlog_continue(const char *fmt, va_list argp)
 {
-	return vfprintf(weston_logfile, fmt, argp);
+	return log_vwrite(NULL, fmt, argp);
 }
 
 WL_EXPORT int
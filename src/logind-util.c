@@ -39,6 +39,7 @@
 #include <sys/ioctl.h>
 #include <sys/signalfd.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <systemd/sd-login.h>
 #include <unistd.h>
 
@@ -67,33 +68,109 @@ struct weston_logind {
 	struct wl_event_source *dbus_ctx;
 	char *spath;
 	DBusPendingCall *pending_active;
+
+	/* struct weston_logind_device, see weston_logind_prefetch() */
+	struct wl_list prefetch_list;
 };
 
-static int
-weston_logind_take_device(struct weston_logind *wl, uint32_t major,
-			  uint32_t minor, bool *paused_out)
+/* A TakeDevice call sent ahead of the open that wants its reply */
+struct weston_logind_device {
+	struct wl_list link;
+	dev_t devnum;
+	DBusPendingCall *pending;
+};
+
+static DBusMessage *
+weston_logind_new_take_device(struct weston_logind *wl, uint32_t major,
+			      uint32_t minor)
 {
-	DBusMessage *m, *reply;
-	bool b;
-	int r, fd;
-	dbus_bool_t paused;
+	DBusMessage *m;
 
 	m = dbus_message_new_method_call("org.freedesktop.login1",
 					 wl->spath,
 					 "org.freedesktop.login1.Session",
 					 "TakeDevice");
 	if (!m)
-		return -ENOMEM;
+		return NULL;
 
-	b = dbus_message_append_args(m,
-				     DBUS_TYPE_UINT32, &major,
-				     DBUS_TYPE_UINT32, &minor,
-				     DBUS_TYPE_INVALID);
-	if (!b) {
-		r = -ENOMEM;
-		goto err_unref;
+	if (!dbus_message_append_args(m,
+				      DBUS_TYPE_UINT32, &major,
+				      DBUS_TYPE_UINT32, &minor,
+				      DBUS_TYPE_INVALID)) {
+		dbus_message_unref(m);
+		return NULL;
 	}
 
+	return m;
+}
+
+static int
+weston_logind_parse_take_device(DBusMessage *reply, bool *paused_out)
+{
+	dbus_bool_t paused;
+	int fd;
+
+	if (!dbus_message_get_args(reply, NULL,
+				   DBUS_TYPE_UNIX_FD, &fd,
+				   DBUS_TYPE_BOOLEAN, &paused,
+				   DBUS_TYPE_INVALID))
+		return -ENODEV;
+
+	if (paused_out)
+		*paused_out = paused;
+
+	return fd;
+}
+
+static struct weston_logind_device *
+weston_logind_find_prefetch(struct weston_logind *wl, dev_t devnum)
+{
+	struct weston_logind_device *dev;
+
+	wl_list_for_each(dev, &wl->prefetch_list, link)
+		if (dev->devnum == devnum)
+			return dev;
+
+	return NULL;
+}
+
+/* Wait for the reply of a prefetched TakeDevice and forget the call */
+static DBusMessage *
+weston_logind_device_finish(struct weston_logind_device *dev)
+{
+	DBusMessage *reply;
+
+	dbus_pending_call_block(dev->pending);
+	reply = dbus_pending_call_steal_reply(dev->pending);
+	dbus_pending_call_unref(dev->pending);
+	wl_list_remove(&dev->link);
+	free(dev);
+
+	return reply;
+}
+
+static int
+weston_logind_take_device(struct weston_logind *wl, uint32_t major,
+			  uint32_t minor, bool *paused_out)
+{
+	struct weston_logind_device *dev;
+	DBusMessage *m, *reply;
+	int r;
+
+	dev = weston_logind_find_prefetch(wl, makedev(major, minor));
+	if (dev) {
+		reply = weston_logind_device_finish(dev);
+		if (reply) {
+			r = weston_logind_parse_take_device(reply, paused_out);
+			dbus_message_unref(reply);
+			return r;
+		}
+	}
+
+	m = weston_logind_new_take_device(wl, major, minor);
+	if (!m)
+		return -ENOMEM;
+
 	reply = dbus_connection_send_with_reply_and_block(wl->dbus, m,
 							  -1, NULL);
 	if (!reply) {
@@ -101,20 +178,8 @@ weston_logind_take_device(struct weston_logind *wl, uint32_t major,
 		goto err_unref;
 	}
 
-	b = dbus_message_get_args(reply, NULL,
-				  DBUS_TYPE_UNIX_FD, &fd,
-				  DBUS_TYPE_BOOLEAN, &paused,
-				  DBUS_TYPE_INVALID);
-	if (!b) {
-		r = -ENODEV;
-		goto err_reply;
-	}
+	r = weston_logind_parse_take_device(reply, paused_out);
 
-	r = fd;
-	if (paused_out)
-		*paused_out = paused;
-
-err_reply:
 	dbus_message_unref(reply);
 err_unref:
 	dbus_message_unref(m);
@@ -216,6 +281,75 @@ err_close:
 	return -1;
 }
 
+/** Send the TakeDevice call for a device that is about to be opened
+ *
+ * weston_logind_open() of the same device then only waits for the
+ * reply. Prefetching all devices of a seat before libinput opens them
+ * keeps one round trip to logind in flight per device, instead of
+ * making them one after the other.
+ */
+WL_EXPORT void
+weston_logind_prefetch(struct weston_logind *wl, const char *path)
+{
+	struct weston_logind_device *dev;
+	struct stat st;
+	DBusMessage *m;
+
+	if (stat(path, &st) < 0 || !S_ISCHR(st.st_mode))
+		return;
+
+	if (weston_logind_find_prefetch(wl, st.st_rdev))
+		return;
+
+	dev = zalloc(sizeof *dev);
+	if (!dev)
+		return;
+
+	m = weston_logind_new_take_device(wl, major(st.st_rdev),
+					  minor(st.st_rdev));
+	if (!m) {
+		free(dev);
+		return;
+	}
+
+	if (!dbus_connection_send_with_reply(wl->dbus, m, &dev->pending, -1) ||
+	    !dev->pending) {
+		dbus_message_unref(m);
+		free(dev);
+		return;
+	}
+	dbus_message_unref(m);
+
+	dev->devnum = st.st_rdev;
+	wl_list_insert(&wl->prefetch_list, &dev->link);
+}
+
+/** Give back the prefetched devices nobody opened */
+WL_EXPORT void
+weston_logind_prefetch_finish(struct weston_logind *wl)
+{
+	struct weston_logind_device *dev, *next;
+	DBusMessage *reply;
+	dev_t devnum;
+	int fd;
+
+	wl_list_for_each_safe(dev, next, &wl->prefetch_list, link) {
+		devnum = dev->devnum;
+		reply = weston_logind_device_finish(dev);
+		if (!reply)
+			continue;
+
+		fd = weston_logind_parse_take_device(reply, NULL);
+		dbus_message_unref(reply);
+		if (fd < 0)
+			continue;
+
+		close(fd);
+		weston_logind_release_device(wl, major(devnum),
+					     minor(devnum));
+	}
+}
+
 WL_EXPORT void
 weston_logind_close(struct weston_logind *wl, int fd)
 {
@@ -842,6 +976,7 @@ weston_logind_connect(struct weston_logind **out,
 
 	wl->compositor = compositor;
 	wl->sync_drm = sync_drm;
+	wl_list_init(&wl->prefetch_list);
 
 	wl->seat = strdup(seat_id);
 	if (!wl->seat) {
@@ -925,6 +1060,16 @@ err_out:
 WL_EXPORT void
 weston_logind_destroy(struct weston_logind *wl)
 {
+	struct weston_logind_device *dev, *next;
+
+	/* Releasing control gives back whatever these took */
+	wl_list_for_each_safe(dev, next, &wl->prefetch_list, link) {
+		dbus_pending_call_cancel(dev->pending);
+		dbus_pending_call_unref(dev->pending);
+		wl_list_remove(&dev->link);
+		free(dev);
+	}
+
 	if (wl->pending_active) {
 		dbus_pending_call_cancel(wl->pending_active);
 		dbus_pending_call_unref(wl->pending_active);
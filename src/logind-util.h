@@ -45,6 +45,12 @@ weston_logind_open(struct weston_logind *wl, const char *path,
 void
 weston_logind_close(struct weston_logind *wl, int fd);
 
+void
+weston_logind_prefetch(struct weston_logind *wl, const char *path);
+
+void
+weston_logind_prefetch_finish(struct weston_logind *wl);
+
 void
 weston_logind_restore(struct weston_logind *wl);
 
@@ -96,6 +102,16 @@ weston_logind_close(struct weston_logind *wl, int fd)
 {
 }
 
+static inline void
+weston_logind_prefetch(struct weston_logind *wl, const char *path)
+{
+}
+
+static inline void
+weston_logind_prefetch_finish(struct weston_logind *wl)
+{
+}
+
 static inline void
 weston_logind_restore(struct weston_logind *wl)
 {
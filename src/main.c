@@ -42,6 +42,7 @@
 #endif
 
 #include "compositor.h"
+#include "timeline.h"
 #include "../shared/os-compatibility.h"
 #include "../shared/helpers.h"
 #include "git-version.h"
@@ -284,7 +285,9 @@ usage(int error_code)
 		"  --height=HEIGHT\tHeight of memory surface\n"
 		"  --transform=TR\tThe output transformation, TR is one of:\n"
 		"\tnormal 90 180 270 flipped flipped-90 flipped-180 flipped-270\n"
-		"  --use-pixman\t\tUse the pixman (CPU) renderer (default: no rendering)\n\n");
+		"  --use-pixman\t\tUse the pixman (CPU) renderer (default: no rendering)\n"
+		"  --refresh=MHZ\t\tRefresh rate in mHz, 0 for as fast as possible\n"
+		"  --benchmark=N\t\tExit after N frames and report repaint statistics\n\n");
 #endif
 
 #if defined(BUILD_RDP_COMPOSITOR)
@@ -363,6 +366,7 @@ on_caught_signal(int s, siginfo_t *siginfo, void *context)
 	 * will allow weston to switch back to gdb on crash and then
 	 * gdb will catch the crash with SIGTRAP.*/
 
+	weston_log_sync();
 	weston_log("caught signal: %d\n", s);
 
 	print_backtrace();
@@ -490,6 +494,184 @@ load_modules(struct weston_compositor *ec, const char *modules,
 	return 0;
 }
 
+/* With staged startup, the modules only get loaded once every output
+ * has drawn its first frame, or after this many milliseconds. */
+#define STAGED_STARTUP_TIMEOUT 3000
+
+struct staged_startup {
+	struct weston_compositor *compositor;
+	/* Owned by main(), which outlives the event loop */
+	const char *modules;
+	const char *option_modules;
+	int argc;
+	char **argv;
+
+	struct wl_list frame_listeners; /* staged_startup_frame::link */
+	struct wl_event_source *timer;
+	struct wl_event_source *idle;
+};
+
+struct staged_startup_frame {
+	struct staged_startup *startup;
+	struct wl_listener listener;
+	struct wl_list link;
+};
+
+static void
+staged_startup_clear_listeners(struct staged_startup *startup)
+{
+	struct staged_startup_frame *frame, *next;
+
+	wl_list_for_each_safe(frame, next, &startup->frame_listeners, link) {
+		wl_list_remove(&frame->listener.link);
+		wl_list_remove(&frame->link);
+		free(frame);
+	}
+}
+
+static void
+staged_startup_load_modules(void *data)
+{
+	struct staged_startup *startup = data;
+	struct weston_compositor *ec = startup->compositor;
+	int i, failed = 0;
+
+	staged_startup_clear_listeners(startup);
+	wl_event_source_remove(startup->timer);
+
+	/* main() left the options to these modules unchecked */
+	TL_POINT("core_startup_modules_begin", TLP_END);
+	if (load_modules(ec, startup->modules,
+			 &startup->argc, startup->argv) < 0 ||
+	    load_modules(ec, startup->option_modules,
+			 &startup->argc, startup->argv) < 0) {
+		weston_log("fatal: failed to load deferred modules\n");
+		failed = 1;
+	} else {
+		for (i = 1; i < startup->argc; i++)
+			weston_log("fatal: unhandled option: %s\n",
+				   startup->argv[i]);
+		failed = startup->argc > 1;
+	}
+	TL_POINT("core_startup_modules_end", TLP_END);
+
+	if (failed) {
+		weston_compositor_exit_with_code(ec, EXIT_FAILURE);
+		wl_display_terminate(ec->wl_display);
+	}
+
+	free(startup);
+}
+
+static void
+staged_startup_schedule(struct staged_startup *startup)
+{
+	struct wl_event_loop *loop;
+
+	if (startup->idle)
+		return;
+
+	/* The frame is queued already, loading from an idle callback
+	 * does not hold back its flip. */
+	loop = wl_display_get_event_loop(startup->compositor->wl_display);
+	startup->idle = wl_event_loop_add_idle(loop,
+					       staged_startup_load_modules,
+					       startup);
+}
+
+static void
+staged_startup_output_frame(struct wl_listener *listener, void *data)
+{
+	struct staged_startup_frame *frame =
+		container_of(listener, struct staged_startup_frame, listener);
+	struct staged_startup *startup = frame->startup;
+	struct weston_output *output = data;
+
+	TL_POINT("core_startup_first_frame", TLP_OUTPUT(output), TLP_END);
+
+	wl_list_remove(&frame->listener.link);
+	wl_list_remove(&frame->link);
+	free(frame);
+
+	if (wl_list_empty(&startup->frame_listeners))
+		staged_startup_schedule(startup);
+}
+
+static int
+staged_startup_timeout(void *data)
+{
+	struct staged_startup *startup = data;
+
+	weston_log("staged startup: outputs did not draw in time, "
+		   "loading modules now\n");
+	staged_startup_schedule(startup);
+
+	return 0;
+}
+
+/** Defer loading the non-shell modules until after the first frame
+ *
+ * Lets the shell's first frame reach the screen without waiting for
+ * e.g. Xwayland or colord to be set up. Falls back to loading the
+ * modules right away if the deferral cannot be set up.
+ *
+ * Returns 1 when the modules were deferred, in which case they check
+ * the remaining options themselves, 0 when they were loaded and -1 on
+ * failure.
+ */
+static int
+staged_startup_init(struct weston_compositor *ec, const char *modules,
+		    const char *option_modules, int *argc, char *argv[])
+{
+	struct staged_startup *startup;
+	struct staged_startup_frame *frame;
+	struct weston_output *output;
+	struct wl_event_loop *loop;
+
+	startup = zalloc(sizeof *startup);
+	if (!startup)
+		goto load_now;
+
+	startup->compositor = ec;
+	startup->modules = modules;
+	startup->option_modules = option_modules;
+	startup->argc = *argc;
+	startup->argv = argv;
+	wl_list_init(&startup->frame_listeners);
+
+	loop = wl_display_get_event_loop(ec->wl_display);
+	startup->timer = wl_event_loop_add_timer(loop, staged_startup_timeout,
+						 startup);
+	if (!startup->timer) {
+		free(startup);
+		goto load_now;
+	}
+	wl_event_source_timer_update(startup->timer, STAGED_STARTUP_TIMEOUT);
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		frame = zalloc(sizeof *frame);
+		if (!frame)
+			continue;
+
+		frame->startup = startup;
+		frame->listener.notify = staged_startup_output_frame;
+		wl_signal_add(&output->frame_signal, &frame->listener);
+		wl_list_insert(&startup->frame_listeners, &frame->link);
+	}
+
+	if (wl_list_empty(&startup->frame_listeners))
+		staged_startup_schedule(startup);
+
+	return 1;
+
+load_now:
+	if (load_modules(ec, modules, argc, argv) < 0 ||
+	    load_modules(ec, option_modules, argc, argv) < 0)
+		return -1;
+
+	return 0;
+}
+
 static int
 weston_compositor_init_config(struct weston_compositor *ec,
 			      struct weston_config *config)
@@ -497,6 +679,8 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	struct xkb_rule_names xkb_names;
 	struct weston_config_section *s;
 	int repaint_msec;
+	int timeline_ring_kb;
+	uint32_t client_memory_mb;
 
 	s = weston_config_get_section(config, "keyboard", NULL, NULL);
 	weston_config_section_get_string(s, "keymap_rules",
@@ -527,8 +711,41 @@ weston_compositor_init_config(struct weston_compositor *ec,
 	} else {
 		ec->repaint_msec = repaint_msec;
 	}
-	weston_log("Output repaint window is %d ms maximum.\n",
-		   ec->repaint_msec);
+	weston_config_section_get_bool(s, "adaptive-repaint-window",
+				       &ec->repaint_adaptive, 0);
+	if (ec->repaint_adaptive)
+		weston_log("Output repaint window adapts to the repaint "
+			   "time, initially %d ms.\n", ec->repaint_msec);
+	else
+		weston_log("Output repaint window is %d ms maximum.\n",
+			   ec->repaint_msec);
+
+	weston_config_section_get_bool(s, "repaint-preempt",
+				       &ec->repaint_preempt, 0);
+	weston_config_section_get_bool(s, "present-frame-callbacks",
+				       &ec->present_frame_callbacks, 0);
+	weston_config_section_get_int(s, "occluded-frame-interval",
+				      &ec->occluded_frame_interval, 0);
+	weston_config_section_get_int(s, "idle-refresh-timeout",
+				      &ec->idle_refresh_timeout, 0);
+	weston_config_section_get_int(s, "idle-refresh-interval",
+				      &ec->idle_refresh_interval, 100);
+	weston_config_section_get_int(s, "idle-refresh-damage",
+				      &ec->idle_refresh_damage, 10);
+
+	weston_config_section_get_uint(s, "client-memory-limit",
+				       &client_memory_mb, 0);
+	ec->client_memory_limit = (uint64_t) client_memory_mb * 1024 * 1024;
+	weston_config_section_get_uint(s, "client-commit-budget",
+				       &ec->client_commit_budget, 0);
+
+	weston_config_section_get_int(s, "damage-max-rects",
+				      &ec->damage_max_rects, 64);
+
+	weston_config_section_get_int(s, "timeline-ring-size",
+				      &timeline_ring_kb, 0);
+	if (timeline_ring_kb > 0)
+		weston_timeline_ring_open(ec, (size_t)timeline_ring_kb * 1024);
 
 	return 0;
 }
@@ -652,6 +869,8 @@ int main(int argc, char *argv[])
 	int32_t version = 0;
 	int32_t noconfig = 0;
 	int32_t numlock_on;
+	int32_t staged_startup;
+	int deferred = 0;
 	char *config_file = NULL;
 	struct weston_config *config = NULL;
 	struct weston_config_section *section;
@@ -737,10 +956,12 @@ int main(int argc, char *argv[])
 	if (weston_compositor_init_config(ec, config) < 0)
 		goto out_signals;
 
+	TL_POINT("core_startup_backend_begin", TLP_END);
 	if (backend_init(ec, &argc, argv, config) < 0) {
 		weston_log("fatal: failed to create compositor backend\n");
 		goto out_signals;
 	}
+	TL_POINT("core_startup_backend_end", TLP_END);
 
 	catch_signals();
 	segv_compositor = ec;
@@ -784,15 +1005,26 @@ int main(int argc, char *argv[])
 		weston_config_section_get_string(section, "shell", &shell,
 						 "desktop-shell.so");
 
+	TL_POINT("core_startup_shell_begin", TLP_END);
 	if (load_modules(ec, shell, &argc, argv) < 0)
 		goto out;
+	TL_POINT("core_startup_shell_end", TLP_END);
 
 	weston_config_section_get_string(section, "modules", &modules, "");
-	if (load_modules(ec, modules, &argc, argv) < 0)
-		goto out;
+	weston_config_section_get_bool(section, "staged-startup",
+				       &staged_startup, 0);
+	if (staged_startup) {
+		deferred = staged_startup_init(ec, modules, option_modules,
+					       &argc, argv);
+		if (deferred < 0)
+			goto out;
+	} else {
+		if (load_modules(ec, modules, &argc, argv) < 0)
+			goto out;
 
-	if (load_modules(ec, option_modules, &argc, argv) < 0)
-		goto out;
+		if (load_modules(ec, option_modules, &argc, argv) < 0)
+			goto out;
+	}
 
 	section = weston_config_get_section(config, "keyboard", NULL, NULL);
 	weston_config_section_get_bool(section, "numlock-on", &numlock_on, 0);
@@ -808,10 +1040,13 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	for (i = 1; i < argc; i++)
-		weston_log("fatal: unhandled option: %s\n", argv[i]);
-	if (argc > 1)
-		goto out;
+	/* Deferred modules may still take some of them */
+	if (!deferred) {
+		for (i = 1; i < argc; i++)
+			weston_log("fatal: unhandled option: %s\n", argv[i]);
+		if (argc > 1)
+			goto out;
+	}
 
 	weston_compositor_wake(ec);
 
@@ -105,7 +105,7 @@ noop_renderer_init(struct weston_compositor *ec)
 {
 	struct weston_renderer *renderer;
 
-	renderer = malloc(sizeof *renderer);
+	renderer = zalloc(sizeof *renderer);
 	if (renderer == NULL)
 		return -1;
 
@@ -0,0 +1,802 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * An always-on performance overlay in the top left corner of every
+ * output: frame time, missed frames, how many views were put on planes
+ * other than the primary one, and the busiest clients' commit rates.
+ *
+ * The overlay is drawn by an ordinary wl_shm client that lives inside
+ * the compositor, on one end of a socketpair, so every renderer shows
+ * it without special support.  Its views are placed from the server
+ * side, in a layer just below the cursor.  The labels are drawn into
+ * the buffers once from a glyph cache built at startup; only the
+ * numbers are redrawn, twice a second.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <wayland-client.h>
+
+#include "compositor.h"
+#include "shared/helpers.h"
+#include "shared/os-compatibility.h"
+#include "shared/timespec-util.h"
+
+#define HUD_UPDATE_MS 500
+#define HUD_TOP_CLIENTS 3
+
+#define HUD_GLYPH_WIDTH 5
+#define HUD_GLYPH_HEIGHT 7
+#define HUD_SCALE 2
+#define HUD_CELL_WIDTH ((HUD_GLYPH_WIDTH + 1) * HUD_SCALE)
+#define HUD_CELL_HEIGHT ((HUD_GLYPH_HEIGHT + 2) * HUD_SCALE)
+#define HUD_TILE_WIDTH (HUD_GLYPH_WIDTH * HUD_SCALE)
+#define HUD_TILE_HEIGHT (HUD_GLYPH_HEIGHT * HUD_SCALE)
+
+#define HUD_LABEL_COLUMNS 8
+#define HUD_VALUE_COLUMNS 20
+#define HUD_COLUMNS (HUD_LABEL_COLUMNS + HUD_VALUE_COLUMNS)
+#define HUD_ROWS (3 + HUD_TOP_CLIENTS)
+#define HUD_MARGIN 8
+#define HUD_WIDTH (HUD_COLUMNS * HUD_CELL_WIDTH + 2 * HUD_MARGIN)
+#define HUD_HEIGHT (HUD_ROWS * HUD_CELL_HEIGHT + 2 * HUD_MARGIN)
+#define HUD_STRIDE (HUD_WIDTH * 4)
+
+/* premultiplied ARGB */
+#define HUD_BACKGROUND 0xc0000000
+#define HUD_FOREGROUND 0xffffffff
+
+/* Frame intervals longer than this many refresh periods are the output
+ * going idle, not missed frames */
+#define HUD_IDLE_PERIODS 8
+
+static const struct {
+	char c;
+	uint8_t rows[HUD_GLYPH_HEIGHT];
+} hud_font[] = {
+	{ '0', { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e } },
+	{ '1', { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+	{ '2', { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f } },
+	{ '3', { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e } },
+	{ '4', { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 } },
+	{ '5', { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e } },
+	{ '6', { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e } },
+	{ '7', { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 } },
+	{ '8', { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e } },
+	{ '9', { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c } },
+	{ 'A', { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 } },
+	{ 'B', { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e } },
+	{ 'C', { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e } },
+	{ 'D', { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c } },
+	{ 'E', { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f } },
+	{ 'F', { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 } },
+	{ 'G', { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f } },
+	{ 'H', { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 } },
+	{ 'I', { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e } },
+	{ 'J', { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c } },
+	{ 'K', { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 } },
+	{ 'L', { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f } },
+	{ 'M', { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 } },
+	{ 'N', { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 } },
+	{ 'O', { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e } },
+	{ 'P', { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 } },
+	{ 'Q', { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d } },
+	{ 'R', { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 } },
+	{ 'S', { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e } },
+	{ 'T', { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 } },
+	{ 'U', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e } },
+	{ 'V', { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 } },
+	{ 'W', { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a } },
+	{ 'X', { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 } },
+	{ 'Y', { 0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04 } },
+	{ 'Z', { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f } },
+	{ '.', { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c } },
+	{ ':', { 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 } },
+	{ '%', { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 } },
+	{ '/', { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 } },
+	{ '-', { 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 } },
+};
+
+static const char *hud_labels[HUD_ROWS] = {
+	"FRAME", "MISSED", "PLANES", "CLIENTS",
+};
+
+struct hud_buffer {
+	struct wl_buffer *buffer;
+	uint32_t *data;
+	int busy;
+	int attached;
+};
+
+struct hud_output {
+	struct hud *hud;
+	struct weston_output *output;
+	struct wl_listener destroy_listener;
+	struct wl_listener frame_listener;
+	struct wl_list link; /* hud::output_list */
+
+	struct wl_surface *surface;
+	struct weston_surface *wsurface; /* once the server created it */
+	struct weston_view *view;
+	void *pool_data;
+	struct hud_buffer buffers[2];
+
+	/* since the last update */
+	struct timespec last_frame;
+	uint32_t frames;
+	uint32_t missed;
+	uint64_t frame_nsec_sum;
+	uint64_t frame_nsec_max;
+	uint32_t views_primary;
+	uint32_t views_planes;
+};
+
+struct hud_client {
+	struct wl_client *client;
+	struct wl_listener destroy_listener;
+	struct wl_list link; /* hud::client_list */
+	pid_t pid;
+	uint32_t commits;
+	uint32_t rate;
+};
+
+struct hud {
+	struct weston_compositor *compositor;
+	struct weston_layer layer;
+	struct wl_listener destroy_listener;
+	struct wl_listener output_created_listener;
+	struct wl_listener create_surface_listener;
+	struct wl_listener commit_listener;
+	struct wl_list output_list;
+	struct wl_list client_list;
+	struct wl_event_source *timer;
+	struct timespec last_update;
+	int ready;
+
+	/* the overlay's own client, both ends */
+	struct wl_client *client;
+	struct wl_display *display;
+	struct wl_event_source *display_source;
+	struct wl_registry *registry;
+	struct wl_compositor *wl_compositor;
+	struct wl_shm *shm;
+
+	/* one pre-rendered tile per ASCII character */
+	uint32_t glyphs[128][HUD_TILE_WIDTH * HUD_TILE_HEIGHT];
+};
+
+static void
+hud_build_glyph_cache(struct hud *hud)
+{
+	uint32_t *tile;
+	unsigned int i;
+	int x, y, c;
+
+	for (c = 0; c < 128; c++)
+		for (i = 0; i < ARRAY_LENGTH(hud->glyphs[c]); i++)
+			hud->glyphs[c][i] = HUD_BACKGROUND;
+
+	for (i = 0; i < ARRAY_LENGTH(hud_font); i++) {
+		tile = hud->glyphs[(int) hud_font[i].c];
+		for (y = 0; y < HUD_TILE_HEIGHT; y++)
+			for (x = 0; x < HUD_TILE_WIDTH; x++)
+				if (hud_font[i].rows[y / HUD_SCALE] &
+				    (0x10 >> (x / HUD_SCALE)))
+					tile[y * HUD_TILE_WIDTH + x] =
+						HUD_FOREGROUND;
+	}
+}
+
+/* Draw text into a cell range of a row, padding it with blanks */
+static void
+hud_draw_text(struct hud *hud, uint32_t *data,
+	      int column, int row, int columns, const char *text)
+{
+	const uint32_t *tile;
+	uint32_t *dst;
+	int i, y, c;
+
+	for (i = 0; i < columns; i++) {
+		c = *text ? toupper((unsigned char) *text++) : ' ';
+		tile = hud->glyphs[c & 0x7f];
+		dst = data + (HUD_MARGIN + row * HUD_CELL_HEIGHT) * HUD_WIDTH +
+			HUD_MARGIN + (column + i) * HUD_CELL_WIDTH;
+		for (y = 0; y < HUD_TILE_HEIGHT; y++)
+			memcpy(dst + y * HUD_WIDTH, tile + y * HUD_TILE_WIDTH,
+			       HUD_TILE_WIDTH * sizeof *tile);
+	}
+}
+
+static void
+hud_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct hud_buffer *hb = data;
+
+	hb->busy = 0;
+}
+
+static const struct wl_buffer_listener hud_buffer_listener = {
+	hud_buffer_release
+};
+
+static int
+hud_output_create_buffers(struct hud_output *ho)
+{
+	struct hud *hud = ho->hud;
+	struct wl_shm_pool *pool;
+	size_t size = HUD_STRIDE * HUD_HEIGHT;
+	unsigned int i, j;
+	int fd;
+
+	fd = os_create_anonymous_file(2 * size);
+	if (fd < 0)
+		return -1;
+
+	ho->pool_data = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE,
+			     MAP_SHARED, fd, 0);
+	if (ho->pool_data == MAP_FAILED) {
+		ho->pool_data = NULL;
+		close(fd);
+		return -1;
+	}
+
+	pool = wl_shm_create_pool(hud->shm, fd, 2 * size);
+	for (i = 0; i < ARRAY_LENGTH(ho->buffers); i++) {
+		struct hud_buffer *hb = &ho->buffers[i];
+
+		hb->data = (uint32_t *) ((char *) ho->pool_data + i * size);
+		hb->buffer = wl_shm_pool_create_buffer(pool, i * size,
+						       HUD_WIDTH, HUD_HEIGHT,
+						       HUD_STRIDE,
+						       WL_SHM_FORMAT_ARGB8888);
+		wl_buffer_add_listener(hb->buffer, &hud_buffer_listener, hb);
+
+		/* the labels never change */
+		for (j = 0; j < HUD_WIDTH * HUD_HEIGHT; j++)
+			hb->data[j] = HUD_BACKGROUND;
+		for (j = 0; j < HUD_ROWS; j++)
+			if (hud_labels[j])
+				hud_draw_text(hud, hb->data, 0, j,
+					      HUD_LABEL_COLUMNS,
+					      hud_labels[j]);
+	}
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	return 0;
+}
+
+static void
+hud_surface_configure(struct weston_surface *surface, int32_t sx, int32_t sy)
+{
+	struct hud_output *ho = surface->configure_private;
+
+	if (wl_list_empty(&ho->view->layer_link.link))
+		weston_layer_entry_insert(&ho->hud->layer.view_list,
+					  &ho->view->layer_link);
+
+	weston_view_set_position(ho->view, ho->output->x, ho->output->y);
+	weston_view_update_transform(ho->view);
+}
+
+static int
+hud_surface_get_label(struct weston_surface *surface, char *buf, size_t len)
+{
+	return snprintf(buf, len, "performance overlay");
+}
+
+static void
+hud_handle_create_surface(struct wl_listener *listener, void *data)
+{
+	struct hud *hud =
+		container_of(listener, struct hud, create_surface_listener);
+	struct weston_surface *surface = data;
+	struct hud_output *ho;
+	uint32_t id;
+
+	if (wl_resource_get_client(surface->resource) != hud->client)
+		return;
+
+	id = wl_resource_get_id(surface->resource);
+	wl_list_for_each(ho, &hud->output_list, link) {
+		if (ho->wsurface ||
+		    wl_proxy_get_id((struct wl_proxy *) ho->surface) != id)
+			continue;
+
+		ho->view = weston_view_create(surface);
+		if (!ho->view)
+			return;
+		ho->wsurface = surface;
+		surface->configure = hud_surface_configure;
+		surface->configure_private = ho;
+		weston_surface_set_label_func(surface, hud_surface_get_label);
+		return;
+	}
+}
+
+static void
+hud_output_frame(struct wl_listener *listener, void *data)
+{
+	struct hud_output *ho =
+		container_of(listener, struct hud_output, frame_listener);
+	struct weston_output *output = ho->output;
+	struct weston_compositor *ec = output->compositor;
+	struct weston_view **views = output->view_list.data;
+	unsigned int i, n = output->view_list.size / sizeof *views;
+	struct timespec now, interval;
+	int64_t nsec, period;
+
+	weston_compositor_read_presentation_clock(ec, &now);
+
+	if (ho->last_frame.tv_sec || ho->last_frame.tv_nsec) {
+		timespec_sub(&interval, &now, &ho->last_frame);
+		nsec = timespec_to_nsec(&interval);
+		period = output->current_mode->refresh ?
+			1000000000000LL / output->current_mode->refresh : 0;
+
+		if (period == 0 || nsec < HUD_IDLE_PERIODS * period) {
+			ho->frames++;
+			ho->frame_nsec_sum += nsec;
+			ho->frame_nsec_max = MAX(ho->frame_nsec_max,
+						 (uint64_t) nsec);
+			if (period && nsec > period + period / 2)
+				ho->missed += (nsec + period / 2) / period - 1;
+		}
+	}
+	ho->last_frame = now;
+
+	/* The plane assignment of this repaint */
+	ho->views_primary = 0;
+	ho->views_planes = 0;
+	for (i = 0; i < n; i++) {
+		if (views[i]->plane == &ec->primary_plane)
+			ho->views_primary++;
+		else
+			ho->views_planes++;
+	}
+}
+
+static void
+hud_output_draw(struct hud_output *ho, uint32_t *data,
+		struct hud_client **top, int n_top)
+{
+	struct hud *hud = ho->hud;
+	char text[HUD_VALUE_COLUMNS + 1];
+	int i;
+
+	if (ho->frames)
+		snprintf(text, sizeof text, "%5.1f MS MAX %5.1f",
+			 ho->frame_nsec_sum / 1e6 / ho->frames,
+			 ho->frame_nsec_max / 1e6);
+	else
+		snprintf(text, sizeof text, "IDLE");
+	hud_draw_text(hud, data, HUD_LABEL_COLUMNS, 0,
+		      HUD_VALUE_COLUMNS, text);
+
+	snprintf(text, sizeof text, "%u OF %u", ho->missed,
+		 ho->frames + ho->missed);
+	hud_draw_text(hud, data, HUD_LABEL_COLUMNS, 1,
+		      HUD_VALUE_COLUMNS, text);
+
+	snprintf(text, sizeof text, "%u GPU %u OTHER",
+		 ho->views_primary, ho->views_planes);
+	hud_draw_text(hud, data, HUD_LABEL_COLUMNS, 2,
+		      HUD_VALUE_COLUMNS, text);
+
+	for (i = 0; i < HUD_TOP_CLIENTS; i++) {
+		if (i < n_top)
+			snprintf(text, sizeof text, "PID %d %u/S",
+				 (int) top[i]->pid, top[i]->rate);
+		else
+			text[0] = '\0';
+		hud_draw_text(hud, data, HUD_LABEL_COLUMNS, 3 + i,
+			      HUD_VALUE_COLUMNS, text);
+	}
+}
+
+static void
+hud_output_update(struct hud_output *ho, struct hud_client **top, int n_top)
+{
+	struct hud_buffer *hb = NULL;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(ho->buffers); i++)
+		if (!ho->buffers[i].busy)
+			hb = &ho->buffers[i];
+
+	/* Both still held by the renderer, try again next time */
+	if (!hb)
+		return;
+
+	hud_output_draw(ho, hb->data, top, n_top);
+
+	wl_surface_attach(ho->surface, hb->buffer, 0, 0);
+	if (hb->attached)
+		wl_surface_damage(ho->surface,
+				  HUD_MARGIN + HUD_LABEL_COLUMNS *
+				  HUD_CELL_WIDTH, HUD_MARGIN,
+				  HUD_VALUE_COLUMNS * HUD_CELL_WIDTH,
+				  HUD_ROWS * HUD_CELL_HEIGHT);
+	else
+		wl_surface_damage(ho->surface, 0, 0, HUD_WIDTH, HUD_HEIGHT);
+	wl_surface_commit(ho->surface);
+	hb->busy = 1;
+	hb->attached = 1;
+
+	ho->frames = 0;
+	ho->missed = 0;
+	ho->frame_nsec_sum = 0;
+	ho->frame_nsec_max = 0;
+}
+
+static int
+hud_update(void *data)
+{
+	struct hud *hud = data;
+	struct hud_client *top[HUD_TOP_CLIENTS], *hc;
+	struct hud_output *ho;
+	struct timespec now, elapsed;
+	int64_t msec;
+	int i, j, n_top = 0;
+
+	weston_compositor_read_presentation_clock(hud->compositor, &now);
+	timespec_sub(&elapsed, &now, &hud->last_update);
+	msec = MAX(timespec_to_nsec(&elapsed) / 1000000, 1);
+	hud->last_update = now;
+
+	/* keep the busiest few, in order */
+	wl_list_for_each(hc, &hud->client_list, link) {
+		hc->rate = hc->commits * 1000 / msec;
+		hc->commits = 0;
+		if (hc->rate == 0)
+			continue;
+
+		for (i = 0; i < n_top; i++)
+			if (hc->rate > top[i]->rate)
+				break;
+		if (i == HUD_TOP_CLIENTS)
+			continue;
+		if (n_top < HUD_TOP_CLIENTS)
+			n_top++;
+		for (j = n_top - 1; j > i; j--)
+			top[j] = top[j - 1];
+		top[i] = hc;
+	}
+
+	wl_list_for_each(ho, &hud->output_list, link)
+		hud_output_update(ho, top, n_top);
+	wl_display_flush(hud->display);
+
+	wl_event_source_timer_update(hud->timer, HUD_UPDATE_MS);
+
+	return 0;
+}
+
+static void
+hud_client_destroy(struct hud_client *hc)
+{
+	wl_list_remove(&hc->destroy_listener.link);
+	wl_list_remove(&hc->link);
+	free(hc);
+}
+
+static void
+hud_client_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct hud_client *hc =
+		container_of(listener, struct hud_client, destroy_listener);
+
+	hud_client_destroy(hc);
+}
+
+static void
+hud_handle_commit(struct wl_listener *listener, void *data)
+{
+	struct hud *hud = container_of(listener, struct hud, commit_listener);
+	struct weston_surface *surface = data;
+	struct wl_listener *l;
+	struct wl_client *client;
+	struct hud_client *hc;
+
+	if (!surface->resource)
+		return;
+
+	client = wl_resource_get_client(surface->resource);
+	if (client == hud->client)
+		return;
+
+	l = wl_client_get_destroy_listener(client, hud_client_handle_destroy);
+	if (l) {
+		hc = container_of(l, struct hud_client, destroy_listener);
+	} else {
+		hc = zalloc(sizeof *hc);
+		if (!hc)
+			return;
+		hc->client = client;
+		wl_client_get_credentials(client, &hc->pid, NULL, NULL);
+		hc->destroy_listener.notify = hud_client_handle_destroy;
+		wl_client_add_destroy_listener(client, &hc->destroy_listener);
+		wl_list_insert(&hud->client_list, &hc->link);
+	}
+
+	hc->commits++;
+}
+
+static void
+hud_output_destroy(struct hud_output *ho)
+{
+	unsigned int i;
+
+	if (ho->view)
+		weston_view_destroy(ho->view);
+	if (ho->wsurface) {
+		ho->wsurface->configure = NULL;
+		ho->wsurface->configure_private = NULL;
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(ho->buffers); i++)
+		if (ho->buffers[i].buffer)
+			wl_buffer_destroy(ho->buffers[i].buffer);
+	if (ho->pool_data)
+		munmap(ho->pool_data, 2 * HUD_STRIDE * HUD_HEIGHT);
+	wl_surface_destroy(ho->surface);
+	wl_display_flush(ho->hud->display);
+
+	wl_list_remove(&ho->frame_listener.link);
+	wl_list_remove(&ho->destroy_listener.link);
+	wl_list_remove(&ho->link);
+	free(ho);
+}
+
+static void
+hud_output_handle_destroy(struct wl_listener *listener, void *data)
+{
+	struct hud_output *ho =
+		container_of(listener, struct hud_output, destroy_listener);
+
+	hud_output_destroy(ho);
+}
+
+static void
+hud_output_create(struct hud *hud, struct weston_output *output)
+{
+	struct hud_output *ho;
+	struct wl_region *region;
+
+	ho = zalloc(sizeof *ho);
+	if (!ho)
+		return;
+
+	ho->hud = hud;
+	ho->output = output;
+	ho->surface = wl_compositor_create_surface(hud->wl_compositor);
+	wl_list_insert(&hud->output_list, &ho->link);
+
+	ho->destroy_listener.notify = hud_output_handle_destroy;
+	wl_signal_add(&output->destroy_signal, &ho->destroy_listener);
+	ho->frame_listener.notify = hud_output_frame;
+	wl_signal_add(&output->frame_signal, &ho->frame_listener);
+
+	/* never take input from what is below */
+	region = wl_compositor_create_region(hud->wl_compositor);
+	wl_surface_set_input_region(ho->surface, region);
+	wl_region_destroy(region);
+
+	if (hud_output_create_buffers(ho) < 0) {
+		weston_log("perf-hud: failed to create buffers for %s\n",
+			   output->name);
+		hud_output_destroy(ho);
+		return;
+	}
+
+	wl_display_flush(hud->display);
+}
+
+static void
+hud_handle_output_created(struct wl_listener *listener, void *data)
+{
+	struct hud *hud =
+		container_of(listener, struct hud, output_created_listener);
+
+	hud_output_create(hud, data);
+}
+
+static void
+registry_handle_global(void *data, struct wl_registry *registry,
+		       uint32_t name, const char *interface, uint32_t version)
+{
+	struct hud *hud = data;
+	struct weston_output *output;
+
+	if (strcmp(interface, "wl_compositor") == 0)
+		hud->wl_compositor =
+			wl_registry_bind(registry, name,
+					 &wl_compositor_interface, 1);
+	else if (strcmp(interface, "wl_shm") == 0)
+		hud->shm = wl_registry_bind(registry, name,
+					    &wl_shm_interface, 1);
+	else
+		return;
+
+	if (!hud->wl_compositor || !hud->shm || hud->ready)
+		return;
+
+	hud->ready = 1;
+
+	wl_list_for_each(output, &hud->compositor->output_list, link)
+		hud_output_create(hud, output);
+
+	wl_signal_add(&hud->compositor->output_created_signal,
+		      &hud->output_created_listener);
+
+	weston_compositor_read_presentation_clock(hud->compositor,
+						  &hud->last_update);
+	hud->timer = wl_event_loop_add_timer(
+		wl_display_get_event_loop(hud->compositor->wl_display),
+		hud_update, hud);
+	wl_event_source_timer_update(hud->timer, HUD_UPDATE_MS);
+}
+
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+			      uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_handle_global,
+	registry_handle_global_remove
+};
+
+static int
+hud_handle_display_event(int fd, uint32_t mask, void *data)
+{
+	struct hud *hud = data;
+
+	if ((mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) ||
+	    wl_display_dispatch(hud->display) < 0) {
+		weston_log("perf-hud: lost the connection to the compositor\n");
+		wl_event_source_remove(hud->display_source);
+		hud->display_source = NULL;
+		if (hud->timer)
+			wl_event_source_remove(hud->timer);
+		hud->timer = NULL;
+	}
+
+	return 1;
+}
+
+static void
+hud_destroy(struct hud *hud)
+{
+	struct hud_output *ho, *ho_next;
+	struct hud_client *hc, *hc_next;
+
+	wl_list_for_each_safe(ho, ho_next, &hud->output_list, link)
+		hud_output_destroy(ho);
+	wl_list_for_each_safe(hc, hc_next, &hud->client_list, link)
+		hud_client_destroy(hc);
+
+	if (hud->ready)
+		wl_list_remove(&hud->output_created_listener.link);
+	if (hud->timer)
+		wl_event_source_remove(hud->timer);
+	if (hud->display_source)
+		wl_event_source_remove(hud->display_source);
+	if (hud->shm)
+		wl_shm_destroy(hud->shm);
+	if (hud->wl_compositor)
+		wl_compositor_destroy(hud->wl_compositor);
+	if (hud->registry)
+		wl_registry_destroy(hud->registry);
+	wl_display_disconnect(hud->display);
+
+	wl_list_remove(&hud->create_surface_listener.link);
+	wl_list_remove(&hud->commit_listener.link);
+	wl_list_remove(&hud->destroy_listener.link);
+	wl_list_remove(&hud->layer.link);
+	free(hud);
+}
+
+static void
+hud_handle_compositor_destroy(struct wl_listener *listener, void *data)
+{
+	struct hud *hud = container_of(listener, struct hud, destroy_listener);
+
+	hud_destroy(hud);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor,
+	    int *argc, char *argv[])
+{
+	struct wl_event_loop *loop =
+		wl_display_get_event_loop(compositor->wl_display);
+	struct hud *hud;
+	int sv[2];
+
+	hud = zalloc(sizeof *hud);
+	if (hud == NULL)
+		return -1;
+
+	hud->compositor = compositor;
+	wl_list_init(&hud->output_list);
+	wl_list_init(&hud->client_list);
+	hud_build_glyph_cache(hud);
+
+	if (os_socketpair_cloexec(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		free(hud);
+		return -1;
+	}
+
+	hud->client = wl_client_create(compositor->wl_display, sv[0]);
+	if (!hud->client) {
+		close(sv[0]);
+		close(sv[1]);
+		free(hud);
+		return -1;
+	}
+
+	hud->display = wl_display_connect_to_fd(sv[1]);
+	if (!hud->display) {
+		wl_client_destroy(hud->client);
+		close(sv[1]);
+		free(hud);
+		return -1;
+	}
+
+	weston_layer_init(&hud->layer, &compositor->cursor_layer.link);
+
+	hud->destroy_listener.notify = hud_handle_compositor_destroy;
+	wl_signal_add(&compositor->destroy_signal, &hud->destroy_listener);
+	hud->create_surface_listener.notify = hud_handle_create_surface;
+	wl_signal_add(&compositor->create_surface_signal,
+		      &hud->create_surface_listener);
+	hud->commit_listener.notify = hud_handle_commit;
+	wl_signal_add(&compositor->commit_signal, &hud->commit_listener);
+	hud->output_created_listener.notify = hud_handle_output_created;
+
+	/* The globals arrive once the server side has read the request;
+	 * the outputs are set up from the registry listener. */
+	hud->registry = wl_display_get_registry(hud->display);
+	wl_registry_add_listener(hud->registry, &registry_listener, hud);
+	wl_display_flush(hud->display);
+
+	hud->display_source =
+		wl_event_loop_add_fd(loop, wl_display_get_fd(hud->display),
+				     WL_EVENT_READABLE,
+				     hud_handle_display_event, hud);
+
+	return 0;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* vld4 splits the bytes of each pixel, which are blue, green, red in
+ * that order on little endian only */
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && \
+    __BYTE_ORDER == __LITTLE_ENDIAN
+#define PIXEL_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+#include "pixel-convert.h"
+
+static inline uint16_t
+convert_pixel_r5g6b5(uint32_t p)
+{
+	return ((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f);
+}
+
+#ifdef __SSE2__
+/* Four pixels to r5g6b5 in the low half of each 32-bit lane, sign
+ * extended so that _mm_packs_epi32 does not saturate them. */
+static inline __m128i
+convert_r5g6b5_sse2(__m128i p)
+{
+	const __m128i red = _mm_set1_epi32(0xf800);
+	const __m128i green = _mm_set1_epi32(0x07e0);
+	const __m128i blue = _mm_set1_epi32(0x001f);
+	__m128i v;
+
+	v = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 8), red),
+			 _mm_and_si128(_mm_srli_epi32(p, 5), green));
+	v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(p, 3), blue));
+
+	return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+#endif
+
+void
+pixel_convert_x8r8g8b8_to_r5g6b5(uint16_t *dst, const uint32_t *src, int n)
+{
+	int i = 0;
+
+#ifdef __SSE2__
+	__m128i a, b;
+
+	for (; i + 8 <= n; i += 8) {
+		a = convert_r5g6b5_sse2(
+			_mm_loadu_si128((const __m128i *) (src + i)));
+		b = convert_r5g6b5_sse2(
+			_mm_loadu_si128((const __m128i *) (src + i + 4)));
+		_mm_storeu_si128((__m128i *) (dst + i),
+				 _mm_packs_epi32(a, b));
+	}
+#endif
+
+#ifdef PIXEL_CONVERT_NEON
+	uint8x8x4_t p;
+	uint16x8_t v;
+
+	/* Each channel widened to the top byte, green and blue shifted
+	 * in below the bits kept of red */
+	for (; i + 8 <= n; i += 8) {
+		p = vld4_u8((const uint8_t *) (src + i));
+		v = vshll_n_u8(p.val[2], 8);
+		v = vsriq_n_u16(v, vshll_n_u8(p.val[1], 8), 5);
+		v = vsriq_n_u16(v, vshll_n_u8(p.val[0], 8), 11);
+		vst1q_u16(dst + i, v);
+	}
+#endif
+
+	for (; i < n; i++)
+		dst[i] = convert_pixel_r5g6b5(src[i]);
+}
+
+void
+pixel_convert_x8r8g8b8_to_r8g8b8(uint8_t *dst, const uint32_t *src, int n)
+{
+	int i = 0;
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	uint32_t p0, p1, p2, p3, w0, w1, w2;
+#endif
+
+#ifdef PIXEL_CONVERT_NEON
+	uint8x8x4_t p;
+	uint8x8x3_t v;
+
+	for (; i + 8 <= n; i += 8) {
+		p = vld4_u8((const uint8_t *) (src + i));
+		v.val[0] = p.val[0];
+		v.val[1] = p.val[1];
+		v.val[2] = p.val[2];
+		vst3_u8(dst + i * 3, v);
+	}
+#endif
+
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	/* Four pixels make three whole words; the byte order of the
+	 * words is then exactly the blue, green, red of each pixel. */
+	for (; i + 4 <= n; i += 4) {
+		p0 = src[i];
+		p1 = src[i + 1];
+		p2 = src[i + 2];
+		p3 = src[i + 3];
+		w0 = (p0 & 0xffffff) | (p1 << 24);
+		w1 = ((p1 >> 8) & 0xffff) | (p2 << 16);
+		w2 = ((p2 >> 16) & 0xff) | (p3 << 8);
+		memcpy(dst + i * 3, &w0, 4);
+		memcpy(dst + i * 3 + 4, &w1, 4);
+		memcpy(dst + i * 3 + 8, &w2, 4);
+	}
+#endif
+
+	for (; i < n; i++) {
+		dst[i * 3 + 0] = src[i];
+		dst[i * 3 + 1] = src[i] >> 8;
+		dst[i * 3 + 2] = src[i] >> 16;
+	}
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WESTON_PIXEL_CONVERT_H
+#define WESTON_PIXEL_CONVERT_H
+
+#include <stdint.h>
+
+/* Converters for the shadow-to-hardware copy when the hardware buffer
+ * is not in the x8r8g8b8 format of the shadow.  Each converts one row
+ * of n pixels and gives bit-exact pixman PIXMAN_OP_SRC results: the
+ * low bits of each channel are dropped, and alpha is ignored. */
+
+/* To PIXMAN_r5g6b5, in native endianness. */
+void
+pixel_convert_x8r8g8b8_to_r5g6b5(uint16_t *dst, const uint32_t *src, int n);
+
+/* To PIXMAN_r8g8b8, which is stored as blue, green, red bytes. */
+void
+pixel_convert_x8r8g8b8_to_r8g8b8(uint8_t *dst, const uint32_t *src, int n);
+
+#endif
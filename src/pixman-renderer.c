@@ -30,39 +30,156 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #include "pixman-renderer.h"
+#include "pixel-convert.h"
+#include "linux-dmabuf.h"
 #include "shared/helpers.h"
 
 #include <linux/input.h>
+#ifdef HAVE_LINUX_DMA_BUF_H
+#include <linux/dma-buf.h>
+#endif
+
+struct pixman_output_thread;
 
 struct pixman_output_state {
 	void *shadow_buffer;
 	pixman_image_t *shadow_image;
 	pixman_image_t *hw_buffer;
+
+	/* Where the software cursor was drawn in the last two frames, in
+	 * global coordinates: the hardware buffer may be two frames old */
+	pixman_region32_t cursor_damage[2];
+
+	/* NULL unless pixman_renderer_output_start_thread() was called */
+	struct pixman_output_thread *thread;
 };
 
 struct pixman_surface_state {
 	struct weston_surface *surface;
 
 	pixman_image_t *image;
+	pixman_color_t color; /* valid if image is a solid fill */
 	struct weston_buffer_reference buffer_ref;
+	int dmabuf_fd; /* -1 unless image maps a dmabuf */
 
 	struct wl_listener buffer_destroy_listener;
 	struct wl_listener surface_destroy_listener;
 	struct wl_listener renderer_destroy_listener;
 };
 
+/* One composite operation recorded during repaint_surfaces(). Jobs are
+ * replayed in order for each horizontal band of the output, so they
+ * must not reference pixman images whose state another band changes:
+ * every band builds its own images over the same pixel data.
+ */
+struct pixman_job {
+	pixman_op_t op;
+	pixman_region32_t clip; /* output coordinates */
+	int has_source_clip;
+	pixman_region32_t source_clip; /* source image coordinates */
+	pixman_transform_t transform;
+	pixman_filter_t filter;
+	uint16_t mask_alpha; /* 0xffff for no mask */
+
+	struct wl_shm_buffer *shm_buffer;
+	/* Held while an output thread reads the buffer, so that
+	 * wl_shm_pool.resize does not remap it under the thread */
+	struct wl_shm_pool *shm_pool;
+	int dmabuf_fd;
+	pixman_format_code_t format;
+	int width, height, stride;
+	void *data; /* NULL for a solid fill of color */
+	pixman_color_t color;
+
+	/* Painted over the hardware buffer once the shadow is copied,
+	 * see draw_cursor_views() */
+	int on_hw;
+
+	/* Only used for jobs handed to an output thread, which keeps the
+	 * source alive until the frame is done. */
+	pixman_image_t *image;
+	struct weston_buffer *buffer;
+	struct weston_buffer_reference buffer_ref;
+	struct wl_listener buffer_destroy_listener;
+	struct pixman_output_thread *thread;
+};
+
+#define PIXMAN_MAX_THREADS 32
+
+struct pixman_worker {
+	struct pixman_renderer *renderer;
+	pthread_t thread;
+	int band;
+};
+
 struct pixman_renderer {
 	struct weston_renderer base;
 
 	int repaint_debug;
-	pixman_image_t *debug_color;
 	struct weston_binding *debug_binding;
 
+	struct wl_array jobs; /* struct pixman_job */
+
+	/* Band workers, band 0 is always painted by the main thread */
+	int n_bands;
+	struct pixman_worker *workers;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	uint32_t work_serial;
+	int busy_workers;
+	int quit;
+	struct weston_output *work_output;
+	pixman_region32_t *work_damage; /* output coordinates */
+
+	struct wl_list dmabufs; /* pixman_dmabuf::link */
+
+	/* NULL when everything is done on the CPU */
+	struct pixman_renderer_blitter *blitter;
+
 	struct wl_signal destroy_signal;
 };
 
+/* A linear dmabuf mapped for reading. It is kept on its
+ * linux_dmabuf_buffer for as long as both the buffer and the renderer
+ * live. */
+struct pixman_dmabuf {
+	struct linux_dmabuf_buffer *dmabuf;
+	struct wl_list link; /* pixman_renderer::dmabufs */
+
+	void *map;
+	size_t size;
+	pixman_format_code_t format;
+};
+
+/* Composites the recorded frames of one output, so that outputs paint
+ * in parallel and the main loop does not wait for them. */
+struct pixman_output_thread {
+	struct weston_output *output;
+	pixman_renderer_output_done_func_t done;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int busy; /* the thread is painting jobs */
+	int quit;
+
+	/* A frame was handed over and its completion not yet handled */
+	int pending;
+	struct wl_array jobs; /* struct pixman_job */
+	pixman_region32_t damage; /* output coordinates */
+
+	int done_pipe[2];
+	struct wl_event_source *done_source;
+};
+
 static inline struct pixman_output_state *
 get_output_state(struct weston_output *output)
 {
@@ -87,6 +204,16 @@ get_renderer(struct weston_compositor *ec)
 	return (struct pixman_renderer *)ec->renderer;
 }
 
+/* Wait until the output thread is done painting */
+static void
+pixman_output_thread_wait(struct pixman_output_thread *t)
+{
+	pthread_mutex_lock(&t->mutex);
+	while (t->busy)
+		pthread_cond_wait(&t->cond, &t->mutex);
+	pthread_mutex_unlock(&t->mutex);
+}
+
 static int
 pixman_renderer_read_pixels(struct weston_output *output,
 			       pixman_format_code_t format, void *pixels,
@@ -97,6 +224,9 @@ pixman_renderer_read_pixels(struct weston_output *output,
 	pixman_transform_t transform;
 	pixman_image_t *out_buf;
 
+	if (po->thread)
+		pixman_output_thread_wait(po->thread);
+
 	if (!po->hw_buffer) {
 		errno = ENODEV;
 		return -1;
@@ -312,6 +442,9 @@ composite_clipped(pixman_image_t *src,
  * \param source_clip The region of the source image to use, in source image
  *                    coordinates. If NULL, use the whole source image.
  * \param pixman_op Compositing operator, either SRC or OVER.
+ *
+ * The operation is only recorded here, pixman_renderer_run_jobs() does
+ * the actual compositing.
  */
 static void
 repaint_region(struct weston_view *ev, struct weston_output *output,
@@ -319,62 +452,658 @@ repaint_region(struct weston_view *ev, struct weston_output *output,
 	       pixman_region32_t *source_clip,
 	       pixman_op_t pixman_op)
 {
-	struct pixman_renderer *pr =
-		(struct pixman_renderer *) output->compositor->renderer;
+	struct pixman_renderer *pr = get_renderer(output->compositor);
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
-	struct pixman_output_state *po = get_output_state(output);
-	pixman_transform_t transform;
-	pixman_filter_t filter;
-	pixman_image_t *mask_image;
-	pixman_color_t mask = { 0, };
+	struct pixman_job *job;
 	bool need_filter;
 
-	/* Clip rendering to the damaged output region */
-	pixman_image_set_clip_region32(po->shadow_image, repaint_output);
+	job = wl_array_add(&pr->jobs, sizeof *job);
+	if (!job) {
+		weston_log("pixman-renderer: out of memory\n");
+		return;
+	}
 
-	pixman_renderer_compute_transform(&transform, ev, output,
+	job->op = pixman_op;
+	job->on_hw = 0;
+	pixman_region32_init(&job->clip);
+	pixman_region32_copy(&job->clip, repaint_output);
+	job->has_source_clip = source_clip != NULL;
+	pixman_region32_init(&job->source_clip);
+	if (source_clip)
+		pixman_region32_copy(&job->source_clip, source_clip);
+
+	pixman_renderer_compute_transform(&job->transform, ev, output,
 					  &need_filter);
 
 	if (need_filter)
-		filter = PIXMAN_FILTER_BILINEAR;
+		job->filter = PIXMAN_FILTER_BILINEAR;
+	else
+		job->filter = PIXMAN_FILTER_NEAREST;
+
+	if (ev->alpha < 1.0)
+		job->mask_alpha = 0xffff * ev->alpha;
 	else
-		filter = PIXMAN_FILTER_NEAREST;
+		job->mask_alpha = 0xffff;
 
+	job->shm_buffer = NULL;
+	job->shm_pool = NULL;
 	if (ps->buffer_ref.buffer)
-		wl_shm_buffer_begin_access(ps->buffer_ref.buffer->shm_buffer);
+		job->shm_buffer = ps->buffer_ref.buffer->shm_buffer;
+	job->dmabuf_fd = ps->dmabuf_fd;
+
+	job->data = pixman_image_get_data(ps->image);
+	job->format = pixman_image_get_format(ps->image);
+	job->width = pixman_image_get_width(ps->image);
+	job->height = pixman_image_get_height(ps->image);
+	job->stride = pixman_image_get_stride(ps->image);
+	job->color = ps->color;
+
+	job->image = ps->image;
+	job->buffer = ps->buffer_ref.buffer;
+	job->thread = NULL;
+}
+
+static pixman_image_t *
+pixman_job_create_source(struct pixman_job *job)
+{
+	if (!job->data)
+		return pixman_image_create_solid_fill(&job->color);
+
+	return pixman_image_create_bits_no_clear(job->format,
+						 job->width, job->height,
+						 job->data, job->stride);
+}
+
+static pixman_image_t *
+image_create_alias(pixman_image_t *image)
+{
+	return pixman_image_create_bits_no_clear(pixman_image_get_format(image),
+						 pixman_image_get_width(image),
+						 pixman_image_get_height(image),
+						 pixman_image_get_data(image),
+						 pixman_image_get_stride(image));
+}
+
+/* Copy the damaged part of the shadow to a hardware buffer that pixman
+ * would only reach through its generic per-pixel paths.  Returns -1
+ * when there is no converter for the pair of formats, so the caller
+ * falls back to compositing.
+ */
+static int
+copy_to_hw_converted(pixman_image_t *hw, pixman_image_t *shadow,
+		     pixman_region32_t *clip)
+{
+	pixman_format_code_t src_format = pixman_image_get_format(shadow);
+	pixman_format_code_t dst_format = pixman_image_get_format(hw);
+	pixman_box32_t *boxes;
+	uint8_t *src, *dst;
+	const uint32_t *s;
+	uint8_t *d;
+	int src_stride, dst_stride, bpp, width, height;
+	int i, n, x1, x2, y, y2;
+
+	if (src_format != PIXMAN_x8r8g8b8 && src_format != PIXMAN_a8r8g8b8)
+		return -1;
+
+	if (dst_format == PIXMAN_r5g6b5)
+		bpp = 2;
+	else if (dst_format == PIXMAN_r8g8b8)
+		bpp = 3;
+	else
+		return -1;
+
+	width = MIN(pixman_image_get_width(hw),
+		    pixman_image_get_width(shadow));
+	height = MIN(pixman_image_get_height(hw),
+		     pixman_image_get_height(shadow));
+	src = (uint8_t *) pixman_image_get_data(shadow);
+	src_stride = pixman_image_get_stride(shadow);
+	dst = (uint8_t *) pixman_image_get_data(hw);
+	dst_stride = pixman_image_get_stride(hw);
+
+	boxes = pixman_region32_rectangles(clip, &n);
+	for (i = 0; i < n; i++) {
+		x1 = MAX(boxes[i].x1, 0);
+		x2 = MIN(boxes[i].x2, width);
+		y2 = MIN(boxes[i].y2, height);
+		if (x1 >= x2)
+			continue;
+
+		for (y = MAX(boxes[i].y1, 0); y < y2; y++) {
+			s = (const uint32_t *) (src + y * src_stride) + x1;
+			d = dst + y * dst_stride + x1 * bpp;
+			if (bpp == 2)
+				pixel_convert_x8r8g8b8_to_r5g6b5(
+					(uint16_t *) d, s, x2 - x1);
+			else
+				pixel_convert_x8r8g8b8_to_r8g8b8(d, s, x2 - x1);
+		}
+	}
 
-	if (ev->alpha < 1.0) {
-		mask.alpha = 0xffff * ev->alpha;
-		mask_image = pixman_image_create_solid_fill(&mask);
+	return 0;
+}
+
+/* Brackets CPU reads of a mapped dmabuf, so that the caches are
+ * coherent with what the GPU of the client wrote */
+static void
+dmabuf_sync(int fd, bool start)
+{
+#ifdef HAVE_LINUX_DMA_BUF_H
+	struct dma_buf_sync sync;
+
+	sync.flags = DMA_BUF_SYNC_READ |
+		     (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END);
+	while (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) < 0 && errno == EINTR)
+		continue;
+#endif
+}
+
+static void
+pixman_jobs_clear(struct wl_array *jobs)
+{
+	struct pixman_job *job;
+
+	wl_array_for_each(job, jobs) {
+		pixman_region32_fini(&job->clip);
+		pixman_region32_fini(&job->source_clip);
+	}
+	jobs->size = 0;
+}
+
+/* Offer a job to the blitter. Source clipped jobs stay with pixman,
+ * which gets them right by drawing each source box separately. */
+static int
+blit_job(struct pixman_renderer_blitter *blitter, struct pixman_job *job,
+	 pixman_image_t *dest, pixman_region32_t *clip)
+{
+	pixman_box32_t *boxes;
+	pixman_image_t *src;
+	int n_boxes, ret;
+
+	if (job->has_source_clip)
+		return -1;
+
+	boxes = pixman_region32_rectangles(clip, &n_boxes);
+
+	if (!job->data) {
+		if (job->mask_alpha < 0xffff)
+			return -1;
+		return blitter->fill(blitter, dest, job->op, &job->color,
+				     boxes, n_boxes);
+	}
+
+	src = pixman_job_create_source(job);
+	ret = blitter->composite(blitter, dest, job->op, src,
+				 &job->transform, job->filter,
+				 job->mask_alpha, boxes, n_boxes);
+	pixman_image_unref(src);
+
+	return ret;
+}
+
+/* Copy the damage of the shadow to the hardware buffer on the blitter */
+static int
+blit_to_hw(struct pixman_renderer_blitter *blitter, pixman_image_t *hw,
+	   pixman_image_t *shadow, pixman_region32_t *clip)
+{
+	pixman_transform_t identity;
+	pixman_box32_t *boxes;
+	int n_boxes;
+
+	pixman_transform_init_identity(&identity);
+	boxes = pixman_region32_rectangles(clip, &n_boxes);
+
+	return blitter->composite(blitter, hw, PIXMAN_OP_SRC, shadow,
+				  &identity, PIXMAN_FILTER_NEAREST, 0xffff,
+				  boxes, n_boxes);
+}
+
+/* Composite a job on the CPU, into dest clipped as set by the caller */
+static void
+composite_job(struct pixman_job *job, pixman_image_t *dest)
+{
+	pixman_color_t mask_color = { 0, };
+	pixman_image_t *src, *mask;
+
+	src = pixman_job_create_source(job);
+
+	if (job->mask_alpha < 0xffff) {
+		mask_color.alpha = job->mask_alpha;
+		mask = pixman_image_create_solid_fill(&mask_color);
 	} else {
-		mask_image = NULL;
+		mask = NULL;
 	}
 
-	if (source_clip)
-		composite_clipped(ps->image, mask_image, po->shadow_image,
-				  &transform, filter, source_clip);
+	if (job->has_source_clip)
+		composite_clipped(src, mask, dest,
+				  &job->transform, job->filter,
+				  &job->source_clip);
 	else
-		composite_whole(pixman_op, ps->image, mask_image,
-				po->shadow_image, &transform, filter);
+		composite_whole(job->op, src, mask, dest,
+				&job->transform, job->filter);
 
-	if (mask_image)
-		pixman_image_unref(mask_image);
+	if (mask)
+		pixman_image_unref(mask);
 
-	if (ps->buffer_ref.buffer)
-		wl_shm_buffer_end_access(ps->buffer_ref.buffer->shm_buffer);
+	pixman_image_unref(src);
+}
+
+/** Replay the recorded jobs for one band of the output
+ *
+ * \param pr The renderer.
+ * \param output The output to paint.
+ * \param jobs The recorded struct pixman_job.
+ * \param damage The damage to copy to the hardware buffer, in output
+ *               coordinates.
+ * \param band Index of the band, out of n_bands.
+ * \param n_bands The number of bands the output is split into.
+ *
+ * Composites into the shadow image and then copies the damaged part of
+ * the band to the hardware buffer, over which the on_hw jobs go last.
+ * Only the rows of the band are written, so bands can be painted
+ * concurrently.
+ *
+ * Jobs the blitter takes are queued on it; it is drained before the
+ * CPU touches the images again and when the band is done.
+ */
+static void
+pixman_renderer_run_band(struct pixman_renderer *pr,
+			 struct weston_output *output, struct wl_array *jobs,
+			 pixman_region32_t *damage, int band, int n_bands)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_renderer_blitter *blitter = pr->blitter;
+	struct pixman_job *job;
+	pixman_region32_t band_region, clip;
+	pixman_image_t *shadow, *hw, *src;
+	int32_t width, height, band_height, y1, y2;
+	bool blits_queued = false;
+
+	width = pixman_image_get_width(po->shadow_image);
+	height = pixman_image_get_height(po->shadow_image);
+	band_height = (height + n_bands - 1) / n_bands;
+	y1 = band * band_height;
+	y2 = MIN(height, y1 + band_height);
+	if (y1 >= y2)
+		return;
+
+	pixman_region32_init_rect(&band_region, 0, y1, width, y2 - y1);
+	pixman_region32_init(&clip);
+
+	shadow = image_create_alias(po->shadow_image);
+
+	wl_array_for_each(job, jobs) {
+		if (job->on_hw)
+			continue;
+
+		pixman_region32_intersect(&clip, &job->clip, &band_region);
+		if (!pixman_region32_not_empty(&clip))
+			continue;
+
+		if (job->shm_buffer)
+			wl_shm_buffer_begin_access(job->shm_buffer);
+		if (job->dmabuf_fd >= 0)
+			dmabuf_sync(job->dmabuf_fd, true);
+
+		if (blitter && !pr->repaint_debug &&
+		    blit_job(blitter, job, po->shadow_image, &clip) == 0) {
+			blits_queued = true;
+			goto job_done;
+		}
+
+		if (blits_queued) {
+			blitter->finish(blitter);
+			blits_queued = false;
+		}
+
+		/* Clip rendering to the damaged output region */
+		pixman_image_set_clip_region32(shadow, &clip);
+		composite_job(job, shadow);
+
+job_done:
+		if (job->shm_buffer)
+			wl_shm_buffer_end_access(job->shm_buffer);
+		if (job->dmabuf_fd >= 0)
+			dmabuf_sync(job->dmabuf_fd, false);
+
+		if (pr->repaint_debug) {
+			pixman_color_t red = {
+				0x3fff, 0x0000, 0x0000, 0x3fff
+			};
+
+			src = pixman_image_create_solid_fill(&red);
+			pixman_image_composite32(PIXMAN_OP_OVER,
+						 src, /* src */
+						 NULL /* mask */,
+						 shadow, /* dest */
+						 0, 0, /* src_x, src_y */
+						 0, 0, /* mask_x, mask_y */
+						 0, 0, /* dest_x, dest_y */
+						 width, height);
+			pixman_image_unref(src);
+		}
+	}
+
+	pixman_region32_intersect(&clip, damage, &band_region);
+	if (pixman_region32_not_empty(&clip) && blitter &&
+	    blit_to_hw(blitter, po->hw_buffer, po->shadow_image, &clip) == 0) {
+		blits_queued = true;
+		pixman_region32_clear(&clip);
+	}
+
+	if (blits_queued && pixman_region32_not_empty(&clip)) {
+		blitter->finish(blitter);
+		blits_queued = false;
+	}
 
-	if (pr->repaint_debug)
-		pixman_image_composite32(PIXMAN_OP_OVER,
-					 pr->debug_color, /* src */
+	if (pixman_region32_not_empty(&clip) &&
+	    copy_to_hw_converted(po->hw_buffer, po->shadow_image, &clip) < 0) {
+		pixman_image_set_clip_region32(shadow, NULL);
+		hw = image_create_alias(po->hw_buffer);
+		pixman_image_set_clip_region32(hw, &clip);
+		pixman_image_composite32(PIXMAN_OP_SRC,
+					 shadow, /* src */
 					 NULL /* mask */,
-					 po->shadow_image, /* dest */
+					 hw, /* dest */
 					 0, 0, /* src_x, src_y */
 					 0, 0, /* mask_x, mask_y */
 					 0, 0, /* dest_x, dest_y */
-					 pixman_image_get_width (po->shadow_image), /* width */
-					 pixman_image_get_height (po->shadow_image) /* height */);
+					 pixman_image_get_width (hw), /* width */
+					 pixman_image_get_height (hw) /* height */);
+		pixman_image_unref(hw);
+	}
+
+	if (blits_queued)
+		blitter->finish(blitter);
+
+	hw = NULL;
+	wl_array_for_each(job, jobs) {
+		if (!job->on_hw)
+			continue;
+
+		pixman_region32_intersect(&clip, &job->clip, &band_region);
+		if (!pixman_region32_not_empty(&clip))
+			continue;
+
+		if (!hw)
+			hw = image_create_alias(po->hw_buffer);
+
+		if (job->shm_buffer)
+			wl_shm_buffer_begin_access(job->shm_buffer);
+		if (job->dmabuf_fd >= 0)
+			dmabuf_sync(job->dmabuf_fd, true);
+
+		pixman_image_set_clip_region32(hw, &clip);
+		composite_job(job, hw);
+
+		if (job->shm_buffer)
+			wl_shm_buffer_end_access(job->shm_buffer);
+		if (job->dmabuf_fd >= 0)
+			dmabuf_sync(job->dmabuf_fd, false);
+	}
+	if (hw)
+		pixman_image_unref(hw);
+
+	pixman_image_unref(shadow);
+	pixman_region32_fini(&clip);
+	pixman_region32_fini(&band_region);
+}
+
+static void *
+pixman_worker_thread(void *data)
+{
+	struct pixman_worker *worker = data;
+	struct pixman_renderer *pr = worker->renderer;
+	uint32_t serial = 0;
+
+	pthread_mutex_lock(&pr->mutex);
+	while (1) {
+		while (!pr->quit && pr->work_serial == serial)
+			pthread_cond_wait(&pr->work_cond, &pr->mutex);
+		if (pr->quit)
+			break;
+		serial = pr->work_serial;
+		pthread_mutex_unlock(&pr->mutex);
+
+		pixman_renderer_run_band(pr, pr->work_output, &pr->jobs,
+					 pr->work_damage, worker->band,
+					 pr->n_bands);
+
+		pthread_mutex_lock(&pr->mutex);
+		if (--pr->busy_workers == 0)
+			pthread_cond_signal(&pr->done_cond);
+	}
+	pthread_mutex_unlock(&pr->mutex);
+
+	return NULL;
+}
+
+/** Paint all recorded jobs to an output and clear the job list
+ *
+ * \param output The output whose shadow and hardware buffers to paint.
+ * \param damage The damage to copy to the hardware buffer, in global
+ *               coordinates.
+ */
+static void
+pixman_renderer_run_jobs(struct weston_output *output,
+			 pixman_region32_t *damage)
+{
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	pixman_region32_t output_damage;
+	int n_bands;
+
+	pixman_region32_init(&output_damage);
+	pixman_region32_copy(&output_damage, damage);
+	region_global_to_output(output, &output_damage);
+
+	pr->work_output = output;
+	pr->work_damage = &output_damage;
+
+	/* A blitter is one engine, fed from a single thread */
+	n_bands = pr->blitter ? 1 : pr->n_bands;
+
+	if (n_bands > 1) {
+		pthread_mutex_lock(&pr->mutex);
+		pr->work_serial++;
+		pr->busy_workers = n_bands - 1;
+		pthread_cond_broadcast(&pr->work_cond);
+		pthread_mutex_unlock(&pr->mutex);
+	}
+
+	pixman_renderer_run_band(pr, output, &pr->jobs, &output_damage,
+				 0, n_bands);
+
+	if (n_bands > 1) {
+		pthread_mutex_lock(&pr->mutex);
+		while (pr->busy_workers > 0)
+			pthread_cond_wait(&pr->done_cond, &pr->mutex);
+		pthread_mutex_unlock(&pr->mutex);
+	}
+
+	pr->work_output = NULL;
+	pr->work_damage = NULL;
+	pixman_region32_fini(&output_damage);
 
-	pixman_image_set_clip_region32 (po->shadow_image, NULL);
+	pixman_jobs_clear(&pr->jobs);
+}
+
+static void *
+pixman_output_thread_run(void *data)
+{
+	struct pixman_output_thread *t = data;
+	struct pixman_renderer *pr = get_renderer(t->output->compositor);
+	char c = 0;
+
+	pthread_mutex_lock(&t->mutex);
+	while (1) {
+		while (!t->quit && !t->busy)
+			pthread_cond_wait(&t->cond, &t->mutex);
+		if (t->quit)
+			break;
+		pthread_mutex_unlock(&t->mutex);
+
+		pixman_renderer_run_band(pr, t->output, &t->jobs,
+					 &t->damage, 0, 1);
+
+		pthread_mutex_lock(&t->mutex);
+		t->busy = 0;
+		pthread_cond_broadcast(&t->cond);
+		/* A full pipe has a wakeup pending already, and
+		 * weston_log() may not be used from this thread */
+		if (write(t->done_pipe[1], &c, 1) < 0)
+			continue;
+	}
+	pthread_mutex_unlock(&t->mutex);
+
+	return NULL;
+}
+
+/* A client destroyed a buffer the thread may be reading. The shm pool
+ * is only unmapped after the destroy signal, so waiting here is enough
+ * to keep the pixels valid. */
+static void
+pixman_job_handle_buffer_destroy(struct wl_listener *listener, void *data)
+{
+	struct pixman_job *job =
+		container_of(listener, struct pixman_job,
+			     buffer_destroy_listener);
+
+	wl_list_remove(&listener->link);
+	wl_list_init(&listener->link);
+
+	pixman_output_thread_wait(job->thread);
+}
+
+/** Release the sources held for a frame of an output thread */
+static void
+pixman_output_thread_release(struct pixman_output_thread *t)
+{
+	struct pixman_job *job;
+
+	wl_array_for_each(job, &t->jobs) {
+		if (job->image)
+			pixman_image_unref(job->image);
+		if (job->shm_pool)
+			wl_shm_pool_unref(job->shm_pool);
+		if (job->buffer) {
+			wl_list_remove(&job->buffer_destroy_listener.link);
+			weston_buffer_reference(&job->buffer_ref, NULL);
+		}
+	}
+
+	pixman_jobs_clear(&t->jobs);
+	pixman_region32_clear(&t->damage);
+	t->pending = 0;
+}
+
+/** Hand the recorded jobs of the renderer over to an output thread
+ *
+ * The jobs only point at the pixels of their sources, so the images and
+ * buffers are referenced until the frame is done: the buffers are not
+ * released to clients while the thread reads them. The shm pools are
+ * referenced too, which defers a resize of the pool, and with it the
+ * remapping of its memory, until the thread is done.
+ */
+static void
+pixman_output_thread_queue(struct pixman_output_thread *t,
+			   struct pixman_renderer *pr,
+			   pixman_region32_t *damage)
+{
+	struct wl_array jobs;
+	struct pixman_job *job;
+
+	jobs = t->jobs;
+	t->jobs = pr->jobs;
+	pr->jobs = jobs;
+
+	/* The job array does not grow any more, so the listeners can
+	 * be linked now. */
+	wl_array_for_each(job, &t->jobs) {
+		job->thread = t;
+		if (job->image)
+			pixman_image_ref(job->image);
+		if (job->shm_buffer)
+			job->shm_pool = wl_shm_buffer_ref_pool(job->shm_buffer);
+		if (job->buffer) {
+			job->buffer_ref.buffer = NULL;
+			weston_buffer_reference(&job->buffer_ref, job->buffer);
+			job->buffer_destroy_listener.notify =
+				pixman_job_handle_buffer_destroy;
+			wl_signal_add(&job->buffer->destroy_signal,
+				      &job->buffer_destroy_listener);
+		}
+	}
+
+	pixman_region32_copy(&t->damage, damage);
+	region_global_to_output(t->output, &t->damage);
+
+	t->pending = 1;
+	pthread_mutex_lock(&t->mutex);
+	t->busy = 1;
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->mutex);
+}
+
+/** Finish a frame painted by an output thread, on the main thread */
+static void
+pixman_output_thread_complete(struct pixman_output_thread *t)
+{
+	struct weston_output *output = t->output;
+
+	pixman_output_thread_wait(t);
+	if (!t->pending)
+		return;
+
+	pixman_output_thread_release(t);
+	wl_signal_emit(&output->frame_signal, output);
+
+	/* Last, the callback may destroy the output */
+	t->done(output);
+}
+
+static int
+pixman_output_thread_done(int fd, uint32_t mask, void *data)
+{
+	struct pixman_output_thread *t = data;
+	char buf[16];
+
+	while (read(fd, buf, sizeof buf) > 0)
+		;
+
+	pthread_mutex_lock(&t->mutex);
+	if (t->busy) {
+		pthread_mutex_unlock(&t->mutex);
+		return 0;
+	}
+	pthread_mutex_unlock(&t->mutex);
+
+	pixman_output_thread_complete(t);
+
+	return 0;
+}
+
+static void
+pixman_output_thread_destroy(struct pixman_output_thread *t)
+{
+	pixman_output_thread_wait(t);
+
+	pthread_mutex_lock(&t->mutex);
+	t->quit = 1;
+	pthread_cond_signal(&t->cond);
+	pthread_mutex_unlock(&t->mutex);
+	pthread_join(t->thread, NULL);
+
+	/* A frame that was not completed is dropped */
+	pixman_output_thread_release(t);
+	wl_array_release(&t->jobs);
+	pixman_region32_fini(&t->damage);
+
+	wl_event_source_remove(t->done_source);
+	close(t->done_pipe[0]);
+	close(t->done_pipe[1]);
+	pthread_cond_destroy(&t->cond);
+	pthread_mutex_destroy(&t->mutex);
+	free(t);
 }
 
 static void
@@ -462,9 +1191,10 @@ draw_view_source_clipped(struct weston_view *view,
 }
 
 static void
-draw_view(struct weston_view *ev, struct weston_output *output,
+draw_view(struct weston_render_item *item, struct weston_output *output,
 	  pixman_region32_t *damage) /* in global coordinates */
 {
+	struct weston_view *ev = item->view;
 	struct pixman_surface_state *ps = get_surface_state(ev->surface);
 	/* repaint bounding region in global coordinates: */
 	pixman_region32_t repaint;
@@ -474,9 +1204,7 @@ draw_view(struct weston_view *ev, struct weston_output *output,
 		return;
 
 	pixman_region32_init(&repaint);
-	pixman_region32_intersect(&repaint,
-				  &ev->transform.boundingbox, damage);
-	pixman_region32_subtract(&repaint, &repaint, &ev->clip);
+	pixman_region32_intersect(&repaint, &item->region, damage);
 
 	if (!pixman_region32_not_empty(&repaint))
 		goto out;
@@ -507,39 +1235,71 @@ out:
 static void
 repaint_surfaces(struct weston_output *output, pixman_region32_t *damage)
 {
-	struct weston_compositor *compositor = output->compositor;
-	struct weston_view *view;
+	struct weston_render_item *item;
 
-	wl_list_for_each_reverse(view, &compositor->view_list, link)
-		if (view->plane == &compositor->primary_plane)
-			draw_view(view, output, damage);
+	/* Bottom to top */
+	wl_array_for_each(item, &output->render_list)
+		draw_view(item, output, damage);
 }
 
+/** Record the views of the software cursor plane
+ *
+ * \param output The output being repainted.
+ * \param damage The output damage, whose views are recorded already;
+ *               the cursor is added to it, for the copy from the shadow
+ *               and for the backends that pass the damage on.
+ *
+ * The shadow image never holds the cursor, it is drawn over the
+ * hardware buffer after the copy. Moving it only copies its old and new
+ * place again, the views under it are not composited.
+ */
 static void
-copy_to_hw_buffer(struct weston_output *output, pixman_region32_t *region)
+draw_cursor_views(struct weston_output *output, pixman_region32_t *damage)
 {
 	struct pixman_output_state *po = get_output_state(output);
-	pixman_region32_t output_region;
-
-	pixman_region32_init(&output_region);
-	pixman_region32_copy(&output_region, region);
-
-	region_global_to_output(output, &output_region);
-
-	pixman_image_set_clip_region32 (po->hw_buffer, &output_region);
-	pixman_region32_fini(&output_region);
+	struct pixman_renderer *pr = get_renderer(output->compositor);
+	struct weston_compositor *ec = output->compositor;
+	struct weston_view *ev, **views = output->view_list.data;
+	struct weston_render_item item;
+	struct pixman_job *job;
+	pixman_region32_t cursor;
+	size_t i, first = pr->jobs.size / sizeof *job;
+
+	pixman_region32_init(&cursor);
+	for (i = output->view_list.size / sizeof *views; i-- > 0; ) {
+		ev = views[i];
+		if (ev->plane == &ec->cursor_plane)
+			pixman_region32_union(&cursor, &cursor,
+					      &ev->transform.boundingbox);
+	}
 
-	pixman_image_composite32(PIXMAN_OP_SRC,
-				 po->shadow_image, /* src */
-				 NULL /* mask */,
-				 po->hw_buffer, /* dest */
-				 0, 0, /* src_x, src_y */
-				 0, 0, /* mask_x, mask_y */
-				 0, 0, /* dest_x, dest_y */
-				 pixman_image_get_width (po->hw_buffer), /* width */
-				 pixman_image_get_height (po->hw_buffer) /* height */);
+	pixman_region32_union(damage, damage, &po->cursor_damage[0]);
+	pixman_region32_union(damage, damage, &po->cursor_damage[1]);
+	pixman_region32_union(damage, damage, &cursor);
+	pixman_region32_union(damage, damage, &ec->cursor_plane.damage);
+	pixman_region32_intersect(damage, damage, &output->region);
+
+	pixman_region32_copy(&po->cursor_damage[1], &po->cursor_damage[0]);
+	pixman_region32_copy(&po->cursor_damage[0], &cursor);
+	pixman_region32_fini(&cursor);
+
+	/* Bottom to top */
+	for (i = output->view_list.size / sizeof *views; i-- > 0; ) {
+		ev = views[i];
+		if (ev->plane != &ec->cursor_plane)
+			continue;
+
+		item.view = ev;
+		item.surface = ev->surface;
+		item.alpha = ev->alpha;
+		item.region = ev->transform.boundingbox;
+		weston_view_to_output_matrix(ev, output, false, &item.matrix);
+		draw_view(&item, output, damage);
+	}
 
-	pixman_image_set_clip_region32 (po->hw_buffer, NULL);
+	job = pr->jobs.data;
+	for (i = first; i < pr->jobs.size / sizeof *job; i++)
+		job[i].on_hw = 1;
 }
 
 static void
@@ -552,7 +1312,18 @@ pixman_renderer_repaint_output(struct weston_output *output,
 		return;
 
 	repaint_surfaces(output, output_damage);
-	copy_to_hw_buffer(output, output_damage);
+	draw_cursor_views(output, output_damage);
+
+	if (po->thread) {
+		/* The frame signal is emitted once the thread is done */
+		pixman_output_thread_queue(po->thread,
+					   get_renderer(output->compositor),
+					   output_damage);
+		pixman_region32_copy(&output->previous_damage, output_damage);
+		return;
+	}
+
+	pixman_renderer_run_jobs(output, output_damage);
 
 	pixman_region32_copy(&output->previous_damage, output_damage);
 	wl_signal_emit(&output->frame_signal, output);
@@ -578,18 +1349,126 @@ buffer_state_handle_buffer_destroy(struct wl_listener *listener, void *data)
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
 	}
+	ps->dmabuf_fd = -1;
 
 	ps->buffer_destroy_listener.notify = NULL;
 }
 
+#define fourcc_code(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+				 ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+/* The DRM formats pixman can read as they are, spelled out here to
+ * keep libdrm out of the core */
+static const struct {
+	uint32_t fourcc;
+	pixman_format_code_t format;
+} dmabuf_formats[] = {
+	{ fourcc_code('X', 'R', '2', '4'), PIXMAN_x8r8g8b8 },
+	{ fourcc_code('A', 'R', '2', '4'), PIXMAN_a8r8g8b8 },
+	{ fourcc_code('X', 'B', '2', '4'), PIXMAN_x8b8g8r8 },
+	{ fourcc_code('A', 'B', '2', '4'), PIXMAN_a8b8g8r8 },
+	{ fourcc_code('R', 'G', '1', '6'), PIXMAN_r5g6b5 },
+};
+
+static void
+pixman_dmabuf_destroy(struct pixman_dmabuf *pd)
+{
+	linux_dmabuf_buffer_set_user_data(pd->dmabuf, NULL, NULL);
+	munmap(pd->map, pd->size);
+	wl_list_remove(&pd->link);
+	free(pd);
+}
+
+static void
+pixman_renderer_destroy_dmabuf(struct linux_dmabuf_buffer *dmabuf)
+{
+	pixman_dmabuf_destroy(linux_dmabuf_buffer_get_user_data(dmabuf));
+}
+
+static bool
+pixman_renderer_import_dmabuf(struct weston_compositor *ec,
+			      struct linux_dmabuf_buffer *dmabuf)
+{
+	struct pixman_renderer *pr = get_renderer(ec);
+	struct pixman_dmabuf *pd;
+	pixman_format_code_t format = 0;
+	size_t size;
+	void *map;
+	unsigned i;
+
+	if (linux_dmabuf_buffer_get_user_data(dmabuf))
+		return true;
+
+	for (i = 0; i < ARRAY_LENGTH(dmabuf_formats); i++)
+		if (dmabuf_formats[i].fourcc == dmabuf->format)
+			format = dmabuf_formats[i].format;
+
+	/* Only single plane, linear buffers can be read in place, and
+	 * pixman wants rows aligned to 32 bits */
+	if (format == 0 || dmabuf->n_planes != 1 ||
+	    dmabuf->modifier[0] != 0 || dmabuf->flags != 0 ||
+	    dmabuf->offset[0] % 4 != 0 || dmabuf->stride[0] % 4 != 0)
+		return false;
+
+	size = dmabuf->offset[0] + (size_t) dmabuf->stride[0] * dmabuf->height;
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, dmabuf->dmabuf_fd[0], 0);
+	if (map == MAP_FAILED)
+		return false;
+
+	pd = zalloc(sizeof *pd);
+	if (pd == NULL) {
+		munmap(map, size);
+		return false;
+	}
+
+	pd->dmabuf = dmabuf;
+	pd->map = map;
+	pd->size = size;
+	pd->format = format;
+	wl_list_insert(&pr->dmabufs, &pd->link);
+	linux_dmabuf_buffer_set_user_data(dmabuf, pd,
+					  pixman_renderer_destroy_dmabuf);
+
+	return true;
+}
+
+static pixman_image_t *
+pixman_renderer_attach_dmabuf(struct weston_surface *es,
+			      struct weston_buffer *buffer,
+			      struct linux_dmabuf_buffer *dmabuf)
+{
+	struct pixman_surface_state *ps = get_surface_state(es);
+	struct pixman_dmabuf *pd;
+
+	/* Buffers imported while another renderer was active are mapped
+	 * on first use */
+	if (!pixman_renderer_import_dmabuf(es->compositor, dmabuf)) {
+		linux_dmabuf_buffer_send_server_error(dmabuf,
+				"dmabuf cannot be mapped");
+		return NULL;
+	}
+	pd = linux_dmabuf_buffer_get_user_data(dmabuf);
+
+	buffer->width = dmabuf->width;
+	buffer->height = dmabuf->height;
+	ps->dmabuf_fd = dmabuf->dmabuf_fd[0];
+
+	return pixman_image_create_bits(pd->format,
+		buffer->width, buffer->height,
+		(uint32_t *) ((uint8_t *) pd->map + dmabuf->offset[0]),
+		dmabuf->stride[0]);
+}
+
 static void
 pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 {
 	struct pixman_surface_state *ps = get_surface_state(es);
 	struct wl_shm_buffer *shm_buffer;
+	struct linux_dmabuf_buffer *dmabuf;
 	pixman_format_code_t pixman_format;
 
 	weston_buffer_reference(&ps->buffer_ref, buffer);
+	ps->dmabuf_fd = -1;
 
 	if (ps->buffer_destroy_listener.notify) {
 		wl_list_remove(&ps->buffer_destroy_listener.link);
@@ -606,8 +1485,18 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 	
 	shm_buffer = wl_shm_buffer_get(buffer->resource);
 
+	if (!shm_buffer &&
+	    (dmabuf = linux_dmabuf_buffer_get(buffer->resource))) {
+		ps->image = pixman_renderer_attach_dmabuf(es, buffer, dmabuf);
+		if (!ps->image) {
+			weston_buffer_reference(&ps->buffer_ref, NULL);
+			return;
+		}
+		goto out;
+	}
+
 	if (! shm_buffer) {
-		weston_log("Pixman renderer supports only SHM buffers\n");
+		weston_log("Pixman renderer supports only SHM and dmabuf buffers\n");
 		weston_buffer_reference(&ps->buffer_ref, NULL);
 		return;
 	}
@@ -638,6 +1527,7 @@ pixman_renderer_attach(struct weston_surface *es, struct weston_buffer *buffer)
 		wl_shm_buffer_get_data(shm_buffer),
 		wl_shm_buffer_get_stride(shm_buffer));
 
+out:
 	ps->buffer_destroy_listener.notify =
 		buffer_state_handle_buffer_destroy;
 	wl_signal_add(&buffer->destroy_signal,
@@ -699,6 +1589,7 @@ pixman_renderer_create_surface(struct weston_surface *surface)
 	surface->renderer_state = ps;
 
 	ps->surface = surface;
+	ps->dmabuf_fd = -1;
 
 	ps->surface_destroy_listener.notify =
 		surface_state_handle_surface_destroy;
@@ -724,7 +1615,8 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	color.green = green * 0xffff;
 	color.blue = blue * 0xffff;
 	color.alpha = alpha * 0xffff;
-	
+	ps->color = color;
+
 	if (ps->image) {
 		pixman_image_unref(ps->image);
 		ps->image = NULL;
@@ -733,13 +1625,113 @@ pixman_renderer_surface_set_color(struct weston_surface *es,
 	ps->image = pixman_image_create_solid_fill(&color);
 }
 
+static int
+pixman_renderer_surface_set_image(struct weston_surface *es,
+				  pixman_image_t *image)
+{
+	struct pixman_surface_state *ps = get_surface_state(es);
+
+	pixman_renderer_attach(es, NULL);
+	ps->image = pixman_image_ref(image);
+
+	return 0;
+}
+
+static void
+pixman_renderer_stop_workers(struct pixman_renderer *pr, int n_workers)
+{
+	int i;
+
+	pthread_mutex_lock(&pr->mutex);
+	pr->quit = 1;
+	pthread_cond_broadcast(&pr->work_cond);
+	pthread_mutex_unlock(&pr->mutex);
+
+	for (i = 0; i < n_workers; i++)
+		pthread_join(pr->workers[i].thread, NULL);
+
+	free(pr->workers);
+	pr->workers = NULL;
+	pr->n_bands = 1;
+}
+
+/** Start the band workers configured in weston.ini
+ *
+ * The [core] key pixman-threads sets the number of threads, including
+ * the compositor's main thread, that composite an output. Failing to
+ * start them is not fatal, the renderer then paints in one thread.
+ */
+static void
+pixman_renderer_start_workers(struct pixman_renderer *pr,
+			      struct weston_compositor *ec)
+{
+	struct weston_config_section *section;
+	int32_t threads;
+	int i;
+
+	pr->n_bands = 1;
+
+	section = weston_config_get_section(ec->config, "core", NULL, NULL);
+	weston_config_section_get_int(section, "pixman-threads", &threads, 1);
+	if (threads <= 1)
+		return;
+	threads = MIN(threads, PIXMAN_MAX_THREADS);
+
+	pthread_mutex_init(&pr->mutex, NULL);
+	pthread_cond_init(&pr->work_cond, NULL);
+	pthread_cond_init(&pr->done_cond, NULL);
+
+	pr->workers = zalloc((threads - 1) * sizeof *pr->workers);
+	if (!pr->workers)
+		goto err;
+
+	for (i = 0; i < threads - 1; i++) {
+		pr->workers[i].renderer = pr;
+		pr->workers[i].band = i + 1;
+		if (pthread_create(&pr->workers[i].thread, NULL,
+				   pixman_worker_thread, &pr->workers[i]) != 0) {
+			weston_log("pixman-renderer: failed to start worker "
+				   "thread\n");
+			pixman_renderer_stop_workers(pr, i);
+			goto err;
+		}
+	}
+
+	pr->n_bands = threads;
+	weston_log("pixman-renderer: compositing with %d threads\n", threads);
+	return;
+
+err:
+	free(pr->workers);
+	pr->workers = NULL;
+	pthread_cond_destroy(&pr->done_cond);
+	pthread_cond_destroy(&pr->work_cond);
+	pthread_mutex_destroy(&pr->mutex);
+}
+
 static void
 pixman_renderer_destroy(struct weston_compositor *ec)
 {
 	struct pixman_renderer *pr = get_renderer(ec);
+	struct pixman_dmabuf *pd, *pd_next;
 
 	wl_signal_emit(&pr->destroy_signal, pr);
 	weston_binding_destroy(pr->debug_binding);
+
+	wl_list_for_each_safe(pd, pd_next, &pr->dmabufs, link)
+		pixman_dmabuf_destroy(pd);
+
+	if (pr->blitter)
+		pr->blitter->destroy(pr->blitter);
+
+	if (pr->n_bands > 1) {
+		pixman_renderer_stop_workers(pr, pr->n_bands - 1);
+		pthread_cond_destroy(&pr->done_cond);
+		pthread_cond_destroy(&pr->work_cond);
+		pthread_mutex_destroy(&pr->mutex);
+	}
+	wl_array_release(&pr->jobs);
+
 	free(pr);
 
 	ec->renderer = NULL;
@@ -777,6 +1769,9 @@ pixman_renderer_surface_copy_content(struct weston_surface *surface,
 	out_buf = pixman_image_create_bits(format, width, height,
 					   target, width * bytespp);
 
+	if (ps->dmabuf_fd >= 0)
+		dmabuf_sync(ps->dmabuf_fd, true);
+
 	pixman_image_set_transform(ps->image, NULL);
 	pixman_image_composite32(PIXMAN_OP_SRC,
 				 ps->image,    /* src */
@@ -787,6 +1782,9 @@ pixman_renderer_surface_copy_content(struct weston_surface *surface,
 				 0, 0,         /* dest_x, dest_y */
 				 width, height);
 
+	if (ps->dmabuf_fd >= 0)
+		dmabuf_sync(ps->dmabuf_fd, false);
+
 	pixman_image_unref(out_buf);
 
 	return 0;
@@ -801,16 +1799,8 @@ debug_binding(struct weston_keyboard *keyboard, uint32_t time, uint32_t key,
 
 	pr->repaint_debug ^= 1;
 
-	if (pr->repaint_debug) {
-		pixman_color_t red = {
-			0x3fff, 0x0000, 0x0000, 0x3fff
-		};
-
-		pr->debug_color = pixman_image_create_solid_fill(&red);
-	} else {
-		pixman_image_unref(pr->debug_color);
+	if (!pr->repaint_debug)
 		weston_compositor_damage_all(ec);
-	}
 }
 
 WL_EXPORT int
@@ -823,21 +1813,23 @@ pixman_renderer_init(struct weston_compositor *ec)
 		return -1;
 
 	renderer->repaint_debug = 0;
-	renderer->debug_color = NULL;
 	renderer->base.read_pixels = pixman_renderer_read_pixels;
 	renderer->base.repaint_output = pixman_renderer_repaint_output;
 	renderer->base.flush_damage = pixman_renderer_flush_damage;
 	renderer->base.attach = pixman_renderer_attach;
 	renderer->base.surface_set_color = pixman_renderer_surface_set_color;
+	renderer->base.surface_set_image = pixman_renderer_surface_set_image;
 	renderer->base.destroy = pixman_renderer_destroy;
 	renderer->base.surface_get_content_size =
 		pixman_renderer_surface_get_content_size;
 	renderer->base.surface_copy_content =
 		pixman_renderer_surface_copy_content;
+	renderer->base.import_dmabuf = pixman_renderer_import_dmabuf;
 	ec->renderer = &renderer->base;
 	ec->capabilities |= WESTON_CAP_ROTATION_ANY;
 	ec->capabilities |= WESTON_CAP_CAPTURE_YFLIP;
 	ec->capabilities |= WESTON_CAP_VIEW_CLIP_MASK;
+	ec->capabilities |= WESTON_CAP_SOFTWARE_CURSOR;
 
 	renderer->debug_binding =
 		weston_compositor_add_debug_binding(ec, KEY_R,
@@ -846,15 +1838,47 @@ pixman_renderer_init(struct weston_compositor *ec)
 	wl_display_add_shm_format(ec->wl_display, WL_SHM_FORMAT_RGB565);
 
 	wl_signal_init(&renderer->destroy_signal);
+	wl_list_init(&renderer->dmabufs);
+
+	wl_array_init(&renderer->jobs);
+	pixman_renderer_start_workers(renderer, ec);
 
 	return 0;
 }
 
+/** Hand operations to a 2D engine, or NULL to go back to the CPU
+ *
+ * The renderer takes ownership of the blitter and destroys it when it
+ * is replaced or the renderer goes away.
+ */
+WL_EXPORT void
+pixman_renderer_set_blitter(struct weston_compositor *ec,
+			    struct pixman_renderer_blitter *blitter)
+{
+	struct pixman_renderer *pr = get_renderer(ec);
+	struct weston_output *output;
+	struct pixman_output_state *po;
+
+	/* Output threads may be painting with the old one */
+	wl_list_for_each(output, &ec->output_list, link) {
+		po = get_output_state(output);
+		if (po && po->thread)
+			pixman_output_thread_wait(po->thread);
+	}
+
+	if (pr->blitter)
+		pr->blitter->destroy(pr->blitter);
+	pr->blitter = blitter;
+}
+
 WL_EXPORT void
 pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *buffer)
 {
 	struct pixman_output_state *po = get_output_state(output);
 
+	if (po->thread)
+		pixman_output_thread_wait(po->thread);
+
 	if (po->hw_buffer)
 		pixman_image_unref(po->hw_buffer);
 	po->hw_buffer = buffer;
@@ -869,15 +1893,14 @@ WL_EXPORT int
 pixman_renderer_output_create(struct weston_output *output)
 {
 	struct pixman_output_state *po;
-	int w, h;
+	int32_t w, h;
 
 	po = zalloc(sizeof *po);
 	if (po == NULL)
 		return -1;
 
 	/* set shadow image transformation */
-	w = output->current_mode->width;
-	h = output->current_mode->height;
+	weston_output_get_buffer_size(output, &w, &h);
 
 	po->shadow_buffer = malloc(w * h * 4);
 
@@ -896,6 +1919,9 @@ pixman_renderer_output_create(struct weston_output *output)
 		return -1;
 	}
 
+	pixman_region32_init(&po->cursor_damage[0]);
+	pixman_region32_init(&po->cursor_damage[1]);
+
 	output->renderer_state = po;
 
 	return 0;
@@ -906,6 +1932,9 @@ pixman_renderer_output_destroy(struct weston_output *output)
 {
 	struct pixman_output_state *po = get_output_state(output);
 
+	if (po->thread)
+		pixman_output_thread_destroy(po->thread);
+
 	pixman_image_unref(po->shadow_image);
 
 	if (po->hw_buffer)
@@ -913,9 +1942,91 @@ pixman_renderer_output_destroy(struct weston_output *output)
 
 	free(po->shadow_buffer);
 
+	pixman_region32_fini(&po->cursor_damage[0]);
+	pixman_region32_fini(&po->cursor_damage[1]);
+
 	po->shadow_buffer = NULL;
 	po->shadow_image = NULL;
 	po->hw_buffer = NULL;
 
 	free(po);
 }
+
+/** Composite the frames of an output on a thread of its own
+ *
+ * \param output An output created with pixman_renderer_output_create().
+ * \param done Called on the main thread when a frame is in the hardware
+ *             buffer; the caller flips from there, not after
+ *             weston_renderer::repaint_output returns.
+ * \return 0 on success, -1 if the thread cannot be started.
+ *
+ * Views are still walked on the main thread, which stays free for the
+ * other outputs and for input while the pixels are composited. The
+ * band workers of pixman-threads are not used for such an output.
+ */
+WL_EXPORT int
+pixman_renderer_output_start_thread(struct weston_output *output,
+				    pixman_renderer_output_done_func_t done)
+{
+	struct pixman_output_state *po = get_output_state(output);
+	struct pixman_output_thread *t;
+	struct wl_event_loop *loop;
+
+	if (po->thread)
+		return 0;
+
+	t = zalloc(sizeof *t);
+	if (t == NULL)
+		return -1;
+
+	t->output = output;
+	t->done = done;
+	wl_array_init(&t->jobs);
+	pixman_region32_init(&t->damage);
+
+	if (pipe2(t->done_pipe, O_CLOEXEC | O_NONBLOCK) < 0)
+		goto err_free;
+
+	loop = wl_display_get_event_loop(output->compositor->wl_display);
+	t->done_source = wl_event_loop_add_fd(loop, t->done_pipe[0],
+					      WL_EVENT_READABLE,
+					      pixman_output_thread_done, t);
+	if (!t->done_source)
+		goto err_pipe;
+
+	pthread_mutex_init(&t->mutex, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	if (pthread_create(&t->thread, NULL,
+			   pixman_output_thread_run, t) != 0) {
+		pthread_cond_destroy(&t->cond);
+		pthread_mutex_destroy(&t->mutex);
+		wl_event_source_remove(t->done_source);
+		goto err_pipe;
+	}
+
+	po->thread = t;
+
+	return 0;
+
+err_pipe:
+	close(t->done_pipe[0]);
+	close(t->done_pipe[1]);
+err_free:
+	pixman_region32_fini(&t->damage);
+	free(t);
+	return -1;
+}
+
+/** Wait for the frame being composited by an output thread
+ *
+ * If a frame is pending, its done callback runs before this returns.
+ * Use it before changing what the output scans out.
+ */
+WL_EXPORT void
+pixman_renderer_output_finish_frame(struct weston_output *output)
+{
+	struct pixman_output_state *po = get_output_state(output);
+
+	if (po->thread)
+		pixman_output_thread_complete(po->thread);
+}
@@ -30,6 +30,46 @@
 int
 pixman_renderer_init(struct weston_compositor *ec);
 
+/** A 2D engine that the pixman renderer hands operations to
+ *
+ * Every operation covers a list of boxes in dest coordinates. A hook
+ * returns 0 when the engine took the operation, or -1 to have pixman
+ * do it instead, so an engine only needs to handle the formats, ops
+ * and transforms it supports. Operations may be queued: images are
+ * only valid during the call, but their pixels stay untouched until
+ * finish() returns. Outputs are then painted in a single band, but
+ * with output threads, calls for different outputs still come from
+ * different threads.
+ */
+struct pixman_renderer_blitter {
+	/** Fill the boxes of dest with a solid color */
+	int (*fill)(struct pixman_renderer_blitter *blitter,
+		    pixman_image_t *dest, pixman_op_t op,
+		    const pixman_color_t *color,
+		    const pixman_box32_t *boxes, int n_boxes);
+
+	/** Copy, scale or blend src into the boxes of dest
+	 *
+	 * The transform maps dest to src coordinates, and alpha is the
+	 * constant opacity of src, 0xffff when opaque.
+	 */
+	int (*composite)(struct pixman_renderer_blitter *blitter,
+			 pixman_image_t *dest, pixman_op_t op,
+			 pixman_image_t *src,
+			 const pixman_transform_t *transform,
+			 pixman_filter_t filter, uint16_t alpha,
+			 const pixman_box32_t *boxes, int n_boxes);
+
+	/** Wait for the queued operations to land */
+	void (*finish)(struct pixman_renderer_blitter *blitter);
+
+	void (*destroy)(struct pixman_renderer_blitter *blitter);
+};
+
+void
+pixman_renderer_set_blitter(struct weston_compositor *ec,
+			    struct pixman_renderer_blitter *blitter);
+
 int
 pixman_renderer_output_create(struct weston_output *output);
 
@@ -38,3 +78,12 @@ pixman_renderer_output_set_buffer(struct weston_output *output, pixman_image_t *
 
 void
 pixman_renderer_output_destroy(struct weston_output *output);
+
+typedef void (*pixman_renderer_output_done_func_t)(struct weston_output *output);
+
+int
+pixman_renderer_output_start_thread(struct weston_output *output,
+				    pixman_renderer_output_done_func_t done);
+
+void
+pixman_renderer_output_finish_frame(struct weston_output *output);
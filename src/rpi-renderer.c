@@ -146,6 +146,15 @@ struct rpir_view {
 	DISPMANX_ELEMENT_HANDLE_T handle;
 	int layer;
 
+	/* Element attributes as last sent, to only send changes */
+	struct {
+		DISPMANX_RESOURCE_HANDLE_T resource;
+		VC_RECT_T src_rect;
+		VC_RECT_T dst_rect;
+		VC_IMAGE_TRANSFORM_T flipmask;
+		uint8_t alpha;
+	} dmx;
+
 	struct wl_listener view_destroy_listener;
 };
 
@@ -316,15 +325,20 @@ shm_buffer_get_vc_format(struct wl_shm_buffer *buffer)
 }
 
 #ifndef HAVE_ELEMENT_SET_OPAQUE_RECT
+/* Copy rows y1 to y2 of the buffer, forcing alpha to 1 inside the opaque
+ * region. The copy is laid out like the whole buffer, but rows outside
+ * the range are left untouched. */
 static uint32_t *
 apply_opaque_region(struct wl_shm_buffer *buffer,
-		    pixman_region32_t *opaque_region)
+		    pixman_region32_t *opaque_region, int y1, int y2)
 {
-	uint32_t *src, *dst;
+	pixman_box32_t *rects;
+	uint32_t *src, *dst, *row;
 	int width;
 	int height;
 	int stride;
-	int x, y;
+	int i, n, x, y;
+	int x1, x2, ry1, ry2;
 
 	width = wl_shm_buffer_get_width(buffer);
 	height = wl_shm_buffer_get_height(buffer);
@@ -337,14 +351,20 @@ apply_opaque_region(struct wl_shm_buffer *buffer,
 		return NULL;
 	}
 
-	for (y = 0; y < height; y++) {
-		for (x = 0; x < width; x++) {
-			int i = y * stride / 4 + x;
-			if (pixman_region32_contains_point (opaque_region, x, y, NULL)) {
-				dst[i] = src[i] | 0xff000000;
-			} else {
-				dst[i] = src[i];
-			}
+	for (y = y1; y < y2; y++)
+		memcpy(dst + y * stride / 4, src + y * stride / 4, width * 4);
+
+	rects = pixman_region32_rectangles(opaque_region, &n);
+	for (i = 0; i < n; i++) {
+		x1 = int_max(rects[i].x1, 0);
+		x2 = rects[i].x2 < width ? rects[i].x2 : width;
+		ry1 = int_max(rects[i].y1, y1);
+		ry2 = rects[i].y2 < y2 ? rects[i].y2 : y2;
+
+		for (y = ry1; y < ry2; y++) {
+			row = dst + y * stride / 4;
+			for (x = x1; x < x2; x++)
+				row[x] |= 0xff000000;
 		}
 	}
 
@@ -383,22 +403,21 @@ rpi_resource_update(struct rpi_resource *resource, struct weston_buffer *buffer,
 	if (pixman_region32_not_empty(opaque_region) &&
 	    wl_shm_buffer_get_format(buffer->shm_buffer) == WL_SHM_FORMAT_ARGB8888 &&
 	    resource->enable_opaque_regions) {
-		pixels = apply_opaque_region(buffer->shm_buffer, opaque_region);
-
-		if (!pixels)
-			return -1;
-
-		applied_opaque_region = 1;
+		/* A fully opaque buffer is scanned out as XRGB, straight
+		 * from the client's pixels. */
+		if (pixman_region32_contains_rectangle(opaque_region,
+				&(pixman_box32_t) { 0, 0, width, height }) ==
+		    PIXMAN_REGION_IN)
+			ifmt = VC_IMAGE_XRGB8888;
+		else
+			applied_opaque_region = 1;
 	}
 #endif
 
 	ret = rpi_resource_realloc(resource, ifmt & ~PREMULT_ALPHA_FLAG,
 				   width, height, stride, height);
-	if (ret < 0) {
-		if (applied_opaque_region)
-			free(pixels);
+	if (ret < 0)
 		return -1;
-	}
 
 	pixman_region32_init_rect(&write_region, 0, 0, width, height);
 	if (ret == 0)
@@ -407,6 +426,19 @@ rpi_resource_update(struct rpi_resource *resource, struct weston_buffer *buffer,
 
 	wl_shm_buffer_begin_access(buffer->shm_buffer);
 
+#ifndef HAVE_ELEMENT_SET_OPAQUE_RECT
+	if (applied_opaque_region) {
+		r = pixman_region32_extents(&write_region);
+		pixels = apply_opaque_region(buffer->shm_buffer, opaque_region,
+					     r->y1, r->y2);
+		if (!pixels) {
+			wl_shm_buffer_end_access(buffer->shm_buffer);
+			pixman_region32_fini(&write_region);
+			return -1;
+		}
+	}
+#endif
+
 #ifdef HAVE_RESOURCE_WRITE_DATA_RECT
 	/* XXX: Can this do a format conversion, so that scanout does not have to? */
 	r = pixman_region32_rectangles(&write_region, &n);
@@ -1014,6 +1046,12 @@ rpir_view_dmx_add(struct rpir_view *view, struct rpir_output *output,
 	if (view->handle == DISPMANX_NO_HANDLE)
 		return -1;
 
+	view->dmx.resource = resource_handle;
+	view->dmx.src_rect = src_rect;
+	view->dmx.dst_rect = dst_rect;
+	view->dmx.flipmask = flipmask;
+	view->dmx.alpha = alphasetup.opacity;
+
 #ifdef HAVE_ELEMENT_SET_OPAQUE_RECT
 	ret = rpir_surface_set_opaque_rect(surface, update);
 	if (ret < 0)
@@ -1032,9 +1070,13 @@ rpir_view_dmx_swap(struct rpir_view *view,
 	VC_RECT_T rect;
 	pixman_box32_t *r;
 
-	/* XXX: skip, iff resource was not reallocated, and single-buffering */
-	vc_dispmanx_element_change_source(update, view->handle,
-					  view->surface->front->handle);
+	/* Same when single-buffering, unless the resource was
+	 * reallocated */
+	if (view->dmx.resource != view->surface->front->handle) {
+		vc_dispmanx_element_change_source(update, view->handle,
+						  view->surface->front->handle);
+		view->dmx.resource = view->surface->front->handle;
+	}
 
 	/* This is current damage now, after rpir_surface_damage() */
 	r = pixman_region32_extents(&view->surface->prev_damage);
@@ -1045,6 +1087,13 @@ rpir_view_dmx_swap(struct rpir_view *view,
 	DBG("rpir_view %p swap\n", view);
 }
 
+static int
+vc_rect_equal(const VC_RECT_T *a, const VC_RECT_T *b)
+{
+	return a->x == b->x && a->y == b->y &&
+	       a->width == b->width && a->height == b->height;
+}
+
 static int
 rpir_view_dmx_move(struct rpir_view *view,
 		   DISPMANX_UPDATE_HANDLE_T update, int layer)
@@ -1053,10 +1102,9 @@ rpir_view_dmx_move(struct rpir_view *view,
 	VC_RECT_T dst_rect;
 	VC_RECT_T src_rect;
 	VC_IMAGE_TRANSFORM_T flipmask;
+	uint32_t change = 0;
 	int ret;
 
-	/* XXX: return early, if all attributes stay the same */
-
 	if (view->surface->buffer_type == BUFFER_TYPE_EGL) {
 		DISPMANX_RESOURCE_HANDLE_T resource_handle;
 
@@ -1066,23 +1114,38 @@ rpir_view_dmx_move(struct rpir_view *view,
 			return 0;
 		}
 
-		vc_dispmanx_element_change_source(update,
-						  view->handle,
-						  resource_handle);
+		if (resource_handle != view->dmx.resource) {
+			vc_dispmanx_element_change_source(update,
+							  view->handle,
+							  resource_handle);
+			view->dmx.resource = resource_handle;
+		}
 	}
 
 	ret = rpir_view_compute_rects(view, &src_rect, &dst_rect, &flipmask);
 	if (ret < 0)
 		return 0;
 
+	/* Most elements stay put from one frame to the next, and each
+	 * change is a round trip to the VideoCore. */
+	if (layer != view->layer)
+		change |= ELEMENT_CHANGE_LAYER;
+	if (alpha != view->dmx.alpha)
+		change |= ELEMENT_CHANGE_OPACITY;
+	if (flipmask != view->dmx.flipmask)
+		change |= ELEMENT_CHANGE_TRANSFORM;
+	if (!vc_rect_equal(&dst_rect, &view->dmx.dst_rect))
+		change |= ELEMENT_CHANGE_DEST_RECT;
+	if (!vc_rect_equal(&src_rect, &view->dmx.src_rect))
+		change |= ELEMENT_CHANGE_SRC_RECT;
+
+	if (change == 0)
+		return 1;
+
 	ret = vc_dispmanx_element_change_attributes(
 		update,
 		view->handle,
-		ELEMENT_CHANGE_LAYER |
-			ELEMENT_CHANGE_OPACITY |
-			ELEMENT_CHANGE_TRANSFORM |
-			ELEMENT_CHANGE_DEST_RECT |
-			ELEMENT_CHANGE_SRC_RECT,
+		change,
 		layer,
 		alpha,
 		&dst_rect,
@@ -1096,6 +1159,11 @@ rpir_view_dmx_move(struct rpir_view *view,
 	if (ret)
 		return -1;
 
+	view->dmx.src_rect = src_rect;
+	view->dmx.dst_rect = dst_rect;
+	view->dmx.flipmask = flipmask;
+	view->dmx.alpha = alpha;
+
 #ifdef HAVE_ELEMENT_SET_OPAQUE_RECT
 	ret = rpir_surface_set_opaque_rect(surface, update);
 	if (ret < 0)
@@ -32,17 +32,34 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/mman.h>
+#include <sys/ioctl.h>
 #include <signal.h>
+#include <fcntl.h>
 #include <linux/input.h>
+#ifdef HAVE_LINUX_UDMABUF_H
+#include <linux/udmabuf.h>
+#endif
 #include <errno.h>
 #include <ctype.h>
 
 #include <wayland-client.h>
 
 #include "compositor.h"
+#include "linux-dmabuf.h"
 #include "shared/helpers.h"
 #include "shared/os-compatibility.h"
 #include "fullscreen-shell-client-protocol.h"
+#include "linux-dmabuf-client-protocol.h"
+
+#ifndef DRM_FORMAT_XRGB8888
+#define DRM_FORMAT_XRGB8888 0x34325258 /* XR24 */
+#endif
+
+/* Frames copied into dmabufs, at most one shown by the parent, one
+ * waiting for its frame callback and one being filled */
+#define SHARED_OUTPUT_DMABUF_BUFFERS 3
+
+struct ss_dmabuf_buffer;
 
 struct shared_output {
 	struct weston_output *output;
@@ -58,13 +75,29 @@ struct shared_output {
 		struct _wl_fullscreen_shell *fshell;
 		struct wl_output *output;
 		struct wl_surface *surface;
+		struct wl_surface *cursor_surface;
 		struct wl_callback *frame_cb;
 		struct _wl_fullscreen_shell_mode_feedback *mode_feedback;
+		struct zlinux_dmabuf *dmabuf;
+		int dmabuf_xrgb8888;
 	} parent;
 
 	struct wl_event_source *event_source;
 	struct wl_listener frame_listener;
 
+	/* The pointer sprite goes to the parent as a cursor surface
+	 * rather than in the shared pixels, as long as the backend keeps
+	 * it on a cursor plane; see weston_output::side_channel_pointer.
+	 * Moving it then costs the parent nothing but its own motion. */
+	struct {
+		struct ss_seat *seat;
+		struct weston_surface *surface; /* last sent, or NULL */
+		int32_t hotspot_x, hotspot_y;
+		int dirty;
+		struct wl_buffer *buffer;
+		struct wl_listener commit_listener;
+	} cursor;
+
 	struct {
 		int32_t width, height;
 
@@ -72,10 +105,34 @@ struct shared_output {
 		struct wl_list free_buffers;
 	} shm;
 
+	/* Where the renderer and the parent can share a dmabuf, the GPU
+	 * copies each frame into one without the pixels ever reaching
+	 * the CPU. The wl_shm buffers are the fallback. */
+	struct {
+		int enabled;
+		int udmabuf_fd;
+		struct wl_list buffers; /* ss_dmabuf_buffer::link */
+		/* filled, waiting for the parent's frame callback */
+		struct ss_dmabuf_buffer *pending;
+		pixman_region32_t damage;
+		/* a frame found no free buffer */
+		int missed;
+	} dmabuf;
+
 	int cache_dirty;
 	pixman_image_t *cache_image;
 	uint32_t *tmp_data;
 	size_t tmp_data_size;
+
+	/* Damage whose pixels are still being read back */
+	struct {
+		int handle;
+		pixman_region32_t damage;
+		pixman_region32_t output_damage;
+		pixman_box32_t *rects;
+		int rects_size;
+		struct wl_event_source *timer;
+	} readback;
 };
 
 struct ss_seat {
@@ -91,6 +148,7 @@ struct ss_seat {
 
 	enum weston_key_state_update keyboard_state_update;
 	uint32_t key_serial;
+	uint32_t enter_serial;
 };
 
 struct ss_shm_buffer {
@@ -106,6 +164,19 @@ struct ss_shm_buffer {
 	pixman_image_t *pm_image;
 };
 
+struct ss_dmabuf_buffer {
+	struct shared_output *output;
+	struct wl_list link;
+
+	/* What the renderer copies into */
+	struct linux_dmabuf_buffer dmabuf;
+
+	/* The parent imports it asynchronously */
+	struct zlinux_buffer_params *params;
+	struct wl_buffer *buffer;
+	int busy;
+};
+
 struct screen_share {
 	struct weston_compositor *compositor;
 	char *command;
@@ -122,6 +193,13 @@ ss_seat_handle_pointer_enter(void *data, struct wl_pointer *pointer,
 	 * always receiving the input in the same coordinates as the output. */
 
 	notify_pointer_focus(&seat->base, NULL, 0, 0);
+
+	/* The parent wants the cursor set again for each enter */
+	seat->enter_serial = serial;
+	if (seat->output->cursor.seat == seat) {
+		seat->output->cursor.dirty = 1;
+		weston_output_schedule_repaint(seat->output->output);
+	}
 }
 
 static void
@@ -297,6 +375,27 @@ static const struct wl_keyboard_listener ss_seat_keyboard_listener = {
 	ss_seat_handle_modifiers,
 };
 
+/* The first seat with a pointer gets its cursor forwarded */
+static void
+shared_output_set_cursor_seat(struct shared_output *so, struct ss_seat *seat)
+{
+	/* Still in shared_output_create(), which picks the seat later */
+	if (!so->output)
+		return;
+
+	if (so->cursor.seat && !seat)
+		so->output->side_channel_pointer = NULL;
+	if (so->cursor.seat && seat)
+		return;
+
+	so->cursor.seat = seat;
+	so->cursor.surface = NULL;
+	so->cursor.dirty = 1;
+	if (seat)
+		so->output->side_channel_pointer = seat->base.pointer_state;
+	weston_output_schedule_repaint(so->output);
+}
+
 static void
 ss_seat_handle_capabilities(void *data, struct wl_seat *seat,
 			    enum wl_seat_capability caps)
@@ -309,7 +408,10 @@ ss_seat_handle_capabilities(void *data, struct wl_seat *seat,
 		wl_pointer_add_listener(ss_seat->parent.pointer,
 					&ss_seat_pointer_listener, ss_seat);
 		weston_seat_init_pointer(&ss_seat->base);
+		shared_output_set_cursor_seat(ss_seat->output, ss_seat);
 	} else if (!(caps & WL_SEAT_CAPABILITY_POINTER) && ss_seat->parent.pointer) {
+		if (ss_seat->output->cursor.seat == ss_seat)
+			shared_output_set_cursor_seat(ss_seat->output, NULL);
 		wl_pointer_destroy(ss_seat->parent.pointer);
 		ss_seat->parent.pointer = NULL;
 	}
@@ -353,6 +455,8 @@ ss_seat_create(struct shared_output *so, uint32_t id)
 static void
 ss_seat_destroy(struct ss_seat *seat)
 {
+	if (seat->output->cursor.seat == seat)
+		shared_output_set_cursor_seat(seat->output, NULL);
 	if (seat->parent.pointer)
 		wl_pointer_release(seat->parent.pointer);
 	if (seat->parent.keyboard)
@@ -495,6 +599,7 @@ static void
 output_compute_transform(struct weston_output *output,
 			 pixman_transform_t *transform)
 {
+	uint32_t buffer_transform = weston_output_get_buffer_transform(output);
 	pixman_fixed_t fw, fh;
 
 	pixman_transform_init_identity(transform);
@@ -502,7 +607,7 @@ output_compute_transform(struct weston_output *output,
 	fw = pixman_int_to_fixed(output->width);
 	fh = pixman_int_to_fixed(output->height);
 
-	switch (output->transform) {
+	switch (buffer_transform) {
 	case WL_OUTPUT_TRANSFORM_FLIPPED:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
 	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
@@ -513,7 +618,7 @@ output_compute_transform(struct weston_output *output,
 		pixman_transform_translate(transform, NULL, fw, 0);
 	}
 
-	switch (output->transform) {
+	switch (buffer_transform) {
 	default:
 	case WL_OUTPUT_TRANSFORM_NORMAL:
 	case WL_OUTPUT_TRANSFORM_FLIPPED:
@@ -600,6 +705,284 @@ static const struct wl_callback_listener shared_output_frame_listener = {
 	shared_output_frame_callback
 };
 
+static void
+ss_dmabuf_buffer_destroy(struct ss_dmabuf_buffer *db)
+{
+	if (db->output->dmabuf.pending == db)
+		db->output->dmabuf.pending = NULL;
+
+	if (db->params)
+		zlinux_buffer_params_destroy(db->params);
+	if (db->buffer)
+		wl_buffer_destroy(db->buffer);
+
+	/* The renderer's import of it */
+	if (db->dmabuf.user_data_destroy_func)
+		db->dmabuf.user_data_destroy_func(&db->dmabuf);
+	close(db->dmabuf.dmabuf_fd[0]);
+
+	wl_list_remove(&db->link);
+	free(db);
+}
+
+/* Back to wl_shm buffers for good, with a full frame to start them */
+static void
+shared_output_dmabuf_fail(struct shared_output *so, const char *why)
+{
+	struct ss_dmabuf_buffer *db, *next;
+
+	weston_log("Screen share: %s, sending wl_shm buffers\n", why);
+
+	so->dmabuf.enabled = 0;
+	wl_list_for_each_safe(db, next, &so->dmabuf.buffers, link)
+		ss_dmabuf_buffer_destroy(db);
+
+	weston_output_damage(so->output);
+}
+
+/* Attach the pending dmabuf once the parent has both imported it and
+ * asked for a new frame */
+static void
+shared_output_dmabuf_send(struct shared_output *so)
+{
+	struct ss_dmabuf_buffer *db = so->dmabuf.pending;
+	pixman_box32_t *r;
+	int i, nrects;
+
+	if (!db || !db->buffer || so->parent.frame_cb)
+		return;
+
+	r = pixman_region32_rectangles(&so->dmabuf.damage, &nrects);
+	for (i = 0; i < nrects; ++i)
+		wl_surface_damage(so->parent.surface, r[i].x1, r[i].y1,
+				  r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
+
+	wl_surface_attach(so->parent.surface, db->buffer, 0, 0);
+
+	so->parent.frame_cb = wl_surface_frame(so->parent.surface);
+	wl_callback_add_listener(so->parent.frame_cb,
+				 &shared_output_frame_listener, so);
+
+	wl_surface_commit(so->parent.surface);
+	wl_callback_destroy(wl_display_sync(so->parent.display));
+	wl_display_flush(so->parent.display);
+
+	db->busy = 1;
+	so->dmabuf.pending = NULL;
+	pixman_region32_clear(&so->dmabuf.damage);
+}
+
+static void
+ss_dmabuf_buffer_release(void *data, struct wl_buffer *buffer)
+{
+	struct ss_dmabuf_buffer *db = data;
+	struct shared_output *so = db->output;
+
+	db->busy = 0;
+
+	/* The frame that found no buffer is gone from the renderer,
+	 * draw it again */
+	if (so->dmabuf.missed) {
+		so->dmabuf.missed = 0;
+		weston_output_damage(so->output);
+	}
+}
+
+static const struct wl_buffer_listener ss_dmabuf_buffer_listener = {
+	ss_dmabuf_buffer_release
+};
+
+static void
+ss_dmabuf_params_created(void *data, struct zlinux_buffer_params *params,
+			 struct wl_buffer *buffer)
+{
+	struct ss_dmabuf_buffer *db = data;
+
+	zlinux_buffer_params_destroy(db->params);
+	db->params = NULL;
+	db->buffer = buffer;
+	wl_buffer_add_listener(buffer, &ss_dmabuf_buffer_listener, db);
+
+	shared_output_dmabuf_send(db->output);
+}
+
+static void
+ss_dmabuf_params_failed(void *data, struct zlinux_buffer_params *params)
+{
+	struct ss_dmabuf_buffer *db = data;
+
+	shared_output_dmabuf_fail(db->output, "parent refused the dmabuf");
+}
+
+static const struct zlinux_buffer_params_listener ss_dmabuf_params_listener = {
+	ss_dmabuf_params_created,
+	ss_dmabuf_params_failed
+};
+
+#ifdef HAVE_LINUX_UDMABUF_H
+/* A linear XRGB8888 dmabuf of system memory, which both the renderer
+ * and the parent can import */
+static struct ss_dmabuf_buffer *
+ss_dmabuf_buffer_create(struct shared_output *so,
+			int32_t width, int32_t height)
+{
+	struct ss_dmabuf_buffer *db;
+	struct udmabuf_create create;
+	long page_size = sysconf(_SC_PAGESIZE);
+	int32_t stride = width * 4;
+	int memfd, fd;
+
+	memset(&create, 0, sizeof create);
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.size = ((uint64_t) stride * height + page_size - 1) /
+		      page_size * page_size;
+
+	/* udmabuf takes memfds sealed against shrinking */
+	memfd = os_create_anonymous_file(create.size);
+	if (memfd < 0)
+		return NULL;
+	if (os_seal_shrink(memfd) < 0) {
+		close(memfd);
+		return NULL;
+	}
+
+	create.memfd = memfd;
+	fd = ioctl(so->dmabuf.udmabuf_fd, UDMABUF_CREATE, &create);
+	close(memfd);
+	if (fd < 0)
+		return NULL;
+
+	db = zalloc(sizeof *db);
+	if (!db) {
+		close(fd);
+		return NULL;
+	}
+
+	db->output = so;
+	db->dmabuf.compositor = so->output->compositor;
+	db->dmabuf.width = width;
+	db->dmabuf.height = height;
+	db->dmabuf.format = DRM_FORMAT_XRGB8888;
+	db->dmabuf.n_planes = 1;
+	db->dmabuf.dmabuf_fd[0] = fd;
+	db->dmabuf.stride[0] = stride;
+	wl_list_insert(&so->dmabuf.buffers, &db->link);
+
+	db->params = zlinux_dmabuf_create_params(so->parent.dmabuf);
+	zlinux_buffer_params_add(db->params, fd, 0, 0, stride, 0, 0);
+	zlinux_buffer_params_add_listener(db->params,
+					  &ss_dmabuf_params_listener, db);
+	zlinux_buffer_params_create(db->params, width, height,
+				    DRM_FORMAT_XRGB8888, 0);
+
+	return db;
+}
+#else
+static struct ss_dmabuf_buffer *
+ss_dmabuf_buffer_create(struct shared_output *so,
+			int32_t width, int32_t height)
+{
+	return NULL;
+}
+#endif
+
+/* A dmabuf the parent is not using, dropping those of an old size */
+static struct ss_dmabuf_buffer *
+shared_output_get_dmabuf(struct shared_output *so,
+			 int32_t width, int32_t height)
+{
+	struct ss_dmabuf_buffer *db, *next, *found = NULL;
+	int count = 0;
+
+	wl_list_for_each_safe(db, next, &so->dmabuf.buffers, link) {
+		if (db->dmabuf.width != width ||
+		    db->dmabuf.height != height) {
+			if (!db->busy)
+				ss_dmabuf_buffer_destroy(db);
+			continue;
+		}
+
+		count++;
+		if (!db->busy && !found)
+			found = db;
+	}
+
+	if (found || count >= SHARED_OUTPUT_DMABUF_BUFFERS)
+		return found;
+
+	return ss_dmabuf_buffer_create(so, width, height);
+}
+
+/* Copy the frame just repainted into a dmabuf on the GPU. A frame
+ * coming before the parent took the last one replaces it. */
+static void
+shared_output_dmabuf_repainted(struct shared_output *so,
+			       pixman_region32_t *output_damage)
+{
+	struct weston_renderer *renderer = so->output->compositor->renderer;
+	struct ss_dmabuf_buffer *db;
+	int32_t width, height;
+
+	/* Frames that only moved the cursor plane send nothing */
+	if (!pixman_region32_not_empty(output_damage))
+		return;
+
+	/* The parent gets the buffer as is */
+	if (weston_output_get_buffer_transform(so->output) !=
+	    WL_OUTPUT_TRANSFORM_NORMAL || so->output->current_scale != 1) {
+		shared_output_dmabuf_fail(so, "output is transformed");
+		return;
+	}
+
+	weston_output_get_buffer_size(so->output, &width, &height);
+
+	db = so->dmabuf.pending;
+	if (!db)
+		db = shared_output_get_dmabuf(so, width, height);
+	if (!db) {
+		so->dmabuf.missed = 1;
+		return;
+	}
+
+	if (renderer->copy_to_dmabuf(so->output, &db->dmabuf,
+				     0, 0, width, height) < 0) {
+		shared_output_dmabuf_fail(so, "renderer can't copy to dmabufs");
+		return;
+	}
+
+	pixman_region32_union(&so->dmabuf.damage, &so->dmabuf.damage,
+			      output_damage);
+	so->dmabuf.pending = db;
+
+	shared_output_dmabuf_send(so);
+}
+
+/* Use dmabufs if the renderer can copy into them, the parent takes
+ * them and udmabuf can make them */
+static void
+shared_output_dmabuf_init(struct shared_output *so)
+{
+	struct weston_renderer *renderer = so->output->compositor->renderer;
+
+	so->dmabuf.udmabuf_fd = -1;
+	wl_list_init(&so->dmabuf.buffers);
+	pixman_region32_init(&so->dmabuf.damage);
+
+#ifdef HAVE_LINUX_UDMABUF_H
+	if (!renderer->copy_to_dmabuf || !so->parent.dmabuf ||
+	    !so->parent.dmabuf_xrgb8888 ||
+	    getenv("WESTON_SCREEN_SHARE_DISABLE_DMABUF"))
+		return;
+
+	so->dmabuf.udmabuf_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC);
+	if (so->dmabuf.udmabuf_fd < 0)
+		return;
+
+	so->dmabuf.enabled = 1;
+	weston_log("Screen share: sending dmabufs\n");
+#endif
+}
+
 static void
 shared_output_update(struct shared_output *so)
 {
@@ -608,6 +991,11 @@ shared_output_update(struct shared_output *so)
 	int i, nrects;
 	pixman_transform_t transform;
 
+	if (so->dmabuf.enabled) {
+		shared_output_dmabuf_send(so);
+		return;
+	}
+
 	/* Only update if we need to */
 	if (!so->cache_dirty || so->parent.frame_cb)
 		return;
@@ -664,6 +1052,139 @@ shared_output_update(struct shared_output *so)
 	pixman_region32_init(&sb->damage);
 }
 
+/* Copy an shm cursor into a new buffer of the parent; the cursor
+ * only changes on shape changes, so buffers are not recycled. */
+static struct wl_buffer *
+shared_output_copy_cursor(struct shared_output *so,
+			  struct wl_shm_buffer *shm_buffer)
+{
+	struct wl_shm_pool *pool;
+	struct wl_buffer *buffer;
+	int32_t width, height, stride, src_stride, y;
+	uint8_t *data, *src;
+	int fd;
+
+	width = wl_shm_buffer_get_width(shm_buffer);
+	height = wl_shm_buffer_get_height(shm_buffer);
+	src_stride = wl_shm_buffer_get_stride(shm_buffer);
+	stride = width * 4;
+
+	fd = os_create_anonymous_file(height * stride);
+	if (fd < 0) {
+		weston_log("os_create_anonymous_file: %m");
+		return NULL;
+	}
+
+	data = mmap(NULL, height * stride, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		weston_log("mmap: %m");
+		close(fd);
+		return NULL;
+	}
+
+	wl_shm_buffer_begin_access(shm_buffer);
+	src = wl_shm_buffer_get_data(shm_buffer);
+	for (y = 0; y < height; y++)
+		memcpy(data + y * stride, src + y * src_stride, stride);
+	wl_shm_buffer_end_access(shm_buffer);
+
+	pool = wl_shm_create_pool(so->parent.shm, fd, height * stride);
+	buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride,
+			wl_shm_buffer_get_format(shm_buffer) ==
+				WL_SHM_FORMAT_XRGB8888 ?
+			WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888);
+	wl_shm_pool_destroy(pool);
+	munmap(data, height * stride);
+	close(fd);
+
+	return buffer;
+}
+
+/* Forward the pointer sprite if the backend kept it out of the shared
+ * pixels, or else hide the parent's cursor, the sprite is in the
+ * pixels then. */
+static void
+shared_output_update_cursor(struct shared_output *so)
+{
+	struct weston_compositor *ec = so->output->compositor;
+	struct ss_seat *seat = so->cursor.seat;
+	struct weston_pointer *pointer;
+	struct weston_view *sprite;
+	struct weston_surface *surface = NULL;
+	struct weston_buffer *buffer;
+	struct wl_shm_buffer *shm_buffer = NULL;
+	struct wl_buffer *copy;
+	int32_t scale = so->output->current_scale;
+
+	if (!seat || !seat->parent.pointer)
+		return;
+
+	pointer = seat->base.pointer_state;
+	sprite = pointer ? pointer->sprite : NULL;
+	if (sprite && sprite->plane && sprite->plane != &ec->primary_plane &&
+	    sprite->plane != &ec->cursor_plane) {
+		buffer = sprite->surface->buffer_ref.buffer;
+		if (buffer)
+			shm_buffer = wl_shm_buffer_get(buffer->resource);
+		if (shm_buffer &&
+		    (wl_shm_buffer_get_format(shm_buffer) ==
+		     WL_SHM_FORMAT_ARGB8888 ||
+		     wl_shm_buffer_get_format(shm_buffer) ==
+		     WL_SHM_FORMAT_XRGB8888))
+			surface = sprite->surface;
+	}
+
+	if (!so->cursor.dirty && surface == so->cursor.surface &&
+	    (!surface || (pointer->hotspot_x == so->cursor.hotspot_x &&
+			  pointer->hotspot_y == so->cursor.hotspot_y)))
+		return;
+
+	so->cursor.dirty = 0;
+	so->cursor.surface = surface;
+
+	if (!surface) {
+		wl_pointer_set_cursor(seat->parent.pointer,
+				      seat->enter_serial, NULL, 0, 0);
+		wl_display_flush(so->parent.display);
+		return;
+	}
+
+	so->cursor.hotspot_x = pointer->hotspot_x;
+	so->cursor.hotspot_y = pointer->hotspot_y;
+
+	copy = shared_output_copy_cursor(so, shm_buffer);
+	if (!copy)
+		return;
+
+	wl_surface_attach(so->parent.cursor_surface, copy, 0, 0);
+	wl_surface_damage(so->parent.cursor_surface, 0, 0,
+			  wl_shm_buffer_get_width(shm_buffer),
+			  wl_shm_buffer_get_height(shm_buffer));
+	wl_surface_commit(so->parent.cursor_surface);
+	wl_pointer_set_cursor(seat->parent.pointer, seat->enter_serial,
+			      so->parent.cursor_surface,
+			      pointer->hotspot_x * scale,
+			      pointer->hotspot_y * scale);
+	wl_display_flush(so->parent.display);
+
+	if (so->cursor.buffer)
+		wl_buffer_destroy(so->cursor.buffer);
+	so->cursor.buffer = copy;
+}
+
+static void
+shared_output_cursor_committed(struct wl_listener *listener, void *data)
+{
+	struct shared_output *so =
+		container_of(listener, struct shared_output,
+			     cursor.commit_listener);
+	struct weston_surface *surface = data;
+
+	if (surface == so->cursor.surface)
+		so->cursor.dirty = 1;
+}
+
 static void
 shm_handle_format(void *data, struct wl_shm *wl_shm, uint32_t format)
 {
@@ -676,6 +1197,20 @@ struct wl_shm_listener shm_listener = {
 	shm_handle_format
 };
 
+static void
+dmabuf_handle_format(void *data, struct zlinux_dmabuf *dmabuf,
+		     uint32_t format)
+{
+	struct shared_output *so = data;
+
+	if (format == DRM_FORMAT_XRGB8888)
+		so->parent.dmabuf_xrgb8888 = 1;
+}
+
+static const struct zlinux_dmabuf_listener dmabuf_listener = {
+	dmabuf_handle_format
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry,
 		       uint32_t id, const char *interface, uint32_t version)
@@ -697,6 +1232,12 @@ registry_handle_global(void *data, struct wl_registry *registry,
 			wl_registry_bind(registry,
 					 id, &wl_shm_interface, 1);
 		wl_shm_add_listener(so->parent.shm, &shm_listener, so);
+	} else if (strcmp(interface, "zlinux_dmabuf") == 0) {
+		so->parent.dmabuf =
+			wl_registry_bind(registry,
+					 id, &zlinux_dmabuf_interface, 1);
+		zlinux_dmabuf_add_listener(so->parent.dmabuf,
+					   &dmabuf_listener, so);
 	} else if (strcmp(interface, "_wl_fullscreen_shell") == 0) {
 		so->parent.fshell =
 			wl_registry_bind(registry,
@@ -774,36 +1315,195 @@ struct _wl_fullscreen_shell_mode_feedback_listener mode_feedback_listener = {
 	mode_feedback_ok,
 };
 
+/* How long to let the GPU work on a read-back before collecting it
+ * when no later frame does it first. */
+#define SHARED_OUTPUT_READBACK_DELAY 4
+
+static void
+shared_output_blit(struct shared_output *so, uint32_t *data,
+		   pixman_box32_t *r, int do_yflip)
+{
+	uint32_t *cache_data = pixman_image_get_data(so->cache_image);
+	int32_t stride = pixman_image_get_stride(so->cache_image) / 4;
+	int32_t width = r->x2 - r->x1, height = r->y2 - r->y1;
+
+	if (do_yflip)
+		pixman_blt(data, cache_data, -width, stride,
+			   32, 32, 0, 1 - height, r->x1, r->y1, width, height);
+	else
+		pixman_blt(data, cache_data, width, stride,
+			   32, 32, 0, 0, r->x1, r->y1, width, height);
+}
+
+static void
+shared_output_read_damage(struct shared_output *so, pixman_region32_t *damage,
+			  int do_yflip)
+{
+	struct weston_renderer *renderer = so->output->compositor->renderer;
+	pixman_box32_t *r;
+	int32_t y, width, height;
+	int i, nrects;
+
+	weston_output_get_buffer_size(so->output, &width, &height);
+
+	r = pixman_region32_rectangles(damage, &nrects);
+	for (i = 0; i < nrects; ++i) {
+		if (do_yflip)
+			y = height - r[i].y2;
+		else
+			y = r[i].y1;
+
+		renderer->read_pixels(so->output, PIXMAN_a8r8g8b8,
+				      so->tmp_data, r[i].x1, y,
+				      r[i].x2 - r[i].x1, r[i].y2 - r[i].y1);
+		shared_output_blit(so, so->tmp_data, &r[i], do_yflip);
+	}
+}
+
+static void
+shared_output_apply_damage(struct shared_output *so,
+			   pixman_region32_t *output_damage)
+{
+	struct ss_shm_buffer *sb;
+
+	/* Frames that only moved the cursor plane send nothing */
+	if (!pixman_region32_not_empty(output_damage))
+		return;
+
+	wl_list_for_each(sb, &so->shm.buffers, link)
+		pixman_region32_union(&sb->damage, &sb->damage, output_damage);
+
+	so->cache_dirty = 1;
+}
+
+/* Start reading back the damage without waiting for the GPU; the
+ * pixels reach the cache, and the shm buffers, once it is collected
+ * by shared_output_finish_readback(). */
+static int
+shared_output_queue_readback(struct shared_output *so,
+			     pixman_region32_t *damage,
+			     pixman_region32_t *output_damage, int do_yflip)
+{
+	struct weston_renderer *renderer = so->output->compositor->renderer;
+	int32_t width, height;
+	pixman_box32_t *r, *rects;
+	int i, nrects, handle;
+
+	weston_output_get_buffer_size(so->output, &width, &height);
+
+	r = pixman_region32_rectangles(damage, &nrects);
+	if (!renderer->queue_read_pixels || nrects == 0)
+		return -1;
+
+	if (so->readback.rects_size < nrects) {
+		rects = realloc(so->readback.rects, nrects * sizeof *rects);
+		if (!rects)
+			return -1;
+		so->readback.rects = rects;
+		so->readback.rects_size = nrects;
+	}
+
+	rects = so->readback.rects;
+	for (i = 0; i < nrects; i++) {
+		rects[i] = r[i];
+		if (do_yflip) {
+			rects[i].y1 = height - r[i].y2;
+			rects[i].y2 = height - r[i].y1;
+		}
+	}
+
+	handle = renderer->queue_read_pixels(so->output, PIXMAN_a8r8g8b8,
+					     rects, nrects);
+	if (handle < 0)
+		return -1;
+
+	so->readback.handle = handle;
+	pixman_region32_copy(&so->readback.damage, damage);
+	pixman_region32_copy(&so->readback.output_damage, output_damage);
+	wl_event_source_timer_update(so->readback.timer,
+				     SHARED_OUTPUT_READBACK_DELAY);
+
+	return 0;
+}
+
+static void
+shared_output_finish_readback(struct shared_output *so)
+{
+	struct weston_renderer *renderer = so->output->compositor->renderer;
+	uint32_t *data;
+	pixman_box32_t *r;
+	int i, nrects, do_yflip;
+
+	if (so->readback.handle < 0)
+		return;
+
+	wl_event_source_timer_update(so->readback.timer, 0);
+
+	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+
+	if (renderer->finish_read_pixels(so->output, so->readback.handle,
+					 so->tmp_data) == 0) {
+		data = so->tmp_data;
+		r = pixman_region32_rectangles(&so->readback.damage, &nrects);
+		for (i = 0; i < nrects; ++i) {
+			shared_output_blit(so, data, &r[i], do_yflip);
+			data += (r[i].x2 - r[i].x1) * (r[i].y2 - r[i].y1);
+		}
+	} else {
+		shared_output_read_damage(so, &so->readback.damage, do_yflip);
+	}
+	so->readback.handle = -1;
+
+	shared_output_apply_damage(so, &so->readback.output_damage);
+}
+
+static int
+shared_output_readback_timeout(void *data)
+{
+	struct shared_output *so = data;
+
+	shared_output_finish_readback(so);
+	shared_output_update(so);
+
+	return 0;
+}
+
 static void
 shared_output_repainted(struct wl_listener *listener, void *data)
 {
 	struct shared_output *so =
 		container_of(listener, struct shared_output, frame_listener);
-	pixman_region32_t damage;
-	struct ss_shm_buffer *sb;
-	int32_t x, y, width, height, stride;
-	int i, nrects, do_yflip;
-	pixman_box32_t *r;
-	uint32_t *cache_data;
+	pixman_region32_t damage, output_damage;
+	int32_t width, height, stride;
+	int do_yflip;
+
+	shared_output_update_cursor(so);
+
+	/* The previous frame's pixels go out before this frame's */
+	shared_output_finish_readback(so);
 
 	/* Damage in output coordinates */
-	pixman_region32_init(&damage);
-	pixman_region32_intersect(&damage, &so->output->region,
+	pixman_region32_init(&output_damage);
+	pixman_region32_intersect(&output_damage, &so->output->region,
 				  &so->output->previous_damage);
-	pixman_region32_translate(&damage, -so->output->x, -so->output->y);
-
-	/* Apply damage to all buffers */
-	wl_list_for_each(sb, &so->shm.buffers, link)
-		pixman_region32_union(&sb->damage, &sb->damage, &damage);
+	pixman_region32_translate(&output_damage,
+				  -so->output->x, -so->output->y);
 
-	/* put it back... */
-	pixman_region32_translate(&damage, so->output->x, so->output->y);
+	if (so->dmabuf.enabled) {
+		shared_output_dmabuf_repainted(so, &output_damage);
+		if (so->dmabuf.enabled) {
+			pixman_region32_fini(&output_damage);
+			return;
+		}
+	}
 
 	/* Transform to buffer coordinates */
+	pixman_region32_init(&damage);
+	pixman_region32_copy(&damage, &output_damage);
+	pixman_region32_translate(&damage, so->output->x, so->output->y);
 	weston_matrix_transform_region(&damage, &so->output->matrix, &damage);
 
-	width = so->output->current_mode->width;
-	height = so->output->current_mode->height;
+	weston_output_get_buffer_size(so->output, &width, &height);
 	stride = width;
 
 	if (!so->cache_image ||
@@ -817,6 +1517,8 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 						 width, height, NULL,
 						 stride);
 		if (!so->cache_image) {
+			pixman_region32_fini(&output_damage);
+			pixman_region32_fini(&damage);
 			shared_output_destroy(so);
 			return;
 		}
@@ -826,43 +1528,23 @@ shared_output_repainted(struct wl_listener *listener, void *data)
 	}
 
 	if (shared_output_ensure_tmp_data(so, &damage) < 0) {
+		pixman_region32_fini(&output_damage);
+		pixman_region32_fini(&damage);
 		shared_output_destroy(so);
 		return;
 	}
 
 	do_yflip = !!(so->output->compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
 
-	cache_data = pixman_image_get_data(so->cache_image);
-	r = pixman_region32_rectangles(&damage, &nrects);
-	for (i = 0; i < nrects; ++i) {
-		x = r[i].x1;
-		y = r[i].y1;
-		width = r[i].x2 - r[i].x1;
-		height = r[i].y2 - r[i].y1;
-
-		if (do_yflip) {
-			so->output->compositor->renderer->read_pixels(
-				so->output, PIXMAN_a8r8g8b8, so->tmp_data,
-				x, so->output->current_mode->height - r[i].y2,
-				width, height);
-
-			pixman_blt(so->tmp_data, cache_data, -width, stride,
-				   32, 32, 0, 1 - height, x, y, width, height);
-		} else {
-			so->output->compositor->renderer->read_pixels(
-				so->output, PIXMAN_a8r8g8b8, so->tmp_data,
-				x, y, width, height);
-
-			pixman_blt(so->tmp_data, cache_data, width, stride,
-				   32, 32, 0, 0, x, y, width, height);
-		}
+	if (shared_output_queue_readback(so, &damage, &output_damage,
+					 do_yflip) < 0) {
+		shared_output_read_damage(so, &damage, do_yflip);
+		shared_output_apply_damage(so, &output_damage);
+		shared_output_update(so);
 	}
 
+	pixman_region32_fini(&output_damage);
 	pixman_region32_fini(&damage);
-
-	so->cache_dirty = 1;
-
-	shared_output_update(so);
 }
 
 static struct shared_output *
@@ -918,6 +1600,13 @@ shared_output_create(struct weston_output *output, int parent_fd)
 		goto err_display;
 	}
 
+	so->parent.cursor_surface =
+		wl_compositor_create_surface(so->parent.compositor);
+	if (!so->parent.cursor_surface) {
+		weston_log("Screen share failed: %m");
+		goto err_display;
+	}
+
 	so->parent.mode_feedback =
 		_wl_fullscreen_shell_present_surface_for_mode(so->parent.fshell,
 							      so->parent.surface,
@@ -942,19 +1631,40 @@ shared_output_create(struct weston_output *output, int parent_fd)
 		goto err_display;
 	}
 
+	so->readback.timer =
+		wl_event_loop_add_timer(loop, shared_output_readback_timeout,
+					so);
+	if (!so->readback.timer) {
+		weston_log("Screen share failed: %m");
+		wl_event_source_remove(so->event_source);
+		goto err_display;
+	}
+	so->readback.handle = -1;
+	pixman_region32_init(&so->readback.damage);
+	pixman_region32_init(&so->readback.output_damage);
+
 	/* Ok, everything's created.  We should be good to go */
 	wl_list_init(&so->shm.buffers);
 	wl_list_init(&so->shm.free_buffers);
 
 	so->output = output;
+	shared_output_dmabuf_init(so);
 	so->output_destroyed.notify = output_destroyed;
 	wl_signal_add(&so->output->destroy_signal, &so->output_destroyed);
 
 	so->frame_listener.notify = shared_output_repainted;
 	wl_signal_add(&output->frame_signal, &so->frame_listener);
+	so->cursor.commit_listener.notify = shared_output_cursor_committed;
+	wl_signal_add(&output->compositor->commit_signal,
+		      &so->cursor.commit_listener);
 	output->disable_planes++;
 	weston_output_damage(output);
 
+	/* Seats that got their pointer during the roundtrips above */
+	wl_list_for_each(seat, &so->seat_list, link)
+		if (seat->parent.pointer)
+			shared_output_set_cursor_seat(so, seat);
+
 	return so;
 
 err_display:
@@ -972,19 +1682,43 @@ static void
 shared_output_destroy(struct shared_output *so)
 {
 	struct ss_shm_buffer *buffer, *bnext;
+	struct ss_dmabuf_buffer *db, *dbnext;
 
 	so->output->disable_planes--;
+	if (so->cursor.seat)
+		so->output->side_channel_pointer = NULL;
+
+	/* Collect a read-back in flight so the renderer can reuse it */
+	if (so->readback.handle >= 0)
+		so->output->compositor->renderer->finish_read_pixels(
+			so->output, so->readback.handle, so->tmp_data);
+	wl_event_source_remove(so->readback.timer);
+	pixman_region32_fini(&so->readback.damage);
+	pixman_region32_fini(&so->readback.output_damage);
+	free(so->readback.rects);
 
 	wl_list_for_each_safe(buffer, bnext, &so->shm.buffers, link)
 		ss_shm_buffer_destroy(buffer);
 	wl_list_for_each_safe(buffer, bnext, &so->shm.free_buffers, free_link)
 		ss_shm_buffer_destroy(buffer);
 
+	wl_list_for_each_safe(db, dbnext, &so->dmabuf.buffers, link)
+		ss_dmabuf_buffer_destroy(db);
+	pixman_region32_fini(&so->dmabuf.damage);
+	if (so->dmabuf.udmabuf_fd >= 0)
+		close(so->dmabuf.udmabuf_fd);
+	if (so->parent.dmabuf)
+		zlinux_dmabuf_destroy(so->parent.dmabuf);
+
+	if (so->cursor.buffer)
+		wl_buffer_destroy(so->cursor.buffer);
+
 	wl_display_disconnect(so->parent.display);
 	wl_event_source_remove(so->event_source);
 
 	wl_list_remove(&so->output_destroyed.link);
 	wl_list_remove(&so->frame_listener.link);
+	wl_list_remove(&so->cursor.commit_listener.link);
 
 	pixman_image_unref(so->cache_image);
 	free(so->tmp_data);
@@ -26,18 +26,31 @@
 #include "config.h"
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <linux/input.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <netdb.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "compositor.h"
+#include "linux-dmabuf.h"
 #include "screenshooter-server-protocol.h"
 #include "shared/helpers.h"
 
 #include "wcap/wcap-decode.h"
+#include "wcap/wcap-encode.h"
 
 struct screenshooter {
 	struct weston_compositor *ec;
@@ -45,33 +58,57 @@ struct screenshooter {
 	struct wl_client *client;
 	struct weston_process process;
 	struct wl_listener destroy_listener;
+
+	/* Listening socket for viewers of a live recording */
+	int stream_fd;
+	struct wl_event_source *stream_source;
+	char *stream_address;
+	char *stream_output;
 };
 
 struct screenshooter_frame_listener {
 	struct wl_listener listener;
 	struct weston_buffer *buffer;
+	struct linux_dmabuf_buffer *dmabuf;
+	int32_t x, y, width, height;
+	/* weston_output::scanout_transform of a whole output shot,
+	 * which is turned back into the display's orientation */
+	uint32_t turn;
 	weston_screenshooter_done_func_t done;
 	void *data;
 };
 
 static void
-copy_bgra_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_bgra_yflip(uint8_t *dst, int dst_stride, uint8_t *src,
+		int height, int stride)
 {
 	uint8_t *end;
 
-	end = dst + height * stride;
+	end = dst + height * dst_stride;
 	while (dst < end) {
 		memcpy(dst, src, stride);
-		dst += stride;
+		dst += dst_stride;
 		src -= stride;
 	}
 }
 
 static void
-copy_bgra(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_bgra(uint8_t *dst, int dst_stride, uint8_t *src, int height, int stride)
 {
+	uint8_t *end;
+
 	/* TODO: optimize this out */
-	memcpy(dst, src, height * stride);
+	if (dst_stride == stride) {
+		memcpy(dst, src, height * stride);
+		return;
+	}
+
+	end = dst + height * dst_stride;
+	while (dst < end) {
+		memcpy(dst, src, stride);
+		dst += dst_stride;
+		src += stride;
+	}
 }
 
 static void
@@ -92,31 +129,105 @@ copy_row_swap_RB(void *vdst, void *vsrc, int bytes)
 }
 
 static void
-copy_rgba_yflip(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_rgba_yflip(uint8_t *dst, int dst_stride, uint8_t *src,
+		int height, int stride)
 {
 	uint8_t *end;
 
-	end = dst + height * stride;
+	end = dst + height * dst_stride;
 	while (dst < end) {
 		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
+		dst += dst_stride;
 		src -= stride;
 	}
 }
 
 static void
-copy_rgba(uint8_t *dst, uint8_t *src, int height, int stride)
+copy_rgba(uint8_t *dst, int dst_stride, uint8_t *src, int height, int stride)
 {
 	uint8_t *end;
 
-	end = dst + height * stride;
+	end = dst + height * dst_stride;
 	while (dst < end) {
 		copy_row_swap_RB(dst, src, stride);
-		dst += stride;
+		dst += dst_stride;
 		src += stride;
 	}
 }
 
+/* The region is given from the top left corner of the output, while
+ * read_pixels() counts rows from the bottom on y-flipped outputs */
+static int32_t
+screenshooter_read_y(struct weston_output *output, int32_t y, int32_t height)
+{
+	struct weston_compositor *compositor = output->compositor;
+
+	int32_t buffer_width, buffer_height;
+
+	if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP) {
+		weston_output_get_buffer_size(output, &buffer_width,
+					      &buffer_height);
+		return buffer_height - y - height;
+	}
+
+	return y;
+}
+
+/* Turn 32 bit pixels read back from a width x height area of an output
+ * the display rotates at scanout into the display's orientation. The
+ * result has its rows top to bottom. */
+static uint32_t *
+screenshooter_turn(const uint32_t *src, int32_t width, int32_t height,
+		   uint32_t transform, int yflip)
+{
+	uint32_t *dst;
+	int32_t x, y, sy, u, v, dst_width;
+
+	dst = malloc(width * height * 4);
+	if (dst == NULL)
+		return NULL;
+
+	dst_width = transform == WL_OUTPUT_TRANSFORM_180 ? width : height;
+
+	for (y = 0; y < height; y++) {
+		sy = yflip ? height - 1 - y : y;
+		for (x = 0; x < width; x++) {
+			switch (transform) {
+			case WL_OUTPUT_TRANSFORM_90:
+				u = height - 1 - y;
+				v = x;
+				break;
+			case WL_OUTPUT_TRANSFORM_180:
+				u = width - 1 - x;
+				v = height - 1 - y;
+				break;
+			case WL_OUTPUT_TRANSFORM_270:
+			default:
+				u = y;
+				v = width - 1 - x;
+				break;
+			}
+			dst[v * dst_width + u] = src[sy * width + x];
+		}
+	}
+
+	return dst;
+}
+
+static void
+screenshooter_copy_dmabuf(struct screenshooter_frame_listener *l,
+			  struct weston_output *output)
+{
+	struct weston_renderer *renderer = output->compositor->renderer;
+	int32_t y = screenshooter_read_y(output, l->y, l->height);
+
+	if (renderer->copy_to_dmabuf(output, l->dmabuf, l->x, y,
+				     l->width, l->height) < 0)
+		l->done(l->data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+	else
+		l->done(l->data, WESTON_SCREENSHOOTER_SUCCESS);
+}
+
 static void
 screenshooter_frame_notify(struct wl_listener *listener, void *data)
 {
@@ -125,13 +236,21 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 			     struct screenshooter_frame_listener, listener);
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
-	int32_t stride;
-	uint8_t *pixels, *d, *s;
+	int32_t stride, dst_stride, height;
+	uint8_t *pixels, *turned, *d, *s;
+	int yflip;
 
 	output->disable_planes--;
 	wl_list_remove(&listener->link);
-	stride = l->buffer->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
-	pixels = malloc(stride * l->buffer->height);
+
+	if (l->dmabuf) {
+		screenshooter_copy_dmabuf(l, output);
+		free(l);
+		return;
+	}
+
+	stride = l->width * (PIXMAN_FORMAT_BPP(compositor->read_format) / 8);
+	pixels = malloc(stride * l->height);
 
 	if (pixels == NULL) {
 		l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
@@ -141,30 +260,51 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 
 	compositor->renderer->read_pixels(output,
 			     compositor->read_format, pixels,
-			     0, 0, output->current_mode->width,
-			     output->current_mode->height);
+			     l->x, screenshooter_read_y(output, l->y, l->height),
+			     l->width, l->height);
+
+	yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	height = l->height;
+
+	if (l->turn != WL_OUTPUT_TRANSFORM_NORMAL) {
+		turned = (uint8_t *) screenshooter_turn((uint32_t *) pixels,
+							l->width, l->height,
+							l->turn, yflip);
+		free(pixels);
+		if (turned == NULL) {
+			l->done(l->data, WESTON_SCREENSHOOTER_NO_MEMORY);
+			free(l);
+			return;
+		}
+		pixels = turned;
+		yflip = 0;
+		if (l->turn != WL_OUTPUT_TRANSFORM_180) {
+			stride = l->height * 4;
+			height = l->width;
+		}
+	}
 
-	stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
+	dst_stride = wl_shm_buffer_get_stride(l->buffer->shm_buffer);
 
 	d = wl_shm_buffer_get_data(l->buffer->shm_buffer);
-	s = pixels + stride * (l->buffer->height - 1);
+	s = pixels + stride * (height - 1);
 
 	wl_shm_buffer_begin_access(l->buffer->shm_buffer);
 
 	switch (compositor->read_format) {
 	case PIXMAN_a8r8g8b8:
 	case PIXMAN_x8r8g8b8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_bgra_yflip(d, s, output->current_mode->height, stride);
+		if (yflip)
+			copy_bgra_yflip(d, dst_stride, s, height, stride);
 		else
-			copy_bgra(d, pixels, output->current_mode->height, stride);
+			copy_bgra(d, dst_stride, pixels, height, stride);
 		break;
 	case PIXMAN_x8b8g8r8:
 	case PIXMAN_a8b8g8r8:
-		if (compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP)
-			copy_rgba_yflip(d, s, output->current_mode->height, stride);
+		if (yflip)
+			copy_rgba_yflip(d, dst_stride, s, height, stride);
 		else
-			copy_rgba(d, pixels, output->current_mode->height, stride);
+			copy_rgba(d, dst_stride, pixels, height, stride);
 		break;
 	default:
 		break;
@@ -177,24 +317,54 @@ screenshooter_frame_notify(struct wl_listener *listener, void *data)
 	free(l);
 }
 
-WL_EXPORT int
-weston_screenshooter_shoot(struct weston_output *output,
-			   struct weston_buffer *buffer,
-			   weston_screenshooter_done_func_t done, void *data)
+static int
+screenshooter_shoot(struct weston_output *output,
+		    struct weston_buffer *buffer,
+		    int32_t x, int32_t y, int32_t width, int32_t height,
+		    uint32_t turn,
+		    weston_screenshooter_done_func_t done, void *data)
 {
+	struct weston_renderer *renderer = output->compositor->renderer;
 	struct screenshooter_frame_listener *l;
+	struct linux_dmabuf_buffer *dmabuf;
+	int32_t buffer_width, buffer_height, shot_width, shot_height;
+
+	weston_output_get_buffer_size(output, &buffer_width, &buffer_height);
+	if (x < 0 || y < 0 || width < 1 || height < 1 ||
+	    x + width > buffer_width ||
+	    y + height > buffer_height) {
+		done(data, WESTON_SCREENSHOOTER_BAD_REGION);
+		return -1;
+	}
 
-	if (!wl_shm_buffer_get(buffer->resource)) {
+	shot_width = width;
+	shot_height = height;
+	if (turn == WL_OUTPUT_TRANSFORM_90 || turn == WL_OUTPUT_TRANSFORM_270) {
+		shot_width = height;
+		shot_height = width;
+	}
+
+	dmabuf = linux_dmabuf_buffer_get(buffer->resource);
+	if (dmabuf) {
+		/* The GPU copy cannot turn the frame */
+		if (!renderer->copy_to_dmabuf ||
+		    turn != WL_OUTPUT_TRANSFORM_NORMAL) {
+			done(data, WESTON_SCREENSHOOTER_BAD_BUFFER);
+			return -1;
+		}
+
+		buffer->width = dmabuf->width;
+		buffer->height = dmabuf->height;
+	} else if (wl_shm_buffer_get(buffer->resource)) {
+		buffer->shm_buffer = wl_shm_buffer_get(buffer->resource);
+		buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
+		buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
+	} else {
 		done(data, WESTON_SCREENSHOOTER_BAD_BUFFER);
 		return -1;
 	}
 
-	buffer->shm_buffer = wl_shm_buffer_get(buffer->resource);
-	buffer->width = wl_shm_buffer_get_width(buffer->shm_buffer);
-	buffer->height = wl_shm_buffer_get_height(buffer->shm_buffer);
-
-	if (buffer->width < output->current_mode->width ||
-	    buffer->height < output->current_mode->height) {
+	if (buffer->width < shot_width || buffer->height < shot_height) {
 		done(data, WESTON_SCREENSHOOTER_BAD_BUFFER);
 		return -1;
 	}
@@ -206,6 +376,12 @@ weston_screenshooter_shoot(struct weston_output *output,
 	}
 
 	l->buffer = buffer;
+	l->dmabuf = dmabuf;
+	l->x = x;
+	l->y = y;
+	l->width = width;
+	l->height = height;
+	l->turn = turn;
 	l->done = done;
 	l->data = data;
 	l->listener.notify = screenshooter_frame_notify;
@@ -216,6 +392,44 @@ weston_screenshooter_shoot(struct weston_output *output,
 	return 0;
 }
 
+/** Copy a rectangle of the output into a buffer on its next frame
+ *
+ * The rectangle is in the pixels the renderer draws, see
+ * weston_output_get_buffer_size(), from the top left corner of the
+ * output and lands at the top left of the buffer. A wl_shm buffer is
+ * filled in by reading the output back; a dmabuf is written by the
+ * renderer on the GPU, if it can.
+ */
+WL_EXPORT int
+weston_screenshooter_shoot_region(struct weston_output *output,
+				  struct weston_buffer *buffer,
+				  int32_t x, int32_t y,
+				  int32_t width, int32_t height,
+				  weston_screenshooter_done_func_t done,
+				  void *data)
+{
+	return screenshooter_shoot(output, buffer, x, y, width, height,
+				   WL_OUTPUT_TRANSFORM_NORMAL, done, data);
+}
+
+/** Copy the whole output into a buffer on its next frame
+ *
+ * The shot is in the display's orientation, sized like the current
+ * mode, also when the display rotates the output at scanout.
+ */
+WL_EXPORT int
+weston_screenshooter_shoot(struct weston_output *output,
+			   struct weston_buffer *buffer,
+			   weston_screenshooter_done_func_t done, void *data)
+{
+	int32_t width, height;
+
+	weston_output_get_buffer_size(output, &width, &height);
+
+	return screenshooter_shoot(output, buffer, 0, 0, width, height,
+				   output->scanout_transform, done, data);
+}
+
 static void
 screenshooter_done(void *data, enum weston_screenshooter_outcome outcome)
 {
@@ -228,6 +442,11 @@ screenshooter_done(void *data, enum weston_screenshooter_outcome outcome)
 	case WESTON_SCREENSHOOTER_NO_MEMORY:
 		wl_resource_post_no_memory(resource);
 		break;
+	case WESTON_SCREENSHOOTER_BAD_BUFFER:
+	case WESTON_SCREENSHOOTER_BAD_REGION:
+		if (wl_resource_get_version(resource) >= 2)
+			screenshooter_send_failed(resource);
+		break;
 	default:
 		break;
 	}
@@ -252,8 +471,31 @@ screenshooter_shoot(struct wl_client *client,
 	weston_screenshooter_shoot(output, buffer, screenshooter_done, resource);
 }
 
+static void
+screenshooter_shoot_region(struct wl_client *client,
+			   struct wl_resource *resource,
+			   struct wl_resource *output_resource,
+			   struct wl_resource *buffer_resource,
+			   int32_t x, int32_t y,
+			   int32_t width, int32_t height)
+{
+	struct weston_output *output =
+		wl_resource_get_user_data(output_resource);
+	struct weston_buffer *buffer =
+		weston_buffer_from_resource(buffer_resource);
+
+	if (buffer == NULL) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	weston_screenshooter_shoot_region(output, buffer, x, y, width, height,
+					  screenshooter_done, resource);
+}
+
 struct screenshooter_interface screenshooter_implementation = {
-	screenshooter_shoot
+	screenshooter_shoot,
+	screenshooter_shoot_region
 };
 
 static void
@@ -263,8 +505,8 @@ bind_shooter(struct wl_client *client,
 	struct screenshooter *shooter = data;
 	struct wl_resource *resource;
 
-	resource = wl_resource_create(client,
-				      &screenshooter_interface, 1, id);
+	resource = wl_resource_create(client, &screenshooter_interface,
+				      MIN(version, 2), id);
 
 	if (client != shooter->client) {
 		wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_OBJECT,
@@ -308,45 +550,431 @@ screenshooter_binding(struct weston_keyboard *keyboard, uint32_t time,
 	free(screenshooter_exe);
 }
 
+/* Every this many frames the recorder writes a key frame, encoded
+ * against black instead of the previous frame, that decoding can
+ * start from. */
+#define RECORDER_KEY_FRAME_INTERVAL 120
+
+/* Frames are read back and encoded in a pipeline: while the worker
+ * thread encodes one frame, the next can wait for the GPU to finish
+ * its read-back and a third can be started. */
+#define RECORDER_JOBS 3
+
+enum recorder_job_state {
+	RECORDER_JOB_FREE,	/* available for the next frame */
+	RECORDER_JOB_READING,	/* being filled in by the compositor */
+	RECORDER_JOB_READY	/* queued for, or being encoded by, the worker */
+};
+
+struct recorder_job {
+	enum recorder_job_state state;
+	uint32_t msecs;
+	int key, skip;
+	int handle;
+	int nrects, rects_size;
+	pixman_box32_t *rects;
+	uint32_t *pixels;
+};
+
 struct weston_recorder {
 	struct weston_output *output;
-	uint32_t *frame, *rect;
-	uint32_t *tmpbuf;
-	uint32_t total;
+	int width, height, do_yflip;
+	int count, destroying, force_key;
+
+	struct recorder_job jobs[RECORDER_JOBS];
+	int submit_index;
+	struct recorder_job *reading;
+	pixman_box32_t *read_rects;
+	int read_rects_size;
+
+	pthread_t worker;
+	pthread_mutex_t mutex;
+	pthread_cond_t input_cond, done_cond;
+	int worker_done, has_worker;
+
+	/* Only touched by the worker while it runs */
+	uint32_t *frame;
+	uint32_t *payload;
+	void *compressed;
+	size_t compressed_size;
+	uint64_t total;
+	uint32_t written;
 	int fd;
+	struct wl_array index;
+
+	/* Streaming to a socket rather than writing a file. A frame
+	 * only partly sent is kept in pending and finished before
+	 * anything else; frames arriving meanwhile are dropped and the
+	 * stream picks up again at a key frame. */
+	int stream;
+	int stream_need_key;
+	char *pending;
+	size_t pending_start, pending_end, pending_alloc;
+	uint32_t dropped;
+	/* Under the mutex, for the compositor to act on */
+	int stream_key_requested;
+	int stream_failed;
+
 	struct wl_listener frame_listener;
-	int count, destroying;
 };
 
-static uint32_t *
-output_run(uint32_t *p, uint32_t delta, int run)
+/* Runs on the worker thread: the viewer went away or the socket
+ * broke, stop sending and have the compositor end the recording. */
+static void
+weston_recorder_stream_fail(struct weston_recorder *recorder)
+{
+	recorder->pending_start = recorder->pending_end = 0;
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->stream_failed = 1;
+	pthread_mutex_unlock(&recorder->mutex);
+}
+
+/* Send what is left of a frame. Returns -1 if some is still left. */
+static int
+weston_recorder_stream_flush(struct weston_recorder *recorder)
 {
+	ssize_t n;
+
+	while (recorder->pending_start < recorder->pending_end) {
+		n = send(recorder->fd,
+			 recorder->pending + recorder->pending_start,
+			 recorder->pending_end - recorder->pending_start,
+			 MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return -1;
+		if (n < 0) {
+			weston_recorder_stream_fail(recorder);
+			return -1;
+		}
+
+		recorder->pending_start += n;
+	}
+
+	recorder->pending_start = recorder->pending_end = 0;
+
+	return 0;
+}
+
+/* Send as much of v as the socket takes right away and keep the
+ * rest. Returns the number of bytes taken on, or -1 on failure. */
+static ssize_t
+weston_recorder_stream_write(struct weston_recorder *recorder,
+			     struct iovec *v, int count)
+{
+	struct msghdr msg;
+	size_t total = 0, skip, len, size;
+	ssize_t n;
+	char *pending;
 	int i;
 
-	while (run > 0) {
-		if (run <= 0xe0) {
-			*p++ = delta | ((run - 1) << 24);
-			break;
+	for (i = 0; i < count; i++)
+		total += v[i].iov_len;
+
+	memset(&msg, 0, sizeof msg);
+	msg.msg_iov = v;
+	msg.msg_iovlen = count;
+	do {
+		n = sendmsg(recorder->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		n = 0;
+	if (n < 0) {
+		weston_recorder_stream_fail(recorder);
+		return -1;
+	}
+
+	if ((size_t) n == total)
+		return total;
+
+	size = total - n;
+	if (recorder->pending_alloc < size) {
+		pending = realloc(recorder->pending, size);
+		if (!pending) {
+			/* Half a frame has gone out, the stream can't
+			 * be resumed. */
+			weston_recorder_stream_fail(recorder);
+			return -1;
 		}
+		recorder->pending = pending;
+		recorder->pending_alloc = size;
+	}
+
+	skip = n;
+	recorder->pending_start = recorder->pending_end = 0;
+	for (i = 0; i < count; i++) {
+		if (skip >= v[i].iov_len) {
+			skip -= v[i].iov_len;
+			continue;
+		}
+
+		len = v[i].iov_len - skip;
+		memcpy(recorder->pending + recorder->pending_end,
+		       (char *) v[i].iov_base + skip, len);
+		recorder->pending_end += len;
+		skip = 0;
+	}
 
-		i = 24 - __builtin_clz(run);
-		*p++ = delta | ((i + 0xe0) << 24);
-		run -= 1 << (7 + i);
+	return total;
+}
+
+/* Decide whether a frame can go out on the stream. While the last
+ * frame is still being sent the new one is dropped, and since the
+ * viewer then misses its changes, frames are dropped until the next
+ * key frame, which the compositor is asked for. */
+static int
+weston_recorder_stream_ready(struct weston_recorder *recorder,
+			     struct recorder_job *job)
+{
+	int failed;
+
+	pthread_mutex_lock(&recorder->mutex);
+	failed = recorder->stream_failed;
+	pthread_mutex_unlock(&recorder->mutex);
+
+	if (failed)
+		return 0;
+
+	if (weston_recorder_stream_flush(recorder) < 0 ||
+	    (recorder->stream_need_key && !job->key)) {
+		if (!recorder->stream_need_key) {
+			recorder->stream_need_key = 1;
+			pthread_mutex_lock(&recorder->mutex);
+			recorder->stream_key_requested = 1;
+			pthread_mutex_unlock(&recorder->mutex);
+		}
+		recorder->dropped++;
+		return 0;
 	}
 
-	return p;
+	recorder->stream_need_key = 0;
+
+	return 1;
 }
 
-static uint32_t
-component_delta(uint32_t next, uint32_t prev)
+/* Runs on the worker thread: delta and run-length encode a frame
+ * against the previous one, compress it and write it out. */
+static void
+weston_recorder_encode(struct weston_recorder *recorder,
+		       struct recorder_job *job)
 {
-	unsigned char dr, dg, db;
+	pixman_box32_t *r = job->rects;
+	int i, n = job->nrects, width, height, stride;
+	uint32_t *s, *p;
+	struct wcap_frame_header_v2 header;
+	struct wcap_index_entry *entry;
+	static const uint32_t zero;
+	struct iovec v[4];
+	ssize_t written;
+	void *out;
+#ifdef HAVE_ZLIB
+	uLongf compressed_size;
+#endif
+
+	if (recorder->stream && !weston_recorder_stream_ready(recorder, job))
+		return;
+
+	stride = recorder->width;
+	s = job->pixels;
+	p = recorder->payload;
 
-	dr = (next >> 16) - (prev >> 16);
-	dg = (next >>  8) - (prev >>  8);
-	db = (next >>  0) - (prev >>  0);
+	for (i = 0; i < n; i++) {
+		width = r[i].x2 - r[i].x1;
+		height = r[i].y2 - r[i].y1;
+
+		if (recorder->do_yflip)
+			p = wcap_encode_rectangle(p, recorder->frame +
+						  stride * (r[i].y2 - 1) +
+						  r[i].x1, -stride, s,
+						  width, height, job->key);
+		else
+			p = wcap_encode_rectangle(p, recorder->frame +
+						  stride * r[i].y1 + r[i].x1,
+						  stride, s,
+						  width, height, job->key);
+		s += width * height;
+	}
 
-	return (dr << 16) | (dg << 8) | (db << 0);
+	header.msecs = job->msecs;
+	header.nrects = n;
+	header.flags = job->key ? WCAP_FRAME_KEY : 0;
+	header.length = (p - recorder->payload) * 4;
+	header.size = header.length;
+	out = recorder->payload;
+
+#ifdef HAVE_ZLIB
+	compressed_size = recorder->compressed_size;
+	if (compress2(recorder->compressed, &compressed_size,
+		      (Bytef *) recorder->payload, header.length,
+		      Z_BEST_SPEED) == Z_OK &&
+	    compressed_size < header.length) {
+		header.flags |= WCAP_FRAME_DEFLATE;
+		header.size = compressed_size;
+		out = recorder->compressed;
+	}
+#endif
+
+	if (job->key && !recorder->stream) {
+		entry = wl_array_add(&recorder->index, sizeof *entry);
+		if (entry) {
+			entry->offset = recorder->total;
+			entry->msecs = job->msecs;
+			entry->frame = recorder->written;
+		}
+	}
+
+	v[0].iov_base = &header;
+	v[0].iov_len = sizeof header;
+	v[1].iov_base = r;
+	v[1].iov_len = n * sizeof *r;
+	v[2].iov_base = out;
+	v[2].iov_len = header.size;
+	v[3].iov_base = (void *) &zero;
+	v[3].iov_len = -header.size & 3;
+	if (recorder->stream)
+		written = weston_recorder_stream_write(recorder, v, 4);
+	else
+		written = writev(recorder->fd, v, 4);
+	if (written < 0)
+		return;
+
+#if 0
+	fprintf(stderr,
+		"%d rects rle %d bytes, stored %d bytes, total %dM\n",
+		n, header.length, header.size,
+		(int) (recorder->total / 1024 / 1024));
+#endif
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->total += written;
+	recorder->written++;
+	pthread_mutex_unlock(&recorder->mutex);
+}
+
+/* Called with the mutex held while the worker has nothing to encode
+ * but the end of a frame is still waiting to be sent. */
+static void
+weston_recorder_wait_stream(struct weston_recorder *recorder)
+{
+	struct timespec deadline;
+
+	pthread_mutex_unlock(&recorder->mutex);
+	weston_recorder_stream_flush(recorder);
+	pthread_mutex_lock(&recorder->mutex);
+
+	if (recorder->pending_start == recorder->pending_end)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += 10 * 1000 * 1000;
+	if (deadline.tv_nsec >= 1000 * 1000 * 1000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000 * 1000 * 1000;
+	}
+	pthread_cond_timedwait(&recorder->input_cond, &recorder->mutex,
+			       &deadline);
+}
+
+static void *
+weston_recorder_worker(void *data)
+{
+	struct weston_recorder *recorder = data;
+	struct recorder_job *job;
+	int i = 0;
+
+	pthread_mutex_lock(&recorder->mutex);
+
+	for (;;) {
+		job = &recorder->jobs[i];
+		if (job->state != RECORDER_JOB_READY) {
+			/* Finish the queued frames before exiting */
+			if (recorder->worker_done)
+				break;
+			if (recorder->pending_start != recorder->pending_end)
+				weston_recorder_wait_stream(recorder);
+			else
+				pthread_cond_wait(&recorder->input_cond,
+						  &recorder->mutex);
+			continue;
+		}
+
+		pthread_mutex_unlock(&recorder->mutex);
+		if (!job->skip)
+			weston_recorder_encode(recorder, job);
+		pthread_mutex_lock(&recorder->mutex);
+
+		job->state = RECORDER_JOB_FREE;
+		pthread_cond_signal(&recorder->done_cond);
+		i = (i + 1) % RECORDER_JOBS;
+	}
+
+	pthread_mutex_unlock(&recorder->mutex);
+
+	return NULL;
+}
+
+static void
+weston_recorder_submit(struct weston_recorder *recorder,
+		       struct recorder_job *job)
+{
+	pthread_mutex_lock(&recorder->mutex);
+	job->state = RECORDER_JOB_READY;
+	pthread_cond_signal(&recorder->input_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+}
+
+/* Collect the pixels of the frame whose read-back was started on the
+ * previous repaint, and hand it to the worker. */
+static void
+weston_recorder_finish_reading(struct weston_recorder *recorder)
+{
+	struct weston_renderer *renderer =
+		recorder->output->compositor->renderer;
+	struct recorder_job *job = recorder->reading;
+
+	if (!job)
+		return;
+
+	recorder->reading = NULL;
+	if (renderer->finish_read_pixels(recorder->output, job->handle,
+					 job->pixels) < 0) {
+		/* The worker's copy of the frame is now out of date,
+		 * start over from a key frame. */
+		weston_log("recorder: read-back failed, dropping a frame\n");
+		job->skip = 1;
+		recorder->force_key = 1;
+	}
+
+	weston_recorder_submit(recorder, job);
+}
+
+static int
+weston_recorder_prepare_read_rects(struct weston_recorder *recorder,
+				   const pixman_box32_t *r, int n)
+{
+	pixman_box32_t *boxes;
+	int i;
+
+	if (recorder->read_rects_size < n) {
+		boxes = realloc(recorder->read_rects, n * sizeof *boxes);
+		if (!boxes)
+			return -1;
+		recorder->read_rects = boxes;
+		recorder->read_rects_size = n;
+	}
+
+	for (i = 0; i < n; i++) {
+		recorder->read_rects[i] = r[i];
+		if (recorder->do_yflip) {
+			recorder->read_rects[i].y1 = recorder->height - r[i].y2;
+			recorder->read_rects[i].y2 = recorder->height - r[i].y1;
+		}
+	}
+
+	return 0;
 }
 
 static void
@@ -359,25 +987,31 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 		container_of(listener, struct weston_recorder, frame_listener);
 	struct weston_output *output = data;
 	struct weston_compositor *compositor = output->compositor;
+	struct weston_renderer *renderer = compositor->renderer;
 	uint32_t msecs = output->frame_time;
-	pixman_box32_t *r;
+	struct recorder_job *job;
+	pixman_box32_t *r, key_box, *boxes;
 	pixman_region32_t damage, transformed_damage;
-	int i, j, k, n, width, height, run, stride;
-	uint32_t delta, prev, *d, *s, *p, next;
-	struct {
-		uint32_t msecs;
-		uint32_t nrects;
-	} header;
-	struct iovec v[2];
-	int do_yflip;
+	uint32_t *pixels;
+	int i, n, width, height;
 	int y_orig;
-	uint32_t *outbuf;
+	int key, failed;
 
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
-	if (do_yflip)
-		outbuf = recorder->rect;
-	else
-		outbuf = recorder->tmpbuf;
+	pthread_mutex_lock(&recorder->mutex);
+	failed = recorder->stream_failed;
+	if (recorder->stream_key_requested) {
+		recorder->force_key = 1;
+		recorder->stream_key_requested = 0;
+	}
+	pthread_mutex_unlock(&recorder->mutex);
+
+	if (failed) {
+		weston_log("recorder: stream viewer went away\n");
+		weston_recorder_destroy(recorder);
+		return;
+	}
+
+	weston_recorder_finish_reading(recorder);
 
 	pixman_region32_init(&damage);
 	pixman_region32_init(&transformed_damage);
@@ -391,71 +1025,85 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 	r = pixman_region32_rectangles(&transformed_damage, &n);
 	if (n == 0) {
 		pixman_region32_fini(&transformed_damage);
+		if (recorder->destroying)
+			weston_recorder_destroy(recorder);
 		return;
 	}
 
-	header.msecs = msecs;
-	header.nrects = n;
-	v[0].iov_base = &header;
-	v[0].iov_len = sizeof header;
-	v[1].iov_base = r;
-	v[1].iov_len = n * sizeof *r;
-	recorder->total += writev(recorder->fd, v, 2);
-	stride = output->current_mode->width;
-
-	for (i = 0; i < n; i++) {
-		width = r[i].x2 - r[i].x1;
-		height = r[i].y2 - r[i].y1;
+	key = recorder->count % RECORDER_KEY_FRAME_INTERVAL == 0 ||
+		recorder->force_key;
+	if (key) {
+		key_box.x1 = 0;
+		key_box.y1 = 0;
+		key_box.x2 = recorder->width;
+		key_box.y2 = recorder->height;
+		r = &key_box;
+		n = 1;
+	}
 
-		if (do_yflip)
-			y_orig = output->current_mode->height - r[i].y2;
-		else
-			y_orig = r[i].y1;
-
-		compositor->renderer->read_pixels(output,
-				compositor->read_format, recorder->rect,
-				r[i].x1, y_orig, width, height);
-
-		s = recorder->rect;
-		p = outbuf;
-		run = prev = 0; /* quiet gcc */
-		for (j = 0; j < height; j++) {
-			if (do_yflip)
-				y_orig = r[i].y2 - j - 1;
-			else
-				y_orig = r[i].y1 + j;
-			d = recorder->frame + stride * y_orig + r[i].x1;
-
-			for (k = 0; k < width; k++) {
-				next = *s++;
-				delta = component_delta(next, *d);
-				*d++ = next;
-				if (run == 0 || delta == prev) {
-					run++;
-				} else {
-					p = output_run(p, prev, run);
-					run = 1;
-				}
-				prev = delta;
-			}
+	job = &recorder->jobs[recorder->submit_index];
+	pthread_mutex_lock(&recorder->mutex);
+	while (job->state != RECORDER_JOB_FREE)
+		pthread_cond_wait(&recorder->done_cond, &recorder->mutex);
+	job->state = RECORDER_JOB_READING;
+	pthread_mutex_unlock(&recorder->mutex);
+	recorder->submit_index = (recorder->submit_index + 1) % RECORDER_JOBS;
+
+	job->msecs = msecs;
+	job->key = key;
+	job->skip = 0;
+	recorder->force_key = 0;
+
+	if (job->rects_size < n) {
+		boxes = realloc(job->rects, n * sizeof *boxes);
+		if (!boxes) {
+			weston_log("%s: out of memory\n", __func__);
+			pixman_region32_fini(&transformed_damage);
+			job->skip = 1;
+			recorder->force_key = 1;
+			weston_recorder_submit(recorder, job);
+			return;
 		}
+		job->rects = boxes;
+		job->rects_size = n;
+	}
+	memcpy(job->rects, r, n * sizeof *r);
+	job->nrects = n;
 
-		p = output_run(p, prev, run);
+	pixman_region32_fini(&transformed_damage);
+	r = job->rects;
+
+	/* Read back in the coordinates read_pixels() takes, the worker
+	 * undoes the y-flip when encoding. */
+	job->handle = -1;
+	if (renderer->queue_read_pixels &&
+	    weston_recorder_prepare_read_rects(recorder, r, n) == 0)
+		job->handle = renderer->queue_read_pixels(output,
+						compositor->read_format,
+						recorder->read_rects, n);
+
+	if (job->handle >= 0) {
+		recorder->reading = job;
+	} else {
+		pixels = job->pixels;
+		for (i = 0; i < n; i++) {
+			width = r[i].x2 - r[i].x1;
+			height = r[i].y2 - r[i].y1;
 
-		recorder->total += write(recorder->fd,
-					 outbuf, (p - outbuf) * 4);
+			if (recorder->do_yflip)
+				y_orig = recorder->height - r[i].y2;
+			else
+				y_orig = r[i].y1;
 
-#if 0
-		fprintf(stderr,
-			"%dx%d at %d,%d rle from %d to %d bytes (%f) total %dM\n",
-			width, height, r[i].x1, r[i].y1,
-			width * height * 4, (int) (p - outbuf) * 4,
-			(float) (p - outbuf) / (width * height),
-			recorder->total / 1024 / 1024);
-#endif
+			renderer->read_pixels(output, compositor->read_format,
+					      pixels, r[i].x1, y_orig,
+					      width, height);
+			pixels += width * height;
+		}
+
+		weston_recorder_submit(recorder, job);
 	}
 
-	pixman_region32_fini(&transformed_damage);
 	recorder->count++;
 
 	if (recorder->destroying)
@@ -465,52 +1113,118 @@ weston_recorder_frame_notify(struct wl_listener *listener, void *data)
 static void
 weston_recorder_free(struct weston_recorder *recorder)
 {
+	int i;
+
 	if (recorder == NULL)
 		return;
 
-	free(recorder->tmpbuf);
-	free(recorder->rect);
+	for (i = 0; i < RECORDER_JOBS; i++) {
+		free(recorder->jobs[i].rects);
+		free(recorder->jobs[i].pixels);
+	}
+	free(recorder->read_rects);
+	free(recorder->pending);
+	wl_array_release(&recorder->index);
+	free(recorder->compressed);
+	free(recorder->payload);
 	free(recorder->frame);
 	free(recorder);
 }
 
+static int
+weston_recorder_start_worker(struct weston_recorder *recorder)
+{
+	pthread_mutex_init(&recorder->mutex, NULL);
+	pthread_cond_init(&recorder->input_cond, NULL);
+	pthread_cond_init(&recorder->done_cond, NULL);
+
+	if (pthread_create(&recorder->worker, NULL,
+			   weston_recorder_worker, recorder) != 0) {
+		pthread_mutex_destroy(&recorder->mutex);
+		pthread_cond_destroy(&recorder->input_cond);
+		pthread_cond_destroy(&recorder->done_cond);
+		return -1;
+	}
+
+	recorder->has_worker = 1;
+
+	return 0;
+}
+
 static void
-weston_recorder_create(struct weston_output *output, const char *filename)
+weston_recorder_stop_worker(struct weston_recorder *recorder)
+{
+	if (!recorder->has_worker)
+		return;
+
+	pthread_mutex_lock(&recorder->mutex);
+	recorder->worker_done = 1;
+	pthread_cond_signal(&recorder->input_cond);
+	pthread_mutex_unlock(&recorder->mutex);
+
+	pthread_join(recorder->worker, NULL);
+
+	pthread_mutex_destroy(&recorder->mutex);
+	pthread_cond_destroy(&recorder->input_cond);
+	pthread_cond_destroy(&recorder->done_cond);
+	recorder->has_worker = 0;
+}
+
+/* Record the output to fd, which is a file or, if stream is set, a
+ * non-blocking socket. The recorder owns fd even when this fails. */
+static void
+weston_recorder_create(struct weston_output *output, int fd, int stream)
 {
 	struct weston_compositor *compositor = output->compositor;
 	struct weston_recorder *recorder;
-	int stride, size;
-	struct { uint32_t magic, format, width, height; } header;
-	int do_yflip;
-
-	do_yflip = !!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	int i, stride, size;
+	struct wcap_header_v2 header;
 
 	recorder = zalloc(sizeof *recorder);
 	if (recorder == NULL) {
 		weston_log("%s: out of memory\n", __func__);
+		close(fd);
 		return;
 	}
 
-	stride = output->current_mode->width;
-	size = stride * 4 * output->current_mode->height;
+	/* Frames are recorded as the renderer draws them */
+	weston_output_get_buffer_size(output, &recorder->width,
+				      &recorder->height);
+	stride = recorder->width;
+	size = stride * 4 * recorder->height;
 	recorder->frame = zalloc(size);
-	recorder->rect = malloc(size);
+	recorder->payload = malloc(size);
 	recorder->output = output;
+	recorder->do_yflip =
+		!!(compositor->capabilities & WESTON_CAP_CAPTURE_YFLIP);
+	recorder->fd = fd;
+	recorder->stream = stream;
+	wl_array_init(&recorder->index);
 
-	if ((recorder->frame == NULL) || (recorder->rect == NULL)) {
+	if ((recorder->frame == NULL) || (recorder->payload == NULL)) {
 		weston_log("%s: out of memory\n", __func__);
 		goto err_recorder;
 	}
 
-	if (!do_yflip) {
-		recorder->tmpbuf = malloc(size);
-		if (recorder->tmpbuf == NULL) {
+	for (i = 0; i < RECORDER_JOBS; i++) {
+		recorder->jobs[i].pixels = malloc(size);
+		if (recorder->jobs[i].pixels == NULL) {
 			weston_log("%s: out of memory\n", __func__);
 			goto err_recorder;
 		}
 	}
 
-	header.magic = WCAP_HEADER_MAGIC;
+#ifdef HAVE_ZLIB
+	recorder->compressed_size = compressBound(size);
+	recorder->compressed = malloc(recorder->compressed_size);
+	if (recorder->compressed == NULL) {
+		weston_log("%s: out of memory\n", __func__);
+		goto err_recorder;
+	}
+#endif
+
+	memset(&header, 0, sizeof header);
+	header.magic = WCAP_HEADER_MAGIC_V2;
 
 	switch (compositor->read_format) {
 	case PIXMAN_x8r8g8b8:
@@ -525,18 +1239,27 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 		goto err_recorder;
 	}
 
-	recorder->fd = open(filename,
-			    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	header.width = recorder->width;
+	header.height = recorder->height;
+	if (stream) {
+		/* A stream has no frame count or index. The header fits
+		 * in the buffer of a new socket. */
+		if (send(recorder->fd, &header, sizeof header,
+			 MSG_NOSIGNAL) != (ssize_t) sizeof header) {
+			weston_log("recorder: failed to start stream: %m\n");
+			goto err_recorder;
+		}
+		recorder->total += sizeof header;
+	} else {
+		recorder->total += write(recorder->fd, &header, sizeof header);
+	}
 
-	if (recorder->fd < 0) {
-		weston_log("problem opening output file %s: %m\n", filename);
+	if (weston_recorder_start_worker(recorder) < 0) {
+		weston_log("%s: failed to start the encoder thread\n",
+			   __func__);
 		goto err_recorder;
 	}
 
-	header.width = output->current_mode->width;
-	header.height = output->current_mode->height;
-	recorder->total += write(recorder->fd, &header, sizeof header);
-
 	recorder->frame_listener.notify = weston_recorder_frame_notify;
 	wl_signal_add(&output->frame_signal, &recorder->frame_listener);
 	output->disable_planes++;
@@ -545,43 +1268,92 @@ weston_recorder_create(struct weston_output *output, const char *filename)
 	return;
 
 err_recorder:
+	close(recorder->fd);
 	weston_recorder_free(recorder);
 	return;
 }
 
+/* Append the key frame index and point the header at it, so
+ * wcap-decode can seek without reading the whole file. */
+static void
+weston_recorder_write_index(struct weston_recorder *recorder)
+{
+	uint32_t counts[2];
+	uint64_t offset = recorder->total;
+
+	if (write(recorder->fd, recorder->index.data, recorder->index.size) !=
+	    (ssize_t) recorder->index.size) {
+		weston_log("failed to write recording index: %m\n");
+		return;
+	}
+	recorder->total += recorder->index.size;
+
+	counts[0] = recorder->written;
+	counts[1] = recorder->index.size / sizeof (struct wcap_index_entry);
+	if (pwrite(recorder->fd, counts, sizeof counts,
+		   offsetof(struct wcap_header_v2, frame_count)) !=
+	    sizeof counts ||
+	    pwrite(recorder->fd, &offset, sizeof offset,
+		   offsetof(struct wcap_header_v2, index_offset)) !=
+	    sizeof offset)
+		weston_log("failed to update recording header: %m\n");
+}
+
 static void
 weston_recorder_destroy(struct weston_recorder *recorder)
 {
 	wl_list_remove(&recorder->frame_listener.link);
+	weston_recorder_finish_reading(recorder);
+	weston_recorder_stop_worker(recorder);
+	if (recorder->stream) {
+		if (recorder->dropped)
+			weston_log("recorder: %u frames dropped from "
+				   "the stream\n", recorder->dropped);
+	} else {
+		weston_recorder_write_index(recorder);
+	}
 	close(recorder->fd);
 	recorder->output->disable_planes--;
 	weston_recorder_free(recorder);
 }
 
-static void
-recorder_binding(struct weston_keyboard *keyboard, uint32_t time,
-		 uint32_t key, void *data)
+static struct weston_recorder *
+weston_recorder_find(struct weston_compositor *ec)
 {
-	struct weston_compositor *ec = keyboard->seat->compositor;
 	struct weston_output *output;
-	struct wl_listener *listener = NULL;
-	struct weston_recorder *recorder;
-	static const char filename[] = "capture.wcap";
+	struct wl_listener *listener;
 
 	wl_list_for_each(output, &ec->output_list, link) {
 		listener = wl_signal_get(&output->frame_signal,
 					 weston_recorder_frame_notify);
 		if (listener)
-			break;
+			return container_of(listener, struct weston_recorder,
+					    frame_listener);
 	}
 
-	if (listener) {
-		recorder = container_of(listener, struct weston_recorder,
-					frame_listener);
+	return NULL;
+}
+
+static void
+recorder_binding(struct weston_keyboard *keyboard, uint32_t time,
+		 uint32_t key, void *data)
+{
+	struct weston_compositor *ec = keyboard->seat->compositor;
+	struct weston_output *output;
+	struct weston_recorder *recorder;
+	static const char filename[] = "capture.wcap";
+	uint64_t total;
+	int fd;
+
+	recorder = weston_recorder_find(ec);
+	if (recorder) {
+		pthread_mutex_lock(&recorder->mutex);
+		total = recorder->total;
+		pthread_mutex_unlock(&recorder->mutex);
 
 		weston_log(
 			"stopping recorder, total file size %dM, %d frames\n",
-			recorder->total / (1024 * 1024), recorder->count);
+			(int) (total / (1024 * 1024)), recorder->count);
 
 		recorder->destroying = 1;
 		weston_output_schedule_repaint(recorder->output);
@@ -592,10 +1364,158 @@ recorder_binding(struct weston_keyboard *keyboard, uint32_t time,
 			output = container_of(ec->output_list.next,
 					      struct weston_output, link);
 
+		fd = open(filename,
+			  O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			weston_log("problem opening output file %s: %m\n",
+				   filename);
+			return;
+		}
+
 		weston_log("starting recorder for output %s, file %s\n",
 			   output->name, filename);
-		weston_recorder_create(output, filename);
+		weston_recorder_create(output, fd, 0);
+	}
+}
+
+static int
+recorder_stream_accept(int fd, uint32_t mask, void *data)
+{
+	struct screenshooter *shooter = data;
+	struct weston_compositor *ec = shooter->ec;
+	struct weston_output *output, *found = NULL;
+	int client;
+
+	client = accept4(fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (client < 0) {
+		weston_log("recorder: failed to accept stream viewer: %m\n");
+		return 1;
+	}
+
+	if (weston_recorder_find(ec) || wl_list_empty(&ec->output_list)) {
+		weston_log("recorder: busy, refusing stream viewer\n");
+		close(client);
+		return 1;
 	}
+
+	wl_list_for_each(output, &ec->output_list, link) {
+		if (shooter->stream_output &&
+		    strcmp(output->name, shooter->stream_output) == 0)
+			found = output;
+	}
+	if (!found)
+		found = container_of(ec->output_list.next,
+				     struct weston_output, link);
+
+	weston_log("starting recorder for output %s, streaming to %s\n",
+		   found->name, shooter->stream_address);
+	weston_recorder_create(found, client, 1);
+
+	return 1;
+}
+
+/* Listen on "unix:PATH" or "tcp:[HOST:]PORT" */
+static int
+recorder_stream_listen(const char *address)
+{
+	struct sockaddr_un addr;
+	struct addrinfo hints, *res, *ai;
+	char *host, *node, *port;
+	int fd = -1, on = 1;
+
+	if (strncmp(address, "unix:", 5) == 0) {
+		if (strlen(address + 5) >= sizeof addr.sun_path)
+			return -1;
+
+		memset(&addr, 0, sizeof addr);
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, address + 5);
+		unlink(addr.sun_path);
+
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			return -1;
+		if (bind(fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+		    listen(fd, 1) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		return fd;
+	}
+
+	if (strncmp(address, "tcp:", 4) != 0)
+		return -1;
+
+	host = strdup(address + 4);
+	if (!host)
+		return -1;
+	port = strrchr(host, ':');
+	if (port) {
+		*port++ = '\0';
+		node = host;
+	} else {
+		port = host;
+		node = NULL;
+	}
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(node, port, &hints, &res) != 0) {
+		free(host);
+		return -1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+			    ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+		    listen(fd, 1) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+	free(host);
+
+	return fd;
+}
+
+static void
+recorder_stream_create(struct screenshooter *shooter)
+{
+	struct weston_config_section *section;
+	struct wl_event_loop *loop;
+
+	section = weston_config_get_section(shooter->ec->config,
+					    "recorder", NULL, NULL);
+	weston_config_section_get_string(section, "stream",
+					 &shooter->stream_address, NULL);
+	weston_config_section_get_string(section, "output",
+					 &shooter->stream_output, NULL);
+	if (!shooter->stream_address)
+		return;
+
+	shooter->stream_fd = recorder_stream_listen(shooter->stream_address);
+	if (shooter->stream_fd < 0) {
+		weston_log("recorder: can't listen on %s: %m\n",
+			   shooter->stream_address);
+		return;
+	}
+
+	loop = wl_display_get_event_loop(shooter->ec->wl_display);
+	shooter->stream_source =
+		wl_event_loop_add_fd(loop, shooter->stream_fd,
+				     WL_EVENT_READABLE,
+				     recorder_stream_accept, shooter);
+	weston_log("recorder: viewers can connect to %s\n",
+		   shooter->stream_address);
 }
 
 static void
@@ -605,6 +1525,12 @@ screenshooter_destroy(struct wl_listener *listener, void *data)
 		container_of(listener, struct screenshooter, destroy_listener);
 
 	wl_global_destroy(shooter->global);
+	if (shooter->stream_source)
+		wl_event_source_remove(shooter->stream_source);
+	if (shooter->stream_fd >= 0)
+		close(shooter->stream_fd);
+	free(shooter->stream_address);
+	free(shooter->stream_output);
 	free(shooter);
 }
 
@@ -613,21 +1539,24 @@ screenshooter_create(struct weston_compositor *ec)
 {
 	struct screenshooter *shooter;
 
-	shooter = malloc(sizeof *shooter);
+	shooter = zalloc(sizeof *shooter);
 	if (shooter == NULL)
 		return;
 
 	shooter->ec = ec;
 	shooter->client = NULL;
+	shooter->stream_fd = -1;
 
 	shooter->global = wl_global_create(ec->wl_display,
-					   &screenshooter_interface, 1,
+					   &screenshooter_interface, 2,
 					   shooter, bind_shooter);
 	weston_compositor_add_key_binding(ec, KEY_S, MODIFIER_SUPER,
 					  screenshooter_binding, shooter);
 	weston_compositor_add_key_binding(ec, KEY_R, MODIFIER_SUPER,
 					  recorder_binding, shooter);
 
+	recorder_stream_create(shooter);
+
 	shooter->destroy_listener.notify = screenshooter_destroy;
 	wl_signal_add(&ec->destroy_signal, &shooter->destroy_listener);
 }
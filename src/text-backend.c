@@ -86,6 +86,17 @@ struct input_method {
 	struct text_backend *text_backend;
 };
 
+/* A key sent to the input method, which it has not answered yet */
+struct input_method_key {
+	uint32_t time;
+	uint32_t key;
+	uint32_t state;
+	uint32_t sent;
+	bool delivered;
+};
+
+#define INPUT_METHOD_MAX_PENDING_KEYS 32
+
 struct input_method_context {
 	struct wl_resource *resource;
 
@@ -93,6 +104,9 @@ struct input_method_context {
 	struct input_method *input_method;
 
 	struct wl_resource *keyboard;
+
+	struct wl_array pending_keys;
+	struct wl_event_source *key_timer;
 };
 
 struct text_backend {
@@ -106,6 +120,8 @@ struct text_backend {
 
 		unsigned deathcount;
 		uint32_t deathstamp;
+
+		int32_t key_timeout;
 	} input_method;
 
 	struct wl_listener seat_created_listener;
@@ -477,6 +493,29 @@ input_method_context_destroy(struct wl_client *client,
 	wl_resource_destroy(resource);
 }
 
+/* Text events complete an update, send them without waiting for the
+ * compositor to flush its clients */
+static void
+text_input_flush(struct text_input *input)
+{
+	wl_client_flush(wl_resource_get_client(input->resource));
+}
+
+/* The input method answered the keys it was sent, they don't time out */
+static void
+input_method_context_keys_answered(struct input_method_context *context)
+{
+	struct input_method_key *keys = context->pending_keys.data;
+	size_t count, i, kept = 0;
+
+	count = context->pending_keys.size / sizeof *keys;
+	for (i = 0; i < count; i++)
+		if (keys[i].delivered)
+			keys[kept++] = keys[i];
+
+	context->pending_keys.size = kept * sizeof *keys;
+}
+
 static void
 input_method_context_commit_string(struct wl_client *client,
 				   struct wl_resource *resource,
@@ -486,9 +525,13 @@ input_method_context_commit_string(struct wl_client *client,
 	struct input_method_context *context =
 		wl_resource_get_user_data(resource);
 
-	if (context->input)
+	input_method_context_keys_answered(context);
+
+	if (context->input) {
 		wl_text_input_send_commit_string(context->input->resource,
 						 serial, text);
+		text_input_flush(context->input);
+	}
 }
 
 static void
@@ -501,9 +544,13 @@ input_method_context_preedit_string(struct wl_client *client,
 	struct input_method_context *context =
 		wl_resource_get_user_data(resource);
 
-	if (context->input)
+	input_method_context_keys_answered(context);
+
+	if (context->input) {
 		wl_text_input_send_preedit_string(context->input->resource,
 						  serial, text, commit);
+		text_input_flush(context->input);
+	}
 }
 
 static void
@@ -586,9 +633,13 @@ input_method_context_keysym(struct wl_client *client,
 	struct input_method_context *context =
 		wl_resource_get_user_data(resource);
 
-	if (context->input)
+	input_method_context_keys_answered(context);
+
+	if (context->input) {
 		wl_text_input_send_keysym(context->input->resource,
 					  serial, time, sym, state, modifiers);
+		text_input_flush(context->input);
+	}
 }
 
 static void
@@ -601,22 +652,165 @@ unbind_keyboard(struct wl_resource *resource)
 	context->keyboard = NULL;
 }
 
+/* Deliver a key to the focus as if the input method forwarded it */
+static void
+input_method_context_deliver_key(struct input_method_context *context,
+				 uint32_t time, uint32_t key, uint32_t state_w)
+{
+	struct weston_seat *seat = context->input_method->seat;
+	struct weston_keyboard *keyboard = weston_seat_get_keyboard(seat);
+	struct weston_keyboard_grab *default_grab = &keyboard->default_grab;
+
+	default_grab->interface->key(default_grab, time, key, state_w);
+
+	if (keyboard->focus && keyboard->focus->resource)
+		wl_client_flush(wl_resource_get_client(keyboard->focus->resource));
+}
+
+static void
+input_method_context_arm_key_timer(struct input_method_context *context)
+{
+	struct input_method_key *key;
+	int32_t timeout = context->input_method->text_backend->input_method.key_timeout;
+	int32_t delay;
+
+	wl_array_for_each(key, &context->pending_keys) {
+		if (key->delivered)
+			continue;
+
+		delay = timeout - (int32_t)(weston_compositor_get_time() - key->sent);
+		wl_event_source_timer_update(context->key_timer, MAX(delay, 1));
+		return;
+	}
+
+	wl_event_source_timer_update(context->key_timer, 0);
+}
+
+/* The input method is too slow to answer, the overdue keys are
+ * delivered directly and dropped if the input method forwards them
+ * later */
+static int
+input_method_context_key_timeout(void *data)
+{
+	struct input_method_context *context = data;
+	int32_t timeout = context->input_method->text_backend->input_method.key_timeout;
+	uint32_t now = weston_compositor_get_time();
+	struct input_method_key *key;
+
+	wl_array_for_each(key, &context->pending_keys) {
+		if (key->delivered ||
+		    (int32_t)(now - key->sent) < timeout)
+			continue;
+
+		key->delivered = true;
+		input_method_context_deliver_key(context, key->time,
+						 key->key, key->state);
+	}
+
+	input_method_context_arm_key_timer(context);
+
+	return 0;
+}
+
+static void
+input_method_context_track_key(struct input_method_context *context,
+			       uint32_t time, uint32_t key, uint32_t state_w)
+{
+	struct weston_compositor *ec = context->input_method->seat->compositor;
+	struct wl_event_loop *loop;
+	struct input_method_key *pending;
+
+	if (!context->key_timer) {
+		loop = wl_display_get_event_loop(ec->wl_display);
+		context->key_timer =
+			wl_event_loop_add_timer(loop,
+						input_method_context_key_timeout,
+						context);
+		if (!context->key_timer)
+			return;
+	}
+
+	/* the oldest keys are given up on */
+	if (context->pending_keys.size ==
+	    INPUT_METHOD_MAX_PENDING_KEYS * sizeof *pending) {
+		memmove(context->pending_keys.data,
+			(char *) context->pending_keys.data + sizeof *pending,
+			context->pending_keys.size - sizeof *pending);
+		context->pending_keys.size -= sizeof *pending;
+	}
+
+	pending = wl_array_add(&context->pending_keys, sizeof *pending);
+	if (!pending)
+		return;
+
+	pending->time = time;
+	pending->key = key;
+	pending->state = state_w;
+	pending->sent = weston_compositor_get_time();
+	pending->delivered = false;
+
+	input_method_context_arm_key_timer(context);
+}
+
+/** Match a key forwarded by the input method with the keys it was sent
+ *
+ * \return true if the key was already delivered on timeout.
+ *
+ * The input method handles keys in order, so the keys sent before the
+ * forwarded one were answered or consumed.
+ */
+static bool
+input_method_context_untrack_key(struct input_method_context *context,
+				 uint32_t key, uint32_t state_w)
+{
+	struct input_method_key *keys = context->pending_keys.data;
+	size_t count, i;
+	bool delivered;
+
+	count = context->pending_keys.size / sizeof *keys;
+	for (i = 0; i < count; i++) {
+		if (keys[i].key != key || keys[i].state != state_w)
+			continue;
+
+		delivered = keys[i].delivered;
+		memmove(keys, keys + i + 1, (count - i - 1) * sizeof *keys);
+		context->pending_keys.size = (count - i - 1) * sizeof *keys;
+
+		if (context->key_timer)
+			input_method_context_arm_key_timer(context);
+
+		return delivered;
+	}
+
+	/* a key the input method made up */
+	return false;
+}
+
 static void
 input_method_context_grab_key(struct weston_keyboard_grab *grab,
 			      uint32_t time, uint32_t key, uint32_t state_w)
 {
 	struct weston_keyboard *keyboard = grab->keyboard;
+	struct input_method_context *context;
 	struct wl_display *display;
+	struct wl_client *client;
 	uint32_t serial;
 
 	if (!keyboard->input_method_resource)
 		return;
 
-	display = wl_client_get_display(
-		wl_resource_get_client(keyboard->input_method_resource));
+	context = wl_resource_get_user_data(keyboard->input_method_resource);
+	if (context->input_method->text_backend->input_method.key_timeout > 0)
+		input_method_context_track_key(context, time, key, state_w);
+
+	client = wl_resource_get_client(keyboard->input_method_resource);
+	display = wl_client_get_display(client);
 	serial = wl_display_next_serial(display);
 	wl_keyboard_send_key(keyboard->input_method_resource,
 			     serial, time, key, state_w);
+
+	/* the round trip through the input method is on the typing path */
+	wl_client_flush(client);
 }
 
 static void
@@ -686,11 +880,11 @@ input_method_context_key(struct wl_client *client,
 {
 	struct input_method_context *context =
 		wl_resource_get_user_data(resource);
-	struct weston_seat *seat = context->input_method->seat;
-	struct weston_keyboard *keyboard = weston_seat_get_keyboard(seat);
-	struct weston_keyboard_grab *default_grab = &keyboard->default_grab;
 
-	default_grab->interface->key(default_grab, time, key, state_w);
+	if (input_method_context_untrack_key(context, key, state_w))
+		return;
+
+	input_method_context_deliver_key(context, time, key, state_w);
 }
 
 static void
@@ -770,6 +964,10 @@ destroy_input_method_context(struct wl_resource *resource)
 	if (context->keyboard)
 		wl_resource_destroy(context->keyboard);
 
+	if (context->key_timer)
+		wl_event_source_remove(context->key_timer);
+	wl_array_release(&context->pending_keys);
+
 	if (context->input_method && context->input_method->context == context)
 		context->input_method->context = NULL;
 
@@ -801,6 +999,7 @@ input_method_context_create(struct text_input *input,
 	context->input = input;
 	context->input_method = input_method;
 	input_method->context = context;
+	wl_array_init(&context->pending_keys);
 
 
 	wl_input_method_send_activate(binding, context->resource);
@@ -1037,6 +1236,10 @@ text_backend_configuration(struct text_backend *text_backend)
 					 &text_backend->input_method.path,
 					 client);
 	free(client);
+
+	weston_config_section_get_int(section, "key-timeout",
+				      &text_backend->input_method.key_timeout,
+				      0);
 }
 
 WL_EXPORT void
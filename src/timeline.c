@@ -27,20 +27,78 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "timeline.h"
 #include "compositor.h"
 #include "file-util.h"
+#include "shared/timespec-util.h"
+
+#define TIMELINE_RING_MAGIC "WTLRING1"
+#define TIMELINE_RING_MAX_NAMES 64
+#define TIMELINE_RING_NAME_LEN 48
+#define TIMELINE_RING_DESCS 256
+#define TIMELINE_RING_NO_NAME 0xffffffff
+
+/*
+ * Layout of the ring buffer file: this header, followed by n_records
+ * fixed-size records. head counts every record ever written, so the
+ * newest one is at (head - 1) % n_records. The point names are kept
+ * in the header so that the file can be decoded after a crash.
+ */
+struct timeline_ring_header {
+	char magic[8];
+	uint32_t record_size;
+	uint32_t n_names;
+	uint64_t n_records;
+	uint64_t head;
+	char names[TIMELINE_RING_MAX_NAMES][TIMELINE_RING_NAME_LEN];
+};
+
+struct timeline_ring_record {
+	int64_t time;		/* nsec on the timeline clock */
+	uint32_t name;		/* index into the header names */
+	uint32_t output;	/* weston_output timeline id, 0 if none */
+	uint32_t surface;	/* weston_surface timeline id, 0 if none */
+	uint32_t input_time;	/* input event time in ms, 0 if none */
+	int64_t vblank;		/* nsec, 0 if none */
+	int64_t deadline;	/* nsec, 0 if none */
+	uint64_t gpu_time;	/* nsec spent on the GPU, 0 if none */
+	uint32_t rects;		/* rectangle count, 0 if none */
+};
+
+/* Object descriptions: the ring only stores ids, the snapshot needs
+ * the names. Slots are reused by id, so descriptions of long gone
+ * objects eventually get overwritten. */
+struct timeline_ring_desc {
+	unsigned id;
+	enum timeline_type type;
+	unsigned main_id;
+	char desc[128];
+};
+
+struct timeline_ring {
+	struct timeline_ring_header *header;
+	size_t size;
+	struct timeline_ring_record *records;
+	const char *name_ptrs[TIMELINE_RING_MAX_NAMES];
+	struct timeline_ring_desc descs[TIMELINE_RING_DESCS];
+};
 
 struct timeline_log {
 	clock_t clk_id;
 	FILE *file;
 	unsigned series;
 	struct wl_listener compositor_destroy_listener;
+
+	/* Set in ring buffer mode, file is NULL then */
+	struct timeline_ring *ring;
 };
 
 WL_EXPORT int weston_timeline_enabled_;
@@ -111,6 +169,14 @@ weston_timeline_close(void)
 
 	wl_list_remove(&timeline_.compositor_destroy_listener.link);
 
+	if (timeline_.ring) {
+		munmap(timeline_.ring->header, timeline_.ring->size);
+		free(timeline_.ring);
+		timeline_.ring = NULL;
+		weston_log("Timeline ring buffer closed.\n");
+		return;
+	}
+
 	fclose(timeline_.file);
 	timeline_.file = NULL;
 	weston_log("Timeline log file closed.\n");
@@ -134,11 +200,11 @@ timeline_new_id(void)
 }
 
 static int
-check_series(struct timeline_emit_context *ctx,
-	     struct weston_timeline_object *to)
+timeline_object_check_series(unsigned series,
+			     struct weston_timeline_object *to)
 {
-	if (to->series == 0 || to->series != ctx->series) {
-		to->series = ctx->series;
+	if (to->series == 0 || to->series != series) {
+		to->series = series;
 		to->id = timeline_new_id();
 		return 1;
 	}
@@ -151,6 +217,13 @@ check_series(struct timeline_emit_context *ctx,
 	return 0;
 }
 
+static int
+check_series(struct timeline_emit_context *ctx,
+	     struct weston_timeline_object *to)
+{
+	return timeline_object_check_series(ctx->series, to);
+}
+
 static void
 fprint_quoted_string(FILE *fp, const char *str)
 {
@@ -234,12 +307,368 @@ emit_vblank_timestamp(struct timeline_emit_context *ctx, void *obj)
 
 typedef int (*type_func)(struct timeline_emit_context *ctx, void *obj);
 
+static int
+emit_deadline_timestamp(struct timeline_emit_context *ctx, void *obj)
+{
+	struct timespec *ts = obj;
+
+	fprintf(ctx->cur, "\"deadline\":[%" PRId64 ", %ld]",
+		(int64_t)ts->tv_sec, ts->tv_nsec);
+
+	return 1;
+}
+
+static int
+emit_input_time(struct timeline_emit_context *ctx, void *obj)
+{
+	uint32_t *msec = obj;
+
+	fprintf(ctx->cur, "\"input_time\":%u", *msec);
+
+	return 1;
+}
+
+static int
+emit_gpu_time(struct timeline_emit_context *ctx, void *obj)
+{
+	uint64_t *nsec = obj;
+
+	fprintf(ctx->cur, "\"gpu_time\":%" PRIu64, *nsec);
+
+	return 1;
+}
+
+static int
+emit_rects(struct timeline_emit_context *ctx, void *obj)
+{
+	uint32_t *n = obj;
+
+	fprintf(ctx->cur, "\"rects\":%u", *n);
+
+	return 1;
+}
+
 static const type_func type_dispatch[] = {
 	[TLT_OUTPUT] = emit_weston_output,
 	[TLT_SURFACE] = emit_weston_surface,
 	[TLT_VBLANK] = emit_vblank_timestamp,
+	[TLT_DEADLINE] = emit_deadline_timestamp,
+	[TLT_INPUT_TIME] = emit_input_time,
+	[TLT_GPU_TIME] = emit_gpu_time,
+	[TLT_RECTS] = emit_rects,
 };
 
+static uint32_t
+timeline_ring_name_index(struct timeline_ring *ring, const char *name)
+{
+	struct timeline_ring_header *hdr = ring->header;
+	uint32_t i;
+
+	/* Point names are string literals, the pointer usually matches */
+	for (i = 0; i < hdr->n_names; i++)
+		if (ring->name_ptrs[i] == name)
+			return i;
+
+	for (i = 0; i < hdr->n_names; i++) {
+		if (strncmp(hdr->names[i], name, TIMELINE_RING_NAME_LEN) == 0) {
+			ring->name_ptrs[i] = name;
+			return i;
+		}
+	}
+
+	if (hdr->n_names == TIMELINE_RING_MAX_NAMES)
+		return TIMELINE_RING_NO_NAME;
+
+	i = hdr->n_names++;
+	snprintf(hdr->names[i], TIMELINE_RING_NAME_LEN, "%s", name);
+	ring->name_ptrs[i] = name;
+
+	return i;
+}
+
+static struct timeline_ring_desc *
+timeline_ring_desc_slot(struct timeline_ring *ring, unsigned id,
+			enum timeline_type type)
+{
+	struct timeline_ring_desc *desc;
+
+	desc = &ring->descs[id % TIMELINE_RING_DESCS];
+	memset(desc, 0, sizeof *desc);
+	desc->id = id;
+	desc->type = type;
+
+	return desc;
+}
+
+static unsigned
+timeline_ring_output_id(struct timeline_ring *ring, struct weston_output *o)
+{
+	struct timeline_ring_desc *desc;
+
+	if (timeline_object_check_series(timeline_.series, &o->timeline)) {
+		desc = timeline_ring_desc_slot(ring, o->timeline.id,
+					       TLT_OUTPUT);
+		snprintf(desc->desc, sizeof desc->desc, "%s",
+			 o->name ? o->name : "");
+	}
+
+	return o->timeline.id;
+}
+
+static unsigned
+timeline_ring_surface_id(struct timeline_ring *ring, struct weston_surface *s)
+{
+	struct timeline_ring_desc *desc;
+	struct weston_surface *mains;
+	unsigned main_id = 0;
+
+	if (!timeline_object_check_series(timeline_.series, &s->timeline))
+		return s->timeline.id;
+
+	mains = weston_surface_get_main_surface(s);
+	if (mains != s)
+		main_id = timeline_ring_surface_id(ring, mains);
+
+	desc = timeline_ring_desc_slot(ring, s->timeline.id, TLT_SURFACE);
+	desc->main_id = main_id;
+	if (!s->get_label ||
+	    s->get_label(s, desc->desc, sizeof desc->desc) < 0)
+		desc->desc[0] = '\0';
+
+	return s->timeline.id;
+}
+
+/* Fills the next record in place; there are no locks, only the head
+ * is advanced atomically. */
+static void
+timeline_ring_point(const struct timespec *ts, const char *name,
+		    va_list argp)
+{
+	struct timeline_ring *ring = timeline_.ring;
+	struct timeline_ring_header *hdr = ring->header;
+	struct timeline_ring_record *rec;
+	enum timeline_type otype;
+	uint64_t slot;
+	void *obj;
+
+	slot = __atomic_fetch_add(&hdr->head, 1, __ATOMIC_RELAXED);
+	rec = &ring->records[slot % hdr->n_records];
+
+	memset(rec, 0, sizeof *rec);
+	rec->time = timespec_to_nsec(ts);
+	rec->name = timeline_ring_name_index(ring, name);
+
+	while (1) {
+		otype = va_arg(argp, enum timeline_type);
+		if (otype == TLT_END)
+			break;
+
+		obj = va_arg(argp, void *);
+		switch (otype) {
+		case TLT_OUTPUT:
+			rec->output = timeline_ring_output_id(ring, obj);
+			break;
+		case TLT_SURFACE:
+			rec->surface = timeline_ring_surface_id(ring, obj);
+			break;
+		case TLT_VBLANK:
+			rec->vblank = timespec_to_nsec(obj);
+			break;
+		case TLT_DEADLINE:
+			rec->deadline = timespec_to_nsec(obj);
+			break;
+		case TLT_INPUT_TIME:
+			rec->input_time = *(uint32_t *)obj;
+			break;
+		case TLT_GPU_TIME:
+			rec->gpu_time = *(uint64_t *)obj;
+			break;
+		case TLT_RECTS:
+			rec->rects = *(uint32_t *)obj;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/** Keep the timeline in a ring buffer instead of a log file
+ *
+ * \param compositor The compositor.
+ * \param size Size of the ring buffer file in bytes.
+ *
+ * Timeline points are stored as fixed-size binary records in a file
+ * mapped into memory, overwriting the oldest ones. This is cheap
+ * enough to leave on all the time; the last records can then be
+ * written out as a regular timeline log with
+ * weston_timeline_ring_snapshot(), or decoded from the file after a
+ * crash.
+ */
+void
+weston_timeline_ring_open(struct weston_compositor *compositor, size_t size)
+{
+	const char *prefix = "weston-timeline-ring-";
+	const char *suffix = ".bin";
+	struct timeline_ring_header *hdr;
+	struct timeline_ring *ring;
+	char fname[1000];
+	FILE *fp;
+	void *map;
+
+	if (weston_timeline_enabled_)
+		weston_timeline_close();
+
+	if (size < sizeof *hdr + 16 * sizeof(struct timeline_ring_record))
+		size = sizeof *hdr + 16 * sizeof(struct timeline_ring_record);
+
+	ring = zalloc(sizeof *ring);
+	if (!ring)
+		return;
+
+	fp = file_create_dated(prefix, suffix, fname, sizeof(fname));
+	if (!fp) {
+		weston_log("Cannot create the timeline ring buffer file: %m\n");
+		free(ring);
+		return;
+	}
+
+	map = MAP_FAILED;
+	if (ftruncate(fileno(fp), size) == 0)
+		map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   fileno(fp), 0);
+	fclose(fp);
+
+	if (map == MAP_FAILED) {
+		weston_log("Cannot map the timeline ring buffer '%s': %m\n",
+			   fname);
+		unlink(fname);
+		free(ring);
+		return;
+	}
+
+	hdr = map;
+	memcpy(hdr->magic, TIMELINE_RING_MAGIC, sizeof hdr->magic);
+	hdr->record_size = sizeof(struct timeline_ring_record);
+	hdr->n_records = (size - sizeof *hdr) / hdr->record_size;
+
+	ring->header = hdr;
+	ring->size = size;
+	ring->records = (struct timeline_ring_record *)(hdr + 1);
+	timeline_.ring = ring;
+
+	timeline_.compositor_destroy_listener.notify = timeline_notify_destroy;
+	wl_signal_add(&compositor->destroy_signal,
+		      &timeline_.compositor_destroy_listener);
+
+	if (++timeline_.series == 0)
+		++timeline_.series;
+
+	weston_timeline_enabled_ = 1;
+	weston_log("Timeline ring buffer '%s' holds %" PRIu64 " records.\n",
+		   fname, hdr->n_records);
+}
+
+int
+weston_timeline_ring_enabled(void)
+{
+	return timeline_.ring != NULL;
+}
+
+static void
+timeline_ring_write_desc(FILE *fp, const struct timeline_ring_desc *desc)
+{
+	switch (desc->type) {
+	case TLT_OUTPUT:
+		fprintf(fp, "{ \"id\":%u, "
+			"\"type\":\"weston_output\", \"name\":", desc->id);
+		fprint_quoted_string(fp, desc->desc);
+		fprintf(fp, " }\n");
+		break;
+	case TLT_SURFACE:
+		fprintf(fp, "{ \"id\":%u, "
+			"\"type\":\"weston_surface\", \"desc\":", desc->id);
+		fprint_quoted_string(fp, desc->desc[0] ? desc->desc : NULL);
+		if (desc->main_id)
+			fprintf(fp, ", \"main_surface\":%u", desc->main_id);
+		fprintf(fp, " }\n");
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+fprint_nsec_timestamp(FILE *fp, const char *key, int64_t nsec)
+{
+	fprintf(fp, ", \"%s\":[%" PRId64 ", %ld]", key,
+		nsec / NSEC_PER_SEC, (long)(nsec % NSEC_PER_SEC));
+}
+
+/** Write the contents of the timeline ring buffer as a timeline log
+ *
+ * The log has the same format as the one written by
+ * weston_timeline_open(), so the same tools can read it. Recording
+ * continues.
+ */
+void
+weston_timeline_ring_snapshot(void)
+{
+	struct timeline_ring *ring = timeline_.ring;
+	struct timeline_ring_header *hdr;
+	struct timeline_ring_record *rec;
+	char fname[1000];
+	uint64_t head, first, i;
+	FILE *fp;
+	int j;
+
+	if (!ring)
+		return;
+
+	fp = file_create_dated("weston-timeline-", ".log",
+			       fname, sizeof(fname));
+	if (!fp) {
+		weston_log("Cannot create the timeline snapshot file: %m\n");
+		return;
+	}
+
+	hdr = ring->header;
+	head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	first = head > hdr->n_records ? head - hdr->n_records : 0;
+
+	for (j = 0; j < TIMELINE_RING_DESCS; j++)
+		if (ring->descs[j].id)
+			timeline_ring_write_desc(fp, &ring->descs[j]);
+
+	for (i = first; i < head; i++) {
+		rec = &ring->records[i % hdr->n_records];
+
+		fprintf(fp, "{ \"T\":[%" PRId64 ", %ld], \"N\":",
+			rec->time / NSEC_PER_SEC,
+			(long)(rec->time % NSEC_PER_SEC));
+		fprint_quoted_string(fp, rec->name < hdr->n_names ?
+					 hdr->names[rec->name] : NULL);
+		if (rec->output)
+			fprintf(fp, ", \"wo\":%u", rec->output);
+		if (rec->surface)
+			fprintf(fp, ", \"ws\":%u", rec->surface);
+		if (rec->vblank)
+			fprint_nsec_timestamp(fp, "vblank", rec->vblank);
+		if (rec->deadline)
+			fprint_nsec_timestamp(fp, "deadline", rec->deadline);
+		if (rec->input_time)
+			fprintf(fp, ", \"input_time\":%u", rec->input_time);
+		if (rec->gpu_time)
+			fprintf(fp, ", \"gpu_time\":%" PRIu64, rec->gpu_time);
+		if (rec->rects)
+			fprintf(fp, ", \"rects\":%u", rec->rects);
+		fprintf(fp, " }\n");
+	}
+
+	fclose(fp);
+	weston_log("Timeline snapshot of %" PRIu64 " records written to "
+		   "'%s'\n", head - first, fname);
+}
+
 WL_EXPORT void
 weston_timeline_point(const char *name, ...)
 {
@@ -252,6 +681,13 @@ weston_timeline_point(const char *name, ...)
 
 	clock_gettime(timeline_.clk_id, &ts);
 
+	if (timeline_.ring) {
+		va_start(argp, name);
+		timeline_ring_point(&ts, name, argp);
+		va_end(argp);
+		return;
+	}
+
 	ctx.out = timeline_.file;
 	ctx.cur = fmemopen(buf, sizeof(buf), "w");
 	ctx.series = timeline_.series;
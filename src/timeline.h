@@ -27,6 +27,9 @@
 #ifndef WESTON_TIMELINE_H
 #define WESTON_TIMELINE_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 extern int weston_timeline_enabled_;
 
 struct weston_compositor;
@@ -37,11 +40,24 @@ weston_timeline_open(struct weston_compositor *compositor);
 void
 weston_timeline_close(void);
 
+void
+weston_timeline_ring_open(struct weston_compositor *compositor, size_t size);
+
+int
+weston_timeline_ring_enabled(void);
+
+void
+weston_timeline_ring_snapshot(void);
+
 enum timeline_type {
 	TLT_END = 0,
 	TLT_OUTPUT,
 	TLT_SURFACE,
 	TLT_VBLANK,
+	TLT_DEADLINE,
+	TLT_INPUT_TIME,
+	TLT_GPU_TIME,
+	TLT_RECTS,
 };
 
 #define TYPEVERIFY(type, arg) ({			\
@@ -53,6 +69,10 @@ enum timeline_type {
 #define TLP_OUTPUT(o) TLT_OUTPUT, TYPEVERIFY(struct weston_output *, (o))
 #define TLP_SURFACE(s) TLT_SURFACE, TYPEVERIFY(struct weston_surface *, (s))
 #define TLP_VBLANK(t) TLT_VBLANK, TYPEVERIFY(const struct timespec *, (t))
+#define TLP_DEADLINE(t) TLT_DEADLINE, TYPEVERIFY(const struct timespec *, (t))
+#define TLP_INPUT_TIME(t) TLT_INPUT_TIME, TYPEVERIFY(const uint32_t *, (t))
+#define TLP_GPU_TIME(t) TLT_GPU_TIME, TYPEVERIFY(const uint64_t *, (t))
+#define TLP_RECTS(n) TLT_RECTS, TYPEVERIFY(const uint32_t *, (n))
 
 #define TL_POINT(...) do { \
 	if (weston_timeline_enabled_) \
@@ -70,6 +70,12 @@
 #define PROFILE_IDC_MAIN        77
 #define PROFILE_IDC_HIGH        100
 
+/* Number of converted frames that can wait for the encoder */
+#define RECORDER_QUEUE_LENGTH   4
+
+/* Number of scanout buffers kept imported as VA surfaces */
+#define RECORDER_MAX_IMPORTS    4
+
 struct vaapi_recorder {
 	int drm_fd, output_fd;
 	int width, height;
@@ -80,11 +86,14 @@ struct vaapi_recorder {
 	pthread_t worker_thread;
 	pthread_mutex_t mutex;
 	pthread_cond_t input_cond;
+	pthread_cond_t space_cond;
 
+	/* Frames already converted to NV12, waiting for the worker
+	 * thread to encode them in order.  The compositor fills the
+	 * slot after the last queued one; the worker owns the rest. */
 	struct {
-		int valid;
-		int prime_fd, stride;
-	} input;
+		int head, count;
+	} queue;
 
 	VADisplay va_dpy;
 
@@ -93,7 +102,20 @@ struct vaapi_recorder {
 		VAConfigID cfg;
 		VAContextID ctx;
 		VABufferID pipeline_buf;
-		VASurfaceID output;
+		VASurfaceID output[RECORDER_QUEUE_LENGTH];
+
+		/* Scanout buffers are reused frame after frame, so keep
+		 * them imported, keyed by the caller's buffer, until it
+		 * calls vaapi_recorder_forget_buffer() */
+		struct {
+			const void *buffer;
+			int stride;
+			VASurfaceID surface;
+		} imports[RECORDER_MAX_IMPORTS];
+		int next_import;
+
+		/* Frames handed over in memory are copied here first */
+		VASurfaceID upload;
 	} vpp;
 
 	struct {
@@ -777,10 +799,11 @@ encoder_write_output(struct vaapi_recorder *r, VABufferID output_buf)
 	return OUTPUT_WRITE_SUCCESS;
 }
 
-static void
+static int
 encoder_encode(struct vaapi_recorder *r, VASurfaceID input)
 {
 	VABufferID output_buf = VA_INVALID_ID;
+	int error = 0;
 
 	VABufferID buffers[8];
 	int count = 0;
@@ -823,19 +846,21 @@ encoder_encode(struct vaapi_recorder *r, VASurfaceID input)
 	} while (ret == OUTPUT_WRITE_OVERFLOW);
 
 	if (ret == OUTPUT_WRITE_FATAL)
-		r->error = errno;
+		error = errno;
 
 	for (i = 0; i < count; i++)
 		vaDestroyBuffer(r->va_dpy, buffers[i]);
 
 	r->frame_count++;
-	return;
+	return error;
 
 bail:
 	for (i = 0; i < count; i++)
 		vaDestroyBuffer(r->va_dpy, buffers[i]);
 	if (output_buf != VA_INVALID_ID)
 		vaDestroyBuffer(r->va_dpy, output_buf);
+
+	return 0;
 }
 
 
@@ -843,6 +868,7 @@ static int
 setup_vpp(struct vaapi_recorder *r)
 {
 	VAStatus status;
+	int i;
 
 	status = vaCreateConfig(r->va_dpy, VAProfileNone,
 				VAEntrypointVideoProc, NULL, 0,
@@ -869,13 +895,17 @@ setup_vpp(struct vaapi_recorder *r)
 	}
 
 	status = vaCreateSurfaces(r->va_dpy, VA_RT_FORMAT_YUV420,
-				  r->width, r->height, &r->vpp.output, 1,
-				  NULL, 0);
+				  r->width, r->height, r->vpp.output,
+				  RECORDER_QUEUE_LENGTH, NULL, 0);
 	if (status != VA_STATUS_SUCCESS) {
 		weston_log("vaapi: failed to create YUV surface\n");
 		goto err_buf;
 	}
 
+	for (i = 0; i < RECORDER_MAX_IMPORTS; i++)
+		r->vpp.imports[i].surface = VA_INVALID_SURFACE;
+	r->vpp.upload = VA_INVALID_SURFACE;
+
 	return 0;
 
 err_buf:
@@ -891,7 +921,16 @@ err_cfg:
 static void
 vpp_destroy(struct vaapi_recorder *r)
 {
-	vaDestroySurfaces(r->va_dpy, &r->vpp.output, 1);
+	int i;
+
+	for (i = 0; i < RECORDER_MAX_IMPORTS; i++)
+		if (r->vpp.imports[i].surface != VA_INVALID_SURFACE)
+			vaDestroySurfaces(r->va_dpy,
+					  &r->vpp.imports[i].surface, 1);
+	if (r->vpp.upload != VA_INVALID_SURFACE)
+		vaDestroySurfaces(r->va_dpy, &r->vpp.upload, 1);
+
+	vaDestroySurfaces(r->va_dpy, r->vpp.output, RECORDER_QUEUE_LENGTH);
 	vaDestroyBuffer(r->va_dpy, r->vpp.pipeline_buf);
 	vaDestroyConfig(r->va_dpy, r->vpp.ctx);
 	vaDestroyConfig(r->va_dpy, r->vpp.cfg);
@@ -902,6 +941,7 @@ setup_worker_thread(struct vaapi_recorder *r)
 {
 	pthread_mutex_init(&r->mutex, NULL);
 	pthread_cond_init(&r->input_cond, NULL);
+	pthread_cond_init(&r->space_cond, NULL);
 	pthread_create(&r->worker_thread, NULL, worker_thread_function, r);
 
 	return 1;
@@ -912,7 +952,8 @@ destroy_worker_thread(struct vaapi_recorder *r)
 {
 	pthread_mutex_lock(&r->mutex);
 
-	/* Make sure the worker thread finishes */
+	/* Make sure the worker thread finishes; it encodes whatever
+	 * is still queued first. */
 	r->destroying = 1;
 	pthread_cond_signal(&r->input_cond);
 
@@ -922,6 +963,7 @@ destroy_worker_thread(struct vaapi_recorder *r)
 
 	pthread_mutex_destroy(&r->mutex);
 	pthread_cond_destroy(&r->input_cond);
+	pthread_cond_destroy(&r->space_cond);
 }
 
 struct vaapi_recorder *
@@ -1041,7 +1083,8 @@ create_surface_from_fd(struct vaapi_recorder *r, int prime_fd,
 }
 
 static VAStatus
-convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
+convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface,
+		   VASurfaceID output)
 {
 	VAProcPipelineParameterBuffer *pipeline_param;
 	VAStatus status;
@@ -1063,7 +1106,7 @@ convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
-	status = vaBeginPicture(r->va_dpy, r->vpp.ctx, r->vpp.output);
+	status = vaBeginPicture(r->va_dpy, r->vpp.ctx, output);
 	if (status != VA_STATUS_SUCCESS)
 		return status;
 
@@ -1079,52 +1122,144 @@ convert_rgb_to_yuv(struct vaapi_recorder *r, VASurfaceID rgb_surface)
 	return status;
 }
 
-static void
-recorder_frame(struct vaapi_recorder *r)
+/* Find the VA surface wrapping buffer, importing it from prime_fd if
+ * this is the first time we see it.  Takes ownership of the fd. */
+static VAStatus
+import_surface(struct vaapi_recorder *r, const void *buffer, int prime_fd,
+	       int stride, VASurfaceID *surface)
 {
-	VASurfaceID rgb_surface;
 	VAStatus status;
+	int i;
 
-	status = create_surface_from_fd(r, r->input.prime_fd,
-					r->input.stride, &rgb_surface);
-	if (status != VA_STATUS_SUCCESS) {
-		weston_log("[libva recorder] "
-			   "failed to create surface from bo\n");
-		return;
+	for (i = 0; i < RECORDER_MAX_IMPORTS; i++) {
+		if (r->vpp.imports[i].surface != VA_INVALID_SURFACE &&
+		    r->vpp.imports[i].buffer == buffer &&
+		    r->vpp.imports[i].stride == stride) {
+			close(prime_fd);
+			*surface = r->vpp.imports[i].surface;
+			return VA_STATUS_SUCCESS;
+		}
+	}
+
+	status = create_surface_from_fd(r, prime_fd, stride, surface);
+	close(prime_fd);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	/* Evict the oldest import; its last conversion was submitted
+	 * several frames ago. */
+	i = r->vpp.next_import;
+	r->vpp.next_import = (i + 1) % RECORDER_MAX_IMPORTS;
+	if (r->vpp.imports[i].surface != VA_INVALID_SURFACE)
+		vaDestroySurfaces(r->va_dpy, &r->vpp.imports[i].surface, 1);
+
+	r->vpp.imports[i].buffer = buffer;
+	r->vpp.imports[i].stride = stride;
+	r->vpp.imports[i].surface = *surface;
+
+	return VA_STATUS_SUCCESS;
+}
+
+/* Copy a frame from memory into the upload surface, swapping red and
+ * blue for xbgr8888 data, since the surface is always bgrx. */
+static VAStatus
+upload_surface(struct vaapi_recorder *r, const void *data, int stride,
+	       int bgr, VASurfaceID *surface)
+{
+	VASurfaceAttrib va_attrib;
+	VAImage image;
+	VAStatus status;
+	const uint32_t *src;
+	uint32_t *dst, p;
+	void *map;
+	int x, y;
+
+	if (r->vpp.upload == VA_INVALID_SURFACE) {
+		va_attrib.type = VASurfaceAttribPixelFormat;
+		va_attrib.flags = VA_SURFACE_ATTRIB_SETTABLE;
+		va_attrib.value.type = VAGenericValueTypeInteger;
+		va_attrib.value.value.i = VA_FOURCC_BGRX;
+
+		status = vaCreateSurfaces(r->va_dpy, VA_RT_FORMAT_RGB32,
+					  r->width, r->height,
+					  &r->vpp.upload, 1, &va_attrib, 1);
+		if (status != VA_STATUS_SUCCESS) {
+			r->vpp.upload = VA_INVALID_SURFACE;
+			return status;
+		}
 	}
 
-	close(r->input.prime_fd);
+	status = vaDeriveImage(r->va_dpy, r->vpp.upload, &image);
+	if (status != VA_STATUS_SUCCESS)
+		return status;
+
+	if (image.format.fourcc != VA_FOURCC_BGRX &&
+	    image.format.fourcc != VA_FOURCC_BGRA) {
+		vaDestroyImage(r->va_dpy, image.image_id);
+		return VA_STATUS_ERROR_INVALID_IMAGE_FORMAT;
+	}
 
-	status = convert_rgb_to_yuv(r, rgb_surface);
+	status = vaMapBuffer(r->va_dpy, image.buf, &map);
 	if (status != VA_STATUS_SUCCESS) {
-		weston_log("[libva recorder] "
-			   "color space conversion failed\n");
-		return;
+		vaDestroyImage(r->va_dpy, image.image_id);
+		return status;
+	}
+
+	for (y = 0; y < r->height; y++) {
+		src = (const uint32_t *) ((const char *) data + y * stride);
+		dst = (uint32_t *) ((char *) map + image.offsets[0] +
+				    y * image.pitches[0]);
+		if (!bgr) {
+			memcpy(dst, src, r->width * 4);
+			continue;
+		}
+
+		for (x = 0; x < r->width; x++) {
+			p = src[x];
+			dst[x] = (p & 0xff00ff00) |
+				 ((p >> 16) & 0xff) | ((p & 0xff) << 16);
+		}
 	}
 
-	encoder_encode(r, r->vpp.output);
+	vaUnmapBuffer(r->va_dpy, image.buf);
+	vaDestroyImage(r->va_dpy, image.image_id);
 
-	vaDestroySurfaces(r->va_dpy, &rgb_surface, 1);
+	*surface = r->vpp.upload;
+
+	return VA_STATUS_SUCCESS;
 }
 
 static void *
 worker_thread_function(void *data)
 {
 	struct vaapi_recorder *r = data;
+	VASurfaceID input;
+	int error;
 
 	pthread_mutex_lock(&r->mutex);
 
-	while (!r->destroying) {
-		if (!r->input.valid)
+	while (1) {
+		while (r->queue.count == 0 && !r->destroying)
 			pthread_cond_wait(&r->input_cond, &r->mutex);
 
-		/* If the thread is awaken by destroy_worker_thread(),
-		 * there might not be valid input */
-		if (!r->input.valid)
-			continue;
+		/* Frames queued before destruction still get encoded */
+		if (r->queue.count == 0)
+			break;
 
-		recorder_frame(r);
-		r->input.valid = 0;
+		input = r->vpp.output[r->queue.head];
+
+		/* The compositor only touches the slot after the queued
+		 * ones, so encode without holding the lock. */
+		pthread_mutex_unlock(&r->mutex);
+		error = encoder_encode(r, input);
+		pthread_mutex_lock(&r->mutex);
+
+		if (error && !r->error)
+			r->error = error;
+
+		r->queue.head = (r->queue.head + 1) % RECORDER_QUEUE_LENGTH;
+		r->queue.count--;
+		pthread_cond_signal(&r->space_cond);
 	}
 
 	pthread_mutex_unlock(&r->mutex);
@@ -1132,30 +1267,136 @@ worker_thread_function(void *data)
 	return NULL;
 }
 
-int
-vaapi_recorder_frame(struct vaapi_recorder *r, int prime_fd, int stride)
+/* Return the queue slot for the next frame, or -1 with errno set if
+ * the encoder failed. */
+static int
+queue_reserve(struct vaapi_recorder *r)
 {
-	int ret = 0;
+	int slot;
 
 	pthread_mutex_lock(&r->mutex);
 
+	/* Wait for the encoder rather than drop a frame; the queue
+	 * absorbs the occasional slow frame without stalling. */
+	while (r->queue.count == RECORDER_QUEUE_LENGTH && !r->error)
+		pthread_cond_wait(&r->space_cond, &r->mutex);
+
 	if (r->error) {
 		errno = r->error;
-		ret = -1;
-		goto unlock;
+		pthread_mutex_unlock(&r->mutex);
+		return -1;
 	}
 
-	/* The mutex is never released while encoding, so this point should
-	 * never be reached if input.valid is true. */
-	assert(!r->input.valid);
+	slot = (r->queue.head + r->queue.count) % RECORDER_QUEUE_LENGTH;
 
-	r->input.prime_fd = prime_fd;
-	r->input.stride = stride;
-	r->input.valid = 1;
-	pthread_cond_signal(&r->input_cond);
+	pthread_mutex_unlock(&r->mutex);
+
+	return slot;
+}
 
-unlock:
+static void
+queue_commit(struct vaapi_recorder *r)
+{
+	pthread_mutex_lock(&r->mutex);
+	r->queue.count++;
+	pthread_cond_signal(&r->input_cond);
 	pthread_mutex_unlock(&r->mutex);
+}
+
+void
+vaapi_recorder_set_rate(struct vaapi_recorder *r, int num, int denom)
+{
+	/* Tc = num_units_in_tick / time_scale, and a frame is two
+	 * ticks.  Only takes effect before the first frame. */
+	r->encoder.param.seq.time_scale = num * 2;
+	r->encoder.param.seq.num_units_in_tick = denom;
+}
+
+/* Drop the import of a buffer about to be destroyed, before anything
+ * else can be allocated at its address */
+void
+vaapi_recorder_forget_buffer(struct vaapi_recorder *r, const void *buffer)
+{
+	int i;
+
+	for (i = 0; i < RECORDER_MAX_IMPORTS; i++) {
+		if (r->vpp.imports[i].surface == VA_INVALID_SURFACE ||
+		    r->vpp.imports[i].buffer != buffer)
+			continue;
+
+		vaDestroySurfaces(r->va_dpy, &r->vpp.imports[i].surface, 1);
+		r->vpp.imports[i].surface = VA_INVALID_SURFACE;
+		r->vpp.imports[i].buffer = NULL;
+	}
+}
+
+int
+vaapi_recorder_frame(struct vaapi_recorder *r, const void *buffer,
+		     int prime_fd, int stride)
+{
+	VASurfaceID rgb_surface;
+	VAStatus status;
+	int slot;
+
+	slot = queue_reserve(r);
+	if (slot < 0) {
+		close(prime_fd);
+		return -1;
+	}
+
+	/* The scanout buffer is converted straight into the queued
+	 * NV12 surface on the GPU, before the compositor can render
+	 * into it again. */
+	status = import_surface(r, buffer, prime_fd, stride, &rgb_surface);
+	if (status != VA_STATUS_SUCCESS) {
+		weston_log("[libva recorder] "
+			   "failed to create surface from bo\n");
+		return 0;
+	}
+
+	status = convert_rgb_to_yuv(r, rgb_surface, r->vpp.output[slot]);
+	if (status != VA_STATUS_SUCCESS) {
+		weston_log("[libva recorder] "
+			   "color space conversion failed\n");
+		return 0;
+	}
+
+	queue_commit(r);
+
+	return 0;
+}
+
+int
+vaapi_recorder_frame_data(struct vaapi_recorder *r, const void *data,
+			  int stride, int bgr)
+{
+	VASurfaceID rgb_surface;
+	VAStatus status;
+	int slot;
 
-	return ret;
+	slot = queue_reserve(r);
+	if (slot < 0)
+		return -1;
+
+	status = upload_surface(r, data, stride, bgr, &rgb_surface);
+	if (status != VA_STATUS_SUCCESS) {
+		weston_log("[libva recorder] failed to upload frame\n");
+		return -1;
+	}
+
+	status = convert_rgb_to_yuv(r, rgb_surface, r->vpp.output[slot]);
+	if (status == VA_STATUS_SUCCESS)
+		status = vaSyncSurface(r->va_dpy, r->vpp.output[slot]);
+	if (status != VA_STATUS_SUCCESS) {
+		weston_log("[libva recorder] "
+			   "color space conversion failed\n");
+		return -1;
+	}
+
+	/* The upload surface is free again once the conversion is
+	 * done, so the caller can move on to the next frame while the
+	 * worker encodes this one. */
+	queue_commit(r);
+
+	return 0;
 }
@@ -33,6 +33,14 @@ vaapi_recorder_create(int drm_fd, int width, int height, const char *filename);
 void
 vaapi_recorder_destroy(struct vaapi_recorder *r);
 int
-vaapi_recorder_frame(struct vaapi_recorder *r, int fd, int stride);
+vaapi_recorder_frame(struct vaapi_recorder *r, const void *buffer,
+		     int fd, int stride);
+void
+vaapi_recorder_forget_buffer(struct vaapi_recorder *r, const void *buffer);
+int
+vaapi_recorder_frame_data(struct vaapi_recorder *r, const void *data,
+			  int stride, int bgr);
+void
+vaapi_recorder_set_rate(struct vaapi_recorder *r, int num, int denom);
 
 #endif /* _VAAPI_RECORDER_H_ */
@@ -25,6 +25,11 @@
 #include <assert.h>
 #include <float.h>
 #include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "vertex-clipping.h"
 
@@ -328,3 +333,225 @@ clip_transformed(struct clip_context *ctx,
 
 	return n;
 }
+
+/* A quad prepared for classifying clip boxes: its bounding box, and
+ * its edges as a * y - b * x + c, non-negative on the inner side. */
+struct clip_quad {
+	const struct polygon8 *polygon;
+	float min_x, min_y, max_x, max_y;
+	float a[4], b[4], c[4];
+	int winding;
+};
+
+enum clip_relation {
+	CLIP_RELATION_OUTSIDE,
+	CLIP_RELATION_QUAD_INSIDE,
+	CLIP_RELATION_BOX_INSIDE,
+	CLIP_RELATION_CROSSING,
+};
+
+static void
+clip_quad_prepare(struct clip_quad *q, const struct polygon8 *polygon)
+{
+	float area = 0.0f;
+	int i, j;
+
+	q->polygon = polygon;
+	q->min_x = q->max_x = polygon->x[0];
+	q->min_y = q->max_y = polygon->y[0];
+	for (i = 1; i < 4; i++) {
+		q->min_x = min(q->min_x, polygon->x[i]);
+		q->max_x = max(q->max_x, polygon->x[i]);
+		q->min_y = min(q->min_y, polygon->y[i]);
+		q->max_y = max(q->max_y, polygon->y[i]);
+	}
+
+	for (i = 0; i < 4; i++) {
+		j = (i + 1) % 4;
+		area += polygon->x[i] * polygon->y[j] -
+			polygon->x[j] * polygon->y[i];
+	}
+
+	/* A degenerate quad always takes the general path */
+	q->winding = area > 0.0f ? 1 : area < 0.0f ? -1 : 0;
+
+	for (i = 0; i < 4; i++) {
+		j = (i + 1) % 4;
+		q->a[i] = (polygon->x[j] - polygon->x[i]) * q->winding;
+		q->b[i] = (polygon->y[j] - polygon->y[i]) * q->winding;
+		q->c[i] = q->b[i] * polygon->x[i] - q->a[i] * polygon->y[i];
+	}
+}
+
+static enum clip_relation
+clip_quad_classify(const struct clip_quad *q, const struct clip_box *box)
+{
+	float cx[4] = { box->x1, box->x2, box->x2, box->x1 };
+	float cy[4] = { box->y1, box->y1, box->y2, box->y2 };
+	int i, k;
+
+	if (q->min_x >= box->x2 || q->max_x <= box->x1 ||
+	    q->min_y >= box->y2 || q->max_y <= box->y1)
+		return CLIP_RELATION_OUTSIDE;
+
+	if (q->min_x >= box->x1 && q->max_x <= box->x2 &&
+	    q->min_y >= box->y1 && q->max_y <= box->y2)
+		return CLIP_RELATION_QUAD_INSIDE;
+
+	if (q->winding == 0)
+		return CLIP_RELATION_CROSSING;
+
+	for (i = 0; i < 4; i++)
+		for (k = 0; k < 4; k++)
+			if (q->a[i] * cy[k] - q->b[i] * cx[k] + q->c[i] < 0.0f)
+				return CLIP_RELATION_CROSSING;
+
+	return CLIP_RELATION_BOX_INSIDE;
+}
+
+#ifdef __SSE2__
+/* The same as clip_quad_classify(), for four boxes at once */
+static void
+clip_quad_classify4(const struct clip_quad *q, const struct clip_box *boxes,
+		    enum clip_relation *relations)
+{
+	__m128i one = _mm_set1_epi32(-1);
+	__m128 x1, y1, x2, y2, e, outside, quad_inside, box_inside;
+	__m128 min_x, max_x, min_y, max_y, a, b, c;
+	int i, out_mask, quad_mask, box_mask;
+
+	x1 = _mm_loadu_ps(&boxes[0].x1);
+	y1 = _mm_loadu_ps(&boxes[1].x1);
+	x2 = _mm_loadu_ps(&boxes[2].x1);
+	y2 = _mm_loadu_ps(&boxes[3].x1);
+	_MM_TRANSPOSE4_PS(x1, y1, x2, y2);
+
+	min_x = _mm_set1_ps(q->min_x);
+	max_x = _mm_set1_ps(q->max_x);
+	min_y = _mm_set1_ps(q->min_y);
+	max_y = _mm_set1_ps(q->max_y);
+
+	outside = _mm_or_ps(_mm_or_ps(_mm_cmpge_ps(min_x, x2),
+				      _mm_cmple_ps(max_x, x1)),
+			    _mm_or_ps(_mm_cmpge_ps(min_y, y2),
+				      _mm_cmple_ps(max_y, y1)));
+	quad_inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(min_x, x1),
+					    _mm_cmple_ps(max_x, x2)),
+				 _mm_and_ps(_mm_cmpge_ps(min_y, y1),
+					    _mm_cmple_ps(max_y, y2)));
+
+	box_inside = _mm_castsi128_ps(one);
+	for (i = 0; i < 4; i++) {
+		a = _mm_set1_ps(q->a[i]);
+		b = _mm_set1_ps(q->b[i]);
+		c = _mm_set1_ps(q->c[i]);
+		e = _mm_min_ps(_mm_sub_ps(_mm_mul_ps(a, y1), _mm_mul_ps(b, x1)),
+			       _mm_sub_ps(_mm_mul_ps(a, y1), _mm_mul_ps(b, x2)));
+		e = _mm_min_ps(e, _mm_sub_ps(_mm_mul_ps(a, y2),
+					     _mm_mul_ps(b, x2)));
+		e = _mm_min_ps(e, _mm_sub_ps(_mm_mul_ps(a, y2),
+					     _mm_mul_ps(b, x1)));
+		box_inside = _mm_and_ps(box_inside,
+					_mm_cmpge_ps(_mm_add_ps(e, c),
+						     _mm_setzero_ps()));
+	}
+
+	out_mask = _mm_movemask_ps(outside);
+	quad_mask = _mm_movemask_ps(quad_inside);
+	box_mask = q->winding ? _mm_movemask_ps(box_inside) : 0;
+
+	for (i = 0; i < 4; i++) {
+		if (out_mask & (1 << i))
+			relations[i] = CLIP_RELATION_OUTSIDE;
+		else if (quad_mask & (1 << i))
+			relations[i] = CLIP_RELATION_QUAD_INSIDE;
+		else if (box_mask & (1 << i))
+			relations[i] = CLIP_RELATION_BOX_INSIDE;
+		else
+			relations[i] = CLIP_RELATION_CROSSING;
+	}
+}
+#endif
+
+static int
+clip_quad_emit(const struct clip_quad *q, const struct clip_box *box,
+	       enum clip_relation relation, int simple, float *ex, float *ey)
+{
+	struct clip_context ctx;
+	struct polygon8 polygon;
+	int n;
+
+	switch (relation) {
+	case CLIP_RELATION_OUTSIDE:
+		return 0;
+	case CLIP_RELATION_QUAD_INSIDE:
+		if (!simple && q->winding == 0)
+			break;
+		memcpy(ex, q->polygon->x, 4 * sizeof *ex);
+		memcpy(ey, q->polygon->y, 4 * sizeof *ey);
+		return 4;
+	case CLIP_RELATION_BOX_INSIDE:
+		/* Box corners in the order the untransformed quad has */
+		ex[0] = ex[3] = box->x1;
+		ex[1] = ex[2] = box->x2;
+		if (q->winding > 0) {
+			ey[0] = ey[1] = box->y1;
+			ey[2] = ey[3] = box->y2;
+		} else {
+			ey[0] = ey[1] = box->y2;
+			ey[2] = ey[3] = box->y1;
+		}
+		return 4;
+	case CLIP_RELATION_CROSSING:
+		break;
+	}
+
+	ctx.clip.x1 = box->x1;
+	ctx.clip.y1 = box->y1;
+	ctx.clip.x2 = box->x2;
+	ctx.clip.y2 = box->y2;
+	polygon = *q->polygon;
+
+	if (simple)
+		return clip_simple(&ctx, &polygon, ex, ey);
+
+	n = clip_transformed(&ctx, &polygon, ex, ey);
+
+	return n < 3 ? 0 : n;
+}
+
+void
+clip_quad_batch(const struct polygon8 *quad, int simple,
+		const struct clip_box *boxes, int n,
+		float *ex, float *ey, int *counts)
+{
+	enum clip_relation relations[4];
+	struct clip_quad q;
+	int i = 0, k, m;
+
+	clip_quad_prepare(&q, quad);
+
+	/* An axis-aligned quad is only clamped, so the bounding box
+	 * tests are all it needs. */
+	if (simple)
+		q.winding = 0;
+
+	while (i < n) {
+#ifdef __SSE2__
+		if (n - i >= 4) {
+			clip_quad_classify4(&q, &boxes[i], relations);
+			m = 4;
+		} else
+#endif
+		{
+			relations[0] = clip_quad_classify(&q, &boxes[i]);
+			m = 1;
+		}
+
+		for (k = 0; k < m; k++, i++)
+			counts[i] = clip_quad_emit(&q, &boxes[i], relations[k],
+						   simple,
+						   ex + i * CLIP_QUAD_MAX_VERTICES,
+						   ey + i * CLIP_QUAD_MAX_VERTICES);
+	}
+}
@@ -63,4 +63,22 @@ clip_transformed(struct clip_context *ctx,
 		 float *ex,
 		 float *ey);\
 
+struct clip_box {
+	float x1, y1;
+	float x2, y2;
+};
+
+#define CLIP_QUAD_MAX_VERTICES 8
+
+/* Clip the convex quad 'quad' (four vertices) against each of the 'n'
+ * boxes.  The polygon for box i is written to ex and ey at offset
+ * i * CLIP_QUAD_MAX_VERTICES, and its vertex count to counts[i]: zero,
+ * or 3-8 vertices in the winding order of the quad.  If 'simple', the
+ * quad is axis-aligned and is clamped to each box as in clip_simple().
+ */
+void
+clip_quad_batch(const struct polygon8 *quad, int simple,
+		const struct clip_box *boxes, int n,
+		float *ex, float *ey, int *counts);
+
 #endif
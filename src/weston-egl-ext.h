@@ -100,6 +100,29 @@ typedef struct wl_buffer * (EGLAPIENTRYP PFNEGLCREATEWAYLANDBUFFERFROMIMAGEWL) (
 #define GL_UNPACK_SKIP_PIXELS_EXT                               0x0CF4
 #endif
 
+/* Tokens for pixel buffer object uploads, core in GLES 3 and provided by
+ * GL_NV_pixel_buffer_object and GL_EXT_map_buffer_range on GLES 2. */
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER					0x88EC
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT					0x0002
+#endif
+#ifndef GL_MAP_INVALIDATE_BUFFER_BIT
+#define GL_MAP_INVALIDATE_BUFFER_BIT				0x0008
+#endif
+
+/* The same extensions provide asynchronous read-back into a buffer */
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER					0x88EB
+#endif
+#ifndef GL_MAP_READ_BIT
+#define GL_MAP_READ_BIT						0x0001
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ						0x88E1
+#endif
+
 /* Define needed tokens from EGL_EXT_image_dma_buf_import extension
  * here to avoid having to add ifdefs everywhere.*/
 #ifndef EGL_EXT_image_dma_buf_import
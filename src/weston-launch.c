@@ -72,6 +72,9 @@
 
 #define MAX_ARGV_SIZE 256
 
+/* The primary GPU plus the [core] secondary-gpus ones */
+#define MAX_DRM_FDS 8
+
 #ifdef HAVE_LIBDRM
 
 #include <xf86drm.h>
@@ -98,7 +101,8 @@ struct weston_launch {
 	int tty;
 	int ttynr;
 	int sock[2];
-	int drm_fd;
+	int drm_fd[MAX_DRM_FDS];
+	int drm_fd_count;
 	int last_input_fd;
 	int kb_mode;
 	struct passwd *pw;
@@ -360,8 +364,9 @@ err0:
 	if (len < 0)
 		return -1;
 
-	if (fd != -1 && major(s.st_rdev) == DRM_MAJOR)
-		wl->drm_fd = fd;
+	if (fd != -1 && major(s.st_rdev) == DRM_MAJOR &&
+	    wl->drm_fd_count < MAX_DRM_FDS)
+		wl->drm_fd[wl->drm_fd_count++] = fd;
 	if (fd != -1 && major(s.st_rdev) == INPUT_MAJOR &&
 	    wl->last_input_fd < fd)
 		wl->last_input_fd = fd;
@@ -405,6 +410,24 @@ handle_socket_msg(struct weston_launch *wl)
 	return ret;
 }
 
+static void
+drop_drm_master(struct weston_launch *wl)
+{
+	int i;
+
+	for (i = 0; i < wl->drm_fd_count; i++)
+		drmDropMaster(wl->drm_fd[i]);
+}
+
+static void
+set_drm_master(struct weston_launch *wl)
+{
+	int i;
+
+	for (i = 0; i < wl->drm_fd_count; i++)
+		drmSetMaster(wl->drm_fd[i]);
+}
+
 static void
 quit(struct weston_launch *wl, int status)
 {
@@ -432,7 +455,7 @@ quit(struct weston_launch *wl, int status)
 	/* We have to drop master before we switch the VT back in
 	 * VT_AUTO, so we don't risk switching to a VT with another
 	 * display server, that will then fail to set drm master. */
-	drmDropMaster(wl->drm_fd);
+	drop_drm_master(wl);
 
 	mode.mode = VT_AUTO;
 	if (ioctl(wl->tty, VT_SETMODE, &mode) < 0)
@@ -496,12 +519,12 @@ handle_signal(struct weston_launch *wl)
 	case SIGUSR1:
 		send_reply(wl, WESTON_LAUNCHER_DEACTIVATE);
 		close_input_fds(wl);
-		drmDropMaster(wl->drm_fd);
+		drop_drm_master(wl);
 		ioctl(wl->tty, VT_RELDISP, 1);
 		break;
 	case SIGUSR2:
 		ioctl(wl->tty, VT_RELDISP, VT_ACKACQ);
-		drmSetMaster(wl->drm_fd);
+		set_drm_master(wl);
 		send_reply(wl, WESTON_LAUNCHER_ACTIVATE);
 		break;
 	default:
@@ -33,6 +33,20 @@
 #include "text-cursor-position-server-protocol.h"
 #include "shared/helpers.h"
 
+/* Only the output matrix changes with the zoom. A renderer that keeps
+ * the unzoomed output offscreen just draws it scaled again, others
+ * have to repaint everything. */
+static void
+weston_zoom_invalidate(struct weston_output *output)
+{
+	output->dirty = 1;
+
+	if (output->compositor->capabilities & WESTON_CAP_ZOOM_OFFSCREEN)
+		weston_output_schedule_repaint(output);
+	else
+		weston_output_damage(output);
+}
+
 static void
 weston_zoom_frame_z(struct weston_animation *animation,
 		struct weston_output *output, uint32_t msecs)
@@ -53,14 +67,16 @@ weston_zoom_frame_z(struct weston_animation *animation,
 			output->zoom.seat = NULL;
 			output->disable_planes--;
 			wl_list_remove(&output->zoom.motion_listener.link);
+			/* back to drawing the views directly */
+			output->dirty = 1;
+			weston_output_damage(output);
 		}
 		output->zoom.spring_z.current = output->zoom.level;
 		wl_list_remove(&animation->link);
 		wl_list_init(&animation->link);
 	}
 
-	output->dirty = 1;
-	weston_output_damage(output);
+	weston_zoom_invalidate(output);
 }
 
 static void
@@ -121,8 +137,7 @@ weston_zoom_transition(struct weston_output *output)
 		}
 	}
 
-	output->dirty = 1;
-	weston_output_damage(output);
+	weston_zoom_invalidate(output);
 }
 
 WL_EXPORT void
@@ -133,10 +148,16 @@ weston_output_update_zoom(struct weston_output *output)
 
 	assert(output->zoom.active);
 
-	output->zoom.current.x = pointer->x;
-	output->zoom.current.y = pointer->y;
+	/* Also called when the output matrix is rebuilt, with nothing
+	 * to redraw unless the pointer or the level moved since */
+	if (output->zoom.current.x != pointer->x ||
+	    output->zoom.current.y != pointer->y ||
+	    output->zoom.level != output->zoom.spring_z.current) {
+		output->zoom.current.x = pointer->x;
+		output->zoom.current.y = pointer->y;
+		weston_zoom_transition(output);
+	}
 
-	weston_zoom_transition(output);
 	weston_output_update_zoom_transform(output);
 }
 
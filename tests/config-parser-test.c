@@ -166,6 +166,22 @@ static struct zuc_fixture config_test_t4 = {
 	.set_up = setup_test_config_failing,
 };
 
+static struct zuc_fixture config_test_t5 = {
+	.data =
+	"[output]\n"
+	"name=A\n"
+	"scale=2\n"
+	"scale=3\n"
+	"[output]\n"
+	"name=B\n"
+	"scale=x\n"
+	"[output]\n"
+	"name=C\n"
+	"mode=1920x1080",
+	.set_up = setup_test_config,
+	.tear_down = cleanup_test_config
+};
+
 ZUC_TEST_F(config_test_t0, comment_only)
 {
 	struct weston_config *config = data;
@@ -445,6 +461,57 @@ ZUC_TEST_F(config_test_t4, doesnt_parse)
 	ZUC_ASSERT_NULL(config);
 }
 
+ZUC_TEST_F(config_test_t5, first_duplicate_key)
+{
+	int r;
+	int32_t n;
+	struct weston_config_section *section;
+	struct weston_config *config = data;
+
+	section = weston_config_get_section(config, "output", "name", "A");
+	r = weston_config_section_get_int(section, "scale", &n, 1);
+
+	ZUC_ASSERT_EQ(0, r);
+	ZUC_ASSERT_EQ(2, n);
+}
+
+ZUC_TEST_F(config_test_t5, invalid_value_cached)
+{
+	int r, i;
+	int32_t n;
+	struct weston_config_section *section;
+	struct weston_config *config = data;
+
+	section = weston_config_get_section(config, "output", "name", "B");
+	ZUC_ASSERT_NOT_NULL(section);
+
+	/* The second lookup comes from the cached conversion */
+	for (i = 0; i < 2; i++) {
+		errno = 0;
+		r = weston_config_section_get_int(section, "scale", &n, 1);
+		ZUC_ASSERT_EQ(-1, r);
+		ZUC_ASSERT_EQ(EINVAL, errno);
+		ZUC_ASSERT_EQ(1, n);
+	}
+}
+
+ZUC_TEST_F(config_test_t5, last_line_without_newline)
+{
+	char *s;
+	int r;
+	struct weston_config_section *section;
+	struct weston_config *config = data;
+
+	section = weston_config_get_section(config, "output", "name", "C");
+	r = weston_config_section_get_string(section, "mode", &s, NULL);
+
+	ZUC_ASSERTG_EQ(0, r, out_free);
+	ZUC_ASSERTG_STREQ("1920x1080", s, out_free);
+
+out_free:
+	free(s);
+}
+
 ZUC_TEST(config_test, destroy_null)
 {
 	weston_config_destroy(NULL);
@@ -0,0 +1,130 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "src/compositor.h"
+
+#define DAMAGE_RECTS 400
+
+/* Scattered small damage, as from a busy terminal or spreadsheet */
+static void
+fragmented_region(pixman_region32_t *region)
+{
+	int i;
+
+	srand(11);
+	pixman_region32_init(region);
+	for (i = 0; i < DAMAGE_RECTS; i++)
+		pixman_region32_union_rect(region, region,
+					   rand() % 1920, rand() % 1080,
+					   1 + rand() % 40, 1 + rand() % 40);
+}
+
+static void
+check_covers(pixman_region32_t *coarse, pixman_region32_t *damage)
+{
+	pixman_region32_t missing;
+
+	pixman_region32_init(&missing);
+	pixman_region32_subtract(&missing, damage, coarse);
+	assert(!pixman_region32_not_empty(&missing));
+	pixman_region32_fini(&missing);
+}
+
+static void
+check_max_rects(pixman_region32_t *damage, int max_rects)
+{
+	pixman_region32_t coarse;
+
+	pixman_region32_init(&coarse);
+	pixman_region32_copy(&coarse, damage);
+	weston_region_coarsen(&coarse, max_rects);
+
+	assert(pixman_region32_n_rects(&coarse) <= max_rects);
+	check_covers(&coarse, damage);
+
+	pixman_region32_fini(&coarse);
+}
+
+/* Rectangles in one band, gap pixels apart */
+static int
+coarsened_band_rects(int gap)
+{
+	pixman_region32_t region;
+	int n;
+
+	pixman_region32_init_rect(&region, 0, 0, 10, 10);
+	pixman_region32_union_rect(&region, &region, 10 + gap, 0, 10, 10);
+	weston_region_coarsen(&region, 64);
+	n = pixman_region32_n_rects(&region);
+	pixman_region32_fini(&region);
+
+	return n;
+}
+
+static void
+damage_coarsen(void *data)
+{
+	struct weston_compositor *compositor = data;
+	pixman_region32_t damage, copy;
+	int max_rects;
+
+	fragmented_region(&damage);
+	assert(pixman_region32_n_rects(&damage) > 64);
+
+	for (max_rects = 1; max_rects <= 256; max_rects *= 2)
+		check_max_rects(&damage, max_rects);
+
+	/* A limit of 0 leaves the region alone */
+	pixman_region32_init(&copy);
+	pixman_region32_copy(&copy, &damage);
+	weston_region_coarsen(&copy, 0);
+	assert(pixman_region32_equal(&copy, &damage));
+	pixman_region32_fini(&copy);
+
+	/* Close rectangles merge, distant ones are not worth it */
+	assert(coarsened_band_rects(5) == 1);
+	assert(coarsened_band_rects(1000) == 2);
+
+	pixman_region32_fini(&damage);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, damage_coarsen, compositor);
+
+	return 0;
+}
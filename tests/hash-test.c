@@ -0,0 +1,134 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "weston-test-runner.h"
+#include "xwayland/hash.h"
+
+/* X clients get a resource id base with the low 21 bits free; model a
+ * few of them creating and destroying windows. */
+#define CLIENT_BASE(c) (((uint32_t)(c) + 1) << 21)
+#define N_CLIENTS 8
+#define N_WINDOWS 512
+
+static void *
+value_for(uint32_t id)
+{
+	return (void *)(uintptr_t)(id | 1);
+}
+
+TEST(hash_insert_lookup_remove)
+{
+	struct hash_table *ht;
+	uint32_t id;
+
+	ht = hash_table_create();
+	assert(ht);
+
+	for (id = 1; id <= 1000; id++)
+		assert(hash_table_insert(ht, id, value_for(id)) == 0);
+
+	for (id = 1; id <= 1000; id++)
+		assert(hash_table_lookup(ht, id) == value_for(id));
+	assert(hash_table_lookup(ht, 1001) == NULL);
+
+	/* Remove every other one, the rest must stay reachable */
+	for (id = 1; id <= 1000; id += 2)
+		hash_table_remove(ht, id);
+
+	for (id = 1; id <= 1000; id++) {
+		if (id & 1)
+			assert(hash_table_lookup(ht, id) == NULL);
+		else
+			assert(hash_table_lookup(ht, id) == value_for(id));
+	}
+
+	hash_table_destroy(ht);
+}
+
+static void
+count_element(void *element, void *data)
+{
+	int *count = data;
+
+	(*count)++;
+}
+
+TEST(hash_churn)
+{
+	static uint32_t live[N_CLIENTS * N_WINDOWS];
+	struct hash_table *ht;
+	uint32_t next[N_CLIENTS] = { 0 };
+	unsigned i, n_live = 0;
+	unsigned round;
+	int count;
+
+	ht = hash_table_create();
+	assert(ht);
+
+	srand(1);
+
+	for (round = 0; round < 200000; round++) {
+		unsigned c = rand() % N_CLIENTS;
+		uint32_t id;
+
+		if (n_live < N_CLIENTS * N_WINDOWS && (rand() & 1)) {
+			id = CLIENT_BASE(c) | ++next[c];
+			assert(hash_table_lookup(ht, id) == NULL);
+			assert(hash_table_insert(ht, id, value_for(id)) == 0);
+			live[n_live++] = id;
+		} else if (n_live > 0) {
+			i = rand() % n_live;
+			id = live[i];
+			assert(hash_table_lookup(ht, id) == value_for(id));
+			hash_table_remove(ht, id);
+			assert(hash_table_lookup(ht, id) == NULL);
+			live[i] = live[--n_live];
+		}
+
+		/* The window manager looks up the same window for a burst
+		 * of events. */
+		if (n_live > 0) {
+			id = live[rand() % n_live];
+			for (i = 0; i < 4; i++)
+				assert(hash_table_lookup(ht, id) ==
+				       value_for(id));
+		}
+	}
+
+	for (i = 0; i < n_live; i++)
+		assert(hash_table_lookup(ht, live[i]) == value_for(live[i]));
+
+	count = 0;
+	hash_table_for_each(ht, count_element, &count);
+	assert(count == (int)n_live);
+
+	hash_table_destroy(ht);
+}
@@ -197,6 +197,37 @@ test_layer_visibility(struct test_context *ctx)
 	ctl->layer_destroy(ivilayer);
 }
 
+static void
+test_layer_cacheable(struct test_context *ctx)
+{
+	const struct ivi_controller_interface *ctl = ctx->controller_interface;
+	struct ivi_layout_layer *ivilayer;
+	const struct ivi_layout_layer_properties *prop;
+
+	ivilayer = ctl->layer_create_with_dimension(IVI_TEST_LAYER_ID(0), 200, 300);
+	iassert(ivilayer != NULL);
+
+	prop = ctl->get_properties_of_layer(ivilayer);
+	iassert(prop->cacheable == false);
+
+	iassert(ctl->layer_set_cacheable(ivilayer, true) == IVI_SUCCEEDED);
+	iassert(prop->cacheable == false);
+
+	ctl->commit_changes();
+
+	iassert(prop->cacheable == true);
+
+	ctl->layer_destroy(ivilayer);
+}
+
+static void
+test_layer_bad_cacheable(struct test_context *ctx)
+{
+	const struct ivi_controller_interface *ctl = ctx->controller_interface;
+
+	iassert(ctl->layer_set_cacheable(NULL, true) == IVI_FAILED);
+}
+
 static void
 test_layer_opacity(struct test_context *ctx)
 {
@@ -958,6 +989,119 @@ test_layer_properties_changed_notification(struct test_context *ctx)
 	ctl->layer_destroy(ivilayer);
 }
 
+static void
+test_commit_notification_callback(const struct ivi_layout_surface_change *surfaces,
+				  int32_t surface_count,
+				  const struct ivi_layout_layer_change *layers,
+				  int32_t layer_count,
+				  void *userdata)
+{
+	struct test_context *ctx = userdata;
+	const struct ivi_controller_interface *ctl = ctx->controller_interface;
+	int32_t i;
+
+	iassert(surface_count == 0);
+
+	for (i = 0; i < layer_count; i++) {
+		iassert(layers[i].mask & IVI_NOTIFICATION_OPACITY);
+		iassert(layers[i].mask & IVI_NOTIFICATION_VISIBILITY);
+		iassert(!(layers[i].mask & IVI_NOTIFICATION_POSITION));
+		if (ctl->get_id_of_layer(layers[i].ivilayer) == IVI_TEST_LAYER_ID(0))
+			ctx->user_flags |= 1 << 0;
+		if (ctl->get_id_of_layer(layers[i].ivilayer) == IVI_TEST_LAYER_ID(1))
+			ctx->user_flags |= 1 << 1;
+	}
+
+	/* count the calls in the upper bits */
+	ctx->user_flags += 1 << 8;
+}
+
+static void
+test_commit_notification(struct test_context *ctx)
+{
+	const struct ivi_controller_interface *ctl = ctx->controller_interface;
+	struct ivi_layout_layer *ivilayers[2];
+	int i;
+
+	ivilayers[0] = ctl->layer_create_with_dimension(IVI_TEST_LAYER_ID(0), 200, 300);
+	ivilayers[1] = ctl->layer_create_with_dimension(IVI_TEST_LAYER_ID(1), 200, 300);
+	ctl->commit_changes();
+
+	ctx->user_flags = 0;
+	iassert(ctl->add_notification_commit(
+		    test_commit_notification_callback, ctx) == IVI_SUCCEEDED);
+
+	/* nothing changed, no call */
+	ctl->commit_changes();
+	iassert(ctx->user_flags == 0);
+
+	/* one call for both layers, each with both changes in its mask */
+	for (i = 0; i < 2; i++) {
+		iassert(ctl->layer_set_opacity(
+			    ivilayers[i], wl_fixed_from_double(0.5)) == IVI_SUCCEEDED);
+		iassert(ctl->layer_set_visibility(ivilayers[i], true) == IVI_SUCCEEDED);
+	}
+	ctl->commit_changes();
+	iassert(ctx->user_flags == ((1 << 8) | (1 << 1) | (1 << 0)));
+
+	ctl->remove_notification_commit(test_commit_notification_callback, ctx);
+
+	ctx->user_flags = 0;
+	iassert(ctl->layer_set_opacity(
+		    ivilayers[0], wl_fixed_from_double(1.0)) == IVI_SUCCEEDED);
+	ctl->commit_changes();
+	iassert(ctx->user_flags == 0);
+
+	ctl->layer_destroy(ivilayers[0]);
+	ctl->layer_destroy(ivilayers[1]);
+}
+
+static void
+test_commit_bad_notification(struct test_context *ctx)
+{
+	const struct ivi_controller_interface *ctl = ctx->controller_interface;
+
+	iassert(ctl->add_notification_commit(NULL, NULL) == IVI_FAILED);
+}
+
+static void
+test_surface_bad_apply_updates(struct test_context *ctx)
+{
+	const struct ivi_controller_interface *ctl = ctx->controller_interface;
+	struct ivi_layout_surface_update update = {
+		.ivisurf = NULL,
+		.mask = IVI_LAYOUT_SURFACE_UPDATE_VISIBILITY,
+		.visibility = true,
+	};
+
+	iassert(ctl->surface_apply_updates(NULL, 1) == IVI_FAILED);
+	iassert(ctl->surface_apply_updates(&update, -1) == IVI_FAILED);
+	iassert(ctl->surface_apply_updates(&update, 1) == IVI_FAILED);
+	iassert(ctl->surface_apply_updates(NULL, 0) == IVI_SUCCEEDED);
+}
+
+static void
+test_surface_dump_async_callback(void *target, int32_t width, int32_t height,
+				 int32_t result, void *userdata)
+{
+	struct test_context *ctx = userdata;
+
+	ctx->user_flags = 1;
+}
+
+static void
+test_surface_bad_dump_async(struct test_context *ctx)
+{
+	const struct ivi_controller_interface *ctl = ctx->controller_interface;
+	uint32_t pixels[16];
+
+	ctx->user_flags = 0;
+	iassert(ctl->surface_dump_async(NULL, pixels, sizeof pixels, 4, 4,
+					test_surface_dump_async_callback,
+					ctx) == IVI_FAILED);
+	iassert(ctx->user_flags == 0);
+}
+
 static void
 test_layer_create_notification_callback(struct ivi_layout_layer *ivilayer,
 					void *userdata)
@@ -1127,6 +1271,8 @@ run_internal_tests(void *data)
 
 	test_layer_create(ctx);
 	test_layer_visibility(ctx);
+	test_layer_cacheable(ctx);
+	test_layer_bad_cacheable(ctx);
 	test_layer_opacity(ctx);
 	test_layer_orientation(ctx);
 	test_layer_dimension(ctx);
@@ -1168,6 +1314,10 @@ run_internal_tests(void *data)
 	test_surface_bad_create_notification(ctx);
 	test_layer_bad_remove_notification(ctx);
 	test_surface_bad_remove_notification(ctx);
+	test_commit_notification(ctx);
+	test_commit_bad_notification(ctx);
+	test_surface_bad_dump_async(ctx);
+	test_surface_bad_apply_updates(ctx);
 
 	weston_compositor_exit_with_code(ctx->compositor, EXIT_SUCCESS);
 	free(ctx);
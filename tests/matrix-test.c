@@ -357,6 +357,7 @@ test_loop_speed_invert_explicit(void)
 	printf("\nRunning 3 s test on weston_matrix_invert()...\n");
 
 	weston_matrix_init(&m);
+	m.type = WESTON_MATRIX_TRANSFORM_OTHER;
 
 	running = 1;
 	alarm(3);
@@ -371,6 +372,105 @@ test_loop_speed_invert_explicit(void)
 	       count, t, 1e9 * t / count);
 }
 
+static void __attribute__((noinline))
+test_loop_speed_invert_scale_translate(void)
+{
+	struct weston_matrix m;
+	unsigned long count = 0;
+	double t;
+
+	printf("\nRunning 3 s test on weston_matrix_invert(), "
+	       "scale and translation...\n");
+
+	weston_matrix_init(&m);
+	weston_matrix_scale(&m, 2.0f, 0.5f, 1.0f);
+	weston_matrix_translate(&m, 100.0f, 20.0f, 0.0f);
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		weston_matrix_invert(&m, &m);
+		count++;
+	}
+	t = read_timer();
+
+	printf("%lu iterations in %f seconds, avg. %.1f ns/iter.\n",
+	       count, t, 1e9 * t / count);
+}
+
+static void __attribute__((noinline))
+test_loop_speed_multiply(void)
+{
+	struct weston_matrix m, n;
+	unsigned long count = 0;
+	double t;
+
+	printf("\nRunning 3 s test on weston_matrix_multiply()...\n");
+
+	weston_matrix_init(&m);
+	weston_matrix_init(&n);
+	weston_matrix_rotate_xy(&n, 0.6f, 0.8f);
+
+	running = 1;
+	alarm(3);
+	reset_timer();
+	while (running) {
+		weston_matrix_multiply(&m, &n);
+		count++;
+	}
+	t = read_timer();
+
+	printf("%lu iterations in %f seconds, avg. %.1f ns/iter.\n",
+	       count, t, 1e9 * t / count);
+}
+
+/* The scale and translation fast paths have to agree with the general
+ * code, which is what the same matrix marked OTHER goes through. */
+static int
+test_scale_translate_paths(void)
+{
+	struct weston_matrix a, b, general, p, q, inv_b, inv_general;
+	float sx, sy;
+	int i, j, failed = 0;
+
+	for (i = 0; i < 100000; i++) {
+		randomize_matrix(&a);
+		a.type = WESTON_MATRIX_TRANSFORM_OTHER;
+
+		sx = frand() * 4.0f;
+		sy = frand() * 4.0f;
+		if (fabs(sx) < 1e-3 || fabs(sy) < 1e-3)
+			continue;
+
+		weston_matrix_init(&b);
+		weston_matrix_scale(&b, sx, sy, 1.0f);
+		weston_matrix_translate(&b, frand() * 1000.0f,
+					frand() * 1000.0f, 0.0f);
+		general = b;
+		general.type = WESTON_MATRIX_TRANSFORM_OTHER;
+
+		p = a;
+		weston_matrix_multiply(&p, &b);
+		q = a;
+		weston_matrix_multiply(&q, &general);
+
+		weston_matrix_invert(&inv_b, &b);
+		weston_matrix_invert(&inv_general, &general);
+
+		for (j = 0; j < 16; j++) {
+			if (p.d[j] != q.d[j] ||
+			    fabs(inv_b.d[j] - inv_general.d[j]) >
+			    1e-6 * (1.0 + fabs(inv_general.d[j])))
+				failed++;
+		}
+	}
+
+	printf("scale and translation fast paths: %d mismatches\n", failed);
+
+	return failed;
+}
+
 int main(void)
 {
 	struct sigaction ding;
@@ -414,11 +514,16 @@ int main(void)
 	print_matrix(&M);
 	printf("max abs error: %g, original determinant %g\n", errsup, det);
 
+	if (test_scale_translate_paths() != 0)
+		return 1;
+
 	test_loop_precision();
 	test_loop_speed_matrixvector();
 	test_loop_speed_inversetransform();
 	test_loop_speed_invert();
 	test_loop_speed_invert_explicit();
+	test_loop_speed_invert_scale_translate();
+	test_loop_speed_multiply();
 
 	return 0;
 }
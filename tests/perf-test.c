@@ -0,0 +1,316 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Compositor benchmarks, run with "make check-perf" rather than as
+ * part of "make check".  Each benchmark writes one JSON object per
+ * line to the file named by WESTON_PERF_RESULTS, or to stdout.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+#include <linux/input.h>
+
+#include "shared/helpers.h"
+#include "weston-test-client-helper.h"
+
+/* The pixman renderer gives the screenshot something to read back;
+ * refresh=0 keeps the virtual vblank from dominating latencies. */
+char *server_parameters = "--use-pixman --width=1024 --height=640 "
+			  "--refresh=0";
+
+#define PERF_ITERATIONS 200
+#define PERF_INPUT_EVENTS 2000
+#define PERF_SCREENSHOTS 20
+#define PERF_SUBSURFACES 8
+
+static uint64_t
+perf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static FILE *
+perf_open_results(void)
+{
+	const char *path = getenv("WESTON_PERF_RESULTS");
+	FILE *fp;
+
+	if (!path)
+		return stdout;
+
+	fp = fopen(path, "a");
+	assert(fp && "cannot open WESTON_PERF_RESULTS");
+
+	return fp;
+}
+
+static void
+perf_close_results(FILE *fp)
+{
+	if (fp != stdout)
+		fclose(fp);
+	else
+		fflush(fp);
+}
+
+static int
+compare_uint64(const void *a, const void *b)
+{
+	const uint64_t *x = a, *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+/* Latencies are reported in microseconds */
+static void
+perf_report_latency(const char *name, uint64_t *samples, int n)
+{
+	uint64_t sum = 0;
+	FILE *fp;
+	int i;
+
+	qsort(samples, n, sizeof *samples, compare_uint64);
+	for (i = 0; i < n; i++)
+		sum += samples[i];
+
+	fp = perf_open_results();
+	fprintf(fp, "{\"benchmark\": \"%s\", \"iterations\": %d, "
+		"\"unit\": \"usec\", \"min\": %.1f, \"median\": %.1f, "
+		"\"p95\": %.1f, \"max\": %.1f, \"mean\": %.1f}\n",
+		name, n, samples[0] / 1e3, samples[n / 2] / 1e3,
+		samples[n * 95 / 100] / 1e3, samples[n - 1] / 1e3,
+		sum / 1e3 / n);
+	perf_close_results(fp);
+}
+
+static void
+perf_report_rate(const char *name, const char *unit, double count,
+		 uint64_t nsec)
+{
+	FILE *fp;
+
+	fp = perf_open_results();
+	fprintf(fp, "{\"benchmark\": \"%s\", \"unit\": \"%s\", "
+		"\"value\": %.1f, \"seconds\": %.3f}\n",
+		name, unit, count * 1e9 / nsec, nsec / 1e9);
+	perf_close_results(fp);
+}
+
+static void
+commit_and_wait(struct client *client, struct wl_surface *surface)
+{
+	int done;
+
+	frame_callback_set(surface, &done);
+	wl_surface_commit(surface);
+	frame_callback_wait(client, &done);
+}
+
+TEST(perf_commit_to_frame_callback)
+{
+	struct client *client;
+	struct surface *surface;
+	uint64_t samples[PERF_ITERATIONS], start;
+	int i;
+
+	client = create_client_and_test_surface(100, 100, 256, 256);
+	assert(client);
+	surface = client->surface;
+
+	for (i = 0; i < PERF_ITERATIONS; i++) {
+		wl_surface_attach(surface->wl_surface, surface->wl_buffer,
+				  0, 0);
+		wl_surface_damage(surface->wl_surface, 0, 0,
+				  surface->width, surface->height);
+
+		start = perf_now();
+		commit_and_wait(client, surface->wl_surface);
+		samples[i] = perf_now() - start;
+	}
+
+	perf_report_latency("commit_to_frame_callback",
+			    samples, PERF_ITERATIONS);
+}
+
+TEST(perf_key_dispatch)
+{
+	struct client *client;
+	struct keyboard *keyboard;
+	uint64_t start;
+	int i;
+
+	client = create_client_and_test_surface(100, 100, 64, 64);
+	assert(client);
+	keyboard = client->input->keyboard;
+
+	weston_test_activate_surface(client->test->weston_test,
+				     client->surface->wl_surface);
+	client_roundtrip(client);
+	assert(keyboard->focus == client->surface);
+
+	start = perf_now();
+	for (i = 0; i < PERF_INPUT_EVENTS; i += 2) {
+		weston_test_send_key(client->test->weston_test, KEY_A,
+				     WL_KEYBOARD_KEY_STATE_PRESSED);
+		weston_test_send_key(client->test->weston_test, KEY_A,
+				     WL_KEYBOARD_KEY_STATE_RELEASED);
+	}
+	client_roundtrip(client);
+	perf_report_rate("key_dispatch", "events/s",
+			 PERF_INPUT_EVENTS, perf_now() - start);
+
+	assert(keyboard->key == KEY_A);
+	assert(keyboard->state == WL_KEYBOARD_KEY_STATE_RELEASED);
+}
+
+TEST(perf_pointer_dispatch)
+{
+	struct client *client;
+	struct pointer *pointer;
+	uint64_t start;
+	int i;
+
+	client = create_client_and_test_surface(100, 100, 200, 200);
+	assert(client);
+	pointer = client->input->pointer;
+
+	/* Every motion stays inside the surface, so each one reaches
+	 * the client as a wl_pointer.motion. */
+	start = perf_now();
+	for (i = 0; i < PERF_INPUT_EVENTS; i++)
+		weston_test_move_pointer(client->test->weston_test,
+					 110 + i % 180, 110 + i % 170);
+	client_roundtrip(client);
+	perf_report_rate("pointer_dispatch", "events/s",
+			 PERF_INPUT_EVENTS, perf_now() - start);
+
+	assert(pointer->focus == client->surface);
+}
+
+TEST(perf_subsurface_commit)
+{
+	struct client *client;
+	struct global *g;
+	struct wl_subcompositor *subco = NULL;
+	struct wl_surface *child[PERF_SUBSURFACES];
+	struct wl_subsurface *sub[PERF_SUBSURFACES];
+	struct wl_buffer *buffer;
+	struct wl_surface *parent;
+	uint64_t samples[PERF_ITERATIONS], start;
+	void *pixels;
+	int i, j;
+
+	client = create_client_and_test_surface(100, 100, 256, 256);
+	assert(client);
+	parent = client->surface->wl_surface;
+
+	wl_list_for_each(g, &client->global_list, link)
+		if (strcmp(g->interface, "wl_subcompositor") == 0)
+			subco = wl_registry_bind(client->wl_registry, g->name,
+						 &wl_subcompositor_interface,
+						 1);
+	assert(subco);
+
+	buffer = create_shm_buffer(client, 32, 32, &pixels);
+	memset(pixels, 0x80, 32 * 32 * 4);
+
+	for (j = 0; j < PERF_SUBSURFACES; j++) {
+		child[j] = wl_compositor_create_surface(client->wl_compositor);
+		sub[j] = wl_subcompositor_get_subsurface(subco, child[j],
+							 parent);
+		wl_subsurface_set_position(sub[j], (j % 4) * 40,
+					   (j / 4) * 40);
+	}
+
+	/* Synchronized children: their commits only take effect with
+	 * the parent's, which is what toolkits mostly do. */
+	for (i = 0; i < PERF_ITERATIONS; i++) {
+		start = perf_now();
+		for (j = 0; j < PERF_SUBSURFACES; j++) {
+			wl_surface_attach(child[j], buffer, 0, 0);
+			wl_surface_damage(child[j], 0, 0, 32, 32);
+			wl_surface_commit(child[j]);
+		}
+		wl_surface_attach(parent, client->surface->wl_buffer, 0, 0);
+		wl_surface_damage(parent, 0, 0, 256, 256);
+		commit_and_wait(client, parent);
+		samples[i] = perf_now() - start;
+	}
+
+	perf_report_latency("subsurface_commit", samples, PERF_ITERATIONS);
+
+	for (j = 0; j < PERF_SUBSURFACES; j++) {
+		wl_subsurface_destroy(sub[j]);
+		wl_surface_destroy(child[j]);
+	}
+	wl_buffer_destroy(buffer);
+	wl_subcompositor_destroy(subco);
+}
+
+TEST(perf_screenshot_readback)
+{
+	struct client *client;
+	struct wl_buffer *buffer;
+	uint64_t start, elapsed;
+	void *pixels;
+	int i, width, height;
+
+	client = create_client_and_test_surface(100, 100, 64, 64);
+	assert(client);
+
+	width = client->output->width;
+	height = client->output->height;
+	buffer = create_shm_buffer(client, width, height, &pixels);
+
+	start = perf_now();
+	for (i = 0; i < PERF_SCREENSHOTS; i++) {
+		client->test->buffer_copy_done = 0;
+		weston_test_capture_screenshot(client->test->weston_test,
+					       client->output->wl_output,
+					       buffer);
+		while (client->test->buffer_copy_done == 0)
+			assert(wl_display_dispatch(client->wl_display) >= 0);
+	}
+	elapsed = perf_now() - start;
+
+	perf_report_rate("screenshot_readback", "frames/s",
+			 PERF_SCREENSHOTS, elapsed);
+	perf_report_rate("screenshot_readback_bandwidth", "MiB/s",
+			 PERF_SCREENSHOTS * (double) width * height * 4 /
+			 (1024 * 1024), elapsed);
+
+	wl_buffer_destroy(buffer);
+}
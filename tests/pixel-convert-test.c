@@ -0,0 +1,118 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+#include "src/pixel-convert.h"
+
+#define WIDTH 131
+
+/* What pixman's generic fetch and store do for PIXMAN_OP_SRC, one
+ * pixel at a time. */
+static void
+reference_r5g6b5(uint16_t *dst, const uint32_t *src, int n)
+{
+	uint32_t r, g, b;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		r = (src[i] >> 16) & 0xff;
+		g = (src[i] >> 8) & 0xff;
+		b = src[i] & 0xff;
+		dst[i] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+	}
+}
+
+static void
+reference_r8g8b8(uint8_t *dst, const uint32_t *src, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		dst[i * 3 + 0] = src[i] & 0xff;
+		dst[i * 3 + 1] = (src[i] >> 8) & 0xff;
+		dst[i * 3 + 2] = (src[i] >> 16) & 0xff;
+	}
+}
+
+static void
+fill_random(uint32_t *p, int n)
+{
+	int i;
+
+	srand(n);
+	for (i = 0; i < n; i++)
+		p[i] = (uint32_t) rand() << 16 ^ rand();
+}
+
+/* Every length and start offset up to a few vectors, so both the
+ * vector loops and their scalar tails are covered, with guard words
+ * checking nothing is written past the end. */
+TEST(convert_r5g6b5_matches_reference)
+{
+	uint32_t src[WIDTH];
+	uint16_t out[WIDTH + 8], ref[WIDTH + 8];
+	int offset, n;
+
+	fill_random(src, WIDTH);
+
+	for (offset = 0; offset < 8; offset++) {
+		for (n = 0; n + offset <= WIDTH; n++) {
+			memset(out, 0xa5, sizeof out);
+			memset(ref, 0xa5, sizeof ref);
+			pixel_convert_x8r8g8b8_to_r5g6b5(out + offset,
+							 src + offset, n);
+			reference_r5g6b5(ref + offset, src + offset, n);
+			assert(memcmp(out, ref, sizeof out) == 0);
+		}
+	}
+}
+
+TEST(convert_r8g8b8_matches_reference)
+{
+	uint32_t src[WIDTH];
+	uint8_t out[WIDTH * 3 + 8], ref[WIDTH * 3 + 8];
+	int offset, n;
+
+	fill_random(src, WIDTH);
+
+	for (offset = 0; offset < 8; offset++) {
+		for (n = 0; n + offset <= WIDTH; n++) {
+			memset(out, 0xa5, sizeof out);
+			memset(ref, 0xa5, sizeof ref);
+			pixel_convert_x8r8g8b8_to_r8g8b8(out + offset * 3,
+							 src + offset, n);
+			reference_r8g8b8(ref + offset * 3, src + offset, n);
+			assert(memcmp(out, ref, sizeof out) == 0);
+		}
+	}
+}
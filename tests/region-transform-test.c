@@ -0,0 +1,164 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "src/compositor.h"
+
+#define OUTPUT_X 1920
+#define OUTPUT_WIDTH 1920
+#define OUTPUT_HEIGHT 1080
+#define DAMAGE_RECTS 400
+
+/* Scattered small damage, as from a busy desktop */
+static void
+fragmented_region(pixman_region32_t *region)
+{
+	int i;
+
+	srand(7);
+	pixman_region32_init(region);
+	for (i = 0; i < DAMAGE_RECTS; i++)
+		pixman_region32_union_rect(region, region,
+					   OUTPUT_X + rand() % OUTPUT_WIDTH,
+					   rand() % OUTPUT_HEIGHT,
+					   1 + rand() % 40, 1 + rand() % 40);
+}
+
+/* Every box through weston_matrix_transform_rect(), as
+ * weston_matrix_transform_region() did for all matrices. */
+static void
+reference_transform_region(pixman_region32_t *dest,
+			   struct weston_matrix *matrix,
+			   pixman_region32_t *src)
+{
+	pixman_box32_t *src_rects, *dest_rects;
+	int nrects, i;
+
+	src_rects = pixman_region32_rectangles(src, &nrects);
+	dest_rects = malloc(nrects * sizeof(*dest_rects));
+	assert(dest_rects);
+
+	for (i = 0; i < nrects; i++)
+		dest_rects[i] = weston_matrix_transform_rect(matrix, src_rects[i]);
+
+	pixman_region32_init_rects(dest, dest_rects, nrects);
+	free(dest_rects);
+}
+
+/* The matrix weston_output_update_matrix() builds, without zoom */
+static void
+output_matrix(struct weston_matrix *matrix, uint32_t transform, int scale)
+{
+	weston_matrix_init(matrix);
+	weston_matrix_translate(matrix, -OUTPUT_X, 0, 0);
+
+	if (transform & WL_OUTPUT_TRANSFORM_FLIPPED) {
+		weston_matrix_translate(matrix, -OUTPUT_WIDTH, 0, 0);
+		weston_matrix_scale(matrix, -1, 1, 1);
+	}
+
+	switch (transform & ~WL_OUTPUT_TRANSFORM_FLIPPED) {
+	case WL_OUTPUT_TRANSFORM_90:
+		weston_matrix_translate(matrix, 0, -OUTPUT_HEIGHT, 0);
+		weston_matrix_rotate_xy(matrix, 0, 1);
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		weston_matrix_translate(matrix,
+					-OUTPUT_WIDTH, -OUTPUT_HEIGHT, 0);
+		weston_matrix_rotate_xy(matrix, -1, 0);
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		weston_matrix_translate(matrix, -OUTPUT_WIDTH, 0, 0);
+		weston_matrix_rotate_xy(matrix, 0, -1);
+		break;
+	}
+
+	if (scale != 1)
+		weston_matrix_scale(matrix, scale, scale, 1);
+}
+
+static void
+check_matrix(struct weston_matrix *matrix, pixman_region32_t *damage)
+{
+	pixman_region32_t expected, result;
+
+	reference_transform_region(&expected, matrix, damage);
+	pixman_region32_init(&result);
+	weston_matrix_transform_region(&result, matrix, damage);
+	assert(pixman_region32_equal(&expected, &result));
+
+	/* In place, as most callers do */
+	pixman_region32_copy(&result, damage);
+	weston_matrix_transform_region(&result, matrix, &result);
+	assert(pixman_region32_equal(&expected, &result));
+
+	pixman_region32_fini(&expected);
+	pixman_region32_fini(&result);
+}
+
+static void
+region_transform(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_matrix matrix;
+	pixman_region32_t damage;
+	uint32_t transform;
+	int scale;
+
+	fragmented_region(&damage);
+
+	for (transform = 0; transform < 8; transform++)
+		for (scale = 1; scale <= 3; scale++) {
+			output_matrix(&matrix, transform, scale);
+			check_matrix(&matrix, &damage);
+		}
+
+	/* Zoomed outputs have fractional scales and translations,
+	 * which still take the general path. */
+	output_matrix(&matrix, WL_OUTPUT_TRANSFORM_90, 1);
+	weston_matrix_translate(&matrix, -10.5f, -3.25f, 0);
+	weston_matrix_scale(&matrix, 1.3f, 1.3f, 1);
+	check_matrix(&matrix, &damage);
+
+	pixman_region32_fini(&damage);
+
+	wl_display_terminate(compositor->wl_display);
+}
+
+WL_EXPORT int
+module_init(struct weston_compositor *compositor, int *argc, char *argv[])
+{
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(compositor->wl_display);
+
+	wl_event_loop_add_idle(loop, region_transform, compositor);
+
+	return 0;
+}
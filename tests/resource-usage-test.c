@@ -0,0 +1,150 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "weston-test-client-helper.h"
+#include "resource-usage-client-protocol.h"
+
+struct usage {
+	int found;
+	uint32_t surfaces;
+	uint32_t buffers;
+	uint32_t shm_kib;
+	int done;
+};
+
+static void
+usage_handle_client(void *data, struct weston_resource_usage *resource_usage,
+		    int32_t pid, uint32_t surfaces, uint32_t buffers,
+		    uint32_t shm_kib, uint32_t dmabuf_kib,
+		    uint32_t texture_kib)
+{
+	struct usage *usage = data;
+
+	/* The test client shares its process with the test */
+	if (pid != getpid())
+		return;
+
+	assert(!usage->found && "client reported twice");
+	usage->found = 1;
+	usage->surfaces = surfaces;
+	usage->buffers = buffers;
+	usage->shm_kib = shm_kib;
+}
+
+static void
+usage_handle_done(void *data, struct weston_resource_usage *resource_usage)
+{
+	struct usage *usage = data;
+
+	usage->done = 1;
+}
+
+static const struct weston_resource_usage_listener usage_listener = {
+	usage_handle_client,
+	usage_handle_done
+};
+
+static struct weston_resource_usage *
+get_resource_usage(struct client *client)
+{
+	struct global *g;
+	struct weston_resource_usage *resource_usage = NULL;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, "weston_resource_usage"))
+			continue;
+
+		assert(!resource_usage && "multiple resource usage globals");
+		resource_usage = wl_registry_bind(client->wl_registry, g->name,
+						  &weston_resource_usage_interface,
+						  1);
+	}
+
+	assert(resource_usage && "no resource usage global found");
+
+	return resource_usage;
+}
+
+static void
+get_usage(struct client *client, struct weston_resource_usage *resource_usage,
+	  struct usage *usage)
+{
+	memset(usage, 0, sizeof *usage);
+	weston_resource_usage_add_listener(resource_usage, &usage_listener,
+					   usage);
+	weston_resource_usage_update(resource_usage);
+	while (!usage->done)
+		client_roundtrip(client);
+	assert(usage->found);
+}
+
+TEST(resource_usage_buffers)
+{
+	struct client *client;
+	struct weston_resource_usage *resource_usage;
+	struct wl_surface *surface;
+	struct wl_buffer *buffer;
+	struct usage before, attached, destroyed;
+	int done;
+
+	client = create_client_and_test_surface(100, 50, 123, 77);
+	assert(client);
+	surface = client->surface->wl_surface;
+
+	resource_usage = get_resource_usage(client);
+	get_usage(client, resource_usage, &before);
+	assert(before.surfaces >= 1);
+
+	/* 256 KiB of ARGB8888 */
+	buffer = create_shm_buffer(client, 256, 256, NULL);
+	wl_surface_attach(surface, buffer, 0, 0);
+	wl_surface_damage(surface, 0, 0, 256, 256);
+	frame_callback_set(surface, &done);
+	wl_surface_commit(surface);
+	frame_callback_wait(client, &done);
+
+	weston_resource_usage_destroy(resource_usage);
+	resource_usage = get_resource_usage(client);
+	get_usage(client, resource_usage, &attached);
+	assert(attached.surfaces == before.surfaces);
+	assert(attached.buffers == before.buffers + 1);
+	assert(attached.shm_kib == before.shm_kib + 256);
+
+	wl_buffer_destroy(buffer);
+
+	weston_resource_usage_destroy(resource_usage);
+	resource_usage = get_resource_usage(client);
+	get_usage(client, resource_usage, &destroyed);
+	assert(destroyed.buffers == before.buffers);
+	assert(destroyed.shm_kib == before.shm_kib);
+
+	weston_resource_usage_destroy(resource_usage);
+}
@@ -74,6 +74,17 @@ surface_to_from_global(void *data)
 	weston_view_from_global(view, 5, 10, &ix, &iy);
 	assert(ix == 0 && iy == 0);
 
+	weston_view_from_global_fixed(view, wl_fixed_from_double(21.5),
+				      wl_fixed_from_double(100.25), &fx, &fy);
+	assert(fx == wl_fixed_from_double(16.5) &&
+	       fy == wl_fixed_from_double(90.25));
+
+	/* Before the transform is updated, the new position counts */
+	weston_view_set_position(view, 7, 12);
+	weston_view_from_global_fixed(view, wl_fixed_from_int(21),
+				      wl_fixed_from_int(100), &fx, &fy);
+	assert(fx == wl_fixed_from_int(14) && fy == wl_fixed_from_int(88));
+
 	wl_display_terminate(compositor->wl_display);
 }
 
@@ -30,6 +30,119 @@
 
 #include "src/compositor.h"
 
+static void
+surface_transform_opaque(struct weston_compositor *compositor)
+{
+	struct weston_surface *surface;
+	struct weston_view *view;
+	struct weston_transform transform;
+	pixman_box32_t *box;
+	int n;
+
+	surface = weston_surface_create(compositor);
+	assert(surface);
+	view = weston_view_create(surface);
+	assert(view);
+	surface->width = 100;
+	surface->height = 100;
+	pixman_region32_union_rect(&surface->opaque, &surface->opaque,
+				   10, 10, 50, 50);
+
+	/* Scaled views keep their opaque region, rounded inwards. */
+	weston_matrix_init(&transform.matrix);
+	weston_matrix_scale(&transform.matrix, 1.5, 1.5, 1);
+	wl_list_insert(&view->geometry.transformation_list, &transform.link);
+	weston_view_set_position(view, 100.5, 100);
+	weston_view_update_transform(view);
+
+	box = pixman_region32_rectangles(&view->transform.opaque, &n);
+	assert(n == 1);
+	assert(box[0].x1 == 116 && box[0].y1 == 115);
+	assert(box[0].x2 == 190 && box[0].y2 == 190);
+
+	/* Rotated views are never treated as opaque. */
+	weston_matrix_rotate_xy(&transform.matrix, 0, 1);
+	weston_view_geometry_dirty(view);
+	weston_view_update_transform(view);
+	assert(!pixman_region32_not_empty(&view->transform.opaque));
+
+	wl_list_remove(&transform.link);
+	weston_view_destroy(view);
+	weston_surface_destroy(surface);
+}
+
+static struct weston_layer pick_layer;
+static struct weston_view *pick_view;
+static struct wl_event_source *pick_timer;
+static int pick_tries;
+
+static int
+surface_pick_check(void *data)
+{
+	struct weston_compositor *compositor = data;
+	struct weston_view *view = pick_view;
+	struct weston_surface *surface = view->surface;
+	wl_fixed_t vx, vy;
+
+	/* Wait for a repaint to put the view in the view list */
+	if (view->pick.serial != compositor->view_list_serial) {
+		assert(++pick_tries < 100);
+		wl_event_source_timer_update(pick_timer, 10);
+		return 1;
+	}
+
+	assert(weston_compositor_pick_view(compositor,
+					   wl_fixed_from_int(150),
+					   wl_fixed_from_int(150),
+					   &vx, &vy) == view);
+	assert(vx == wl_fixed_from_int(50) && vy == wl_fixed_from_int(50));
+
+	/* An unmapped view must not be picked, even before the view list
+	 * is rebuilt. */
+	weston_view_unmap(view);
+	assert(weston_compositor_pick_view(compositor,
+					   wl_fixed_from_int(150),
+					   wl_fixed_from_int(150),
+					   &vx, &vy) == NULL);
+
+	wl_event_source_remove(pick_timer);
+	wl_list_remove(&pick_layer.link);
+	weston_view_destroy(view);
+	weston_surface_destroy(surface);
+
+	wl_display_terminate(compositor->wl_display);
+
+	return 1;
+}
+
+static void
+surface_pick_unmapped(struct weston_compositor *compositor)
+{
+	struct wl_event_loop *loop;
+	struct weston_surface *surface;
+	struct weston_view *view;
+
+	surface = weston_surface_create(compositor);
+	assert(surface);
+	view = weston_view_create(surface);
+	assert(view);
+	surface->width = 200;
+	surface->height = 200;
+
+	weston_layer_init(&pick_layer, &compositor->cursor_layer.link);
+	weston_layer_entry_insert(&pick_layer.view_list, &view->layer_link);
+	weston_view_set_position(view, 100, 100);
+	weston_view_update_transform(view);
+	assert(weston_view_is_mapped(view));
+	weston_compositor_schedule_repaint(compositor);
+
+	pick_view = view;
+	loop = wl_display_get_event_loop(compositor->wl_display);
+	pick_timer = wl_event_loop_add_timer(loop, surface_pick_check,
+					     compositor);
+	wl_event_source_timer_update(pick_timer, 10);
+}
+
 static void
 surface_transform(void *data)
 {
@@ -56,7 +169,8 @@ surface_transform(void *data)
 	weston_view_to_global_float(view, 50, 40, &x, &y);
 	assert(x == 200 && y == 340);
 
-	wl_display_terminate(compositor->wl_display);
+	surface_transform_opaque(compositor);
+	surface_pick_unmapped(compositor);
 }
 
 WL_EXPORT int
@@ -0,0 +1,111 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <assert.h>
+
+#include "weston-test-client-helper.h"
+#include "tearing-control-client-protocol.h"
+
+static struct ztearing_control_manager *
+get_tearing_control_manager(struct client *client)
+{
+	struct global *g;
+	struct ztearing_control_manager *manager = NULL;
+
+	wl_list_for_each(g, &client->global_list, link) {
+		if (strcmp(g->interface, "ztearing_control_manager"))
+			continue;
+
+		assert(!manager && "multiple tearing control managers");
+		manager = wl_registry_bind(client->wl_registry, g->name,
+					   &ztearing_control_manager_interface,
+					   1);
+	}
+
+	assert(manager && "no tearing control manager found");
+
+	return manager;
+}
+
+TEST(tearing_control_hint)
+{
+	struct client *client;
+	struct ztearing_control_manager *manager;
+	struct ztearing_control *control;
+	struct wl_surface *surface;
+	int done;
+
+	client = create_client_and_test_surface(100, 50, 123, 77);
+	assert(client);
+	surface = client->surface->wl_surface;
+
+	manager = get_tearing_control_manager(client);
+	control = ztearing_control_manager_get_tearing_control(manager,
+							       surface);
+
+	/* Without direct scanout the headless compositor just keeps
+	 * compositing as usual */
+	ztearing_control_set_presentation_hint(control,
+			ZTEARING_CONTROL_PRESENTATION_HINT_ASYNC);
+	wl_surface_attach(surface, client->surface->wl_buffer, 0, 0);
+	wl_surface_damage(surface, 0, 0, 123, 77);
+	frame_callback_set(surface, &done);
+	wl_surface_commit(surface);
+	frame_callback_wait(client, &done);
+
+	ztearing_control_destroy(control);
+	wl_surface_commit(surface);
+
+	/* A new one may be created once the old one is gone */
+	control = ztearing_control_manager_get_tearing_control(manager,
+							       surface);
+	ztearing_control_set_presentation_hint(control,
+			ZTEARING_CONTROL_PRESENTATION_HINT_VSYNC);
+	client_roundtrip(client);
+
+	ztearing_control_destroy(control);
+	ztearing_control_manager_destroy(manager);
+}
+
+TEST(tearing_control_exists)
+{
+	struct client *client;
+	struct ztearing_control_manager *manager;
+	struct wl_surface *surface;
+
+	client = create_client_and_test_surface(100, 50, 123, 77);
+	assert(client);
+	surface = client->surface->wl_surface;
+
+	manager = get_tearing_control_manager(client);
+	ztearing_control_manager_get_tearing_control(manager, surface);
+	ztearing_control_manager_get_tearing_control(manager, surface);
+
+	expect_protocol_error(client, &ztearing_control_manager_interface,
+		ZTEARING_CONTROL_MANAGER_ERROR_TEARING_CONTROL_EXISTS);
+}
@@ -26,7 +26,13 @@
 #include "config.h"
 
 #include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pixman.h>
 
 #include "weston-test-runner.h"
 
@@ -221,3 +227,386 @@ TEST(float_difference_same)
 	assert(float_difference(1.0f, 1.0f) == 0.0f);
 }
 
+
+#define BATCH_QUADS 64
+#define BATCH_BOXES 37
+#define BENCH_ROUNDS 200
+
+/* Random quad: a square of side 20-120 around (0, 0) rotated and scaled,
+ * then moved into (0, 0)-(400, 400).  Every fifth one is axis-aligned. */
+static void
+random_quad(struct polygon8 *quad, int *simple)
+{
+	float size = 20.0f + rand() % 100;
+	float angle = rand() % 360 * (float) M_PI / 180.0f;
+	float scale = 0.5f + rand() % 300 / 100.0f;
+	float cx = rand() % 400, cy = rand() % 400;
+	float c, s, x, y;
+	int i;
+
+	*simple = rand() % 5 == 0;
+	if (*simple)
+		angle = 0.0f;
+	c = cosf(angle) * scale;
+	s = sinf(angle) * scale;
+
+	for (i = 0; i < 4; i++) {
+		x = (i == 1 || i == 2) ? size : -size;
+		y = i >= 2 ? size : -size;
+		quad->x[i] = cx + c * x - s * y;
+		quad->y[i] = cy + s * x + c * y;
+	}
+	quad->n = 4;
+}
+
+static void
+random_box(struct clip_box *box)
+{
+	box->x1 = rand() % 400;
+	box->y1 = rand() % 400;
+	box->x2 = box->x1 + 1 + rand() % 200;
+	box->y2 = box->y1 + 1 + rand() % 200;
+}
+
+/* What gl-renderer did for each pair before clip_quad_batch() */
+static int
+reference_clip(const struct polygon8 *quad, int simple,
+	       const struct clip_box *box, float *ex, float *ey)
+{
+	struct clip_context ctx;
+	struct polygon8 polygon = *quad;
+	float min_x, max_x, min_y, max_y;
+	int i, n;
+
+	min_x = max_x = quad->x[0];
+	min_y = max_y = quad->y[0];
+	for (i = 1; i < 4; i++) {
+		min_x = MIN(min_x, quad->x[i]);
+		max_x = MAX(max_x, quad->x[i]);
+		min_y = MIN(min_y, quad->y[i]);
+		max_y = MAX(max_y, quad->y[i]);
+	}
+
+	if (min_x >= box->x2 || max_x <= box->x1 ||
+	    min_y >= box->y2 || max_y <= box->y1)
+		return 0;
+
+	ctx.clip.x1 = box->x1;
+	ctx.clip.y1 = box->y1;
+	ctx.clip.x2 = box->x2;
+	ctx.clip.y2 = box->y2;
+
+	if (simple)
+		return clip_simple(&ctx, &polygon, ex, ey);
+
+	n = clip_transformed(&ctx, &polygon, ex, ey);
+
+	return n < 3 ? 0 : n;
+}
+
+static float
+polygon_area(const float *x, const float *y, int n)
+{
+	float area = 0.0f;
+	int i;
+
+	for (i = 0; i < n; i++)
+		area += x[i] * y[(i + 1) % n] - x[(i + 1) % n] * y[i];
+
+	return area / 2.0f;
+}
+
+/* The fast paths may start the polygon at a different vertex, so
+ * compare what matters for drawing: the same signed area and the
+ * same bounds. */
+TEST(clip_quad_batch_matches_reference)
+{
+	struct polygon8 quad;
+	struct clip_box boxes[BATCH_BOXES];
+	float ex[BATCH_BOXES * CLIP_QUAD_MAX_VERTICES];
+	float ey[BATCH_BOXES * CLIP_QUAD_MAX_VERTICES];
+	float rx[CLIP_QUAD_MAX_VERTICES], ry[CLIP_QUAD_MAX_VERTICES];
+	float area, expected;
+	int counts[BATCH_BOXES];
+	int i, j, k, n, simple;
+
+	srand(1);
+	for (i = 0; i < BATCH_QUADS; i++) {
+		random_quad(&quad, &simple);
+		for (j = 0; j < BATCH_BOXES; j++)
+			random_box(&boxes[j]);
+
+		clip_quad_batch(&quad, simple, boxes, BATCH_BOXES,
+				ex, ey, counts);
+
+		for (j = 0; j < BATCH_BOXES; j++) {
+			float *bx = ex + j * CLIP_QUAD_MAX_VERTICES;
+			float *by = ey + j * CLIP_QUAD_MAX_VERTICES;
+
+			n = reference_clip(&quad, simple, &boxes[j], rx, ry);
+			assert((counts[j] == 0) == (n == 0));
+			if (n == 0)
+				continue;
+
+			area = polygon_area(bx, by, counts[j]);
+			expected = polygon_area(rx, ry, n);
+			assert(fabsf(area - expected) <=
+			       fabsf(expected) * 1e-4f + 1e-3f);
+
+			for (k = 0; k < counts[j]; k++) {
+				assert(bx[k] >= boxes[j].x1 - 1e-3f);
+				assert(bx[k] <= boxes[j].x2 + 1e-3f);
+				assert(by[k] >= boxes[j].y1 - 1e-3f);
+				assert(by[k] <= boxes[j].y2 + 1e-3f);
+			}
+		}
+	}
+}
+
+static uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Not a pass/fail check: prints how many quad and box pairs per second
+ * the per-pair path and clip_quad_batch() get through. */
+TEST(clip_quad_batch_throughput)
+{
+	struct polygon8 quads[BATCH_QUADS];
+	int simple[BATCH_QUADS];
+	struct clip_box boxes[BATCH_BOXES];
+	float ex[BATCH_BOXES * CLIP_QUAD_MAX_VERTICES];
+	float ey[BATCH_BOXES * CLIP_QUAD_MAX_VERTICES];
+	int counts[BATCH_BOXES];
+	double pairs = (double) BENCH_ROUNDS * BATCH_QUADS * BATCH_BOXES;
+	uint64_t start, reference, batch;
+	int r, i, j, sum = 0;
+
+	srand(2);
+	for (i = 0; i < BATCH_QUADS; i++)
+		random_quad(&quads[i], &simple[i]);
+	for (j = 0; j < BATCH_BOXES; j++)
+		random_box(&boxes[j]);
+
+	start = bench_now();
+	for (r = 0; r < BENCH_ROUNDS; r++)
+		for (i = 0; i < BATCH_QUADS; i++)
+			for (j = 0; j < BATCH_BOXES; j++)
+				sum += reference_clip(&quads[i], simple[i],
+						      &boxes[j],
+						      ex + j * CLIP_QUAD_MAX_VERTICES,
+						      ey + j * CLIP_QUAD_MAX_VERTICES);
+	reference = bench_now() - start;
+
+	start = bench_now();
+	for (r = 0; r < BENCH_ROUNDS; r++)
+		for (i = 0; i < BATCH_QUADS; i++) {
+			clip_quad_batch(&quads[i], simple[i], boxes,
+					BATCH_BOXES, ex, ey, counts);
+			for (j = 0; j < BATCH_BOXES; j++)
+				sum -= counts[j];
+		}
+	batch = bench_now() - start;
+
+	fprintf(stderr, "per pair: %.2f Mpairs/s, batched: %.2f Mpairs/s\n",
+		pairs * 1e3 / reference, pairs * 1e3 / batch);
+
+	/* Use the results, so that neither loop is optimized away */
+	fprintf(stderr, "vertex count difference: %d\n", sum);
+}
+
+/* A terminal of 80x25 cells of 8x16 pixels, with a rounded window
+ * around it, at (SWEEP_DX, SWEEP_DY) on the output */
+#define SWEEP_COLS 80
+#define SWEEP_ROWS 25
+#define SWEEP_CELL_W 8
+#define SWEEP_CELL_H 16
+#define SWEEP_DX 37
+#define SWEEP_DY 23
+
+/* Damage rectangles clipped against a surface rectangle at a time */
+#define CLIP_BATCH_MAX 16
+
+static void
+sweep_damage(pixman_region32_t *damage, int percent)
+{
+	int row, col;
+
+	pixman_region32_init(damage);
+	for (row = 0; row < SWEEP_ROWS; row++)
+		for (col = 0; col < SWEEP_COLS; col++)
+			if (rand() % 100 < percent)
+				pixman_region32_union_rect(damage, damage,
+					SWEEP_DX + 4 + col * SWEEP_CELL_W,
+					SWEEP_DY + 4 + row * SWEEP_CELL_H,
+					SWEEP_CELL_W, SWEEP_CELL_H);
+}
+
+static void
+sweep_surface(pixman_region32_t *surf)
+{
+	int w = SWEEP_COLS * SWEEP_CELL_W + 8;
+	int h = SWEEP_ROWS * SWEEP_CELL_H + 8;
+	int i;
+
+	pixman_region32_init_rect(surf, 0, 0, w, h);
+
+	/* Rounded corners, a band per row of pixels */
+	for (i = 0; i < 4; i++) {
+		pixman_region32_t corner;
+
+		pixman_region32_init_rect(&corner, 0, i, 4 - i, 1);
+		pixman_region32_union_rect(&corner, &corner,
+					   w - 4 + i, i, 4 - i, 1);
+		pixman_region32_union_rect(&corner, &corner,
+					   0, h - 1 - i, 4 - i, 1);
+		pixman_region32_union_rect(&corner, &corner,
+					   w - 4 + i, h - 1 - i, 4 - i, 1);
+		pixman_region32_subtract(surf, surf, &corner);
+		pixman_region32_fini(&corner);
+	}
+}
+
+/* What gl-renderer does for transformed views, and did for all views:
+ * clip every surface rectangle against every damage rectangle */
+static int
+quads_pairwise(pixman_region32_t *damage, pixman_region32_t *surf,
+	       float *ex, float *ey, struct clip_box *boxes, float *area)
+{
+	pixman_box32_t *rects, *surf_rects;
+	struct polygon8 quad;
+	int counts[CLIP_BATCH_MAX];
+	int i, j, k, b, n, nbox, nrects, nsurf, nfans = 0;
+
+	rects = pixman_region32_rectangles(damage, &nrects);
+	surf_rects = pixman_region32_rectangles(surf, &nsurf);
+	for (i = 0; i < nrects; i++) {
+		boxes[i].x1 = rects[i].x1;
+		boxes[i].y1 = rects[i].y1;
+		boxes[i].x2 = rects[i].x2;
+		boxes[i].y2 = rects[i].y2;
+	}
+
+	*area = 0.0f;
+	for (j = 0; j < nsurf; j++) {
+		quad.x[0] = quad.x[3] = surf_rects[j].x1 + SWEEP_DX;
+		quad.x[1] = quad.x[2] = surf_rects[j].x2 + SWEEP_DX;
+		quad.y[0] = quad.y[1] = surf_rects[j].y1 + SWEEP_DY;
+		quad.y[2] = quad.y[3] = surf_rects[j].y2 + SWEEP_DY;
+		quad.n = 4;
+
+		for (i = 0; i < nrects; i += nbox) {
+			nbox = MIN(nrects - i, CLIP_BATCH_MAX);
+			clip_quad_batch(&quad, 1, boxes + i, nbox,
+					ex, ey, counts);
+
+			for (b = 0; b < nbox; b++) {
+				n = counts[b];
+				if (n < 3)
+					continue;
+
+				k = b * CLIP_QUAD_MAX_VERTICES;
+				*area += fabsf(polygon_area(ex + k, ey + k, n));
+				nfans++;
+			}
+		}
+	}
+
+	return nfans;
+}
+
+/* What gl-renderer does for untransformed views: intersect the
+ * regions in one sweep and emit a quad per rectangle */
+static int
+quads_sweep(pixman_region32_t *damage, pixman_region32_t *surf,
+	    float *ex, float *ey, float *area)
+{
+	pixman_region32_t quads;
+	pixman_box32_t *rects;
+	int i, nrects;
+
+	pixman_region32_init(&quads);
+	pixman_region32_copy(&quads, surf);
+	pixman_region32_translate(&quads, SWEEP_DX, SWEEP_DY);
+	pixman_region32_intersect(&quads, &quads, damage);
+	rects = pixman_region32_rectangles(&quads, &nrects);
+
+	*area = 0.0f;
+	for (i = 0; i < nrects; i++) {
+		ex[0] = ex[3] = rects[i].x1;
+		ex[1] = ex[2] = rects[i].x2;
+		ey[0] = ey[1] = rects[i].y1;
+		ey[2] = ey[3] = rects[i].y2;
+		*area += fabsf(polygon_area(ex, ey, 4));
+	}
+
+	pixman_region32_fini(&quads);
+
+	return nrects;
+}
+
+TEST(region_sweep_matches_pairwise)
+{
+	static const int percents[] = { 1, 10, 50, 90, 100 };
+	pixman_region32_t damage, surf;
+	struct clip_box boxes[SWEEP_ROWS * SWEEP_COLS];
+	float ex[CLIP_BATCH_MAX * CLIP_QUAD_MAX_VERTICES];
+	float ey[CLIP_BATCH_MAX * CLIP_QUAD_MAX_VERTICES];
+	float pairwise, sweep;
+	unsigned i;
+
+	srand(3);
+	sweep_surface(&surf);
+
+	for (i = 0; i < ARRAY_LENGTH(percents); i++) {
+		sweep_damage(&damage, percents[i]);
+
+		quads_pairwise(&damage, &surf, ex, ey, boxes, &pairwise);
+		quads_sweep(&damage, &surf, ex, ey, &sweep);
+		assert(fabsf(pairwise - sweep) <= pairwise * 1e-5f + 1e-3f);
+
+		pixman_region32_fini(&damage);
+	}
+
+	pixman_region32_fini(&surf);
+}
+
+/* Not a pass/fail check: prints how long building the quads of a
+ * fragmented terminal repaint takes both ways. */
+TEST(region_sweep_throughput)
+{
+	pixman_region32_t damage, surf;
+	struct clip_box boxes[SWEEP_ROWS * SWEEP_COLS];
+	float ex[CLIP_BATCH_MAX * CLIP_QUAD_MAX_VERTICES];
+	float ey[CLIP_BATCH_MAX * CLIP_QUAD_MAX_VERTICES];
+	uint64_t start, pairwise, sweep;
+	float area;
+	int r, fans = 0, quads = 0;
+
+	srand(4);
+	sweep_surface(&surf);
+	sweep_damage(&damage, 30);
+
+	start = bench_now();
+	for (r = 0; r < BENCH_ROUNDS; r++)
+		fans += quads_pairwise(&damage, &surf, ex, ey, boxes, &area);
+	pairwise = bench_now() - start;
+
+	start = bench_now();
+	for (r = 0; r < BENCH_ROUNDS; r++)
+		quads += quads_sweep(&damage, &surf, ex, ey, &area);
+	sweep = bench_now() - start;
+
+	fprintf(stderr, "pairwise: %.1f us and %d fans per repaint, "
+		"sweep: %.1f us and %d quads per repaint\n",
+		pairwise / 1e3 / BENCH_ROUNDS, fans / BENCH_ROUNDS,
+		sweep / 1e3 / BENCH_ROUNDS, quads / BENCH_ROUNDS);
+
+	pixman_region32_fini(&damage);
+	pixman_region32_fini(&surf);
+}
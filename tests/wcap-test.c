@@ -0,0 +1,210 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "weston-test-runner.h"
+#include "wcap/wcap-decode.h"
+#include "wcap/wcap-encode.h"
+
+#define WIDTH 67
+#define HEIGHT 23
+
+/* The original per-pixel encoder, kept as the reference the
+ * vectorized one has to match word for word. */
+static uint32_t *
+scalar_output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+static uint32_t
+scalar_component_delta(uint32_t next, uint32_t prev)
+{
+	unsigned char dr, dg, db;
+
+	dr = (next >> 16) - (prev >> 16);
+	dg = (next >>  8) - (prev >>  8);
+	db = (next >>  0) - (prev >>  0);
+
+	return (dr << 16) | (dg << 8) | (db << 0);
+}
+
+static uint32_t *
+scalar_encode(uint32_t *p, uint32_t *d, const uint32_t *s,
+	      int width, int height, int key)
+{
+	uint32_t delta, prev = 0, next;
+	int j, k, run = 0;
+
+	for (j = 0; j < height; j++) {
+		for (k = 0; k < width; k++) {
+			next = s[k];
+			delta = scalar_component_delta(next, key ? 0 : d[k]);
+			d[k] = next;
+			if (run == 0 || delta == prev) {
+				run++;
+			} else {
+				p = scalar_output_run(p, prev, run);
+				run = 1;
+			}
+			prev = delta;
+		}
+		s += width;
+		d += width;
+	}
+
+	return scalar_output_run(p, prev, run);
+}
+
+/* Flat areas with a few noisy blocks, so both long runs and run
+ * breaks inside a four pixel group get exercised. */
+static void
+fill_frame(uint32_t *pixels, int width, int height, unsigned int seed)
+{
+	int i, x, y;
+
+	srand(seed);
+	for (i = 0; i < width * height; i++)
+		pixels[i] = 0xff000000 | (seed * 0x010203);
+
+	for (i = 0; i < 12; i++) {
+		x = rand() % width;
+		y = rand() % height;
+		pixels[y * width + x] = 0xff000000 | rand();
+		if (x + 1 < width)
+			pixels[y * width + x + 1] = pixels[y * width + x];
+	}
+
+	for (y = height / 3; y < height / 2; y++)
+		for (x = 5; x < 5 + width / 4; x++)
+			pixels[y * width + x] = 0xff000000 | rand();
+}
+
+static void
+check_encode(uint32_t *reference, uint32_t *scalar_reference,
+	     const uint32_t *pixels, uint32_t *decoded, int key)
+{
+	struct wcap_rectangle rect = { 0, 0, WIDTH, HEIGHT };
+	uint32_t *out, *scalar_out, *end, *scalar_end, *flipped;
+	size_t size = (WIDTH * HEIGHT + 1) * sizeof *out;
+	int y;
+
+	out = malloc(size);
+	scalar_out = malloc(size);
+	flipped = malloc(WIDTH * HEIGHT * sizeof *flipped);
+	assert(out && scalar_out && flipped);
+
+	end = wcap_encode_rectangle(out, reference, WIDTH, pixels,
+				    WIDTH, HEIGHT, key);
+	scalar_end = scalar_encode(scalar_out, scalar_reference, pixels,
+				   WIDTH, HEIGHT, key);
+
+	assert(end - out == scalar_end - scalar_out);
+	assert(memcmp(out, scalar_out, (end - out) * sizeof *out) == 0);
+	assert(memcmp(reference, scalar_reference,
+		      WIDTH * HEIGHT * sizeof *reference) == 0);
+
+	/* The decoder writes rows bottom-up, like the recorder reads
+	 * them back from GL. */
+	if (key)
+		memset(decoded, 0, WIDTH * HEIGHT * sizeof *decoded);
+	assert(wcap_decode_rectangle(decoded, WIDTH, &rect, out) == end);
+	for (y = 0; y < HEIGHT; y++)
+		memcpy(flipped + (HEIGHT - 1 - y) * WIDTH, pixels + y * WIDTH,
+		       WIDTH * sizeof *pixels);
+	assert(memcmp(decoded, flipped, WIDTH * HEIGHT * sizeof *decoded) == 0);
+
+	free(out);
+	free(scalar_out);
+	free(flipped);
+}
+
+TEST(wcap_encode_matches_scalar)
+{
+	uint32_t *reference, *scalar_reference, *pixels, *decoded;
+	size_t size = WIDTH * HEIGHT * sizeof *pixels;
+	unsigned int frame;
+
+	reference = calloc(1, size);
+	scalar_reference = calloc(1, size);
+	pixels = malloc(size);
+	decoded = calloc(1, size);
+	assert(reference && scalar_reference && pixels && decoded);
+
+	for (frame = 0; frame < 16; frame++) {
+		fill_frame(pixels, WIDTH, HEIGHT, frame);
+		check_encode(reference, scalar_reference, pixels, decoded,
+			     frame % 5 == 0);
+	}
+
+	free(reference);
+	free(scalar_reference);
+	free(pixels);
+	free(decoded);
+}
+
+TEST(wcap_encode_long_runs)
+{
+	uint32_t *reference, *scalar_reference, *pixels, *decoded;
+	size_t size = WIDTH * HEIGHT * sizeof *pixels;
+	int i;
+
+	reference = calloc(1, size);
+	scalar_reference = calloc(1, size);
+	pixels = malloc(size);
+	decoded = calloc(1, size);
+	assert(reference && scalar_reference && pixels && decoded);
+
+	/* A single run covering the whole rectangle needs several of
+	 * the long run codes and wraps across every row. */
+	for (i = 0; i < WIDTH * HEIGHT; i++)
+		pixels[i] = 0xff405060;
+	check_encode(reference, scalar_reference, pixels, decoded, 1);
+	check_encode(reference, scalar_reference, pixels, decoded, 0);
+
+	free(reference);
+	free(scalar_reference);
+	free(pixels);
+	free(decoded);
+}
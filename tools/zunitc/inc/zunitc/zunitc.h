@@ -257,6 +257,39 @@ zuc_set_spawn(bool spawn);
 void
 zuc_set_output_junit(bool enable);
 
+/**
+ * Enables output in a JSON format, including any benchmark results.
+ * Defaults to false.
+ *
+ * @param enable true to generate JSON output, false to disable.
+ */
+void
+zuc_set_output_json(bool enable);
+
+/**
+ * Sets the number of timed samples taken for each benchmark.
+ * The reported minimum, median and 99th percentile are computed over
+ * these samples.
+ * Defaults to 10.
+ *
+ * @param samples number of samples to take.
+ * @see ZUC_BENCH()
+ */
+void
+zuc_set_bench_samples(int samples);
+
+/**
+ * Sets the minimum duration of a single benchmark sample.
+ * The iteration count of each benchmark is scaled up until one sample
+ * takes at least this long.
+ * Defaults to 10 milliseconds.
+ *
+ * @param ms minimum sample duration in milliseconds.
+ * @see ZUC_BENCH()
+ */
+void
+zuc_set_bench_min_time(int ms);
+
 /**
  * Defines a test case that can be registered to run.
  */
@@ -292,6 +325,48 @@ zuc_set_output_junit(bool enable);
 	\
 	static void zuctest_##tcase##_##test(void *data)
 
+/**
+ * Defines a benchmark that can be registered to run.
+ * The body receives the number of iterations to perform as 'iterations'
+ * and should execute the code being measured that many times. The
+ * framework runs the body once to warm up, scales the iteration count
+ * until a sample takes at least the configured minimum time, then
+ * reports the minimum, median and 99th percentile wall-clock and CPU
+ * time per iteration over a number of samples.
+ *
+ * Benchmarks are registered and filtered like tests, and checks may be
+ * used within the body.
+ *
+ * @see zuc_set_bench_samples()
+ * @see zuc_set_bench_min_time()
+ */
+#define ZUC_BENCH(tcase, test) \
+	static void zucbench_##tcase##_##test(uint64_t iterations); \
+	\
+	ZUC_TEST(tcase, test) \
+	{ \
+		zucimpl_run_bench(zucbench_##tcase##_##test, 0, 0); \
+	} \
+	\
+	static void zucbench_##tcase##_##test(uint64_t iterations)
+
+/**
+ * Defines a benchmark that uses a fixture, in the same manner as
+ * ZUC_TEST_F(). Setup and tear-down run once around the whole benchmark,
+ * not around each sample, so their cost is not measured.
+ *
+ * @see ZUC_BENCH()
+ */
+#define ZUC_BENCH_F(tcase, test) \
+	static void zucbench_##tcase##_##test(void *data, \
+					      uint64_t iterations); \
+	\
+	ZUC_TEST_F(tcase, test) \
+	{ \
+		zucimpl_run_bench(0, zucbench_##tcase##_##test, data); \
+	} \
+	\
+	static void zucbench_##tcase##_##test(void *data, uint64_t iterations)
 
 /**
  * Returns true if the currently executing test has encountered any skips.
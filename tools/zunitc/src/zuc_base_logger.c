@@ -302,6 +302,21 @@ test_ended(void *data, struct zuc_test *test)
 		printf(" %s.%s (%ld ms)\n",
 		       test->test_case->name, test->name, test->elapsed);
 	}
+
+	if (test->bench) {
+		struct zuc_bench *bench = test->bench;
+
+		styled_printf(bdata->use_color, STYLE_GOOD, "[    BENCH ]");
+		printf(" %s.%s: %llu iterations x %d samples\n",
+		       test->test_case->name, test->name,
+		       (unsigned long long)bench->iterations, bench->samples);
+		printf("             wall min %.1f, median %.1f, p99 %.1f"
+		       " ns/iter\n",
+		       bench->wall_min, bench->wall_median, bench->wall_p99);
+		printf("             cpu  min %.1f, median %.1f, p99 %.1f"
+		       " ns/iter\n",
+		       bench->cpu_min, bench->cpu_median, bench->cpu_p99);
+	}
 }
 
 const char *
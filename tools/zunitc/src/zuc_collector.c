@@ -34,6 +34,7 @@
 
 #include "shared/zalloc.h"
 #include "zuc_event_listener.h"
+#include "zuc_types.h"
 #include "zunitc/zunitc_impl.h"
 
 #include <sys/types.h>
@@ -152,6 +153,9 @@ check_triggered(void *data, char const *file, int line,
 static void
 collect_event(void *data, char const *file, int line, const char *expr1);
 
+static void
+bench_ended(void *data, struct zuc_test *test, const struct zuc_bench *bench);
+
 struct zuc_event_listener *
 zuc_collector_create(int *pipe_fd)
 {
@@ -165,6 +169,7 @@ zuc_collector_create(int *pipe_fd)
 	listener->test_ended = test_ended;
 	listener->check_triggered = check_triggered;
 	listener->collect_event = collect_event;
+	listener->bench_ended = bench_ended;
 
 	return listener;
 }
@@ -183,6 +188,13 @@ pack_intptr_t(char *ptr, intptr_t val)
 	return ptr + sizeof(val);
 }
 
+static char *
+pack_raw(char *ptr, const void *val, size_t size)
+{
+	memcpy(ptr, val, size);
+	return ptr + size;
+}
+
 static char *
 pack_cstr(char *ptr, intptr_t val, int len)
 {
@@ -239,6 +251,45 @@ collect_event(void *data, char const *file, int line, const char *expr1)
 		    0, 0, expr1, "");
 }
 
+static void
+write_all(int fd, const char *buf, int len)
+{
+	int sent = 0;
+	int count;
+
+	while (sent < len) {
+		count = write(fd, buf + sent, len - sent);
+		if (count == -1)
+			break;
+		sent += count;
+	}
+}
+
+void
+bench_ended(void *data, struct zuc_test *test, const struct zuc_bench *bench)
+{
+	struct collector_data *cdata = data;
+	char buf[sizeof(int32_t) * 3 + sizeof(uint64_t) + sizeof(double) * 6];
+	char *ptr;
+
+	/* The results are already on the test when running in-process. */
+	if (*cdata->fd == -1)
+		return;
+
+	ptr = pack_int32(buf, sizeof(buf) - 4);
+	ptr = pack_int32(ptr, ZUC_EVENT_BENCH);
+	ptr = pack_raw(ptr, &bench->iterations, sizeof(bench->iterations));
+	ptr = pack_int32(ptr, bench->samples);
+	ptr = pack_raw(ptr, &bench->wall_min, sizeof(double));
+	ptr = pack_raw(ptr, &bench->wall_median, sizeof(double));
+	ptr = pack_raw(ptr, &bench->wall_p99, sizeof(double));
+	ptr = pack_raw(ptr, &bench->cpu_min, sizeof(double));
+	ptr = pack_raw(ptr, &bench->cpu_median, sizeof(double));
+	ptr = pack_raw(ptr, &bench->cpu_p99, sizeof(double));
+
+	write_all(*cdata->fd, buf, ptr - buf);
+}
+
 void
 store_event(struct collector_data *cdata,
 	    enum zuc_event_type event_type, char const *file, int line,
@@ -268,8 +319,6 @@ store_event(struct collector_data *cdata,
 	if (*cdata->fd == -1) {
 	} else {
 		/* Need to pass it back */
-		int sent;
-		int count;
 		int expr1_len = strlen(expr1);
 		int expr2_len = strlen(expr2);
 		int val1_len =
@@ -315,13 +364,7 @@ store_event(struct collector_data *cdata,
 		}
 
 
-		sent = 0;
-		while (sent < len) {
-			count = write(*cdata->fd, buf, len);
-			if (count == -1)
-				break;
-			sent += count;
-		}
+		write_all(*cdata->fd, buf, len);
 
 		free(buf);
 	}
@@ -369,6 +412,38 @@ unpack_cstr(char const *ptr, char **str)
 	return ptr;
 }
 
+static char const *
+unpack_raw(char const *ptr, void *val, size_t size)
+{
+	memcpy(val, ptr, size);
+	return ptr + size;
+}
+
+/**
+ * Extracts benchmark results from the given buffer.
+ *
+ * @param ptr the buffer to extract from.
+ * @return the benchmark results that were packed in the buffer.
+ */
+static struct zuc_bench *
+unpack_bench(char const *ptr)
+{
+	struct zuc_bench *bench = zalloc(sizeof(*bench));
+	int32_t val = 0;
+
+	ptr = unpack_raw(ptr, &bench->iterations, sizeof(bench->iterations));
+	ptr = unpack_int32(ptr, &val);
+	bench->samples = val;
+	ptr = unpack_raw(ptr, &bench->wall_min, sizeof(double));
+	ptr = unpack_raw(ptr, &bench->wall_median, sizeof(double));
+	ptr = unpack_raw(ptr, &bench->wall_p99, sizeof(double));
+	ptr = unpack_raw(ptr, &bench->cpu_min, sizeof(double));
+	ptr = unpack_raw(ptr, &bench->cpu_median, sizeof(double));
+	ptr = unpack_raw(ptr, &bench->cpu_p99, sizeof(double));
+
+	return bench;
+}
+
 struct zuc_event *
 unpack_event(char const *ptr, int32_t len)
 {
@@ -419,8 +494,14 @@ zuc_process_message(struct zuc_test *test, int fd)
 		tmp = unpack_int32(raw, &val);
 		event_type = val;
 
-		struct zuc_event *evt = unpack_event(tmp, len - (tmp - raw));
-		zuc_attach_event(test, evt, event_type, true);
+		if (event_type == ZUC_EVENT_BENCH) {
+			free(test->bench);
+			test->bench = unpack_bench(tmp);
+		} else {
+			struct zuc_event *evt =
+				unpack_event(tmp, len - (tmp - raw));
+			zuc_attach_event(test, evt, event_type, true);
+		}
 		free(raw);
 	}
 	return got;
@@ -46,6 +46,9 @@ struct zuc_context {
 	bool break_on_failure;
 	bool output_tap;
 	bool output_junit;
+	bool output_json;
+	int bench_samples;
+	int bench_min_time;
 	int fds[2];
 	char *filter;
 
@@ -36,7 +36,8 @@
 enum zuc_event_type
 {
 	ZUC_EVENT_IMMEDIATE,
-	ZUC_EVENT_DEFERRED
+	ZUC_EVENT_DEFERRED,
+	ZUC_EVENT_BENCH
 };
 
 /**
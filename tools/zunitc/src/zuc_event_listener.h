@@ -33,6 +33,7 @@
 
 struct zuc_test;
 struct zuc_case;
+struct zuc_bench;
 
 /**
  * Interface to allow components to process testing events as they occur.
@@ -137,6 +138,15 @@ struct zuc_event_listener {
 	void (*test_disabled)(void *data,
 			      struct zuc_test *test);
 
+	/**
+	 * Handler for benchmark results of the current test.
+	 *
+	 * @param data the user data associated with this instance.
+	 */
+	void (*bench_ended)(void *data,
+			    struct zuc_test *test,
+			    const struct zuc_bench *bench);
+
 	/**
 	 * Handler for check/assertion fired due to failure, warning, etc.
 	 *
@@ -0,0 +1,236 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include "zuc_json_reporter.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "zuc_event_listener.h"
+#include "zuc_types.h"
+
+#include "shared/zalloc.h"
+
+/**
+ * Hardcoded output name, following the JUnit XML reporter.
+ */
+#define JSON_FNAME "test_detail.json"
+
+/**
+ * Internal data.
+ */
+struct json_data
+{
+	FILE *fp;
+	time_t begin;
+};
+
+/**
+ * Writes a string as a quoted JSON string value.
+ *
+ * @param fp the stream to write to.
+ * @param str the string to write.
+ */
+static void
+emit_string(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for (; *str; ++str) {
+		switch (*str) {
+		case '"':
+		case '\\':
+			fprintf(fp, "\\%c", *str);
+			break;
+		default:
+			if ((unsigned char)*str < 0x20)
+				fprintf(fp, "\\u%04x", *str);
+			else
+				fputc(*str, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+/**
+ * Returns the result string for the test.
+ *
+ * @param test the test to check status of.
+ * @return the result string.
+ */
+static char const *
+get_test_result(struct zuc_test *test)
+{
+	if (test->disabled)
+		return "disabled";
+	else if (test->failed || test->fatal)
+		return "failed";
+	else if (test->skipped)
+		return "skipped";
+	else
+		return "passed";
+}
+
+/**
+ * Output the given benchmark results.
+ * Times are in nanoseconds per iteration.
+ *
+ * @param fp the stream to write to.
+ * @param bench the results to write out.
+ */
+static void
+emit_bench(FILE *fp, struct zuc_bench *bench)
+{
+	fprintf(fp, ",\n          \"bench\": {"
+		" \"iterations\": %llu, \"samples\": %d,\n"
+		"            \"wall_ns\": {"
+		" \"min\": %.1f, \"median\": %.1f, \"p99\": %.1f },\n"
+		"            \"cpu_ns\": {"
+		" \"min\": %.1f, \"median\": %.1f, \"p99\": %.1f } }",
+		(unsigned long long)bench->iterations, bench->samples,
+		bench->wall_min, bench->wall_median, bench->wall_p99,
+		bench->cpu_min, bench->cpu_median, bench->cpu_p99);
+}
+
+/**
+ * Output the given test.
+ *
+ * @param fp the stream to write to.
+ * @param test the test to write out.
+ */
+static void
+emit_test(FILE *fp, struct zuc_test *test)
+{
+	fprintf(fp, "        { \"name\": ");
+	emit_string(fp, test->name);
+	fprintf(fp, ", \"result\": \"%s\", \"time_ms\": %ld",
+		get_test_result(test), test->elapsed);
+
+	if (test->bench)
+		emit_bench(fp, test->bench);
+
+	fprintf(fp, " }");
+}
+
+/**
+ * Output the given test case.
+ *
+ * @param fp the stream to write to.
+ * @param test_case the test case to write out.
+ */
+static void
+emit_case(FILE *fp, struct zuc_case *test_case)
+{
+	int i;
+
+	fprintf(fp, "    { \"name\": ");
+	emit_string(fp, test_case->name);
+	fprintf(fp, ", \"tests\": %d, \"time_ms\": %ld,\n"
+		"      \"testcases\": [\n",
+		test_case->test_count, test_case->elapsed);
+
+	for (i = 0; i < test_case->test_count; ++i) {
+		emit_test(fp, test_case->tests[i]);
+		fprintf(fp, "%s\n", (i + 1 < test_case->test_count) ? "," : "");
+	}
+
+	fprintf(fp, "      ] }");
+}
+
+static void
+run_started(void *data, int live_case_count, int live_test_count,
+	    int disabled_count)
+{
+	struct json_data *jdata = data;
+	int fd;
+
+	jdata->begin = time(NULL);
+	fd = open(JSON_FNAME, O_WRONLY | O_CLOEXEC | O_CREAT | O_TRUNC,
+		  S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+	if (fd != -1) {
+		jdata->fp = fdopen(fd, "w");
+		if (!jdata->fp)
+			close(fd);
+	}
+}
+
+static void
+run_ended(void *data, int case_count, struct zuc_case **cases,
+	  int live_case_count, int live_test_count, int total_passed,
+	  int total_failed, int total_disabled, long total_elapsed)
+{
+	struct json_data *jdata = data;
+	FILE *fp = jdata->fp;
+	int i;
+
+	if (!fp)
+		return;
+
+	fprintf(fp, "{\n  \"tests\": %d, \"failures\": %d, \"disabled\": %d,"
+		" \"time_ms\": %ld, \"timestamp\": %lld,\n"
+		"  \"testsuites\": [\n",
+		live_test_count, total_failed, total_disabled, total_elapsed,
+		(long long)jdata->begin);
+
+	for (i = 0; i < case_count; ++i) {
+		emit_case(fp, cases[i]);
+		fprintf(fp, "%s\n", (i + 1 < case_count) ? "," : "");
+	}
+
+	fprintf(fp, "  ]\n}\n");
+
+	fclose(fp);
+	jdata->fp = NULL;
+}
+
+static void
+destroy(void *data)
+{
+	struct json_data *jdata = data;
+
+	if (jdata->fp)
+		fclose(jdata->fp);
+
+	free(data);
+}
+
+struct zuc_event_listener *
+zuc_json_reporter_create(void)
+{
+	struct zuc_event_listener *listener =
+		zalloc(sizeof(struct zuc_event_listener));
+
+	listener->data = zalloc(sizeof(struct json_data));
+	listener->destroy = destroy;
+	listener->run_started = run_started;
+	listener->run_ended = run_ended;
+
+	return listener;
+}
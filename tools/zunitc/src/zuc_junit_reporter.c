@@ -71,6 +71,46 @@ set_attribute(xmlNodePtr node, const char *name, int value)
 	xmlSetProp(node, BAD_CAST name, scratch);
 }
 
+static void
+add_property(xmlNodePtr parent, const char *name, const char *fmt,
+	     double value)
+{
+	xmlChar scratch[MAX_64BIT_STRLEN + 8] = {};
+	xmlNodePtr node = xmlNewChild(parent, NULL, BAD_CAST "property", NULL);
+
+	xmlStrPrintf(scratch, sizeof(scratch), BAD_CAST fmt, value);
+	xmlSetProp(node, BAD_CAST "name", BAD_CAST name);
+	xmlSetProp(node, BAD_CAST "value", scratch);
+}
+
+/**
+ * Output benchmark results as properties of a test.
+ * Times are in nanoseconds per iteration.
+ *
+ * @param parent the parent node to add new content to.
+ * @param bench the results to write out.
+ */
+static void
+emit_bench(xmlNodePtr parent, struct zuc_bench *bench)
+{
+	xmlNodePtr node = xmlNewChild(parent, NULL, BAD_CAST "properties", NULL);
+
+	add_property(node, "bench.iterations", "%.0f", bench->iterations);
+	add_property(node, "bench.samples", "%.0f", bench->samples);
+	add_property(node, "bench.wall_min_ns", "%.1f",
+		     bench->wall_min);
+	add_property(node, "bench.wall_median_ns", "%.1f",
+		     bench->wall_median);
+	add_property(node, "bench.wall_p99_ns", "%.1f",
+		     bench->wall_p99);
+	add_property(node, "bench.cpu_min_ns", "%.1f",
+		     bench->cpu_min);
+	add_property(node, "bench.cpu_median_ns", "%.1f",
+		     bench->cpu_median);
+	add_property(node, "bench.cpu_p99_ns", "%.1f",
+		     bench->cpu_p99);
+}
+
 /**
  * Output the given event.
  *
@@ -278,6 +318,9 @@ emit_test(xmlNodePtr parent, struct zuc_test *test)
 
 	xmlSetProp(node, BAD_CAST "classname", BAD_CAST test->test_case->name);
 
+	if (test->bench)
+		emit_bench(node, test->bench);
+
 	if ((test->failed || test->fatal || test->skipped) && test->events) {
 		struct zuc_event *evt;
 		for (evt = test->events; evt; evt = evt->next)
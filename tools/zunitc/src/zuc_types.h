@@ -30,6 +30,21 @@
 
 struct zuc_case;
 
+/**
+ * Results of a benchmark run. Times are in nanoseconds per iteration.
+ */
+struct zuc_bench
+{
+	uint64_t iterations;	/**< iterations per sample. */
+	int samples;		/**< number of timed samples. */
+	double wall_min;
+	double wall_median;
+	double wall_p99;
+	double cpu_min;
+	double cpu_median;
+	double cpu_p99;
+};
+
 /**
  * Represents a specific test.
  */
@@ -47,6 +62,7 @@ struct zuc_test
 	long elapsed;
 	struct zuc_event *events;
 	struct zuc_event *deferred;
+	struct zuc_bench *bench;
 };
 
 /**
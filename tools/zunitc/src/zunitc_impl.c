@@ -44,6 +44,7 @@
 #include "zuc_collector.h"
 #include "zuc_context.h"
 #include "zuc_event_listener.h"
+#include "zuc_json_reporter.h"
 #include "zuc_junit_reporter.h"
 
 #include "shared/config-parser.h"
@@ -66,6 +67,10 @@ static char const DISABLED_PREFIX[] = "DISABLED_";
 
 #define MS_PER_SEC 1000L
 #define NANO_PER_MS 1000000L
+#define NANO_PER_SEC 1000000000L
+
+/* Upper bound on the iterations of a single benchmark sample. */
+#define BENCH_MAX_ITERATIONS (1ULL << 40)
 
 /**
  * Simple single-linked list structure.
@@ -84,6 +89,8 @@ static struct zuc_context g_ctx = {
 	.random = 0,
 	.spawn = true,
 	.break_on_failure = false,
+	.bench_samples = 10,
+	.bench_min_time = 10,
 	.fds = {-1, -1},
 
 	.listeners = NULL,
@@ -159,6 +166,24 @@ zuc_set_output_junit(bool enable)
 	g_ctx.output_junit = enable;
 }
 
+void
+zuc_set_output_json(bool enable)
+{
+	g_ctx.output_json = enable;
+}
+
+void
+zuc_set_bench_samples(int samples)
+{
+	g_ctx.bench_samples = samples > 0 ? samples : 1;
+}
+
+void
+zuc_set_bench_min_time(int ms)
+{
+	g_ctx.bench_min_time = ms > 0 ? ms : 1;
+}
+
 const char *
 zuc_get_program_name(void)
 {
@@ -351,6 +376,7 @@ free_test(struct zuc_test *test)
 	free(test->name);
 	free_events(&test->events);
 	free_events(&test->deferred);
+	free(test->bench);
 	free(test);
 }
 
@@ -531,6 +557,9 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 	int opt_random = 0;
 	int opt_break_on_failure = 0;
 	int opt_junit = 0;
+	int opt_json = 0;
+	int opt_bench_samples = 0;
+	int opt_bench_min_time = 0;
 	char *opt_filter = NULL;
 
 	char *help_param = NULL;
@@ -546,6 +575,11 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 #if ENABLE_JUNIT_XML
 		{ WESTON_OPTION_BOOLEAN, "zuc-output-xml", 0, &opt_junit },
 #endif
+		{ WESTON_OPTION_BOOLEAN, "zuc-output-json", 0, &opt_json },
+		{ WESTON_OPTION_INTEGER, "zuc-bench-samples", 0,
+		  &opt_bench_samples },
+		{ WESTON_OPTION_INTEGER, "zuc-bench-min-time", 0,
+		  &opt_bench_min_time },
 		{ WESTON_OPTION_STRING, "zuc-filter", 0, &opt_filter },
 	};
 
@@ -630,6 +664,8 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 
 	if (opt_help) {
 		printf("Usage: %s [OPTIONS]\n"
+		       "  --zuc-bench-min-time=MS   [default 10]\n"
+		       "  --zuc-bench-samples=N     [default 10]\n"
 		       "  --zuc-break-on-failure\n"
 		       "  --zuc-filter=FILTER\n"
 		       "  --zuc-list-tests\n"
@@ -637,6 +673,7 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 #if ENABLE_JUNIT_XML
 		       "  --zuc-output-xml\n"
 #endif
+		       "  --zuc-output-json\n"
 		       "  --zuc-random=N            [0|1|<seed number>]\n"
 		       "  --zuc-repeat=N\n"
 		       "  --help\n",
@@ -653,6 +690,11 @@ zuc_initialize(int *argc, char *argv[], bool *help_flagged)
 		zuc_set_spawn(!opt_nofork);
 		zuc_set_break_on_failure(opt_break_on_failure);
 		zuc_set_output_junit(opt_junit);
+		zuc_set_output_json(opt_json);
+		if (opt_bench_samples)
+			zuc_set_bench_samples(opt_bench_samples);
+		if (opt_bench_min_time)
+			zuc_set_bench_min_time(opt_bench_min_time);
 		rc = EXIT_SUCCESS;
 	}
 
@@ -770,6 +812,18 @@ dispatch_test_disabled(struct zuc_context *ctx, struct zuc_test *test)
 	}
 }
 
+static void
+dispatch_bench_ended(struct zuc_context *ctx, struct zuc_test *test,
+		     const struct zuc_bench *bench)
+{
+	struct zuc_slinked *curr;
+	for (curr = ctx->listeners; curr; curr = curr->next) {
+		struct zuc_event_listener *listener = curr->data;
+		if (listener->bench_ended)
+			listener->bench_ended(listener->data, test, bench);
+	}
+}
+
 static void
 dispatch_check_triggered(struct zuc_context *ctx, char const *file, int line,
 			 enum zuc_fail_state state, enum zuc_check_op op,
@@ -1247,6 +1301,8 @@ reset_test_values(struct zuc_case **cases, int case_count)
 			test->failed = 0;
 			test->fatal = 0;
 			test->elapsed = 0;
+			free(test->bench);
+			test->bench = NULL;
 
 			free_events(&test->events);
 			free_events(&test->deferred);
@@ -1318,6 +1374,8 @@ zucimpl_run_tests(void)
 		zuc_add_event_listener(zuc_base_logger_create());
 		if (g_ctx.output_junit)
 			zuc_add_event_listener(zuc_junit_reporter_create());
+		if (g_ctx.output_json)
+			zuc_add_event_listener(zuc_json_reporter_create());
 	}
 
 	if (g_ctx.case_count < 1) {
@@ -1349,6 +1407,147 @@ zucimpl_run_tests(void)
 	return rc;
 }
 
+static int64_t
+timespec_diff_nsec(const struct timespec *end, const struct timespec *begin)
+{
+	return (int64_t)(end->tv_sec - begin->tv_sec) * NANO_PER_SEC +
+		(end->tv_nsec - begin->tv_nsec);
+}
+
+/**
+ * Runs one benchmark sample of the given number of iterations.
+ *
+ * @param cpu_ns set to the CPU time consumed by the sample.
+ * @return the wall-clock time taken by the sample, in nanoseconds.
+ */
+static int64_t
+run_bench_sample(zucimpl_bench_fn fn, zucimpl_bench_fn_f fn_f, void *data,
+		 uint64_t iterations, int64_t *cpu_ns)
+{
+	struct timespec wall_begin, wall_end;
+	struct timespec cpu_begin, cpu_end;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_begin);
+	clock_gettime(TARGET_TIMER, &wall_begin);
+
+	if (fn_f)
+		fn_f(data, iterations);
+	else
+		fn(iterations);
+
+	clock_gettime(TARGET_TIMER, &wall_end);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+
+	*cpu_ns = timespec_diff_nsec(&cpu_end, &cpu_begin);
+
+	return timespec_diff_nsec(&wall_end, &wall_begin);
+}
+
+static int
+compare_double(const void *lhs, const void *rhs)
+{
+	double a = *(const double *)lhs;
+	double b = *(const double *)rhs;
+
+	return (a > b) - (a < b);
+}
+
+/* Nearest-rank percentile of an already sorted array. */
+static double
+percentile(const double *sorted, int count, int percent)
+{
+	int rank = (count * percent + 99) / 100;
+
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+void
+zucimpl_run_bench(zucimpl_bench_fn fn, zucimpl_bench_fn_f fn_f, void *data)
+{
+	int64_t min_ns = (int64_t)g_ctx.bench_min_time * NANO_PER_MS;
+	int samples = g_ctx.bench_samples;
+	struct zuc_test *test = g_ctx.curr_test;
+	struct zuc_bench *bench = NULL;
+	uint64_t iterations = 1;
+	double *wall = NULL;
+	double *cpu = NULL;
+	int64_t wall_ns, cpu_ns;
+	int i;
+
+	if (!test)
+		return;
+
+	/*
+	 * The first call warms up caches and lazy initialization; it and
+	 * the calls that follow calibrate the iteration count, growing it
+	 * towards the minimum sample time from the last measurement.
+	 */
+	for (;;) {
+		uint64_t next;
+
+		wall_ns = run_bench_sample(fn, fn_f, data, iterations, &cpu_ns);
+		if (test_has_failure(test) || test_has_skip(test))
+			return;
+
+		if (wall_ns >= min_ns || iterations >= BENCH_MAX_ITERATIONS)
+			break;
+
+		if (wall_ns <= 0)
+			next = iterations * 100;
+		else
+			next = iterations * (min_ns * 1.2 / wall_ns);
+
+		if (next > iterations * 100)
+			next = iterations * 100;
+		if (next <= iterations)
+			next = iterations + 1;
+		if (next > BENCH_MAX_ITERATIONS)
+			next = BENCH_MAX_ITERATIONS;
+		iterations = next;
+	}
+
+	wall = zalloc(samples * sizeof(*wall));
+	cpu = zalloc(samples * sizeof(*cpu));
+	bench = zalloc(sizeof(*bench));
+	if (!wall || !cpu || !bench) {
+		printf("%s:%d: error: alloc failed.\n", __FILE__, __LINE__);
+		mark_failed(test, ZUC_CHECK_ERROR);
+		goto out;
+	}
+
+	for (i = 0; i < samples; ++i) {
+		wall_ns = run_bench_sample(fn, fn_f, data, iterations, &cpu_ns);
+		if (test_has_failure(test) || test_has_skip(test))
+			goto out;
+
+		wall[i] = (double)wall_ns / iterations;
+		cpu[i] = (double)cpu_ns / iterations;
+	}
+
+	qsort(wall, samples, sizeof(*wall), compare_double);
+	qsort(cpu, samples, sizeof(*cpu), compare_double);
+
+	bench->iterations = iterations;
+	bench->samples = samples;
+	bench->wall_min = wall[0];
+	bench->wall_median = percentile(wall, samples, 50);
+	bench->wall_p99 = percentile(wall, samples, 99);
+	bench->cpu_min = cpu[0];
+	bench->cpu_median = percentile(cpu, samples, 50);
+	bench->cpu_p99 = percentile(cpu, samples, 99);
+
+	free(test->bench);
+	test->bench = bench;
+	bench = NULL;
+
+	dispatch_bench_ended(&g_ctx, test, test->bench);
+
+out:
+	free(bench);
+	free(cpu);
+	free(wall);
+}
+
 int
 zucimpl_tracepoint(char const *file, int line, char const *fmt, ...)
 {
@@ -0,0 +1,90 @@
+/*
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+/**
+ * Tests of benchmarks.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "zunitc/zunitc.h"
+
+/* Keeps the compiler from optimizing the measured loops away. */
+static volatile uint32_t sink;
+
+ZUC_BENCH(bench_basic, checksum)
+{
+	uint64_t i;
+	uint32_t sum = 0;
+
+	ZUC_ASSERT_GT(iterations, 0);
+
+	for (i = 0; i < iterations; ++i)
+		sum = sum * 31 + (uint32_t)i;
+
+	sink = sum;
+}
+
+static void *
+setup_buffer(void *data)
+{
+	char *buf = malloc(4096);
+
+	ZUC_ASSERTG_NOT_NULL(buf, out);
+	memset(buf, 0x5a, 4096);
+
+out:
+	return buf;
+}
+
+static void
+teardown_buffer(void *data)
+{
+	free(data);
+}
+
+static struct zuc_fixture bench_fixture = {
+	.set_up = setup_buffer,
+	.tear_down = teardown_buffer
+};
+
+ZUC_BENCH_F(bench_fixture, copy)
+{
+	char dst[4096];
+	uint64_t i;
+
+	ZUC_ASSERT_NOT_NULL(data);
+
+	for (i = 0; i < iterations; ++i) {
+		memcpy(dst, data, sizeof(dst));
+		sink += dst[i % sizeof(dst)];
+	}
+
+	ZUC_ASSERT_EQ(0x5a, dst[0]);
+}
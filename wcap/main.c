@@ -29,18 +29,84 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <sys/mman.h>
-#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
+#include <stdarg.h>
 
 #include <cairo.h>
 
 #include "wcap-decode.h"
 
+#ifdef BUILD_VAAPI_RECORDER
+#include "vaapi-recorder.h"
+
+int weston_log(const char *fmt, ...);
+
+/* The recorder reports its errors through the compositor log */
+int
+weston_log(const char *fmt, ...)
+{
+	va_list ap;
+	int l;
+
+	va_start(ap, fmt);
+	l = vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	return l;
+}
+
+static struct vaapi_recorder *
+create_h264_encoder(struct wcap_decoder *decoder, const char *device,
+		    const char *filename, int num, int denom)
+{
+	struct vaapi_recorder *recorder;
+	int fd;
+
+	if (decoder->format != WCAP_FORMAT_XRGB8888 &&
+	    decoder->format != WCAP_FORMAT_XBGR8888) {
+		fprintf(stderr, "h264 output needs an xrgb or xbgr capture\n");
+		return NULL;
+	}
+
+	fd = open(device, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "failed to open %s: %m\n", device);
+		return NULL;
+	}
+
+	/* The recorder owns the fd from here on */
+	recorder = vaapi_recorder_create(fd, decoder->width, decoder->height,
+					 filename);
+	if (recorder == NULL) {
+		fprintf(stderr, "failed to create h264 encoder on %s\n",
+			device);
+		close(fd);
+		return NULL;
+	}
+
+	vaapi_recorder_set_rate(recorder, num, denom);
+
+	return recorder;
+}
+#endif
+
+#define MAX_CONVERT_THREADS 8
+
+struct convert_job {
+	struct wcap_decoder *decoder;
+	unsigned char *out;
+	int depth;
+	int first, last;
+	int started;
+	pthread_t thread;
+};
+
 static void
 write_png(struct wcap_decoder *decoder, const char *filename)
 {
@@ -99,7 +165,8 @@ int clamp_uv(int u)
 }
 
 static void
-convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out,
+		int first, int last)
 {
 	unsigned char *y1, *y2, *u, *v;
 	uint32_t *p1, *p2, *end;
@@ -108,7 +175,7 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 
 	stride0 = decoder->width;
 	stride1 = decoder->width / 2;
-	for (i = 0; i < decoder->height; i += 2) {
+	for (i = first; i < last; i += 2) {
 		y1 = out + stride0 * i;
 		y2 = y1 + stride0;
 		v = out + stride0 * decoder->height + stride1 * i / 2;
@@ -138,9 +205,9 @@ convert_to_yv12(struct wcap_decoder *decoder, unsigned char *out)
 }
 
 static void
-convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
+convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out,
+		  int first, int last)
 {
-
 	unsigned char *yp, *up, *vp;
 	uint32_t *rp, *end;
 	int u, v;
@@ -149,7 +216,7 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 
 	stride = decoder->width;
 	psize = stride * decoder->height;
-	for (i = 0; i < decoder->height; i++) {
+	for (i = first; i < last; i++) {
 		yp = out + stride * i;
 		up = yp + (psize * 2);
 		vp = yp + (psize * 1);
@@ -169,8 +236,59 @@ convert_to_yuv444(struct wcap_decoder *decoder, unsigned char *out)
 	}
 }
 
+static void *
+convert_thread(void *data)
+{
+	struct convert_job *job = data;
+
+	if (job->depth == 444)
+		convert_to_yuv444(job->decoder, job->out,
+				  job->first, job->last);
+	else
+		convert_to_yv12(job->decoder, job->out,
+				job->first, job->last);
+
+	return NULL;
+}
+
+/* Split the frame into bands of rows and convert them in parallel.
+ * Bands start on even rows so each 2x2 chroma block stays in one
+ * band. */
 static void
-output_yuv_frame(struct wcap_decoder *decoder, int depth)
+convert_frame(struct wcap_decoder *decoder, unsigned char *out,
+	      int depth, int threads)
+{
+	struct convert_job jobs[MAX_CONVERT_THREADS];
+	int i, n, band;
+
+	band = ((decoder->height + threads - 1) / threads + 1) & ~1;
+	for (n = 0; n < threads && n * band < decoder->height; n++) {
+		jobs[n].decoder = decoder;
+		jobs[n].out = out;
+		jobs[n].depth = depth;
+		jobs[n].first = n * band;
+		jobs[n].last = (n + 1) * band;
+		if (jobs[n].last > decoder->height)
+			jobs[n].last = decoder->height;
+	}
+
+	/* The last band is converted on this thread, as is any band
+	 * we fail to start a thread for. */
+	for (i = 0; i < n - 1; i++)
+		jobs[i].started = pthread_create(&jobs[i].thread, NULL,
+						 convert_thread, &jobs[i]) == 0;
+	convert_thread(&jobs[n - 1]);
+
+	for (i = 0; i < n - 1; i++) {
+		if (jobs[i].started)
+			pthread_join(jobs[i].thread, NULL);
+		else
+			convert_thread(&jobs[i]);
+	}
+}
+
+static void
+output_yuv_frame(struct wcap_decoder *decoder, int depth, int threads)
 {
 	static unsigned char *out;
 	int size;
@@ -183,11 +301,7 @@ output_yuv_frame(struct wcap_decoder *decoder, int depth)
 	if (out == NULL)
 		out = malloc(size);
 
-	if (depth == 444) {
-		convert_to_yuv444(decoder, out);
-	} else {
-		convert_to_yv12(decoder, out);
-	}
+	convert_frame(decoder, out, depth, threads);
 
 	printf("FRAME\n");
 	fwrite(out, 1, size, stdout);
@@ -198,14 +312,20 @@ usage(int exit_code)
 {
 	fprintf(stderr, "usage: wcap-decode "
 		"[--help] [--yuv4mpeg2] [--frame=<frame>] [--all] \n"
-		"\t[--rate=<num:denom>] <wcap file>\n\n"
+		"\t[--rate=<num:denom>] [--threads=<n>]\n"
+		"\t[--h264=<file>] [--vaapi-device=<device>] <wcap file>\n\n"
 		"\t--help\t\t\tthis help text\n"
 		"\t--yuv4mpeg2\t\tdump wcap file to stdout in yuv4mpeg2 format\n"
 		"\t--yuv4mpeg2-444\t\tdump wcap file to stdout in yuv4mpeg2 444 format\n"
 		"\t--frame=<frame>\t\twrite out the given frame number as png\n"
 		"\t--all\t\t\twrite all frames as pngs\n"
 		"\t--rate=<num:denom>\treplay frame rate for yuv4mpeg2,\n"
-		"\t\t\t\tspecified as an integer fraction\n\n");
+		"\t\t\t\tspecified as an integer fraction\n"
+		"\t--threads=<n>\t\tnumber of threads for yuv conversion\n"
+		"\t--h264=<file>\t\tencode to an h264 elementary stream\n"
+		"\t\t\t\twith vaapi, at the replay frame rate\n"
+		"\t--vaapi-device=<device>\tdrm device to encode on,\n"
+		"\t\t\t\tdefaults to /dev/dri/renderD128\n\n");
 
 	exit(exit_code);
 }
@@ -214,10 +334,15 @@ int main(int argc, char *argv[])
 {
 	struct wcap_decoder *decoder;
 	int i, j, output_frame = -1, yuv4mpeg2 = 0, all = 0, has_frame;
-	int num = 30, denom = 1;
+	int num = 30, denom = 1, threads = 0;
 	char filename[200];
 	char *mode;
+	const char *h264 = NULL;
+	const char *device = "/dev/dri/renderD128";
 	uint32_t msecs, frame_time;
+#ifdef BUILD_VAAPI_RECORDER
+	struct vaapi_recorder *recorder = NULL;
+#endif
 
 	for (i = 1, j = 1; i < argc; i++) {
 		if (strcmp(argv[i], "--yuv4mpeg2-444") == 0) {
@@ -234,6 +359,12 @@ int main(int argc, char *argv[])
 			;
 		} else if (sscanf(argv[i], "--rate=%d:%d", &num, &denom) == 2) {
 			;
+		} else if (sscanf(argv[i], "--threads=%d", &threads) == 1) {
+			;
+		} else if (strncmp(argv[i], "--h264=", 7) == 0) {
+			h264 = argv[i] + 7;
+		} else if (strncmp(argv[i], "--vaapi-device=", 15) == 0) {
+			device = argv[i] + 15;
 		} else if (strcmp(argv[i], "--") == 0) {
 			break;
 		} else if (argv[i][0] == '-') {
@@ -252,6 +383,19 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "invalid rate, denom can not be 0\n");
 		exit(EXIT_FAILURE);
 	}
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
+	if (threads > MAX_CONVERT_THREADS)
+		threads = MAX_CONVERT_THREADS;
+#ifndef BUILD_VAAPI_RECORDER
+	if (h264) {
+		fprintf(stderr, "h264 output needs weston built with "
+			"the vaapi recorder\n");
+		exit(EXIT_FAILURE);
+	}
+#endif
 
 	decoder = wcap_decoder_create(argv[1]);
 	if (decoder == NULL) {
@@ -279,10 +423,40 @@ int main(int argc, char *argv[])
 		fflush(stdout);
 	}
 
+#ifdef BUILD_VAAPI_RECORDER
+	if (h264) {
+		recorder = create_h264_encoder(decoder, device, h264,
+					       num, denom);
+		if (recorder == NULL) {
+			wcap_decoder_destroy(decoder);
+			exit(EXIT_FAILURE);
+		}
+	}
+#endif
+
 	i = 0;
 	has_frame = wcap_decoder_get_frame(decoder);
 	msecs = decoder->msecs;
 	frame_time = 1000 * denom / num;
+
+	/* Extracting a single frame only needs to decode from the key
+	 * frame before it. */
+	if (output_frame > 0 && !all && !yuv4mpeg2 && !h264) {
+		if (wcap_decoder_seek(decoder,
+				      msecs + output_frame * frame_time)) {
+			snprintf(filename, sizeof filename,
+				 "wcap-frame-%d.png", output_frame);
+			write_png(decoder, filename);
+			fprintf(stderr, "wrote %s\n", filename);
+		} else {
+			fprintf(stderr, "no frame %d in wcap file\n",
+				output_frame);
+		}
+		wcap_decoder_destroy(decoder);
+
+		return EXIT_SUCCESS;
+	}
+
 	while (has_frame) {
 		if (all || i == output_frame) {
 			snprintf(filename, sizeof filename,
@@ -291,7 +465,20 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "wrote %s\n", filename);
 		}
 		if (yuv4mpeg2)
-			output_yuv_frame(decoder, yuv4mpeg2);
+			output_yuv_frame(decoder, yuv4mpeg2, threads);
+#ifdef BUILD_VAAPI_RECORDER
+		/* Conversion and encoding both run on the GPU, and the
+		 * encoder thread overlaps with decoding the next frame. */
+		if (recorder &&
+		    vaapi_recorder_frame_data(recorder, decoder->frame,
+					      decoder->width * 4,
+					      decoder->format ==
+					      WCAP_FORMAT_XBGR8888) < 0) {
+			fprintf(stderr, "h264 encoding failed at frame %d\n",
+				i);
+			break;
+		}
+#endif
 		i++;
 		msecs += frame_time;
 		while (decoder->msecs < msecs && has_frame)
@@ -301,6 +488,12 @@ int main(int argc, char *argv[])
 	fprintf(stderr, "wcap file: size %dx%d, %d frames\n",
 		decoder->width, decoder->height, i);
 
+#ifdef BUILD_VAAPI_RECORDER
+	/* Waits for the queued frames to be encoded */
+	if (recorder)
+		vaapi_recorder_destroy(recorder);
+#endif
+
 	wcap_decoder_destroy(decoder);
 
 	return EXIT_SUCCESS;
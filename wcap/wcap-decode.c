@@ -36,20 +36,53 @@
 #include <string.h>
 #include <fcntl.h>
 
-#include <cairo.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
 
 #include "wcap-decode.h"
 
+/* Add the color channels bytewise, without carrying across channels */
+static inline uint32_t
+component_add(uint32_t pixel, uint32_t delta)
+{
+	return (((pixel & 0x7f7f7f7f) + (delta & 0x7f7f7f7f)) ^
+		((pixel ^ delta) & 0x80808080)) | 0xff000000;
+}
+
 static void
-wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
-			      struct wcap_rectangle *rect)
+apply_run(uint32_t *d, int count, uint32_t delta)
+{
+	int k = 0;
+#ifdef __SSE2__
+	__m128i deltas = _mm_set1_epi32(delta);
+	__m128i alpha = _mm_set1_epi32(0xff000000);
+	__m128i v;
+
+	for (; k + 4 <= count; k += 4) {
+		v = _mm_loadu_si128((const __m128i *) (d + k));
+		v = _mm_or_si128(_mm_add_epi8(v, deltas), alpha);
+		_mm_storeu_si128((__m128i *) (d + k), v);
+	}
+#endif
+
+	for (; k < count; k++)
+		d[k] = component_add(d[k], delta);
+}
+
+uint32_t *
+wcap_decode_rectangle(uint32_t *frame, int stride,
+		      const struct wcap_rectangle *rect, uint32_t *p)
 {
-	uint32_t v, *p = decoder->p, *d;
+	uint32_t v, delta, *d;
 	int width = rect->x2 - rect->x1, height = rect->y2 - rect->y1;
-	int x, i, j, k, l, count = width * height;
-	unsigned char r, g, b, dr, dg, db;
+	int x, i, j, k, l, n, count = width * height;
 
-	d = decoder->frame + (rect->y2 - 1) * decoder->width;
+	d = frame + (rect->y2 - 1) * stride;
 	x = rect->x1;
 	i = 0;
 	while (i < count) {
@@ -61,18 +94,17 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 			j = 1 << (l - 0xe0 + 7);
 		}
 
-		dr = (v >> 16);
-		dg = (v >>  8);
-		db = (v >>  0);
-		for (k = 0; k < j; k++) {
-			r = (d[x] >> 16) + dr;
-			g = (d[x] >>  8) + dg;
-			b = (d[x] >>  0) + db;
-			d[x] = 0xff000000 | (r << 16) | (g << 8) | b;
-			x++;
+		/* A run can wrap around any number of rows */
+		delta = v & 0x00ffffff;
+		for (k = 0; k < j && i + k < count; k += n) {
+			n = rect->x2 - x;
+			if (n > j - k)
+				n = j - k;
+			apply_run(d + x, n, delta);
+			x += n;
 			if (x == rect->x2) {
 				x = rect->x1;
-				d -= decoder->width;
+				d -= stride;
 			}
 		}
 		i += j;
@@ -82,7 +114,81 @@ wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
 		printf("rle encoding longer than expected (%d expected %d)\n",
 		       i, count);
 
-	decoder->p = p;
+	return p;
+}
+
+static uint32_t *
+wcap_decoder_decode_rectangle(struct wcap_decoder *decoder,
+			      struct wcap_rectangle *rect, uint32_t *p)
+{
+	return wcap_decode_rectangle(decoder->frame, decoder->width, rect, p);
+}
+
+static uint32_t *
+wcap_decoder_inflate(struct wcap_decoder *decoder,
+		     struct wcap_frame_header_v2 *header, void *payload)
+{
+#ifdef HAVE_ZLIB
+	uLongf length = header->length;
+
+	if (decoder->scratch_size < header->length) {
+		free(decoder->scratch);
+		decoder->scratch = malloc(header->length);
+		if (decoder->scratch == NULL) {
+			decoder->scratch_size = 0;
+			return NULL;
+		}
+		decoder->scratch_size = header->length;
+	}
+
+	if (uncompress((Bytef *) decoder->scratch, &length,
+		       payload, header->size) != Z_OK ||
+	    length != header->length) {
+		fprintf(stderr, "corrupt compressed frame %d\n",
+			decoder->count);
+		return NULL;
+	}
+
+	return decoder->scratch;
+#else
+	fprintf(stderr, "wcap file is compressed, "
+		"but wcap-decode was built without zlib\n");
+	return NULL;
+#endif
+}
+
+static int
+wcap_decoder_get_frame_v2(struct wcap_decoder *decoder)
+{
+	struct wcap_frame_header_v2 *header;
+	struct wcap_rectangle *rects;
+	uint32_t i, *p;
+	void *payload;
+
+	header = decoder->p;
+	rects = (void *) (header + 1);
+	payload = rects + header->nrects;
+	decoder->p = (char *) payload + ((header->size + 3) & ~3);
+	decoder->msecs = header->msecs;
+	decoder->count++;
+
+	/* Key frames are encoded against a black frame, so decoding
+	 * can start at any of them. */
+	if (header->flags & WCAP_FRAME_KEY)
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+
+	if (header->flags & WCAP_FRAME_DEFLATE)
+		p = wcap_decoder_inflate(decoder, header, payload);
+	else
+		p = payload;
+	if (p == NULL)
+		return 0;
+
+	for (i = 0; i < header->nrects; i++)
+		p = wcap_decoder_decode_rectangle(decoder, &rects[i], p);
+
+	return 1;
 }
 
 int
@@ -90,19 +196,58 @@ wcap_decoder_get_frame(struct wcap_decoder *decoder)
 {
 	struct wcap_rectangle *rects;
 	struct wcap_frame_header *header;
-	uint32_t i;
+	uint32_t i, *p;
 
 	if (decoder->p == decoder->end)
 		return 0;
 
+	if (decoder->version == 2)
+		return wcap_decoder_get_frame_v2(decoder);
+
 	header = decoder->p;
 	decoder->msecs = header->msecs;
 	decoder->count++;
 
 	rects = (void *) (header + 1);
-	decoder->p = (uint32_t *) (rects + header->nrects);
+	p = (uint32_t *) (rects + header->nrects);
 	for (i = 0; i < header->nrects; i++)
-		wcap_decoder_decode_rectangle(decoder, &rects[i]);
+		p = wcap_decoder_decode_rectangle(decoder, &rects[i], p);
+	decoder->p = p;
+
+	return 1;
+}
+
+/* Decode the first frame with a timestamp of at least msecs, like
+ * calling wcap_decoder_get_frame() until reaching it would.  When the
+ * file has a key frame index, decoding starts from the last key frame
+ * before msecs instead of from the start of the file.  Returns 0 if
+ * the recording ends before msecs. */
+int
+wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs)
+{
+	struct wcap_index_entry *entry = NULL;
+	uint32_t i;
+
+	for (i = 0; i < decoder->index_count; i++) {
+		if (decoder->index[i].msecs > msecs)
+			break;
+		entry = &decoder->index[i];
+	}
+
+	if (entry) {
+		decoder->p = (char *) decoder->map + entry->offset;
+		decoder->count = entry->frame;
+	} else {
+		memset(decoder->frame, 0,
+		       decoder->width * decoder->height * 4);
+		decoder->p = decoder->first;
+		decoder->count = 0;
+	}
+
+	do {
+		if (!wcap_decoder_get_frame(decoder))
+			return 0;
+	} while (decoder->msecs < msecs);
 
 	return 1;
 }
@@ -112,6 +257,7 @@ wcap_decoder_create(const char *filename)
 {
 	struct wcap_decoder *decoder;
 	struct wcap_header *header;
+	struct wcap_header_v2 *header_v2;
 	int frame_size;
 	struct stat buf;
 
@@ -142,6 +288,31 @@ wcap_decoder_create(const char *filename)
 	decoder->height = header->height;
 	decoder->p = header + 1;
 	decoder->end = decoder->map + decoder->size;
+	decoder->index = NULL;
+	decoder->index_count = 0;
+	decoder->scratch = NULL;
+	decoder->scratch_size = 0;
+
+	if (header->magic == WCAP_HEADER_MAGIC_V2) {
+		header_v2 = decoder->map;
+		decoder->version = 2;
+		decoder->p = header_v2 + 1;
+
+		/* The index is written when recording stops; without
+		 * it we can still decode, just not seek. */
+		if (header_v2->index_offset != 0 &&
+		    header_v2->index_offset +
+		    header_v2->index_count * sizeof *decoder->index ==
+		    decoder->size) {
+			decoder->index = (void *) ((char *) decoder->map +
+						   header_v2->index_offset);
+			decoder->index_count = header_v2->index_count;
+			decoder->end = decoder->index;
+		}
+	} else {
+		decoder->version = 1;
+	}
+	decoder->first = decoder->p;
 
 	frame_size = header->width * header->height * 4;
 	decoder->frame = malloc(frame_size);
@@ -159,6 +330,7 @@ wcap_decoder_destroy(struct wcap_decoder *decoder)
 {
 	munmap(decoder->map, decoder->size);
 	close(decoder->fd);
+	free(decoder->scratch);
 	free(decoder->frame);
 	free(decoder);
 }
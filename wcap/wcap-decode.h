@@ -27,6 +27,7 @@
 #define _WCAP_DECODE_
 
 #define WCAP_HEADER_MAGIC	0x57434150
+#define WCAP_HEADER_MAGIC_V2	0x57434132
 
 #define WCAP_FORMAT_XRGB8888	0x34325258
 #define WCAP_FORMAT_XBGR8888	0x34324258
@@ -44,6 +45,32 @@ struct wcap_frame_header {
 	uint32_t nrects;
 };
 
+#define WCAP_FRAME_KEY		(1 << 0)
+#define WCAP_FRAME_DEFLATE	(1 << 1)
+
+struct wcap_header_v2 {
+	uint32_t magic;
+	uint32_t format;
+	uint32_t width, height;
+	uint32_t frame_count;
+	uint32_t index_count;
+	uint64_t index_offset;
+};
+
+struct wcap_frame_header_v2 {
+	uint32_t msecs;
+	uint32_t nrects;
+	uint32_t flags;
+	uint32_t size;
+	uint32_t length;
+};
+
+struct wcap_index_entry {
+	uint64_t offset;
+	uint32_t msecs;
+	uint32_t frame;
+};
+
 struct wcap_rectangle {
 	int32_t x1, y1, x2, y2;
 };
@@ -57,9 +84,20 @@ struct wcap_decoder {
 	uint32_t msecs;
 	uint32_t count;
 	int width, height;
+
+	int version;
+	void *first;
+	struct wcap_index_entry *index;
+	uint32_t index_count;
+	uint32_t *scratch;
+	size_t scratch_size;
 };
 
+uint32_t *wcap_decode_rectangle(uint32_t *frame, int stride,
+				const struct wcap_rectangle *rect,
+				uint32_t *p);
 int wcap_decoder_get_frame(struct wcap_decoder *decoder);
+int wcap_decoder_seek(struct wcap_decoder *decoder, uint32_t msecs);
 struct wcap_decoder *wcap_decoder_create(const char *filename);
 void wcap_decoder_destroy(struct wcap_decoder *decoder);
 
@@ -0,0 +1,132 @@
+/*
+ * Copyright © 2008-2011 Kristian Høgsberg
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "config.h"
+
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "wcap-encode.h"
+
+static uint32_t *
+output_run(uint32_t *p, uint32_t delta, int run)
+{
+	int i;
+
+	while (run > 0) {
+		if (run <= 0xe0) {
+			*p++ = delta | ((run - 1) << 24);
+			break;
+		}
+
+		i = 24 - __builtin_clz(run);
+		*p++ = delta | ((i + 0xe0) << 24);
+		run -= 1 << (7 + i);
+	}
+
+	return p;
+}
+
+/* Subtract the color channels bytewise, without borrowing across
+ * channels, all in one go. */
+static inline uint32_t
+component_delta(uint32_t next, uint32_t prev)
+{
+	return (((next | 0x80808080) - (prev & 0x7f7f7f7f)) ^
+		((next ^ ~prev) & 0x80808080)) & 0x00ffffff;
+}
+
+uint32_t *
+wcap_encode_rectangle(uint32_t *p, uint32_t *reference,
+		      int reference_stride, const uint32_t *pixels,
+		      int width, int height, int key)
+{
+	uint32_t delta, prev, next, *d;
+	int j, k, run;
+#ifdef __SSE2__
+	__m128i n, r, deltas, mask = _mm_set1_epi32(0x00ffffff);
+	uint32_t lanes[4];
+	int l;
+#endif
+
+	run = prev = 0;
+	for (j = 0; j < height; j++) {
+		d = reference + j * reference_stride;
+		k = 0;
+
+#ifdef __SSE2__
+		/* Four pixels at a time; the common case of all four
+		 * continuing the current run needs no per-pixel work. */
+		for (; k + 4 <= width; k += 4) {
+			n = _mm_loadu_si128((const __m128i *) (pixels + k));
+			if (key)
+				r = _mm_setzero_si128();
+			else
+				r = _mm_loadu_si128((const __m128i *) (d + k));
+			deltas = _mm_and_si128(_mm_sub_epi8(n, r), mask);
+			_mm_storeu_si128((__m128i *) (d + k), n);
+
+			if (run > 0 &&
+			    _mm_movemask_epi8(_mm_cmpeq_epi32(deltas,
+					_mm_set1_epi32(prev))) == 0xffff) {
+				run += 4;
+				continue;
+			}
+
+			_mm_storeu_si128((__m128i *) lanes, deltas);
+			for (l = 0; l < 4; l++) {
+				if (run == 0 || lanes[l] == prev) {
+					run++;
+				} else {
+					p = output_run(p, prev, run);
+					run = 1;
+				}
+				prev = lanes[l];
+			}
+		}
+#endif
+
+		for (; k < width; k++) {
+			next = pixels[k];
+			delta = component_delta(next, key ? 0 : d[k]);
+			d[k] = next;
+			if (run == 0 || delta == prev) {
+				run++;
+			} else {
+				p = output_run(p, prev, run);
+				run = 1;
+			}
+			prev = delta;
+		}
+
+		pixels += width;
+	}
+
+	return output_run(p, prev, run);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright © 2008-2011 Kristian Høgsberg
+ * Copyright © 2026 The Weston Authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _WCAP_ENCODE_
+#define _WCAP_ENCODE_
+
+#include <stdint.h>
+
+/* Append the run-length encoded difference between a rectangle of
+ * pixels and the corresponding part of the reference frame to out, and
+ * copy the pixels into the reference frame.  The rectangle's rows are
+ * packed in pixels, and the row of the reference frame matching row j
+ * starts at reference + j * reference_stride.  A key frame is encoded
+ * against black instead.  Returns the new end of out, which needs room
+ * for up to width * height words. */
+uint32_t *
+wcap_encode_rectangle(uint32_t *out, uint32_t *reference,
+		      int reference_stride, const uint32_t *pixels,
+		      int width, int height, int key);
+
+#endif
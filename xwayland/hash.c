@@ -39,6 +39,15 @@
 
 #include "hash.h"
 
+/*
+ * Open addressing with linear probing over a power-of-two table, and
+ * backward shift deletion so that no tombstones are left behind. X
+ * resource ids are mostly sequential, so they are spread over the
+ * table with a multiplicative (Fibonacci) hash.
+ *
+ * An entry is free when its data is NULL, so NULL cannot be stored.
+ */
+
 struct hash_entry {
 	uint32_t hash;
 	void *data;
@@ -47,75 +56,40 @@ struct hash_entry {
 struct hash_table {
 	struct hash_entry *table;
 	uint32_t size;
-	uint32_t rehash;
-	uint32_t max_entries;
-	uint32_t size_index;
+	uint32_t mask;
+	uint32_t shift;
 	uint32_t entries;
-	uint32_t deleted_entries;
-};
-
-#define ARRAY_SIZE(array) (sizeof(array) / sizeof(array[0]))
-
-/*
- * From Knuth -- a good choice for hash/rehash values is p, p-2 where
- * p and p-2 are both prime.  These tables are sized to have an extra 10%
- * free to avoid exponential performance degradation as the hash table fills
- */
 
-static const uint32_t deleted_data;
-
-static const struct {
-   uint32_t max_entries, size, rehash;
-} hash_sizes[] = {
-    { 2,		5,		3	  },
-    { 4,		7,		5	  },
-    { 8,		13,		11	  },
-    { 16,		19,		17	  },
-    { 32,		43,		41        },
-    { 64,		73,		71        },
-    { 128,		151,		149       },
-    { 256,		283,		281       },
-    { 512,		571,		569       },
-    { 1024,		1153,		1151      },
-    { 2048,		2269,		2267      },
-    { 4096,		4519,		4517      },
-    { 8192,		9013,		9011      },
-    { 16384,		18043,		18041     },
-    { 32768,		36109,		36107     },
-    { 65536,		72091,		72089     },
-    { 131072,		144409,		144407    },
-    { 262144,		288361,		288359    },
-    { 524288,		576883,		576881    },
-    { 1048576,		1153459,	1153457   },
-    { 2097152,		2307163,	2307161   },
-    { 4194304,		4613893,	4613891   },
-    { 8388608,		9227641,	9227639   },
-    { 16777216,		18455029,	18455027  },
-    { 33554432,		36911011,	36911009  },
-    { 67108864,		73819861,	73819859  },
-    { 134217728,	147639589,	147639587 },
-    { 268435456,	295279081,	295279079 },
-    { 536870912,	590559793,	590559791 },
-    { 1073741824,	1181116273,	1181116271},
-    { 2147483648ul,	2362232233ul,	2362232231ul}
+	/* Result of the last successful lookup. X events tend to come
+	 * in runs for one window, so this saves most of the probing. */
+	struct hash_entry *last;
 };
 
-static int
-entry_is_free(struct hash_entry *entry)
-{
-	return entry->data == NULL;
-}
+#define HASH_TABLE_MIN_BITS 3
 
-static int
-entry_is_deleted(struct hash_entry *entry)
+static inline uint32_t
+hash_table_home(const struct hash_table *ht, uint32_t hash)
 {
-	return entry->data == &deleted_data;
+	return (hash * 2654435769u) >> ht->shift;
 }
 
 static int
-entry_is_present(struct hash_entry *entry)
+hash_table_alloc(struct hash_table *ht, uint32_t bits)
 {
-	return entry->data != NULL && entry->data != &deleted_data;
+	struct hash_entry *table;
+
+	table = calloc(1u << bits, sizeof *table);
+	if (table == NULL)
+		return -1;
+
+	ht->table = table;
+	ht->size = 1u << bits;
+	ht->mask = ht->size - 1;
+	ht->shift = 32 - bits;
+	ht->entries = 0;
+	ht->last = NULL;
+
+	return 0;
 }
 
 struct hash_table *
@@ -127,15 +101,7 @@ hash_table_create(void)
 	if (ht == NULL)
 		return NULL;
 
-	ht->size_index = 0;
-	ht->size = hash_sizes[ht->size_index].size;
-	ht->rehash = hash_sizes[ht->size_index].rehash;
-	ht->max_entries = hash_sizes[ht->size_index].max_entries;
-	ht->table = calloc(ht->size, sizeof(*ht->table));
-	ht->entries = 0;
-	ht->deleted_entries = 0;
-
-	if (ht->table == NULL) {
+	if (hash_table_alloc(ht, HASH_TABLE_MIN_BITS) < 0) {
 		free(ht);
 		return NULL;
 	}
@@ -157,36 +123,33 @@ hash_table_destroy(struct hash_table *ht)
 }
 
 /**
- * Finds a hash table entry with the given key and hash of that key.
+ * Finds the hash table entry with the given hash.
  *
- * Returns NULL if no entry is found.  Note that the data pointer may be
- * modified by the user.
+ * Returns NULL if no entry is found.
  */
-static void *
+static struct hash_entry *
 hash_table_search(struct hash_table *ht, uint32_t hash)
 {
-	uint32_t hash_address;
-
-	hash_address = hash % ht->size;
-	do {
-		uint32_t double_hash;
-
-		struct hash_entry *entry = ht->table + hash_address;
+	struct hash_entry *entry;
+	uint32_t i;
 
-		if (entry_is_free(entry)) {
+	i = hash_table_home(ht, hash);
+	while (1) {
+		entry = ht->table + i;
+		if (entry->data == NULL)
 			return NULL;
-		} else if (entry_is_present(entry) && entry->hash == hash) {
+		if (entry->hash == hash)
 			return entry;
-		}
-
-		double_hash = 1 + hash % ht->rehash;
 
-		hash_address = (hash_address + double_hash) % ht->size;
-	} while (hash_address != hash % ht->size);
-
-	return NULL;
+		i = (i + 1) & ht->mask;
+	}
 }
 
+/**
+ * Calls func on every element in the table.
+ *
+ * The table must not be modified from func.
+ */
 void
 hash_table_for_each(struct hash_table *ht,
 		    hash_table_iterator_func_t func, void *data)
@@ -196,7 +159,7 @@ hash_table_for_each(struct hash_table *ht,
 
 	for (i = 0; i < ht->size; i++) {
 		entry = ht->table + i;
-		if (entry_is_present(entry))
+		if (entry->data != NULL)
 			func(entry->data, data);
 	}
 }
@@ -206,104 +169,110 @@ hash_table_lookup(struct hash_table *ht, uint32_t hash)
 {
 	struct hash_entry *entry;
 
-	entry = hash_table_search(ht, hash);
-	if (entry != NULL)
+	entry = ht->last;
+	if (entry != NULL && entry->hash == hash)
 		return entry->data;
 
-	return NULL;
+	entry = hash_table_search(ht, hash);
+	if (entry == NULL)
+		return NULL;
+
+	ht->last = entry;
+
+	return entry->data;
 }
 
 static void
-hash_table_rehash(struct hash_table *ht, unsigned int new_size_index)
+hash_table_place(struct hash_table *ht, uint32_t hash, void *data)
 {
-	struct hash_table old_ht;
-	struct hash_entry *table, *entry;
+	struct hash_entry *entry;
+	uint32_t i;
 
-	if (new_size_index >= ARRAY_SIZE(hash_sizes))
-		return;
+	i = hash_table_home(ht, hash);
+	while (ht->table[i].data != NULL)
+		i = (i + 1) & ht->mask;
 
-	table = calloc(hash_sizes[new_size_index].size, sizeof(*ht->table));
-	if (table == NULL)
-		return;
+	entry = ht->table + i;
+	entry->hash = hash;
+	entry->data = data;
+	ht->entries++;
+}
 
-	old_ht = *ht;
+static int
+hash_table_grow(struct hash_table *ht)
+{
+	struct hash_table old_ht = *ht;
+	uint32_t i;
 
-	ht->table = table;
-	ht->size_index = new_size_index;
-	ht->size = hash_sizes[ht->size_index].size;
-	ht->rehash = hash_sizes[ht->size_index].rehash;
-	ht->max_entries = hash_sizes[ht->size_index].max_entries;
-	ht->entries = 0;
-	ht->deleted_entries = 0;
-
-	for (entry = old_ht.table;
-	     entry != old_ht.table + old_ht.size;
-	     entry++) {
-		if (entry_is_present(entry)) {
-			hash_table_insert(ht, entry->hash, entry->data);
-		}
+	if (hash_table_alloc(ht, 32 - ht->shift + 1) < 0) {
+		*ht = old_ht;
+		return -1;
 	}
 
+	for (i = 0; i < old_ht.size; i++)
+		if (old_ht.table[i].data != NULL)
+			hash_table_place(ht, old_ht.table[i].hash,
+					 old_ht.table[i].data);
+
 	free(old_ht.table);
+
+	return 0;
 }
 
 /**
  * Inserts the data with the given hash into the table.
  *
- * Note that insertion may rearrange the table on a resize or rehash,
- * so previously found hash_entries are no longer valid after this function.
+ * The table is kept at most 3/4 full. Returns -1 if it needed to grow
+ * and could not.
  */
 int
 hash_table_insert(struct hash_table *ht, uint32_t hash, void *data)
 {
-	uint32_t hash_address;
+	if ((ht->entries + 1) * 4 > ht->size * 3 &&
+	    hash_table_grow(ht) < 0)
+		return -1;
 
-	if (ht->entries >= ht->max_entries) {
-		hash_table_rehash(ht, ht->size_index + 1);
-	} else if (ht->deleted_entries + ht->entries >= ht->max_entries) {
-		hash_table_rehash(ht, ht->size_index);
-	}
+	hash_table_place(ht, hash, data);
 
-	hash_address = hash % ht->size;
-	do {
-		struct hash_entry *entry = ht->table + hash_address;
-		uint32_t double_hash;
-
-		if (!entry_is_present(entry)) {
-			if (entry_is_deleted(entry))
-				ht->deleted_entries--;
-			entry->hash = hash;
-			entry->data = data;
-			ht->entries++;
-			return 0;
-		}
-
-		double_hash = 1 + hash % ht->rehash;
-
-		hash_address = (hash_address + double_hash) % ht->size;
-	} while (hash_address != hash % ht->size);
-
-	/* We could hit here if a required resize failed. An unchecked-malloc
-	 * application could ignore this result.
-	 */
-	return -1;
+	return 0;
 }
 
 /**
- * This function deletes the given hash table entry.
+ * Deletes the entry with the given hash, if there is one.
  *
- * Note that deletion doesn't otherwise modify the table, so an iteration over
- * the table deleting entries is safe.
+ * The entries following it in its probe run are moved back to close
+ * the gap, so this must not be called from hash_table_for_each().
  */
 void
 hash_table_remove(struct hash_table *ht, uint32_t hash)
 {
 	struct hash_entry *entry;
+	uint32_t i, j, home;
 
 	entry = hash_table_search(ht, hash);
-	if (entry != NULL) {
-		entry->data = (void *) &deleted_data;
-		ht->entries--;
-		ht->deleted_entries++;
+	if (entry == NULL)
+		return;
+
+	ht->entries--;
+	ht->last = NULL;
+
+	i = entry - ht->table;
+	j = i;
+	while (1) {
+		j = (j + 1) & ht->mask;
+		if (ht->table[j].data == NULL)
+			break;
+
+		/* Move the entry at j into the hole at i unless its home
+		 * slot lies cyclically in (i, j], where it is still
+		 * reachable from. */
+		home = hash_table_home(ht, ht->table[j].hash);
+		if (((j - home) & ht->mask) < ((j - i) & ht->mask))
+			continue;
+
+		ht->table[i] = ht->table[j];
+		i = j;
 	}
+
+	ht->table[i].data = NULL;
 }
@@ -38,6 +38,8 @@
 #include "xwayland.h"
 #include "shared/helpers.h"
 
+/* How soon a pre-spawned X server is started again after it exits */
+#define XSERVER_RESPAWN_DELAY 100
 
 static int
 handle_sigusr1(int signal_number, void *data)
@@ -49,29 +51,46 @@ handle_sigusr1(int signal_number, void *data)
 	 * this came from Xwayland.*/
 	wxs->wm = weston_wm_create(wxs, wxs->wm_fd);
 	wl_event_source_remove(wxs->sigusr1_source);
+	wxs->sigusr1_source = NULL;
+
+	if (wxs->spawn_time_ms)
+		weston_log("xserver ready after %u ms\n",
+			   weston_compositor_get_time() - wxs->spawn_time_ms);
 
 	return 1;
 }
 
-static int
-weston_xserver_handle_event(int listen_fd, uint32_t mask, void *data)
+static void
+weston_xserver_spawn(struct weston_xserver *wxs)
 {
-	struct weston_xserver *wxs = data;
 	char display[8], s[8], abstract_fd[8], unix_fd[8], wm_fd[8];
 	int sv[2], wm[2], fd;
 	char *xserver = NULL;
 	struct weston_config_section *section;
 
+	if (wxs->process.pid != 0)
+		return;
+
 	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
 		weston_log("wl connection socketpair failed\n");
-		return 1;
+		return;
 	}
 
 	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, wm) < 0) {
 		weston_log("X wm connection socketpair failed\n");
-		return 1;
+		close(sv[0]);
+		close(sv[1]);
+		return;
 	}
 
+	/* The signal source goes away once the X server is up, a
+	 * restarted one needs it again to get its window manager. */
+	if (!wxs->sigusr1_source)
+		wxs->sigusr1_source =
+			wl_event_loop_add_signal(wxs->loop, SIGUSR1,
+						 handle_sigusr1, wxs);
+	wxs->spawn_time_ms = weston_compositor_get_time();
+
 	wxs->process.pid = fork();
 	switch (wxs->process.pid) {
 	case 0:
@@ -146,12 +165,39 @@ weston_xserver_handle_event(int listen_fd, uint32_t mask, void *data)
 
 	case -1:
 		weston_log( "failed to fork\n");
+		wxs->process.pid = 0;
+		close(sv[0]);
+		close(sv[1]);
+		close(wm[0]);
+		close(wm[1]);
 		break;
 	}
+}
+
+static int
+weston_xserver_handle_event(int listen_fd, uint32_t mask, void *data)
+{
+	struct weston_xserver *wxs = data;
+
+	weston_xserver_spawn(wxs);
 
 	return 1;
 }
 
+static int
+weston_xserver_prespawn(void *data)
+{
+	struct weston_xserver *wxs = data;
+
+	if (wxs->process.pid == 0) {
+		weston_log("pre-spawning X server on display :%d\n",
+			   wxs->display);
+		weston_xserver_spawn(wxs);
+	}
+
+	return 0;
+}
+
 static void
 weston_xserver_shutdown(struct weston_xserver *wxs)
 {
@@ -165,6 +211,14 @@ weston_xserver_shutdown(struct weston_xserver *wxs)
 		wl_event_source_remove(wxs->abstract_source);
 		wl_event_source_remove(wxs->unix_source);
 	}
+	if (wxs->prespawn_source) {
+		wl_event_source_remove(wxs->prespawn_source);
+		wxs->prespawn_source = NULL;
+	}
+	if (wxs->sigusr1_source) {
+		wl_event_source_remove(wxs->sigusr1_source);
+		wxs->sigusr1_source = NULL;
+	}
 	close(wxs->abstract_fd);
 	close(wxs->unix_fd);
 	if (wxs->wm) {
@@ -198,6 +252,13 @@ weston_xserver_cleanup(struct weston_process *process, int status)
 		weston_log("xserver exited, code %d\n", status);
 		weston_wm_destroy(wxs->wm);
 		wxs->wm = NULL;
+
+		/* Have the next one warm before the next X client
+		 * shows up; a client connecting first starts it
+		 * right away through the listening sockets. */
+		if (wxs->prespawn_source)
+			wl_event_source_timer_update(wxs->prespawn_source,
+						     XSERVER_RESPAWN_DELAY);
 	} else {
 		/* If the X server crashes before it binds to the
 		 * xserver interface, shut down and don't try
@@ -354,8 +415,10 @@ module_init(struct weston_compositor *compositor,
 
 {
 	struct wl_display *display = compositor->wl_display;
+	struct weston_config_section *section;
 	struct weston_xserver *wxs;
 	char lockfile[256], display_name[8];
+	int prespawn, prespawn_delay;
 
 	wxs = zalloc(sizeof *wxs);
 	if (wxs == NULL)
@@ -410,6 +473,23 @@ module_init(struct weston_compositor *compositor,
 
 	wxs->sigusr1_source = wl_event_loop_add_signal(wxs->loop, SIGUSR1,
 						       handle_sigusr1, wxs);
+
+	/* Modules are loaded once the shell has drawn its first frame,
+	 * so the X server start does not hold that back. */
+	section = weston_config_get_section(compositor->config,
+					    "xwayland", NULL, NULL);
+	weston_config_section_get_bool(section, "prespawn", &prespawn, 0);
+	weston_config_section_get_int(section, "prespawn-delay",
+				      &prespawn_delay, 1000);
+	if (prespawn) {
+		wxs->prespawn_source =
+			wl_event_loop_add_timer(wxs->loop,
+						weston_xserver_prespawn, wxs);
+		if (wxs->prespawn_source)
+			wl_event_source_timer_update(wxs->prespawn_source,
+						     MAX(prespawn_delay, 1));
+	}
+
 	wxs->destroy_listener.notify = weston_xserver_destroy;
 	wl_signal_add(&compositor->destroy_signal, &wxs->destroy_listener);
 
@@ -29,6 +29,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 
 #include "xwayland.h"
 #include "shared/helpers.h"
@@ -273,7 +274,13 @@ weston_wm_handle_selection_notify(struct weston_wm *wm,
 	}
 }
 
-static const size_t incr_chunk_size = 64 * 1024;
+/*
+ * Bounds on the size of one INCR chunk, and so of what is buffered
+ * between the data source pipe and the X property.  Within these, a
+ * chunk is as large as the X server accepts in one ChangeProperty.
+ */
+#define INCR_CHUNK_SIZE_MIN (64 * 1024)
+#define INCR_CHUNK_SIZE_MAX (4 * 1024 * 1024)
 
 static void
 weston_wm_send_selection_notify(struct weston_wm *wm, xcb_atom_t property)
@@ -358,28 +365,37 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 	int len, current, available;
 	void *p;
 
+	/* The buffer holds one chunk at most; once it is full, reading
+	 * stops until the requestor has taken the property. */
 	current = wm->source_data.size;
-	if (wm->source_data.size < incr_chunk_size)
-		p = wl_array_add(&wm->source_data, incr_chunk_size);
-	else
-		p = (char *) wm->source_data.data + wm->source_data.size;
-	available = wm->source_data.alloc - current;
+	if (wm->source_data.alloc < wm->incr_chunk_size) {
+		p = wl_array_add(&wm->source_data,
+				 wm->incr_chunk_size - current);
+		if (p == NULL)
+			return 1;
+		wm->source_data.size = current;
+	}
+	p = (char *) wm->source_data.data + current;
+	available = wm->incr_chunk_size - current;
 
 	len = read(fd, p, available);
 	if (len == -1) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 1;
 		weston_log("read error from data source: %m\n");
 		weston_wm_send_selection_notify(wm, XCB_ATOM_NONE);
 		wl_event_source_remove(wm->property_source);
 		wm->property_source = NULL;
 		close(fd);
 		wl_array_release(&wm->source_data);
+		return 1;
 	}
 
-	weston_log("read %d (available %d, mask 0x%x) bytes: \"%.*s\"\n",
-		len, available, mask, len, (char *) p);
+	weston_log("read %d (available %d, mask 0x%x) bytes\n",
+		len, available, mask);
 
 	wm->source_data.size = current + len;
-	if (wm->source_data.size >= incr_chunk_size) {
+	if (wm->source_data.size >= wm->incr_chunk_size) {
 		if (!wm->incr) {
 			weston_log("got %zu bytes, starting incr\n",
 				wm->source_data.size);
@@ -390,7 +406,7 @@ weston_wm_read_data_source(int fd, uint32_t mask, void *data)
 					    wm->selection_request.property,
 					    wm->atom.incr,
 					    32, /* format */
-					    1, &incr_chunk_size);
+					    1, &wm->incr_chunk_size);
 			wm->selection_property_set = 1;
 			wm->flush_property_on_delete = 1;
 			wl_event_source_remove(wm->property_source);
@@ -459,6 +475,11 @@ weston_wm_send_data(struct weston_wm *wm, xcb_atom_t target, const char *mime_ty
 		return;
 	}
 
+	/* Let a whole chunk sit in the pipe, so it is drained in a
+	 * few large reads rather than many page sized ones.  Where the
+	 * pipe cannot grow that far, the default size still works. */
+	fcntl(p[0], F_SETPIPE_SZ, wm->incr_chunk_size);
+
 	wl_array_init(&wm->source_data);
 	wm->selection_target = target;
 	wm->data_source_fd = p[0];
@@ -699,9 +720,21 @@ weston_wm_selection_init(struct weston_wm *wm)
 {
 	struct weston_seat *seat;
 	uint32_t values[1], mask;
+	uint32_t max_request;
 
 	wm->selection_request.requestor = XCB_NONE;
 
+	/* Pick the INCR chunk size from the largest request the server
+	 * takes (in 4 byte units, BIG-REQUESTS included), leaving room
+	 * for the ChangeProperty request header. */
+	max_request = xcb_get_maximum_request_length(wm->conn);
+	if (max_request > INCR_CHUNK_SIZE_MAX / 4)
+		wm->incr_chunk_size = INCR_CHUNK_SIZE_MAX;
+	else
+		wm->incr_chunk_size = max_request * 4 - 32;
+	if (wm->incr_chunk_size < INCR_CHUNK_SIZE_MIN)
+		wm->incr_chunk_size = INCR_CHUNK_SIZE_MIN;
+
 	values[0] = XCB_EVENT_MASK_PROPERTY_CHANGE;
 	wm->selection_window = xcb_generate_id(wm->conn);
 	xcb_create_window(wm->conn,
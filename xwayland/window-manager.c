@@ -34,6 +34,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <signal.h>
+#include <assert.h>
 #include <X11/Xcursor/Xcursor.h>
 #include <linux/input.h>
 
@@ -123,6 +124,8 @@ struct motif_wm_hints {
 #define _NET_WM_MOVERESIZE_MOVE_KEYBOARD    10   /* move via keyboard */
 #define _NET_WM_MOVERESIZE_CANCEL           11   /* cancel operation */
 
+#define WM_WINDOW_PROPERTY_COUNT 11
+
 struct weston_wm_window {
 	struct weston_wm *wm;
 	xcb_window_t id;
@@ -135,8 +138,14 @@ struct weston_wm_window {
 	struct weston_view *view;
 	struct wl_listener surface_destroy_listener;
 	struct wl_event_source *repaint_source;
-	struct wl_event_source *configure_source;
+	uint32_t configure_pending;
+	struct wl_list configure_link;
 	int properties_dirty;
+	int properties_pending;
+	xcb_get_property_cookie_t property_cookies[WM_WINDOW_PROPERTY_COUNT];
+	int geometry_pending;
+	xcb_get_geometry_cookie_t geometry_cookie;
+	struct wl_list fetch_link;
 	int pid;
 	char *machine;
 	char *class;
@@ -154,6 +163,7 @@ struct weston_wm_window {
 	int delete_window;
 	int maximized_vert;
 	int maximized_horz;
+	uint32_t map_request_ms;
 	struct wm_size_hints size_hints;
 	struct motif_wm_hints motif_hints;
 	struct wl_list link;
@@ -162,9 +172,23 @@ struct weston_wm_window {
 static struct weston_wm_window *
 get_wm_window(struct weston_surface *surface);
 
+static int
+weston_wm_handle_event(int fd, uint32_t mask, void *data);
+
 static void
 weston_wm_window_schedule_repaint(struct weston_wm_window *window);
 
+/* Changes to the X side of a window, sent by weston_wm_flush() */
+#define WM_CONFIGURE_SIZE	(1 << 0)
+#define WM_CONFIGURE_MOVE	(1 << 1)
+
+static void
+weston_wm_window_queue_configure(struct weston_wm_window *window,
+				 uint32_t flags);
+
+static void
+weston_wm_schedule_flush(struct weston_wm *wm);
+
 static void
 xserver_map_shell_surface(struct weston_wm_window *window,
 			  struct weston_surface *surface);
@@ -387,19 +411,18 @@ read_and_dump_property(struct weston_wm *wm,
 #define TYPE_NET_WM_STATE	XCB_ATOM_CUT_BUFFER2
 #define TYPE_WM_NORMAL_HINTS	XCB_ATOM_CUT_BUFFER3
 
+struct wm_property_desc {
+	xcb_atom_t atom;
+	xcb_atom_t type;
+	int offset;
+};
+
 static void
-weston_wm_window_read_properties(struct weston_wm_window *window)
+weston_wm_get_property_descs(struct weston_wm *wm,
+			     struct wm_property_desc *desc)
 {
-	struct weston_wm *wm = window->wm;
-	struct weston_shell_interface *shell_interface =
-		&wm->server->compositor->shell_interface;
-
 #define F(field) offsetof(struct weston_wm_window, field)
-	const struct {
-		xcb_atom_t atom;
-		xcb_atom_t type;
-		int offset;
-	} props[] = {
+	const struct wm_property_desc props[] = {
 		{ XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, F(class) },
 		{ XCB_ATOM_WM_NAME, XCB_ATOM_STRING, F(name) },
 		{ XCB_ATOM_WM_TRANSIENT_FOR, XCB_ATOM_WINDOW, F(transient_for) },
@@ -414,24 +437,106 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	};
 #undef F
 
-	xcb_get_property_cookie_t cookie[ARRAY_LENGTH(props)];
+	assert(ARRAY_LENGTH(props) == WM_WINDOW_PROPERTY_COUNT);
+	memcpy(desc, props, sizeof props);
+}
+
+/* Send the GetProperty requests for all the properties we track
+ * without waiting for the replies.  The replies are collected in
+ * weston_wm_window_read_properties() when the window is mapped or
+ * repainted, so a burst of new windows or property changes costs a
+ * single round trip instead of one per window. */
+static void
+weston_wm_window_fetch_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct wm_property_desc props[WM_WINDOW_PROPERTY_COUNT];
+	uint32_t i;
+
+	if (window->properties_pending)
+		return;
+
+	weston_wm_get_property_descs(wm, props);
+	for (i = 0; i < ARRAY_LENGTH(props); i++)
+		window->property_cookies[i] =
+			xcb_get_property(wm->conn,
+					 0, /* delete */
+					 window->id,
+					 props[i].atom,
+					 XCB_ATOM_ANY, 0, 2048);
+	window->properties_pending = 1;
+}
+
+static void
+weston_wm_window_discard_properties(struct weston_wm_window *window)
+{
+	uint32_t i;
+
+	if (!window->properties_pending)
+		return;
+
+	for (i = 0; i < ARRAY_LENGTH(window->property_cookies); i++)
+		xcb_discard_reply(window->wm->conn,
+				  window->property_cookies[i].sequence);
+	window->properties_pending = 0;
+}
+
+static void
+weston_wm_window_schedule_fetch(struct weston_wm_window *window)
+{
+	if (wl_list_empty(&window->fetch_link))
+		wl_list_insert(window->wm->fetch_list.prev,
+			       &window->fetch_link);
+}
+
+static void
+weston_wm_window_read_geometry(struct weston_wm_window *window)
+{
+	xcb_get_geometry_reply_t *geometry_reply;
+
+	if (!window->geometry_pending)
+		return;
+	window->geometry_pending = 0;
+
+	geometry_reply = xcb_get_geometry_reply(window->wm->conn,
+						window->geometry_cookie, NULL);
+	/* technically we should use XRender and check the visual format's
+	alpha_mask, but checking depth is simpler and works in all known cases */
+	if (geometry_reply != NULL)
+		window->has_alpha = geometry_reply->depth == 32;
+	free(geometry_reply);
+}
+
+static void
+weston_wm_window_read_properties(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	struct weston_shell_interface *shell_interface =
+		&wm->server->compositor->shell_interface;
+	struct wm_property_desc props[WM_WINDOW_PROPERTY_COUNT];
 	xcb_get_property_reply_t *reply;
 	void *p;
 	uint32_t *xid;
 	xcb_atom_t *atom;
-	uint32_t i;
+	uint32_t i, j;
 	char name[1024];
 
+	weston_wm_window_read_geometry(window);
+
 	if (!window->properties_dirty)
 		return;
 	window->properties_dirty = 0;
 
-	for (i = 0; i < ARRAY_LENGTH(props); i++)
-		cookie[i] = xcb_get_property(wm->conn,
-					     0, /* delete */
-					     window->id,
-					     props[i].atom,
-					     XCB_ATOM_ANY, 0, 2048);
+	/* The property may have changed after the prefetched requests
+	 * went out; in that case the fetch was discarded and we have
+	 * to ask again now. */
+	weston_wm_get_property_descs(wm, props);
+	weston_wm_window_fetch_properties(window);
+	window->properties_pending = 0;
+	if (!wl_list_empty(&window->fetch_link)) {
+		wl_list_remove(&window->fetch_link);
+		wl_list_init(&window->fetch_link);
+	}
 
 	window->decorate = window->override_redirect ? 0 : MWM_DECOR_EVERYTHING;
 	window->size_hints.flags = 0;
@@ -439,7 +544,9 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 	window->delete_window = 0;
 
 	for (i = 0; i < ARRAY_LENGTH(props); i++)  {
-		reply = xcb_get_property_reply(wm->conn, cookie[i], NULL);
+		reply = xcb_get_property_reply(wm->conn,
+					       window->property_cookies[i],
+					       NULL);
 		if (!reply)
 			/* Bad window, typically */
 			continue;
@@ -476,8 +583,8 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 			break;
 		case TYPE_WM_PROTOCOLS:
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++)
-				if (atom[i] == wm->atom.wm_delete_window) {
+			for (j = 0; j < reply->value_len; j++)
+				if (atom[j] == wm->atom.wm_delete_window) {
 					window->delete_window = 1;
 					break;
 				}
@@ -490,12 +597,12 @@ weston_wm_window_read_properties(struct weston_wm_window *window)
 		case TYPE_NET_WM_STATE:
 			window->fullscreen = 0;
 			atom = xcb_get_property_value(reply);
-			for (i = 0; i < reply->value_len; i++) {
-				if (atom[i] == wm->atom.net_wm_state_fullscreen)
+			for (j = 0; j < reply->value_len; j++) {
+				if (atom[j] == wm->atom.net_wm_state_fullscreen)
 					window->fullscreen = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_vert)
+				if (atom[j] == wm->atom.net_wm_state_maximized_vert)
 					window->maximized_vert = 1;
-				if (atom[i] == wm->atom.net_wm_state_maximized_horz)
+				if (atom[j] == wm->atom.net_wm_state_maximized_horz)
 					window->maximized_horz = 1;
 			}
 			break;
@@ -726,6 +833,7 @@ weston_wm_create_surface(struct wl_listener *listener, void *data)
 	wl_list_for_each(window, &wm->unpaired_window_list, link)
 		if (window->surface_id ==
 		    wl_resource_get_id(surface->resource)) {
+			wm->pair_stats.deferred++;
 			xserver_map_shell_surface(window, surface);
 			window->surface_id = 0;
 			wl_list_remove(&window->link);
@@ -733,6 +841,30 @@ weston_wm_create_surface(struct wl_listener *listener, void *data)
 		}
 }
 
+/* Xwayland creates the wl_surface, then sends WL_SURFACE_ID over X,
+ * and may commit the first buffer before we read that message. Read
+ * it now, so the window is paired and the commit maps it instead of
+ * the next one. */
+static void
+weston_wm_surface_commit(struct wl_listener *listener, void *data)
+{
+	struct weston_surface *surface = data;
+	struct weston_wm *wm =
+		container_of(listener, struct weston_wm, commit_listener);
+
+	if (wl_resource_get_client(surface->resource) != wm->server->client)
+		return;
+
+	/* Paired already, or used as a cursor */
+	if (surface->configure || get_wm_window(surface))
+		return;
+
+	weston_wm_handle_event(-1, 0, wm);
+
+	if (get_wm_window(surface))
+		wm->pair_stats.on_commit++;
+}
+
 static void
 weston_wm_send_focus_window(struct weston_wm *wm,
 			    struct weston_wm_window *window)
@@ -740,8 +872,6 @@ weston_wm_send_focus_window(struct weston_wm *wm,
 	xcb_client_message_event_t client_message;
 
 	if (window) {
-		uint32_t values[1];
-
 		if (window->override_redirect)
 			return;
 
@@ -759,9 +889,10 @@ weston_wm_send_focus_window(struct weston_wm *wm,
 		xcb_set_input_focus (wm->conn, XCB_INPUT_FOCUS_POINTER_ROOT,
 				     window->id, XCB_TIME_CURRENT_TIME);
 
-		values[0] = XCB_STACK_MODE_ABOVE;
-		xcb_configure_window (wm->conn, window->frame_id,
-				      XCB_CONFIG_WINDOW_STACK_MODE, values);
+		/* Only the last window activated in this loop
+		 * iteration needs raising. */
+		wm->raise_window = window;
+		weston_wm_schedule_flush(wm);
 	} else {
 		xcb_set_input_focus (wm->conn,
 				     XCB_INPUT_FOCUS_POINTER_ROOT,
@@ -804,7 +935,6 @@ weston_wm_window_transform(struct wl_listener *listener, void *data)
 	struct weston_wm_window *window = get_wm_window(surface);
 	struct weston_wm *wm =
 		container_of(listener, struct weston_wm, transform_listener);
-	uint32_t mask, values[2];
 
 	if (!window || !wm)
 		return;
@@ -813,14 +943,8 @@ weston_wm_window_transform(struct wl_listener *listener, void *data)
 		return;
 
 	if (window->x != window->view->geometry.x ||
-	    window->y != window->view->geometry.y) {
-		values[0] = window->view->geometry.x;
-		values[1] = window->view->geometry.y;
-		mask = XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y;
-
-		xcb_configure_window(wm->conn, window->frame_id, mask, values);
-		xcb_flush(wm->conn);
-	}
+	    window->y != window->view->geometry.y)
+		weston_wm_window_queue_configure(window, WM_CONFIGURE_MOVE);
 }
 
 #define ICCCM_WITHDRAWN_STATE	0
@@ -975,6 +1099,9 @@ weston_wm_handle_map_request(struct weston_wm *wm, xcb_generic_event_t *event)
 	if (window->frame_id == XCB_WINDOW_NONE)
 		weston_wm_window_create_frame(window);
 
+	if (!window->surface)
+		window->map_request_ms = weston_compositor_get_time();
+
 	wm_log("XCB_MAP_REQUEST (window %d, %p, frame %d)\n",
 	       window->id, window, window->frame_id);
 
@@ -1074,7 +1201,7 @@ weston_wm_window_draw_decoration(void *data)
 		if (wm->focus_window == window)
 			flags |= THEME_FRAME_ACTIVE;
 
-		frame_repaint(window->frame, cr);
+		frame_repaint_damage(window->frame, cr);
 	} else {
 		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
 		cairo_set_source_rgba(cr, 0, 0, 0, 0);
@@ -1115,6 +1242,8 @@ weston_wm_window_draw_decoration(void *data)
 
 		pixman_region32_init_rect(&window->surface->pending.input,
 					  input_x, input_y, input_w, input_h);
+		window->surface->pending.dirty |= WESTON_SURFACE_STATE_OPAQUE |
+						  WESTON_SURFACE_STATE_INPUT;
 
 		shell_interface->set_window_geometry(window->shsurf,
 						     input_x, input_y, input_w, input_h);
@@ -1129,6 +1258,7 @@ weston_wm_window_schedule_repaint(struct weston_wm_window *window)
 
 	if (window->frame_id == XCB_WINDOW_NONE) {
 		if (window->surface != NULL) {
+			weston_wm_window_read_geometry(window);
 			weston_wm_window_get_frame_size(window, &width, &height);
 			pixman_region32_fini(&window->surface->pending.opaque);
 			if (window->has_alpha) {
@@ -1137,6 +1267,8 @@ weston_wm_window_schedule_repaint(struct weston_wm_window *window)
 				pixman_region32_init_rect(&window->surface->pending.opaque, 0, 0,
 							  width, height);
 			}
+			window->surface->pending.dirty |=
+				WESTON_SURFACE_STATE_OPAQUE;
 			if (window->view)
 				weston_view_geometry_dirty(window->view);
 		}
@@ -1163,6 +1295,8 @@ weston_wm_handle_property_notify(struct weston_wm *wm, xcb_generic_event_t *even
 		return;
 
 	window->properties_dirty = 1;
+	weston_wm_window_discard_properties(window);
+	weston_wm_window_schedule_fetch(window);
 
 	wm_log("XCB_PROPERTY_NOTIFY: window %d, ", property_notify->window);
 	if (property_notify->state == XCB_PROPERTY_DELETE)
@@ -1182,8 +1316,6 @@ weston_wm_window_create(struct weston_wm *wm,
 {
 	struct weston_wm_window *window;
 	uint32_t values[1];
-	xcb_get_geometry_cookie_t geometry_cookie;
-	xcb_get_geometry_reply_t *geometry_reply;
 
 	window = zalloc(sizeof *window);
 	if (window == NULL) {
@@ -1191,7 +1323,8 @@ weston_wm_window_create(struct weston_wm *wm,
 		return;
 	}
 
-	geometry_cookie = xcb_get_geometry(wm->conn, id);
+	window->geometry_cookie = xcb_get_geometry(wm->conn, id);
+	window->geometry_pending = 1;
 
 	values[0] = XCB_EVENT_MASK_PROPERTY_CHANGE |
                     XCB_EVENT_MASK_FOCUS_CHANGE;
@@ -1205,15 +1338,11 @@ weston_wm_window_create(struct weston_wm *wm,
 	window->height = height;
 	window->x = x;
 	window->y = y;
-
-	geometry_reply = xcb_get_geometry_reply(wm->conn, geometry_cookie, NULL);
-	/* technically we should use XRender and check the visual format's
-	alpha_mask, but checking depth is simpler and works in all known cases */
-	if (geometry_reply != NULL)
-		window->has_alpha = geometry_reply->depth == 32;
-	free(geometry_reply);
+	wl_list_init(&window->fetch_link);
+	wl_list_init(&window->configure_link);
 
 	hash_table_insert(wm->window_hash, id, window);
+	weston_wm_window_fetch_properties(window);
 }
 
 static void
@@ -1226,6 +1355,14 @@ weston_wm_window_destroy(struct weston_wm_window *window)
 	if (window->cairo_surface)
 		cairo_surface_destroy(window->cairo_surface);
 
+	weston_wm_window_discard_properties(window);
+	if (window->geometry_pending)
+		xcb_discard_reply(wm->conn, window->geometry_cookie.sequence);
+	wl_list_remove(&window->fetch_link);
+	wl_list_remove(&window->configure_link);
+	if (wm->raise_window == window)
+		wm->raise_window = NULL;
+
 	if (window->frame_id) {
 		xcb_reparent_window(wm->conn, window->id, wm->wm_window, 0, 0);
 		xcb_destroy_window(wm->conn, window->frame_id);
@@ -1417,9 +1554,6 @@ update_state(int action, int *state)
 	return changed;
 }
 
-static void
-weston_wm_window_configure(void *data);
-
 static void
 weston_wm_window_set_toplevel(struct weston_wm_window *window)
 {
@@ -1433,7 +1567,7 @@ weston_wm_window_set_toplevel(struct weston_wm_window *window)
 		frame_resize_inside(window->frame,
 					window->width,
 					window->height);
-	weston_wm_window_configure(window);
+	weston_wm_window_queue_configure(window, WM_CONFIGURE_SIZE);
 }
 
 static inline bool
@@ -1907,6 +2041,7 @@ static int
 weston_wm_handle_event(int fd, uint32_t mask, void *data)
 {
 	struct weston_wm *wm = data;
+	struct weston_wm_window *window, *next;
 	xcb_generic_event_t *event;
 	int count = 0;
 
@@ -1979,6 +2114,14 @@ weston_wm_handle_event(int fd, uint32_t mask, void *data)
 		count++;
 	}
 
+	/* Refetch the properties of every window that saw a
+	 * PropertyNotify in this batch, once per window. */
+	wl_list_for_each_safe(window, next, &wm->fetch_list, fetch_link) {
+		wl_list_remove(&window->fetch_link);
+		wl_list_init(&window->fetch_link);
+		weston_wm_window_fetch_properties(window);
+	}
+
 	xcb_flush(wm->conn);
 
 	return count;
@@ -2282,6 +2425,9 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 	wm->create_surface_listener.notify = weston_wm_create_surface;
 	wl_signal_add(&wxs->compositor->create_surface_signal,
 		      &wm->create_surface_listener);
+	wm->commit_listener.notify = weston_wm_surface_commit;
+	wl_signal_add(&wxs->compositor->commit_signal,
+		      &wm->commit_listener);
 	wm->activate_listener.notify = weston_wm_window_activate;
 	wl_signal_add(&wxs->compositor->activate_signal,
 		      &wm->activate_listener);
@@ -2292,6 +2438,8 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 	wl_signal_add(&wxs->compositor->kill_signal,
 		      &wm->kill_listener);
 	wl_list_init(&wm->unpaired_window_list);
+	wl_list_init(&wm->fetch_list);
+	wl_list_init(&wm->configure_list);
 
 	weston_wm_create_cursors(wm);
 	weston_wm_window_set_cursor(wm, wm->screen->root, XWM_CURSOR_LEFT_PTR);
@@ -2308,6 +2456,14 @@ weston_wm_create(struct weston_xserver *wxs, int fd)
 void
 weston_wm_destroy(struct weston_wm *wm)
 {
+	if (wm->pair_stats.count > 0)
+		weston_log("xwm: paired %u windows, %u ms average, "
+			   "%u ms max; %u on first commit, %u deferred\n",
+			   wm->pair_stats.count,
+			   wm->pair_stats.total_ms / wm->pair_stats.count,
+			   wm->pair_stats.max_ms, wm->pair_stats.on_commit,
+			   wm->pair_stats.deferred);
+
 	/* FIXME: Free windows in hash. */
 	hash_table_destroy(wm->window_hash);
 	weston_wm_destroy_cursors(wm);
@@ -2318,6 +2474,9 @@ weston_wm_destroy(struct weston_wm *wm)
 	wl_list_remove(&wm->kill_listener.link);
 	wl_list_remove(&wm->transform_listener.link);
 	wl_list_remove(&wm->create_surface_listener.link);
+	wl_list_remove(&wm->commit_listener.link);
+	if (wm->flush_source)
+		wl_event_source_remove(wm->flush_source);
 
 	free(wm);
 }
@@ -2336,9 +2495,8 @@ get_wm_window(struct weston_surface *surface)
 }
 
 static void
-weston_wm_window_configure(void *data)
+weston_wm_window_configure(struct weston_wm_window *window)
 {
-	struct weston_wm_window *window = data;
 	struct weston_wm *wm = window->wm;
 	uint32_t values[4];
 	int x, y, width, height;
@@ -2365,16 +2523,94 @@ weston_wm_window_configure(void *data)
 			     XCB_CONFIG_WINDOW_HEIGHT,
 			     values);
 
-	window->configure_source = NULL;
-
 	weston_wm_window_schedule_repaint(window);
 }
 
+static void
+weston_wm_window_move_frame(struct weston_wm_window *window)
+{
+	struct weston_wm *wm = window->wm;
+	uint32_t values[2];
+
+	if (!window->view || !weston_view_is_mapped(window->view))
+		return;
+
+	if (window->x == window->view->geometry.x &&
+	    window->y == window->view->geometry.y)
+		return;
+
+	values[0] = window->view->geometry.x;
+	values[1] = window->view->geometry.y;
+	xcb_configure_window(wm->conn, window->frame_id,
+			     XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y,
+			     values);
+}
+
+/* Send everything the compositor changed on the X windows during
+ * this loop iteration, once per window, and flush once. */
+static void
+weston_wm_flush(void *data)
+{
+	struct weston_wm *wm = data;
+	struct weston_wm_window *window, *next;
+	uint32_t pending, values[1];
+
+	wm->flush_source = NULL;
+
+	wl_list_for_each_safe(window, next, &wm->configure_list,
+			      configure_link) {
+		wl_list_remove(&window->configure_link);
+		wl_list_init(&window->configure_link);
+		pending = window->configure_pending;
+		window->configure_pending = 0;
+
+		if (pending & WM_CONFIGURE_SIZE)
+			weston_wm_window_configure(window);
+		if (pending & WM_CONFIGURE_MOVE &&
+		    window->frame_id != XCB_WINDOW_NONE)
+			weston_wm_window_move_frame(window);
+	}
+
+	window = wm->raise_window;
+	wm->raise_window = NULL;
+	if (window && window->frame_id != XCB_WINDOW_NONE) {
+		values[0] = XCB_STACK_MODE_ABOVE;
+		xcb_configure_window(wm->conn, window->frame_id,
+				     XCB_CONFIG_WINDOW_STACK_MODE, values);
+	}
+
+	xcb_flush(wm->conn);
+}
+
+static void
+weston_wm_schedule_flush(struct weston_wm *wm)
+{
+	if (wm->flush_source)
+		return;
+
+	wm->flush_source =
+		wl_event_loop_add_idle(wm->server->loop,
+				       weston_wm_flush, wm);
+}
+
+static void
+weston_wm_window_queue_configure(struct weston_wm_window *window,
+				 uint32_t flags)
+{
+	struct weston_wm *wm = window->wm;
+
+	window->configure_pending |= flags;
+	if (wl_list_empty(&window->configure_link))
+		wl_list_insert(wm->configure_list.prev,
+			       &window->configure_link);
+
+	weston_wm_schedule_flush(wm);
+}
+
 static void
 send_configure(struct weston_surface *surface, int32_t width, int32_t height)
 {
 	struct weston_wm_window *window = get_wm_window(surface);
-	struct weston_wm *wm = window->wm;
 	struct theme *t = window->wm->theme;
 	int vborder, hborder;
 
@@ -2399,12 +2635,7 @@ send_configure(struct weston_surface *surface, int32_t width, int32_t height)
 	if (window->frame)
 		frame_resize_inside(window->frame, window->width, window->height);
 
-	if (window->configure_source)
-		return;
-
-	window->configure_source =
-		wl_event_loop_add_idle(wm->server->loop,
-				       weston_wm_window_configure, window);
+	weston_wm_window_queue_configure(window, WM_CONFIGURE_SIZE);
 }
 
 static const struct weston_shell_client shell_client = {
@@ -2479,6 +2710,7 @@ xserver_map_shell_surface(struct weston_wm_window *window,
 		&wm->server->compositor->shell_interface;
 	struct weston_output *output;
 	struct weston_wm_window *parent;
+	uint32_t latency;
 	int flags = 0;
 
 	weston_wm_window_read_properties(window);
@@ -2494,6 +2726,19 @@ xserver_map_shell_surface(struct weston_wm_window *window,
 	wl_signal_add(&window->surface->destroy_signal,
 		      &window->surface_destroy_listener);
 
+	if (window->map_request_ms) {
+		latency = weston_compositor_get_time() -
+			  window->map_request_ms;
+		window->map_request_ms = 0;
+		wm->pair_stats.count++;
+		wm->pair_stats.total_ms += latency;
+		if (latency > wm->pair_stats.max_ms)
+			wm->pair_stats.max_ms = latency;
+		wm_log("window %d paired with surface %u after %u ms\n",
+		       window->id, wl_resource_get_id(surface->resource),
+		       latency);
+	}
+
 	weston_wm_window_schedule_repaint(window);
 
 	if (!shell_interface->create_shell_surface)
@@ -45,6 +45,8 @@ struct weston_xserver {
 	int wm_fd;
 	int display;
 	struct wl_event_source *sigusr1_source;
+	struct wl_event_source *prespawn_source;
+	uint32_t spawn_time_ms;
 	struct weston_process process;
 	struct wl_resource *resource;
 	struct wl_client *client;
@@ -69,10 +71,24 @@ struct weston_wm {
 	xcb_visualid_t visual_id;
 	xcb_colormap_t colormap;
 	struct wl_listener create_surface_listener;
+	struct wl_listener commit_listener;
 	struct wl_listener activate_listener;
 	struct wl_listener transform_listener;
 	struct wl_listener kill_listener;
 	struct wl_list unpaired_window_list;
+	struct wl_list fetch_list;
+	struct wl_list configure_list;
+	struct wl_event_source *flush_source;
+	struct weston_wm_window *raise_window;
+
+	/* Time from MapRequest until the window has its wl_surface */
+	struct {
+		uint32_t count;
+		uint32_t total_ms;
+		uint32_t max_ms;
+		uint32_t on_commit;
+		uint32_t deferred;
+	} pair_stats;
 
 	xcb_window_t selection_window;
 	xcb_window_t selection_owner;
@@ -82,6 +98,7 @@ struct weston_wm {
 	xcb_get_property_reply_t *property_reply;
 	int property_start;
 	struct wl_array source_data;
+	uint32_t incr_chunk_size;
 	xcb_selection_request_event_t selection_request;
 	xcb_atom_t selection_target;
 	xcb_timestamp_t selection_timestamp;